@@ -0,0 +1,613 @@
+/*
+ ============================================================================
+ Name        : hev-bench-flow.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bench Flow Generator
+ ============================================================================
+ */
+
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "hev-bench-server.h"
+#include "hev-bench-flow.h"
+
+#define PKT_SIZE (65536)
+#define RECV_BATCH (256)
+#define TIMER_INTERVAL_US (50 * 1000)
+#define SYN_RTO_US (1000 * 1000)
+#define DATA_RTO_US (250 * 1000)
+#define OUR_WSCALE (7)
+
+#define TCP_FIN (0x01)
+#define TCP_SYN (0x02)
+#define TCP_RST (0x04)
+#define TCP_PSH (0x08)
+#define TCP_ACK (0x10)
+
+static uint8_t pkt[PKT_SIZE];
+static uint16_t ip_id;
+
+uint64_t
+hev_bench_now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+hist_index (uint64_t us)
+{
+    int e;
+
+    if (us < 16)
+        return us;
+
+    e = 63 - __builtin_clzll (us);
+    return (e - 3) * 16 + ((us >> (e - 4)) & 15);
+}
+
+static uint64_t
+hist_value (int index)
+{
+    int e;
+
+    if (index < 16)
+        return index;
+
+    e = index / 16 + 3;
+    return (uint64_t)(16 + index % 16) << (e - 4);
+}
+
+void
+hev_bench_hist_add (HevBenchHist *self, uint64_t us)
+{
+    self->buckets[hist_index (us)]++;
+    self->count++;
+}
+
+uint64_t
+hev_bench_hist_percentile (HevBenchHist *self, double p)
+{
+    uint64_t rank, sum = 0;
+    int i;
+
+    if (!self->count)
+        return 0;
+
+    rank = (uint64_t)(p * (self->count - 1)) + 1;
+    for (i = 0; i < HEV_BENCH_HIST_BUCKETS; i++) {
+        sum += self->buckets[i];
+        if (sum >= rank)
+            return hist_value (i);
+    }
+
+    return hist_value (HEV_BENCH_HIST_BUCKETS - 1);
+}
+
+static uint32_t
+csum_add (uint32_t sum, const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+    if (len & 1)
+        sum += data[len - 1] << 8;
+
+    return sum;
+}
+
+static uint16_t
+csum_fold (uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum & 0xffff;
+}
+
+static void
+put16 (uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void
+put32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint16_t
+get16 (const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Fill the IPv4 header and return the pseudo header sum for the L4 one. */
+static uint32_t
+ip4_header (HevBenchFlows *self, int proto, unsigned int l4_len)
+{
+    uint8_t pseudo[12];
+
+    memset (pkt, 0, 20);
+    pkt[0] = 0x45;
+    put16 (pkt + 2, 20 + l4_len);
+    put16 (pkt + 4, ip_id++);
+    pkt[8] = 64;
+    pkt[9] = proto;
+    put32 (pkt + 12, self->saddr);
+    put32 (pkt + 16, self->daddr);
+    put16 (pkt + 10, csum_fold (csum_add (0, pkt, 20)));
+
+    memcpy (pseudo, pkt + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = proto;
+    put16 (pseudo + 10, l4_len);
+
+    return csum_add (0, pseudo, sizeof (pseudo));
+}
+
+static void
+flows_write (HevBenchFlows *self, size_t len)
+{
+    ssize_t s;
+
+    do {
+        s = write (self->fd, pkt, len);
+    } while (s < 0 && errno == EINTR);
+
+    if (s > 0)
+        self->tx_packets++;
+}
+
+static uint32_t
+seq_of (HevBenchTCP *f, uint64_t off)
+{
+    return f->iss + 1 + (uint32_t)off;
+}
+
+static void
+tcp_output (HevBenchFlows *self, HevBenchTCP *f, int flags, uint32_t seq,
+            unsigned int len)
+{
+    unsigned int hlen = 20;
+    uint32_t sum;
+    uint8_t *t;
+
+    if (flags & TCP_SYN)
+        hlen += 8;
+
+    t = pkt + 20;
+    sum = ip4_header (self, IPPROTO_TCP, hlen + len);
+    memset (t, 0, hlen);
+    put16 (t, f->sport);
+    put16 (t + 2, f->dport);
+    put32 (t + 4, seq);
+    if (flags & TCP_ACK)
+        put32 (t + 8, f->rcv_nxt);
+    t[12] = (hlen / 4) << 4;
+    t[13] = flags;
+    put16 (t + 14, 0xffff);
+
+    if (flags & TCP_SYN) {
+        t[20] = 2;
+        t[21] = 4;
+        put16 (t + 22, self->mss);
+        t[24] = 1;
+        t[25] = 3;
+        t[26] = 3;
+        t[27] = OUR_WSCALE;
+    }
+
+    /* The payload is whatever the buffer holds; only its length matters. */
+    sum = csum_add (sum, t, hlen + len);
+    put16 (t + 16, csum_fold (sum));
+
+    flows_write (self, 20 + hlen + len);
+    f->need_ack = 0;
+}
+
+static void
+tcp_kick (HevBenchFlows *self, int index)
+{
+    HevBenchTCP *f = &self->tcps[index];
+
+    if (f->busy)
+        return;
+
+    f->busy = 1;
+    self->busy[self->busy_count++] = index;
+}
+
+static void
+tcp_push (HevBenchFlows *self, HevBenchTCP *f)
+{
+    if (f->state != HEV_BENCH_TCP_ESTABLISHED) {
+        if (f->need_ack && f->state == HEV_BENCH_TCP_DONE)
+            tcp_output (self, f, TCP_ACK, seq_of (f, f->nxt), 0);
+        return;
+    }
+
+    for (;;) {
+        uint64_t in_flight = f->nxt - f->una;
+        uint64_t len;
+
+        if (f->nxt < f->limit) {
+            if (in_flight >= f->snd_wnd)
+                break;
+
+            len = f->limit - f->nxt;
+            if (len > (uint64_t)self->mss)
+                len = self->mss;
+            if (len > f->snd_wnd - in_flight)
+                len = f->snd_wnd - in_flight;
+            /* Wait for a full segment while others are in flight. */
+            if (len < (uint64_t)self->mss && len < f->limit - f->nxt &&
+                in_flight)
+                break;
+
+            tcp_output (self, f, TCP_ACK | TCP_PSH, seq_of (f, f->nxt), len);
+            f->nxt += len;
+        } else if (f->want_fin && f->nxt == f->limit) {
+            tcp_output (self, f, TCP_ACK | TCP_FIN, seq_of (f, f->nxt), 0);
+            f->nxt++;
+        } else {
+            break;
+        }
+
+        if (f->max < f->nxt)
+            f->max = f->nxt;
+    }
+
+    if (f->need_ack)
+        tcp_output (self, f, TCP_ACK, seq_of (f, f->nxt), 0);
+}
+
+static void
+tcp_parse_wscale (HevBenchTCP *f, const uint8_t *opt, unsigned int len)
+{
+    unsigned int i = 0;
+
+    while (i < len) {
+        unsigned int kind = opt[i];
+
+        if (kind == 0)
+            break;
+        if (kind == 1) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len || opt[i + 1] < 2 || i + opt[i + 1] > len)
+            break;
+        if (kind == 3 && opt[i + 1] == 3)
+            f->wscale = opt[i + 2] > 14 ? 14 : opt[i + 2];
+        i += opt[i + 1];
+    }
+}
+
+static void
+tcp_input (HevBenchFlows *self, const uint8_t *t, unsigned int len)
+{
+    unsigned int hlen, dlen, index;
+    uint32_t seq, ack, off;
+    HevBenchTCP *f;
+    uint64_t now;
+    int flags;
+
+    if (len < 20)
+        return;
+
+    index = get16 (t + 2) - self->tcp_port_base;
+    if (index >= (unsigned int)self->tcp_count)
+        return;
+
+    f = &self->tcps[index];
+    if (get16 (t) != f->dport || f->state == HEV_BENCH_TCP_CLOSED)
+        return;
+
+    hlen = (t[12] >> 4) * 4;
+    if (hlen < 20 || hlen > len)
+        return;
+
+    seq = get32 (t + 4);
+    ack = get32 (t + 8);
+    flags = t[13];
+    dlen = len - hlen;
+    now = hev_bench_now_us ();
+
+    if (flags & TCP_RST) {
+        if (f->state != HEV_BENCH_TCP_DONE && f->state != HEV_BENCH_TCP_RESET)
+            self->resets++;
+        f->state = HEV_BENCH_TCP_RESET;
+        return;
+    }
+
+    if (f->state == HEV_BENCH_TCP_SYN_SENT) {
+        if ((flags & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK) ||
+            ack != f->iss + 1)
+            return;
+
+        tcp_parse_wscale (f, t + 20, hlen - 20);
+        f->rcv_nxt = seq + 1;
+        f->snd_wnd = get16 (t + 14);
+        f->state = HEV_BENCH_TCP_ESTABLISHED;
+        f->progress_time = now;
+        f->need_ack = 1;
+        hev_bench_hist_add (&self->syn_ack, now - f->syn_time);
+        tcp_kick (self, index);
+        return;
+    }
+
+    if (flags & TCP_ACK) {
+        uint64_t acked = (uint32_t)(ack - seq_of (f, f->una));
+
+        if (acked && acked <= f->max - f->una) {
+            f->una += acked;
+            if (f->nxt < f->una)
+                f->nxt = f->una;
+            f->progress_time = now;
+        }
+        f->snd_wnd = (uint32_t)get16 (t + 14) << f->wscale;
+        tcp_kick (self, index);
+    }
+
+    if (dlen || (flags & TCP_FIN)) {
+        off = f->rcv_nxt - seq;
+        if ((int32_t)off < 0) {
+            self->out_of_order++;
+        } else if (off < dlen) {
+            if (!f->rcvd)
+                hev_bench_hist_add (&self->first_byte, now - f->syn_time);
+            f->rcv_nxt += dlen - off;
+            f->rcvd += dlen - off;
+        }
+        if ((flags & TCP_FIN) && seq + dlen == f->rcv_nxt) {
+            f->rcv_nxt++;
+            f->peer_fin = 1;
+        }
+        f->need_ack = 1;
+        tcp_kick (self, index);
+    }
+
+    if (f->state == HEV_BENCH_TCP_ESTABLISHED && f->want_fin &&
+        f->peer_fin && f->una == f->limit + 1)
+        f->state = HEV_BENCH_TCP_DONE;
+}
+
+static void
+udp_input (HevBenchFlows *self, const uint8_t *u, unsigned int len)
+{
+    uint16_t port;
+    uint64_t ts;
+
+    if (len < 8 + sizeof (ts))
+        return;
+
+    port = get16 (u + 2);
+    memcpy (&ts, u + 8, sizeof (ts));
+    hev_bench_hist_add (&self->udp_rtt, hev_bench_now_us () - ts);
+    self->udp_pending[port] = 0;
+    self->udp_rcvd++;
+}
+
+static void
+flows_input (HevBenchFlows *self, const uint8_t *p, size_t len)
+{
+    unsigned int ihl, tot;
+
+    if (len < 20 || (p[0] >> 4) != 4)
+        return;
+
+    ihl = (p[0] & 15) * 4;
+    tot = get16 (p + 2);
+    if (ihl < 20 || tot > len || tot < ihl)
+        return;
+
+    self->rx_packets++;
+
+    switch (p[9]) {
+    case IPPROTO_TCP:
+        tcp_input (self, p + ihl, tot - ihl);
+        break;
+    case IPPROTO_UDP:
+        udp_input (self, p + ihl, tot - ihl);
+        break;
+    }
+}
+
+static void
+flows_timer (HevBenchFlows *self, uint64_t now)
+{
+    int i;
+
+    for (i = 0; i < self->tcp_count; i++) {
+        HevBenchTCP *f = &self->tcps[i];
+
+        switch (f->state) {
+        case HEV_BENCH_TCP_SYN_SENT:
+            if (now - f->progress_time < SYN_RTO_US)
+                break;
+            tcp_output (self, f, TCP_SYN, f->iss, 0);
+            f->progress_time = now;
+            self->retransmits++;
+            break;
+        case HEV_BENCH_TCP_ESTABLISHED:
+            if (now - f->progress_time < DATA_RTO_US)
+                break;
+            f->progress_time = now;
+            if (f->max > f->una) {
+                f->nxt = f->una;
+                self->retransmits++;
+                tcp_kick (self, i);
+            } else if (f->nxt < f->limit && !f->snd_wnd) {
+                /* An old sequence number gets the current window back. */
+                tcp_output (self, f, TCP_ACK, seq_of (f, f->nxt) - 1, 0);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+int
+hev_bench_flows_init (HevBenchFlows *self, int fd, int mtu, int tcps)
+{
+    memset (self, 0, sizeof (HevBenchFlows));
+
+    self->fd = fd;
+    self->mss = mtu - 40;
+    self->saddr = 0xc6120002; /* 198.18.0.2 */
+    self->daddr = HEV_BENCH_ECHO_ADDR;
+    self->tcp_count = tcps;
+    self->tcp_port_base = 10000;
+
+    self->tcps = calloc (tcps ? tcps : 1, sizeof (HevBenchTCP));
+    self->busy = calloc (tcps ? tcps : 1, sizeof (int));
+    self->udp_pending = calloc (65536, sizeof (uint64_t));
+    if (!self->tcps || !self->busy || !self->udp_pending) {
+        hev_bench_flows_fini (self);
+        return -1;
+    }
+
+    memset (pkt, 'h', sizeof (pkt));
+
+    return 0;
+}
+
+void
+hev_bench_flows_fini (HevBenchFlows *self)
+{
+    free (self->tcps);
+    free (self->busy);
+    free (self->udp_pending);
+    self->tcps = NULL;
+    self->busy = NULL;
+    self->udp_pending = NULL;
+}
+
+void
+hev_bench_flows_poll (HevBenchFlows *self, int timeout_ms)
+{
+    static uint8_t buf[PKT_SIZE];
+    struct pollfd pfd;
+    uint64_t now;
+    int i;
+
+    pfd.fd = self->fd;
+    pfd.events = POLLIN;
+    if (poll (&pfd, 1, timeout_ms) > 0) {
+        for (i = 0; i < RECV_BATCH; i++) {
+            ssize_t s = recv (self->fd, buf, sizeof (buf), MSG_DONTWAIT);
+            if (s <= 0)
+                break;
+            flows_input (self, buf, s);
+        }
+    }
+
+    now = hev_bench_now_us ();
+    if (now - self->tmr_time >= TIMER_INTERVAL_US) {
+        self->tmr_time = now;
+        flows_timer (self, now);
+    }
+
+    for (i = 0; i < self->busy_count; i++) {
+        HevBenchTCP *f = &self->tcps[self->busy[i]];
+
+        f->busy = 0;
+        tcp_push (self, f);
+    }
+    self->busy_count = 0;
+}
+
+void
+hev_bench_tcp_open (HevBenchFlows *self, int index, uint16_t dport,
+                    uint64_t limit)
+{
+    HevBenchTCP *f = &self->tcps[index];
+
+    memset (f, 0, sizeof (HevBenchTCP));
+    f->sport = self->tcp_port_base + index;
+    f->dport = dport;
+    f->iss = random ();
+    f->limit = limit;
+    f->state = HEV_BENCH_TCP_SYN_SENT;
+    f->syn_time = hev_bench_now_us ();
+    f->progress_time = f->syn_time;
+
+    tcp_output (self, f, TCP_SYN, f->iss, 0);
+}
+
+void
+hev_bench_tcp_send (HevBenchFlows *self, int index, uint64_t len)
+{
+    HevBenchTCP *f = &self->tcps[index];
+
+    if (f->state != HEV_BENCH_TCP_ESTABLISHED || f->want_fin)
+        return;
+
+    f->limit += len;
+    tcp_kick (self, index);
+}
+
+void
+hev_bench_tcp_close (HevBenchFlows *self, int index)
+{
+    HevBenchTCP *f = &self->tcps[index];
+
+    if (f->state != HEV_BENCH_TCP_ESTABLISHED || f->want_fin)
+        return;
+
+    f->limit = f->max;
+    f->want_fin = 1;
+    tcp_kick (self, index);
+}
+
+void
+hev_bench_udp_send (HevBenchFlows *self, uint16_t sport, uint16_t dport,
+                    unsigned int len)
+{
+    uint64_t now = hev_bench_now_us ();
+    uint32_t sum;
+    uint8_t *u;
+
+    if (len < sizeof (now))
+        len = sizeof (now);
+    if (len > (unsigned int)self->mss + 12)
+        len = self->mss + 12;
+
+    u = pkt + 20;
+    sum = ip4_header (self, IPPROTO_UDP, 8 + len);
+    put16 (u, sport);
+    put16 (u + 2, dport);
+    put16 (u + 4, 8 + len);
+    put16 (u + 6, 0);
+    memcpy (u + 8, &now, sizeof (now));
+    sum = csum_fold (csum_add (sum, u, 8 + len));
+    put16 (u + 6, sum ? sum : 0xffff);
+
+    flows_write (self, 20 + 8 + len);
+    self->udp_pending[sport] = now;
+    self->udp_sent++;
+}
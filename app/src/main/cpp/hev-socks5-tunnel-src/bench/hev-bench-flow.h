@@ -0,0 +1,131 @@
+/*
+ ============================================================================
+ Name        : hev-bench-flow.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bench Flow Generator
+ ============================================================================
+ */
+
+#ifndef __HEV_BENCH_FLOW_H__
+#define __HEV_BENCH_FLOW_H__
+
+#include <stdint.h>
+
+#define HEV_BENCH_HIST_BUCKETS (64 * 16)
+
+typedef struct _HevBenchHist HevBenchHist;
+typedef struct _HevBenchTCP HevBenchTCP;
+typedef struct _HevBenchFlows HevBenchFlows;
+
+/*
+ * Latency histogram in microseconds, 16 linear sub-buckets per power of
+ * two, so percentiles are within about 6% of the sample.
+ */
+struct _HevBenchHist
+{
+    uint64_t count;
+    uint64_t buckets[HEV_BENCH_HIST_BUCKETS];
+};
+
+typedef enum
+{
+    HEV_BENCH_TCP_CLOSED,
+    HEV_BENCH_TCP_SYN_SENT,
+    HEV_BENCH_TCP_ESTABLISHED,
+    HEV_BENCH_TCP_DONE,
+    HEV_BENCH_TCP_RESET,
+} HevBenchTCPState;
+
+/*
+ * One synthetic TCP client on the TUN side. It sends limit bytes after the
+ * handshake and counts what comes back in order; the peer is an echo
+ * server, so a flow is complete once rcvd reaches limit. Sent bytes are
+ * tracked as 64-bit offsets from the first data byte, and lost segments are
+ * resent go-back-N from una.
+ */
+struct _HevBenchTCP
+{
+    HevBenchTCPState state;
+    uint16_t sport;
+    uint16_t dport;
+    unsigned int busy : 1;
+    unsigned int need_ack : 1;
+    unsigned int want_fin : 1;
+    unsigned int peer_fin : 1;
+    unsigned int wscale : 4;
+
+    uint32_t iss;
+    uint32_t rcv_nxt;
+    uint32_t snd_wnd;
+
+    uint64_t una;
+    uint64_t nxt;
+    uint64_t max;
+    uint64_t limit;
+    uint64_t rcvd;
+
+    uint64_t syn_time;
+    uint64_t progress_time;
+};
+
+struct _HevBenchFlows
+{
+    int fd;
+    int mss;
+    uint32_t saddr;
+    uint32_t daddr;
+
+    HevBenchTCP *tcps;
+    int tcp_count;
+    int tcp_port_base;
+    int *busy;
+    int busy_count;
+    uint64_t tmr_time;
+
+    /* Send time of the outstanding datagram per source port, 0 if none. */
+    uint64_t *udp_pending;
+
+    uint64_t tx_packets;
+    uint64_t rx_packets;
+    uint64_t retransmits;
+    uint64_t out_of_order;
+    uint64_t resets;
+    uint64_t udp_sent;
+    uint64_t udp_rcvd;
+
+    HevBenchHist syn_ack;
+    HevBenchHist first_byte;
+    HevBenchHist udp_rtt;
+};
+
+uint64_t hev_bench_now_us (void);
+
+void hev_bench_hist_add (HevBenchHist *self, uint64_t us);
+uint64_t hev_bench_hist_percentile (HevBenchHist *self, double p);
+
+int hev_bench_flows_init (HevBenchFlows *self, int fd, int mtu, int tcps);
+void hev_bench_flows_fini (HevBenchFlows *self);
+
+/*
+ * Receive what the tunnel sent for up to timeout_ms, then answer it: ACK,
+ * push data the windows allow and resend what timed out.
+ */
+void hev_bench_flows_poll (HevBenchFlows *self, int timeout_ms);
+
+void hev_bench_tcp_open (HevBenchFlows *self, int index, uint16_t dport,
+                         uint64_t limit);
+
+/* Send len more bytes, once the handshake is done. */
+void hev_bench_tcp_send (HevBenchFlows *self, int index, uint64_t len);
+
+/*
+ * Send nothing past what was already sent, then FIN. The flow is DONE once
+ * the FIN is acknowledged and the peer's FIN arrived.
+ */
+void hev_bench_tcp_close (HevBenchFlows *self, int index);
+
+void hev_bench_udp_send (HevBenchFlows *self, uint16_t sport, uint16_t dport,
+                         unsigned int len);
+
+#endif /* __HEV_BENCH_FLOW_H__ */
@@ -0,0 +1,278 @@
+/*
+ ============================================================================
+ Name        : hev-bench-server.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bench Server
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-task-system.h>
+#include <hev-socks5-misc.h>
+#include <hev-socks5-server.h>
+
+#include "hev-bench-server.h"
+
+#define ECHO_BUFFER_SIZE (16384)
+#define ECHO_STACK_SIZE (ECHO_BUFFER_SIZE + 16384)
+
+static int
+bench_socket (int type, uint32_t ip, int *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof (addr);
+    int one = 1;
+    int fd;
+
+    fd = socket (AF_INET, type, 0);
+    if (fd < 0)
+        return -1;
+
+    if (fcntl (fd, F_SETFL, O_NONBLOCK) < 0)
+        goto err;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (ip);
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    if (bind (fd, (struct sockaddr *)&addr, len) < 0)
+        goto err;
+    if (type == SOCK_STREAM && listen (fd, 4096) < 0)
+        goto err;
+    if (getsockname (fd, (struct sockaddr *)&addr, &len) < 0)
+        goto err;
+
+    *port = ntohs (addr.sin_port);
+    return fd;
+
+err:
+    close (fd);
+    return -1;
+}
+
+static void
+socks5_entry (void *data)
+{
+    HevSocks5Server *server = data;
+
+    hev_socks5_server_run (server);
+    hev_object_unref (HEV_OBJECT (server));
+}
+
+static void
+echo_entry (void *data)
+{
+    int fd = (intptr_t)data;
+    char buf[ECHO_BUFFER_SIZE];
+    int one = 1;
+
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    for (;;) {
+        ssize_t s;
+
+        s = hev_task_io_socket_recv (fd, buf, sizeof (buf), 0, NULL, NULL);
+        if (s <= 0)
+            break;
+
+        s = hev_task_io_socket_send (fd, buf, s, MSG_WAITALL, NULL, NULL);
+        if (s <= 0)
+            break;
+    }
+
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+}
+
+static void
+socks5_listener_entry (void *data)
+{
+    int fd = (intptr_t)data;
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN);
+
+    for (;;) {
+        HevSocks5Server *server;
+        HevTask *task;
+        int nfd;
+
+        nfd = hev_task_io_socket_accept (fd, NULL, NULL, NULL, NULL);
+        if (nfd < 0)
+            continue;
+
+        server = hev_socks5_server_new (nfd);
+        if (!server) {
+            close (nfd);
+            continue;
+        }
+
+        task = hev_task_new (-1);
+        if (!task) {
+            hev_object_unref (HEV_OBJECT (server));
+            continue;
+        }
+        hev_task_run (task, socks5_entry, server);
+    }
+}
+
+static void
+echo_listener_entry (void *data)
+{
+    int fd = (intptr_t)data;
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN);
+
+    for (;;) {
+        HevTask *task;
+        int nfd;
+
+        nfd = hev_task_io_socket_accept (fd, NULL, NULL, NULL, NULL);
+        if (nfd < 0)
+            continue;
+
+        task = hev_task_new (ECHO_STACK_SIZE);
+        if (!task) {
+            close (nfd);
+            continue;
+        }
+        hev_task_add_fd (task, nfd, POLLIN | POLLOUT);
+        hev_task_run (task, echo_entry, (void *)(intptr_t)nfd);
+    }
+}
+
+static void
+udp_echo_entry (void *data)
+{
+    int fd = (intptr_t)data;
+    char buf[ECHO_BUFFER_SIZE];
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+
+    for (;;) {
+        struct sockaddr_in6 addr;
+        socklen_t len = sizeof (addr);
+        ssize_t s;
+
+        s = hev_task_io_socket_recvfrom (fd, buf, sizeof (buf), 0,
+                                         (struct sockaddr *)&addr, &len, NULL,
+                                         NULL);
+        if (s <= 0)
+            continue;
+
+        hev_task_io_socket_sendto (fd, buf, s, 0, (struct sockaddr *)&addr,
+                                   len, NULL, NULL);
+    }
+}
+
+static void
+parent_entry (void *data)
+{
+    int fd = (intptr_t)data;
+    char c;
+
+    /* The parent holds the other end; EOF means it went away. */
+    hev_task_add_fd (hev_task_self (), fd, POLLIN);
+    hev_task_io_read (fd, &c, 1, NULL, NULL);
+    _exit (0);
+}
+
+static void
+spawn (HevTaskEntry entry, int stack_size, int fd)
+{
+    HevTask *task = hev_task_new (stack_size);
+
+    hev_task_run (task, entry, (void *)(intptr_t)fd);
+}
+
+static void
+child_run (int fds[4], int pipe_fd)
+{
+    signal (SIGPIPE, SIG_IGN);
+    signal (SIGINT, SIG_IGN);
+
+    if (hev_task_system_init () < 0)
+        _exit (1);
+
+    hev_socks5_set_connect_timeout (5000);
+    hev_socks5_set_tcp_timeout (300000);
+    hev_socks5_set_udp_timeout (60000);
+
+    spawn (socks5_listener_entry, -1, fds[0]);
+    spawn (echo_listener_entry, -1, fds[1]);
+    spawn (udp_echo_entry, ECHO_STACK_SIZE, fds[2]);
+    spawn (udp_echo_entry, ECHO_STACK_SIZE, fds[3]);
+    spawn (parent_entry, -1, pipe_fd);
+
+    hev_task_system_run ();
+    _exit (0);
+}
+
+int
+hev_bench_server_start (HevBenchServer *self)
+{
+    int fds[4];
+    int pfd[2];
+    int i;
+
+    fds[0] = bench_socket (SOCK_STREAM, INADDR_LOOPBACK, &self->socks_port);
+    fds[1] = bench_socket (SOCK_STREAM, HEV_BENCH_ECHO_ADDR,
+                           &self->echo_port);
+    fds[2] = bench_socket (SOCK_DGRAM, HEV_BENCH_ECHO_ADDR, &self->dns_port);
+    fds[3] = bench_socket (SOCK_DGRAM, HEV_BENCH_ECHO_ADDR, &self->game_port);
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 || fds[3] < 0)
+        goto err;
+
+    if (pipe (pfd) < 0)
+        goto err;
+
+    self->pid = fork ();
+    if (self->pid < 0) {
+        close (pfd[0]);
+        close (pfd[1]);
+        goto err;
+    }
+
+    if (self->pid == 0) {
+        close (pfd[1]);
+        fcntl (pfd[0], F_SETFL, O_NONBLOCK);
+        child_run (fds, pfd[0]);
+    }
+
+    /* pfd[1] stays open until this process exits, the child then quits. */
+    close (pfd[0]);
+    for (i = 0; i < 4; i++)
+        close (fds[i]);
+
+    return 0;
+
+err:
+    for (i = 0; i < 4; i++)
+        if (fds[i] >= 0)
+            close (fds[i]);
+    return -1;
+}
+
+void
+hev_bench_server_stop (HevBenchServer *self)
+{
+    if (self->pid <= 0)
+        return;
+
+    kill (self->pid, SIGTERM);
+    waitpid (self->pid, NULL, 0);
+    self->pid = 0;
+}
@@ -0,0 +1,40 @@
+/*
+ ============================================================================
+ Name        : hev-bench-server.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bench Server
+ ============================================================================
+ */
+
+#ifndef __HEV_BENCH_SERVER_H__
+#define __HEV_BENCH_SERVER_H__
+
+#include <sys/types.h>
+
+/*
+ * The echo servers listen on 127.0.0.2: the tunnel's netif owns 127.0.0.1,
+ * and lwIP takes UDP sent there as local instead of starting a session.
+ */
+#define HEV_BENCH_ECHO_ADDR (0x7f000002)
+
+typedef struct _HevBenchServer HevBenchServer;
+
+/*
+ * A socks5 server on 127.0.0.1 and the TCP and UDP echo servers it
+ * reaches. They run in a child process, so the tunnel's resident memory
+ * and CPU time are measured without them.
+ */
+struct _HevBenchServer
+{
+    pid_t pid;
+    int socks_port;
+    int echo_port;
+    int dns_port;
+    int game_port;
+};
+
+int hev_bench_server_start (HevBenchServer *self);
+void hev_bench_server_stop (HevBenchServer *self);
+
+#endif /* __HEV_BENCH_SERVER_H__ */
@@ -0,0 +1,792 @@
+/*
+ ============================================================================
+ Name        : hev-bench.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Loopback Benchmark
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "hev-main.h"
+#include "hev-bench-flow.h"
+#include "hev-bench-server.h"
+
+#define PIPE_BUFFER_SIZE (4 * 1024 * 1024)
+#define IDLE_CONCURRENCY (256)
+#define IDLE_REQUEST_SIZE (16)
+#define CHATTY_REQUEST_SIZE (64)
+#define DNS_CONCURRENCY (256)
+#define DNS_QUERY_SIZE (40)
+#define DNS_PORT_BASE (20000)
+#define DNS_PORT_RANGE (16384)
+#define DNS_TIMEOUT_US (2000 * 1000)
+#define GAME_PORT_BASE (40000)
+#define GAME_PACKET_SIZE (100)
+#define GAME_RATE_HZ (60)
+#define SETTLE_US (10 * 1000 * 1000)
+#define RELOAD_INTERVAL_US (100 * 1000)
+#define RELOAD_MAX (256)
+
+typedef struct _HevBench HevBench;
+typedef struct _HevBenchRun HevBenchRun;
+
+struct _HevBench
+{
+    const char *scenario;
+    double seconds;
+    int count;
+    int mtu;
+    const char *udp_mode;
+    const char *log_level;
+    int session_rate;
+
+    HevBenchServer server;
+};
+
+/* One tunnel instance, started fresh for each scenario. */
+struct _HevBenchRun
+{
+    int fds[2];
+    char config[2048];
+    pthread_t thread;
+    clockid_t cpu_clock;
+
+    HevBenchFlows flows;
+
+    HevSocks5TunnelStats stats;
+    uint64_t time;
+    uint64_t cpu;
+};
+
+static uint64_t
+thread_cpu_us (clockid_t clock)
+{
+    struct timespec ts;
+
+    if (clock_gettime (clock, &ts) < 0)
+        return 0;
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long
+rss_kb (void)
+{
+#if defined(__linux__)
+    long size, pages = 0;
+    FILE *fp;
+
+    fp = fopen ("/proc/self/statm", "r");
+    if (fp) {
+        if (fscanf (fp, "%ld %ld", &size, &pages) != 2)
+            pages = 0;
+        fclose (fp);
+    }
+
+    return pages * (sysconf (_SC_PAGESIZE) / 1024);
+#else
+    struct rusage ru;
+
+    /* Peak, not current: the best other systems report for free. */
+    getrusage (RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+#endif
+}
+
+static void
+raise_nofile (void)
+{
+    struct rlimit limit;
+
+    if (getrlimit (RLIMIT_NOFILE, &limit) < 0)
+        return;
+
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &limit);
+}
+
+/*
+ * An idle session holds seven fds in the server process: three sockets,
+ * the socks5 and echo ends of the upstream and the echo server's, and the
+ * two splice pipes of the relay.
+ */
+static int
+max_idle_sessions (void)
+{
+    struct rlimit limit;
+
+    if (getrlimit (RLIMIT_NOFILE, &limit) < 0)
+        return INT32_MAX;
+    if (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > INT32_MAX)
+        return INT32_MAX;
+
+    return ((int)limit.rlim_cur - 64) / 7;
+}
+
+static void *
+tunnel_entry (void *data)
+{
+    HevBenchRun *run = data;
+
+    hev_socks5_tunnel_main_from_str ((unsigned char *)run->config,
+                                     strlen (run->config), run->fds[1]);
+
+    return NULL;
+}
+
+static void
+run_mark (HevBenchRun *run)
+{
+    hev_socks5_tunnel_get_stats (&run->stats, sizeof (run->stats));
+    run->time = hev_bench_now_us ();
+    run->cpu = thread_cpu_us (run->cpu_clock);
+}
+
+static int
+run_start (HevBench *self, HevBenchRun *run, int tcps)
+{
+    int size = PIPE_BUFFER_SIZE;
+    int i;
+
+    memset (run, 0, sizeof (HevBenchRun));
+
+    /* A datagram socketpair keeps packet boundaries, like a TUN fd. */
+    if (socketpair (AF_UNIX, SOCK_DGRAM, 0, run->fds) < 0)
+        return -1;
+
+    for (i = 0; i < 2; i++) {
+        setsockopt (run->fds[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+        setsockopt (run->fds[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+    }
+
+    /* The app's settings, see HevSocks5Tunnel.buildConfig. */
+    snprintf (run->config, sizeof (run->config),
+              "tunnel:\n"
+              "  mtu: %d\n"
+              "socks5:\n"
+              "  address: 127.0.0.1\n"
+              "  port: %d\n"
+              "  pool-size: 4\n"
+              "  tcp-nodelay: true\n"
+              "  udp: '%s'\n"
+              "  udp-mux: 16\n"
+              "udp-timeout:\n"
+              "  - port: %d\n"
+              "    timeout: 5000\n"
+              "    one-shot: true\n"
+              "misc:\n"
+              "  task-stack-size: 32768\n"
+              "  task-stack-auto: true\n"
+              "  session-bulk-rate: 1048576\n"
+              "  memory-limit: 134217728\n"
+              "  session-memory-limit: 8388608\n"
+              "  connect-timeout: 8000\n"
+              "  tcp-read-write-timeout: 120000\n"
+              "  udp-read-write-timeout: 60000\n"
+              "  tcp-time-wait: 1000\n"
+              "  timer-slack: 100\n"
+              "  session-rate-limit: %d\n"
+              "  log-level: %s\n",
+              self->mtu, self->server.socks_port, self->udp_mode,
+              self->server.dns_port, self->session_rate, self->log_level);
+
+    if (hev_bench_flows_init (&run->flows, run->fds[0], self->mtu, tcps) < 0)
+        goto err;
+
+    if (pthread_create (&run->thread, NULL, tunnel_entry, run))
+        goto err_flows;
+
+    if (pthread_getcpuclockid (run->thread, &run->cpu_clock))
+        run->cpu_clock = CLOCK_PROCESS_CPUTIME_ID;
+
+    /* Let the tunnel come up before measuring from it. */
+    for (i = 0; i < 100; i++)
+        hev_bench_flows_poll (&run->flows, 1);
+
+    run_mark (run);
+    return 0;
+
+err_flows:
+    hev_bench_flows_fini (&run->flows);
+err:
+    close (run->fds[0]);
+    close (run->fds[1]);
+    return -1;
+}
+
+static void
+run_stop (HevBenchRun *run)
+{
+    hev_socks5_tunnel_quit ();
+    pthread_join (run->thread, NULL);
+    hev_bench_flows_fini (&run->flows);
+    close (run->fds[0]);
+    close (run->fds[1]);
+}
+
+/* Packets and bytes through the TUN side since the last run_mark. */
+static void
+run_report (HevBenchRun *run, HevSocks5TunnelStats *s0, uint64_t t0,
+            uint64_t cpu0)
+{
+    HevSocks5TunnelStats *s1 = &run->stats;
+    double secs = (run->time - t0) / 1e6;
+    double cpu_ms = (run->cpu - cpu0) / 1e3;
+    uint64_t pkts, bytes;
+
+    pkts = s1->tx_packets - s0->tx_packets + s1->rx_packets - s0->rx_packets;
+    bytes = s1->tx_bytes - s0->tx_bytes + s1->rx_bytes - s0->rx_bytes;
+    if (secs <= 0)
+        secs = 1e-6;
+
+    printf (" seconds=%.3f tun_pps=%.0f tun_gbps=%.3f cpu_ms=%.1f"
+            " cpu_ms_per_gb=%.1f",
+            secs, pkts / secs, bytes * 8 / secs / 1e9, cpu_ms,
+            bytes ? cpu_ms / (bytes / 1e9) : 0.0);
+    printf (" lwip_io_ms=%.1f lwip_timer_ms=%.1f tcp_session_ms=%.1f"
+            " udp_session_ms=%.1f",
+            (s1->task_run_time[0] - s0->task_run_time[0]) / 1e6,
+            (s1->task_run_time[1] - s0->task_run_time[1]) / 1e6,
+            (s1->task_run_time[2] - s0->task_run_time[2]) / 1e6,
+            (s1->task_run_time[3] - s0->task_run_time[3]) / 1e6);
+}
+
+static void
+print_hist (const char *name, HevBenchHist *hist)
+{
+    printf (" %s_p50_us=%llu %s_p99_us=%llu", name,
+            (unsigned long long)hev_bench_hist_percentile (hist, 0.5), name,
+            (unsigned long long)hev_bench_hist_percentile (hist, 0.99));
+}
+
+static int
+tcp_all_done (HevBenchFlows *flows, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        HevBenchTCPState state = flows->tcps[i].state;
+        if (state != HEV_BENCH_TCP_DONE && state != HEV_BENCH_TCP_RESET)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* A few flows push as much as lwIP takes and read the echo back. */
+static int
+bench_bulk (HevBench *self)
+{
+    int flows = self->count > 0 ? self->count : 4;
+    HevSocks5TunnelStats s0;
+    uint64_t t0, cpu0, end, rcvd = 0;
+    HevBenchRun run;
+    int i;
+
+    if (run_start (self, &run, flows) < 0)
+        return -1;
+
+    for (i = 0; i < flows; i++)
+        hev_bench_tcp_open (&run.flows, i, self->server.echo_port, UINT64_MAX);
+
+    s0 = run.stats;
+    t0 = run.time;
+    cpu0 = run.cpu;
+    end = t0 + self->seconds * 1e6;
+    while (hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 1);
+
+    run_mark (&run);
+    for (i = 0; i < flows; i++) {
+        rcvd += run.flows.tcps[i].rcvd;
+        hev_bench_tcp_close (&run.flows, i);
+    }
+
+    end = hev_bench_now_us () + SETTLE_US;
+    while (!tcp_all_done (&run.flows, flows) && hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 1);
+
+    printf ("scenario=bulk flows=%d", flows);
+    run_report (&run, &s0, t0, cpu0);
+    printf (" goodput_gbps=%.3f retransmits=%llu resets=%llu"
+            " closed=%d\n",
+            rcvd * 8 / ((run.time - t0) / 1e6) / 1e9,
+            (unsigned long long)run.flows.retransmits,
+            (unsigned long long)run.flows.resets,
+            tcp_all_done (&run.flows, flows));
+
+    run_stop (&run);
+    return 0;
+}
+
+/*
+ * Open sessions, IDLE_CONCURRENCY at a time, each sending one small request
+ * through to the echo server so the upstream exists. Returns how many were
+ * opened.
+ */
+static int
+sessions_open (HevBench *self, HevBenchRun *run, int sessions)
+{
+    int opened = 0, ready = 0;
+    uint64_t end;
+    int i;
+
+    end = hev_bench_now_us () + 6 * SETTLE_US;
+    while (ready < sessions && hev_bench_now_us () < end) {
+        while (opened < sessions && opened - ready < IDLE_CONCURRENCY)
+            hev_bench_tcp_open (&run->flows, opened++, self->server.echo_port,
+                                IDLE_REQUEST_SIZE);
+
+        hev_bench_flows_poll (&run->flows, 1);
+
+        for (ready = 0, i = 0; i < opened; i++)
+            if (run->flows.tcps[i].rcvd >= IDLE_REQUEST_SIZE ||
+                run->flows.tcps[i].state == HEV_BENCH_TCP_RESET)
+                ready++;
+    }
+
+    return opened;
+}
+
+static int
+sessions_cap (const char *scenario, int sessions)
+{
+    int limit = max_idle_sessions ();
+
+    if (sessions > limit) {
+        fprintf (stderr, "%s: %d sessions, nofile allows %d\n", scenario,
+                 sessions, limit);
+        sessions = limit;
+    }
+
+    return sessions;
+}
+
+/* Open many sessions, then leave them idle. */
+static int
+bench_idle (HevBench *self)
+{
+    int count = self->count > 0 ? self->count : 10000;
+    int sessions = sessions_cap ("idle", count);
+    HevSocks5TunnelStats s0, s1;
+    uint64_t t0, cpu0, end;
+    long rss0, rss1;
+    HevBenchRun run;
+    int opened, i;
+
+    if (run_start (self, &run, sessions) < 0)
+        return -1;
+
+    rss0 = rss_kb ();
+    opened = sessions_open (self, &run, sessions);
+
+    run_mark (&run);
+    rss1 = rss_kb ();
+    s0 = run.stats;
+    t0 = run.time;
+    cpu0 = run.cpu;
+    end = t0 + self->seconds * 1e6;
+    while (hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 10);
+    run_mark (&run);
+    s1 = run.stats;
+
+    printf ("scenario=idle sessions=%d established=%llu resets=%llu", sessions,
+            (unsigned long long)s0.tcp_sessions,
+            (unsigned long long)run.flows.resets);
+    print_hist ("syn_ack", &run.flows.syn_ack);
+    print_hist ("first_byte", &run.flows.first_byte);
+    printf (" rss_per_session_kb=%.2f", s0.tcp_sessions
+                                            ? (double)(rss1 - rss0) /
+                                                  s0.tcp_sessions
+                                            : 0.0);
+    run_report (&run, &s0, t0, cpu0);
+    printf (" wakeups_per_s=%.1f",
+            (s1.wakeups - s0.wakeups) / ((run.time - t0) / 1e6));
+    printf (" mem_per_session_kb=%.2f mem_evictions=%llu",
+            s0.tcp_sessions ? s0.mem_used / 1024.0 / s0.tcp_sessions : 0.0,
+            (unsigned long long)s1.mem_evictions);
+
+    for (i = 0; i < opened; i++)
+        hev_bench_tcp_close (&run.flows, i);
+    end = hev_bench_now_us () + SETTLE_US;
+    while (!tcp_all_done (&run.flows, opened) && hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 1);
+    printf (" closed=%d\n", tcp_all_done (&run.flows, opened));
+
+    run_stop (&run);
+    return 0;
+}
+
+/*
+ * Many sessions, each with one small request in flight at all times, so
+ * every round touches the state of every session: the splice and timer
+ * paths are bound by cache misses rather than bytes.
+ */
+static int
+bench_chatty (HevBench *self)
+{
+    int count = self->count > 0 ? self->count : 2000;
+    int sessions = sessions_cap ("chatty", count);
+    uint64_t t0, cpu0, end, requests = 0;
+    HevSocks5TunnelStats s0;
+    HevBenchRun run;
+    int opened, i;
+
+    if (run_start (self, &run, sessions) < 0)
+        return -1;
+
+    opened = sessions_open (self, &run, sessions);
+
+    run_mark (&run);
+    s0 = run.stats;
+    t0 = run.time;
+    cpu0 = run.cpu;
+    end = t0 + self->seconds * 1e6;
+    while (hev_bench_now_us () < end) {
+        for (i = 0; i < opened; i++) {
+            HevBenchTCP *f = &run.flows.tcps[i];
+
+            if (f->state != HEV_BENCH_TCP_ESTABLISHED || f->rcvd < f->limit)
+                continue;
+            hev_bench_tcp_send (&run.flows, i, CHATTY_REQUEST_SIZE);
+            requests++;
+        }
+
+        hev_bench_flows_poll (&run.flows, 1);
+    }
+    run_mark (&run);
+
+    printf ("scenario=chatty sessions=%d established=%llu resets=%llu"
+            " requests_per_s=%.0f cpu_us_per_request=%.2f",
+            sessions, (unsigned long long)s0.tcp_sessions,
+            (unsigned long long)run.flows.resets,
+            requests / ((run.time - t0) / 1e6),
+            requests ? (double)(run.cpu - cpu0) / requests : 0.0);
+    run_report (&run, &s0, t0, cpu0);
+
+    for (i = 0; i < opened; i++)
+        hev_bench_tcp_close (&run.flows, i);
+    end = hev_bench_now_us () + SETTLE_US;
+    while (!tcp_all_done (&run.flows, opened) && hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 1);
+    printf (" closed=%d\n", tcp_all_done (&run.flows, opened));
+
+    run_stop (&run);
+    return 0;
+}
+
+/*
+ * One-shot queries from fresh source ports, a fixed number in flight, as a
+ * resolver storm at app start or on a network change looks like. A query
+ * that finds no mux leader opens its own socks5 connection, and their
+ * TIME-WAIT on loopback runs out of ephemeral ports past some 10k queries.
+ */
+static int
+bench_dns (HevBench *self)
+{
+    int queries = self->count > 0 ? self->count : 5000;
+    static uint16_t ring[DNS_CONCURRENCY];
+    uint64_t t0, cpu0, lost = 0, peak = 0;
+    unsigned int head = 0, tail = 0;
+    HevSocks5TunnelStats s0;
+    HevBenchRun run;
+
+    if (run_start (self, &run, 0) < 0)
+        return -1;
+
+    s0 = run.stats;
+    t0 = run.time;
+    cpu0 = run.cpu;
+    while (head < (unsigned int)queries) {
+        HevSocks5TunnelStats s;
+        uint64_t now;
+
+        while (tail < (unsigned int)queries &&
+               tail - head < DNS_CONCURRENCY) {
+            uint16_t port = DNS_PORT_BASE + tail % DNS_PORT_RANGE;
+
+            ring[tail % DNS_CONCURRENCY] = port;
+            hev_bench_udp_send (&run.flows, port, self->server.dns_port,
+                                DNS_QUERY_SIZE);
+            tail++;
+        }
+
+        hev_bench_flows_poll (&run.flows, 1);
+
+        now = hev_bench_now_us ();
+        while (head < tail) {
+            uint16_t port = ring[head % DNS_CONCURRENCY];
+            uint64_t sent = run.flows.udp_pending[port];
+
+            if (sent && now - sent < DNS_TIMEOUT_US)
+                break;
+            if (sent) {
+                run.flows.udp_pending[port] = 0;
+                lost++;
+            }
+            head++;
+        }
+
+        hev_socks5_tunnel_get_stats (&s, sizeof (s));
+        if (peak < s.udp_sessions)
+            peak = s.udp_sessions;
+    }
+    run_mark (&run);
+
+    printf ("scenario=dns queries=%d answered=%llu lost=%llu qps=%.0f"
+            " udp_sessions_peak=%llu",
+            queries, (unsigned long long)run.flows.udp_rcvd,
+            (unsigned long long)lost,
+            run.flows.udp_rcvd / ((run.time - t0) / 1e6),
+            (unsigned long long)peak);
+    print_hist ("rtt", &run.flows.udp_rtt);
+    run_report (&run, &s0, t0, cpu0);
+    printf ("\n");
+
+    run_stop (&run);
+    return 0;
+}
+
+/* Steady small datagrams on long lived flows, where only latency counts. */
+static int
+bench_game (HevBench *self)
+{
+    int flows = self->count > 0 ? self->count : 16;
+    uint64_t t0, cpu0, end, next, sent = 0;
+    HevSocks5TunnelStats s0;
+    HevBenchRun run;
+    int i;
+
+    if (run_start (self, &run, 0) < 0)
+        return -1;
+
+    s0 = run.stats;
+    t0 = run.time;
+    cpu0 = run.cpu;
+    end = t0 + self->seconds * 1e6;
+    for (next = t0; next < end; next += 1000000 / GAME_RATE_HZ) {
+        while (hev_bench_now_us () < next)
+            hev_bench_flows_poll (&run.flows, 1);
+
+        for (i = 0; i < flows; i++)
+            hev_bench_udp_send (&run.flows, GAME_PORT_BASE + i,
+                                self->server.game_port, GAME_PACKET_SIZE);
+        sent += flows;
+    }
+
+    end = hev_bench_now_us () + 500 * 1000;
+    while (run.flows.udp_rcvd < sent && hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 1);
+    run_mark (&run);
+
+    printf ("scenario=game flows=%d sent=%llu rcvd=%llu loss_pct=%.3f", flows,
+            (unsigned long long)sent, (unsigned long long)run.flows.udp_rcvd,
+            sent ? 100.0 * (sent - run.flows.udp_rcvd) / sent : 0.0);
+    print_hist ("rtt", &run.flows.udp_rtt);
+    printf (" rtt_p999_us=%llu", (unsigned long long)hev_bench_hist_percentile (
+                                     &run.flows.udp_rtt, 0.999));
+    run_report (&run, &s0, t0, cpu0);
+    printf ("\n");
+
+    run_stop (&run);
+    return 0;
+}
+
+/*
+ * Chatty sessions while the config is reloaded every RELOAD_INTERVAL_US,
+ * with a fresh session opened behind each reload. The established ones
+ * must not notice, the fresh ones must get through.
+ */
+static int
+bench_reload (HevBench *self)
+{
+    int count = self->count > 0 ? self->count : 256;
+    int sessions = sessions_cap ("reload", count);
+    uint64_t t0, cpu0, end, next, requests = 0;
+    int opened, reloads = 0, failed = 0, fresh = 0;
+    HevSocks5TunnelStats s0;
+    HevBenchRun run;
+    int i;
+
+    if (run_start (self, &run, sessions + RELOAD_MAX) < 0)
+        return -1;
+
+    opened = sessions_open (self, &run, sessions);
+
+    run_mark (&run);
+    s0 = run.stats;
+    t0 = run.time;
+    cpu0 = run.cpu;
+    end = t0 + self->seconds * 1e6;
+    next = t0 + RELOAD_INTERVAL_US;
+    while (hev_bench_now_us () < end) {
+        if (hev_bench_now_us () >= next && reloads < RELOAD_MAX) {
+            if (hev_socks5_tunnel_reload_from_str (
+                    (unsigned char *)run.config, strlen (run.config)) < 0)
+                failed++;
+            hev_bench_tcp_open (&run.flows, opened + reloads,
+                                self->server.echo_port, IDLE_REQUEST_SIZE);
+            reloads++;
+            next += RELOAD_INTERVAL_US;
+        }
+
+        for (i = 0; i < opened; i++) {
+            HevBenchTCP *f = &run.flows.tcps[i];
+
+            if (f->state != HEV_BENCH_TCP_ESTABLISHED || f->rcvd < f->limit)
+                continue;
+            hev_bench_tcp_send (&run.flows, i, CHATTY_REQUEST_SIZE);
+            requests++;
+        }
+
+        hev_bench_flows_poll (&run.flows, 1);
+    }
+
+    end = hev_bench_now_us () + SETTLE_US;
+    while (hev_bench_now_us () < end) {
+        for (fresh = 0, i = 0; i < reloads; i++)
+            if (run.flows.tcps[opened + i].rcvd >= IDLE_REQUEST_SIZE)
+                fresh++;
+        if (fresh == reloads)
+            break;
+        hev_bench_flows_poll (&run.flows, 1);
+    }
+    run_mark (&run);
+
+    printf ("scenario=reload sessions=%d established=%llu resets=%llu"
+            " reloads=%d reload_failed=%d fresh_ok=%d requests_per_s=%.0f",
+            sessions, (unsigned long long)s0.tcp_sessions,
+            (unsigned long long)run.flows.resets, reloads, failed, fresh,
+            requests / ((run.time - t0) / 1e6));
+    run_report (&run, &s0, t0, cpu0);
+
+    opened += reloads;
+    for (i = 0; i < opened; i++)
+        hev_bench_tcp_close (&run.flows, i);
+    end = hev_bench_now_us () + SETTLE_US;
+    while (!tcp_all_done (&run.flows, opened) && hev_bench_now_us () < end)
+        hev_bench_flows_poll (&run.flows, 1);
+    printf (" closed=%d\n", tcp_all_done (&run.flows, opened));
+
+    run_stop (&run);
+    return 0;
+}
+
+static void
+show_help (const char *self_path)
+{
+    printf ("%s [options]\n", self_path);
+    printf ("  -s name    bulk, idle, chatty, dns, game, reload or all "
+            "(default all)\n");
+    printf ("  -d secs    measuring time of bulk, idle, chatty, game and "
+            "reload (default 5)\n");
+    printf ("  -n count   flows, sessions or queries (default 4, 10000, "
+            "2000, 5000, 16, 256)\n");
+    printf ("  -m mtu     tunnel MTU (default 1500)\n");
+    printf ("  -u mode    socks5 udp mode, udp or tcp (default tcp)\n");
+    printf ("  -l level   tunnel log level (default warn)\n");
+    printf ("  -r bytes   session-rate-limit per second (default 0)\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const struct
+    {
+        const char *name;
+        int (*entry) (HevBench *self);
+    } scenarios[] = {
+        { "bulk", bench_bulk },
+        { "idle", bench_idle },
+        { "chatty", bench_chatty },
+        { "dns", bench_dns },
+        { "game", bench_game },
+        { "reload", bench_reload },
+    };
+    HevBench self = { 0 };
+    int i, opt, res = 0, found = 0;
+
+    self.scenario = "all";
+    self.seconds = 5;
+    self.mtu = 1500;
+    self.udp_mode = "tcp";
+    self.log_level = "warn";
+
+    while ((opt = getopt (argc, argv, "s:d:n:m:u:l:r:h")) != -1) {
+        switch (opt) {
+        case 's':
+            self.scenario = optarg;
+            break;
+        case 'd':
+            self.seconds = atof (optarg);
+            break;
+        case 'n':
+            self.count = atoi (optarg);
+            break;
+        case 'm':
+            self.mtu = atoi (optarg);
+            break;
+        case 'u':
+            self.udp_mode = optarg;
+            break;
+        case 'l':
+            self.log_level = optarg;
+            break;
+        case 'r':
+            self.session_rate = atoi (optarg);
+            break;
+        default:
+            show_help (argv[0]);
+            return -1;
+        }
+    }
+
+    if (self.mtu < 576 || self.mtu > 65535 || self.seconds <= 0) {
+        show_help (argv[0]);
+        return -1;
+    }
+
+    signal (SIGPIPE, SIG_IGN);
+    raise_nofile ();
+    srandom (time (NULL));
+
+    if (hev_bench_server_start (&self.server) < 0) {
+        fprintf (stderr, "Start bench server failed!\n");
+        return -2;
+    }
+
+    for (i = 0; i < sizeof (scenarios) / sizeof (scenarios[0]); i++) {
+        if (strcmp (self.scenario, "all") &&
+            strcmp (self.scenario, scenarios[i].name))
+            continue;
+
+        found = 1;
+        fflush (stdout);
+        if (scenarios[i].entry (&self) < 0) {
+            fprintf (stderr, "Run scenario %s failed!\n", scenarios[i].name);
+            res = -3;
+        }
+        fflush (stdout);
+    }
+
+    hev_bench_server_stop (&self.server);
+
+    if (!found) {
+        show_help (argv[0]);
+        return -1;
+    }
+
+    return res;
+}
@@ -0,0 +1 @@
+../src/hev-socks5-bucket.h
\ No newline at end of file
@@ -0,0 +1 @@
+../src/hev-socks5-service.h
\ No newline at end of file
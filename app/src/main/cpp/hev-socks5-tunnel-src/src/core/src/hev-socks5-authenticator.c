@@ -2,19 +2,110 @@
  ============================================================================
  Name        : hev-socks5-authenticator.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2023 hev
+ Copyright   : Copyright (c) 2023 - 2026 hev
  Description : Socks5 Authenticator
  ============================================================================
  */
 
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 
 #include "hev-compiler.h"
 #include "hev-socks5-logger-priv.h"
 
 #include "hev-socks5-authenticator.h"
 
+/* Open addressing, at most half full. */
+struct _HevSocks5AuthenticatorTable
+{
+    unsigned int mask;
+    unsigned int count;
+    HevSocks5User *slots[];
+};
+
+static uint32_t
+hev_socks5_authenticator_hash (const char *name, unsigned int name_len)
+{
+    uint32_t hash = 2166136261u;
+    unsigned int i;
+
+    /* FNV-1a */
+    for (i = 0; i < name_len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static HevSocks5AuthenticatorTable *
+hev_socks5_authenticator_table_new (HevSocks5Authenticator *self)
+{
+    HevSocks5AuthenticatorTable *table;
+    unsigned int count = 0;
+    unsigned int size = 4;
+    HevRBTreeNode *n;
+
+    for (n = hev_rbtree_first (&self->tree); n; n = hev_rbtree_node_next (n))
+        count++;
+    while (size < count * 2)
+        size <<= 1;
+
+    table = calloc (1, sizeof (*table) + sizeof (HevSocks5User *) * size);
+    if (!table)
+        return NULL;
+
+    table->mask = size - 1;
+    table->count = count;
+
+    for (n = hev_rbtree_first (&self->tree); n; n = hev_rbtree_node_next (n)) {
+        HevSocks5User *user = container_of (n, HevSocks5User, node);
+        unsigned int i;
+
+        i = hev_socks5_authenticator_hash (user->name, user->name_len);
+        for (i &= table->mask; table->slots[i]; i = (i + 1) & table->mask)
+            ;
+
+        hev_object_ref (HEV_OBJECT (user));
+        table->slots[i] = user;
+    }
+
+    return table;
+}
+
+static void
+hev_socks5_authenticator_table_free (HevSocks5AuthenticatorTable *table)
+{
+    unsigned int i;
+
+    for (i = 0; i <= table->mask; i++)
+        if (table->slots[i])
+            hev_object_unref (HEV_OBJECT (table->slots[i]));
+
+    free (table);
+}
+
+static HevSocks5User *
+hev_socks5_authenticator_table_get (HevSocks5AuthenticatorTable *table,
+                                    const char *name, unsigned int name_len)
+{
+    unsigned int i;
+
+    i = hev_socks5_authenticator_hash (name, name_len) & table->mask;
+    for (; table->slots[i]; i = (i + 1) & table->mask) {
+        HevSocks5User *user = table->slots[i];
+
+        if ((user->name_len == name_len) &&
+            (memcmp (user->name, name, name_len) == 0))
+            return user;
+    }
+
+    return NULL;
+}
+
 HevSocks5Authenticator *
 hev_socks5_authenticator_new (void)
 {
@@ -41,6 +132,8 @@ hev_socks5_authenticator_add (HevSocks5Authenticator *self, HevSocks5User *user)
 {
     HevRBTreeNode **new = &self->tree.root, *parent = NULL;
 
+    pthread_mutex_lock (&self->mutex);
+
     while (*new) {
         HevSocks5User *this;
         int res;
@@ -60,22 +153,29 @@ hev_socks5_authenticator_add (HevSocks5Authenticator *self, HevSocks5User *user)
         else if (res > 0)
             new = &((*new)->right);
         else
-            return -1;
+            goto fail;
     }
 
     hev_rbtree_node_link (&user->node, parent, new);
     hev_rbtree_insert_color (&self->tree, &user->node);
 
+    pthread_mutex_unlock (&self->mutex);
     return 0;
+
+fail:
+    pthread_mutex_unlock (&self->mutex);
+    return -1;
 }
 
 int
 hev_socks5_authenticator_del (HevSocks5Authenticator *self, const char *name,
                               unsigned int name_len)
 {
-    HevRBTreeNode *node = self->tree.root;
+    HevRBTreeNode *node;
+
+    pthread_mutex_lock (&self->mutex);
 
-    while (node) {
+    for (node = self->tree.root; node;) {
         HevSocks5User *this;
         int res;
 
@@ -94,40 +194,88 @@ hev_socks5_authenticator_del (HevSocks5Authenticator *self, const char *name,
         } else {
             hev_rbtree_erase (&self->tree, node);
             hev_object_unref (HEV_OBJECT (this));
+            pthread_mutex_unlock (&self->mutex);
             return 0;
         }
     }
 
+    pthread_mutex_unlock (&self->mutex);
     return -1;
 }
 
-HevSocks5User *
-hev_socks5_authenticator_get (HevSocks5Authenticator *self, const char *name,
-                              unsigned int name_len)
+int
+hev_socks5_authenticator_commit (HevSocks5Authenticator *self)
 {
-    HevRBTreeNode *node = self->tree.root;
+    _Atomic (HevSocks5AuthenticatorTable *) *tp = (void *)&self->table;
+    atomic_uint *readers = (atomic_uint *)self->readers;
+    atomic_uint *epoch = (atomic_uint *)&self->epoch;
+    HevSocks5AuthenticatorTable *table;
+    unsigned int old;
+
+    pthread_mutex_lock (&self->mutex);
+
+    table = hev_socks5_authenticator_table_new (self);
+    if (!table) {
+        pthread_mutex_unlock (&self->mutex);
+        return -1;
+    }
 
-    while (node) {
-        HevSocks5User *this;
-        int res;
+    /*
+     * Lookups that read the old table counted themselves in the old epoch
+     * before they loaded it, so once that count drops to zero it is unused.
+     */
+    table = atomic_exchange (tp, table);
+    old = atomic_fetch_add (epoch, 1) & 1;
+    while (atomic_load (&readers[old]))
+        sched_yield ();
 
-        this = container_of (node, HevSocks5User, node);
-        if (this->name_len < name_len)
-            res = -1;
-        else if (this->name_len > name_len)
-            res = 1;
-        else
-            res = memcmp (this->name, name, name_len);
+    pthread_mutex_unlock (&self->mutex);
 
-        if (res < 0)
-            node = node->left;
-        else if (res > 0)
-            node = node->right;
-        else
-            return this;
-    }
+    if (table)
+        hev_socks5_authenticator_table_free (table);
 
-    return NULL;
+    LOG_D ("%p socks5 authenticator commit", self);
+
+    return 0;
+}
+
+static HevSocks5User *
+hev_socks5_authenticator_find (HevSocks5Authenticator *self, const char *name,
+                               unsigned int name_len, int ref)
+{
+    _Atomic (HevSocks5AuthenticatorTable *) *tp = (void *)&self->table;
+    atomic_uint *readers = (atomic_uint *)self->readers;
+    atomic_uint *epoch = (atomic_uint *)&self->epoch;
+    HevSocks5AuthenticatorTable *table;
+    HevSocks5User *user = NULL;
+    unsigned int e;
+
+    e = atomic_load (epoch) & 1;
+    atomic_fetch_add (&readers[e], 1);
+
+    table = atomic_load (tp);
+    if (table)
+        user = hev_socks5_authenticator_table_get (table, name, name_len);
+    if (user && ref)
+        hev_object_ref (HEV_OBJECT (user));
+
+    atomic_fetch_sub (&readers[e], 1);
+
+    return user;
+}
+
+HevSocks5User *
+hev_socks5_authenticator_lookup (HevSocks5Authenticator *self,
+                                 const char *name, unsigned int name_len)
+{
+    return hev_socks5_authenticator_find (self, name, name_len, 1);
+}
+
+HevSocks5User *
+hev_socks5_authenticator_get (HevSocks5Authenticator *self, const char *name,
+                              unsigned int name_len)
+{
+    return hev_socks5_authenticator_find (self, name, name_len, 0);
 }
 
 void
@@ -135,6 +283,8 @@ hev_socks5_authenticator_clear (HevSocks5Authenticator *self)
 {
     HevRBTreeNode *n;
 
+    pthread_mutex_lock (&self->mutex);
+
     while ((n = hev_rbtree_first (&self->tree))) {
         HevSocks5User *t;
 
@@ -142,6 +292,8 @@ hev_socks5_authenticator_clear (HevSocks5Authenticator *self)
         hev_rbtree_erase (&self->tree, n);
         hev_object_unref (HEV_OBJECT (t));
     }
+
+    pthread_mutex_unlock (&self->mutex);
 }
 
 int
@@ -157,6 +309,8 @@ hev_socks5_authenticator_construct (HevSocks5Authenticator *self)
 
     HEV_OBJECT (self)->klass = HEV_SOCKS5_AUTHENTICATOR_TYPE;
 
+    pthread_mutex_init (&self->mutex, NULL);
+
     return 0;
 }
 
@@ -168,6 +322,9 @@ hev_socks5_authenticator_destruct (HevObject *base)
     LOG_D ("%p socks5 authenticator destruct", self);
 
     hev_socks5_authenticator_clear (self);
+    if (self->table)
+        hev_socks5_authenticator_table_free (self->table);
+    pthread_mutex_destroy (&self->mutex);
 
     HEV_OBJECT_ATOMIC_TYPE->destruct (base);
     free (base);
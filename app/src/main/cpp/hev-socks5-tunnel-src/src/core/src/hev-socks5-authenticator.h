@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-socks5-authenticator.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2023 hev
+ Copyright   : Copyright (c) 2023 - 2026 hev
  Description : Socks5 Authenticator
  ============================================================================
  */
@@ -10,6 +10,8 @@
 #ifndef __HEV_SOCKS5_AUTHENTICATOR_H__
 #define __HEV_SOCKS5_AUTHENTICATOR_H__
 
+#include <pthread.h>
+
 #include <hev-object-atomic.h>
 
 #include "hev-rbtree.h"
@@ -26,12 +28,26 @@ extern "C" {
 typedef struct _HevSocks5Authenticator HevSocks5Authenticator;
 typedef struct _HevSocks5AuthenticatorClass HevSocks5AuthenticatorClass;
 typedef enum _HevSocks5AuthenticatorType HevSocks5AuthenticatorType;
+typedef struct _HevSocks5AuthenticatorTable HevSocks5AuthenticatorTable;
 
+/*
+ * Users are added to and removed from a tree that only writers touch, under
+ * the mutex. Lookups read an immutable hash table built from the tree by
+ * hev_socks5_authenticator_commit and swapped in atomically, so they never
+ * take a lock and an authenticator can be shared by any number of threads.
+ * A replaced table is freed once the lookups that may still read it are
+ * done, told apart by two reader counts that alternate between commits.
+ */
 struct _HevSocks5Authenticator
 {
     HevObjectAtomic base;
 
     HevRBTree tree;
+    pthread_mutex_t mutex;
+
+    HevSocks5AuthenticatorTable *table;
+    unsigned int epoch;
+    unsigned int readers[2];
 };
 
 struct _HevSocks5AuthenticatorClass
@@ -51,6 +67,22 @@ int hev_socks5_authenticator_add (HevSocks5Authenticator *self,
 int hev_socks5_authenticator_del (HevSocks5Authenticator *self,
                                   const char *name, unsigned int name_len);
 
+/*
+ * Publishes the users added and removed so far to lookups. Returns -1 if
+ * the table could not be allocated, lookups then keep the previous one.
+ * Waits for lookups of the replaced table, meant for a control thread.
+ */
+int hev_socks5_authenticator_commit (HevSocks5Authenticator *self);
+
+/* The committed user of @name, with a reference the caller drops. */
+HevSocks5User *hev_socks5_authenticator_lookup (HevSocks5Authenticator *self,
+                                                const char *name,
+                                                unsigned int name_len);
+
+/*
+ * Like lookup, without a reference. The user may go away with the next
+ * commit, so only use it where no commit can run meanwhile.
+ */
 HevSocks5User *hev_socks5_authenticator_get (HevSocks5Authenticator *self,
                                              const char *name,
                                              unsigned int name_len);
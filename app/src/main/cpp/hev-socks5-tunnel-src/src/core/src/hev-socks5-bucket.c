@@ -0,0 +1,137 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-bucket.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Token Bucket
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stdatomic.h>
+
+#include "hev-socks5-bucket.h"
+
+/* Longest idle time refilled at once (us), more would overflow. */
+#define REFILL_MAX (10000000)
+
+static uint64_t
+hev_socks5_bucket_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+hev_socks5_bucket_init (HevSocks5Bucket *self, unsigned int rate,
+                        unsigned int burst)
+{
+    if (!burst) {
+        burst = rate / 4;
+        if (burst < HEV_SOCKS5_BUCKET_QUANTUM)
+            burst = HEV_SOCKS5_BUCKET_QUANTUM;
+    }
+
+    self->grain = rate / 64;
+    if (self->grain < HEV_SOCKS5_BUCKET_GRAIN)
+        self->grain = HEV_SOCKS5_BUCKET_GRAIN;
+    if (self->grain > HEV_SOCKS5_BUCKET_QUANTUM)
+        self->grain = HEV_SOCKS5_BUCKET_QUANTUM;
+    if (self->grain > burst)
+        self->grain = burst;
+
+    self->rate = rate;
+    self->burst = burst;
+    self->tokens = burst;
+    self->stamp = hev_socks5_bucket_now ();
+}
+
+static int64_t
+hev_socks5_bucket_refill (HevSocks5Bucket *self)
+{
+    atomic_uint_least64_t *stamp = (atomic_uint_least64_t *)&self->stamp;
+    atomic_int_least64_t *tokens = (atomic_int_least64_t *)&self->tokens;
+    uint64_t now, old, from, next;
+    int64_t add, t;
+
+    now = hev_socks5_bucket_now ();
+    old = atomic_load (stamp);
+    if (now <= old)
+        return atomic_load (tokens);
+
+    from = old;
+    if (now - from > REFILL_MAX)
+        from = now - REFILL_MAX;
+
+    /*
+     * The stamp only moves by the time the whole bytes took, so frequent
+     * refills at low rates do not round the fractions away.
+     */
+    add = (now - from) * self->rate / 1000000;
+    if (!add)
+        return atomic_load (tokens);
+    next = from + (uint64_t)add * 1000000 / self->rate;
+
+    /* Whoever moves the stamp adds the tokens for the time it covered. */
+    if (!atomic_compare_exchange_strong (stamp, &old, next))
+        return atomic_load (tokens);
+
+    t = atomic_fetch_add (tokens, add) + add;
+    while (t > self->burst) {
+        if (atomic_compare_exchange_weak (tokens, &t, self->burst))
+            return self->burst;
+    }
+
+    return t;
+}
+
+size_t
+hev_socks5_bucket_peek (HevSocks5Bucket *self, size_t size)
+{
+    int64_t t;
+
+    if (!self->rate)
+        return size;
+
+    t = hev_socks5_bucket_refill (self);
+    if ((t < self->grain) && (t < (int64_t)size))
+        return 0;
+
+    if (t > HEV_SOCKS5_BUCKET_QUANTUM)
+        t = HEV_SOCKS5_BUCKET_QUANTUM;
+    if (size > t)
+        size = t;
+
+    return size;
+}
+
+void
+hev_socks5_bucket_take (HevSocks5Bucket *self, size_t size)
+{
+    atomic_int_least64_t *tokens = (atomic_int_least64_t *)&self->tokens;
+
+    if (self->rate && size)
+        atomic_fetch_sub (tokens, size);
+}
+
+unsigned int
+hev_socks5_bucket_delay (HevSocks5Bucket *self)
+{
+    uint64_t need;
+    int64_t t;
+
+    if (!self->rate)
+        return 0;
+
+    t = hev_socks5_bucket_refill (self);
+    if (t >= self->grain)
+        return 0;
+
+    /* Until a debt is paid and a grain is in. */
+    need = self->grain - t;
+
+    return (need * 1000 + self->rate - 1) / self->rate;
+}
@@ -0,0 +1,73 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-bucket.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Token Bucket
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_BUCKET_H__
+#define __HEV_SOCKS5_BUCKET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Most a single take hands out, so one flow can not drain a shared bucket. */
+#define HEV_SOCKS5_BUCKET_QUANTUM (16384)
+/* Least a take waits for, so a drained bucket is not sipped byte by byte. */
+#define HEV_SOCKS5_BUCKET_GRAIN (1024)
+
+typedef struct _HevSocks5Bucket HevSocks5Bucket;
+
+/*
+ * Token bucket of @rate bytes per second holding at most @burst bytes. The
+ * tokens are refilled from the monotonic clock on use, and an I/O may take
+ * more than is left, leaving a debt the next refills pay back first. An
+ * empty bucket hands out tokens again in grains of about 1/64 s of rate,
+ * so a shaped flow wakes up some 64 times a second at most. All
+ * operations are lock free, so one bucket can be shared by the sessions of
+ * several threads, for example all sessions of a user.
+ */
+struct _HevSocks5Bucket
+{
+    int64_t tokens;
+    uint64_t stamp;
+    unsigned int rate;
+    unsigned int burst;
+    unsigned int grain;
+};
+
+/*
+ * A @rate of 0 leaves the bucket unlimited. A @burst of 0 picks a quarter
+ * second worth of @rate, and never less than one quantum.
+ */
+void hev_socks5_bucket_init (HevSocks5Bucket *self, unsigned int rate,
+                             unsigned int burst);
+
+static inline int
+hev_socks5_bucket_limited (HevSocks5Bucket *self)
+{
+    return self->rate != 0;
+}
+
+/*
+ * Returns how many of @size bytes may go now, at most one quantum, or 0
+ * when fewer than a grain (or @size) are left. The bytes that went are
+ * charged with take.
+ */
+size_t hev_socks5_bucket_peek (HevSocks5Bucket *self, size_t size);
+void hev_socks5_bucket_take (HevSocks5Bucket *self, size_t size);
+
+/* Milliseconds until the bucket holds a grain again, 0 if it does now. */
+unsigned int hev_socks5_bucket_delay (HevSocks5Bucket *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_BUCKET_H__ */
@@ -7,6 +7,7 @@
  ============================================================================
  */
 
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -122,6 +123,34 @@ hev_socks5_client_udp_set_upstream_addr (HevSocks5Client *base,
     return 0;
 }
 
+int
+hev_socks5_client_udp_provide (HevSocks5ClientUDP *self,
+                               HevSocks5ClientProvider provider, void *data)
+{
+    int fd, res;
+
+    fd = provider (data);
+    if (fd < 0) {
+        LOG_D ("%p socks5 client udp provider", self);
+        return -1;
+    }
+
+    res = fcntl (fd, F_GETFL);
+    if ((res < 0) || (fcntl (fd, F_SETFL, res | O_NONBLOCK) < 0)) {
+        LOG_W ("%p socks5 client udp provider nonblock", self);
+        close (fd);
+        return -1;
+    }
+
+    HEV_SOCKS5 (self)->type = HEV_SOCKS5_TYPE_UDP_IN_UDP;
+    HEV_SOCKS5 (self)->udp_associated = 1;
+    HEV_SOCKS5 (self)->udp_provided = 1;
+    self->fd = fd;
+    LOG_D ("%p socks5 client udp provider fd %d", self, fd);
+
+    return 0;
+}
+
 static int
 hev_socks5_client_udp_get_fd (HevSocks5UDP *self)
 {
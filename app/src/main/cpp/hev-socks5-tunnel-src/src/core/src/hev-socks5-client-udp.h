@@ -44,6 +44,18 @@ HevObjectClass *hev_socks5_client_udp_class (void);
 int hev_socks5_client_udp_construct (HevSocks5ClientUDP *self,
                                      HevSocks5Type type);
 
+/*
+ * Stands in for the whole UDP associate: provider returns a connected
+ * datagram socket, e.g. of a tunnel running in the same process, that
+ * carries one socks5 UDP request per message, or -1. The session then
+ * splices without a server connection or handshake, and without UDP
+ * offloads, which the socket may not support. The client owns the fd
+ * afterwards.
+ */
+int hev_socks5_client_udp_provide (HevSocks5ClientUDP *self,
+                                   HevSocks5ClientProvider provider,
+                                   void *data);
+
 HevSocks5ClientUDP *hev_socks5_client_udp_new (HevSocks5Type type);
 
 #ifdef __cplusplus
@@ -7,12 +7,17 @@
  ============================================================================
  */
 
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
+#include <hev-task-system.h>
 #include <hev-memory-allocator.h>
 
 #include "hev-socks5-misc-priv.h"
@@ -22,6 +27,39 @@
 
 #define task_io_yielder hev_socks5_task_io_yielder
 
+#define CONNECT_RACE_DELAY 250
+
+#define HEV_SOCKS5_CLIENT_POOL(p) ((HevSocks5ClientPool *)p)
+#define HEV_SOCKS5_CLIENT_POOL_TYPE (hev_socks5_client_pool_class ())
+
+typedef struct _HevSocks5ClientPool HevSocks5ClientPool;
+typedef struct _HevSocks5ClientAttempt HevSocks5ClientAttempt;
+
+struct _HevSocks5ClientPool
+{
+    HevSocks5Client base;
+
+    HevTask *task;
+    HevSocks5ClientPoolBinder binder;
+    unsigned int size;
+    unsigned int count;
+    int stop;
+    int port;
+    char addr[256];
+    char user[256];
+    char pass[256];
+    int fds[0];
+};
+
+struct _HevSocks5ClientAttempt
+{
+    int fd;
+    int family;
+    struct sockaddr_in6 saddr;
+};
+
+static __thread HevSocks5ClientPool *pool;
+
 static int
 hev_socks5_client_write_auth_methods (HevSocks5Client *self)
 {
@@ -110,6 +148,9 @@ hev_socks5_client_write_request (HevSocks5Client *self)
     case HEV_SOCKS5_TYPE_UDP_IN_UDP:
         req.cmd = HEV_SOCKS5_REQ_CMD_UDP_ASC;
         break;
+    case HEV_SOCKS5_TYPE_RESOLVE:
+        req.cmd = HEV_SOCKS5_REQ_CMD_RESOLVE;
+        break;
     default:
         return -1;
     }
@@ -261,15 +302,83 @@ hev_socks5_client_read_response (HevSocks5Client *self)
     return 0;
 }
 
-int
-hev_socks5_client_connect (HevSocks5Client *self, const char *addr, int port)
+static int
+hev_socks5_client_attempt_start (HevSocks5Client *self,
+                                 HevSocks5ClientAttempt *attempt)
 {
     HevSocks5Class *klass;
-    struct sockaddr_in6 saddr;
     struct sockaddr *sap;
+    int fd, res;
+
+    fd = hev_socks5_socket (SOCK_STREAM);
+    if (fd < 0) {
+        LOG_E ("%p socks5 client socket", self);
+        return -1;
+    }
+
+    sap = (struct sockaddr *)&attempt->saddr;
+    klass = HEV_OBJECT_GET_CLASS (self);
+    res = klass->binder (HEV_SOCKS5 (self), fd, sap);
+    if (res < 0) {
+        LOG_W ("%p socks5 client bind", self);
+        goto exit;
+    }
+
+    res = connect (fd, sap, sizeof (attempt->saddr));
+    if ((res < 0) && (errno != EINPROGRESS)) {
+        LOG_I ("%p socks5 client connect", self);
+        goto exit;
+    }
+
+    attempt->fd = fd;
+    return 0;
+
+exit:
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+    return -1;
+}
+
+static int
+hev_socks5_client_attempt_poll (HevSocks5ClientAttempt *attempt)
+{
+    struct pollfd pfd;
+    socklen_t len;
+    int err;
+
+    pfd.fd = attempt->fd;
+    pfd.events = POLLOUT;
+    if (poll (&pfd, 1, 0) <= 0)
+        return 0;
+
+    len = sizeof (err);
+    if (getsockopt (attempt->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        return -1;
+    if (err)
+        return -1;
+
+    return 1;
+}
+
+static void
+hev_socks5_client_attempt_close (HevSocks5ClientAttempt *attempt)
+{
+    if (attempt->fd < 0)
+        return;
+
+    hev_task_del_fd (hev_task_self (), attempt->fd);
+    close (attempt->fd);
+    attempt->fd = -1;
+}
+
+static int
+hev_socks5_client_open (HevSocks5Client *self, const char *addr, int port)
+{
+    HevSocks5ClientAttempt attempts[2];
+    unsigned long long start;
     int addr_family;
     int timeout;
-    int fd, res;
+    int i, res;
 
     LOG_D ("%p socks5 client connect [%s]:%d", self, addr, port);
 
@@ -277,51 +386,117 @@ hev_socks5_client_connect (HevSocks5Client *self, const char *addr, int port)
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
     addr_family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
-    res = hev_socks5_name_into_sockaddr6 (addr, port, &saddr, &addr_family);
+    res = hev_socks5_name_into_sockaddr6 (addr, port, &attempts[0].saddr,
+                                          &addr_family);
     if (res < 0) {
         LOG_I ("%p socks5 client resolve [%s]:%d", self, addr, port);
         return -1;
     }
 
-    fd = hev_socks5_socket (SOCK_STREAM);
-    if (fd < 0) {
-        LOG_E ("%p socks5 client socket", self);
-        return -1;
+    /*
+     * Happy eyeballs (RFC 8305): the resolver's first family goes first,
+     * and when the family is left open and the address is a name, the other
+     * family joins after CONNECT_RACE_DELAY or as soon as the first fails.
+     * Whichever connects first is kept.
+     */
+    attempts[0].family = addr_family;
+    attempts[0].fd = -1;
+    attempts[1].family = 0;
+    attempts[1].fd = -1;
+    if (hev_socks5_get_addr_family (HEV_SOCKS5 (self)) ==
+        HEV_SOCKS5_ADDR_FAMILY_UNSPEC) {
+        if (addr_family == HEV_SOCKS5_ADDR_FAMILY_IPV6)
+            attempts[1].family = HEV_SOCKS5_ADDR_FAMILY_IPV4;
+        else
+            attempts[1].family = HEV_SOCKS5_ADDR_FAMILY_IPV6;
     }
 
-    sap = (struct sockaddr *)&saddr;
-    klass = HEV_OBJECT_GET_CLASS (self);
-    res = klass->binder (HEV_SOCKS5 (self), fd, sap);
-    if (res < 0) {
-        LOG_W ("%p socks5 client bind", self);
-        hev_task_del_fd (hev_task_self (), fd);
-        close (fd);
-        return -1;
+    start = hev_task_system_get_clock ();
+    if (hev_socks5_client_attempt_start (self, &attempts[0]) < 0)
+        attempts[0].family = 0;
+
+    for (;;) {
+        unsigned long long elapsed;
+        int wait, pending = 0;
+
+        for (i = 0; i < 2; i++) {
+            if (attempts[i].fd < 0)
+                continue;
+
+            res = hev_socks5_client_attempt_poll (&attempts[i]);
+            if (res > 0)
+                goto done;
+            if (res < 0) {
+                LOG_I ("%p socks5 client connect family %d", self,
+                       attempts[i].family);
+                hev_socks5_client_attempt_close (&attempts[i]);
+                attempts[i].family = 0;
+                continue;
+            }
+            pending++;
+        }
+
+        elapsed = hev_task_system_get_clock () - start;
+        if (attempts[1].family && (attempts[1].fd < 0) &&
+            (!pending || (elapsed >= CONNECT_RACE_DELAY))) {
+            int family = attempts[1].family;
+
+            res = hev_socks5_name_into_sockaddr6 (addr, port,
+                                                  &attempts[1].saddr, &family);
+            if ((res < 0) || (family != attempts[1].family) ||
+                (hev_socks5_client_attempt_start (self, &attempts[1]) < 0)) {
+                attempts[1].family = 0;
+            } else {
+                LOG_D ("%p socks5 client connect fallback family %d", self,
+                       family);
+                pending++;
+            }
+            continue;
+        }
+
+        if (!pending) {
+            LOG_I ("%p socks5 client connect", self);
+            return -1;
+        }
+
+        if (elapsed >= timeout) {
+            LOG_I ("%p io timeout", self);
+            goto fail;
+        }
+
+        wait = timeout - elapsed;
+        if (attempts[1].family && (attempts[1].fd < 0) &&
+            (wait > (CONNECT_RACE_DELAY - elapsed)))
+            wait = CONNECT_RACE_DELAY - elapsed;
+        hev_task_sleep (wait);
+
+        /* Terminated while connecting. */
+        if (HEV_SOCKS5 (self)->timeout == 0)
+            goto fail;
     }
 
-    res = hev_task_io_socket_connect (fd, sap, sizeof (saddr), task_io_yielder,
-                                      self);
-    if (res < 0) {
-        LOG_I ("%p socks5 client connect", self);
-        hev_task_del_fd (hev_task_self (), fd);
-        close (fd);
-        return -1;
-    }
+fail:
+    for (i = 0; i < 2; i++)
+        hev_socks5_client_attempt_close (&attempts[i]);
+    return -1;
 
-    HEV_SOCKS5 (self)->fd = fd;
-    hev_socks5_set_addr_family (HEV_SOCKS5 (self), addr_family);
-    LOG_D ("%p socks5 client connect server fd %d", self, fd);
+done:
+    hev_socks5_client_attempt_close (&attempts[!i]);
+
+    HEV_SOCKS5 (self)->fd = attempts[i].fd;
+    hev_socks5_set_addr_family (HEV_SOCKS5 (self), attempts[i].family);
+    self->connect_time = hev_task_system_get_clock () - start;
+    self->connect_fallback = i;
+    LOG_D ("%p socks5 client connect server fd %d", self, attempts[i].fd);
 
     return 0;
 }
 
 static int
-hev_socks5_client_handshake_standard (HevSocks5Client *self)
+hev_socks5_client_authenticate (HevSocks5Client *self)
 {
     int res;
 
-    LOG_D ("%p socks5 client handshake standard", self);
-
     res = hev_socks5_client_write_auth_methods (self);
     if (res < 0)
         return -1;
@@ -343,6 +518,383 @@ hev_socks5_client_handshake_standard (HevSocks5Client *self)
         return -1;
     }
 
+    return 0;
+}
+
+static int
+hev_socks5_client_pool_alive (int fd)
+{
+    char c;
+    int res;
+
+    /* Idle connections the server gave up on read EOF or an error. */
+    res = recv (fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if ((res < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        return 1;
+
+    return 0;
+}
+
+static void
+hev_socks5_client_pool_prune (HevSocks5ClientPool *self)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < self->count; i++) {
+        int fd = self->fds[i];
+
+        if (hev_socks5_client_pool_alive (fd)) {
+            self->fds[n++] = fd;
+        } else {
+            hev_task_del_fd (hev_task_self (), fd);
+            close (fd);
+        }
+    }
+
+    self->count = n;
+}
+
+static int
+hev_socks5_client_pool_take (HevSocks5Client *client, const char *addr,
+                             int port)
+{
+    HevSocks5ClientPool *self = pool;
+    HevSocks5AddrFamily family;
+
+    if (!self || (self->port != port) || strcmp (self->addr, addr))
+        return -1;
+
+    family = hev_socks5_get_addr_family (HEV_SOCKS5 (client));
+    if ((family != HEV_SOCKS5_ADDR_FAMILY_UNSPEC) &&
+        (family != hev_socks5_get_addr_family (HEV_SOCKS5 (self))))
+        return -1;
+
+    while (self->count) {
+        int fd = self->fds[--self->count];
+
+        hev_task_wakeup (self->task);
+
+        if (!hev_socks5_client_pool_alive (fd)) {
+            hev_task_del_fd (hev_task_self (), fd);
+            close (fd);
+            continue;
+        }
+
+        hev_task_mod_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+        HEV_SOCKS5 (client)->fd = fd;
+        family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
+        hev_socks5_set_addr_family (HEV_SOCKS5 (client), family);
+        client->pooled = 1;
+        LOG_D ("%p socks5 client pooled fd %d", client, fd);
+        return 0;
+    }
+
+    return -1;
+}
+
+static int
+hev_socks5_client_pool_fill (HevSocks5ClientPool *self)
+{
+    HevSocks5Client *client = HEV_SOCKS5_CLIENT (self);
+    int timeout;
+    int res, fd;
+
+    res = hev_socks5_client_open (client, self->addr, self->port);
+    if (res < 0)
+        return -1;
+
+    if (!self->stop) {
+        timeout = hev_socks5_get_tcp_timeout ();
+        hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+        res = hev_socks5_client_authenticate (client);
+    }
+
+    fd = HEV_SOCKS5 (self)->fd;
+    HEV_SOCKS5 (self)->fd = -1;
+    if ((res < 0) || self->stop) {
+        hev_task_del_fd (hev_task_self (), fd);
+        close (fd);
+        return -1;
+    }
+
+    self->fds[self->count++] = fd;
+    LOG_D ("%p socks5 client pool fill %u/%u", self, self->count, self->size);
+
+    return 0;
+}
+
+static void
+hev_socks5_client_pool_task_entry (void *data)
+{
+    HevSocks5ClientPool *self = data;
+    unsigned int delay = 0;
+
+    while (!self->stop) {
+        hev_socks5_client_pool_prune (self);
+
+        if (self->count == self->size) {
+            hev_task_yield (HEV_TASK_WAITIO);
+            continue;
+        }
+
+        if (hev_socks5_client_pool_fill (self) == 0) {
+            delay = 0;
+            continue;
+        }
+
+        /* Back off while the server is unreachable. */
+        delay = delay ? delay * 2 : 100;
+        if (delay > 10000)
+            delay = 10000;
+        hev_task_sleep (delay);
+    }
+
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+static int
+hev_socks5_client_pool_bind (HevSocks5 *base, int fd,
+                             const struct sockaddr *dest)
+{
+    HevSocks5ClientPool *self = HEV_SOCKS5_CLIENT_POOL (base);
+
+    if (!self->binder)
+        return 0;
+
+    return self->binder (fd, dest);
+}
+
+static void
+hev_socks5_client_pool_destruct (HevObject *base)
+{
+    HevSocks5ClientPool *self = HEV_SOCKS5_CLIENT_POOL (base);
+    unsigned int i;
+
+    LOG_D ("%p socks5 client pool destruct", self);
+
+    for (i = 0; i < self->count; i++) {
+        hev_task_del_fd (hev_task_self (), self->fds[i]);
+        close (self->fds[i]);
+    }
+
+    HEV_SOCKS5_CLIENT_TYPE->destruct (base);
+}
+
+static HevObjectClass *
+hev_socks5_client_pool_class (void)
+{
+    static HevSocks5ClientClass klass;
+    HevSocks5ClientClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevSocks5Class *skptr;
+
+        memcpy (kptr, HEV_SOCKS5_CLIENT_TYPE, sizeof (HevSocks5ClientClass));
+
+        okptr->name = "HevSocks5ClientPool";
+        okptr->destruct = hev_socks5_client_pool_destruct;
+
+        skptr = HEV_SOCKS5_CLASS (kptr);
+        skptr->binder = hev_socks5_client_pool_bind;
+    }
+
+    return okptr;
+}
+
+int
+hev_socks5_client_pool_init (const char *addr, int port, const char *user,
+                             const char *pass, unsigned int size,
+                             HevSocks5ClientPoolBinder binder)
+{
+    HevSocks5ClientPool *self;
+    int res;
+
+    if (pool || !size)
+        return -1;
+
+    self = hev_malloc0 (sizeof (HevSocks5ClientPool) + sizeof (int) * size);
+    if (!self)
+        return -1;
+
+    res = hev_socks5_client_construct (&self->base, HEV_SOCKS5_TYPE_TCP);
+    if (res < 0) {
+        hev_free (self);
+        return -1;
+    }
+
+    LOG_D ("%p socks5 client pool init [%s]:%d %u", self, addr, port, size);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_CLIENT_POOL_TYPE;
+
+    strncpy (self->addr, addr, sizeof (self->addr) - 1);
+    self->port = port;
+    self->size = size;
+    self->binder = binder;
+    if (user && pass) {
+        strncpy (self->user, user, sizeof (self->user) - 1);
+        strncpy (self->pass, pass, sizeof (self->pass) - 1);
+        hev_socks5_client_set_auth (&self->base, self->user, self->pass);
+    }
+
+    self->task = hev_task_new (-1);
+    if (!self->task) {
+        hev_object_unref (HEV_OBJECT (self));
+        return -1;
+    }
+
+    /* The task holds its own reference until it has seen stop. */
+    hev_object_ref (HEV_OBJECT (self));
+    hev_task_run (self->task, hev_socks5_client_pool_task_entry, self);
+    pool = self;
+
+    return 0;
+}
+
+void
+hev_socks5_client_pool_fini (void)
+{
+    HevSocks5ClientPool *self = pool;
+
+    if (!self)
+        return;
+
+    LOG_D ("%p socks5 client pool fini", self);
+
+    pool = NULL;
+    self->stop = 1;
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), 0);
+    hev_task_wakeup (self->task);
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+int
+hev_socks5_client_connect (HevSocks5Client *self, const char *addr, int port)
+{
+    int timeout;
+    int res;
+
+    res = hev_socks5_client_pool_take (self, addr, port);
+    if (res == 0) {
+        timeout = hev_socks5_get_connect_timeout ();
+        hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+        return 0;
+    }
+
+    return hev_socks5_client_open (self, addr, port);
+}
+
+int
+hev_socks5_client_connect_provider (HevSocks5Client *self,
+                                    HevSocks5ClientProvider provider,
+                                    void *data)
+{
+    HevTask *task = hev_task_self ();
+    int timeout;
+    int fd, res;
+
+    timeout = hev_socks5_get_connect_timeout ();
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
+    fd = provider (data);
+    if (fd < 0) {
+        LOG_I ("%p socks5 client provider", self);
+        return -1;
+    }
+
+    res = fcntl (fd, F_GETFL);
+    if ((res < 0) || (fcntl (fd, F_SETFL, res | O_NONBLOCK) < 0)) {
+        LOG_W ("%p socks5 client provider nonblock", self);
+        close (fd);
+        return -1;
+    }
+
+    res = hev_task_add_fd (task, fd, POLLIN | POLLOUT);
+    if (res < 0)
+        hev_task_mod_fd (task, fd, POLLIN | POLLOUT);
+
+    HEV_SOCKS5 (self)->fd = fd;
+    LOG_D ("%p socks5 client provider fd %d", self, fd);
+
+    return 0;
+}
+
+int
+hev_socks5_client_connect_direct (HevSocks5Client *self)
+{
+    HevSocks5ClientClass *klass;
+    HevSocks5Addr *addr;
+    char host[256];
+    uint16_t port;
+    int timeout;
+    int res;
+
+    klass = HEV_OBJECT_GET_CLASS (self);
+    addr = klass->get_upstream_addr (self);
+
+    switch (addr->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        inet_ntop (AF_INET, addr->ipv4.addr, host, sizeof (host));
+        port = addr->ipv4.port;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        inet_ntop (AF_INET6, addr->ipv6.addr, host, sizeof (host));
+        port = addr->ipv6.port;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        memcpy (host, addr->domain.addr, addr->domain.len);
+        host[addr->domain.len] = '\0';
+        memcpy (&port, addr->domain.addr + addr->domain.len, 2);
+        break;
+    default:
+        LOG_I ("%p socks5 client direct atype %u", self, addr->atype);
+        hev_free (addr);
+        return -1;
+    }
+
+    /* Taken over like by a request, which is never sent here. */
+    hev_free (addr);
+
+    res = hev_socks5_client_open (self, host, ntohs (port));
+    if (res < 0)
+        return -1;
+
+    /* Nothing to negotiate, the stream timeout applies from here on. */
+    timeout = hev_socks5_get_tcp_timeout ();
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
+    return 0;
+}
+
+static int
+hev_socks5_client_handshake_standard (HevSocks5Client *self)
+{
+    int res;
+
+    LOG_D ("%p socks5 client handshake standard", self);
+
+    res = hev_socks5_client_authenticate (self);
+    if (res < 0)
+        return -1;
+
+    res = hev_socks5_client_write_request (self);
+    if (res < 0)
+        return -1;
+
+    res = hev_socks5_client_read_response (self);
+    if (res < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+hev_socks5_client_handshake_pooled (HevSocks5Client *self)
+{
+    int res;
+
+    LOG_D ("%p socks5 client handshake pooled", self);
+
     res = hev_socks5_client_write_request (self);
     if (res < 0)
         return -1;
@@ -402,7 +954,9 @@ hev_socks5_client_handshake (HevSocks5Client *self, int pipeline)
     timeout = hev_socks5_get_tcp_timeout ();
     hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
 
-    if (pipeline)
+    if (self->pooled)
+        res = hev_socks5_client_handshake_pooled (self);
+    else if (pipeline)
         res = hev_socks5_client_handshake_pipeline (self);
     else
         res = hev_socks5_client_handshake_standard (self);
@@ -420,6 +974,133 @@ hev_socks5_client_handshake (HevSocks5Client *self, int pipeline)
     return res;
 }
 
+int
+hev_socks5_client_handshake_optimistic (HevSocks5Client *self)
+{
+    int timeout;
+    int res;
+
+    LOG_D ("%p socks5 client handshake optimistic", self);
+
+    timeout = hev_socks5_get_tcp_timeout ();
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), timeout);
+
+    if (!self->pooled) {
+        res = hev_socks5_client_write_auth_methods (self);
+        if (res < 0)
+            return -1;
+
+        res = hev_socks5_client_write_auth_creds (self);
+        if (res < 0)
+            return -1;
+    }
+
+    res = hev_socks5_client_write_request (self);
+    if (res < 0)
+        return -1;
+
+    self->replies = self->pooled ? 1 : 2;
+
+    return 0;
+}
+
+int
+hev_socks5_client_read_replies (HevSocks5Client *self)
+{
+    HevSocks5ClientClass *klass;
+    HevSocks5ReqRes res;
+    unsigned char buf[32];
+    int fd, len, off = 0;
+    int addrlen;
+
+    if (!self->replies)
+        return 1;
+
+    /* Only peeked until complete, the stream data behind stays queued. */
+    fd = HEV_SOCKS5 (self)->fd;
+    len = recv (fd, buf, sizeof (buf), MSG_PEEK | MSG_DONTWAIT);
+    if (len < 0)
+        return (EAGAIN == errno) ? 0 : -1;
+    if (len == 0) {
+        LOG_I ("%p socks5 client read replies", self);
+        return -1;
+    }
+
+    if (self->replies > 1) {
+        if (len < 2)
+            return 0;
+        if (buf[0] != HEV_SOCKS5_VERSION_5) {
+            LOG_I ("%p socks5 client auth.ver %u", self, buf[0]);
+            return -1;
+        }
+        off = 2;
+
+        if (buf[1] == HEV_SOCKS5_AUTH_METHOD_USER) {
+            if (len < 4)
+                return 0;
+            if (buf[2] != HEV_SOCKS5_AUTH_VERSION_1) {
+                LOG_I ("%p socks5 client auth.res.ver %u", self, buf[2]);
+                return -1;
+            }
+            if (buf[3] != HEV_SOCKS5_RES_REP_SUCC) {
+                LOG_I ("%p socks5 client auth.res.rep %u", self, buf[3]);
+                return -1;
+            }
+            off = 4;
+        } else if (buf[1] != HEV_SOCKS5_AUTH_METHOD_NONE) {
+            LOG_I ("%p socks5 client auth method %d", self, buf[1]);
+            return -1;
+        }
+    }
+
+    if (len < off + 4)
+        return 0;
+    memcpy (&res, &buf[off], 4);
+
+    if (res.ver != HEV_SOCKS5_VERSION_5) {
+        LOG_I ("%p socks5 client res.ver %u", self, res.ver);
+        return -1;
+    }
+
+    if (res.rep != HEV_SOCKS5_RES_REP_SUCC) {
+        LOG_I ("%p socks5 client res.rep %u", self, res.rep);
+        return -1;
+    }
+
+    switch (res.addr.atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        addrlen = 6;
+        break;
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        addrlen = 18;
+        break;
+    default:
+        LOG_I ("%p socks5 client res.atype %u", self, res.addr.atype);
+        return -1;
+    }
+
+    if (len < off + 4 + addrlen)
+        return 0;
+    memcpy (&res.addr.ipv4, &buf[off + 4], addrlen);
+
+    len = off + 4 + addrlen;
+    if (recv (fd, buf, len, MSG_DONTWAIT) != len) {
+        LOG_I ("%p socks5 client read replies", self);
+        return -1;
+    }
+    self->replies = 0;
+
+    klass = HEV_OBJECT_GET_CLASS (self);
+    if (klass->set_upstream_addr (self, &res.addr) < 0) {
+        LOG_W ("%p socks5 client set upstream addr", self);
+        return -1;
+    }
+
+    LOG_D ("%p socks5 client replies done", self);
+
+    return 1;
+}
+
 void
 hev_socks5_client_set_auth (HevSocks5Client *self, const char *user,
                             const char *pass)
@@ -443,6 +1124,8 @@ hev_socks5_client_construct (HevSocks5Client *self, HevSocks5Type type)
 
     HEV_OBJECT (self)->klass = HEV_SOCKS5_CLIENT_TYPE;
 
+    self->connect_time = -1;
+
     return 0;
 }
 
@@ -23,6 +23,8 @@ extern "C" {
 
 typedef struct _HevSocks5Client HevSocks5Client;
 typedef struct _HevSocks5ClientClass HevSocks5ClientClass;
+typedef int (*HevSocks5ClientPoolBinder) (int fd, const struct sockaddr *dest);
+typedef int (*HevSocks5ClientProvider) (void *data);
 
 struct _HevSocks5Client
 {
@@ -33,6 +35,14 @@ struct _HevSocks5Client
         const char *user;
         const char *pass;
     } auth;
+
+    int pooled;
+    /* Milliseconds the TCP connect took, -1 when none was made. */
+    int connect_time;
+    /* The connect was won by the fallback address family. */
+    int connect_fallback;
+    /* Server replies still unread after an optimistic handshake. */
+    int replies;
 };
 
 struct _HevSocks5ClientClass
@@ -50,11 +60,48 @@ int hev_socks5_client_construct (HevSocks5Client *self, HevSocks5Type type);
 int hev_socks5_client_connect (HevSocks5Client *self, const char *addr,
                                int port);
 
+/*
+ * Stands in for the TCP connect to the server: provider returns a
+ * connected stream socket, e.g. a stream of a tunnel running in the same
+ * process, or -1. The client owns the fd afterwards.
+ */
+int hev_socks5_client_connect_provider (HevSocks5Client *self,
+                                        HevSocks5ClientProvider provider,
+                                        void *data);
+
+/*
+ * Connects straight to the destination of the request, bound like a
+ * server connection, for streams that skip the server. No handshake
+ * follows (TCP only).
+ */
+int hev_socks5_client_connect_direct (HevSocks5Client *self);
+
 int hev_socks5_client_handshake (HevSocks5Client *self, int pipeline);
 
+/*
+ * Sends the whole handshake without waiting for any reply, so that stream
+ * data can follow the request at once (TCP only). The replies are then
+ * consumed by hev_socks5_client_read_replies on the non-blocking socket
+ * before the first stream byte is read: 1 when done, 0 when incomplete
+ * and -1 when the server refused or broke the protocol.
+ */
+int hev_socks5_client_handshake_optimistic (HevSocks5Client *self);
+int hev_socks5_client_read_replies (HevSocks5Client *self);
+
 void hev_socks5_client_set_auth (HevSocks5Client *self, const char *user,
                                  const char *pass);
 
+/*
+ * Keeps up to size connections of the calling thread's task system to
+ * addr:port connected and authenticated with user:pass, refilled by a
+ * background task. Clients connecting to the same addr:port take one and
+ * only send the request in their handshake. All three are copied.
+ */
+int hev_socks5_client_pool_init (const char *addr, int port, const char *user,
+                                 const char *pass, unsigned int size,
+                                 HevSocks5ClientPoolBinder binder);
+void hev_socks5_client_pool_fini (void);
+
 #ifdef __cplusplus
 }
 #endif
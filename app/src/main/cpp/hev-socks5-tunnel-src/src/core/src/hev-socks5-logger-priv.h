@@ -16,16 +16,28 @@
 extern "C" {
 #endif
 
-#define LOG_D(fmt...) hev_socks5_logger_log (HEV_SOCKS5_LOGGER_DEBUG, fmt)
-#define LOG_I(fmt...) hev_socks5_logger_log (HEV_SOCKS5_LOGGER_INFO, fmt)
-#define LOG_W(fmt...) hev_socks5_logger_log (HEV_SOCKS5_LOGGER_WARN, fmt)
-#define LOG_E(fmt...) hev_socks5_logger_log (HEV_SOCKS5_LOGGER_ERROR, fmt)
-
-#define LOG_ON() hev_socks5_logger_enabled (HEV_SOCKS5_LOGGER_UNSET)
-#define LOG_ON_D() hev_socks5_logger_enabled (HEV_SOCKS5_LOGGER_DEBUG)
-#define LOG_ON_I() hev_socks5_logger_enabled (HEV_SOCKS5_LOGGER_INFO)
-#define LOG_ON_W() hev_socks5_logger_enabled (HEV_SOCKS5_LOGGER_WARN)
-#define LOG_ON_E() hev_socks5_logger_enabled (HEV_SOCKS5_LOGGER_ERROR)
+#define HEV_SOCKS5_LOGGER_ON(level) \
+    ((int)(level) >= hev_socks5_logger_threshold)
+
+#define HEV_SOCKS5_LOGGER_LOG(level, fmt...)    \
+    do {                                        \
+        if (HEV_SOCKS5_LOGGER_ON (level))       \
+            hev_socks5_logger_log (level, fmt); \
+    } while (0)
+
+#define LOG_D(fmt...) HEV_SOCKS5_LOGGER_LOG (HEV_SOCKS5_LOGGER_DEBUG, fmt)
+#define LOG_I(fmt...) HEV_SOCKS5_LOGGER_LOG (HEV_SOCKS5_LOGGER_INFO, fmt)
+#define LOG_W(fmt...) HEV_SOCKS5_LOGGER_LOG (HEV_SOCKS5_LOGGER_WARN, fmt)
+#define LOG_E(fmt...) HEV_SOCKS5_LOGGER_LOG (HEV_SOCKS5_LOGGER_ERROR, fmt)
+
+#define LOG_ON() HEV_SOCKS5_LOGGER_ON (HEV_SOCKS5_LOGGER_UNSET)
+#define LOG_ON_D() HEV_SOCKS5_LOGGER_ON (HEV_SOCKS5_LOGGER_DEBUG)
+#define LOG_ON_I() HEV_SOCKS5_LOGGER_ON (HEV_SOCKS5_LOGGER_INFO)
+#define LOG_ON_W() HEV_SOCKS5_LOGGER_ON (HEV_SOCKS5_LOGGER_WARN)
+#define LOG_ON_E() HEV_SOCKS5_LOGGER_ON (HEV_SOCKS5_LOGGER_ERROR)
+
+/* Lowest level written; above HEV_SOCKS5_LOGGER_UNSET while logging is off. */
+extern int hev_socks5_logger_threshold;
 
 int hev_socks5_logger_enabled (HevSocks5LoggerLevel level);
 void hev_socks5_logger_log (HevSocks5LoggerLevel level, const char *fmt, ...);
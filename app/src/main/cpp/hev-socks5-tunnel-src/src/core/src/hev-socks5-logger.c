@@ -19,14 +19,14 @@
 #include "hev-socks5-logger.h"
 #include "hev-socks5-logger-priv.h"
 
+int hev_socks5_logger_threshold = HEV_SOCKS5_LOGGER_UNSET + 1;
+
 static int fd = -1;
-static HevSocks5LoggerLevel req_level;
+static HevSocks5LoggerWriter writer;
 
 int
 hev_socks5_logger_init (HevSocks5LoggerLevel level, const char *path)
 {
-    req_level = level;
-
     if (0 == strcmp (path, "stdout"))
         fd = dup (1);
     else if (0 == strcmp (path, "stderr"))
@@ -37,22 +37,29 @@ hev_socks5_logger_init (HevSocks5LoggerLevel level, const char *path)
     if (fd < 0)
         return -1;
 
+    hev_socks5_logger_threshold = level;
     return 0;
 }
 
 void
 hev_socks5_logger_fini (void)
 {
+    hev_socks5_logger_threshold = HEV_SOCKS5_LOGGER_UNSET + 1;
+    writer = NULL;
     close (fd);
+    fd = -1;
+}
+
+void
+hev_socks5_logger_set_writer (HevSocks5LoggerWriter _writer)
+{
+    writer = _writer;
 }
 
 int
 hev_socks5_logger_enabled (HevSocks5LoggerLevel level)
 {
-    if (level >= req_level && fd >= 0)
-        return 1;
-
-    return 0;
+    return HEV_SOCKS5_LOGGER_ON (level);
 }
 
 void
@@ -67,9 +74,18 @@ hev_socks5_logger_log (HevSocks5LoggerLevel level, const char *fmt, ...)
     va_list ap;
     int len;
 
-    if (level < req_level || fd < 0)
+    if (!HEV_SOCKS5_LOGGER_ON (level))
         return;
 
+    if (writer) {
+        va_start (ap, fmt);
+        len = vsnprintf (msg, 1024, fmt, ap);
+        va_end (ap);
+        if (len >= 0)
+            writer (level, msg, (len < 1024) ? len : 1023);
+        return;
+    }
+
     time (&now);
     ti = localtime (&now);
 
@@ -10,6 +10,8 @@
 #ifndef __HEV_SOCKS5_LOGGER_H__
 #define __HEV_SOCKS5_LOGGER_H__
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,9 +27,18 @@ enum _HevSocks5LoggerLevel
     HEV_SOCKS5_LOGGER_UNSET,
 };
 
+typedef void (*HevSocks5LoggerWriter) (HevSocks5LoggerLevel level,
+                                      const char *msg, size_t len);
+
 int hev_socks5_logger_init (HevSocks5LoggerLevel level, const char *path);
 void hev_socks5_logger_fini (void);
 
+/*
+ * Route formatted messages to writer instead of the logger's own fd, so an
+ * embedding application can share one sink. NULL restores the fd.
+ */
+void hev_socks5_logger_set_writer (HevSocks5LoggerWriter writer);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,6 +33,8 @@ int hev_socks5_get_udp_timeout (void);
 
 int hev_socks5_get_task_stack_size (void);
 int hev_socks5_get_udp_copy_buffer_nums (void);
+int hev_socks5_get_udp_offload (void);
+int hev_socks5_get_tcp_splice_buffer_size (void);
 
 #ifdef __cplusplus
 }
@@ -11,11 +11,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
 #include <hev-task-dns.h>
+#include <hev-task-system.h>
 #include <hev-memory-allocator.h>
 
 #include "hev-socks5.h"
@@ -31,6 +33,41 @@ static int udp_timeout = 60000;
 static int task_stack_size = 8192;
 static int udp_recv_buffer_size = 512 * 1024;
 static int udp_copy_buffer_nums = 10;
+static int udp_offload;
+static int tcp_splice_buffer_size = 8192;
+
+/*
+ * getaddrinfo doesn't tell the record TTLs, so answers are kept for a fixed
+ * time, and failures for a shorter one.
+ */
+#define NAME_CACHE_SIZE (64)
+#define NAME_CACHE_TTL (60000)
+#define NAME_CACHE_NEG_TTL (5000)
+
+typedef struct _HevSocks5NameEntry HevSocks5NameEntry;
+typedef struct _HevSocks5NameWaiter HevSocks5NameWaiter;
+
+struct _HevSocks5NameWaiter
+{
+    HevSocks5NameWaiter *next;
+    HevTask *task;
+    struct in6_addr addr;
+    int family;
+    int done;
+};
+
+struct _HevSocks5NameEntry
+{
+    unsigned long long expire;
+    HevSocks5NameWaiter *waiters;
+    struct in6_addr addr;
+    int pending;
+    int hint;
+    int family; /* 0: negative */
+    char name[256];
+};
+
+static __thread HevSocks5NameEntry name_cache[NAME_CACHE_SIZE];
 
 int
 hev_socks5_task_io_yielder (HevTaskYieldType type, void *data)
@@ -84,6 +121,49 @@ hev_socks5_socket (int type)
     return fd;
 }
 
+int
+hev_socks5_socket_set_tcp_options (int fd, const HevSocks5TCPOptions *opts)
+{
+    socklen_t len;
+    int type;
+    int one = 1;
+
+    len = sizeof (type);
+    if (getsockopt (fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+        return -1;
+    if (type != SOCK_STREAM)
+        return 0;
+
+    /* Tuning only, a platform lacking an option keeps its default. */
+    if (opts->nodelay)
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    if (opts->sndbuf)
+        setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &opts->sndbuf,
+                    sizeof (opts->sndbuf));
+    if (opts->rcvbuf)
+        setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &opts->rcvbuf,
+                    sizeof (opts->rcvbuf));
+#if defined(TCP_NOTSENT_LOWAT)
+    if (opts->notsent_lowat)
+        setsockopt (fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &opts->notsent_lowat,
+                    sizeof (opts->notsent_lowat));
+#endif
+#if defined(TCP_QUICKACK)
+    if (opts->quickack)
+        setsockopt (fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof (one));
+#endif
+#if defined(TCP_FASTOPEN_CONNECT)
+    /*
+     * connect () returns at once and the first write, the pipelined
+     * handshake, rides in the SYN once the server has given a cookie.
+     */
+    if (opts->fastopen)
+        setsockopt (fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof (one));
+#endif
+
+    return 0;
+}
+
 const char *
 hev_socks5_addr_into_str (const HevSocks5Addr *addr, char *buf, int len)
 {
@@ -255,8 +335,8 @@ hev_socks5_name_resolve_ipv6 (const char *name, struct sockaddr_in6 *saddr)
 }
 
 static int
-hev_socks5_name_resolve_name (const char *name, struct sockaddr_in6 *saddr,
-                              int *family)
+hev_socks5_name_resolve_query (const char *name, struct sockaddr_in6 *saddr,
+                               int *family)
 {
     struct addrinfo *result = NULL;
     struct addrinfo hints = { 0 };
@@ -293,6 +373,98 @@ hev_socks5_name_resolve_name (const char *name, struct sockaddr_in6 *saddr,
     return res;
 }
 
+static int
+hev_socks5_name_resolve_done (struct sockaddr_in6 *saddr, int *family,
+                              const struct in6_addr *addr, int afamily)
+{
+    if (!afamily)
+        return -1;
+
+    memcpy (&saddr->sin6_addr, addr, sizeof (struct in6_addr));
+    *family = afamily;
+
+    return 0;
+}
+
+static int
+hev_socks5_name_resolve_name (const char *name, struct sockaddr_in6 *saddr,
+                              int *family)
+{
+    HevSocks5NameEntry *entry = NULL;
+    HevSocks5NameEntry *slot = NULL;
+    HevSocks5NameWaiter *waiter;
+    unsigned long long now;
+    int res, i;
+
+    if (strlen (name) >= sizeof (slot->name))
+        return hev_socks5_name_resolve_query (name, saddr, family);
+
+    for (i = 0; i < NAME_CACHE_SIZE; i++) {
+        HevSocks5NameEntry *e = &name_cache[i];
+
+        if (e->name[0] && (e->hint == *family) && !strcmp (e->name, name)) {
+            entry = e;
+            break;
+        }
+
+        /* Unused slots expire at 0, they are taken first. */
+        if (!e->pending && (!slot || (e->expire < slot->expire)))
+            slot = e;
+    }
+
+    now = hev_task_system_get_clock ();
+    if (entry && entry->pending) {
+        HevSocks5NameWaiter w = { 0 };
+
+        /* Coalesced: one query per name, the others wait for its answer. */
+        w.task = hev_task_self ();
+        w.next = entry->waiters;
+        entry->waiters = &w;
+        while (!w.done)
+            hev_task_yield (HEV_TASK_WAITIO);
+
+        return hev_socks5_name_resolve_done (saddr, family, &w.addr, w.family);
+    } else if (entry && (entry->expire > now)) {
+        LOG_D ("socks5 name cache hit %s", name);
+        return hev_socks5_name_resolve_done (saddr, family, &entry->addr,
+                                             entry->family);
+    } else if (entry) {
+        slot = entry;
+    } else if (!slot) {
+        return hev_socks5_name_resolve_query (name, saddr, family);
+    }
+
+    strcpy (slot->name, name);
+    slot->hint = *family;
+    slot->pending = 1;
+    slot->waiters = NULL;
+
+    res = hev_socks5_name_resolve_query (name, saddr, family);
+
+    slot->pending = 0;
+    if (res < 0) {
+        slot->family = 0;
+        slot->expire = hev_task_system_get_clock () + NAME_CACHE_NEG_TTL;
+    } else {
+        slot->family = *family;
+        memcpy (&slot->addr, &saddr->sin6_addr, sizeof (struct in6_addr));
+        slot->expire = hev_task_system_get_clock () + NAME_CACHE_TTL;
+    }
+
+    for (waiter = slot->waiters; waiter;) {
+        HevSocks5NameWaiter *next = waiter->next;
+
+        memcpy (&waiter->addr, &slot->addr, sizeof (struct in6_addr));
+        waiter->family = slot->family;
+        waiter->done = 1;
+        hev_task_wakeup (waiter->task);
+        waiter = next;
+    }
+    slot->waiters = NULL;
+
+    return res;
+}
+
 int
 hev_socks5_name_into_sockaddr6 (const char *name, int port,
                                 struct sockaddr_in6 *saddr, int *family)
@@ -321,37 +493,37 @@ hev_socks5_name_into_sockaddr6 (const char *name, int port,
 void
 hev_socks5_set_connect_timeout (int timeout)
 {
-    connect_timeout = timeout;
+    __atomic_store_n (&connect_timeout, timeout, __ATOMIC_RELAXED);
 }
 
 int
 hev_socks5_get_connect_timeout (void)
 {
-    return connect_timeout;
+    return __atomic_load_n (&connect_timeout, __ATOMIC_RELAXED);
 }
 
 void
 hev_socks5_set_tcp_timeout (int timeout)
 {
-    tcp_timeout = timeout;
+    __atomic_store_n (&tcp_timeout, timeout, __ATOMIC_RELAXED);
 }
 
 int
 hev_socks5_get_tcp_timeout (void)
 {
-    return tcp_timeout;
+    return __atomic_load_n (&tcp_timeout, __ATOMIC_RELAXED);
 }
 
 void
 hev_socks5_set_udp_timeout (int timeout)
 {
-    udp_timeout = timeout;
+    __atomic_store_n (&udp_timeout, timeout, __ATOMIC_RELAXED);
 }
 
 int
 hev_socks5_get_udp_timeout (void)
 {
-    return udp_timeout;
+    return __atomic_load_n (&udp_timeout, __ATOMIC_RELAXED);
 }
 
 void
@@ -383,3 +555,27 @@ hev_socks5_get_udp_copy_buffer_nums (void)
 {
     return udp_copy_buffer_nums;
 }
+
+void
+hev_socks5_set_udp_offload (int enable)
+{
+    udp_offload = enable;
+}
+
+int
+hev_socks5_get_udp_offload (void)
+{
+    return udp_offload;
+}
+
+void
+hev_socks5_set_tcp_splice_buffer_size (int buffer_size)
+{
+    tcp_splice_buffer_size = buffer_size;
+}
+
+int
+hev_socks5_get_tcp_splice_buffer_size (void)
+{
+    return tcp_splice_buffer_size;
+}
@@ -20,6 +20,22 @@
 extern "C" {
 #endif
 
+typedef struct _HevSocks5TCPOptions HevSocks5TCPOptions;
+
+/*
+ * Tuning for upstream TCP sockets, for class binder hooks. Zero fields
+ * keep the system default, quickack and fastopen are Linux only.
+ */
+struct _HevSocks5TCPOptions
+{
+    int nodelay;
+    int quickack;
+    int fastopen;
+    int sndbuf;
+    int rcvbuf;
+    int notsent_lowat;
+};
+
 int hev_socks5_task_io_yielder (HevTaskYieldType type, void *data);
 
 void hev_socks5_set_connect_timeout (int timeout);
@@ -29,6 +45,16 @@ void hev_socks5_set_udp_timeout (int timeout);
 void hev_socks5_set_task_stack_size (int stack_size);
 void hev_socks5_set_udp_recv_buffer_size (int buffer_size);
 void hev_socks5_set_udp_copy_buffer_nums (int nums);
+void hev_socks5_set_udp_offload (int enable);
+
+/*
+ * Initial relay buffer of each direction of a TCP splice. With the splice
+ * syscall it is a pipe that grows while bursts keep filling it.
+ */
+void hev_socks5_set_tcp_splice_buffer_size (int buffer_size);
+
+int hev_socks5_socket_set_tcp_options (int fd,
+                                       const HevSocks5TCPOptions *opts);
 
 int hev_socks5_addr_len (const HevSocks5Addr *addr);
 int hev_socks5_addr_from_name (HevSocks5Addr *addr, const char *name, int port);
@@ -50,6 +50,8 @@ enum _HevSocks5ReqCmd
     HEV_SOCKS5_REQ_CMD_CONNECT = 1,
     HEV_SOCKS5_REQ_CMD_UDP_ASC = 3,
     HEV_SOCKS5_REQ_CMD_FWD_UDP = 5,
+    /* Tor extension, the reply carries the resolved address. */
+    HEV_SOCKS5_REQ_CMD_RESOLVE = 0xf0,
 };
 
 enum _HevSocks5ResRep
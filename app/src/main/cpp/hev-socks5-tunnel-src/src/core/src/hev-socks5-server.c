@@ -7,6 +7,7 @@
  ============================================================================
  */
 
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -171,7 +172,7 @@ hev_socks5_server_read_auth_user (HevSocks5Server *self)
         return -1;
     }
 
-    user = hev_socks5_authenticator_get (self->auth, (char *)name, nlen);
+    user = hev_socks5_authenticator_lookup (self->auth, (char *)name, nlen);
     if (!user) {
         LOG_I ("%p socks5 server auth user: %s pass: %s", self, name, pass);
         return -1;
@@ -180,10 +181,10 @@ hev_socks5_server_read_auth_user (HevSocks5Server *self)
     res = hev_socks5_user_check (user, (char *)pass, plen);
     if (res < 0) {
         LOG_I ("%p socks5 server auth user: %s pass: %s", self, name, pass);
+        hev_object_unref (HEV_OBJECT (user));
         return -1;
     }
 
-    hev_object_ref (HEV_OBJECT (user));
     hev_object_unref (HEV_OBJECT (self->auth));
     self->user = user;
 
@@ -576,6 +577,29 @@ hev_socks5_server_run (HevSocks5Server *self)
     return 0;
 }
 
+/*
+ * Charges what a direction moved to the user's bucket of it and hands out
+ * the next quantum, or the time until there is one.
+ */
+static ssize_t
+hev_socks5_server_limiter (int dir, size_t moved, void *data)
+{
+    HevSocks5Server *self = data;
+    HevSocks5Bucket *bucket;
+    size_t size;
+
+    if (!self->user)
+        return SSIZE_MAX;
+
+    bucket = dir ? &self->user->down : &self->user->up;
+    hev_socks5_bucket_take (bucket, moved);
+    size = hev_socks5_bucket_peek (bucket, SSIZE_MAX);
+    if (size)
+        return size;
+
+    return -(ssize_t)hev_socks5_bucket_delay (bucket);
+}
+
 static int
 hev_socks5_server_get_fd (HevSocks5UDP *self)
 {
@@ -674,10 +698,12 @@ hev_socks5_server_class (void)
 
         tiptr = &kptr->tcp;
         memcpy (tiptr, HEV_SOCKS5_TCP_TYPE, sizeof (HevSocks5TCPIface));
+        tiptr->limiter = hev_socks5_server_limiter;
 
         uiptr = &kptr->udp;
         memcpy (uiptr, HEV_SOCKS5_UDP_TYPE, sizeof (HevSocks5UDPIface));
         uiptr->get_fd = hev_socks5_server_get_fd;
+        uiptr->limiter = hev_socks5_server_limiter;
     }
 
     return okptr;
@@ -0,0 +1,412 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-service.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Service
+ ============================================================================
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-system.h>
+
+#include "hev-compiler.h"
+#include "hev-socks5-misc-priv.h"
+#include "hev-socks5-logger-priv.h"
+
+#include "hev-socks5-service.h"
+
+/* Connections taken per wakeup before the sessions get to run. */
+#define ACCEPT_BATCH (32)
+#define LISTEN_BACKLOG (1024)
+/* Pause after an accept error other than EAGAIN, e.g. out of fds. */
+#define ACCEPT_RETRY_DELAY (100)
+
+typedef struct _HevSocks5ServiceWorker HevSocks5ServiceWorker;
+
+struct _HevSocks5ServiceWorker
+{
+    HevSocks5Service *service;
+    HevSocks5Authenticator *auth;
+    unsigned int auth_gen;
+    pthread_t thread;
+    int started;
+    int fd;
+    int event_fds[2];
+};
+
+struct _HevSocks5Service
+{
+    struct sockaddr_in6 addr;
+    HevSocks5ServiceWorker *workers;
+    int worker_count;
+    int run;
+
+    HevSocks5ServiceFactory factory;
+    void *factory_data;
+
+    pthread_mutex_t mutex;
+    HevSocks5Authenticator *auth;
+    unsigned int auth_gen;
+};
+
+HevSocks5Service *
+hev_socks5_service_new (const struct sockaddr_in6 *addr, int workers)
+{
+    HevSocks5Service *self;
+    int i;
+
+    if (workers <= 0)
+        return NULL;
+
+    self = calloc (1, sizeof (HevSocks5Service));
+    if (!self)
+        return NULL;
+
+    self->workers = calloc (workers, sizeof (HevSocks5ServiceWorker));
+    if (!self->workers) {
+        free (self);
+        return NULL;
+    }
+
+    memcpy (&self->addr, addr, sizeof (self->addr));
+    self->worker_count = workers;
+    pthread_mutex_init (&self->mutex, NULL);
+
+    for (i = 0; i < workers; i++) {
+        HevSocks5ServiceWorker *worker = &self->workers[i];
+
+        worker->service = self;
+        worker->fd = -1;
+        worker->event_fds[0] = -1;
+        worker->event_fds[1] = -1;
+    }
+
+    LOG_D ("%p socks5 service new", self);
+
+    return self;
+}
+
+void
+hev_socks5_service_destroy (HevSocks5Service *self)
+{
+    LOG_D ("%p socks5 service destroy", self);
+
+    hev_socks5_service_stop (self);
+
+    if (self->auth)
+        hev_object_unref (HEV_OBJECT (self->auth));
+    pthread_mutex_destroy (&self->mutex);
+    free (self->workers);
+    free (self);
+}
+
+void
+hev_socks5_service_set_factory (HevSocks5Service *self,
+                                HevSocks5ServiceFactory factory, void *data)
+{
+    self->factory = factory;
+    self->factory_data = data;
+}
+
+void
+hev_socks5_service_set_auth (HevSocks5Service *self,
+                             HevSocks5Authenticator *auth)
+{
+    HevSocks5Authenticator *old;
+
+    if (auth)
+        hev_object_ref (HEV_OBJECT (auth));
+
+    pthread_mutex_lock (&self->mutex);
+    old = self->auth;
+    self->auth = auth;
+    WRITE_ONCE (self->auth_gen, self->auth_gen + 1);
+    pthread_mutex_unlock (&self->mutex);
+
+    if (old)
+        hev_object_unref (HEV_OBJECT (old));
+}
+
+/* Takes the published authenticator if it changed since the last accept. */
+static void
+hev_socks5_service_worker_sync_auth (HevSocks5ServiceWorker *self)
+{
+    HevSocks5Service *service = self->service;
+    HevSocks5Authenticator *old;
+
+    if (READ_ONCE (service->auth_gen) == self->auth_gen)
+        return;
+
+    old = self->auth;
+    pthread_mutex_lock (&service->mutex);
+    self->auth = service->auth;
+    if (self->auth)
+        hev_object_ref (HEV_OBJECT (self->auth));
+    self->auth_gen = service->auth_gen;
+    pthread_mutex_unlock (&service->mutex);
+
+    if (old)
+        hev_object_unref (HEV_OBJECT (old));
+}
+
+static void
+hev_socks5_service_session_entry (void *data)
+{
+    HevSocks5Server *server = data;
+
+    hev_socks5_server_run (server);
+    hev_object_unref (HEV_OBJECT (server));
+}
+
+static void
+hev_socks5_service_worker_spawn (HevSocks5ServiceWorker *self, int fd)
+{
+    HevSocks5Service *service = self->service;
+    HevSocks5Server *server;
+    HevTask *task;
+
+    if (service->factory)
+        server = service->factory (fd, service->factory_data);
+    else
+        server = hev_socks5_server_new (fd);
+    if (!server) {
+        close (fd);
+        return;
+    }
+
+    task = hev_task_new (hev_socks5_get_task_stack_size ());
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (server));
+        return;
+    }
+
+    if (self->auth)
+        hev_socks5_server_set_auth (server, self->auth);
+
+    hev_task_run (task, hev_socks5_service_session_entry, server);
+}
+
+static int
+hev_socks5_service_accept (int fd)
+{
+#ifdef SOCK_NONBLOCK
+    return accept4 (fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int nfd;
+
+    nfd = accept (fd, NULL, NULL);
+    if (nfd >= 0) {
+        fcntl (nfd, F_SETFL, fcntl (nfd, F_GETFL) | O_NONBLOCK);
+        fcntl (nfd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return nfd;
+#endif
+}
+
+static void
+hev_socks5_service_listener_entry (void *data)
+{
+    HevSocks5ServiceWorker *self = data;
+    HevTask *task = hev_task_self ();
+
+    LOG_D ("%p socks5 service listener run", self);
+
+    hev_task_add_fd (task, self->fd, POLLIN);
+    hev_task_add_fd (task, self->event_fds[0], POLLIN);
+
+    while (READ_ONCE (self->service->run)) {
+        int i;
+
+        for (i = 0; i < ACCEPT_BATCH; i++) {
+            int nfd;
+
+            nfd = hev_socks5_service_accept (self->fd);
+            if (nfd < 0)
+                break;
+
+            if (i == 0)
+                hev_socks5_service_worker_sync_auth (self);
+            hev_socks5_service_worker_spawn (self, nfd);
+        }
+
+        if (i == ACCEPT_BATCH) {
+            hev_task_yield (HEV_TASK_YIELD);
+        } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+                   (errno == EINTR)) {
+            hev_task_yield (HEV_TASK_WAITIO);
+        } else {
+            LOG_W ("%p socks5 service accept", self);
+            hev_task_sleep (ACCEPT_RETRY_DELAY);
+        }
+    }
+
+    hev_task_del_fd (task, self->event_fds[0]);
+    hev_task_del_fd (task, self->fd);
+    close (self->fd);
+    self->fd = -1;
+}
+
+static void *
+hev_socks5_service_worker_entry (void *data)
+{
+    HevSocks5ServiceWorker *self = data;
+    HevTask *task;
+
+    if (hev_task_system_init () < 0) {
+        LOG_E ("%p socks5 service task system", self);
+        return NULL;
+    }
+
+    task = hev_task_new (-1);
+    if (task) {
+        hev_task_run (task, hev_socks5_service_listener_entry, self);
+        hev_task_system_run ();
+    }
+
+    if (self->auth) {
+        hev_object_unref (HEV_OBJECT (self->auth));
+        self->auth = NULL;
+    }
+
+    hev_task_system_fini ();
+
+    return NULL;
+}
+
+static int
+hev_socks5_service_listen (struct sockaddr_in6 *addr)
+{
+    socklen_t alen = sizeof (*addr);
+    int one = 1;
+    int zero = 0;
+    int fd;
+
+    fd = socket (AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+#ifdef SO_REUSEPORT
+    setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof (one));
+#endif
+    setsockopt (fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof (zero));
+
+    if ((bind (fd, (struct sockaddr *)addr, sizeof (*addr)) < 0) ||
+        (listen (fd, LISTEN_BACKLOG) < 0)) {
+        close (fd);
+        return -1;
+    }
+
+    /* Port 0 picked one, the other listeners must join it. */
+    getsockname (fd, (struct sockaddr *)addr, &alen);
+
+    return fd;
+}
+
+int
+hev_socks5_service_start (HevSocks5Service *self)
+{
+    struct sockaddr_in6 addr = self->addr;
+    int i;
+
+    LOG_D ("%p socks5 service start", self);
+
+    for (i = 0; i < self->worker_count; i++) {
+        HevSocks5ServiceWorker *worker = &self->workers[i];
+
+#ifdef SO_REUSEPORT
+        worker->fd = hev_socks5_service_listen (&addr);
+#else
+        if (i == 0)
+            worker->fd = hev_socks5_service_listen (&addr);
+        else
+            worker->fd = dup (self->workers[0].fd);
+#endif
+        if (worker->fd < 0) {
+            LOG_E ("%p socks5 service listen", self);
+            goto fail;
+        }
+
+        if (pipe (worker->event_fds) < 0) {
+            LOG_E ("%p socks5 service pipe", self);
+            goto fail;
+        }
+        fcntl (worker->event_fds[0], F_SETFL,
+               fcntl (worker->event_fds[0], F_GETFL) | O_NONBLOCK);
+    }
+
+    self->run = 1;
+
+    for (i = 0; i < self->worker_count; i++) {
+        HevSocks5ServiceWorker *worker = &self->workers[i];
+
+        if (pthread_create (&worker->thread, NULL,
+                            hev_socks5_service_worker_entry, worker)) {
+            LOG_E ("%p socks5 service thread", self);
+            goto fail;
+        }
+        worker->started = 1;
+    }
+
+    return 0;
+
+fail:
+    hev_socks5_service_stop (self);
+    return -1;
+}
+
+void
+hev_socks5_service_stop (HevSocks5Service *self)
+{
+    int i;
+
+    LOG_D ("%p socks5 service stop", self);
+
+    WRITE_ONCE (self->run, 0);
+
+    /* Wake all listeners first, so none accepts while another drains. */
+    for (i = 0; i < self->worker_count; i++) {
+        HevSocks5ServiceWorker *worker = &self->workers[i];
+        char c = 's';
+
+        if (worker->started && (write (worker->event_fds[1], &c, 1) < 0))
+            LOG_W ("%p socks5 service wake", self);
+    }
+
+    for (i = 0; i < self->worker_count; i++) {
+        HevSocks5ServiceWorker *worker = &self->workers[i];
+
+        if (worker->started) {
+            pthread_join (worker->thread, NULL);
+            worker->started = 0;
+        }
+
+        if (worker->fd >= 0) {
+            close (worker->fd);
+            worker->fd = -1;
+        }
+        if (worker->event_fds[0] >= 0) {
+            close (worker->event_fds[0]);
+            close (worker->event_fds[1]);
+            worker->event_fds[0] = -1;
+            worker->event_fds[1] = -1;
+        }
+    }
+}
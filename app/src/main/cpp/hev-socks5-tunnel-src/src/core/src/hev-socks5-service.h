@@ -0,0 +1,66 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-service.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 hev
+ Description : Socks5 Service
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_SERVICE_H__
+#define __HEV_SOCKS5_SERVICE_H__
+
+#include <netinet/in.h>
+
+#include "hev-socks5-server.h"
+#include "hev-socks5-authenticator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevSocks5Service HevSocks5Service;
+
+/*
+ * Creates the server of an accepted connection, on the worker that accepted
+ * it. Returns NULL to refuse the connection, the fd is then closed.
+ */
+typedef HevSocks5Server *(*HevSocks5ServiceFactory) (int fd, void *data);
+
+/*
+ * Accept loop around HevSocks5Server. Each of @workers threads runs its own
+ * task system with its own listener on @addr (SO_REUSEPORT where available,
+ * one shared listener otherwise), accepts in batches and runs every
+ * connection as a task of that thread. @addr is IPv6, IPv4 clients are
+ * taken as mapped addresses.
+ */
+HevSocks5Service *hev_socks5_service_new (const struct sockaddr_in6 *addr,
+                                          int workers);
+void hev_socks5_service_destroy (HevSocks5Service *self);
+
+/* Used for new connections, hev_socks5_server_new if unset. */
+void hev_socks5_service_set_factory (HevSocks5Service *self,
+                                     HevSocks5ServiceFactory factory,
+                                     void *data);
+
+/*
+ * Publishes @auth, NULL for no authentication. Workers switch to it at
+ * their next accept and sessions keep the one they started with. Users
+ * committed to @auth later reach all workers without publishing it again.
+ */
+void hev_socks5_service_set_auth (HevSocks5Service *self,
+                                  HevSocks5Authenticator *auth);
+
+int hev_socks5_service_start (HevSocks5Service *self);
+
+/*
+ * Closes the listeners and waits for the workers. Established sessions run
+ * to their end, bounded by the TCP and UDP timeouts.
+ */
+void hev_socks5_service_stop (HevSocks5Service *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_SOCKS5_SERVICE_H__ */
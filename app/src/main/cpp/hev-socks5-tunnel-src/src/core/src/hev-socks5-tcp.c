@@ -19,6 +19,7 @@ static int
 hev_socks5_tcp_splicer (HevSocks5TCP *self, int fd)
 {
     HevTask *task = hev_task_self ();
+    HevSocks5TCPIface *iface;
     int cfd;
     int res;
 
@@ -32,7 +33,10 @@ hev_socks5_tcp_splicer (HevSocks5TCP *self, int fd)
     if (res < 0)
         hev_task_mod_fd (task, fd, POLLIN | POLLOUT);
 
-    hev_task_io_splice (cfd, cfd, fd, fd, 8192, task_io_yielder, self);
+    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_TCP_TYPE);
+    hev_task_io_splice_limited (cfd, cfd, fd, fd,
+                                hev_socks5_get_tcp_splice_buffer_size (),
+                                iface->limiter, self, task_io_yielder, self);
 
     return 0;
 }
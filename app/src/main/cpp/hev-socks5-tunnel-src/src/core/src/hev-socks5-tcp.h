@@ -10,6 +10,9 @@
 #ifndef __HEV_SOCKS5_TCP_H__
 #define __HEV_SOCKS5_TCP_H__
 
+#include <hev-task.h>
+#include <hev-task-io.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,6 +27,13 @@ typedef struct _HevSocks5TCPIface HevSocks5TCPIface;
 struct _HevSocks5TCPIface
 {
     int (*splicer) (HevSocks5TCP *self, int fd);
+
+    /*
+     * Bounds the reads of the default splicer, called with the object as
+     * data. Direction 0 is from the socks5 peer, 1 is toward it. NULL for
+     * no limit.
+     */
+    HevTaskIOLimiter limiter;
 };
 
 void *hev_socks5_tcp_iface (void);
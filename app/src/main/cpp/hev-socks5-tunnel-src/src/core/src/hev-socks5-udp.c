@@ -11,6 +11,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <netinet/udp.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -24,13 +25,54 @@
 #include "hev-socks5-udp.h"
 
 #define UDP_BUF_SIZE 1500
+#define UDP_BATCH_MIN 2
+#define UDP_STREAM_SIZE 16384
+#define UDP_STREAM_BATCH 16
+#define UDP_GRO_SIZE 65536
+#define UDP_GSO_SIZE 65000
+#define UDP_GSO_SEGS 64
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+/*
+ * UDP in TCP frames are read in bulk into rbuf and cut out of it, and the
+ * tail of a batch the socket didn't take waits in wbuf, so neither side
+ * blocks on a partial frame. UDP in UDP uses rbuf alone, to hold one GRO
+ * read that is cut into segments of rseg bytes.
+ */
+struct _HevSocks5UDPStream
+{
+    unsigned int rhead;
+    unsigned int rtail;
+    unsigned int whead;
+    unsigned int wtail;
+    unsigned int rsize;
+    unsigned int wsize;
+    unsigned int rseg;
+    int gro;
+    uint8_t *rbuf;
+    uint8_t *wbuf;
+    uint8_t data[0];
+};
+
+/* Kernel UDP_SEGMENT support: 0 unknown, 1 works, -1 falls back. */
+static int gso_state;
 
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
     HevSocks5 *self = data;
 
-    if (self->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) {
+    /* A provided socket has no server connection to watch. */
+    if ((self->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) && (self->fd >= 0)) {
         ssize_t res;
         char buf;
 
@@ -44,59 +86,368 @@ task_io_yielder (HevTaskYieldType type, void *data)
     return hev_socks5_task_io_yielder (type, data);
 }
 
+/* The class is final once constructed, so its interface can be kept. */
+static HevSocks5UDPIface *
+hev_socks5_udp_get_iface (HevSocks5UDP *self)
+{
+    HevSocks5 *base = HEV_SOCKS5 (self);
+
+    if (!base->udp_iface)
+        base->udp_iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_UDP_TYPE);
+
+    return base->udp_iface;
+}
+
 int
-hev_socks5_udp_get_fd (HevSocks5UDP *self)
+hev_socks5_udp_lookup_fd (HevSocks5UDP *self)
 {
-    HevSocks5UDPIface *iface;
+    HevSocks5UDPIface *iface = hev_socks5_udp_get_iface (self);
+    int fd;
+
+    fd = iface->get_fd (self);
+    HEV_SOCKS5 (self)->udp_fd = fd;
+
+    return fd;
+}
+
+static HevSocks5UDPStream *
+hev_socks5_udp_get_stream (HevSocks5UDP *self)
+{
+    HevSocks5 *base = HEV_SOCKS5 (self);
+    HevSocks5UDPStream *stream;
+    unsigned int rsize = UDP_STREAM_SIZE;
+    unsigned int wsize = UDP_STREAM_SIZE;
+
+    if (base->udp_stream)
+        return base->udp_stream;
+
+    if (base->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) {
+        rsize = UDP_GRO_SIZE;
+        wsize = 0;
+    }
+
+    stream = hev_malloc0 (sizeof (HevSocks5UDPStream) + rsize + wsize);
+    if (!stream)
+        return NULL;
+
+    stream->rsize = rsize;
+    stream->wsize = wsize;
+    stream->rbuf = stream->data;
+    stream->wbuf = stream->data + rsize;
+    base->udp_stream = stream;
+
+    return stream;
+}
+
+static int
+hev_socks5_udp_stream_flush (HevSocks5UDPStream *stream, int fd)
+{
+    while (stream->whead < stream->wtail) {
+        ssize_t s;
+
+        s = write (fd, stream->wbuf + stream->whead,
+                   stream->wtail - stream->whead);
+        if (s <= 0) {
+            if ((s < 0) && (errno == EAGAIN))
+                return 0;
+            return -1;
+        }
+        stream->whead += s;
+    }
+
+    stream->whead = 0;
+    stream->wtail = 0;
+
+    return 1;
+}
 
-    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_UDP_TYPE);
-    return iface->get_fd (self);
+static int
+hev_socks5_udp_stream_push (HevSocks5UDPStream *stream, HevSocks5UDPMsg *msg)
+{
+    uint8_t *p;
+    int addrlen;
+    size_t len;
+
+    if (stream->whead) {
+        stream->wtail -= stream->whead;
+        memmove (stream->wbuf, stream->wbuf + stream->whead, stream->wtail);
+        stream->whead = 0;
+    }
+
+    addrlen = hev_socks5_addr_len (msg->addr);
+    len = 3 + addrlen + msg->len;
+    if (len > (stream->wsize - stream->wtail))
+        return -1;
+
+    p = stream->wbuf + stream->wtail;
+    p[0] = msg->len >> 8;
+    p[1] = msg->len;
+    p[2] = 3 + addrlen;
+    memcpy (p + 3, msg->addr, addrlen);
+    memcpy (p + 3 + addrlen, msg->buf, msg->len);
+    stream->wtail += len;
+
+    return 0;
+}
+
+static int
+hev_socks5_udp_stream_pop (HevSocks5UDPStream *stream, HevSocks5UDPMsg *msg)
+{
+    uint8_t *p = stream->rbuf + stream->rhead;
+    unsigned int avail = stream->rtail - stream->rhead;
+    unsigned int addrlen;
+    unsigned int datlen;
+
+    if (avail < 3)
+        return 0;
+
+    if (p[2] < 5)
+        return -1;
+
+    addrlen = p[2] - 3;
+    datlen = (p[0] << 8) | p[1];
+    if ((3 + addrlen + datlen) > stream->rsize)
+        return -1;
+    if ((3 + addrlen + datlen) > avail)
+        return 0;
+    if ((addrlen + datlen) > msg->len)
+        return -1;
+
+    memcpy (msg->buf, p + 3, addrlen);
+    memcpy (msg->buf + addrlen, p + 3 + addrlen, datlen);
+    msg->addr = msg->buf;
+    msg->buf += addrlen;
+    msg->len = datlen;
+    stream->rhead += 3 + addrlen + datlen;
+
+    return 1;
 }
 
 static int
 hev_socks5_udp_sendmmsg_tcp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num)
 {
-    struct iovec iov[num * 3];
-    HevSocks5UDPHdr udp[num];
-    struct msghdr mh;
-    int i, res;
+    HevSocks5UDPStream *stream;
+    unsigned int i;
+    int fd, res;
 
-    mh.msg_name = NULL;
-    mh.msg_namelen = 0;
-    mh.msg_control = NULL;
-    mh.msg_controllen = 0;
-    mh.msg_iov = iov;
-    mh.msg_iovlen = num * 3;
+    stream = hev_socks5_udp_get_stream (self);
+    if (!stream)
+        return -1;
 
     for (i = 0; i < num; i++) {
-        int addrlen;
-
-        addrlen = hev_socks5_addr_len (msgv[i].addr);
-        if (addrlen <= 0) {
+        if (hev_socks5_addr_len (msgv[i].addr) <= 0) {
             LOG_D ("%p socks5 udp addr", self);
             return -1;
         }
+        if (msgv[i].len > (UDP_STREAM_SIZE - 3 - 259)) {
+            LOG_D ("%p socks5 udp data len", self);
+            return -1;
+        }
+    }
 
-        udp[i].datlen = htons (msgv[i].len);
-        udp[i].hdrlen = 3 + addrlen;
+    fd = hev_socks5_udp_get_fd (self);
+    for (i = 0;;) {
+        res = hev_socks5_udp_stream_flush (stream, fd);
+        if (res < 0) {
+            LOG_D ("%p socks5 udp write tcp", self);
+            return -1;
+        }
+        if (res > 0)
+            break;
 
-        iov[i * 3].iov_base = &udp[i];
-        iov[i * 3].iov_len = 3;
-        iov[i * 3 + 1].iov_base = msgv[i].addr;
-        iov[i * 3 + 1].iov_len = addrlen;
-        iov[i * 3 + 2].iov_base = msgv[i].buf;
-        iov[i * 3 + 2].iov_len = msgv[i].len;
+        /* Queued behind the pending bytes, frames stay in order. */
+        for (; i < num; i++)
+            if (hev_socks5_udp_stream_push (stream, &msgv[i]) < 0)
+                break;
+        if (i)
+            return i;
+
+        if (task_io_yielder (HEV_TASK_WAITIO, self) < 0)
+            return -1;
+    }
+
+    while (i < num) {
+        struct iovec iov[UDP_STREAM_BATCH * 3];
+        uint8_t udp[UDP_STREAM_BATCH][3];
+        size_t len = 0;
+        unsigned int c;
+        ssize_t s;
+
+        for (c = 0; (c < UDP_STREAM_BATCH) && ((i + c) < num); c++) {
+            HevSocks5UDPMsg *msg = &msgv[i + c];
+            int addrlen = hev_socks5_addr_len (msg->addr);
+
+            udp[c][0] = msg->len >> 8;
+            udp[c][1] = msg->len;
+            udp[c][2] = 3 + addrlen;
+
+            iov[c * 3].iov_base = udp[c];
+            iov[c * 3].iov_len = 3;
+            iov[c * 3 + 1].iov_base = msg->addr;
+            iov[c * 3 + 1].iov_len = addrlen;
+            iov[c * 3 + 2].iov_base = msg->buf;
+            iov[c * 3 + 2].iov_len = msg->len;
+            len += 3 + addrlen + msg->len;
+        }
+
+        s = writev (fd, iov, c * 3);
+        if ((s < 0) && (errno != EAGAIN)) {
+            LOG_D ("%p socks5 udp write tcp", self);
+            return -1;
+        }
+        if (s == len) {
+            i += c;
+            continue;
+        }
+        if (s < 0)
+            s = 0;
+
+        /* Frames the socket took whole are done. */
+        for (; c; c--, i++) {
+            size_t flen = 3 + iov[1].iov_len + iov[2].iov_len;
+
+            if (s < flen)
+                break;
+            s -= flen;
+            memmove (iov, iov + 3, sizeof (struct iovec) * (c - 1) * 3);
+        }
+
+        /* The rest of a frame cut short is queued first, then all after it. */
+        hev_socks5_udp_stream_push (stream, &msgv[i]);
+        stream->whead = s;
+        for (i++; i < num; i++)
+            if (hev_socks5_udp_stream_push (stream, &msgv[i]) < 0)
+                break;
+        break;
     }
 
-    res = hev_task_io_socket_sendmsg (hev_socks5_udp_get_fd (self), &mh,
-                                      MSG_WAITALL, task_io_yielder, self);
+    return i;
+}
+
+static int
+hev_socks5_udp_gso_probe (int fd)
+{
+    socklen_t len;
+    int val;
+
+    if (gso_state)
+        return gso_state > 0;
+
+    /* Kernels without UDP_SEGMENT would send the whole batch as one. */
+    len = sizeof (val);
+    if (getsockopt (fd, SOL_UDP, UDP_SEGMENT, &val, &len) < 0) {
+        LOG_I ("socks5 udp gso unsupported");
+        gso_state = -1;
+        return 0;
+    }
+
+    gso_state = 1;
+    return 1;
+}
+
+static int
+hev_socks5_udp_sendmmsg_gso (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
+                             unsigned int num)
+{
+    union
+    {
+        char buf[CMSG_SPACE (sizeof (uint16_t))];
+        struct cmsghdr align;
+    } ctrl[num];
+    struct iovec iov[num * 3];
+    struct mmsghdr mvec[num];
+    HevSocks5UDPHdr udp[num];
+    unsigned int segs[num];
+    unsigned int i, g;
+    int res, sent;
+
+    /*
+     * Runs of equally sized datagrams go out as one send each, the kernel
+     * cuts them at the segment size. Only the last of a run may be shorter.
+     */
+    for (i = 0, g = 0; i < num; g++) {
+        struct msghdr *mh = &mvec[g].msg_hdr;
+        size_t size = 0, total = 0;
+        unsigned int c;
+
+        for (c = 0; ((i + c) < num) && (c < UDP_GSO_SEGS); c++) {
+            HevSocks5UDPMsg *msg = &msgv[i + c];
+            unsigned int k = (i + c) * 3;
+            int addrlen;
+            size_t len;
+
+            addrlen = hev_socks5_addr_len (msg->addr);
+            if (addrlen <= 0) {
+                LOG_D ("%p socks5 udp addr", self);
+                return -1;
+            }
+
+            len = 3 + addrlen + msg->len;
+            if (c == 0)
+                size = len;
+            else if ((len > size) || ((total + len) > UDP_GSO_SIZE))
+                break;
+
+            udp[i + c].datlen = 0;
+            udp[i + c].hdrlen = 0;
+
+            iov[k].iov_base = &udp[i + c];
+            iov[k].iov_len = 3;
+            iov[k + 1].iov_base = msg->addr;
+            iov[k + 1].iov_len = addrlen;
+            iov[k + 2].iov_base = msg->buf;
+            iov[k + 2].iov_len = msg->len;
+            total += len;
+
+            if (len < size) {
+                c++;
+                break;
+            }
+        }
+
+        mh->msg_name = NULL;
+        mh->msg_namelen = 0;
+        mh->msg_control = NULL;
+        mh->msg_controllen = 0;
+        mh->msg_flags = 0;
+        mh->msg_iov = &iov[i * 3];
+        mh->msg_iovlen = c * 3;
+
+        if (c > 1) {
+            struct cmsghdr *cmsg;
+            uint16_t seg = size;
+
+            mh->msg_control = ctrl[g].buf;
+            mh->msg_controllen = sizeof (ctrl[g].buf);
+            cmsg = CMSG_FIRSTHDR (mh);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN (sizeof (seg));
+            memcpy (CMSG_DATA (cmsg), &seg, sizeof (seg));
+        }
+
+        segs[g] = c;
+        i += c;
+    }
+
+    res = hev_task_io_socket_sendmmsg (hev_socks5_udp_get_fd (self), mvec, g,
+                                       MSG_WAITALL, task_io_yielder, self);
+    if ((res == -1) && ((errno == EIO) || (errno == EINVAL))) {
+        /* No segmentation offload on the route's device. */
+        LOG_I ("%p socks5 udp gso fallback", self);
+        gso_state = -1;
+        return 0;
+    }
     if (res <= 0) {
-        LOG_D ("%p socks5 udp write tcp", self);
-        return -1;
+        LOG_D ("%p socks5 udp write udp", self);
+        return res < 0 ? res : -1;
     }
 
-    return num;
+    for (i = 0, sent = 0; i < res; i++)
+        sent += segs[i];
+
+    return sent;
 }
 
 static int
@@ -108,6 +459,13 @@ hev_socks5_udp_sendmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
     HevSocks5UDPHdr udp[num];
     int i, res;
 
+    if (hev_socks5_get_udp_offload () && !HEV_SOCKS5 (self)->udp_provided &&
+        (num > 1) && hev_socks5_udp_gso_probe (hev_socks5_udp_get_fd (self))) {
+        res = hev_socks5_udp_sendmmsg_gso (self, msgv, num);
+        if (res)
+            return res;
+    }
+
     for (i = 0; i < num; i++) {
         int addrlen;
 
@@ -161,74 +519,192 @@ static int
 hev_socks5_udp_recvmmsg_tcp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num, int nonblock)
 {
-    int i, fd, rlen = 0;
+    HevSocks5UDPStream *stream;
+    unsigned int n = 0;
+    int fd, res;
+
+    stream = hev_socks5_udp_get_stream (self);
+    if (!stream)
+        return -1;
 
     fd = hev_socks5_udp_get_fd (self);
 
-    if (nonblock)
-        nonblock = MSG_DONTWAIT;
+    /* Splicers receive every round, so queued frames leave from here too. */
+    if (stream->wtail && (hev_socks5_udp_stream_flush (stream, fd) < 0)) {
+        LOG_D ("%p socks5 udp write tcp", self);
+        return -1;
+    }
 
-    for (i = 0; i < num; i++) {
-        HevSocks5UDPHdr udp;
-        struct iovec iov[2];
-        struct msghdr mh;
-        int addrlen;
-        int res;
+    for (;;) {
+        int flags;
 
-        res = hev_task_io_socket_recv (fd, &udp, 5, nonblock, task_io_yielder,
-                                       self);
-        if (res > 0 && res < 5)
-            res += hev_task_io_socket_recv (fd, (void *)&udp + res, 5 - res,
-                                            MSG_WAITALL, task_io_yielder, self);
-        if (res != 5) {
-            if (rlen > 0)
+        for (; n < num; n++) {
+            res = hev_socks5_udp_stream_pop (stream, &msgv[n]);
+            if (res < 0) {
+                LOG_D ("%p socks5 udp read udp head", self);
+                return -1;
+            }
+            if (res == 0)
+                break;
+        }
+        if (n == num)
+            break;
+
+        if (stream->rhead) {
+            stream->rtail -= stream->rhead;
+            memmove (stream->rbuf, stream->rbuf + stream->rhead, stream->rtail);
+            stream->rhead = 0;
+        }
+
+        flags = (n || nonblock) ? MSG_DONTWAIT : 0;
+        res = hev_task_io_socket_recv (fd, stream->rbuf + stream->rtail,
+                                       stream->rsize - stream->rtail, flags,
+                                       task_io_yielder, self);
+        if (res <= 0) {
+            if (n)
                 break;
             if (res != -1 || errno != EAGAIN)
-                LOG_D ("%p socks5 udp read udp head", self);
+                LOG_D ("%p socks5 udp read udp data", self);
             return res;
         }
+        stream->rtail += res;
+    }
 
-        if (udp.hdrlen < 5) {
-            LOG_D ("%p socks5 udp head len", self);
-            return -1;
+    return n;
+}
+
+static int
+hev_socks5_udp_msg_parse (HevSocks5UDP *self, HevSocks5UDPMsg *msg,
+                          size_t len)
+{
+    HevSocks5UDPHdr *udp = msg->buf;
+    int addrlen, doff;
+
+    msg->len = len;
+    if (msg->len < 4) {
+        msg->addr = NULL;
+        msg->len = 0;
+        return 0;
+    }
+
+    addrlen = hev_socks5_addr_len (&udp->addr);
+    if (addrlen <= 0) {
+        LOG_D ("%p socks5 udp addr", self);
+        return -1;
+    }
+
+    doff = 3 + addrlen;
+    if (doff > msg->len) {
+        LOG_D ("%p socks5 udp data len", self);
+        return -1;
+    }
+
+    msg->addr = &udp->addr;
+    msg->buf += doff;
+    msg->len -= doff;
+
+    return 0;
+}
+
+static HevSocks5UDPStream *
+hev_socks5_udp_gro_stream (HevSocks5UDP *self, int fd)
+{
+    HevSocks5UDPStream *stream;
+    int one = 1;
+
+    stream = hev_socks5_udp_get_stream (self);
+    if (!stream)
+        return NULL;
+
+    if (!stream->gro) {
+        stream->gro = 1;
+        if (setsockopt (fd, SOL_UDP, UDP_GRO, &one, sizeof (one)) < 0) {
+            LOG_I ("%p socks5 udp gro unsupported", self);
+            stream->gro = -1;
         }
+    }
 
-        addrlen = udp.hdrlen - 3;
-        udp.datlen = ntohs (udp.datlen);
-        if (udp.datlen > (msgv[i].len - addrlen)) {
-            LOG_D ("%p socks5 udp data len", self);
-            return -1;
+    return (stream->gro > 0) ? stream : NULL;
+}
+
+static int
+hev_socks5_udp_recvmmsg_gro (HevSocks5UDP *self, HevSocks5UDPStream *stream,
+                             HevSocks5UDPMsg *msgv, unsigned int num,
+                             int nonblock)
+{
+    union
+    {
+        char buf[CMSG_SPACE (sizeof (int))];
+        struct cmsghdr align;
+    } ctrl;
+    unsigned int n = 0;
+    int fd;
+
+    fd = hev_socks5_udp_get_fd (self);
+
+    for (;;) {
+        struct cmsghdr *cmsg;
+        struct mmsghdr mvec;
+        struct iovec iov;
+        int flags, res;
+
+        /* A coalesced read holds equal segments, the last may be short. */
+        for (; (n < num) && (stream->rhead < stream->rtail); n++) {
+            size_t len = stream->rtail - stream->rhead;
+
+            if (len > stream->rseg)
+                len = stream->rseg;
+            if (len > msgv[n].len)
+                len = 0;
+
+            memcpy (msgv[n].buf, stream->rbuf + stream->rhead, len);
+            stream->rhead += stream->rseg;
+            if (hev_socks5_udp_msg_parse (self, &msgv[n], len) < 0)
+                return -1;
         }
+        if (n == num)
+            break;
+
+        stream->rhead = 0;
+        stream->rtail = 0;
+
+        iov.iov_base = stream->rbuf;
+        iov.iov_len = stream->rsize;
 
-        mh.msg_name = NULL;
-        mh.msg_namelen = 0;
-        mh.msg_control = NULL;
-        mh.msg_controllen = 0;
-        mh.msg_iov = iov;
-        mh.msg_iovlen = 2;
-
-        iov[0].iov_base = msgv[i].buf + 2;
-        iov[0].iov_len = addrlen - 2;
-        iov[1].iov_base = msgv[i].buf + addrlen;
-        iov[1].iov_len = udp.datlen;
-
-        res = hev_task_io_socket_recvmsg (fd, &mh, MSG_WAITALL, task_io_yielder,
-                                          self);
-        if (res != (addrlen - 2 + udp.datlen)) {
-            LOG_D ("%p socks5 udp read udp data", self);
+        mvec.msg_hdr.msg_name = NULL;
+        mvec.msg_hdr.msg_namelen = 0;
+        mvec.msg_hdr.msg_control = ctrl.buf;
+        mvec.msg_hdr.msg_controllen = sizeof (ctrl.buf);
+        mvec.msg_hdr.msg_flags = 0;
+        mvec.msg_hdr.msg_iov = &iov;
+        mvec.msg_hdr.msg_iovlen = 1;
+
+        flags = (n || nonblock) ? MSG_DONTWAIT : 0;
+        res = hev_task_io_socket_recvmmsg (fd, &mvec, 1, flags,
+                                           task_io_yielder, self);
+        if (res <= 0) {
+            if (n)
+                break;
+            if (res != -1 || errno != EAGAIN)
+                LOG_D ("%p socks5 udp read udp", self);
             return res;
         }
 
-        msgv[i].addr = msgv[i].buf;
-        msgv[i].buf = iov[1].iov_base;
-        msgv[i].len = udp.datlen;
-        msgv[i].addr->atype = udp.addr.atype;
-        msgv[i].addr->domain.len = udp.addr.domain.len;
-
-        rlen++;
+        stream->rtail = mvec.msg_len;
+        stream->rseg = mvec.msg_len;
+        for (cmsg = CMSG_FIRSTHDR (&mvec.msg_hdr); cmsg;
+             cmsg = CMSG_NXTHDR (&mvec.msg_hdr, cmsg)) {
+            int seg;
+
+            if ((cmsg->cmsg_level != SOL_UDP) || (cmsg->cmsg_type != UDP_GRO))
+                continue;
+            memcpy (&seg, CMSG_DATA (cmsg), sizeof (seg));
+            if (seg > 0)
+                stream->rseg = seg;
+        }
     }
 
-    return rlen;
+    return n;
 }
 
 static int
@@ -242,6 +718,15 @@ hev_socks5_udp_recvmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
 
     fd = hev_socks5_udp_get_fd (self);
 
+    if (HEV_SOCKS5 (self)->udp_associated && !HEV_SOCKS5 (self)->udp_provided &&
+        hev_socks5_get_udp_offload ()) {
+        HevSocks5UDPStream *stream = hev_socks5_udp_gro_stream (self, fd);
+
+        if (stream)
+            return hev_socks5_udp_recvmmsg_gro (self, stream, msgv, num,
+                                                nonblock);
+    }
+
     if (nonblock)
         nonblock = MSG_DONTWAIT;
 
@@ -278,33 +763,9 @@ hev_socks5_udp_recvmmsg_udp (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
         HEV_SOCKS5 (self)->udp_associated = 1;
     }
 
-    for (i = 0; i < res; i++) {
-        HevSocks5UDPHdr *udp = msgv[i].buf;
-        int addrlen = hev_socks5_addr_len (&udp->addr);
-        int doff;
-
-        msgv[i].len = mvec[i].msg_len;
-        if (msgv[i].len < 4) {
-            msgv[i].addr = NULL;
-            msgv[i].len = 0;
-            continue;
-        }
-
-        if (addrlen <= 0) {
-            LOG_D ("%p socks5 udp addr", self);
-            return -1;
-        }
-
-        doff = 3 + addrlen;
-        if (doff > msgv[i].len) {
-            LOG_D ("%p socks5 udp data len", self);
+    for (i = 0; i < res; i++)
+        if (hev_socks5_udp_msg_parse (self, &msgv[i], mvec[i].msg_len) < 0)
             return -1;
-        }
-
-        msgv[i].addr = &udp->addr;
-        msgv[i].buf += doff;
-        msgv[i].len -= doff;
-    }
 
     return res;
 }
@@ -325,17 +786,17 @@ hev_socks5_udp_recvmmsg (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
 
 static int
 hev_socks5_udp_fwd_f (HevSocks5UDP *self, int fd, void *buf, unsigned int num,
-                      int *bind)
+                      int *bind, size_t *moved)
 {
     HevSocks5UDPMsg svec[num];
-    int i, res;
+    int i, n, res;
 
     for (i = 0; i < num; i++) {
         svec[i].buf = buf + UDP_BUF_SIZE * i;
         svec[i].len = UDP_BUF_SIZE;
     }
 
-    res = hev_socks5_udp_recvmmsg (self, svec, num, 1);
+    res = n = hev_socks5_udp_recvmmsg (self, svec, num, 1);
     if (res > 0) {
         struct sockaddr_in6 addr[res];
         struct mmsghdr dvec[res];
@@ -366,6 +827,7 @@ hev_socks5_udp_fwd_f (HevSocks5UDP *self, int fd, void *buf, unsigned int num,
             dvec[i].msg_hdr.msg_iovlen = 1;
             iov[i].iov_base = svec[i].buf;
             iov[i].iov_len = svec[i].len;
+            *moved += svec[i].len;
         }
 
         if (!*bind) {
@@ -389,17 +851,17 @@ hev_socks5_udp_fwd_f (HevSocks5UDP *self, int fd, void *buf, unsigned int num,
         return -1;
     }
 
-    return 1;
+    return n;
 }
 
 static int
 hev_socks5_udp_fwd_b (HevSocks5UDP *self, int fd, struct mmsghdr *svec,
-                      unsigned int num)
+                      unsigned int num, size_t *moved)
 {
-    int i, res;
+    int i, n, res;
 
-    res = hev_task_io_socket_recvmmsg (fd, svec, num, MSG_DONTWAIT,
-                                       task_io_yielder, self);
+    res = n = hev_task_io_socket_recvmmsg (fd, svec, num, MSG_DONTWAIT,
+                                           task_io_yielder, self);
     if (res > 0) {
         HevSocks5UDPMsg dvec[res];
         char saddr[res][19];
@@ -410,6 +872,7 @@ hev_socks5_udp_fwd_b (HevSocks5UDP *self, int fd, struct mmsghdr *svec,
             dvec[i].addr = (HevSocks5Addr *)&saddr[i];
             hev_socks5_addr_from_sockaddr6 (dvec[i].addr,
                                             svec[i].msg_hdr.msg_name);
+            *moved += dvec[i].len;
         }
         res = hev_socks5_udp_sendmmsg (self, dvec, res);
     }
@@ -420,26 +883,113 @@ hev_socks5_udp_fwd_b (HevSocks5UDP *self, int fd, struct mmsghdr *svec,
         return -1;
     }
 
-    return 1;
+    return n;
+}
+
+/*
+ * Asks the limiter whether a direction may forward a batch. A direction
+ * that found nothing last time goes anyway, so that only one with traffic
+ * sleeps on a hold and an idle one waits for I/O and its timeout.
+ */
+static int
+hev_socks5_udp_limit (HevSocks5UDP *self, HevTaskIOLimiter limiter, int dir,
+                      size_t *moved, int active, unsigned int *hold)
+{
+    unsigned int ms;
+    ssize_t q;
+
+    if (!limiter)
+        return 1;
+
+    q = limiter (dir, *moved, self);
+    *moved = 0;
+    if ((q > 0) || !active)
+        return 1;
+
+    ms = q ? -q : 1;
+    if (!*hold || (ms < *hold))
+        *hold = ms;
+
+    return 0;
+}
+
+/*
+ * The batch doubles after a full one, up to max, and halves after one that
+ * used a quarter or less. Returns the batch for the next receive.
+ */
+static int
+hev_socks5_udp_adapt (int batch, int res_f, int res_b, int max)
+{
+    int res = (res_f > res_b) ? res_f : res_b;
+
+    if (res == batch)
+        batch *= 2;
+    else if ((res > 0) && ((res * 4) <= batch))
+        batch /= 2;
+
+    if (batch < UDP_BATCH_MIN)
+        batch = UDP_BATCH_MIN;
+    if (batch > max)
+        batch = max;
+
+    return batch;
+}
+
+/*
+ * Point the backward receive vectors at the second half of a buffer of two
+ * times num datagrams, the first half is for forward receives.
+ */
+static void
+hev_socks5_udp_vec_init (struct mmsghdr *vec, struct sockaddr_in6 *addr,
+                         struct iovec *iov, void *buf, unsigned int num)
+{
+    int i;
+
+    for (i = 0; i < num; i++) {
+        vec[i].msg_hdr.msg_name = (struct sockaddr *)&addr[i];
+        vec[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in6);
+        vec[i].msg_hdr.msg_control = NULL;
+        vec[i].msg_hdr.msg_controllen = 0;
+        vec[i].msg_hdr.msg_iov = &iov[i];
+        vec[i].msg_hdr.msg_iovlen = 1;
+        iov[i].iov_base = buf + UDP_BUF_SIZE * (num + i);
+        iov[i].iov_len = UDP_BUF_SIZE;
+    }
 }
 
 static int
 hev_socks5_udp_splicer (HevSocks5UDP *self, int fd_b)
 {
     HevTask *task = hev_task_self ();
+    HevSocks5UDPIface *iface;
+    HevTaskIOLimiter limiter;
     int res_f = 1, res_b = 1;
+    int active_f = 0, active_b = 0;
+    size_t moved_f = 0, moved_b = 0;
     int bind = 0;
     void *buf;
     int fd_a;
+    int max;
     int num;
+    int cap;
 
     LOG_D ("%p socks5 udp splicer", self);
 
-    num = hev_socks5_get_udp_copy_buffer_nums ();
-    buf = hev_malloc (UDP_BUF_SIZE * num * 2);
+    /*
+     * Start small and follow the flow: a session that sends now and then
+     * keeps buffers for a couple of datagrams, one that fills its batches
+     * grows them toward the configured copy buffer nums.
+     */
+    max = hev_socks5_get_udp_copy_buffer_nums ();
+    num = (max < UDP_BATCH_MIN) ? max : UDP_BATCH_MIN;
+    cap = num;
+    buf = hev_malloc (UDP_BUF_SIZE * cap * 2);
     if (!buf)
         return -1;
 
+    iface = hev_socks5_udp_get_iface (self);
+    limiter = iface->limiter;
+
     fd_a = hev_socks5_udp_get_fd (self);
     if (hev_task_mod_fd (task, fd_a, POLLIN | POLLOUT) < 0)
         hev_task_add_fd (task, fd_a, POLLIN | POLLOUT);
@@ -447,29 +997,33 @@ hev_socks5_udp_splicer (HevSocks5UDP *self, int fd_b)
         hev_task_mod_fd (task, fd_b, POLLIN | POLLOUT);
 
     {
-        struct mmsghdr vec[num];
-        struct sockaddr_in6 addr[num];
-        struct iovec iov[num];
-        int i;
-
-        for (i = 0; i < num; i++) {
-            vec[i].msg_hdr.msg_name = (struct sockaddr *)&addr[i];
-            vec[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in6);
-            vec[i].msg_hdr.msg_control = NULL;
-            vec[i].msg_hdr.msg_controllen = 0;
-            vec[i].msg_hdr.msg_iov = &iov[i];
-            vec[i].msg_hdr.msg_iovlen = 1;
-            iov[i].iov_base = buf + UDP_BUF_SIZE * (num + i);
-            iov[i].iov_len = UDP_BUF_SIZE;
-        }
+        struct mmsghdr vec[max];
+        struct sockaddr_in6 addr[max];
+        struct iovec iov[max];
+
+        hev_socks5_udp_vec_init (vec, addr, iov, buf, cap);
 
         for (;;) {
             HevTaskYieldType type;
-
-            if (res_f >= 0)
-                res_f = hev_socks5_udp_fwd_f (self, fd_b, buf, num, &bind);
-            if (res_b >= 0)
-                res_b = hev_socks5_udp_fwd_b (self, fd_b, vec, num);
+            unsigned int hold = 0;
+
+            if ((res_f >= 0) && hev_socks5_udp_limit (self, limiter, 0,
+                                                      &moved_f, active_f,
+                                                      &hold)) {
+                res_f = hev_socks5_udp_fwd_f (self, fd_b, buf, num, &bind,
+                                              &moved_f);
+                active_f = res_f > 0;
+            } else if (res_f >= 0) {
+                res_f = 0;
+            }
+            if ((res_b >= 0) && hev_socks5_udp_limit (self, limiter, 1,
+                                                      &moved_b, active_b,
+                                                      &hold)) {
+                res_b = hev_socks5_udp_fwd_b (self, fd_b, vec, num, &moved_b);
+                active_b = res_b > 0;
+            } else if (res_b >= 0) {
+                res_b = 0;
+            }
 
             if (res_f > 0 || res_b > 0)
                 type = HEV_TASK_YIELD;
@@ -478,6 +1032,27 @@ hev_socks5_udp_splicer (HevSocks5UDP *self, int fd_b)
             else
                 break;
 
+            num = hev_socks5_udp_adapt (num, res_f, res_b, max);
+            if ((num > cap) || ((num * 4) <= cap)) {
+                void *nbuf = hev_malloc (UDP_BUF_SIZE * num * 2);
+
+                /* Keep the old buffer and batch if the new one fails. */
+                if (nbuf) {
+                    hev_free (buf);
+                    buf = nbuf;
+                    cap = num;
+                    hev_socks5_udp_vec_init (vec, addr, iov, buf, cap);
+                } else {
+                    num = cap;
+                }
+            }
+
+            /* Out of quota, I/O ends the sleep early to ask again. */
+            if ((type == HEV_TASK_WAITIO) && hold) {
+                hev_task_sleep (hold);
+                continue;
+            }
+
             if (task_io_yielder (type, self))
                 break;
         }
@@ -493,7 +1068,7 @@ hev_socks5_udp_splice (HevSocks5UDP *self, int fd)
 {
     HevSocks5UDPIface *iface;
 
-    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_UDP_TYPE);
+    iface = hev_socks5_udp_get_iface (self);
     return iface->splicer (self, fd);
 }
 
@@ -10,6 +10,10 @@
 #ifndef __HEV_SOCKS5_UDP_H__
 #define __HEV_SOCKS5_UDP_H__
 
+#include <hev-task.h>
+#include <hev-task-io.h>
+
+#include "hev-socks5.h"
 #include "hev-socks5-proto.h"
 
 #ifdef __cplusplus
@@ -22,7 +26,6 @@ extern "C" {
 
 typedef void HevSocks5UDP;
 typedef struct _HevSocks5UDPMsg HevSocks5UDPMsg;
-typedef struct _HevSocks5UDPIface HevSocks5UDPIface;
 
 struct _HevSocks5UDPMsg
 {
@@ -35,11 +38,30 @@ struct _HevSocks5UDPIface
 {
     int (*get_fd) (HevSocks5UDP *self);
     int (*splicer) (HevSocks5UDP *self, int fd);
+
+    /*
+     * Asked before each batch of the default splicer, as for TCP. Datagrams
+     * go whole, so the returned bytes only tell a held direction from one
+     * that may go, and the bytes of the batch are charged next time.
+     */
+    HevTaskIOLimiter limiter;
 };
 
 void *hev_socks5_udp_iface (void);
 
-int hev_socks5_udp_get_fd (HevSocks5UDP *self);
+/*
+ * The socket datagrams go through, -1 until there is one. It does not
+ * change once it exists, so only the first lookup goes through get_fd.
+ */
+int hev_socks5_udp_lookup_fd (HevSocks5UDP *self);
+
+static inline int
+hev_socks5_udp_get_fd (HevSocks5UDP *self)
+{
+    int fd = HEV_SOCKS5 (self)->udp_fd;
+
+    return (fd >= 0) ? fd : hev_socks5_udp_lookup_fd (self);
+}
 
 int hev_socks5_udp_sendmmsg (HevSocks5UDP *self, HevSocks5UDPMsg *msgv,
                              unsigned int num);
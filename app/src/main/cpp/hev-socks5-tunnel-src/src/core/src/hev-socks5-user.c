@@ -36,6 +36,14 @@ hev_socks5_user_new (const char *name, unsigned int name_len, const char *pass,
     return self;
 }
 
+void
+hev_socks5_user_set_rate_limit (HevSocks5User *self, unsigned int up,
+                                unsigned int down, unsigned int burst)
+{
+    hev_socks5_bucket_init (&self->up, up, burst);
+    hev_socks5_bucket_init (&self->down, down, burst);
+}
+
 int
 hev_socks5_user_check (HevSocks5User *self, const char *pass,
                        unsigned int pass_len)
@@ -83,6 +91,9 @@ hev_socks5_user_construct (HevSocks5User *self, const char *name,
     self->pass_len = pass_len;
     memcpy (self->pass, pass, pass_len);
 
+    hev_socks5_bucket_init (&self->up, 0, 0);
+    hev_socks5_bucket_init (&self->down, 0, 0);
+
     return 0;
 }
 
@@ -13,6 +13,7 @@
 #include <hev-object-atomic.h>
 
 #include "hev-rbtree.h"
+#include "hev-socks5-bucket.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +36,10 @@ struct _HevSocks5User
     char *pass;
     unsigned int name_len;
     unsigned int pass_len;
+
+    /* Shared by all sessions of the user, unlimited unless set. */
+    HevSocks5Bucket up;
+    HevSocks5Bucket down;
 };
 
 struct _HevSocks5UserClass
@@ -54,6 +59,15 @@ int hev_socks5_user_construct (HevSocks5User *self, const char *name,
 HevSocks5User *hev_socks5_user_new (const char *name, unsigned int name_len,
                                     const char *pass, unsigned int pass_len);
 
+/*
+ * Caps the traffic of all sessions of the user together, @up from the client
+ * and @down to it, in bytes per second (0 for unlimited) with bursts of up to
+ * @burst bytes (0 for the default, see hev_socks5_bucket_init). Set it before
+ * the user is added to an authenticator, sessions read it unlocked.
+ */
+void hev_socks5_user_set_rate_limit (HevSocks5User *self, unsigned int up,
+                                     unsigned int down, unsigned int burst);
+
 int hev_socks5_user_check (HevSocks5User *self, const char *pass,
                            unsigned int pass_len);
 
@@ -66,6 +66,7 @@ hev_socks5_construct (HevSocks5 *self, HevSocks5Type type)
     HEV_OBJECT (self)->klass = HEV_SOCKS5_TYPE;
 
     self->fd = -1;
+    self->udp_fd = -1;
     self->timeout = -1;
     self->type = type;
     self->addr_family = HEV_SOCKS5_ADDR_FAMILY_UNSPEC;
@@ -85,6 +86,9 @@ hev_socks5_destruct (HevObject *base)
         close (self->fd);
     }
 
+    if (self->udp_stream)
+        hev_free (self->udp_stream);
+
     HEV_OBJECT_TYPE->destruct (base);
     hev_free (base);
 }
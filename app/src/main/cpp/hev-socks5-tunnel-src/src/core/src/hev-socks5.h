@@ -25,6 +25,8 @@ extern "C" {
 
 typedef struct _HevSocks5 HevSocks5;
 typedef struct _HevSocks5Class HevSocks5Class;
+typedef struct _HevSocks5UDPStream HevSocks5UDPStream;
+typedef struct _HevSocks5UDPIface HevSocks5UDPIface;
 typedef enum _HevSocks5Type HevSocks5Type;
 typedef enum _HevSocks5AddrFamily HevSocks5AddrFamily;
 
@@ -34,6 +36,7 @@ enum _HevSocks5Type
     HEV_SOCKS5_TYPE_TCP,
     HEV_SOCKS5_TYPE_UDP_IN_TCP,
     HEV_SOCKS5_TYPE_UDP_IN_UDP,
+    HEV_SOCKS5_TYPE_RESOLVE,
 };
 
 enum _HevSocks5AddrFamily
@@ -50,8 +53,14 @@ struct _HevSocks5
     int fd;
     int timeout;
     int udp_associated;
+    int udp_provided;
     HevSocks5Type type;
     HevSocks5AddrFamily addr_family;
+    HevSocks5UDPStream *udp_stream;
+
+    /* UDP interface and socket, kept from their first lookup. */
+    HevSocks5UDPIface *udp_iface;
+    int udp_fd;
 };
 
 struct _HevSocks5Class
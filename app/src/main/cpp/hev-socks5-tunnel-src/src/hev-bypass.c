@@ -0,0 +1,488 @@
+/*
+ ============================================================================
+ Name        : hev-bypass.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bypass
+ ============================================================================
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-bypass.h"
+
+typedef struct _HevBypassRange HevBypassRange;
+typedef struct _HevBypassNet6 HevBypassNet6;
+
+struct _HevBypassRange
+{
+    uint32_t min; /* host byte order */
+    uint32_t max;
+};
+
+struct _HevBypassNet6
+{
+    unsigned char addr[16];
+    unsigned int prefix;
+};
+
+/* IPv4 networks, sorted and merged for a binary search. */
+static HevBypassRange *ranges;
+static int range_count;
+static int range_size;
+
+static HevBypassNet6 *nets6;
+static int net6_count;
+static int net6_size;
+
+/* Domains in an open addressing table, kept at most half full. */
+static char **names;
+static unsigned int name_size;
+static unsigned int name_count;
+
+static uint32_t
+hev_bypass_hash (const char *name, int len)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    /* FNV-1a */
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static unsigned int
+hev_bypass_name_slot (char **table, unsigned int size, const char *name,
+                      int len)
+{
+    unsigned int mask = size - 1;
+    unsigned int i;
+
+    for (i = hev_bypass_hash (name, len) & mask; table[i]; i = (i + 1) & mask)
+        if (!strncmp (table[i], name, len) && !table[i][len])
+            break;
+
+    return i;
+}
+
+static int
+hev_bypass_name_rehash (unsigned int size)
+{
+    char **table;
+    unsigned int i;
+
+    table = hev_calloc (size, sizeof (char *));
+    if (!table)
+        return -1;
+
+    for (i = 0; i < name_size; i++) {
+        char *name = names[i];
+
+        if (name)
+            table[hev_bypass_name_slot (table, size, name, strlen (name))] =
+                name;
+    }
+
+    if (names)
+        hev_free (names);
+    names = table;
+    name_size = size;
+
+    return 0;
+}
+
+static int
+hev_bypass_add_name (const char *name, int len)
+{
+    unsigned int i;
+    char *copy;
+
+    if (((name_count + 1) * 2 > name_size) &&
+        (hev_bypass_name_rehash (name_size ? name_size * 2 : 64) < 0))
+        return -1;
+
+    i = hev_bypass_name_slot (names, name_size, name, len);
+    if (names[i])
+        return 0;
+
+    copy = hev_malloc (len + 1);
+    if (!copy)
+        return -1;
+
+    memcpy (copy, name, len);
+    copy[len] = '\0';
+    names[i] = copy;
+    name_count++;
+
+    return 0;
+}
+
+static int
+hev_bypass_add_net4 (const unsigned char *addr, unsigned int prefix)
+{
+    HevBypassRange *range;
+    uint32_t ip, mask;
+
+    if (range_count == range_size) {
+        int size = range_size ? range_size * 2 : 64;
+
+        size_t len = sizeof (HevBypassRange) * size;
+
+        range = ranges ? hev_realloc (ranges, len) : hev_malloc (len);
+        if (!range)
+            return -1;
+        ranges = range;
+        range_size = size;
+    }
+
+    memcpy (&ip, addr, 4);
+    ip = ntohl (ip);
+    mask = prefix ? 0xffffffffu << (32 - prefix) : 0;
+
+    range = &ranges[range_count++];
+    range->min = ip & mask;
+    range->max = range->min | ~mask;
+
+    return 0;
+}
+
+static int
+hev_bypass_add_net6 (const unsigned char *addr, unsigned int prefix)
+{
+    HevBypassNet6 *net;
+
+    if (net6_count == net6_size) {
+        int size = net6_size ? net6_size * 2 : 16;
+
+        size_t len = sizeof (HevBypassNet6) * size;
+
+        net = nets6 ? hev_realloc (nets6, len) : hev_malloc (len);
+        if (!net)
+            return -1;
+        nets6 = net;
+        net6_size = size;
+    }
+
+    net = &nets6[net6_count++];
+    memcpy (net->addr, addr, 16);
+    net->prefix = prefix;
+
+    return 0;
+}
+
+static int
+hev_bypass_parse_prefix (const char *str, unsigned int max,
+                         unsigned int *prefix)
+{
+    char *end;
+
+    if (!str) {
+        *prefix = max;
+        return 0;
+    }
+
+    *prefix = strtoul (str, &end, 10);
+    if ((end == str) || *end || (*prefix > max))
+        return -1;
+
+    return 0;
+}
+
+/*
+ * A network with optional prefix length, or a domain, optionally written
+ * as "*.domain" or ".domain". Blank lines and lines starting with '#' are
+ * skipped. Returns -1 only when out of memory.
+ */
+static int
+hev_bypass_add (char *entry)
+{
+    unsigned char addr[16];
+    unsigned int prefix;
+    char *slash;
+    int i, len;
+
+    while (isspace ((unsigned char)*entry))
+        entry++;
+    len = strlen (entry);
+    while (len && isspace ((unsigned char)entry[len - 1]))
+        len--;
+    entry[len] = '\0';
+    if (!len || (entry[0] == '#'))
+        return 0;
+
+    slash = strchr (entry, '/');
+    if (slash)
+        *slash++ = '\0';
+
+    if (inet_pton (AF_INET, entry, addr) == 1) {
+        if (hev_bypass_parse_prefix (slash, 32, &prefix) < 0)
+            goto invalid;
+        return hev_bypass_add_net4 (addr, prefix);
+    }
+
+    if (inet_pton (AF_INET6, entry, addr) == 1) {
+        if (hev_bypass_parse_prefix (slash, 128, &prefix) < 0)
+            goto invalid;
+        return hev_bypass_add_net6 (addr, prefix);
+    }
+
+    if (slash)
+        goto invalid;
+
+    if (!strncmp (entry, "*.", 2))
+        entry += 2;
+    else if (entry[0] == '.')
+        entry++;
+    len = strlen (entry);
+    if (len && (entry[len - 1] == '.'))
+        len--;
+    if (!len || (len > 255))
+        return 0;
+
+    for (i = 0; i < len; i++)
+        entry[i] = tolower ((unsigned char)entry[i]);
+
+    return hev_bypass_add_name (entry, len);
+
+invalid:
+    if (slash)
+        slash[-1] = '/';
+    LOG_W ("bypass invalid network: %s", entry);
+    return 0;
+}
+
+static int
+hev_bypass_load (const char *path)
+{
+    char line[1024];
+    FILE *fp;
+    int res = 0;
+
+    fp = fopen (path, "r");
+    if (!fp) {
+        LOG_E ("bypass open %s", path);
+        return -1;
+    }
+
+    while (fgets (line, sizeof (line), fp)) {
+        res = hev_bypass_add (line);
+        if (res < 0)
+            break;
+    }
+
+    fclose (fp);
+    return res;
+}
+
+static int
+hev_bypass_range_cmp (const void *a, const void *b)
+{
+    const HevBypassRange *ra = a;
+    const HevBypassRange *rb = b;
+
+    if (ra->min != rb->min)
+        return (ra->min < rb->min) ? -1 : 1;
+
+    return 0;
+}
+
+static void
+hev_bypass_merge (void)
+{
+    int i, j = 0;
+
+    if (!range_count)
+        return;
+
+    qsort (ranges, range_count, sizeof (HevBypassRange),
+           hev_bypass_range_cmp);
+
+    /* Overlapping and adjacent networks become one range. */
+    for (i = 0; i < range_count; i++) {
+        HevBypassRange *last = j ? &ranges[j - 1] : NULL;
+
+        if (last && ((last->max == 0xffffffffu) ||
+                     (ranges[i].min <= last->max + 1))) {
+            if (ranges[i].max > last->max)
+                last->max = ranges[i].max;
+            continue;
+        }
+
+        ranges[j++] = ranges[i];
+    }
+
+    range_count = j;
+}
+
+int
+hev_bypass_init (void)
+{
+    const char *rule;
+    const char *file;
+    char buf[256];
+    int i;
+
+    for (i = 0; (rule = hev_config_get_bypass_rule (i)); i++) {
+        strncpy (buf, rule, sizeof (buf) - 1);
+        buf[sizeof (buf) - 1] = '\0';
+        if (hev_bypass_add (buf) < 0)
+            goto fail;
+    }
+
+    file = hev_config_get_bypass_file ();
+    if (file && (hev_bypass_load (file) < 0))
+        goto fail;
+
+    hev_bypass_merge ();
+
+    LOG_D ("bypass init: %d ranges, %d networks6, %u names", range_count,
+           net6_count, name_count);
+
+    return 0;
+
+fail:
+    hev_bypass_fini ();
+    return -1;
+}
+
+void
+hev_bypass_fini (void)
+{
+    unsigned int i;
+
+    /* The task system allocator does not take NULL. */
+    for (i = 0; i < name_size; i++)
+        if (names[i])
+            hev_free (names[i]);
+
+    if (names)
+        hev_free (names);
+    names = NULL;
+    name_size = 0;
+    name_count = 0;
+
+    if (ranges)
+        hev_free (ranges);
+    ranges = NULL;
+    range_count = 0;
+    range_size = 0;
+
+    if (nets6)
+        hev_free (nets6);
+    nets6 = NULL;
+    net6_count = 0;
+    net6_size = 0;
+}
+
+int
+hev_bypass_is_empty (void)
+{
+    return !range_count && !net6_count && !name_count;
+}
+
+static int
+hev_bypass_match_ipv4 (const uint8_t *addr)
+{
+    int lo = 0, hi = range_count;
+    uint32_t ip;
+
+    memcpy (&ip, addr, 4);
+    ip = ntohl (ip);
+
+    /* The last range starting at or below ip is the only candidate. */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (ranges[mid].min <= ip)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo && (ip <= ranges[lo - 1].max);
+}
+
+static int
+hev_bypass_match_ipv6 (const uint8_t *addr)
+{
+    int i;
+
+    for (i = 0; i < net6_count; i++) {
+        const HevBypassNet6 *net = &nets6[i];
+        unsigned int bytes = net->prefix >> 3;
+        unsigned int bits = net->prefix & 7;
+
+        if (memcmp (net->addr, addr, bytes) != 0)
+            continue;
+
+        if (bits) {
+            uint8_t mask = 0xff << (8 - bits);
+
+            if ((net->addr[bytes] ^ addr[bytes]) & mask)
+                continue;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+hev_bypass_match_name (const uint8_t *name, int len)
+{
+    char buf[256];
+    char *p = buf;
+    int i;
+
+    if (len && (name[len - 1] == '.'))
+        len--;
+    for (i = 0; i < len; i++)
+        buf[i] = tolower (name[i]);
+
+    /* The name itself, then each parent domain. */
+    while (len > 0) {
+        char *dot;
+
+        if (names[hev_bypass_name_slot (names, name_size, p, len)])
+            return 1;
+
+        dot = memchr (p, '.', len);
+        if (!dot)
+            break;
+        len -= dot + 1 - p;
+        p = dot + 1;
+    }
+
+    return 0;
+}
+
+int
+hev_bypass_match (const HevSocks5Addr *addr)
+{
+    switch (addr->atype) {
+    case HEV_SOCKS5_ADDR_TYPE_IPV4:
+        return range_count && hev_bypass_match_ipv4 (addr->ipv4.addr);
+    case HEV_SOCKS5_ADDR_TYPE_IPV6:
+        return net6_count && hev_bypass_match_ipv6 (addr->ipv6.addr);
+    case HEV_SOCKS5_ADDR_TYPE_NAME:
+        return name_count &&
+               hev_bypass_match_name (addr->domain.addr, addr->domain.len);
+    }
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ ============================================================================
+ Name        : hev-bypass.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bypass
+ ============================================================================
+ */
+
+#ifndef __HEV_BYPASS_H__
+#define __HEV_BYPASS_H__
+
+#include <hev-socks5-proto.h>
+
+/*
+ * Destinations TCP sessions connect to directly instead of through the
+ * socks5 server. Like the packet filter, the set is compiled once from the
+ * config and then only read, so all workers match against it without
+ * locking.
+ */
+int hev_bypass_init (void);
+void hev_bypass_fini (void);
+
+/*
+ * Returns 1 when the request address is in the set: an address within
+ * one of the networks, or a name (as mapped by mapdns) equal to or below
+ * one of the domains.
+ */
+int hev_bypass_match (const HevSocks5Addr *addr);
+
+int hev_bypass_is_empty (void);
+
+#endif /* __HEV_BYPASS_H__ */
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-config-const.h
  Author      : hev <r@hev.cc>
- Copyright   : Copyright (c) 2019 - 2024 hev
+ Copyright   : Copyright (c) 2019 - 2025 hev
  Description : Config Constants
  ============================================================================
  */
@@ -14,8 +14,17 @@
 #define MINOR_VERSION (14)
 #define MICRO_VERSION (3)
 
+#define FILTER_RULES_MAX (64)
+#define UDP_TIMEOUTS_MAX (32)
+#define BYPASS_RULES_MAX (64)
+#define UPSTREAMS_MAX (8)
+#define TUNNEL_WRITE_BATCH (64)
+
 static const int UDP_BUF_SIZE = 1500;
+static const int UDP_VEC_SIZE = 256;
 static const int UDP_POOL_SIZE = 512;
 static const int TASK_STACK_SIZE = 20480;
+static const int TUNNEL_READ_BATCH_MAX = 256;
+static const int TUNNEL_WORKERS_MAX = 64;
 
 #endif /* __HEV_CONFIG_CONST_H__ */
@@ -2,12 +2,15 @@
  ============================================================================
  Name        : hev-config.c
  Author      : hev <r@hev.cc>
- Copyright   : Copyright (c) 2019 - 2024 hev
+ Copyright   : Copyright (c) 2019 - 2025 hev
  Description : Config
  ============================================================================
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <lwip/tcp.h>
@@ -17,9 +20,44 @@
 #include "hev-config.h"
 #include "hev-config-const.h"
 
+/*
+ * What a reload may change: the socks5 section, the udp-timeout rules and
+ * the misc timeouts. Sessions hold the generation they started with, so
+ * one being replaced lives on until the last of them is gone.
+ */
+struct _HevConfigLive
+{
+    unsigned int refs;
+    unsigned int id;
+
+    HevConfigServer srv;
+    HevConfigUpstream upstreams[UPSTREAMS_MAX];
+    int upstream_count;
+
+    HevConfigUDPTimeout udp_timeouts[UDP_TIMEOUTS_MAX];
+    int udp_timeout_count;
+
+    int connect_timeout;
+    int tcp_read_write_timeout;
+    int udp_read_write_timeout;
+
+    /* Credentials of the upstreams, entry 0 is the server's own. */
+    char auth[UPSTREAMS_MAX][2][256];
+};
+
+static HevConfigLive *live;
+static unsigned int live_id;
+static pthread_mutex_t live_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static char tun_name[64];
 static unsigned int tun_mtu = 8500;
 static int multi_queue;
+static int workers = 1;
+static int read_batch = 16;
+static int offload;
+static int gro;
+static int tcp_mss[2];
+static int tcp_snd_buf;
 
 static char tun_ipv4_address[16];
 static char tun_ipv6_address[64];
@@ -27,26 +65,67 @@ static char tun_ipv6_address[64];
 static char tun_post_up_script[1024];
 static char tun_pre_down_script[1024];
 
-static HevConfigServer srv;
+static HevConfigFilterRule filter_rules[FILTER_RULES_MAX];
+static int filter_rule_count;
+
+static char bypass_rules[BYPASS_RULES_MAX][256];
+static int bypass_rule_count;
+static char bypass_file[1024];
 
 static int mapdns_address;
 static int mapdns_port;
 static int mapdns_network;
 static int mapdns_netmask;
 static int mapdns_cache_size;
+static int mapdns_has_network6;
+static unsigned char mapdns_network6[16];
+static char mapdns_cache_file[1024];
+static int mapdns_prefetch;
 
 static char log_file[1024];
 static char pid_file[1024];
 static int max_session_count;
+static int max_tcp_session_count;
+static int max_udp_session_count;
+static int memory_limit;
+static int session_memory_limit;
+static int tcp_pcb_limit;
+static int udp_pcb_limit;
+static int tcp_seg_limit;
+static int pbuf_ref_limit;
+static int ip_reass_max_bytes = 1048576;
+static int ip_reass_datagram_max_bytes = 65535;
 static int task_stack_size = 86016;
+static int tcp_task_stack_size;
+static int udp_task_stack_size;
+static int task_stack_auto;
 static int tcp_buffer_size = 65536;
+static int tcp_coalesce_size = 4096;
+static int tcp_buffer_budget;
+static int tcp_window_size;
+static int tcp_ooseq_max_bytes = TCP_WND;
+static int tcp_ooseq_max_pbufs = 256;
+static int tcp_time_wait = 120000;
+static int tcp_ack_segments = 2;
+static int tcp_zerocopy_size;
 static int udp_recv_buffer_size = 524288;
 static int udp_copy_buffer_nums = 10;
-static int connect_timeout = 10000;
-static int tcp_read_write_timeout = 300000;
-static int udp_read_write_timeout = 60000;
+static int udp_offload;
+static int session_bulk_rate;
+static int trace_sample;
+static int rate_limit;
+static int session_rate_limit;
+static int rate_burst;
+static int connect_timeout;
+static int tcp_read_write_timeout;
+static int udp_read_write_timeout;
 static int limit_nofile = 65535;
 static int log_level = HEV_LOGGER_WARN;
+static int log_async;
+static int timer_slack;
+static char thread_cpus[256];
+static int thread_nice;
+static int thread_util_min;
 
 static int
 hev_config_parse_tunnel_ipv4 (yaml_document_t *doc, yaml_node_t *base)
@@ -148,6 +227,14 @@ hev_config_parse_tunnel (yaml_document_t *doc, yaml_node_t *base)
                 tun_mtu = strtoul (value, NULL, 10);
             else if (0 == strcmp (key, "multi-queue"))
                 multi_queue = strcasecmp (value, "false");
+            else if (0 == strcmp (key, "workers"))
+                workers = strtoul (value, NULL, 10);
+            else if (0 == strcmp (key, "read-batch"))
+                read_batch = strtoul (value, NULL, 10);
+            else if (0 == strcmp (key, "offload"))
+                offload = strcasecmp (value, "false");
+            else if (0 == strcmp (key, "gro"))
+                gro = strcasecmp (value, "true") == 0;
             else if (0 == strcmp (key, "ipv4"))
                 strncpy (tun_ipv4_address, value, 16 - 1);
             else if (0 == strcmp (key, "ipv6"))
@@ -168,11 +255,106 @@ hev_config_parse_tunnel (yaml_document_t *doc, yaml_node_t *base)
 }
 
 static int
-hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
+hev_config_parse_upstream (yaml_document_t *doc, yaml_node_t *base,
+                           HevConfigLive *self, int index)
+{
+    HevConfigUpstream *up = &self->upstreams[index];
+    yaml_node_pair_t *pair;
+    const char *addr = NULL;
+    const char *port = NULL;
+    const char *user = NULL;
+    const char *pass = NULL;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "port"))
+            port = value;
+        else if (0 == strcmp (key, "address"))
+            addr = value;
+        else if (0 == strcmp (key, "username"))
+            user = value;
+        else if (0 == strcmp (key, "password"))
+            pass = value;
+    }
+
+    if (!addr || !port) {
+        fprintf (stderr, "Can't found socks5.upstreams address or port!\n");
+        return -1;
+    }
+
+    if ((user && !pass) || (!user && pass)) {
+        fprintf (stderr, "Must be set both socks5 username and password!\n");
+        return -1;
+    }
+
+    strncpy (up->addr, addr, 256 - 1);
+    up->port = strtoul (port, NULL, 10);
+
+    if (user && pass) {
+        strncpy (self->auth[index][0], user, 256 - 1);
+        strncpy (self->auth[index][1], pass, 256 - 1);
+        up->user = self->auth[index][0];
+        up->pass = self->auth[index][1];
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_upstreams (yaml_document_t *doc, yaml_node_t *base,
+                            HevConfigLive *self)
+{
+    yaml_node_item_t *item;
+
+    if (!base || YAML_SEQUENCE_NODE != base->type)
+        return -1;
+
+    /* Entry 0 is the socks5 section's own server. */
+    self->upstream_count = 1;
+    for (item = base->data.sequence.items.start;
+         item < base->data.sequence.items.top; item++) {
+        yaml_node_t *node;
+        int index = self->upstream_count;
+
+        if (index >= UPSTREAMS_MAX) {
+            fprintf (stderr, "Too many socks5 upstreams!\n");
+            return -1;
+        }
+
+        node = yaml_document_get_node (doc, *item);
+        if (hev_config_parse_upstream (doc, node, self, index) < 0)
+            return -1;
+        self->upstream_count++;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base,
+                         HevConfigLive *self)
 {
+    HevConfigServer *srv = &self->srv;
     yaml_node_pair_t *pair;
-    static char _user[256];
-    static char _pass[256];
     const char *addr = NULL;
     const char *port = NULL;
     const char *udpm = NULL;
@@ -181,6 +363,16 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
     const char *pass = NULL;
     const char *mark = NULL;
     const char *pipe = NULL;
+    const char *opti = NULL;
+    const char *pool = NULL;
+    const char *umux = NULL;
+    const char *bal = NULL;
+    const char *nodelay = NULL;
+    const char *quickack = NULL;
+    const char *fastopen = NULL;
+    const char *sndbuf = NULL;
+    const char *rcvbuf = NULL;
+    const char *lowat = NULL;
 
     if (!base || YAML_MAPPING_NODE != base->type)
         return -1;
@@ -199,6 +391,11 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
         key = (const char *)node->data.scalar.value;
 
         node = yaml_document_get_node (doc, pair->value);
+        if (node && (0 == strcmp (key, "upstreams"))) {
+            if (hev_config_parse_upstreams (doc, node, self) < 0)
+                return -1;
+            continue;
+        }
         if (!node || YAML_SCALAR_NODE != node->type)
             break;
         value = (const char *)node->data.scalar.value;
@@ -207,18 +404,38 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
             port = value;
         else if (0 == strcmp (key, "address"))
             addr = value;
+        else if (0 == strcmp (key, "balance"))
+            bal = value;
         else if (0 == strcmp (key, "udp"))
             udpm = value;
         else if (0 == strcmp (key, "udp-address"))
             udpa = value;
+        else if (0 == strcmp (key, "udp-mux"))
+            umux = value;
         else if (0 == strcmp (key, "pipeline"))
             pipe = value;
+        else if (0 == strcmp (key, "optimistic"))
+            opti = value;
+        else if (0 == strcmp (key, "pool-size"))
+            pool = value;
         else if (0 == strcmp (key, "username"))
             user = value;
         else if (0 == strcmp (key, "password"))
             pass = value;
         else if (0 == strcmp (key, "mark"))
             mark = value;
+        else if (0 == strcmp (key, "tcp-nodelay"))
+            nodelay = value;
+        else if (0 == strcmp (key, "tcp-quickack"))
+            quickack = value;
+        else if (0 == strcmp (key, "tcp-fastopen"))
+            fastopen = value;
+        else if (0 == strcmp (key, "tcp-send-buffer-size"))
+            sndbuf = value;
+        else if (0 == strcmp (key, "tcp-recv-buffer-size"))
+            rcvbuf = value;
+        else if (0 == strcmp (key, "tcp-notsent-lowat"))
+            lowat = value;
     }
 
     if (!port) {
@@ -236,27 +453,72 @@ hev_config_parse_socks5 (yaml_document_t *doc, yaml_node_t *base)
         return -1;
     }
 
-    strncpy (srv.addr, addr, 256 - 1);
-    srv.port = strtoul (port, NULL, 10);
+    strncpy (srv->addr, addr, 256 - 1);
+    srv->port = strtoul (port, NULL, 10);
 
     if (pipe && (strcasecmp (pipe, "true") == 0))
-        srv.pipeline = 1;
+        srv->pipeline = 1;
+
+    if (opti && (strcasecmp (opti, "true") == 0))
+        srv->optimistic = 1;
+
+    if (pool)
+        srv->pool_size = strtoul (pool, NULL, 10);
 
     if (udpm && (strcasecmp (udpm, "udp") == 0))
-        srv.udp_in_udp = 1;
+        srv->udp_in_udp = 1;
 
     if (udpa)
-        strncpy (srv.udp_addr, udpa, 256 - 1);
+        strncpy (srv->udp_addr, udpa, 256 - 1);
+
+    if (umux)
+        srv->udp_mux = strtoul (umux, NULL, 10);
 
     if (user && pass) {
-        strncpy (_user, user, 256 - 1);
-        strncpy (_pass, pass, 256 - 1);
-        srv.user = _user;
-        srv.pass = _pass;
+        strncpy (self->auth[0][0], user, 256 - 1);
+        strncpy (self->auth[0][1], pass, 256 - 1);
+        srv->user = self->auth[0][0];
+        srv->pass = self->auth[0][1];
     }
 
     if (mark)
-        srv.mark = strtoul (mark, NULL, 0);
+        srv->mark = strtoul (mark, NULL, 0);
+
+    if (!bal || 0 == strcmp (bal, "round-robin"))
+        srv->balance = HEV_CONFIG_BALANCE_ROUND_ROBIN;
+    else if (0 == strcmp (bal, "least-sessions"))
+        srv->balance = HEV_CONFIG_BALANCE_LEAST_SESSIONS;
+    else if (0 == strcmp (bal, "latency"))
+        srv->balance = HEV_CONFIG_BALANCE_LATENCY;
+    else {
+        fprintf (stderr, "Unknown socks5 balance: %s!\n", bal);
+        return -1;
+    }
+
+    memcpy (self->upstreams[0].addr, srv->addr, sizeof (srv->addr));
+    self->upstreams[0].port = srv->port;
+    self->upstreams[0].user = srv->user;
+    self->upstreams[0].pass = srv->pass;
+    if (!self->upstream_count)
+        self->upstream_count = 1;
+
+    if (nodelay && (strcasecmp (nodelay, "true") == 0))
+        srv->tcp_nodelay = 1;
+
+    if (quickack && (strcasecmp (quickack, "true") == 0))
+        srv->tcp_quickack = 1;
+
+    if (fastopen && (strcasecmp (fastopen, "true") == 0))
+        srv->tcp_fastopen = 1;
+
+    if (sndbuf)
+        srv->tcp_sndbuf = strtoul (sndbuf, NULL, 10);
+
+    if (rcvbuf)
+        srv->tcp_rcvbuf = strtoul (rcvbuf, NULL, 10);
+
+    if (lowat)
+        srv->tcp_notsent_lowat = strtoul (lowat, NULL, 10);
 
     return 0;
 }
@@ -295,8 +557,15 @@ hev_config_parse_mapdns (yaml_document_t *doc, yaml_node_t *base)
             inet_pton (AF_INET, value, &mapdns_network);
         else if (0 == strcmp (key, "netmask"))
             inet_pton (AF_INET, value, &mapdns_netmask);
+        else if (0 == strcmp (key, "network6"))
+            mapdns_has_network6 =
+                inet_pton (AF_INET6, value, mapdns_network6) == 1;
         else if (0 == strcmp (key, "cache-size"))
             mapdns_cache_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-file"))
+            strncpy (mapdns_cache_file, value, 1024 - 1);
+        else if (0 == strcmp (key, "prefetch"))
+            mapdns_prefetch = strcasecmp (value, "true") == 0;
     }
 
     mapdns_network = ntohl (mapdns_network);
@@ -306,25 +575,55 @@ hev_config_parse_mapdns (yaml_document_t *doc, yaml_node_t *base)
 }
 
 static int
-hev_config_parse_log_level (const char *value)
+hev_config_parse_port_range (const char *port, unsigned short *min,
+                             unsigned short *max)
 {
-    if (0 == strcmp (value, "debug"))
-        return HEV_LOGGER_DEBUG;
-    else if (0 == strcmp (value, "info"))
-        return HEV_LOGGER_INFO;
-    else if (0 == strcmp (value, "error"))
-        return HEV_LOGGER_ERROR;
+    char *end;
 
-    return HEV_LOGGER_WARN;
+    *min = strtoul (port, &end, 10);
+    *max = *min;
+    if (*end == '-')
+        *max = strtoul (end + 1, NULL, 10);
+    if (!*min || (*max < *min))
+        return -1;
+
+    return 0;
 }
 
 static int
-hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
+hev_config_parse_bypass_rules (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_item_t *item;
+
+    if (!base || YAML_SEQUENCE_NODE != base->type)
+        return -1;
+
+    for (item = base->data.sequence.items.start;
+         item < base->data.sequence.items.top; item++) {
+        yaml_node_t *node;
+        const char *value;
+
+        if (bypass_rule_count >= BYPASS_RULES_MAX) {
+            fprintf (stderr, "Too many bypass rules!\n");
+            return -1;
+        }
+
+        node = yaml_document_get_node (doc, *item);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            return -1;
+        value = (const char *)node->data.scalar.value;
+
+        strncpy (bypass_rules[bypass_rule_count], value, 256 - 1);
+        bypass_rule_count++;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_bypass (yaml_document_t *doc, yaml_node_t *base)
 {
     yaml_node_pair_t *pair;
-    int tcp_rw_timeout = -1;
-    int udp_rw_timeout = -1;
-    int rw_timeout = -1;
 
     if (!base || YAML_MAPPING_NODE != base->type)
         return -1;
@@ -332,7 +631,7 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
     for (pair = base->data.mapping.pairs.start;
          pair < base->data.mapping.pairs.top; pair++) {
         yaml_node_t *node;
-        const char *key, *value;
+        const char *key;
 
         if (!pair->key || !pair->value)
             break;
@@ -343,68 +642,37 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
         key = (const char *)node->data.scalar.value;
 
         node = yaml_document_get_node (doc, pair->value);
-        if (!node || YAML_SCALAR_NODE != node->type)
-            break;
-        value = (const char *)node->data.scalar.value;
-
-        if (0 == strcmp (key, "task-stack-size"))
-            task_stack_size = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "tcp-buffer-size"))
-            tcp_buffer_size = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "udp-recv-buffer-size"))
-            udp_recv_buffer_size = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "udp-copy-buffer-nums"))
-            udp_copy_buffer_nums = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "max-session-count"))
-            max_session_count = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "connect-timeout"))
-            connect_timeout = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "read-write-timeout"))
-            rw_timeout = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "tcp-read-write-timeout"))
-            tcp_rw_timeout = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "udp-read-write-timeout"))
-            udp_rw_timeout = strtoul (value, NULL, 10);
-        else if (0 == strcmp (key, "pid-file"))
-            strncpy (pid_file, value, 1024 - 1);
-        else if (0 == strcmp (key, "log-file"))
-            strncpy (log_file, value, 1024 - 1);
-        else if (0 == strcmp (key, "log-level"))
-            log_level = hev_config_parse_log_level (value);
-        else if (0 == strcmp (key, "limit-nofile"))
-            limit_nofile = strtol (value, NULL, 10);
+        if (0 == strcmp (key, "rules")) {
+            if (hev_config_parse_bypass_rules (doc, node) < 0)
+                return -1;
+        } else if (0 == strcmp (key, "file")) {
+            if (!node || YAML_SCALAR_NODE != node->type)
+                return -1;
+            strncpy (bypass_file, (const char *)node->data.scalar.value,
+                     1024 - 1);
+        }
     }
 
-    if (tcp_rw_timeout <= 0)
-        tcp_rw_timeout = rw_timeout;
-    if (udp_rw_timeout <= 0)
-        udp_rw_timeout = rw_timeout;
-
-    if (tcp_rw_timeout > 0)
-        tcp_read_write_timeout = tcp_rw_timeout;
-    if (udp_rw_timeout > 0)
-        udp_read_write_timeout = udp_rw_timeout;
-
     return 0;
 }
 
 static int
-hev_config_parse_doc (yaml_document_t *doc)
+hev_config_parse_filter_rule (yaml_document_t *doc, yaml_node_t *base,
+                              HevConfigFilterRule *rule)
 {
-    yaml_node_t *root;
     yaml_node_pair_t *pair;
-    int min_task_stack_size;
-    int udp_buffer_size;
+    const char *network = NULL;
+    const char *action = NULL;
+    const char *proto = NULL;
+    const char *port = NULL;
 
-    root = yaml_document_get_root_node (doc);
-    if (!root || YAML_MAPPING_NODE != root->type)
+    if (!base || YAML_MAPPING_NODE != base->type)
         return -1;
 
-    for (pair = root->data.mapping.pairs.start;
-         pair < root->data.mapping.pairs.top; pair++) {
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
         yaml_node_t *node;
-        const char *key;
-        int res = 0;
+        const char *key, *value;
 
         if (!pair->key || !pair->value)
             break;
@@ -412,83 +680,649 @@ hev_config_parse_doc (yaml_document_t *doc)
         node = yaml_document_get_node (doc, pair->key);
         if (!node || YAML_SCALAR_NODE != node->type)
             break;
-
         key = (const char *)node->data.scalar.value;
+
         node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
 
-        if (0 == strcmp (key, "tunnel"))
-            res = hev_config_parse_tunnel (doc, node);
-        else if (0 == strcmp (key, "socks5"))
-            res = hev_config_parse_socks5 (doc, node);
-        else if (0 == strcmp (key, "mapdns"))
-            res = hev_config_parse_mapdns (doc, node);
-        else if (0 == strcmp (key, "misc"))
-            res = hev_config_parse_misc (doc, node);
+        if (0 == strcmp (key, "action"))
+            action = value;
+        else if (0 == strcmp (key, "proto"))
+            proto = value;
+        else if (0 == strcmp (key, "port"))
+            port = value;
+        else if (0 == strcmp (key, "network"))
+            network = value;
+    }
 
-        if (res < 0)
-            return -1;
+    memset (rule, 0, sizeof (HevConfigFilterRule));
+
+    if (!action || 0 == strcmp (action, "reject"))
+        rule->action = HEV_CONFIG_FILTER_REJECT;
+    else if (0 == strcmp (action, "drop"))
+        rule->action = HEV_CONFIG_FILTER_DROP;
+    else if (0 == strcmp (action, "accept"))
+        rule->action = HEV_CONFIG_FILTER_ACCEPT;
+    else {
+        fprintf (stderr, "Unknown filter action: %s!\n", action);
+        return -1;
     }
 
-    if (tcp_buffer_size > TCP_SND_BUF)
-        tcp_buffer_size = TCP_SND_BUF;
+    if (!proto || 0 == strcmp (proto, "any"))
+        rule->proto = 0;
+    else if (0 == strcmp (proto, "tcp"))
+        rule->proto = IPPROTO_TCP;
+    else if (0 == strcmp (proto, "udp"))
+        rule->proto = IPPROTO_UDP;
+    else if (0 == strcmp (proto, "icmp"))
+        rule->proto = IPPROTO_ICMP;
+    else if (0 == strcmp (proto, "icmpv6"))
+        rule->proto = IPPROTO_ICMPV6;
+    else {
+        fprintf (stderr, "Unknown filter proto: %s!\n", proto);
+        return -1;
+    }
 
-    udp_buffer_size = UDP_BUF_SIZE * udp_copy_buffer_nums;
+    if (port && hev_config_parse_port_range (port, &rule->port_min,
+                                             &rule->port_max) < 0) {
+        fprintf (stderr, "Invalid filter port: %s!\n", port);
+        return -1;
+    }
 
-    if (tcp_buffer_size > udp_buffer_size)
-        min_task_stack_size = TASK_STACK_SIZE + tcp_buffer_size;
-    else
-        min_task_stack_size = TASK_STACK_SIZE + udp_buffer_size;
+    if (network) {
+        char addr[64];
+        char *slash;
+        int max;
+
+        strncpy (addr, network, sizeof (addr) - 1);
+        addr[sizeof (addr) - 1] = '\0';
+        slash = strchr (addr, '/');
+        if (slash)
+            *slash++ = '\0';
+
+        if (inet_pton (AF_INET, addr, rule->addr) == 1) {
+            rule->family = 4;
+            max = 32;
+        } else if (inet_pton (AF_INET6, addr, rule->addr) == 1) {
+            rule->family = 6;
+            max = 128;
+        } else {
+            fprintf (stderr, "Invalid filter network: %s!\n", network);
+            return -1;
+        }
 
-    if (task_stack_size < min_task_stack_size)
-        task_stack_size = min_task_stack_size;
+        rule->prefix = slash ? strtoul (slash, NULL, 10) : max;
+        if (rule->prefix > max)
+            rule->prefix = max;
+    }
 
     return 0;
 }
 
-int
-hev_config_init_from_file (const char *config_path)
+static int
+hev_config_parse_filter (yaml_document_t *doc, yaml_node_t *base)
 {
-    yaml_parser_t parser;
-    yaml_document_t doc;
-    FILE *fp;
-    int res = -1;
+    yaml_node_item_t *item;
 
-    if (!yaml_parser_initialize (&parser))
-        goto exit;
+    if (!base || YAML_SEQUENCE_NODE != base->type)
+        return -1;
 
-    fp = fopen (config_path, "r");
-    if (!fp) {
-        fprintf (stderr, "Open %s failed!\n", config_path);
-        goto exit_free_parser;
-    }
+    for (item = base->data.sequence.items.start;
+         item < base->data.sequence.items.top; item++) {
+        HevConfigFilterRule *rule;
+        yaml_node_t *node;
 
-    yaml_parser_set_input_file (&parser, fp);
-    if (!yaml_parser_load (&parser, &doc)) {
-        fprintf (stderr, "Parse %s failed!\n", config_path);
-        goto exit_close_fp;
-    }
+        if (filter_rule_count >= FILTER_RULES_MAX) {
+            fprintf (stderr, "Too many filter rules!\n");
+            return -1;
+        }
 
-    res = hev_config_parse_doc (&doc);
-    yaml_document_delete (&doc);
+        node = yaml_document_get_node (doc, *item);
+        rule = &filter_rules[filter_rule_count];
+        if (hev_config_parse_filter_rule (doc, node, rule) < 0)
+            return -1;
+        filter_rule_count++;
+    }
 
-exit_close_fp:
-    fclose (fp);
-exit_free_parser:
-    yaml_parser_delete (&parser);
-exit:
-    return res;
+    return 0;
 }
 
-int
-hev_config_init_from_str (const unsigned char *config_str,
-                          unsigned int config_len)
+static int
+hev_config_parse_udp_timeout (yaml_document_t *doc, yaml_node_t *base,
+                              HevConfigUDPTimeout *rule)
 {
-    yaml_parser_t parser;
-    yaml_document_t doc;
-    int res = -1;
-
-    if (!yaml_parser_initialize (&parser))
-        goto exit;
+    yaml_node_pair_t *pair;
+    const char *timeout = NULL;
+    const char *port = NULL;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    memset (rule, 0, sizeof (HevConfigUDPTimeout));
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "port"))
+            port = value;
+        else if (0 == strcmp (key, "timeout"))
+            timeout = value;
+        else if (0 == strcmp (key, "one-shot"))
+            rule->one_shot = strcasecmp (value, "true") == 0;
+    }
+
+    if (!port || !timeout) {
+        fprintf (stderr, "Incomplete udp-timeout rule!\n");
+        return -1;
+    }
+
+    if (hev_config_parse_port_range (port, &rule->port_min,
+                                     &rule->port_max) < 0) {
+        fprintf (stderr, "Invalid udp-timeout port: %s!\n", port);
+        return -1;
+    }
+
+    rule->timeout = strtoul (timeout, NULL, 10);
+    if (rule->timeout <= 0) {
+        fprintf (stderr, "Invalid udp-timeout timeout: %s!\n", timeout);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_udp_timeouts (yaml_document_t *doc, yaml_node_t *base,
+                               HevConfigLive *self)
+{
+    yaml_node_item_t *item;
+
+    if (!base || YAML_SEQUENCE_NODE != base->type)
+        return -1;
+
+    for (item = base->data.sequence.items.start;
+         item < base->data.sequence.items.top; item++) {
+        HevConfigUDPTimeout *rule;
+        yaml_node_t *node;
+
+        if (self->udp_timeout_count >= UDP_TIMEOUTS_MAX) {
+            fprintf (stderr, "Too many udp-timeout rules!\n");
+            return -1;
+        }
+
+        node = yaml_document_get_node (doc, *item);
+        rule = &self->udp_timeouts[self->udp_timeout_count];
+        if (hev_config_parse_udp_timeout (doc, node, rule) < 0)
+            return -1;
+        self->udp_timeout_count++;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_parse_log_level (const char *value)
+{
+    if (0 == strcmp (value, "debug"))
+        return HEV_LOGGER_DEBUG;
+    else if (0 == strcmp (value, "info"))
+        return HEV_LOGGER_INFO;
+    else if (0 == strcmp (value, "error"))
+        return HEV_LOGGER_ERROR;
+
+    return HEV_LOGGER_WARN;
+}
+
+static int
+hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+    int tcp_stack = 0;
+    int udp_stack = 0;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "task-stack-size"))
+            task_stack_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-task-stack-size"))
+            tcp_stack = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-task-stack-size"))
+            udp_stack = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "task-stack-auto"))
+            task_stack_auto = strcasecmp (value, "true") == 0;
+        else if (0 == strcmp (key, "tcp-buffer-size"))
+            tcp_buffer_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-coalesce-size"))
+            tcp_coalesce_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-buffer-budget"))
+            tcp_buffer_budget = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-window-size"))
+            tcp_window_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-ooseq-max-bytes"))
+            tcp_ooseq_max_bytes = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-ooseq-max-pbufs"))
+            tcp_ooseq_max_pbufs = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-time-wait"))
+            tcp_time_wait = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-ack-segments"))
+            tcp_ack_segments = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-zerocopy-size"))
+            tcp_zerocopy_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-recv-buffer-size"))
+            udp_recv_buffer_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-copy-buffer-nums"))
+            udp_copy_buffer_nums = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-offload"))
+            udp_offload = strcasecmp (value, "true") == 0;
+        else if (0 == strcmp (key, "session-bulk-rate"))
+            session_bulk_rate = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "rate-limit"))
+            rate_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "session-rate-limit"))
+            session_rate_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "rate-burst"))
+            rate_burst = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-session-count"))
+            max_session_count = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-tcp-session-count"))
+            max_tcp_session_count = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "max-udp-session-count"))
+            max_udp_session_count = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "memory-limit"))
+            memory_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "session-memory-limit"))
+            session_memory_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-pcb-limit"))
+            tcp_pcb_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-pcb-limit"))
+            udp_pcb_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-seg-limit"))
+            tcp_seg_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "pbuf-ref-limit"))
+            pbuf_ref_limit = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "ip-reass-max-bytes"))
+            ip_reass_max_bytes = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "ip-reass-datagram-max-bytes"))
+            ip_reass_datagram_max_bytes = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "pid-file"))
+            strncpy (pid_file, value, 1024 - 1);
+        else if (0 == strcmp (key, "log-file"))
+            strncpy (log_file, value, 1024 - 1);
+        else if (0 == strcmp (key, "log-level"))
+            log_level = hev_config_parse_log_level (value);
+        else if (0 == strcmp (key, "log-async"))
+            log_async = strcasecmp (value, "true") == 0;
+        else if (0 == strcmp (key, "timer-slack"))
+            timer_slack = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "thread-cpus"))
+            strncpy (thread_cpus, value, 256 - 1);
+        else if (0 == strcmp (key, "thread-nice"))
+            thread_nice = strtol (value, NULL, 10);
+        else if (0 == strcmp (key, "thread-util-min"))
+            thread_util_min = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "trace-sample"))
+            trace_sample = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "limit-nofile"))
+            limit_nofile = strtol (value, NULL, 10);
+    }
+
+    /* Unset ones follow task-stack-size, see hev_config_parse_doc. */
+    tcp_task_stack_size = tcp_stack;
+    udp_task_stack_size = udp_stack;
+
+    return 0;
+}
+
+/* The timeouts of the misc section, see hev_config_parse_live. */
+static int
+hev_config_parse_timeouts (yaml_document_t *doc, yaml_node_t *base,
+                           HevConfigLive *self)
+{
+    yaml_node_pair_t *pair;
+    int tcp_rw_timeout = -1;
+    int udp_rw_timeout = -1;
+    int rw_timeout = -1;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "connect-timeout"))
+            self->connect_timeout = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "read-write-timeout"))
+            rw_timeout = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-read-write-timeout"))
+            tcp_rw_timeout = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-read-write-timeout"))
+            udp_rw_timeout = strtoul (value, NULL, 10);
+    }
+
+    if (tcp_rw_timeout <= 0)
+        tcp_rw_timeout = rw_timeout;
+    if (udp_rw_timeout <= 0)
+        udp_rw_timeout = rw_timeout;
+
+    if (tcp_rw_timeout > 0)
+        self->tcp_read_write_timeout = tcp_rw_timeout;
+    if (udp_rw_timeout > 0)
+        self->udp_read_write_timeout = udp_rw_timeout;
+
+    return 0;
+}
+
+static HevConfigLive *
+hev_config_live_new (void)
+{
+    HevConfigLive *self;
+
+    self = calloc (1, sizeof (HevConfigLive));
+    if (!self)
+        return NULL;
+
+    self->refs = 1;
+    self->connect_timeout = 10000;
+    self->tcp_read_write_timeout = 300000;
+    self->udp_read_write_timeout = 60000;
+
+    return self;
+}
+
+/*
+ * Makes self the generation new sessions hold, taking over its reference.
+ * A reload only replaces a generation, it fails once the config is gone.
+ */
+static int
+hev_config_live_set (HevConfigLive *self, int reload)
+{
+    HevConfigLive *old;
+
+    pthread_mutex_lock (&live_mutex);
+    old = live;
+    if (reload && !old) {
+        pthread_mutex_unlock (&live_mutex);
+        return -1;
+    }
+    live = self;
+    if (self) {
+        self->id = ++live_id;
+        /* Workers read these without the lock. */
+        __atomic_store_n (&connect_timeout, self->connect_timeout,
+                          __ATOMIC_RELAXED);
+        __atomic_store_n (&tcp_read_write_timeout,
+                          self->tcp_read_write_timeout, __ATOMIC_RELAXED);
+        __atomic_store_n (&udp_read_write_timeout,
+                          self->udp_read_write_timeout, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock (&live_mutex);
+
+    if (old)
+        hev_config_live_release (old);
+
+    return 0;
+}
+
+/* Parses the sections a reload may change into self. */
+static int
+hev_config_parse_live (yaml_document_t *doc, HevConfigLive *self)
+{
+    yaml_node_t *root;
+    yaml_node_pair_t *pair;
+
+    root = yaml_document_get_root_node (doc);
+    if (!root || YAML_MAPPING_NODE != root->type)
+        return -1;
+
+    for (pair = root->data.mapping.pairs.start;
+         pair < root->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key;
+        int res = 0;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+
+        key = (const char *)node->data.scalar.value;
+        node = yaml_document_get_node (doc, pair->value);
+
+        if (0 == strcmp (key, "socks5"))
+            res = hev_config_parse_socks5 (doc, node, self);
+        else if (0 == strcmp (key, "udp-timeout"))
+            res = hev_config_parse_udp_timeouts (doc, node, self);
+        else if (0 == strcmp (key, "misc"))
+            res = hev_config_parse_timeouts (doc, node, self);
+
+        if (res < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+hev_config_tcp_mss (int hlen)
+{
+    int mss = (int)tun_mtu - hlen;
+
+    if (mss < 536)
+        return 536;
+    if (mss > TCP_MSS)
+        return TCP_MSS;
+
+    return mss;
+}
+
+static int
+hev_config_parse_doc (yaml_document_t *doc)
+{
+    HevConfigLive *self;
+    yaml_node_t *root;
+    yaml_node_pair_t *pair;
+    int min_task_stack_size;
+    int udp_buffer_size;
+
+    root = yaml_document_get_root_node (doc);
+    if (!root || YAML_MAPPING_NODE != root->type)
+        return -1;
+
+    self = hev_config_live_new ();
+    if (!self)
+        return -1;
+
+    if (hev_config_parse_live (doc, self) < 0) {
+        free (self);
+        return -1;
+    }
+
+    for (pair = root->data.mapping.pairs.start;
+         pair < root->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key;
+        int res = 0;
+
+        if (!pair->key || !pair->value)
+            break;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+
+        key = (const char *)node->data.scalar.value;
+        node = yaml_document_get_node (doc, pair->value);
+
+        if (0 == strcmp (key, "tunnel"))
+            res = hev_config_parse_tunnel (doc, node);
+        else if (0 == strcmp (key, "mapdns"))
+            res = hev_config_parse_mapdns (doc, node);
+        else if (0 == strcmp (key, "filter"))
+            res = hev_config_parse_filter (doc, node);
+        else if (0 == strcmp (key, "bypass"))
+            res = hev_config_parse_bypass (doc, node);
+        else if (0 == strcmp (key, "misc"))
+            res = hev_config_parse_misc (doc, node);
+
+        if (res < 0) {
+            free (self);
+            return -1;
+        }
+    }
+
+    hev_config_live_set (self, 0);
+
+    if (workers < 1)
+        workers = 1;
+    else if (workers > TUNNEL_WORKERS_MAX)
+        workers = TUNNEL_WORKERS_MAX;
+
+    if (read_batch < 1)
+        read_batch = 1;
+    else if (read_batch > TUNNEL_READ_BATCH_MAX)
+        read_batch = TUNNEL_READ_BATCH_MAX;
+
+    /*
+     * The tun side MSS follows the tunnel MTU under the TCP_MSS ceiling,
+     * lwIP no longer advertises segments the tun cannot carry. Offload
+     * writes whole 64 KiB GSO batches, so pcbs queue several of them.
+     */
+    tcp_mss[0] = hev_config_tcp_mss (40);
+    tcp_mss[1] = hev_config_tcp_mss (60);
+
+    tcp_snd_buf = offload ? TCP_SND_BUF : TCP_SND_BUF / 4;
+
+    if (tcp_buffer_size > tcp_snd_buf)
+        tcp_buffer_size = tcp_snd_buf;
+
+    if (tcp_ack_segments < 1)
+        tcp_ack_segments = 1;
+    else if (tcp_ack_segments > 64)
+        tcp_ack_segments = 64;
+
+    /* lwIP counts queued pbufs in 16 bits. */
+    if (tcp_ooseq_max_pbufs > 0xffff)
+        tcp_ooseq_max_pbufs = 0xffff;
+
+    /* Datagrams sit in pooled slots, the stack only holds their vectors. */
+    udp_buffer_size = UDP_VEC_SIZE * udp_copy_buffer_nums;
+
+    min_task_stack_size = TASK_STACK_SIZE + udp_buffer_size;
+
+    if (task_stack_size < min_task_stack_size)
+        task_stack_size = min_task_stack_size;
+
+    /* TCP sessions keep no UDP buffers on their stack. */
+    if (tcp_task_stack_size <= 0)
+        tcp_task_stack_size = task_stack_size;
+    else if (tcp_task_stack_size < TASK_STACK_SIZE)
+        tcp_task_stack_size = TASK_STACK_SIZE;
+
+    if (udp_task_stack_size <= 0)
+        udp_task_stack_size = task_stack_size;
+    else if (udp_task_stack_size < min_task_stack_size)
+        udp_task_stack_size = min_task_stack_size;
+
+    return 0;
+}
+
+int
+hev_config_init_from_file (const char *config_path)
+{
+    yaml_parser_t parser;
+    yaml_document_t doc;
+    FILE *fp;
+    int res = -1;
+
+    if (!yaml_parser_initialize (&parser))
+        goto exit;
+
+    fp = fopen (config_path, "r");
+    if (!fp) {
+        fprintf (stderr, "Open %s failed!\n", config_path);
+        goto exit_free_parser;
+    }
+
+    yaml_parser_set_input_file (&parser, fp);
+    if (!yaml_parser_load (&parser, &doc)) {
+        fprintf (stderr, "Parse %s failed!\n", config_path);
+        goto exit_close_fp;
+    }
+
+    res = hev_config_parse_doc (&doc);
+    yaml_document_delete (&doc);
+
+exit_close_fp:
+    fclose (fp);
+exit_free_parser:
+    yaml_parser_delete (&parser);
+exit:
+    return res;
+}
+
+int
+hev_config_init_from_str (const unsigned char *config_str,
+                          unsigned int config_len)
+{
+    yaml_parser_t parser;
+    yaml_document_t doc;
+    int res = -1;
+
+    if (!yaml_parser_initialize (&parser))
+        goto exit;
 
     yaml_parser_set_input_string (&parser, config_str, config_len);
     if (!yaml_parser_load (&parser, &doc)) {
@@ -505,9 +1339,77 @@ exit:
     return res;
 }
 
+int
+hev_config_reload_from_str (const unsigned char *config_str,
+                            unsigned int config_len)
+{
+    HevConfigLive *self;
+    yaml_parser_t parser;
+    yaml_document_t doc;
+    int res = -1;
+
+    if (!yaml_parser_initialize (&parser))
+        goto exit;
+
+    yaml_parser_set_input_string (&parser, config_str, config_len);
+    if (!yaml_parser_load (&parser, &doc)) {
+        fprintf (stderr, "Failed to parse config.");
+        goto exit_free_parser;
+    }
+
+    self = hev_config_live_new ();
+    if (self) {
+        res = hev_config_parse_live (&doc, self);
+        if (res == 0)
+            res = hev_config_live_set (self, 1);
+        if (res < 0)
+            free (self);
+    }
+    yaml_document_delete (&doc);
+
+exit_free_parser:
+    yaml_parser_delete (&parser);
+exit:
+    return res;
+}
+
 void
 hev_config_fini (void)
 {
+    hev_config_live_set (NULL, 0);
+}
+
+HevConfigLive *
+hev_config_live_hold (void)
+{
+    HevConfigLive *self;
+
+    pthread_mutex_lock (&live_mutex);
+    self = live;
+    if (self)
+        self->refs++;
+    pthread_mutex_unlock (&live_mutex);
+
+    return self;
+}
+
+void
+hev_config_live_release (HevConfigLive *self)
+{
+    unsigned int refs;
+
+    pthread_mutex_lock (&live_mutex);
+    refs = --self->refs;
+    pthread_mutex_unlock (&live_mutex);
+
+    if (!refs)
+        free (self);
+}
+
+unsigned int
+hev_config_live_get_id (HevConfigLive *self)
+{
+    return self->id;
 }
 
 const char *
@@ -531,6 +1433,42 @@ hev_config_get_tunnel_multi_queue (void)
     return multi_queue;
 }
 
+int
+hev_config_get_tunnel_workers (void)
+{
+    return workers;
+}
+
+int
+hev_config_get_tunnel_read_batch (void)
+{
+    return read_batch;
+}
+
+int
+hev_config_get_tunnel_offload (void)
+{
+    return offload;
+}
+
+int
+hev_config_get_tunnel_gro (void)
+{
+    return gro;
+}
+
+int
+hev_config_get_tunnel_tcp_mss (int ipv6)
+{
+    return tcp_mss[!!ipv6];
+}
+
+int
+hev_config_get_tunnel_tcp_snd_buf (void)
+{
+    return tcp_snd_buf;
+}
+
 const char *
 hev_config_get_tunnel_ipv4_address (void)
 {
@@ -568,9 +1506,17 @@ hev_config_get_tunnel_pre_down_script (void)
 }
 
 HevConfigServer *
-hev_config_get_socks5_server (void)
+hev_config_get_socks5_server (HevConfigLive *self)
+{
+    return &self->srv;
+}
+
+const HevConfigUpstream *
+hev_config_get_socks5_upstreams (HevConfigLive *self, int *count)
 {
-    return &srv;
+    *count = self->upstream_count;
+
+    return self->upstreams;
 }
 
 int
@@ -603,18 +1549,142 @@ hev_config_get_mapdns_cache_size (void)
     return mapdns_cache_size;
 }
 
+const char *
+hev_config_get_mapdns_cache_file (void)
+{
+    if (!mapdns_cache_file[0])
+        return NULL;
+
+    return mapdns_cache_file;
+}
+
+int
+hev_config_get_mapdns_prefetch (void)
+{
+    return mapdns_prefetch;
+}
+
+const unsigned char *
+hev_config_get_mapdns_network6 (void)
+{
+    if (!mapdns_has_network6)
+        return NULL;
+
+    return mapdns_network6;
+}
+
+const HevConfigFilterRule *
+hev_config_get_filter_rules (int *count)
+{
+    *count = filter_rule_count;
+
+    return filter_rules;
+}
+
+const HevConfigUDPTimeout *
+hev_config_get_udp_timeouts (HevConfigLive *self, int *count)
+{
+    *count = self->udp_timeout_count;
+
+    return self->udp_timeouts;
+}
+
+const char *
+hev_config_get_bypass_rule (int index)
+{
+    if (index >= bypass_rule_count)
+        return NULL;
+
+    return bypass_rules[index];
+}
+
+const char *
+hev_config_get_bypass_file (void)
+{
+    if (!bypass_file[0])
+        return NULL;
+
+    return bypass_file;
+}
+
 int
 hev_config_get_misc_task_stack_size (void)
 {
     return task_stack_size;
 }
 
+int
+hev_config_get_misc_tcp_task_stack_size (void)
+{
+    return tcp_task_stack_size;
+}
+
+int
+hev_config_get_misc_udp_task_stack_size (void)
+{
+    return udp_task_stack_size;
+}
+
+int
+hev_config_get_misc_task_stack_auto (void)
+{
+    return task_stack_auto;
+}
+
 int
 hev_config_get_misc_tcp_buffer_size (void)
 {
     return tcp_buffer_size;
 }
 
+int
+hev_config_get_misc_tcp_coalesce_size (void)
+{
+    return tcp_coalesce_size;
+}
+
+int
+hev_config_get_misc_tcp_buffer_budget (void)
+{
+    return tcp_buffer_budget;
+}
+
+int
+hev_config_get_misc_tcp_window_size (void)
+{
+    return tcp_window_size;
+}
+
+int
+hev_config_get_misc_tcp_ooseq_max_bytes (void)
+{
+    return tcp_ooseq_max_bytes;
+}
+
+int
+hev_config_get_misc_tcp_ooseq_max_pbufs (void)
+{
+    return tcp_ooseq_max_pbufs;
+}
+
+int
+hev_config_get_misc_tcp_time_wait (void)
+{
+    return tcp_time_wait;
+}
+
+int
+hev_config_get_misc_tcp_ack_segments (void)
+{
+    return tcp_ack_segments;
+}
+
+int
+hev_config_get_misc_tcp_zerocopy_size (void)
+{
+    return tcp_zerocopy_size;
+}
+
 int
 hev_config_get_misc_udp_recv_buffer_size (void)
 {
@@ -627,28 +1697,124 @@ hev_config_get_misc_udp_copy_buffer_nums (void)
     return udp_copy_buffer_nums;
 }
 
+int
+hev_config_get_misc_udp_offload (void)
+{
+    return udp_offload;
+}
+
+int
+hev_config_get_misc_session_bulk_rate (void)
+{
+    return session_bulk_rate;
+}
+
+int
+hev_config_get_misc_trace_sample (void)
+{
+    return trace_sample;
+}
+
+int
+hev_config_get_misc_rate_limit (void)
+{
+    return rate_limit;
+}
+
+int
+hev_config_get_misc_session_rate_limit (void)
+{
+    return session_rate_limit;
+}
+
+int
+hev_config_get_misc_rate_burst (void)
+{
+    return rate_burst;
+}
+
 int
 hev_config_get_misc_max_session_count (void)
 {
     return max_session_count;
 }
 
+int
+hev_config_get_misc_max_tcp_session_count (void)
+{
+    return max_tcp_session_count;
+}
+
+int
+hev_config_get_misc_max_udp_session_count (void)
+{
+    return max_udp_session_count;
+}
+
+int
+hev_config_get_misc_memory_limit (void)
+{
+    return memory_limit;
+}
+
+int
+hev_config_get_misc_session_memory_limit (void)
+{
+    return session_memory_limit;
+}
+
+int
+hev_config_get_misc_tcp_pcb_limit (void)
+{
+    return tcp_pcb_limit;
+}
+
+int
+hev_config_get_misc_udp_pcb_limit (void)
+{
+    return udp_pcb_limit;
+}
+
+int
+hev_config_get_misc_tcp_seg_limit (void)
+{
+    return tcp_seg_limit;
+}
+
+int
+hev_config_get_misc_pbuf_ref_limit (void)
+{
+    return pbuf_ref_limit;
+}
+
+int
+hev_config_get_misc_ip_reass_max_bytes (void)
+{
+    return ip_reass_max_bytes;
+}
+
+int
+hev_config_get_misc_ip_reass_datagram_max_bytes (void)
+{
+    return ip_reass_datagram_max_bytes;
+}
+
 int
 hev_config_get_misc_connect_timeout (void)
 {
-    return connect_timeout;
+    return __atomic_load_n (&connect_timeout, __ATOMIC_RELAXED);
 }
 
 int
 hev_config_get_misc_tcp_read_write_timeout (void)
 {
-    return tcp_read_write_timeout;
+    return __atomic_load_n (&tcp_read_write_timeout, __ATOMIC_RELAXED);
 }
 
 int
 hev_config_get_misc_udp_read_write_timeout (void)
 {
-    return udp_read_write_timeout;
+    return __atomic_load_n (&udp_read_write_timeout, __ATOMIC_RELAXED);
 }
 
 int
@@ -680,3 +1846,36 @@ hev_config_get_misc_log_level (void)
 {
     return log_level;
 }
+
+int
+hev_config_get_misc_log_async (void)
+{
+    return log_async;
+}
+
+int
+hev_config_get_misc_timer_slack (void)
+{
+    return timer_slack;
+}
+
+const char *
+hev_config_get_misc_thread_cpus (void)
+{
+    if (!thread_cpus[0])
+        return NULL;
+
+    return thread_cpus;
+}
+
+int
+hev_config_get_misc_thread_nice (void)
+{
+    return thread_nice;
+}
+
+int
+hev_config_get_misc_thread_util_min (void)
+{
+    return thread_util_min;
+}
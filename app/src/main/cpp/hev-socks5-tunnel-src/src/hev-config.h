@@ -11,6 +11,24 @@
 #define __HEV_CONFIG_H__
 
 typedef struct _HevConfigServer HevConfigServer;
+typedef struct _HevConfigUpstream HevConfigUpstream;
+typedef struct _HevConfigFilterRule HevConfigFilterRule;
+typedef struct _HevConfigUDPTimeout HevConfigUDPTimeout;
+typedef struct _HevConfigLive HevConfigLive;
+
+typedef enum
+{
+    HEV_CONFIG_FILTER_ACCEPT,
+    HEV_CONFIG_FILTER_DROP,
+    HEV_CONFIG_FILTER_REJECT,
+} HevConfigFilterAction;
+
+typedef enum
+{
+    HEV_CONFIG_BALANCE_ROUND_ROBIN,
+    HEV_CONFIG_BALANCE_LEAST_SESSIONS,
+    HEV_CONFIG_BALANCE_LATENCY,
+} HevConfigBalance;
 
 struct _HevConfigServer
 {
@@ -19,19 +37,80 @@ struct _HevConfigServer
     unsigned int mark;
     short udp_in_udp;
     unsigned short port;
+    unsigned short pool_size;
+    unsigned short udp_mux;
     unsigned char pipeline;
+    unsigned char optimistic;
+    unsigned char balance;
+    unsigned char tcp_nodelay;
+    unsigned char tcp_quickack;
+    unsigned char tcp_fastopen;
+    int tcp_sndbuf;
+    int tcp_rcvbuf;
+    int tcp_notsent_lowat;
     char udp_addr[256];
     char addr[256];
 };
 
+struct _HevConfigUpstream
+{
+    const char *user;
+    const char *pass;
+    unsigned short port;
+    char addr[256];
+};
+
+struct _HevConfigFilterRule
+{
+    unsigned char action;
+    unsigned char family; /* 0: any, 4 or 6 */
+    unsigned char proto; /* 0: any, else IP protocol number */
+    unsigned char prefix; /* destination prefix length, 0: any */
+    unsigned short port_min; /* destination port range, 0-0: any */
+    unsigned short port_max;
+    unsigned char addr[16];
+};
+
+struct _HevConfigUDPTimeout
+{
+    unsigned short port_min; /* destination port range */
+    unsigned short port_max;
+    int timeout; /* idle timeout (ms) */
+    int one_shot; /* close once every request has a reply */
+};
+
 int hev_config_init_from_file (const char *config_path);
 int hev_config_init_from_str (const unsigned char *config_str,
                               unsigned int config_len);
 void hev_config_fini (void);
 
+/*
+ * Replaces the socks5 section, the udp-timeout rules and the misc timeouts
+ * with those of a new config, for sessions that start from then on. The
+ * other sections stay as they were at init. Returns -1 and changes nothing
+ * when the config does not parse.
+ */
+int hev_config_reload_from_str (const unsigned char *config_str,
+                                unsigned int config_len);
+
+/*
+ * The current generation of the reloadable config, held until released.
+ * Its id grows with each reload, so a newer generation has a larger one.
+ * NULL before the config is loaded and after hev_config_fini.
+ */
+HevConfigLive *hev_config_live_hold (void);
+void hev_config_live_release (HevConfigLive *self);
+unsigned int hev_config_live_get_id (HevConfigLive *self);
+
 const char *hev_config_get_tunnel_name (void);
 unsigned int hev_config_get_tunnel_mtu (void);
 int hev_config_get_tunnel_multi_queue (void);
+int hev_config_get_tunnel_workers (void);
+int hev_config_get_tunnel_read_batch (void);
+int hev_config_get_tunnel_offload (void);
+int hev_config_get_tunnel_gro (void);
+int hev_config_get_tunnel_tcp_mss (int ipv6);
+int hev_config_get_tunnel_tcp_snd_buf (void);
 
 const char *hev_config_get_tunnel_ipv4_address (void);
 const char *hev_config_get_tunnel_ipv6_address (void);
@@ -39,19 +118,57 @@ const char *hev_config_get_tunnel_ipv6_address (void);
 const char *hev_config_get_tunnel_post_up_script (void);
 const char *hev_config_get_tunnel_pre_down_script (void);
 
-HevConfigServer *hev_config_get_socks5_server (void);
+HevConfigServer *hev_config_get_socks5_server (HevConfigLive *live);
+const HevConfigUpstream *hev_config_get_socks5_upstreams (HevConfigLive *live,
+                                                          int *count);
 
 int hev_config_get_mapdns_address (void);
 int hev_config_get_mapdns_port (void);
 int hev_config_get_mapdns_network (void);
 int hev_config_get_mapdns_netmask (void);
 int hev_config_get_mapdns_cache_size (void);
+const unsigned char *hev_config_get_mapdns_network6 (void);
+const char *hev_config_get_mapdns_cache_file (void);
+int hev_config_get_mapdns_prefetch (void);
+
+const HevConfigFilterRule *hev_config_get_filter_rules (int *count);
+const HevConfigUDPTimeout *hev_config_get_udp_timeouts (HevConfigLive *live,
+                                                       int *count);
+const char *hev_config_get_bypass_rule (int index);
+const char *hev_config_get_bypass_file (void);
 
 int hev_config_get_misc_task_stack_size (void);
+int hev_config_get_misc_tcp_task_stack_size (void);
+int hev_config_get_misc_udp_task_stack_size (void);
+int hev_config_get_misc_task_stack_auto (void);
 int hev_config_get_misc_tcp_buffer_size (void);
+int hev_config_get_misc_tcp_coalesce_size (void);
+int hev_config_get_misc_tcp_buffer_budget (void);
+int hev_config_get_misc_tcp_window_size (void);
+int hev_config_get_misc_tcp_ooseq_max_bytes (void);
+int hev_config_get_misc_tcp_ooseq_max_pbufs (void);
+int hev_config_get_misc_tcp_time_wait (void);
+int hev_config_get_misc_tcp_ack_segments (void);
+int hev_config_get_misc_tcp_zerocopy_size (void);
 int hev_config_get_misc_udp_recv_buffer_size (void);
 int hev_config_get_misc_udp_copy_buffer_nums (void);
+int hev_config_get_misc_udp_offload (void);
+int hev_config_get_misc_session_bulk_rate (void);
+int hev_config_get_misc_trace_sample (void);
+int hev_config_get_misc_rate_limit (void);
+int hev_config_get_misc_session_rate_limit (void);
+int hev_config_get_misc_rate_burst (void);
 int hev_config_get_misc_max_session_count (void);
+int hev_config_get_misc_max_tcp_session_count (void);
+int hev_config_get_misc_max_udp_session_count (void);
+int hev_config_get_misc_memory_limit (void);
+int hev_config_get_misc_session_memory_limit (void);
+int hev_config_get_misc_tcp_pcb_limit (void);
+int hev_config_get_misc_udp_pcb_limit (void);
+int hev_config_get_misc_tcp_seg_limit (void);
+int hev_config_get_misc_pbuf_ref_limit (void);
+int hev_config_get_misc_ip_reass_max_bytes (void);
+int hev_config_get_misc_ip_reass_datagram_max_bytes (void);
 int hev_config_get_misc_connect_timeout (void);
 int hev_config_get_misc_tcp_read_write_timeout (void);
 int hev_config_get_misc_udp_read_write_timeout (void);
@@ -59,5 +176,10 @@ int hev_config_get_misc_limit_nofile (void);
 const char *hev_config_get_misc_pid_file (void);
 const char *hev_config_get_misc_log_file (void);
 int hev_config_get_misc_log_level (void);
+int hev_config_get_misc_log_async (void);
+int hev_config_get_misc_timer_slack (void);
+const char *hev_config_get_misc_thread_cpus (void);
+int hev_config_get_misc_thread_nice (void);
+int hev_config_get_misc_thread_util_min (void);
 
 #endif /* __HEV_CONFIG_H__ */
@@ -23,9 +23,29 @@
 #include "hev-logger.h"
 #include "hev-socks5-logger.h"
 #include "hev-socks5-tunnel.h"
+#include "hev-thread-place.h"
 
 #include "hev-main.h"
 
+static void
+socks5_logger_write (HevSocks5LoggerLevel level, const char *msg, size_t len)
+{
+    hev_logger_write ((HevLoggerLevel)level, msg, len);
+}
+
+static void
+hev_socks5_tunnel_set_timeouts (void)
+{
+    int res;
+
+    res = hev_config_get_misc_connect_timeout ();
+    hev_socks5_set_connect_timeout (res);
+    res = hev_config_get_misc_tcp_read_write_timeout ();
+    hev_socks5_set_tcp_timeout (res);
+    res = hev_config_get_misc_udp_read_write_timeout ();
+    hev_socks5_set_udp_timeout (res);
+}
+
 static int
 hev_socks5_tunnel_main_inner (int tun_fd)
 {
@@ -38,15 +58,12 @@ hev_socks5_tunnel_main_inner (int tun_fd)
     log_file = hev_config_get_misc_log_file ();
     log_level = hev_config_get_misc_log_level ();
 
-    res = hev_config_get_misc_connect_timeout ();
-    hev_socks5_set_connect_timeout (res);
-    res = hev_config_get_misc_tcp_read_write_timeout ();
-    hev_socks5_set_tcp_timeout (res);
-    res = hev_config_get_misc_udp_read_write_timeout ();
-    hev_socks5_set_udp_timeout (res);
+    hev_socks5_tunnel_set_timeouts ();
 
     res = hev_config_get_misc_udp_recv_buffer_size ();
     hev_socks5_set_udp_recv_buffer_size (res);
+    res = hev_config_get_misc_udp_offload ();
+    hev_socks5_set_udp_offload (res);
 
     res = hev_logger_init (log_level, log_file);
     if (res < 0)
@@ -65,10 +82,22 @@ hev_socks5_tunnel_main_inner (int tun_fd)
     if (pid_file)
         run_as_daemon (pid_file);
 
+    if (hev_config_get_misc_log_async ()) {
+        if (hev_logger_start_async () < 0)
+            LOG_W ("start async logger");
+        else
+            hev_socks5_logger_set_writer (socks5_logger_write);
+    }
+
     res = hev_task_system_init ();
     if (res < 0)
         return -4;
 
+    hev_task_system_set_timer_slack (hev_config_get_misc_timer_slack ());
+    hev_thread_place (hev_config_get_misc_thread_cpus (),
+                      hev_config_get_misc_thread_nice (),
+                      hev_config_get_misc_thread_util_min ());
+
     lwip_init ();
 
     res = hev_socks5_tunnel_init (tun_fd);
@@ -119,6 +148,21 @@ hev_socks5_tunnel_quit (void)
     hev_socks5_tunnel_stop ();
 }
 
+int
+hev_socks5_tunnel_reload_from_str (const unsigned char *config_str,
+                                   unsigned int config_len)
+{
+    int res;
+
+    res = hev_config_reload_from_str (config_str, config_len);
+    if (res < 0)
+        return -1;
+
+    hev_socks5_tunnel_set_timeouts ();
+
+    return hev_socks5_tunnel_reload ();
+}
+
 #ifndef ENABLE_LIBRARY
 static void
 show_help (const char *self_path)
@@ -11,11 +11,129 @@
 #define __HEV_MAIN_H__
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define HEV_SOCKS5_TUNNEL_STATS_VERSION (9)
+#define HEV_SOCKS5_TUNNEL_STATS_LATENCY_BUCKETS (8)
+#define HEV_SOCKS5_TUNNEL_STATS_TASK_CLASSES (4)
+
+typedef struct _HevSocks5TunnelStats HevSocks5TunnelStats;
+
+/**
+ * HevSocks5TunnelStats:
+ * @version: layout version, HEV_SOCKS5_TUNNEL_STATS_VERSION of the library
+ * @size: bytes of this struct filled in by the library
+ * @tx_packets: packets read from the tunnel interface
+ * @tx_bytes: bytes read from the tunnel interface
+ * @rx_packets: packets written to the tunnel interface
+ * @rx_bytes: bytes written to the tunnel interface
+ * @fwd_writevs: writes to upstream sockets on the TCP forward path
+ * @fwd_bytes: bytes written by them
+ * @tcp_sessions: active TCP sessions
+ * @udp_sessions: active UDP sessions
+ * @tcp_accepts: TCP sessions accepted so far
+ * @udp_accepts: UDP sessions accepted so far
+ * @evictions: sessions closed to stay within the session limits
+ * @quic_rejects: QUIC packets rejected by the reject-quic fallback
+ * @filter_drops: packets dropped or rejected by filter rules
+ * @connect_failures: socks5 connects or handshakes that failed
+ * @connect_latency: socks5 connect plus handshake times, bucketed by upper
+ *   bound of 10, 25, 50, 100, 250, 500 and 1000 ms, the last one unbounded
+ * @tcp_pcbs: TCP PCBs alive in lwIP, sampled on timer ticks
+ * @tcp_queued: pbufs queued on TCP send queues, sampled on timer ticks
+ * @udp_drops: datagrams dropped from full UDP session queues (version 2)
+ * @egress_flushes: rounds of packets written to the tunnel interface, so
+ *   rx_packets / egress_flushes is the write batch size (version 3)
+ * @connect_ipv4: upstream TCP connects made over IPv4 (version 4)
+ * @connect_ipv4_msecs: total time they took, so the ratio is the average
+ * @connect_ipv6: upstream TCP connects made over IPv6 (version 4)
+ * @connect_ipv6_msecs: total time they took
+ * @connect_fallbacks: connects won by the happy eyeballs fallback family
+ * @tcp_segs: TCP segments allocated in lwIP, sampled on timer ticks
+ *   (version 5)
+ * @udp_pcbs: UDP PCBs alive in lwIP, sampled on timer ticks (version 5)
+ * @ref_pbufs: reference pbufs alive in lwIP, sampled on timer ticks
+ *   (version 5)
+ * @pool_refusals: lwIP allocations refused by the misc pool limits
+ *   (version 5)
+ * @wakeups: times the workers slept and woke up, sampled on timer ticks;
+ *   misc timer-slack lowers it (version 6)
+ * @reass_bytes: IP fragment payload waiting for reassembly, sampled on
+ *   timer ticks (version 7)
+ * @reass_drops: IP fragments dropped as malformed, over the misc
+ *   ip-reass limits or with a datagram that timed out (version 7)
+ * @mem_used: bytes sessions hold in queued packets, buffers and task
+ *   stacks (version 8)
+ * @mem_evictions: sessions closed to stay within the misc memory-limit,
+ *   also counted in evictions (version 8)
+ * @task_run_time: nanoseconds the workers ran lwIP input, lwIP timer, TCP
+ *   session and UDP session tasks, estimated from the scheduler's sampled
+ *   runs, sampled on timer ticks (version 9)
+ * @task_switches: times the workers switched to tasks of those classes,
+ *   so task_run_time / task_switches is the average run (version 9)
+ *
+ * Counters only grow, rates such as accepts per second are the difference
+ * of two snapshots. New fields are only ever appended, so a caller built
+ * against an older layout keeps working.
+ *
+ * Since: 2.14.4
+ */
+struct _HevSocks5TunnelStats
+{
+    uint32_t version;
+    uint32_t size;
+
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t fwd_writevs;
+    uint64_t fwd_bytes;
+
+    uint64_t tcp_sessions;
+    uint64_t udp_sessions;
+    uint64_t tcp_accepts;
+    uint64_t udp_accepts;
+    uint64_t evictions;
+    uint64_t quic_rejects;
+    uint64_t filter_drops;
+
+    uint64_t connect_failures;
+    uint64_t connect_latency[HEV_SOCKS5_TUNNEL_STATS_LATENCY_BUCKETS];
+
+    uint64_t tcp_pcbs;
+    uint64_t tcp_queued;
+
+    uint64_t udp_drops;
+    uint64_t egress_flushes;
+
+    uint64_t connect_ipv4;
+    uint64_t connect_ipv4_msecs;
+    uint64_t connect_ipv6;
+    uint64_t connect_ipv6_msecs;
+    uint64_t connect_fallbacks;
+
+    uint64_t tcp_segs;
+    uint64_t udp_pcbs;
+    uint64_t ref_pbufs;
+    uint64_t pool_refusals;
+
+    uint64_t wakeups;
+
+    uint64_t reass_bytes;
+    uint64_t reass_drops;
+
+    uint64_t mem_used;
+    uint64_t mem_evictions;
+
+    uint64_t task_run_time[HEV_SOCKS5_TUNNEL_STATS_TASK_CLASSES];
+    uint64_t task_switches[HEV_SOCKS5_TUNNEL_STATS_TASK_CLASSES];
+};
+
 /**
  * hev_socks5_tunnel_main:
  * @config_path: config file path
@@ -69,11 +187,33 @@ int hev_socks5_tunnel_main_from_str (const unsigned char *config_str,
  */
 void hev_socks5_tunnel_quit (void);
 
+/**
+ * hev_socks5_tunnel_reload_from_str:
+ * @config_str: string config
+ * @config_len: the byte length of string config
+ *
+ * Apply the socks5 section, the udp-timeout rules and the misc timeouts of
+ * a new config to a running tunnel without restarting it. Sessions that
+ * start from then on use the new upstreams, while existing ones keep the
+ * upstream they are connected to until they end. The lwIP stack and the
+ * mapped DNS table are kept. Changes to other sections, such as tunnel,
+ * mapdns, filter or bypass, take a restart. Must not race with
+ * hev_socks5_tunnel_quit.
+ *
+ * Returns: returns zero on successful, otherwise returns -1, leaving the
+ * running config in place when @config_str does not parse.
+ *
+ * Since: 2.14.4
+ */
+int hev_socks5_tunnel_reload_from_str (const unsigned char *config_str,
+                                       unsigned int config_len);
+
 /**
  * hev_socks5_tunnel_set_reject_quic:
  * @enabled: 1 to reject QUIC (UDP 443) with ICMP, 0 to allow
  *
- * Control whether QUIC packets are rejected with ICMP Port Unreachable.
+ * Control whether QUIC packets are rejected with ICMP Port Unreachable,
+ * or ICMPv6 Port Unreachable for IPv6.
  * When enabled, forces clients to fall back to TCP immediately.
  * Default is enabled (1). Resets to 1 on hev_socks5_tunnel_fini.
  *
@@ -81,6 +221,75 @@ void hev_socks5_tunnel_quit (void);
  */
 void hev_socks5_tunnel_set_reject_quic (int enabled);
 
+/**
+ * HevSocks5TunnelProvider:
+ * @data: user data given to hev_socks5_tunnel_set_provider
+ *
+ * Opens a stream to the socks5 server behind a tunnel running in the same
+ * process, such as a stream of a QUIC connection.
+ *
+ * Returns: returns a connected stream socket, owned by the library from
+ * then on, otherwise returns -1.
+ *
+ * Since: 2.14.4
+ */
+typedef int (*HevSocks5TunnelProvider) (void *data);
+
+/**
+ * hev_socks5_tunnel_set_provider:
+ * @provider: (nullable): stream opener, NULL to connect to servers again
+ * @data: user data for @provider
+ * @user: (nullable): socks5 username on provided streams
+ * @pass: (nullable): socks5 password on provided streams
+ *
+ * Let TCP sessions take their socks5 server streams from @provider instead
+ * of connecting to the configured servers, which saves the loopback
+ * connections in front of such a tunnel. The socks5 handshake then runs
+ * on the provided stream with @user and @pass. UDP sessions keep using the
+ * configured servers. Must be called before the tunnel starts, resets on
+ * hev_socks5_tunnel_fini. @provider is called on worker threads.
+ *
+ * Since: 2.14.4
+ */
+void hev_socks5_tunnel_set_provider (HevSocks5TunnelProvider provider,
+                                     void *data, const char *user,
+                                     const char *pass);
+
+/**
+ * hev_socks5_tunnel_set_datagram_provider:
+ * @provider: (nullable): datagram socket opener, NULL for UDP associates
+ * @data: user data for @provider
+ *
+ * Let UDP sessions take a connected datagram socket from @provider instead
+ * of associating with the configured servers. Each message on the socket
+ * is one socks5 UDP request, header and payload, in both directions. When
+ * @provider returns -1, e.g. while its tunnel cannot carry datagrams, the
+ * session falls back to the configured servers. Must be called before the
+ * tunnel starts, resets on hev_socks5_tunnel_fini. @provider is called on
+ * worker threads.
+ *
+ * Since: 2.14.4
+ */
+void hev_socks5_tunnel_set_datagram_provider (HevSocks5TunnelProvider provider,
+                                              void *data);
+
+/**
+ * hev_socks5_tunnel_replace_fd:
+ * @fd: replacement tunnel file descriptor
+ *
+ * Move a running tunnel to a new tunnel file descriptor, keeping the lwIP
+ * stack and all sessions. Only supported when the tunnel was started with
+ * an external file descriptor. Packets queued for the old descriptor are
+ * written to it first; the caller keeps ownership of both descriptors and
+ * may close the old one once this returns. Must not race with
+ * hev_socks5_tunnel_quit.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14.4
+ */
+int hev_socks5_tunnel_replace_fd (int fd);
+
 /**
  * hev_socks5_tunnel_stats:
  * @tx_packets (out): transmitted packets
@@ -95,6 +304,260 @@ void hev_socks5_tunnel_set_reject_quic (int enabled);
 void hev_socks5_tunnel_stats (size_t *tx_packets, size_t *tx_bytes,
                               size_t *rx_packets, size_t *rx_bytes);
 
+/**
+ * hev_socks5_tunnel_fwd_stats:
+ * @writevs (out): writes to upstream sockets on the TCP forward path
+ * @bytes (out): bytes written by them
+ *
+ * Retrieve TCP forward path statistics. The ratio is the average number
+ * of bytes per writev, which shows how well small segments coalesce.
+ *
+ * Since: 2.14.4
+ */
+void hev_socks5_tunnel_fwd_stats (size_t *writevs, size_t *bytes);
+
+/**
+ * hev_socks5_tunnel_session_stats:
+ * @tcp_sessions (out): active TCP sessions
+ * @udp_sessions (out): active UDP sessions
+ * @evictions (out): sessions closed to stay within the session limits
+ *
+ * Retrieve session statistics.
+ *
+ * Since: 2.14.4
+ */
+void hev_socks5_tunnel_session_stats (size_t *tcp_sessions,
+                                      size_t *udp_sessions,
+                                      size_t *evictions);
+
+/**
+ * hev_socks5_tunnel_get_stats:
+ * @stats (out): statistics snapshot
+ * @size: size of the caller's #HevSocks5TunnelStats
+ *
+ * Retrieve all statistics in one call. Each counter is read atomically, so
+ * none is ever torn, even 64-bit ones on 32-bit targets. Fields beyond
+ * @size are not touched.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14.4
+ */
+int hev_socks5_tunnel_get_stats (HevSocks5TunnelStats *stats, size_t size);
+
+typedef struct _HevSocks5TunnelStatsPage HevSocks5TunnelStatsPage;
+
+/**
+ * HevSocks5TunnelStatsPage:
+ * @seq: odd while the tunnel is writing the page, bumped on every write
+ * @running: 1 while the tunnel runs, 0 once it stopped
+ * @stats: the last snapshot, as filled in by hev_socks5_tunnel_get_stats
+ *
+ * Stats the tunnel keeps copying into memory of the caller, so readers just
+ * poll it, without calling into the library. To take a consistent snapshot,
+ * load @seq with acquire semantics, copy the rest, then load @seq again
+ * after an acquire fence, and retry while either value is odd or they
+ * differ. @stats.size tells how much of @stats the library fills in.
+ *
+ * Since: 2.14.4
+ */
+struct _HevSocks5TunnelStatsPage
+{
+    uint32_t seq;
+    uint32_t running;
+    HevSocks5TunnelStats stats;
+};
+
+/**
+ * hev_socks5_tunnel_set_stats_page:
+ * @page: (nullable): page to publish into, NULL to stop publishing
+ * @size: size of the caller's #HevSocks5TunnelStatsPage
+ * @interval: milliseconds between updates
+ *
+ * Publish statistics into @page, at most once per @interval while the
+ * tunnel moves packets, and once when it starts and stops. While nothing
+ * moves no counter changes either, so the page stays current without
+ * waking up the tunnel. Only to be called while the tunnel is not running,
+ * the page is kept across runs and must stay valid until replaced.
+ *
+ * Returns: returns zero on successful, otherwise returns -1.
+ *
+ * Since: 2.14.4
+ */
+int hev_socks5_tunnel_set_stats_page (HevSocks5TunnelStatsPage *page,
+                                      size_t size, unsigned int interval);
+
+typedef enum _HevSocks5TunnelSessionState HevSocks5TunnelSessionState;
+typedef struct _HevSocks5TunnelSession HevSocks5TunnelSession;
+
+/**
+ * HevSocks5TunnelSessionState:
+ * @HEV_SOCKS5_TUNNEL_SESSION_ACTIVE: still open, an interim record
+ * @HEV_SOCKS5_TUNNEL_SESSION_CLOSED: both directions finished
+ * @HEV_SOCKS5_TUNNEL_SESSION_CONNECT_FAILED: no upstream could be connected
+ * @HEV_SOCKS5_TUNNEL_SESSION_HANDSHAKE_FAILED: the socks5 handshake failed
+ *   or the server refused the request
+ * @HEV_SOCKS5_TUNNEL_SESSION_IDLE: closed by the read/write timeout
+ * @HEV_SOCKS5_TUNNEL_SESSION_EVICTED: closed to stay within session limits
+ * @HEV_SOCKS5_TUNNEL_SESSION_ABORTED: reset by the tunnel side, or the
+ *   tunnel was stopped
+ *
+ * Since: 2.14.4
+ */
+enum _HevSocks5TunnelSessionState
+{
+    HEV_SOCKS5_TUNNEL_SESSION_ACTIVE,
+    HEV_SOCKS5_TUNNEL_SESSION_CLOSED,
+    HEV_SOCKS5_TUNNEL_SESSION_CONNECT_FAILED,
+    HEV_SOCKS5_TUNNEL_SESSION_HANDSHAKE_FAILED,
+    HEV_SOCKS5_TUNNEL_SESSION_IDLE,
+    HEV_SOCKS5_TUNNEL_SESSION_EVICTED,
+    HEV_SOCKS5_TUNNEL_SESSION_ABORTED,
+};
+
+/**
+ * HevSocks5TunnelSession:
+ * @id: unique per run, interim and final records of a session share it
+ * @tx_bytes: payload bytes sent upstream so far
+ * @rx_bytes: payload bytes received from upstream so far
+ * @duration: milliseconds since the session was accepted
+ * @handshake: milliseconds the socks5 connect plus handshake took, -1 when
+ *   none completed (e.g. a UDP flow riding on a shared association)
+ * @ttfb: milliseconds from accept to the first upstream byte, -1 if none
+ * @type: 0 for TCP, 1 for UDP
+ * @state: a #HevSocks5TunnelSessionState
+ * @family: 4 or 6
+ * @port: destination port
+ * @addr: destination address, an IPv4 one in the first 4 bytes
+ *
+ * Since: 2.14.4
+ */
+struct _HevSocks5TunnelSession
+{
+    uint64_t id;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint32_t duration;
+    int32_t handshake;
+    int32_t ttfb;
+    uint8_t type;
+    uint8_t state;
+    uint8_t family;
+    uint8_t reserved;
+    uint16_t port;
+    uint8_t addr[16];
+};
+
+/**
+ * hev_socks5_tunnel_take_sessions:
+ * @sessions (out): records to fill, oldest first
+ * @count: capacity of @sessions
+ *
+ * Take session records queued by the workers. A record is queued when a
+ * session ends, and about every 5 seconds while it keeps moving data, so
+ * long-lived flows show up before they close. The queue keeps the last
+ * 1024 records, callers are expected to poll it periodically.
+ *
+ * Returns: returns the number of records taken.
+ *
+ * Since: 2.14.4
+ */
+size_t hev_socks5_tunnel_take_sessions (HevSocks5TunnelSession *sessions,
+                                        size_t count);
+
+typedef enum _HevSocks5TunnelTraceMilestone HevSocks5TunnelTraceMilestone;
+typedef struct _HevSocks5TunnelTraceEvent HevSocks5TunnelTraceEvent;
+
+/**
+ * HevSocks5TunnelTraceMilestone:
+ * @HEV_SOCKS5_TUNNEL_TRACE_ACCEPT: lwIP accepted the TCP connection
+ * @HEV_SOCKS5_TUNNEL_TRACE_CONNECT: a stream to the socks5 server is open,
+ *   connected or taken from the provider
+ * @HEV_SOCKS5_TUNNEL_TRACE_HANDSHAKE: the socks5 handshake completed, or for
+ *   an optimistic one, was sent
+ * @HEV_SOCKS5_TUNNEL_TRACE_FIRST_BYTE: the first upstream byte arrived
+ * @HEV_SOCKS5_TUNNEL_TRACE_CLOSE: the session ended
+ *
+ * Milestones of a traced session, in the order they are reached. Tunnels
+ * behind a #HevSocks5TunnelTraceProvider number theirs from 16 on.
+ *
+ * Since: 2.14.4
+ */
+enum _HevSocks5TunnelTraceMilestone
+{
+    HEV_SOCKS5_TUNNEL_TRACE_ACCEPT = 1,
+    HEV_SOCKS5_TUNNEL_TRACE_CONNECT,
+    HEV_SOCKS5_TUNNEL_TRACE_HANDSHAKE,
+    HEV_SOCKS5_TUNNEL_TRACE_FIRST_BYTE,
+    HEV_SOCKS5_TUNNEL_TRACE_CLOSE,
+};
+
+/**
+ * HevSocks5TunnelTraceEvent:
+ * @trace: trace ID, the #HevSocks5TunnelSession id of the session
+ * @time: CLOCK_MONOTONIC in microseconds
+ * @milestone: a #HevSocks5TunnelTraceMilestone
+ * @reserved: zero
+ *
+ * Since: 2.14.4
+ */
+struct _HevSocks5TunnelTraceEvent
+{
+    uint64_t trace;
+    uint64_t time;
+    uint32_t milestone;
+    uint32_t reserved;
+};
+
+/**
+ * HevSocks5TunnelTraceProvider:
+ * @data: user data given to hev_socks5_tunnel_set_provider
+ * @trace: trace ID of the session the stream is for
+ *
+ * Like #HevSocks5TunnelProvider, for sessions sampled by misc.trace-sample.
+ * The tunnel behind it may record milestones of its own under @trace, on
+ * the same clock, to be merged with hev_socks5_tunnel_take_traces.
+ *
+ * Returns: returns a connected stream socket, owned by the library from
+ * then on, otherwise returns -1.
+ *
+ * Since: 2.14.4
+ */
+typedef int (*HevSocks5TunnelTraceProvider) (void *data, uint64_t trace);
+
+/**
+ * hev_socks5_tunnel_set_trace_provider:
+ * @provider: (nullable): stream opener for traced sessions, NULL to use the
+ *   stream provider for them too
+ *
+ * Open the streams of traced sessions with @provider, which is given the
+ * data of hev_socks5_tunnel_set_provider. Only used while a stream provider
+ * is set. Must be called before the tunnel starts, resets on
+ * hev_socks5_tunnel_fini. @provider is called on worker threads.
+ *
+ * Since: 2.14.4
+ */
+void hev_socks5_tunnel_set_trace_provider (
+    HevSocks5TunnelTraceProvider provider);
+
+/**
+ * hev_socks5_tunnel_take_traces:
+ * @events (out): events to fill
+ * @count: capacity of @events
+ *
+ * Take the milestones of sessions sampled by misc.trace-sample. Each worker
+ * records into a ring of its own without locks or waiting, and drops
+ * events while its ring of 256 is full, so callers are expected to poll
+ * it periodically. Events of one worker come oldest first; those of a
+ * session all come from one worker.
+ *
+ * Returns: returns the number of events taken.
+ *
+ * Since: 2.14.4
+ */
+size_t hev_socks5_tunnel_take_traces (HevSocks5TunnelTraceEvent *events,
+                                      size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,9 +7,14 @@
  ============================================================================
  */
 
+#include <stdio.h>
 #include <stdint.h>
-#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
 
 #include <hev-compiler.h>
@@ -33,12 +38,16 @@ struct _DNSHdr
     uint16_t ar;
 };
 
+/* Longer names, rare in practice, get their own allocation. */
+#define NAME_INLINE_SIZE (48)
+
 struct _HevMappedDNSNode
 {
-    HevRBTreeNode tree;
     HevListNode list;
     char *name;
-    int idx;
+    uint32_t hash;
+    int len;
+    char sname[NAME_INLINE_SIZE];
 };
 
 HevMappedDNS *
@@ -47,7 +56,7 @@ hev_mapped_dns_new (int net, int mask, int max)
     HevMappedDNS *self;
     int res;
 
-    self = hev_malloc0 (sizeof (HevMappedDNS) + sizeof (void *) * max);
+    self = hev_malloc0 (sizeof (HevMappedDNS));
     if (!self)
         return NULL;
 
@@ -74,79 +83,156 @@ hev_mapped_dns_put (HevMappedDNS *self)
     singleton = self;
 }
 
-static HevMappedDNSNode *
-hev_mapped_dns_node_alloc (const char *name)
+static uint32_t
+hev_mapped_dns_hash (const char *name, int len)
 {
-    HevMappedDNSNode *node;
-
-    node = hev_malloc0 (sizeof (HevMappedDNSNode));
-    if (!node)
-        return NULL;
+    uint32_t hash = 2166136261u;
+    int i;
 
-    node->name = strdup (name);
+    /* FNV-1a */
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
 
-    return node;
+    return hash;
 }
 
 static void
-hev_mapped_dns_node_free (HevMappedDNSNode *node)
+hev_mapped_dns_unlink (HevMappedDNS *self, int idx)
 {
-    free (node->name);
-    hev_free (node);
+    unsigned int mask = self->slots_mask;
+    unsigned int i, j, k;
+
+    i = self->records[idx].hash & mask;
+    while (self->slots[i] != idx + 1)
+        i = (i + 1) & mask;
+
+    /*
+     * Linear probing without tombstones: later entries of the run move back
+     * into the hole unless their home slot lies cyclically in (i, j].
+     */
+    for (j = i;;) {
+        j = (j + 1) & mask;
+        if (!self->slots[j])
+            break;
+
+        k = self->records[self->slots[j] - 1].hash & mask;
+        if ((i < j) ? ((k <= i) || (k > j)) : ((k <= i) && (k > j))) {
+            self->slots[i] = self->slots[j];
+            i = j;
+        }
+    }
+    self->slots[i] = 0;
 }
 
 static int
-hev_mapped_dns_find (HevMappedDNS *self, const char *name)
+hev_mapped_dns_find (HevMappedDNS *self, const char *name, int len)
 {
-    HevRBTreeNode **new = &self->tree.root, *parent = NULL;
+    unsigned int mask = self->slots_mask;
     HevMappedDNSNode *node;
-    int idx = self->use;
-
-    while (*new) {
-        int res;
-
-        node = container_of (*new, HevMappedDNSNode, tree);
-        res = strcmp (node->name, name);
-        parent = *new;
+    char *buf = NULL;
+    unsigned int i;
+    uint32_t hash;
+    int idx;
 
-        if (res < 0) {
-            new = &((*new)->left);
-        } else if (res > 0) {
-            new = &((*new)->right);
-        } else {
-            hev_list_del (&self->list, &node->list);
-            hev_list_add_tail (&self->list, &node->list);
-            return node->idx;
-        }
+    hash = hev_mapped_dns_hash (name, len);
+    for (i = hash & mask; self->slots[i]; i = (i + 1) & mask) {
+        node = &self->records[self->slots[i] - 1];
+        if ((node->hash != hash) || (node->len != len))
+            continue;
+        if (memcmp (node->name, name, len) != 0)
+            continue;
+
+        hev_list_del (&self->list, &node->list);
+        hev_list_add_tail (&self->list, &node->list);
+        return self->slots[i] - 1;
     }
 
-    node = hev_mapped_dns_node_alloc (name);
-    if (!node)
-        return -1;
-
-    hev_rbtree_node_link (&node->tree, parent, new);
-    hev_rbtree_insert_color (&self->tree, &node->tree);
-    hev_list_add_tail (&self->list, &node->list);
+    if (len >= NAME_INLINE_SIZE) {
+        buf = hev_malloc (len + 1);
+        if (!buf)
+            return -1;
+    }
 
     if (self->use < self->max) {
+        /* Restored records may sit anywhere, the cursor skips over them. */
+        while (self->records[self->next].len)
+            self->next++;
+        idx = self->next++;
         self->use++;
+        node = &self->records[idx];
     } else {
-        HevMappedDNSNode *nf;
         HevListNode *nl;
 
         nl = hev_list_first (&self->list);
-        nf = container_of (nl, HevMappedDNSNode, list);
+        node = container_of (nl, HevMappedDNSNode, list);
+        idx = node - self->records;
+
+        hev_mapped_dns_unlink (self, idx);
+        hev_list_del (&self->list, &node->list);
+        if (node->name != node->sname)
+            hev_free (node->name);
+        node->len = 0;
+
+        /* The run may have moved back over the slot found above. */
+        for (i = hash & mask; self->slots[i]; i = (i + 1) & mask)
+            ;
+    }
 
-        idx = nf->idx;
-        hev_rbtree_erase (&self->tree, &nf->tree);
-        hev_list_del (&self->list, &nf->list);
-        hev_mapped_dns_node_free (nf);
+    node->name = buf ? buf : node->sname;
+    memcpy (node->name, name, len);
+    node->name[len] = '\0';
+    node->hash = hash;
+    node->len = len;
+
+    self->slots[i] = idx + 1;
+    hev_list_add_tail (&self->list, &node->list);
+    self->dirty = 1;
+
+    if (self->prefetch)
+        self->prefetch (node->name, len);
+
+    return idx;
+}
+
+static void
+hev_mapped_dns_restore (HevMappedDNS *self, int idx, const char *name,
+                        int len)
+{
+    unsigned int mask = self->slots_mask;
+    HevMappedDNSNode *node;
+    unsigned int i;
+    uint32_t hash;
+
+    node = &self->records[idx];
+    if (node->len)
+        return;
+
+    hash = hev_mapped_dns_hash (name, len);
+    for (i = hash & mask; self->slots[i]; i = (i + 1) & mask) {
+        HevMappedDNSNode *n = &self->records[self->slots[i] - 1];
+
+        if ((n->hash == hash) && (n->len == len) &&
+            (memcmp (n->name, name, len) == 0))
+            return;
     }
 
-    self->records[idx] = node;
-    node->idx = idx;
+    node->name = node->sname;
+    if (len >= NAME_INLINE_SIZE) {
+        node->name = hev_malloc (len + 1);
+        if (!node->name)
+            return;
+    }
 
-    return node->idx;
+    memcpy (node->name, name, len);
+    node->name[len] = '\0';
+    node->hash = hash;
+    node->len = len;
+
+    self->slots[i] = idx + 1;
+    hev_list_add_tail (&self->list, &node->list);
+    self->use++;
 }
 
 static inline uint16_t
@@ -155,6 +241,12 @@ read_u16 (const uint8_t *p)
     return ((uint16_t)p[0] << 8) | p[1];
 }
 
+static inline uint32_t
+read_u32 (const uint8_t *p)
+{
+    return ((uint32_t)read_u16 (p) << 16) | read_u16 (p + 2);
+}
+
 static inline void
 write_u16 (uint8_t *p, uint16_t v)
 {
@@ -171,103 +263,400 @@ write_u32 (uint8_t *p, uint32_t v)
     p[3] = v;
 }
 
+#define DNS_QUESTIONS_MAX (32)
+#define DNS_UDP_SIZE (512)
+#define DNS_EDNS_UDP_SIZE (1232)
+#define DNS_TYPE_A (1)
+#define DNS_TYPE_AAAA (28)
+#define DNS_TYPE_OPT (41)
+#define DNS_CLASS_IN (1)
+#define DNS_FLAG_QR (0x8000)
+#define DNS_FLAG_TC (0x0200)
+
+/*
+ * Walks the name at off and returns the offset past it. When name is given
+ * the dotted form is written there, following compression pointers, which
+ * only ever point backwards; the jump limit guards against loops anyway.
+ */
+static int
+hev_mapped_dns_parse_name (const uint8_t *buf, int len, int off, char *name,
+                           int *nlen)
+{
+    int end = -1;
+    int jumps = 0;
+    int n = 0;
+
+    for (;;) {
+        int l;
+
+        if (off >= len)
+            return -1;
+
+        l = buf[off];
+        if (!l)
+            break;
+
+        if ((l & 0xc0) == 0xc0) {
+            if ((off + 2) > len)
+                return -1;
+            if (end < 0)
+                end = off + 2;
+            if (!name)
+                return end;
+            if (++jumps > 16)
+                return -1;
+            off = read_u16 (&buf[off]) & 0x3fff;
+            continue;
+        }
+
+        if ((l > 63) || ((off + 1 + l) > len))
+            return -1;
+        if (name) {
+            if ((n + l + 1) > 255)
+                return -1;
+            if (n)
+                name[n++] = '.';
+            memcpy (&name[n], &buf[off + 1], l);
+            n += l;
+        }
+        off += 1 + l;
+    }
+
+    if (name) {
+        name[n] = '\0';
+        *nlen = n;
+    }
+
+    return (end < 0) ? off + 1 : end;
+}
+
 int
-hev_mapped_dns_handle (HevMappedDNS *self, void *req, int qlen, void *res,
-                       int slen)
+hev_mapped_dns_handle (HevMappedDNS *self, const void *req, int qlen,
+                       void *res, int slen)
 {
-    DNSHdr *qhdr = req;
+    const DNSHdr *qhdr = req;
     DNSHdr *shdr = res;
-    uint8_t *rb = req;
+    const uint8_t *rb = req;
     uint8_t *sb = res;
-    int ips[32];
-    int ipo[32];
-    int ipn = 0;
-    int off;
+    int qoff[DNS_QUESTIONS_MAX];
+    int qtype[DNS_QUESTIONS_MAX];
+    int qidx[DNS_QUESTIONS_MAX];
+    uint32_t opt_ttl = 0;
+    int edns = 0;
+    int limit;
+    int qd, rr;
+    int fl, an;
+    int off, qend;
     int i;
 
-    if (slen < qlen)
+    if (qlen < (int)sizeof (DNSHdr))
         return -1;
 
-    memcpy (res, req, qlen);
-    qhdr->qd = ntohs (qhdr->qd);
-    shdr->fl = ntohs (shdr->fl);
-    shdr->ns = 0;
-    shdr->an = 0;
-    shdr->ar = 0;
-
-    if (qhdr->qd > 32)
+    fl = ntohs (qhdr->fl);
+    qd = ntohs (qhdr->qd);
+    if ((fl & DNS_FLAG_QR) || !qd || (qd > DNS_QUESTIONS_MAX))
         return -1;
 
+    /* Questions, each name resolved to a pool index as it is parsed. */
+    pthread_mutex_lock (&self->mutex);
     off = sizeof (DNSHdr);
-    for (i = 0; i < qhdr->qd; i++) {
-        ipo[ipn] = off;
+    for (i = 0; i < qd; i++) {
+        char name[256];
+        int type, len;
+
+        qoff[i] = off;
+        off = hev_mapped_dns_parse_name (rb, qlen, off, name, &len);
+        if ((off < 0) || ((off + 4) > qlen))
+            goto unlock;
+
+        /* A, or AAAA with an IPv6 pool, both families map one record. */
+        type = read_u16 (&rb[off + 0]);
+        qtype[i] = type;
+        qidx[i] = -1;
+        if (((type == DNS_TYPE_A) ||
+             ((type == DNS_TYPE_AAAA) && self->has_net6)) &&
+            (read_u16 (&rb[off + 2]) == DNS_CLASS_IN) && (len > 0))
+            qidx[i] = hev_mapped_dns_find (self, name, len);
+
+        off += 4;
+    }
+    pthread_mutex_unlock (&self->mutex);
+    qend = off;
 
-        while (rb[off]) {
-            int poff = off;
+    /* The remaining sections are only scanned for the EDNS0 OPT record. */
+    rr = ntohs (qhdr->an) + ntohs (qhdr->ns) + ntohs (qhdr->ar);
+    for (i = 0; i < rr; i++) {
+        int noff = off;
 
-            off += 1 + rb[off];
-            if (off >= qlen)
-                return -1;
+        off = hev_mapped_dns_parse_name (rb, qlen, off, NULL, NULL);
+        if ((off < 0) || ((off + 10) > qlen))
+            return -1;
+        if ((read_u16 (&rb[off]) == DNS_TYPE_OPT) && (rb[noff] == 0)) {
+            int size = read_u16 (&rb[off + 2]);
 
-            rb[poff] = '.';
+            edns = (size > DNS_UDP_SIZE) ? size : DNS_UDP_SIZE;
+            opt_ttl = read_u32 (&rb[off + 4]);
         }
-
-        off++;
-        if ((off + 3) >= qlen)
+        off += 10 + read_u16 (&rb[off + 8]);
+        if (off > qlen)
             return -1;
+    }
 
-        if ((read_u16 (&rb[off + 0]) == 1) && (read_u16 (&rb[off + 2]) == 1)) {
-            int idx;
+    /* Replies stay within what the client said it can take. */
+    limit = edns ? edns : DNS_UDP_SIZE;
+    if (limit > slen)
+        limit = slen;
+    if (edns)
+        limit -= 11;
+    if (qend > limit)
+        return -1;
 
-            idx = hev_mapped_dns_find (self, (char *)&rb[ipo[ipn] + 1]);
-            if (idx >= 0) {
-                ips[ipn] = self->net | idx;
-                ipn++;
-            }
-        }
+    memcpy (res, req, qend);
+    fl |= DNS_FLAG_QR | ((fl & 0x100) >> 1);
+    fl &= ~0x000f;
+    an = 0;
 
-        off += 4;
-    }
+    /* An unknown EDNS version gets BADVERS and nothing else. */
+    if (((opt_ttl >> 16) & 0xff) != 0)
+        qd = 0;
 
-    for (i = 0; i < ipn; i++) {
-        if ((off + 15) >= slen)
-            return -1;
+    off = qend;
+    for (i = 0; i < qd; i++) {
+        int alen = (qtype[i] == DNS_TYPE_AAAA) ? 16 : 4;
+
+        if (qidx[i] < 0)
+            continue;
+        if ((off + 12 + alen) > limit) {
+            fl |= DNS_FLAG_TC;
+            break;
+        }
 
-        sb[off + 0] = 0xc0;
-        sb[off + 1] = ipo[i];
-        write_u16 (&sb[off + 2], 1);
-        write_u16 (&sb[off + 4], 1);
+        write_u16 (&sb[off + 0], 0xc000 | qoff[i]);
+        write_u16 (&sb[off + 2], qtype[i]);
+        write_u16 (&sb[off + 4], DNS_CLASS_IN);
         write_u32 (&sb[off + 6], 1);
-        write_u16 (&sb[off + 10], 4);
-        write_u32 (&sb[off + 12], ips[i]);
+        write_u16 (&sb[off + 10], alen);
+        if (alen == 4) {
+            write_u32 (&sb[off + 12], self->net | qidx[i]);
+        } else {
+            memcpy (&sb[off + 12], self->net6, 12);
+            write_u32 (&sb[off + 24], qidx[i]);
+        }
 
-        off += 16;
+        off += 12 + alen;
+        an++;
     }
 
-    shdr->fl = htons (shdr->fl | 0x8000 | ((shdr->fl & 0x100) >> 1));
-    shdr->an = htons (ipn);
+    shdr->fl = htons (fl);
+    shdr->an = htons (an);
+    shdr->ns = 0;
+    shdr->ar = 0;
+
+    /* The OPT record goes last, after the answers, echoing the DO bit. */
+    if (edns) {
+        uint32_t ttl = opt_ttl & 0x8000;
+
+        if (((opt_ttl >> 16) & 0xff) != 0)
+            ttl |= 1 << 24;
+
+        sb[off + 0] = 0;
+        write_u16 (&sb[off + 1], DNS_TYPE_OPT);
+        write_u16 (&sb[off + 3], DNS_EDNS_UDP_SIZE);
+        write_u32 (&sb[off + 5], ttl);
+        write_u16 (&sb[off + 9], 0);
+        off += 11;
+        shdr->ar = htons (1);
+    }
 
     return off;
+
+unlock:
+    pthread_mutex_unlock (&self->mutex);
+    return -1;
 }
 
-const char *
-hev_mapped_dns_lookup (HevMappedDNS *self, int ip)
+static int
+hev_mapped_dns_lookup_idx (HevMappedDNS *self, unsigned int idx, char *name,
+                           int len)
 {
     HevMappedDNSNode *node;
-    int idx;
+    int res = -1;
 
-    idx = ip & ~self->mask;
     if (idx >= self->max)
-        return NULL;
+        return -1;
 
-    node = self->records[idx];
-    if (!node)
-        return NULL;
+    pthread_mutex_lock (&self->mutex);
+    node = &self->records[idx];
+    if (node->len) {
+        hev_list_del (&self->list, &node->list);
+        hev_list_add_tail (&self->list, &node->list);
+
+        res = node->len;
+        if (res < len)
+            memcpy (name, node->name, res + 1);
+        else
+            res = -1;
+    }
+    pthread_mutex_unlock (&self->mutex);
 
-    hev_list_del (&self->list, &node->list);
-    hev_list_add_tail (&self->list, &node->list);
+    return res;
+}
+
+int
+hev_mapped_dns_lookup (HevMappedDNS *self, int ip, char *name, int len)
+{
+    if ((ip & self->mask) != self->net)
+        return -1;
 
-    return node->name;
+    return hev_mapped_dns_lookup_idx (self, ip & ~self->mask, name, len);
+}
+
+int
+hev_mapped_dns_lookup6 (HevMappedDNS *self, const void *ip, char *name,
+                        int len)
+{
+    const uint8_t *p = ip;
+
+    if (!self->has_net6 || memcmp (p, self->net6, 12) != 0)
+        return -1;
+
+    return hev_mapped_dns_lookup_idx (self, read_u32 (&p[12]), name, len);
+}
+
+void
+hev_mapped_dns_set_prefetch (HevMappedDNS *self, HevMappedDNSPrefetch prefetch)
+{
+    self->prefetch = prefetch;
+}
+
+void
+hev_mapped_dns_set_network6 (HevMappedDNS *self, const void *prefix)
+{
+    memcpy (self->net6, prefix, 12);
+    self->has_net6 = 1;
+}
+
+/*
+ * Snapshot layout, all fields big-endian: the header, then the records in
+ * LRU order, oldest first, as a u32 index, a u8 length and the name.
+ */
+#define SNAPSHOT_MAGIC (0x484d4431) /* HMD1 */
+#define SNAPSHOT_HDR_SIZE (20)
+
+int
+hev_mapped_dns_save (HevMappedDNS *self, const char *path)
+{
+    char tmp[PATH_MAX];
+    HevListNode *n;
+    uint8_t *buf;
+    size_t size;
+    int fd, res;
+
+    pthread_mutex_lock (&self->mutex);
+    if (!self->dirty) {
+        pthread_mutex_unlock (&self->mutex);
+        return 0;
+    }
+
+    size = SNAPSHOT_HDR_SIZE;
+    for (n = hev_list_first (&self->list); n; n = hev_list_node_next (n))
+        size += 5 + container_of (n, HevMappedDNSNode, list)->len;
+
+    buf = hev_malloc (size);
+    if (!buf) {
+        pthread_mutex_unlock (&self->mutex);
+        return -1;
+    }
+
+    write_u32 (&buf[0], SNAPSHOT_MAGIC);
+    write_u32 (&buf[4], self->max);
+    write_u32 (&buf[8], self->net);
+    write_u32 (&buf[12], self->mask);
+    write_u32 (&buf[16], self->use);
+    size = SNAPSHOT_HDR_SIZE;
+    for (n = hev_list_first (&self->list); n; n = hev_list_node_next (n)) {
+        HevMappedDNSNode *node = container_of (n, HevMappedDNSNode, list);
+
+        write_u32 (&buf[size], node - self->records);
+        buf[size + 4] = node->len;
+        memcpy (&buf[size + 5], node->name, node->len);
+        size += 5 + node->len;
+    }
+    self->dirty = 0;
+    pthread_mutex_unlock (&self->mutex);
+
+    /* Replaced in one rename, a crash never leaves a torn snapshot. */
+    res = snprintf (tmp, sizeof (tmp), "%s.tmp", path);
+    if ((res < 0) || (res >= sizeof (tmp))) {
+        hev_free (buf);
+        return -1;
+    }
+
+    res = -1;
+    fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+        if (write (fd, buf, size) == size)
+            res = 0;
+        close (fd);
+    }
+    if (res == 0)
+        res = rename (tmp, path);
+    if (res < 0)
+        unlink (tmp);
+    hev_free (buf);
+
+    return res;
+}
+
+int
+hev_mapped_dns_load (HevMappedDNS *self, const char *path)
+{
+    struct stat st;
+    uint8_t *data;
+    size_t off;
+    int fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if ((fstat (fd, &st) < 0) || (st.st_size < SNAPSHOT_HDR_SIZE)) {
+        close (fd);
+        return -1;
+    }
+
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    /* Indexes only keep their meaning under the same pool and size. */
+    if ((read_u32 (&data[0]) != SNAPSHOT_MAGIC) ||
+        (read_u32 (&data[4]) != self->max) ||
+        (read_u32 (&data[8]) != self->net) ||
+        (read_u32 (&data[12]) != self->mask)) {
+        munmap (data, st.st_size);
+        return -1;
+    }
+
+    pthread_mutex_lock (&self->mutex);
+    off = SNAPSHOT_HDR_SIZE;
+    while ((off + 5) <= st.st_size) {
+        uint32_t idx = read_u32 (&data[off]);
+        int len = data[off + 4];
+
+        if ((off + 5 + len) > st.st_size)
+            break;
+        if ((idx < self->max) && (len > 0))
+            hev_mapped_dns_restore (self, idx, (char *)&data[off + 5], len);
+        off += 5 + len;
+    }
+    pthread_mutex_unlock (&self->mutex);
+
+    munmap (data, st.st_size);
+    LOG_I ("%p mapped dns load %d", self, self->use);
+
+    return 0;
 }
 
 int
@@ -286,9 +675,26 @@ hev_mapped_dns_construct (HevMappedDNS *self, int net, int mask, int max)
     if (max > ~mask)
         return -1;
 
+    /* Sized up front, at most half full so probe runs stay short. */
+    self->slots_mask = 1;
+    while (self->slots_mask < (unsigned int)max * 2)
+        self->slots_mask <<= 1;
+
+    self->records = hev_malloc0 (sizeof (HevMappedDNSNode) * max);
+    self->slots = hev_malloc0 (sizeof (unsigned int) * self->slots_mask);
+    if (!self->records || !self->slots) {
+        if (self->records)
+            hev_free (self->records);
+        if (self->slots)
+            hev_free (self->slots);
+        return -1;
+    }
+    self->slots_mask--;
+
     self->max = max;
     self->net = net;
     self->mask = mask;
+    pthread_mutex_init (&self->mutex, NULL);
 
     return 0;
 }
@@ -302,13 +708,16 @@ hev_mapped_dns_destruct (HevObject *base)
     LOG_D ("%p mapped dns destruct", self);
 
     n = hev_list_first (&self->list);
-    while (n) {
+    for (; n; n = hev_list_node_next (n)) {
         HevMappedDNSNode *t;
 
         t = container_of (n, HevMappedDNSNode, list);
-        n = hev_list_node_next (n);
-        hev_mapped_dns_node_free (t);
+        if (t->name != t->sname)
+            hev_free (t->name);
     }
+    hev_free (self->records);
+    hev_free (self->slots);
+    pthread_mutex_destroy (&self->mutex);
 
     HEV_OBJECT_TYPE->destruct (base);
     hev_free (base);
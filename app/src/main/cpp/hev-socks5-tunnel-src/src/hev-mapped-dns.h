@@ -10,8 +10,9 @@
 #ifndef __HEV_MAPPED_DNS_H__
 #define __HEV_MAPPED_DNS_H__
 
+#include <pthread.h>
+
 #include <hev-list.h>
-#include <hev-rbtree.h>
 #include <hev-object.h>
 
 #ifdef __cplusplus
@@ -25,6 +26,7 @@ extern "C" {
 typedef struct _HevMappedDNS HevMappedDNS;
 typedef struct _HevMappedDNSClass HevMappedDNSClass;
 typedef struct _HevMappedDNSNode HevMappedDNSNode;
+typedef void (*HevMappedDNSPrefetch) (const char *name, int len);
 
 struct _HevMappedDNS
 {
@@ -32,12 +34,20 @@ struct _HevMappedDNS
 
     int use;
     int max;
+    int next;
+    int dirty;
     int net;
     int mask;
+    int has_net6;
+    unsigned char net6[12];
 
+    pthread_mutex_t mutex;
     HevList list;
-    HevRBTree tree;
-    HevMappedDNSNode *records[0];
+    /* Open-addressed index into records by name, 0 is empty else idx+1. */
+    unsigned int *slots;
+    unsigned int slots_mask;
+    HevMappedDNSNode *records;
+    HevMappedDNSPrefetch prefetch;
 };
 
 struct _HevMappedDNSClass
@@ -54,9 +64,32 @@ HevMappedDNS *hev_mapped_dns_new (int net, int mask, int max);
 HevMappedDNS *hev_mapped_dns_get (void);
 void hev_mapped_dns_put (HevMappedDNS *self);
 
-int hev_mapped_dns_handle (HevMappedDNS *self, void *req, int qlen, void *res,
-                           int slen);
-const char *hev_mapped_dns_lookup (HevMappedDNS *self, int ip);
+int hev_mapped_dns_handle (HevMappedDNS *self, const void *req, int qlen,
+                           void *res, int slen);
+int hev_mapped_dns_lookup (HevMappedDNS *self, int ip, char *name, int len);
+
+/*
+ * Snapshot of the name to index table, so a restart hands out the same
+ * addresses. Saving writes only when names were added since the last save,
+ * loading is refused when the pool or cache size changed.
+ */
+int hev_mapped_dns_save (HevMappedDNS *self, const char *path);
+int hev_mapped_dns_load (HevMappedDNS *self, const char *path);
+
+/*
+ * Adds an IPv6 pool: AAAA queries are answered from the /96 prefix, the
+ * first 12 bytes of prefix, with the same record index as the A answer.
+ */
+/*
+ * Called for every name given an address by a query, in the querying
+ * thread and with the table locked, so it must not block.
+ */
+void hev_mapped_dns_set_prefetch (HevMappedDNS *self,
+                                  HevMappedDNSPrefetch prefetch);
+
+void hev_mapped_dns_set_network6 (HevMappedDNS *self, const void *prefix);
+int hev_mapped_dns_lookup6 (HevMappedDNS *self, const void *ip, char *name,
+                            int len);
 
 #ifdef __cplusplus
 }
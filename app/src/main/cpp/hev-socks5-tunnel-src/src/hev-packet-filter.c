@@ -0,0 +1,297 @@
+/*
+ ============================================================================
+ Name        : hev-packet-filter.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Packet Filter
+ ============================================================================
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+
+#include "hev-logger.h"
+
+#include "hev-packet-filter.h"
+
+#define PORT_MAP_WORDS (65536 / 32)
+
+enum
+{
+    PORT_MAP_TCP,
+    PORT_MAP_UDP,
+    PORT_MAP_COUNT,
+};
+
+static const HevConfigFilterRule *rules;
+static int rule_count;
+
+/*
+ * Ports named by any rule, per transport. Unless a rule matches without a
+ * port, a packet whose port bit is clear passes without a rule scan.
+ */
+static uint32_t port_maps[PORT_MAP_COUNT][PORT_MAP_WORDS];
+static int portless;
+
+static void
+port_map_set (uint32_t *map, unsigned int min, unsigned int max)
+{
+    unsigned int i;
+
+    for (i = min; i <= max; i++)
+        map[i >> 5] |= 1u << (i & 31);
+}
+
+int
+hev_packet_filter_init (void)
+{
+    int i;
+
+    rules = hev_config_get_filter_rules (&rule_count);
+
+    memset (port_maps, 0, sizeof (port_maps));
+    portless = 0;
+
+    for (i = 0; i < rule_count; i++) {
+        const HevConfigFilterRule *rule = &rules[i];
+
+        if (!rule->port_min) {
+            portless = 1;
+            continue;
+        }
+
+        if (!rule->proto || rule->proto == IPPROTO_TCP)
+            port_map_set (port_maps[PORT_MAP_TCP], rule->port_min,
+                          rule->port_max);
+        if (!rule->proto || rule->proto == IPPROTO_UDP)
+            port_map_set (port_maps[PORT_MAP_UDP], rule->port_min,
+                          rule->port_max);
+    }
+
+    LOG_D ("packet filter init: %d rules", rule_count);
+
+    return 0;
+}
+
+void
+hev_packet_filter_fini (void)
+{
+    rules = NULL;
+    rule_count = 0;
+}
+
+int
+hev_packet_filter_is_empty (void)
+{
+    return rule_count == 0;
+}
+
+/*
+ * Both ports in one load. Headers sit at fixed offsets, so the address and
+ * port copies are fixed-size and become a few wide moves; TUN payloads have
+ * no alignment guarantee, which memcpy takes care of.
+ */
+static void
+hev_packet_filter_parse_ports (const uint8_t *data, unsigned int len,
+                               HevPacketFilterInfo *info)
+{
+    uint32_t ports;
+
+    if ((info->proto != IPPROTO_TCP && info->proto != IPPROTO_UDP) ||
+        (len < info->hdr_len + 4u))
+        return;
+
+    memcpy (&ports, data + info->hdr_len, 4);
+    ports = ntohl (ports);
+    info->sport = ports >> 16;
+    info->dport = ports;
+}
+
+static int
+hev_packet_filter_parse_ipv4 (const uint8_t *data, unsigned int len,
+                              HevPacketFilterInfo *info)
+{
+    unsigned int hdr_len;
+
+    if (len < 20)
+        return -1;
+
+    hdr_len = (data[0] & 0x0f) * 4;
+    if (hdr_len < 20 || len < hdr_len)
+        return -1;
+
+    info->proto = data[9];
+    info->hdr_len = hdr_len;
+    memcpy (info->saddr, data + 12, 4);
+    memcpy (info->daddr, data + 16, 4);
+
+    /* MF set or a non-zero fragment offset. */
+    if ((data[6] & 0x3f) | data[7])
+        info->flags |= HEV_PACKET_FILTER_FRAGMENT;
+
+    /* Later fragments carry no transport header. */
+    if (((data[6] & 0x1f) | data[7]) != 0)
+        return 0;
+
+    hev_packet_filter_parse_ports (data, len, info);
+
+    return 0;
+}
+
+static int
+hev_packet_filter_parse_ipv6 (const uint8_t *data, unsigned int len,
+                              HevPacketFilterInfo *info)
+{
+    unsigned int hdr_len = 40;
+    uint8_t next;
+    int i;
+
+    if (len < 40)
+        return -1;
+
+    /* Source and destination are adjacent, one 32 byte copy. */
+    memcpy (info->saddr, data + 8, 32);
+    next = data[6];
+
+    /* Walk a bounded number of extension headers. */
+    for (i = 0; i < 8; i++) {
+        const uint8_t *ext = data + hdr_len;
+
+        if (next != IPPROTO_HOPOPTS && next != IPPROTO_ROUTING &&
+            next != IPPROTO_DSTOPTS && next != IPPROTO_FRAGMENT)
+            break;
+
+        if (len < hdr_len + 8)
+            return -1;
+
+        if (next == IPPROTO_FRAGMENT) {
+            next = ext[0];
+            hdr_len += 8;
+            info->flags |= HEV_PACKET_FILTER_FRAGMENT;
+            /* Later fragments carry no transport header. */
+            if (((ext[2] << 8) | (ext[3] & 0xf8)) != 0) {
+                info->proto = next;
+                info->hdr_len = hdr_len;
+                return 0;
+            }
+            continue;
+        }
+
+        next = ext[0];
+        hdr_len += (ext[1] + 1) * 8;
+    }
+
+    if (len < hdr_len)
+        return -1;
+
+    info->proto = next;
+    info->hdr_len = hdr_len;
+
+    hev_packet_filter_parse_ports (data, len, info);
+
+    return 0;
+}
+
+int
+hev_packet_filter_parse (const uint8_t *data, unsigned int len,
+                         HevPacketFilterInfo *info)
+{
+    memset (info, 0, sizeof (*info));
+
+    if (len < 1)
+        return -1;
+
+    switch (data[0] >> 4) {
+    case 4:
+        info->family = 4;
+        if (hev_packet_filter_parse_ipv4 (data, len, info) == 0)
+            return 0;
+        break;
+    case 6:
+        info->family = 6;
+        if (hev_packet_filter_parse_ipv6 (data, len, info) == 0)
+            return 0;
+        break;
+    }
+
+    info->family = 0;
+    return -1;
+}
+
+void
+hev_packet_filter_parse_batch (struct pbuf **bufs, int num,
+                               HevPacketFilterInfo *infos)
+{
+    int i;
+
+    /*
+     * The batch was read a packet at a time, so the early headers may have
+     * left L1 by now. Pull the next one in while this one is parsed.
+     */
+    for (i = 0; i < num; i++) {
+        if ((i + 1) < num)
+            __builtin_prefetch (bufs[i + 1]->payload);
+        hev_packet_filter_parse (bufs[i]->payload, bufs[i]->len, &infos[i]);
+    }
+}
+
+static int
+hev_packet_filter_match_addr (const HevConfigFilterRule *rule,
+                              const uint8_t *addr)
+{
+    unsigned int bytes = rule->prefix >> 3;
+    unsigned int bits = rule->prefix & 7;
+
+    if (memcmp (rule->addr, addr, bytes) != 0)
+        return 0;
+
+    if (bits) {
+        uint8_t mask = 0xff << (8 - bits);
+
+        if ((rule->addr[bytes] ^ addr[bytes]) & mask)
+            return 0;
+    }
+
+    return 1;
+}
+
+int
+hev_packet_filter_classify (const HevPacketFilterInfo *info)
+{
+    int i;
+
+    if (!rule_count)
+        return -1;
+
+    if (!portless) {
+        const uint32_t *map;
+
+        if (info->proto == IPPROTO_TCP)
+            map = port_maps[PORT_MAP_TCP];
+        else if (info->proto == IPPROTO_UDP)
+            map = port_maps[PORT_MAP_UDP];
+        else
+            return -1;
+
+        if (!(map[info->dport >> 5] & (1u << (info->dport & 31))))
+            return -1;
+    }
+
+    for (i = 0; i < rule_count; i++) {
+        const HevConfigFilterRule *rule = &rules[i];
+
+        if (rule->family && rule->family != info->family)
+            continue;
+        if (rule->proto && rule->proto != info->proto)
+            continue;
+        if (rule->port_min && ((info->dport < rule->port_min) ||
+                               (info->dport > rule->port_max)))
+            continue;
+        if (rule->prefix && !hev_packet_filter_match_addr (rule, info->daddr))
+            continue;
+
+        return rule->action;
+    }
+
+    return -1;
+}
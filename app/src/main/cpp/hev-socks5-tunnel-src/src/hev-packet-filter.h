@@ -0,0 +1,66 @@
+/*
+ ============================================================================
+ Name        : hev-packet-filter.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Packet Filter
+ ============================================================================
+ */
+
+#ifndef __HEV_PACKET_FILTER_H__
+#define __HEV_PACKET_FILTER_H__
+
+#include <stdint.h>
+
+#include <lwip/pbuf.h>
+
+#include "hev-config.h"
+
+typedef struct _HevPacketFilterInfo HevPacketFilterInfo;
+
+enum
+{
+    /* Part of a fragmented datagram, the first fragment included. */
+    HEV_PACKET_FILTER_FRAGMENT = 1 << 0,
+};
+
+/*
+ * Flow key of a packet, taken from its headers in one pass, so the filter,
+ * the QUIC reject and the mapped DNS intercept never read the headers again.
+ * IPv4 addresses fill the first 4 bytes and the rest is zero.
+ */
+struct _HevPacketFilterInfo
+{
+    uint8_t saddr[16];
+    uint8_t daddr[16];
+    uint16_t hdr_len; /* bytes in front of the upper layer header */
+    uint16_t sport; /* TCP/UDP ports, 0 when unknown */
+    uint16_t dport;
+    uint8_t family; /* 4 or 6, 0 if the headers did not parse */
+    uint8_t proto; /* upper layer protocol, after IPv6 extension headers */
+    uint8_t flags;
+};
+
+/*
+ * The rule table is compiled once from the config and then only read, so
+ * all workers classify against it without locking.
+ */
+int hev_packet_filter_init (void);
+void hev_packet_filter_fini (void);
+
+int hev_packet_filter_parse (const uint8_t *data, unsigned int len,
+                             HevPacketFilterInfo *info);
+
+/*
+ * Parses the first pbuf of each packet of a TUN read batch. Packets whose
+ * headers do not parse get a family of 0.
+ */
+void hev_packet_filter_parse_batch (struct pbuf **bufs, int num,
+                                    HevPacketFilterInfo *infos);
+
+/* Returns the action of the first matching rule, or -1 if none matches. */
+int hev_packet_filter_classify (const HevPacketFilterInfo *info);
+
+int hev_packet_filter_is_empty (void);
+
+#endif /* __HEV_PACKET_FILTER_H__ */
@@ -0,0 +1,216 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-prefetch.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Resolve Prefetch
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+#include <hev-socks5-misc.h>
+#include <hev-socks5-client-tcp.h>
+
+#include "hev-list.h"
+#include "hev-logger.h"
+#include "hev-config.h"
+#include "hev-compiler.h"
+#include "hev-socks5-session.h"
+#include "hev-socks5-upstream.h"
+
+#include "hev-socks5-prefetch.h"
+
+#define PREFETCH_MAX (8)
+#define PREFETCH_FAILS (3)
+
+#define HEV_SOCKS5_PREFETCH(p) ((HevSocks5Prefetch *)p)
+#define HEV_SOCKS5_PREFETCH_TYPE (hev_socks5_prefetch_class ())
+
+typedef struct _HevSocks5Prefetch HevSocks5Prefetch;
+
+struct _HevSocks5Prefetch
+{
+    HevSocks5ClientTCP base;
+
+    HevListNode node;
+    HevTask *task;
+    HevConfigLive *live;
+};
+
+static __thread HevList prefetches;
+static __thread unsigned int count;
+static __thread unsigned int fails;
+
+static HevObjectClass *hev_socks5_prefetch_class (void);
+
+static int
+hev_socks5_prefetch_construct (HevSocks5Prefetch *self, const char *name)
+{
+    HevSocks5Addr addr;
+    int res;
+
+    self->live = hev_config_live_hold ();
+    if (!self->live)
+        return -1;
+
+    hev_socks5_addr_from_name (&addr, name, 0);
+    res = hev_socks5_client_tcp_construct (&self->base, &addr);
+    if (res < 0) {
+        hev_config_live_release (self->live);
+        return -1;
+    }
+
+    LOG_D ("%p socks5 prefetch construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_SOCKS5_PREFETCH_TYPE;
+    /* Same request layout as CONNECT, only the command differs. */
+    HEV_SOCKS5 (self)->type = HEV_SOCKS5_TYPE_RESOLVE;
+
+    return 0;
+}
+
+static HevSocks5Prefetch *
+hev_socks5_prefetch_new (const char *name)
+{
+    HevSocks5Prefetch *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevSocks5Prefetch));
+    if (!self)
+        return NULL;
+
+    res = hev_socks5_prefetch_construct (self, name);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 prefetch new", self);
+
+    return self;
+}
+
+static void
+hev_socks5_prefetch_task_entry (void *data)
+{
+    HevSocks5Prefetch *self = data;
+    HevSocks5Client *client = HEV_SOCKS5_CLIENT (self);
+    const HevConfigUpstream *up;
+    HevConfigServer *srv;
+    int index, res;
+
+    srv = hev_config_get_socks5_server (self->live);
+    index = hev_socks5_upstream_get (self->live, 0, &up);
+
+    res = hev_socks5_client_connect (client, up->addr, up->port);
+    if (res < 0)
+        goto exit;
+
+    if (up->user && up->pass)
+        hev_socks5_client_set_auth (client, up->user, up->pass);
+
+    /* Only refusals after a good connect count against the extension. */
+    res = hev_socks5_client_handshake (client, srv->pipeline);
+    if (res < 0) {
+        if (hev_socks5_get_timeout (HEV_SOCKS5 (self)) &&
+            (++fails == PREFETCH_FAILS))
+            LOG_I ("socks5 prefetch off, resolve refused by upstream");
+        goto exit;
+    }
+    fails = 0;
+
+exit:
+    hev_socks5_upstream_put (self->live, index);
+    hev_list_del (&prefetches, &self->node);
+    count--;
+    hev_object_unref (HEV_OBJECT (self));
+}
+
+void
+hev_socks5_prefetch_name (const char *name, int len)
+{
+    HevSocks5Prefetch *self;
+    int stack_size;
+    HevTask *task;
+
+    if ((count >= PREFETCH_MAX) || (fails >= PREFETCH_FAILS))
+        return;
+
+    self = hev_socks5_prefetch_new (name);
+    if (!self)
+        return;
+
+    stack_size = hev_config_get_misc_task_stack_size ();
+    task = hev_task_new (stack_size);
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (self));
+        return;
+    }
+
+    self->task = task;
+    hev_list_add_tail (&prefetches, &self->node);
+    count++;
+    hev_task_run (task, hev_socks5_prefetch_task_entry, self);
+}
+
+void
+hev_socks5_prefetch_fini (void)
+{
+    HevListNode *node;
+
+    node = hev_list_first (&prefetches);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5Prefetch *self;
+
+        self = container_of (node, HevSocks5Prefetch, node);
+        hev_socks5_set_timeout (HEV_SOCKS5 (self), 0);
+        hev_task_wakeup (self->task);
+    }
+}
+
+static int
+hev_socks5_prefetch_bind (HevSocks5 *self, int fd, const struct sockaddr *dest)
+{
+    HevSocks5Prefetch *prefetch = HEV_SOCKS5_PREFETCH (self);
+
+    LOG_D ("%p socks5 prefetch bind", self);
+
+    return hev_socks5_session_bind_socket (prefetch->live, fd);
+}
+
+static void
+hev_socks5_prefetch_destruct (HevObject *base)
+{
+    HevSocks5Prefetch *self = HEV_SOCKS5_PREFETCH (base);
+
+    LOG_D ("%p socks5 prefetch destruct", self);
+
+    hev_config_live_release (self->live);
+    HEV_SOCKS5_CLIENT_TCP_TYPE->destruct (base);
+}
+
+static HevObjectClass *
+hev_socks5_prefetch_class (void)
+{
+    static HevSocks5ClientTCPClass klass;
+    HevSocks5ClientTCPClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevSocks5Class *skptr;
+
+        memcpy (kptr, HEV_SOCKS5_CLIENT_TCP_TYPE,
+                sizeof (HevSocks5ClientTCPClass));
+
+        okptr->name = "HevSocks5Prefetch";
+        okptr->destruct = hev_socks5_prefetch_destruct;
+
+        skptr = HEV_SOCKS5_CLASS (kptr);
+        skptr->binder = hev_socks5_prefetch_bind;
+    }
+
+    return okptr;
+}
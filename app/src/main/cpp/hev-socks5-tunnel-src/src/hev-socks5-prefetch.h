@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-prefetch.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Resolve Prefetch
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_PREFETCH_H__
+#define __HEV_SOCKS5_PREFETCH_H__
+
+/*
+ * Asks an upstream to resolve a newly mapped name with the SOCKS5 RESOLVE
+ * extension, so its resolver cache is warm when the first connect to the
+ * name arrives. Best effort: hints beyond the in-flight limit are dropped,
+ * and a worker stops sending them once the upstream keeps refusing.
+ */
+void hev_socks5_prefetch_name (const char *name, int len);
+
+/* Terminates the in-flight hints of the calling worker. */
+void hev_socks5_prefetch_fini (void);
+
+#endif /* __HEV_SOCKS5_PREFETCH_H__ */
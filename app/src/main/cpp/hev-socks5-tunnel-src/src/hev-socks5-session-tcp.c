@@ -2,57 +2,308 @@
  ============================================================================
  Name        : hev-socks5-session-tcp.c
  Author      : hev <r@hev.cc>
- Copyright   : Copyright (c) 2017 - 2023 hev
+ Copyright   : Copyright (c) 2017 - 2025 hev
  Description : Socks5 Session TCP
  ============================================================================
  */
 
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
+#include <lwip/sys.h>
 #include <lwip/tcp.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
-#include <hev-task-mutex.h>
 #include <hev-memory-allocator.h>
 #include <hev-socks5-misc.h>
 
+#include "hev-main.h"
 #include "hev-utils.h"
 #include "hev-config.h"
 #include "hev-logger.h"
+#include "hev-compiler.h"
 #include "hev-config-const.h"
 #include "hev-socks5-tunnel.h"
 
 #include "hev-socks5-session-tcp.h"
 
+#define FWD_WND_MIN (2 * hev_config_get_tunnel_tcp_mss (0))
+#define FWD_WND_INIT (0xffff)
+
+/* Bounded wait for zerocopy completions once the splice is over. */
+#define ZC_DRAIN_WAITS (100)
+#define ZC_DRAIN_WAIT_MS (10)
+
+/*
+ * Bytes all sessions of all workers have grown their buffers and forward
+ * windows by, checked against tcp-buffer-budget before each growth step.
+ */
+static size_t budget_used;
+static int zerocopy_unsupported;
+
+static int
+tcp_budget_charge (HevSocks5SessionTCP *self, size_t size)
+{
+    size_t budget = hev_config_get_misc_tcp_buffer_budget ();
+    size_t used;
+
+    used = __atomic_add_fetch (&budget_used, size, __ATOMIC_RELAXED);
+    if (budget && (used > budget)) {
+        __atomic_sub_fetch (&budget_used, size, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    self->budget += size;
+    return 0;
+}
+
+static void
+tcp_budget_release (HevSocks5SessionTCP *self, size_t size)
+{
+    __atomic_sub_fetch (&budget_used, size, __ATOMIC_RELAXED);
+    self->budget -= size;
+}
+
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
-    HevSocks5Session *self = data;
-    HevListNode *node;
-    int res;
+    return hev_socks5_session_yield (data, type);
+}
 
-    res = hev_socks5_task_io_yielder (type, data);
-    node = hev_socks5_session_get_node (self);
-    hev_socks5_tunnel_update_session (node);
+static void
+tcp_window_update (HevSocks5SessionTCP *self)
+{
+    struct tcp_pcb *pcb = self->pcb;
+    int credit;
+
+    /* Credit beyond fwd-wnd is withheld, the window is never retracted. */
+    credit = self->fwd_wnd - (int)pcb->rcv_wnd;
+    if (credit > self->fwd_recved)
+        credit = self->fwd_recved;
+    if (credit <= 0)
+        return;
 
-    return res;
+    /* Window updates below the lwIP threshold would not be sent. */
+    if (self->queue && (credit < TCP_WND_UPDATE_THRESHOLD))
+        return;
+
+    tcp_recved (pcb, credit);
+    self->fwd_recved -= credit;
+}
+
+static void
+tcp_window_grow (HevSocks5SessionTCP *self)
+{
+    int size, max;
+
+    self->fwd_full = 0;
+    if (!self->pcb || hev_socks5_tunnel_mem_pressure (&self->data.node))
+        return;
+
+    max = hev_config_get_misc_tcp_window_size ();
+    if (!max || (max > TCP_WND_MAX (self->pcb)))
+        max = TCP_WND_MAX (self->pcb);
+
+    size = self->fwd_wnd * 2;
+    if (size > max)
+        size = max;
+    if (size <= self->fwd_wnd)
+        return;
+
+    if (tcp_budget_charge (self, size - self->fwd_wnd) < 0)
+        return;
+
+    self->fwd_wnd = size;
+}
+
+static void
+tcp_window_shrink (HevSocks5SessionTCP *self)
+{
+    int size;
+
+    size = self->fwd_wnd / 2;
+    if (size < FWD_WND_MIN)
+        size = FWD_WND_MIN;
+    if (size >= self->fwd_wnd)
+        return;
+
+    tcp_budget_release (self, self->fwd_wnd - size);
+    self->fwd_wnd = size;
+}
+
+/*
+ * The forward queue links the pbufs lwIP hands over through their next
+ * fields but keeps its length and tail here: chain totals are 16 bits wide
+ * and pbuf_cat walks the whole chain, while a scaled window queues more
+ * than that in many small segments.
+ */
+static void
+tcp_queue_push (HevSocks5SessionTCP *self, struct pbuf *p)
+{
+    struct pbuf *t;
+
+    self->queue_len += p->tot_len;
+    self->queue_segs++;
+
+    for (t = p; t->next; t = t->next)
+        self->queue_segs++;
+
+    if (self->queue_tail)
+        self->queue_tail->next = p;
+    else
+        self->queue = p;
+    self->queue_tail = t;
+}
+
+static void
+tcp_queue_pull (HevSocks5SessionTCP *self, size_t len)
+{
+    self->queue_len -= len;
+
+    while (len) {
+        struct pbuf *p = self->queue;
+
+        if (len < p->len) {
+            pbuf_remove_header (p, len);
+            break;
+        }
+
+        len -= p->len;
+        self->queue = p->next;
+        self->queue_segs--;
+        p->next = NULL;
+        pbuf_free (p);
+    }
+
+    if (!self->queue)
+        self->queue_tail = NULL;
+}
+
+static void
+tcp_zerocopy_reap (HevSocks5SessionTCP *self)
+{
+    int len = 0;
+
+    hev_task_io_socket_zc_reap (&self->zc);
+    /* The kernel had to copy anyway, pinning pages only costs here. */
+    if (self->zc.copied)
+        self->zc_size = 0;
+
+    /* TCP completes send calls in order. */
+    while (self->zc_freed != self->zc.done) {
+        len += self->zc_lens[self->zc_freed % HEV_SOCKS5_SESSION_TCP_ZC_SLOTS];
+        self->zc_freed++;
+    }
+    if (!len)
+        return;
+
+    tcp_queue_pull (self, len);
+    self->zc_held -= len;
+    self->fwd_recved += len;
+    hev_socks5_tunnel_charge (&self->data.node, -len);
+}
+
+static ssize_t
+tcp_splice_f_send (HevSocks5SessionTCP *self, struct iovec *iov, int iovc,
+                   int len)
+{
+    unsigned int slots = HEV_SOCKS5_SESSION_TCP_ZC_SLOTS;
+    unsigned int next = self->zc.next;
+    int pending;
+    ssize_t s;
+
+    pending = next != self->zc_freed;
+    s = -1;
+    if (self->zc_size && (len >= self->zc_size) &&
+        (next - self->zc_freed) < slots) {
+        struct msghdr mh = { 0 };
+
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovc;
+        s = hev_task_io_socket_sendmsg_zc (&self->zc, &mh, MSG_DONTWAIT, NULL,
+                                           NULL, NULL);
+        if ((0 > s) && (EAGAIN == errno))
+            return s;
+        if (0 > s)
+            self->zc_size = 0;
+    }
+
+    if (0 > s)
+        s = writev (HEV_SOCKS5 (self)->fd, iov, iovc);
+
+    /* A call the kernel took with zerocopy has a slot of its own. */
+    if ((s > 0) && (self->zc.next != next)) {
+        self->zc_lens[next % slots] = s;
+        self->zc_held += s;
+    } else if ((s > 0) && pending) {
+        /* Released in stream order, together with the preceding call. */
+        self->zc_lens[(next - 1) % slots] += s;
+        self->zc_held += s;
+    } else if (s > 0) {
+        tcp_queue_pull (self, s);
+        self->fwd_recved += s;
+        hev_socks5_tunnel_charge (&self->data.node, -s);
+    }
+
+    return s;
 }
 
 static int
-tcp_splice_f (HevSocks5SessionTCP *self)
+tcp_splice_f (HevSocks5SessionTCP *self, int coalesce)
 {
     struct iovec iov[64];
     struct pbuf *p;
+    size_t quota;
     int iovc = 0;
     int res = 1;
+    int len = 0;
+
+    if (self->zc.next != self->zc_freed)
+        tcp_zerocopy_reap (self);
+
+    len = self->queue_len - self->zc_held;
+
+    if (len) {
+        int off = self->zc_held;
+
+        /*
+         * A short queue is held back for one scheduling round, so that the
+         * segments of the next tunnel read batch leave in the same writev.
+         * When nothing arrives meanwhile the flow is latency bound (e.g.
+         * interactive), and holding is skipped for the next few writes.
+         */
+        if (self->fwd_held) {
+            if (len == self->fwd_held)
+                self->fwd_skip = 16;
+            self->fwd_held = 0;
+        } else if (self->fwd_skip) {
+            self->fwd_skip--;
+        } else if (!self->pcb_eof && len < coalesce) {
+            self->fwd_held = len;
+            return 1;
+        }
 
-    if (self->queue) {
-        for (p = self->queue; p && (iovc < 64); p = p->next, iovc++) {
-            iov[iovc].iov_base = p->payload;
-            iov[iovc].iov_len = p->len;
+        /* Held by the rate limit, the queue waits with the window shut. */
+        quota = len = hev_socks5_session_quota (&self->data, 0, len, 1);
+        if (!len)
+            return 0;
+
+        /* Skip the part already sent with zerocopy. */
+        for (p = self->queue; off >= p->len; p = p->next)
+            off -= p->len;
+        for (; p && quota && (iovc < 64); p = p->next, iovc++) {
+            size_t size = p->len - off;
+
+            if (size > quota)
+                size = quota;
+            iov[iovc].iov_base = (char *)p->payload + off;
+            iov[iovc].iov_len = size;
+            quota -= size;
+            off = 0;
         }
     } else if (self->pcb_eof) {
         res = -1;
@@ -61,70 +312,216 @@ tcp_splice_f (HevSocks5SessionTCP *self)
     }
 
     if (iovc) {
-        ssize_t s = writev (HEV_SOCKS5 (self)->fd, iov, iovc);
+        ssize_t s = tcp_splice_f_send (self, iov, iovc, len);
         if (0 >= s) {
+            self->fwd_full = 0;
             if ((0 > s) && (EAGAIN == errno))
                 res = 0;
             else
                 res = -1;
         } else {
-            hev_task_mutex_lock (self->mutex);
-            self->queue = pbuf_free_header (self->queue, s);
-            if (self->pcb)
-                tcp_recved (self->pcb, s);
-            hev_task_mutex_unlock (self->mutex);
+            /*
+             * The sender ran out of window and upstream took all of it in
+             * one go, so the window is what limits the flow.
+             */
+            if (s < len)
+                self->fwd_full = 0;
+            else if (self->fwd_full)
+                tcp_window_grow (self);
+            hev_socks5_tunnel_add_fwd_stats (s);
+            hev_socks5_session_charge (&self->data, 0, s);
+            self->data.stats.tx_bytes += s;
             res = 1;
         }
     } else if (res < 0) {
         shutdown (HEV_SOCKS5 (self)->fd, SHUT_WR);
     }
 
+    if (self->pcb)
+        tcp_window_update (self);
+
     return res;
 }
 
+static void
+tcp_buffer_resize (HevSocks5SessionTCP *self, size_t size)
+{
+    size_t old_size, new_size;
+
+    /* lwIP references the data until acked, so only an empty one moves. */
+    if (hev_circular_buffer_get_use_size (self->buffer))
+        return;
+
+    self->buffer_full = 0;
+    old_size = hev_circular_buffer_get_max_size (self->buffer);
+    if (size == old_size)
+        return;
+
+    if (size > old_size) {
+        if (tcp_budget_charge (self, size - old_size) < 0)
+            return;
+        self->buffer = hev_circular_buffer_resize (self->buffer, size);
+        if (hev_circular_buffer_get_max_size (self->buffer) != size)
+            tcp_budget_release (self, size - old_size);
+    } else {
+        self->buffer = hev_circular_buffer_resize (self->buffer, size);
+        if (hev_circular_buffer_get_max_size (self->buffer) == size)
+            tcp_budget_release (self, old_size - size);
+    }
+
+    new_size = hev_circular_buffer_get_max_size (self->buffer);
+    hev_socks5_tunnel_charge (&self->data.node,
+                              (ssize_t)new_size - (ssize_t)old_size);
+}
+
 static int
-tcp_splice_b (HevSocks5SessionTCP *self)
+tcp_splice_b_write (HevSocks5SessionTCP *self, struct iovec *iov, int iovc,
+                    int defer)
+{
+    size_t s = 0;
+    int i;
+
+    /* Data beyond tcp_sndbuf stays in the ring until acks free room. */
+    for (i = 0; i < iovc; i++) {
+        size_t room = tcp_sndbuf (self->pcb);
+        size_t len = iov[i].iov_len;
+        u8_t flags = 0;
+        err_t err;
+
+        if (len > room)
+            len = room;
+        if (!len)
+            break;
+
+        if (defer || (i + 1 < iovc) || (len < iov[i].iov_len))
+            flags = TCP_WRITE_FLAG_MORE;
+        err = tcp_write (self->pcb, iov[i].iov_base, len, flags);
+        if (err == ERR_MEM)
+            break;
+        if (err != ERR_OK)
+            return -1;
+
+        s += len;
+        if (len < iov[i].iov_len)
+            break;
+    }
+
+    hev_circular_buffer_read_advance (self->buffer, s);
+    self->bwd_held += s;
+
+    return s;
+}
+
+static int
+tcp_splice_b (HevSocks5SessionTCP *self, size_t max_size, int coalesce)
 {
     struct iovec iov[2];
-    err_t err = ERR_OK;
     int res = 1, iovc;
+    int defer = 0;
+    int more = 0;
+
+    /* The replies of an optimistic handshake lead the backward stream. */
+    if (HEV_SOCKS5_CLIENT (self)->replies) {
+        res = hev_socks5_client_read_replies (HEV_SOCKS5_CLIENT (self));
+        if (res <= 0)
+            return res ? -2 : 0;
+    }
 
-    iovc = hev_ring_buffer_writing (self->buffer, iov);
+    /* Grow once a full buffer has drained, up to tcp-buffer-size. */
+    if (self->buffer_full &&
+        !hev_socks5_tunnel_mem_pressure (&self->data.node)) {
+        size_t size = hev_circular_buffer_get_max_size (self->buffer) * 2;
+
+        if (size > max_size)
+            size = max_size;
+        tcp_buffer_resize (self, size);
+    }
+
+    iovc = hev_circular_buffer_writing (self->buffer, iov);
     if (iovc) {
+        size_t room = iov[0].iov_len + ((iovc > 1) ? iov[1].iov_len : 0);
+        size_t quota;
+
+        quota = hev_socks5_session_quota (&self->data, 1, room,
+                                          self->bwd_active);
+        if (iov[0].iov_len >= quota) {
+            iov[0].iov_len = quota;
+            iovc = 1;
+        } else if (quota < room) {
+            iov[1].iov_len = quota - iov[0].iov_len;
+        }
+    }
+    if (iovc && iov[0].iov_len) {
         ssize_t s = readv (HEV_SOCKS5 (self)->fd, iov, iovc);
         if (0 >= s) {
             if ((0 > s) && (EAGAIN == errno))
                 res = 0;
             else
                 res = -1;
+            self->bwd_active = 0;
         } else {
-            hev_ring_buffer_write_finish (self->buffer, s);
+            HevSocks5SessionStats *stats = &self->data.stats;
+
+            if (!stats->rx_bytes) {
+                stats->ttfb = sys_now () - stats->start;
+                hev_socks5_tunnel_trace (stats->trace,
+                                         HEV_SOCKS5_TUNNEL_TRACE_FIRST_BYTE);
+            }
+            stats->rx_bytes += s;
+            self->bwd_active = 1;
+            hev_socks5_session_charge (&self->data, 1, s);
+            hev_circular_buffer_write_finish (self->buffer, s);
+            /* Filled all the room, the socket likely has more queued. */
+            more = s == (iov[0].iov_len + ((iovc > 1) ? iov[1].iov_len : 0));
         }
     } else {
         res = 0;
     }
 
-    hev_task_mutex_lock (self->mutex);
+    if (hev_circular_buffer_get_use_size (self->buffer) ==
+        hev_circular_buffer_get_max_size (self->buffer))
+        self->buffer_full = 1;
+
     if (self->pcb) {
-        iovc = hev_ring_buffer_reading (self->buffer, iov);
+        iovc = hev_circular_buffer_reading (self->buffer, iov);
         if (iovc) {
-            ssize_t s = 0;
-            int i;
-            for (i = 0; i < iovc; i++) {
-                void *ptr = iov[i].iov_base;
-                size_t len = iov[i].iov_len;
-                err |= tcp_write (self->pcb, ptr, len, 0);
-                s += len;
-            }
-            hev_ring_buffer_read_finish (self->buffer, s);
-            err |= tcp_output (self->pcb);
-            res = 1;
+            size_t size = iov[0].iov_len;
+            int s;
+
+            /*
+             * While upstream trickles in faster than it is read, segments
+             * are queued for one more round before tcp_output, so lwIP
+             * sends them full rather than one per readv.
+             */
+            if (iovc > 1)
+                size += iov[1].iov_len;
+            defer = more && (self->bwd_held + size < coalesce);
+
+            s = tcp_splice_b_write (self, iov, iovc, defer);
+            if (s < 0)
+                return -1;
+            if (s > 0)
+                res = 1;
+            else if (res < 0)
+                res = 0;
         } else if (res < 0) {
+            /* Sends what is queued ahead of the FIN. */
             tcp_shutdown (self->pcb, 0, 1);
+            self->bwd_held = 0;
+        }
+
+        if (self->bwd_held && !defer) {
+            err_t err = tcp_output (self->pcb);
+
+            /* Out of segments, lwIP retries from its timer. */
+            if ((err != ERR_OK) && (err != ERR_MEM))
+                return -1;
+            self->bwd_held = 0;
+            hev_socks5_tunnel_flush ();
         }
+        hev_socks5_tunnel_kick_timer ();
     }
-    hev_task_mutex_unlock (self->mutex);
-    if (!self->pcb || (err != ERR_OK))
+    if (!self->pcb)
         res = -1;
 
     return res;
@@ -136,13 +533,15 @@ tcp_recv_handler (void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
     HevSocks5SessionTCP *self = arg;
 
     if (p) {
-        if (!self->queue) {
-            self->queue = p;
-        } else {
-            if (self->queue->tot_len > TCP_WND_MAX (pcb))
-                return ERR_WOULDBLOCK;
-            pbuf_cat (self->queue, p);
-        }
+        /* Refused data is offered again from the lwIP timer. */
+        if (self->queue && ((self->queue_len > TCP_WND_MAX (pcb)) ||
+                            (self->queue_segs >=
+                             HEV_SOCKS5_SESSION_TCP_QUEUE_SEGS_MAX)))
+            return ERR_WOULDBLOCK;
+        tcp_queue_push (self, p);
+        hev_socks5_tunnel_charge (&self->data.node, p->tot_len);
+        if (pcb->rcv_wnd < pcb->mss)
+            self->fwd_full = 1;
     } else {
         self->pcb_eof = 1;
     }
@@ -156,7 +555,7 @@ tcp_sent_handler (void *arg, struct tcp_pcb *pcb, u16_t len)
 {
     HevSocks5SessionTCP *self = arg;
 
-    hev_ring_buffer_read_release (self->buffer, len);
+    hev_circular_buffer_read_release (self->buffer, len);
     hev_task_wakeup (self->data.task);
 
     return ERR_OK;
@@ -168,11 +567,13 @@ tcp_err_handler (void *arg, err_t err)
     HevSocks5SessionTCP *self = arg;
 
     self->pcb = NULL;
+    hev_socks5_session_set_state (HEV_SOCKS5_SESSION (self),
+                                  HEV_SOCKS5_TUNNEL_SESSION_ABORTED);
     hev_socks5_session_terminate (HEV_SOCKS5_SESSION (self));
 }
 
 HevSocks5SessionTCP *
-hev_socks5_session_tcp_new (struct tcp_pcb *pcb, HevTaskMutex *mutex)
+hev_socks5_session_tcp_new (struct tcp_pcb *pcb)
 {
     HevSocks5SessionTCP *self;
     int res;
@@ -181,7 +582,7 @@ hev_socks5_session_tcp_new (struct tcp_pcb *pcb, HevTaskMutex *mutex)
     if (!self)
         return NULL;
 
-    res = hev_socks5_session_tcp_construct (self, pcb, mutex);
+    res = hev_socks5_session_tcp_construct (self, pcb);
     if (res < 0) {
         hev_free (self);
         return NULL;
@@ -196,32 +597,23 @@ static int
 hev_socks5_session_tcp_bind (HevSocks5 *self, int fd,
                              const struct sockaddr *dest)
 {
-    HevConfigServer *srv;
-    unsigned int mark;
+    HevSocks5SessionTCP *session = HEV_SOCKS5_SESSION_TCP (self);
 
     LOG_D ("%p socks5 session tcp bind", self);
 
-    srv = hev_config_get_socks5_server ();
-    mark = srv->mark;
-
-    if (mark) {
-        int res;
-
-        res = set_sock_mark (fd, mark);
-        if (res < 0)
-            return -1;
-    }
-
-    return 0;
+    return hev_socks5_session_bind_socket (session->data.live, fd);
 }
 
 static void
 hev_socks5_session_tcp_splice (HevSocks5Session *base)
 {
     HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
+    int tcp_coalesce_size;
     int tcp_buffer_size;
+    int min_buffer_size;
     int res_f = 1;
     int res_b = 1;
+    int i;
 
     LOG_D ("%p socks5 session tcp splice", self);
 
@@ -229,17 +621,39 @@ hev_socks5_session_tcp_splice (HevSocks5Session *base)
         return;
 
     tcp_buffer_size = hev_config_get_misc_tcp_buffer_size ();
-    self->buffer = hev_ring_buffer_alloca (tcp_buffer_size);
+    min_buffer_size = HEV_CIRCULAR_BUFFER_MIN_SIZE;
+    if (min_buffer_size > tcp_buffer_size)
+        min_buffer_size = tcp_buffer_size;
+
+    self->buffer = hev_circular_buffer_new (min_buffer_size);
     if (!self->buffer)
         return;
+    hev_socks5_tunnel_charge (&self->data.node, min_buffer_size);
+
+    /* Probed once, kernels without SO_ZEROCOPY keep the copy path. */
+    self->zc_size = hev_config_get_misc_tcp_zerocopy_size ();
+    if (self->zc_size && !READ_ONCE (zerocopy_unsupported) &&
+        (hev_task_io_socket_zc_init (&self->zc, HEV_SOCKS5 (self)->fd) < 0)) {
+        WRITE_ONCE (zerocopy_unsupported, 1);
+        LOG_I ("%p socks5 session tcp zerocopy unsupported", self);
+    }
+    if (READ_ONCE (zerocopy_unsupported))
+        self->zc_size = 0;
 
+    tcp_coalesce_size = hev_config_get_misc_tcp_coalesce_size ();
     for (;;) {
         HevTaskYieldType type;
 
         if (res_f >= 0)
-            res_f = tcp_splice_f (self);
+            res_f = tcp_splice_f (self, tcp_coalesce_size);
         if (res_b >= 0)
-            res_b = tcp_splice_b (self);
+            res_b = tcp_splice_b (self, tcp_buffer_size, tcp_coalesce_size);
+        /* Refused after data was sent, the flow is reset. */
+        if (res_b < -1) {
+            hev_socks5_session_set_state (
+                base, HEV_SOCKS5_TUNNEL_SESSION_HANDSHAKE_FAILED);
+            break;
+        }
 
         if (res_f > 0 || res_b > 0)
             type = HEV_TASK_YIELD;
@@ -248,17 +662,50 @@ hev_socks5_session_tcp_splice (HevSocks5Session *base)
         else
             break;
 
-        if (task_io_yielder (type, base) < 0)
+        /*
+         * Buffers that did not fill since the last wait are halved, and
+         * all of them are while memory is short. A rate limit hold is no
+         * wait, the flow is busy.
+         */
+        if ((type == HEV_TASK_WAITIO) && !self->data.hold) {
+            size_t size = hev_circular_buffer_get_max_size (self->buffer) / 2;
+            int pressure = hev_socks5_tunnel_mem_pressure (&self->data.node);
+
+            if (!self->buffer_full || pressure) {
+                if (size < min_buffer_size)
+                    size = min_buffer_size;
+                tcp_buffer_resize (self, size);
+            }
+            if (!self->fwd_full || pressure)
+                tcp_window_shrink (self);
+        }
+
+        if (task_io_yielder (type, base) < 0) {
+            hev_socks5_session_io_closed (base);
             break;
+        }
     }
 
     while (self->pcb) {
-        if (hev_ring_buffer_get_use_size (self->buffer) == 0)
+        if (hev_circular_buffer_get_use_size (self->buffer) == 0)
             break;
 
         if (task_io_yielder (HEV_TASK_WAITIO, base) < 0)
             break;
     }
+
+    /*
+     * Queued pbufs sent with zerocopy are read by the kernel until done,
+     * even when terminated. What is still out after the wait is aborted
+     * in destruct.
+     */
+    for (i = 0; i < ZC_DRAIN_WAITS; i++) {
+        tcp_zerocopy_reap (self);
+        if (self->zc.next == self->zc_freed)
+            break;
+
+        hev_task_sleep (ZC_DRAIN_WAIT_MS);
+    }
 }
 
 static HevTask *
@@ -287,7 +734,7 @@ hev_socks5_session_tcp_get_node (HevSocks5Session *base)
 
 int
 hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
-                                  struct tcp_pcb *pcb, HevTaskMutex *mutex)
+                                  struct tcp_pcb *pcb)
 {
     HevSocks5Addr addr;
     int res;
@@ -296,21 +743,38 @@ hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
     if (res < 0)
         return -1;
 
+    self->data.live = hev_config_live_hold ();
+    if (!self->data.live)
+        return -1;
+
     res = hev_socks5_client_tcp_construct (&self->base, &addr);
-    if (res < 0)
+    if (res < 0) {
+        hev_config_live_release (self->data.live);
         return -1;
+    }
 
     LOG_D ("%p socks5 session tcp construct", self);
 
     HEV_OBJECT (self)->klass = HEV_SOCKS5_SESSION_TCP_TYPE;
 
+    /*
+     * With window scaling lwIP opens at TCP_WND, which is only the ceiling
+     * here. Nothing beyond the unscaled SYN-ACK window was announced yet,
+     * so the session starts at that and grows under the budget.
+     */
+    if (pcb->rcv_wnd > FWD_WND_INIT) {
+        pcb->rcv_wnd = FWD_WND_INIT;
+        pcb->rcv_ann_wnd = FWD_WND_INIT;
+        pcb->rcv_ann_right_edge = pcb->rcv_nxt + FWD_WND_INIT;
+    }
+
     tcp_arg (pcb, self);
     tcp_recv (pcb, tcp_recv_handler);
     tcp_sent (pcb, tcp_sent_handler);
     tcp_err (pcb, tcp_err_handler);
 
     self->pcb = pcb;
-    self->mutex = mutex;
+    self->fwd_wnd = FWD_WND_MIN;
     self->data.self = self;
 
     return 0;
@@ -323,7 +787,6 @@ hev_socks5_session_tcp_destruct (HevObject *base)
 
     LOG_D ("%p socks5 session tcp destruct", self);
 
-    hev_task_mutex_lock (self->mutex);
     if (self->pcb) {
         tcp_recv (self->pcb, NULL);
         tcp_sent (self->pcb, NULL);
@@ -331,9 +794,37 @@ hev_socks5_session_tcp_destruct (HevObject *base)
         tcp_abort (self->pcb);
     }
 
+    /*
+     * Zerocopy sends still pin the queue. A graceful close would let the
+     * kernel send them after the pbufs are reused, reset instead.
+     */
+    if (self->zc.next != self->zc_freed) {
+        HevSocks5 *s5 = HEV_SOCKS5 (self);
+        struct linger linger = { 1, 0 };
+
+        LOG_D ("%p socks5 session tcp zerocopy abort", self);
+        setsockopt (s5->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof (linger));
+        hev_task_del_fd (hev_task_self (), s5->fd);
+        close (s5->fd);
+        s5->fd = -1;
+    }
+
     if (self->queue)
         pbuf_free (self->queue);
-    hev_task_mutex_unlock (self->mutex);
+
+    /* Freed after the abort, unacked segments may still point into it. */
+    if (self->buffer)
+        hev_circular_buffer_unref (self->buffer);
+
+    if (self->budget)
+        tcp_budget_release (self, self->budget);
+
+    if (self->data.mem)
+        hev_socks5_tunnel_charge (&self->data.node,
+                                  -(ssize_t)self->data.mem);
+
+    if (self->data.live)
+        hev_config_live_release (self->data.live);
 
     HEV_SOCKS5_CLIENT_TCP_TYPE->destruct (base);
 }
@@ -10,7 +10,8 @@
 #ifndef __HEV_SOCKS5_SESSION_TCP_H__
 #define __HEV_SOCKS5_SESSION_TCP_H__
 
-#include <hev-ring-buffer.h>
+#include <hev-circular-buffer.h>
+#include <hev-task-io-socket.h>
 #include <hev-socks5-client-tcp.h>
 
 #include "hev-socks5-session.h"
@@ -19,20 +20,46 @@
 #define HEV_SOCKS5_SESSION_TCP_CLASS(p) ((HevSocks5SessionTCPClass *)p)
 #define HEV_SOCKS5_SESSION_TCP_TYPE (hev_socks5_session_tcp_class ())
 
+#define HEV_SOCKS5_SESSION_TCP_ZC_SLOTS (8)
+/* Pbufs queued towards upstream before lwIP is asked to hold segments. */
+#define HEV_SOCKS5_SESSION_TCP_QUEUE_SEGS_MAX (1024)
+
 typedef struct _HevSocks5SessionTCP HevSocks5SessionTCP;
 typedef struct _HevSocks5SessionTCPClass HevSocks5SessionTCPClass;
 
+/*
+ * What the splicer touches on every round comes right after the base, so
+ * it shares cache lines with the socket; the session data and the zero
+ * copy slots follow.
+ */
 struct _HevSocks5SessionTCP
 {
     HevSocks5ClientTCP base;
 
-    HevSocks5SessionData data;
-
-    struct pbuf *queue;
     struct tcp_pcb *pcb;
-    HevTaskMutex *mutex;
-    HevRingBuffer *buffer;
+    struct pbuf *queue;
+    struct pbuf *queue_tail;
+    size_t queue_len;
+    HevCircularBuffer *buffer;
+    size_t budget;
+    int queue_segs;
     int pcb_eof;
+    int buffer_full;
+    int fwd_held;
+    int fwd_skip;
+    int bwd_held;
+    int fwd_recved;
+    int fwd_wnd;
+    int fwd_full;
+    int bwd_active;
+    int zc_size;
+    int zc_held;
+    unsigned int zc_freed;
+
+    HevSocks5SessionData data;
+
+    HevTaskIOSocketZC zc;
+    int zc_lens[HEV_SOCKS5_SESSION_TCP_ZC_SLOTS];
 };
 
 struct _HevSocks5SessionTCPClass
@@ -45,9 +72,8 @@ struct _HevSocks5SessionTCPClass
 HevObjectClass *hev_socks5_session_tcp_class (void);
 
 int hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
-                                      struct tcp_pcb *pcb, HevTaskMutex *mutex);
+                                      struct tcp_pcb *pcb);
 
-HevSocks5SessionTCP *hev_socks5_session_tcp_new (struct tcp_pcb *pcb,
-                                                 HevTaskMutex *mutex);
+HevSocks5SessionTCP *hev_socks5_session_tcp_new (struct tcp_pcb *pcb);
 
 #endif /* __HEV_SOCKS5_SESSION_TCP_H__ */
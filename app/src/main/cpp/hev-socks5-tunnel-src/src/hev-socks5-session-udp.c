@@ -10,16 +10,17 @@
 #include <errno.h>
 #include <string.h>
 
+#include <lwip/sys.h>
 #include <lwip/udp.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
-#include <hev-task-mutex.h>
 #include <hev-memory-allocator.h>
 #include <hev-socks5-udp.h>
 #include <hev-socks5-misc.h>
 
+#include "hev-main.h"
 #include "hev-utils.h"
 #include "hev-config.h"
 #include "hev-logger.h"
@@ -29,23 +30,26 @@
 
 #include "hev-socks5-session-udp.h"
 
-typedef struct _HevSocks5UDPFrame HevSocks5UDPFrame;
+#define UDP_BATCH_MIN (2)
+#define UDP_SLOTS_MAX (64)
 
-struct _HevSocks5UDPFrame
-{
-    HevListNode node;
-    HevSocks5Addr addr;
-    struct pbuf *data;
-};
+/* Leaders of this worker with room for followers. */
+static __thread HevList mux_leaders;
+
+/*
+ * Receive slots shared by the sessions of this worker. A session takes one
+ * per message of its batch for a single receive and hands them back once
+ * the packets are sent, so an idle session holds none.
+ */
+static __thread void *slots;
+static __thread unsigned int slots_count;
 
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
     HevSocks5 *self = data;
-    HevListNode *node;
-    int res;
 
-    if (self->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) {
+    if ((self->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) && (self->fd >= 0)) {
         ssize_t res;
         char buf;
 
@@ -56,114 +60,354 @@ task_io_yielder (HevTaskYieldType type, void *data)
         }
     }
 
-    res = hev_socks5_task_io_yielder (type, data);
-    node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (self));
-    hev_socks5_tunnel_update_session (node);
+    return hev_socks5_session_yield (HEV_SOCKS5_SESSION (self), type);
+}
+
+static struct pbuf *
+hev_socks5_session_udp_frame (HevSocks5SessionUDP *self, unsigned int i)
+{
+    return self->ring[(self->ring_head + i) % self->ring_size];
+}
+
+static unsigned int
+hev_socks5_session_udp_take (HevSocks5SessionUDP *self, struct pbuf **bufv,
+                             HevSocks5UDPMsg *msgv, unsigned int num)
+{
+    unsigned int i;
+
+    if (num > self->frames)
+        num = self->frames;
+
+    /* Taken off the ring, a drop of the oldest can't free them mid-send. */
+    for (i = 0; i < num; i++) {
+        struct pbuf *buf = hev_socks5_session_udp_frame (self, i);
+
+        bufv[i] = buf;
+        msgv[i].buf = buf->payload;
+        msgv[i].len = buf->len;
+        hev_socks5_tunnel_charge (&self->data.node, -buf->tot_len);
+    }
+
+    self->ring_head = (self->ring_head + num) % self->ring_size;
+    self->frames -= num;
+    self->unanswered += num;
+
+    if (num && self->transaction) {
+        HevListNode *node;
+
+        self->active = sys_now ();
+        node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (self));
+        hev_socks5_tunnel_update_session (node);
+    }
 
-    return res;
+    return num;
 }
 
 static int
 hev_socks5_session_udp_fwd_f (HevSocks5SessionUDP *self, unsigned int num)
 {
     HevSocks5UDPMsg msgv[num];
-    HevSocks5UDPFrame *frame;
+    struct pbuf *bufv[num];
+    char addrv[num][19];
+    HevSocks5Addr addr;
     HevListNode *node;
-    struct pbuf *buf;
-    int i, res;
+    unsigned int i, n = 0;
+    size_t size = 0;
+    int res;
 
-    res = self->frames;
-    if (res <= 0)
+    /*
+     * Sessions sharing the socket of a leader are shaped together, by the
+     * leader's rate limit.
+     */
+    if (!hev_socks5_session_quota (&self->data, 0, UDP_BUF_SIZE,
+                                   self->frames ||
+                                       hev_list_first (&self->followers)))
         return 0;
 
-    res = (res > num) ? num : res;
-    node = hev_list_first (&self->frame_list);
-    for (i = 0; i < res; i++) {
-        frame = container_of (node, HevSocks5UDPFrame, node);
-        node = hev_list_node_next (node);
-        buf = frame->data;
+    if (self->frames) {
+        /* Every frame of a session comes from its one pcb. */
+        hev_socks5_addr_from_lwip (&addr, &self->pcb->local_ip,
+                                   self->pcb->local_port);
+        if (addr.atype == HEV_SOCKS5_ADDR_TYPE_NAME) {
+            self->addr = ip_2_ip4 (&self->pcb->local_ip)->addr;
+            self->port = self->pcb->local_port;
+        }
 
-        msgv[i].buf = buf->payload;
-        msgv[i].len = buf->len;
-        msgv[i].addr = &frame->addr;
+        n = hev_socks5_session_udp_take (self, bufv, msgv, num);
+        for (i = 0; i < n; i++) {
+            msgv[i].addr = &addr;
+            self->data.stats.tx_bytes += msgv[i].len;
+            size += msgv[i].len;
+        }
+    }
+
+    node = hev_list_first (&self->followers);
+    for (; node && (n < num); node = hev_list_node_next (node)) {
+        HevSocks5SessionUDP *f;
+        unsigned int c;
+
+        f = container_of (node, HevSocks5SessionUDP, mux_node);
+        c = hev_socks5_session_udp_take (f, &bufv[n], &msgv[n], num - n);
+
+        /* Copied, the follower may go away while the send waits. */
+        for (i = n; i < n + c; i++) {
+            memcpy (addrv[i], f->mux_addr, sizeof (f->mux_addr));
+            msgv[i].addr = (HevSocks5Addr *)addrv[i];
+            f->data.stats.tx_bytes += msgv[i].len;
+            size += msgv[i].len;
+        }
+        n += c;
     }
 
-    res = hev_socks5_udp_sendmmsg (HEV_SOCKS5_UDP (self), msgv, res);
+    if (!n)
+        return 0;
+
+    res = hev_socks5_udp_sendmmsg (HEV_SOCKS5_UDP (self), msgv, n);
+
+    for (i = 0; i < n; i++)
+        pbuf_free (bufv[i]);
+
     if (res <= 0) {
         LOG_D ("%p socks5 session udp fwd f send", self);
         return -1;
     }
+    hev_socks5_session_charge (&self->data, 0, size);
 
-    for (i = 0; i < res; i++) {
-        node = hev_list_first (&self->frame_list);
-        frame = container_of (node, HevSocks5UDPFrame, node);
-        buf = frame->data;
+    return 1;
+}
 
-        hev_list_del (&self->frame_list, node);
-        hev_free (frame);
-        pbuf_free (buf);
-        self->frames--;
+static HevSocks5SessionUDP *
+hev_socks5_session_udp_demux (HevSocks5SessionUDP *self, HevSocks5Addr *addr)
+{
+    HevListNode *node;
+    int len;
+
+    len = hev_socks5_addr_len (addr);
+    if (len > sizeof (self->mux_addr))
+        return self;
+
+    node = hev_list_first (&self->followers);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5SessionUDP *f;
+
+        f = container_of (node, HevSocks5SessionUDP, mux_node);
+        if (memcmp (f->mux_addr, addr, len) == 0)
+            return f;
     }
 
-    return 1;
+    /* Replies from other sources go to the leader, as without sharing. */
+    return self;
+}
+
+/*
+ * A one-shot flow closes once every request it sent has had a reply, and
+ * nothing more is queued. A leader still carrying followers stays up.
+ */
+static void
+hev_socks5_session_udp_answered (HevSocks5SessionUDP *self)
+{
+    if (self->unanswered)
+        self->unanswered--;
+
+    if (!self->one_shot || self->unanswered || self->frames)
+        return;
+    if (hev_list_first (&self->followers))
+        return;
+
+    LOG_D ("%p socks5 session udp answered", self);
+
+    hev_socks5_session_set_state (HEV_SOCKS5_SESSION (self),
+                                  HEV_SOCKS5_TUNNEL_SESSION_CLOSED);
+    hev_socks5_session_terminate (HEV_SOCKS5_SESSION (self));
+}
+
+static void
+udp_pbuf_free (struct pbuf *p)
+{
+    /* The payload lives in a receive slot of fwd_b. */
+}
+
+static unsigned int
+hev_socks5_session_udp_slots_take (void **slotv, unsigned int num,
+                                   size_t size)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (slots) {
+            slotv[i] = slots;
+            slots = *(void **)slots;
+            slots_count--;
+        } else {
+            slotv[i] = hev_malloc (size);
+            if (!slotv[i])
+                break;
+        }
+    }
+
+    return i;
+}
+
+static void
+hev_socks5_session_udp_slots_give (void **slotv, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (slots_count >= UDP_SLOTS_MAX) {
+            hev_free (slotv[i]);
+            continue;
+        }
+
+        *(void **)slotv[i] = slots;
+        slots = slotv[i];
+        slots_count++;
+    }
+}
+
+void
+hev_socks5_session_udp_slots_clear (void)
+{
+    while (slots) {
+        void *slot = slots;
+
+        slots = *(void **)slot;
+        hev_free (slot);
+    }
+    slots_count = 0;
+}
+
+/*
+ * The next batch doubles after one that came back full, up to num, and
+ * halves after one that used a quarter or less, so a chatty flow drains
+ * its socket in few calls and a quiet one takes few slots.
+ */
+static void
+hev_socks5_session_udp_adapt (HevSocks5SessionUDP *self, unsigned int res,
+                              unsigned int num)
+{
+    unsigned int batch = self->batch;
+
+    if (res == batch)
+        batch *= 2;
+    else if ((res * 4) <= batch)
+        batch /= 2;
+
+    if (batch < UDP_BATCH_MIN)
+        batch = UDP_BATCH_MIN;
+    if (batch > num)
+        batch = num;
+
+    self->batch = batch;
 }
 
 static int
 hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
 {
-    char buf[UDP_BUF_SIZE * num];
-    HevSocks5UDPMsg msgv[num];
+    /*
+     * Each slot is [pbuf_custom][lwIP header room][socks5 header][payload],
+     * so udp_sendfrom prepends its headers in place instead of chaining a
+     * freshly allocated header pbuf in front of a PBUF_REF.
+     */
+    const size_t hlen = LWIP_MEM_ALIGN_SIZE (PBUF_TRANSPORT);
+    const size_t room = LWIP_MEM_ALIGN_SIZE (sizeof (struct pbuf_custom)) + hlen;
+    const size_t size = ALIGN_UP (room + UDP_BUF_SIZE, sizeof (void *));
+    unsigned int batch = self->batch;
+    HevSocks5UDPMsg msgv[batch];
+    void *slotv[batch];
+    size_t moved = 0;
     int i, res;
 
-    for (i = 0; i < num; i++) {
-        msgv[i].buf = buf + UDP_BUF_SIZE * i;
+    if (!hev_socks5_session_quota (&self->data, 1, UDP_BUF_SIZE,
+                                   self->bwd_active))
+        return 0;
+
+    batch = hev_socks5_session_udp_slots_take (slotv, batch, size);
+    if (!batch) {
+        LOG_D ("%p socks5 session udp fwd b slot", self);
+        return -1;
+    }
+
+    for (i = 0; i < batch; i++) {
+        msgv[i].buf = (char *)slotv[i] + room;
         msgv[i].len = UDP_BUF_SIZE;
     }
 
-    res = hev_socks5_udp_recvmmsg (HEV_SOCKS5_UDP (self), msgv, num, 1);
+    res = hev_socks5_udp_recvmmsg (HEV_SOCKS5_UDP (self), msgv, batch, 1);
+    self->bwd_active = res > 0;
     if (res <= 0) {
+        hev_socks5_session_udp_slots_give (slotv, batch);
         if (res == -1 && errno == EAGAIN)
             return 0;
         LOG_D ("%p socks5 session udp fwd b recv", self);
         return -1;
     }
 
+    hev_socks5_session_udp_adapt (self, res, num);
+
+    for (i = 0; i < res; i++)
+        moved += msgv[i].len;
+    hev_socks5_session_charge (&self->data, 1, moved);
+
     for (i = 0; i < res; i++) {
+        struct pbuf_custom *c = slotv[i];
+        HevSocks5SessionUDP *dst = self;
         ip_addr_t saddr;
         struct pbuf *b;
         uint16_t port;
         err_t err;
         int ret;
 
-        if (self->addr && self->port) {
+        if (hev_list_first (&self->followers))
+            dst = hev_socks5_session_udp_demux (self, msgv[i].addr);
+
+        if ((dst == self) && self->addr && self->port) {
             ip_2_ip4 (&saddr)->addr = self->addr;
             port = self->port;
         } else {
             ret = hev_socks5_addr_into_lwip (msgv[i].addr, &saddr, &port);
             if (ret < 0) {
                 LOG_D ("%p socks5 session udp fwd b addr", self);
-                return -1;
+                res = -1;
+                break;
             }
         }
 
-        b = pbuf_alloc_reference (msgv[i].buf, msgv[i].len, PBUF_REF);
+        c->custom_free_function = udp_pbuf_free;
+        b = pbuf_alloced_custom (PBUF_TRANSPORT, msgv[i].len, PBUF_RAM, c,
+                                 (char *)msgv[i].buf - hlen,
+                                 hlen + msgv[i].len);
         if (!b) {
             LOG_D ("%p socks5 session udp fwd b buf", self);
-            return -1;
+            res = -1;
+            break;
         }
 
-        hev_task_mutex_lock (self->mutex);
-        err = udp_sendfrom (self->pcb, b, &saddr, port);
-        hev_task_mutex_unlock (self->mutex);
+        if (!dst->data.stats.rx_bytes)
+            dst->data.stats.ttfb = sys_now () - dst->data.stats.start;
+        dst->data.stats.rx_bytes += msgv[i].len;
+
+        err = udp_sendfrom (dst->pcb, b, &saddr, port);
+        if (dst->transaction)
+            dst->active = sys_now ();
+        else if (dst != self)
+            hev_task_wakeup (dst->data.task);
 
         pbuf_free (b);
         if (err != ERR_OK) {
             LOG_D ("%p socks5 session udp fwd b send", self);
-            return -1;
+            res = -1;
+            break;
         }
+
+        hev_socks5_session_udp_answered (dst);
     }
 
-    return 1;
+    /* The queued packets still point into the slots. */
+    hev_socks5_tunnel_flush ();
+    hev_socks5_session_udp_slots_give (slotv, batch);
+
+    return (res < 0) ? -1 : 1;
 }
 
 static void
@@ -171,40 +415,42 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
                   const ip_addr_t *addr, u16_t port)
 {
     HevSocks5SessionUDP *self = arg;
-    HevSocks5UDPFrame *frame;
+    HevListNode *node = &self->data.node;
+    unsigned int tail, depth;
 
     if (!p) {
         hev_socks5_session_terminate (HEV_SOCKS5_SESSION (self));
         return;
     }
 
-    if (self->frames > UDP_POOL_SIZE) {
-        pbuf_free (p);
-        return;
-    }
+    /* Short of memory, only the last few datagrams are kept. */
+    depth = self->ring_size;
+    if (hev_socks5_tunnel_mem_pressure (node))
+        depth /= 4;
 
-    frame = hev_malloc (sizeof (HevSocks5UDPFrame));
-    if (!frame) {
-        pbuf_free (p);
-        return;
-    }
+    /* Full: drop the oldest, a stale datagram is the least useful one. */
+    while (self->frames && (self->frames >= depth)) {
+        struct pbuf *oldest = self->ring[self->ring_head];
 
-    frame->data = p;
-    memset (&frame->node, 0, sizeof (frame->node));
-    hev_socks5_addr_from_lwip (&frame->addr, &pcb->local_ip, pcb->local_port);
-
-    if (frame->addr.atype == HEV_SOCKS5_ADDR_TYPE_NAME) {
-        self->addr = ip_2_ip4 (&pcb->local_ip)->addr;
-        self->port = pcb->local_port;
+        hev_socks5_tunnel_charge (node, -oldest->tot_len);
+        pbuf_free (oldest);
+        self->ring_head = (self->ring_head + 1) % self->ring_size;
+        self->frames--;
+        hev_socks5_tunnel_add_udp_drops (1);
     }
 
+    /* The pbuf is held in place until it is sent. */
+    tail = (self->ring_head + self->frames) % self->ring_size;
+    self->ring[tail] = p;
     self->frames++;
-    hev_list_add_tail (&self->frame_list, &frame->node);
+    hev_socks5_tunnel_charge (node, p->tot_len);
     hev_task_wakeup (self->data.task);
+    if (self->leader)
+        hev_task_wakeup (self->leader->data.task);
 }
 
 HevSocks5SessionUDP *
-hev_socks5_session_udp_new (struct udp_pcb *pcb, HevTaskMutex *mutex)
+hev_socks5_session_udp_new (struct udp_pcb *pcb)
 {
     HevSocks5SessionUDP *self;
     int res;
@@ -213,7 +459,7 @@ hev_socks5_session_udp_new (struct udp_pcb *pcb, HevTaskMutex *mutex)
     if (!self)
         return NULL;
 
-    res = hev_socks5_session_udp_construct (self, pcb, mutex);
+    res = hev_socks5_session_udp_construct (self, pcb);
     if (res < 0) {
         hev_free (self);
         return NULL;
@@ -228,23 +474,11 @@ static int
 hev_socks5_session_udp_bind (HevSocks5 *self, int fd,
                              const struct sockaddr *dest)
 {
-    HevConfigServer *srv;
-    unsigned int mark;
+    HevSocks5SessionUDP *session = HEV_SOCKS5_SESSION_UDP (self);
 
     LOG_D ("%p socks5 session udp bind", self);
 
-    srv = hev_config_get_socks5_server ();
-    mark = srv->mark;
-
-    if (mark) {
-        int res;
-
-        res = set_sock_mark (fd, mark);
-        if (res < 0)
-            return -1;
-    }
-
-    return 0;
+    return hev_socks5_session_bind_socket (session->data.live, fd);
 }
 
 static uint16_t
@@ -270,7 +504,8 @@ static int
 hev_socks5_session_udp_set_upstream_addr (HevSocks5Client *base,
                                           HevSocks5Addr *addr)
 {
-    HevConfigServer *srv = hev_config_get_socks5_server ();
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
+    HevConfigServer *srv = hev_config_get_socks5_server (self->data.live);
     HevSocks5ClientClass *ckptr;
 
     if (srv->udp_in_udp && srv->udp_addr[0]) {
@@ -282,6 +517,200 @@ hev_socks5_session_udp_set_upstream_addr (HevSocks5Client *base,
     return ckptr->set_upstream_addr (base, addr);
 }
 
+/*
+ * Find a leader with room for this flow, with mux_addr filled in first.
+ * Returns NULL if there is none or the flow can't share an upstream.
+ */
+static HevSocks5SessionUDP *
+hev_socks5_session_udp_find_leader (HevSocks5SessionUDP *self)
+{
+    HevConfigServer *srv = hev_config_get_socks5_server (self->data.live);
+    HevSocks5Addr addr;
+    HevListNode *node;
+    int len;
+
+    if (srv->udp_mux < 2)
+        return NULL;
+
+    /* Replies to mapped names carry the real address, they don't match. */
+    hev_socks5_addr_from_lwip (&addr, &self->pcb->local_ip,
+                               self->pcb->local_port);
+    if (addr.atype == HEV_SOCKS5_ADDR_TYPE_NAME)
+        return NULL;
+
+    len = hev_socks5_addr_len (&addr);
+    memcpy (self->mux_addr, &addr, len);
+
+    /* A leader carries one flow per destination, else replies are ambiguous. */
+    node = hev_list_first (&mux_leaders);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5SessionUDP *l;
+        HevSocks5SessionUDP *f;
+
+        l = container_of (node, HevSocks5SessionUDP, mux_node);
+        if (l->members >= srv->udp_mux)
+            continue;
+        /* Leaders from before a reload ride on the old upstreams. */
+        if (l->data.live != self->data.live)
+            continue;
+        if (memcmp (l->mux_addr, self->mux_addr, len) == 0)
+            continue;
+        f = hev_socks5_session_udp_demux (l, &addr);
+        if (f != l)
+            continue;
+
+        return l;
+    }
+
+    return NULL;
+}
+
+static void
+hev_socks5_session_udp_follow_leader (HevSocks5SessionUDP *self,
+                                      HevSocks5SessionUDP *l)
+{
+    hev_list_add_tail (&l->followers, &self->mux_node);
+    l->members++;
+    self->leader = l;
+    LOG_D ("%p socks5 session udp follow %p", self, l);
+
+    hev_socks5_set_timeout (HEV_SOCKS5 (self), self->idle_timeout);
+    if (self->frames)
+        hev_task_wakeup (l->data.task);
+}
+
+static int
+hev_socks5_session_udp_attach (HevSocks5Session *base)
+{
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
+    HevConfigServer *srv = hev_config_get_socks5_server (self->data.live);
+    HevSocks5SessionUDP *l;
+
+    l = hev_socks5_session_udp_find_leader (self);
+    if (l) {
+        hev_socks5_session_udp_follow_leader (self, l);
+        return 1;
+    }
+
+    if (srv->udp_mux < 2 || !self->mux_addr[0])
+        return 0;
+
+    hev_list_add_tail (&mux_leaders, &self->mux_node);
+    self->members = 1;
+
+    return 0;
+}
+
+int
+hev_socks5_session_udp_join (HevSocks5SessionUDP *self)
+{
+    HevSocks5SessionUDP *l;
+
+    if (!self->one_shot)
+        return 0;
+
+    l = hev_socks5_session_udp_find_leader (self);
+    if (!l)
+        return 0;
+
+    self->transaction = 1;
+    self->active = sys_now ();
+    self->data.task = l->data.task;
+    l->transactions++;
+    hev_socks5_session_udp_follow_leader (self, l);
+
+    return 1;
+}
+
+/*
+ * Close the transactions of a leader that were answered, evicted or went
+ * idle. Returns the milliseconds until the next one idles out, -1 if none
+ * is left.
+ */
+static int
+hev_socks5_session_udp_reap (HevSocks5SessionUDP *self)
+{
+    u32_t now = sys_now ();
+    HevListNode *node;
+    int next = -1;
+
+    node = hev_list_first (&self->followers);
+    while (node) {
+        HevSocks5SessionUDP *f;
+
+        f = container_of (node, HevSocks5SessionUDP, mux_node);
+        node = hev_list_node_next (node);
+        if (!f->transaction)
+            continue;
+
+        if (hev_socks5_get_timeout (HEV_SOCKS5 (f))) {
+            u32_t idle = now - f->active;
+
+            if (idle < f->idle_timeout) {
+                int left = f->idle_timeout - idle;
+
+                if ((next < 0) || (left < next))
+                    next = left;
+                continue;
+            }
+            hev_socks5_session_io_closed (HEV_SOCKS5_SESSION (f));
+        }
+
+        hev_socks5_tunnel_delete_session (
+            hev_socks5_session_get_node (HEV_SOCKS5_SESSION (f)));
+        hev_object_unref (HEV_OBJECT (f));
+    }
+
+    return next;
+}
+
+/*
+ * Wait for I/O as a leader carrying transactions: wake up for the next one
+ * to idle out too. The leader's own idle timeout counts from its last
+ * traffic, so these extra wakeups don't extend it.
+ */
+static int
+hev_socks5_session_udp_wait (HevSocks5SessionUDP *self, int next)
+{
+    HevSocks5 *base = HEV_SOCKS5 (self);
+    u32_t idle = sys_now () - self->active;
+    int timeout;
+
+    if (!hev_socks5_get_timeout (base) || (idle >= self->idle_timeout))
+        return -1;
+
+    timeout = self->idle_timeout - idle;
+    if ((next >= 0) && (next < timeout))
+        timeout = next ? next : 1;
+
+    hev_socks5_set_timeout (base, timeout);
+    task_io_yielder (HEV_TASK_WAITIO, self);
+    if (!hev_socks5_get_timeout (base))
+        return -1;
+    hev_socks5_set_timeout (base, self->idle_timeout);
+
+    return 0;
+}
+
+static void
+hev_socks5_session_udp_follow (HevSocks5SessionUDP *self)
+{
+    LOG_D ("%p socks5 session udp follow", self);
+
+    /* The leader moves the datagrams, this only tracks the idle timeout. */
+    while (self->leader) {
+        HevListNode *node;
+
+        if (hev_socks5_task_io_yielder (HEV_TASK_WAITIO, self) < 0) {
+            hev_socks5_session_io_closed (HEV_SOCKS5_SESSION (self));
+            break;
+        }
+
+        node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (self));
+        hev_socks5_tunnel_update_session (node);
+    }
+}
+
 static void
 hev_socks5_session_udp_splice (HevSocks5Session *base)
 {
@@ -293,28 +722,56 @@ hev_socks5_session_udp_splice (HevSocks5Session *base)
 
     LOG_D ("%p socks5 session udp splice", self);
 
+    if (self->leader) {
+        hev_socks5_session_udp_follow (self);
+        return;
+    }
+
+    /* The handshake left the default timeout, unless terminated meanwhile. */
+    if (hev_socks5_get_timeout (HEV_SOCKS5 (self)))
+        hev_socks5_set_timeout (HEV_SOCKS5 (self), self->idle_timeout);
+
     num = hev_config_get_misc_udp_copy_buffer_nums ();
+    if (self->batch > num)
+        self->batch = num;
     fd = hev_socks5_udp_get_fd (HEV_SOCKS5_UDP (self));
     if (hev_task_mod_fd (task, fd, POLLIN | POLLOUT) < 0)
         hev_task_add_fd (task, fd, POLLIN | POLLOUT);
 
+    self->active = sys_now ();
     for (;;) {
         HevTaskYieldType type;
+        int next = -1;
 
         if (res_f >= 0)
             res_f = hev_socks5_session_udp_fwd_f (self, num);
         if (res_b >= 0)
             res_b = hev_socks5_session_udp_fwd_b (self, num);
+        if (self->transactions)
+            next = hev_socks5_session_udp_reap (self);
 
-        if (res_f > 0 || res_b > 0)
+        if (res_f > 0 || res_b > 0) {
             type = HEV_TASK_YIELD;
-        else if ((res_f & res_b) == 0)
+            self->active = sys_now ();
+        } else if ((res_f & res_b) == 0) {
             type = HEV_TASK_WAITIO;
-        else
+        } else {
             break;
+        }
+
+        if (self->transactions && (type == HEV_TASK_WAITIO) &&
+            !self->data.hold) {
+            if (hev_socks5_session_udp_wait (self, next) < 0) {
+                hev_socks5_session_io_closed (HEV_SOCKS5_SESSION (self));
+                break;
+            }
+            continue;
+        }
 
-        if (task_io_yielder (type, self))
+        if (task_io_yielder (type, self)) {
+            hev_socks5_session_io_closed (HEV_SOCKS5_SESSION (self));
             break;
+        }
     }
 }
 
@@ -342,22 +799,63 @@ hev_socks5_session_udp_get_node (HevSocks5Session *base)
     return &self->data.node;
 }
 
+static void
+hev_socks5_session_udp_set_policy (HevSocks5SessionUDP *self)
+{
+    const HevConfigUDPTimeout *rules;
+    int i, count;
+
+    self->idle_timeout = hev_config_get_misc_udp_read_write_timeout ();
+
+    /* The pcb's local end is the destination the app sent to. */
+    rules = hev_config_get_udp_timeouts (self->data.live, &count);
+    for (i = 0; i < count; i++) {
+        const HevConfigUDPTimeout *r = &rules[i];
+
+        if ((self->pcb->local_port < r->port_min) ||
+            (self->pcb->local_port > r->port_max))
+            continue;
+
+        self->idle_timeout = r->timeout;
+        self->one_shot = r->one_shot;
+        break;
+    }
+}
+
 int
 hev_socks5_session_udp_construct (HevSocks5SessionUDP *self,
-                                  struct udp_pcb *pcb, HevTaskMutex *mutex)
+                                  struct udp_pcb *pcb)
 {
-    HevConfigServer *srv = hev_config_get_socks5_server ();
+    HevConfigLive *live;
+    HevConfigServer *srv;
     int type;
     int res;
 
+    live = hev_config_live_hold ();
+    if (!live)
+        return -1;
+
+    srv = hev_config_get_socks5_server (live);
     if (srv->udp_in_udp)
         type = HEV_SOCKS5_TYPE_UDP_IN_UDP;
     else
         type = HEV_SOCKS5_TYPE_UDP_IN_TCP;
 
+    /* Datagrams queue up while the socks5 handshake is in flight. */
+    self->ring = hev_malloc (sizeof (struct pbuf *) * UDP_POOL_SIZE);
+    if (!self->ring) {
+        hev_config_live_release (live);
+        return -1;
+    }
+    self->ring_size = UDP_POOL_SIZE;
+    self->batch = UDP_BATCH_MIN;
+
     res = hev_socks5_client_udp_construct (&self->base, type);
-    if (res < 0)
+    if (res < 0) {
+        hev_free (self->ring);
+        hev_config_live_release (live);
         return -1;
+    }
 
     LOG_D ("%p socks5 session udp construct", self);
 
@@ -366,8 +864,9 @@ hev_socks5_session_udp_construct (HevSocks5SessionUDP *self,
     udp_recv (pcb, udp_recv_handler, self);
 
     self->pcb = pcb;
-    self->mutex = mutex;
     self->data.self = self;
+    self->data.live = live;
+    hev_socks5_session_udp_set_policy (self);
 
     return 0;
 }
@@ -376,26 +875,53 @@ void
 hev_socks5_session_udp_destruct (HevObject *base)
 {
     HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
-    HevListNode *node;
+    unsigned int i;
 
     LOG_D ("%p socks5 session udp destruct", self);
 
-    node = hev_list_first (&self->frame_list);
-    while (node) {
-        HevSocks5UDPFrame *frame;
+    if (self->leader) {
+        hev_list_del (&self->leader->followers, &self->mux_node);
+        self->leader->members--;
+        if (self->transaction)
+            self->leader->transactions--;
+    } else if (self->members) {
+        HevListNode *node;
+
+        hev_list_del (&mux_leaders, &self->mux_node);
+        while ((node = hev_list_first (&self->followers))) {
+            HevSocks5SessionUDP *f;
+
+            f = container_of (node, HevSocks5SessionUDP, mux_node);
+            hev_list_del (&self->followers, node);
+            f->leader = NULL;
+            if (!f->transaction) {
+                hev_socks5_session_terminate (HEV_SOCKS5_SESSION (f));
+                continue;
+            }
 
-        frame = container_of (node, HevSocks5UDPFrame, node);
-        node = hev_list_node_next (node);
-        pbuf_free (frame->data);
-        hev_free (frame);
+            /* Without a task of their own, transactions end here. */
+            hev_socks5_session_io_closed (HEV_SOCKS5_SESSION (f));
+            hev_socks5_tunnel_delete_session (
+                hev_socks5_session_get_node (HEV_SOCKS5_SESSION (f)));
+            hev_object_unref (HEV_OBJECT (f));
+        }
     }
 
-    hev_task_mutex_lock (self->mutex);
+    for (i = 0; i < self->frames; i++)
+        pbuf_free (hev_socks5_session_udp_frame (self, i));
+    hev_free (self->ring);
+
+    if (self->data.mem)
+        hev_socks5_tunnel_charge (&self->data.node,
+                                  -(ssize_t)self->data.mem);
+
     if (self->pcb) {
         udp_recv (self->pcb, NULL, NULL);
         udp_remove (self->pcb);
     }
-    hev_task_mutex_unlock (self->mutex);
+
+    if (self->data.live)
+        hev_config_live_release (self->data.live);
 
     HEV_SOCKS5_CLIENT_UDP_TYPE->destruct (base);
 }
@@ -438,6 +964,7 @@ hev_socks5_session_udp_class (void)
         ckptr->set_upstream_addr = hev_socks5_session_udp_set_upstream_addr;
 
         siptr = &kptr->session;
+        siptr->attach = hev_socks5_session_udp_attach;
         siptr->splicer = hev_socks5_session_udp_splice;
         siptr->get_task = hev_socks5_session_udp_get_task;
         siptr->set_task = hev_socks5_session_udp_set_task;
@@ -27,12 +27,38 @@ struct _HevSocks5SessionUDP
 
     HevSocks5SessionData data;
 
-    HevList frame_list;
     struct udp_pcb *pcb;
-    HevTaskMutex *mutex;
-    int frames;
+    struct pbuf **ring;
+    unsigned int ring_head;
+    unsigned int ring_size;
+    unsigned int frames;
+    unsigned int batch; /* messages per receive, adapted to the flow */
+    int bwd_active; /* the last receive got datagrams */
     int addr;
     int port;
+
+    /* Idle timeout by destination port; one-shot flows close once answered. */
+    int idle_timeout;
+    int one_shot;
+    unsigned int unanswered;
+    u32_t active;
+
+    /*
+     * A leader owns the upstream association and forwards the datagrams of
+     * its followers too, replies are demultiplexed by their address.
+     */
+    HevSocks5SessionUDP *leader;
+    HevListNode mux_node;
+    HevList followers;
+    unsigned int members;
+    char mux_addr[19];
+
+    /*
+     * A transaction is a one-shot follower without a task of its own, its
+     * leader closes it once answered or idle.
+     */
+    int transaction;
+    unsigned int transactions;
 };
 
 struct _HevSocks5SessionUDPClass
@@ -45,9 +71,17 @@ struct _HevSocks5SessionUDPClass
 HevObjectClass *hev_socks5_session_udp_class (void);
 
 int hev_socks5_session_udp_construct (HevSocks5SessionUDP *self,
-                                      struct udp_pcb *pcb, HevTaskMutex *mutex);
+                                      struct udp_pcb *pcb);
+
+/*
+ * Attach a new one-shot flow to a leader as a transaction. Returns 1 if
+ * it joined, the session then needs no task; 0 if it must run on its own.
+ */
+int hev_socks5_session_udp_join (HevSocks5SessionUDP *self);
+
+HevSocks5SessionUDP *hev_socks5_session_udp_new (struct udp_pcb *pcb);
 
-HevSocks5SessionUDP *hev_socks5_session_udp_new (struct udp_pcb *pcb,
-                                                 HevTaskMutex *mutex);
+/* Free the receive slots kept by the calling worker. */
+void hev_socks5_session_udp_slots_clear (void);
 
 #endif /* __HEV_SOCKS5_SESSION_UDP_H__ */
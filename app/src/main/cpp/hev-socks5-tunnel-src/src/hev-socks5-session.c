@@ -9,44 +9,253 @@
 
 #include <string.h>
 
+#include <lwip/sys.h>
+
+#include <hev-socks5-misc.h>
+#include <hev-socks5-client-tcp.h>
+#include <hev-socks5-client-udp.h>
+
+#include "hev-main.h"
+#include "hev-utils.h"
 #include "hev-logger.h"
+#include "hev-compiler.h"
 #include "hev-config.h"
+#include "hev-bypass.h"
+#include "hev-socks5-tunnel.h"
 #include "hev-socks5-client.h"
+#include "hev-socks5-upstream.h"
 
 #include "hev-socks5-session.h"
 
+#define RATE_WINDOW (1000)
+
+/* rate-limit, shared by the sessions of all workers. */
+static HevSocks5Bucket rate_buckets[2];
+static int rate_shaped;
+
+/*
+ * Completes the socks5 handshake on a connected client, start being when
+ * the connect began. Returns the milliseconds both took, or -1.
+ */
+static int
+hev_socks5_session_handshake (HevSocks5Session *self, const char *user,
+                              const char *pass, u32_t start)
+{
+    HevSocks5Client *client = HEV_SOCKS5_CLIENT (self);
+    HevSocks5SessionStats *stats = hev_socks5_session_get_stats (self);
+    HevSocks5SessionData *sd;
+    HevConfigServer *srv;
+    int res;
+
+    hev_socks5_tunnel_trace (stats->trace, HEV_SOCKS5_TUNNEL_TRACE_CONNECT);
+    if (client->connect_time >= 0) {
+        int family = hev_socks5_get_addr_family (HEV_SOCKS5 (self));
+
+        hev_socks5_tunnel_add_family_stats (
+            family == HEV_SOCKS5_ADDR_FAMILY_IPV6, client->connect_time,
+            client->connect_fallback);
+    }
+
+    if (user && pass) {
+        hev_socks5_client_set_auth (client, user, pass);
+        LOG_D ("%p socks5 client auth %s:%s", self, user, pass);
+    }
+
+    /* TCP data goes out behind the request, the splicer reads the replies. */
+    sd = container_of (stats, HevSocks5SessionData, stats);
+    srv = hev_config_get_socks5_server (sd->live);
+    if (srv->optimistic && (HEV_SOCKS5 (self)->type == HEV_SOCKS5_TYPE_TCP))
+        res = hev_socks5_client_handshake_optimistic (client);
+    else
+        res = hev_socks5_client_handshake (client, srv->pipeline);
+    if (res < 0) {
+        LOG_I ("%p socks5 session handshake", self);
+        if (hev_socks5_get_timeout (HEV_SOCKS5 (self)))
+            hev_socks5_session_set_state (
+                self, HEV_SOCKS5_TUNNEL_SESSION_HANDSHAKE_FAILED);
+        hev_socks5_session_io_closed (self);
+        hev_socks5_tunnel_add_connect_stats (-1);
+        return -1;
+    }
+
+    res = sys_now () - start;
+    stats->handshake = res;
+    hev_socks5_tunnel_add_connect_stats (res);
+    hev_socks5_tunnel_trace (stats->trace, HEV_SOCKS5_TUNNEL_TRACE_HANDSHAKE);
+
+    return res;
+}
+
+/* A stream provider call of a traced session, see hev_socks5_session_run. */
+typedef struct
+{
+    HevSocks5TunnelTraceProvider provider;
+    void *data;
+    uint64_t trace;
+} HevSocks5SessionTraceCall;
+
+static int
+hev_socks5_session_trace_provide (void *data)
+{
+    HevSocks5SessionTraceCall *call = data;
+
+    return call->provider (call->data, call->trace);
+}
+
+static void
+hev_socks5_session_connect_failed (HevSocks5Session *self)
+{
+    if (hev_socks5_get_timeout (HEV_SOCKS5 (self)))
+        hev_socks5_session_set_state (self,
+                                      HEV_SOCKS5_TUNNEL_SESSION_CONNECT_FAILED);
+    hev_socks5_session_io_closed (self);
+    hev_socks5_tunnel_add_connect_stats (-1);
+}
+
+/*
+ * Connects TCP to a bypassed destination directly. Returns 1 when it did,
+ * 0 when the destination is not bypassed and -1 when the connect failed.
+ */
+static int
+hev_socks5_session_bypass (HevSocks5Session *self)
+{
+    HevSocks5Client *client = HEV_SOCKS5_CLIENT (self);
+    HevSocks5SessionStats *stats = hev_socks5_session_get_stats (self);
+    u32_t start;
+
+    if ((HEV_SOCKS5 (self)->type != HEV_SOCKS5_TYPE_TCP) ||
+        hev_bypass_is_empty ())
+        return 0;
+
+    /* Peeked, the request address is handed over by the connect. */
+    if (!hev_bypass_match (HEV_SOCKS5_CLIENT_TCP (self)->addr))
+        return 0;
+
+    LOG_D ("%p socks5 session bypass", self);
+
+    start = sys_now ();
+    if (hev_socks5_client_connect_direct (client) < 0) {
+        LOG_I ("%p socks5 session connect direct", self);
+        /* Not counted against the upstreams. */
+        if (hev_socks5_get_timeout (HEV_SOCKS5 (self)))
+            hev_socks5_session_set_state (
+                self, HEV_SOCKS5_TUNNEL_SESSION_CONNECT_FAILED);
+        hev_socks5_session_io_closed (self);
+        return -1;
+    }
+
+    stats->handshake = sys_now () - start;
+    hev_socks5_tunnel_trace (stats->trace, HEV_SOCKS5_TUNNEL_TRACE_CONNECT);
+
+    return 1;
+}
+
 void
 hev_socks5_session_run (HevSocks5Session *self)
 {
     HevSocks5SessionIface *iface;
-    HevConfigServer *srv;
+    HevSocks5TunnelProvider provider;
+    HevSocks5SessionTraceCall call;
+    const HevConfigUpstream *up;
+    HevSocks5SessionData *sd;
+    const char *user, *pass;
+    void *data;
+    u32_t start;
+    unsigned int tried = 0;
+    int index, count, tries;
     int res;
 
     LOG_D ("%p socks5 session run", self);
 
-    srv = hev_config_get_socks5_server ();
+    /* Sessions riding on the upstream of another skip the handshake. */
+    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_SESSION_TYPE);
+    if (iface->attach && iface->attach (self)) {
+        iface->splicer (self);
+        return;
+    }
 
-    res = hev_socks5_client_connect (HEV_SOCKS5_CLIENT (self), srv->addr,
-                                     srv->port);
-    if (res < 0) {
-        LOG_I ("%p socks5 session connect", self);
+    res = hev_socks5_session_bypass (self);
+    if (res) {
+        if (res > 0)
+            iface->splicer (self);
         return;
     }
 
-    if (srv->user && srv->pass) {
-        hev_socks5_client_set_auth (HEV_SOCKS5_CLIENT (self), srv->user,
-                                    srv->pass);
-        LOG_D ("%p socks5 client auth %s:%s", self, srv->user, srv->pass);
+    /* So do its datagram sockets, for UDP it can carry itself. */
+    provider = hev_socks5_tunnel_get_datagram_provider (&data);
+    if (provider && (HEV_SOCKS5 (self)->type != HEV_SOCKS5_TYPE_TCP)) {
+        res = hev_socks5_client_udp_provide (HEV_SOCKS5_CLIENT_UDP (self),
+                                             provider, data);
+        if (res >= 0) {
+            iface->splicer (self);
+            return;
+        }
+    }
+
+    /* Streams of an in-process tunnel replace connects to the servers. */
+    provider = hev_socks5_tunnel_get_provider (&data, &user, &pass);
+    if (provider && (HEV_SOCKS5 (self)->type == HEV_SOCKS5_TYPE_TCP)) {
+        /* Traced sessions hand their ID on to the tunnel behind it. */
+        call.trace = hev_socks5_session_get_stats (self)->trace;
+        call.provider = hev_socks5_tunnel_get_trace_provider ();
+        if (call.trace && call.provider) {
+            call.data = data;
+            provider = hev_socks5_session_trace_provide;
+            data = &call;
+        }
+
+        start = sys_now ();
+        res = hev_socks5_client_connect_provider (HEV_SOCKS5_CLIENT (self),
+                                                  provider, data);
+        if (res < 0) {
+            LOG_I ("%p socks5 session connect", self);
+            hev_socks5_session_connect_failed (self);
+            return;
+        }
+
+        if (hev_socks5_session_handshake (self, user, pass, start) >= 0)
+            iface->splicer (self);
+        return;
     }
 
-    res = hev_socks5_client_handshake (HEV_SOCKS5_CLIENT (self), srv->pipeline);
+    /* Upstreams of the config the session started with, even after reloads. */
+    sd = container_of (hev_socks5_session_get_node (self),
+                       HevSocks5SessionData, node);
+    hev_config_get_socks5_upstreams (sd->live, &count);
+
+    /* A failed connect moves on to an upstream not tried yet. */
+    for (tries = 1;; tries++) {
+        index = hev_socks5_upstream_get (sd->live, tried, &up);
+        tried |= 1U << index;
+        start = sys_now ();
+
+        res = hev_socks5_client_connect (HEV_SOCKS5_CLIENT (self), up->addr,
+                                         up->port);
+        if (res >= 0)
+            break;
+
+        LOG_I ("%p socks5 session connect", self);
+        hev_socks5_upstream_put (sd->live, index);
+
+        /* Not the upstream's fault when the session was terminated. */
+        if (!hev_socks5_get_timeout (HEV_SOCKS5 (self)))
+            break;
+        hev_socks5_upstream_report (sd->live, index, -1);
+        if (tries >= count)
+            break;
+    }
     if (res < 0) {
-        LOG_I ("%p socks5 session handshake", self);
+        hev_socks5_session_connect_failed (self);
         return;
     }
 
-    iface = HEV_OBJECT_GET_IFACE (self, HEV_SOCKS5_SESSION_TYPE);
-    iface->splicer (self);
+    res = hev_socks5_session_handshake (self, up->user, up->pass, start);
+    if (res >= 0) {
+        hev_socks5_upstream_report (sd->live, index, res);
+        iface->splicer (self);
+    }
+
+    hev_socks5_upstream_put (sd->live, index);
 }
 
 void
@@ -61,6 +270,55 @@ hev_socks5_session_terminate (HevSocks5Session *self)
     hev_task_wakeup (iface->get_task (self));
 }
 
+void
+hev_socks5_session_set_state (HevSocks5Session *self, int state)
+{
+    HevSocks5SessionStats *stats = hev_socks5_session_get_stats (self);
+
+    if (!stats->state)
+        stats->state = state;
+}
+
+void
+hev_socks5_session_io_closed (HevSocks5Session *self)
+{
+    int state = HEV_SOCKS5_TUNNEL_SESSION_ABORTED;
+
+    if (hev_socks5_get_timeout (HEV_SOCKS5 (self)))
+        state = HEV_SOCKS5_TUNNEL_SESSION_IDLE;
+
+    hev_socks5_session_set_state (self, state);
+}
+
+HevSocks5SessionStats *
+hev_socks5_session_get_stats (HevSocks5Session *self)
+{
+    HevListNode *node = hev_socks5_session_get_node (self);
+
+    return &container_of (node, HevSocks5SessionData, node)->stats;
+}
+
+int
+hev_socks5_session_bind_socket (HevConfigLive *live, int fd)
+{
+    HevSocks5TCPOptions opts;
+    HevConfigServer *srv;
+
+    srv = hev_config_get_socks5_server (live);
+    if (srv->mark && (set_sock_mark (fd, srv->mark) < 0))
+        return -1;
+
+    opts.nodelay = srv->tcp_nodelay;
+    opts.quickack = srv->tcp_quickack;
+    opts.fastopen = srv->tcp_fastopen;
+    opts.sndbuf = srv->tcp_sndbuf;
+    opts.rcvbuf = srv->tcp_rcvbuf;
+    opts.notsent_lowat = srv->tcp_notsent_lowat;
+    hev_socks5_socket_set_tcp_options (fd, &opts);
+
+    return 0;
+}
+
 void
 hev_socks5_session_set_task (HevSocks5Session *self, HevTask *task)
 {
@@ -70,6 +328,129 @@ hev_socks5_session_set_task (HevSocks5Session *self, HevTask *task)
     iface->set_task (self, task);
 }
 
+int
+hev_socks5_session_yield (HevSocks5Session *self, HevTaskYieldType type)
+{
+    HevListNode *node = hev_socks5_session_get_node (self);
+    HevSocks5SessionData *sd;
+    int res = 0;
+
+    sd = container_of (node, HevSocks5SessionData, node);
+    if ((type == HEV_TASK_WAITIO) && sd->hold)
+        hev_task_sleep (sd->hold);
+    else
+        res = hev_socks5_task_io_yielder (type, self);
+    sd->hold = 0;
+
+    hev_socks5_tunnel_update_session (node);
+    hev_socks5_session_update_priority (self);
+
+    return res;
+}
+
+void
+hev_socks5_session_update_priority (HevSocks5Session *self)
+{
+    HevSocks5SessionData *sd;
+    uint64_t bytes;
+    u32_t elapsed;
+    int limit, bulk;
+
+    limit = hev_config_get_misc_session_bulk_rate ();
+    if (!limit)
+        return;
+
+    sd = container_of (hev_socks5_session_get_node (self),
+                       HevSocks5SessionData, node);
+    bytes = sd->stats.tx_bytes + sd->stats.rx_bytes - sd->rate_bytes;
+    elapsed = sys_now () - sd->rate_start;
+
+    /* Demoted as soon as the window carried more, not at its end. */
+    if (elapsed < RATE_WINDOW) {
+        if (sd->bulk || bytes <= limit)
+            return;
+        bulk = 1;
+    } else {
+        sd->rate_bytes += bytes;
+        sd->rate_start += elapsed;
+        bytes = bytes * 1000 / elapsed;
+        bulk = (bytes > limit) || (sd->bulk && (bytes > limit / 2));
+        if (bulk == sd->bulk)
+            return;
+    }
+
+    sd->bulk = bulk;
+    hev_task_set_priority (sd->task, bulk ? HEV_TASK_PRIORITY_LOW
+                                          : HEV_TASK_PRIORITY_DEFAULT);
+    LOG_D ("%p socks5 session %s", self, bulk ? "bulk" : "interactive");
+}
+
+void
+hev_socks5_session_rate_init (void)
+{
+    int burst = hev_config_get_misc_rate_burst ();
+    int limit = hev_config_get_misc_rate_limit ();
+    int i;
+
+    for (i = 0; i < 2; i++)
+        hev_socks5_bucket_init (&rate_buckets[i], limit, burst);
+
+    rate_shaped = limit || hev_config_get_misc_session_rate_limit ();
+}
+
+void
+hev_socks5_session_rate_setup (HevSocks5SessionData *sd)
+{
+    int burst = hev_config_get_misc_rate_burst ();
+    int limit = hev_config_get_misc_session_rate_limit ();
+    int i;
+
+    for (i = 0; i < 2; i++)
+        hev_socks5_bucket_init (&sd->rate[i], limit, burst);
+    sd->hold = 0;
+}
+
+size_t
+hev_socks5_session_quota (HevSocks5SessionData *sd, int dir, size_t size,
+                          int active)
+{
+    HevSocks5Bucket *global = &rate_buckets[dir];
+    HevSocks5Bucket *local = &sd->rate[dir];
+    unsigned int hold, ms;
+
+    if (!rate_shaped)
+        return size;
+
+    size = hev_socks5_bucket_peek (local, size);
+    if (size)
+        size = hev_socks5_bucket_peek (global, size);
+    if (size)
+        return size;
+    if (!active)
+        return 1;
+
+    hold = hev_socks5_bucket_delay (local);
+    ms = hev_socks5_bucket_delay (global);
+    if (ms > hold)
+        hold = ms;
+    if (!hold)
+        hold = 1;
+    if (!sd->hold || (hold < sd->hold))
+        sd->hold = hold;
+
+    return 0;
+}
+
+void
+hev_socks5_session_charge (HevSocks5SessionData *sd, int dir, size_t size)
+{
+    if (!rate_shaped)
+        return;
+
+    hev_socks5_bucket_take (&sd->rate[dir], size);
+    hev_socks5_bucket_take (&rate_buckets[dir], size);
+}
+
 HevListNode *
 hev_socks5_session_get_node (HevSocks5Session *self)
 {
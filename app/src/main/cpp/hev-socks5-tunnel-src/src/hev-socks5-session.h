@@ -10,9 +10,14 @@
 #ifndef __HEV_SOCKS5_SESSION_H__
 #define __HEV_SOCKS5_SESSION_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <hev-task.h>
+#include <hev-socks5-bucket.h>
 
 #include "hev-list.h"
+#include "hev-config.h"
 
 #define HEV_SOCKS5_SESSION(p) ((HevSocks5Session *)p)
 #define HEV_SOCKS5_SESSION_IFACE(p) ((HevSocks5SessionIface *)p)
@@ -20,17 +25,63 @@
 
 typedef void HevSocks5Session;
 typedef struct _HevSocks5SessionData HevSocks5SessionData;
+typedef struct _HevSocks5SessionStats HevSocks5SessionStats;
 typedef struct _HevSocks5SessionIface HevSocks5SessionIface;
 
+/*
+ * Plain counters of one session, only touched by its worker. They leave
+ * as HevSocks5TunnelSession records, see hev_socks5_tunnel_take_sessions.
+ * trace is the ID milestones are recorded under, 0 when not sampled.
+ */
+struct _HevSocks5SessionStats
+{
+    uint64_t id;
+    uint64_t trace;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint32_t start;
+    int handshake;
+    int ttfb;
+    unsigned int exported;
+    unsigned char type;
+    unsigned char state;
+    unsigned char family;
+    unsigned short port;
+    unsigned char addr[16];
+};
+
 struct _HevSocks5SessionData
 {
     HevListNode node;
     HevTask *task;
     HevSocks5Session *self;
+    unsigned int stamp;
+    int type;
+
+    /* Bytes charged to the session, and the part that is its stack. */
+    size_t mem;
+    int stack;
+
+    /* Shortest hold quota asked for since the splicer last slept, see below. */
+    unsigned int hold;
+
+    /* Bytes and sys_now at the start of the rate window, see below. */
+    uint64_t rate_bytes;
+    uint32_t rate_start;
+    int bulk;
+
+    HevSocks5SessionStats stats;
+
+    /* session-rate-limit of each direction, only touched when it is set. */
+    HevSocks5Bucket rate[2];
+
+    /* The config generation the session started with, held until destruct. */
+    HevConfigLive *live;
 };
 
 struct _HevSocks5SessionIface
 {
+    int (*attach) (HevSocks5Session *self);
     void (*splicer) (HevSocks5Session *self);
     HevTask *(*get_task) (HevSocks5Session *self);
     void (*set_task) (HevSocks5Session *self, HevTask *task);
@@ -42,7 +93,55 @@ void *hev_socks5_session_iface (void);
 void hev_socks5_session_run (HevSocks5Session *self);
 void hev_socks5_session_terminate (HevSocks5Session *self);
 
+/*
+ * Records why the session ends, a HevSocks5TunnelSessionState. The first
+ * reason sticks, so an eviction is not reported as the abort it causes.
+ * io_closed is for splicers whose io yielder failed: a timeout of zero
+ * means the session was terminated, otherwise it was idle.
+ */
+void hev_socks5_session_set_state (HevSocks5Session *self, int state);
+void hev_socks5_session_io_closed (HevSocks5Session *self);
+HevSocks5SessionStats *hev_socks5_session_get_stats (HevSocks5Session *self);
+
 void hev_socks5_session_set_task (HevSocks5Session *self, HevTask *task);
+
+/*
+ * The yield of the session splicers: sleeps the hold a quota recorded in
+ * place of a wait for I/O, see below, else hev_socks5_task_io_yielder, then
+ * refreshes the session's place in the eviction order and its priority.
+ */
+int hev_socks5_session_yield (HevSocks5Session *self, HevTaskYieldType type);
+
+/*
+ * Called by splicers on each yield of the session task. With
+ * session-bulk-rate set, a session whose rate went above it runs at the
+ * lowest priority, so copy loops of bulk flows queue behind the wakeups of
+ * interactive ones. Below half of it for a second, it is back at default.
+ */
+void hev_socks5_session_update_priority (HevSocks5Session *self);
+
+/*
+ * Traffic shaping of the splicers, under rate-limit for all sessions and
+ * session-rate-limit for each. Direction 0 is toward upstream, 1 from it.
+ * quota returns how many of @size bytes may go now, charged with charge
+ * once they went, or 0 and records the hold in sd->hold; a splicer with
+ * nothing else to do then sleeps the hold instead of waiting for I/O.
+ * @active is whether the last read of the direction got data, one that
+ * found none is given a byte (or one batch of datagrams) even when held,
+ * so that only directions with data sleep and idle ones keep their timeout.
+ */
+void hev_socks5_session_rate_init (void);
+void hev_socks5_session_rate_setup (HevSocks5SessionData *sd);
+size_t hev_socks5_session_quota (HevSocks5SessionData *sd, int dir,
+                                 size_t size, int active);
+void hev_socks5_session_charge (HevSocks5SessionData *sd, int dir,
+                                size_t size);
+
+/*
+ * Binder hook body shared by every upstream socket: applies socks5.mark,
+ * and the socks5.tcp-* options when fd is a stream socket, of live.
+ */
+int hev_socks5_session_bind_socket (HevConfigLive *live, int fd);
 HevListNode *hev_socks5_session_get_node (HevSocks5Session *self);
 
 #endif /* __HEV_SOCKS5_SESSION_H__ */
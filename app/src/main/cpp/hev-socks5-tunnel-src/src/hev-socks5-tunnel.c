@@ -11,10 +11,16 @@
 #include <assert.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 
+#include <lwip/sys.h>
 #include <lwip/tcp.h>
+#include <lwip/init.h>
 #include <lwip/udp.h>
+#include <lwip/memp.h>
 #include <lwip/nd6.h>
 #include <lwip/netif.h>
 #include <lwip/ip4_frag.h>
@@ -23,67 +29,283 @@
 
 #include <hev-task.h>
 #include <hev-task-io.h>
-#include <hev-task-mutex.h>
 #include <hev-task-system.h>
 #include <hev-memory-allocator.h>
 
 #include "hev-exec.h"
+#include "hev-utils.h"
+#include "hev-main.h"
 #include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-tunnel.h"
+#include "hev-bypass.h"
+#include "hev-tcp-gro.h"
+#include "hev-checksum.h"
 #include "hev-compiler.h"
 #include "hev-mapped-dns.h"
+#include "hev-pbuf-pool.h"
 #include "hev-config-const.h"
+#include "hev-thread-place.h"
+#include "hev-packet-filter.h"
+#include "hev-socks5-prefetch.h"
 #include "hev-socks5-session-tcp.h"
 #include "hev-socks5-session-udp.h"
 
 #include "hev-socks5-tunnel.h"
 
-static int run;
+/* Sessions touched within the same ~1 s tick share an idle bucket. */
+#define SESSION_TICK_SHIFT (10)
+/* Milliseconds between mapped DNS snapshots while names are added. */
+#define MAPDNS_SAVE_INTERVAL (60000)
+
+/* Active sessions are exported every few ticks, into a ring of records. */
+#define SESSION_EXPORT_TICKS (5)
+#define SESSION_RECORDS (1024)
+
+/* Milestones of traced sessions each worker holds until they are taken. */
+#define TRACE_EVENTS (256)
+
+/* task-stack-auto: sessions to see before sizing, and the size bounds. */
+#define STACK_AUTO_SAMPLES (64)
+#define STACK_AUTO_ALIGN (4096)
+#define STACK_AUTO_MIN (8192)
+
+#define LATENCY_BUCKETS HEV_SOCKS5_TUNNEL_STATS_LATENCY_BUCKETS
+
+/* Commands on a worker's event socket. */
+#define EVENT_QUIT (0)
+#define EVENT_REPLACE_FD (1)
+#define EVENT_RELOAD (2)
+
+/*
+ * Each counter has a single writer, the worker thread, so a relaxed store
+ * of the new value is enough for readers on other threads to never see a
+ * torn one, and costs no locked instruction.
+ */
+#define STAT_ADD(field, val) \
+    __atomic_store_n (&worker->field, worker->field + (val), __ATOMIC_RELAXED)
+#define STAT_SET(field, val) \
+    __atomic_store_n (&worker->field, (val), __ATOMIC_RELAXED)
+#define STAT_GET(w, field) __atomic_load_n (&(w)->field, __ATOMIC_RELAXED)
+
+typedef struct _HevSocks5TunnelWorker HevSocks5TunnelWorker;
+typedef struct _HevSocks5TunnelStack HevSocks5TunnelStack;
+
+enum
+{
+    SESSION_TCP,
+    SESSION_UDP,
+    SESSION_TYPES,
+};
+
+/*
+ * Task classes the scheduler profiles the workers by, in the order of
+ * HevSocks5TunnelStats.task_run_time. The event and prefetch tasks stay in
+ * class 0 and are not reported.
+ */
+enum
+{
+    TASK_CLASS_OTHER,
+    TASK_CLASS_LWIP_IO,
+    TASK_CLASS_LWIP_TIMER,
+    TASK_CLASS_TCP_SESSION,
+    TASK_CLASS_UDP_SESSION,
+    TASK_CLASSES,
+};
+
+#define TASK_CLASSES_REPORTED HEV_SOCKS5_TUNNEL_STATS_TASK_CLASSES
+
+struct _HevSocks5TunnelWorker
+{
+    pthread_t thread;
+    int started;
+    int tun_fd;
+    int next_tun_fd;
+    int event_fds[2];
+
+    uint64_t stat_tx_packets;
+    uint64_t stat_rx_packets;
+    uint64_t stat_tx_bytes;
+    uint64_t stat_rx_bytes;
+    uint64_t stat_fwd_writevs;
+    uint64_t stat_fwd_bytes;
+    uint64_t stat_sessions[SESSION_TYPES];
+    uint64_t stat_accepts[SESSION_TYPES];
+    uint64_t stat_evictions;
+    uint64_t stat_mem_evictions;
+    uint64_t stat_quic_rejects;
+    uint64_t stat_filter_drops;
+    uint64_t stat_connect_failures;
+    uint64_t stat_connect_latency[LATENCY_BUCKETS];
+    uint64_t stat_tcp_pcbs;
+    uint64_t stat_tcp_queued;
+    uint64_t stat_udp_drops;
+    uint64_t stat_egress_flushes;
+    uint64_t stat_connect_family[2];
+    uint64_t stat_connect_family_msecs[2];
+    uint64_t stat_connect_fallbacks;
+    uint64_t stat_tcp_segs;
+    uint64_t stat_udp_pcbs;
+    uint64_t stat_ref_pbufs;
+    uint64_t stat_pool_refusals;
+    uint64_t stat_wakeups;
+    uint64_t stat_reass_bytes;
+    uint64_t stat_reass_drops;
+    uint64_t stat_task_run_time[TASK_CLASSES_REPORTED];
+    uint64_t stat_task_switches[TASK_CLASSES_REPORTED];
+
+    /*
+     * Ring of trace events: the worker alone moves head, readers move tail
+     * under traces_mutex. Each side publishes its index with a release
+     * store, so neither ever waits for the other.
+     */
+    unsigned int trace_head;
+    unsigned int trace_tail;
+    HevSocks5TunnelTraceEvent traces[TRACE_EVENTS];
+};
+
+/*
+ * Stack size for new tasks of one session type. With task-stack-auto it
+ * moves, once enough sessions finished, to twice the deepest any of them
+ * reached, within the configured size. A deeper session raises it again.
+ */
+struct _HevSocks5TunnelStack
+{
+    int size;
+    int max;
+    int peak;
+    unsigned int samples;
+};
+
 static int reject_quic = 1;
-static int tun_fd = -1;
+static HevSocks5TunnelProvider provider;
+static void *provider_data;
+static char provider_user[256];
+static char provider_pass[256];
+static HevSocks5TunnelTraceProvider trace_provider;
+static HevSocks5TunnelProvider datagram_provider;
+static void *datagram_provider_data;
 static int tun_fd_local;
-static int session_count;
-static int event_fds[2] = { -1, -1 };
+static int worker_count;
+static HevSocks5TunnelWorker *workers;
+
+/* Session records of all workers, taken by hev_socks5_tunnel_take_sessions. */
+static pthread_mutex_t records_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t replace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static HevSocks5TunnelSession records[SESSION_RECORDS];
+static unsigned int records_head;
+static unsigned int records_count;
+static uint64_t session_ids;
+static pthread_mutex_t traces_mutex = PTHREAD_MUTEX_INITIALIZER;
+static u32_t mapdns_saved;
+
+/*
+ * Bytes the sessions of all workers hold, see hev_socks5_tunnel_charge, and
+ * the part of it held by evicted sessions. That part is on its way out and
+ * does not count against memory-limit again.
+ */
+static size_t mem_used;
+static size_t mem_doomed;
+
+/* Stats page of hev_socks5_tunnel_set_stats_page. */
+static HevSocks5TunnelStatsPage *stats_page;
+static size_t stats_page_size;
+static u32_t stats_page_interval;
+static u32_t stats_page_saved;
+
+/*
+ * Every worker thread owns one interface queue, one hev-task-system and one
+ * lwIP instance (lwIP state is thread-local, see LWIP_TLS). Flows are steered
+ * to queues by the kernel, so the workers share nothing on the packet path.
+ *
+ * lwIP is only entered from tasks of the owning worker, and neither lwIP nor
+ * its callbacks ever yield, so the cooperative scheduler already runs every
+ * lwIP call to completion and no lock is taken around them.
+ */
+static __thread int run;
+static __thread int tun_fd = -1;
+static __thread HevSocks5TunnelWorker *worker;
+
+static __thread struct netif netif;
+static __thread struct tcp_pcb *tcp;
+static __thread struct udp_pcb *udp;
 
-static size_t stat_tx_packets;
-static size_t stat_rx_packets;
-static size_t stat_tx_bytes;
-static size_t stat_rx_bytes;
+static __thread HevTask *task_event;
+static __thread HevTask *task_lwip_io;
+static __thread HevTask *task_lwip_timer;
+static __thread HevList session_sets[SESSION_TYPES];
+static __thread HevSocks5TunnelStack session_stacks[SESSION_TYPES];
+static __thread int timer_idle;
 
-static struct netif netif;
-static struct tcp_pcb *tcp;
-static struct udp_pcb *udp;
+/* Part of mem_used the live sessions of this worker hold. */
+static __thread size_t mem_local;
 
-static HevTaskMutex mutex;
-static HevTask *task_event;
-static HevTask *task_lwip_io;
-static HevTask *task_lwip_timer;
-static HevList session_set;
+static __thread struct pbuf *egress_queue[TUNNEL_WRITE_BATCH];
+static __thread int egress_count;
 
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
     hev_task_yield (type);
 
+    /* Woken up to flush the egress queue, or the fd was replaced. */
+    if (egress_count || ((intptr_t)data != tun_fd))
+        return -1;
+
     return run ? 0 : -1;
 }
 
+static void
+egress_flush (void)
+{
+    int i;
+
+    if (!egress_count)
+        return;
+
+    for (i = 0; i < egress_count; i++) {
+        struct pbuf *p = egress_queue[i];
+        ssize_t s;
+
+        s = hev_tunnel_write (tun_fd, p);
+        pbuf_free (p);
+        if (s <= 0) {
+            if (errno != EAGAIN)
+                LOG_W ("socks5 tunnel write");
+            continue;
+        }
+
+        STAT_ADD (stat_rx_packets, 1);
+        STAT_ADD (stat_rx_bytes, s);
+    }
+
+    egress_count = 0;
+    if ((hev_tunnel_flush (tun_fd) < 0) && (errno != EAGAIN))
+        LOG_W ("socks5 tunnel write");
+    STAT_ADD (stat_egress_flushes, 1);
+}
+
+/*
+ * Packets lwIP emits are held until the current round of lwIP work ends:
+ * a TUN read batch, a timer tick or a session splice. The round then goes
+ * out as GSO super-packets with offload, or in one tight write loop. Any
+ * other output wakes the lwIP I/O task, which flushes once the emitting
+ * task yields. lwIP already skips retransmitting segments that are still
+ * referenced here.
+ */
 static err_t
 netif_output_handler (struct netif *netif, struct pbuf *p)
 {
-    ssize_t s;
+    if (egress_count == TUNNEL_WRITE_BATCH)
+        egress_flush ();
 
-    s = hev_tunnel_write (tun_fd, p);
-    if (s <= 0) {
-        if (errno == EAGAIN)
-            return ERR_WOULDBLOCK;
-        LOG_W ("socks5 tunnel write");
-        return ERR_IF;
-    }
+    pbuf_ref (p);
+    egress_queue[egress_count++] = p;
 
-    stat_rx_packets++;
-    stat_rx_bytes += s;
+    if (!run)
+        egress_flush ();
+    else if (egress_count == 1)
+        hev_task_wakeup (task_lwip_io);
 
     return ERR_OK;
 }
@@ -111,52 +333,356 @@ netif_init_handler (struct netif *netif)
     return ERR_OK;
 }
 
+/*
+ * Each session type keeps its sessions ordered by last activity, oldest
+ * first. A touch only relinks when the session's coarse tick changed, so
+ * the list is a run of idle buckets and eviction takes the longest idle
+ * session in O(1).
+ */
+static int
+hev_socks5_tunnel_session_limit (int type)
+{
+    if (type == SESSION_TCP)
+        return hev_config_get_misc_max_tcp_session_count ();
+
+    return hev_config_get_misc_max_udp_session_count ();
+}
+
+static void
+hev_socks5_tunnel_export_session (HevSocks5SessionData *sd, int state)
+{
+    HevSocks5SessionStats *stats = &sd->stats;
+    HevSocks5TunnelSession *r;
+
+    pthread_mutex_lock (&records_mutex);
+    /* Nobody polling, the oldest record makes room. */
+    if (records_count == SESSION_RECORDS) {
+        records_head = (records_head + 1) % SESSION_RECORDS;
+        records_count--;
+    }
+    r = &records[(records_head + records_count++) % SESSION_RECORDS];
+
+    r->id = stats->id;
+    r->tx_bytes = stats->tx_bytes;
+    r->rx_bytes = stats->rx_bytes;
+    r->duration = sys_now () - stats->start;
+    r->handshake = stats->handshake;
+    r->ttfb = stats->ttfb;
+    r->type = stats->type;
+    r->state = state;
+    r->family = stats->family;
+    r->reserved = 0;
+    r->port = stats->port;
+    memcpy (r->addr, stats->addr, sizeof (r->addr));
+    pthread_mutex_unlock (&records_mutex);
+}
+
+static void
+hev_socks5_tunnel_evict_session (HevSocks5SessionData *sd)
+{
+    hev_socks5_session_set_state (sd->self, HEV_SOCKS5_TUNNEL_SESSION_EVICTED);
+    hev_list_del (&session_sets[sd->type], &sd->node);
+    STAT_ADD (stat_sessions[sd->type], -1);
+    STAT_ADD (stat_evictions, 1);
+    sd->type = -1;
+    mem_local -= sd->mem;
+    __atomic_add_fetch (&mem_doomed, sd->mem, __ATOMIC_RELAXED);
+
+    hev_socks5_session_terminate (sd->self);
+}
+
+static HevSocks5SessionData *
+hev_socks5_tunnel_oldest_session (void)
+{
+    HevSocks5SessionData *oldest = NULL;
+    int i;
+
+    for (i = 0; i < SESSION_TYPES; i++) {
+        HevListNode *node = hev_list_first (&session_sets[i]);
+        HevSocks5SessionData *sd;
+
+        if (!node)
+            continue;
+
+        sd = container_of (node, HevSocks5SessionData, node);
+        if (!oldest || (int)(sd->stamp - oldest->stamp) < 0)
+            oldest = sd;
+    }
+
+    return oldest;
+}
+
+static size_t
+hev_socks5_tunnel_mem_held (void)
+{
+    size_t used = __atomic_load_n (&mem_used, __ATOMIC_RELAXED);
+    size_t doomed = __atomic_load_n (&mem_doomed, __ATOMIC_RELAXED);
+
+    return (used > doomed) ? used - doomed : 0;
+}
+
+/*
+ * The session to give up its memory first: bulk sessions before
+ * interactive ones, they already run last, then the one holding the most.
+ */
+static HevSocks5SessionData *
+hev_socks5_tunnel_mem_victim (void)
+{
+    HevSocks5SessionData *victim = NULL;
+    int i;
+
+    for (i = 0; i < SESSION_TYPES; i++) {
+        HevListNode *node = hev_list_first (&session_sets[i]);
+
+        for (; node; node = hev_list_node_next (node)) {
+            HevSocks5SessionData *sd;
+
+            sd = container_of (node, HevSocks5SessionData, node);
+            if (!sd->mem)
+                continue;
+            if (!victim || (sd->bulk > victim->bulk) ||
+                ((sd->bulk == victim->bulk) && (sd->mem > victim->mem)))
+                victim = sd;
+        }
+    }
+
+    return victim;
+}
+
+/*
+ * Over memory-limit, sessions of this worker are evicted until what the
+ * others hold fits, or until this worker is down to its share of the
+ * limit. The rest is for the other workers to give up as they charge.
+ * Near the limit, hev_socks5_tunnel_mem_pressure has already made every
+ * session shrink, so this is the last resort.
+ */
+static void
+hev_socks5_tunnel_mem_enforce (void)
+{
+    size_t limit = hev_config_get_misc_memory_limit ();
+    size_t share = limit / worker_count;
+
+    while (limit && (hev_socks5_tunnel_mem_held () > limit) &&
+           (mem_local > share)) {
+        HevSocks5SessionData *sd = hev_socks5_tunnel_mem_victim ();
+
+        if (!sd)
+            break;
+
+        LOG_D ("%p socks5 tunnel memory evict %zu", sd->self, sd->mem);
+        STAT_ADD (stat_mem_evictions, 1);
+        hev_socks5_tunnel_evict_session (sd);
+    }
+}
+
 static void
-hev_socks5_tunnel_insert_session (HevListNode *node)
+hev_socks5_tunnel_insert_session (HevListNode *node, int type,
+                                  const ip_addr_t *ip, u16_t port,
+                                  int stack_size)
 {
+    HevSocks5SessionStats *stats;
     HevSocks5SessionData *sd;
     int max_session_count;
+    size_t count;
+    int sample;
+    int limit;
+
+    sd = container_of (node, HevSocks5SessionData, node);
+    sd->stamp = hev_task_system_get_clock () >> SESSION_TICK_SHIFT;
+    sd->type = type;
+
+    stats = &sd->stats;
+    stats->id = __atomic_add_fetch (&session_ids, 1, __ATOMIC_RELAXED);
+    stats->start = sys_now ();
+    stats->trace = 0;
+    sample = hev_config_get_misc_trace_sample ();
+    if (type == SESSION_TCP && sample > 0 && (stats->id % sample) == 0) {
+        stats->trace = stats->id;
+        hev_socks5_tunnel_trace (stats->trace, HEV_SOCKS5_TUNNEL_TRACE_ACCEPT);
+    }
+    sd->rate_start = stats->start;
+    hev_socks5_session_rate_setup (sd);
+    stats->handshake = -1;
+    stats->ttfb = -1;
+    stats->exported = sd->stamp;
+    stats->type = type;
+    stats->port = port;
+    if (IP_IS_V6 (ip)) {
+        stats->family = 6;
+        memcpy (stats->addr, ip_2_ip6 (ip)->addr, 16);
+    } else {
+        stats->family = 4;
+        memcpy (stats->addr, &ip_2_ip4 (ip)->addr, 4);
+    }
+
+    hev_list_add_tail (&session_sets[type], node);
+    STAT_ADD (stat_sessions[type], 1);
+    STAT_ADD (stat_accepts[type], 1);
 
-    hev_list_add_tail (&session_set, node);
-    session_count++;
+    /* The stack is only mapped as it is used, this is an upper bound. */
+    sd->stack = stack_size;
+    hev_socks5_tunnel_charge (node, stack_size);
+
+    limit = hev_socks5_tunnel_session_limit (type);
+    if (limit && worker->stat_sessions[type] > limit) {
+        node = hev_list_first (&session_sets[type]);
+        sd = container_of (node, HevSocks5SessionData, node);
+        hev_socks5_tunnel_evict_session (sd);
+    }
 
     max_session_count = hev_config_get_misc_max_session_count ();
-    if (!max_session_count || session_count < max_session_count)
+    count = worker->stat_sessions[SESSION_TCP];
+    count += worker->stat_sessions[SESSION_UDP];
+    if (!max_session_count || count < max_session_count)
         return;
 
-    node = hev_list_first (&session_set);
-    sd = container_of (node, HevSocks5SessionData, node);
-    hev_socks5_session_terminate (sd->self);
+    sd = hev_socks5_tunnel_oldest_session ();
+    hev_socks5_tunnel_evict_session (sd);
 }
 
-static void
+void
 hev_socks5_tunnel_delete_session (HevListNode *node)
 {
-    hev_list_del (&session_set, node);
-    session_count--;
+    HevSocks5SessionData *sd;
+
+    sd = container_of (node, HevSocks5SessionData, node);
+    hev_socks5_session_set_state (sd->self, HEV_SOCKS5_TUNNEL_SESSION_CLOSED);
+    hev_socks5_tunnel_export_session (sd, sd->stats.state);
+    hev_socks5_tunnel_trace (sd->stats.trace, HEV_SOCKS5_TUNNEL_TRACE_CLOSE);
+    if (sd->type < 0)
+        return;
+
+    hev_list_del (&session_sets[sd->type], node);
+    STAT_ADD (stat_sessions[sd->type], -1);
 }
 
 void
 hev_socks5_tunnel_update_session (HevListNode *node)
 {
-    int max_session_count;
+    HevSocks5SessionData *sd;
+    unsigned int stamp;
 
-    max_session_count = hev_config_get_misc_max_session_count ();
-    if (!max_session_count)
+    sd = container_of (node, HevSocks5SessionData, node);
+    if (sd->type < 0)
+        return;
+
+    stamp = hev_task_system_get_clock () >> SESSION_TICK_SHIFT;
+    if (sd->stamp == stamp)
+        return;
+
+    sd->stamp = stamp;
+    hev_list_del (&session_sets[sd->type], node);
+    hev_list_add_tail (&session_sets[sd->type], node);
+
+    /* Long-lived flows show up before they close. */
+    if ((stamp - sd->stats.exported) >= SESSION_EXPORT_TICKS) {
+        sd->stats.exported = stamp;
+        hev_socks5_tunnel_export_session (sd, HEV_SOCKS5_TUNNEL_SESSION_ACTIVE);
+    }
+}
+
+void
+hev_socks5_tunnel_charge (HevListNode *node, ssize_t size)
+{
+    HevSocks5SessionData *sd;
+
+    sd = container_of (node, HevSocks5SessionData, node);
+    sd->mem += size;
+    __atomic_add_fetch (&mem_used, size, __ATOMIC_RELAXED);
+
+    if (sd->type < 0) {
+        __atomic_add_fetch (&mem_doomed, size, __ATOMIC_RELAXED);
+        return;
+    }
+
+    mem_local += size;
+
+    if (size > 0)
+        hev_socks5_tunnel_mem_enforce ();
+}
+
+int
+hev_socks5_tunnel_mem_pressure (HevListNode *node)
+{
+    HevSocks5SessionData *sd;
+    size_t limit;
+
+    sd = container_of (node, HevSocks5SessionData, node);
+    limit = hev_config_get_misc_session_memory_limit ();
+    if (limit && (sd->mem > limit))
+        return 1;
+
+    limit = hev_config_get_misc_memory_limit ();
+    if (limit && (hev_socks5_tunnel_mem_held () > limit - limit / 4))
+        return 1;
+
+    return 0;
+}
+
+static void
+session_stacks_init (void)
+{
+    int i;
+
+    memset (session_stacks, 0, sizeof (session_stacks));
+    session_stacks[SESSION_TCP].max =
+        hev_config_get_misc_tcp_task_stack_size ();
+    session_stacks[SESSION_UDP].max =
+        hev_config_get_misc_udp_task_stack_size ();
+
+    for (i = 0; i < SESSION_TYPES; i++)
+        session_stacks[i].size = session_stacks[i].max;
+}
+
+static void
+session_stack_sample (int type)
+{
+    HevSocks5TunnelStack *st = &session_stacks[type];
+    int usage, size;
+
+    if (!hev_config_get_misc_task_stack_auto ())
+        return;
+
+    /* Runs on the session's own task, before its stack goes away. */
+    usage = hev_task_get_stack_usage (hev_task_self ());
+    if (usage < 0)
+        return;
+
+    if (st->peak < usage)
+        st->peak = usage;
+    if (st->samples < STACK_AUTO_SAMPLES)
+        st->samples++;
+    if (st->samples < STACK_AUTO_SAMPLES)
         return;
 
-    hev_list_del (&session_set, node);
-    hev_list_add_tail (&session_set, node);
+    size = ALIGN_UP (st->peak * 2, STACK_AUTO_ALIGN);
+    if (size < STACK_AUTO_MIN)
+        size = STACK_AUTO_MIN;
+    else if (size > st->max)
+        size = st->max;
+
+    if (st->size != size) {
+        LOG_I ("socks5 tunnel %s stack size %d, peak %d",
+               (type == SESSION_TCP) ? "tcp" : "udp", size, st->peak);
+        st->size = size;
+    }
 }
 
 static void
 hev_socks5_session_task_entry (void *data)
 {
     HevSocks5Session *s = data;
+    HevSocks5SessionData *sd;
+    HevListNode *node;
 
     hev_socks5_session_run (s);
 
-    hev_socks5_tunnel_delete_session (hev_socks5_session_get_node (s));
+    node = hev_socks5_session_get_node (s);
+    sd = container_of (node, HevSocks5SessionData, node);
+    session_stack_sample (sd->stats.type);
+
+    hev_socks5_tunnel_delete_session (node);
+    hev_socks5_tunnel_charge (node, -sd->stack);
     hev_object_unref (HEV_OBJECT (s));
 }
 
@@ -174,26 +700,100 @@ tcp_accept_handler (void *arg, struct tcp_pcb *pcb, err_t err)
     if (!run)
         return ERR_RST;
 
-    tcp = hev_socks5_session_tcp_new (pcb, &mutex);
+    tcp = hev_socks5_session_tcp_new (pcb);
     if (!tcp)
         return ERR_MEM;
 
-    stack_size = hev_config_get_misc_task_stack_size ();
+    stack_size = session_stacks[SESSION_TCP].size;
     task = hev_task_new (stack_size);
     if (!task) {
         hev_object_unref (HEV_OBJECT (tcp));
         return ERR_MEM;
     }
 
+    hev_task_set_class (task, TASK_CLASS_TCP_SESSION);
     hev_socks5_session_set_task (HEV_SOCKS5_SESSION (tcp), task);
     node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (tcp));
-    hev_socks5_tunnel_insert_session (node);
+    hev_socks5_tunnel_insert_session (node, SESSION_TCP, &pcb->local_ip,
+                                      pcb->local_port, stack_size);
     hev_task_run (task, hev_socks5_session_task_entry, tcp);
-    hev_task_wakeup (task_lwip_timer);
 
     return ERR_OK;
 }
 
+/*
+ * Saves the mapped DNS snapshot at most once per interval, by whichever
+ * worker gets there first, or unconditionally when force is set.
+ */
+static void
+mapped_dns_save (HevMappedDNS *dns, int force)
+{
+    const char *path = hev_config_get_mapdns_cache_file ();
+    u32_t now, last;
+
+    if (!path)
+        return;
+
+    if (!force) {
+        now = sys_now ();
+        last = __atomic_load_n (&mapdns_saved, __ATOMIC_RELAXED);
+        if ((now - last) < MAPDNS_SAVE_INTERVAL)
+            return;
+        if (!__atomic_compare_exchange_n (&mapdns_saved, &last, now, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+    }
+
+    if (hev_mapped_dns_save (dns, path) < 0)
+        LOG_W ("socks5 tunnel mapped dns save");
+}
+
+/*
+ * Copies the stats into the page at most once per interval, by whichever
+ * worker gets there first, or unconditionally when force is set. The page
+ * sequence is a seqlock, a writer claims it by making it odd, so two
+ * workers never write at once and readers retry meanwhile.
+ *
+ * Returns the milliseconds until the page may be written again when this
+ * round was skipped for the interval, otherwise 0.
+ */
+static u32_t
+stats_page_publish (int running, int force)
+{
+    HevSocks5TunnelStatsPage *page = stats_page;
+    u32_t now, last, seq;
+
+    if (!page)
+        return 0;
+
+    if (!force) {
+        now = sys_now ();
+        last = __atomic_load_n (&stats_page_saved, __ATOMIC_RELAXED);
+        if ((now - last) < stats_page_interval)
+            return stats_page_interval - (now - last);
+        if (!__atomic_compare_exchange_n (&stats_page_saved, &last, now, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return 0;
+    }
+
+    seq = __atomic_load_n (&page->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) ||
+        !__atomic_compare_exchange_n (&page->seq, &seq, seq + 1, 0,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return 0;
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    page->running = running;
+    hev_socks5_tunnel_get_stats (&page->stats,
+                                 stats_page_size -
+                                     offsetof (HevSocks5TunnelStatsPage,
+                                               stats));
+
+    __atomic_store_n (&page->seq, seq + 2, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
 static void
 dns_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
                   const ip_addr_t *addr, u16_t port)
@@ -215,6 +815,7 @@ dns_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
     b->len = res;
     b->tot_len = res;
     udp_sendfrom (pcb, b, &pcb->local_ip, pcb->local_port);
+    mapped_dns_save (dns, 0);
 
 free:
     pbuf_free (b);
@@ -249,90 +850,162 @@ udp_recv_handler (void *arg, struct udp_pcb *pcb, struct pbuf *p,
         }
     }
 
-    udp = hev_socks5_session_udp_new (pcb, &mutex);
+    udp = hev_socks5_session_udp_new (pcb);
     if (!udp) {
         udp_remove (pcb);
         return;
     }
 
-    stack_size = hev_config_get_misc_task_stack_size ();
+    /* Request/response flows ride on a leader, no task or handshake. */
+    if (hev_socks5_session_udp_join (udp)) {
+        node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (udp));
+        hev_socks5_tunnel_insert_session (node, SESSION_UDP, &pcb->local_ip,
+                                          pcb->local_port, 0);
+        return;
+    }
+
+    stack_size = session_stacks[SESSION_UDP].size;
     task = hev_task_new (stack_size);
     if (!task) {
         hev_object_unref (HEV_OBJECT (udp));
         return;
     }
 
+    hev_task_set_class (task, TASK_CLASS_UDP_SESSION);
     hev_socks5_session_set_task (HEV_SOCKS5_SESSION (udp), task);
     node = hev_socks5_session_get_node (HEV_SOCKS5_SESSION (udp));
-    hev_socks5_tunnel_insert_session (node);
+    hev_socks5_tunnel_insert_session (node, SESSION_UDP, &pcb->local_ip,
+                                      pcb->local_port, stack_size);
     hev_task_run (task, hev_socks5_session_task_entry, udp);
-    hev_task_wakeup (task_lwip_timer);
 }
 
+/*
+ * Move the lwIP I/O task to the replacement fd. netif, PCBs and sessions
+ * are untouched; packets still queued for the old fd go out to it first.
+ * Claiming the fd races with the caller cancelling it, only the winner
+ * acts, and a claimed fd is always acked.
+ */
 static void
-event_task_entry (void *data)
+replace_tun_fd (void)
 {
-    HevListNode *node;
-    int val;
+    unsigned char ack = EVENT_REPLACE_FD;
+    int fd;
 
-    LOG_D ("socks5 tunnel event task run");
+    fd = __atomic_exchange_n (&worker->next_tun_fd, -1, __ATOMIC_ACQ_REL);
+    if (fd < 0)
+        return;
+
+    egress_flush ();
+    hev_tunnel_del_task (tun_fd, task_lwip_io);
+    tun_fd = fd;
+    WRITE_ONCE (worker->tun_fd, fd);
+    hev_tunnel_add_task (tun_fd, task_lwip_io);
+    hev_task_wakeup (task_lwip_io);
 
-    hev_task_add_fd (task_event, event_fds[0], POLLIN);
+    LOG_I ("socks5 tunnel fd replaced: %d", fd);
+    if (write (worker->event_fds[0], &ack, 1) != 1)
+        LOG_W ("socks5 tunnel replace fd ack");
+}
 
-    hev_task_io_read (event_fds[0], &val, sizeof (val), NULL, NULL);
+static int
+client_pool_bind (int fd, const struct sockaddr *dest)
+{
+    HevConfigLive *live;
+    int res;
 
-    run = 0;
-    node = hev_list_first (&session_set);
-    for (; node; node = hev_list_node_next (node)) {
-        HevSocks5SessionData *sd;
+    live = hev_config_live_hold ();
+    if (!live)
+        return -1;
 
-        sd = container_of (node, HevSocks5SessionData, node);
-        hev_socks5_session_terminate (sd->self);
-    }
+    res = hev_socks5_session_bind_socket (live, fd);
+    hev_config_live_release (live);
 
-    hev_task_join (task_lwip_io);
-    hev_task_join (task_lwip_timer);
-    hev_task_del_fd (task_event, event_fds[0]);
+    return res;
 }
 
-/*
- * Check if an IPv4 packet is UDP destined for port 443 (QUIC).
- * Returns the IP header length in bytes if QUIC, 0 otherwise.
- */
-static uint16_t
-is_quic_packet (const uint8_t *data, uint16_t len)
+static void
+client_pool_init (void)
 {
-    uint16_t iphdr_len, dst_port;
+    HevConfigServer *srv;
+    HevConfigLive *live;
+    int res = 0;
 
-    /* Minimum: IPv4 header (20) + UDP header (8) */
-    if (len < 28)
-        return 0;
+    /* Shutting down, nothing to connect with. */
+    live = hev_config_live_hold ();
+    if (!live)
+        return;
 
-    /* IPv4 only */
-    if ((data[0] >> 4) != 4)
-        return 0;
+    srv = hev_config_get_socks5_server (live);
 
-    iphdr_len = (data[0] & 0x0F) * 4;
-    if (iphdr_len < 20 || len < iphdr_len + 4)
-        return 0;
+    /* Sessions still connect on their own when this fails. */
+    if (srv->pool_size)
+        res = hev_socks5_client_pool_init (srv->addr, srv->port, srv->user,
+                                           srv->pass, srv->pool_size,
+                                           client_pool_bind);
+    if (res < 0)
+        LOG_W ("socks5 tunnel client pool");
 
-    /* UDP protocol (17) */
-    if (data[9] != 17)
-        return 0;
+    hev_config_live_release (live);
+}
 
-    /* Destination port (big-endian at iphdr_len+2..3) */
-    dst_port = ((uint16_t)data[iphdr_len + 2] << 8) | data[iphdr_len + 3];
+static void
+reload_config (void)
+{
+    /* Pooled connections went through the old server and credentials. */
+    hev_socks5_client_pool_fini ();
+    client_pool_init ();
 
-    return (dst_port == 443) ? iphdr_len : 0;
+    LOG_I ("socks5 tunnel config reloaded");
 }
 
-/*
- * Send ICMP Destination Unreachable / Port Unreachable back to TUN.
- * Forces QUIC clients to fall back to TCP immediately instead of
- * waiting 5-10 seconds for a timeout.
- *
- * Packet format (RFC 792):
- *   [20B IP header][8B ICMP header][original IP header + 8B of UDP]
+static void
+event_task_entry (void *data)
+{
+    HevListNode *node;
+    int i;
+
+    LOG_D ("socks5 tunnel event task run");
+
+    hev_task_add_fd (task_event, worker->event_fds[0], POLLIN);
+
+    for (;;) {
+        unsigned char cmd;
+        ssize_t res;
+
+        res = hev_task_io_read (worker->event_fds[0], &cmd, 1, NULL, NULL);
+        if ((res <= 0) || (cmd == EVENT_QUIT))
+            break;
+        if (cmd == EVENT_REPLACE_FD)
+            replace_tun_fd ();
+        else if (cmd == EVENT_RELOAD)
+            reload_config ();
+    }
+
+    run = 0;
+    hev_socks5_client_pool_fini ();
+    for (i = 0; i < SESSION_TYPES; i++) {
+        node = hev_list_first (&session_sets[i]);
+        for (; node; node = hev_list_node_next (node)) {
+            HevSocks5SessionData *sd;
+
+            sd = container_of (node, HevSocks5SessionData, node);
+            hev_socks5_session_terminate (sd->self);
+        }
+    }
+    hev_socks5_prefetch_fini ();
+
+    hev_task_join (task_lwip_io);
+    hev_task_join (task_lwip_timer);
+    hev_task_del_fd (task_event, worker->event_fds[0]);
+}
+
+/*
+ * Send ICMP Destination Unreachable / Port Unreachable back to TUN.
+ * Forces QUIC clients to fall back to TCP immediately instead of
+ * waiting 5-10 seconds for a timeout.
+ *
+ * Packet format (RFC 792):
+ *   [20B IP header][8B ICMP header][original IP header + 8B of UDP]
  */
 static void
 send_icmp_port_unreachable (const uint8_t *orig, uint16_t orig_len,
@@ -341,9 +1014,7 @@ send_icmp_port_unreachable (const uint8_t *orig, uint16_t orig_len,
     uint16_t icmp_data_len, icmp_total, ip_total;
     struct pbuf *p;
     uint8_t *out, *icmp;
-    uint32_t sum;
     uint16_t cksum;
-    int i;
 
     icmp_data_len = iphdr_len + 8;    /* Original IP header + 8B of UDP */
     if (orig_len < icmp_data_len)
@@ -369,12 +1040,7 @@ send_icmp_port_unreachable (const uint8_t *orig, uint16_t orig_len,
     memcpy (out + 16, orig + 12, 4);       /* Dst IP = original Src IP */
 
     /* IP header checksum */
-    sum = 0;
-    for (i = 0; i < 20; i += 2)
-        sum += ((uint32_t)out[i] << 8) | out[i + 1];
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    cksum = ~sum & 0xFFFF;
+    cksum = hev_checksum (out, 20);
     out[10] = (cksum >> 8) & 0xFF;
     out[11] = cksum & 0xFF;
 
@@ -389,16 +1055,7 @@ send_icmp_port_unreachable (const uint8_t *orig, uint16_t orig_len,
     memcpy (icmp + 8, orig, icmp_data_len);
 
     /* ICMP checksum (over ICMP header + data) */
-    sum = 0;
-    for (i = 0; i < icmp_total; i += 2) {
-        if (i + 1 < icmp_total)
-            sum += ((uint32_t)icmp[i] << 8) | icmp[i + 1];
-        else
-            sum += (uint32_t)icmp[i] << 8;
-    }
-    while (sum >> 16)
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    cksum = ~sum & 0xFFFF;
+    cksum = hev_checksum (icmp, icmp_total);
     icmp[2] = (cksum >> 8) & 0xFF;
     icmp[3] = cksum & 0xFF;
 
@@ -407,58 +1064,373 @@ send_icmp_port_unreachable (const uint8_t *orig, uint16_t orig_len,
     pbuf_free (p);
 }
 
+/*
+ * Send ICMPv6 Destination Unreachable / Port Unreachable back to TUN.
+ *
+ * Packet format (RFC 4443):
+ *   [40B IPv6 header][8B ICMPv6 header][as much of the original packet
+ *   as fits in the minimum IPv6 MTU]
+ */
+static void
+send_icmp6_port_unreachable (const uint8_t *orig, uint16_t orig_len)
+{
+    uint16_t icmp_data_len, icmp_total, ip_total;
+    struct pbuf *p;
+    uint8_t *out, *icmp;
+    uint32_t sum;
+    uint16_t cksum;
+
+    icmp_data_len = orig_len;
+    if (icmp_data_len > 1280 - 40 - 8)
+        icmp_data_len = 1280 - 40 - 8;
+
+    icmp_total = 8 + icmp_data_len;   /* ICMPv6 header (8) + data */
+    ip_total = 40 + icmp_total;       /* IPv6 header (40) + ICMPv6 */
+
+    p = pbuf_alloc (PBUF_RAW, ip_total, PBUF_RAM);
+    if (!p)
+        return;
+
+    out = (uint8_t *)p->payload;
+    memset (out, 0, ip_total);
+
+    /* --- IPv6 header (40 bytes) --- */
+    out[0] = 0x60;                         /* Version 6 */
+    out[4] = (icmp_total >> 8) & 0xFF;     /* Payload Length */
+    out[5] = icmp_total & 0xFF;
+    out[6] = 58;                           /* Next Header: ICMPv6 */
+    out[7] = 64;                           /* Hop Limit */
+    memcpy (out + 8, orig + 24, 16);       /* Src IP = original Dst IP */
+    memcpy (out + 24, orig + 8, 16);       /* Dst IP = original Src IP */
+
+    /* --- ICMPv6 header (8 bytes) --- */
+    icmp = out + 40;
+    icmp[0] = 1;                           /* Type: Destination Unreachable */
+    icmp[1] = 4;                           /* Code: Port Unreachable */
+    /* Bytes 2-3: checksum (computed below) */
+    /* Bytes 4-7: unused (zero) */
+
+    /* ICMPv6 data: leading part of the original packet */
+    memcpy (icmp + 8, orig, icmp_data_len);
+
+    /* ICMPv6 checksum (over pseudo-header + ICMPv6 header + data) */
+    sum = hev_checksum_add (icmp_total + 58, out + 8, 32);
+    sum = hev_checksum_add (sum, icmp, icmp_total);
+    cksum = ~hev_checksum_fold (sum);
+    icmp[2] = (cksum >> 8) & 0xFF;
+    icmp[3] = cksum & 0xFF;
+
+    /* Write ICMPv6 response back to TUN */
+    netif_output_handler (&netif, p);
+    pbuf_free (p);
+}
+
+/*
+ * Run the packet filter ahead of lwIP, so unwanted traffic costs neither an
+ * lwIP pass nor a session. Returns 0 if the packet was consumed.
+ */
+static int
+packet_filter (struct pbuf *buf, const HevPacketFilterInfo *info)
+{
+    const uint8_t *data = buf->payload;
+    int action;
+
+    if (!info->family)
+        return -1;
+
+    action = hev_packet_filter_classify (info);
+
+    /* Reject QUIC (UDP 443) unless a rule decided otherwise.
+     * Forces immediate TCP fallback instead of 5-10s timeout. */
+    if ((action < 0) && reject_quic && (info->proto == IP_PROTO_UDP) &&
+        (info->dport == 443)) {
+        STAT_ADD (stat_quic_rejects, 1);
+        action = HEV_CONFIG_FILTER_REJECT;
+    } else if ((action == HEV_CONFIG_FILTER_REJECT) ||
+               (action == HEV_CONFIG_FILTER_DROP)) {
+        STAT_ADD (stat_filter_drops, 1);
+    }
+
+    switch (action) {
+    case HEV_CONFIG_FILTER_REJECT:
+        /* Never answer ICMP with ICMP errors. */
+        if ((info->proto == IP_PROTO_UDP) || (info->proto == IP_PROTO_TCP)) {
+            if (info->family == 4)
+                send_icmp_port_unreachable (data, buf->len, info->hdr_len);
+            else
+                send_icmp6_port_unreachable (data, buf->len);
+        }
+        /* fall through */
+    case HEV_CONFIG_FILTER_DROP:
+        pbuf_free (buf);
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Answer queries to the mapped DNS address ahead of lwIP, with the IPv4 and
+ * UDP headers built in place, so no udp_pcb is set up per query. Returns 0
+ * if the packet was consumed, fragments and options go the lwIP way.
+ */
+static int
+mapped_dns_intercept (HevMappedDNS *dns, struct pbuf *buf,
+                      const HevPacketFilterInfo *info)
+{
+    uint8_t *data = buf->payload;
+    uint16_t ulen, rlen;
+    int faddr, fport;
+    struct pbuf *p;
+    uint8_t *out;
+    uint32_t sum;
+    uint16_t cksum;
+    int res;
+
+    /* IPv4, UDP and DNS headers at least. */
+    if ((buf->len != buf->tot_len) || (buf->len < 28 + 12))
+        return -1;
+    if ((info->family != 4) || (info->hdr_len != 20) ||
+        (info->proto != IP_PROTO_UDP) ||
+        (info->flags & HEV_PACKET_FILTER_FRAGMENT))
+        return -1;
+
+    faddr = hev_config_get_mapdns_address ();
+    fport = hev_config_get_mapdns_port ();
+    if (memcmp (info->daddr, &faddr, 4) || (info->dport != fport))
+        return -1;
+
+    ulen = (data[24] << 8) | data[25];
+    if ((ulen < 8) || (20 + ulen > buf->len))
+        return -1;
+
+    p = pbuf_alloc (PBUF_RAW, 28 + UDP_BUF_SIZE, PBUF_RAM);
+    if (!p)
+        goto free;
+
+    out = p->payload;
+    res = hev_mapped_dns_handle (dns, data + 28, ulen - 8, out + 28,
+                                 UDP_BUF_SIZE);
+    if (res < 0) {
+        pbuf_free (p);
+        goto free;
+    }
+    rlen = 28 + res;
+    pbuf_realloc (p, rlen);
+
+    /* --- IPv4 header (20 bytes) --- */
+    memset (out, 0, 28);
+    out[0] = 0x45;
+    out[2] = rlen >> 8;
+    out[3] = rlen;
+    out[8] = 64;
+    out[9] = IP_PROTO_UDP;
+    memcpy (out + 12, data + 16, 4);
+    memcpy (out + 16, data + 12, 4);
+    cksum = hev_checksum (out, 20);
+    out[10] = cksum >> 8;
+    out[11] = cksum;
+
+    /* --- UDP header (8 bytes), ports swapped --- */
+    ulen = rlen - 20;
+    memcpy (out + 20, data + 22, 2);
+    memcpy (out + 22, data + 20, 2);
+    out[24] = ulen >> 8;
+    out[25] = ulen;
+    sum = hev_checksum_add (ulen + IP_PROTO_UDP, out + 12, 8);
+    sum = hev_checksum_add (sum, out + 20, ulen);
+    cksum = ~hev_checksum_fold (sum);
+    if (!cksum)
+        cksum = 0xffff;
+    out[26] = cksum >> 8;
+    out[27] = cksum;
+
+    netif_output_handler (&netif, p);
+    pbuf_free (p);
+    mapped_dns_save (dns, 0);
+
+free:
+    pbuf_free (buf);
+    return 0;
+}
+
 static void
 lwip_io_task_entry (void *data)
 {
     const unsigned int mtu = hev_config_get_tunnel_mtu ();
+    const int batch = hev_config_get_tunnel_read_batch ();
+    const int gro = hev_config_get_tunnel_gro () && batch > 1;
+    const int ack_batch = hev_config_get_misc_tcp_ack_segments () > 2;
+    HevPacketFilterInfo infos[batch];
+    struct pbuf *bufs[batch];
 
     LOG_D ("socks5 tunnel lwip task run");
 
     hev_tunnel_add_task (tun_fd, task_lwip_io);
 
     for (; run;) {
-        struct pbuf *buf;
-        uint16_t iphdr_len;
+        int i, num, filter;
+        HevMappedDNS *dns;
+
+        num = hev_tunnel_read_batch (tun_fd, mtu, bufs, batch,
+                                     task_io_yielder, (void *)(intptr_t)tun_fd);
+
+        filter = reject_quic || !hev_packet_filter_is_empty ();
+        dns = hev_mapped_dns_get ();
+        if (filter || dns || gro)
+            hev_packet_filter_parse_batch (bufs, num, infos);
+        for (i = 0; i < num; i++) {
+            struct pbuf *buf = bufs[i];
+
+            STAT_ADD (stat_tx_packets, 1);
+            STAT_ADD (stat_tx_bytes, buf->tot_len);
+
+            /* Consumed packets leave a hole for the input pass below. */
+            if ((filter && (packet_filter (buf, &infos[i]) == 0)) ||
+                (dns && (mapped_dns_intercept (dns, buf, &infos[i]) == 0)))
+                bufs[i] = NULL;
+        }
 
-        buf = hev_tunnel_read (tun_fd, mtu, task_io_yielder, NULL);
-        if (!buf)
-            continue;
+        if (gro && num > 1)
+            hev_tcp_gro_merge (bufs, infos, num);
 
-        stat_tx_packets++;
-        stat_tx_bytes += buf->tot_len;
-
-        /* Reject QUIC (UDP 443) with ICMP Port Unreachable.
-         * Forces immediate TCP fallback instead of 5-10s timeout. */
-        iphdr_len = is_quic_packet ((const uint8_t *)buf->payload,
-                                     buf->len);
-        if (reject_quic && iphdr_len) {
-            send_icmp_port_unreachable ((const uint8_t *)buf->payload,
-                                         buf->len, iphdr_len);
-            pbuf_free (buf);
-            continue;
-        }
+        for (i = 0; i < num; i++) {
+            struct pbuf *buf = bufs[i];
 
-        hev_task_mutex_lock (&mutex);
-        if (netif.input (buf, &netif) != ERR_OK)
-            pbuf_free (buf);
-        hev_task_mutex_unlock (&mutex);
+            if (buf && (netif.input (buf, &netif) != ERR_OK))
+                pbuf_free (buf);
+        }
+        /* ACKs held for more segments go out with this batch's writes. */
+        if (ack_batch)
+            tcp_ack_flush ();
+        egress_flush ();
+        hev_socks5_tunnel_kick_timer ();
+        stats_page_publish (1, 0);
     }
 
+    egress_flush ();
     hev_tunnel_del_task (tun_fd, task_lwip_io);
 }
 
+/*
+ * lwIP timers count ticks of this task rather than wall time, so a tick may
+ * only be skipped while no timer is armed. Established connections that are
+ * quiet and UDP flows need no ticks at all.
+ *
+ * The walk also samples the TCP occupancy gauges, next to the lwIP pool
+ * and reassembly ones and the scheduler profile.
+ */
+static int
+lwip_timer_pending (void)
+{
+    unsigned int pcbs = 0, queued = 0;
+    unsigned int reass_bytes = 0, reass_drops = 0;
+    HevTaskSystemStats sys_stats;
+    HevTaskProfile profile;
+    struct tcp_pcb *pcb;
+    int pending = 0;
+    int i;
+
+    for (pcb = tcp_tw_pcbs; pcb; pcb = pcb->next) {
+        pending = 1;
+        pcbs++;
+    }
+
+    for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        pcbs++;
+        queued += pcb->snd_queuelen;
+
+        /* Handshake and close timeouts. */
+        if (pcb->state != ESTABLISHED && pcb->state != CLOSE_WAIT)
+            pending = 1;
+        /* Retransmits and zero window probes. */
+        else if (pcb->unacked || pcb->unsent || pcb->persist_backoff)
+            pending = 1;
+        /* Delayed ACKs, pending FINs and refused data. */
+        else if ((pcb->flags & (TF_ACK_DELAY | TF_CLOSEPEND)) ||
+                 pcb->refused_data)
+            pending = 1;
+#if TCP_QUEUE_OOSEQ
+        else if (pcb->ooseq)
+            pending = 1;
+#endif
+        else if (ip_get_option (pcb, SOF_KEEPALIVE))
+            pending = 1;
+    }
+
+    STAT_SET (stat_tcp_pcbs, pcbs);
+    STAT_SET (stat_tcp_queued, queued);
+    STAT_SET (stat_tcp_segs, memp_used (MEMP_TCP_SEG));
+    STAT_SET (stat_udp_pcbs, memp_used (MEMP_UDP_PCB));
+    STAT_SET (stat_ref_pbufs, memp_used (MEMP_PBUF));
+    STAT_SET (stat_pool_refusals, memp_refused ());
+    hev_task_system_get_stats (&sys_stats);
+    STAT_SET (stat_wakeups, sys_stats.wakeups);
+    for (i = 0; i < TASK_CLASSES_REPORTED; i++) {
+        hev_task_system_get_class_profile (TASK_CLASS_LWIP_IO + i, &profile);
+        STAT_SET (stat_task_run_time[i], profile.run_time);
+        STAT_SET (stat_task_switches[i], profile.switches);
+    }
+#if IP_REASSEMBLY
+    reass_bytes += ip_reass_bytes ();
+    reass_drops += ip_reass_drops ();
+#endif
+#if LWIP_IPV6 && LWIP_IPV6_REASS
+    reass_bytes += ip6_reass_bytes ();
+    reass_drops += ip6_reass_drops ();
+#endif
+    STAT_SET (stat_reass_bytes, reass_bytes);
+    STAT_SET (stat_reass_drops, reass_drops);
+
+    if (pending)
+        return 1;
+
+#if IP_REASSEMBLY
+    if (ip_reass_pending ())
+        return 1;
+#endif
+#if LWIP_IPV6
+#if LWIP_IPV6_REASS
+    if (ip6_reass_pending ())
+        return 1;
+#endif
+    /* Duplicate address detection. */
+    for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++)
+        if (ip6_addr_istentative (netif_ip6_addr_state (&netif, i)))
+            return 1;
+#endif
+
+    return 0;
+}
+
 static void
 lwip_timer_task_entry (void *data)
 {
-    unsigned int i;
+    unsigned int i = 1;
 
     LOG_D ("socks5 tunnel timer task run");
 
-    for (i = 1; run; i++) {
-        hev_task_mutex_lock (&mutex);
+    while (run) {
+        if (!lwip_timer_pending ()) {
+            u32_t wait;
+
+            /* The page catches up with the last round before sleeping. */
+            wait = stats_page_publish (1, 0);
+            if (wait) {
+                hev_task_sleep (wait < TCP_TMR_INTERVAL ? wait : TCP_TMR_INTERVAL);
+                continue;
+            }
+
+            timer_idle = 1;
+            hev_task_yield (HEV_TASK_WAITIO);
+            timer_idle = 0;
+            continue;
+        }
+
+        hev_task_sleep (TCP_TMR_INTERVAL);
         tcp_tmr ();
 
-        if ((i & 3) == 0) {
+        if ((i++ & 3) == 0) {
 #if IP_REASSEMBLY
             ip_reass_tmr ();
 #endif
@@ -469,20 +1441,63 @@ lwip_timer_task_entry (void *data)
 #endif
 #endif
         }
-        hev_task_mutex_unlock (&mutex);
+        egress_flush ();
+        stats_page_publish (1, 0);
+    }
+}
 
-        if (hev_list_first (&session_set))
-            hev_task_sleep (TCP_TMR_INTERVAL);
-        else
-            hev_task_yield (HEV_TASK_WAITIO);
+static int
+workers_init (int extern_tun_fd)
+{
+    HevSocks5TunnelWorker *list;
+    int count, i;
+
+    count = hev_config_get_tunnel_workers ();
+#if !defined(__linux__)
+    count = 1;
+#endif
+    if (extern_tun_fd >= 0 && count > 1) {
+        LOG_W ("socks5 tunnel workers need a local interface");
+        count = 1;
+    }
+
+    list = hev_malloc0 (sizeof (HevSocks5TunnelWorker) * count);
+    if (!list) {
+        LOG_E ("socks5 tunnel workers");
+        return -1;
     }
+
+    for (i = 0; i < count; i++) {
+        list[i].tun_fd = -1;
+        list[i].next_tun_fd = -1;
+        list[i].event_fds[0] = -1;
+        list[i].event_fds[1] = -1;
+    }
+
+    worker_count = count;
+    WRITE_ONCE (workers, list);
+
+    return 0;
+}
+
+static void
+workers_fini (void)
+{
+    HevSocks5TunnelWorker *list = workers;
+
+    if (!list)
+        return;
+
+    WRITE_ONCE (workers, NULL);
+    worker_count = 0;
+    hev_free (list);
 }
 
 static int
 tunnel_init (int extern_tun_fd)
 {
     const char *script_path, *name, *ipv4, *ipv6;
-    int multi_queue, res;
+    int multi_queue, res, i;
     unsigned int mtu;
 
     if (extern_tun_fd >= 0) {
@@ -494,17 +1509,34 @@ tunnel_init (int extern_tun_fd)
             return -1;
         }
 
-        tun_fd = extern_tun_fd;
+        workers[0].tun_fd = extern_tun_fd;
         return 0;
     }
 
     name = hev_config_get_tunnel_name ();
-    multi_queue = hev_config_get_tunnel_multi_queue ();
-    tun_fd = hev_tunnel_open (name, multi_queue);
-    if (tun_fd < 0) {
+    multi_queue = hev_config_get_tunnel_multi_queue () || worker_count > 1;
+#if defined(__linux__)
+    hev_tunnel_set_offload (hev_config_get_tunnel_offload ());
+#endif
+    workers[0].tun_fd = hev_tunnel_open (name, multi_queue);
+    if (workers[0].tun_fd < 0) {
         LOG_E ("socks5 tunnel open (%s)", strerror (errno));
         return -1;
     }
+#if defined(__linux__)
+    if (hev_config_get_tunnel_offload () && !hev_tunnel_get_offload ())
+        LOG_W ("socks5 tunnel offload unsupported, disabled");
+#endif
+    tun_fd_local = 1;
+
+    /* Attach the other queues to the interface created above. */
+    for (i = 1; i < worker_count; i++) {
+        workers[i].tun_fd = hev_tunnel_open (hev_tunnel_get_name (), 1);
+        if (workers[i].tun_fd < 0) {
+            LOG_E ("socks5 tunnel open queue %d (%s)", i, strerror (errno));
+            return -1;
+        }
+    }
 
     mtu = hev_config_get_tunnel_mtu ();
     res = hev_tunnel_set_mtu (mtu);
@@ -542,7 +1574,6 @@ tunnel_init (int extern_tun_fd)
         hev_exec_run (script_path, hev_tunnel_get_name (),
                       hev_tunnel_get_index (), 0);
 
-    tun_fd_local = 1;
     return 0;
 }
 
@@ -550,6 +1581,7 @@ static void
 tunnel_fini (void)
 {
     const char *script_path;
+    int i;
 
     if (!tun_fd_local)
         return;
@@ -559,9 +1591,15 @@ tunnel_fini (void)
         hev_exec_run (script_path, hev_tunnel_get_name (),
                       hev_tunnel_get_index (), 1);
 
-    hev_tunnel_close (tun_fd);
+    for (i = 0; i < worker_count; i++) {
+        if (workers[i].tun_fd >= 0)
+            hev_tunnel_close (workers[i].tun_fd);
+        workers[i].tun_fd = -1;
+    }
+#if defined(__linux__)
+    hev_tunnel_set_offload (0);
+#endif
     tun_fd_local = 0;
-    tun_fd = -1;
 }
 
 static int
@@ -605,26 +1643,58 @@ gateway_fini (void)
     udp_remove (udp);
     tcp_close (tcp);
     netif_remove (&netif);
+    udp = NULL;
+    tcp = NULL;
 }
 
 static int
-event_task_init (void)
+event_init (void)
 {
-    int nonblock = 1;
-    int res;
+    int i;
 
-    res = socketpair (PF_LOCAL, SOCK_STREAM, 0, event_fds);
-    if (res < 0) {
-        LOG_E ("socks5 tunnel event");
-        return -1;
+    for (i = 0; i < worker_count; i++) {
+        HevSocks5TunnelWorker *w = &workers[i];
+        int nonblock = 1;
+        int res;
+
+        res = socketpair (PF_LOCAL, SOCK_STREAM, 0, w->event_fds);
+        if (res < 0) {
+            LOG_E ("socks5 tunnel event");
+            return -1;
+        }
+
+        res = ioctl (w->event_fds[0], FIONBIO, (char *)&nonblock);
+        if (res < 0) {
+            LOG_E ("socks5 tunnel event nonblock");
+            return -1;
+        }
     }
 
-    res = ioctl (event_fds[0], FIONBIO, (char *)&nonblock);
-    if (res < 0) {
-        LOG_E ("socks5 tunnel event nonblock");
-        return -1;
+    return 0;
+}
+
+static void
+event_fini (void)
+{
+    int i;
+
+    for (i = 0; i < worker_count; i++) {
+        HevSocks5TunnelWorker *w = &workers[i];
+
+        if (w->event_fds[0] >= 0) {
+            close (w->event_fds[0]);
+            w->event_fds[0] = -1;
+        }
+        if (w->event_fds[1] >= 0) {
+            close (w->event_fds[1]);
+            w->event_fds[1] = -1;
+        }
     }
+}
 
+static int
+event_task_init (void)
+{
     task_event = hev_task_new (-1);
     if (!task_event) {
         LOG_E ("socks5 tunnel task event");
@@ -641,15 +1711,6 @@ event_task_fini (void)
         hev_task_unref (task_event);
         task_event = NULL;
     }
-
-    if (event_fds[0] >= 0) {
-        close (event_fds[0]);
-        event_fds[0] = -1;
-    }
-    if (event_fds[1] >= 0) {
-        close (event_fds[1]);
-        event_fds[1] = -1;
-    }
 }
 
 static int
@@ -661,6 +1722,7 @@ lwip_io_task_init (void)
         return -1;
     }
     hev_task_set_priority (task_lwip_io, 1);
+    hev_task_set_class (task_lwip_io, TASK_CLASS_LWIP_IO);
 
     return 0;
 }
@@ -683,6 +1745,7 @@ lwip_timer_task_init (void)
         return -1;
     }
     hev_task_set_priority (task_lwip_timer, 1);
+    hev_task_set_class (task_lwip_timer, TASK_CLASS_LWIP_TIMER);
 
     return 0;
 }
@@ -699,6 +1762,8 @@ lwip_timer_task_fini (void)
 static int
 mapped_dns_init (void)
 {
+    const unsigned char *network6;
+    const char *cache_file;
     HevMappedDNS *dns;
     int cache_size;
     int network;
@@ -715,6 +1780,18 @@ mapped_dns_init (void)
     if (!dns)
         return -1;
 
+    network6 = hev_config_get_mapdns_network6 ();
+    if (network6)
+        hev_mapped_dns_set_network6 (dns, network6);
+    if (hev_config_get_mapdns_prefetch ())
+        hev_mapped_dns_set_prefetch (dns, hev_socks5_prefetch_name);
+
+    /* Names keep their addresses across restarts, apps may cache them. */
+    cache_file = hev_config_get_mapdns_cache_file ();
+    if (cache_file)
+        hev_mapped_dns_load (dns, cache_file);
+    mapdns_saved = sys_now ();
+
     hev_mapped_dns_put (dns);
 
     return 0;
@@ -727,11 +1804,109 @@ mapped_dns_fini (void)
 
     dns = hev_mapped_dns_get ();
     if (dns) {
+        mapped_dns_save (dns, 1);
         hev_object_unref (HEV_OBJECT (dns));
         hev_mapped_dns_put (NULL);
     }
 }
 
+static int
+worker_init (HevSocks5TunnelWorker *self)
+{
+    int res;
+
+    worker = self;
+    tun_fd = self->tun_fd;
+    session_stacks_init ();
+
+    res = gateway_init ();
+    if (res < 0)
+        return -1;
+
+    res = event_task_init ();
+    if (res < 0)
+        return -1;
+
+    res = lwip_io_task_init ();
+    if (res < 0)
+        return -1;
+
+    res = lwip_timer_task_init ();
+    if (res < 0)
+        return -1;
+
+    return 0;
+}
+
+static void
+worker_fini (void)
+{
+    lwip_timer_task_fini ();
+    lwip_io_task_fini ();
+    event_task_fini ();
+    gateway_fini ();
+    hev_pbuf_pool_clear ();
+    hev_socks5_session_udp_slots_clear ();
+
+    tun_fd = -1;
+    worker = NULL;
+}
+
+static void
+worker_run (void)
+{
+    task_event = hev_task_ref (task_event);
+    hev_task_run (task_event, event_task_entry, NULL);
+
+    task_lwip_io = hev_task_ref (task_lwip_io);
+    hev_task_run (task_lwip_io, lwip_io_task_entry, NULL);
+
+    task_lwip_timer = hev_task_ref (task_lwip_timer);
+    hev_task_run (task_lwip_timer, lwip_timer_task_entry, NULL);
+
+    client_pool_init ();
+
+    run = 1;
+    hev_task_system_run ();
+}
+
+static void *
+worker_thread_entry (void *data)
+{
+    HevSocks5TunnelWorker *self = data;
+    int res;
+
+    res = hev_task_system_init ();
+    if (res < 0) {
+        LOG_E ("socks5 tunnel worker task system");
+        goto exit;
+    }
+
+    hev_task_system_set_timer_slack (hev_config_get_misc_timer_slack ());
+    hev_thread_place (hev_config_get_misc_thread_cpus (),
+                      hev_config_get_misc_thread_nice (),
+                      hev_config_get_misc_thread_util_min ());
+
+    lwip_init ();
+
+    res = worker_init (self);
+    if (res == 0)
+        worker_run ();
+    else
+        LOG_E ("socks5 tunnel worker init");
+
+    worker_fini ();
+    hev_task_system_fini ();
+
+exit:
+    if (res < 0) {
+        /* Detach the queue so the kernel stops steering flows to it. */
+        hev_tunnel_close (self->tun_fd);
+        self->tun_fd = -1;
+    }
+    return NULL;
+}
+
 int
 hev_socks5_tunnel_init (int tun_fd)
 {
@@ -739,34 +1914,38 @@ hev_socks5_tunnel_init (int tun_fd)
 
     LOG_D ("socks5 tunnel init");
 
+    res = workers_init (tun_fd);
+    if (res < 0)
+        goto exit;
+
     res = tunnel_init (tun_fd);
     if (res < 0)
         goto exit;
 
-    res = gateway_init ();
+    res = event_init ();
     if (res < 0)
         goto exit;
 
-    res = event_task_init ();
+    res = mapped_dns_init ();
     if (res < 0)
         goto exit;
 
-    res = lwip_io_task_init ();
+    res = hev_packet_filter_init ();
     if (res < 0)
         goto exit;
 
-    res = lwip_timer_task_init ();
+    res = hev_bypass_init ();
     if (res < 0)
         goto exit;
 
-    res = mapped_dns_init ();
+    hev_socks5_session_rate_init ();
+
+    res = worker_init (&workers[0]);
     if (res < 0)
         goto exit;
 
     signal (SIGPIPE, SIG_IGN);
 
-    hev_task_mutex_init (&mutex);
-
     return 0;
 
 exit:
@@ -779,36 +1958,52 @@ hev_socks5_tunnel_fini (void)
 {
     LOG_D ("socks5 tunnel fini");
 
+    worker_fini ();
+    hev_bypass_fini ();
+    hev_packet_filter_fini ();
     mapped_dns_fini ();
-    lwip_timer_task_fini ();
-    lwip_io_task_fini ();
-    event_task_fini ();
-    gateway_fini ();
-    tunnel_fini ();
 
-    stat_tx_packets = 0;
-    stat_rx_packets = 0;
-    stat_tx_bytes = 0;
-    stat_rx_bytes = 0;
+    if (workers) {
+        event_fini ();
+        tunnel_fini ();
+        workers_fini ();
+    }
+
     reject_quic = 1;
+    provider = NULL;
+    trace_provider = NULL;
+    datagram_provider = NULL;
 }
 
 int
 hev_socks5_tunnel_run (void)
 {
+    int i, res;
+
     LOG_D ("socks5 tunnel run");
 
-    task_event = hev_task_ref (task_event);
-    hev_task_run (task_event, event_task_entry, NULL);
+    for (i = 1; i < worker_count; i++) {
+        HevSocks5TunnelWorker *w = &workers[i];
 
-    task_lwip_io = hev_task_ref (task_lwip_io);
-    hev_task_run (task_lwip_io, lwip_io_task_entry, NULL);
+        res = pthread_create (&w->thread, NULL, worker_thread_entry, w);
+        if (res != 0) {
+            LOG_E ("socks5 tunnel worker thread");
+            hev_tunnel_close (w->tun_fd);
+            w->tun_fd = -1;
+            continue;
+        }
+        w->started = 1;
+    }
 
-    task_lwip_timer = hev_task_ref (task_lwip_timer);
-    hev_task_run (task_lwip_timer, lwip_timer_task_entry, NULL);
+    stats_page_publish (1, 1);
+    worker_run ();
 
-    run = 1;
-    hev_task_system_run ();
+    for (i = 1; i < worker_count; i++) {
+        if (workers[i].started)
+            pthread_join (workers[i].thread, NULL);
+        workers[i].started = 0;
+    }
+    stats_page_publish (0, 1);
 
     return 0;
 }
@@ -816,21 +2011,106 @@ hev_socks5_tunnel_run (void)
 void
 hev_socks5_tunnel_stop (void)
 {
-    int res;
-    int fd;
+    HevSocks5TunnelWorker *list;
+    int i;
 
     LOG_D ("socks5 tunnel stop");
 
     for (;;) {
-        fd = READ_ONCE (event_fds[1]);
-        if (fd >= 0)
+        list = READ_ONCE (workers);
+        if (list && READ_ONCE (list[worker_count - 1].event_fds[1]) >= 0)
             break;
         /* Wait for async initialization */
         usleep (100 * 1000);
     }
 
-    res = write (fd, &res, 1);
-    assert (res > 0 && "socks5 tunnel write event");
+    for (i = 0; i < worker_count; i++) {
+        unsigned char cmd = EVENT_QUIT;
+        int res;
+
+        res = write (list[i].event_fds[1], &cmd, 1);
+        assert (res > 0 && "socks5 tunnel write event");
+    }
+}
+
+int
+hev_socks5_tunnel_replace_fd (int fd)
+{
+    HevSocks5TunnelWorker *list;
+    unsigned char cmd = EVENT_REPLACE_FD;
+    struct pollfd pfd;
+    int nonblock = 1;
+    int expected = fd;
+    int res = -1;
+
+    LOG_D ("socks5 tunnel replace fd");
+
+    list = READ_ONCE (workers);
+    if (fd < 0 || !list || tun_fd_local || worker_count != 1 ||
+        READ_ONCE (list[0].event_fds[1]) < 0)
+        return -1;
+
+    if (ioctl (fd, FIONBIO, (char *)&nonblock) < 0) {
+        LOG_E ("socks5 tunnel replace fd non-blocking");
+        return -1;
+    }
+
+    pfd.fd = list[0].event_fds[1];
+    pfd.events = POLLIN;
+
+    pthread_mutex_lock (&replace_mutex);
+    __atomic_store_n (&list[0].next_tun_fd, fd, __ATOMIC_RELEASE);
+    /* The old fd stays in use until the worker acks the switch. */
+    if ((write (pfd.fd, &cmd, 1) == 1) && (poll (&pfd, 1, 1000) == 1))
+        res = 0;
+    /* Cancel, unless the worker already claimed the fd and is switching. */
+    else if (!__atomic_compare_exchange_n (&list[0].next_tun_fd, &expected,
+                                           -1, 0, __ATOMIC_ACQ_REL,
+                                           __ATOMIC_ACQUIRE))
+        res = 0;
+    if ((res == 0) && (read (pfd.fd, &cmd, 1) != 1))
+        LOG_W ("socks5 tunnel replace fd ack");
+    pthread_mutex_unlock (&replace_mutex);
+
+    return res;
+}
+
+int
+hev_socks5_tunnel_reload (void)
+{
+    HevSocks5TunnelWorker *list;
+    unsigned char cmd = EVENT_RELOAD;
+    int res = 0;
+    int i;
+
+    LOG_D ("socks5 tunnel reload");
+
+    list = READ_ONCE (workers);
+    if (!list || READ_ONCE (list[worker_count - 1].event_fds[1]) < 0)
+        return -1;
+
+    for (i = 0; i < worker_count; i++)
+        if (write (list[i].event_fds[1], &cmd, 1) != 1)
+            res = -1;
+
+    return res;
+}
+
+void
+hev_socks5_tunnel_flush (void)
+{
+    egress_flush ();
+}
+
+void
+hev_socks5_tunnel_kick_timer (void)
+{
+    /* Cheap enough to call after every use of lwIP. */
+    if (!timer_idle)
+        return;
+
+    timer_idle = 0;
+    hev_task_wakeup (task_lwip_timer);
 }
 
 void
@@ -839,21 +2119,304 @@ hev_socks5_tunnel_set_reject_quic (int enabled)
     reject_quic = enabled;
 }
 
+void
+hev_socks5_tunnel_set_provider (HevSocks5TunnelProvider open, void *data,
+                                const char *user, const char *pass)
+{
+    provider = open;
+    provider_data = data;
+
+    /* socks5 carries at most 255 bytes of either. */
+    provider_user[0] = '\0';
+    provider_pass[0] = '\0';
+    if (user && pass) {
+        strncpy (provider_user, user, sizeof (provider_user) - 1);
+        strncpy (provider_pass, pass, sizeof (provider_pass) - 1);
+    }
+}
+
+HevSocks5TunnelProvider
+hev_socks5_tunnel_get_provider (void **data, const char **user,
+                                const char **pass)
+{
+    *data = provider_data;
+    *user = provider_user[0] ? provider_user : NULL;
+    *pass = provider_user[0] ? provider_pass : NULL;
+
+    return provider;
+}
+
+void
+hev_socks5_tunnel_set_trace_provider (HevSocks5TunnelTraceProvider open)
+{
+    trace_provider = open;
+}
+
+HevSocks5TunnelTraceProvider
+hev_socks5_tunnel_get_trace_provider (void)
+{
+    return trace_provider;
+}
+
+void
+hev_socks5_tunnel_set_datagram_provider (HevSocks5TunnelProvider open,
+                                         void *data)
+{
+    datagram_provider = open;
+    datagram_provider_data = data;
+}
+
+HevSocks5TunnelProvider
+hev_socks5_tunnel_get_datagram_provider (void **data)
+{
+    *data = datagram_provider_data;
+
+    return datagram_provider;
+}
+
 void
 hev_socks5_tunnel_stats (size_t *tx_packets, size_t *tx_bytes,
                          size_t *rx_packets, size_t *rx_bytes)
 {
+    HevSocks5TunnelStats stats;
+
     LOG_D ("socks5 tunnel stats");
 
+    hev_socks5_tunnel_get_stats (&stats, sizeof (stats));
+
     if (tx_packets)
-        *tx_packets = stat_tx_packets;
+        *tx_packets = stats.tx_packets;
 
     if (tx_bytes)
-        *tx_bytes = stat_tx_bytes;
+        *tx_bytes = stats.tx_bytes;
 
     if (rx_packets)
-        *rx_packets = stat_rx_packets;
+        *rx_packets = stats.rx_packets;
 
     if (rx_bytes)
-        *rx_bytes = stat_rx_bytes;
+        *rx_bytes = stats.rx_bytes;
+}
+
+void
+hev_socks5_tunnel_fwd_stats (size_t *writevs, size_t *bytes)
+{
+    HevSocks5TunnelStats stats;
+
+    hev_socks5_tunnel_get_stats (&stats, sizeof (stats));
+
+    if (writevs)
+        *writevs = stats.fwd_writevs;
+
+    if (bytes)
+        *bytes = stats.fwd_bytes;
+}
+
+void
+hev_socks5_tunnel_session_stats (size_t *tcp_sessions, size_t *udp_sessions,
+                                 size_t *evictions)
+{
+    HevSocks5TunnelStats stats;
+
+    hev_socks5_tunnel_get_stats (&stats, sizeof (stats));
+
+    if (tcp_sessions)
+        *tcp_sessions = stats.tcp_sessions;
+
+    if (udp_sessions)
+        *udp_sessions = stats.udp_sessions;
+
+    if (evictions)
+        *evictions = stats.evictions;
+}
+
+int
+hev_socks5_tunnel_get_stats (HevSocks5TunnelStats *stats, size_t size)
+{
+    HevSocks5TunnelWorker *list = READ_ONCE (workers);
+    HevSocks5TunnelStats s = { 0 };
+    int i, j;
+
+    if (!stats || size < offsetof (HevSocks5TunnelStats, tx_packets))
+        return -1;
+
+    for (i = 0; list && i < worker_count; i++) {
+        HevSocks5TunnelWorker *w = &list[i];
+
+        s.tx_packets += STAT_GET (w, stat_tx_packets);
+        s.tx_bytes += STAT_GET (w, stat_tx_bytes);
+        s.rx_packets += STAT_GET (w, stat_rx_packets);
+        s.rx_bytes += STAT_GET (w, stat_rx_bytes);
+        s.fwd_writevs += STAT_GET (w, stat_fwd_writevs);
+        s.fwd_bytes += STAT_GET (w, stat_fwd_bytes);
+        s.tcp_sessions += STAT_GET (w, stat_sessions[SESSION_TCP]);
+        s.udp_sessions += STAT_GET (w, stat_sessions[SESSION_UDP]);
+        s.tcp_accepts += STAT_GET (w, stat_accepts[SESSION_TCP]);
+        s.udp_accepts += STAT_GET (w, stat_accepts[SESSION_UDP]);
+        s.evictions += STAT_GET (w, stat_evictions);
+        s.mem_evictions += STAT_GET (w, stat_mem_evictions);
+        s.quic_rejects += STAT_GET (w, stat_quic_rejects);
+        s.filter_drops += STAT_GET (w, stat_filter_drops);
+        s.connect_failures += STAT_GET (w, stat_connect_failures);
+        for (j = 0; j < LATENCY_BUCKETS; j++)
+            s.connect_latency[j] += STAT_GET (w, stat_connect_latency[j]);
+        s.tcp_pcbs += STAT_GET (w, stat_tcp_pcbs);
+        s.tcp_queued += STAT_GET (w, stat_tcp_queued);
+        s.udp_drops += STAT_GET (w, stat_udp_drops);
+        s.egress_flushes += STAT_GET (w, stat_egress_flushes);
+        s.connect_ipv4 += STAT_GET (w, stat_connect_family[0]);
+        s.connect_ipv4_msecs += STAT_GET (w, stat_connect_family_msecs[0]);
+        s.connect_ipv6 += STAT_GET (w, stat_connect_family[1]);
+        s.connect_ipv6_msecs += STAT_GET (w, stat_connect_family_msecs[1]);
+        s.connect_fallbacks += STAT_GET (w, stat_connect_fallbacks);
+        s.tcp_segs += STAT_GET (w, stat_tcp_segs);
+        s.udp_pcbs += STAT_GET (w, stat_udp_pcbs);
+        s.ref_pbufs += STAT_GET (w, stat_ref_pbufs);
+        s.pool_refusals += STAT_GET (w, stat_pool_refusals);
+        s.wakeups += STAT_GET (w, stat_wakeups);
+        s.reass_bytes += STAT_GET (w, stat_reass_bytes);
+        s.reass_drops += STAT_GET (w, stat_reass_drops);
+        for (j = 0; j < TASK_CLASSES_REPORTED; j++) {
+            s.task_run_time[j] += STAT_GET (w, stat_task_run_time[j]);
+            s.task_switches[j] += STAT_GET (w, stat_task_switches[j]);
+        }
+    }
+
+    s.mem_used = __atomic_load_n (&mem_used, __ATOMIC_RELAXED);
+
+    if (size > sizeof (s))
+        size = sizeof (s);
+
+    s.version = HEV_SOCKS5_TUNNEL_STATS_VERSION;
+    s.size = size;
+    memcpy (stats, &s, size);
+
+    return 0;
+}
+
+int
+hev_socks5_tunnel_set_stats_page (HevSocks5TunnelStatsPage *page,
+                                  size_t size, unsigned int interval)
+{
+    if (page && size < offsetof (HevSocks5TunnelStatsPage, stats.tx_packets))
+        return -1;
+
+    if (size > sizeof (HevSocks5TunnelStatsPage))
+        size = sizeof (HevSocks5TunnelStatsPage);
+
+    stats_page = page;
+    stats_page_size = size;
+    stats_page_interval = interval;
+
+    return 0;
+}
+
+size_t
+hev_socks5_tunnel_take_sessions (HevSocks5TunnelSession *sessions,
+                                 size_t count)
+{
+    size_t i;
+
+    pthread_mutex_lock (&records_mutex);
+    if (count > records_count)
+        count = records_count;
+    for (i = 0; i < count; i++) {
+        sessions[i] = records[records_head];
+        records_head = (records_head + 1) % SESSION_RECORDS;
+    }
+    records_count -= count;
+    pthread_mutex_unlock (&records_mutex);
+
+    return count;
+}
+
+void
+hev_socks5_tunnel_trace (uint64_t trace, int milestone)
+{
+    HevSocks5TunnelTraceEvent *e;
+    unsigned int head, tail;
+    struct timespec ts;
+
+    if (!trace || !worker)
+        return;
+
+    /* A full ring drops new events, the taken ones stay consistent. */
+    head = worker->trace_head;
+    tail = __atomic_load_n (&worker->trace_tail, __ATOMIC_ACQUIRE);
+    if ((head - tail) >= TRACE_EVENTS)
+        return;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    e = &worker->traces[head % TRACE_EVENTS];
+    e->trace = trace;
+    e->time = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    e->milestone = milestone;
+    e->reserved = 0;
+    __atomic_store_n (&worker->trace_head, head + 1, __ATOMIC_RELEASE);
+}
+
+size_t
+hev_socks5_tunnel_take_traces (HevSocks5TunnelTraceEvent *events,
+                               size_t count)
+{
+    HevSocks5TunnelWorker *list = READ_ONCE (workers);
+    size_t taken = 0;
+    int i;
+
+    pthread_mutex_lock (&traces_mutex);
+    for (i = 0; list && i < worker_count; i++) {
+        HevSocks5TunnelWorker *w = &list[i];
+        unsigned int head, tail;
+
+        head = __atomic_load_n (&w->trace_head, __ATOMIC_ACQUIRE);
+        tail = w->trace_tail;
+        for (; tail != head && taken < count; tail++)
+            events[taken++] = w->traces[tail % TRACE_EVENTS];
+        __atomic_store_n (&w->trace_tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock (&traces_mutex);
+
+    return taken;
+}
+
+void
+hev_socks5_tunnel_add_fwd_stats (size_t bytes)
+{
+    STAT_ADD (stat_fwd_writevs, 1);
+    STAT_ADD (stat_fwd_bytes, bytes);
+}
+
+void
+hev_socks5_tunnel_add_udp_drops (size_t count)
+{
+    STAT_ADD (stat_udp_drops, count);
+}
+
+void
+hev_socks5_tunnel_add_connect_stats (int msecs)
+{
+    static const int bounds[LATENCY_BUCKETS - 1] = {
+        10, 25, 50, 100, 250, 500, 1000,
+    };
+    int i;
+
+    if (msecs < 0) {
+        STAT_ADD (stat_connect_failures, 1);
+        return;
+    }
+
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+        if (msecs < bounds[i])
+            break;
+
+    STAT_ADD (stat_connect_latency[i], 1);
+}
+
+void
+hev_socks5_tunnel_add_family_stats (int ipv6, int msecs, int fallback)
+{
+    ipv6 = !!ipv6;
+    STAT_ADD (stat_connect_family[ipv6], 1);
+    STAT_ADD (stat_connect_family_msecs[ipv6], msecs);
+    if (fallback)
+        STAT_ADD (stat_connect_fallbacks, 1);
 }
@@ -10,19 +10,84 @@
 #ifndef __HEV_SOCKS5_TUNNEL_H__
 #define __HEV_SOCKS5_TUNNEL_H__
 
+#include <sys/types.h>
+
 #include "hev-list.h"
+#include "hev-main.h"
 
 int hev_socks5_tunnel_init (int tun_fd);
 void hev_socks5_tunnel_fini (void);
 
 int hev_socks5_tunnel_run (void);
 void hev_socks5_tunnel_stop (void);
+int hev_socks5_tunnel_replace_fd (int fd);
+
+/*
+ * Has each worker pick up a reloaded config, see hev_config_reload_from_str.
+ * Sessions take the new one as they start, workers restart their client
+ * pool. Returns -1 when the tunnel is not running.
+ */
+int hev_socks5_tunnel_reload (void);
 
 void hev_socks5_tunnel_stats (size_t *tx_packets, size_t *tx_bytes,
                               size_t *rx_packets, size_t *rx_bytes);
+void hev_socks5_tunnel_fwd_stats (size_t *writevs, size_t *bytes);
+void hev_socks5_tunnel_session_stats (size_t *tcp_sessions,
+                                      size_t *udp_sessions,
+                                      size_t *evictions);
+void hev_socks5_tunnel_add_fwd_stats (size_t bytes);
+void hev_socks5_tunnel_add_connect_stats (int msecs);
+void hev_socks5_tunnel_add_family_stats (int ipv6, int msecs, int fallback);
+void hev_socks5_tunnel_add_udp_drops (size_t count);
 
 void hev_socks5_tunnel_set_reject_quic (int enabled);
 
+/*
+ * The stream provider set by hev_socks5_tunnel_set_provider, or NULL.
+ * user and pass are NULL when the provided streams need no auth.
+ */
+HevSocks5TunnelProvider hev_socks5_tunnel_get_provider (void **data,
+                                                        const char **user,
+                                                        const char **pass);
+
+/*
+ * The provider set by hev_socks5_tunnel_set_trace_provider, or NULL. It
+ * takes the data of the stream provider.
+ */
+HevSocks5TunnelTraceProvider hev_socks5_tunnel_get_trace_provider (void);
+
+/*
+ * The datagram provider set by hev_socks5_tunnel_set_datagram_provider, or
+ * NULL.
+ */
+HevSocks5TunnelProvider hev_socks5_tunnel_get_datagram_provider (void **data);
+
+/*
+ * Record that the session traced as trace reached milestone, a
+ * HevSocks5TunnelTraceMilestone. Does nothing for trace 0, sessions not
+ * sampled by misc.trace-sample.
+ */
+void hev_socks5_tunnel_trace (uint64_t trace, int milestone);
+
 void hev_socks5_tunnel_update_session (HevListNode *node);
+void hev_socks5_tunnel_delete_session (HevListNode *node);
+
+/*
+ * Sessions report the bytes they hold as the amount changes: queued pbufs,
+ * buffers and their task stack. A charge that takes all sessions over
+ * misc.memory-limit evicts sessions of this worker. The rest of a session's
+ * charge is returned once it is destructed.
+ */
+void hev_socks5_tunnel_charge (HevListNode *node, ssize_t size);
+
+/*
+ * Whether a session should give memory back rather than take more: while it
+ * holds more than misc.session-memory-limit, or all sessions hold more than
+ * 3/4 of misc.memory-limit.
+ */
+int hev_socks5_tunnel_mem_pressure (HevListNode *node);
+
+void hev_socks5_tunnel_flush (void);
+void hev_socks5_tunnel_kick_timer (void);
 
 #endif /* __HEV_SOCKS5_TUNNEL_H__ */
@@ -0,0 +1,189 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-upstream.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Upstream Balancer
+ ============================================================================
+ */
+
+#include <string.h>
+#include <lwip/sys.h>
+
+#include "hev-logger.h"
+#include "hev-config.h"
+#include "hev-config-const.h"
+
+#include "hev-socks5-upstream.h"
+
+#define HEALTH_FAILS (3)
+#define HEALTH_BACKOFF_MIN (1000)
+#define HEALTH_BACKOFF_MAX (30000)
+
+typedef struct _HevSocks5UpstreamState HevSocks5UpstreamState;
+
+struct _HevSocks5UpstreamState
+{
+    unsigned int sessions;
+    unsigned int fails;
+    unsigned int ewma; /* 1/8 ms */
+    u32_t retry;
+};
+
+static __thread HevSocks5UpstreamState states[UPSTREAMS_MAX];
+static __thread unsigned int states_id;
+static __thread unsigned int next;
+
+static u32_t
+hev_socks5_upstream_backoff (HevSocks5UpstreamState *self)
+{
+    unsigned int shift = self->fails - HEALTH_FAILS;
+
+    if (shift > 5)
+        return HEALTH_BACKOFF_MAX;
+    if ((HEALTH_BACKOFF_MIN << shift) > HEALTH_BACKOFF_MAX)
+        return HEALTH_BACKOFF_MAX;
+
+    return HEALTH_BACKOFF_MIN << shift;
+}
+
+static unsigned long long
+hev_socks5_upstream_cost (HevSocks5UpstreamState *self, int balance)
+{
+    switch (balance) {
+    case HEV_CONFIG_BALANCE_LEAST_SESSIONS:
+        return self->sessions;
+    case HEV_CONFIG_BALANCE_LATENCY:
+        /* Loaded fast upstreams lose to idle slower ones at some point. */
+        return (unsigned long long)self->ewma * (self->sessions + 1);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Whether states are those of live, starting over on the first session of
+ * a newer generation. The list behind the indexes may have changed.
+ */
+static int
+hev_socks5_upstream_sync (HevConfigLive *live)
+{
+    unsigned int id = hev_config_live_get_id (live);
+
+    if (id == states_id)
+        return 1;
+    if ((int)(id - states_id) < 0)
+        return 0;
+
+    memset (states, 0, sizeof (states));
+    states_id = id;
+    next = 0;
+
+    return 1;
+}
+
+int
+hev_socks5_upstream_get (HevConfigLive *live, unsigned int skip,
+                         const HevConfigUpstream **upstream)
+{
+    const HevConfigUpstream *list;
+    unsigned long long cost = 0;
+    HevConfigServer *srv;
+    int i, count, best = -1;
+    u32_t now;
+
+    list = hev_config_get_socks5_upstreams (live, &count);
+    srv = hev_config_get_socks5_server (live);
+
+    /* Sessions left from before a reload only spread over theirs. */
+    if (!hev_socks5_upstream_sync (live)) {
+        for (i = 0, best = 0; i < count; i++) {
+            best = (next + i) % count;
+            if (!(skip & (1U << best)))
+                break;
+        }
+        next++;
+        *upstream = &list[best];
+        return best;
+    }
+
+    now = sys_now ();
+
+    /* Scanned from a rotating start, so equal costs take turns. */
+    for (i = 0; i < count; i++) {
+        int j = (next + i) % count;
+        HevSocks5UpstreamState *s = &states[j];
+        unsigned long long c;
+
+        if (skip & (1U << j))
+            continue;
+        if ((s->fails >= HEALTH_FAILS) && ((s32_t)(now - s->retry) < 0))
+            continue;
+
+        c = hev_socks5_upstream_cost (s, srv->balance);
+        if ((best < 0) || (c < cost)) {
+            best = j;
+            cost = c;
+        }
+    }
+
+    /* All are down, the one due first is probed anyway. */
+    for (i = 0; (best < 0) && (i < count); i++)
+        if (!(skip & (1U << i)))
+            best = i;
+    for (; i < count; i++)
+        if (!(skip & (1U << i)) &&
+            ((s32_t)(states[i].retry - states[best].retry) < 0))
+            best = i;
+    if (best < 0)
+        best = 0;
+
+    /* A down upstream gets one probe per backoff period. */
+    if (states[best].fails >= HEALTH_FAILS)
+        states[best].retry = now + hev_socks5_upstream_backoff (&states[best]);
+
+    next = best + 1;
+    states[best].sessions++;
+    *upstream = &list[best];
+
+    return best;
+}
+
+void
+hev_socks5_upstream_put (HevConfigLive *live, int index)
+{
+    if (hev_config_live_get_id (live) == states_id)
+        states[index].sessions--;
+}
+
+void
+hev_socks5_upstream_report (HevConfigLive *live, int index, int msecs)
+{
+    HevSocks5UpstreamState *self = &states[index];
+
+    if (hev_config_live_get_id (live) != states_id)
+        return;
+
+    if (msecs < 0) {
+        /* A failure also counts as a slow sample for latency picks. */
+        self->ewma += HEALTH_BACKOFF_MIN - (self->ewma >> 3);
+        self->fails++;
+        if (self->fails < HEALTH_FAILS)
+            return;
+
+        if (self->fails == HEALTH_FAILS)
+            LOG_W ("socks5 upstream %d down", index);
+        self->retry = sys_now () + hev_socks5_upstream_backoff (self);
+        return;
+    }
+
+    if (self->fails >= HEALTH_FAILS)
+        LOG_I ("socks5 upstream %d up", index);
+    self->fails = 0;
+
+    /* EWMA with weight 1/8, the first sample seeds it. */
+    if (!self->ewma)
+        self->ewma = msecs << 3;
+    else
+        self->ewma += msecs - (self->ewma >> 3);
+}
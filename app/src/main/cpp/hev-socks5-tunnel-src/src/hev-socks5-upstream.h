@@ -0,0 +1,33 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-upstream.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Upstream Balancer
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_UPSTREAM_H__
+#define __HEV_SOCKS5_UPSTREAM_H__
+
+#include "hev-config.h"
+
+/*
+ * Picks an upstream of live for a new session by the socks5.balance policy
+ * and counts the session on it until hev_socks5_upstream_put. Upstreams
+ * whose bit is set in skip are passed over while others remain. State is
+ * per worker thread, so no locks and no sharing across workers. It follows
+ * the newest config generation seen; older ones get plain round robin and
+ * their puts and reports are dropped.
+ */
+int hev_socks5_upstream_get (HevConfigLive *live, unsigned int skip,
+                             const HevConfigUpstream **upstream);
+void hev_socks5_upstream_put (HevConfigLive *live, int index);
+
+/*
+ * Feeds the passive health score: msecs is the connect plus handshake
+ * time of a session, or -1 when the upstream could not be connected.
+ */
+void hev_socks5_upstream_report (HevConfigLive *live, int index, int msecs);
+
+#endif /* __HEV_SOCKS5_UPSTREAM_H__ */
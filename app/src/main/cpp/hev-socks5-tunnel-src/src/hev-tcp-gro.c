@@ -0,0 +1,217 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-gro.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TCP receive coalescing
+ ============================================================================
+ */
+
+#include <string.h>
+#include <netinet/in.h>
+
+#include "hev-tcp-gro.h"
+
+#define TCP_FLAG_PSH (0x08)
+#define TCP_FLAG_ACK (0x10)
+
+/* Flows a batch coalesces at once, the oldest run is closed past it. */
+#define GRO_FLOWS (8)
+#define GRO_MAX_LEN (65535)
+
+typedef struct _HevTCPGROFlow HevTCPGROFlow;
+
+struct _HevTCPGROFlow
+{
+    struct pbuf *head;
+    const HevPacketFilterInfo *info;
+    uint32_t next_seq;
+    uint16_t hdr_len;
+    uint16_t seg_size;
+    uint16_t last_size;
+};
+
+static inline uint32_t
+read_u32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * Header length of a plain data segment, or 0 for anything lwIP must see
+ * on its own: other flags, options in the IP header, fragments, no payload,
+ * or padding past the IP length.
+ */
+static unsigned int
+tcp_gro_parse (struct pbuf *buf, const HevPacketFilterInfo *info)
+{
+    const uint8_t *h = buf->payload;
+    unsigned int ihl = info->hdr_len;
+    unsigned int ip_len, thl;
+
+    if (info->proto != IPPROTO_TCP || (info->flags & HEV_PACKET_FILTER_FRAGMENT))
+        return 0;
+    if (buf->next || buf->len < ihl + 20)
+        return 0;
+
+    switch (info->family) {
+    case 4:
+        if (ihl != 20)
+            return 0;
+        ip_len = (h[2] << 8) | h[3];
+        break;
+    case 6:
+        if (ihl != 40)
+            return 0;
+        ip_len = 40 + ((h[4] << 8) | h[5]);
+        break;
+    default:
+        return 0;
+    }
+
+    thl = (h[ihl + 12] >> 4) * 4;
+    if (thl < 20 || ip_len != buf->len || ip_len <= ihl + thl)
+        return 0;
+
+    if ((h[ihl + 13] & ~TCP_FLAG_PSH) != TCP_FLAG_ACK)
+        return 0;
+
+    return ihl + thl;
+}
+
+static int
+tcp_gro_same_flow (const HevPacketFilterInfo *a, const HevPacketFilterInfo *b)
+{
+    return a->family == b->family && a->sport == b->sport &&
+           a->dport == b->dport && !memcmp (a->saddr, b->saddr, 32);
+}
+
+static int
+tcp_gro_mergeable (HevTCPGROFlow *flow, const uint8_t *h, unsigned int hdr_len,
+                   unsigned int size, uint32_t seq)
+{
+    const uint8_t *g = flow->head->payload;
+    unsigned int ihl = flow->info->hdr_len;
+    const uint8_t *t = h + ihl;
+    const uint8_t *u = g + ihl;
+
+    if (flow->hdr_len != hdr_len || flow->next_seq != seq)
+        return 0;
+
+    /* Only full segments are followed, and nothing follows a push. */
+    if (flow->last_size != flow->seg_size || size > flow->seg_size ||
+        (u[13] & TCP_FLAG_PSH))
+        return 0;
+
+    if (flow->head->tot_len + size > GRO_MAX_LEN)
+        return 0;
+
+    if (ihl == 20) {
+        if (h[1] != g[1] || h[8] != g[8])
+            return 0;
+    } else {
+        if (memcmp (h, g, 4) || h[7] != g[7])
+            return 0;
+    }
+
+    /* Ack, window and options must all match. */
+    if (memcmp (t + 8, u + 8, 4) || memcmp (t + 14, u + 14, 2) ||
+        memcmp (t + 20, u + 20, hdr_len - ihl - 20))
+        return 0;
+
+    return 1;
+}
+
+static void
+tcp_gro_append (HevTCPGROFlow *flow, struct pbuf *buf, unsigned int size)
+{
+    uint8_t *g = flow->head->payload;
+    const uint8_t *h = buf->payload;
+    unsigned int ihl = flow->info->hdr_len;
+    unsigned int len;
+
+    g[ihl + 13] |= h[ihl + 13] & TCP_FLAG_PSH;
+
+    pbuf_remove_header (buf, flow->hdr_len);
+    pbuf_cat (flow->head, buf);
+
+    /* lwIP checks no checksums, so only the lengths need to agree. */
+    len = flow->head->tot_len;
+    if (ihl == 20) {
+        g[2] = len >> 8;
+        g[3] = len;
+    } else {
+        len -= 40;
+        g[4] = len >> 8;
+        g[5] = len;
+    }
+
+    flow->next_seq += size;
+    flow->last_size = size;
+}
+
+int
+hev_tcp_gro_merge (struct pbuf **bufs, const HevPacketFilterInfo *infos,
+                   int num)
+{
+    HevTCPGROFlow flows[GRO_FLOWS];
+    unsigned int nflows = 0;
+    unsigned int evict = 0;
+    int merged = 0;
+    int i;
+
+    for (i = 0; i < num; i++) {
+        const HevPacketFilterInfo *info = &infos[i];
+        struct pbuf *buf = bufs[i];
+        HevTCPGROFlow *flow = NULL;
+        unsigned int hdr_len, size, j;
+        const uint8_t *h;
+        uint32_t seq;
+
+        if (!buf || info->proto != IPPROTO_TCP)
+            continue;
+
+        for (j = 0; j < nflows; j++) {
+            if (tcp_gro_same_flow (flows[j].info, info)) {
+                flow = &flows[j];
+                break;
+            }
+        }
+
+        hdr_len = tcp_gro_parse (buf, info);
+        if (!hdr_len) {
+            /* Later segments must not overtake this one. */
+            if (flow)
+                flows[j] = flows[--nflows];
+            continue;
+        }
+
+        h = buf->payload;
+        size = buf->tot_len - hdr_len;
+        seq = read_u32 (h + info->hdr_len + 4);
+
+        if (flow && tcp_gro_mergeable (flow, h, hdr_len, size, seq)) {
+            tcp_gro_append (flow, buf, size);
+            bufs[i] = NULL;
+            merged++;
+            continue;
+        }
+
+        if (!flow) {
+            if (nflows < GRO_FLOWS)
+                flow = &flows[nflows++];
+            else
+                flow = &flows[evict++ % GRO_FLOWS];
+        }
+
+        flow->head = buf;
+        flow->info = info;
+        flow->next_seq = seq + size;
+        flow->hdr_len = hdr_len;
+        flow->seg_size = size;
+        flow->last_size = size;
+    }
+
+    return merged;
+}
@@ -0,0 +1,33 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-gro.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TCP receive coalescing
+ ============================================================================
+ */
+
+#ifndef __HEV_TCP_GRO_H__
+#define __HEV_TCP_GRO_H__
+
+#include <lwip/pbuf.h>
+
+#include "hev-packet-filter.h"
+
+/*
+ * Coalesce the in-order data segments of each TCP flow in a read batch,
+ * so lwIP takes one input and makes one recv callback per run instead of
+ * one per packet. A segment joins the previous one of its flow when it
+ * carries only ACK or PSH, starts where that one ends and matches it in
+ * ack, window and options, as in kernel GRO. A run ends at PSH, at a short
+ * segment, or at 64 KiB.
+ *
+ * NULL entries, such as packets already consumed by the filter, are
+ * skipped. Joined segments are chained onto the first of their run, whose
+ * IP length is updated, and their entries set to NULL. Returns how many
+ * segments were joined.
+ */
+int hev_tcp_gro_merge (struct pbuf **bufs, const HevPacketFilterInfo *infos,
+                       int num);
+
+#endif /* __HEV_TCP_GRO_H__ */
@@ -23,13 +23,38 @@
 #include <netinet/in.h>
 #include <linux/ipv6.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 
 #include "hev-tunnel.h"
+#include "hev-checksum.h"
+
+#define VNET_PKT_SIZE (65535)
+#define VNET_HDR_PEEK (120)
+
+#define TCP_FLAG_PSH (0x08)
+#define TCP_FLAG_ACK (0x10)
+
+typedef struct _HevTunnelGSO HevTunnelGSO;
+
+struct _HevTunnelGSO
+{
+    size_t len;
+    unsigned int iphdr_len;
+    unsigned int hdr_len;
+    unsigned int seg_size;
+    unsigned int last_size;
+    unsigned int segs;
+    uint32_t next_seq;
+
+    uint8_t data[VNET_PKT_SIZE];
+};
 
 static char tun_name[IFNAMSIZ];
+static int tun_offload;
+static __thread HevTunnelGSO gso;
 
 int
 hev_tunnel_open (const char *name, int multi_queue)
@@ -45,6 +70,8 @@ hev_tunnel_open (const char *name, int multi_queue)
     ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
     if (multi_queue)
         ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    if (tun_offload)
+        ifr.ifr_flags |= IFF_VNET_HDR;
     if (name)
         strncpy (ifr.ifr_name, name, IFNAMSIZ - 1);
 
@@ -52,6 +79,23 @@ hev_tunnel_open (const char *name, int multi_queue)
     if (res < 0)
         goto exit_close;
 
+    if (tun_offload) {
+        unsigned int flags = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+        int size = sizeof (struct virtio_net_hdr);
+
+        res = ioctl (fd, TUNSETVNETHDRSZ, &size);
+        if (res < 0)
+            goto exit_close;
+
+        /* Without TSO the vnet headers buy nothing: reopen without them. */
+        res = ioctl (fd, TUNSETOFFLOAD, flags);
+        if (res < 0) {
+            close (fd);
+            tun_offload = 0;
+            return hev_tunnel_open (name, multi_queue);
+        }
+    }
+
     memcpy (tun_name, ifr.ifr_name, IFNAMSIZ);
     return fd;
 
@@ -198,6 +242,265 @@ hev_tunnel_get_index (void)
     return tun_index;
 }
 
+void
+hev_tunnel_set_offload (int enabled)
+{
+    tun_offload = !!enabled;
+    gso.len = 0;
+}
+
+int
+hev_tunnel_get_offload (void)
+{
+    return tun_offload;
+}
+
+struct pbuf *
+hev_tunnel_read_offload (int fd, HevTaskIOYielder yielder, void *yielder_data)
+{
+    static __thread uint8_t data[VNET_PKT_SIZE];
+    struct virtio_net_hdr hdr;
+    struct iovec iov[2];
+    struct pbuf *buf;
+    ssize_t s;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof (hdr);
+    iov[1].iov_base = data;
+    iov[1].iov_len = sizeof (data);
+
+    s = hev_task_io_readv (fd, iov, 2, yielder, yielder_data);
+    if (s <= (ssize_t)sizeof (hdr))
+        return NULL;
+
+    /*
+     * GSO super-packets carry a valid total length in the IP header and
+     * are handed to lwIP as one large segment. Partial checksums are
+     * fine since lwIP does not verify them.
+     */
+    s -= sizeof (hdr);
+    buf = pbuf_alloc (PBUF_RAW, s, PBUF_RAM);
+    if (!buf)
+        return NULL;
+
+    memcpy (buf->payload, data, s);
+
+    return buf;
+}
+
+static int
+vnet_tcp_parse (const uint8_t *h, size_t hlen, size_t len,
+                unsigned int *iphdr_len, unsigned int *hdr_len)
+{
+    unsigned int ihl, thl;
+
+    if (hlen < 20)
+        return -1;
+
+    switch (h[0] >> 4) {
+    case 4:
+        ihl = (h[0] & 0x0F) * 4;
+        if (ihl != 20 || h[9] != IPPROTO_TCP)
+            return -1;
+        if ((h[6] & 0x3F) || h[7])
+            return -1;
+        break;
+    case 6:
+        ihl = 40;
+        if (h[6] != IPPROTO_TCP)
+            return -1;
+        break;
+    default:
+        return -1;
+    }
+
+    if (hlen < ihl + 20)
+        return -1;
+
+    thl = (h[ihl + 12] >> 4) * 4;
+    if (thl < 20 || hlen < ihl + thl || len <= ihl + thl)
+        return -1;
+
+    /* Only plain data segments are worth coalescing. */
+    if ((h[ihl + 13] & ~TCP_FLAG_PSH) != TCP_FLAG_ACK)
+        return -1;
+
+    *iphdr_len = ihl;
+    *hdr_len = ihl + thl;
+
+    return 0;
+}
+
+static int
+vnet_tcp_mergeable (const uint8_t *h, unsigned int iphdr_len,
+                    unsigned int hdr_len, unsigned int size, uint32_t seq)
+{
+    const uint8_t *g = gso.data;
+    const uint8_t *t = h + iphdr_len;
+    const uint8_t *u = g + iphdr_len;
+
+    if (gso.iphdr_len != iphdr_len || gso.hdr_len != hdr_len)
+        return 0;
+
+    if (gso.next_seq != seq || size > gso.seg_size ||
+        gso.last_size != gso.seg_size || gso.len + size > VNET_PKT_SIZE)
+        return 0;
+
+    if (iphdr_len == 20) {
+        if (h[1] != g[1] || h[8] != g[8] || memcmp (h + 12, g + 12, 8))
+            return 0;
+    } else {
+        if (memcmp (h, g, 4) || h[7] != g[7] || memcmp (h + 8, g + 8, 32))
+            return 0;
+    }
+
+    /* Ports, ack, window and options must all match. */
+    if (memcmp (t, u, 4) || memcmp (t + 8, u + 8, 4) ||
+        memcmp (t + 14, u + 14, 2) ||
+        memcmp (t + 20, u + 20, hdr_len - iphdr_len - 20))
+        return 0;
+
+    return 1;
+}
+
+static ssize_t
+vnet_write (int fd, struct pbuf *buf)
+{
+    struct virtio_net_hdr hdr = { 0 };
+    struct iovec iov[512];
+    struct pbuf *p = buf;
+    ssize_t res;
+    int i;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof (hdr);
+
+    for (i = 1; p && (i < 512); p = p->next) {
+        iov[i].iov_base = p->payload;
+        iov[i].iov_len = p->len;
+        i++;
+    }
+
+    res = writev (fd, iov, i);
+    if (res <= (ssize_t)sizeof (hdr))
+        return -1;
+
+    return res - sizeof (hdr);
+}
+
+ssize_t
+hev_tunnel_write_offload (int fd, struct pbuf *buf)
+{
+    unsigned int iphdr_len, hdr_len, size;
+    uint8_t h[VNET_HDR_PEEK];
+    size_t hlen, len;
+    uint32_t seq;
+    uint8_t *t;
+
+    len = buf->tot_len;
+    hlen = pbuf_copy_partial (buf, h, sizeof (h), 0);
+    if (vnet_tcp_parse (h, hlen, len, &iphdr_len, &hdr_len) < 0) {
+        if (hev_tunnel_flush_offload (fd) < 0)
+            return -1;
+        return vnet_write (fd, buf);
+    }
+
+    t = h + iphdr_len;
+    size = len - hdr_len;
+    seq = ((uint32_t)t[4] << 24) | ((uint32_t)t[5] << 16) |
+          ((uint32_t)t[6] << 8) | t[7];
+
+    if (gso.len && vnet_tcp_mergeable (h, iphdr_len, hdr_len, size, seq)) {
+        pbuf_copy_partial (buf, gso.data + gso.len, size, hdr_len);
+        gso.len += size;
+        gso.segs++;
+    } else {
+        if (hev_tunnel_flush_offload (fd) < 0)
+            return -1;
+        pbuf_copy_partial (buf, gso.data, len, 0);
+        gso.len = len;
+        gso.iphdr_len = iphdr_len;
+        gso.hdr_len = hdr_len;
+        gso.seg_size = size;
+        gso.segs = 1;
+    }
+
+    gso.last_size = size;
+    gso.next_seq = seq + size;
+
+    /* A push ends the burst, send it now. */
+    if (t[13] & TCP_FLAG_PSH) {
+        gso.data[iphdr_len + 13] |= TCP_FLAG_PSH;
+        if ((hev_tunnel_flush_offload (fd) < 0) && (errno != EAGAIN))
+            return -1;
+    }
+
+    return len;
+}
+
+/*
+ * Send the pending super-packet. When the device would block it is kept
+ * for the next flush, and packets that cannot join it are refused. On any
+ * other error it is dropped, TCP retransmits it.
+ */
+int
+hev_tunnel_flush_offload (int fd)
+{
+    struct virtio_net_hdr hdr = { 0 };
+    struct iovec iov[2];
+    uint8_t *h = gso.data;
+    ssize_t res;
+
+    if (!gso.len)
+        return 0;
+
+    if (gso.segs > 1) {
+        unsigned int tcp_len = gso.len - gso.iphdr_len;
+        uint32_t sum = IPPROTO_TCP + tcp_len;
+        uint16_t cksum;
+
+        if (gso.iphdr_len == 20) {
+            /* Only the total length changed: patch the header checksum. */
+            cksum = hev_checksum_update ((h[10] << 8) | h[11],
+                                         (h[2] << 8) | h[3], gso.len);
+            h[2] = gso.len >> 8;
+            h[3] = gso.len;
+            h[10] = cksum >> 8;
+            h[11] = cksum;
+            sum = hev_checksum_add (sum, h + 12, 8);
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        } else {
+            h[4] = tcp_len >> 8;
+            h[5] = tcp_len;
+            sum = hev_checksum_add (sum, h + 8, 32);
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+        }
+
+        /* Partial checksum: pseudo header only, the kernel does the rest. */
+        cksum = hev_checksum_fold (sum);
+        h[gso.iphdr_len + 16] = cksum >> 8;
+        h[gso.iphdr_len + 17] = cksum;
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.hdr_len = gso.hdr_len;
+        hdr.gso_size = gso.seg_size;
+        hdr.csum_start = gso.iphdr_len;
+        hdr.csum_offset = 16;
+    }
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof (hdr);
+    iov[1].iov_base = h;
+    iov[1].iov_len = gso.len;
+
+    res = writev (fd, iov, 2);
+    if ((res < 0) && (errno == EAGAIN))
+        return -1;
+
+    gso.len = 0;
+    return (res < 0) ? -1 : 0;
+}
+
 int
 hev_tunnel_add_task (int fd, HevTask *task)
 {
@@ -10,4 +10,12 @@
 #ifndef __HEV_TUNNEL_LINUX_H__
 #define __HEV_TUNNEL_LINUX_H__
 
+void hev_tunnel_set_offload (int enabled);
+int hev_tunnel_get_offload (void);
+
+struct pbuf *hev_tunnel_read_offload (int fd, HevTaskIOYielder yielder,
+                                      void *yielder_data);
+ssize_t hev_tunnel_write_offload (int fd, struct pbuf *buf);
+int hev_tunnel_flush_offload (int fd);
+
 #endif /* __HEV_TUNNEL_LINUX_H__ */
@@ -20,7 +20,7 @@ hev_tunnel_read (int fd, int mtu, HevTaskIOYielder yielder, void *yielder_data)
     uint32_t type;
     ssize_t s;
 
-    buf = pbuf_alloc (PBUF_RAW, mtu, PBUF_RAM);
+    buf = hev_pbuf_pool_alloc (mtu);
     if (!buf)
         return NULL;
 
@@ -35,10 +35,7 @@ hev_tunnel_read (int fd, int mtu, HevTaskIOYielder yielder, void *yielder_data)
         return NULL;
     }
 
-    buf->tot_len = s - sizeof (type);
-    buf->len = s - sizeof (type);
-
-    return buf;
+    return hev_pbuf_pool_trim (buf, s - sizeof (type));
 }
 
 static inline ssize_t
@@ -21,12 +21,17 @@
 
 #include "hev-tunnel.h"
 
+#define PBUF_POOL_MAX_COUNT (64)
+#define SPIN_MIN (4)
+#define SPIN_MAX (1024)
+
 typedef struct _HevPBuf HevPBuf;
 
 struct _HevPBuf
 {
     struct pbuf_custom base;
     void *mem;
+    HevPBuf *next;
 };
 
 static HevWinTun *wintun;
@@ -34,13 +39,60 @@ static HevWinTunAdapter *adapter;
 static HevWinTunSession *session;
 static char tun_name[IFNAMSIZ];
 
+/*
+ * Packet wrappers are recycled on a per-thread list while the reading task
+ * is attached, the packet memory itself stays in the Wintun ring.
+ */
+static __thread HevPBuf *pbuf_list;
+static __thread unsigned int pbuf_count;
+static __thread unsigned int pbuf_max;
+
+/* Yields spent polling an empty ring before waiting on the read event. */
+static __thread int spin_limit = SPIN_MIN;
+
 static void
 hev_pbuf_free (struct pbuf *p)
 {
     HevPBuf *buf = (HevPBuf *)p;
 
     hev_wintun_session_release (session, buf->mem);
-    hev_free (buf);
+
+    if (pbuf_count >= pbuf_max) {
+        hev_free (buf);
+        return;
+    }
+
+    buf->next = pbuf_list;
+    pbuf_list = buf;
+    pbuf_count++;
+}
+
+static HevPBuf *
+hev_pbuf_alloc (void)
+{
+    HevPBuf *buf;
+
+    if (!pbuf_list)
+        return hev_malloc (sizeof (HevPBuf));
+
+    buf = pbuf_list;
+    pbuf_list = buf->next;
+    pbuf_count--;
+
+    return buf;
+}
+
+static void
+hev_pbuf_clear (void)
+{
+    while (pbuf_list) {
+        HevPBuf *buf = pbuf_list;
+
+        pbuf_list = buf->next;
+        hev_free (buf);
+    }
+
+    pbuf_count = 0;
 }
 
 int
@@ -144,6 +196,8 @@ int
 hev_tunnel_add_task (int fd, HevTask *task)
 {
     void *handle = hev_wintun_session_get_read_wait_event (session);
+
+    pbuf_max = PBUF_POOL_MAX_COUNT;
     return hev_task_add_whandle (task, handle);
 }
 
@@ -151,7 +205,12 @@ void
 hev_tunnel_del_task (int fd, HevTask *task)
 {
     void *handle = hev_wintun_session_get_read_wait_event (session);
+
     hev_task_del_whandle (task, handle);
+
+    /* Packets lwIP still holds are freed, not pooled, from here on. */
+    pbuf_max = 0;
+    hev_pbuf_clear ();
 }
 
 struct pbuf *
@@ -165,24 +224,41 @@ hev_tunnel_read (int fd, int mtu, HevTaskIOYielder yielder, void *yielder_data)
 retry:
     packet = hev_wintun_session_receive (session, &size);
     if (!packet) {
-        if (hev_wintun_get_last_error () == HEV_WINTUN_EAGAIN) {
-            if (spin++ < 1000) {
-                hev_task_yield (HEV_TASK_YIELD);
-            } else if (yielder) {
-                if (yielder (HEV_TASK_WAITIO, yielder_data))
-                    return NULL;
-            } else {
-                hev_task_yield (HEV_TASK_WAITIO);
-            }
-            goto retry;
-        } else {
+        HevTaskYieldType type = HEV_TASK_YIELD;
+
+        if (hev_wintun_get_last_error () != HEV_WINTUN_EAGAIN)
             return NULL;
+
+        /*
+         * Poll the ring for a while before sleeping on the read event.
+         * The yielder sees every poll, so a batch's nowait reads stop at
+         * once. The budget grows while packets turn up during the spin
+         * and shrinks each time it runs out, so an idle tunnel sleeps.
+         */
+        if (spin++ >= spin_limit) {
+            if (spin_limit > SPIN_MIN)
+                spin_limit >>= 1;
+            spin = 0;
+            type = HEV_TASK_WAITIO;
+        }
+
+        if (yielder) {
+            if (yielder (type, yielder_data))
+                return NULL;
+        } else {
+            hev_task_yield (type);
         }
+        goto retry;
     }
 
-    buf = hev_malloc (sizeof (HevPBuf));
-    if (!buf)
+    if (spin && (spin_limit < SPIN_MAX))
+        spin_limit <<= 1;
+
+    buf = hev_pbuf_alloc ();
+    if (!buf) {
+        hev_wintun_session_release (session, packet);
         return NULL;
+    }
 
     buf->mem = packet;
     buf->base.custom_free_function = hev_pbuf_free;
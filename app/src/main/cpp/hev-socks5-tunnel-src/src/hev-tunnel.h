@@ -12,6 +12,8 @@
 
 #include <lwip/pbuf.h>
 
+#include "hev-pbuf-pool.h"
+
 #if defined(__linux__)
 #include "hev-tunnel-linux.h"
 #endif /* __linux__ */
@@ -39,7 +41,12 @@ hev_tunnel_read (int fd, int mtu, HevTaskIOYielder yielder, void *yielder_data)
     struct pbuf *buf;
     ssize_t s;
 
-    buf = pbuf_alloc (PBUF_RAW, mtu, PBUF_RAM);
+#if defined(__linux__)
+    if (hev_tunnel_get_offload ())
+        return hev_tunnel_read_offload (fd, yielder, yielder_data);
+#endif
+
+    buf = hev_pbuf_pool_alloc (mtu);
     if (!buf)
         return NULL;
 
@@ -49,10 +56,7 @@ hev_tunnel_read (int fd, int mtu, HevTaskIOYielder yielder, void *yielder_data)
         return NULL;
     }
 
-    buf->tot_len = s;
-    buf->len = s;
-
-    return buf;
+    return hev_pbuf_pool_trim (buf, s);
 }
 
 static inline ssize_t
@@ -62,6 +66,11 @@ hev_tunnel_write (int fd, struct pbuf *buf)
     struct pbuf *p = buf;
     int i;
 
+#if defined(__linux__)
+    if (hev_tunnel_get_offload ())
+        return hev_tunnel_write_offload (fd, buf);
+#endif
+
     if (!p->next)
         return write (fd, p->payload, p->len);
 
@@ -75,6 +84,50 @@ hev_tunnel_write (int fd, struct pbuf *buf)
 }
 #endif /* defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) */
 
+/*
+ * Push out packets held back by hev_tunnel_write for coalescing.
+ */
+static inline int
+hev_tunnel_flush (int fd)
+{
+#if defined(__linux__)
+    if (hev_tunnel_get_offload ())
+        return hev_tunnel_flush_offload (fd);
+#endif
+    return 0;
+}
+
+static inline int
+hev_tunnel_read_nowait_yielder (HevTaskYieldType type, void *data)
+{
+    return -1;
+}
+
+/*
+ * Read up to num packets into bufs. Only the first read waits for the
+ * tunnel to become readable, the rest drain what is already queued and
+ * stop as soon as the device would block.
+ */
+static inline int
+hev_tunnel_read_batch (int fd, int mtu, struct pbuf **bufs, int num,
+                       HevTaskIOYielder yielder, void *yielder_data)
+{
+    int i;
+
+    bufs[0] = hev_tunnel_read (fd, mtu, yielder, yielder_data);
+    if (!bufs[0])
+        return 0;
+
+    for (i = 1; i < num; i++) {
+        bufs[i] = hev_tunnel_read (fd, mtu, hev_tunnel_read_nowait_yielder,
+                                   NULL);
+        if (!bufs[i])
+            break;
+    }
+
+    return i;
+}
+
 int hev_tunnel_open (const char *name, int multi_queue);
 void hev_tunnel_close (int fd);
 
@@ -0,0 +1,206 @@
+/*
+ ============================================================================
+ Name        : hev-checksum.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Internet checksum
+ ============================================================================
+ */
+
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hev-checksum.h"
+
+/* Vector steps per flush, keeps the 32-bit lanes from overflowing. */
+#define VEC_BLOCK (8192)
+
+#if defined(__ARM_NEON)
+
+static uint64_t
+sum_vector (const uint8_t **data, size_t *len)
+{
+    const uint8_t *p = *data;
+    size_t n = *len;
+    uint64_t sum = 0;
+
+    while (n >= 32) {
+        uint32x4_t a = vdupq_n_u32 (0);
+        uint32x4_t b = vdupq_n_u32 (0);
+        uint64x2_t s;
+        size_t i;
+
+        for (i = 0; (i < VEC_BLOCK) && (n >= 32); i++) {
+            a = vpadalq_u16 (a, vreinterpretq_u16_u8 (vld1q_u8 (p)));
+            b = vpadalq_u16 (b, vreinterpretq_u16_u8 (vld1q_u8 (p + 16)));
+            p += 32;
+            n -= 32;
+        }
+
+        s = vaddq_u64 (vpaddlq_u32 (a), vpaddlq_u32 (b));
+        sum += vgetq_lane_u64 (s, 0) + vgetq_lane_u64 (s, 1);
+    }
+
+    *data = p;
+    *len = n;
+    return sum;
+}
+
+#elif defined(__SSE2__)
+
+static uint64_t
+sum_vector (const uint8_t **data, size_t *len)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    const uint8_t *p = *data;
+    size_t n = *len;
+    uint64_t sum = 0;
+
+    while (n >= 32) {
+        __m128i a = zero;
+        __m128i b = zero;
+        uint32_t l[4];
+        size_t i;
+
+        for (i = 0; (i < VEC_BLOCK) && (n >= 32); i++) {
+            __m128i x = _mm_loadu_si128 ((const __m128i *)p);
+            __m128i y = _mm_loadu_si128 ((const __m128i *)(p + 16));
+
+            a = _mm_add_epi32 (a, _mm_unpacklo_epi16 (x, zero));
+            b = _mm_add_epi32 (b, _mm_unpackhi_epi16 (x, zero));
+            a = _mm_add_epi32 (a, _mm_unpacklo_epi16 (y, zero));
+            b = _mm_add_epi32 (b, _mm_unpackhi_epi16 (y, zero));
+            p += 32;
+            n -= 32;
+        }
+
+        _mm_storeu_si128 ((__m128i *)l, a);
+        sum += (uint64_t)l[0] + l[1] + l[2] + l[3];
+        _mm_storeu_si128 ((__m128i *)l, b);
+        sum += (uint64_t)l[0] + l[1] + l[2] + l[3];
+    }
+
+    *data = p;
+    *len = n;
+    return sum;
+}
+
+#else
+
+static uint64_t
+sum_vector (const uint8_t **data, size_t *len)
+{
+    return 0;
+}
+
+#endif
+
+/*
+ * Sum of native-order 16-bit words, folded to 16 bits. The ones' complement
+ * sum is byte order independent (RFC 1071), so wider native loads give the
+ * same result once folded.
+ */
+static uint16_t
+sum_native (const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t sum;
+
+    sum = sum_vector (&p, &len);
+
+    while (len >= 16) {
+        uint32_t w[4];
+
+        memcpy (w, p, sizeof (w));
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        p += 16;
+        len -= 16;
+    }
+
+    while (len >= 4) {
+        uint32_t w;
+
+        memcpy (&w, p, sizeof (w));
+        sum += w;
+        p += 4;
+        len -= 4;
+    }
+
+    if (len >= 2) {
+        uint16_t w;
+
+        memcpy (&w, p, sizeof (w));
+        sum += w;
+        p += 2;
+        len -= 2;
+    }
+
+    if (len) {
+        uint8_t b[2] = { p[0], 0 };
+        uint16_t w;
+
+        memcpy (&w, b, sizeof (w));
+        sum += w;
+    }
+
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
+uint32_t
+hev_checksum_add (uint32_t sum, const void *data, size_t len)
+{
+    uint16_t s = sum_native (data, len);
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    s = __builtin_bswap16 (s);
+#endif
+
+    return sum + s;
+}
+
+uint16_t
+hev_checksum_fold (uint32_t sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
+uint16_t
+hev_checksum (const void *data, size_t len)
+{
+    return ~hev_checksum_fold (hev_checksum_add (0, data, len));
+}
+
+uint16_t
+hev_checksum_update (uint16_t check, uint16_t old, uint16_t new)
+{
+    uint32_t sum;
+
+    /* HC' = ~(~HC + ~m + m') */
+    sum = (uint16_t)~check;
+    sum += (uint16_t)~old;
+    sum += new;
+
+    return ~hev_checksum_fold (sum);
+}
+
+unsigned short
+hev_checksum_lwip (const void *data, int len)
+{
+    if (len <= 0)
+        return 0;
+
+    return sum_native (data, len);
+}
@@ -0,0 +1,75 @@
+/*
+ ============================================================================
+ Name        : hev-checksum.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Internet checksum
+ ============================================================================
+ */
+
+#ifndef __HEV_CHECKSUM_H__
+#define __HEV_CHECKSUM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * hev_checksum_add:
+ * @sum: partial sum
+ * @data: data
+ * @len: data length
+ *
+ * Add @data to a partial ones' complement sum of big-endian 16-bit words
+ * (RFC 1071). An odd trailing byte is padded with zero. The result stays
+ * unfolded so several buffers can be chained.
+ *
+ * Returns: the new partial sum.
+ */
+uint32_t hev_checksum_add (uint32_t sum, const void *data, size_t len);
+
+/**
+ * hev_checksum_fold:
+ * @sum: partial sum
+ *
+ * Fold a partial sum into 16 bits, not inverted.
+ *
+ * Returns: the folded sum.
+ */
+uint16_t hev_checksum_fold (uint32_t sum);
+
+/**
+ * hev_checksum:
+ * @data: data
+ * @len: data length
+ *
+ * Compute the Internet checksum of @data, ready to store big-endian.
+ *
+ * Returns: the checksum.
+ */
+uint16_t hev_checksum (const void *data, size_t len);
+
+/**
+ * hev_checksum_update:
+ * @check: old checksum
+ * @old: old 16-bit field value
+ * @new: new 16-bit field value
+ *
+ * Update a checksum after one 16-bit field changed (RFC 1624, eqn. 3).
+ * All values are in the same byte order as in the packet.
+ *
+ * Returns: the new checksum.
+ */
+uint16_t hev_checksum_update (uint16_t check, uint16_t old, uint16_t new);
+
+/**
+ * hev_checksum_lwip:
+ * @data: data
+ * @len: data length
+ *
+ * The LWIP_CHKSUM routine: folded, not inverted sum in native byte order.
+ *
+ * Returns: the folded sum.
+ */
+unsigned short hev_checksum_lwip (const void *data, int len);
+
+#endif /* __HEV_CHECKSUM_H__ */
@@ -11,21 +11,53 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
 
 #include "hev-logger.h"
 
+#define RING_SLOTS (256)
+#define RING_BATCH (64)
+#define RING_IDLE_MIN_NS (1000 * 1000)
+#define RING_IDLE_MAX_NS (64 * 1000 * 1000)
+#define MSG_SIZE (1024)
+#define LINE_SIZE (32 + 4 + MSG_SIZE)
+
+typedef struct _HevLoggerSlot HevLoggerSlot;
+
+struct _HevLoggerSlot
+{
+    unsigned long seq;
+    unsigned int len;
+    char line[LINE_SIZE];
+};
+
+int hev_logger_threshold = HEV_LOGGER_UNSET + 1;
+
 static int fd = -1;
-static HevLoggerLevel req_level;
+
+/*
+ * Bounded multi-producer ring: a producer claims a slot by advancing the
+ * tail, fills it and publishes it through the slot sequence; the single
+ * consumer writes published slots in order and hands them back.
+ */
+static HevLoggerSlot *ring;
+static unsigned long ring_tail;
+static unsigned long ring_dropped;
+static pthread_t ring_thread;
+static int ring_quit;
+
+static __thread time_t ts_cache_time = -1;
+static __thread char ts_cache[32];
+static __thread int ts_cache_len;
 
 int
 hev_logger_init (HevLoggerLevel level, const char *path)
 {
-    req_level = level;
-
     if (0 == strcmp (path, "stdout"))
         fd = dup (1);
     else if (0 == strcmp (path, "stderr"))
@@ -36,73 +68,106 @@ hev_logger_init (HevLoggerLevel level, const char *path)
     if (fd < 0)
         return -1;
 
+    hev_logger_threshold = level;
     return 0;
 }
 
-void
-hev_logger_fini (void)
-{
-    close (fd);
-}
-
 int
 hev_logger_enabled (HevLoggerLevel level)
 {
-    if (level >= req_level && fd >= 0)
-        return 1;
-
-    return 0;
+    return HEV_LOGGER_ON (level);
 }
 
-void
-hev_logger_log (HevLoggerLevel level, const char *fmt, ...)
+/* The timestamp only changes once a second, so format it once per second
+ * per thread. */
+static const char *
+hev_logger_timestamp (int *len)
 {
-    struct iovec iov[4];
     const char *ts_fmt;
-    char msg[1024];
-    struct tm *ti;
-    char ts[32];
+    struct tm ti;
     time_t now;
-    va_list ap;
-    int len;
-
-    if (level < req_level || fd < 0)
-        return;
 
     time (&now);
-    ti = localtime (&now);
-
-    ts_fmt = "[%04u-%02u-%02u %02u:%02u:%02u] ";
-    len = snprintf (ts, sizeof (ts), ts_fmt, 1900 + ti->tm_year, 1 + ti->tm_mon,
-                    ti->tm_mday, ti->tm_hour, ti->tm_min, ti->tm_sec);
+    if (now != ts_cache_time) {
+        localtime_r (&now, &ti);
+        ts_fmt = "[%04u-%02u-%02u %02u:%02u:%02u] ";
+        ts_cache_len = snprintf (ts_cache, sizeof (ts_cache), ts_fmt,
+                                 1900 + ti.tm_year, 1 + ti.tm_mon, ti.tm_mday,
+                                 ti.tm_hour, ti.tm_min, ti.tm_sec);
+        ts_cache_time = now;
+    }
 
-    iov[0].iov_base = ts;
-    iov[0].iov_len = len;
+    *len = ts_cache_len;
+    return ts_cache;
+}
 
+static const char *
+hev_logger_tag (HevLoggerLevel level)
+{
     switch (level) {
     case HEV_LOGGER_DEBUG:
-        iov[1].iov_base = "[D] ";
-        break;
+        return "[D] ";
     case HEV_LOGGER_INFO:
-        iov[1].iov_base = "[I] ";
-        break;
+        return "[I] ";
     case HEV_LOGGER_WARN:
-        iov[1].iov_base = "[W] ";
-        break;
+        return "[W] ";
     case HEV_LOGGER_ERROR:
-        iov[1].iov_base = "[E] ";
-        break;
-    case HEV_LOGGER_UNSET:
-        iov[1].iov_base = "[?] ";
-        break;
+        return "[E] ";
+    default:
+        return "[?] ";
     }
-    iov[1].iov_len = 4;
+}
 
-    va_start (ap, fmt);
-    iov[2].iov_base = msg;
-    iov[2].iov_len = vsnprintf (msg, 1024, fmt, ap);
-    va_end (ap);
+static HevLoggerSlot *
+hev_logger_ring_claim (void)
+{
+    unsigned long pos;
+
+    pos = __atomic_load_n (&ring_tail, __ATOMIC_RELAXED);
+    for (;;) {
+        HevLoggerSlot *slot = &ring[pos % RING_SLOTS];
+        unsigned long seq;
+        long dif;
+
+        seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+        dif = (long)(seq - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n (&ring_tail, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED))
+                return slot;
+        } else if (dif < 0) {
+            __atomic_add_fetch (&ring_dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n (&ring_tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void
+hev_logger_ring_publish (HevLoggerSlot *slot)
+{
+    unsigned long seq = slot->seq + 1;
 
+    __atomic_store_n (&slot->seq, seq, __ATOMIC_RELEASE);
+}
+
+static void
+hev_logger_write_line (HevLoggerLevel level, const char *msg, size_t len)
+{
+    struct iovec iov[4];
+    const char *ts;
+    int ts_len;
+
+    ts = hev_logger_timestamp (&ts_len);
+
+    iov[0].iov_base = (void *)ts;
+    iov[0].iov_len = ts_len;
+    iov[1].iov_base = (void *)hev_logger_tag (level);
+    iov[1].iov_len = 4;
+    iov[2].iov_base = (void *)msg;
+    iov[2].iov_len = len;
     iov[3].iov_base = "\n";
     iov[3].iov_len = 1;
 
@@ -110,3 +175,186 @@ hev_logger_log (HevLoggerLevel level, const char *fmt, ...)
         /* ignore return value */
     }
 }
+
+static void
+hev_logger_ring_write (HevLoggerSlot **slots, int count)
+{
+    struct iovec iov[RING_BATCH];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = slots[i]->line;
+        iov[i].iov_len = slots[i]->len;
+    }
+
+    if (writev (fd, iov, count)) {
+        /* ignore return value */
+    }
+}
+
+static void
+hev_logger_ring_note_dropped (void)
+{
+    unsigned long dropped;
+    char msg[64];
+    int len;
+
+    dropped = __atomic_exchange_n (&ring_dropped, 0, __ATOMIC_RELAXED);
+    if (!dropped)
+        return;
+
+    len = snprintf (msg, sizeof (msg), "logger: dropped %lu lines", dropped);
+    /* Runs on the ring thread, so the note goes straight to the fd. */
+    hev_logger_write_line (HEV_LOGGER_WARN, msg, len);
+}
+
+static void *
+hev_logger_ring_entry (void *data)
+{
+    unsigned long head = 0;
+    long idle_ns = RING_IDLE_MIN_NS;
+
+    /* Poll rather than wake: producers never make a call. The poll backs off
+     * while the ring stays empty. */
+    for (;;) {
+        HevLoggerSlot *slots[RING_BATCH];
+        int count = 0;
+        int i;
+
+        while (count < RING_BATCH) {
+            HevLoggerSlot *slot = &ring[head % RING_SLOTS];
+            unsigned long seq;
+
+            seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq != head + 1)
+                break;
+            slots[count++] = slot;
+            head++;
+        }
+
+        if (count) {
+            hev_logger_ring_write (slots, count);
+            for (i = 0; i < count; i++) {
+                unsigned long seq = slots[i]->seq - 1 + RING_SLOTS;
+                __atomic_store_n (&slots[i]->seq, seq, __ATOMIC_RELEASE);
+            }
+            idle_ns = RING_IDLE_MIN_NS;
+            continue;
+        }
+
+        hev_logger_ring_note_dropped ();
+
+        if (__atomic_load_n (&ring_quit, __ATOMIC_ACQUIRE)) {
+            /* Producers may still be filling claimed slots. */
+            if (head == __atomic_load_n (&ring_tail, __ATOMIC_ACQUIRE))
+                break;
+        } else {
+            struct timespec ts = { 0, idle_ns };
+
+            nanosleep (&ts, NULL);
+            if (idle_ns < RING_IDLE_MAX_NS)
+                idle_ns *= 2;
+        }
+    }
+
+    return NULL;
+}
+
+int
+hev_logger_start_async (void)
+{
+    unsigned long i;
+
+    if (fd < 0 || ring)
+        return -1;
+
+    ring = malloc (sizeof (HevLoggerSlot) * RING_SLOTS);
+    if (!ring)
+        return -1;
+
+    for (i = 0; i < RING_SLOTS; i++)
+        ring[i].seq = i;
+    ring_tail = 0;
+    ring_dropped = 0;
+    ring_quit = 0;
+
+    if (pthread_create (&ring_thread, NULL, hev_logger_ring_entry, NULL)) {
+        free (ring);
+        ring = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+hev_logger_stop_async (void)
+{
+    if (!ring)
+        return;
+
+    __atomic_store_n (&ring_quit, 1, __ATOMIC_RELEASE);
+    pthread_join (ring_thread, NULL);
+    free (ring);
+    ring = NULL;
+}
+
+void
+hev_logger_fini (void)
+{
+    hev_logger_threshold = HEV_LOGGER_UNSET + 1;
+    hev_logger_stop_async ();
+    close (fd);
+    fd = -1;
+}
+
+void
+hev_logger_write (HevLoggerLevel level, const char *msg, size_t len)
+{
+    HevLoggerSlot *slot;
+    const char *ts;
+    int ts_len;
+
+    if (!HEV_LOGGER_ON (level))
+        return;
+
+    if (len > MSG_SIZE - 1)
+        len = MSG_SIZE - 1;
+
+    if (!ring) {
+        hev_logger_write_line (level, msg, len);
+        return;
+    }
+
+    slot = hev_logger_ring_claim ();
+    if (!slot)
+        return;
+
+    ts = hev_logger_timestamp (&ts_len);
+    memcpy (slot->line, ts, ts_len);
+    memcpy (slot->line + ts_len, hev_logger_tag (level), 4);
+    memcpy (slot->line + ts_len + 4, msg, len);
+    slot->len = ts_len + 4 + len;
+    slot->line[slot->len++] = '\n';
+    hev_logger_ring_publish (slot);
+}
+
+void
+hev_logger_log (HevLoggerLevel level, const char *fmt, ...)
+{
+    char msg[MSG_SIZE];
+    va_list ap;
+    int len;
+
+    if (!HEV_LOGGER_ON (level))
+        return;
+
+    va_start (ap, fmt);
+    len = vsnprintf (msg, MSG_SIZE, fmt, ap);
+    va_end (ap);
+
+    if (len < 0)
+        return;
+
+    hev_logger_write (level, msg, len);
+}
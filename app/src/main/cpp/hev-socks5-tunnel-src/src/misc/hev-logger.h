@@ -10,16 +10,30 @@
 #ifndef __HEV_LOGGER_H__
 #define __HEV_LOGGER_H__
 
-#define LOG_D(fmt...) hev_logger_log (HEV_LOGGER_DEBUG, fmt)
-#define LOG_I(fmt...) hev_logger_log (HEV_LOGGER_INFO, fmt)
-#define LOG_W(fmt...) hev_logger_log (HEV_LOGGER_WARN, fmt)
-#define LOG_E(fmt...) hev_logger_log (HEV_LOGGER_ERROR, fmt)
+#include <stddef.h>
 
-#define LOG_ON() hev_logger_enabled (HEV_LOGGER_UNSET)
-#define LOG_ON_D() hev_logger_enabled (HEV_LOGGER_DEBUG)
-#define LOG_ON_I() hev_logger_enabled (HEV_LOGGER_INFO)
-#define LOG_ON_W() hev_logger_enabled (HEV_LOGGER_WARN)
-#define LOG_ON_E() hev_logger_enabled (HEV_LOGGER_ERROR)
+/*
+ * The level is checked inline, so a disabled message costs one load and
+ * compare: its arguments are not evaluated and no call is made.
+ */
+#define HEV_LOGGER_ON(level) ((int)(level) >= hev_logger_threshold)
+
+#define HEV_LOGGER_LOG(level, fmt...)    \
+    do {                                 \
+        if (HEV_LOGGER_ON (level))       \
+            hev_logger_log (level, fmt); \
+    } while (0)
+
+#define LOG_D(fmt...) HEV_LOGGER_LOG (HEV_LOGGER_DEBUG, fmt)
+#define LOG_I(fmt...) HEV_LOGGER_LOG (HEV_LOGGER_INFO, fmt)
+#define LOG_W(fmt...) HEV_LOGGER_LOG (HEV_LOGGER_WARN, fmt)
+#define LOG_E(fmt...) HEV_LOGGER_LOG (HEV_LOGGER_ERROR, fmt)
+
+#define LOG_ON() HEV_LOGGER_ON (HEV_LOGGER_UNSET)
+#define LOG_ON_D() HEV_LOGGER_ON (HEV_LOGGER_DEBUG)
+#define LOG_ON_I() HEV_LOGGER_ON (HEV_LOGGER_INFO)
+#define LOG_ON_W() HEV_LOGGER_ON (HEV_LOGGER_WARN)
+#define LOG_ON_E() HEV_LOGGER_ON (HEV_LOGGER_ERROR)
 
 typedef enum
 {
@@ -30,10 +44,24 @@ typedef enum
     HEV_LOGGER_UNSET,
 } HevLoggerLevel;
 
+/* Lowest level written; above HEV_LOGGER_UNSET while logging is off. */
+extern int hev_logger_threshold;
+
 int hev_logger_init (HevLoggerLevel level, const char *path);
 void hev_logger_fini (void);
 
+/*
+ * Hand lines to a background thread through a lock-free ring instead of
+ * writing them on the calling thread. Lines logged while the ring is full
+ * are dropped and counted. Start after any fork; hev_logger_fini flushes
+ * the ring and stops the thread.
+ */
+int hev_logger_start_async (void);
+
 int hev_logger_enabled (HevLoggerLevel level);
 void hev_logger_log (HevLoggerLevel level, const char *fmt, ...);
 
+/* Write an already formatted message, for loggers sharing this sink. */
+void hev_logger_write (HevLoggerLevel level, const char *msg, size_t len);
+
 #endif /* __HEV_LOGGER_H__ */
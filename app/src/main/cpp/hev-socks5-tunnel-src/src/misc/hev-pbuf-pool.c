@@ -0,0 +1,109 @@
+/*
+ ============================================================================
+ Name        : hev-pbuf-pool.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : PBuf pool
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-compiler.h"
+#include "hev-pbuf-pool.h"
+
+#define POOL_MAX_COUNT (64)
+
+typedef struct _HevPBufPoolBuf HevPBufPoolBuf;
+
+struct _HevPBufPoolBuf
+{
+    struct pbuf_custom base;
+
+    HevPBufPoolBuf *next;
+    u16_t size;
+
+    unsigned char data[0] __attribute__ ((aligned (MEM_ALIGNMENT)));
+};
+
+static __thread HevPBufPoolBuf *list;
+static __thread unsigned int count;
+static __thread u16_t list_size;
+
+static void
+hev_pbuf_pool_free (struct pbuf *p)
+{
+    HevPBufPoolBuf *buf = container_of (p, HevPBufPoolBuf, base.pbuf);
+
+    if ((buf->size != list_size) || (count >= POOL_MAX_COUNT)) {
+        hev_free (buf);
+        return;
+    }
+
+    buf->next = list;
+    list = buf;
+    count++;
+}
+
+struct pbuf *
+hev_pbuf_pool_alloc (u16_t size)
+{
+    HevPBufPoolBuf *buf;
+
+    /* A new size, say after an MTU change, retires the old buffers. */
+    if (size != list_size) {
+        hev_pbuf_pool_clear ();
+        list_size = size;
+    }
+
+    if (list) {
+        buf = list;
+        list = buf->next;
+        count--;
+    } else {
+        buf = hev_malloc (sizeof (HevPBufPoolBuf) + size);
+        if (!buf)
+            return NULL;
+        buf->size = size;
+    }
+
+    buf->base.custom_free_function = hev_pbuf_pool_free;
+
+    return pbuf_alloced_custom (PBUF_RAW, size, PBUF_RAM, &buf->base,
+                                buf->data, size);
+}
+
+struct pbuf *
+hev_pbuf_pool_trim (struct pbuf *p, u16_t len)
+{
+    struct pbuf *q;
+
+    if (len <= (p->len / 4)) {
+        q = pbuf_alloc (PBUF_RAW, len, PBUF_RAM);
+        if (q) {
+            memcpy (q->payload, p->payload, len);
+            pbuf_free (p);
+            return q;
+        }
+    }
+
+    p->tot_len = len;
+    p->len = len;
+
+    return p;
+}
+
+void
+hev_pbuf_pool_clear (void)
+{
+    while (list) {
+        HevPBufPoolBuf *buf = list;
+
+        list = buf->next;
+        hev_free (buf);
+    }
+    count = 0;
+    list_size = 0;
+}
@@ -0,0 +1,32 @@
+/*
+ ============================================================================
+ Name        : hev-pbuf-pool.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : PBuf pool
+ ============================================================================
+ */
+
+#ifndef __HEV_PBUF_POOL_H__
+#define __HEV_PBUF_POOL_H__
+
+#include <lwip/pbuf.h>
+
+/*
+ * Receive buffers of one size kept on a per-thread free list. A pbuf from
+ * hev_pbuf_pool_alloc returns its buffer to the list of the thread that
+ * frees it, so workers only ever touch their own list.
+ */
+struct pbuf *hev_pbuf_pool_alloc (u16_t size);
+
+/*
+ * Cut a pooled pbuf down to the len bytes actually received. Packets of
+ * at most a quarter of the buffer are copied into an exact sized pbuf and
+ * the buffer goes back to the list at once, so lwIP queueing small packets
+ * does not pin whole buffers.
+ */
+struct pbuf *hev_pbuf_pool_trim (struct pbuf *p, u16_t len);
+
+void hev_pbuf_pool_clear (void);
+
+#endif /* __HEV_PBUF_POOL_H__ */
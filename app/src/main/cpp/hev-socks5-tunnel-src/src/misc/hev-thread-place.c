@@ -0,0 +1,193 @@
+/*
+ ============================================================================
+ Name        : hev-thread-place.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Thread placement
+ ============================================================================
+ */
+
+#if defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#endif
+
+#include "hev-logger.h"
+
+#include "hev-thread-place.h"
+
+#if defined(__linux__)
+
+#define SCHED_FLAG_KEEP_POLICY (0x08)
+#define SCHED_FLAG_KEEP_PARAMS (0x10)
+#define SCHED_FLAG_UTIL_CLAMP_MIN (0x20)
+
+/* struct sched_attr of the kernel, which libcs do not all declare. */
+typedef struct _HevSchedAttr HevSchedAttr;
+
+struct _HevSchedAttr
+{
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+    uint32_t sched_util_min;
+    uint32_t sched_util_max;
+};
+
+static unsigned long
+read_cpu_value (int cpu, const char *name)
+{
+    unsigned long value = 0;
+    char path[128];
+    FILE *fp;
+
+    snprintf (path, sizeof (path), "/sys/devices/system/cpu/cpu%d/%s", cpu,
+              name);
+    fp = fopen (path, "r");
+    if (!fp)
+        return 0;
+    if (fscanf (fp, "%lu", &value) != 1)
+        value = 0;
+    fclose (fp);
+
+    return value;
+}
+
+/* Capacity where the kernel knows it, else the top frequency. */
+static unsigned long
+read_cpu_capacity (int cpu)
+{
+    unsigned long cap = read_cpu_value (cpu, "cpu_capacity");
+
+    if (!cap)
+        cap = read_cpu_value (cpu, "cpufreq/cpuinfo_max_freq");
+
+    return cap;
+}
+
+static int
+parse_performance (cpu_set_t *set)
+{
+    unsigned long min = 0, max = 0;
+    int count, i;
+
+    count = sysconf (_SC_NPROCESSORS_CONF);
+    if (count > CPU_SETSIZE)
+        count = CPU_SETSIZE;
+
+    for (i = 0; i < count; i++) {
+        unsigned long cap = read_cpu_capacity (i);
+
+        if (!cap)
+            return -1;
+        if (!min || cap < min)
+            min = cap;
+        if (cap > max)
+            max = cap;
+    }
+
+    /* All cores alike, nothing to prefer. */
+    if (min == max)
+        return -1;
+
+    CPU_ZERO (set);
+    for (i = 0; i < count; i++)
+        if (read_cpu_capacity (i) > min)
+            CPU_SET (i, set);
+
+    return CPU_COUNT (set) ? 0 : -1;
+}
+
+static int
+parse_list (const char *cpus, cpu_set_t *set)
+{
+    const char *p = cpus;
+
+    CPU_ZERO (set);
+    while (*p) {
+        unsigned long first, last;
+        char *end;
+
+        first = strtoul (p, &end, 10);
+        if (end == p)
+            return -1;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtoul (p, &end, 10);
+            if (end == p)
+                return -1;
+            p = end;
+        }
+        if (first > last || last >= CPU_SETSIZE)
+            return -1;
+        for (; first <= last; first++)
+            CPU_SET (first, set);
+        while (*p == ',' || *p == ' ')
+            p++;
+    }
+
+    return CPU_COUNT (set) ? 0 : -1;
+}
+
+void
+hev_thread_place (const char *cpus, int nice, int util_min)
+{
+    if (cpus) {
+        cpu_set_t set;
+        int res;
+
+        if (0 == strcmp (cpus, "performance"))
+            res = parse_performance (&set);
+        else
+            res = parse_list (cpus, &set);
+
+        if (res < 0)
+            LOG_I ("thread place: no cpus from %s", cpus);
+        else if (sched_setaffinity (0, sizeof (set), &set) < 0)
+            LOG_W ("thread place: affinity %s", cpus);
+    }
+
+    if (nice) {
+        if (setpriority (PRIO_PROCESS, syscall (SYS_gettid), nice) < 0)
+            LOG_W ("thread place: nice %d", nice);
+    }
+
+#if defined(SYS_sched_setattr)
+    if (util_min > 0) {
+        HevSchedAttr attr;
+
+        memset (&attr, 0, sizeof (attr));
+        attr.size = sizeof (attr);
+        attr.sched_flags = SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS |
+                           SCHED_FLAG_UTIL_CLAMP_MIN;
+        attr.sched_util_min = util_min > 1024 ? 1024 : util_min;
+        if (syscall (SYS_sched_setattr, 0, &attr, 0) < 0)
+            LOG_W ("thread place: util-min %d", util_min);
+    }
+#endif
+}
+
+#else
+
+void
+hev_thread_place (const char *cpus, int nice, int util_min)
+{
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ ============================================================================
+ Name        : hev-thread-place.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Thread placement
+ ============================================================================
+ */
+
+#ifndef __HEV_THREAD_PLACE_H__
+#define __HEV_THREAD_PLACE_H__
+
+/*
+ * Place the calling thread. cpus is a list such as "4-7,9", or
+ * "performance" for every CPU but those of the lowest capacity, which on
+ * big.LITTLE leaves out the little cores; NULL keeps the affinity. nice is
+ * set when not 0, and util_min (0 to 1024, 0: off) asks the scheduler to
+ * run the thread as if it used that much of a CPU, which keeps its core at
+ * a higher frequency. Each step that fails is logged and skipped.
+ */
+void hev_thread_place (const char *cpus, int nice, int util_min);
+
+#endif /* __HEV_THREAD_PLACE_H__ */
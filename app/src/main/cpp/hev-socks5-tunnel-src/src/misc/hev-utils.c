@@ -2,15 +2,17 @@
  ============================================================================
  Name        : hev-utils.c
  Author      : hev <r@hev.cc>
- Copyright   : Copyright (c) 2023 hev
+ Copyright   : Copyright (c) 2023 - 2025 hev
  Description : Utils
  ============================================================================
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <sys/resource.h>
 
 #if defined(__APPLE__)
@@ -87,18 +89,30 @@ hev_socks5_addr_from_lwip (HevSocks5Addr *addr, const ip_addr_t *ip, u16_t port)
     switch (ip->type) {
     case IPADDR_TYPE_V4: {
         HevMappedDNS *dns = hev_mapped_dns_get ();
-        const char *name = NULL;
+        char name[256];
+        int res = -1;
         if (dns)
-            name = hev_mapped_dns_lookup (dns, ntohl (ip_2_ip4 (ip)->addr));
-        if (name)
+            res = hev_mapped_dns_lookup (dns, ntohl (ip_2_ip4 (ip)->addr),
+                                         name, sizeof (name));
+        if (res >= 0)
             hev_socks5_addr_from_name (addr, name, htons (port));
         else
             hev_socks5_addr_from_ipv4 (addr, ip, htons (port));
         return 0;
     }
-    case IPADDR_TYPE_V6:
-        hev_socks5_addr_from_ipv6 (addr, ip, htons (port));
+    case IPADDR_TYPE_V6: {
+        HevMappedDNS *dns = hev_mapped_dns_get ();
+        char name[256];
+        int res = -1;
+        if (dns)
+            res = hev_mapped_dns_lookup6 (dns, ip_2_ip6 (ip)->addr, name,
+                                          sizeof (name));
+        if (res >= 0)
+            hev_socks5_addr_from_name (addr, name, htons (port));
+        else
+            hev_socks5_addr_from_ipv6 (addr, ip, htons (port));
         return 0;
+    }
     default:
         return -1;
     }
@@ -10,6 +10,8 @@
 #ifndef __HEV_UTILS_H__
 #define __HEV_UTILS_H__
 
+#include <sys/uio.h>
+#include <sys/types.h>
 #include <lwip/ip_addr.h>
 #include <hev-socks5-proto.h>
 
@@ -3,7 +3,9 @@
 ENABLE_DEBUG := 0
 ENABLE_STACK_OVERFLOW_DETECTION := 1
 ENABLE_MEMALLOC_SLICE := 1
+ENABLE_MEMALLOC_SLAB := 0
 ENABLE_IO_SPLICE_SYSCALL := 1
+ENABLE_IO_URING := 0
 
 # Stack backend
 # {
@@ -20,10 +22,29 @@ CONFIG_STACK_BACKEND := STACK_MMAP
 # }
 CONFIG_STACK_OVERFLOW_DETECTION := 1
 
+# Released stacks cached per task system (mmap backend)
+CONFIG_STACK_CACHE_MAX_COUNT := 32
+
+# Return unused stack pages of tasks waiting longer than this (ms, 0 = never),
+# the same idle sweep trims the slab allocator
+CONFIG_STACK_RECLAIM_TIMEOUT := 5000
+
+# Idle splice pipe pairs cached per task system, and the size a splice pipe
+# may grow to while transfers keep filling it (bytes)
+CONFIG_IO_SPLICE_PIPE_CACHE := 16
+CONFIG_IO_SPLICE_PIPE_MAX_SIZE := 262144
+
+# Released circular buffers cached per task system and size class
+CONFIG_IO_BUFFER_CACHE := 64
+
 CONFIG_MEMALLOC_SLICE_ALIGN := 64
 CONFIG_MEMALLOC_SLICE_MAX_SIZE := 4096
 CONFIG_MEMALLOC_SLICE_MAX_COUNT := 1000
 
+# Slab allocator: mapping size per slab, magazine depth per size class
+CONFIG_MEMALLOC_SLAB_SIZE := 65536
+CONFIG_MEMALLOC_SLAB_MAGAZINE := 32
+
 # Schedule clock
 # {
 #   CLOCK_NONE,
@@ -32,6 +53,19 @@ CONFIG_MEMALLOC_SLICE_MAX_COUNT := 1000
 # }
 CONFIG_SCHED_CLOCK := CLOCK_NONE
 
+# Run queue
+# {
+#   SCHED_RBTREE, fair share, ordered by runtime weighted by priority
+#   SCHED_BUCKET, strict priority, one FIFO per priority level
+# }
+CONFIG_SCHED_QUEUE := SCHED_RBTREE
+
+# Schedule passes between non-blocking I/O polls while tasks are runnable
+CONFIG_SCHED_POLL_INTERVAL := 8
+
+# Task runs between the ones the profiler times, 0 only counts switches
+CONFIG_SCHED_PROFILE_INTERVAL := 64
+
 CONFIG_CFLAGS :=
 
 ifeq ($(ENABLE_DEBUG),1)
@@ -46,13 +80,31 @@ ifeq ($(ENABLE_MEMALLOC_SLICE),1)
 	CONFIG_CFLAGS+=-DENABLE_MEMALLOC_SLICE
 endif
 
+ifeq ($(ENABLE_MEMALLOC_SLAB),1)
+	CONFIG_CFLAGS+=-DENABLE_MEMALLOC_SLAB
+endif
+
 ifeq ($(ENABLE_IO_SPLICE_SYSCALL),1)
 	CONFIG_CFLAGS+=-DENABLE_IO_SPLICE_SYSCALL
 endif
 
+ifeq ($(ENABLE_IO_URING),1)
+	CONFIG_CFLAGS+=-DENABLE_IO_URING
+endif
+
 CONFIG_CFLAGS+=-DCONFIG_STACK_BACKEND=$(CONFIG_STACK_BACKEND)
 CONFIG_CFLAGS+=-DCONFIG_STACK_OVERFLOW_DETECTION=$(CONFIG_STACK_OVERFLOW_DETECTION)
+CONFIG_CFLAGS+=-DCONFIG_STACK_CACHE_MAX_COUNT=$(CONFIG_STACK_CACHE_MAX_COUNT)
+CONFIG_CFLAGS+=-DCONFIG_STACK_RECLAIM_TIMEOUT=$(CONFIG_STACK_RECLAIM_TIMEOUT)
+CONFIG_CFLAGS+=-DCONFIG_IO_SPLICE_PIPE_CACHE=$(CONFIG_IO_SPLICE_PIPE_CACHE)
+CONFIG_CFLAGS+=-DCONFIG_IO_SPLICE_PIPE_MAX_SIZE=$(CONFIG_IO_SPLICE_PIPE_MAX_SIZE)
+CONFIG_CFLAGS+=-DCONFIG_IO_BUFFER_CACHE=$(CONFIG_IO_BUFFER_CACHE)
 CONFIG_CFLAGS+=-DCONFIG_MEMALLOC_SLICE_ALIGN=$(CONFIG_MEMALLOC_SLICE_ALIGN)
 CONFIG_CFLAGS+=-DCONFIG_MEMALLOC_SLICE_MAX_SIZE=$(CONFIG_MEMALLOC_SLICE_MAX_SIZE)
 CONFIG_CFLAGS+=-DCONFIG_MEMALLOC_SLICE_MAX_COUNT=$(CONFIG_MEMALLOC_SLICE_MAX_COUNT)
+CONFIG_CFLAGS+=-DCONFIG_MEMALLOC_SLAB_SIZE=$(CONFIG_MEMALLOC_SLAB_SIZE)
+CONFIG_CFLAGS+=-DCONFIG_MEMALLOC_SLAB_MAGAZINE=$(CONFIG_MEMALLOC_SLAB_MAGAZINE)
 CONFIG_CFLAGS+=-DCONFIG_SCHED_CLOCK=$(CONFIG_SCHED_CLOCK)
+CONFIG_CFLAGS+=-DCONFIG_SCHED_QUEUE=$(CONFIG_SCHED_QUEUE)
+CONFIG_CFLAGS+=-DCONFIG_SCHED_POLL_INTERVAL=$(CONFIG_SCHED_POLL_INTERVAL)
+CONFIG_CFLAGS+=-DCONFIG_SCHED_PROFILE_INTERVAL=$(CONFIG_SCHED_PROFILE_INTERVAL)
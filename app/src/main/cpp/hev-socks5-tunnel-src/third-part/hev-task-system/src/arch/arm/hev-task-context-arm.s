@@ -0,0 +1,34 @@
+/*
+ ============================================================================
+ Name        : hev-task-context-arm.s
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description :
+ ============================================================================
+ */
+
+#include "asm.h"
+
+/* r4 - r11, sp, lr, d8 - d15 with VFP */
+
+NESTED(hev_task_context_save)
+    mov    ip, sp
+    stmia  r0, {r4-r11, ip, lr}
+#if defined(__ARM_FP)
+    add    ip, r0, #0x28
+    vstmia ip, {d8-d15}
+#endif
+    mov    r0, #0
+    bx     lr
+END(hev_task_context_save)
+
+NESTED(hev_task_context_load)
+#if defined(__ARM_FP)
+    add    ip, r0, #0x28
+    vldmia ip, {d8-d15}
+#endif
+    ldmia  r0, {r4-r11, ip, lr}
+    mov    sp, ip
+    mov    r0, r1
+    bx     lr
+END(hev_task_context_load)
@@ -0,0 +1,84 @@
+/*
+ ============================================================================
+ Name        : hev-task-context-riscv64.s
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description :
+ ============================================================================
+ */
+
+/* ra, sp, s0 - s11, fs0 - fs11 with the D extension */
+
+    .globl hev_task_context_save
+    .type hev_task_context_save, @function
+
+hev_task_context_save:
+    sd  ra, 0x00(a0)
+    sd  sp, 0x08(a0)
+    sd  s0, 0x10(a0)
+    sd  s1, 0x18(a0)
+    sd  s2, 0x20(a0)
+    sd  s3, 0x28(a0)
+    sd  s4, 0x30(a0)
+    sd  s5, 0x38(a0)
+    sd  s6, 0x40(a0)
+    sd  s7, 0x48(a0)
+    sd  s8, 0x50(a0)
+    sd  s9, 0x58(a0)
+    sd  s10, 0x60(a0)
+    sd  s11, 0x68(a0)
+#if defined(__riscv_flen)
+    fsd  fs0, 0x70(a0)
+    fsd  fs1, 0x78(a0)
+    fsd  fs2, 0x80(a0)
+    fsd  fs3, 0x88(a0)
+    fsd  fs4, 0x90(a0)
+    fsd  fs5, 0x98(a0)
+    fsd  fs6, 0xa0(a0)
+    fsd  fs7, 0xa8(a0)
+    fsd  fs8, 0xb0(a0)
+    fsd  fs9, 0xb8(a0)
+    fsd  fs10, 0xc0(a0)
+    fsd  fs11, 0xc8(a0)
+#endif
+    li  a0, 0
+    ret
+
+    .size hev_task_context_save, . - hev_task_context_save
+
+    .globl hev_task_context_load
+    .type hev_task_context_load, @function
+
+hev_task_context_load:
+    ld  ra, 0x00(a0)
+    ld  sp, 0x08(a0)
+    ld  s0, 0x10(a0)
+    ld  s1, 0x18(a0)
+    ld  s2, 0x20(a0)
+    ld  s3, 0x28(a0)
+    ld  s4, 0x30(a0)
+    ld  s5, 0x38(a0)
+    ld  s6, 0x40(a0)
+    ld  s7, 0x48(a0)
+    ld  s8, 0x50(a0)
+    ld  s9, 0x58(a0)
+    ld  s10, 0x60(a0)
+    ld  s11, 0x68(a0)
+#if defined(__riscv_flen)
+    fld  fs0, 0x70(a0)
+    fld  fs1, 0x78(a0)
+    fld  fs2, 0x80(a0)
+    fld  fs3, 0x88(a0)
+    fld  fs4, 0x90(a0)
+    fld  fs5, 0x98(a0)
+    fld  fs6, 0xa0(a0)
+    fld  fs7, 0xa8(a0)
+    fld  fs8, 0xb0(a0)
+    fld  fs9, 0xb8(a0)
+    fld  fs10, 0xc0(a0)
+    fld  fs11, 0xc8(a0)
+#endif
+    mv  a0, a1
+    ret
+
+    .size hev_task_context_load, . - hev_task_context_load
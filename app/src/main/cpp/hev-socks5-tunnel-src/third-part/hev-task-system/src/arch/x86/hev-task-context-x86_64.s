@@ -0,0 +1,39 @@
+/*
+ ============================================================================
+ Name        : hev-task-context-x86_64.s
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description :
+ ============================================================================
+ */
+
+#include "asm.h"
+
+/* rbx, rbp, r12 - r15, rsp, rip */
+
+NESTED(hev_task_context_save)
+    movq  (%rsp), %rdx
+    leaq  0x08(%rsp), %rcx
+    movq  %rbx, 0x00(%rdi)
+    movq  %rbp, 0x08(%rdi)
+    movq  %r12, 0x10(%rdi)
+    movq  %r13, 0x18(%rdi)
+    movq  %r14, 0x20(%rdi)
+    movq  %r15, 0x28(%rdi)
+    movq  %rcx, 0x30(%rdi)
+    movq  %rdx, 0x38(%rdi)
+    xorl  %eax, %eax
+    retq
+END(hev_task_context_save)
+
+NESTED(hev_task_context_load)
+    movq  0x00(%rdi), %rbx
+    movq  0x08(%rdi), %rbp
+    movq  0x10(%rdi), %r12
+    movq  0x18(%rdi), %r13
+    movq  0x20(%rdi), %r14
+    movq  0x28(%rdi), %r15
+    movq  0x30(%rdi), %rsp
+    movl  %esi, %eax
+    jmpq  *0x38(%rdi)
+END(hev_task_context_load)
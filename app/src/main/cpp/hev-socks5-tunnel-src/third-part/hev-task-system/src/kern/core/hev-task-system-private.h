@@ -11,7 +11,8 @@
 #define __HEV_TASK_SYSTEM_PRIVATE_H__
 
 #include <time.h>
-#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include "hev-task-system.h"
 #include "kern/task/hev-task.h"
@@ -20,10 +21,18 @@
 #include "kern/io/hev-task-io-reactor.h"
 #include "lib/list/hev-list.h"
 #include "lib/dns/hev-task-dns-proxy.h"
+#include "lib/io/basic/hev-task-io-private.h"
+#include "lib/io/buffer/hev-circular-buffer-private.h"
 #include "lib/rbtree/hev-rbtree-cached.h"
 #include "lib/misc/hev-task-stack-detector.h"
 
 #define CLOCK_NONE (-1)
+
+#if defined(CLOCK_MONOTONIC_COARSE)
+#define CACHED_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define CACHED_CLOCK CLOCK_MONOTONIC
+#endif
 #define HEV_TASK_RUN_SCHEDULER HEV_TASK_YIELD_COUNT
 #define PRIORITY_COUNT (HEV_TASK_PRIORITY_MAX - HEV_TASK_PRIORITY_MIN + 1)
 
@@ -47,11 +56,38 @@ struct _HevTaskSystemContext
     HevTaskStackDetector *stack_detector;
 
     HevTask *current_task;
+#if CONFIG_SCHED_QUEUE == SCHED_BUCKET
+    HevList running_tasks[PRIORITY_COUNT];
+    unsigned int running_bitmap;
+#else
     HevRBTreeCached running_tasks;
+#endif
+
+    HevTaskStack *stack_cache;
+    unsigned int stack_cache_count;
+
+    HevTaskIOPipe pipe_cache[CONFIG_IO_SPLICE_PIPE_CACHE];
+    unsigned int pipe_cache_count;
+
+    HevCircularBuffer *buffer_cache[HEV_CIRCULAR_BUFFER_CLASSES];
+    unsigned int buffer_cache_count[HEV_CIRCULAR_BUFFER_CLASSES];
 
     struct timespec sched_time;
 
-    jmp_buf kernel_context;
+    uint64_t clock;
+    unsigned int clock_slack;
+    unsigned int timer_slack;
+
+    unsigned int poll_skips;
+    uint64_t stack_reclaim_time;
+    HevTaskSystemStats stats;
+
+    HevTaskProfile class_profile[HEV_TASK_CLASS_MAX];
+    struct timespec profile_time;
+    unsigned int profile_seed;
+    int profile_sampled;
+
+    HevTaskContext kernel_context;
 
     HevList all_tasks;
 };
@@ -65,5 +101,18 @@ void hev_task_system_wakeup_task_with_context (HevTaskSystemContext *ctx,
                                                HevTask *task);
 
 HevTaskSystemContext *hev_task_system_get_context (void);
+/* Also safe before the first hev_task_system_init, NULL without a context. */
+HevTaskSystemContext *hev_task_system_find_context (void);
+
+static inline void
+hev_task_system_update_clock (HevTaskSystemContext *ctx)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CACHED_CLOCK, &ts) < 0)
+        abort ();
+
+    ctx->clock = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 #endif /* __HEV_TASK_SYSTEM_PRIVATE_H__ */
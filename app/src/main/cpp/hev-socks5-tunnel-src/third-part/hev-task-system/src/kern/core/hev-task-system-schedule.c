@@ -7,7 +7,7 @@
  ============================================================================
  */
 
-/* Disable signal stack check in longjmp */
+/* Disable signal stack check in longjmp, for the _setjmp fallback */
 #ifdef _FORTIFY_SOURCE
 #undef _FORTIFY_SOURCE
 #endif
@@ -20,6 +20,7 @@
 #include "kern/task/hev-task-executer.h"
 #include "kern/io/hev-task-io-reactor.h"
 #include "lib/misc/hev-compiler.h"
+#include "mem/api/hev-memory-allocator-api.h"
 
 static inline void
 hev_task_system_get_clock_time (struct timespec *ts)
@@ -33,6 +34,7 @@ hev_task_system_get_clock_time (struct timespec *ts)
 static inline void
 hev_task_system_update_sched_key (HevTaskSystemContext *ctx)
 {
+#if CONFIG_SCHED_QUEUE != SCHED_BUCKET
     HevTask *curr_task = ctx->current_task;
     uint64_t runtime = 1;
 
@@ -54,14 +56,101 @@ hev_task_system_update_sched_key (HevTaskSystemContext *ctx)
 #endif
 
     curr_task->sched_key += runtime * curr_task->priority;
+#endif
 }
 
 static inline void
 hev_task_system_update_sched_time (HevTaskSystemContext *ctx)
 {
     hev_task_system_get_clock_time (&ctx->sched_time);
+
+#if CONFIG_SCHED_PROFILE_INTERVAL > 0
+    /*
+     * Time each run with a chance of one in CONFIG_SCHED_PROFILE_INTERVAL,
+     * as the thread's CPU time is a system call to read. A fixed stride
+     * would keep hitting the same tasks of a round-robin. CPU time rather
+     * than wall time, so a preempted thread doesn't bill its tasks.
+     */
+    ctx->profile_seed = ctx->profile_seed * 1103515245 + 12345;
+    if ((ctx->profile_seed >> 16) % CONFIG_SCHED_PROFILE_INTERVAL)
+        return;
+
+    ctx->profile_sampled = 1;
+    if (-1 == clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ctx->profile_time))
+        abort ();
+#endif
+}
+
+static inline void
+hev_task_system_update_profile (HevTaskSystemContext *ctx)
+{
+    HevTask *curr_task = ctx->current_task;
+    HevTaskProfile *klass = &ctx->class_profile[curr_task->klass];
+
+    curr_task->profile.switches++;
+    klass->switches++;
+
+#if CONFIG_SCHED_PROFILE_INTERVAL > 0
+    if (ctx->profile_sampled) {
+        struct timespec curr_time;
+        uint64_t runtime;
+
+        if (-1 == clock_gettime (CLOCK_THREAD_CPUTIME_ID, &curr_time))
+            abort ();
+
+        runtime = (uint64_t)(curr_time.tv_sec - ctx->profile_time.tv_sec) *
+                      1000000000UL +
+                  curr_time.tv_nsec - ctx->profile_time.tv_nsec;
+        runtime *= CONFIG_SCHED_PROFILE_INTERVAL;
+
+        curr_task->profile.run_time += runtime;
+        klass->run_time += runtime;
+        ctx->profile_sampled = 0;
+    }
+#endif
 }
 
+#if CONFIG_SCHED_QUEUE == SCHED_BUCKET
+
+static inline uint64_t
+hev_task_system_get_min_sched_key (HevTaskSystemContext *ctx)
+{
+    return 0;
+}
+
+static inline void
+hev_task_system_queue_add (HevTaskSystemContext *ctx, HevTask *task)
+{
+    int i = task->priority - HEV_TASK_PRIORITY_MIN;
+
+    hev_list_add_tail (&ctx->running_tasks[i], &task->sched_node);
+    ctx->running_bitmap |= 1U << i;
+}
+
+static inline void
+hev_task_system_queue_del (HevTaskSystemContext *ctx, HevTask *task)
+{
+    int i = task->priority - HEV_TASK_PRIORITY_MIN;
+
+    hev_list_del (&ctx->running_tasks[i], &task->sched_node);
+    if (!hev_list_first (&ctx->running_tasks[i]))
+        ctx->running_bitmap &= ~(1U << i);
+}
+
+static inline HevTask *
+hev_task_system_queue_first (HevTaskSystemContext *ctx)
+{
+    HevListNode *node;
+    int i;
+
+    i = __builtin_ctz (ctx->running_bitmap);
+    node = hev_list_first (&ctx->running_tasks[i]);
+
+    return container_of (node, HevTask, sched_node);
+}
+
+#else /* CONFIG_SCHED_QUEUE == SCHED_RBTREE */
+
 static inline uint64_t
 hev_task_system_get_min_sched_key (HevTaskSystemContext *ctx)
 {
@@ -77,8 +166,9 @@ hev_task_system_get_min_sched_key (HevTaskSystemContext *ctx)
 }
 
 static inline void
-_hev_task_system_insert_task (HevRBTreeCached *tree, HevTask *task)
+hev_task_system_queue_add (HevTaskSystemContext *ctx, HevTask *task)
 {
+    HevRBTreeCached *tree = &ctx->running_tasks;
     HevRBTreeNode **new = &tree->base.root, *parent = NULL;
     int leftmost = 1;
 
@@ -98,13 +188,31 @@ _hev_task_system_insert_task (HevRBTreeCached *tree, HevTask *task)
     hev_rbtree_cached_insert_color (tree, &task->sched_node, leftmost);
 }
 
+static inline void
+hev_task_system_queue_del (HevTaskSystemContext *ctx, HevTask *task)
+{
+    hev_rbtree_cached_erase (&ctx->running_tasks, &task->sched_node);
+}
+
+static inline HevTask *
+hev_task_system_queue_first (HevTaskSystemContext *ctx)
+{
+    HevRBTreeNode *sched_node;
+
+    sched_node = hev_rbtree_cached_first (&ctx->running_tasks);
+
+    return container_of (sched_node, HevTask, sched_node);
+}
+
+#endif /* CONFIG_SCHED_QUEUE */
+
 static inline void
 hev_task_system_insert_task (HevTaskSystemContext *ctx, HevTask *task)
 {
     task->state = HEV_TASK_RUNNING;
     task->priority = task->next_priority;
 
-    _hev_task_system_insert_task (&ctx->running_tasks, task);
+    hev_task_system_queue_add (ctx, task);
 
     ctx->running_task_count++;
 }
@@ -114,10 +222,11 @@ hev_task_system_reinsert_current_task (HevTaskSystemContext *ctx)
 {
     HevTask *task = ctx->current_task;
 
+    hev_task_system_queue_del (ctx, task);
+
     task->priority = task->next_priority;
 
-    hev_rbtree_cached_erase (&ctx->running_tasks, &task->sched_node);
-    _hev_task_system_insert_task (&ctx->running_tasks, task);
+    hev_task_system_queue_add (ctx, task);
 }
 
 static inline void
@@ -128,7 +237,7 @@ hev_task_system_remove_current_task (HevTaskSystemContext *ctx,
 
     task->state = state;
 
-    hev_rbtree_cached_erase (&ctx->running_tasks, &task->sched_node);
+    hev_task_system_queue_del (ctx, task);
 
     ctx->running_task_count--;
 
@@ -137,6 +246,7 @@ hev_task_system_remove_current_task (HevTaskSystemContext *ctx,
         hev_task_unref (task);
     } else {
         task->sched_key = task->next_priority;
+        task->wait_time = ctx->clock;
     }
 }
 
@@ -156,43 +266,111 @@ hev_task_system_wakeup_task_with_context (HevTaskSystemContext *ctx,
     hev_task_system_insert_task (ctx, task);
 }
 
+static inline void
+hev_task_system_reclaim_stacks (HevTaskSystemContext *ctx)
+{
+#if CONFIG_STACK_RECLAIM_TIMEOUT > 0
+    HevListNode *node;
+
+    if (ctx->clock < ctx->stack_reclaim_time)
+        return;
+
+    ctx->stack_reclaim_time = ctx->clock + CONFIG_STACK_RECLAIM_TIMEOUT / 2;
+
+    /*
+     * Deep call paths (DNS, TLS) leave pages faulted in below the point
+     * where a task now sleeps. Drop them once per long wait, stack_sp is
+     * cleared until the task is switched out again.
+     */
+    node = hev_list_first (&ctx->all_tasks);
+    for (; node; node = hev_list_node_next (node)) {
+        HevTask *task = container_of (node, HevTask, list_node);
+
+        if ((task->state != HEV_TASK_WAITING) || !task->stack_sp)
+            continue;
+        if ((ctx->clock - task->wait_time) < CONFIG_STACK_RECLAIM_TIMEOUT)
+            continue;
+
+        if (hev_task_stack_reclaim (task->stack, task->stack_sp) == 0)
+            ctx->stats.stack_reclaims++;
+        task->stack_sp = NULL;
+    }
+
+    /* Idle too, hand empty slabs back. */
+    hev_malloc_trim ();
+#endif
+}
+
 static inline void
 hev_task_system_io_poll (HevTaskSystemContext *ctx, int timeout)
 {
-    int i, count;
     HevTaskIOReactorWaitEvent events[1024];
+    int i, count;
 
-    if (timeout < 0)
+    if (timeout < 0) {
+        hev_task_system_update_clock (ctx);
+        hev_task_system_reclaim_stacks (ctx);
         timeout = hev_task_timer_get_timeout (ctx->timer);
+    }
 
-    count = hev_task_io_reactor_wait (ctx->reactor, events, 1024, timeout);
-    for (i = 0; i < count; i++) {
-        HevTaskSchedEntity *sched_entity;
+    /*
+     * A full batch may leave more events pending, drain them without
+     * waiting. The reactors are edge-triggered, so this terminates.
+     */
+    do {
+        count = hev_task_io_reactor_wait (ctx->reactor, events,
+                                          ARRAY_SIZE (events), timeout);
+        ctx->stats.polls++;
+        if (timeout)
+            ctx->stats.wakeups++;
+        if (count <= 0) {
+            ctx->stats.empty_polls++;
+            break;
+        }
 
-        sched_entity = hev_task_io_reactor_wait_event_get_data (&events[i]);
-        hev_task_system_wakeup_task_with_context (ctx, sched_entity->task);
-    }
+        ctx->stats.poll_events += count;
+        for (i = 0; i < count; i++) {
+            HevTaskSchedEntity *sched_entity;
 
+            sched_entity = hev_task_io_reactor_wait_event_get_data (&events[i]);
+            hev_task_system_wakeup_task_with_context (ctx, sched_entity->task);
+        }
+
+        timeout = 0;
+    } while (count == ARRAY_SIZE (events));
+
+    hev_task_system_update_clock (ctx);
     hev_task_timer_wake (ctx->timer);
 }
 
 static inline void
 hev_task_system_pick_current_task (HevTaskSystemContext *ctx)
 {
-    HevRBTreeNode *sched_node;
+    ctx->stats.switches++;
 
     if (ctx->running_task_count < ctx->total_task_count) {
         if (ctx->running_task_count) {
-            hev_task_system_io_poll (ctx, 0);
+            /*
+             * Runnable tasks keep the CPU busy, only look for I/O every
+             * few passes instead of paying a syscall per switch.
+             */
+            if (++ctx->poll_skips >= CONFIG_SCHED_POLL_INTERVAL) {
+                ctx->poll_skips = 0;
+                hev_task_system_io_poll (ctx, 0);
+            }
         } else {
+            ctx->poll_skips = 0;
             do {
                 hev_task_system_io_poll (ctx, -1);
             } while (!ctx->running_task_count);
         }
+    } else if (++ctx->poll_skips >= CONFIG_SCHED_POLL_INTERVAL) {
+        /* Nothing to poll, still keep the cached clock moving. */
+        ctx->poll_skips = 0;
+        hev_task_system_update_clock (ctx);
     }
 
-    sched_node = hev_rbtree_cached_first (&ctx->running_tasks);
-    ctx->current_task = container_of (sched_node, HevTask, sched_node);
+    ctx->current_task = hev_task_system_queue_first (ctx);
 }
 
 void
@@ -205,25 +383,29 @@ hev_task_system_schedule (HevTaskYieldType type)
          * NOTE: in task context
          * save current task context
          */
-        if (_setjmp (ctx->current_task->context))
+        ctx->current_task->stack_sp = __builtin_frame_address (0);
+        if (hev_task_context_save (ctx->current_task->context))
             return; /* resume to task context */
 
         /* resume to kernel context */
-        _longjmp (ctx->kernel_context, type);
+        hev_task_context_load (ctx->kernel_context, type);
     }
 
     /* NOTE: in kernel context */
     if (type == HEV_TASK_RUN_SCHEDULER) {
-        switch (_setjmp (ctx->kernel_context)) {
+        switch (hev_task_context_save (ctx->kernel_context)) {
         case HEV_TASK_SCHED_SWITCH:
+            hev_task_system_update_profile (ctx);
             hev_task_system_update_sched_key (ctx);
             hev_task_system_reinsert_current_task (ctx);
             break;
         case HEV_TASK_SCHED_WAITIO:
+            hev_task_system_update_profile (ctx);
             hev_task_system_update_sched_key (ctx);
             hev_task_system_remove_current_task (ctx, HEV_TASK_WAITING);
             break;
         case HEV_TASK_SCHED_REMOVE:
+            hev_task_system_update_profile (ctx);
             hev_task_system_remove_current_task (ctx, HEV_TASK_STOPPED);
             break;
         }
@@ -242,7 +424,7 @@ hev_task_system_schedule (HevTaskYieldType type)
     hev_task_system_update_sched_time (ctx);
 
     /* switch to task */
-    _longjmp (ctx->current_task->context, 1);
+    hev_task_context_load (ctx->current_task->context, 1);
 }
 
 void
@@ -277,5 +459,5 @@ hev_task_system_kill_current_task (void)
      * NOTE: remove current task in kernel context, because current
      * task stack may be freed.
      */
-    _longjmp (ctx->kernel_context, HEV_TASK_SCHED_REMOVE);
+    hev_task_context_load (ctx->kernel_context, HEV_TASK_SCHED_REMOVE);
 }
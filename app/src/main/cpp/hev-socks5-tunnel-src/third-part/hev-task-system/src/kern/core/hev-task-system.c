@@ -13,6 +13,7 @@
 #include "lib/misc/hev-compiler.h"
 #include "lib/misc/hev-task-stack-detector.h"
 #include "mem/api/hev-memory-allocator-api.h"
+#include "mem/slab/hev-memory-allocator-slab.h"
 #include "mem/slice/hev-memory-allocator-slice.h"
 
 #include "hev-task-system-private.h"
@@ -34,6 +35,14 @@ hev_task_system_get_context (void)
     return pthread_getspecific (key);
 }
 
+HevTaskSystemContext *
+hev_task_system_find_context (void)
+{
+    pthread_once (&key_once, pthread_key_creator);
+
+    return pthread_getspecific (key);
+}
+
 static inline int
 hev_task_system_set_context (HevTaskSystemContext *context)
 {
@@ -45,8 +54,11 @@ hev_task_system_init (void)
 {
     HevMemoryAllocator *allocator = NULL;
     HevTaskSystemContext *context;
+    struct timespec res;
 
-#ifdef ENABLE_MEMALLOC_SLICE
+#if defined(ENABLE_MEMALLOC_SLAB)
+    allocator = hev_memory_allocator_slab_new ();
+#elif defined(ENABLE_MEMALLOC_SLICE)
     allocator = hev_memory_allocator_slice_new ();
 #endif
     allocator = hev_memory_allocator_set_default (allocator);
@@ -77,6 +89,15 @@ hev_task_system_init (void)
     if (!context->stack_detector)
         goto free_timer;
 
+    /*
+     * The cached clock lags behind by up to its resolution plus the
+     * truncated millisecond, timers add this much so they never fire early.
+     */
+    if (clock_getres (CACHED_CLOCK, &res) < 0)
+        res.tv_nsec = 0;
+    context->clock_slack = res.tv_sec * 1000 + res.tv_nsec / 1000000 + 1;
+    hev_task_system_update_clock (context);
+
     return 0;
 
 free_timer:
@@ -99,6 +120,9 @@ hev_task_system_fini (void)
 
     if (context->dns_proxy)
         hev_task_dns_proxy_destroy (context->dns_proxy);
+    hev_task_stack_cache_clear ();
+    hev_task_io_pipe_cache_clear ();
+    hev_circular_buffer_cache_clear ();
     hev_task_stack_detector_destroy (context->stack_detector);
     hev_task_timer_destroy (context->timer);
     hev_task_io_reactor_destroy (context->reactor);
@@ -115,3 +139,66 @@ hev_task_system_run (void)
 {
     hev_task_system_schedule (HEV_TASK_RUN_SCHEDULER);
 }
+
+EXPORT_SYMBOL void
+hev_task_system_get_stats (HevTaskSystemStats *stats)
+{
+    HevTaskSystemContext *context = hev_task_system_get_context ();
+
+    *stats = context->stats;
+}
+
+EXPORT_SYMBOL void
+hev_task_system_get_class_profile (unsigned int klass, HevTaskProfile *profile)
+{
+    HevTaskSystemContext *context = hev_task_system_get_context ();
+
+    if (klass >= HEV_TASK_CLASS_MAX) {
+        profile->run_time = 0;
+        profile->switches = 0;
+        return;
+    }
+
+    *profile = context->class_profile[klass];
+}
+
+EXPORT_SYMBOL unsigned int
+hev_task_system_get_busy_tasks (HevTask **tasks, unsigned int count)
+{
+    HevTaskSystemContext *context = hev_task_system_get_context ();
+    HevListNode *node = hev_list_first (&context->all_tasks);
+    unsigned int n = 0;
+
+    for (; node; node = hev_list_node_next (node)) {
+        HevTask *task = container_of (node, HevTask, list_node);
+        unsigned long long run_time = task->profile.run_time;
+        unsigned int i;
+
+        if (!run_time || !count)
+            continue;
+
+        /* Insertion into the top @count, the last one drops out. */
+        if (n < count)
+            n++;
+        else if (tasks[count - 1]->profile.run_time >= run_time)
+            continue;
+        for (i = n - 1; i > 0 && tasks[i - 1]->profile.run_time < run_time;
+             i--)
+            tasks[i] = tasks[i - 1];
+        tasks[i] = task;
+    }
+
+    return n;
+}
+
+EXPORT_SYMBOL unsigned long long
+hev_task_system_get_clock (void)
+{
+    return hev_task_system_get_context ()->clock;
+}
+
+EXPORT_SYMBOL void
+hev_task_system_set_timer_slack (unsigned int milliseconds)
+{
+    hev_task_system_get_context ()->timer_slack = milliseconds;
+}
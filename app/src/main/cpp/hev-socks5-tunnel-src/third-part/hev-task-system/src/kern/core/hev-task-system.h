@@ -10,13 +10,27 @@
 #ifndef __HEV_TASK_SYSTEM_H__
 #define __HEV_TASK_SYSTEM_H__
 
+#include "hev-task.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #define HEV_TASK_SYSTEM_MAJOR_VERSION (5)
-#define HEV_TASK_SYSTEM_MINOR_VERSION (10)
-#define HEV_TASK_SYSTEM_MICRO_VERSION (1)
+#define HEV_TASK_SYSTEM_MINOR_VERSION (11)
+#define HEV_TASK_SYSTEM_MICRO_VERSION (0)
+
+typedef struct _HevTaskSystemStats HevTaskSystemStats;
+
+struct _HevTaskSystemStats
+{
+    unsigned long long switches;
+    unsigned long long polls;
+    unsigned long long poll_events;
+    unsigned long long empty_polls;
+    unsigned long long stack_reclaims;
+    unsigned long long wakeups;
+};
 
 /**
  * hev_task_system_init:
@@ -47,6 +61,77 @@ void hev_task_system_fini (void);
  */
 void hev_task_system_run (void);
 
+/**
+ * hev_task_system_get_stats:
+ * @stats: (out): counters
+ *
+ * Get the scheduler counters of the task system in the calling thread:
+ * schedule passes, I/O reactor polls, events they returned, polls that
+ * returned nothing, stacks of long-waiting tasks whose unused pages
+ * were returned to the kernel and polls that slept, each one a wakeup of
+ * the thread.
+ *
+ * Since: 5.11
+ */
+void hev_task_system_get_stats (HevTaskSystemStats *stats);
+
+/**
+ * hev_task_system_get_class_profile:
+ * @klass: a class id set by hev_task_set_class
+ * @profile: (out): run time and switches of all tasks of @klass
+ *
+ * Get what the tasks of a class, including the finished ones, cost the task
+ * system in the calling thread. Sampling is set by
+ * CONFIG_SCHED_PROFILE_INTERVAL, run times stay 0 when it is 0.
+ *
+ * Since: 5.12
+ */
+void hev_task_system_get_class_profile (unsigned int klass,
+                                        HevTaskProfile *profile);
+
+/**
+ * hev_task_system_get_busy_tasks:
+ * @tasks: (out): tasks, most run time first
+ * @count: capacity of @tasks
+ *
+ * Find the tasks of the task system in the calling thread that ran the
+ * longest, for hev_task_get_profile and hev_task_get_data. The tasks are
+ * not referenced, use them before switching to another task.
+ *
+ * Returns: the number of tasks stored in @tasks
+ *
+ * Since: 5.12
+ */
+unsigned int hev_task_system_get_busy_tasks (HevTask **tasks,
+                                             unsigned int count);
+
+/**
+ * hev_task_system_get_clock:
+ *
+ * Get the monotonic clock of the task system in the calling thread, in
+ * milliseconds. The value is cached, it is refreshed after every I/O poll
+ * round from CLOCK_MONOTONIC_COARSE where available, so it is cheap enough
+ * for per-packet bookkeeping but may lag by a few milliseconds.
+ *
+ * Returns: the cached clock in milliseconds.
+ *
+ * Since: 5.11
+ */
+unsigned long long hev_task_system_get_clock (void);
+
+/**
+ * hev_task_system_set_timer_slack:
+ * @milliseconds: how late a timer may fire, 0 to fire them on time
+ *
+ * Let timers of the task system in the calling thread fire up to
+ * @milliseconds late, but by at most an eighth of their timeout. Deadlines
+ * are rounded up to shared power-of-two slots, so timers armed at
+ * different times expire in the same wakeup. Timers never fire early.
+ *
+ * Since: 5.11
+ */
+void hev_task_system_set_timer_slack (unsigned int milliseconds);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,9 +7,12 @@
  ============================================================================
  */
 
-#if defined(__linux__)
+#if defined(__linux__) && !defined(ENABLE_IO_URING)
 
+#include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "mem/api/hev-memory-allocator-api.h"
@@ -19,41 +22,106 @@
 HevTaskIOReactor *
 hev_task_io_reactor_new (void)
 {
-    HevTaskIOReactor *self;
+    HevTaskIOReactorEpoll *self;
     int flags;
 
-    self = hev_malloc0 (sizeof (HevTaskIOReactor));
+    self = hev_malloc0 (sizeof (HevTaskIOReactorEpoll));
     if (!self)
         return NULL;
 
-    self->fd = epoll_create (128);
-    if (self->fd < 0) {
+    self->base.fd = epoll_create (128);
+    if (self->base.fd < 0) {
         hev_free (self);
         return NULL;
     }
 
-    flags = fcntl (self->fd, F_GETFD);
+    flags = fcntl (self->base.fd, F_GETFD);
     if (flags < 0) {
         hev_free (self);
         return NULL;
     }
 
     flags |= FD_CLOEXEC;
-    if (fcntl (self->fd, F_SETFD, flags) < 0) {
+    if (fcntl (self->base.fd, F_SETFD, flags) < 0) {
         hev_free (self);
         return NULL;
     }
 
-    return self;
+    return &self->base;
 }
 
 void
-hev_task_io_reactor_destroy (HevTaskIOReactor *self)
+hev_task_io_reactor_destroy (HevTaskIOReactor *_self)
 {
-    close (self->fd);
+    HevTaskIOReactorEpoll *self = (HevTaskIOReactorEpoll *)_self;
+
+    close (_self->fd);
+    free (self->fds);
     hev_free (self);
 }
 
+/* The table grows on add and mod only, NULL leaves the fd uncached. */
+static HevTaskIOReactorEpollFD *
+hev_task_io_reactor_epoll_get_fd (HevTaskIOReactorEpoll *self, int fd,
+                                  int grow)
+{
+    HevTaskIOReactorEpollFD *fds;
+    int size;
+
+    if (fd < 0)
+        return NULL;
+    if (fd < self->fds_size)
+        return &self->fds[fd];
+    if (!grow)
+        return NULL;
+
+    size = self->fds_size ? self->fds_size * 2 : 64;
+    if (size <= fd)
+        size = fd + 1;
+
+    fds = realloc (self->fds, sizeof (*fds) * size);
+    if (!fds)
+        return NULL;
+
+    memset (&fds[self->fds_size], 0, sizeof (*fds) * (size - self->fds_size));
+    self->fds = fds;
+    self->fds_size = size;
+
+    return &fds[fd];
+}
+
+/*
+ * Session code adds or modifies its fds before each wait, mostly with what
+ * is registered already. Those calls are answered from the table, without
+ * an epoll_ctl. Like the io_uring reactor's, the table needs fds removed
+ * before they are closed.
+ */
+static int
+hev_task_io_reactor_epoll_ctl (HevTaskIOReactorEpoll *self,
+                               HevTaskIOReactorSetupEvent *ev)
+{
+    HevTaskIOReactorEpollFD *efd;
+    int del = ev->op == HEV_TASK_IO_REACTOR_OP_DEL;
+
+    efd = hev_task_io_reactor_epoll_get_fd (self, ev->fd, !del);
+    if (efd && !del && (efd->events == ev->event.events) &&
+        (efd->data == ev->event.data.ptr))
+        return 0;
+
+    if (epoll_ctl (self->base.fd, ev->op, ev->fd, &ev->event) < 0) {
+        if (efd && (errno == ENOENT))
+            efd->events = 0;
+        return -1;
+    }
+
+    if (efd) {
+        efd->events = del ? 0 : ev->event.events;
+        efd->data = ev->event.data.ptr;
+    }
+
+    return 0;
+}
+
 int
 hev_task_io_reactor_setup (HevTaskIOReactor *self,
                            HevTaskIOReactorSetupEvent *events, int count)
@@ -62,10 +130,11 @@ hev_task_io_reactor_setup (HevTaskIOReactor *self,
 
     for (i = 0; i < count; i++) {
         HevTaskIOReactorSetupEvent *ev = &events[i];
-        res |= epoll_ctl (self->fd, ev->op, ev->fd, &ev->event);
+        res |= hev_task_io_reactor_epoll_ctl ((HevTaskIOReactorEpoll *)self,
+                                              ev);
     }
 
     return res;
 }
 
-#endif /* defined(__linux__) */
+#endif /* defined(__linux__) && !defined(ENABLE_IO_URING) */
@@ -15,9 +15,26 @@
 
 #define HEV_TASK_IO_REACTOR_EVENT_GEN_MAX (1)
 
+typedef struct _HevTaskIOReactorEpoll HevTaskIOReactorEpoll;
+typedef struct _HevTaskIOReactorEpollFD HevTaskIOReactorEpollFD;
 typedef struct _HevTaskIOReactorSetupEvent HevTaskIOReactorSetupEvent;
 typedef struct epoll_event HevTaskIOReactorWaitEvent;
 
+/* What the epoll set holds for an fd, events is zero when not added. */
+struct _HevTaskIOReactorEpollFD
+{
+    unsigned int events;
+    void *data;
+};
+
+struct _HevTaskIOReactorEpoll
+{
+    HevTaskIOReactor base;
+
+    HevTaskIOReactorEpollFD *fds;
+    int fds_size;
+};
+
 enum _HevTaskIOReactorEvents
 {
     HEV_TASK_IO_REACTOR_EV_RO = EPOLLIN,
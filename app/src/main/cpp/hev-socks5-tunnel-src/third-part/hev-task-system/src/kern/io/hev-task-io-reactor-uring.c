@@ -0,0 +1,469 @@
+/*
+ ============================================================================
+ Name        : hev-task-io-reactor-uring.c
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : I/O Reactor io_uring
+ ============================================================================
+ */
+
+#if defined(__linux__) && defined(ENABLE_IO_URING)
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "lib/misc/hev-compiler.h"
+#include "mem/api/hev-memory-allocator-api.h"
+
+#include "kern/io/hev-task-io-reactor.h"
+
+#define SQ_ENTRIES (64)
+#define CQ_ENTRIES (4096)
+
+/*
+ * Multishot poll (5.13) has no feature bit of its own, RSRC_TAGS came with
+ * the same release.
+ */
+#define REQUIRED_FEATURES                                 \
+    (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |       \
+     IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)
+
+struct _HevTaskIOReactorUringPoll
+{
+    HevListNode list_node;
+
+    int fd;
+    unsigned int events;
+    void *data;
+
+    int armed;
+    int dead;
+};
+
+static int
+hev_task_io_reactor_uring_enter (HevTaskIOReactorUring *self,
+                                 unsigned int to_submit, unsigned int wait_nr,
+                                 unsigned int flags, void *arg, size_t size)
+{
+    return syscall (__NR_io_uring_enter, self->base.fd, to_submit, wait_nr,
+                    flags, arg, size);
+}
+
+static int
+hev_task_io_reactor_uring_submit (HevTaskIOReactorUring *self)
+{
+    int res;
+
+    while (self->sq_pending) {
+        res = hev_task_io_reactor_uring_enter (self, self->sq_pending, 0, 0,
+                                               NULL, 0);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        self->sq_pending -= res;
+    }
+
+    return 0;
+}
+
+static struct io_uring_sqe *
+hev_task_io_reactor_uring_get_sqe (HevTaskIOReactorUring *self)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int head;
+    unsigned int tail;
+
+    tail = *self->sq_tail;
+    head = __atomic_load_n (self->sq_head, __ATOMIC_ACQUIRE);
+    if ((tail - head) >= self->sq_entries) {
+        if (hev_task_io_reactor_uring_submit (self) < 0)
+            return NULL;
+    }
+
+    sqe = &self->sqes[tail & self->sq_mask];
+    memset (sqe, 0, sizeof (*sqe));
+
+    return sqe;
+}
+
+static void
+hev_task_io_reactor_uring_commit_sqe (HevTaskIOReactorUring *self)
+{
+    __atomic_store_n (self->sq_tail, *self->sq_tail + 1, __ATOMIC_RELEASE);
+    self->sq_pending++;
+}
+
+static int
+hev_task_io_reactor_uring_arm (HevTaskIOReactorUring *self,
+                               HevTaskIOReactorUringPoll *poll)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int events;
+
+    sqe = hev_task_io_reactor_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    events = poll->events;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    events = (events << 16) | (events >> 16);
+#endif
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = poll->fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uintptr_t)poll;
+    hev_task_io_reactor_uring_commit_sqe (self);
+
+    poll->armed = 1;
+
+    return 0;
+}
+
+static void
+hev_task_io_reactor_uring_free (HevTaskIOReactorUring *self,
+                                HevTaskIOReactorUringPoll *poll)
+{
+    hev_list_del (&self->poll_list, &poll->list_node);
+    free (poll);
+}
+
+static int
+hev_task_io_reactor_uring_release (HevTaskIOReactorUring *self,
+                                   HevTaskIOReactorUringPoll *poll)
+{
+    struct io_uring_sqe *sqe;
+
+    /* Freed once the kernel posts the final completion of the poll. */
+    poll->dead = 1;
+
+    if (!poll->armed) {
+        hev_task_io_reactor_uring_free (self, poll);
+        return 0;
+    }
+
+    sqe = hev_task_io_reactor_uring_get_sqe (self);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = (uintptr_t)poll;
+    hev_task_io_reactor_uring_commit_sqe (self);
+
+    return 0;
+}
+
+static int
+hev_task_io_reactor_uring_add (HevTaskIOReactorUring *self,
+                               HevTaskIOReactorSetupEvent *event)
+{
+    HevTaskIOReactorUringPoll *poll;
+
+    if (event->fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (event->fd >= self->polls_size) {
+        HevTaskIOReactorUringPoll **polls;
+        int size;
+
+        size = self->polls_size ? self->polls_size * 2 : 64;
+        if (size <= event->fd)
+            size = event->fd + 1;
+
+        polls = realloc (self->polls, sizeof (*polls) * size);
+        if (!polls)
+            return -1;
+
+        memset (&polls[self->polls_size], 0,
+                sizeof (*polls) * (size - self->polls_size));
+        self->polls = polls;
+        self->polls_size = size;
+    }
+
+    if (self->polls[event->fd]) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    poll = calloc (1, sizeof (HevTaskIOReactorUringPoll));
+    if (!poll)
+        return -1;
+
+    poll->fd = event->fd;
+    poll->events = event->events;
+    poll->data = event->data;
+    hev_list_add_tail (&self->poll_list, &poll->list_node);
+
+    if (hev_task_io_reactor_uring_arm (self, poll) < 0) {
+        hev_task_io_reactor_uring_free (self, poll);
+        return -1;
+    }
+
+    self->polls[event->fd] = poll;
+
+    return 0;
+}
+
+static int
+hev_task_io_reactor_uring_del (HevTaskIOReactorUring *self,
+                               HevTaskIOReactorSetupEvent *event)
+{
+    HevTaskIOReactorUringPoll *poll = NULL;
+
+    if ((event->fd >= 0) && (event->fd < self->polls_size))
+        poll = self->polls[event->fd];
+    if (!poll) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    self->polls[event->fd] = NULL;
+
+    return hev_task_io_reactor_uring_release (self, poll);
+}
+
+static int
+hev_task_io_reactor_uring_mod (HevTaskIOReactorUring *self,
+                               HevTaskIOReactorSetupEvent *event)
+{
+    if (hev_task_io_reactor_uring_del (self, event) < 0)
+        return -1;
+
+    return hev_task_io_reactor_uring_add (self, event);
+}
+
+HevTaskIOReactor *
+hev_task_io_reactor_new (void)
+{
+    HevTaskIOReactorUring *self;
+    struct io_uring_params p;
+    unsigned int *array;
+    size_t sq_size;
+    size_t cq_size;
+    unsigned int i;
+    int fd;
+
+    self = hev_malloc0 (sizeof (HevTaskIOReactorUring));
+    if (!self)
+        return NULL;
+
+    memset (&p, 0, sizeof (p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = CQ_ENTRIES;
+
+    fd = syscall (__NR_io_uring_setup, SQ_ENTRIES, &p);
+    if (fd < 0)
+        goto free;
+
+    if ((p.features & REQUIRED_FEATURES) != REQUIRED_FEATURES)
+        goto close;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    self->ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+    self->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+    self->ring = mmap (NULL, self->ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (self->ring == MAP_FAILED)
+        goto close;
+
+    self->sqes = mmap (NULL, self->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED)
+        goto unmap;
+
+    self->sq_head = self->ring + p.sq_off.head;
+    self->sq_tail = self->ring + p.sq_off.tail;
+    self->sq_flags = self->ring + p.sq_off.flags;
+    self->sq_mask = *(unsigned int *)(self->ring + p.sq_off.ring_mask);
+    self->sq_entries = p.sq_entries;
+    self->cq_head = self->ring + p.cq_off.head;
+    self->cq_tail = self->ring + p.cq_off.tail;
+    self->cq_mask = *(unsigned int *)(self->ring + p.cq_off.ring_mask);
+    self->cqes = self->ring + p.cq_off.cqes;
+
+    array = self->ring + p.sq_off.array;
+    for (i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+
+    pthread_mutex_init (&self->mutex, NULL);
+    self->base.fd = fd;
+
+    return &self->base;
+
+unmap:
+    munmap (self->ring, self->ring_size);
+close:
+    close (fd);
+free:
+    hev_free (self);
+    return NULL;
+}
+
+void
+hev_task_io_reactor_destroy (HevTaskIOReactor *_self)
+{
+    HevTaskIOReactorUring *self = (HevTaskIOReactorUring *)_self;
+    HevListNode *node;
+
+    close (_self->fd);
+    munmap (self->sqes, self->sqes_size);
+    munmap (self->ring, self->ring_size);
+
+    node = hev_list_first (&self->poll_list);
+    while (node) {
+        HevTaskIOReactorUringPoll *poll;
+
+        poll = container_of (node, HevTaskIOReactorUringPoll, list_node);
+        node = hev_list_node_next (node);
+        free (poll);
+    }
+
+    free (self->polls);
+    pthread_mutex_destroy (&self->mutex);
+    hev_free (self);
+}
+
+int
+hev_task_io_reactor_setup (HevTaskIOReactor *_self,
+                           HevTaskIOReactorSetupEvent *events, int count)
+{
+    HevTaskIOReactorUring *self = (HevTaskIOReactorUring *)_self;
+    int i, res = 0;
+
+    pthread_mutex_lock (&self->mutex);
+
+    for (i = 0; i < count; i++) {
+        HevTaskIOReactorSetupEvent *ev = &events[i];
+
+        switch (ev->op) {
+        case HEV_TASK_IO_REACTOR_OP_ADD:
+            res |= hev_task_io_reactor_uring_add (self, ev);
+            break;
+        case HEV_TASK_IO_REACTOR_OP_MOD:
+            res |= hev_task_io_reactor_uring_mod (self, ev);
+            break;
+        case HEV_TASK_IO_REACTOR_OP_DEL:
+            res |= hev_task_io_reactor_uring_del (self, ev);
+            break;
+        }
+    }
+
+    /*
+     * Like epoll_ctl, changes take effect before returning: a waiter in
+     * another thread must see them, and a removed poll must drop its file
+     * reference before the caller closes the fd.
+     */
+    res |= hev_task_io_reactor_uring_submit (self);
+
+    pthread_mutex_unlock (&self->mutex);
+
+    return res;
+}
+
+int
+hev_task_io_reactor_wait (HevTaskIOReactor *_self,
+                          HevTaskIOReactorWaitEvent *events, int count,
+                          int timeout)
+{
+    HevTaskIOReactorUring *self = (HevTaskIOReactorUring *)_self;
+    unsigned int head, tail;
+    int n = 0;
+
+    if (count <= 0)
+        return -1;
+
+    head = *self->cq_head;
+    tail = __atomic_load_n (self->cq_tail, __ATOMIC_ACQUIRE);
+
+    /*
+     * Completions are posted into the shared ring, so a zero timeout poll
+     * only enters the kernel to flush an overflowed completion queue.
+     */
+    if (head == tail) {
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        unsigned int flags;
+        int res;
+
+        if (timeout == 0) {
+            flags = __atomic_load_n (self->sq_flags, __ATOMIC_RELAXED);
+            if (!(flags & IORING_SQ_CQ_OVERFLOW))
+                return 0;
+
+            res = hev_task_io_reactor_uring_enter (
+                self, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+        } else if (timeout < 0) {
+            res = hev_task_io_reactor_uring_enter (
+                self, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        } else {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000;
+            memset (&arg, 0, sizeof (arg));
+            arg.ts = (uintptr_t)&ts;
+            flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+            res = hev_task_io_reactor_uring_enter (self, 0, 1, flags, &arg,
+                                                   sizeof (arg));
+        }
+
+        if (res < 0)
+            return (errno == ETIME) ? 0 : -1;
+
+        tail = __atomic_load_n (self->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    pthread_mutex_lock (&self->mutex);
+
+    for (; (head != tail) && (n < count); head++) {
+        struct io_uring_cqe *cqe = &self->cqes[head & self->cq_mask];
+        HevTaskIOReactorUringPoll *poll;
+        int more;
+
+        poll = (HevTaskIOReactorUringPoll *)(uintptr_t)cqe->user_data;
+        if (!poll)
+            continue;
+
+        more = cqe->flags & IORING_CQE_F_MORE;
+        if (!more)
+            poll->armed = 0;
+
+        if (poll->dead) {
+            if (!more)
+                hev_task_io_reactor_uring_free (self, poll);
+            continue;
+        }
+
+        events[n].data = poll->data;
+        if (cqe->res < 0) {
+            events[n++].events = HEV_TASK_IO_REACTOR_EV_ER;
+            continue;
+        }
+
+        events[n++].events = cqe->res;
+        if (!more)
+            hev_task_io_reactor_uring_arm (self, poll);
+    }
+
+    __atomic_store_n (self->cq_head, head, __ATOMIC_RELEASE);
+    hev_task_io_reactor_uring_submit (self);
+
+    pthread_mutex_unlock (&self->mutex);
+
+    return n;
+}
+
+#endif /* defined(__linux__) && defined(ENABLE_IO_URING) */
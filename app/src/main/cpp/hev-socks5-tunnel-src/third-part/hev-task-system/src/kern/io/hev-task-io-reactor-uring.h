@@ -0,0 +1,137 @@
+/*
+ ============================================================================
+ Name        : hev-task-io-reactor-uring.h
+ Author      : hev <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : I/O Reactor io_uring
+ ============================================================================
+ */
+
+#ifndef __HEV_TASK_IO_REACTOR_URING_H__
+#define __HEV_TASK_IO_REACTOR_URING_H__
+
+#include <poll.h>
+#include <pthread.h>
+
+#include "lib/list/hev-list.h"
+
+#define HEV_TASK_IO_REACTOR_EVENT_GEN_MAX (1)
+
+typedef struct _HevTaskIOReactorUring HevTaskIOReactorUring;
+typedef struct _HevTaskIOReactorUringPoll HevTaskIOReactorUringPoll;
+typedef struct _HevTaskIOReactorSetupEvent HevTaskIOReactorSetupEvent;
+typedef struct _HevTaskIOReactorWaitEvent HevTaskIOReactorWaitEvent;
+
+struct _HevTaskIOReactorUring
+{
+    HevTaskIOReactor base;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_flags;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_pending;
+    struct io_uring_sqe *sqes;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring;
+    size_t ring_size;
+    size_t sqes_size;
+
+    HevTaskIOReactorUringPoll **polls;
+    int polls_size;
+    HevList poll_list;
+
+    pthread_mutex_t mutex;
+};
+
+enum _HevTaskIOReactorEvents
+{
+    HEV_TASK_IO_REACTOR_EV_RO = POLLIN,
+    HEV_TASK_IO_REACTOR_EV_WO = POLLOUT,
+    HEV_TASK_IO_REACTOR_EV_ER = POLLERR,
+};
+
+enum _HevTaskIOReactorOperation
+{
+    HEV_TASK_IO_REACTOR_OP_ADD,
+    HEV_TASK_IO_REACTOR_OP_MOD,
+    HEV_TASK_IO_REACTOR_OP_DEL,
+};
+
+struct _HevTaskIOReactorSetupEvent
+{
+    HevTaskIOReactorOperation op;
+
+    int fd;
+    unsigned int events;
+    void *data;
+};
+
+struct _HevTaskIOReactorWaitEvent
+{
+    unsigned int events;
+    void *data;
+};
+
+int hev_task_io_reactor_wait (HevTaskIOReactor *self,
+                              HevTaskIOReactorWaitEvent *events, int count,
+                              int timeout);
+
+static inline void
+hev_task_io_reactor_setup_event_set (HevTaskIOReactorSetupEvent *event, int fd,
+                                     HevTaskIOReactorOperation op,
+                                     unsigned int events, void *data)
+{
+    event->op = op;
+    event->fd = fd;
+    event->events = events;
+    event->data = data;
+}
+
+static inline int
+hev_task_io_reactor_setup_event_fd_gen (HevTaskIOReactorSetupEvent *events,
+                                        int fd, HevTaskIOReactorOperation op,
+                                        unsigned int poll_events, void *data)
+{
+    HevTaskIOReactorEvents reactor_events = 0;
+
+    if (poll_events & POLLIN)
+        reactor_events |= HEV_TASK_IO_REACTOR_EV_RO;
+    if (poll_events & POLLOUT)
+        reactor_events |= HEV_TASK_IO_REACTOR_EV_WO;
+    if (poll_events & POLLERR)
+        reactor_events |= HEV_TASK_IO_REACTOR_EV_ER;
+
+    hev_task_io_reactor_setup_event_set (events, fd, op, reactor_events, data);
+
+    return 1;
+}
+
+static inline int
+hev_task_io_reactor_setup_event_whandle_gen (HevTaskIOReactorSetupEvent *events,
+                                             void *handle,
+                                             HevTaskIOReactorOperation op,
+                                             void *data)
+{
+    return -1;
+}
+
+static inline unsigned int
+hev_task_io_reactor_wait_event_get_events (HevTaskIOReactorWaitEvent *event)
+{
+    return event->events;
+}
+
+static inline void *
+hev_task_io_reactor_wait_event_get_data (HevTaskIOReactorWaitEvent *event)
+{
+    return event->data;
+}
+
+#endif /* __HEV_TASK_IO_REACTOR_URING_H__ */
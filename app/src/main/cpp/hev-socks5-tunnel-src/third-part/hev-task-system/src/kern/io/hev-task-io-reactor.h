@@ -25,6 +25,8 @@ struct _HevTaskIOReactor
 
 #if defined(__MSYS__)
 #include "kern/io/hev-task-io-reactor-iocp.h"
+#elif defined(__linux__) && defined(ENABLE_IO_URING)
+#include "kern/io/hev-task-io-reactor-uring.h"
 #elif defined(__linux__)
 #include "kern/io/hev-task-io-reactor-epoll.h"
 #else
@@ -0,0 +1,40 @@
+/*
+ ============================================================================
+ Name        : hev-task-channel-mpsc-private.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Cross-thread MPSC Channel
+ ============================================================================
+ */
+
+#ifndef __HEV_TASK_CHANNEL_MPSC_PRIVATE_H__
+#define __HEV_TASK_CHANNEL_MPSC_PRIVATE_H__
+
+#include <sys/types.h>
+
+#include "hev-task-channel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+ssize_t hev_task_channel_mpsc_read (HevTaskChannel *self, void *buffer,
+                                    size_t count);
+ssize_t hev_task_channel_mpsc_write (HevTaskChannel *self, const void *buffer,
+                                     size_t count);
+void hev_task_channel_mpsc_destroy (HevTaskChannel *self);
+
+/*
+ * Called by the selector before it sleeps: queue @self on the read list if
+ * it has data, otherwise arm the notifier for the selecting task.
+ */
+void hev_task_channel_mpsc_select_sync (HevTaskChannel *self);
+
+/* Detach the notifier from the reading task, it must not be woken later. */
+void hev_task_channel_mpsc_unbind (HevTaskChannel *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_TASK_CHANNEL_MPSC_PRIVATE_H__ */
@@ -0,0 +1,446 @@
+/*
+ ============================================================================
+ Name        : hev-task-channel-mpsc.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Cross-thread MPSC Channel
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+#include "kern/task/hev-task.h"
+#include "lib/io/pipe/hev-task-io-pipe.h"
+#include "lib/misc/hev-compiler.h"
+#include "mem/api/hev-memory-allocator-api.h"
+
+#include "hev-task-channel-select-private.h"
+
+#include "hev-task-channel.h"
+#include "hev-task-channel-private.h"
+#include "hev-task-channel-mpsc-private.h"
+
+#define CACHE_LINE (64)
+
+typedef struct _HevTaskChannelMPSCSlot HevTaskChannelMPSCSlot;
+
+struct _HevTaskChannelMPSCSlot
+{
+    unsigned long seq;
+    size_t size;
+    HevTaskChannelData data[0];
+};
+
+/*
+ * Bounded ring with a sequence number per slot. Producers claim a run of
+ * free slots with one CAS on tail and publish each slot by bumping its
+ * sequence, the consumer releases slots in order and then moves head.
+ */
+struct _HevTaskChannelMPSC
+{
+    unsigned long tail;
+    char pad0[CACHE_LINE - sizeof (unsigned long)];
+
+    unsigned long head;
+    int waiting;
+    int closed;
+    char pad1[CACHE_LINE - sizeof (unsigned long) - sizeof (int) * 2];
+
+    int fd[2];
+    HevTask *task;
+    unsigned int mask;
+    unsigned int stride;
+    unsigned int max_size;
+
+    char slots[0];
+};
+
+static inline HevTaskChannelMPSCSlot *
+slot_get (HevTaskChannelMPSC *self, unsigned long pos)
+{
+    return (void *)self->slots + (size_t)self->stride * (pos & self->mask);
+}
+
+static int
+notifier_open (int fd[2])
+{
+#if defined(__linux__)
+    fd[0] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fd[1] = fd[0];
+    return fd[0];
+#else
+    return hev_task_io_pipe_pipe (fd);
+#endif
+}
+
+static void
+notifier_close (int fd[2])
+{
+    close (fd[0]);
+    if (fd[1] != fd[0])
+        close (fd[1]);
+}
+
+static void
+notifier_signal (int fd[2])
+{
+    uint64_t v = 1;
+
+    /* A full pipe or a saturated counter is already signaled. */
+    if (write (fd[1], &v, fd[0] == fd[1] ? sizeof (v) : 1) < 0)
+        return;
+}
+
+static void
+notifier_clear (int fd[2])
+{
+    uint64_t v[8];
+
+    while (read (fd[0], v, sizeof (v)) == sizeof (v))
+        ;
+}
+
+EXPORT_SYMBOL int
+hev_task_channel_new_mpsc (HevTaskChannel **chan, unsigned int size,
+                           unsigned int buffers)
+{
+    HevTaskChannelMPSC *mpsc;
+    HevTaskChannel *self;
+    unsigned int capacity = 1;
+    unsigned int stride;
+    size_t head;
+
+    while (capacity < buffers)
+        capacity <<= 1;
+
+    stride = sizeof (HevTaskChannelMPSCSlot) + size;
+    stride = ALIGN_UP (stride, sizeof (unsigned long long));
+
+    head = ALIGN_UP (sizeof (HevTaskChannel), CACHE_LINE) + CACHE_LINE;
+    self = hev_malloc (head + sizeof (HevTaskChannelMPSC) +
+                       (size_t)stride * capacity);
+    if (!self)
+        goto err0;
+
+    __builtin_bzero (self, sizeof (HevTaskChannel));
+    self->ref_count = 1;
+    self->max_size = size;
+
+    mpsc = (void *)ALIGN_UP ((uintptr_t)self + head - CACHE_LINE, CACHE_LINE);
+    __builtin_bzero (mpsc, sizeof (HevTaskChannelMPSC));
+    mpsc->mask = capacity - 1;
+    mpsc->stride = stride;
+    mpsc->max_size = size;
+    self->mpsc = mpsc;
+
+    if (notifier_open (mpsc->fd) < 0)
+        goto err1;
+
+    for (; capacity; capacity--) {
+        HevTaskChannelMPSCSlot *slot = slot_get (mpsc, capacity - 1);
+
+        slot->seq = capacity - 1;
+    }
+
+    *chan = self;
+
+    return 0;
+
+err1:
+    hev_free (self);
+err0:
+
+    return -1;
+}
+
+static int
+hev_task_channel_mpsc_bind (HevTaskChannelMPSC *self, HevTask *task)
+{
+    if (self->task == task)
+        return 0;
+
+    if (self->task)
+        hev_task_del_fd (self->task, self->fd[0]);
+    self->task = NULL;
+
+    if (hev_task_add_fd (task, self->fd[0], POLLIN) < 0)
+        return -1;
+    self->task = task;
+
+    return 0;
+}
+
+static inline int
+hev_task_channel_mpsc_is_readable (HevTaskChannelMPSC *self)
+{
+    HevTaskChannelMPSCSlot *slot = slot_get (self, self->head);
+
+    return __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) == (self->head + 1);
+}
+
+/*
+ * Announce the consumer is about to sleep, producers signal the notifier
+ * only when they see this, so a busy consumer costs them no syscalls.
+ * Returns nonzero if data raced in and the consumer must not sleep.
+ */
+static int
+hev_task_channel_mpsc_arm (HevTaskChannelMPSC *self)
+{
+    __atomic_store_n (&self->waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+
+    return hev_task_channel_mpsc_is_readable (self);
+}
+
+static unsigned int
+hev_task_channel_mpsc_pop (HevTaskChannel *chan, void *buffer, size_t size,
+                           unsigned int count, size_t item_size,
+                           size_t *first_size)
+{
+    HevTaskChannelMPSC *self = chan->mpsc;
+    unsigned long pos = self->head;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        HevTaskChannelMPSCSlot *slot = slot_get (self, pos);
+        size_t len;
+
+        if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != (pos + 1))
+            break;
+
+        len = slot->size < item_size ? slot->size : item_size;
+        __builtin_memcpy (buffer + size * i, slot->data, len);
+        if (i == 0)
+            *first_size = len;
+
+        __atomic_store_n (&slot->seq, pos + self->mask + 1, __ATOMIC_RELEASE);
+        pos++;
+    }
+
+    __atomic_store_n (&self->head, pos, __ATOMIC_RELEASE);
+
+    if (chan->select && !hev_task_channel_mpsc_is_readable (self))
+        hev_task_channel_select_del_read (chan->select, chan);
+
+    return i;
+}
+
+static ssize_t
+hev_task_channel_mpsc_read_wait (HevTaskChannel *chan, void *buffer,
+                                 size_t size, unsigned int count,
+                                 size_t item_size, size_t *first_size)
+{
+    HevTaskChannelMPSC *self = chan->mpsc;
+    unsigned int n;
+
+    if (hev_task_channel_mpsc_bind (self, hev_task_self ()) < 0)
+        return -1;
+
+    for (;;) {
+        n = hev_task_channel_mpsc_pop (chan, buffer, size, count, item_size,
+                                       first_size);
+        if (n)
+            break;
+
+        if (READ_ONCE (self->closed))
+            return -1;
+
+        if (!hev_task_channel_mpsc_arm (self))
+            hev_task_yield (HEV_TASK_WAITIO);
+        notifier_clear (self->fd);
+    }
+
+    __atomic_store_n (&self->waiting, 0, __ATOMIC_RELAXED);
+
+    return n;
+}
+
+static unsigned int
+hev_task_channel_mpsc_push (HevTaskChannelMPSC *self, const void *buffer,
+                            size_t size, unsigned int count, size_t item_size)
+{
+    unsigned long pos, head;
+    unsigned int i, n;
+
+    pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        unsigned long used;
+
+        head = __atomic_load_n (&self->head, __ATOMIC_ACQUIRE);
+        used = pos - head;
+        if ((long)used < 0) {
+            /* Stale tail, the consumer already passed it. */
+            pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (used > self->mask)
+            return 0;
+
+        n = self->mask + 1 - used;
+        if (n > count)
+            n = count;
+        if (__atomic_compare_exchange_n (&self->tail, &pos, pos + n, 1,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    count = n;
+
+    for (i = 0; i < count; i++) {
+        HevTaskChannelMPSCSlot *slot = slot_get (self, pos + i);
+
+        /* Freed by the consumer in order, released before head moved. */
+        slot->size = hev_task_channel_data_copy (slot->data, buffer + size * i,
+                                                 item_size);
+        __atomic_store_n (&slot->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&self->waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n (&self->waiting, 0, __ATOMIC_ACQ_REL))
+        notifier_signal (self->fd);
+
+    return count;
+}
+
+ssize_t
+hev_task_channel_mpsc_read (HevTaskChannel *self, void *buffer, size_t count)
+{
+    size_t size = 0;
+    ssize_t res;
+
+    if (count > self->max_size)
+        count = self->max_size;
+
+    res = hev_task_channel_mpsc_read_wait (self, buffer, count, 1, count,
+                                           &size);
+    if (res < 0)
+        return -1;
+
+    return size;
+}
+
+ssize_t
+hev_task_channel_mpsc_write (HevTaskChannel *self, const void *buffer,
+                             size_t count)
+{
+    HevTaskChannelMPSC *mpsc = self->mpsc;
+
+    if (count > self->max_size)
+        count = self->max_size;
+
+    /* Wait on full, producers may be plain threads without a task. */
+    while (!hev_task_channel_mpsc_push (mpsc, buffer, count, 1, count)) {
+        if (READ_ONCE (mpsc->closed))
+            return -1;
+        if (hev_task_self ())
+            hev_task_yield (HEV_TASK_YIELD);
+        else
+            sched_yield ();
+    }
+
+    return count;
+}
+
+void
+hev_task_channel_mpsc_destroy (HevTaskChannel *self)
+{
+    HevTaskChannelMPSC *mpsc = self->mpsc;
+
+    WRITE_ONCE (mpsc->closed, 1);
+    hev_task_channel_mpsc_unbind (self);
+    notifier_close (mpsc->fd);
+
+    hev_free (self);
+}
+
+void
+hev_task_channel_mpsc_unbind (HevTaskChannel *self)
+{
+    HevTaskChannelMPSC *mpsc = self->mpsc;
+
+    __atomic_store_n (&mpsc->waiting, 0, __ATOMIC_SEQ_CST);
+    if (mpsc->task)
+        hev_task_del_fd (mpsc->task, mpsc->fd[0]);
+    mpsc->task = NULL;
+}
+
+void
+hev_task_channel_mpsc_select_sync (HevTaskChannel *self)
+{
+    HevTaskChannelMPSC *mpsc = self->mpsc;
+
+    if (hev_task_channel_mpsc_bind (mpsc, self->task) < 0)
+        return;
+
+    notifier_clear (mpsc->fd);
+    if (hev_task_channel_mpsc_is_readable (mpsc) ||
+        hev_task_channel_mpsc_arm (mpsc)) {
+        __atomic_store_n (&mpsc->waiting, 0, __ATOMIC_RELAXED);
+        hev_task_channel_select_add_read (self->select, self);
+    }
+}
+
+EXPORT_SYMBOL ssize_t
+hev_task_channel_read_batch (HevTaskChannel *self, void *buffer, size_t size,
+                             unsigned int count)
+{
+    size_t first_size;
+    unsigned int i;
+
+    if (!count)
+        return 0;
+
+    if (self->mpsc) {
+        size_t item_size = size;
+
+        /* Records keep the caller's stride, only the copy is clamped. */
+        if (item_size > self->max_size)
+            item_size = self->max_size;
+        return hev_task_channel_mpsc_read_wait (self, buffer, size, count,
+                                                item_size, &first_size);
+    }
+
+    /* Wait for the first one only, then take what is already queued. */
+    if (hev_task_channel_read (self, buffer, size) < 0)
+        return -1;
+
+    for (i = 1; i < count; i++) {
+        if (!hev_task_channel_is_readable (self))
+            break;
+        if (hev_task_channel_read (self, buffer + size * i, size) < 0)
+            break;
+    }
+
+    return i;
+}
+
+EXPORT_SYMBOL ssize_t
+hev_task_channel_write_batch (HevTaskChannel *self, const void *buffer,
+                              size_t size, unsigned int count)
+{
+    HevTaskChannelMPSC *mpsc = self->mpsc;
+    unsigned int i;
+
+    if (!mpsc) {
+        for (i = 0; i < count; i++)
+            if (hev_task_channel_write (self, buffer + size * i, size) < 0)
+                break;
+        return i ? i : -1;
+    }
+
+    if (READ_ONCE (mpsc->closed))
+        return -1;
+
+    if (size > self->max_size)
+        return hev_task_channel_mpsc_push (mpsc, buffer, size, count,
+                                           self->max_size);
+
+    return hev_task_channel_mpsc_push (mpsc, buffer, size, count, size);
+}
@@ -21,6 +21,7 @@ extern "C" {
 
 typedef union _HevTaskChannelData HevTaskChannelData;
 typedef struct _HevTaskChannelBuffer HevTaskChannelBuffer;
+typedef struct _HevTaskChannelMPSC HevTaskChannelMPSC;
 
 union _HevTaskChannelData
 {
@@ -54,6 +55,7 @@ struct _HevTaskChannel
 
     HevTask *task;
     HevTaskChannelSelect *select;
+    HevTaskChannelMPSC *mpsc;
 
     unsigned int rd_idx;
     unsigned int wr_idx;
@@ -65,6 +67,34 @@ struct _HevTaskChannel
     HevTaskChannelBuffer buffers[0];
 };
 
+static inline ssize_t
+hev_task_channel_data_copy (void *dst, const void *src, size_t size)
+{
+    HevTaskChannelData *d = dst;
+    const HevTaskChannelData *s = src;
+
+    switch (size) {
+    case 0:
+        break;
+    case sizeof (char):
+        d->b[0] = s->b[0];
+        break;
+    case sizeof (short):
+        d->h[0] = s->h[0];
+        break;
+    case sizeof (int):
+        d->w[0] = s->w[0];
+        break;
+    case sizeof (long long):
+        d->d[0] = s->d[0];
+        break;
+    default:
+        __builtin_memcpy (dst, src, size);
+    }
+
+    return size;
+}
+
 static inline int
 hev_task_channel_is_active (HevTaskChannel *self)
 {
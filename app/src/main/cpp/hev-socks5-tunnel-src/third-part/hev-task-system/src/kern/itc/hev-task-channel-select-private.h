@@ -25,6 +25,7 @@ extern "C" {
 struct _HevTaskChannelSelect
 {
     HevTask *task;
+    unsigned int mpsc_count;
     HevList chan_list;
     HevList read_list;
     HevList write_list;
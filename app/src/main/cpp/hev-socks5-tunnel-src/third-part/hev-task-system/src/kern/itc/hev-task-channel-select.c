@@ -12,6 +12,7 @@
 
 #include "hev-task-channel-select.h"
 #include "hev-task-channel-select-private.h"
+#include "hev-task-channel-mpsc-private.h"
 
 EXPORT_SYMBOL HevTaskChannelSelect *
 hev_task_channel_select_new (void)
@@ -36,6 +37,12 @@ hev_task_channel_select_add (HevTaskChannelSelect *self, HevTaskChannel *chan)
     chan->task = hev_task_self ();
 
     hev_list_add_tail (&self->chan_list, &chan->chan_node);
+    if (chan->mpsc) {
+        self->mpsc_count++;
+        hev_task_channel_mpsc_select_sync (chan);
+        return;
+    }
+
     if (hev_task_channel_is_readable (chan))
         hev_task_channel_select_add_read (self, chan);
     if (chan->peer && hev_task_channel_is_select_writable (chan->peer))
@@ -48,11 +55,33 @@ hev_task_channel_select_del (HevTaskChannelSelect *self, HevTaskChannel *chan)
     hev_task_channel_select_del_read (self, chan);
     hev_task_channel_select_del_write (self, chan);
     hev_list_del (&self->chan_list, &chan->chan_node);
+    if (chan->mpsc) {
+        self->mpsc_count--;
+        hev_task_channel_mpsc_unbind (chan);
+    }
 
     chan->task = NULL;
     chan->select = NULL;
 }
 
+static void
+hev_task_channel_select_sync (HevTaskChannelSelect *self, HevList *list)
+{
+    HevListNode *node;
+
+    /* Cross-thread channels cannot touch the lists, poll them here. */
+    if (!self->mpsc_count || (list != &self->read_list))
+        return;
+
+    node = hev_list_first (&self->chan_list);
+    for (; node; node = hev_list_node_next (node)) {
+        HevTaskChannel *chan = container_of (node, HevTaskChannel, chan_node);
+
+        if (chan->mpsc)
+            hev_task_channel_mpsc_select_sync (chan);
+    }
+}
+
 static HevListNode *
 hev_task_channel_select (HevTaskChannelSelect *self, HevList *list, int timeout)
 {
@@ -62,6 +91,7 @@ hev_task_channel_select (HevTaskChannelSelect *self, HevList *list, int timeout)
     if (!hev_list_first (&self->chan_list))
         return NULL;
 
+    hev_task_channel_select_sync (self, list);
     while (!(node = hev_list_first (list)) && milliseconds) {
         barrier ();
         if (timeout < 0)
@@ -69,6 +99,7 @@ hev_task_channel_select (HevTaskChannelSelect *self, HevList *list, int timeout)
         else
             milliseconds = hev_task_sleep (milliseconds);
         barrier ();
+        hev_task_channel_select_sync (self, list);
     }
 
     return node;
@@ -15,6 +15,7 @@
 
 #include "hev-task-channel.h"
 #include "hev-task-channel-private.h"
+#include "hev-task-channel-mpsc-private.h"
 
 EXPORT_SYMBOL int
 hev_task_channel_new (HevTaskChannel **chan1, HevTaskChannel **chan2)
@@ -97,6 +98,11 @@ hev_task_channel_unref (HevTaskChannel *self)
 EXPORT_SYMBOL void
 hev_task_channel_destroy (HevTaskChannel *self)
 {
+    if (self->mpsc) {
+        hev_task_channel_mpsc_destroy (self);
+        return;
+    }
+
     if (self->peer) {
         self->peer->peer = NULL;
         if (self->peer->task)
@@ -108,40 +114,15 @@ hev_task_channel_destroy (HevTaskChannel *self)
     hev_task_channel_unref (self);
 }
 
-static ssize_t
-hev_task_channel_data_copy (void *dst, const void *src, size_t size)
-{
-    HevTaskChannelData *d = dst;
-    const HevTaskChannelData *s = src;
-
-    switch (size) {
-    case 0:
-        break;
-    case sizeof (char):
-        d->b[0] = s->b[0];
-        break;
-    case sizeof (short):
-        d->h[0] = s->h[0];
-        break;
-    case sizeof (int):
-        d->w[0] = s->w[0];
-        break;
-    case sizeof (long long):
-        d->d[0] = s->d[0];
-        break;
-    default:
-        __builtin_memcpy (dst, src, size);
-    }
-
-    return size;
-}
-
 EXPORT_SYMBOL ssize_t
 hev_task_channel_read (HevTaskChannel *self, void *buffer, size_t count)
 {
     HevTaskChannelBuffer *cbuf;
     ssize_t size = -1;
 
+    if (self->mpsc)
+        return hev_task_channel_mpsc_read (self, buffer, count);
+
     /* wait on empty */
     while (!hev_task_channel_is_readable (self)) {
         /* check is peer alive because cond wait may yield */
@@ -187,6 +168,9 @@ hev_task_channel_write (HevTaskChannel *self, const void *buffer, size_t count)
     HevTaskChannelBuffer *cbuf;
     ssize_t size = -1;
 
+    if (self->mpsc)
+        return hev_task_channel_mpsc_write (self, buffer, count);
+
     if (!peer)
         goto out0;
 
@@ -52,6 +52,28 @@ int hev_task_channel_new_with_buffers (HevTaskChannel **chan1,
                                        HevTaskChannel **chan2,
                                        unsigned int size, unsigned int buffers);
 
+/**
+ * hev_task_channel_new_mpsc:
+ * @chan: (out): a #HevTaskChannel
+ * @size: buffer size
+ * @buffers: buffers capacity, rounded up to a power of two
+ *
+ * Creates a multi-producer, single-consumer task channel that crosses
+ * threads. Any thread, with or without a task system, may write to @chan;
+ * one task reads it, directly or through a #HevTaskChannelSelect. The
+ * queue is a lock-free ring, and the reader is woken through an eventfd
+ * (a pipe off Linux) only when it is waiting on an empty channel.
+ *
+ * Create and destroy @chan in the reader's thread, after all writers have
+ * stopped, and before the reading task exits.
+ *
+ * Returns: When successful, returns zero. When an error occurs, returns -1.
+ *
+ * Since: 5.11
+ */
+int hev_task_channel_new_mpsc (HevTaskChannel **chan, unsigned int size,
+                               unsigned int buffers);
+
 /**
  * hev_task_channel_destroy:
  * @self: a #HevTaskChannel
@@ -94,6 +116,43 @@ ssize_t hev_task_channel_read (HevTaskChannel *self, void *buffer,
 ssize_t hev_task_channel_write (HevTaskChannel *self, const void *buffer,
                                 size_t count);
 
+/**
+ * hev_task_channel_read_batch:
+ * @self: a #HevTaskChannel
+ * @buffer: (array length=count): @count records of @size bytes
+ * @size: record size
+ * @count: max records
+ *
+ * Wait for at least one record, then read as many already queued records
+ * as fit, up to @count. Records shorter than @size leave the rest of their
+ * slot untouched.
+ *
+ * Returns: the number of records read, -1 if the channel is closed
+ *
+ * Since: 5.11
+ */
+ssize_t hev_task_channel_read_batch (HevTaskChannel *self, void *buffer,
+                                     size_t size, unsigned int count);
+
+/**
+ * hev_task_channel_write_batch:
+ * @self: a #HevTaskChannel
+ * @buffer: (array length=count): @count records of @size bytes
+ * @size: record size
+ * @count: records
+ *
+ * Write up to @count records. On a channel from hev_task_channel_new_mpsc
+ * this never waits: it claims as many free slots as there are in one step
+ * and wakes the reader at most once. Other channels write one by one.
+ *
+ * Returns: the number of records written, 0 if the MPSC ring is full, -1
+ * if the channel is closed
+ *
+ * Since: 5.11
+ */
+ssize_t hev_task_channel_write_batch (HevTaskChannel *self, const void *buffer,
+                                      size_t size, unsigned int count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,78 @@
+/*
+ ============================================================================
+ Name        : hev-task-context.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description : Task context switch
+ ============================================================================
+ */
+
+#ifndef __HEV_TASK_CONTEXT_H__
+#define __HEV_TASK_CONTEXT_H__
+
+/*
+ * Switching tasks only needs the registers the ABI keeps across a call.
+ * _setjmp also saves state a task switch never changes, and some libcs
+ * mangle pointers or unwind a shadow stack on _longjmp. Arches with a
+ * hand-written switch in arch/ use it, the others keep _setjmp.
+ */
+#if defined(__x86_64__) && !defined(__MSYS__)
+/* Jumping between stacks would fault with CET shadow stacks. */
+#if !defined(__CET__) || !(__CET__ & 2)
+#define HEV_TASK_CONTEXT_WORDS (8)
+#endif
+#elif defined(__aarch64__)
+#define HEV_TASK_CONTEXT_WORDS (21)
+#elif defined(__arm__) && (!defined(__thumb__) || defined(__thumb2__))
+#define HEV_TASK_CONTEXT_WORDS (26)
+#elif defined(__riscv) && defined(_LP64)
+#if !defined(__riscv_flen) || (__riscv_flen == 64)
+#define HEV_TASK_CONTEXT_WORDS (26)
+#endif
+#endif
+
+#ifndef __ASSEMBLER__
+
+#ifdef HEV_TASK_CONTEXT_WORDS
+
+#include <stdint.h>
+
+typedef uintptr_t HevTaskContext[HEV_TASK_CONTEXT_WORDS];
+
+/**
+ * hev_task_context_save:
+ * @ctx: a #HevTaskContext
+ *
+ * Save the callee-saved registers, the stack pointer and the return
+ * address to @ctx.
+ *
+ * Returns: 0 when saved, the value passed to hev_task_context_load when
+ * resumed through @ctx.
+ */
+extern int hev_task_context_save (HevTaskContext ctx)
+    __attribute__ ((returns_twice));
+
+/**
+ * hev_task_context_load:
+ * @ctx: a #HevTaskContext
+ * @val: value hev_task_context_save returns, not 0
+ *
+ * Resume the hev_task_context_save call that filled @ctx.
+ */
+extern void hev_task_context_load (HevTaskContext ctx, int val)
+    __attribute__ ((noreturn));
+
+#else /* !HEV_TASK_CONTEXT_WORDS */
+
+#include <setjmp.h>
+
+typedef jmp_buf HevTaskContext;
+
+#define hev_task_context_save(ctx) _setjmp (ctx)
+#define hev_task_context_load(ctx, val) _longjmp (ctx, val)
+
+#endif /* HEV_TASK_CONTEXT_WORDS */
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* __HEV_TASK_CONTEXT_H__ */
@@ -11,13 +11,16 @@
 #define __HEV_TASK_PRIVATE_H__
 
 #include <stdint.h>
-#include <setjmp.h>
 
 #include "hev-task.h"
+#include "hev-task-context.h"
 #include "hev-task-stack.h"
 #include "lib/list/hev-list.h"
 #include "lib/rbtree/hev-rbtree.h"
 
+#define SCHED_RBTREE (1)
+#define SCHED_BUCKET (2)
+
 typedef struct _HevTaskSchedEntity HevTaskSchedEntity;
 
 struct _HevTaskSchedEntity
@@ -32,7 +35,11 @@ struct _HevTask
     void *data;
 
     uint64_t sched_key;
+#if CONFIG_SCHED_QUEUE == SCHED_BUCKET
+    HevListNode sched_node;
+#else
     HevRBTreeNode sched_node;
+#endif
     HevTaskSchedEntity sched_entity;
 
     HevTaskStack *stack;
@@ -43,9 +50,15 @@ struct _HevTask
     int next_priority;
     HevTaskState state;
 
-    jmp_buf context;
+    void *stack_sp;
+    uint64_t wait_time;
+
+    HevTaskContext context;
 
     HevListNode list_node;
+
+    unsigned int klass;
+    HevTaskProfile profile;
 };
 
 extern void hev_task_execute (HevTask *self, void *executer);
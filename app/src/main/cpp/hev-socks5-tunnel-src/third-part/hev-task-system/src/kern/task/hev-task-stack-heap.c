@@ -84,6 +84,23 @@ hev_task_stack_destroy (HevTaskStack *self)
     hev_free (self);
 }
 
+void
+hev_task_stack_cache_clear (void)
+{
+}
+
+int
+hev_task_stack_reclaim (HevTaskStack *self, void *sp)
+{
+    return -1;
+}
+
+int
+hev_task_stack_get_usage (HevTaskStack *self)
+{
+    return -1;
+}
+
 void *
 hev_task_stack_get_base (HevTaskStack *self)
 {
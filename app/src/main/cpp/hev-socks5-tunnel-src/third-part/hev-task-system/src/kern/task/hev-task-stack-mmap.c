@@ -11,6 +11,7 @@
 #include <sys/mman.h>
 
 #include "lib/misc/hev-compiler.h"
+#include "kern/core/hev-task-system-private.h"
 #include "mem/api/hev-memory-allocator-api.h"
 
 #include "hev-task-stack.h"
@@ -24,14 +25,19 @@
 struct _HevTaskStack
 {
     int size;
+    int usage;
     void *stack;
+    HevTaskStack *next;
 };
 
+static int page_size;
+
 HevTaskStack *
 hev_task_stack_new (int size)
 {
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+    HevTaskStack **prev;
     HevTaskStack *self;
-    static int page_size;
 
     if (!page_size)
         page_size = getpagesize ();
@@ -41,6 +47,16 @@ hev_task_stack_new (int size)
     size += page_size;
 #endif
 
+    /* Cached stacks are already faulted in, reuse needs no syscall. */
+    for (prev = &ctx->stack_cache; *prev; prev = &(*prev)->next) {
+        self = *prev;
+        if (self->size == size) {
+            *prev = self->next;
+            ctx->stack_cache_count--;
+            return self;
+        }
+    }
+
     self = hev_malloc (sizeof (HevTaskStack));
     if (!self)
         return NULL;
@@ -61,6 +77,7 @@ hev_task_stack_new (int size)
 #endif
 
     self->size = size;
+    self->usage = 0;
 
     return self;
 }
@@ -68,10 +85,82 @@ hev_task_stack_new (int size)
 void
 hev_task_stack_destroy (HevTaskStack *self)
 {
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+
+    if (ctx->stack_cache_count < CONFIG_STACK_CACHE_MAX_COUNT) {
+        self->next = ctx->stack_cache;
+        ctx->stack_cache = self;
+        ctx->stack_cache_count++;
+        return;
+    }
+
     munmap (self->stack, self->size);
     hev_free (self);
 }
 
+void
+hev_task_stack_cache_clear (void)
+{
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+
+    while (ctx->stack_cache) {
+        HevTaskStack *self = ctx->stack_cache;
+
+        ctx->stack_cache = self->next;
+        munmap (self->stack, self->size);
+        hev_free (self);
+    }
+    ctx->stack_cache_count = 0;
+}
+
+int
+hev_task_stack_reclaim (HevTaskStack *self, void *sp)
+{
+    void *base = self->stack;
+    void *end;
+
+#ifdef ENABLE_STACK_OVERFLOW_DETECTION
+    base += page_size;
+#endif
+
+    if ((sp < base) || (sp > (self->stack + self->size)))
+        return -1;
+
+    /* Keep one page below the switch frame, its locals may sit there. */
+    end = (void *)ALIGN_DOWN ((uintptr_t)sp, page_size) - page_size;
+    if (end <= base)
+        return -1;
+
+    /* The released pages read as zero, remember how deep they went. */
+    self->usage = hev_task_stack_get_usage (self);
+
+    return madvise (base, end - base, MADV_DONTNEED);
+}
+
+int
+hev_task_stack_get_usage (HevTaskStack *self)
+{
+    void *base = self->stack;
+    void *end = self->stack + self->size;
+    uintptr_t *p;
+    int usage;
+
+#ifdef ENABLE_STACK_OVERFLOW_DETECTION
+    base += page_size;
+#endif
+
+    /* Fresh mmap pages are zero, the stack grows down from end. */
+    for (p = base; (void *)p < end; p++)
+        if (*p)
+            break;
+
+    usage = end - (void *)p;
+    if (usage < self->usage)
+        usage = self->usage;
+
+    return usage;
+}
+
 void *
 hev_task_stack_get_base (HevTaskStack *self)
 {
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-task-stack.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2020 everyone.
+ Copyright   : Copyright (c) 2020 - 2025 everyone.
  Description :
  ============================================================================
  */
@@ -18,6 +18,29 @@ typedef struct _HevTaskStack HevTaskStack;
 HevTaskStack *hev_task_stack_new (int size);
 void hev_task_stack_destroy (HevTaskStack *self);
 
+/*
+ * The mmap backend keeps up to CONFIG_STACK_CACHE_MAX_COUNT released stacks
+ * per task system for reuse, dropped by hev_task_system_fini.
+ */
+void hev_task_stack_cache_clear (void);
+
+/*
+ * Give the pages wholly below @sp, the task's stack pointer when it was
+ * switched out, back to the kernel. They read as zero when touched again.
+ * Returns 0 if any were released, -1 otherwise (heap backend, or @sp not
+ * on this stack, e.g. inside hev_task_call).
+ */
+int hev_task_stack_reclaim (HevTaskStack *self, void *sp);
+
+/*
+ * The deepest the stack was ever written, in bytes from the bottom, found
+ * as the lowest non-zero word. Pages given back by reclaim are counted at
+ * the depth they had, and a stack taken from the cache still holds what
+ * its last task wrote. Returns -1 on the heap backend, its memory is not
+ * zeroed to begin with.
+ */
+int hev_task_stack_get_usage (HevTaskStack *self);
+
 void *hev_task_stack_get_base (HevTaskStack *self);
 void *hev_task_stack_get_bottom (HevTaskStack *self);
 
@@ -100,6 +100,33 @@ hev_task_get_priority (HevTask *self)
     return self->next_priority;
 }
 
+EXPORT_SYMBOL int
+hev_task_get_stack_usage (HevTask *self)
+{
+    return hev_task_stack_get_usage (self->stack);
+}
+
+EXPORT_SYMBOL void
+hev_task_set_class (HevTask *self, unsigned int klass)
+{
+    if (klass >= HEV_TASK_CLASS_MAX)
+        klass = 0;
+
+    self->klass = klass;
+}
+
+EXPORT_SYMBOL unsigned int
+hev_task_get_class (HevTask *self)
+{
+    return self->klass;
+}
+
+EXPORT_SYMBOL void
+hev_task_get_profile (HevTask *self, HevTaskProfile *profile)
+{
+    *profile = self->profile;
+}
+
 EXPORT_SYMBOL int
 hev_task_add_fd (HevTask *self, int fd, unsigned int events)
 {
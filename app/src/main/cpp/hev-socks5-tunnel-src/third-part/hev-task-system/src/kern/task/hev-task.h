@@ -25,7 +25,10 @@ extern "C" {
 #define HEV_TASK_PRIORITY_DEFAULT (8)
 #define HEV_TASK_PRIORITY_REALTIME (0)
 
+#define HEV_TASK_CLASS_MAX (8)
+
 typedef struct _HevTask HevTask;
+typedef struct _HevTaskProfile HevTaskProfile;
 typedef void (*HevTaskEntry) (void *data);
 
 /**
@@ -141,6 +144,74 @@ void hev_task_set_priority (HevTask *self, int priority);
  */
 int hev_task_get_priority (HevTask *self);
 
+/**
+ * hev_task_get_stack_usage:
+ * @self: a #HevTask
+ *
+ * Get the deepest the stack of a task has been used so far, for sizing
+ * the stacks of similar tasks. A stack reused from the stack cache
+ * counts what its earlier tasks used too.
+ *
+ * Returns: the high-water mark in bytes, -1 if the stack backend can't
+ * tell (heap).
+ *
+ * Since: 5.12
+ */
+int hev_task_get_stack_usage (HevTask *self);
+
+/**
+ * HevTaskProfile:
+ * @run_time: nanoseconds of thread CPU time the task ran, estimated from
+ *   sampled runs
+ * @switches: times the task was switched to
+ *
+ * The scheduler times a random one in CONFIG_SCHED_PROFILE_INTERVAL runs
+ * and scales it up, so run times of tasks that rarely run are coarse while
+ * the busy ones that matter converge quickly.
+ *
+ * Since: 5.12
+ */
+struct _HevTaskProfile
+{
+    unsigned long long run_time;
+    unsigned long long switches;
+};
+
+/**
+ * hev_task_set_class:
+ * @self: a #HevTask
+ * @klass: class id, 0 to HEV_TASK_CLASS_MAX - 1
+ *
+ * Set the class the task system accounts the runs of a task to, see
+ * hev_task_system_get_class_profile. New tasks are in class 0.
+ *
+ * Since: 5.12
+ */
+void hev_task_set_class (HevTask *self, unsigned int klass);
+
+/**
+ * hev_task_get_class:
+ * @self: a #HevTask
+ *
+ * Get the class of a task.
+ *
+ * Returns: the class id
+ *
+ * Since: 5.12
+ */
+unsigned int hev_task_get_class (HevTask *self);
+
+/**
+ * hev_task_get_profile:
+ * @self: a #HevTask
+ * @profile: (out): the run time and switches of @self so far
+ *
+ * Get what a task cost the scheduler thread so far.
+ *
+ * Since: 5.12
+ */
+void hev_task_get_profile (HevTask *self, HevTaskProfile *profile);
+
 /**
  * hev_task_add_fd:
  * @self: a #HevTask
@@ -150,6 +221,10 @@ int hev_task_get_priority (HevTask *self);
  * Add a file descriptor to I/O reactor of task system. The task system will
  * wake up the task when I/O events ready.
  *
+ * The reactor remembers what each fd is added with, adding or modifying it
+ * again with the same task and events makes no system call. Remove the fd
+ * with hev_task_del_fd before closing it.
+ *
  * Returns: When successful, returns zero. When an error occurs, returns -1.
  *
  * Since: 1.0
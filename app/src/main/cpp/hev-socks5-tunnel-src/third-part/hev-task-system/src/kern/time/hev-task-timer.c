@@ -7,6 +7,7 @@
  ============================================================================
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "hev-task-timer.h"
@@ -14,91 +15,159 @@
 #include "mem/api/hev-memory-allocator-api.h"
 #include "lib/misc/hev-compiler.h"
 
+/*
+ * Hierarchical timing wheel with millisecond ticks of the cached clock. Level n has 64 slots of
+ * 64^n ticks each, six levels cover the whole unsigned int range. Arming and
+ * canceling are a list insert or delete. Timers in upper levels move down
+ * when the wheel reaches the start of their slot.
+ */
+#define WHEEL_BITS (6)
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS (6)
+
 typedef struct _HevTaskTimerNode HevTaskTimerNode;
 
 struct _HevTaskTimer
 {
-    HevRBTreeCached sort_tree;
     HevTaskSystemContext *ctx;
+
+    uint64_t curr;
+    unsigned int count;
+    uint64_t bitmap[WHEEL_LEVELS];
+    HevList slots[WHEEL_LEVELS][WHEEL_SIZE];
 };
 
 struct _HevTaskTimerNode
 {
-    HevRBTreeNode base;
+    HevListNode base;
 
-    struct timespec expire;
+    uint64_t expire;
+    HevList *slot;
     HevTask *task;
 };
 
-static inline int
-hev_task_timer_cmp (const struct timespec *a, const struct timespec *b)
+static inline uint64_t
+hev_task_timer_rotr (uint64_t bitmap, unsigned int shift)
 {
-    if (a->tv_sec < b->tv_sec)
-        return -1;
-    if (a->tv_sec > b->tv_sec)
-        return 1;
+    shift &= WHEEL_MASK;
+    if (!shift)
+        return bitmap;
 
-    if (a->tv_nsec < b->tv_nsec)
-        return -1;
-    if (a->tv_nsec > b->tv_nsec)
-        return 1;
+    return (bitmap >> shift) | (bitmap << (WHEEL_SIZE - shift));
+}
 
-    return 0;
+static void
+hev_task_timer_add (HevTaskTimer *self, HevTaskTimerNode *node)
+{
+    uint64_t expire = node->expire;
+    uint64_t delta;
+    int level = 0;
+    int index;
+
+    if (expire < self->curr)
+        expire = self->curr;
+
+    delta = expire - self->curr;
+    while ((level < (WHEEL_LEVELS - 1)) &&
+           (delta >> (WHEEL_BITS * (level + 1))))
+        level++;
+
+    index = (expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    node->slot = &self->slots[level][index];
+    hev_list_add_tail (node->slot, &node->base);
+    self->bitmap[level] |= 1ULL << index;
 }
 
-static inline int
-hev_task_timer_node_cmp (HevTaskTimerNode *a, HevTaskTimerNode *b)
+static void
+hev_task_timer_del (HevTaskTimer *self, HevTaskTimerNode *node)
 {
-    int res;
+    HevList *slot = node->slot;
 
-    res = hev_task_timer_cmp (&a->expire, &b->expire);
-    if (res)
-        return res;
+    hev_list_del (slot, &node->base);
+    node->slot = NULL;
 
-    if (a < b)
-        return -1;
-    if (a > b)
-        return 1;
+    if (!hev_list_first (slot)) {
+        int index = (slot - self->slots[0]);
 
-    return 0;
+        self->bitmap[index / WHEEL_SIZE] &= ~(1ULL << (index % WHEEL_SIZE));
+    }
 }
 
-static inline void
-hev_task_timer_get_curr (struct timespec *curr)
+static void
+hev_task_timer_cascade (HevTaskTimer *self, int level, int index)
 {
-    if (clock_gettime (CLOCK_MONOTONIC, curr) < 0)
-        abort ();
+    HevList *slot = &self->slots[level][index];
+    HevListNode *node = hev_list_first (slot);
+
+    slot->head = NULL;
+    slot->tail = NULL;
+    self->bitmap[level] &= ~(1ULL << index);
+
+    while (node) {
+        HevTaskTimerNode *this = container_of (node, HevTaskTimerNode, base);
+
+        node = hev_list_node_next (node);
+        hev_task_timer_add (self, this);
+    }
 }
 
-static inline void
-hev_task_timer_get_expire (struct timespec *expire, unsigned int milliseconds)
+static void
+hev_task_timer_expire (HevTaskTimer *self, int index)
 {
-    expire->tv_sec += milliseconds / 1000;
-    expire->tv_nsec += (milliseconds % 1000) * 1000000;
-    if (expire->tv_nsec > 1000000000L) {
-        expire->tv_sec++;
-        expire->tv_nsec -= 1000000000L;
+    HevList *slot = &self->slots[0][index];
+    HevListNode *node = hev_list_first (slot);
+
+    slot->head = NULL;
+    slot->tail = NULL;
+    self->bitmap[0] &= ~(1ULL << index);
+
+    while (node) {
+        HevTaskTimerNode *this = container_of (node, HevTaskTimerNode, base);
+
+        node = hev_list_node_next (node);
+        this->slot = NULL;
+        self->count--;
+        hev_task_system_wakeup_task_with_context (self->ctx, this->task);
     }
 }
 
-static inline unsigned int
-hev_task_timer_get_time (const struct timespec *curr,
-                         const struct timespec *expire)
+static void
+hev_task_timer_advance (HevTaskTimer *self, uint64_t curr)
 {
-    time_t sec;
-    long nsec;
-
-    sec = expire->tv_sec - curr->tv_sec;
-    nsec = expire->tv_nsec - curr->tv_nsec;
-    if (nsec < 0) {
-        sec--;
-        nsec += 1000000000L;
-    }
+    while (self->count && (self->curr <= curr)) {
+        int index = self->curr & WHEEL_MASK;
+        uint64_t bitmap;
 
-    if (sec < 0)
-        return 0;
+        if (!index) {
+            int level;
+
+            for (level = 1; level < WHEEL_LEVELS; level++) {
+                int i = (self->curr >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+                hev_task_timer_cascade (self, level, i);
+                if (i)
+                    break;
+            }
+        }
+
+        /* Skip the empty ticks, up to the next slot boundary at most. */
+        bitmap = self->bitmap[0] >> index;
+        if (!bitmap) {
+            self->curr = (self->curr | WHEEL_MASK) + 1;
+            continue;
+        }
 
-    return (sec * 1000) + ((nsec + 999999) / 1000000);
+        self->curr += __builtin_ctzll (bitmap);
+        if (self->curr > curr)
+            break;
+
+        hev_task_timer_expire (self, self->curr & WHEEL_MASK);
+        self->curr++;
+    }
+
+    if (!self->count || (self->curr > curr))
+        self->curr = curr + 1;
 }
 
 HevTaskTimer *
@@ -124,93 +193,114 @@ hev_task_timer_destroy (HevTaskTimer *self)
 int
 hev_task_timer_get_timeout (HevTaskTimer *self)
 {
-    HevTaskTimerNode *this;
-    HevRBTreeNode *node;
-    struct timespec curr;
+    uint64_t next = UINT64_MAX;
+    uint64_t curr;
+    int level;
 
-    node = hev_rbtree_cached_first (&self->sort_tree);
-    if (!node)
+    if (!self->count)
         return -1;
 
-    hev_task_timer_get_curr (&curr);
-    this = container_of (node, HevTaskTimerNode, base);
-    return hev_task_timer_get_time (&curr, &this->expire);
-}
+    /*
+     * A lower bound of the next expiry: the first busy tick of level 0,
+     * or the start of the next busy slot of an upper level, where its
+     * timers move down.
+     */
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        uint64_t base = self->curr >> shift;
+        uint64_t bitmap;
+        uint64_t time;
+        int dist;
+
+        if (!self->bitmap[level])
+            continue;
+
+        if (!level) {
+            bitmap = hev_task_timer_rotr (self->bitmap[0], base);
+            dist = __builtin_ctzll (bitmap);
+        } else {
+            bitmap = hev_task_timer_rotr (self->bitmap[level], base + 1);
+            dist = __builtin_ctzll (bitmap) + 1;
+        }
 
-static void
-hev_task_timer_wakeup (HevTaskTimer *self, const struct timespec *curr)
-{
-    HevTaskTimerNode *this;
-    HevRBTreeNode *node;
+        time = (base + dist) << shift;
+        if (time < next)
+            next = time;
+    }
 
-    node = hev_rbtree_cached_first (&self->sort_tree);
-    if (!node)
-        return;
+    curr = self->ctx->clock;
+    if (next <= curr)
+        return 0;
 
-    this = container_of (node, HevTaskTimerNode, base);
-    if (hev_task_timer_cmp (curr, &this->expire) < 0)
-        return;
+    if ((next - curr) > INT32_MAX)
+        return INT32_MAX;
 
-    hev_task_system_wakeup_task_with_context (self->ctx, this->task);
+    return next - curr;
 }
 
 void
 hev_task_timer_wake (HevTaskTimer *self)
 {
-    HevRBTreeNode *node;
-    struct timespec curr;
-
-    node = hev_rbtree_cached_first (&self->sort_tree);
-    if (!node)
+    if (!self->count)
         return;
 
-    hev_task_timer_get_curr (&curr);
-    hev_task_timer_wakeup (self, &curr);
+    hev_task_timer_advance (self, self->ctx->clock);
+}
+
+/*
+ * Round the deadline up to a slot of the largest power of two within the
+ * slack, and within an eighth of the timeout, so short timers stay close.
+ * Slots of smaller powers nest in larger ones, timers of any length that
+ * land in one share its wakeup.
+ */
+static uint64_t
+hev_task_timer_round (HevTaskTimer *self, uint64_t expire,
+                      unsigned int milliseconds)
+{
+    unsigned int slack = self->ctx->timer_slack;
+    uint64_t slot;
+
+    if (slack > (milliseconds >> 3))
+        slack = milliseconds >> 3;
+    if (slack < 2)
+        return expire;
+
+    slot = 1ULL << (31 - __builtin_clz (slack));
+    return (expire + slot - 1) & ~(slot - 1);
 }
 
 unsigned int
 hev_task_timer_wait (HevTaskTimer *self, unsigned int milliseconds,
                      HevTask *task)
 {
-    HevTaskTimerNode curr_node, *node = &curr_node;
-    HevRBTreeNode **new = &self->sort_tree.base.root, *parent = NULL;
-    struct timespec curr;
-    int leftmost = 1;
-
-    /* get expire time */
-    hev_task_timer_get_curr (&node->expire);
-    hev_task_timer_get_expire (&node->expire, milliseconds);
-    node->task = task;
-
-    /* insert to sort tree */
-    while (*new) {
-        HevTaskTimerNode *this = container_of (*new, HevTaskTimerNode, base);
-        int result = hev_task_timer_node_cmp (node, this);
-
-        parent = *new;
-        if (result < 0) {
-            new = &((*new)->left);
-        } else {
-            new = &((*new)->right);
-            leftmost = 0;
-        }
-    }
-    hev_rbtree_node_link (&node->base, parent, new);
-    hev_rbtree_cached_insert_color (&self->sort_tree, &node->base, leftmost);
+    HevTaskTimerNode node;
+    uint64_t curr;
 
-    hev_task_yield (HEV_TASK_WAITIO);
+    /* get expire time, never earlier than requested */
+    curr = self->ctx->clock;
+    node.expire = curr + milliseconds + self->ctx->clock_slack;
+    node.expire = hev_task_timer_round (self, node.expire, milliseconds);
+    node.task = task;
 
-    /* check current is first */
-    if (&node->base == hev_rbtree_cached_first (&self->sort_tree))
-        leftmost = 1;
+    if (!self->count)
+        self->curr = curr;
+    self->count++;
+    hev_task_timer_add (self, &node);
 
-    /* remove from sort tree */
-    hev_rbtree_cached_erase (&self->sort_tree, &node->base);
+    hev_task_yield (HEV_TASK_WAITIO);
 
-    hev_task_timer_get_curr (&curr);
-    if (leftmost)
-        hev_task_timer_wakeup (self, &curr);
+    /* woken up before expired */
+    if (node.slot) {
+        hev_task_timer_del (self, &node);
+        self->count--;
+    }
 
     /* get remaining milliseconds */
-    return hev_task_timer_get_time (&curr, &curr_node.expire);
+    curr = self->ctx->clock;
+    if (node.expire <= curr)
+        return 0;
+    if ((node.expire - curr) > milliseconds)
+        return milliseconds;
+
+    return node.expire - curr;
 }
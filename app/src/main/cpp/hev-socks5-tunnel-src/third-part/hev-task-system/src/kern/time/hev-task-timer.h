@@ -13,7 +13,7 @@
 #include <time.h>
 
 #include "kern/task/hev-task.h"
-#include "lib/rbtree/hev-rbtree-cached.h"
+#include "lib/list/hev-list.h"
 
 typedef struct _HevTaskTimer HevTaskTimer;
 
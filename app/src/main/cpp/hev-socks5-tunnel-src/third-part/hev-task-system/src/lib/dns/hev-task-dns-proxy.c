@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-task-dns-proxy.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2022 everyone.
+ Copyright   : Copyright (c) 2021 - 2026 everyone.
  Description : DNS Proxy
  ============================================================================
  */
@@ -10,9 +10,8 @@
 #include <poll.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
-#include "kern/aide/hev-task-aide.h"
-#include "kern/sync/hev-task-mutex.h"
 #include "kern/core/hev-task-system-private.h"
 #include "lib/io/basic/hev-task-io.h"
 #include "lib/io/socket/hev-task-io-socket.h"
@@ -31,18 +30,36 @@ enum _HevTaskDNSCallType
     HEV_TASK_DNS_CALL_GETNAMEINFO,
 };
 
+/*
+ * Calls of all task systems go to one queue, served by a pool of resolver
+ * threads that grows on demand up to HEV_TASK_DNS_PROXY_THREADS, so a slow
+ * lookup holds up only its own task. A finished call is sent back as a
+ * pointer datagram on the socket of its proxy.
+ *
+ * Of the tasks waiting on one proxy, the reader polls the socket, marks the
+ * returned calls done and wakes their tasks. The others wait without an fd,
+ * and the reader hands its role to one of them when its own call is done.
+ */
+#define HEV_TASK_DNS_PROXY_THREADS (8)
+
 struct _HevTaskDNSProxy
 {
     int fd;
-    HevTaskMutex mutex;
-    HevTaskAideWork work;
-    HevTaskDNSCall *call;
+    int reply_fd;
+    HevTaskDNSCall *reader;
+    HevTaskDNSCall *waiters;
     HevTaskSchedEntity sched_entity;
 };
 
 struct _HevTaskDNSCall
 {
     int type;
+    int done;
+    HevTask *task;
+    HevTaskDNSProxy *proxy;
+    HevTaskDNSCall *queue_next;
+    HevTaskDNSCall *prev;
+    HevTaskDNSCall *next;
 };
 
 struct _HevTaskDNSCallGetAddrInfo
@@ -72,6 +89,14 @@ struct _HevTaskDNSCallGetNameInfo
 
 static HevTask dummy_task = { .state = HEV_TASK_RUNNING };
 
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static HevTaskDNSCall *pool_head;
+static HevTaskDNSCall *pool_tail;
+static unsigned int pool_pending;
+static unsigned int pool_threads;
+static unsigned int pool_idle;
+
 static void
 hev_task_dns_server_getaddrinfo (HevTaskDNSCall *call)
 {
@@ -92,39 +117,98 @@ hev_task_dns_server_getnameinfo (HevTaskDNSCall *call)
 }
 
 static void
-hev_task_dns_server_handler (unsigned int revents, void *data)
+hev_task_dns_server_reply (HevTaskDNSCall *call)
 {
-    HevTaskDNSProxy *proxy = data;
+    int fd = call->proxy->reply_fd;
 
     for (;;) {
-        char sync = 's';
+        struct pollfd pfd;
         int res;
 
-        res = read (proxy->work.fd, &sync, sizeof (sync));
-        if (0 >= res)
+        res = write (fd, &call, sizeof (call));
+        if ((0 <= res) || (EAGAIN != errno))
             break;
 
-        switch (proxy->call->type) {
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        poll (&pfd, 1, -1);
+    }
+}
+
+static void *
+hev_task_dns_server_entry (void *data)
+{
+    pthread_mutex_lock (&pool_mutex);
+    for (;;) {
+        HevTaskDNSCall *call;
+
+        while (!pool_head) {
+            pool_idle++;
+            pthread_cond_wait (&pool_cond, &pool_mutex);
+            pool_idle--;
+        }
+
+        call = pool_head;
+        pool_head = call->queue_next;
+        if (!pool_head)
+            pool_tail = NULL;
+        pool_pending--;
+        pthread_mutex_unlock (&pool_mutex);
+
+        switch (call->type) {
         case HEV_TASK_DNS_CALL_GETADDRINFO:
-            hev_task_dns_server_getaddrinfo (proxy->call);
+            hev_task_dns_server_getaddrinfo (call);
             break;
         case HEV_TASK_DNS_CALL_GETNAMEINFO:
-            hev_task_dns_server_getnameinfo (proxy->call);
+            hev_task_dns_server_getnameinfo (call);
             break;
         }
 
-        for (;;) {
-            struct pollfd pfd;
+        /* The call belongs to its task again once it is sent. */
+        hev_task_dns_server_reply (call);
 
-            res = write (proxy->work.fd, &sync, sizeof (sync));
-            if ((0 <= res) || (EAGAIN != errno))
-                break;
+        pthread_mutex_lock (&pool_mutex);
+    }
 
-            pfd.fd = proxy->work.fd;
-            pfd.events = POLLOUT;
-            poll (&pfd, 1, -1);
-        }
+    return NULL;
+}
+
+static int
+hev_task_dns_server_push (HevTaskDNSCall *call)
+{
+    int res = 0;
+
+    pthread_mutex_lock (&pool_mutex);
+
+    /* Only start a thread when the idle ones cannot take the backlog. */
+    if ((pool_pending >= pool_idle) &&
+        (pool_threads < HEV_TASK_DNS_PROXY_THREADS)) {
+        pthread_attr_t attr;
+        pthread_t thread;
+
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create (&thread, &attr, hev_task_dns_server_entry, NULL))
+            res = pool_threads ? 0 : -1;
+        else
+            pool_threads++;
+        pthread_attr_destroy (&attr);
     }
+
+    if (res == 0) {
+        call->queue_next = NULL;
+        if (pool_tail)
+            pool_tail->queue_next = call;
+        else
+            pool_head = call;
+        pool_tail = call;
+        pool_pending++;
+        pthread_cond_signal (&pool_cond);
+    }
+
+    pthread_mutex_unlock (&pool_mutex);
+
+    return res;
 }
 
 HevTaskDNSProxy *
@@ -137,35 +221,27 @@ hev_task_dns_proxy_new (void)
     int count;
     int res;
 
-    res = hev_task_aide_init ();
-    if (0 > res)
-        return NULL;
-
     self = hev_malloc0 (sizeof (HevTaskDNSProxy));
     if (!self)
         goto exit;
 
-    res = hev_task_io_socket_socketpair (PF_LOCAL, SOCK_STREAM, 0, fds);
+    /* Datagrams, so replies of concurrent resolver threads never mix. */
+    res = hev_task_io_socket_socketpair (PF_LOCAL, SOCK_DGRAM, 0, fds);
     if (0 > res)
         goto free;
 
     reactor = hev_task_system_get_context ()->reactor;
     count = hev_task_io_reactor_setup_event_fd_gen (revents, fds[0],
                                                     HEV_TASK_IO_REACTOR_OP_ADD,
-                                                    POLLIN | POLLOUT,
+                                                    POLLIN,
                                                     &self->sched_entity);
     res = hev_task_io_reactor_setup (reactor, revents, count);
     if (0 > res)
         goto close;
 
     self->fd = fds[0];
-    self->work.fd = fds[1];
-    self->work.events = POLLIN;
-    self->work.handler = hev_task_dns_server_handler;
-    self->work.data = self;
-    res = hev_task_aide_add (&self->work);
-    if (0 > res)
-        goto close;
+    self->reply_fd = fds[1];
+    self->sched_entity.task = &dummy_task;
 
     return self;
 
@@ -181,41 +257,74 @@ exit:
 void
 hev_task_dns_proxy_destroy (HevTaskDNSProxy *self)
 {
-    hev_task_aide_del (&self->work);
-    close (self->work.fd);
+    close (self->reply_fd);
     close (self->fd);
     hev_free (self);
 }
 
 static void
-hev_task_dns_proxy_call (HevTaskDNSProxy *self, HevTaskDNSCall *call)
+hev_task_dns_proxy_drain (HevTaskDNSProxy *self)
 {
-    hev_task_mutex_lock (&self->mutex);
-
-    self->call = call;
-    self->sched_entity.task = hev_task_self ();
-
     for (;;) {
-        char sync = 's';
-        int res = write (self->fd, &sync, sizeof (sync));
-        if ((0 <= res) || (EAGAIN != errno))
+        HevTaskDNSCall *call;
+        int res;
+
+        res = read (self->fd, &call, sizeof (call));
+        if (res != sizeof (call))
             break;
 
-        hev_task_yield (HEV_TASK_WAITIO);
+        call->done = 1;
+        hev_task_wakeup (call->task);
     }
+}
+
+static void
+hev_task_dns_proxy_call (HevTaskDNSProxy *self, HevTaskDNSCall *call)
+{
+    call->done = 0;
+    call->task = hev_task_self ();
+    call->proxy = self;
+
+    if (hev_task_dns_server_push (call) < 0)
+        return;
+
+    call->prev = NULL;
+    call->next = self->waiters;
+    if (self->waiters)
+        self->waiters->prev = call;
+    self->waiters = call;
 
     for (;;) {
-        char sync;
-        int res = read (self->fd, &sync, sizeof (sync));
-        if ((0 <= res) || (EAGAIN != errno))
+        if (!self->reader) {
+            self->reader = call;
+            self->sched_entity.task = call->task;
+        }
+
+        if (self->reader == call)
+            hev_task_dns_proxy_drain (self);
+
+        if (call->done)
             break;
 
         hev_task_yield (HEV_TASK_WAITIO);
     }
 
-    self->sched_entity.task = &dummy_task;
-
-    hev_task_mutex_unlock (&self->mutex);
+    if (call->prev)
+        call->prev->next = call->next;
+    else
+        self->waiters = call->next;
+    if (call->next)
+        call->next->prev = call->prev;
+
+    if (self->reader == call) {
+        self->reader = self->waiters;
+        if (self->reader) {
+            self->sched_entity.task = self->reader->task;
+            hev_task_wakeup (self->reader->task);
+        } else {
+            self->sched_entity.task = &dummy_task;
+        }
+    }
 }
 
 int
@@ -231,7 +340,8 @@ hev_task_dns_proxy_getaddrinfo (HevTaskDNSProxy *self, const char *node,
     gai.service = service;
     gai.hints = hints;
     gai.res = res;
-    gai.ret = -1;
+    gai.ret = EAI_SYSTEM;
+    gai.err = EAGAIN;
 
     hev_task_dns_proxy_call (self, &gai.base);
 
@@ -255,7 +365,8 @@ hev_task_dns_proxy_getnameinfo (HevTaskDNSProxy *self,
     gni.service = service;
     gni.servicelen = servicelen;
     gni.flags = flags;
-    gni.ret = -1;
+    gni.ret = EAI_SYSTEM;
+    gni.err = EAGAIN;
 
     hev_task_dns_proxy_call (self, &gni.base);
 
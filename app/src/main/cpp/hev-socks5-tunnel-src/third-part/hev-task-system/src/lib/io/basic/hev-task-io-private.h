@@ -0,0 +1,30 @@
+/*
+ ============================================================================
+ Name        : hev-task-io-private.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description : Task I/O operations private
+ ============================================================================
+ */
+
+#ifndef __HEV_TASK_IO_PRIVATE_H__
+#define __HEV_TASK_IO_PRIVATE_H__
+
+#include <stddef.h>
+
+typedef struct _HevTaskIOPipe HevTaskIOPipe;
+
+struct _HevTaskIOPipe
+{
+    int fd[2];
+    size_t size;
+};
+
+/*
+ * Splicers borrow a pipe pair only while they move a burst and give it back
+ * once it is empty. Up to CONFIG_IO_SPLICE_PIPE_CACHE idle pairs are kept
+ * per task system, dropped by hev_task_system_fini.
+ */
+void hev_task_io_pipe_cache_clear (void);
+
+#endif /* __HEV_TASK_IO_PRIVATE_H__ */
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-task-io.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2018 everyone.
+ Copyright   : Copyright (c) 2018 - 2026 everyone.
  Description : Task I/O operations
  ============================================================================
  */
@@ -25,9 +25,11 @@
 #include <sys/socket.h>
 
 #include "kern/task/hev-task.h"
+#include "kern/core/hev-task-system-private.h"
 #include "lib/io/buffer/hev-circular-buffer.h"
 #include "lib/misc/hev-compiler.h"
 
+#include "hev-task-io-private.h"
 #include "hev-task-io.h"
 
 typedef struct _HevTaskIOSplicer HevTaskIOSplicer;
@@ -35,12 +37,15 @@ typedef struct _HevTaskIOSplicer HevTaskIOSplicer;
 struct _HevTaskIOSplicer
 {
 #ifdef ENABLE_IO_SPLICE_SYSCALL
-    int fd[2];
+    HevTaskIOPipe pipe; /* fd[0] < 0 between bursts */
     size_t wlen;
-    size_t blen;
+    size_t size;
+    int grow;
 #else
     HevCircularBuffer *buf;
 #endif /* !ENABLE_IO_SPLICE_SYSCALL */
+    size_t moved; /* read since the last limiter call */
+    int active; /* the last read got data */
 };
 
 EXPORT_SYMBOL int
@@ -208,67 +213,156 @@ retry:
 
 #ifdef ENABLE_IO_SPLICE_SYSCALL
 
+/*
+ * The pipes are never polled: one fills only while its output socket is
+ * blocked and drains only into it, so the task always waits on a socket.
+ */
 static int
-task_io_splicer_init (HevTaskIOSplicer *self, size_t buf_size)
+task_io_pipe_get (HevTaskIOSplicer *self)
 {
-    HevTask *task = hev_task_self ();
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+    HevTaskIOPipe *pipe = &self->pipe;
     int res;
 
-    res = pipe2 (self->fd, O_NONBLOCK);
-    if (res < 0)
-        goto exit;
+    if (ctx->pipe_cache_count) {
+        *pipe = ctx->pipe_cache[--ctx->pipe_cache_count];
+        return 0;
+    }
 
-    res = hev_task_add_fd (task, self->fd[0], POLLIN);
+    res = pipe2 (pipe->fd, O_NONBLOCK);
     if (res < 0)
-        goto exit_close;
+        return res;
 
-    res = hev_task_add_fd (task, self->fd[1], POLLOUT);
+    pipe->size = self->size;
+#ifdef F_SETPIPE_SZ
+    res = fcntl (pipe->fd[0], F_SETPIPE_SZ, self->size);
     if (res < 0)
-        goto exit_close;
+        res = fcntl (pipe->fd[0], F_GETPIPE_SZ);
+    if (res > 0)
+        pipe->size = res;
+#endif
+
+    return 0;
+}
+
+static void
+task_io_pipe_put (HevTaskIOSplicer *self)
+{
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+    HevTaskIOPipe *pipe = &self->pipe;
+
+    if (pipe->fd[0] < 0)
+        return;
+
+    /* A pipe that still holds data is of no use to anyone else. */
+    if (!self->wlen && (ctx->pipe_cache_count < CONFIG_IO_SPLICE_PIPE_CACHE)) {
+        ctx->pipe_cache[ctx->pipe_cache_count++] = *pipe;
+    } else {
+        close (pipe->fd[0]);
+        close (pipe->fd[1]);
+    }
 
-#ifdef F_GETPIPE_SZ
-    buf_size = fcntl (self->fd[0], F_GETPIPE_SZ);
+    pipe->fd[0] = -1;
+    pipe->fd[1] = -1;
+}
+
+/*
+ * A burst that fills the pipe in one go is held back by the pipe, not by
+ * the sockets. Double it, up to CONFIG_IO_SPLICE_PIPE_MAX_SIZE, and stop
+ * trying once the kernel refuses (fs.pipe-max-size, pipe-user-pages).
+ */
+static void
+task_io_pipe_grow (HevTaskIOSplicer *self)
+{
+#ifdef F_SETPIPE_SZ
+    HevTaskIOPipe *pipe = &self->pipe;
+    int res;
+
+    if (!self->grow || (pipe->size >= CONFIG_IO_SPLICE_PIPE_MAX_SIZE))
+        return;
+
+    res = fcntl (pipe->fd[0], F_SETPIPE_SZ, pipe->size * 2);
+    if (res > 0)
+        pipe->size = res;
+    else
+        self->grow = 0;
 #endif
+}
+
+void
+hev_task_io_pipe_cache_clear (void)
+{
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+
+    while (ctx->pipe_cache_count) {
+        HevTaskIOPipe *pipe = &ctx->pipe_cache[--ctx->pipe_cache_count];
+
+        close (pipe->fd[0]);
+        close (pipe->fd[1]);
+    }
+}
 
+static int
+task_io_splicer_init (HevTaskIOSplicer *self, size_t buf_size)
+{
+    self->pipe.fd[0] = -1;
+    self->pipe.fd[1] = -1;
     self->wlen = 0;
-    self->blen = buf_size;
+    self->size = buf_size;
+    self->grow = 1;
+    self->moved = 0;
+    self->active = 0;
 
     return 0;
-
-exit_close:
-    close (self->fd[0]);
-    close (self->fd[1]);
-exit:
-    return res;
 }
 
 static void
 task_io_splicer_fini (HevTaskIOSplicer *self)
 {
-    close (self->fd[0]);
-    close (self->fd[1]);
+    task_io_pipe_put (self);
 }
 
 static int
-task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
+task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out, size_t quota)
 {
+    size_t len;
     int res;
     ssize_t s;
 
-    s = splice (fd_in, NULL, self->fd[1], NULL, self->blen,
-                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
-    if (0 >= s) {
+    if (!quota && !self->wlen)
+        return 0;
+
+    if ((self->pipe.fd[0] < 0) && (task_io_pipe_get (self) < 0)) {
+        shutdown (fd_out, SHUT_WR);
+        return -1;
+    }
+
+    len = self->pipe.size;
+    if (len > quota)
+        len = quota;
+
+    s = quota ? splice (fd_in, NULL, self->pipe.fd[1], NULL, len,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+              : 0;
+    if (!quota) {
+        res = 0;
+    } else if (0 >= s) {
         if ((0 > s) && (EAGAIN == errno))
             res = 0;
         else
             res = -1;
+        self->active = 0;
     } else {
         res = 1;
         self->wlen += s;
+        self->moved += s;
+        self->active = 1;
+        if (self->wlen >= self->pipe.size)
+            task_io_pipe_grow (self);
     }
 
     if (self->wlen) {
-        s = splice (self->fd[0], NULL, fd_out, NULL, self->blen,
+        s = splice (self->pipe.fd[0], NULL, fd_out, NULL, self->pipe.size,
                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
         if (0 >= s) {
             if ((0 > s) && (EAGAIN == errno))
@@ -283,6 +377,10 @@ task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
         shutdown (fd_out, SHUT_WR);
     }
 
+    /* Between bursts, the pipe goes back to the cache. */
+    if (!self->wlen && (res <= 0))
+        task_io_pipe_put (self);
+
     return res;
 }
 
@@ -295,6 +393,9 @@ task_io_splicer_init (HevTaskIOSplicer *self, size_t buf_size)
     if (!self->buf)
         return -1;
 
+    self->moved = 0;
+    self->active = 0;
+
     return 0;
 }
 
@@ -305,23 +406,42 @@ task_io_splicer_fini (HevTaskIOSplicer *self)
         hev_circular_buffer_unref (self->buf);
 }
 
+void
+hev_task_io_pipe_cache_clear (void)
+{
+}
+
 static int
-task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
+task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out, size_t quota)
 {
     struct iovec iov[2];
     int res = 1, iovc;
 
-    iovc = hev_circular_buffer_writing (self->buf, iov);
+    iovc = quota ? hev_circular_buffer_writing (self->buf, iov) : 0;
     if (iovc) {
-        ssize_t s = readv (fd_in, iov, iovc);
+        ssize_t s;
+
+        if (iov[0].iov_len >= quota) {
+            iov[0].iov_len = quota;
+            iovc = 1;
+        } else if ((iovc > 1) && (iov[1].iov_len > quota - iov[0].iov_len)) {
+            iov[1].iov_len = quota - iov[0].iov_len;
+        }
+
+        s = readv (fd_in, iov, iovc);
         if (0 >= s) {
             if ((0 > s) && (EAGAIN == errno))
                 res = 0;
             else
                 res = -1;
+            self->active = 0;
         } else {
             hev_circular_buffer_write_finish (self->buf, s);
+            self->moved += s;
+            self->active = 1;
         }
+    } else if (!quota) {
+        res = 0;
     }
 
     iovc = hev_circular_buffer_reading (self->buf, iov);
@@ -345,10 +465,53 @@ task_io_splice (HevTaskIOSplicer *self, int fd_in, int fd_out)
 
 #endif /* !ENABLE_IO_SPLICE_SYSCALL */
 
+/*
+ * Asks the limiter how much the direction may read this round. A held one
+ * that found its input empty last time still reads a byte, so that it only
+ * sleeps on the hold while it has data and waits for I/O otherwise.
+ */
+static int
+task_io_splice_limited (HevTaskIOSplicer *self, int dir, int fd_in,
+                        int fd_out, HevTaskIOLimiter limiter, void *data,
+                        unsigned int *hold)
+{
+    size_t quota = (size_t)-1;
+    ssize_t q;
+
+    if (!limiter)
+        return task_io_splice (self, fd_in, fd_out, quota);
+
+    q = limiter (dir, self->moved, data);
+    self->moved = 0;
+    if (q > 0) {
+        quota = q;
+    } else if (self->active) {
+        unsigned int ms = q ? -q : 1;
+
+        quota = 0;
+        if (!*hold || (ms < *hold))
+            *hold = ms;
+    } else {
+        quota = 1;
+    }
+
+    return task_io_splice (self, fd_in, fd_out, quota);
+}
+
 EXPORT_SYMBOL void
 hev_task_io_splice (int fd_a_i, int fd_a_o, int fd_b_i, int fd_b_o,
                     size_t buf_size, HevTaskIOYielder yielder,
                     void *yielder_data)
+{
+    hev_task_io_splice_limited (fd_a_i, fd_a_o, fd_b_i, fd_b_o, buf_size,
+                                NULL, NULL, yielder, yielder_data);
+}
+
+EXPORT_SYMBOL void
+hev_task_io_splice_limited (int fd_a_i, int fd_a_o, int fd_b_i, int fd_b_o,
+                            size_t buf_size, HevTaskIOLimiter limiter,
+                            void *limiter_data, HevTaskIOYielder yielder,
+                            void *yielder_data)
 {
     HevTaskIOSplicer splicer_f;
     HevTaskIOSplicer splicer_b;
@@ -362,11 +525,14 @@ hev_task_io_splice (int fd_a_i, int fd_a_o, int fd_b_i, int fd_b_o,
 
     for (;;) {
         HevTaskYieldType type;
+        unsigned int hold = 0;
 
         if (res_f >= 0)
-            res_f = task_io_splice (&splicer_f, fd_a_i, fd_b_o);
+            res_f = task_io_splice_limited (&splicer_f, 0, fd_a_i, fd_b_o,
+                                            limiter, limiter_data, &hold);
         if (res_b >= 0)
-            res_b = task_io_splice (&splicer_b, fd_b_i, fd_a_o);
+            res_b = task_io_splice_limited (&splicer_b, 1, fd_b_i, fd_a_o,
+                                            limiter, limiter_data, &hold);
 
         if (res_f > 0 || res_b > 0)
             type = HEV_TASK_YIELD;
@@ -375,6 +541,12 @@ hev_task_io_splice (int fd_a_i, int fd_a_o, int fd_b_i, int fd_b_o,
         else
             break;
 
+        /* Out of quota, I/O of the other direction ends the sleep early. */
+        if ((type == HEV_TASK_WAITIO) && hold) {
+            hev_task_sleep (hold);
+            continue;
+        }
+
         if (yielder) {
             if (yielder (type, yielder_data))
                 break;
@@ -19,6 +19,21 @@ extern "C" {
 
 typedef int (*HevTaskIOYielder) (HevTaskYieldType type, void *data);
 
+/**
+ * HevTaskIOLimiter:
+ * @dir: 0 for @fd_a_i to @fd_b_o, 1 for @fd_b_i to @fd_a_o
+ * @moved: bytes read in @dir since the last call
+ * @data: user data
+ *
+ * Called by hev_task_io_splice_limited before each read of a direction.
+ *
+ * Returns: the most bytes @dir may read now, or the negated milliseconds to
+ * hold it for (0 for one).
+ *
+ * Since: 5.11
+ */
+typedef ssize_t (*HevTaskIOLimiter) (int dir, size_t moved, void *data);
+
 /**
  * hev_task_io_open:
  * @pathname: file path name
@@ -182,12 +197,42 @@ ssize_t hev_task_io_writev (int fd, const struct iovec *iov, int iovcnt,
  *
  * The splice moves data between two file descriptors until one error or closed.
  *
+ * With the splice syscall, @buf_size is the initial pipe size of each
+ * direction. A pipe grows while bursts keep filling it, and is only held
+ * while a burst is in flight; idle pipes are shared by the splices of the
+ * task system.
+ *
  * Since: 3.2
  */
 void hev_task_io_splice (int fd_a_i, int fd_a_o, int fd_b_i, int fd_b_o,
                          size_t buf_size, HevTaskIOYielder yielder,
                          void *yielder_data);
 
+/**
+ * hev_task_io_splice_limited:
+ * @fd_a_i: a file descriptor for input
+ * @fd_a_o: a file descriptor for output
+ * @fd_b_i: another file descriptor for input
+ * @fd_b_o: another file destriptor for output
+ * @buf_size: buffer length
+ * @limiter: (nullable): a #HevTaskIOLimiter
+ * @limiter_data: user data of @limiter
+ * @yielder: a #HevTaskIOYielder
+ * @yielder_data: user data
+ *
+ * The same as hev_task_io_splice, with each read bounded by @limiter. While
+ * a direction is held and nothing else moves, the task sleeps until the
+ * hold ends, or I/O wakes it up, instead of calling @yielder; a direction
+ * without pending input waits for I/O as usual, so idle timeouts of
+ * @yielder keep working.
+ *
+ * Since: 5.11
+ */
+void hev_task_io_splice_limited (int fd_a_i, int fd_a_o, int fd_b_i,
+                                 int fd_b_o, size_t buf_size,
+                                 HevTaskIOLimiter limiter, void *limiter_data,
+                                 HevTaskIOYielder yielder, void *yielder_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : hev-circular-buffer-private.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description : Circular buffer private
+ ============================================================================
+ */
+
+#ifndef __HEV_CIRCULAR_BUFFER_PRIVATE_H__
+#define __HEV_CIRCULAR_BUFFER_PRIVATE_H__
+
+#include "hev-circular-buffer.h"
+
+/* Size classes HEV_CIRCULAR_BUFFER_MIN_SIZE << 0 .. 5 */
+#define HEV_CIRCULAR_BUFFER_CLASSES (6)
+
+/*
+ * Released buffers of a size class are kept per task system, up to
+ * CONFIG_IO_BUFFER_CACHE of each, dropped by hev_task_system_fini.
+ */
+void hev_circular_buffer_cache_clear (void);
+
+#endif /* __HEV_CIRCULAR_BUFFER_PRIVATE_H__ */
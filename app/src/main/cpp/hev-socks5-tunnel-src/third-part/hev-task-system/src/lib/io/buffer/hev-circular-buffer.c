@@ -2,43 +2,115 @@
  ============================================================================
  Name        : hev-circular-buffer.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2019 everyone.
+ Copyright   : Copyright (c) 2019 - 2026 everyone.
  Description : Circular buffer
  ============================================================================
  */
 
+#include "kern/core/hev-task-system-private.h"
 #include "lib/misc/hev-compiler.h"
 #include "mem/api/hev-memory-allocator-api.h"
 
 #include "hev-circular-buffer.h"
+#include "hev-circular-buffer-private.h"
 
 struct _HevCircularBuffer
 {
     size_t rp;
+    size_t rda_size;
     size_t use_size;
     size_t max_size;
     unsigned int ref_count;
+    int klass;
 
     unsigned char data[0];
 };
 
+static int
+hev_circular_buffer_class (size_t size)
+{
+    size_t cap = HEV_CIRCULAR_BUFFER_MIN_SIZE;
+    int idx = 0;
+
+    while (cap < size) {
+        cap <<= 1;
+        idx++;
+    }
+
+    return idx;
+}
+
 EXPORT_SYMBOL HevCircularBuffer *
 hev_circular_buffer_new (size_t max_size)
 {
+    HevTaskSystemContext *ctx = hev_task_system_find_context ();
     HevCircularBuffer *self;
+    size_t cap = max_size;
+    int idx;
+
+    idx = hev_circular_buffer_class (max_size);
+    if (idx >= HEV_CIRCULAR_BUFFER_CLASSES)
+        idx = -1;
+
+    if (ctx && idx >= 0 && ctx->buffer_cache[idx]) {
+        self = ctx->buffer_cache[idx];
+        ctx->buffer_cache[idx] = *(HevCircularBuffer **)self->data;
+        ctx->buffer_cache_count[idx]--;
+        goto init;
+    }
+
+    if (idx >= 0)
+        cap = (size_t)HEV_CIRCULAR_BUFFER_MIN_SIZE << idx;
 
-    self = hev_malloc (sizeof (HevCircularBuffer) + max_size);
+    self = hev_malloc (sizeof (HevCircularBuffer) + cap);
     if (!self)
         return NULL;
 
+init:
     self->rp = 0;
+    self->rda_size = 0;
     self->use_size = 0;
     self->max_size = max_size;
     self->ref_count = 1;
+    self->klass = idx;
 
     return self;
 }
 
+static void
+hev_circular_buffer_release (HevCircularBuffer *self)
+{
+    HevTaskSystemContext *ctx = hev_task_system_find_context ();
+    int idx = self->klass;
+
+    if (!ctx || idx < 0 ||
+        ctx->buffer_cache_count[idx] >= CONFIG_IO_BUFFER_CACHE) {
+        hev_free (self);
+        return;
+    }
+
+    *(HevCircularBuffer **)self->data = ctx->buffer_cache[idx];
+    ctx->buffer_cache[idx] = self;
+    ctx->buffer_cache_count[idx]++;
+}
+
+void
+hev_circular_buffer_cache_clear (void)
+{
+    HevTaskSystemContext *ctx = hev_task_system_get_context ();
+    int i;
+
+    for (i = 0; i < HEV_CIRCULAR_BUFFER_CLASSES; i++) {
+        while (ctx->buffer_cache[i]) {
+            HevCircularBuffer *self = ctx->buffer_cache[i];
+
+            ctx->buffer_cache[i] = *(HevCircularBuffer **)self->data;
+            hev_free (self);
+        }
+        ctx->buffer_cache_count[i] = 0;
+    }
+}
+
 EXPORT_SYMBOL HevCircularBuffer *
 hev_circular_buffer_ref (HevCircularBuffer *self)
 {
@@ -54,7 +126,24 @@ hev_circular_buffer_unref (HevCircularBuffer *self)
     if (self->ref_count)
         return;
 
-    hev_free (self);
+    hev_circular_buffer_release (self);
+}
+
+EXPORT_SYMBOL HevCircularBuffer *
+hev_circular_buffer_resize (HevCircularBuffer *self, size_t max_size)
+{
+    HevCircularBuffer *new;
+
+    if (self->use_size || (self->ref_count > 1) ||
+        (self->max_size == max_size))
+        return self;
+
+    new = hev_circular_buffer_new (max_size);
+    if (!new)
+        return self;
+
+    hev_circular_buffer_release (self);
+    return new;
 }
 
 EXPORT_SYMBOL size_t
@@ -74,18 +163,18 @@ hev_circular_buffer_reading (HevCircularBuffer *self, struct iovec *iov)
 {
     size_t upper_size = self->max_size - self->rp;
 
-    if (0 == self->use_size)
+    if (0 == self->rda_size)
         return 0;
 
     iov[0].iov_base = self->data + self->rp;
-    if (self->use_size <= upper_size) {
-        iov[0].iov_len = self->use_size;
+    if (self->rda_size <= upper_size) {
+        iov[0].iov_len = self->rda_size;
         return 1;
     }
 
     iov[0].iov_len = upper_size;
     iov[1].iov_base = self->data;
-    iov[1].iov_len = self->use_size - upper_size;
+    iov[1].iov_len = self->rda_size - upper_size;
     return 2;
 }
 
@@ -93,13 +182,29 @@ EXPORT_SYMBOL void
 hev_circular_buffer_read_finish (HevCircularBuffer *self, size_t size)
 {
     self->rp = (self->rp + size) % self->max_size;
+    self->rda_size -= size;
+    self->use_size -= size;
+}
+
+EXPORT_SYMBOL void
+hev_circular_buffer_read_advance (HevCircularBuffer *self, size_t size)
+{
+    self->rp = (self->rp + size) % self->max_size;
+    self->rda_size -= size;
+}
+
+EXPORT_SYMBOL void
+hev_circular_buffer_read_release (HevCircularBuffer *self, size_t size)
+{
     self->use_size -= size;
+    if (!self->use_size)
+        self->rp = 0;
 }
 
 EXPORT_SYMBOL int
 hev_circular_buffer_writing (HevCircularBuffer *self, struct iovec *iov)
 {
-    size_t wp = (self->rp + self->use_size) % self->max_size;
+    size_t wp = (self->rp + self->rda_size) % self->max_size;
     size_t upper_size = self->max_size - wp;
     size_t spc_size = self->max_size - self->use_size;
 
@@ -122,4 +227,5 @@ EXPORT_SYMBOL void
 hev_circular_buffer_write_finish (HevCircularBuffer *self, size_t size)
 {
     self->use_size += size;
+    self->rda_size += size;
 }
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-circular-buffer.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2019 everyone.
+ Copyright   : Copyright (c) 2019 - 2026 everyone.
  Description : Circular buffer
  ============================================================================
  */
@@ -17,6 +17,8 @@
 extern "C" {
 #endif
 
+#define HEV_CIRCULAR_BUFFER_MIN_SIZE (4096)
+
 typedef struct _HevCircularBuffer HevCircularBuffer;
 
 /**
@@ -25,6 +27,10 @@ typedef struct _HevCircularBuffer HevCircularBuffer;
  *
  * Creates a new circular buffer. The max buffer size is specified by @max_size.
  *
+ * Backing storage is rounded up to a power of two size class starting at
+ * %HEV_CIRCULAR_BUFFER_MIN_SIZE and, up to 128 KiB, reused from buffers
+ * released on the same task system.
+ *
  * Returns: a new #HevCircularBuffer.
  *
  * Since: 4.6.1
@@ -54,6 +60,21 @@ HevCircularBuffer *hev_circular_buffer_ref (HevCircularBuffer *self);
  */
 void hev_circular_buffer_unref (HevCircularBuffer *self);
 
+/**
+ * hev_circular_buffer_resize:
+ * @self: a #HevCircularBuffer
+ * @max_size: new max buffer size
+ *
+ * Swaps an empty, unshared buffer for one of @max_size. A buffer that holds
+ * data or has other references is kept.
+ *
+ * Returns: the new buffer, or @self unchanged on failure
+ *
+ * Since: 5.11
+ */
+HevCircularBuffer *hev_circular_buffer_resize (HevCircularBuffer *self,
+                                               size_t max_size);
+
 /**
  * hev_circular_buffer_get_max_size:
  * @self: a #HevCircularBuffer
@@ -70,7 +91,7 @@ size_t hev_circular_buffer_get_max_size (HevCircularBuffer *self);
  * hev_circular_buffer_get_use_size:
  * @self: a #HevCircularBuffer
  *
- * Get the use size of buffer.
+ * Get the use size of buffer, including data read but not yet released.
  *
  * Returns: the number of bytes actually used
  *
@@ -106,6 +127,31 @@ int hev_circular_buffer_reading (HevCircularBuffer *self, struct iovec *iov);
  */
 void hev_circular_buffer_read_finish (HevCircularBuffer *self, size_t size);
 
+/**
+ * hev_circular_buffer_read_advance:
+ * @self: a #HevCircularBuffer
+ * @size: the number of bytes actually read
+ *
+ * Increases the read pointer by @size like hev_circular_buffer_read_finish,
+ * but keeps the bytes in the buffer until hev_circular_buffer_read_release,
+ * for a reader that still references them, e.g. until they are acked.
+ *
+ * Since: 5.11
+ */
+void hev_circular_buffer_read_advance (HevCircularBuffer *self, size_t size);
+
+/**
+ * hev_circular_buffer_read_release:
+ * @self: a #HevCircularBuffer
+ * @size: the number of bytes no longer referenced
+ *
+ * Frees the oldest @size bytes passed by hev_circular_buffer_read_advance.
+ * A buffer emptied this way starts over at its beginning.
+ *
+ * Since: 5.11
+ */
+void hev_circular_buffer_read_release (HevCircularBuffer *self, size_t size);
+
 /**
  * hev_circular_buffer_writing:
  * @self: a #HevCircularBuffer
@@ -28,16 +28,21 @@ hev_task_io_poll (HevTaskIOPollFD fds[], unsigned int nfds, int timeout)
                 hev_task_add_fd (task, fds[i].fd, fds[i].events);
         }
 
+        /*
+         * Registrations already in place are kept without an epoll_ctl,
+         * which is what rearmed the edge before, so poll first.
+         */
+        res = poll (fds, nfds, 0);
         if (timeout > 0) {
-            do {
+            while (timeout > 0 && res == 0) {
                 timeout = hev_task_sleep (timeout);
                 res = poll (fds, nfds, 0);
-            } while (timeout > 0 && res == 0);
+            }
         } else {
-            do {
+            while (res == 0) {
                 hev_task_yield (HEV_TASK_WAITIO);
                 res = poll (fds, nfds, 0);
-            } while (res == 0);
+            }
         }
     }
 
@@ -25,6 +25,7 @@ typedef struct pollfd HevTaskIOPollFD;
  * @timeout: amount of time to wait, in milliseconds, or -1 to wait forever
  *
  * Polls @fds, as with the poll() system call, but not block current thread.
+ * @fds stay added to the current task, see hev_task_add_fd.
  *
  * Returns: the number of entries in @fds whose %revents fields
  * were filled in, or 0 if the operation timed out, or -1 on error or
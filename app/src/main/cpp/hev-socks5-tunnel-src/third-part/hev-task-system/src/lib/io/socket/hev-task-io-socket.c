@@ -9,16 +9,29 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
 #include "kern/task/hev-task.h"
 #include "lib/io/basic/hev-task-io.h"
 #include "lib/misc/hev-compiler.h"
 
 #include "hev-task-io-socket.h"
 
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY (0)
+#endif
+
+/* Send calls in flight, one bit each in HevTaskIOSocketZC.acked. */
+#define TASK_IO_SOCKET_ZC_WINDOW (64)
+
 EXPORT_SYMBOL int
 hev_task_io_socket_socket (int domain, int type, int protocol)
 {
@@ -472,3 +485,249 @@ retry:
 
     return c;
 }
+
+EXPORT_SYMBOL int
+hev_task_io_socket_zc_init (HevTaskIOSocketZC *self, int fd)
+{
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+    int one = 1;
+#endif
+
+    memset (self, 0, sizeof (HevTaskIOSocketZC));
+    self->fd = fd;
+
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+    if (setsockopt (fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) == 0) {
+        self->enabled = 1;
+        return 0;
+    }
+#else
+    errno = EOPNOTSUPP;
+#endif
+
+    return -1;
+}
+
+static void
+task_io_socket_zc_ack (HevTaskIOSocketZC *self, unsigned int lo,
+                       unsigned int hi)
+{
+    unsigned int id;
+
+    /* Ranges of datagram sockets can complete out of order. */
+    if ((int)(lo - self->done) < 0)
+        lo = self->done;
+    for (id = lo; (int)(hi - id) >= 0; id++) {
+        unsigned int off = id - self->done;
+
+        if (off >= TASK_IO_SOCKET_ZC_WINDOW)
+            break;
+        self->acked |= 1ULL << off;
+    }
+
+    while (self->acked & 1) {
+        self->acked >>= 1;
+        self->done++;
+    }
+}
+
+EXPORT_SYMBOL int
+hev_task_io_socket_zc_reap (HevTaskIOSocketZC *self)
+{
+    unsigned int done = self->done;
+
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+    while (self->next != self->done) {
+        char control[128];
+        struct msghdr msg = { 0 };
+        struct cmsghdr *cmsg;
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof (control);
+
+        if (recvmsg (self->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+
+        for (cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+             cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+            struct sock_extended_err *serr;
+
+            if (!((cmsg->cmsg_level == SOL_IP &&
+                   cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 &&
+                   cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA (cmsg);
+            if (serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                self->copied++;
+            /* Notifications cover the range ee_info..ee_data of send calls. */
+            task_io_socket_zc_ack (self, serr->ee_info, serr->ee_data);
+        }
+    }
+#endif
+
+    return self->done - done;
+}
+
+EXPORT_SYMBOL int
+hev_task_io_socket_zc_done (HevTaskIOSocketZC *self, unsigned int token)
+{
+    return (int)(token - self->done) < 0;
+}
+
+static int
+task_io_socket_zc_room (HevTaskIOSocketZC *self, unsigned int count)
+{
+    if (!self->enabled)
+        return 0;
+
+    if ((self->next - self->done + count) > TASK_IO_SOCKET_ZC_WINDOW)
+        hev_task_io_socket_zc_reap (self);
+
+    return (self->next - self->done + count) <= TASK_IO_SOCKET_ZC_WINDOW;
+}
+
+static ssize_t
+task_io_socket_sendmsg_zc (HevTaskIOSocketZC *self, const struct msghdr *msg,
+                           int flags)
+{
+    ssize_t s;
+
+    if (task_io_socket_zc_room (self, 1)) {
+        s = sendmsg (self->fd, msg, flags | MSG_ZEROCOPY);
+        /* Calls that send nothing take no token. */
+        if (s > 0)
+            self->next++;
+        /* ENOBUFS: out of optmem for completions, send a copy instead. */
+        if (s >= 0 || errno != ENOBUFS)
+            return s;
+    }
+
+    return sendmsg (self->fd, msg, flags);
+}
+
+EXPORT_SYMBOL ssize_t
+hev_task_io_socket_sendmsg_zc (HevTaskIOSocketZC *self,
+                               const struct msghdr *msg, int flags,
+                               unsigned int *token, HevTaskIOYielder yielder,
+                               void *yielder_data)
+{
+    ssize_t s;
+
+retry:
+    s = task_io_socket_sendmsg_zc (self, msg, flags & ~MSG_WAITALL);
+    if (s < 0 && errno == EAGAIN && !(flags & MSG_DONTWAIT)) {
+        if (yielder) {
+            if (yielder (HEV_TASK_WAITIO, yielder_data))
+                return -2;
+        } else {
+            hev_task_yield (HEV_TASK_WAITIO);
+        }
+        goto retry;
+    }
+
+    if (token)
+        *token = self->next - 1;
+
+    return s;
+}
+
+static int
+task_io_socket_sendmmsg_zc (HevTaskIOSocketZC *self, struct mmsghdr *msgv,
+                            unsigned int n, int flags)
+{
+    int i, r;
+
+    if (task_io_socket_zc_room (self, n)) {
+#ifdef MSG_WAITFORONE
+        r = sendmmsg (self->fd, msgv, n, flags | MSG_ZEROCOPY);
+#else
+        r = sendmsg (self->fd, &msgv[0].msg_hdr, flags | MSG_ZEROCOPY);
+        if (r >= 0) {
+            msgv[0].msg_len = r;
+            r = 1;
+        }
+#endif
+        for (i = 0; i < r; i++)
+            if (msgv[i].msg_len > 0)
+                self->next++;
+        if (r >= 0 || errno != ENOBUFS)
+            return r;
+    }
+
+#ifdef MSG_WAITFORONE
+    r = sendmmsg (self->fd, msgv, n, flags);
+#else
+    r = sendmsg (self->fd, &msgv[0].msg_hdr, flags);
+    if (r >= 0) {
+        msgv[0].msg_len = r;
+        r = 1;
+    }
+#endif
+
+    return r;
+}
+
+EXPORT_SYMBOL int
+hev_task_io_socket_sendmmsg_zc (HevTaskIOSocketZC *self, void *_msgv,
+                                unsigned int n, int flags, unsigned int *token,
+                                HevTaskIOYielder yielder, void *yielder_data)
+{
+    struct mmsghdr *msgv = _msgv;
+    int r, c = 0;
+
+retry:
+    r = task_io_socket_sendmmsg_zc (self, &msgv[c], n - c, flags & ~MSG_WAITALL);
+    if (r < 0 && errno == EAGAIN && !(flags & MSG_DONTWAIT)) {
+        if (yielder) {
+            if (yielder (HEV_TASK_WAITIO, yielder_data)) {
+                r = c ? c : -2;
+                goto out;
+            }
+        } else {
+            hev_task_yield (HEV_TASK_WAITIO);
+        }
+        goto retry;
+    }
+
+    if (!(flags & MSG_WAITALL))
+        goto out;
+
+    if (r <= 0) {
+        r = c ? c : r;
+        goto out;
+    }
+
+    c += r;
+    if (c < n)
+        goto retry;
+    r = c;
+
+out:
+    if (token)
+        *token = self->next - 1;
+
+    return r;
+}
+
+EXPORT_SYMBOL int
+hev_task_io_socket_zc_wait (HevTaskIOSocketZC *self, unsigned int token,
+                            HevTaskIOYielder yielder, void *yielder_data)
+{
+    for (;;) {
+        hev_task_io_socket_zc_reap (self);
+        if (hev_task_io_socket_zc_done (self, token))
+            return 0;
+
+        if (yielder) {
+            if (yielder (HEV_TASK_WAITIO, yielder_data))
+                return -2;
+        } else {
+            hev_task_yield (HEV_TASK_WAITIO);
+        }
+    }
+}
@@ -10,6 +10,7 @@
 #ifndef __HEV_TASK_IO_SOCKET_H__
 #define __HEV_TASK_IO_SOCKET_H__
 
+#include <stdint.h>
 #include <sys/socket.h>
 
 #ifdef __cplusplus
@@ -24,6 +25,33 @@ struct mmsghdr
 };
 #endif
 
+typedef struct _HevTaskIOSocketZC HevTaskIOSocketZC;
+
+/**
+ * HevTaskIOSocketZC:
+ * @fd: the socket
+ * @enabled: whether sends use MSG_ZEROCOPY
+ * @next: the token of the next zerocopy send call
+ * @done: send calls before this token have completed
+ * @copied: completions for which the kernel copied the data anyway
+ *
+ * Zerocopy completion state of a socket, owned by the caller. Up to 64 send
+ * calls can be in flight, sends beyond that are copied.
+ *
+ * Since: 5.11
+ */
+struct _HevTaskIOSocketZC
+{
+    int fd;
+    int enabled;
+    unsigned int next;
+    unsigned int done;
+    unsigned int copied;
+
+    /*< private >*/
+    uint64_t acked;
+};
+
 /**
  * hev_task_io_socket_socket:
  * @domain: the communications domain
@@ -274,6 +302,114 @@ int hev_task_io_socket_recvmmsg (int fd, void *msgv, unsigned int n, int flags,
 int hev_task_io_socket_sendmmsg (int fd, void *msgv, unsigned int n, int flags,
                                  HevTaskIOYielder yielder, void *yielder_data);
 
+/**
+ * hev_task_io_socket_zc_init:
+ * @self: a #HevTaskIOSocketZC
+ * @fd: a file descriptor
+ *
+ * The zc_init function shall enable SO_ZEROCOPY on @fd, a TCP or UDP socket,
+ * and reset @self for it. Without kernel support @self is still usable and
+ * every send is copied, its token completing at once.
+ *
+ * Returns: zero when sends will use zerocopy, -1 otherwise.
+ *
+ * Since: 5.11
+ */
+int hev_task_io_socket_zc_init (HevTaskIOSocketZC *self, int fd);
+
+/**
+ * hev_task_io_socket_sendmsg_zc:
+ * @self: a #HevTaskIOSocketZC
+ * @msg: message
+ * @flags: flags
+ * @token: (out) (optional): completion token of the send
+ * @yielder: a #HevTaskIOYielder
+ * @yielder_data: user data
+ *
+ * The sendmsg_zc function shall send @msg like hev_task_io_socket_sendmsg,
+ * with MSG_ZEROCOPY. The memory of @msg must stay untouched until @token is
+ * done. Tokens are ordered: a token is done once its send call and all the
+ * earlier ones are, so a copied send reports the token of the last zerocopy
+ * one. Sends are copied when out of completion memory (ENOBUFS) or with 64
+ * send calls in flight. MSG_WAITALL is ignored, stream sockets may take a
+ * part of @msg.
+ *
+ * Returns: the length of the message in bytes
+ *
+ * Since: 5.11
+ */
+ssize_t hev_task_io_socket_sendmsg_zc (HevTaskIOSocketZC *self,
+                                       const struct msghdr *msg, int flags,
+                                       unsigned int *token,
+                                       HevTaskIOYielder yielder,
+                                       void *yielder_data);
+
+/**
+ * hev_task_io_socket_sendmmsg_zc:
+ * @self: a #HevTaskIOSocketZC
+ * @msgv: an array of mmsghdr structures
+ * @n: size of mmsghdr array
+ * @flags: flags
+ * @token: (out) (optional): completion token of the last message
+ * @yielder: a #HevTaskIOYielder
+ * @yielder_data: user data
+ *
+ * The sendmmsg_zc function shall send @msgv like hev_task_io_socket_sendmmsg,
+ * with MSG_ZEROCOPY. Each message is a send call of its own, see
+ * hev_task_io_socket_sendmsg_zc.
+ *
+ * Returns: the number of messages sent from msgv
+ *
+ * Since: 5.11
+ */
+int hev_task_io_socket_sendmmsg_zc (HevTaskIOSocketZC *self, void *msgv,
+                                    unsigned int n, int flags,
+                                    unsigned int *token,
+                                    HevTaskIOYielder yielder,
+                                    void *yielder_data);
+
+/**
+ * hev_task_io_socket_zc_reap:
+ * @self: a #HevTaskIOSocketZC
+ *
+ * The zc_reap function shall read the completions queued on the error queue
+ * of the socket (MSG_ERRQUEUE) without waiting.
+ *
+ * Returns: the number of send calls that became done.
+ *
+ * Since: 5.11
+ */
+int hev_task_io_socket_zc_reap (HevTaskIOSocketZC *self);
+
+/**
+ * hev_task_io_socket_zc_done:
+ * @self: a #HevTaskIOSocketZC
+ * @token: a completion token
+ *
+ * Returns: nonzero when the memory of the send of @token can be reused.
+ *
+ * Since: 5.11
+ */
+int hev_task_io_socket_zc_done (HevTaskIOSocketZC *self, unsigned int token);
+
+/**
+ * hev_task_io_socket_zc_wait:
+ * @self: a #HevTaskIOSocketZC
+ * @token: a completion token
+ * @yielder: a #HevTaskIOYielder
+ * @yielder_data: user data
+ *
+ * The zc_wait function shall wait until @token is done. Completions raise
+ * POLLERR, which epoll and poll report whatever events the fd was added
+ * with, so the task only needs the fd added.
+ *
+ * Returns: zero when done, -2 when the yielder stopped the wait.
+ *
+ * Since: 5.11
+ */
+int hev_task_io_socket_zc_wait (HevTaskIOSocketZC *self, unsigned int token,
+                                HevTaskIOYielder yielder, void *yielder_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -70,3 +70,21 @@ hev_free (void *ptr)
     allocator = hev_memory_allocator_default ();
     hev_memory_allocator_free (allocator, ptr);
 }
+
+EXPORT_SYMBOL void
+hev_malloc_trim (void)
+{
+    HevMemoryAllocator *allocator;
+
+    allocator = hev_memory_allocator_default ();
+    hev_memory_allocator_trim (allocator);
+}
+
+EXPORT_SYMBOL void
+hev_malloc_stats (HevMemoryAllocatorStats *stats)
+{
+    HevMemoryAllocator *allocator;
+
+    allocator = hev_memory_allocator_default ();
+    hev_memory_allocator_get_stats (allocator, stats);
+}
@@ -16,6 +16,21 @@
 extern "C" {
 #endif
 
+typedef struct _HevMemoryAllocatorStats HevMemoryAllocatorStats;
+
+struct _HevMemoryAllocatorStats
+{
+    size_t slabs;
+    size_t slab_bytes;
+    size_t cached;
+    unsigned long long allocs;
+    unsigned long long frees;
+    unsigned long long large_allocs;
+    unsigned long long remote_frees;
+    unsigned long long refills;
+    unsigned long long releases;
+};
+
 /**
  * hev_malloc:
  * @size: bytes
@@ -78,6 +93,31 @@ void *hev_realloc (void *ptr, size_t size);
  */
 void hev_free (void *ptr);
 
+/**
+ * hev_malloc_trim:
+ *
+ * Return free memory cached by the default memory allocator of the calling
+ * thread to the system: empty slabs are unmapped and magazines flushed. The
+ * task system does this by itself while idle.
+ *
+ * Since: 5.11
+ */
+void hev_malloc_trim (void);
+
+/**
+ * hev_malloc_stats:
+ * @stats: (out): counters
+ *
+ * Get the counters of the default memory allocator of the calling thread:
+ * slabs mapped and their bytes, free blocks held in magazines, small
+ * allocations and frees, allocations passed to malloc, frees of blocks
+ * owned by another thread, magazine refills and flushes. All zero unless
+ * the slab allocator (ENABLE_MEMALLOC_SLAB) is in use.
+ *
+ * Since: 5.11
+ */
+void hev_malloc_stats (HevMemoryAllocatorStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -90,3 +90,19 @@ hev_memory_allocator_free (HevMemoryAllocator *self, void *ptr)
 {
     return self->free (self, ptr);
 }
+
+EXPORT_SYMBOL void
+hev_memory_allocator_trim (HevMemoryAllocator *self)
+{
+    if (self->trim)
+        self->trim (self);
+}
+
+EXPORT_SYMBOL void
+hev_memory_allocator_get_stats (HevMemoryAllocator *self,
+                                HevMemoryAllocatorStats *stats)
+{
+    memset (stats, 0, sizeof (HevMemoryAllocatorStats));
+    if (self->get_stats)
+        self->get_stats (self, stats);
+}
@@ -12,6 +12,8 @@
 
 #include <stddef.h>
 
+#include "mem/api/hev-memory-allocator-api.h"
+
 typedef struct _HevMemoryAllocator HevMemoryAllocator;
 
 typedef void *(*HevMemoryAllocatorAlloc) (HevMemoryAllocator *self,
@@ -19,6 +21,9 @@ typedef void *(*HevMemoryAllocatorAlloc) (HevMemoryAllocator *self,
 typedef void *(*HevMemoryAllocatorRealloc) (HevMemoryAllocator *self, void *ptr,
                                             size_t size);
 typedef void (*HevMemoryAllocatorFree) (HevMemoryAllocator *self, void *ptr);
+typedef void (*HevMemoryAllocatorTrim) (HevMemoryAllocator *self);
+typedef void (*HevMemoryAllocatorGetStats) (HevMemoryAllocator *self,
+                                           HevMemoryAllocatorStats *stats);
 typedef void (*HevMemoryAllocatorDestroy) (HevMemoryAllocator *self);
 
 struct _HevMemoryAllocator
@@ -26,6 +31,8 @@ struct _HevMemoryAllocator
     HevMemoryAllocatorAlloc alloc;
     HevMemoryAllocatorRealloc realloc;
     HevMemoryAllocatorFree free;
+    HevMemoryAllocatorTrim trim;
+    HevMemoryAllocatorGetStats get_stats;
     HevMemoryAllocatorDestroy destroy;
 
     unsigned int ref_count;
@@ -117,4 +124,26 @@ void *hev_memory_allocator_realloc (HevMemoryAllocator *self, void *ptr,
  */
 void hev_memory_allocator_free (HevMemoryAllocator *self, void *ptr);
 
+/**
+ * hev_memory_allocator_trim:
+ * @self: a #HevMemoryAllocator
+ *
+ * Return cached free memory to the system, if the allocator caches any.
+ *
+ * Since: 5.11
+ */
+void hev_memory_allocator_trim (HevMemoryAllocator *self);
+
+/**
+ * hev_memory_allocator_get_stats:
+ * @self: a #HevMemoryAllocator
+ * @stats: (out): counters
+ *
+ * Get the counters of @self, all zero if the allocator keeps none.
+ *
+ * Since: 5.11
+ */
+void hev_memory_allocator_get_stats (HevMemoryAllocator *self,
+                                     HevMemoryAllocatorStats *stats);
+
 #endif /* __HEV_MEMORY_ALLOCATOR_H__ */
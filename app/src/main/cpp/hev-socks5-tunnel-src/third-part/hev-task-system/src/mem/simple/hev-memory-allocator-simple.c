@@ -30,6 +30,8 @@ hev_memory_allocator_simple_new (void)
     self->alloc = _hev_memory_allocator_alloc;
     self->realloc = _hev_memory_allocator_realloc;
     self->free = _hev_memory_allocator_free;
+    self->trim = NULL;
+    self->get_stats = NULL;
     self->destroy = NULL;
 
     return self;
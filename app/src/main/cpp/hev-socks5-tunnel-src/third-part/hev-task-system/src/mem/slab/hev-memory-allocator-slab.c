@@ -0,0 +1,430 @@
+/*
+ ============================================================================
+ Name        : hev-memory-allocator-slab.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Memory allocator slab
+ ============================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lib/list/hev-list.h"
+#include "lib/misc/hev-compiler.h"
+
+#include "hev-memory-allocator-slab.h"
+
+#define SLAB_ALIGN CONFIG_MEMALLOC_SLICE_ALIGN
+#define SLAB_MAX_SIZE CONFIG_MEMALLOC_SLICE_MAX_SIZE
+#define SLAB_CLASS_COUNT (SLAB_MAX_SIZE / SLAB_ALIGN)
+#define SLAB_SIZE CONFIG_MEMALLOC_SLAB_SIZE
+#define MAGAZINE_SIZE CONFIG_MEMALLOC_SLAB_MAGAZINE
+
+#ifndef MAP_ANON
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+typedef struct _HevMemorySlab HevMemorySlab;
+typedef struct _HevMemorySlabObject HevMemorySlabObject;
+typedef struct _HevMemorySlabClass HevMemorySlabClass;
+
+/* Precedes every returned block, @slab is NULL for large blocks. */
+struct _HevMemorySlabObject
+{
+    HevMemorySlab *slab;
+    HevMemorySlabObject *next;
+};
+
+/* Lives at the start of each SLAB_SIZE mapping, objects follow. */
+struct _HevMemorySlab
+{
+    HevListNode node;
+    HevMemoryAllocatorSlab *owner;
+    HevMemorySlabObject *free;
+    char *bump;
+    char *end;
+    unsigned int used;
+    unsigned int index;
+};
+
+struct _HevMemorySlabClass
+{
+    HevList partial;
+    HevList full;
+    HevMemorySlab *empty;
+    unsigned int count;
+    HevMemorySlabObject *magazine[MAGAZINE_SIZE];
+};
+
+struct _HevMemoryAllocatorSlab
+{
+    HevMemoryAllocator base;
+
+    HevMemorySlabObject *remote;
+    HevMemoryAllocatorStats stats;
+    HevMemorySlabClass classes[SLAB_CLASS_COUNT];
+};
+
+static void *_hev_memory_allocator_alloc (HevMemoryAllocator *self,
+                                          size_t size);
+static void *_hev_memory_allocator_realloc (HevMemoryAllocator *self, void *ptr,
+                                            size_t size);
+static void _hev_memory_allocator_free (HevMemoryAllocator *self, void *ptr);
+static void _hev_memory_allocator_trim (HevMemoryAllocator *self);
+static void _hev_memory_allocator_get_stats (HevMemoryAllocator *self,
+                                             HevMemoryAllocatorStats *stats);
+static void _hev_memory_allocator_destroy (HevMemoryAllocator *self);
+
+HevMemoryAllocator *
+hev_memory_allocator_slab_new (void)
+{
+    HevMemoryAllocator *allocator = NULL;
+
+    allocator = calloc (1, sizeof (HevMemoryAllocatorSlab));
+    if (!allocator)
+        return NULL;
+
+    allocator->ref_count = 1;
+    allocator->alloc = _hev_memory_allocator_alloc;
+    allocator->realloc = _hev_memory_allocator_realloc;
+    allocator->free = _hev_memory_allocator_free;
+    allocator->trim = _hev_memory_allocator_trim;
+    allocator->get_stats = _hev_memory_allocator_get_stats;
+    allocator->destroy = _hev_memory_allocator_destroy;
+
+    return allocator;
+}
+
+static inline size_t
+slab_stride (unsigned int index)
+{
+    return sizeof (HevMemorySlabObject) + (index + 1) * SLAB_ALIGN;
+}
+
+static HevMemorySlab *
+slab_new (HevMemoryAllocatorSlab *self, unsigned int index)
+{
+    HevMemorySlab *slab;
+    size_t head;
+
+    slab = mmap (NULL, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (slab == MAP_FAILED)
+        return NULL;
+
+    head = ALIGN_UP (sizeof (HevMemorySlab), sizeof (HevMemorySlabObject));
+    slab->owner = self;
+    slab->free = NULL;
+    slab->bump = (char *)slab + head;
+    slab->end = slab->bump;
+    slab->end += (SLAB_SIZE - head) / slab_stride (index) * slab_stride (index);
+    slab->used = 0;
+    slab->index = index;
+
+    self->stats.slabs++;
+    self->stats.slab_bytes += SLAB_SIZE;
+
+    return slab;
+}
+
+static void
+slab_destroy (HevMemoryAllocatorSlab *self, HevMemorySlab *slab)
+{
+    self->stats.slabs--;
+    self->stats.slab_bytes -= SLAB_SIZE;
+    munmap (slab, SLAB_SIZE);
+}
+
+static inline int
+slab_full (HevMemorySlab *slab)
+{
+    return !slab->free && (slab->bump == slab->end);
+}
+
+static HevMemorySlabObject *
+slab_take (HevMemorySlab *slab)
+{
+    HevMemorySlabObject *obj;
+
+    if (slab->free) {
+        obj = slab->free;
+        slab->free = obj->next;
+    } else {
+        /* Carve lazily, pages past the bump pointer stay untouched. */
+        obj = (HevMemorySlabObject *)slab->bump;
+        obj->slab = slab;
+        slab->bump += slab_stride (slab->index);
+    }
+
+    slab->used++;
+    return obj;
+}
+
+static void
+slab_release (HevMemoryAllocatorSlab *self, HevMemorySlabObject *obj)
+{
+    HevMemorySlab *slab = obj->slab;
+    HevMemorySlabClass *class = &self->classes[slab->index];
+
+    if (slab_full (slab)) {
+        hev_list_del (&class->full, &slab->node);
+        hev_list_add_tail (&class->partial, &slab->node);
+    }
+
+    obj->next = slab->free;
+    slab->free = obj;
+    slab->used--;
+
+    if (slab->used)
+        return;
+
+    /* Keep one empty slab per class, return the rest to the kernel. */
+    hev_list_del (&class->partial, &slab->node);
+    if (class->empty)
+        slab_destroy (self, slab);
+    else
+        class->empty = slab;
+}
+
+static void
+drain_remote (HevMemoryAllocatorSlab *self)
+{
+    HevMemorySlabObject *obj;
+
+    if (!__atomic_load_n (&self->remote, __ATOMIC_RELAXED))
+        return;
+
+    obj = __atomic_exchange_n (&self->remote, NULL, __ATOMIC_ACQUIRE);
+    while (obj) {
+        HevMemorySlabObject *next = obj->next;
+
+        slab_release (self, obj);
+        obj = next;
+    }
+}
+
+static void
+magazine_refill (HevMemoryAllocatorSlab *self, HevMemorySlabClass *class,
+                 unsigned int index)
+{
+    drain_remote (self);
+
+    self->stats.refills++;
+    while (class->count < (MAGAZINE_SIZE / 2)) {
+        HevListNode *node = hev_list_first (&class->partial);
+        HevMemorySlab *slab;
+
+        if (node) {
+            slab = container_of (node, HevMemorySlab, node);
+        } else {
+            slab = class->empty;
+            if (slab)
+                class->empty = NULL;
+            else
+                slab = slab_new (self, index);
+            if (!slab)
+                return;
+            hev_list_add_tail (&class->partial, &slab->node);
+        }
+
+        class->magazine[class->count++] = slab_take (slab);
+        if (slab_full (slab)) {
+            hev_list_del (&class->partial, &slab->node);
+            hev_list_add_tail (&class->full, &slab->node);
+        }
+    }
+}
+
+static void
+magazine_flush (HevMemoryAllocatorSlab *self, HevMemorySlabClass *class,
+                unsigned int count)
+{
+    unsigned int i;
+
+    /* The bottom of the stack is the coldest, keep the top hot. */
+    self->stats.releases++;
+    for (i = 0; i < count; i++)
+        slab_release (self, class->magazine[i]);
+
+    class->count -= count;
+    memmove (class->magazine, class->magazine + count,
+             sizeof (HevMemorySlabObject *) * class->count);
+}
+
+static void *
+_hev_memory_allocator_alloc (HevMemoryAllocator *allocator, size_t size)
+{
+    HevMemoryAllocatorSlab *self = (HevMemoryAllocatorSlab *)allocator;
+    HevMemorySlabClass *class;
+    HevMemorySlabObject *obj;
+    unsigned int index;
+
+    if (!size)
+        return NULL;
+
+    index = (ALIGN_UP (size, SLAB_ALIGN) / SLAB_ALIGN) - 1;
+    if (index >= SLAB_CLASS_COUNT) {
+        obj = malloc (sizeof (HevMemorySlabObject) + size);
+        if (!obj)
+            return NULL;
+        obj->slab = NULL;
+        self->stats.large_allocs++;
+        return obj + 1;
+    }
+
+    class = &self->classes[index];
+    if (!class->count) {
+        magazine_refill (self, class, index);
+        if (!class->count)
+            return NULL;
+    }
+
+    obj = class->magazine[--class->count];
+    self->stats.allocs++;
+
+    return obj + 1;
+}
+
+static void *
+_hev_memory_allocator_realloc (HevMemoryAllocator *allocator, void *ptr,
+                               size_t size)
+{
+    HevMemorySlabObject *obj;
+    size_t usable = 0;
+    void *data;
+
+    if (!ptr)
+        return _hev_memory_allocator_alloc (allocator, size);
+
+    if (0 == size) {
+        _hev_memory_allocator_free (allocator, ptr);
+        return NULL;
+    }
+
+    obj = (HevMemorySlabObject *)ptr - 1;
+    if (!obj->slab) {
+        if (size <= SLAB_MAX_SIZE)
+            goto move;
+
+        obj = realloc (obj, sizeof (HevMemorySlabObject) + size);
+        if (!obj)
+            return NULL;
+        return obj + 1;
+    }
+
+    usable = (obj->slab->index + 1) * SLAB_ALIGN;
+    if ((size <= usable) && (size > (usable - SLAB_ALIGN)))
+        return ptr;
+
+move:
+    data = _hev_memory_allocator_alloc (allocator, size);
+    if (!data)
+        return NULL;
+
+    /* A large block is always bigger than any slab class. */
+    if (obj->slab && (usable < size))
+        size = usable;
+    memcpy (data, ptr, size);
+    _hev_memory_allocator_free (allocator, ptr);
+
+    return data;
+}
+
+static void
+_hev_memory_allocator_free (HevMemoryAllocator *allocator, void *ptr)
+{
+    HevMemoryAllocatorSlab *self = (HevMemoryAllocatorSlab *)allocator;
+    HevMemorySlabObject *obj = (HevMemorySlabObject *)ptr - 1;
+    HevMemorySlabClass *class;
+    HevMemorySlab *slab;
+
+    slab = obj->slab;
+    if (!slab) {
+        free (obj);
+        return;
+    }
+
+    /* Blocks of another thread go back to their owner's remote list. */
+    if (slab->owner != self) {
+        HevMemoryAllocatorSlab *owner = slab->owner;
+
+        obj->next = __atomic_load_n (&owner->remote, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n (&owner->remote, &obj->next, obj,
+                                             1, __ATOMIC_RELEASE,
+                                             __ATOMIC_RELAXED))
+            ;
+        self->stats.remote_frees++;
+        return;
+    }
+
+    class = &self->classes[slab->index];
+    if (class->count == MAGAZINE_SIZE)
+        magazine_flush (self, class, MAGAZINE_SIZE / 2);
+
+    class->magazine[class->count++] = obj;
+    self->stats.frees++;
+}
+
+static void
+_hev_memory_allocator_trim (HevMemoryAllocator *allocator)
+{
+    HevMemoryAllocatorSlab *self = (HevMemoryAllocatorSlab *)allocator;
+    int i;
+
+    drain_remote (self);
+
+    for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+        HevMemorySlabClass *class = &self->classes[i];
+
+        if (class->count)
+            magazine_flush (self, class, class->count);
+
+        if (class->empty) {
+            slab_destroy (self, class->empty);
+            class->empty = NULL;
+        }
+    }
+}
+
+static void
+_hev_memory_allocator_get_stats (HevMemoryAllocator *allocator,
+                                 HevMemoryAllocatorStats *stats)
+{
+    HevMemoryAllocatorSlab *self = (HevMemoryAllocatorSlab *)allocator;
+    int i;
+
+    *stats = self->stats;
+
+    stats->cached = 0;
+    for (i = 0; i < SLAB_CLASS_COUNT; i++)
+        stats->cached += self->classes[i].count;
+}
+
+static void
+_hev_memory_allocator_destroy (HevMemoryAllocator *allocator)
+{
+    HevMemoryAllocatorSlab *self = (HevMemoryAllocatorSlab *)allocator;
+    int i;
+
+    for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+        HevMemorySlabClass *class = &self->classes[i];
+        HevList *lists[] = { &class->partial, &class->full };
+        int j;
+
+        for (j = 0; j < ARRAY_SIZE (lists); j++) {
+            HevListNode *node = hev_list_first (lists[j]);
+
+            while (node) {
+                HevListNode *next = hev_list_node_next (node);
+
+                munmap (container_of (node, HevMemorySlab, node), SLAB_SIZE);
+                node = next;
+            }
+        }
+
+        if (class->empty)
+            munmap (class->empty, SLAB_SIZE);
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ ============================================================================
+ Name        : hev-memory-allocator-slab.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Memory allocator slab
+ ============================================================================
+ */
+
+#ifndef __HEV_MEMORY_ALLOCATOR_SLAB_H__
+#define __HEV_MEMORY_ALLOCATOR_SLAB_H__
+
+#include "mem/base/hev-memory-allocator.h"
+
+typedef struct _HevMemoryAllocatorSlab HevMemoryAllocatorSlab;
+
+/**
+ * hev_memory_allocator_slab_new:
+ *
+ * Creates a new slab memory allocator. Blocks up to
+ * CONFIG_MEMALLOC_SLICE_MAX_SIZE are carved from CONFIG_MEMALLOC_SLAB_SIZE
+ * mappings, one set per size class, and handed out through a per-class
+ * magazine refilled and flushed in bulk. Larger blocks go to malloc.
+ *
+ * Blocks freed by another thread are queued to the owning allocator and
+ * reclaimed on its next refill or trim, so the owner must outlive them.
+ *
+ * Returns: a new #HevMemoryAllocator
+ *
+ * Since: 5.11
+ */
+HevMemoryAllocator *hev_memory_allocator_slab_new (void);
+
+#endif /* __HEV_MEMORY_ALLOCATOR_SLAB_H__ */
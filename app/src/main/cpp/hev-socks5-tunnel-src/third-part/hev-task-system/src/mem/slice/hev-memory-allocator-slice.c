@@ -72,6 +72,8 @@ hev_memory_allocator_slice_new (void)
     allocator->alloc = _hev_memory_allocator_alloc;
     allocator->realloc = _hev_memory_allocator_realloc;
     allocator->free = _hev_memory_allocator_free;
+    allocator->trim = NULL;
+    allocator->get_stats = NULL;
     allocator->destroy = _hev_memory_allocator_destroy;
 
     self = (HevMemoryAllocatorSlice *)allocator;
@@ -9,6 +9,7 @@
 
 #include <assert.h>
 
+#include <hev-task-system.h>
 #include <hev-circular-buffer.h>
 
 int
@@ -134,5 +135,54 @@ main (int argc, char *argv[])
 
     hev_circular_buffer_unref (buffer);
 
+    buffer = hev_circular_buffer_new (HEV_CIRCULAR_BUFFER_MIN_SIZE);
+    assert (buffer);
+
+    assert (1 == hev_circular_buffer_writing (buffer, iov));
+    wb1 = iov[0].iov_base;
+    hev_circular_buffer_write_finish (buffer, 64);
+    assert (1 == hev_circular_buffer_reading (buffer, iov));
+    assert (iov[0].iov_base == wb1);
+    hev_circular_buffer_read_advance (buffer, 48);
+
+    /* Read data stays used until it is released. */
+    assert (64 == hev_circular_buffer_get_use_size (buffer));
+    assert (1 == hev_circular_buffer_reading (buffer, iov));
+    assert (iov[0].iov_base == (wb1 + 48));
+    assert (iov[0].iov_len == 16);
+    assert (1 == hev_circular_buffer_writing (buffer, iov));
+    assert (iov[0].iov_base == (wb1 + 64));
+    assert (iov[0].iov_len == (HEV_CIRCULAR_BUFFER_MIN_SIZE - 64));
+
+    hev_circular_buffer_read_release (buffer, 32);
+    assert (32 == hev_circular_buffer_get_use_size (buffer));
+    assert (buffer == hev_circular_buffer_resize (buffer, 8192));
+
+    hev_circular_buffer_read_advance (buffer, 16);
+    hev_circular_buffer_read_release (buffer, 32);
+    assert (0 == hev_circular_buffer_get_use_size (buffer));
+    assert (0 == hev_circular_buffer_reading (buffer, iov));
+    assert (1 == hev_circular_buffer_writing (buffer, iov));
+    assert (iov[0].iov_base == wb1);
+
+    buffer = hev_circular_buffer_resize (buffer, 8192);
+    assert (8192 == hev_circular_buffer_get_max_size (buffer));
+    assert (1 == hev_circular_buffer_writing (buffer, iov));
+    assert (iov[0].iov_len == 8192);
+
+    hev_circular_buffer_unref (buffer);
+
+    /* Released buffers are reused within a task system. */
+    assert (0 == hev_task_system_init ());
+    buffer = hev_circular_buffer_new (3000);
+    assert (buffer);
+    rb1 = buffer;
+    hev_circular_buffer_unref (buffer);
+    buffer = hev_circular_buffer_new (HEV_CIRCULAR_BUFFER_MIN_SIZE);
+    assert (buffer == rb1);
+    assert (0 == hev_circular_buffer_get_use_size (buffer));
+    hev_circular_buffer_unref (buffer);
+    hev_task_system_fini ();
+
     return 0;
 }
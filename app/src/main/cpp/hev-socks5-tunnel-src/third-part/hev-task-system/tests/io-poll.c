@@ -33,6 +33,8 @@ task1_entry (void *data)
     assert (val == 1);
     assert (pfds[0].revents & POLLIN);
 
+    /* Polled fds stay added to the task. */
+    assert (hev_task_del_fd (hev_task_self (), fds[0]) == 0);
     close (fds[0]);
 }
 
@@ -53,6 +55,7 @@ task2_entry (void *data)
 
     assert (write (fds[1], &val, sizeof (val)) == sizeof (val));
 
+    assert (hev_task_del_fd (hev_task_self (), fds[1]) == 0);
     close (fds[1]);
 }
 
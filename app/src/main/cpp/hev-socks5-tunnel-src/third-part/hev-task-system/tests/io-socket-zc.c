@@ -0,0 +1,242 @@
+/*
+ ============================================================================
+ Name        : io-socket-zc.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description : IO Socket Zerocopy Test
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+
+#define TCP_SIZE (1024 * 1024)
+#define TCP_CHUNK (64 * 1024)
+#define UDP_COUNT (16)
+
+static int tcp_fd;
+static int udp_fds[2];
+static unsigned char tcp_buf[TCP_SIZE];
+
+static int
+bind_loopback (int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof (addr);
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+    assert (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) == 0);
+    assert (getsockname (fd, (struct sockaddr *)&addr, &len) == 0);
+
+    return ntohs (addr.sin_port);
+}
+
+static void
+task_tcp_receiver_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+    static unsigned char buf[TCP_SIZE];
+    ssize_t size;
+    int fd;
+
+    assert (hev_task_add_fd (task, tcp_fd, POLLIN) == 0);
+    fd = hev_task_io_socket_accept (tcp_fd, NULL, NULL, NULL, NULL);
+    assert (fd >= 0);
+    assert (hev_task_add_fd (task, fd, POLLIN) == 0);
+
+    size = hev_task_io_socket_recv (fd, buf, TCP_SIZE, MSG_WAITALL, NULL,
+                                    NULL);
+    assert (size == TCP_SIZE);
+    assert (memcmp (buf, tcp_buf, TCP_SIZE) == 0);
+
+    assert (hev_task_del_fd (task, fd) == 0);
+    assert (hev_task_del_fd (task, tcp_fd) == 0);
+    close (fd);
+    close (tcp_fd);
+}
+
+static void
+task_tcp_sender_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+    HevTaskIOSocketZC zc;
+    struct sockaddr_in addr;
+    unsigned int token, first;
+    size_t sent = 0;
+    int port = (intptr_t)data;
+    int fd, i;
+
+    fd = hev_task_io_socket_socket (AF_INET, SOCK_STREAM, 0);
+    assert (fd >= 0);
+    assert (hev_task_add_fd (task, fd, POLLIN | POLLOUT) == 0);
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+    addr.sin_port = htons (port);
+    assert (hev_task_io_socket_connect (fd, (struct sockaddr *)&addr,
+                                        sizeof (addr), NULL, NULL) == 0);
+
+    /* Without kernel support the sends are copied and complete at once. */
+    hev_task_io_socket_zc_init (&zc, fd);
+    assert (zc.fd == fd);
+    assert (hev_task_io_socket_zc_done (&zc, zc.next - 1));
+
+    for (i = 0; sent < TCP_SIZE; i++) {
+        struct msghdr mh;
+        struct iovec iov;
+        ssize_t s;
+
+        memset (&mh, 0, sizeof (mh));
+        iov.iov_base = tcp_buf + sent;
+        iov.iov_len = TCP_SIZE - sent;
+        if (iov.iov_len > TCP_CHUNK)
+            iov.iov_len = TCP_CHUNK;
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+
+        s = hev_task_io_socket_sendmsg_zc (&zc, &mh, 0, &token, NULL, NULL);
+        assert (s > 0);
+        if (i == 0)
+            first = token;
+        sent += s;
+
+        /* Tokens of later sends never precede earlier ones. */
+        assert ((int)(token - first) >= 0);
+    }
+
+    assert (hev_task_io_socket_zc_wait (&zc, token, NULL, NULL) == 0);
+    assert (hev_task_io_socket_zc_done (&zc, first));
+    assert (zc.done == zc.next);
+    assert (hev_task_io_socket_zc_reap (&zc) == 0);
+
+    assert (hev_task_del_fd (task, fd) == 0);
+    close (fd);
+}
+
+static void
+task_udp_receiver_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+    char buf[64];
+    int i;
+
+    assert (hev_task_add_fd (task, udp_fds[0], POLLIN) == 0);
+
+    for (i = 0; i < UDP_COUNT; i++) {
+        ssize_t s;
+
+        s = hev_task_io_socket_recv (udp_fds[0], buf, sizeof (buf), 0, NULL,
+                                     NULL);
+        assert (s == 2);
+        assert (buf[0] == 'z' && buf[1] == 'a' + i);
+    }
+
+    assert (hev_task_del_fd (task, udp_fds[0]) == 0);
+    close (udp_fds[0]);
+}
+
+static void
+task_udp_sender_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+    struct mmsghdr msgv[UDP_COUNT];
+    struct iovec iov[UDP_COUNT];
+    char bufs[UDP_COUNT][2];
+    HevTaskIOSocketZC zc;
+    unsigned int token;
+    int i;
+
+    for (i = 0; i < UDP_COUNT; i++) {
+        memset (&msgv[i], 0, sizeof (msgv[i]));
+        msgv[i].msg_hdr.msg_iov = &iov[i];
+        msgv[i].msg_hdr.msg_iovlen = 1;
+
+        bufs[i][0] = 'z';
+        bufs[i][1] = 'a' + i;
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = 2;
+    }
+
+    assert (hev_task_add_fd (task, udp_fds[1], POLLOUT) == 0);
+
+    hev_task_io_socket_zc_init (&zc, udp_fds[1]);
+    i = hev_task_io_socket_sendmmsg_zc (&zc, msgv, UDP_COUNT, MSG_WAITALL,
+                                        &token, NULL, NULL);
+    assert (i == UDP_COUNT);
+    if (zc.enabled)
+        assert (zc.next == UDP_COUNT);
+
+    /* Each message is a send call, the last token covers them all. */
+    assert (hev_task_io_socket_zc_wait (&zc, token, NULL, NULL) == 0);
+    assert (zc.done == zc.next);
+
+    assert (hev_task_del_fd (task, udp_fds[1]) == 0);
+    close (udp_fds[1]);
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTask *task;
+    int i, port;
+
+    assert (hev_task_system_init () == 0);
+
+    for (i = 0; i < TCP_SIZE; i++)
+        tcp_buf[i] = i * 7;
+
+    tcp_fd = hev_task_io_socket_socket (AF_INET, SOCK_STREAM, 0);
+    assert (tcp_fd >= 0);
+    port = bind_loopback (tcp_fd);
+    assert (listen (tcp_fd, 5) == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_tcp_receiver_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_tcp_sender_entry, (void *)(intptr_t)port);
+
+    udp_fds[0] = hev_task_io_socket_socket (AF_INET, SOCK_DGRAM, 0);
+    udp_fds[1] = hev_task_io_socket_socket (AF_INET, SOCK_DGRAM, 0);
+    assert (udp_fds[0] >= 0 && udp_fds[1] >= 0);
+    port = bind_loopback (udp_fds[0]);
+    {
+        struct sockaddr_in addr;
+
+        memset (&addr, 0, sizeof (addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+        addr.sin_port = htons (port);
+        assert (connect (udp_fds[1], (struct sockaddr *)&addr,
+                         sizeof (addr)) == 0);
+    }
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_udp_receiver_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_udp_sender_entry, NULL);
+
+    hev_task_system_run ();
+
+    hev_task_system_fini ();
+
+    return 0;
+}
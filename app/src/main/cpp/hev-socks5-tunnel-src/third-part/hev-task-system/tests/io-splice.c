@@ -2,7 +2,7 @@
  ============================================================================
  Name        : io-splice.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2018 - 2025 everyone.
+ Copyright   : Copyright (c) 2018 - 2026 everyone.
  Description : IO Splice Test
  ============================================================================
  */
@@ -14,14 +14,27 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <hev-task.h>
 #include <hev-task-system.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
 
+#define BULK_SIZE (4 * 1024 * 1024)
+#define LIMITED_SIZE (1024 * 1024)
+#define LIMITED_CHUNK (65536)
+#define LIMITED_HOLD (10)
+
 static int fds1[2];
 static int fds2[2];
+static int fds3[2];
+static int fds4[2];
+static int fds5[2];
+static int fds6[2];
+
+static size_t limited_moved;
+static unsigned int limited_holds;
 
 static void
 task_splice_entry (void *data)
@@ -74,6 +87,210 @@ task_entry (void *data)
     close (fds2[1]);
 }
 
+static void
+task_bulk_splice_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+
+    assert (hev_task_add_fd (task, fds3[1], POLLIN | POLLOUT) == 0);
+    assert (hev_task_add_fd (task, fds4[0], POLLIN | POLLOUT) == 0);
+
+    hev_task_io_splice (fds3[1], fds3[1], fds4[0], fds4[0], 4096, NULL, NULL);
+
+    assert (hev_task_del_fd (task, fds3[1]) == 0);
+    assert (hev_task_del_fd (task, fds4[0]) == 0);
+
+    close (fds3[1]);
+    close (fds4[0]);
+}
+
+static long
+now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static ssize_t
+limiter (int dir, size_t moved, void *data)
+{
+    static long until;
+    long now;
+
+    if (dir)
+        return 4096;
+
+    /* Reads of a page, with a hold after every chunk. */
+    now = now_ms ();
+    limited_moved += moved;
+    if (limited_moved >= (limited_holds + 1) * LIMITED_CHUNK) {
+        limited_holds++;
+        until = now + LIMITED_HOLD;
+    }
+    if (now < until)
+        return now - until;
+
+    return 4096;
+}
+
+static void
+task_limited_splice_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+
+    assert (hev_task_add_fd (task, fds5[1], POLLIN | POLLOUT) == 0);
+    assert (hev_task_add_fd (task, fds6[0], POLLIN | POLLOUT) == 0);
+
+    hev_task_io_splice_limited (fds5[1], fds5[1], fds6[0], fds6[0], 4096,
+                                limiter, NULL, NULL, NULL);
+
+    assert (hev_task_del_fd (task, fds5[1]) == 0);
+    assert (hev_task_del_fd (task, fds6[0]) == 0);
+
+    close (fds5[1]);
+    close (fds6[0]);
+}
+
+static void
+task_bulk_writer_entry (void *data)
+{
+    static char buf[65536];
+    int fd = *(int *)data;
+    size_t size = (fd == fds3[0]) ? BULK_SIZE : LIMITED_SIZE;
+    size_t sent = 0;
+
+    assert (hev_task_add_fd (hev_task_self (), fd, POLLOUT) == 0);
+
+    while (sent < size) {
+        ssize_t res;
+        size_t i;
+
+        for (i = 0; i < sizeof (buf); i++)
+            buf[i] = (sent + i) * 7;
+
+        res = hev_task_io_socket_send (fd, buf, sizeof (buf), MSG_WAITALL,
+                                       NULL, NULL);
+        assert (res == sizeof (buf));
+        sent += res;
+    }
+
+    shutdown (fd, SHUT_WR);
+
+    assert (hev_task_del_fd (hev_task_self (), fd) == 0);
+}
+
+/*
+ * Megabytes through a splice that starts with a one page pipe, which has to
+ * grow and be given back between bursts on the way.
+ */
+static void
+task_bulk_entry (void *data)
+{
+    static char buf[65536];
+    HevTask *task;
+    size_t rcvd = 0;
+    int result;
+
+    result = hev_task_io_socket_socketpair (PF_LOCAL, SOCK_STREAM, 0, fds3);
+    assert (result == 0);
+    result = hev_task_io_socket_socketpair (PF_LOCAL, SOCK_STREAM, 0, fds4);
+    assert (result == 0);
+
+    assert (hev_task_add_fd (hev_task_self (), fds4[1], POLLIN) == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_bulk_splice_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_bulk_writer_entry, &fds3[0]);
+
+    for (;;) {
+        ssize_t size;
+        ssize_t i;
+
+        size = hev_task_io_socket_recv (fds4[1], buf, sizeof (buf), 0, NULL,
+                                        NULL);
+        assert (size >= 0);
+        if (size == 0)
+            break;
+
+        for (i = 0; i < size; i++)
+            assert (buf[i] == (char)((rcvd + i) * 7));
+        rcvd += size;
+    }
+
+    assert (rcvd == BULK_SIZE);
+
+    assert (hev_task_del_fd (hev_task_self (), fds4[1]) == 0);
+
+    close (fds3[0]);
+    close (fds4[1]);
+}
+
+/*
+ * The limited splice moves the same stream intact, and sleeps out every
+ * hold its limiter asks for.
+ */
+static void
+task_limited_entry (void *data)
+{
+    static char buf[65536];
+    HevTask *task;
+    size_t rcvd = 0;
+    long elapsed;
+    long start;
+    int result;
+
+    result = hev_task_io_socket_socketpair (PF_LOCAL, SOCK_STREAM, 0, fds5);
+    assert (result == 0);
+    result = hev_task_io_socket_socketpair (PF_LOCAL, SOCK_STREAM, 0, fds6);
+    assert (result == 0);
+
+    assert (hev_task_add_fd (hev_task_self (), fds6[1], POLLIN) == 0);
+
+    start = now_ms ();
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_limited_splice_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_bulk_writer_entry, &fds5[0]);
+
+    for (;;) {
+        ssize_t size;
+        ssize_t i;
+
+        size = hev_task_io_socket_recv (fds6[1], buf, sizeof (buf), 0, NULL,
+                                        NULL);
+        assert (size >= 0);
+        if (size == 0)
+            break;
+
+        for (i = 0; i < size; i++)
+            assert (buf[i] == (char)((rcvd + i) * 7));
+        rcvd += size;
+    }
+
+    elapsed = now_ms () - start;
+
+    assert (rcvd == LIMITED_SIZE);
+    assert (limited_moved == LIMITED_SIZE);
+    assert (limited_holds == LIMITED_SIZE / LIMITED_CHUNK);
+    assert (elapsed >= (LIMITED_SIZE / LIMITED_CHUNK - 1) * LIMITED_HOLD);
+
+    assert (hev_task_del_fd (hev_task_self (), fds6[1]) == 0);
+
+    close (fds5[0]);
+    close (fds6[1]);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -85,6 +302,14 @@ main (int argc, char *argv[])
     assert (task);
     hev_task_run (task, task_entry, NULL);
 
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_bulk_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_limited_entry, NULL);
+
     hev_task_system_run ();
 
     hev_task_system_fini ();
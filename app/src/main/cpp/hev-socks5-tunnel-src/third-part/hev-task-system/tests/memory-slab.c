@@ -0,0 +1,106 @@
+/*
+ ============================================================================
+ Name        : memory-slab.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Memory Slab Test
+ ============================================================================
+ */
+
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <hev-task-system.h>
+#include <hev-memory-allocator.h>
+
+#define COUNT (4096)
+
+static void *ptrs[COUNT];
+
+static void *
+thread_entry (void *data)
+{
+    HevMemoryAllocatorStats stats;
+    int i;
+
+    assert (hev_task_system_init () == 0);
+
+    /* Blocks of the main thread, queued back to their owner. */
+    for (i = 0; i < COUNT; i += 2)
+        hev_free (ptrs[i]);
+
+    hev_malloc_stats (&stats);
+#ifdef ENABLE_MEMALLOC_SLAB
+    assert (stats.remote_frees > 0);
+#endif
+
+    hev_task_system_fini ();
+
+    return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevMemoryAllocatorStats stats;
+    pthread_t thread;
+    int i;
+
+    assert (hev_task_system_init () == 0);
+
+    for (i = 0; i < COUNT; i++) {
+        size_t size = 1 + (i * 131) % 8192;
+
+        ptrs[i] = hev_malloc (size);
+        assert (ptrs[i] != NULL);
+        memset (ptrs[i], i, size);
+    }
+
+    for (i = 0; i < COUNT; i++) {
+        size_t size = 1 + (i * 131) % 8192;
+        unsigned char *p = ptrs[i];
+
+        assert (p[0] == (unsigned char)i);
+        assert (p[size - 1] == (unsigned char)i);
+    }
+
+    /* Grow across classes and into malloc, then shrink back. */
+    ptrs[1] = hev_realloc (ptrs[1], 100000);
+    assert (ptrs[1] != NULL);
+    assert (((unsigned char *)ptrs[1])[0] == 1);
+    ptrs[1] = hev_realloc (ptrs[1], 40);
+    assert (ptrs[1] != NULL);
+    assert (((unsigned char *)ptrs[1])[39] == 1);
+
+    assert (pthread_create (&thread, NULL, thread_entry, NULL) == 0);
+    assert (pthread_join (thread, NULL) == 0);
+
+    for (i = 1; i < COUNT; i += 2)
+        hev_free (ptrs[i]);
+
+    hev_malloc_stats (&stats);
+#ifdef ENABLE_MEMALLOC_SLAB
+    size_t slabs;
+
+    assert (stats.slabs > 0);
+    assert (stats.allocs > 0);
+    assert (stats.large_allocs > 0);
+    assert (stats.cached > 0);
+
+    /* Only the task system's own blocks keep slabs alive. */
+    slabs = stats.slabs;
+    hev_malloc_trim ();
+    hev_malloc_stats (&stats);
+    assert (stats.slabs < slabs);
+    assert (stats.cached == 0);
+#else
+    assert (stats.slabs == 0);
+    assert (stats.allocs == 0);
+#endif
+
+    hev_task_system_fini ();
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ ============================================================================
+ Name        : system-stats.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : System Stats Test
+ ============================================================================
+ */
+
+#include <stddef.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+
+#define YIELD_COUNT (1000)
+
+static int fds[2];
+
+static void
+task1_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+    char buf[4];
+    ssize_t size;
+
+    assert (hev_task_add_fd (task, fds[0], POLLIN) == 0);
+
+    size = hev_task_io_read (fds[0], buf, 4, NULL, NULL);
+    assert (size == 4);
+
+    assert (hev_task_del_fd (task, fds[0]) == 0);
+}
+
+static void
+task2_entry (void *data)
+{
+    char buf[4] = { 0 };
+    int i;
+
+    for (i = 0; i < YIELD_COUNT; i++)
+        hev_task_yield (HEV_TASK_YIELD);
+
+    assert (write (fds[1], buf, 4) == 4);
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTaskSystemStats stats;
+    HevTask *task;
+
+    assert (hev_task_system_init () == 0);
+
+    assert (hev_task_io_socket_socketpair (PF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task1_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task2_entry, NULL);
+
+    hev_task_system_run ();
+
+    hev_task_system_get_stats (&stats);
+    assert (stats.switches > YIELD_COUNT);
+    assert (stats.polls > 0);
+    assert (stats.polls < stats.switches);
+    assert (stats.poll_events > 0);
+    assert (stats.empty_polls < stats.polls);
+
+    close (fds[0]);
+    close (fds[1]);
+
+    hev_task_system_fini ();
+
+    return 0;
+}
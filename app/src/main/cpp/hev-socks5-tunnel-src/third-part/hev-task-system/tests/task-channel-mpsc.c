@@ -0,0 +1,235 @@
+/*
+ ============================================================================
+ Name        : task-channel-mpsc.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Channel MPSC Test
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+#include <hev-task-channel.h>
+#include <hev-task-channel-select.h>
+
+#define PRODUCERS (4)
+#define ITEMS (100000)
+#define BATCH (16)
+#define LOCAL_ITEMS (10)
+
+typedef struct _Record Record;
+
+struct _Record
+{
+    uint32_t value;
+    uint32_t pad[3];
+};
+
+static HevTaskChannel *mpsc;
+static HevTaskChannel *local;
+
+static void *
+producer_entry (void *data)
+{
+    uint64_t id = (uintptr_t)data;
+    uint64_t items[BATCH];
+    unsigned int seq = 0;
+
+    /* Plain thread, no task system. */
+    while (seq < ITEMS) {
+        unsigned int i, n = 0;
+        ssize_t res;
+
+        for (i = 0; (i < BATCH) && (seq + i < ITEMS); i++)
+            items[i] = (id << 32) | (seq + i);
+
+        while (n < i) {
+            res = hev_task_channel_write_batch (mpsc, &items[n],
+                                                sizeof (uint64_t), i - n);
+            assert (res >= 0);
+            if (res == 0)
+                sched_yield ();
+            n += res;
+        }
+        seq += i;
+    }
+
+    return NULL;
+}
+
+static void
+task_producer_entry (void *data)
+{
+    uint64_t id = PRODUCERS;
+    unsigned int seq;
+
+    for (seq = 0; seq < ITEMS; seq++) {
+        uint64_t item = (id << 32) | seq;
+
+        assert (hev_task_channel_write (mpsc, &item, sizeof (item)) ==
+                sizeof (item));
+    }
+}
+
+static void *
+task_producer_thread_entry (void *data)
+{
+    HevTask *task;
+
+    /* Producer task in another task system. */
+    assert (hev_task_system_init () == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_producer_entry, NULL);
+
+    hev_task_system_run ();
+    hev_task_system_fini ();
+
+    return NULL;
+}
+
+static void
+task_local_entry (void *data)
+{
+    HevTaskChannel *chan = data;
+    int i;
+
+    for (i = 0; i < LOCAL_ITEMS; i++)
+        assert (hev_task_channel_write (chan, &i, sizeof (i)) == sizeof (i));
+
+    hev_task_channel_destroy (chan);
+}
+
+static void
+task_oversize_entry (void *data)
+{
+    Record in[BATCH] = { 0 }, out[BATCH] = { 0 };
+    HevTaskChannel *chan;
+    ssize_t i, n;
+
+    /* Records larger than max_size: only the head of each one travels. */
+    assert (hev_task_channel_new_mpsc (&chan, sizeof (uint32_t), 64) == 0);
+
+    for (i = 0; i < BATCH; i++)
+        in[i].value = i + 1;
+    assert (hev_task_channel_write_batch (chan, in, sizeof (Record), BATCH) ==
+            BATCH);
+
+    n = hev_task_channel_read_batch (chan, out, sizeof (Record), BATCH);
+    assert (n == BATCH);
+    for (i = 0; i < n; i++) {
+        assert (out[i].value == i + 1);
+        assert (out[i].pad[0] == 0);
+    }
+
+    hev_task_channel_destroy (chan);
+}
+
+static void
+task_consumer_entry (void *data)
+{
+    unsigned int next[PRODUCERS + 1] = { 0 };
+    unsigned int total = 0, local_count = 0;
+    HevTaskChannelSelect *sel;
+    int local_open = 1;
+
+    sel = hev_task_channel_select_new ();
+    assert (sel);
+
+    hev_task_channel_select_add (sel, mpsc);
+    hev_task_channel_select_add (sel, local);
+
+    while (total < (PRODUCERS + 1) * ITEMS) {
+        HevTaskChannel *c;
+
+        c = hev_task_channel_select_read (sel, -1);
+        assert (c);
+
+        if (c == mpsc) {
+            uint64_t items[64];
+            ssize_t i, n;
+
+            n = hev_task_channel_read_batch (c, items, sizeof (uint64_t), 64);
+            assert (n > 0);
+
+            /* Each producer's records arrive in order. */
+            for (i = 0; i < n; i++) {
+                unsigned int id = items[i] >> 32;
+
+                assert (id <= PRODUCERS);
+                assert ((unsigned int)items[i] == next[id]);
+                next[id]++;
+            }
+            total += n;
+        } else {
+            int v;
+
+            if (hev_task_channel_read (c, &v, sizeof (v)) < 0) {
+                hev_task_channel_select_del (sel, c);
+                local_open = 0;
+                continue;
+            }
+            assert (v == local_count);
+            local_count++;
+        }
+    }
+
+    assert (local_count == LOCAL_ITEMS);
+    assert (hev_task_channel_select_read (sel, 10) == NULL);
+
+    if (local_open)
+        hev_task_channel_select_del (sel, local);
+    hev_task_channel_select_del (sel, mpsc);
+    hev_task_channel_select_destroy (sel);
+}
+
+int
+main (int argc, char *argv[])
+{
+    pthread_t threads[PRODUCERS + 1];
+    HevTaskChannel *chan;
+    HevTask *task;
+    uintptr_t i;
+
+    assert (hev_task_system_init () == 0);
+
+    assert (hev_task_channel_new_mpsc (&mpsc, sizeof (uint64_t), 256) == 0);
+    assert (hev_task_channel_new_with_buffers (&local, &chan, sizeof (int),
+                                               4) == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_oversize_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_consumer_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_local_entry, chan);
+
+    for (i = 0; i < PRODUCERS; i++)
+        assert (pthread_create (&threads[i], NULL, producer_entry,
+                                (void *)i) == 0);
+    assert (pthread_create (&threads[PRODUCERS], NULL,
+                            task_producer_thread_entry, NULL) == 0);
+
+    hev_task_system_run ();
+
+    for (i = 0; i <= PRODUCERS; i++)
+        assert (pthread_join (threads[i], NULL) == 0);
+
+    hev_task_channel_destroy (local);
+    hev_task_channel_destroy (mpsc);
+
+    hev_task_system_fini ();
+
+    return 0;
+}
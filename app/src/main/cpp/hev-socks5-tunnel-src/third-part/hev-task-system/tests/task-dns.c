@@ -33,6 +33,26 @@ getaddrinfo_entry (void *data)
     freeaddrinfo (result);
 }
 
+static int concurrent_count;
+
+static void
+concurrent_entry (void *data)
+{
+    struct addrinfo hints = { 0 };
+    struct addrinfo *result = NULL;
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+    assert (hev_task_dns_getaddrinfo ("127.0.0.1", "80", &hints, &result) ==
+            0);
+    assert (result != NULL);
+    freeaddrinfo (result);
+
+    concurrent_count++;
+}
+
 static void
 getnameinfo_entry (void *data)
 {
@@ -65,6 +85,7 @@ int
 main (int argc, char *argv[])
 {
     HevTask *task;
+    int i;
 
     assert (hev_task_system_init () == 0);
 
@@ -76,8 +97,17 @@ main (int argc, char *argv[])
     assert (task);
     hev_task_run (task, getnameinfo_entry, NULL);
 
+    /* Tasks waiting on one proxy all get their answers. */
+    for (i = 0; i < 64; i++) {
+        task = hev_task_new (-1);
+        assert (task);
+        hev_task_run (task, concurrent_entry, NULL);
+    }
+
     hev_task_system_run ();
 
+    assert (concurrent_count == 64);
+
     hev_task_system_fini ();
 
     return 0;
@@ -27,6 +27,8 @@ task1_entry (void *data)
 
     assert (hev_task_add_fd (task, fds[0], POLLOUT) == 0);
     assert (hev_task_mod_fd (task, fds[0], POLLIN) == 0);
+    /* Already registered so, the wakeup below must still come. */
+    assert (hev_task_mod_fd (task, fds[0], POLLIN) == 0);
 retry:
     if (read (fds[0], &val, sizeof (val)) == -1 && errno == EAGAIN) {
         hev_task_yield (HEV_TASK_WAITIO);
@@ -34,6 +36,7 @@ retry:
         goto retry;
     }
     assert (hev_task_del_fd (task, fds[0]) == 0);
+    assert (hev_task_mod_fd (task, fds[0], POLLIN) < 0);
 }
 
 static void
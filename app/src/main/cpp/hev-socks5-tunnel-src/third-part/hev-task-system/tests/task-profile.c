@@ -0,0 +1,106 @@
+/*
+ ============================================================================
+ Name        : task-profile.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description : Task Profile Test
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define YIELD_COUNT (4000)
+
+static void
+spin (long nsecs)
+{
+    struct timespec begin, now;
+
+    clock_gettime (CLOCK_MONOTONIC, &begin);
+    do {
+        clock_gettime (CLOCK_MONOTONIC, &now);
+    } while (((now.tv_sec - begin.tv_sec) * 1000000000L + now.tv_nsec -
+              begin.tv_nsec) < nsecs);
+}
+
+static void
+task_entry (void *data)
+{
+    long nsecs = (long)data;
+    HevTask *tasks[4];
+    HevTaskProfile profile;
+    int i, n;
+
+    for (i = 0; i < YIELD_COUNT; i++) {
+        spin (nsecs);
+        hev_task_yield (HEV_TASK_YIELD);
+    }
+
+    hev_task_get_profile (hev_task_self (), &profile);
+    assert (profile.switches == YIELD_COUNT);
+
+    if (nsecs < 20000)
+        return;
+
+#if CONFIG_SCHED_PROFILE_INTERVAL > 0
+    /*
+     * The heavy task spun 20 times longer than the light ones. With a
+     * scheduler clock the light ones may have finished already.
+     */
+    n = hev_task_system_get_busy_tasks (tasks, 4);
+    assert (n >= 1 && n <= 4);
+    assert (tasks[0] == hev_task_self ());
+    assert (1 == hev_task_system_get_busy_tasks (tasks, 1));
+    assert (tasks[0] == hev_task_self ());
+#else
+    n = hev_task_system_get_busy_tasks (tasks, 4);
+    assert (0 == n);
+#endif
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTaskProfile heavy, light, none;
+    HevTask *task;
+    int i;
+
+    assert (hev_task_system_init () == 0);
+
+    for (i = 0; i < 4; i++) {
+        task = hev_task_new (-1);
+        assert (task);
+        hev_task_set_class (task, (i == 0) ? 2 : 1);
+        assert (hev_task_get_class (task) == ((i == 0) ? 2 : 1));
+        hev_task_run (task, task_entry, (void *)(long)((i == 0) ? 20000 : 1000));
+    }
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_set_class (task, HEV_TASK_CLASS_MAX);
+    assert (hev_task_get_class (task) == 0);
+    hev_task_unref (task);
+
+    hev_task_system_run ();
+
+    hev_task_system_get_class_profile (2, &heavy);
+    hev_task_system_get_class_profile (1, &light);
+    hev_task_system_get_class_profile (3, &none);
+    assert (heavy.switches == YIELD_COUNT + 1);
+    assert (light.switches == 3 * (YIELD_COUNT + 1));
+    assert (none.switches == 0 && none.run_time == 0);
+#if CONFIG_SCHED_PROFILE_INTERVAL > 0
+    assert (heavy.run_time > 2 * light.run_time);
+    /* About 80 ms of spinning, a preempted sample only adds to it. */
+    assert (heavy.run_time > 40000000ULL);
+#endif
+
+    hev_task_system_fini ();
+
+    return 0;
+}
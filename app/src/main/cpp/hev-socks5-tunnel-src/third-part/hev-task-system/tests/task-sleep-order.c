@@ -0,0 +1,96 @@
+/*
+ ============================================================================
+ Name        : task-sleep-order.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Sleep Order Test
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define TASK_COUNT (64)
+
+static unsigned int last;
+static int woken;
+
+static void
+task_entry (void *data)
+{
+    unsigned int ms = (uintptr_t)data;
+    struct timespec sp1, sp2;
+    long diff;
+
+    clock_gettime (CLOCK_MONOTONIC, &sp1);
+    assert (hev_task_sleep (ms) == 0);
+    clock_gettime (CLOCK_MONOTONIC, &sp2);
+
+    diff = (sp2.tv_sec - sp1.tv_sec) * 1000;
+    diff += (sp2.tv_nsec - sp1.tv_nsec + 999999) / 1000000;
+    assert (diff >= ms);
+
+    /* all tasks start in the same millisecond tick, so wake in order */
+    assert (ms >= last);
+    last = ms;
+    woken++;
+}
+
+static void
+cancel_entry (void *data)
+{
+    HevTask *task = data;
+
+    hev_task_sleep (5);
+    hev_task_wakeup (task);
+}
+
+static void
+sleeper_entry (void *data)
+{
+    unsigned int remaining;
+
+    remaining = hev_task_sleep (5000);
+    assert (remaining > 0);
+    assert (remaining <= 5000);
+    woken++;
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTask *task, *sleeper;
+    int i;
+
+    assert (hev_task_system_init () == 0);
+
+    sleeper = hev_task_new (-1);
+    assert (sleeper);
+    hev_task_run (sleeper, sleeper_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, cancel_entry, sleeper);
+
+    /* spans several level 0 rounds and crosses into level 1 */
+    for (i = 0; i < TASK_COUNT; i++) {
+        uintptr_t ms = ((i * 37) % TASK_COUNT) * 5 + 1;
+
+        task = hev_task_new (-1);
+        assert (task);
+        hev_task_run (task, task_entry, (void *)ms);
+    }
+
+    hev_task_system_run ();
+
+    assert (woken == TASK_COUNT + 1);
+
+    hev_task_system_fini ();
+
+    return 0;
+}
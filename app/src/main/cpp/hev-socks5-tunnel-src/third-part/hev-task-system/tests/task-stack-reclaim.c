@@ -0,0 +1,90 @@
+/*
+ ============================================================================
+ Name        : task-stack-reclaim.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Stack Reclaim Test
+ ============================================================================
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define STACK_HEAP (0)
+#define STACK_MMAP (1)
+
+#define DEEP_SIZE (32 * 1024)
+
+static int done;
+
+static __attribute__ ((noinline)) unsigned int
+deep_call (unsigned char fill)
+{
+    unsigned char buf[DEEP_SIZE];
+    unsigned int sum = 0;
+    int i;
+
+    memset (buf, fill, sizeof (buf));
+    __asm__ volatile ("" : : "r"(buf) : "memory");
+
+    for (i = 0; i < sizeof (buf); i++)
+        sum += buf[i];
+
+    return sum;
+}
+
+static void
+task1_entry (void *data)
+{
+    HevTaskSystemStats stats;
+
+    assert (deep_call (1) == DEEP_SIZE);
+
+    /* Long wait with the deep pages idle below the sleeping frame. */
+    hev_task_sleep (CONFIG_STACK_RECLAIM_TIMEOUT + CONFIG_STACK_RECLAIM_TIMEOUT);
+
+    hev_task_system_get_stats (&stats);
+#if (CONFIG_STACK_BACKEND == STACK_MMAP) && (CONFIG_STACK_RECLAIM_TIMEOUT > 0)
+    assert (stats.stack_reclaims > 0);
+    /* Reclaimed pages still count towards the high-water mark. */
+    assert (hev_task_get_stack_usage (hev_task_self ()) >= DEEP_SIZE);
+#endif
+
+    /* Released pages fault back in on use. */
+    assert (deep_call (2) == DEEP_SIZE * 2);
+
+    done = 1;
+}
+
+static void
+task2_entry (void *data)
+{
+    /* Periodic wakeups, like protocol timers, drive the reclaim sweep. */
+    while (!done)
+        hev_task_sleep (100);
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTask *task;
+
+    assert (hev_task_system_init () == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task1_entry, NULL);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task2_entry, NULL);
+
+    hev_task_system_run ();
+
+    hev_task_system_fini ();
+
+    return 0;
+}
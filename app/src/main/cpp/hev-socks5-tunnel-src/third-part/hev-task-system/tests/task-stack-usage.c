@@ -0,0 +1,88 @@
+/*
+ ============================================================================
+ Name        : task-stack-usage.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Stack Usage Test
+ ============================================================================
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define STACK_HEAP (0)
+#define STACK_MMAP (1)
+
+#define STACK_SIZE (64 * 1024)
+#define DEEP_SIZE (32 * 1024)
+
+static __attribute__ ((noinline)) unsigned int
+deep_call (unsigned char fill)
+{
+    unsigned char buf[DEEP_SIZE];
+    unsigned int sum = 0;
+    int i;
+
+    memset (buf, fill, sizeof (buf));
+    __asm__ volatile ("" : : "r"(buf) : "memory");
+
+    for (i = 0; i < sizeof (buf); i++)
+        sum += buf[i];
+
+    return sum;
+}
+
+static void
+task_entry (void *data)
+{
+    HevTask *task = hev_task_self ();
+    int usage;
+
+    usage = hev_task_get_stack_usage (task);
+#if CONFIG_STACK_BACKEND == STACK_MMAP
+    assert (usage > 0);
+    assert (usage < DEEP_SIZE);
+#else
+    assert (usage == -1);
+#endif
+
+    assert (deep_call (1) == DEEP_SIZE);
+
+    /* The deep frame is gone, its mark on the stack stays. */
+    usage = hev_task_get_stack_usage (task);
+#if CONFIG_STACK_BACKEND == STACK_MMAP
+    assert (usage >= DEEP_SIZE);
+    assert (usage <= STACK_SIZE);
+#else
+    assert (usage == -1);
+#endif
+
+    *(int *)data = usage;
+}
+
+int
+main (int argc, char *argv[])
+{
+    HevTask *task;
+    int usage = 0;
+
+    assert (hev_task_system_init () == 0);
+
+    task = hev_task_new (STACK_SIZE);
+    assert (task);
+    hev_task_ref (task);
+    hev_task_run (task, task_entry, &usage);
+
+    hev_task_system_run ();
+
+    /* Still readable after the task returned. */
+    assert (hev_task_get_stack_usage (task) == usage);
+    hev_task_unref (task);
+
+    hev_task_system_fini ();
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ ============================================================================
+ Name        : task-stack.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Stack Test
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+static void
+task_entry (void *data)
+{
+    char probe;
+
+    *(uintptr_t *)data = (uintptr_t)&probe;
+}
+
+int
+main (int argc, char *argv[])
+{
+    uintptr_t probe1 = 0;
+    uintptr_t probe2 = 0;
+    HevTask *task;
+
+    hev_task_system_init ();
+
+    task = hev_task_new (16384);
+    assert (task);
+    hev_task_run (task, task_entry, &probe1);
+    hev_task_system_run ();
+
+    task = hev_task_new (16384);
+    assert (task);
+    hev_task_run (task, task_entry, &probe2);
+    hev_task_system_run ();
+
+    assert (probe1 && probe1 == probe2);
+
+    task = hev_task_new (32768);
+    assert (task);
+    hev_task_unref (task);
+
+    hev_task_system_fini ();
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ ============================================================================
+ Name        : task-timer-slack.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Timer Slack Test
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define TASK_COUNT (8)
+
+static long
+time_diff (struct timespec *sp1, struct timespec *sp2)
+{
+    time_t sec;
+    long nsec;
+
+    sec = sp2->tv_sec - sp1->tv_sec;
+    nsec = sp2->tv_nsec - sp1->tv_nsec;
+    if (nsec < 0) {
+        sec--;
+        nsec += 1000000000L;
+    }
+
+    return (sec * 1000) + ((nsec + 999999) / 1000000);
+}
+
+static void
+task_entry (void *data)
+{
+    unsigned int milliseconds = (unsigned long)data;
+    struct timespec sp1, sp2;
+
+    clock_gettime (CLOCK_MONOTONIC, &sp1);
+    assert (hev_task_sleep (milliseconds) == 0);
+    clock_gettime (CLOCK_MONOTONIC, &sp2);
+    assert (time_diff (&sp1, &sp2) >= milliseconds);
+}
+
+static unsigned long long
+run_sleepers (unsigned int slack)
+{
+    HevTaskSystemStats stats1, stats2;
+    int i;
+
+    hev_task_system_set_timer_slack (slack);
+
+    for (i = 0; i < TASK_COUNT; i++) {
+        HevTask *task = hev_task_new (-1);
+        unsigned long milliseconds = 200 + i * 5;
+
+        assert (task);
+        hev_task_run (task, task_entry, (void *)milliseconds);
+    }
+
+    hev_task_system_get_stats (&stats1);
+    hev_task_system_run ();
+    hev_task_system_get_stats (&stats2);
+
+    return stats2.wakeups - stats1.wakeups;
+}
+
+int
+main (int argc, char *argv[])
+{
+    unsigned long long precise, coalesced;
+
+    assert (hev_task_system_init () == 0);
+
+    precise = run_sleepers (0);
+    coalesced = run_sleepers (64);
+
+    /* 200 to 235 ms, rounded up to 16 ms slots, share wakeups. */
+    assert (coalesced > 0);
+    assert (coalesced < precise);
+
+    hev_task_system_fini ();
+
+    return 0;
+}
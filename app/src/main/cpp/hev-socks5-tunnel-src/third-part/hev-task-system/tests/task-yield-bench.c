@@ -0,0 +1,63 @@
+/*
+ ============================================================================
+ Name        : task-yield-bench.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 everyone.
+ Description : Task Yield Benchmark
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define TASK_COUNT (64)
+#define YIELD_COUNT (20000)
+
+static unsigned long count;
+
+static void
+task_entry (void *data)
+{
+    int i;
+
+    for (i = 0; i < YIELD_COUNT; i++) {
+        count++;
+        hev_task_yield (HEV_TASK_YIELD);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct timespec begin, end;
+    double secs;
+    int i;
+
+    assert (hev_task_system_init () == 0);
+
+    for (i = 0; i < TASK_COUNT; i++) {
+        HevTask *task;
+
+        task = hev_task_new (-1);
+        assert (task);
+        hev_task_run (task, task_entry, NULL);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &begin);
+    hev_task_system_run ();
+    clock_gettime (CLOCK_MONOTONIC, &end);
+
+    hev_task_system_fini ();
+
+    assert (count == (unsigned long)TASK_COUNT * YIELD_COUNT);
+
+    secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf ("%d tasks: %.0f yields/sec\n", TASK_COUNT, count / secs);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ ============================================================================
+ Name        : task-yield-pingpong.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2026 everyone.
+ Description : Task Yield Ping-Pong Benchmark
+ ============================================================================
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <hev-task.h>
+#include <hev-task-system.h>
+
+#define YIELD_COUNT (1000000)
+
+static int counts[2];
+
+static void
+task_entry (void *data)
+{
+    int self = (int)(intptr_t)data;
+    double sum = 0;
+    int i;
+
+    /* The order the two run in is up to the scheduler clock. */
+    for (i = 0; i < YIELD_COUNT; i++) {
+        counts[self]++;
+        hev_task_yield (HEV_TASK_YIELD);
+        /* Lives in a callee-saved register where the ABI has them. */
+        sum += self + 0.5;
+    }
+
+    assert (sum == (self + 0.5) * YIELD_COUNT);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct timespec begin, end;
+    HevTask *task;
+    double secs;
+
+    assert (hev_task_system_init () == 0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_entry, (void *)0);
+
+    task = hev_task_new (-1);
+    assert (task);
+    hev_task_run (task, task_entry, (void *)1);
+
+    clock_gettime (CLOCK_MONOTONIC, &begin);
+    hev_task_system_run ();
+    clock_gettime (CLOCK_MONOTONIC, &end);
+
+    hev_task_system_fini ();
+
+    assert (counts[0] == YIELD_COUNT);
+    assert (counts[1] == YIELD_COUNT);
+
+    secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf ("2 tasks: %.0f yields/sec\n", 2.0 * YIELD_COUNT / secs);
+
+    return 0;
+}
@@ -133,6 +133,9 @@ PACK_STRUCT_END
 #error "MEMP_NUM_REASSDATA > IP_REASS_MAX_PBUFS doesn't make sense since each struct ip_reassdata must hold 2 pbufs at least!"
 #endif
 #endif /* !MEMP_MEM_MALLOC */
+#if ((IP_REASSEMBLY || LWIP_IPV6_REASS) && ((IP_REASS_HASH_SIZE < 1) || (IP_REASS_HASH_SIZE & (IP_REASS_HASH_SIZE - 1))))
+#error "IP_REASS_HASH_SIZE must be a power of two"
+#endif
 #if LWIP_WND_SCALE
 #if (LWIP_TCP && (TCP_WND > 0xffffffff))
 #error "If you want to use TCP, TCP_WND must fit in an u32_t, so, you have to reduce it in your lwipopts.h"
@@ -61,7 +61,7 @@
 #include "lwip/ip.h"
 
 /** Global data for both IPv4 and IPv6 */
-struct ip_globals ip_data;
+LWIP_TLS struct ip_globals ip_data;
 
 #if LWIP_IPV4 && LWIP_IPV6
 
@@ -104,11 +104,11 @@
 #endif /* LWIP_DHCP */
 
 /** The IP header ID of the next outgoing IP packet */
-static u16_t ip_id;
+static LWIP_TLS u16_t ip_id;
 
 #if LWIP_MULTICAST_TX_OPTIONS
 /** The default netif used for multicast */
-static struct netif *ip4_default_multicast_netif;
+static LWIP_TLS struct netif *ip4_default_multicast_netif;
 
 /**
  * @ingroup ip4
@@ -105,19 +105,80 @@ PACK_STRUCT_END
 #  include "arch/epstruct.h"
 #endif
 
+/* RFC 791 keys datagrams on the protocol, too. */
 #define IP_ADDRESSES_AND_ID_MATCH(iphdrA, iphdrB)  \
   (ip4_addr_eq(&(iphdrA)->src, &(iphdrB)->src) && \
    ip4_addr_eq(&(iphdrA)->dest, &(iphdrB)->dest) && \
-   IPH_ID(iphdrA) == IPH_ID(iphdrB)) ? 1 : 0
+   IPH_ID(iphdrA) == IPH_ID(iphdrB) && \
+   IPH_PROTO(iphdrA) == IPH_PROTO(iphdrB)) ? 1 : 0
+
+/* Whether 'pbufs' more pbufs carrying 'bytes' payload may be enqueued. */
+#define IP_REASS_ROOM(pbufs, bytes) \
+  (((ip_reass_pbufcount + (pbufs)) <= IP_REASS_MAX_PBUFS) && \
+   (((u32_t)IP_REASS_MAX_BYTES == 0) || \
+    ((ip_reass_bytecount + (bytes)) <= (u32_t)IP_REASS_MAX_BYTES)))
 
 /* global variables */
-static struct ip_reassdata *reassdatagrams;
-static u16_t ip_reass_pbufcount;
+static LWIP_TLS struct ip_reassdata *reassdatagrams[IP_REASS_HASH_SIZE];
+static LWIP_TLS u16_t ip_reass_datagrams;
+static LWIP_TLS u16_t ip_reass_pbufcount;
+static LWIP_TLS u32_t ip_reass_bytecount;
+static LWIP_TLS u32_t ip_reass_dropcount;
 
 /* function prototypes */
 static void ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev);
 static int ip_reass_free_complete_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev);
 
+/**
+ * Check whether any datagram is waiting for reassembly, i.e. whether
+ * ip_reass_tmr() has anything to age.
+ */
+u8_t
+ip_reass_pending(void)
+{
+  return ip_reass_datagrams != 0;
+}
+
+/**
+ * Get the fragment payload bytes waiting for reassembly, to be held against
+ * IP_REASS_MAX_BYTES.
+ */
+u32_t
+ip_reass_bytes(void)
+{
+  return ip_reass_bytecount;
+}
+
+/**
+ * Get the number of fragments dropped so far: malformed or duplicate ones,
+ * those over the reassembly limits and those of datagrams that timed out or
+ * were freed to make room.
+ */
+u32_t
+ip_reass_drops(void)
+{
+  return ip_reass_dropcount;
+}
+
+/**
+ * Get the hash bucket of the datagram a fragment belongs to.
+ *
+ * @param iphdr IP header of the fragment
+ */
+static struct ip_reassdata **
+ip_reass_bucket(const struct ip_hdr *iphdr)
+{
+  u32_t h;
+
+  h = ip4_addr_get_u32(&iphdr->src) ^ ip4_addr_get_u32(&iphdr->dest);
+  h ^= ((u32_t)IPH_ID(iphdr) << 16) | IPH_PROTO(iphdr);
+  h ^= h >> 16;
+  h *= 0x45d9f3bU;
+  h ^= h >> 16;
+
+  return &reassdatagrams[h & (IP_REASS_HASH_SIZE - 1)];
+}
+
 /**
  * Reassembly timer base function
  * for both NO_SYS == 0 and 1 (!).
@@ -127,33 +188,37 @@ static int ip_reass_free_complete_datagram(struct ip_reassdata *ipr, struct ip_r
 void
 ip_reass_tmr(void)
 {
-  struct ip_reassdata *r, *prev = NULL;
-
-  r = reassdatagrams;
-  while (r != NULL) {
-    /* Decrement the timer. Once it reaches 0,
-     * clean up the incomplete fragment assembly */
-    if (r->timer > 0) {
-      r->timer--;
-      LWIP_DEBUGF(IP_REASS_DEBUG, ("ip_reass_tmr: timer dec %"U16_F"\n", (u16_t)r->timer));
-      prev = r;
-      r = r->next;
-    } else {
-      /* reassembly timed out */
-      struct ip_reassdata *tmp;
-      LWIP_DEBUGF(IP_REASS_DEBUG, ("ip_reass_tmr: timer timed out\n"));
-      tmp = r;
-      /* get the next pointer before freeing */
-      r = r->next;
-      /* free the helper struct and all enqueued pbufs */
-      ip_reass_free_complete_datagram(tmp, prev);
+  struct ip_reassdata *r, *prev;
+  int i;
+
+  for (i = 0; (i < IP_REASS_HASH_SIZE) && (ip_reass_datagrams != 0); i++) {
+    prev = NULL;
+    r = reassdatagrams[i];
+    while (r != NULL) {
+      /* Decrement the timer. Once it reaches 0,
+       * clean up the incomplete fragment assembly */
+      if (r->timer > 0) {
+        r->timer--;
+        LWIP_DEBUGF(IP_REASS_DEBUG, ("ip_reass_tmr: timer dec %"U16_F"\n", (u16_t)r->timer));
+        prev = r;
+        r = r->next;
+      } else {
+        /* reassembly timed out */
+        struct ip_reassdata *tmp;
+        LWIP_DEBUGF(IP_REASS_DEBUG, ("ip_reass_tmr: timer timed out\n"));
+        tmp = r;
+        /* get the next pointer before freeing */
+        r = r->next;
+        /* free the helper struct and all enqueued pbufs */
+        ip_reass_free_complete_datagram(tmp, prev);
+      }
     }
   }
 }
 
 /**
  * Free a datagram (struct ip_reassdata) and all its pbufs.
- * Updates the total count of enqueued pbufs (ip_reass_pbufcount),
+ * Updates the total count of enqueued pbufs (ip_reass_pbufcount) and bytes,
  * SNMP counters and sends an ICMP time exceeded packet.
  *
  * @param ipr datagram to free
@@ -184,6 +249,7 @@ ip_reass_free_complete_datagram(struct ip_reassdata *ipr, struct ip_reassdata *p
     /* Then, copy the original header into it. */
     SMEMCPY(p->payload, &ipr->iphdr, IP_HLEN);
     icmp_time_exceeded(p, ICMP_TE_FRAG);
+    ip_reass_dropcount++;
     clen = pbuf_clen(p);
     LWIP_ASSERT("pbufs_freed + clen <= 0xffff", pbufs_freed + clen <= 0xffff);
     pbufs_freed = (u16_t)(pbufs_freed + clen);
@@ -200,11 +266,14 @@ ip_reass_free_complete_datagram(struct ip_reassdata *ipr, struct ip_reassdata *p
     pcur = p;
     /* get the next pointer before freeing */
     p = iprh->next_pbuf;
+    ip_reass_dropcount++;
     clen = pbuf_clen(pcur);
     LWIP_ASSERT("pbufs_freed + clen <= 0xffff", pbufs_freed + clen <= 0xffff);
     pbufs_freed = (u16_t)(pbufs_freed + clen);
     pbuf_free(pcur);
   }
+  LWIP_ASSERT("ip_reass_bytecount >= ipr->bytes", ip_reass_bytecount >= ipr->bytes);
+  ip_reass_bytecount -= ipr->bytes;
   /* Then, unchain the struct ip_reassdata from the list and free it. */
   ip_reass_dequeue_datagram(ipr, prev);
   LWIP_ASSERT("ip_reass_pbufcount >= pbufs_freed", ip_reass_pbufcount >= pbufs_freed);
@@ -221,49 +290,43 @@ ip_reass_free_complete_datagram(struct ip_reassdata *ipr, struct ip_reassdata *p
  * @param fraghdr IP header of the current fragment
  * @param pbufs_needed number of pbufs needed to enqueue
  *        (used for freeing other datagrams if not enough space)
+ * @param bytes_needed payload bytes needed to enqueue
  * @return the number of pbufs freed
  */
 static int
-ip_reass_remove_oldest_datagram(struct ip_hdr *fraghdr, int pbufs_needed)
+ip_reass_remove_oldest_datagram(struct ip_hdr *fraghdr, int pbufs_needed, u32_t bytes_needed)
 {
-  /* @todo Can't we simply remove the last datagram in the
-   *       linked list behind reassdatagrams?
-   */
   struct ip_reassdata *r, *oldest, *prev, *oldest_prev;
   int pbufs_freed = 0, pbufs_freed_current;
   int other_datagrams;
+  int i;
 
-  /* Free datagrams until being allowed to enqueue 'pbufs_needed' pbufs,
-   * but don't free the datagram that 'fraghdr' belongs to! */
+  /* Free datagrams until being allowed to enqueue 'pbufs_needed' pbufs
+   * and 'bytes_needed' bytes, but don't free the datagram that 'fraghdr'
+   * belongs to! */
   do {
     oldest = NULL;
-    prev = NULL;
     oldest_prev = NULL;
     other_datagrams = 0;
-    r = reassdatagrams;
-    while (r != NULL) {
-      if (!IP_ADDRESSES_AND_ID_MATCH(&r->iphdr, fraghdr)) {
-        /* Not the same datagram as fraghdr */
-        other_datagrams++;
-        if (oldest == NULL) {
-          oldest = r;
-          oldest_prev = prev;
-        } else if (r->timer <= oldest->timer) {
-          /* older than the previous oldest */
-          oldest = r;
-          oldest_prev = prev;
+    for (i = 0; i < IP_REASS_HASH_SIZE; i++) {
+      prev = NULL;
+      for (r = reassdatagrams[i]; r != NULL; prev = r, r = r->next) {
+        if (!IP_ADDRESSES_AND_ID_MATCH(&r->iphdr, fraghdr)) {
+          /* Not the same datagram as fraghdr */
+          other_datagrams++;
+          if ((oldest == NULL) || (r->timer <= oldest->timer)) {
+            /* older than the previous oldest */
+            oldest = r;
+            oldest_prev = prev;
+          }
         }
       }
-      if (r->next != NULL) {
-        prev = r;
-      }
-      r = r->next;
     }
     if (oldest != NULL) {
       pbufs_freed_current = ip_reass_free_complete_datagram(oldest, oldest_prev);
       pbufs_freed += pbufs_freed_current;
     }
-  } while ((pbufs_freed < pbufs_needed) && (other_datagrams > 1));
+  } while (!IP_REASS_ROOM(pbufs_needed, bytes_needed) && (other_datagrams > 1));
   return pbufs_freed;
 }
 #endif /* IP_REASS_FREE_OLDEST */
@@ -277,6 +340,7 @@ ip_reass_remove_oldest_datagram(struct ip_hdr *fraghdr, int pbufs_needed)
 static struct ip_reassdata *
 ip_reass_enqueue_new_datagram(struct ip_hdr *fraghdr, int clen)
 {
+  struct ip_reassdata **bucket;
   struct ip_reassdata *ipr;
 #if ! IP_REASS_FREE_OLDEST
   LWIP_UNUSED_ARG(clen);
@@ -286,7 +350,7 @@ ip_reass_enqueue_new_datagram(struct ip_hdr *fraghdr, int clen)
   ipr = (struct ip_reassdata *)memp_malloc(MEMP_REASSDATA);
   if (ipr == NULL) {
 #if IP_REASS_FREE_OLDEST
-    if (ip_reass_remove_oldest_datagram(fraghdr, clen) >= clen) {
+    if (ip_reass_remove_oldest_datagram(fraghdr, clen, 0) >= clen) {
       ipr = (struct ip_reassdata *)memp_malloc(MEMP_REASSDATA);
     }
     if (ipr == NULL)
@@ -300,9 +364,11 @@ ip_reass_enqueue_new_datagram(struct ip_hdr *fraghdr, int clen)
   memset(ipr, 0, sizeof(struct ip_reassdata));
   ipr->timer = IP_REASS_MAXAGE;
 
-  /* enqueue the new structure to the front of the list */
-  ipr->next = reassdatagrams;
-  reassdatagrams = ipr;
+  /* enqueue the new structure to the front of its bucket */
+  bucket = ip_reass_bucket(fraghdr);
+  ipr->next = *bucket;
+  *bucket = ipr;
+  ip_reass_datagrams++;
   /* copy the ip header for later tests and input */
   /* @todo: no ip options supported? */
   SMEMCPY(&(ipr->iphdr), fraghdr, IP_HLEN);
@@ -316,15 +382,18 @@ ip_reass_enqueue_new_datagram(struct ip_hdr *fraghdr, int clen)
 static void
 ip_reass_dequeue_datagram(struct ip_reassdata *ipr, struct ip_reassdata *prev)
 {
+  struct ip_reassdata **bucket = ip_reass_bucket(&ipr->iphdr);
+
   /* dequeue the reass struct  */
-  if (reassdatagrams == ipr) {
+  if (*bucket == ipr) {
     /* it was the first in the list */
-    reassdatagrams = ipr->next;
+    *bucket = ipr->next;
   } else {
     /* it wasn't the first, so it must have a valid 'prev' */
     LWIP_ASSERT("sanity check linked list", prev != NULL);
     prev->next = ipr->next;
   }
+  ip_reass_datagrams--;
 
   /* now we can free the ip_reassdata struct */
   memp_free(MEMP_REASSDATA, ipr);
@@ -504,6 +573,7 @@ ip4_reass(struct pbuf *p)
 {
   struct pbuf *r;
   struct ip_hdr *fraghdr;
+  struct ip_reassdata **bucket;
   struct ip_reassdata *ipr;
   struct ip_reass_helper *iprh;
   u16_t offset, len, clen;
@@ -531,17 +601,25 @@ ip4_reass(struct pbuf *p)
   }
   len = (u16_t)(len - hlen);
 
+  /* A datagram growing past the limit is never going to be delivered. */
+  if (((u32_t)IP_REASS_MAX_DATAGRAM_BYTES != 0) &&
+      (((u32_t)offset + len) > (u32_t)IP_REASS_MAX_DATAGRAM_BYTES)) {
+    LWIP_DEBUGF(IP_REASS_DEBUG, ("ip4_reass: datagram too large\n"));
+    IPFRAG_STATS_INC(ip_frag.memerr);
+    goto nullreturn;
+  }
+
   /* Check if we are allowed to enqueue more datagrams. */
   clen = pbuf_clen(p);
-  if ((ip_reass_pbufcount + clen) > IP_REASS_MAX_PBUFS) {
+  if (!IP_REASS_ROOM(clen, len)) {
 #if IP_REASS_FREE_OLDEST
-    if (!ip_reass_remove_oldest_datagram(fraghdr, clen) ||
-        ((ip_reass_pbufcount + clen) > IP_REASS_MAX_PBUFS))
+    if (!ip_reass_remove_oldest_datagram(fraghdr, clen, len) ||
+        !IP_REASS_ROOM(clen, len))
 #endif /* IP_REASS_FREE_OLDEST */
     {
-      /* No datagram could be freed and still too many pbufs enqueued */
-      LWIP_DEBUGF(IP_REASS_DEBUG, ("ip4_reass: Overflow condition: pbufct=%d, clen=%d, MAX=%d\n",
-                                   ip_reass_pbufcount, clen, IP_REASS_MAX_PBUFS));
+      /* No datagram could be freed and still too many pbufs or bytes enqueued */
+      LWIP_DEBUGF(IP_REASS_DEBUG, ("ip4_reass: Overflow condition: pbufct=%d, clen=%d, MAX=%d, bytes=%"U32_F"\n",
+                                   ip_reass_pbufcount, clen, IP_REASS_MAX_PBUFS, ip_reass_bytecount));
       IPFRAG_STATS_INC(ip_frag.memerr);
       /* @todo: send ICMP time exceeded here? */
       /* drop this pbuf */
@@ -549,9 +627,9 @@ ip4_reass(struct pbuf *p)
     }
   }
 
-  /* Look for the datagram the fragment belongs to in the current datagram queue,
-   * remembering the previous in the queue for later dequeueing. */
-  for (ipr = reassdatagrams; ipr != NULL; ipr = ipr->next) {
+  /* Look for the datagram the fragment belongs to in its bucket. */
+  bucket = ip_reass_bucket(fraghdr);
+  for (ipr = *bucket; ipr != NULL; ipr = ipr->next) {
     /* Check if the incoming fragment matches the one currently present
        in the reassembly buffer. If so, we proceed with copying the
        fragment into the buffer. */
@@ -605,6 +683,8 @@ ip4_reass(struct pbuf *p)
      the number of fragments that may be enqueued at any one time
      (overflow checked by testing against IP_REASS_MAX_PBUFS) */
   ip_reass_pbufcount = (u16_t)(ip_reass_pbufcount + clen);
+  ipr->bytes += len;
+  ip_reass_bytecount += len;
   if (is_last) {
     u16_t datagram_len = (u16_t)(offset + len);
     ipr->datagram_len = datagram_len;
@@ -649,10 +729,10 @@ ip4_reass(struct pbuf *p)
     }
 
     /* find the previous entry in the linked list */
-    if (ipr == reassdatagrams) {
+    if (ipr == *bucket) {
       ipr_prev = NULL;
     } else {
-      for (ipr_prev = reassdatagrams; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
+      for (ipr_prev = *bucket; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
         if (ipr_prev->next == ipr) {
           break;
         }
@@ -660,6 +740,7 @@ ip4_reass(struct pbuf *p)
     }
 
     /* release the sources allocate for the fragment queue entry */
+    ip_reass_bytecount -= ipr->bytes;
     ip_reass_dequeue_datagram(ipr, ipr_prev);
 
     /* and adjust the number of pbufs currently queued for reassembly. */
@@ -680,13 +761,14 @@ nullreturn_ipr:
   LWIP_ASSERT("ipr != NULL", ipr != NULL);
   if (ipr->p == NULL) {
     /* dropped pbuf after creating a new datagram entry: remove the entry, too */
-    LWIP_ASSERT("not firstalthough just enqueued", ipr == reassdatagrams);
+    LWIP_ASSERT("not firstalthough just enqueued", ipr == *bucket);
     ip_reass_dequeue_datagram(ipr, NULL);
   }
 
 nullreturn:
   LWIP_DEBUGF(IP_REASS_DEBUG, ("ip4_reass: nullreturn\n"));
   IPFRAG_STATS_INC(ip_frag.drop);
+  ip_reass_dropcount++;
   pbuf_free(p);
   return NULL;
 }
@@ -464,14 +464,31 @@ ip6_forward(struct pbuf *p, struct ip6_hdr *iphdr, struct netif *inp)
 }
 #endif /* LWIP_IPV6_FORWARD */
 
+/** Return the upper layer protocol of the current input packet, looking past
+ * a Fragment Header: every fragment repeats the protocol in it. */
+static u8_t
+ip6_input_proto(const struct pbuf *p, const struct ip6_hdr *ip6hdr)
+{
+  const struct ip6_frag_hdr *frag_hdr;
+
+  if ((IP6H_NEXTH(ip6hdr) != IP6_NEXTH_FRAGMENT) ||
+      (p->len < (IP6_HLEN + IP6_FRAG_HLEN))) {
+    return IP6H_NEXTH(ip6hdr);
+  }
+
+  frag_hdr = (const struct ip6_frag_hdr *)((const u8_t *)ip6hdr + IP6_HLEN);
+  return frag_hdr->_nexth;
+}
+
 /** Return true if the current input packet should be accepted on this netif */
 static int
-ip6_input_accept(struct netif *netif, const struct ip6_hdr *ip6hdr)
+ip6_input_accept(struct netif *netif, const struct pbuf *p, const struct ip6_hdr *ip6hdr)
 {
   /* interface is up? */
   if (netif_is_up(netif)) {
     u8_t i;
-    if (netif_is_flag_set(netif, NETIF_FLAG_PRETEND) && ((IP6H_NEXTH(ip6hdr) == IP6_NEXTH_TCP) || (IP6H_NEXTH(ip6hdr) == IP6_NEXTH_UDP))) {
+    if (netif_is_flag_set(netif, NETIF_FLAG_PRETEND) &&
+        ((ip6_input_proto(p, ip6hdr) == IP6_NEXTH_TCP) || (ip6_input_proto(p, ip6hdr) == IP6_NEXTH_UDP))) {
       /* accept on this netif */
       return 1;
     }
@@ -630,7 +647,7 @@ ip6_input(struct pbuf *p, struct netif *inp)
   } else {
     /* start trying with inp. if that's not acceptable, start walking the
        list of configured netifs. */
-    if (ip6_input_accept(inp, ip6hdr)) {
+    if (ip6_input_accept(inp, p, ip6hdr)) {
       netif = inp;
     } else {
       netif = NULL;
@@ -661,7 +678,7 @@ ip6_input(struct pbuf *p, struct netif *inp)
           /* we checked that before already */
           continue;
         }
-        if (ip6_input_accept(netif, ip6hdr)) {
+        if (ip6_input_accept(netif, p, ip6hdr)) {
           break;
         }
       }
@@ -99,47 +99,116 @@ PACK_STRUCT_END
 #  include "arch/epstruct.h"
 #endif
 
+/* Whether 'pbufs' more pbufs carrying 'bytes' payload may be enqueued. */
+#define IP6_REASS_ROOM(pbufs, bytes) \
+  (((ip6_reass_pbufcount + (pbufs)) <= IP_REASS_MAX_PBUFS) && \
+   (((u32_t)IP_REASS_MAX_BYTES == 0) || \
+    ((ip6_reass_bytecount + (bytes)) <= (u32_t)IP_REASS_MAX_BYTES)))
+
+/* Folds what identifies a datagram into one word, for addresses both packed
+ * and not. */
+#define IP6_REASS_KEY(src, dest, id) \
+  ((src)->addr[0] ^ (src)->addr[1] ^ (src)->addr[2] ^ (src)->addr[3] ^ \
+   (dest)->addr[0] ^ (dest)->addr[1] ^ (dest)->addr[2] ^ (dest)->addr[3] ^ \
+   (id))
+
+#define IP6_REASS_BUCKET_OF(ipr) \
+  ip6_reass_bucket(IP6_REASS_KEY(&IPV6_FRAG_SRC(ipr), &IPV6_FRAG_DEST(ipr), \
+                                 (ipr)->identification))
+
 /* static variables */
-static struct ip6_reassdata *reassdatagrams;
-static u16_t ip6_reass_pbufcount;
+static LWIP_TLS struct ip6_reassdata *reassdatagrams[IP_REASS_HASH_SIZE];
+static LWIP_TLS u16_t ip6_reass_datagrams;
+static LWIP_TLS u16_t ip6_reass_pbufcount;
+static LWIP_TLS u32_t ip6_reass_bytecount;
+static LWIP_TLS u32_t ip6_reass_dropcount;
 
 /* Forward declarations. */
 static void ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr);
 #if IP_REASS_FREE_OLDEST
-static void ip6_reass_remove_oldest_datagram(struct ip6_reassdata *ipr, int pbufs_needed);
+static void ip6_reass_remove_oldest_datagram(struct ip6_reassdata *ipr, int pbufs_needed, u32_t bytes_needed);
 #endif /* IP_REASS_FREE_OLDEST */
 
+/**
+ * Check whether any datagram is waiting for reassembly, i.e. whether
+ * ip6_reass_tmr() has anything to age.
+ */
+u8_t
+ip6_reass_pending(void)
+{
+  return ip6_reass_datagrams != 0;
+}
+
+/**
+ * Get the fragment payload bytes waiting for reassembly, to be held against
+ * IP_REASS_MAX_BYTES.
+ */
+u32_t
+ip6_reass_bytes(void)
+{
+  return ip6_reass_bytecount;
+}
+
+/**
+ * Get the number of fragments dropped so far: malformed or duplicate ones,
+ * those over the reassembly limits and those of datagrams that timed out or
+ * were freed to make room.
+ */
+u32_t
+ip6_reass_drops(void)
+{
+  return ip6_reass_dropcount;
+}
+
+/**
+ * Get the hash bucket of a datagram.
+ *
+ * @param key IP6_REASS_KEY of the datagram
+ */
+static struct ip6_reassdata **
+ip6_reass_bucket(u32_t key)
+{
+  key ^= key >> 16;
+  key *= 0x45d9f3bU;
+  key ^= key >> 16;
+
+  return &reassdatagrams[key & (IP_REASS_HASH_SIZE - 1)];
+}
+
 void
 ip6_reass_tmr(void)
 {
   struct ip6_reassdata *r, *tmp;
+  int i;
 
 #if !IPV6_FRAG_COPYHEADER
   LWIP_ASSERT("sizeof(struct ip6_reass_helper) <= IP6_FRAG_HLEN, set IPV6_FRAG_COPYHEADER to 1",
     sizeof(struct ip6_reass_helper) <= IP6_FRAG_HLEN);
 #endif /* !IPV6_FRAG_COPYHEADER */
 
-  r = reassdatagrams;
-  while (r != NULL) {
-    /* Decrement the timer. Once it reaches 0,
-     * clean up the incomplete fragment assembly */
-    if (r->timer > 0) {
-      r->timer--;
-      r = r->next;
-    } else {
-      /* reassembly timed out */
-      tmp = r;
-      /* get the next pointer before freeing */
-      r = r->next;
-      /* free the helper struct and all enqueued pbufs */
-      ip6_reass_free_complete_datagram(tmp);
-     }
-   }
+  for (i = 0; (i < IP_REASS_HASH_SIZE) && (ip6_reass_datagrams != 0); i++) {
+    r = reassdatagrams[i];
+    while (r != NULL) {
+      /* Decrement the timer. Once it reaches 0,
+       * clean up the incomplete fragment assembly */
+      if (r->timer > 0) {
+        r->timer--;
+        r = r->next;
+      } else {
+        /* reassembly timed out */
+        tmp = r;
+        /* get the next pointer before freeing */
+        r = r->next;
+        /* free the helper struct and all enqueued pbufs */
+        ip6_reass_free_complete_datagram(tmp);
+      }
+    }
+  }
 }
 
 /**
  * Free a datagram (struct ip6_reassdata) and all its pbufs.
- * Updates the total count of enqueued pbufs (ip6_reass_pbufcount),
+ * Updates the total count of enqueued pbufs (ip6_reass_pbufcount) and bytes,
  * sends an ICMP time exceeded packet.
  *
  * @param ipr datagram to free
@@ -147,6 +216,7 @@ ip6_reass_tmr(void)
 static void
 ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr)
 {
+  struct ip6_reassdata **bucket = IP6_REASS_BUCKET_OF(ipr);
   struct ip6_reassdata *prev;
   u16_t pbufs_freed = 0;
   u16_t clen;
@@ -179,6 +249,7 @@ ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr)
       /* Send the actual ICMP response. */
       icmp6_time_exceeded_with_addrs(p, ICMP6_TE_FRAG, &src_addr, &dest_addr);
     }
+    ip6_reass_dropcount++;
     clen = pbuf_clen(p);
     LWIP_ASSERT("pbufs_freed + clen <= 0xffff", pbufs_freed + clen <= 0xffff);
     pbufs_freed = (u16_t)(pbufs_freed + clen);
@@ -195,17 +266,18 @@ ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr)
     pcur = p;
     /* get the next pointer before freeing */
     p = iprh->next_pbuf;
+    ip6_reass_dropcount++;
     clen = pbuf_clen(pcur);
     LWIP_ASSERT("pbufs_freed + clen <= 0xffff", pbufs_freed + clen <= 0xffff);
     pbufs_freed = (u16_t)(pbufs_freed + clen);
     pbuf_free(pcur);
   }
 
-  /* Then, unchain the struct ip6_reassdata from the list and free it. */
-  if (ipr == reassdatagrams) {
-    reassdatagrams = ipr->next;
+  /* Then, unchain the struct ip6_reassdata from its bucket and free it. */
+  if (ipr == *bucket) {
+    *bucket = ipr->next;
   } else {
-    prev = reassdatagrams;
+    prev = *bucket;
     while (prev != NULL) {
       if (prev->next == ipr) {
         break;
@@ -216,6 +288,9 @@ ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr)
       prev->next = ipr->next;
     }
   }
+  ip6_reass_datagrams--;
+  LWIP_ASSERT("ip6_reass_bytecount >= ipr->bytes", ip6_reass_bytecount >= ipr->bytes);
+  ip6_reass_bytecount -= ipr->bytes;
   memp_free(MEMP_IP6_REASSDATA, ipr);
 
   /* Finally, update number of pbufs in reassembly queue */
@@ -231,33 +306,32 @@ ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr)
  * @param ipr ip6_reassdata for the current fragment
  * @param pbufs_needed number of pbufs needed to enqueue
  *        (used for freeing other datagrams if not enough space)
+ * @param bytes_needed payload bytes needed to enqueue
  */
 static void
-ip6_reass_remove_oldest_datagram(struct ip6_reassdata *ipr, int pbufs_needed)
+ip6_reass_remove_oldest_datagram(struct ip6_reassdata *ipr, int pbufs_needed, u32_t bytes_needed)
 {
   struct ip6_reassdata *r, *oldest;
+  int i;
 
-  /* Free datagrams until being allowed to enqueue 'pbufs_needed' pbufs,
-   * but don't free the current datagram! */
+  /* Free datagrams until being allowed to enqueue 'pbufs_needed' pbufs
+   * and 'bytes_needed' bytes, but don't free the current datagram! */
   do {
-    r = oldest = reassdatagrams;
-    while (r != NULL) {
-      if (r != ipr) {
-        if (r->timer <= oldest->timer) {
+    oldest = NULL;
+    for (i = 0; i < IP_REASS_HASH_SIZE; i++) {
+      for (r = reassdatagrams[i]; r != NULL; r = r->next) {
+        if ((r != ipr) && ((oldest == NULL) || (r->timer <= oldest->timer))) {
           /* older than the previous oldest */
           oldest = r;
         }
       }
-      r = r->next;
     }
-    if (oldest == ipr) {
+    if (oldest == NULL) {
       /* nothing to free, ipr is the only element on the list */
       return;
     }
-    if (oldest != NULL) {
-      ip6_reass_free_complete_datagram(oldest);
-    }
-  } while (((ip6_reass_pbufcount + pbufs_needed) > IP_REASS_MAX_PBUFS) && (reassdatagrams != NULL));
+    ip6_reass_free_complete_datagram(oldest);
+  } while (!IP6_REASS_ROOM(pbufs_needed, bytes_needed) && (ip6_reass_datagrams != 0));
 }
 #endif /* IP_REASS_FREE_OLDEST */
 
@@ -271,6 +345,7 @@ ip6_reass_remove_oldest_datagram(struct ip6_reassdata *ipr, int pbufs_needed)
 struct pbuf *
 ip6_reass(struct pbuf *p)
 {
+  struct ip6_reassdata **bucket;
   struct ip6_reassdata *ipr, *ipr_prev;
   struct ip6_reass_helper *iprh, *iprh_tmp, *iprh_prev=NULL;
   struct ip6_frag_hdr *frag_hdr;
@@ -312,10 +387,18 @@ ip6_reass(struct pbuf *p)
     IP6_FRAG_STATS_INC(ip6_frag.proterr);
     goto nullreturn;
   }
+  /* A datagram growing past the limit is never going to be delivered. */
+  if (((u32_t)IP_REASS_MAX_DATAGRAM_BYTES != 0) &&
+      (((u32_t)start + len) > (u32_t)IP_REASS_MAX_DATAGRAM_BYTES)) {
+    IP6_FRAG_STATS_INC(ip6_frag.memerr);
+    goto nullreturn;
+  }
 
-  /* Look for the datagram the fragment belongs to in the current datagram queue,
-   * remembering the previous in the queue for later dequeueing. */
-  for (ipr = reassdatagrams, ipr_prev = NULL; ipr != NULL; ipr = ipr->next) {
+  /* Look for the datagram the fragment belongs to in its bucket,
+   * remembering the previous in the bucket for later dequeueing. */
+  bucket = ip6_reass_bucket(IP6_REASS_KEY(ip6_current_src_addr(), ip6_current_dest_addr(),
+                                          frag_hdr->_identification));
+  for (ipr = *bucket, ipr_prev = NULL; ipr != NULL; ipr = ipr->next) {
     /* Check if the incoming fragment matches the one currently present
        in the reassembly buffer. If so, we proceed with copying the
        fragment into the buffer. */
@@ -334,11 +417,11 @@ ip6_reass(struct pbuf *p)
     if (ipr == NULL) {
 #if IP_REASS_FREE_OLDEST
       /* Make room and try again. */
-      ip6_reass_remove_oldest_datagram(ipr, clen);
+      ip6_reass_remove_oldest_datagram(ipr, clen, 0);
       ipr = (struct ip6_reassdata *)memp_malloc(MEMP_IP6_REASSDATA);
       if (ipr != NULL) {
         /* re-search ipr_prev since it might have been removed */
-        for (ipr_prev = reassdatagrams; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
+        for (ipr_prev = *bucket; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
           if (ipr_prev->next == ipr) {
             break;
           }
@@ -354,9 +437,10 @@ ip6_reass(struct pbuf *p)
     memset(ipr, 0, sizeof(struct ip6_reassdata));
     ipr->timer = IPV6_REASS_MAXAGE;
 
-    /* enqueue the new structure to the front of the list */
-    ipr->next = reassdatagrams;
-    reassdatagrams = ipr;
+    /* enqueue the new structure to the front of its bucket */
+    ipr->next = *bucket;
+    *bucket = ipr;
+    ip6_reass_datagrams++;
 
     /* Use the current IPv6 header for src/dest address reference.
      * Eventually, we will replace it when we get the first fragment
@@ -385,12 +469,12 @@ ip6_reass(struct pbuf *p)
   }
 
   /* Check if we are allowed to enqueue more datagrams. */
-  if ((ip6_reass_pbufcount + clen) > IP_REASS_MAX_PBUFS) {
+  if (!IP6_REASS_ROOM(clen, len)) {
 #if IP_REASS_FREE_OLDEST
-    ip6_reass_remove_oldest_datagram(ipr, clen);
-    if ((ip6_reass_pbufcount + clen) <= IP_REASS_MAX_PBUFS) {
+    ip6_reass_remove_oldest_datagram(ipr, clen, len);
+    if (IP6_REASS_ROOM(clen, len)) {
       /* re-search ipr_prev since it might have been removed */
-      for (ipr_prev = reassdatagrams; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
+      for (ipr_prev = *bucket; ipr_prev != NULL; ipr_prev = ipr_prev->next) {
         if (ipr_prev->next == ipr) {
           break;
         }
@@ -399,6 +483,13 @@ ip6_reass(struct pbuf *p)
 #endif /* IP_REASS_FREE_OLDEST */
     {
       /* @todo: send ICMPv6 time exceeded here? */
+      if (ipr->p == NULL) {
+        /* the entry just made for this fragment would time out empty */
+        LWIP_ASSERT("sanity check linked list", *bucket == ipr);
+        *bucket = ipr->next;
+        ip6_reass_datagrams--;
+        memp_free(MEMP_IP6_REASSDATA, ipr);
+      }
       /* drop this pbuf */
       IP6_FRAG_STATS_INC(ip6_frag.memerr);
       goto nullreturn;
@@ -518,6 +609,8 @@ ip6_reass(struct pbuf *p)
   /* Track the current number of pbufs current 'in-flight', in order to limit
   the number of fragments that may be enqueued at any one time */
   ip6_reass_pbufcount = (u16_t)(ip6_reass_pbufcount + clen);
+  ipr->bytes += len;
+  ip6_reass_bytecount += len;
 
   /* Remember IPv6 header if this is the first fragment. */
   if (start == 0) {
@@ -648,14 +741,16 @@ ip6_reass(struct pbuf *p)
     }
 
     /* release the resources allocated for the fragment queue entry */
-    if (reassdatagrams == ipr) {
+    if (*bucket == ipr) {
       /* it was the first in the list */
-      reassdatagrams = ipr->next;
+      *bucket = ipr->next;
     } else {
       /* it wasn't the first, so it must have a valid 'prev' */
       LWIP_ASSERT("sanity check linked list", ipr_prev != NULL);
       ipr_prev->next = ipr->next;
     }
+    ip6_reass_datagrams--;
+    ip6_reass_bytecount -= ipr->bytes;
     memp_free(MEMP_IP6_REASSDATA, ipr);
 
     /* adjust the number of pbufs currently queued for reassembly. */
@@ -679,6 +774,7 @@ ip6_reass(struct pbuf *p)
 
 nullreturn:
   IP6_FRAG_STATS_INC(ip6_frag.drop);
+  ip6_reass_dropcount++;
   pbuf_free(p);
   return NULL;
 }
@@ -742,7 +838,7 @@ ip6_frag(struct pbuf *p, struct netif *netif, const ip6_addr_t *dest)
   u16_t newpbuflen = 0;
   u16_t left_to_copy;
 #endif
-  static u32_t identification;
+  static LWIP_TLS u32_t identification;
   u16_t left, cop;
   const u16_t mtu = nd6_get_destination_mtu(dest, netif);
   const u16_t nfb = (u16_t)((mtu - (IP6_HLEN + IP6_FRAG_HLEN)) & IP6_FRAG_OFFSET_MASK);
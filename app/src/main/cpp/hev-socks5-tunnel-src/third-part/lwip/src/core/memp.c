@@ -83,6 +83,12 @@ const struct memp_desc *const memp_pools[MEMP_MAX] = {
 #include "lwip/priv/memp_std.h"
 };
 
+#if MEMP_MEM_MALLOC
+/* Elements allocated per pool, and allocations refused by MEMP_LIMIT. */
+static LWIP_TLS u32_t memp_pools_used[MEMP_MAX];
+static LWIP_TLS u32_t memp_pools_refused;
+#endif /* MEMP_MEM_MALLOC */
+
 #ifdef LWIP_HOOK_FILENAME
 #include LWIP_HOOK_FILENAME
 #endif
@@ -340,18 +346,36 @@ memp_malloc_fn(memp_t type, const char *file, const int line)
 #endif
 {
   void *memp;
+#if MEMP_MEM_MALLOC
+  u32_t limit;
+#endif /* MEMP_MEM_MALLOC */
   LWIP_ERROR("memp_malloc: type < MEMP_MAX", (type < MEMP_MAX), return NULL;);
 
 #if MEMP_OVERFLOW_CHECK >= 2
   memp_overflow_check_all();
 #endif /* MEMP_OVERFLOW_CHECK >= 2 */
 
+#if MEMP_MEM_MALLOC
+  limit = (u32_t)MEMP_LIMIT(type);
+  if ((limit != 0) && (memp_pools_used[type] >= limit)) {
+    memp_pools_refused++;
+    LWIP_DEBUGF(MEMP_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("memp_malloc: pool %s is full\n", memp_pools[type]->desc));
+    return NULL;
+  }
+#endif /* MEMP_MEM_MALLOC */
+
 #if !MEMP_OVERFLOW_CHECK
   memp = do_memp_malloc_pool(memp_pools[type]);
 #else
   memp = do_memp_malloc_pool_fn(memp_pools[type], file, line);
 #endif
 
+#if MEMP_MEM_MALLOC
+  if (memp != NULL) {
+    memp_pools_used[type]++;
+  }
+#endif /* MEMP_MEM_MALLOC */
+
   return memp;
 }
 
@@ -438,6 +462,9 @@ memp_free(memp_t type, void *mem)
 #endif
 
   do_memp_free_pool(memp_pools[type], mem);
+#if MEMP_MEM_MALLOC
+  memp_pools_used[type]--;
+#endif /* MEMP_MEM_MALLOC */
 
 #ifdef LWIP_HOOK_MEMP_AVAILABLE
   if (old_first == NULL) {
@@ -445,3 +472,30 @@ memp_free(memp_t type, void *mem)
   }
 #endif
 }
+
+#if MEMP_MEM_MALLOC
+/**
+ * Get the number of elements of a pool allocated by the calling thread.
+ *
+ * @param type the pool to query
+ * @return elements allocated and not yet freed
+ */
+u32_t
+memp_used(memp_t type)
+{
+  LWIP_ERROR("memp_used: type < MEMP_MAX", (type < MEMP_MAX), return 0;);
+
+  return memp_pools_used[type];
+}
+
+/**
+ * Get the number of allocations refused because a pool reached MEMP_LIMIT.
+ *
+ * @return allocations refused so far by the calling thread
+ */
+u32_t
+memp_refused(void)
+{
+  return memp_pools_refused;
+}
+#endif /* MEMP_MEM_MALLOC */
@@ -156,10 +156,10 @@ static const char *const tcp_state_str[] = {
 };
 
 /* last local TCP port */
-static u16_t tcp_port = TCP_LOCAL_PORT_RANGE_START;
+static LWIP_TLS u16_t tcp_port = TCP_LOCAL_PORT_RANGE_START;
 
 /* Incremented every coarse grained timer shot (typically every 500 ms). */
-u32_t tcp_ticks;
+LWIP_TLS u32_t tcp_ticks;
 static const u8_t tcp_backoff[13] =
 { 1, 2, 3, 4, 5, 6, 7, 7, 7, 7, 7, 7, 7};
 /* Times per slowtmr hits */
@@ -168,25 +168,31 @@ static const u8_t tcp_persist_backoff[7] = { 3, 6, 12, 24, 48, 96, 120 };
 /* The TCP PCB lists. */
 
 /** List of all TCP PCBs bound but not yet (connected || listening) */
-struct tcp_pcb *tcp_bound_pcbs;
+LWIP_TLS struct tcp_pcb *tcp_bound_pcbs;
 /** List of all TCP PCBs in LISTEN state */
-union tcp_listen_pcbs_t tcp_listen_pcbs;
+LWIP_TLS union tcp_listen_pcbs_t tcp_listen_pcbs;
 /** List of all TCP PCBs that are in a state in which
  * they accept or send data. */
-struct tcp_pcb *tcp_active_pcbs;
+LWIP_TLS struct tcp_pcb *tcp_active_pcbs;
 /** List of all TCP PCBs in TIME-WAIT state */
-struct tcp_pcb *tcp_tw_pcbs;
+LWIP_TLS struct tcp_pcb *tcp_tw_pcbs;
 
-/** An array with all (non-temporary) PCB lists, mainly used for smaller code size */
-struct tcp_pcb **const tcp_pcb_lists[] = {&tcp_listen_pcbs.pcbs, &tcp_bound_pcbs,
-         &tcp_active_pcbs, &tcp_tw_pcbs
-};
+/** An array with all (non-temporary) PCB lists, mainly used for smaller code size.
+ * Filled in by tcp_init() since the lists may be thread-local (LWIP_TLS). */
+LWIP_TLS struct tcp_pcb **tcp_pcb_lists[NUM_TCP_PCB_LISTS];
+
+LWIP_TLS u8_t tcp_active_pcbs_changed;
+/** Set when a delayed ACK has been armed since the last tcp_ack_flush() */
+LWIP_TLS u8_t tcp_ack_delayed;
 
-u8_t tcp_active_pcbs_changed;
+#if TCP_PCB_HASH_BITS
+/** 4-tuple hash over tcp_active_pcbs and tcp_tw_pcbs */
+static LWIP_TLS struct tcp_pcb *tcp_pcb_hash[1 << TCP_PCB_HASH_BITS];
+#endif /* TCP_PCB_HASH_BITS */
 
 /** Timer counter to handle calling slow-timer from tcp_tmr() */
-static u8_t tcp_timer;
-static u8_t tcp_timer_ctr;
+static LWIP_TLS u8_t tcp_timer;
+static LWIP_TLS u8_t tcp_timer_ctr;
 static u16_t tcp_new_port(void);
 
 static err_t tcp_close_shutdown_fin(struct tcp_pcb *pcb);
@@ -200,16 +206,109 @@ static void tcp_ext_arg_invoke_callbacks_destroyed(struct tcp_pcb_ext_args *ext_
 void
 tcp_init(void)
 {
+  tcp_pcb_lists[0] = &tcp_listen_pcbs.pcbs;
+  tcp_pcb_lists[1] = &tcp_bound_pcbs;
+  tcp_pcb_lists[2] = &tcp_active_pcbs;
+  tcp_pcb_lists[3] = &tcp_tw_pcbs;
 #ifdef LWIP_RAND
   tcp_port = TCP_ENSURE_LOCAL_PORT_RANGE(LWIP_RAND());
 #endif /* LWIP_RAND */
 }
 
+#if TCP_PCB_HASH_BITS
+static u32_t
+tcp_pcb_hash_addr(const ip_addr_t *addr)
+{
+#if LWIP_IPV6
+  if (IP_IS_V6(addr)) {
+    const u32_t *a = ip_2_ip6(addr)->addr;
+    return a[0] ^ a[1] ^ a[2] ^ a[3];
+  }
+#endif /* LWIP_IPV6 */
+  return ip4_addr_get_u32(ip_2_ip4(addr));
+}
+
+static struct tcp_pcb **
+tcp_pcb_hash_bucket(const ip_addr_t *local_ip, u16_t local_port,
+                    const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  u32_t h;
+
+  h = tcp_pcb_hash_addr(local_ip) ^ (tcp_pcb_hash_addr(remote_ip) * 31);
+  h ^= ((u32_t)local_port << 16) | remote_port;
+  /* Fibonacci hashing, the top bits are the well mixed ones. */
+  h *= 0x9E3779B1UL;
+
+  return &tcp_pcb_hash[h >> (32 - TCP_PCB_HASH_BITS)];
+}
+
+/** Link a pcb that just entered tcp_active_pcbs or tcp_tw_pcbs */
+void
+tcp_pcb_hash_add(struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **bucket;
+
+  bucket = tcp_pcb_hash_bucket(&pcb->local_ip, pcb->local_port,
+                               &pcb->remote_ip, pcb->remote_port);
+  pcb->hash_next = *bucket;
+  if (pcb->hash_next != NULL) {
+    pcb->hash_next->hash_pprev = &pcb->hash_next;
+  }
+  pcb->hash_pprev = bucket;
+  *bucket = pcb;
+}
+
+/** Unlink a pcb, does nothing if it is not linked */
+void
+tcp_pcb_hash_del(struct tcp_pcb *pcb)
+{
+  if (pcb->hash_pprev == NULL) {
+    return;
+  }
+  *pcb->hash_pprev = pcb->hash_next;
+  if (pcb->hash_next != NULL) {
+    pcb->hash_next->hash_pprev = pcb->hash_pprev;
+  }
+  pcb->hash_next = NULL;
+  pcb->hash_pprev = NULL;
+}
+
+/** Find the active or TIME-WAIT pcb of a 4-tuple, as tcp_input() sees it */
+struct tcp_pcb *
+tcp_pcb_hash_find(const ip_addr_t *local_ip, u16_t local_port,
+                  const ip_addr_t *remote_ip, u16_t remote_port,
+                  u8_t netif_idx)
+{
+  struct tcp_pcb *pcb;
+
+  pcb = *tcp_pcb_hash_bucket(local_ip, local_port, remote_ip, remote_port);
+  for (; pcb != NULL; pcb = pcb->hash_next) {
+    /* check if PCB is bound to specific netif */
+    if ((pcb->netif_idx != NETIF_NO_INDEX) &&
+        (pcb->netif_idx != netif_idx)) {
+      continue;
+    }
+
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_eq(&pcb->remote_ip, remote_ip) &&
+        ip_addr_eq(&pcb->local_ip, local_ip)) {
+      return pcb;
+    }
+  }
+
+  return NULL;
+}
+#endif /* TCP_PCB_HASH_BITS */
+
 /** Free a tcp pcb */
 void
 tcp_free(struct tcp_pcb *pcb)
 {
   LWIP_ASSERT("tcp_free: LISTEN", pcb->state != LISTEN);
+#if TCP_PCB_HASH_BITS
+  LWIP_ASSERT("tcp_free: still hashed", pcb->hash_pprev == NULL);
+#endif /* TCP_PCB_HASH_BITS */
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
   tcp_ext_arg_invoke_callbacks_destroyed(pcb->ext_args);
 #endif
@@ -1218,6 +1317,7 @@ tcp_slowtmr(void)
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
+  u32_t tw_ticks;      /* TIME-WAIT lifetime in slow timer ticks */
 
   err = ERR_OK;
 
@@ -1406,6 +1506,7 @@ tcp_slowtmr_start:
       void *err_arg;
       enum tcp_state last_state;
       tcp_pcb_purge(pcb);
+      tcp_pcb_hash_del(pcb);
       /* Remove PCB from tcp_active_pcbs list. */
       if (prev != NULL) {
         LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_active_pcbs", pcb != tcp_active_pcbs);
@@ -1457,6 +1558,7 @@ tcp_slowtmr_start:
 
 
   /* Steps through all of the TIME-WAIT PCBs. */
+  tw_ticks = (u32_t)(TCP_TIME_WAIT_TIMEOUT) / TCP_SLOW_INTERVAL;
   prev = NULL;
   pcb = tcp_tw_pcbs;
   while (pcb != NULL) {
@@ -1464,7 +1566,7 @@ tcp_slowtmr_start:
     pcb_remove = 0;
 
     /* Check if this PCB has stayed long enough in TIME-WAIT */
-    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+    if ((tw_ticks == 0) || ((u32_t)(tcp_ticks - pcb->tmr) > tw_ticks)) {
       ++pcb_remove;
     }
 
@@ -1472,6 +1574,7 @@ tcp_slowtmr_start:
     if (pcb_remove) {
       struct tcp_pcb *pcb2;
       tcp_pcb_purge(pcb);
+      tcp_pcb_hash_del(pcb);
       /* Remove PCB from tcp_tw_pcbs list. */
       if (prev != NULL) {
         LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
@@ -1491,6 +1594,31 @@ tcp_slowtmr_start:
   }
 }
 
+/**
+ * Sends the ACKs delayed on active pcbs, as the next tcp_fasttmr() would.
+ * With TCP_ACK_SEGS above 2 a caller that reads input in batches calls this
+ * after each one, so an ACK waits for the batch rather than the timer.
+ */
+void
+tcp_ack_flush(void)
+{
+  struct tcp_pcb *pcb, *next;
+
+  if (!tcp_ack_delayed) {
+    return;
+  }
+  tcp_ack_delayed = 0;
+
+  for (pcb = tcp_active_pcbs; pcb != NULL; pcb = next) {
+    next = pcb->next;
+    if (pcb->flags & TF_ACK_DELAY) {
+      tcp_ack_now(pcb);
+      tcp_output(pcb);
+      tcp_clear_flags(pcb, TF_ACK_DELAY | TF_ACK_NOW);
+    }
+  }
+}
+
 /**
  * Is called every TCP_FAST_INTERVAL (250 ms) and process data previously
  * "refused" by upper layer (application) and sends delayed ACKs or pending FINs.
@@ -1824,6 +1952,34 @@ tcp_kill_timewait(void)
   }
 }
 
+#if MEMP_MEM_MALLOC
+/**
+ * Recycles the oldest TIME_WAIT pcb while the pcb pool is nearly full, so
+ * that allocations keep succeeding instead of failing first. The pool is
+ * capped by MEMP_LIMIT, or nominally MEMP_NUM_TCP_PCB when uncapped.
+ */
+static void
+tcp_relieve_timewait(void)
+{
+  u32_t limit;
+
+  if (tcp_tw_pcbs == NULL) {
+    return;
+  }
+
+  limit = (u32_t)MEMP_LIMIT(MEMP_TCP_PCB);
+  if (limit == 0) {
+    limit = MEMP_NUM_TCP_PCB;
+  }
+  if (memp_used(MEMP_TCP_PCB) >= limit - limit / 8) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_relieve_timewait: pcb pool under pressure\n"));
+    tcp_kill_timewait();
+  }
+}
+#else /* MEMP_MEM_MALLOC */
+#define tcp_relieve_timewait()
+#endif /* MEMP_MEM_MALLOC */
+
 /* Called when allocating a pcb fails.
  * In this case, we want to handle all pcbs that want to close first: if we can
  * now send the FIN (which failed before), the pcb might be in a state that is
@@ -1859,6 +2015,8 @@ tcp_alloc(u8_t prio)
 
   LWIP_ASSERT_CORE_LOCKED();
 
+  tcp_relieve_timewait();
+
   pcb = (struct tcp_pcb *)memp_malloc(MEMP_TCP_PCB);
   if (pcb == NULL) {
     /* Try to send FIN for all pcbs stuck in TF_CLOSEPEND first */
@@ -1911,7 +2069,7 @@ tcp_alloc(u8_t prio)
     /* zero out the whole pcb, so there is no need to initialize members to zero */
     memset(pcb, 0, sizeof(struct tcp_pcb));
     pcb->prio = prio;
-    pcb->snd_buf = TCP_SND_BUF;
+    pcb->snd_buf = TCP_SND_BUF_INIT;
     /* Start with a window that does not need scaling. When window scaling is
        enabled and used, the window is enlarged when both sides agree on scaling. */
     pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND_MIN16(TCP_WND);
@@ -1934,7 +2092,7 @@ tcp_alloc(u8_t prio)
     initial advertised window is very small and then grows rapidly once the
     connection is established. To avoid these complications, we set ssthresh to the
     largest effective cwnd (amount of in-flight data) that the sender can have. */
-    pcb->ssthresh = TCP_SND_BUF;
+    pcb->ssthresh = TCP_SND_BUF_INIT;
 
 #if LWIP_CALLBACK_API
     pcb->recv = tcp_recv_null;
@@ -2208,6 +2366,9 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
   LWIP_ASSERT("tcp_pcb_remove: invalid pcblist", pcblist != NULL);
 
   TCP_RMV(pcblist, pcb);
+  if ((pcblist == &tcp_active_pcbs) || (pcblist == &tcp_tw_pcbs)) {
+    tcp_pcb_hash_del(pcb);
+  }
 
   tcp_pcb_purge(pcb);
 
@@ -2246,7 +2407,7 @@ tcp_next_iss(struct tcp_pcb *pcb)
   LWIP_ASSERT("tcp_next_iss: invalid pcb", pcb != NULL);
   return LWIP_HOOK_TCP_ISN(&pcb->local_ip, pcb->local_port, &pcb->remote_ip, pcb->remote_port);
 #else /* LWIP_HOOK_TCP_ISN */
-  static u32_t iss = 6510;
+  static LWIP_TLS u32_t iss = 6510;
 
   LWIP_ASSERT("tcp_next_iss: invalid pcb", pcb != NULL);
   LWIP_UNUSED_ARG(pcb);
@@ -71,21 +71,21 @@
 /* These variables are global to all functions involved in the input
    processing of TCP segments. They are set by the tcp_input()
    function. */
-static struct tcp_seg inseg;
-static struct tcp_hdr *tcphdr;
-static u16_t tcphdr_optlen;
-static u16_t tcphdr_opt1len;
-static u8_t *tcphdr_opt2;
-static u16_t tcp_optidx;
-static u32_t seqno, ackno;
-static tcpwnd_size_t recv_acked;
-static u16_t tcplen;
-static u8_t flags;
-
-static u8_t recv_flags;
-static struct pbuf *recv_data;
-
-struct tcp_pcb *tcp_input_pcb;
+static LWIP_TLS struct tcp_seg inseg;
+static LWIP_TLS struct tcp_hdr *tcphdr;
+static LWIP_TLS u16_t tcphdr_optlen;
+static LWIP_TLS u16_t tcphdr_opt1len;
+static LWIP_TLS u8_t *tcphdr_opt2;
+static LWIP_TLS u16_t tcp_optidx;
+static LWIP_TLS u32_t seqno, ackno;
+static LWIP_TLS tcpwnd_size_t recv_acked;
+static LWIP_TLS u16_t tcplen;
+static LWIP_TLS u8_t flags;
+
+static LWIP_TLS u8_t recv_flags;
+static LWIP_TLS struct pbuf *recv_data;
+
+LWIP_TLS struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
 static err_t tcp_process(struct tcp_pcb *pcb);
@@ -247,6 +247,26 @@ tcp_input(struct pbuf *p, struct netif *inp)
      for an active connection. */
   prev = NULL;
 
+#if TCP_PCB_HASH_BITS
+  /* One hash lookup covers both the active and the TIME-WAIT pcbs. */
+  pcb = tcp_pcb_hash_find(ip_current_dest_addr(), tcphdr->dest,
+                          ip_current_src_addr(), tcphdr->src,
+                          netif_get_index(ip_data.current_input_netif));
+  if ((pcb != NULL) && (pcb->state == TIME_WAIT)) {
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for TIME_WAITing connection.\n"));
+#ifdef LWIP_HOOK_TCP_INPACKET_PCB
+    if (LWIP_HOOK_TCP_INPACKET_PCB(pcb, tcphdr, tcphdr_optlen, tcphdr_opt1len,
+                                   tcphdr_opt2, p) == ERR_OK)
+#endif
+    {
+      tcp_timewait_input(pcb);
+    }
+    pbuf_free(p);
+    return;
+  }
+
+  if (pcb == NULL) {
+#else /* TCP_PCB_HASH_BITS */
   for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
     LWIP_ASSERT("tcp_input: active pcb->state != CLOSED", pcb->state != CLOSED);
     LWIP_ASSERT("tcp_input: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
@@ -311,6 +331,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
         return;
       }
     }
+#endif /* TCP_PCB_HASH_BITS */
 
     /* Finally, if we still did not get a match, we check all PCBs that
        are LISTENing for incoming connections. */
@@ -1015,7 +1036,7 @@ tcp_process(struct tcp_pcb *pcb)
           tcp_pcb_purge(pcb);
           TCP_RMV_ACTIVE(pcb);
           pcb->state = TIME_WAIT;
-          TCP_REG(&tcp_tw_pcbs, pcb);
+          TCP_REG_TW(pcb);
         } else {
           tcp_ack_now(pcb);
           pcb->state = CLOSING;
@@ -1033,7 +1054,7 @@ tcp_process(struct tcp_pcb *pcb)
         tcp_pcb_purge(pcb);
         TCP_RMV_ACTIVE(pcb);
         pcb->state = TIME_WAIT;
-        TCP_REG(&tcp_tw_pcbs, pcb);
+        TCP_REG_TW(pcb);
       }
       break;
     case CLOSING:
@@ -1043,7 +1064,7 @@ tcp_process(struct tcp_pcb *pcb)
         tcp_pcb_purge(pcb);
         TCP_RMV_ACTIVE(pcb);
         pcb->state = TIME_WAIT;
-        TCP_REG(&tcp_tw_pcbs, pcb);
+        TCP_REG_TW(pcb);
       }
       break;
     case LAST_ACK:
@@ -1469,6 +1490,8 @@ tcp_receive(struct tcp_pcb *pcb)
     if (TCP_SEQ_BETWEEN(seqno, pcb->rcv_nxt,
                         pcb->rcv_nxt + pcb->rcv_wnd - 1)) {
       if (pcb->rcv_nxt == seqno) {
+        u16_t ack_segs;
+
         /* The incoming segment is the next in sequence. We check if
            we have to trim the end of the segment and update rcv_nxt
            and pass the data to the application. */
@@ -1578,6 +1601,9 @@ tcp_receive(struct tcp_pcb *pcb)
           recv_flags |= TF_GOT_FIN;
         }
 
+        /* A segment coalesced before input counts for the MSS it spans. */
+        ack_segs = (pcb->mss && tcplen > pcb->mss) ? tcplen / pcb->mss : 1;
+
 #if TCP_QUEUE_OOSEQ
         /* We now check if we have segments on the ->ooseq queue that
            are now in sequence. */
@@ -1585,6 +1611,9 @@ tcp_receive(struct tcp_pcb *pcb)
                pcb->ooseq->tcphdr->seqno == pcb->rcv_nxt) {
 
           struct tcp_seg *cseg = pcb->ooseq;
+
+          /* A filled hole is acknowledged at once (RFC 5681 4.2). */
+          ack_segs = (u16_t)TCP_ACK_SEGS;
           seqno = pcb->ooseq->tcphdr->seqno;
 
           pcb->rcv_nxt += TCP_TCPLEN(cseg);
@@ -1634,7 +1663,7 @@ tcp_receive(struct tcp_pcb *pcb)
 
 
         /* Acknowledge the segment(s). */
-        tcp_ack(pcb);
+        tcp_ack_segs(pcb, ack_segs);
 
 #if LWIP_TCP_SACK_OUT
         if (LWIP_TCP_SACK_VALID(pcb, 0)) {
@@ -1961,8 +1990,8 @@ tcp_parseopt(struct tcp_pcb *pcb)
           /* An MSS option with the right option length. */
           mss = (u16_t)(tcp_get_next_optbyte() << 8);
           mss |= tcp_get_next_optbyte();
-          /* Limit the mss to the configured TCP_MSS and prevent division by zero */
-          pcb->mss = ((mss > TCP_MSS) || (mss == 0)) ? TCP_MSS : mss;
+          /* Limit the mss to the configured TCP_MSS_LIMIT and prevent division by zero */
+          pcb->mss = ((mss > TCP_MSS_LIMIT(pcb)) || (mss == 0)) ? TCP_MSS_LIMIT(pcb) : mss;
           break;
 #if LWIP_WND_SCALE
         case LWIP_TCP_OPT_WS:
@@ -1501,9 +1501,9 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
   if (seg->flags & TF_SEG_OPTS_MSS) {
     u16_t mss;
 #if TCP_CALCULATE_EFF_SEND_MSS
-    mss = tcp_eff_send_mss_netif(TCP_MSS, netif, &pcb->remote_ip);
+    mss = tcp_eff_send_mss_netif(TCP_MSS_LIMIT(pcb), netif, &pcb->remote_ip);
 #else /* TCP_CALCULATE_EFF_SEND_MSS */
-    mss = TCP_MSS;
+    mss = TCP_MSS_LIMIT(pcb);
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
     *opts = TCP_BUILD_MSS_OPTION(mss);
     opts += 1;
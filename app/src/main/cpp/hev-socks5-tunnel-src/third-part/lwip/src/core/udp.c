@@ -74,11 +74,17 @@
 #endif
 
 /* last local UDP port */
-static u16_t udp_port = UDP_LOCAL_PORT_RANGE_START;
+static LWIP_TLS u16_t udp_port = UDP_LOCAL_PORT_RANGE_START;
 
 /* The list of UDP PCBs */
 /* exported in udp.h (was static) */
-struct udp_pcb *udp_pcbs;
+LWIP_TLS struct udp_pcb *udp_pcbs;
+
+#if UDP_PCB_HASH_BITS
+/* Hash of the connected pcbs in udp_pcbs. Pretend pcbs are keyed on their
+   remote end alone, since that is all udp_input() matches them on. */
+static LWIP_TLS struct udp_pcb *udp_pcb_hash[1 << UDP_PCB_HASH_BITS];
+#endif /* UDP_PCB_HASH_BITS */
 
 /**
  * Initialize this module.
@@ -118,6 +124,106 @@ again:
   return udp_port;
 }
 
+#if UDP_PCB_HASH_BITS
+static struct udp_pcb **
+udp_pcb_hash_bucket(const ip_addr_t *remote_ip, u16_t remote_port,
+                    u16_t local_port)
+{
+  u32_t h;
+
+#if LWIP_IPV6
+  if (IP_IS_V6(remote_ip)) {
+    const u32_t *a = ip_2_ip6(remote_ip)->addr;
+    h = a[0] ^ a[1] ^ a[2] ^ a[3];
+  } else
+#endif /* LWIP_IPV6 */
+  {
+    h = ip4_addr_get_u32(ip_2_ip4(remote_ip));
+  }
+  h ^= ((u32_t)local_port << 16) | remote_port;
+  /* Fibonacci hashing, the top bits are the well mixed ones. */
+  h *= 0x9E3779B1UL;
+
+  return &udp_pcb_hash[h >> (32 - UDP_PCB_HASH_BITS)];
+}
+
+static void
+udp_pcb_hash_del(struct udp_pcb *pcb)
+{
+  if (pcb->hash_pprev == NULL) {
+    return;
+  }
+  *pcb->hash_pprev = pcb->hash_next;
+  if (pcb->hash_next != NULL) {
+    pcb->hash_next->hash_pprev = pcb->hash_pprev;
+  }
+  pcb->hash_next = NULL;
+  pcb->hash_pprev = NULL;
+}
+
+/** Relink a pcb after its remote end, local port or flags changed */
+static void
+udp_pcb_rehash(struct udp_pcb *pcb)
+{
+  struct udp_pcb **bucket;
+  u16_t local_port = pcb->local_port;
+
+  udp_pcb_hash_del(pcb);
+
+  if ((pcb->flags & UDP_FLAGS_CONNECTED) == 0) {
+    return;
+  }
+  if (pcb->pretend_netif_idx != NETIF_NO_INDEX) {
+    local_port = 0;
+  } else if (ip_addr_isany(&pcb->remote_ip)) {
+    /* matches any remote address, leave it to the list walk */
+    return;
+  }
+
+  bucket = udp_pcb_hash_bucket(&pcb->remote_ip, pcb->remote_port, local_port);
+  pcb->hash_next = *bucket;
+  if (pcb->hash_next != NULL) {
+    pcb->hash_next->hash_pprev = &pcb->hash_next;
+  }
+  pcb->hash_pprev = bucket;
+  *bucket = pcb;
+}
+
+static u8_t udp_input_local_match(struct udp_pcb *pcb, struct netif *inp,
+                                  u8_t broadcast);
+
+/** Find the connected pcb of the current input packet, as the walk would */
+static struct udp_pcb *
+udp_pcb_hash_find(struct netif *inp, u8_t broadcast, u16_t src, u16_t dest)
+{
+  struct udp_pcb *pcb;
+
+  pcb = *udp_pcb_hash_bucket(ip_current_src_addr(), src, 0);
+  for (; pcb != NULL; pcb = pcb->hash_next) {
+    if ((pcb->pretend_netif_idx != NETIF_NO_INDEX) &&
+        (pcb->remote_port == src) &&
+        ip_addr_eq(&pcb->remote_ip, ip_current_src_addr())) {
+      return pcb;
+    }
+  }
+
+  pcb = *udp_pcb_hash_bucket(ip_current_src_addr(), src, dest);
+  for (; pcb != NULL; pcb = pcb->hash_next) {
+    if ((pcb->pretend_netif_idx == NETIF_NO_INDEX) &&
+        (pcb->local_port == dest) && (pcb->remote_port == src) &&
+        ip_addr_eq(&pcb->remote_ip, ip_current_src_addr()) &&
+        (udp_input_local_match(pcb, inp, broadcast) != 0)) {
+      return pcb;
+    }
+  }
+
+  return NULL;
+}
+#else /* UDP_PCB_HASH_BITS */
+#define udp_pcb_hash_del(pcb)
+#define udp_pcb_rehash(pcb)
+#endif /* UDP_PCB_HASH_BITS */
+
 /** Common code to see if the current input packet matches the pcb
  * (current input packet is accessed via ip(4/6)_current_* macros)
  *
@@ -247,11 +353,25 @@ again:
   pcb = NULL;
   prev = NULL;
   uncon_pcb = NULL;
+#if UDP_PCB_HASH_BITS
+  /* Connected pcbs are found by hash, the walk below only has to consider
+   * the unconnected and wildcard ones. */
+  pcb = udp_pcb_hash_find(inp, broadcast, src, dest);
+  if (pcb != NULL) {
+    goto found;
+  }
+#endif /* UDP_PCB_HASH_BITS */
   /* Iterate through the UDP pcb list for a matching pcb.
    * 'Perfect match' pcbs (connected to the remote port & ip address) are
    * preferred. If no perfect match is found, the first unconnected pcb that
    * matches the local port and ip address gets the datagram. */
   for (pcb = udp_pcbs; pcb != NULL; pcb = pcb->next) {
+#if UDP_PCB_HASH_BITS
+    if (pcb->hash_pprev != NULL) {
+      prev = pcb;
+      continue;
+    }
+#endif /* UDP_PCB_HASH_BITS */
     /* print the PCB local and remote address */
     LWIP_DEBUGF(UDP_DEBUG, ("pcb ("));
     ip_addr_debug_print_val(UDP_DEBUG, pcb->local_ip);
@@ -318,6 +438,9 @@ again:
   if (pcb == NULL) {
     pcb = uncon_pcb;
   }
+#if UDP_PCB_HASH_BITS
+found:
+#endif /* UDP_PCB_HASH_BITS */
 
   /* Check checksum if this is a match or if it was directed at us. */
   if (pcb != NULL) {
@@ -451,10 +574,14 @@ again:
         if (npcb != NULL) {
           ip_addr_set_ipaddr(&npcb->remote_ip, ip_current_src_addr());
           npcb->remote_port = src;
+          /* the recv callback looks at where the flow goes */
+          ip_addr_set_ipaddr(&npcb->local_ip, ip_current_dest_addr());
+          npcb->local_port = dest;
           npcb->flags |= UDP_FLAGS_CONNECTED;
           npcb->pretend_netif_idx = pcb->pretend_netif_idx;
           npcb->next = udp_pcbs;
           udp_pcbs = npcb;
+          udp_pcb_rehash(npcb);
           pcb->recv(pcb->recv_arg, npcb, p, ip_current_dest_addr(), dest);
           goto again;
         }
@@ -1113,6 +1240,7 @@ done:
     pcb->next = udp_pcbs;
     udp_pcbs = pcb;
   }
+  udp_pcb_rehash(pcb);
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, ("udp_bind: bound to "));
   ip_addr_debug_print_val(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, pcb->local_ip);
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, (", port %"U16_F")\n", pcb->local_port));
@@ -1189,6 +1317,7 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
 
   pcb->remote_port = port;
   pcb->flags |= UDP_FLAGS_CONNECTED;
+  udp_pcb_rehash(pcb);
 
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, ("udp_connect: connected to "));
   ip_addr_debug_print_val(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE,
@@ -1236,6 +1365,7 @@ udp_disconnect(struct udp_pcb *pcb)
   pcb->netif_idx = NETIF_NO_INDEX;
   /* mark PCB as unconnected */
   udp_clear_flags(pcb, UDP_FLAGS_CONNECTED);
+  udp_pcb_hash_del(pcb);
 }
 
 /**
@@ -1278,6 +1408,7 @@ udp_remove(struct udp_pcb *pcb)
   LWIP_ERROR("udp_remove: invalid pcb", pcb != NULL, return);
 
   mib2_udp_unbind(pcb);
+  udp_pcb_hash_del(pcb);
   /* pcb to be removed is first in list? */
   if (udp_pcbs == pcb) {
     /* make list start at 2nd pcb */
@@ -62,6 +62,7 @@ struct ip_reassdata {
   struct ip_reassdata *next;
   struct pbuf *p;
   struct ip_hdr iphdr;
+  u32_t bytes;
   u16_t datagram_len;
   u8_t flags;
   u8_t timer;
@@ -69,6 +70,9 @@ struct ip_reassdata {
 
 void ip_reass_init(void);
 void ip_reass_tmr(void);
+u8_t ip_reass_pending(void);
+u32_t ip_reass_bytes(void);
+u32_t ip_reass_drops(void);
 struct pbuf * ip4_reass(struct pbuf *p);
 #endif /* IP_REASSEMBLY */
 
@@ -102,6 +102,7 @@ struct ip6_reassdata {
   u8_t orig_hdr[sizeof(struct ip6_frag_hdr)];
 #endif /* IPV6_FRAG_COPYHEADER */
   u32_t identification;
+  u32_t bytes;
   u16_t datagram_len;
   u8_t nexth;
   u8_t timer;
@@ -113,6 +114,9 @@ struct ip6_reassdata {
 
 #define ip6_reass_init() /* Compatibility define */
 void ip6_reass_tmr(void);
+u8_t ip6_reass_pending(void);
+u32_t ip6_reass_bytes(void);
+u32_t ip6_reass_drops(void);
 struct pbuf *ip6_reass(struct pbuf *p);
 
 #endif /* LWIP_IPV6 && LWIP_IPV6_REASS */
@@ -148,6 +148,11 @@ void *memp_malloc(memp_t type);
 #endif
 void  memp_free(memp_t type, void *mem);
 
+#if MEMP_MEM_MALLOC
+u32_t memp_used(memp_t type);
+u32_t memp_refused(void);
+#endif /* MEMP_MEM_MALLOC */
+
 #ifdef __cplusplus
 }
 #endif
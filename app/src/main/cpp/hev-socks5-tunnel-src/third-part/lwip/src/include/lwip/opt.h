@@ -202,6 +202,18 @@
 #define LWIP_TCPIP_CORE_LOCKING_INPUT   0
 #endif
 
+/**
+ * LWIP_TLS: storage class applied to the stack's internal mutable state
+ * (pcb lists, input globals, reassembly queues, netif list, ...).
+ * Define it to the compiler's thread-local qualifier (e.g. __thread) to run
+ * independent stack instances on several threads with NO_SYS==1: every
+ * thread calls lwip_init() and only touches its own pcbs and pbufs.
+ * Pools must come from the heap (MEMP_MEM_MALLOC==1) in that case.
+ */
+#if !defined LWIP_TLS || defined __DOXYGEN__
+#define LWIP_TLS
+#endif
+
 /**
  * SYS_LIGHTWEIGHT_PROT==1: enable inter-task protection (and task-vs-interrupt
  * protection) for certain critical regions during buffer allocation, deallocation
@@ -282,6 +294,16 @@
 #define MEMP_MEM_MALLOC                 0
 #endif
 
+/**
+ * MEMP_LIMIT(type): Return the maximum number of elements of a pool that may
+ * be allocated at once, 0 for no limit. Only valid for MEMP_MEM_MALLOC==1,
+ * where pools are otherwise only bounded by the heap. Use this to make the
+ * pool sizes dynamic; memp_used() reports the current occupancy.
+ */
+#if !defined MEMP_LIMIT || defined __DOXYGEN__
+#define MEMP_LIMIT(type)                0
+#endif
+
 /**
  * MEMP_MEM_INIT==1: Force use of memset to initialize pool memory.
  * Useful if pool are moved in uninitialized section of memory. This will ensure
@@ -819,6 +841,34 @@
 #define IP_REASS_MAX_PBUFS              10
 #endif
 
+/**
+ * IP_REASS_HASH_SIZE: Number of buckets (a power of two) the datagrams
+ * waiting for reassembly are hashed into by addresses and identification,
+ * for IPv4 and IPv6 each. 1 keeps a single list that every fragment walks.
+ */
+#if !defined IP_REASS_HASH_SIZE || defined __DOXYGEN__
+#define IP_REASS_HASH_SIZE              1
+#endif
+
+/**
+ * IP_REASS_MAX_BYTES: Return the most fragment payload bytes that may wait
+ * for reassembly at once, for IPv4 and IPv6 each, 0 for no limit besides
+ * IP_REASS_MAX_PBUFS. The oldest datagrams make room when
+ * IP_REASS_FREE_OLDEST is set.
+ */
+#if !defined IP_REASS_MAX_BYTES || defined __DOXYGEN__
+#define IP_REASS_MAX_BYTES              0
+#endif
+
+/**
+ * IP_REASS_MAX_DATAGRAM_BYTES: Return the largest payload a reassembled
+ * datagram may have, 0 for no limit. Fragments reaching past it are
+ * dropped, so such a datagram never completes and times out.
+ */
+#if !defined IP_REASS_MAX_DATAGRAM_BYTES || defined __DOXYGEN__
+#define IP_REASS_MAX_DATAGRAM_BYTES     0
+#endif
+
 /**
  * IP_DEFAULT_TTL: Default value for Time-To-Live used by transport layers.
  */
@@ -1254,6 +1304,15 @@
 #define UDP_TTL                         IP_DEFAULT_TTL
 #endif
 
+/**
+ * UDP_PCB_HASH_BITS: log2 of the number of buckets of a hash over the
+ * connected pcbs, used by udp_input() before it walks udp_pcbs for the
+ * unconnected ones. 0 disables the hash.
+ */
+#if !defined UDP_PCB_HASH_BITS || defined __DOXYGEN__
+#define UDP_PCB_HASH_BITS               0
+#endif
+
 /**
  * LWIP_NETBUF_RECVINFO==1: append destination addr and port to every netbuf.
  */
@@ -1353,6 +1412,16 @@
 #define TCP_MSS                         536
 #endif
 
+/**
+ * TCP_MSS_LIMIT(pcb): The MSS advertised on a SYN from pcb and the most
+ * taken from the remote host's MSS option. Defaults to TCP_MSS; may be a
+ * runtime expression no larger than TCP_MSS, which stays the compile time
+ * ceiling.
+ */
+#if !defined TCP_MSS_LIMIT || defined __DOXYGEN__
+#define TCP_MSS_LIMIT(pcb)              TCP_MSS
+#endif
+
 /**
  * TCP_CALCULATE_EFF_SEND_MSS: "The maximum size of a segment that TCP really
  * sends, the 'effective send MSS,' MUST be the smaller of the send MSS (which
@@ -1383,6 +1452,15 @@
 #define TCP_SND_BUF                     (2 * TCP_MSS)
 #endif
 
+/**
+ * TCP_SND_BUF_INIT: The sender buffer space (bytes) and initial ssthresh a
+ * new pcb starts with. Defaults to TCP_SND_BUF; may be a runtime expression
+ * no larger than TCP_SND_BUF.
+ */
+#if !defined TCP_SND_BUF_INIT || defined __DOXYGEN__
+#define TCP_SND_BUF_INIT                TCP_SND_BUF
+#endif
+
 /**
  * TCP_SND_QUEUELEN: TCP sender buffer space (pbufs). This must be at least
  * as much as (2 * TCP_SND_BUF/TCP_MSS) for things to work.
@@ -1455,6 +1533,27 @@
 #endif
 #endif
 
+/**
+ * TCP_TIME_WAIT_TIMEOUT: How long in milliseconds a closed pcb stays in
+ * TIME-WAIT. 0 frees it on the next slow timer tick, once the final ACK has
+ * gone out. Defaults to 2 * TCP_MSL as RFC 793 asks for; may be a runtime
+ * expression.
+ */
+#if !defined TCP_TIME_WAIT_TIMEOUT || defined __DOXYGEN__
+#define TCP_TIME_WAIT_TIMEOUT           (2 * TCP_MSL)
+#endif
+
+/**
+ * TCP_ACK_SEGS: How many in-order segments are taken before an ACK goes out
+ * at once; an ACK owed for fewer is delayed until tcp_fasttmr() or
+ * tcp_ack_flush(). A segment spanning several MSS counts as that many.
+ * Defaults to 2, every second segment as RFC 5681 suggests; may be a runtime
+ * expression.
+ */
+#if !defined TCP_ACK_SEGS || defined __DOXYGEN__
+#define TCP_ACK_SEGS                    2
+#endif
+
 /**
  * TCP_LISTEN_BACKLOG: Enable the backlog option for tcp listen pcb.
  */
@@ -1471,6 +1570,15 @@
 #define TCP_DEFAULT_LISTEN_BACKLOG      0xff
 #endif
 
+/**
+ * TCP_PCB_HASH_BITS: log2 of the number of buckets of a hash over the
+ * 4-tuple of all active and TIME-WAIT pcbs, used by tcp_input() instead of
+ * scanning both lists. 0 disables the hash.
+ */
+#if !defined TCP_PCB_HASH_BITS || defined __DOXYGEN__
+#define TCP_PCB_HASH_BITS               0
+#endif
+
 /**
  * TCP_OVERSIZE: The maximum number of bytes that tcp_write may
  * allocate ahead of time in an attempt to create shorter pbuf chains
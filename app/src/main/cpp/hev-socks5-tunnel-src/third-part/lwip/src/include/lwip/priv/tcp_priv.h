@@ -66,6 +66,9 @@ void             tcp_tmr     (void);  /* Must be called every
    intervals (instead of calling tcp_tmr()). */
 void             tcp_slowtmr (void);
 void             tcp_fasttmr (void);
+/* Send the delayed ACKs now rather than on the next tcp_fasttmr(), e.g.
+   once a batch of input has been taken. */
+void             tcp_ack_flush (void);
 
 /* Call this from a netif driver (watch out for threading issues!) that has
    returned a memory error on transmit and now has free buffers to send more.
@@ -320,25 +323,26 @@ struct tcp_seg {
 #endif /* LWIP_WND_SCALE */
 
 /* Global variables: */
-extern struct tcp_pcb *tcp_input_pcb;
-extern u32_t tcp_ticks;
-extern u8_t tcp_active_pcbs_changed;
+extern LWIP_TLS struct tcp_pcb *tcp_input_pcb;
+extern LWIP_TLS u32_t tcp_ticks;
+extern LWIP_TLS u8_t tcp_active_pcbs_changed;
+extern LWIP_TLS u8_t tcp_ack_delayed;
 
 /* The TCP PCB lists. */
 union tcp_listen_pcbs_t { /* List of all TCP PCBs in LISTEN state. */
   struct tcp_pcb_listen *listen_pcbs;
   struct tcp_pcb *pcbs;
 };
-extern struct tcp_pcb *tcp_bound_pcbs;
-extern union tcp_listen_pcbs_t tcp_listen_pcbs;
-extern struct tcp_pcb *tcp_active_pcbs;  /* List of all TCP PCBs that are in a
+extern LWIP_TLS struct tcp_pcb *tcp_bound_pcbs;
+extern LWIP_TLS union tcp_listen_pcbs_t tcp_listen_pcbs;
+extern LWIP_TLS struct tcp_pcb *tcp_active_pcbs;  /* List of all TCP PCBs that are in a
               state in which they accept or send
               data. */
-extern struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. */
+extern LWIP_TLS struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. */
 
 #define NUM_TCP_PCB_LISTS_NO_TIME_WAIT  3
 #define NUM_TCP_PCB_LISTS               4
-extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
+extern LWIP_TLS struct tcp_pcb **tcp_pcb_lists[NUM_TCP_PCB_LISTS];
 
 /* Axioms about the above lists:
    1) Every TCP PCB that is not CLOSED is in one of the lists.
@@ -414,18 +418,37 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
 
 #endif /* LWIP_DEBUG */
 
+#if TCP_PCB_HASH_BITS
+void tcp_pcb_hash_add(struct tcp_pcb *pcb);
+void tcp_pcb_hash_del(struct tcp_pcb *pcb);
+struct tcp_pcb *tcp_pcb_hash_find(const ip_addr_t *local_ip, u16_t local_port,
+                                  const ip_addr_t *remote_ip, u16_t remote_port,
+                                  u8_t netif_idx);
+#else /* TCP_PCB_HASH_BITS */
+#define tcp_pcb_hash_add(pcb)
+#define tcp_pcb_hash_del(pcb)
+#endif /* TCP_PCB_HASH_BITS */
+
 #define TCP_REG_ACTIVE(npcb)                       \
   do {                                             \
     TCP_REG(&tcp_active_pcbs, npcb);               \
+    tcp_pcb_hash_add(npcb);                        \
     tcp_active_pcbs_changed = 1;                   \
   } while (0)
 
 #define TCP_RMV_ACTIVE(npcb)                       \
   do {                                             \
+    tcp_pcb_hash_del(npcb);                        \
     TCP_RMV(&tcp_active_pcbs, npcb);               \
     tcp_active_pcbs_changed = 1;                   \
   } while (0)
 
+#define TCP_REG_TW(npcb)                           \
+  do {                                             \
+    TCP_REG(&tcp_tw_pcbs, npcb);                   \
+    tcp_pcb_hash_add(npcb);                        \
+  } while (0)
+
 #define TCP_PCB_REMOVE_ACTIVE(pcb)                 \
   do {                                             \
     tcp_pcb_remove(&tcp_active_pcbs, pcb);         \
@@ -442,17 +465,27 @@ void tcp_segs_free(struct tcp_seg *seg);
 void tcp_seg_free(struct tcp_seg *seg);
 struct tcp_seg *tcp_seg_copy(struct tcp_seg *seg);
 
-#define tcp_ack(pcb)                               \
+/* Owe an ACK for segs in-order segments, and send it at once once
+   TCP_ACK_SEGS are owed. */
+#define tcp_ack_segs(pcb, segs)                    \
   do {                                             \
-    if((pcb)->flags & TF_ACK_DELAY) {              \
+    if(!((pcb)->flags & TF_ACK_DELAY)) {           \
+      (pcb)->rcv_ack_segs = 0;                     \
+    }                                              \
+    (pcb)->rcv_ack_segs += (segs);                 \
+    if((pcb)->rcv_ack_segs >= TCP_ACK_SEGS) {      \
       tcp_clear_flags(pcb, TF_ACK_DELAY);          \
       tcp_ack_now(pcb);                            \
     }                                              \
     else {                                         \
       tcp_set_flags(pcb, TF_ACK_DELAY);            \
+      tcp_ack_delayed = 1;                         \
     }                                              \
   } while (0)
 
+#define tcp_ack(pcb)                               \
+  tcp_ack_segs(pcb, 1)
+
 #define tcp_ack_now(pcb)                           \
   tcp_set_flags(pcb, TF_ACK_NOW)
 
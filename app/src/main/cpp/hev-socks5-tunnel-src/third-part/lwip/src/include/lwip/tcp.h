@@ -239,7 +239,13 @@ struct tcp_pcb_listen {
 };
 
 
-/** the TCP protocol control block */
+/** the TCP protocol control block
+ *
+ * Fields are ordered by how often they are touched: the per-segment input
+ * and output paths and the timers should find what they need in the first
+ * three cache lines, so walking thousands of pcbs stays cheap. Fields used
+ * only on rare events (SACK, RTT sampling, keepalive, persist) come last.
+ */
 struct tcp_pcb {
 /** common PCB members */
   IP_PCB;
@@ -249,6 +255,11 @@ struct tcp_pcb {
   /* ports are in host byte order */
   u16_t remote_port;
 
+#if TCP_PCB_HASH_BITS
+  /* 4-tuple hash chain, only linked while active or in TIME-WAIT */
+  struct tcp_pcb *hash_next;
+#endif /* TCP_PCB_HASH_BITS */
+
   tcpflags_t flags;
 #define TF_ACK_DELAY   0x01U   /* Delayed ACK. */
 #define TF_ACK_NOW     0x02U   /* Immediate ACK. */
@@ -275,9 +286,38 @@ struct tcp_pcb {
   /* the rest of the fields are in host byte order
      as we have to do some math with them */
 
+  /* Retransmission timer. */
+  s16_t rtime;
+
+  u16_t mss;   /* maximum segment size */
+
+#define TCP_SNDQUEUELEN_OVERFLOW (0xffffU-3)
+  u16_t snd_queuelen; /* Number of pbufs currently in the send buffer. */
+
+#if TCP_OVERSIZE
+  /* Extra bytes available at the end of the last pbuf in unsent. */
+  u16_t unsent_oversize;
+#endif /* TCP_OVERSIZE */
+
+  u16_t rcv_ack_segs; /* segments taken since the delayed ACK was armed */
+
   /* Timers */
   u8_t polltmr, pollinterval;
   u8_t last_timer;
+
+  u8_t nrtx;    /* number of retransmissions */
+
+  /* fast retransmit/recovery */
+  u8_t dupacks;
+
+  /* Persist timer back-off */
+  u8_t persist_backoff;
+
+#if LWIP_WND_SCALE
+  u8_t snd_scale;
+  u8_t rcv_scale;
+#endif
+
   u32_t tmr;
 
   /* receiver variables */
@@ -286,73 +326,67 @@ struct tcp_pcb {
   tcpwnd_size_t rcv_ann_wnd; /* receiver window to announce */
   u32_t rcv_ann_right_edge; /* announced right edge of window */
 
-#if LWIP_TCP_SACK_OUT
-  /* SACK ranges to include in ACK packets (entry is invalid if left==right) */
-  struct tcp_sack_range rcv_sacks[LWIP_TCP_MAX_SACK_NUM];
-#define LWIP_TCP_SACK_VALID(pcb, idx) ((pcb)->rcv_sacks[idx].left != (pcb)->rcv_sacks[idx].right)
-#endif /* LWIP_TCP_SACK_OUT */
-
-  /* Retransmission timer. */
-  s16_t rtime;
-
-  u16_t mss;   /* maximum segment size */
-
-  /* RTT (round trip time) estimation variables */
-  u32_t rttest; /* RTT estimate in 500ms ticks */
-  u32_t rtseq;  /* sequence number being timed */
-  s16_t sa, sv; /* @see "Congestion Avoidance and Control" by Van Jacobson and Karels */
-
-  s16_t rto;    /* retransmission time-out (in ticks of TCP_SLOW_INTERVAL) */
-  u8_t nrtx;    /* number of retransmissions */
-
-  /* fast retransmit/recovery */
-  u8_t dupacks;
   u32_t lastack; /* Highest acknowledged seqno. */
 
   /* congestion avoidance/control variables */
   tcpwnd_size_t cwnd;
   tcpwnd_size_t ssthresh;
 
-  /* first byte following last rto byte */
-  u32_t rto_end;
-
   /* sender variables */
   u32_t snd_nxt;   /* next new seqno to be sent */
   u32_t snd_wl1, snd_wl2; /* Sequence and acknowledgement numbers of last
                              window update. */
   u32_t snd_lbb;       /* Sequence number of next byte to be buffered. */
   tcpwnd_size_t snd_wnd;   /* sender window */
-  tcpwnd_size_t snd_wnd_max; /* the maximum sender window announced by the remote host */
 
   tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
-#define TCP_SNDQUEUELEN_OVERFLOW (0xffffU-3)
-  u16_t snd_queuelen; /* Number of pbufs currently in the send buffer. */
-
-#if TCP_OVERSIZE
-  /* Extra bytes available at the end of the last pbuf in unsent. */
-  u16_t unsent_oversize;
-#endif /* TCP_OVERSIZE */
 
   tcpwnd_size_t bytes_acked;
 
   /* These are ordered by sequence number: */
   struct tcp_seg *unsent;   /* Unsent (queued) segments. */
   struct tcp_seg *unacked;  /* Sent but unacknowledged segments. */
+
+#if LWIP_CALLBACK_API
+  /* Function to be called when more send buffer space is available. */
+  tcp_sent_fn sent;
+  /* Function to be called when (in-sequence) data has arrived. */
+  tcp_recv_fn recv;
+#endif /* LWIP_CALLBACK_API */
+
+  struct pbuf *refused_data; /* Data previously received but not yet taken by upper layer */
+
 #if TCP_QUEUE_OOSEQ
   struct tcp_seg *ooseq;    /* Received out of sequence segments. */
 #endif /* TCP_QUEUE_OOSEQ */
 
-  struct pbuf *refused_data; /* Data previously received but not yet taken by upper layer */
+  /* RTT (round trip time) estimation variables */
+  u32_t rttest; /* RTT estimate in 500ms ticks */
+  u32_t rtseq;  /* sequence number being timed */
+  s16_t sa, sv; /* @see "Congestion Avoidance and Control" by Van Jacobson and Karels */
+
+  s16_t rto;    /* retransmission time-out (in ticks of TCP_SLOW_INTERVAL) */
+
+  /* first byte following last rto byte */
+  u32_t rto_end;
+
+  tcpwnd_size_t snd_wnd_max; /* the maximum sender window announced by the remote host */
+
+#if TCP_PCB_HASH_BITS
+  struct tcp_pcb **hash_pprev;
+#endif /* TCP_PCB_HASH_BITS */
+
+#if LWIP_TCP_SACK_OUT
+  /* SACK ranges to include in ACK packets (entry is invalid if left==right) */
+  struct tcp_sack_range rcv_sacks[LWIP_TCP_MAX_SACK_NUM];
+#define LWIP_TCP_SACK_VALID(pcb, idx) ((pcb)->rcv_sacks[idx].left != (pcb)->rcv_sacks[idx].right)
+#endif /* LWIP_TCP_SACK_OUT */
 
 #if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
   struct tcp_pcb_listen* listener;
 #endif /* LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG */
 
 #if LWIP_CALLBACK_API
-  /* Function to be called when more send buffer space is available. */
-  tcp_sent_fn sent;
-  /* Function to be called when (in-sequence) data has arrived. */
-  tcp_recv_fn recv;
   /* Function to be called when a connection has been set up. */
   tcp_connected_fn connected;
   /* Function which is called periodically. */
@@ -375,18 +409,11 @@ struct tcp_pcb {
 
   /* Persist timer counter */
   u8_t persist_cnt;
-  /* Persist timer back-off */
-  u8_t persist_backoff;
   /* Number of persist probes */
   u8_t persist_probe;
 
   /* KEEPALIVE counter */
   u8_t keep_cnt_sent;
-
-#if LWIP_WND_SCALE
-  u8_t snd_scale;
-  u8_t rcv_scale;
-#endif
 };
 
 #if LWIP_EVENT_API
@@ -86,6 +86,12 @@ struct udp_pcb {
 
   struct udp_pcb *next;
 
+#if UDP_PCB_HASH_BITS
+  /* connected pcb hash chain, see udp_pcb_rehash() */
+  struct udp_pcb *hash_next;
+  struct udp_pcb **hash_pprev;
+#endif /* UDP_PCB_HASH_BITS */
+
   u8_t flags;
   u8_t pretend_netif_idx;
   /** ports are in host byte order */
@@ -113,7 +119,7 @@ struct udp_pcb {
   void *recv_arg;
 };
 /* udp_pcbs export for external reference (e.g. SNMP agent) */
-extern struct udp_pcb *udp_pcbs;
+extern LWIP_TLS struct udp_pcb *udp_pcbs;
 
 /* The following functions is the application layer interface to the
    UDP code. */
@@ -64,6 +64,12 @@
  */
 #define NO_SYS                          1
 
+/**
+ * LWIP_TLS: keep the stack state per thread, so every tunnel worker thread
+ * runs its own independent lwIP instance.
+ */
+#define LWIP_TLS                        __thread
+
 /**
  * LWIP_TIMERS==0: Drop support for sys_timeout and lwip-internal cyclic timers.
  * (the array of lwip-internal cyclic timers is still provided)
@@ -108,6 +114,28 @@ void *hev_malloc (size_t size);
 void *hev_calloc (size_t nmemb, size_t size);
 #define MEM_CUSTOM_CALLOC hev_calloc
 
+/**
+ * MEMP_MEM_MALLOC==1: Use mem_malloc/mem_free instead of the lwip pool allocator.
+ * The static pools cannot be shared by the per-thread stack instances.
+ */
+#define MEMP_MEM_MALLOC                 1
+
+/**
+ * MEMP_LIMIT(type): per worker caps of the heap backed pools, from
+ * misc.tcp-pcb-limit, misc.udp-pcb-limit, misc.tcp-seg-limit and
+ * misc.pbuf-ref-limit, 0 for no cap. The MEMP_NUM_* values below only
+ * feed lwIP's compile time sanity checks.
+ */
+int hev_config_get_misc_tcp_pcb_limit (void);
+int hev_config_get_misc_udp_pcb_limit (void);
+int hev_config_get_misc_tcp_seg_limit (void);
+int hev_config_get_misc_pbuf_ref_limit (void);
+#define MEMP_LIMIT(type) \
+    ((type) == MEMP_TCP_PCB ? hev_config_get_misc_tcp_pcb_limit () : \
+     (type) == MEMP_UDP_PCB ? hev_config_get_misc_udp_pcb_limit () : \
+     (type) == MEMP_TCP_SEG ? hev_config_get_misc_tcp_seg_limit () : \
+     (type) == MEMP_PBUF ? hev_config_get_misc_pbuf_ref_limit () : 0)
+
 /*
    ------------------------------------------------
    ---------- Internal Memory Pool Sizes ----------
@@ -133,12 +161,24 @@ void *hev_calloc (size_t nmemb, size_t size);
  */
 #define MEMP_NUM_UDP_PCB                1024
 
+/**
+ * UDP_PCB_HASH_BITS: log2 of the number of buckets of the connected UDP
+ * pcb hash used for demultiplexing, one pcb per UDP session.
+ */
+#define UDP_PCB_HASH_BITS               10
+
 /**
  * MEMP_NUM_TCP_PCB: the number of simulatenously active TCP connections.
  * (requires the LWIP_TCP option)
  */
 #define MEMP_NUM_TCP_PCB                4096
 
+/**
+ * TCP_PCB_HASH_BITS: log2 of the number of buckets of the TCP 4-tuple
+ * hash used for demultiplexing. Keeps lookups flat with thousands of pcbs.
+ */
+#define TCP_PCB_HASH_BITS               12
+
 /**
  * MEMP_NUM_TCP_PCB_LISTEN: the number of listening TCP connections.
  * (requires the LWIP_TCP option)
@@ -154,8 +194,10 @@ void *hev_calloc (size_t nmemb, size_t size);
 /**
  * MEMP_NUM_REASSDATA: the number of simultaneously IP packets queued for
  * reassembly (whole packets, not fragments!)
+ * Pools grow on demand (MEMP_MEM_MALLOC), the reassembly limits below are
+ * what bounds them.
  */
-#define MEMP_NUM_REASSDATA              1
+#define MEMP_NUM_REASSDATA              256
 
 /**
  * MEMP_NUM_ARP_QUEUE: the number of simulateously queued outgoing
@@ -257,8 +299,27 @@ void *hev_calloc (size_t nmemb, size_t size);
  * Since the received pbufs are enqueued, be sure to configure
  * PBUF_POOL_SIZE > IP_REASS_MAX_PBUFS so that the stack is still able to receive
  * packets even if the maximum amount of fragments is enqueued for reassembly!
+ * Only a backstop here, IP_REASS_MAX_BYTES is the limit meant to apply.
  */
-#define IP_REASS_MAX_PBUFS              4
+#define IP_REASS_MAX_PBUFS              4096
+
+/**
+ * IP_REASS_HASH_SIZE: buckets the datagrams waiting for reassembly are
+ * looked up in, per address family and worker.
+ */
+#define IP_REASS_HASH_SIZE              64
+
+/**
+ * IP_REASS_MAX_BYTES and IP_REASS_MAX_DATAGRAM_BYTES: fragment payload that
+ * may wait for reassembly per address family and worker, and the largest
+ * datagram payload, from misc.ip-reass-max-bytes and
+ * misc.ip-reass-datagram-max-bytes.
+ */
+int hev_config_get_misc_ip_reass_max_bytes (void);
+#define IP_REASS_MAX_BYTES              ((u32_t)hev_config_get_misc_ip_reass_max_bytes ())
+
+int hev_config_get_misc_ip_reass_datagram_max_bytes (void);
+#define IP_REASS_MAX_DATAGRAM_BYTES     ((u32_t)hev_config_get_misc_ip_reass_datagram_max_bytes ())
 
 /**
  * IP_FRAG_USES_STATIC_BUF==1: Use a static MTU-sized buffer for IP
@@ -282,10 +343,23 @@ void *hev_calloc (size_t nmemb, size_t size);
  */
 #define LWIP_IPV6                       1
 
+/**
+ * LWIP_IPV6_SEND_ROUTER_SOLICIT==1: Send router solicitation messages during
+ * network startup. There is no router behind the tunnel.
+ */
+#define LWIP_IPV6_SEND_ROUTER_SOLICIT   0
+
 #ifdef __LP64__
 #define IPV6_FRAG_COPYHEADER            1
 #endif
 
+/**
+ * IPV6_REASS_MAXAGE: seconds a fragmented IPv6 packet waits for all its
+ * fragments. The fragments come from the local stack back to back, so wait
+ * no longer than IPv4 does instead of the 60 of RFC 8200.
+ */
+#define IPV6_REASS_MAXAGE               IP_REASS_MAXAGE
+
 /*
    ----------------------------------
    ---------- ICMP options ----------
@@ -385,9 +459,18 @@ void *hev_calloc (size_t nmemb, size_t size);
  * For the receive side, this MSS is advertised to the remote side
  * when opening a connection. For the transmit size, this MSS sets
  * an upper limit on the MSS advertised by the remote host.
+ * Here it is only the compile time ceiling, see TCP_MSS_LIMIT.
  */
 #define TCP_MSS                         8191
 
+/**
+ * TCP_MSS_LIMIT(pcb): the MSS the tun side advertises and accepts, the
+ * tunnel MTU less the IPv4 or IPv6 and TCP headers, under TCP_MSS.
+ */
+int hev_config_get_tunnel_tcp_mss (int ipv6);
+#define TCP_MSS_LIMIT(pcb) \
+    ((u16_t)hev_config_get_tunnel_tcp_mss (IP_IS_V6 (&(pcb)->remote_ip)))
+
 /**
  * TCP_WND: The size of a TCP window.  This must be at least
  * (2 * TCP_MSS) for things to work well.
@@ -395,19 +478,85 @@ void *hev_calloc (size_t nmemb, size_t size);
  * with scaling applied. Maximum window value in the TCP header
  * will be TCP_WND >> TCP_RCV_SCALE
  */
-#define TCP_WND                         (8 * TCP_MSS)
+#define TCP_WND                         (128 * TCP_MSS)
+
+/**
+ * TCP_WND_UPDATE_THRESHOLD: difference in window to trigger an
+ * explicit window update, two segments at the tunnel MTU.
+ */
+#define TCP_WND_UPDATE_THRESHOLD        (2 * hev_config_get_tunnel_tcp_mss (0))
+
+/**
+ * LWIP_WND_SCALE and TCP_RCV_SCALE:
+ * Set LWIP_WND_SCALE to 1 to enable window scaling.
+ * Set TCP_RCV_SCALE to the desired scaling factor (shift count in the
+ * range of [0..14]).
+ * TCP_WND is only the ceiling, sessions start at 64 KiB and grow their
+ * window under misc.tcp-window-size and misc.tcp-buffer-budget.
+ */
+#define LWIP_WND_SCALE                  1
+#define TCP_RCV_SCALE                   5
+
+/**
+ * LWIP_TCP_SACK_OUT==1: TCP will support sending selective acknowledgements (SACKs).
+ */
+#define LWIP_TCP_SACK_OUT               1
+
+/**
+ * TCP_TIME_WAIT_TIMEOUT: how long a closed tun side pcb lingers in
+ * TIME-WAIT, from misc.tcp-time-wait. The tun is a private link, so a short
+ * one only risks a stray RST to a retransmitted FIN.
+ */
+int hev_config_get_misc_tcp_time_wait (void);
+#define TCP_TIME_WAIT_TIMEOUT           ((u32_t)hev_config_get_misc_tcp_time_wait ())
+
+/**
+ * TCP_ACK_SEGS: in-order segments taken per ACK written to the tun, from
+ * misc.tcp-ack-segments. Each ACK costs a tun write and a kernel TCP input;
+ * the tunnel flushes what is still owed after each read batch when it is
+ * above 2, so the sender is never left waiting on the delayed ACK timer.
+ */
+int hev_config_get_misc_tcp_ack_segments (void);
+#define TCP_ACK_SEGS                    ((u32_t)hev_config_get_misc_tcp_ack_segments ())
+
+/**
+ * TCP_OOSEQ_BYTES_LIMIT(pcb) and TCP_OOSEQ_PBUFS_LIMIT(pcb): the most one
+ * pcb may hold out of order, from misc.tcp-ooseq-max-bytes and
+ * misc.tcp-ooseq-max-pbufs. The pbufs cap also bounds the queue walk done
+ * for every out-of-order segment.
+ */
+int hev_config_get_misc_tcp_ooseq_max_bytes (void);
+#define TCP_OOSEQ_BYTES_LIMIT(pcb)      ((u32_t)hev_config_get_misc_tcp_ooseq_max_bytes ())
+
+int hev_config_get_misc_tcp_ooseq_max_pbufs (void);
+#define TCP_OOSEQ_PBUFS_LIMIT(pcb)      ((u16_t)hev_config_get_misc_tcp_ooseq_max_pbufs ())
 
 /**
  * TCP_SND_BUF: TCP sender buffer space (bytes).
  * To achieve good performance, this should be at least 2 * TCP_MSS.
+ * Here it is only the compile time ceiling, four 64 KiB GSO batches.
+ */
+#define TCP_SND_BUF                     (4 * 0x10000)
+
+/**
+ * TCP_SND_BUF_INIT: the sender buffer each pcb gets, one GSO batch, or
+ * four with tunnel.offload, where the tun takes them whole.
+ */
+int hev_config_get_tunnel_tcp_snd_buf (void);
+#define TCP_SND_BUF_INIT                ((tcpwnd_size_t)hev_config_get_tunnel_tcp_snd_buf ())
+
+/**
+ * TCP_SNDLOWAT: only the socket API reads it, keep lwIP's sanity checks
+ * within the 16 bit bound with the larger TCP_SND_BUF.
  */
-#define TCP_SND_BUF                     (8 * TCP_MSS)
+#define TCP_SNDLOWAT                    (0x4000)
 
 /**
  * TCP_SND_QUEUELEN: TCP sender buffer space (pbufs). This must be at least
- * as much as (2 * TCP_SND_BUF/TCP_MSS) for things to work.
+ * as much as (2 * TCP_SND_BUF/TCP_MSS) for things to work. About 1024,
+ * ample for TCP_SND_BUF at the smallest MTU.
  */
-#define TCP_SND_QUEUELEN                ((128 * (TCP_SND_BUF) + (TCP_MSS - 1))/(TCP_MSS))
+#define TCP_SND_QUEUELEN                ((32 * (TCP_SND_BUF) + (TCP_MSS - 1))/(TCP_MSS))
 
 /*
    ----------------------------------
@@ -425,7 +574,8 @@ void *hev_calloc (size_t nmemb, size_t size);
  * PBUF_POOL_BUFSIZE: the size of each pbuf in the pbuf pool. The default is
  * designed to accommodate single full size TCP frame in one pbuf, including
  * TCP_MSS, IP header, and link header.
-*
+ * Pools come from the heap here and tun reads use buffers sized from the
+ * tunnel MTU, so this only feeds lwIP's sanity checks.
  */
 #define PBUF_POOL_BUFSIZE               LWIP_MEM_ALIGN_SIZE(TCP_MSS+40+PBUF_LINK_HLEN)
 
@@ -512,6 +662,12 @@ void *hev_calloc (size_t nmemb, size_t size);
  */
 #define LWIP_CHECKSUM_ON_COPY           1
 
+/**
+ * LWIP_CHKSUM: Use the word-at-a-time / SIMD sum shared with the tunnel.
+ */
+unsigned short hev_checksum_lwip (const void *data, int len);
+#define LWIP_CHKSUM hev_checksum_lwip
+
 /*
    ---------------------------------------
    ---------- Threading options ----------
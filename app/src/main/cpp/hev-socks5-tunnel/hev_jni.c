@@ -3,6 +3,7 @@
  */
 
 #include <jni.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
@@ -19,6 +20,12 @@ static volatile int tunnel_running = 0;
 static char *config_content = NULL;
 static int tun_fd_global = -1;
 
+// Stats the tunnel keeps publishing for nativeGetStatsPage. The engine runs
+// in this process, so plain static memory is as shared as a memfd mapping
+// would be, and it outlives every run.
+#define STATS_PAGE_INTERVAL_MS 500
+static HevSocks5TunnelStatsPage stats_page __attribute__((aligned(64)));
+
 static void *tunnel_thread_func(void *arg) {
     LOGI("Tunnel thread started");
 
@@ -69,6 +76,9 @@ Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeStart(
     tun_fd_global = tun_fd;
     tunnel_running = 1;
 
+    hev_socks5_tunnel_set_stats_page(&stats_page, sizeof(stats_page),
+                                     STATS_PAGE_INTERVAL_MS);
+
     LOGI("Starting tunnel with fd=%d", tun_fd);
     LOGI("Config:\n%s", config_content);
 
@@ -111,6 +121,59 @@ Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeStop(
     LOGI("Tunnel stopped");
 }
 
+JNIEXPORT jint JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeReplaceFd(
+    JNIEnv *env,
+    jclass clazz,
+    jint tun_fd
+) {
+    if (!tunnel_running) {
+        LOGE("Tunnel not running");
+        return -1;
+    }
+
+    int ret = hev_socks5_tunnel_replace_fd(tun_fd);
+    if (ret != 0) {
+        LOGE("Failed to replace tunnel fd=%d", tun_fd);
+        return -1;
+    }
+
+    tun_fd_global = tun_fd;
+    LOGI("Tunnel switched to fd=%d", tun_fd);
+    return 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeReload(
+    JNIEnv *env,
+    jclass clazz,
+    jstring config
+) {
+    if (!tunnel_running) {
+        LOGE("Tunnel not running");
+        return -1;
+    }
+
+    const char *config_str = (*env)->GetStringUTFChars(env, config, NULL);
+    if (!config_str) {
+        LOGE("Failed to get config string");
+        return -1;
+    }
+
+    // Sessions already running keep their upstream until they end.
+    int ret = hev_socks5_tunnel_reload_from_str(
+        (const unsigned char *)config_str, strlen(config_str));
+    (*env)->ReleaseStringUTFChars(env, config, config_str);
+
+    if (ret != 0) {
+        LOGE("Failed to reload tunnel config");
+        return -1;
+    }
+
+    LOGI("Tunnel config reloaded");
+    return 0;
+}
+
 JNIEXPORT void JNICALL
 Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeSetRejectQuic(
     JNIEnv *env,
@@ -120,6 +183,52 @@ Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeSetRejectQuic(
     hev_socks5_tunnel_set_reject_quic(enabled ? 1 : 0);
 }
 
+JNIEXPORT void JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeSetProvider(
+    JNIEnv *env,
+    jclass clazz,
+    jlong address,
+    jstring username,
+    jstring password
+) {
+    const char *user = NULL;
+    const char *pass = NULL;
+
+    if (username)
+        user = (*env)->GetStringUTFChars(env, username, NULL);
+    if (password)
+        pass = (*env)->GetStringUTFChars(env, password, NULL);
+
+    // The library copies the credentials.
+    hev_socks5_tunnel_set_provider(
+        (HevSocks5TunnelProvider)(intptr_t)address, NULL, user, pass);
+
+    if (user)
+        (*env)->ReleaseStringUTFChars(env, username, user);
+    if (pass)
+        (*env)->ReleaseStringUTFChars(env, password, pass);
+}
+
+JNIEXPORT void JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeSetTraceProvider(
+    JNIEnv *env,
+    jclass clazz,
+    jlong address
+) {
+    hev_socks5_tunnel_set_trace_provider(
+        (HevSocks5TunnelTraceProvider)(intptr_t)address);
+}
+
+JNIEXPORT void JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeSetDatagramProvider(
+    JNIEnv *env,
+    jclass clazz,
+    jlong address
+) {
+    hev_socks5_tunnel_set_datagram_provider(
+        (HevSocks5TunnelProvider)(intptr_t)address, NULL);
+}
+
 JNIEXPORT jboolean JNICALL
 Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeIsRunning(
     JNIEnv *env,
@@ -133,22 +242,172 @@ Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeGetStats(
     JNIEnv *env,
     jclass clazz
 ) {
-    size_t tx_packets = 0, tx_bytes = 0, rx_packets = 0, rx_bytes = 0;
+    HevSocks5TunnelStats stats;
+    memset(&stats, 0, sizeof(stats));
 
     if (tunnel_running) {
-        hev_socks5_tunnel_stats(&tx_packets, &tx_bytes, &rx_packets, &rx_bytes);
+        hev_socks5_tunnel_get_stats(&stats, sizeof(stats));
     }
 
-    jlongArray result = (*env)->NewLongArray(env, 4);
+    // Layout is append-only: the first four entries are the traffic
+    // counters, the rest follow HevSocks5TunnelStats field order.
+    jlong values[] = {
+        (jlong)stats.tx_packets,
+        (jlong)stats.tx_bytes,
+        (jlong)stats.rx_packets,
+        (jlong)stats.rx_bytes,
+        (jlong)stats.fwd_writevs,
+        (jlong)stats.fwd_bytes,
+        (jlong)stats.tcp_sessions,
+        (jlong)stats.udp_sessions,
+        (jlong)stats.tcp_accepts,
+        (jlong)stats.udp_accepts,
+        (jlong)stats.evictions,
+        (jlong)stats.quic_rejects,
+        (jlong)stats.filter_drops,
+        (jlong)stats.connect_failures,
+        (jlong)stats.connect_latency[0],
+        (jlong)stats.connect_latency[1],
+        (jlong)stats.connect_latency[2],
+        (jlong)stats.connect_latency[3],
+        (jlong)stats.connect_latency[4],
+        (jlong)stats.connect_latency[5],
+        (jlong)stats.connect_latency[6],
+        (jlong)stats.connect_latency[7],
+        (jlong)stats.tcp_pcbs,
+        (jlong)stats.tcp_queued,
+        (jlong)stats.udp_drops,
+        (jlong)stats.egress_flushes,
+        (jlong)stats.connect_ipv4,
+        (jlong)stats.connect_ipv4_msecs,
+        (jlong)stats.connect_ipv6,
+        (jlong)stats.connect_ipv6_msecs,
+        (jlong)stats.connect_fallbacks,
+        (jlong)stats.tcp_segs,
+        (jlong)stats.udp_pcbs,
+        (jlong)stats.ref_pbufs,
+        (jlong)stats.pool_refusals,
+        (jlong)stats.wakeups,
+        (jlong)stats.reass_bytes,
+        (jlong)stats.reass_drops,
+        (jlong)stats.mem_used,
+        (jlong)stats.mem_evictions,
+        (jlong)stats.task_run_time[0],
+        (jlong)stats.task_run_time[1],
+        (jlong)stats.task_run_time[2],
+        (jlong)stats.task_run_time[3],
+        (jlong)stats.task_switches[0],
+        (jlong)stats.task_switches[1],
+        (jlong)stats.task_switches[2],
+        (jlong)stats.task_switches[3]
+    };
+    jsize count = sizeof(values) / sizeof(values[0]);
+
+    jlongArray result = (*env)->NewLongArray(env, count);
     if (result) {
-        jlong stats[4] = {
-            (jlong)tx_packets,
-            (jlong)tx_bytes,
-            (jlong)rx_packets,
-            (jlong)rx_bytes
-        };
-        (*env)->SetLongArrayRegion(env, result, 0, 4, stats);
+        (*env)->SetLongArrayRegion(env, result, 0, count, values);
+    }
+
+    return result;
+}
+
+JNIEXPORT jobject JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeGetStatsPage(
+    JNIEnv *env,
+    jclass clazz
+) {
+    // A HevSocks5TunnelStatsPage; the values follow at byte 16 in the
+    // same order as nativeGetStats, read under the page seqlock.
+    return (*env)->NewDirectByteBuffer(env, &stats_page, sizeof(stats_page));
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeTakeSessions(
+    JNIEnv *env,
+    jclass clazz
+) {
+    // Fixed stride per record: id, tx, rx, duration, handshake, ttfb,
+    // type, state, family, port, then the address as two big-endian longs.
+    enum { STRIDE = 12, BATCH = 256 };
+    HevSocks5TunnelSession records[BATCH];
+    size_t count = 0;
+
+    if (tunnel_running) {
+        count = hev_socks5_tunnel_take_sessions(records, BATCH);
+    }
+
+    jlongArray result = (*env)->NewLongArray(env, count * STRIDE);
+    if (!result || !count) {
+        return result;
+    }
+
+    jlong *values = (*env)->GetLongArrayElements(env, result, NULL);
+    if (!values) {
+        return result;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        HevSocks5TunnelSession *r = &records[i];
+        jlong *v = &values[i * STRIDE];
+        uint64_t hi = 0, lo = 0;
+
+        for (int j = 0; j < 8; j++) {
+            hi = (hi << 8) | r->addr[j];
+            lo = (lo << 8) | r->addr[8 + j];
+        }
+
+        v[0] = (jlong)r->id;
+        v[1] = (jlong)r->tx_bytes;
+        v[2] = (jlong)r->rx_bytes;
+        v[3] = (jlong)r->duration;
+        v[4] = (jlong)r->handshake;
+        v[5] = (jlong)r->ttfb;
+        v[6] = (jlong)r->type;
+        v[7] = (jlong)r->state;
+        v[8] = (jlong)r->family;
+        v[9] = (jlong)r->port;
+        v[10] = (jlong)hi;
+        v[11] = (jlong)lo;
     }
 
+    (*env)->ReleaseLongArrayElements(env, result, values, 0);
+
+    return result;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_app_slipnet_tunnel_HevSocks5Tunnel_nativeTakeTraces(
+    JNIEnv *env,
+    jclass clazz
+) {
+    // Fixed stride per event: trace, time in microseconds, milestone.
+    enum { STRIDE = 3, BATCH = 256 };
+    HevSocks5TunnelTraceEvent events[BATCH];
+    size_t count = 0;
+
+    if (tunnel_running) {
+        count = hev_socks5_tunnel_take_traces(events, BATCH);
+    }
+
+    jlongArray result = (*env)->NewLongArray(env, count * STRIDE);
+    if (!result || !count) {
+        return result;
+    }
+
+    jlong *values = (*env)->GetLongArrayElements(env, result, NULL);
+    if (!values) {
+        return result;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        jlong *v = &values[i * STRIDE];
+
+        v[0] = (jlong)events[i].trace;
+        v[1] = (jlong)events[i].time;
+        v[2] = (jlong)events[i].milestone;
+    }
+
+    (*env)->ReleaseLongArrayElements(env, result, values, 0);
+
     return result;
 }
@@ -9,13 +9,16 @@ import app.slipnet.domain.model.ScanMode
 import app.slipnet.domain.repository.ResolverScannerRepository
 import dagger.hilt.android.qualifiers.ApplicationContext
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.channels.trySendBlocking
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.channelFlow
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.sync.Semaphore
 import kotlinx.coroutines.withContext
 import kotlinx.coroutines.withTimeoutOrNull
 import app.slipnet.tunnel.DomainRouter
+import app.slipnet.tunnel.SlipstreamBridge
 import java.io.BufferedReader
 import java.io.InputStreamReader
 import java.net.DatagramPacket
@@ -464,9 +467,33 @@ class ResolverScannerRepositoryImpl @Inject constructor(
         concurrency: Int,
         scanMode: ScanMode
     ): Flow<ResolverScanResult> = channelFlow {
-        val semaphore = Semaphore(concurrency)
+        val reported = BooleanArray(hosts.size)
+        if (SlipstreamBridge.isLoaded()) {
+            // Native engine: one thread, batched UDP, thousands of probes in
+            // flight. It does the whole simple scan; for the tunnel scan it
+            // only weeds out hosts that never answer, which are most of a
+            // range, before the per-host record tests below.
+            val simple = scanMode == ScanMode.SIMPLE
+            val finished = withContext(Dispatchers.IO) {
+                SlipstreamBridge.scanResolvers(
+                    hosts.toTypedArray(), port, testDomain,
+                    timeoutMs.coerceIn(1L, Int.MAX_VALUE.toLong()).toInt(), concurrency,
+                    if (simple) 4 else 0
+                ) { index, status, timeMs, rcode, answer ->
+                    if (simple || status == SlipstreamBridge.SCAN_TIMEOUT) {
+                        reported[index] = true
+                        trySendBlocking(nativeScanResult(hosts[index], port, status, timeMs, rcode, answer)).isSuccess
+                    } else {
+                        isActive
+                    }
+                }
+            }
+            if (finished && simple) return@channelFlow
+        }
 
-        hosts.forEach { host ->
+        val semaphore = Semaphore(concurrency.coerceIn(1, JVM_SCAN_CONCURRENCY_MAX))
+        hosts.forEachIndexed { index, host ->
+            if (reported[index]) return@forEachIndexed
             launch {
                 semaphore.acquire()
                 try {
@@ -479,7 +506,41 @@ class ResolverScannerRepositoryImpl @Inject constructor(
         }
     }
 
+    private fun nativeScanResult(
+        host: String,
+        port: Int,
+        status: Int,
+        timeMs: Long,
+        rcode: Int,
+        answer: String?
+    ): ResolverScanResult = when (status) {
+        SlipstreamBridge.SCAN_WORKING -> ResolverScanResult(
+            host = host, port = port,
+            status = ResolverStatus.WORKING,
+            responseTimeMs = timeMs
+        )
+        SlipstreamBridge.SCAN_CENSORED -> ResolverScanResult(
+            host = host, port = port,
+            status = ResolverStatus.CENSORED,
+            responseTimeMs = timeMs,
+            errorMessage = "Hijacked to $answer"
+        )
+        SlipstreamBridge.SCAN_ERROR -> ResolverScanResult(
+            host = host, port = port,
+            status = ResolverStatus.ERROR,
+            responseTimeMs = timeMs,
+            errorMessage = if (rcode != 0) "Response code: $rcode" else "Unreachable"
+        )
+        else -> ResolverScanResult(
+            host = host, port = port,
+            status = ResolverStatus.TIMEOUT,
+            responseTimeMs = timeMs
+        )
+    }
+
     companion object {
+        /** Blocking probes beyond this only queue on the IO dispatcher's threads. */
+        private const val JVM_SCAN_CONCURRENCY_MAX = 64
         private const val DNS_TYPE_A = 1      // A record (IPv4 address)
         private const val DNS_TYPE_NS = 2     // NS record (Name server)
         private const val DNS_TYPE_TXT = 16   // TXT record (Text)
@@ -32,6 +32,7 @@ import kotlinx.coroutines.flow.first
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.runBlocking
 import kotlinx.coroutines.withContext
+import java.io.File
 import javax.inject.Inject
 import javax.inject.Singleton
 import app.slipnet.tunnel.SingBoxBridge
@@ -43,6 +44,9 @@ class VpnRepositoryImpl @Inject constructor(
 ) : VpnRepository {
     companion object {
         private const val TAG = "VpnRepositoryImpl"
+        // Under noBackupFilesDir: session tickets are secrets and must not be restored elsewhere
+        private const val SLIPSTREAM_SESSION_DIR = "slipstream-sessions"
+        private const val DOH3_STATE_DIR = "doh3"
     }
 
     private val scope = CoroutineScope(SupervisorJob() + Dispatchers.Main)
@@ -185,7 +189,8 @@ class VpnRepositoryImpl @Inject constructor(
         val result = DohBridge.start(
             dohUrl = profile.dohUrl,
             listenPort = proxyPort,
-            listenHost = proxyHost
+            listenHost = proxyHost,
+            stateDir = File(context.noBackupFilesDir, DOH3_STATE_DIR)
         )
 
         if (result.isSuccess) {
@@ -358,6 +363,29 @@ class VpnRepositoryImpl @Inject constructor(
         }
         Log.i(TAG, "  UDP mode: $udpMode")
 
+        // Slipstream without domain routing: TCP sessions open QUIC streams in-process
+        // and authenticate to Dante themselves, skipping SlipstreamSocksBridge and the
+        // client's TCP listener. UDP rides QUIC datagrams when the server relays
+        // them, and goes through the bridge otherwise.
+        val streamProvider = if (profile.tunnelType == TunnelType.SLIPSTREAM &&
+            !SlipstreamSocksBridge.domainRouter.enabled
+        ) {
+            // Same rule as the bridge: both credentials or no auth at all.
+            val hasAuth = !profile.socksUsername.isNullOrBlank() && !profile.socksPassword.isNullOrBlank()
+            SlipstreamBridge.streamProvider().takeIf { it != 0L }?.let {
+                HevSocks5Tunnel.StreamProvider(
+                    address = it,
+                    username = if (hasAuth) profile.socksUsername else null,
+                    password = if (hasAuth) profile.socksPassword else null,
+                    traceAddress = SlipstreamBridge.traceStreamProvider()
+                )
+            }
+        } else {
+            null
+        }
+        Log.i(TAG, "  In-process streams: ${streamProvider != null}")
+        val datagramProvider = if (streamProvider != null) SlipstreamBridge.datagramProvider() else 0L
+
         val hevResult = HevSocks5Tunnel.start(
             tunFd = pfd,
             socksAddress = "127.0.0.1",
@@ -368,7 +396,9 @@ class VpnRepositoryImpl @Inject constructor(
             udpMode = udpMode,
             mtu = 1500,
             ipv4Address = "10.255.255.1",
-            disableQuic = disableQuic
+            disableQuic = disableQuic,
+            streamProvider = streamProvider,
+            datagramProvider = datagramProvider
         )
 
         return if (hevResult.isSuccess) {
@@ -552,7 +582,8 @@ class VpnRepositoryImpl @Inject constructor(
             gsoEnabled = profile.gsoEnabled,
             debugPoll = debugLogging,
             debugStreams = debugLogging,
-            idlePollIntervalMs = 2000
+            idlePollIntervalMs = 2000,
+            sessionCacheDir = File(context.noBackupFilesDir, SLIPSTREAM_SESSION_DIR).absolutePath
         )
         if (result.isFailure) {
             val exception = result.exceptionOrNull()
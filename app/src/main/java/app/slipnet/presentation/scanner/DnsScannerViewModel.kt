@@ -30,7 +30,7 @@ data class DnsScannerUiState(
     val profileId: Long? = null,
     val testDomain: String = "google.com",
     val timeoutMs: String = "3000",
-    val concurrency: String = "50",
+    val concurrency: String = "500",
     val scanMode: ScanMode = ScanMode.DNS_TUNNEL,
     val resolverList: List<String> = emptyList(),
     val scannerState: ScannerState = ScannerState(),
@@ -441,7 +441,7 @@ class DnsScannerViewModel @Inject constructor(
 
         val state = _uiState.value
         val timeout = state.timeoutMs.toLongOrNull() ?: 3000L
-        val concurrency = state.concurrency.toIntOrNull() ?: 50
+        val concurrency = state.concurrency.toIntOrNull() ?: 500
 
         // Initialize scanner state
         val initialResults = state.resolverList.map { host ->
@@ -479,7 +479,7 @@ class DnsScannerViewModel @Inject constructor(
 
         val state = _uiState.value
         val timeout = state.timeoutMs.toLongOrNull() ?: 3000L
-        val concurrency = state.concurrency.toIntOrNull() ?: 50
+        val concurrency = state.concurrency.toIntOrNull() ?: 500
 
         // Determine which hosts were already scanned.
         val existingResults = mutableMapOf<String, ResolverScanResult>()
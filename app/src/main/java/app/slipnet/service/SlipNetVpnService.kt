@@ -27,6 +27,7 @@ import app.slipnet.domain.model.TunnelType
 import app.slipnet.tunnel.DnsttBridge
 import app.slipnet.tunnel.DnsttSocksBridge
 import app.slipnet.tunnel.DohBridge
+import app.slipnet.tunnel.FlowTraces
 import app.slipnet.tunnel.HevSocks5Tunnel
 import app.slipnet.tunnel.HttpProxyServer
 import app.slipnet.tunnel.NaiveBridge
@@ -46,6 +47,7 @@ import kotlinx.coroutines.flow.first
 import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
+import java.io.File
 import javax.inject.Inject
 import app.slipnet.tunnel.SingBoxBridge
 import app.slipnet.tunnel.CdnScanner
@@ -303,6 +305,12 @@ class SlipNetVpnService : VpnService() {
                 currentTunnelType = profile.tunnelType
                 Log.i(TAG, "Starting VPN with tunnel type: $currentTunnelType")
 
+                // Geo-bypass networks are connected by tun2socks itself when our sockets skip the VPN
+                val bypassFile = File(cacheDir, "bypass.list")
+                HevSocks5Tunnel.bypassFile = bypassFile.absolutePath.takeIf {
+                    needsSelfExclusion() && domainRouter.writeBypassNetworks(bypassFile)
+                }
+
                 val dnsServer = profile.resolvers.firstOrNull()?.host ?: DEFAULT_DNS
                 // Remote DNS: the DNS servers used on the remote side of the tunnel
                 val remoteDns = preferencesDataStore.getEffectiveRemoteDns().first()
@@ -1948,6 +1956,11 @@ class SlipNetVpnService : VpnService() {
                     }
                 }
 
+                // Sampled flows end up in the debug log.
+                if (HevSocks5Tunnel.traceSample > 0) {
+                    FlowTraces.collect().forEach { Log.i(TAG, it.format()) }
+                }
+
                 // Check traffic stats for stale connection detection (skip in proxy-only mode)
                 if (!isProxyOnly) {
                     val stats = HevSocks5Tunnel.getStats()
@@ -2101,6 +2114,7 @@ class SlipNetVpnService : VpnService() {
      * Handle network change by restarting the QUIC connection.
      * The Rust client has built-in reconnection logic, but we need to force it
      * when the network changes because the underlying sockets become stale.
+     * Slipstream tunnels only swap their sockets and keep the connection.
      */
     private fun handleNetworkChange(reason: String = "unknown") {
         serviceScope.launch {
@@ -2112,7 +2126,18 @@ class SlipNetVpnService : VpnService() {
             isReconnecting = true
 
             try {
-                Log.i(TAG, "Handling network change ($reason) - restarting connection")
+                Log.i(TAG, "Handling network change ($reason)")
+
+                // Slipstream moves its QUIC connection onto the new network in
+                // place, so everything stacked on top of it keeps running.
+                if ((currentTunnelType == TunnelType.SLIPSTREAM ||
+                            currentTunnelType == TunnelType.SLIPSTREAM_SSH) &&
+                    !isKillSwitchActive &&
+                    SlipstreamBridge.networkChanged()
+                ) {
+                    Log.i(TAG, "Slipstream moved to the new network ($reason) without reconnecting")
+                    return@launch
+                }
 
                 // Stop health check during reconnection
                 healthCheckJob?.cancel()
@@ -2124,10 +2149,8 @@ class SlipNetVpnService : VpnService() {
                     return@launch
                 }
 
-                // Stop current tunnels
-                if (!isProxyOnly) {
-                    HevSocks5Tunnel.stop()
-                }
+                // Stop the current proxy. tun2socks keeps running and is moved
+                // onto the VPN interface below, so its lwIP state survives.
                 stopCurrentProxy()
 
                 // Give native code time to clean up
@@ -2482,6 +2505,12 @@ class SlipNetVpnService : VpnService() {
                     vpnRepository.setProxyConnected(profile)
                 } else {
                     vpnInterface?.let { pfd ->
+                        if (HevSocks5Tunnel.isRunning() && HevSocks5Tunnel.replaceFd(pfd)) {
+                            return@let
+                        }
+                        if (HevSocks5Tunnel.isRunning()) {
+                            HevSocks5Tunnel.stop()
+                        }
                         // All tunnel types now have user-facing SOCKS5 on proxyPort
                         val tun2socksResult = vpnRepository.startTun2Socks(profile, pfd)
                         if (tun2socksResult.isFailure) {
@@ -2661,16 +2690,9 @@ class SlipNetVpnService : VpnService() {
         }
     }
 
-    private suspend fun establishVpnInterface(dnsServer: String): ParcelFileDescriptor? {
-        val builder = Builder()
-            .setSession("SlipNet VPN")
-            .setMtu(VPN_MTU)
-            .addAddress(VPN_ADDRESS, 32)
-            .addRoute(VPN_ROUTE, 0)
-            .addDnsServer(dnsServer)
-            .setBlocking(false)
-
-        val needsSelfExclusion = currentTunnelType == TunnelType.DNSTT ||
+    /** Tunnel types whose own sockets must bypass the VPN, so the app is excluded from it. */
+    private fun needsSelfExclusion(): Boolean {
+        return currentTunnelType == TunnelType.DNSTT ||
                 currentTunnelType == TunnelType.SSH ||
                 currentTunnelType == TunnelType.DNSTT_SSH ||
                 currentTunnelType == TunnelType.DOH ||
@@ -2681,6 +2703,18 @@ class SlipNetVpnService : VpnService() {
                 currentTunnelType == TunnelType.TROJAN ||
                 currentTunnelType == TunnelType.HYSTERIA2 ||
                 currentTunnelType == TunnelType.SHADOWSOCKS
+    }
+
+    private suspend fun establishVpnInterface(dnsServer: String): ParcelFileDescriptor? {
+        val builder = Builder()
+            .setSession("SlipNet VPN")
+            .setMtu(VPN_MTU)
+            .addAddress(VPN_ADDRESS, 32)
+            .addRoute(VPN_ROUTE, 0)
+            .addDnsServer(dnsServer)
+            .setBlocking(false)
+
+        val needsSelfExclusion = needsSelfExclusion()
 
         val splitEnabled = preferencesDataStore.splitTunnelingEnabled.first()
         val splitMode = preferencesDataStore.splitTunnelingMode.first()
@@ -1,8 +1,10 @@
 package app.slipnet.tunnel
 
 import app.slipnet.util.AppLog as Log
+import android.util.Base64
 import java.io.BufferedOutputStream
 import java.io.ByteArrayInputStream
+import java.io.File
 import java.io.InputStream
 import java.io.OutputStream
 import java.io.SequenceInputStream
@@ -13,6 +15,8 @@ import java.net.InetSocketAddress
 import java.net.ServerSocket
 import java.net.Socket
 import java.net.URL
+import java.security.KeyStore
+import java.security.cert.X509Certificate
 import java.util.concurrent.CopyOnWriteArrayList
 import java.util.concurrent.TimeUnit
 import java.util.concurrent.atomic.AtomicBoolean
@@ -162,7 +166,10 @@ val DOH_SERVERS = listOf(
  * All other traffic is proxied directly (no encryption).
  *
  * Uses OkHttp with HTTP/2, connection pooling, and pre-resolved IP addresses
- * for known DoH servers to bypass ISP DNS resolution.
+ * for known DoH servers to bypass ISP DNS resolution. When given a state
+ * directory, DNS goes over HTTP/3 first through the native client, which
+ * keeps lookups independent of each other on a lossy path; OkHttp takes
+ * any query HTTP/3 does not answer.
  *
  * Traffic flow:
  * App DNS -> TUN -> hev-socks5-tunnel -> FWD_UDP (0x05) -> DohBridge -> HTTPS POST to DoH server
@@ -178,6 +185,10 @@ object DohBridge {
     private const val BIND_RETRY_DELAY_MS = 200L
     private const val BUFFER_SIZE = 32768
     private const val TCP_CONNECT_TIMEOUT_MS = 10000
+    /** Wait for an HTTP/3 answer before asking again over HTTP/2. */
+    private const val DOH3_TIMEOUT_MS = 2000
+    private const val DOH3_CERT_ROOTS = "doh3-roots.pem"
+    private const val DOH3_TICKETS = "doh3-tickets.bin"
 
     /** Hostname → IPs lookup built from [DOH_SERVERS] for the custom OkHttp DNS resolver. */
     private val serverIpMap: Map<String, List<String>> by lazy {
@@ -196,6 +207,8 @@ object DohBridge {
     private val connectionThreads = CopyOnWriteArrayList<Thread>()
     @Volatile
     private var httpClient: OkHttpClient? = null
+    @Volatile
+    private var doh3Active = false
 
     /**
      * Create an OkHttpClient configured for DoH with:
@@ -238,15 +251,75 @@ object DohBridge {
             .build()
     }
 
+    /**
+     * Start the native HTTP/3 client for [url], dialing a pre-resolved
+     * address of the server where one is known.
+     */
+    private fun startDoh3(url: String, stateDir: File): Boolean {
+        if (!SlipstreamBridge.isLoaded()) return false
+        val parsed = try { URL(url) } catch (_: Exception) { return false }
+        if (parsed.protocol != "https") return false
+        val host = parsed.host
+        val address = try {
+            serverIpMap[host]?.firstOrNull()?.let { InetAddress.getByName(it) }
+                ?: InetAddress.getByName(host)
+        } catch (e: Exception) {
+            logd("DoH3: cannot resolve $host: ${e.message}")
+            return false
+        }
+        val roots = File(stateDir, DOH3_CERT_ROOTS)
+        if (!exportCertRoots(roots)) return false
+        val port = if (parsed.port > 0) parsed.port else 443
+        val path = parsed.file.ifEmpty { "/" }
+        val started = SlipstreamBridge.startDoh3(
+            address.hostAddress ?: return false, port, host, path,
+            roots.absolutePath, File(stateDir, DOH3_TICKETS).absolutePath
+        )
+        Log.i(TAG, "DoH3 upstream ${if (started) "started" else "unavailable"} for $host")
+        return started
+    }
+
+    /**
+     * Write the system CA certificates as PEM for the native TLS stack, which
+     * cannot read the Android trust store. User-added CAs are left out, as
+     * they are for OkHttp.
+     */
+    private fun exportCertRoots(file: File): Boolean {
+        return try {
+            val store = KeyStore.getInstance("AndroidCAStore").apply { load(null) }
+            val pem = StringBuilder()
+            for (alias in store.aliases()) {
+                if (!alias.startsWith("system:")) continue
+                val cert = store.getCertificate(alias) as? X509Certificate ?: continue
+                pem.append("-----BEGIN CERTIFICATE-----\n")
+                pem.append(Base64.encodeToString(cert.encoded, Base64.DEFAULT))
+                pem.append("-----END CERTIFICATE-----\n")
+            }
+            file.parentFile?.mkdirs()
+            file.writeText(pem.toString())
+            true
+        } catch (e: Exception) {
+            Log.w(TAG, "DoH3: cannot export CA certificates: ${e.message}")
+            false
+        }
+    }
+
     /**
      * Start the DoH SOCKS5 proxy.
      *
      * @param dohUrl DoH server URL (e.g., "https://cloudflare-dns.com/dns-query")
      * @param listenPort Local port for the SOCKS5 proxy
      * @param listenHost Local host for the SOCKS5 proxy
+     * @param stateDir Directory for the HTTP/3 certificate roots and session
+     *   tickets; null keeps DNS on HTTP/2
      * @return Result indicating success or failure
      */
-    fun start(dohUrl: String, listenPort: Int, listenHost: String = "127.0.0.1"): Result<Unit> {
+    fun start(
+        dohUrl: String,
+        listenPort: Int,
+        listenHost: String = "127.0.0.1",
+        stateDir: File? = null
+    ): Result<Unit> {
         Log.i(TAG, "========================================")
         Log.i(TAG, "Starting DoH bridge")
         Log.i(TAG, "  DoH URL: $dohUrl")
@@ -256,6 +329,7 @@ object DohBridge {
         stop()
         this.dohUrl = dohUrl
         httpClient = createHttpClient()
+        if (stateDir != null) doh3Active = startDoh3(dohUrl, stateDir)
 
         return try {
             val ss = bindServerSocket(listenHost, listenPort)
@@ -316,6 +390,11 @@ object DohBridge {
         }
         httpClient = null
 
+        if (doh3Active) {
+            doh3Active = false
+            SlipstreamBridge.stopDoh3()
+        }
+
         logd("DoH bridge stopped")
     }
 
@@ -695,9 +774,13 @@ object DohBridge {
 
     /**
      * Forward DNS query via DoH (HTTPS POST, RFC 8484).
-     * Uses OkHttp with HTTP/2 and pre-resolved server IPs.
+     * Tries HTTP/3 first when it runs, then OkHttp with HTTP/2 and
+     * pre-resolved server IPs.
      */
     private fun forwardDnsViaDoH(payload: ByteArray): ByteArray? {
+        if (doh3Active) {
+            SlipstreamBridge.queryDoh3(payload, DOH3_TIMEOUT_MS)?.let { return it }
+        }
         val client = httpClient ?: return null
         return try {
             val body = payload.toRequestBody("application/dns-message".toMediaType())
@@ -4,6 +4,7 @@ import android.content.Context
 import app.slipnet.util.AppLog as Log
 import app.slipnet.data.local.datastore.DomainRoutingMode
 import java.io.BufferedReader
+import java.io.File
 import java.io.InputStreamReader
 import java.net.InetSocketAddress
 import java.net.Socket
@@ -141,6 +142,13 @@ class DomainRouter(
             return start to end
         }
 
+        /**
+         * Convert a Long to an IPv4 address string.
+         */
+        internal fun longToIp(ip: Long): String {
+            return "${(ip shr 24) and 0xFF}.${(ip shr 16) and 0xFF}.${(ip shr 8) and 0xFF}.${ip and 0xFF}"
+        }
+
         /**
          * Convert an IPv4 address string to a Long.
          */
@@ -196,6 +204,32 @@ class DomainRouter(
         return false
     }
 
+    /**
+     * Write the geo-bypass CIDR ranges to [file], one network per line, so that
+     * hev-socks5-tunnel connects TCP to them directly instead of through a bridge.
+     * The app must be excluded from the VPN for those sockets to go direct.
+     * Returns false when there are no ranges or the file could not be written.
+     */
+    fun writeBypassNetworks(file: File): Boolean {
+        val starts = geoBypass.ipRangeStarts
+        val ends = geoBypass.ipRangeEnds
+        if (!geoBypassEnabled || starts.isEmpty()) return false
+
+        return try {
+            file.bufferedWriter().use { out ->
+                for (i in starts.indices) {
+                    // Ranges come from CIDRs, so their sizes are powers of two.
+                    val prefix = 32 - java.lang.Long.numberOfTrailingZeros(ends[i] - starts[i] + 1)
+                    out.write("${longToIp(starts[i])}/$prefix\n")
+                }
+            }
+            true
+        } catch (e: Exception) {
+            Log.e(TAG, "Failed to write bypass networks: ${e.message}")
+            false
+        }
+    }
+
     /**
      * Create a direct TCP connection bypassing the tunnel.
      * Relies on addDisallowedApplication (app is excluded from VPN) so the socket
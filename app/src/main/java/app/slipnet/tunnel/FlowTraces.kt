@@ -0,0 +1,71 @@
+package app.slipnet.tunnel
+
+import java.util.Locale
+
+/**
+ * Latency breakdowns of the TCP flows hev traces ([HevSocks5Tunnel.traceSample]).
+ *
+ * hev stamps a traced session's accept, connect, handshake, first byte and
+ * close; with in-process streams the slipstream client stamps the QUIC stream
+ * open, the first request bytes and the first answer bytes of the same flow,
+ * under the same trace ID and clock. Both sides drop events while their rings
+ * are full, so [collect] should run every few seconds while tracing.
+ */
+object FlowTraces {
+    /** Milestones of hev (1-5) and the slipstream client (16-18). */
+    val MILESTONE_NAMES = mapOf(
+        1 to "accept",
+        2 to "connect",
+        3 to "handshake",
+        4 to "first-byte",
+        5 to "close",
+        16 to "stream-open",
+        17 to "stream-request",
+        18 to "stream-first-byte"
+    )
+
+    private const val MILESTONE_CLOSE = 5
+
+    /** Open flows kept between calls, the oldest go first. */
+    private const val MAX_OPEN_FLOWS = 256
+
+    data class Milestone(val name: String, val offsetUs: Long)
+
+    /** One flow, milestones in time order and offset from the first one. */
+    data class FlowTrace(val id: Long, val milestones: List<Milestone>) {
+        /** e.g. `flow 42: accept +0.0ms, stream-open +0.4ms, ...` */
+        fun format(): String = milestones.joinToString(
+            prefix = "flow $id: ",
+            separator = ", "
+        ) { String.format(Locale.US, "%s +%.1fms", it.name, it.offsetUs / 1000.0) }
+    }
+
+    private val openFlows = LinkedHashMap<Long, MutableList<HevSocks5Tunnel.TraceEvent>>()
+
+    /**
+     * Take the events of both engines and return the flows that closed since
+     * the last call. Events of flows still open wait for a later call.
+     */
+    @Synchronized
+    fun collect(): List<FlowTrace> {
+        val events = HevSocks5Tunnel.takeTraces() + SlipstreamBridge.takeTraces()
+        for (event in events) {
+            openFlows.getOrPut(event.trace) { mutableListOf() }.add(event)
+        }
+
+        val closed = openFlows.filterValues { flow -> flow.any { it.milestone == MILESTONE_CLOSE } }
+        closed.keys.forEach { openFlows.remove(it) }
+        val excess = openFlows.size - MAX_OPEN_FLOWS
+        if (excess > 0) {
+            openFlows.keys.take(excess).forEach { openFlows.remove(it) }
+        }
+
+        return closed.map { (id, flow) ->
+            val sorted = flow.sortedBy { it.timeUs }
+            val start = sorted.first().timeUs
+            FlowTrace(id, sorted.map {
+                Milestone(MILESTONE_NAMES[it.milestone] ?: "m${it.milestone}", it.timeUs - start)
+            })
+        }
+    }
+}
@@ -1,6 +1,8 @@
 package app.slipnet.tunnel
 
 import android.os.ParcelFileDescriptor
+import java.net.InetAddress
+import java.nio.ByteBuffer
 import app.slipnet.util.AppLog as Log
 
 /**
@@ -12,6 +14,20 @@ object HevSocks5Tunnel {
 
     private var isLibraryLoaded = false
 
+    /**
+     * File of networks whose TCP flows hev connects to directly, skipping the
+     * SOCKS5 hop (see DomainRouter.writeBypassNetworks). Only set while the app
+     * itself is excluded from the VPN. Read when the tunnel starts.
+     */
+    @Volatile var bypassFile: String? = null
+
+    /**
+     * Trace one in this many TCP sessions (misc.trace-sample), 0 for none.
+     * Their milestones come out of [takeTraces], merged per flow by
+     * [FlowTraces]. Read when the tunnel starts.
+     */
+    @Volatile var traceSample: Int = 0
+
     init {
         try {
             System.loadLibrary("hev-socks5-tunnel")
@@ -36,6 +52,11 @@ object HevSocks5Tunnel {
      *                           If false, UDP is not tunneled (Slipstream uses DnsForwarder instead).
      * @param mtu MTU size
      * @param ipv4Address IPv4 address for TUN interface
+     * @param streamProvider If set, TCP sessions open their upstream streams
+     *                       through it instead of connecting to the SOCKS5 server
+     * @param datagramProvider If non-zero, address of a native provider that UDP
+     *                         sessions take a datagram socket from; sessions fall
+     *                         back to UDP over SOCKS5 while it has none to give
      * @return Result indicating success or failure
      */
     fun start(
@@ -48,7 +69,9 @@ object HevSocks5Tunnel {
         udpMode: String = "tcp",
         mtu: Int = 1500,
         ipv4Address: String = "10.255.255.1",
-        disableQuic: Boolean = true
+        disableQuic: Boolean = true,
+        streamProvider: StreamProvider? = null,
+        datagramProvider: Long = 0L
     ): Result<Unit> {
         if (!isLibraryLoaded) {
             return Result.failure(IllegalStateException("Native library not loaded"))
@@ -81,6 +104,13 @@ object HevSocks5Tunnel {
 
         return try {
             nativeSetRejectQuic(disableQuic)
+            nativeSetProvider(
+                streamProvider?.address ?: 0L,
+                streamProvider?.username,
+                streamProvider?.password
+            )
+            nativeSetTraceProvider(streamProvider?.traceAddress ?: 0L)
+            nativeSetDatagramProvider(datagramProvider)
             val fd = tunFd.fd
             val result = nativeStart(config, fd)
             if (result == 0) {
@@ -133,6 +163,77 @@ object HevSocks5Tunnel {
         }
     }
 
+    /**
+     * Move the running tunnel to a new TUN file descriptor without tearing
+     * down the lwIP stack or its sessions. The caller keeps ownership of
+     * both descriptors and may close the old one once this returns.
+     *
+     * @return true if the tunnel now reads from [tunFd]
+     */
+    fun replaceFd(tunFd: ParcelFileDescriptor): Boolean {
+        if (!isLibraryLoaded || !isRunning()) return false
+
+        return try {
+            val result = nativeReplaceFd(tunFd.fd)
+            if (result == 0) {
+                Log.i(TAG, "Tunnel switched to new TUN fd")
+                true
+            } else {
+                Log.w(TAG, "Failed to replace TUN fd: error code $result")
+                false
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Exception replacing TUN fd", e)
+            false
+        }
+    }
+
+    /**
+     * Point the running tunnel at another SOCKS5 server, or change its
+     * credentials, without tearing down the lwIP stack. New sessions use
+     * the new settings; sessions already running stay on the old server
+     * until they end. [mtu] and [ipv4Address] only take effect on a restart.
+     *
+     * @return true if the tunnel took the new configuration
+     */
+    fun reload(
+        socksAddress: String,
+        socksPort: Int,
+        socksUsername: String? = null,
+        socksPassword: String? = null,
+        enableUdpTunneling: Boolean = false,
+        udpMode: String = "tcp",
+        mtu: Int = 1500,
+        ipv4Address: String = "10.255.255.1"
+    ): Boolean {
+        if (!isLibraryLoaded || !isRunning()) return false
+
+        val config = buildConfig(
+            socksAddress = socksAddress,
+            socksPort = socksPort,
+            socksUsername = socksUsername,
+            socksPassword = socksPassword,
+            enableUdpTunneling = enableUdpTunneling,
+            udpMode = udpMode,
+            mtu = mtu,
+            ipv4Address = ipv4Address
+        )
+
+        return try {
+            val result = nativeReload(config)
+            if (result == 0) {
+                Log.i(TAG, "Tunnel reloaded, SOCKS5: $socksAddress:$socksPort")
+                true
+            } else {
+                Log.w(TAG, "Failed to reload tunnel: error code $result")
+                false
+            }
+        } catch (e: Exception) {
+            Log.e(TAG, "Exception reloading tunnel", e)
+            false
+        }
+    }
+
     /**
      * Check if the tunnel is running.
      */
@@ -150,23 +251,143 @@ object HevSocks5Tunnel {
      * @return TrafficStats or null if tunnel not running
      */
     fun getStats(): TrafficStats? {
-        if (!isLibraryLoaded || !isRunning()) return null
+        if (!isLibraryLoaded) return null
+
+        statsPage?.let { page ->
+            synchronized(statsValues) {
+                val count = page.read(statsValues)
+                if (count >= 0) {
+                    return if (count >= 4) toTrafficStats(statsValues, count) else null
+                }
+            }
+        }
 
+        if (!isRunning()) return null
         return try {
             val stats = nativeGetStats()
-            if (stats != null && stats.size == 4) {
-                TrafficStats(
-                    txPackets = stats[0],
-                    txBytes = stats[1],
-                    rxPackets = stats[2],
-                    rxBytes = stats[3]
-                )
-            } else null
+            if (stats != null && stats.size >= 4) toTrafficStats(stats, stats.size) else null
         } catch (e: Exception) {
             null
         }
     }
 
+    /**
+     * Page the native tunnel keeps its stats in, so [getStats] reads them
+     * without a JNI call. Null with an older native library.
+     */
+    private val statsPage: StatsPage? by lazy {
+        if (!isLibraryLoaded) return@lazy null
+        try {
+            nativeGetStatsPage()?.let { StatsPage(it) }
+        } catch (e: UnsatisfiedLinkError) {
+            null
+        }
+    }
+
+    private val statsValues = LongArray(STATS_VALUES)
+
+    private fun toTrafficStats(stats: LongArray, size: Int): TrafficStats {
+        // Entries past the first four are append-only, older native builds
+        // simply report fewer of them.
+        fun at(i: Int) = if (i < size) stats[i] else 0L
+        return TrafficStats(
+            txPackets = stats[0],
+            txBytes = stats[1],
+            rxPackets = stats[2],
+            rxBytes = stats[3],
+            fwdWritevs = at(4),
+            fwdBytes = at(5),
+            tcpSessions = at(6),
+            udpSessions = at(7),
+            tcpAccepts = at(8),
+            udpAccepts = at(9),
+            evictions = at(10),
+            quicRejects = at(11),
+            filterDrops = at(12),
+            connectFailures = at(13),
+            connectLatency = List(LATENCY_BUCKETS) { at(14 + it) },
+            tcpPcbs = at(14 + LATENCY_BUCKETS),
+            tcpQueued = at(15 + LATENCY_BUCKETS),
+            udpDrops = at(16 + LATENCY_BUCKETS),
+            egressFlushes = at(17 + LATENCY_BUCKETS),
+            connectIpv4 = at(18 + LATENCY_BUCKETS),
+            connectIpv4Msecs = at(19 + LATENCY_BUCKETS),
+            connectIpv6 = at(20 + LATENCY_BUCKETS),
+            connectIpv6Msecs = at(21 + LATENCY_BUCKETS),
+            connectFallbacks = at(22 + LATENCY_BUCKETS),
+            tcpSegs = at(23 + LATENCY_BUCKETS),
+            udpPcbs = at(24 + LATENCY_BUCKETS),
+            refPbufs = at(25 + LATENCY_BUCKETS),
+            poolRefusals = at(26 + LATENCY_BUCKETS),
+            wakeups = at(27 + LATENCY_BUCKETS),
+            reassBytes = at(28 + LATENCY_BUCKETS),
+            reassDrops = at(29 + LATENCY_BUCKETS),
+            memUsed = at(30 + LATENCY_BUCKETS),
+            memEvictions = at(31 + LATENCY_BUCKETS),
+            taskRunTimeNs = List(TASK_CLASSES) { at(32 + LATENCY_BUCKETS + it) },
+            taskSwitches = List(TASK_CLASSES) {
+                at(32 + LATENCY_BUCKETS + TASK_CLASSES + it)
+            }
+        )
+    }
+
+    /**
+     * Take the per-session records queued since the last call, oldest first.
+     * Each session shows up when it ends, and about every 5 s while active,
+     * so poll this periodically to see which flows carry the traffic.
+     */
+    fun takeSessions(): List<SessionRecord> {
+        if (!isLibraryLoaded || !isRunning()) return emptyList()
+
+        return try {
+            val v = nativeTakeSessions() ?: return emptyList()
+            List(v.size / SESSION_STRIDE) { i ->
+                val o = i * SESSION_STRIDE
+                val bytes = ByteArray(16) { j ->
+                    (v[o + 10 + j / 8] ushr (56 - (j % 8) * 8)).toByte()
+                }
+                val family = v[o + 8].toInt()
+                val address = InetAddress.getByAddress(
+                    if (family == 6) bytes else bytes.copyOf(4)
+                ).hostAddress ?: ""
+                SessionRecord(
+                    id = v[o],
+                    txBytes = v[o + 1],
+                    rxBytes = v[o + 2],
+                    durationMs = v[o + 3],
+                    handshakeMs = v[o + 4],
+                    ttfbMs = v[o + 5],
+                    udp = v[o + 6] == 1L,
+                    state = SessionState.entries.getOrElse(v[o + 7].toInt()) {
+                        SessionState.ACTIVE
+                    },
+                    address = address,
+                    port = v[o + 9].toInt()
+                )
+            }
+        } catch (e: Exception) {
+            emptyList()
+        }
+    }
+
+    /**
+     * Take the milestones of traced sessions queued since the last call.
+     * Events of one session come oldest first.
+     */
+    fun takeTraces(): List<TraceEvent> {
+        if (!isLibraryLoaded || !isRunning()) return emptyList()
+
+        return try {
+            val v = nativeTakeTraces() ?: return emptyList()
+            List(v.size / TRACE_STRIDE) { i ->
+                val o = i * TRACE_STRIDE
+                TraceEvent(trace = v[o], timeUs = v[o + 1], milestone = v[o + 2].toInt())
+            }
+        } catch (e: Exception) {
+            emptyList()
+        }
+    }
+
     private fun buildConfig(
         socksAddress: String,
         socksPort: Int,
@@ -182,15 +403,23 @@ object HevSocks5Tunnel {
         sb.appendLine("tunnel:")
         sb.appendLine("  mtu: $mtu")
         sb.appendLine("  ipv4: $ipv4Address")
+        // Bulk uploads reach lwIP as one input per run of segments, not per packet.
+        sb.appendLine("  gro: true")
         sb.appendLine()
 
         sb.appendLine("socks5:")
         sb.appendLine("  address: $socksAddress")
         sb.appendLine("  port: $socksPort")
+        // Keep a few connections authenticated ahead, new flows only send CONNECT.
+        sb.appendLine("  pool-size: 4")
+        // The bridges listen on loopback, where Nagle only delays small writes.
+        sb.appendLine("  tcp-nodelay: true")
         // UDP tunneling via 'tcp' mode sends FWD_UDP (cmd 0x05) to the SOCKS5 proxy.
         // Supported by: SSH SOCKS5, DohBridge, SlipstreamSocksBridge, DNSTT (remote Dante).
         if (enableUdpTunneling) {
             sb.appendLine("  udp: '$udpMode'")
+            // Up to 16 flows to distinct destinations share one association.
+            sb.appendLine("  udp-mux: 16")
         }
 
         if (!socksUsername.isNullOrBlank() && !socksPassword.isNullOrBlank()) {
@@ -200,27 +429,171 @@ object HevSocks5Tunnel {
 
         sb.appendLine()
 
+        // One-shot lookups would otherwise hold a session for the full UDP timeout.
+        sb.appendLine("udp-timeout:")
+        sb.appendLine("  - port: 53")
+        sb.appendLine("    timeout: 5000")
+        sb.appendLine("    one-shot: true")
+        sb.appendLine("  - port: 123")
+        sb.appendLine("    timeout: 2000")
+        sb.appendLine("    one-shot: true")
+        sb.appendLine()
+
+        // Bypassed networks would only be proxied by a bridge that connects out directly.
+        bypassFile?.let {
+            sb.appendLine("bypass:")
+            sb.appendLine("  file: '$it'")
+            sb.appendLine()
+        }
+
         sb.appendLine("misc:")
         sb.appendLine("  task-stack-size: 32768")  // 32KB - sufficient for tun2socks, reduces memory
+        sb.appendLine("  task-stack-auto: true")  // Size session stacks from measured use
+        sb.appendLine("  session-bulk-rate: 1048576")  // Bulk flows (>1 MiB/s) yield to interactive ones
+        sb.appendLine("  memory-limit: 134217728")  // 128 MiB for all sessions, stalled upstreams can't balloon RSS
+        sb.appendLine("  session-memory-limit: 8388608")  // 8 MiB per session
         sb.appendLine("  connect-timeout: 8000")   // 8s connection timeout
         sb.appendLine("  tcp-read-write-timeout: 120000")  // 2min TCP timeout
         sb.appendLine("  udp-read-write-timeout: 60000")   // 60s UDP timeout (for DNS queries)
+        sb.appendLine("  tcp-time-wait: 1000")  // Private TUN link, no need to hold closed PCBs for 2 min
+        sb.appendLine("  tcp-ack-segments: 4")  // Fewer ACK writes on downloads, the rest go out per read batch
+        sb.appendLine("  timer-slack: 100")  // Let timers share wakeups, spares the battery
+        sb.appendLine("  thread-cpus: performance")  // Keep the tunnel off the little cores
+        sb.appendLine("  thread-nice: -4")  // As Android's display threads
+        sb.appendLine("  thread-util-min: 256")  // Hold the core above its lowest frequency
         sb.appendLine("  log-level: warning")  // Use 'debug' for troubleshooting
+        if (traceSample > 0) {
+            sb.appendLine("  trace-sample: $traceSample")
+        }
 
         return sb.toString()
     }
 
+    /** Upper bounds in ms of the connect latency buckets, the last one is open. */
+    val LATENCY_BOUNDS_MS = listOf(10L, 25L, 50L, 100L, 250L, 500L, 1000L)
+    private const val LATENCY_BUCKETS = 8
+
+    /** Task classes of [TrafficStats.taskRunTimeNs], in native order. */
+    val TASK_CLASS_NAMES = listOf("lwip-io", "lwip-timer", "tcp-session", "udp-session")
+    private const val TASK_CLASSES = 4
+
+    /** Room for the stats page values, more than any native build reports. */
+    private const val STATS_VALUES = 64
+
+    /**
+     * Counters only grow; rates such as accepts per second come from the
+     * difference of two snapshots. Sessions, PCBs, queued, segments,
+     * reference pbufs, reassembly bytes and memory used are gauges.
+     * [taskRunTimeNs] and [taskSwitches] split the tunnel threads' time by
+     * [TASK_CLASS_NAMES]; run times are estimates from sampled task runs.
+     */
     data class TrafficStats(
         val txPackets: Long,
         val txBytes: Long,
         val rxPackets: Long,
-        val rxBytes: Long
+        val rxBytes: Long,
+        val fwdWritevs: Long = 0,
+        val fwdBytes: Long = 0,
+        val tcpSessions: Long = 0,
+        val udpSessions: Long = 0,
+        val tcpAccepts: Long = 0,
+        val udpAccepts: Long = 0,
+        val evictions: Long = 0,
+        val quicRejects: Long = 0,
+        val filterDrops: Long = 0,
+        val connectFailures: Long = 0,
+        val connectLatency: List<Long> = List(LATENCY_BUCKETS) { 0L },
+        val tcpPcbs: Long = 0,
+        val tcpQueued: Long = 0,
+        val udpDrops: Long = 0,
+        val egressFlushes: Long = 0,
+        val connectIpv4: Long = 0,
+        val connectIpv4Msecs: Long = 0,
+        val connectIpv6: Long = 0,
+        val connectIpv6Msecs: Long = 0,
+        val connectFallbacks: Long = 0,
+        val tcpSegs: Long = 0,
+        val udpPcbs: Long = 0,
+        val refPbufs: Long = 0,
+        val poolRefusals: Long = 0,
+        val wakeups: Long = 0,
+        val reassBytes: Long = 0,
+        val reassDrops: Long = 0,
+        val memUsed: Long = 0,
+        val memEvictions: Long = 0,
+        val taskRunTimeNs: List<Long> = List(TASK_CLASSES) { 0L },
+        val taskSwitches: List<Long> = List(TASK_CLASSES) { 0L }
+    )
+
+    private const val SESSION_STRIDE = 12
+
+    /** Why a session ended, in native HevSocks5TunnelSessionState order. */
+    enum class SessionState {
+        ACTIVE,
+        CLOSED,
+        CONNECT_FAILED,
+        HANDSHAKE_FAILED,
+        IDLE,
+        EVICTED,
+        ABORTED
+    }
+
+    /**
+     * One flow; ACTIVE records are interim snapshots of the same [id].
+     * Bytes are cumulative, handshake and TTFB are -1 when not reached.
+     */
+    data class SessionRecord(
+        val id: Long,
+        val txBytes: Long,
+        val rxBytes: Long,
+        val durationMs: Long,
+        val handshakeMs: Long,
+        val ttfbMs: Long,
+        val udp: Boolean,
+        val state: SessionState,
+        val address: String,
+        val port: Int
+    )
+
+    private const val TRACE_STRIDE = 3
+
+    /**
+     * A milestone the session traced as [trace] (its [SessionRecord.id])
+     * reached at [timeUs], CLOCK_MONOTONIC in microseconds. See
+     * [FlowTraces.MILESTONE_NAMES] for the milestones of both engines.
+     */
+    data class TraceEvent(
+        val trace: Long,
+        val timeUs: Long,
+        val milestone: Int
+    )
+
+    /**
+     * A native `HevSocks5TunnelProvider` at [address] that opens streams to the
+     * SOCKS5 server behind an in-process tunnel, e.g. [SlipstreamBridge.streamProvider].
+     * The SOCKS5 handshake on those streams uses [username] and [password].
+     * Traced sessions open theirs through the `HevSocks5TunnelTraceProvider` at
+     * [traceAddress] instead when it is non-zero.
+     */
+    data class StreamProvider(
+        val address: Long,
+        val username: String?,
+        val password: String?,
+        val traceAddress: Long = 0L
     )
 
     // Native methods
     private external fun nativeStart(config: String, tunFd: Int): Int
     private external fun nativeStop()
+    private external fun nativeReplaceFd(tunFd: Int): Int
+    private external fun nativeReload(config: String): Int
     private external fun nativeSetRejectQuic(enabled: Boolean)
+    private external fun nativeSetProvider(address: Long, username: String?, password: String?)
+    private external fun nativeSetTraceProvider(address: Long)
+    private external fun nativeSetDatagramProvider(address: Long)
     private external fun nativeIsRunning(): Boolean
     private external fun nativeGetStats(): LongArray?
+    private external fun nativeGetStatsPage(): ByteBuffer?
+    private external fun nativeTakeSessions(): LongArray?
+    private external fun nativeTakeTraces(): LongArray?
 }
@@ -3,6 +3,7 @@ package app.slipnet.tunnel
 import android.net.VpnService
 import app.slipnet.util.AppLog as Log
 import java.lang.ref.WeakReference
+import java.nio.ByteBuffer
 
 /**
  * Bridge to the Rust slipstream client library.
@@ -25,8 +26,14 @@ object SlipstreamBridge {
     // In proxy-only mode there is no VPN interface, so protect() always returns
     // false.  That is harmless — no TUN exists to create a routing loop — so we
     // skip the protect call entirely and tell the Rust client "success".
+    // Pooled sockets were protected (or not) for the old mode, so a change of
+    // mode closes them.
     @Volatile
     var proxyOnlyMode = false
+        set(value) {
+            if (field != value && isLibraryLoaded) nativeDrainProtectedSockets()
+            field = value
+        }
 
     init {
         try {
@@ -44,10 +51,13 @@ object SlipstreamBridge {
     /**
      * Set the VpnService reference for socket protection.
      * Uses WeakReference to prevent memory leaks.
+     * Setting a service starts protecting UDP sockets for the client in the
+     * background, so starting it does not wait on protect().
      */
     fun setVpnService(service: VpnService?) {
         vpnServiceRef = service?.let { WeakReference(it) }
         Log.d(TAG, "VpnService ${if (service != null) "set" else "cleared"}")
+        if (service != null && isLibraryLoaded) nativePrefillProtectedSockets()
     }
 
     /**
@@ -79,6 +89,13 @@ object SlipstreamBridge {
      * @param gsoEnabled Enable Generic Segmentation Offload
      * @param debugPoll Enable debug logging for DNS polling
      * @param debugStreams Enable debug logging for streams
+     * @param sessionCacheDir Directory for TLS session tickets, so reconnects can resume
+     *        with 0-RTT; empty to disable
+     * @param threadCpus Cores for the client thread: "performance" to keep it off the
+     *        little cores, a list such as "4-7", or empty to leave it to the scheduler
+     * @param threadNice Nice level of the client thread, 0 to keep it
+     * @param threadUtilMin Scheduler utilization hint (0 to 1024) that holds the
+     *        thread's core above its lowest frequency, 0 to disable
      */
     fun startClient(
         domain: String,
@@ -90,7 +107,11 @@ object SlipstreamBridge {
         gsoEnabled: Boolean = false,
         debugPoll: Boolean = false,
         debugStreams: Boolean = false,
-        idlePollIntervalMs: Int = 2000
+        idlePollIntervalMs: Int = 2000,
+        sessionCacheDir: String = "",
+        threadCpus: String = "performance",
+        threadNice: Int = -4,
+        threadUtilMin: Int = 256
     ): Result<Unit> {
         if (!isLibraryLoaded) {
             return Result.failure(IllegalStateException("Native library not loaded"))
@@ -128,6 +149,10 @@ object SlipstreamBridge {
             Log.i(TAG, "Starting slipstream client on $tcpListenHost:$actualPort, domain=$domain")
             currentPort = actualPort
 
+            if (!nativeSetThreadPlacement(threadCpus, threadNice, threadUtilMin)) {
+                Log.w(TAG, "Ignoring thread placement cpus=$threadCpus")
+            }
+
             val result = nativeStartSlipstreamClient(
                 domain = domain,
                 resolverHosts = resolvers.map { it.host }.toTypedArray(),
@@ -140,7 +165,8 @@ object SlipstreamBridge {
                 gsoEnabled = gsoEnabled,
                 debugPoll = debugPoll,
                 debugStreams = debugStreams,
-                idlePollInterval = idlePollIntervalMs
+                idlePollInterval = idlePollIntervalMs,
+                sessionCacheDir = sessionCacheDir
             )
 
             when (result) {
@@ -211,6 +237,7 @@ object SlipstreamBridge {
      */
     fun isClientRunning(): Boolean {
         if (!isLibraryLoaded) return false
+        withStatsPage { count, _ -> count > 0 }?.let { return it }
         return try {
             nativeIsClientRunning()
         } catch (e: Exception) {
@@ -219,6 +246,22 @@ object SlipstreamBridge {
         }
     }
 
+    /**
+     * Move the running client to the current network without reconnecting.
+     * Its sockets are replaced; the QUIC connection, streams and congestion
+     * state are kept. False when no client runs or the native library predates
+     * this, in which case the caller restarts the client instead.
+     */
+    fun networkChanged(): Boolean {
+        if (!isLibraryLoaded) return false
+        return try {
+            nativeNetworkChanged()
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native network change unavailable", e)
+            false
+        }
+    }
+
     /**
      * Check if the client is running AND the port is actually listening.
      * Use this for health checks after connection is established.
@@ -280,12 +323,73 @@ object SlipstreamBridge {
         gsoEnabled: Boolean,
         debugPoll: Boolean,
         debugStreams: Boolean,
-        idlePollInterval: Int
+        idlePollInterval: Int,
+        sessionCacheDir: String
     ): Int
 
     private external fun nativeStopSlipstreamClient()
     private external fun nativeIsClientRunning(): Boolean
+    private external fun nativeNetworkChanged(): Boolean
     private external fun nativeIsQuicReady(): Boolean
+    private external fun nativeSetTelemetryInterval(intervalMs: Int)
+    private external fun nativeSetThreadPlacement(cpus: String, nice: Int, utilMin: Int): Boolean
+    private external fun nativeDrainTelemetry(): LongArray?
+    private external fun nativeGetStreamProvider(): Long
+    private external fun nativeGetTraceStreamProvider(): Long
+    private external fun nativeGetDatagramProvider(): Long
+    private external fun nativeTakeTraces(): LongArray?
+    private external fun nativeGetStatsPage(): ByteBuffer?
+    private external fun nativePrefillProtectedSockets()
+    private external fun nativeDrainProtectedSockets()
+    private external fun nativeStartDoh3(
+        server: String,
+        port: Int,
+        authority: String,
+        path: String,
+        certRoots: String,
+        ticketFile: String
+    ): Boolean
+    private external fun nativeQueryDoh3(query: ByteArray, timeoutMs: Int): ByteArray?
+    private external fun nativeStopDoh3()
+    private external fun nativeScanResolvers(
+        hosts: Array<String>,
+        port: Int,
+        domain: String,
+        timeoutMs: Int,
+        concurrency: Int,
+        samples: Int,
+        listener: ResolverScanListener
+    ): Boolean
+
+    /**
+     * Page the native client mirrors its state flags in, so the health polls
+     * above need no JNI call. Null with an older native library.
+     */
+    private val statsPage: StatsPage? by lazy {
+        if (!isLibraryLoaded) return@lazy null
+        try {
+            nativeGetStatsPage()?.let { StatsPage(it) }
+        } catch (e: UnsatisfiedLinkError) {
+            null
+        }
+    }
+
+    // Page values: listener ready, QUIC ready, consecutive failures, QUIC connects.
+    private const val PAGE_QUIC_READY = 1
+    private val statsValues = LongArray(8)
+
+    /**
+     * Run [block] on a snapshot of the stats page, with the number of values
+     * (0 while the client is not running) and the values.
+     * @return null if the page is unavailable and JNI has to answer instead
+     */
+    private inline fun <T> withStatsPage(block: (Int, LongArray) -> T): T? {
+        val page = statsPage ?: return null
+        synchronized(statsValues) {
+            val count = page.read(statsValues)
+            return if (count >= 0) block(count, statsValues) else null
+        }
+    }
 
     /**
      * Check if the native client reports it's running (alias for isClientRunning).
@@ -299,6 +403,8 @@ object SlipstreamBridge {
      */
     fun isQuicReady(): Boolean {
         if (!isLibraryLoaded) return false
+        withStatsPage { count, v -> count > PAGE_QUIC_READY && v[PAGE_QUIC_READY] != 0L }
+            ?.let { return it }
         return try {
             nativeIsQuicReady()
         } catch (e: Exception) {
@@ -306,4 +412,222 @@ object SlipstreamBridge {
             false
         }
     }
+
+    /**
+     * Address of the native function that opens a QUIC stream in-process, for
+     * [HevSocks5Tunnel.StreamProvider]. 0 when the library is not loaded.
+     */
+    fun streamProvider(): Long {
+        if (!isLibraryLoaded) return 0L
+        return try {
+            nativeGetStreamProvider()
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native stream provider unavailable", e)
+            0L
+        }
+    }
+
+    /**
+     * Address of the native function that opens a QUIC stream for a traced
+     * session, for [HevSocks5Tunnel.StreamProvider.traceAddress]. 0 when the
+     * library is not loaded.
+     */
+    fun traceStreamProvider(): Long {
+        if (!isLibraryLoaded) return 0L
+        return try {
+            nativeGetTraceStreamProvider()
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native trace stream provider unavailable", e)
+            0L
+        }
+    }
+
+    /**
+     * Take the stream milestones the client recorded for traced sessions,
+     * under hev's trace IDs and on its clock.
+     */
+    fun takeTraces(): List<HevSocks5Tunnel.TraceEvent> {
+        if (!isLibraryLoaded) return emptyList()
+        val flat = try {
+            nativeTakeTraces()
+        } catch (e: Exception) {
+            Log.e(TAG, "Error taking traces", e)
+            null
+        } ?: return emptyList()
+        return (0 until flat.size / 3).map { i ->
+            HevSocks5Tunnel.TraceEvent(
+                trace = flat[i * 3],
+                timeUs = flat[i * 3 + 1],
+                milestone = flat[i * 3 + 2].toInt()
+            )
+        }
+    }
+
+    /**
+     * Address of the native function that hands UDP sessions a socket carried in
+     * QUIC datagrams, for [HevSocks5Tunnel.start]. 0 when the library is not loaded.
+     */
+    fun datagramProvider(): Long {
+        if (!isLibraryLoaded) return 0L
+        return try {
+            nativeGetDatagramProvider()
+        } catch (e: UnsatisfiedLinkError) {
+            Log.e(TAG, "Native datagram provider unavailable", e)
+            0L
+        }
+    }
+
+    /**
+     * One congestion control sample for a QUIC path, as recorded by the native
+     * client. Loss and packet counters are cumulative; every packet on a path
+     * is one DNS query, so the [packetsSent] delta is the poll cadence.
+     */
+    data class PathTelemetrySample(
+        val timeUs: Long,
+        val pathId: Long,
+        val cwin: Long,
+        val pacingRate: Long,
+        val rttMinUs: Long,
+        val smoothedRttUs: Long,
+        val bytesInTransit: Long,
+        val losses: Long,
+        val timerLosses: Long,
+        val spuriousLosses: Long,
+        val packetsSent: Long,
+        val notification: Int,
+        val pathMode: Int
+    )
+
+    private const val TELEMETRY_SAMPLE_FIELDS = 13
+
+    /**
+     * Set the per-path telemetry sampling interval; 0 disables sampling.
+     * Samples queue in a fixed-size native ring and are dropped when it is full,
+     * so call [drainTelemetry] at least once per second while graphs are shown.
+     */
+    fun setTelemetryInterval(intervalMs: Int) {
+        if (!isLibraryLoaded) return
+        try {
+            nativeSetTelemetryInterval(intervalMs)
+        } catch (e: Exception) {
+            Log.e(TAG, "Error setting telemetry interval", e)
+        }
+    }
+
+    /**
+     * Start the native DNS over HTTP/3 upstream, replacing any running one.
+     * [server] is the address to dial, [authority] the name its certificate
+     * is checked against with the PEM roots in [certRoots]. Session tickets
+     * for 0-RTT go to [ticketFile] when it is not empty.
+     */
+    fun startDoh3(
+        server: String,
+        port: Int,
+        authority: String,
+        path: String,
+        certRoots: String,
+        ticketFile: String
+    ): Boolean {
+        if (!isLibraryLoaded) return false
+        return try {
+            nativeStartDoh3(server, port, authority, path, certRoots, ticketFile)
+        } catch (e: Throwable) {
+            // UnsatisfiedLinkError with an older native library.
+            Log.e(TAG, "Error starting DoH3 upstream", e)
+            false
+        }
+    }
+
+    /**
+     * Resolve [query] over HTTP/3. Null when no upstream runs, the server is
+     * unreachable or no answer came within [timeoutMs].
+     */
+    fun queryDoh3(query: ByteArray, timeoutMs: Int): ByteArray? {
+        if (!isLibraryLoaded) return null
+        return try {
+            nativeQueryDoh3(query, timeoutMs)
+        } catch (e: Throwable) {
+            Log.e(TAG, "Error querying DoH3 upstream", e)
+            null
+        }
+    }
+
+    fun stopDoh3() {
+        if (!isLibraryLoaded) return
+        try {
+            nativeStopDoh3()
+        } catch (e: Throwable) {
+            Log.e(TAG, "Error stopping DoH3 upstream", e)
+        }
+    }
+
+    /** Receives native resolver scan results; return false to stop the scan. */
+    fun interface ResolverScanListener {
+        fun onScanResult(index: Int, status: Int, timeMs: Long, rcode: Int, answer: String?): Boolean
+    }
+
+    const val SCAN_WORKING = 0
+    const val SCAN_CENSORED = 1
+    const val SCAN_ERROR = 2
+    const val SCAN_TIMEOUT = 3
+
+    /**
+     * Probe [hosts], IP addresses, for resolvers answering an A query for
+     * [domain], [concurrency] at a time from one native thread with batched
+     * UDP. Each host gets a warm-up query and [samples] measured ones (with
+     * none, the warm-up is timed); [listener] gets each host's index, SCAN_*
+     * status, median RTT (or time taken), response code and A answer as they
+     * are known. Blocks until done.
+     * Returns false when the scan could not run to the end, in which case
+     * hosts not reported have no result.
+     */
+    fun scanResolvers(
+        hosts: Array<String>,
+        port: Int,
+        domain: String,
+        timeoutMs: Int,
+        concurrency: Int,
+        samples: Int,
+        listener: ResolverScanListener
+    ): Boolean {
+        if (!isLibraryLoaded) return false
+        return try {
+            nativeScanResolvers(hosts, port, domain, timeoutMs, concurrency, samples, listener)
+        } catch (e: Throwable) {
+            // UnsatisfiedLinkError with an older native library.
+            Log.e(TAG, "Error running native resolver scan", e)
+            false
+        }
+    }
+
+    /**
+     * Drain the telemetry samples queued since the last call, oldest first.
+     */
+    fun drainTelemetry(): List<PathTelemetrySample> {
+        if (!isLibraryLoaded) return emptyList()
+        val flat = try {
+            nativeDrainTelemetry()
+        } catch (e: Exception) {
+            Log.e(TAG, "Error draining telemetry", e)
+            null
+        } ?: return emptyList()
+        return (0 until flat.size / TELEMETRY_SAMPLE_FIELDS).map { i ->
+            val base = i * TELEMETRY_SAMPLE_FIELDS
+            PathTelemetrySample(
+                timeUs = flat[base],
+                pathId = flat[base + 1],
+                cwin = flat[base + 2],
+                pacingRate = flat[base + 3],
+                rttMinUs = flat[base + 4],
+                smoothedRttUs = flat[base + 5],
+                bytesInTransit = flat[base + 6],
+                losses = flat[base + 7],
+                timerLosses = flat[base + 8],
+                spuriousLosses = flat[base + 9],
+                packetsSent = flat[base + 10],
+                notification = flat[base + 11].toInt(),
+                pathMode = flat[base + 12].toInt()
+            )
+        }
+    }
 }
@@ -0,0 +1,58 @@
+package app.slipnet.tunnel
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Reader for a stats page that a native engine keeps publishing into memory
+ * it hands out once as a direct buffer, so polling its stats costs no JNI
+ * call and no allocation.
+ *
+ * Pages share one layout: a seqlock sequence at byte 0 (odd while the engine
+ * writes), a running flag at 4, a version at 8, the size of everything from
+ * byte 8 on at 12, then the values as 64-bit counters from byte 16.
+ */
+internal class StatsPage(buffer: ByteBuffer) {
+    private val page = buffer.order(ByteOrder.nativeOrder())
+
+    // ART turns a volatile store and load into a release store followed by
+    // an acquire load, which keeps the plain buffer reads on either side in
+    // program order, as the seqlock needs.
+    @Volatile private var fence = 0
+
+    private fun barrier(): Int {
+        fence = 0
+        return fence
+    }
+
+    /**
+     * Copy the values of one consistent snapshot into [into].
+     *
+     * @return the number of values copied, 0 if the engine is not running,
+     *         or -1 if it kept rewriting the page while it was read
+     */
+    fun read(into: LongArray): Int {
+        repeat(MAX_RETRIES) {
+            val seq = page.getInt(0)
+            barrier()
+            if (seq and 1 == 0) {
+                val running = page.getInt(4) != 0
+                val count = minOf(
+                    into.size,
+                    (page.getInt(12) - 8).coerceAtLeast(0) / 8,
+                    (page.capacity() - 16) / 8
+                )
+                for (i in 0 until count) into[i] = page.getLong(16 + i * 8)
+                barrier()
+                if (page.getInt(0) == seq) return if (running) count else 0
+            }
+            Thread.yield()
+        }
+        return -1
+    }
+
+    private companion object {
+        // An update is a few hundred bytes of stores, so this is plenty.
+        const val MAX_RETRIES = 16
+    }
+}
@@ -3,21 +3,41 @@
 //! This module provides the JNI interface for the Android VPN app, including:
 //! - Client lifecycle management (start/stop)
 //! - State flags (running, listener ready, QUIC ready)
-//! - Socket protection via VpnService.protect()
+//! - Socket protection via VpnService.protect(), with a pool of UDP sockets
+//!   protected ahead of use
+//! - Per-path congestion telemetry for live graphs
+//! - A stats page the app reads without JNI calls
+//! - The in-process stream provider for hev-socks5-tunnel
+//! - CPU placement of the client thread
+//! - The DNS over HTTP/3 upstream of the DoH tunnel
+//! - The resolver scanner
 
 use crate::error::ClientError;
+use crate::placement::{CpuSelection, ThreadPlacement};
 use crate::runtime::run_client;
-use jni::objects::{JBooleanArray, JClass, JIntArray, JObject, JObjectArray, JString, JValue};
-use jni::sys::{jboolean, jbooleanArray, jint, jintArray, JNI_FALSE, JNI_TRUE};
+use crate::runtime::setup::{new_udp_socket, UDP_BIND_ADDR};
+use crate::runtime::socket_pool::ProtectedSocketPool;
+use crate::scan::{scan_resolvers, ScanConfig, ScanStatus};
+use jni::objects::{
+    JBooleanArray, JByteArray, JClass, JIntArray, JObject, JObjectArray, JString, JValue,
+};
+use jni::sys::{
+    jboolean, jbooleanArray, jbyteArray, jint, jintArray, jlong, jlongArray, jobject, JNI_FALSE,
+    JNI_TRUE,
+};
 use jni::JNIEnv;
 use once_cell::sync::OnceCell;
 use slipstream_core::HostPort;
-use slipstream_ffi::{ClientConfig, ResolverMode, ResolverSpec};
-use std::os::unix::io::RawFd;
+use slipstream_ffi::{ClientConfig, Doh3Client, ResolverMode, ResolverSpec, ResolverTransport};
+use socket2::Socket;
+use std::net::{IpAddr, SocketAddr};
+use std::os::unix::io::{AsRawFd, RawFd};
 use std::panic;
-use std::sync::atomic::{AtomicBool, AtomicI32, Ordering};
-use std::sync::Mutex;
+use std::path::Path;
+use std::sync::atomic::{fence, AtomicBool, AtomicI32, AtomicU32, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
 use std::thread::{self, JoinHandle};
+use std::time::Duration;
 use tokio::runtime::Builder;
 use tracing::{debug, error, info, warn};
 
@@ -43,15 +63,66 @@ static IS_THREAD_DONE: AtomicBool = AtomicBool::new(true);
 /// Count of consecutive connection failures (connections that never became ready).
 static CONSECUTIVE_FAILURES: AtomicI32 = AtomicI32::new(0);
 
+/// Times the QUIC connection became ready in this run, so reconnects show up.
+static QUIC_CONNECTS: AtomicU64 = AtomicU64::new(0);
+
 /// Maximum consecutive failures before giving up.
 const MAX_CONSECUTIVE_FAILURES: i32 = 5;
 
+/// UDP sockets protected ahead of the client binding one.
+static PROTECTED_SOCKETS: ProtectedSocketPool = ProtectedSocketPool::new();
+
+/// Protected sockets kept ready: one for the next client start, one spare
+/// for a start that follows straight after.
+const PROTECTED_SOCKET_POOL_SIZE: usize = 2;
+
 /// Handle to the client thread.
 static CLIENT_THREAD: Mutex<Option<JoinHandle<()>>> = Mutex::new(None);
 
+/// Placement the client thread applies to itself when it starts.
+static THREAD_PLACEMENT: Mutex<ThreadPlacement> = Mutex::new(ThreadPlacement {
+    cpus: CpuSelection::Any,
+    nice: 0,
+    util_min: 0,
+});
+
 /// Global JVM reference for callbacks.
 static JAVA_VM: OnceCell<jni::JavaVM> = OnceCell::new();
 
+/// Layout version of `StatsPage`; values are only ever appended.
+const STATS_PAGE_VERSION: u32 = 1;
+
+/// Client state for `nativeGetStatsPage`, in the page layout the app's
+/// `StatsPage` reader expects: a seqlock sequence, odd while being written,
+/// a running flag, the version and the size from `version` on, then 64-bit
+/// values.
+#[repr(C, align(64))]
+struct StatsPage {
+    seq: AtomicU32,
+    running: AtomicU32,
+    version: AtomicU32,
+    size: AtomicU32,
+    listener_ready: AtomicU64,
+    quic_ready: AtomicU64,
+    consecutive_failures: AtomicU64,
+    quic_connects: AtomicU64,
+}
+
+static STATS_PAGE: StatsPage = StatsPage {
+    seq: AtomicU32::new(0),
+    running: AtomicU32::new(0),
+    version: AtomicU32::new(0),
+    size: AtomicU32::new(0),
+    listener_ready: AtomicU64::new(0),
+    quic_ready: AtomicU64::new(0),
+    consecutive_failures: AtomicU64::new(0),
+    quic_connects: AtomicU64::new(0),
+};
+
+/// Serializes writers of `STATS_PAGE`, which change state from the JNI and
+/// the client threads.
+static STATS_PAGE_WRITER: Mutex<()> = Mutex::new(());
+
 /// Cached global reference to SlipstreamBridge class.
 /// This is needed because native threads can't find app classes via the system class loader.
 static BRIDGE_CLASS: OnceCell<jni::objects::GlobalRef> = OnceCell::new();
@@ -60,6 +131,42 @@ static BRIDGE_CLASS: OnceCell<jni::objects::GlobalRef> = OnceCell::new();
 // Public API for Rust code
 // ============================================================================
 
+/// Copy the state flags into the stats page. Called after every change of
+/// them, which is rare, so readers never need to ask over JNI.
+fn publish_stats() {
+    let _guard = STATS_PAGE_WRITER.lock().unwrap_or_else(|e| e.into_inner());
+    let page = &STATS_PAGE;
+    let seq = page.seq.load(Ordering::Relaxed);
+
+    page.seq.store(seq.wrapping_add(1), Ordering::Relaxed);
+    fence(Ordering::Release);
+
+    page.running
+        .store(IS_RUNNING.load(Ordering::SeqCst) as u32, Ordering::Relaxed);
+    page.version.store(STATS_PAGE_VERSION, Ordering::Relaxed);
+    page.size.store(
+        (std::mem::offset_of!(StatsPage, quic_connects) + 8
+            - std::mem::offset_of!(StatsPage, version)) as u32,
+        Ordering::Relaxed,
+    );
+    page.listener_ready.store(
+        IS_LISTENER_READY.load(Ordering::SeqCst) as u64,
+        Ordering::Relaxed,
+    );
+    page.quic_ready.store(
+        IS_QUIC_READY.load(Ordering::SeqCst) as u64,
+        Ordering::Relaxed,
+    );
+    page.consecutive_failures.store(
+        CONSECUTIVE_FAILURES.load(Ordering::SeqCst).max(0) as u64,
+        Ordering::Relaxed,
+    );
+    page.quic_connects
+        .store(QUIC_CONNECTS.load(Ordering::SeqCst), Ordering::Relaxed);
+
+    page.seq.store(seq.wrapping_add(2), Ordering::Release);
+}
+
 /// Check if the client should shut down.
 pub fn should_shutdown() -> bool {
     SHOULD_SHUTDOWN.load(Ordering::SeqCst)
@@ -68,6 +175,7 @@ pub fn should_shutdown() -> bool {
 /// Signal that the TCP listener is ready.
 pub fn signal_listener_ready() {
     IS_LISTENER_READY.store(true, Ordering::SeqCst);
+    publish_stats();
     info!("TCP listener is ready");
 }
 
@@ -75,18 +183,22 @@ pub fn signal_listener_ready() {
 pub fn signal_quic_ready() {
     IS_QUIC_READY.store(true, Ordering::SeqCst);
     CONSECUTIVE_FAILURES.store(0, Ordering::SeqCst);
+    QUIC_CONNECTS.fetch_add(1, Ordering::SeqCst);
+    publish_stats();
     info!("QUIC connection is ready");
 }
 
 /// Reset the QUIC ready flag (called on reconnect).
 pub fn reset_quic_ready() {
     IS_QUIC_READY.store(false, Ordering::SeqCst);
+    publish_stats();
     debug!("QUIC ready flag reset for reconnection");
 }
 
 /// Record a connection failure (connection that never became ready).
 pub fn record_connection_failure() {
     let failures = CONSECUTIVE_FAILURES.fetch_add(1, Ordering::SeqCst) + 1;
+    publish_stats();
     warn!("Connection failure recorded, total: {}", failures);
 }
 
@@ -126,12 +238,7 @@ pub fn protect_socket(fd: RawFd) -> bool {
     // Call SlipstreamBridge.protectSocket(fd) using cached class reference
     // Safety: GlobalRef holds a valid JNI reference, converting to JClass is safe
     let class = unsafe { JClass::from_raw(class_ref.as_raw()) };
-    let result = env.call_static_method(
-        class,
-        "protectSocket",
-        "(I)Z",
-        &[JValue::Int(fd)],
-    );
+    let result = env.call_static_method(class, "protectSocket", "(I)Z", &[JValue::Int(fd)]);
 
     match result {
         Ok(val) => {
@@ -152,6 +259,59 @@ pub fn protect_socket(fd: RawFd) -> bool {
     }
 }
 
+/// Returns a protected UDP socket bound to `addr`, from the pool when one is
+/// ready, and starts refilling the pool in the background.
+pub(crate) fn protected_udp_socket(addr: SocketAddr) -> Result<Socket, ClientError> {
+    if addr == UDP_BIND_ADDR {
+        if let Some(socket) = PROTECTED_SOCKETS.take() {
+            info!(
+                "Using pre-protected UDP socket fd={} for DNS queries",
+                socket.as_raw_fd()
+            );
+            refill_protected_sockets();
+            return Ok(socket);
+        }
+    }
+    let socket = new_udp_socket(addr)?;
+    let fd = socket.as_raw_fd();
+    info!("Protecting UDP socket fd={} for DNS queries", fd);
+    if !protect_socket(fd) {
+        return Err(ClientError::new(
+            "Failed to protect UDP socket - DNS queries will fail due to routing loop",
+        ));
+    }
+    info!("UDP socket fd={} protected successfully", fd);
+    refill_protected_sockets();
+    Ok(socket)
+}
+
+/// Tops the protected socket pool up on a background thread, unless a refill
+/// is already running.
+fn refill_protected_sockets() {
+    let Some(generation) = PROTECTED_SOCKETS.begin_refill() else {
+        return;
+    };
+    let spawned = thread::Builder::new()
+        .name("slipstream-protect".to_string())
+        .spawn(move || {
+            let added = PROTECTED_SOCKETS.refill(generation, PROTECTED_SOCKET_POOL_SIZE, || {
+                let socket = match new_udp_socket(UDP_BIND_ADDR) {
+                    Ok(socket) => socket,
+                    Err(e) => {
+                        warn!("Failed to create UDP socket for the pool: {}", e);
+                        return None;
+                    }
+                };
+                protect_socket(socket.as_raw_fd()).then_some(socket)
+            });
+            debug!("Protected socket pool refilled with {} sockets", added);
+        });
+    if let Err(e) = spawned {
+        warn!("Failed to spawn protected socket refill: {:?}", e);
+        PROTECTED_SOCKETS.end_refill();
+    }
+}
+
 // ============================================================================
 // JNI Functions
 // ============================================================================
@@ -208,6 +368,7 @@ pub extern "system" fn JNI_OnLoad(vm: jni::JavaVM, _: *mut std::ffi::c_void) ->
 /// - gsoEnabled: Enable Generic Segmentation Offload
 /// - debugPoll: Enable debug logging for DNS polling
 /// - debugStreams: Enable debug logging for streams
+/// - sessionCacheDir: Directory for session tickets and address tokens, empty to disable
 ///
 /// # Returns
 /// - 0: Success
@@ -217,7 +378,9 @@ pub extern "system" fn JNI_OnLoad(vm: jni::JavaVM, _: *mut std::ffi::c_void) ->
 /// - -11: Failed to listen on port
 /// - -12: Exceeded max connection failures
 #[no_mangle]
-pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStartSlipstreamClient<'local>(
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStartSlipstreamClient<
+    'local,
+>(
     mut env: JNIEnv<'local>,
     _class: JClass<'local>,
     domain: JString<'local>,
@@ -232,6 +395,7 @@ pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStartSlips
     debug_poll: jboolean,
     debug_streams: jboolean,
     idle_poll_interval: jint,
+    session_cache_dir: JString<'local>,
 ) -> jint {
     // Catch panics to prevent crashes
     let result = panic::catch_unwind(panic::AssertUnwindSafe(|| {
@@ -249,6 +413,7 @@ pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStartSlips
             debug_poll,
             debug_streams,
             idle_poll_interval,
+            session_cache_dir,
         )
     }));
 
@@ -257,6 +422,7 @@ pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStartSlips
         Err(e) => {
             error!("Panic in nativeStartSlipstreamClient: {:?}", e);
             IS_RUNNING.store(false, Ordering::SeqCst);
+            publish_stats();
             -100
         }
     }
@@ -276,6 +442,7 @@ fn start_client_impl<'local>(
     debug_poll: jboolean,
     debug_streams: jboolean,
     idle_poll_interval: jint,
+    session_cache_dir: JString<'local>,
 ) -> jint {
     info!("nativeStartSlipstreamClient called");
 
@@ -290,18 +457,16 @@ fn start_client_impl<'local>(
     if BRIDGE_CLASS.get().is_none() {
         let class_name = "app/slipnet/tunnel/SlipstreamBridge";
         match env.find_class(class_name) {
-            Ok(class) => {
-                match env.new_global_ref(class) {
-                    Ok(global_ref) => {
-                        let _ = BRIDGE_CLASS.set(global_ref);
-                        info!("Cached SlipstreamBridge class for callbacks");
-                    }
-                    Err(e) => {
-                        error!("Failed to create global ref for SlipstreamBridge: {:?}", e);
-                        return -3;
-                    }
+            Ok(class) => match env.new_global_ref(class) {
+                Ok(global_ref) => {
+                    let _ = BRIDGE_CLASS.set(global_ref);
+                    info!("Cached SlipstreamBridge class for callbacks");
                 }
-            }
+                Err(e) => {
+                    error!("Failed to create global ref for SlipstreamBridge: {:?}", e);
+                    return -3;
+                }
+            },
             Err(e) => {
                 error!("Failed to find SlipstreamBridge class: {:?}", e);
                 return -3;
@@ -331,6 +496,7 @@ fn start_client_impl<'local>(
     IS_QUIC_READY.store(false, Ordering::SeqCst);
     IS_THREAD_DONE.store(false, Ordering::SeqCst);
     CONSECUTIVE_FAILURES.store(0, Ordering::SeqCst);
+    QUIC_CONNECTS.store(0, Ordering::SeqCst);
 
     // Extract domain
     let domain_str: String = match env.get_string(&domain) {
@@ -363,7 +529,25 @@ fn start_client_impl<'local>(
             return -2;
         }
     };
-    let cc_option = if cc_str.is_empty() { None } else { Some(cc_str) };
+    let cc_option = if cc_str.is_empty() {
+        None
+    } else {
+        Some(cc_str)
+    };
+
+    // Extract session cache directory
+    let session_cache_str: String = match env.get_string(&session_cache_dir) {
+        Ok(s) => s.into(),
+        Err(e) => {
+            error!("Failed to get session cache directory string: {:?}", e);
+            return -2;
+        }
+    };
+    let session_cache_option = if session_cache_str.is_empty() {
+        None
+    } else {
+        Some(session_cache_str)
+    };
 
     // Extract resolver configuration
     let resolver_count = match env.get_array_length(&resolver_hosts) {
@@ -434,6 +618,7 @@ fn start_client_impl<'local>(
                 family: slipstream_core::AddressFamily::V4,
             },
             mode,
+            transport: ResolverTransport::Udp,
         });
     }
 
@@ -444,6 +629,7 @@ fn start_client_impl<'local>(
 
     // Mark as running
     IS_RUNNING.store(true, Ordering::SeqCst);
+    publish_stats();
 
     // Spawn client thread
     let listen_port_u16 = listen_port as u16;
@@ -467,6 +653,7 @@ fn start_client_impl<'local>(
                 dbg_poll,
                 dbg_streams,
                 idle_poll_ms,
+                session_cache_option,
             );
         });
 
@@ -500,6 +687,7 @@ fn start_client_impl<'local>(
         Err(e) => {
             error!("Failed to spawn client thread: {:?}", e);
             IS_RUNNING.store(false, Ordering::SeqCst);
+            publish_stats();
             -10
         }
     }
@@ -516,9 +704,16 @@ fn run_client_thread(
     debug_poll: bool,
     debug_streams: bool,
     idle_poll_interval_ms: u64,
+    session_cache_dir: Option<String>,
 ) {
     info!("Client thread started");
 
+    let placement = THREAD_PLACEMENT
+        .lock()
+        .unwrap_or_else(|e| e.into_inner())
+        .clone();
+    placement.apply();
+
     let result = panic::catch_unwind(panic::AssertUnwindSafe(|| {
         let config = ClientConfig {
             tcp_listen_host: &listen_host,
@@ -532,6 +727,16 @@ fn run_client_thread(
             debug_poll,
             debug_streams,
             idle_poll_interval_ms,
+            session_cache_dir: session_cache_dir.as_deref(),
+            // Off until servers run a version that splits batched queries.
+            batch_uplink: false,
+            hedge_polls: false,
+            // Off until servers run a version that answers NULL queries and
+            // the multi-answer marker.
+            probe_encodings: false,
+            // Off until servers run a version that issues CID slots.
+            compact_headers: false,
+            connections: 1,
         };
 
         // Build tokio runtime
@@ -566,6 +771,7 @@ fn run_client_thread(
     IS_RUNNING.store(false, Ordering::SeqCst);
     IS_LISTENER_READY.store(false, Ordering::SeqCst);
     IS_QUIC_READY.store(false, Ordering::SeqCst);
+    publish_stats();
     IS_THREAD_DONE.store(true, Ordering::SeqCst);
 
     info!("Client thread finished");
@@ -574,8 +780,8 @@ fn run_client_thread(
 /// Run the client with socket protection.
 /// This wraps run_client and ensures the UDP socket is protected.
 async fn run_client_with_protection(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
-    // The socket protection happens inside the modified bind_udp_socket function
-    // which calls protect_socket() after creating the socket.
+    // The socket protection happens inside bind_udp_socket, which takes a
+    // socket from the protected pool or calls protect_socket() on a new one.
     run_client(config).await
 }
 
@@ -619,10 +825,47 @@ pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStopSlipst
     IS_RUNNING.store(false, Ordering::SeqCst);
     IS_LISTENER_READY.store(false, Ordering::SeqCst);
     IS_QUIC_READY.store(false, Ordering::SeqCst);
+    publish_stats();
 
     info!("Client stopped");
 }
 
+/// Start filling the protected socket pool, once the VpnService is set, so
+/// the next client start binds without a JNI round trip.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativePrefillProtectedSockets(
+    _env: JNIEnv,
+    _class: JClass,
+) {
+    refill_protected_sockets();
+}
+
+/// Close the pooled protected sockets, e.g. when protection changes mode.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeDrainProtectedSockets(
+    _env: JNIEnv,
+    _class: JClass,
+) {
+    PROTECTED_SOCKETS.drain();
+    info!("Protected socket pool drained");
+}
+
+/// Move the running client to the current network, keeping its QUIC
+/// connections. Returns false when no client runs, for the caller to start
+/// one instead.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeNetworkChanged(
+    _env: JNIEnv,
+    _class: JClass,
+) -> jboolean {
+    if !IS_RUNNING.load(Ordering::SeqCst) {
+        return JNI_FALSE;
+    }
+    crate::runtime::network::network_changed();
+    info!("Network change passed to the client");
+    JNI_TRUE
+}
+
 /// Check if the client is running.
 #[no_mangle]
 pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeIsClientRunning(
@@ -649,6 +892,403 @@ pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeIsQuicRead
     }
 }
 
+/// Address of `slipstream_client_open_stream`, for handing to the native
+/// tun2socks engine so its sessions open streams in-process.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeGetStreamProvider(
+    _env: JNIEnv,
+    _class: JClass,
+) -> jlong {
+    crate::provider::slipstream_client_open_stream as usize as jlong
+}
+
+/// Address of `slipstream_client_open_traced_stream`, the engine's provider
+/// of streams for the sessions it traces.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeGetTraceStreamProvider(
+    _env: JNIEnv,
+    _class: JClass,
+) -> jlong {
+    crate::provider::slipstream_client_open_traced_stream as usize as jlong
+}
+
+/// Address of `slipstream_client_open_datagrams`, the engine's provider of
+/// UDP sessions carried in QUIC datagrams.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeGetDatagramProvider(
+    _env: JNIEnv,
+    _class: JClass,
+) -> jlong {
+    crate::provider::slipstream_client_open_datagrams as usize as jlong
+}
+
+/// The stats page as a direct buffer, the same memory on every call. The
+/// client runs in the app process, so static memory is as shared as a
+/// memfd mapping would be.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeGetStatsPage(
+    mut env: JNIEnv,
+    _class: JClass,
+) -> jobject {
+    let page = &STATS_PAGE as *const StatsPage as *mut u8;
+    // Safety: the page is static and the app only ever reads it.
+    match unsafe { env.new_direct_byte_buffer(page, std::mem::size_of::<StatsPage>()) } {
+        Ok(buffer) => buffer.into_raw(),
+        Err(e) => {
+            error!("Failed to wrap stats page: {:?}", e);
+            std::ptr::null_mut()
+        }
+    }
+}
+
+/// Number of longs per telemetry sample in `nativeDrainTelemetry` output.
+const TELEMETRY_SAMPLE_FIELDS: usize = 13;
+
+/// Set the per-path telemetry sampling interval in milliseconds; 0 disables it.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeSetTelemetryInterval(
+    _env: JNIEnv,
+    _class: JClass,
+    interval_ms: jint,
+) {
+    let interval_us = (interval_ms.max(0) as u64).saturating_mul(1000);
+    slipstream_ffi::set_telemetry_interval(interval_us);
+}
+
+/// Set where the client thread runs from its next start: `cpus` is empty
+/// to keep the affinity, "performance" to leave out the lowest capacity
+/// cores, or a list such as "4-7"; `nice` 0 keeps the nice level and
+/// `util_min` (0 to 1024, 0: off) is the scheduler utilization hint.
+/// Returns false, leaving the placement as it was, when `cpus` is invalid.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeSetThreadPlacement(
+    mut env: JNIEnv,
+    _class: JClass,
+    cpus: JString,
+    nice: jint,
+    util_min: jint,
+) -> jboolean {
+    let cpus: String = match env.get_string(&cpus) {
+        Ok(s) => s.into(),
+        Err(e) => {
+            error!("Failed to get thread cpus string: {:?}", e);
+            return JNI_FALSE;
+        }
+    };
+    let cpus = match CpuSelection::parse(&cpus) {
+        Ok(cpus) => cpus,
+        Err(e) => {
+            warn!("Thread placement: {}", e);
+            return JNI_FALSE;
+        }
+    };
+    *THREAD_PLACEMENT.lock().unwrap_or_else(|e| e.into_inner()) = ThreadPlacement {
+        cpus,
+        nice,
+        util_min: util_min.max(0) as u32,
+    };
+    JNI_TRUE
+}
+
+/// Drain queued telemetry samples as a flat array of TELEMETRY_SAMPLE_FIELDS
+/// longs per sample, in `slipstream_telemetry_sample_t` field order.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeDrainTelemetry<'local>(
+    env: JNIEnv<'local>,
+    _class: JClass<'local>,
+) -> jlongArray {
+    let samples = slipstream_ffi::drain_telemetry();
+    let mut flat: Vec<jlong> = Vec::with_capacity(samples.len() * TELEMETRY_SAMPLE_FIELDS);
+    for sample in &samples {
+        flat.extend_from_slice(&[
+            sample.time_us as jlong,
+            sample.unique_path_id as jlong,
+            sample.cwin as jlong,
+            sample.pacing_rate as jlong,
+            sample.rtt_min as jlong,
+            sample.smoothed_rtt as jlong,
+            sample.bytes_in_transit as jlong,
+            sample.nb_losses as jlong,
+            sample.nb_timer_losses as jlong,
+            sample.nb_spurious as jlong,
+            sample.packets_sent as jlong,
+            sample.notification as jlong,
+            sample.path_mode as jlong,
+        ]);
+    }
+    let array = match env.new_long_array(flat.len() as jint) {
+        Ok(array) => array,
+        Err(e) => {
+            error!("Failed to allocate telemetry array: {:?}", e);
+            return std::ptr::null_mut();
+        }
+    };
+    if let Err(e) = env.set_long_array_region(&array, 0, &flat) {
+        error!("Failed to fill telemetry array: {:?}", e);
+        return std::ptr::null_mut();
+    }
+    array.into_raw()
+}
+
+/// Take the stream milestones of traced flows as a flat array of trace ID,
+/// CLOCK_MONOTONIC microseconds and milestone per event, see `crate::trace`.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeTakeTraces<'local>(
+    env: JNIEnv<'local>,
+    _class: JClass<'local>,
+) -> jlongArray {
+    let mut events = [crate::trace::TraceEvent::default(); 256];
+    let count = crate::trace::take(&mut events);
+    let mut flat: Vec<jlong> = Vec::with_capacity(count * 3);
+    for event in &events[..count] {
+        flat.extend_from_slice(&[
+            event.trace as jlong,
+            event.time as jlong,
+            event.milestone as jlong,
+        ]);
+    }
+    let array = match env.new_long_array(flat.len() as jint) {
+        Ok(array) => array,
+        Err(e) => {
+            error!("Failed to allocate trace array: {:?}", e);
+            return std::ptr::null_mut();
+        }
+    };
+    if let Err(e) = env.set_long_array_region(&array, 0, &flat) {
+        error!("Failed to fill trace array: {:?}", e);
+        return std::ptr::null_mut();
+    }
+    array.into_raw()
+}
+
+/// DoH3 upstream of the DoH tunnel. Queries hold a reference, so stopping
+/// it never frees the client under a query in progress.
+static DOH3_CLIENT: Mutex<Option<Arc<Doh3Client>>> = Mutex::new(None);
+
+/// Start the DNS over HTTP/3 upstream for `server`:`port`, verified as
+/// `authority` against the PEM roots in `cert_roots`, posting to `path`.
+/// `ticket_file` keeps session tickets for 0-RTT and may be empty. Replaces
+/// any upstream already running; returns false when none could start.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStartDoh3(
+    mut env: JNIEnv,
+    _class: JClass,
+    server: JString,
+    port: jint,
+    authority: JString,
+    path: JString,
+    cert_roots: JString,
+    ticket_file: JString,
+) -> jboolean {
+    let mut strings = Vec::with_capacity(5);
+    for value in [&server, &authority, &path, &cert_roots, &ticket_file] {
+        match env.get_string(value) {
+            Ok(s) => strings.push(String::from(s)),
+            Err(e) => {
+                error!("Failed to get DoH3 setting string: {:?}", e);
+                return JNI_FALSE;
+            }
+        }
+    }
+    let [server, authority, path, cert_roots, ticket_file] = &strings[..] else {
+        return JNI_FALSE;
+    };
+    let ip: IpAddr = match server.parse() {
+        Ok(ip) => ip,
+        Err(_) => {
+            warn!("DoH3 server is not an address: {}", server);
+            return JNI_FALSE;
+        }
+    };
+    if !(1..=65535).contains(&port) {
+        warn!("DoH3 server port out of range: {}", port);
+        return JNI_FALSE;
+    }
+
+    let mut slot = DOH3_CLIENT.lock().unwrap_or_else(|e| e.into_inner());
+    slot.take();
+    let ticket_file = (!ticket_file.is_empty()).then(|| Path::new(ticket_file));
+    match Doh3Client::new(
+        SocketAddr::new(ip, port as u16),
+        authority,
+        path,
+        Some(Path::new(cert_roots)),
+        ticket_file,
+    ) {
+        Ok(client) => {
+            info!("DoH3 upstream {} via {}:{}", authority, ip, port);
+            *slot = Some(Arc::new(client));
+            JNI_TRUE
+        }
+        Err(e) => {
+            warn!("{}", e);
+            JNI_FALSE
+        }
+    }
+}
+
+/// Resolve one DNS message over HTTP/3, waiting up to `timeout_ms`. Returns
+/// null when no upstream runs or it gave no answer, for the caller to fall
+/// back on DoH over HTTP/2.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeQueryDoh3<'local>(
+    env: JNIEnv<'local>,
+    _class: JClass<'local>,
+    query: JByteArray<'local>,
+    timeout_ms: jint,
+) -> jbyteArray {
+    let Some(client) = DOH3_CLIENT
+        .lock()
+        .unwrap_or_else(|e| e.into_inner())
+        .clone()
+    else {
+        return std::ptr::null_mut();
+    };
+    let query = match env.convert_byte_array(&query) {
+        Ok(query) => query,
+        Err(e) => {
+            error!("Failed to read DoH3 query: {:?}", e);
+            return std::ptr::null_mut();
+        }
+    };
+    let timeout = Duration::from_millis(timeout_ms.max(0) as u64);
+    let Some(answer) = client.query(&query, timeout) else {
+        return std::ptr::null_mut();
+    };
+    match env.byte_array_from_slice(&answer) {
+        Ok(array) => array.into_raw(),
+        Err(e) => {
+            error!("Failed to allocate DoH3 answer: {:?}", e);
+            std::ptr::null_mut()
+        }
+    }
+}
+
+/// Stop the DoH3 upstream. Queries in progress finish on their own reference.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeStopDoh3(
+    _env: JNIEnv,
+    _class: JClass,
+) {
+    let client = DOH3_CLIENT.lock().unwrap_or_else(|e| e.into_inner()).take();
+    drop(client);
+}
+
+/// Scan `hosts`, IP addresses, for resolvers answering an A query for
+/// `domain` on `port`, `concurrency` at a time, with `samples` timed queries
+/// after a warm-up one (none: the warm-up is timed). Each result goes to
+/// `listener.onScanResult(index, status, timeMs, rcode, answer)` as it is
+/// known, status being 0 working, 1 censored, 2 error or 3 timeout; the
+/// scan stops early when that returns false. Blocks until done. Returns
+/// false when a host is not an address or the scan fails; hosts not
+/// reported by then have no result.
+#[no_mangle]
+pub extern "system" fn Java_app_slipnet_tunnel_SlipstreamBridge_nativeScanResolvers(
+    mut env: JNIEnv,
+    _class: JClass,
+    hosts: JObjectArray,
+    port: jint,
+    domain: JString,
+    timeout_ms: jint,
+    concurrency: jint,
+    samples: jint,
+    listener: JObject,
+) -> jboolean {
+    let domain: String = match env.get_string(&domain) {
+        Ok(s) => s.into(),
+        Err(e) => {
+            error!("Failed to get scan domain string: {:?}", e);
+            return JNI_FALSE;
+        }
+    };
+    let count = match env.get_array_length(&hosts) {
+        Ok(count) => count,
+        Err(e) => {
+            error!("Failed to get scan hosts length: {:?}", e);
+            return JNI_FALSE;
+        }
+    };
+    let mut targets = Vec::with_capacity(count as usize);
+    for i in 0..count {
+        let host: String = match env
+            .get_object_array_element(&hosts, i)
+            .and_then(|obj| env.get_string(&JString::from(obj)).map(String::from))
+        {
+            Ok(host) => host,
+            Err(e) => {
+                error!("Failed to get scan host {}: {:?}", i, e);
+                return JNI_FALSE;
+            }
+        };
+        match host.parse() {
+            Ok(ip) => targets.push(ip),
+            Err(_) => {
+                warn!("Scan host is not an address: {}", host);
+                return JNI_FALSE;
+            }
+        }
+    }
+    if !(1..=65535).contains(&port) {
+        warn!("Scan port out of range: {}", port);
+        return JNI_FALSE;
+    }
+
+    let timeout = Duration::from_millis(timeout_ms.max(1) as u64);
+    let config = ScanConfig {
+        domain,
+        port: port as u16,
+        timeout,
+        // The app's scan waits at most 3 s for each answer.
+        query_timeout: timeout.min(Duration::from_secs(3)),
+        samples: samples.max(0) as usize,
+        max_in_flight: concurrency.max(1) as usize,
+    };
+    let scanned = scan_resolvers(&targets, &config, |result| {
+        let status = match result.status {
+            ScanStatus::Working => 0,
+            ScanStatus::Censored => 1,
+            ScanStatus::Error => 2,
+            ScanStatus::Timeout => 3,
+        };
+        let answer = match result.answer {
+            Some(ip) => match env.new_string(ip.to_string()) {
+                Ok(s) => JObject::from(s),
+                Err(_) => return false,
+            },
+            None => JObject::null(),
+        };
+        let keep_going = env
+            .call_method(
+                &listener,
+                "onScanResult",
+                "(IIJILjava/lang/String;)Z",
+                &[
+                    JValue::Int(result.index as jint),
+                    JValue::Int(status),
+                    JValue::Long(result.time.as_millis() as jlong),
+                    JValue::Int(result.rcode as jint),
+                    JValue::Object(&answer),
+                ],
+            )
+            .and_then(|value| value.z());
+        let _ = env.delete_local_ref(answer);
+        match keep_going {
+            Ok(keep_going) => keep_going,
+            Err(e) => {
+                error!("Scan listener failed: {:?}", e);
+                false
+            }
+        }
+    });
+    match scanned {
+        Ok(()) => JNI_TRUE,
+        Err(e) => {
+            warn!("Resolver scan: {}", e);
+            JNI_FALSE
+        }
+    }
+}
+
 // ============================================================================
 // Tests
 // ============================================================================
@@ -682,6 +1322,33 @@ mod tests {
         IS_LISTENER_READY.store(false, Ordering::SeqCst);
     }
 
+    #[test]
+    fn test_stats_page() {
+        let seq = STATS_PAGE.seq.load(Ordering::SeqCst);
+
+        IS_RUNNING.store(true, Ordering::SeqCst);
+        signal_listener_ready();
+
+        // Other tests publish too, so only check the sequence moved on and
+        // no write is left half done.
+        let now = STATS_PAGE.seq.load(Ordering::SeqCst);
+        assert_ne!(now, seq);
+        assert_eq!(now & 1, 0);
+        assert_eq!(STATS_PAGE.running.load(Ordering::SeqCst), 1);
+        assert_eq!(
+            STATS_PAGE.version.load(Ordering::SeqCst),
+            STATS_PAGE_VERSION
+        );
+        assert_eq!(STATS_PAGE.size.load(Ordering::SeqCst), 8 + 4 * 8);
+        assert_eq!(STATS_PAGE.listener_ready.load(Ordering::SeqCst), 1);
+
+        // Cleanup
+        IS_RUNNING.store(false, Ordering::SeqCst);
+        IS_LISTENER_READY.store(false, Ordering::SeqCst);
+        publish_stats();
+        assert_eq!(STATS_PAGE.seq.load(Ordering::SeqCst) & 1, 0);
+    }
+
     #[test]
     fn test_failure_tracking() {
         CONSECUTIVE_FAILURES.store(0, Ordering::SeqCst);
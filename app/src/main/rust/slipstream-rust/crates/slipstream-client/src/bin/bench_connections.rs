@@ -0,0 +1,720 @@
+//! Connection-scaling load generator for the slipstream server; see
+//! docs/benchmarks.md.
+//!
+//! Runs many lightweight picoquic client connections in one process against
+//! one server, each polling over DNS like an idle slipstream client, then
+//! writes one CSV row: the server's RSS and CPU per answered query, read from
+//! /proc, and the answer latency percentiles, all over a fixed window once
+//! every connection is up.
+
+use slipstream_dns::{
+    build_qname_into, decode_response_packets, encode_query, QueryParams, CLASS_IN, RR_TXT,
+};
+use slipstream_ffi::picoquic::{
+    picoquic_call_back_event_t, picoquic_close, picoquic_cnx_t, picoquic_create,
+    picoquic_create_client_cnx, picoquic_current_time, picoquic_disable_keep_alive,
+    picoquic_get_cnx_state, picoquic_incoming_packet_ex, picoquic_prepare_next_packet_ex,
+    picoquic_prepare_packet_ex, picoquic_quic_t, picoquic_state_enum,
+    slipstream_mixed_cc_algorithm, slipstream_request_poll, slipstream_set_default_path_mode,
+    PICOQUIC_MAX_PACKET_SIZE,
+};
+use slipstream_ffi::{
+    configure_cipher_suites, configure_quic_with_custom, socket_addr_to_storage, QuicGuard,
+};
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap};
+use std::ffi::{c_void, CString};
+use std::fs::OpenOptions;
+use std::io::{self, Write};
+use std::net::{SocketAddr, UdpSocket};
+use std::os::unix::io::AsRawFd;
+
+const ALPN: &str = "picoquic_sample";
+const SNI: &str = "test.example.com";
+// Few enough connections per socket that DNS IDs do not wrap within a query
+// timeout, as behind a resolver that spreads its clients over source ports.
+const CONNECTIONS_PER_SOCKET: usize = 256;
+const QUERY_TIMEOUT_US: u64 = 2_000_000;
+// A poll the congestion controller holds back is retried this much later.
+const POLL_RETRY_US: u64 = 10_000;
+const STATE_CHECK_US: u64 = 200_000;
+const SEND_BURST: usize = 1024;
+const RECV_BURST: usize = 64;
+const WAIT_MAX_MS: u64 = 5;
+// Recursive path mode, as the client sets for a resolver.
+const PATH_MODE_RECURSIVE: libc::c_int = 1;
+
+struct Options {
+    server: SocketAddr,
+    domain: String,
+    connections: usize,
+    ramp_per_sec: u64,
+    poll_interval_ms: u64,
+    connect_timeout_secs: u64,
+    warmup_secs: u64,
+    duration_secs: u64,
+    server_pid: u32,
+    csv: String,
+    label: String,
+}
+
+fn parse_options() -> Result<Options, String> {
+    let mut options = Options {
+        server: SocketAddr::from(([127, 0, 0, 1], 8853)),
+        domain: "test.com".to_string(),
+        connections: 1000,
+        ramp_per_sec: 2000,
+        poll_interval_ms: 1000,
+        connect_timeout_secs: 120,
+        warmup_secs: 2,
+        duration_secs: 10,
+        server_pid: 0,
+        csv: "-".to_string(),
+        label: String::new(),
+    };
+    for arg in std::env::args().skip(1) {
+        let (key, value) = arg
+            .split_once('=')
+            .ok_or_else(|| format!("expected --name=value, got {}", arg))?;
+        let invalid = || format!("invalid {}: {}", &key[2..], value);
+        match key {
+            "--server" => options.server = value.parse().map_err(|_| invalid())?,
+            "--domain" => options.domain = value.to_string(),
+            "--connections" => options.connections = value.parse().map_err(|_| invalid())?,
+            "--ramp-per-sec" => options.ramp_per_sec = value.parse().map_err(|_| invalid())?,
+            "--poll-interval-ms" => {
+                options.poll_interval_ms = value.parse().map_err(|_| invalid())?
+            }
+            "--connect-timeout-secs" => {
+                options.connect_timeout_secs = value.parse().map_err(|_| invalid())?
+            }
+            "--warmup-secs" => options.warmup_secs = value.parse().map_err(|_| invalid())?,
+            "--duration-secs" => options.duration_secs = value.parse().map_err(|_| invalid())?,
+            "--server-pid" => options.server_pid = value.parse().map_err(|_| invalid())?,
+            "--csv" => options.csv = value.to_string(),
+            "--label" => options.label = value.to_string(),
+            _ => return Err(format!("unknown option {}", key)),
+        }
+    }
+    if options.connections == 0 || options.ramp_per_sec == 0 || options.duration_secs == 0 {
+        return Err("connections, ramp-per-sec and duration-secs must be positive".to_string());
+    }
+    Ok(options)
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum ClientState {
+    Connecting,
+    Ready,
+    Closed,
+}
+
+struct Client {
+    cnx: *mut picoquic_cnx_t,
+    socket: usize,
+    state: ClientState,
+    poll_outstanding: bool,
+    next_poll_at: u64,
+}
+
+struct Outstanding {
+    sent_at: u64,
+    client: usize,
+    poll: bool,
+}
+
+#[derive(Default)]
+struct Window {
+    queries: u64,
+    answered: u64,
+    timeouts: u64,
+    latencies_us: Vec<u64>,
+}
+
+/// CPU time of a process in microseconds, and its resident set in KiB, from
+/// /proc; zeros where it cannot be read.
+#[derive(Clone, Copy, Default)]
+struct ProcessSample {
+    cpu_us: u64,
+    rss_kb: u64,
+}
+
+fn sample_process(pid: &str) -> ProcessSample {
+    let ticks_per_sec = unsafe { libc::sysconf(libc::_SC_CLK_TCK) }.max(1) as u64;
+    let cpu_us = std::fs::read_to_string(format!("/proc/{}/stat", pid))
+        .ok()
+        .and_then(|stat| {
+            // Fields after the parenthesised command name, from the state on.
+            let fields: Vec<&str> = stat.rsplit_once(')')?.1.split_whitespace().collect();
+            let utime: u64 = fields.get(11)?.parse().ok()?;
+            let stime: u64 = fields.get(12)?.parse().ok()?;
+            Some((utime + stime) * 1_000_000 / ticks_per_sec)
+        })
+        .unwrap_or(0);
+    let rss_kb = std::fs::read_to_string(format!("/proc/{}/status", pid))
+        .ok()
+        .and_then(|status| {
+            let line = status.lines().find(|line| line.starts_with("VmRSS:"))?;
+            line.split_whitespace().nth(1)?.parse().ok()
+        })
+        .unwrap_or(0);
+    ProcessSample { cpu_us, rss_kb }
+}
+
+fn percentile_ms(sorted_us: &[u64], percentile: usize) -> f64 {
+    if sorted_us.is_empty() {
+        return 0.0;
+    }
+    let rank = (sorted_us.len() * percentile).div_ceil(100).max(1) - 1;
+    sorted_us[rank] as f64 / 1000.0
+}
+
+unsafe extern "C" fn bench_callback(
+    _cnx: *mut picoquic_cnx_t,
+    _stream_id: u64,
+    _bytes: *mut u8,
+    _length: libc::size_t,
+    _fin_or_event: picoquic_call_back_event_t,
+    _callback_ctx: *mut c_void,
+    _stream_ctx: *mut c_void,
+) -> libc::c_int {
+    0
+}
+
+struct LoadGenerator {
+    options: Options,
+    quic: *mut picoquic_quic_t,
+    sni: CString,
+    alpn: CString,
+    sockets: Vec<UdpSocket>,
+    dns_ids: Vec<u16>,
+    clients: Vec<Client>,
+    client_by_cnx: HashMap<usize, usize>,
+    outstanding: HashMap<(usize, u16), Outstanding>,
+    polls: BinaryHeap<Reverse<(u64, usize)>>,
+    window: Option<Window>,
+    send_buf: Vec<u8>,
+    recv_buf: Vec<u8>,
+    qname: String,
+}
+
+impl LoadGenerator {
+    fn connect(&mut self, now: u64) -> Result<(), String> {
+        let index = self.clients.len();
+        let socket = index / CONNECTIONS_PER_SOCKET;
+        if socket == self.sockets.len() {
+            let udp = UdpSocket::bind(match self.options.server {
+                SocketAddr::V4(_) => SocketAddr::from(([0, 0, 0, 0], 0)),
+                SocketAddr::V6(_) => SocketAddr::from(([0u16; 8], 0)),
+            })
+            .map_err(|err| format!("bind UDP socket: {}", err))?;
+            udp.set_nonblocking(true)
+                .map_err(|err| format!("set UDP socket non-blocking: {}", err))?;
+            self.sockets.push(udp);
+            self.dns_ids.push(1);
+        }
+        let mut server = socket_addr_to_storage(self.options.server);
+        let cnx = unsafe {
+            picoquic_create_client_cnx(
+                self.quic,
+                &mut server as *mut _ as *mut libc::sockaddr,
+                now,
+                0,
+                self.sni.as_ptr(),
+                self.alpn.as_ptr(),
+                Some(bench_callback),
+                std::ptr::null_mut(),
+            )
+        };
+        if cnx.is_null() {
+            return Err(format!("could not create connection {}", index));
+        }
+        unsafe { picoquic_disable_keep_alive(cnx) };
+        self.client_by_cnx.insert(cnx as usize, index);
+        self.clients.push(Client {
+            cnx,
+            socket,
+            state: ClientState::Connecting,
+            poll_outstanding: false,
+            next_poll_at: u64::MAX,
+        });
+        Ok(())
+    }
+
+    fn send_query(&mut self, client: usize, length: usize, poll: bool, now: u64) {
+        let socket = self.clients[client].socket;
+        let id = self.dns_ids[socket];
+        self.dns_ids[socket] = id.wrapping_add(1);
+        if build_qname_into(
+            &self.send_buf[..length],
+            &self.options.domain,
+            &mut self.qname,
+        )
+        .is_err()
+        {
+            return;
+        }
+        let params = QueryParams {
+            id,
+            qname: &self.qname,
+            qtype: RR_TXT,
+            qclass: CLASS_IN,
+            rd: true,
+            cd: false,
+            qdcount: 1,
+            is_query: true,
+        };
+        let Ok(packet) = encode_query(&params) else {
+            return;
+        };
+        if self.sockets[socket]
+            .send_to(&packet, self.options.server)
+            .is_err()
+        {
+            return;
+        }
+        if let Some(window) = self.window.as_mut() {
+            window.queries += 1;
+        }
+        // A reused ID replaces a query that is as good as lost.
+        self.outstanding.insert(
+            (socket, id),
+            Outstanding {
+                sent_at: now,
+                client,
+                poll,
+            },
+        );
+        if poll {
+            self.clients[client].poll_outstanding = true;
+        }
+    }
+
+    fn schedule_poll(&mut self, client: usize, at: u64) {
+        let state = &mut self.clients[client];
+        if state.state == ClientState::Closed || state.poll_outstanding {
+            return;
+        }
+        if at < state.next_poll_at {
+            state.next_poll_at = at;
+            self.polls.push(Reverse((at, client)));
+        }
+    }
+
+    fn receive(&mut self, socket: usize) -> bool {
+        let mut received = false;
+        let local = socket_addr_to_storage(self.sockets[socket].local_addr().unwrap());
+        for _ in 0..RECV_BURST {
+            let (length, peer) = match self.sockets[socket].recv_from(&mut self.recv_buf) {
+                Ok(datagram) => datagram,
+                Err(_) => break,
+            };
+            received = true;
+            let now = picoquic_now();
+            let response = &self.recv_buf[..length];
+            let answered = (length >= 2)
+                .then(|| u16::from_be_bytes([response[0], response[1]]))
+                .and_then(|id| self.outstanding.remove(&(socket, id)));
+            let packets = decode_response_packets(response);
+            let has_payload = packets.is_some();
+            if let Some(packets) = packets {
+                let mut peer_storage = socket_addr_to_storage(peer);
+                let mut local_storage = local;
+                let mut first_cnx: *mut picoquic_cnx_t = std::ptr::null_mut();
+                let mut first_path: libc::c_int = -1;
+                for mut payload in packets {
+                    unsafe {
+                        picoquic_incoming_packet_ex(
+                            self.quic,
+                            payload.as_mut_ptr(),
+                            payload.len(),
+                            &mut peer_storage as *mut _ as *mut libc::sockaddr,
+                            &mut local_storage as *mut _ as *mut libc::sockaddr,
+                            0,
+                            0,
+                            &mut first_cnx,
+                            &mut first_path,
+                            now,
+                        );
+                    }
+                }
+            }
+            let Some(query) = answered else {
+                continue;
+            };
+            if let Some(window) = self.window.as_mut() {
+                window.answered += 1;
+                window.latencies_us.push(now.saturating_sub(query.sent_at));
+            }
+            if query.poll {
+                self.clients[query.client].poll_outstanding = false;
+            }
+            // Drain what the server has queued, then idle at the poll interval.
+            let next = if has_payload {
+                now
+            } else {
+                query.sent_at + self.options.poll_interval_ms * 1000
+            };
+            self.schedule_poll(query.client, next);
+        }
+        received
+    }
+
+    fn expire(&mut self, now: u64) {
+        let expire_before = now.saturating_sub(QUERY_TIMEOUT_US);
+        let mut expired = Vec::new();
+        self.outstanding.retain(|_, query| {
+            if query.sent_at > expire_before {
+                return true;
+            }
+            expired.push((query.client, query.poll));
+            false
+        });
+        for (client, poll) in expired {
+            if let Some(window) = self.window.as_mut() {
+                window.timeouts += 1;
+            }
+            if poll {
+                self.clients[client].poll_outstanding = false;
+                self.schedule_poll(client, now);
+            }
+        }
+    }
+
+    fn send_polls(&mut self, now: u64) -> bool {
+        let mut sent = false;
+        while let Some(Reverse((at, client))) = self.polls.peek().copied() {
+            if at > now {
+                break;
+            }
+            self.polls.pop();
+            let state = &self.clients[client];
+            if state.next_poll_at != at
+                || state.poll_outstanding
+                || state.state == ClientState::Closed
+            {
+                continue;
+            }
+            self.clients[client].next_poll_at = u64::MAX;
+            let cnx = self.clients[client].cnx;
+            let length = unsafe {
+                slipstream_request_poll(cnx);
+                self.prepare(|send_buf, length, addr_to, addr_from, if_index| {
+                    picoquic_prepare_packet_ex(
+                        cnx,
+                        0,
+                        now,
+                        send_buf.as_mut_ptr(),
+                        send_buf.len(),
+                        length,
+                        addr_to,
+                        addr_from,
+                        if_index,
+                        std::ptr::null_mut(),
+                    )
+                })
+            };
+            match length {
+                Some(length) => {
+                    self.send_query(client, length, true, now);
+                    sent = true;
+                }
+                None => self.schedule_poll(client, now + POLL_RETRY_US),
+            }
+        }
+        sent
+    }
+
+    /// Sends what picoquic has queued itself: handshake flights, ACKs and
+    /// retransmissions.
+    fn send_pending(&mut self, now: u64) -> bool {
+        let quic = self.quic;
+        for burst in 0..SEND_BURST {
+            let mut last_cnx: *mut picoquic_cnx_t = std::ptr::null_mut();
+            let length = unsafe {
+                self.prepare(|send_buf, length, addr_to, addr_from, if_index| {
+                    picoquic_prepare_next_packet_ex(
+                        quic,
+                        now,
+                        send_buf.as_mut_ptr(),
+                        send_buf.len(),
+                        length,
+                        addr_to,
+                        addr_from,
+                        if_index,
+                        std::ptr::null_mut(),
+                        &mut last_cnx,
+                        std::ptr::null_mut(),
+                    )
+                })
+            };
+            let Some(length) = length else {
+                return burst > 0;
+            };
+            if let Some(&client) = self.client_by_cnx.get(&(last_cnx as usize)) {
+                self.send_query(client, length, false, now);
+            }
+        }
+        true
+    }
+
+    fn prepare(
+        &mut self,
+        prepare: impl FnOnce(
+            &mut [u8],
+            &mut libc::size_t,
+            &mut libc::sockaddr_storage,
+            &mut libc::sockaddr_storage,
+            &mut libc::c_int,
+        ) -> libc::c_int,
+    ) -> Option<usize> {
+        let mut length: libc::size_t = 0;
+        let mut addr_to: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+        let mut addr_from: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+        let mut if_index: libc::c_int = 0;
+        let ret = prepare(
+            &mut self.send_buf,
+            &mut length,
+            &mut addr_to,
+            &mut addr_from,
+            &mut if_index,
+        );
+        (ret == 0 && length > 0 && addr_to.ss_family != 0).then_some(length)
+    }
+
+    /// Moves handshaken connections to polling, and counts those up and those
+    /// lost.
+    fn check_states(&mut self, now: u64) -> (usize, usize) {
+        let mut ready = 0;
+        let mut closed = 0;
+        for index in 0..self.clients.len() {
+            let state = unsafe { picoquic_get_cnx_state(self.clients[index].cnx) };
+            let client = &mut self.clients[index];
+            if state as i32 >= picoquic_state_enum::picoquic_state_disconnecting as i32 {
+                client.state = ClientState::Closed;
+            } else if client.state == ClientState::Connecting
+                && state as i32 >= picoquic_state_enum::picoquic_state_client_ready_start as i32
+            {
+                client.state = ClientState::Ready;
+                self.schedule_poll(index, now);
+            }
+            match self.clients[index].state {
+                ClientState::Ready => ready += 1,
+                ClientState::Closed => closed += 1,
+                ClientState::Connecting => {}
+            }
+        }
+        (ready, closed)
+    }
+
+    fn wait(&self, now: u64) {
+        let next_poll = self
+            .polls
+            .peek()
+            .map(|Reverse((at, _))| at.saturating_sub(now) / 1000)
+            .unwrap_or(WAIT_MAX_MS);
+        let timeout = next_poll.min(WAIT_MAX_MS) as libc::c_int;
+        let mut fds: Vec<libc::pollfd> = self
+            .sockets
+            .iter()
+            .map(|socket| libc::pollfd {
+                fd: socket.as_raw_fd(),
+                events: libc::POLLIN,
+                revents: 0,
+            })
+            .collect();
+        unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, timeout) };
+    }
+}
+
+fn picoquic_now() -> u64 {
+    unsafe { picoquic_current_time() }
+}
+
+fn write_row(options: &Options, row: &str) -> io::Result<()> {
+    const HEADER: &str = "label,connections,connected,duration_s,queries,answered,timeouts,\
+server_rss_base_kb,server_rss_kb,rss_per_conn_kb,server_cpu_s,cpu_us_per_query,p50_ms,p99_ms,\
+loadgen_cpu_s";
+    if options.csv == "-" {
+        println!("{}\n{}", HEADER, row);
+        return Ok(());
+    }
+    let mut file = OpenOptions::new()
+        .create(true)
+        .append(true)
+        .open(&options.csv)?;
+    if file.metadata()?.len() == 0 {
+        writeln!(file, "{}", HEADER)?;
+    }
+    writeln!(file, "{}", row)
+}
+
+fn run(options: Options) -> Result<(), String> {
+    // The client's MTU for the domain, so queries fit in a question name.
+    let mtu = ((240.0 - options.domain.len() as f64) / 1.6) as u32;
+    if options.domain.len() >= 240 || mtu == 0 {
+        return Err(format!("domain too long: {}", options.domain));
+    }
+    let server_pid = (options.server_pid > 0).then(|| options.server_pid.to_string());
+    let server_sample = || {
+        server_pid
+            .as_deref()
+            .map(sample_process)
+            .unwrap_or_default()
+    };
+    let server_base = server_sample();
+
+    let alpn = CString::new(ALPN).unwrap();
+    let sni = CString::new(SNI).unwrap();
+    let start = picoquic_now();
+    let quic = unsafe {
+        picoquic_create(
+            (options.connections + 16) as libc::c_uint,
+            std::ptr::null(),
+            std::ptr::null(),
+            std::ptr::null(),
+            alpn.as_ptr(),
+            Some(bench_callback),
+            std::ptr::null_mut(),
+            None,
+            std::ptr::null_mut(),
+            std::ptr::null(),
+            start,
+            std::ptr::null_mut(),
+            std::ptr::null(),
+            std::ptr::null(),
+            0,
+        )
+    };
+    if quic.is_null() {
+        return Err("could not create QUIC context".to_string());
+    }
+    let _quic_guard = QuicGuard::new(quic);
+    unsafe {
+        let mixed_cc = slipstream_mixed_cc_algorithm;
+        if mixed_cc.is_null() {
+            return Err("could not load mixed congestion control".to_string());
+        }
+        configure_quic_with_custom(quic, mixed_cc, mtu);
+        configure_cipher_suites(quic);
+        slipstream_set_default_path_mode(PATH_MODE_RECURSIVE);
+    }
+
+    let mut generator = LoadGenerator {
+        quic,
+        sni,
+        alpn,
+        sockets: Vec::new(),
+        dns_ids: Vec::new(),
+        clients: Vec::with_capacity(options.connections),
+        client_by_cnx: HashMap::with_capacity(options.connections),
+        outstanding: HashMap::new(),
+        polls: BinaryHeap::new(),
+        window: None,
+        send_buf: vec![0u8; PICOQUIC_MAX_PACKET_SIZE],
+        recv_buf: vec![0u8; 4096],
+        qname: String::with_capacity(256),
+        options,
+    };
+
+    let connections = generator.options.connections;
+    let connect_deadline = start + generator.options.connect_timeout_secs * 1_000_000;
+    let mut warmup_end = None;
+    let mut window_start = None;
+    let mut window_end = u64::MAX;
+    let mut last_state_check = 0;
+    let mut last_expire = 0;
+    let mut connected = (0, 0);
+    let mut server_start = ProcessSample::default();
+    let mut self_start = ProcessSample::default();
+    loop {
+        let now = picoquic_now();
+        let due = (((now - start) as u128 * generator.options.ramp_per_sec as u128 / 1_000_000)
+            as usize
+            + 1)
+        .min(connections);
+        while generator.clients.len() < due {
+            generator.connect(now)?;
+        }
+
+        let mut busy = false;
+        for socket in 0..generator.sockets.len() {
+            busy |= generator.receive(socket);
+        }
+        if now - last_expire >= STATE_CHECK_US {
+            generator.expire(now);
+            last_expire = now;
+        }
+        if now - last_state_check >= STATE_CHECK_US {
+            connected = generator.check_states(now);
+            last_state_check = now;
+        }
+        busy |= generator.send_polls(now);
+        busy |= generator.send_pending(now);
+
+        let all_settled =
+            generator.clients.len() == connections && connected.0 + connected.1 == connections;
+        if warmup_end.is_none() && (all_settled || now >= connect_deadline) {
+            eprintln!(
+                "bench_connections: {} of {} connections up after {:.1}s",
+                connected.0,
+                connections,
+                (now - start) as f64 / 1e6
+            );
+            warmup_end = Some(now + generator.options.warmup_secs * 1_000_000);
+        }
+        if window_start.is_none() && warmup_end.is_some_and(|end| now >= end) {
+            server_start = server_sample();
+            self_start = sample_process("self");
+            generator.window = Some(Window::default());
+            window_start = Some(now);
+            window_end = now + generator.options.duration_secs * 1_000_000;
+        }
+        if now >= window_end {
+            break;
+        }
+        if !busy {
+            generator.wait(now);
+        }
+    }
+
+    let server_end = server_sample();
+    let self_end = sample_process("self");
+    let (ready, _) = generator.check_states(picoquic_now());
+    for client in &generator.clients {
+        unsafe { picoquic_close(client.cnx, 0) };
+    }
+    let mut window = generator.window.take().unwrap_or_default();
+    window.latencies_us.sort_unstable();
+    let server_cpu_us = server_end.cpu_us.saturating_sub(server_start.cpu_us);
+    let row = format!(
+        "{},{},{},{},{},{},{},{},{},{:.2},{:.3},{:.1},{:.3},{:.3},{:.3}",
+        generator.options.label,
+        connections,
+        ready,
+        generator.options.duration_secs,
+        window.queries,
+        window.answered,
+        window.timeouts,
+        server_base.rss_kb,
+        server_end.rss_kb,
+        server_end.rss_kb.saturating_sub(server_base.rss_kb) as f64 / ready.max(1) as f64,
+        server_cpu_us as f64 / 1e6,
+        server_cpu_us as f64 / window.answered.max(1) as f64,
+        percentile_ms(&window.latencies_us, 50),
+        percentile_ms(&window.latencies_us, 99),
+        self_end.cpu_us.saturating_sub(self_start.cpu_us) as f64 / 1e6,
+    );
+    write_row(&generator.options, &row).map_err(|err| format!("write CSV: {}", err))
+}
+
+fn main() {
+    let options = parse_options().unwrap_or_else(|err| {
+        eprintln!("bench_connections: {}", err);
+        std::process::exit(2);
+    });
+    if let Err(err) = run(options) {
+        eprintln!("bench_connections: {}", err);
+        std::process::exit(1);
+    }
+}
@@ -0,0 +1,309 @@
+//! UDP carried in QUIC DATAGRAM frames.
+//!
+//! The tun2socks engine takes one datagram socket per UDP session from
+//! `crate::provider`; each message on it is a SOCKS5 UDP request. Every
+//! destination of a socket gets a flow ID that the server maps to its own UDP
+//! socket, and replies come back tagged with it. Nothing is retransmitted: a
+//! datagram that cannot be queued, or is lost, is gone, as it would be on the
+//! network, and loss on one flow never holds up another.
+
+use slipstream_core::datagram::{
+    decode_downlink, decode_socks_udp, encode_socks_udp, encode_uplink, UPLINK_HEADER_MAX,
+};
+use slipstream_dns::truncated_reply;
+use slipstream_ffi::picoquic::{
+    picoquic_cnx_t, slipstream_datagram_max_payload, slipstream_queue_datagram,
+};
+use std::collections::HashMap;
+use std::net::SocketAddr;
+use std::os::unix::net::UnixDatagram as StdUnixDatagram;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tokio::net::UnixDatagram;
+use tokio::sync::mpsc;
+use tokio::time::timeout;
+
+use crate::streams::Command;
+
+/// Largest frame the client accepts from the server.
+pub(crate) const DATAGRAM_MAX_FRAME_SIZE: u32 = 1200;
+// Matches the server's per-connection cap, so flow IDs are recycled before
+// the server refuses new flows.
+const MAX_FLOWS: usize = 256;
+// Past the tun2socks engine's UDP idle timeout, so a socket closes only once
+// its session has.
+const LOCAL_IDLE_TIMEOUT: Duration = Duration::from_secs(120);
+// Datagrams still waiting behind this many are stale; drop them instead.
+const MAX_QUEUED_DATAGRAMS: usize = 32;
+const MAX_MESSAGE_SIZE: usize = 65535;
+const DNS_PORT: u16 = 53;
+
+fn now_ms(epoch: Instant) -> u64 {
+    epoch.elapsed().as_millis() as u64
+}
+
+/// One datagram socket handed out to the tun2socks engine.
+#[derive(Clone)]
+pub(crate) struct LocalSocket {
+    id: u64,
+    socket: Arc<UnixDatagram>,
+    epoch: Instant,
+    last_active_ms: Arc<AtomicU64>,
+}
+
+impl LocalSocket {
+    fn touch(&self) {
+        self.last_active_ms
+            .store(now_ms(self.epoch), Ordering::Relaxed);
+    }
+
+    fn idle_for(&self) -> Duration {
+        let idle_ms =
+            now_ms(self.epoch).saturating_sub(self.last_active_ms.load(Ordering::Relaxed));
+        Duration::from_millis(idle_ms)
+    }
+}
+
+struct Flow {
+    id: u16,
+    last_active: Instant,
+}
+
+pub(crate) struct DatagramRelay {
+    flows: HashMap<(u64, SocketAddr), Flow>,
+    by_id: HashMap<u16, (LocalSocket, SocketAddr)>,
+    last_activity: Option<Instant>,
+    buf: Vec<u8>,
+}
+
+impl DatagramRelay {
+    pub(crate) fn new() -> Self {
+        Self {
+            flows: HashMap::new(),
+            by_id: HashMap::new(),
+            last_activity: None,
+            buf: Vec::with_capacity(UPLINK_HEADER_MAX + 512),
+        }
+    }
+
+    /// When a datagram last went either way, to keep the poll loop awake.
+    pub(crate) fn last_activity(&self) -> Option<Instant> {
+        self.last_activity
+    }
+
+    /// Queues one message of `socket` on the connection. A DNS query too
+    /// long for the uplink is answered locally with a truncated reply, so
+    /// the app retries over TCP.
+    pub(crate) fn send(&mut self, cnx: *mut picoquic_cnx_t, socket: LocalSocket, message: &[u8]) {
+        let Some((dest, payload)) = decode_socks_udp(message) else {
+            return;
+        };
+        let max_payload = unsafe { slipstream_datagram_max_payload(cnx) };
+        if max_payload == 0 {
+            return;
+        }
+        let flow_id = self.flow_id(&socket, dest);
+        self.last_activity = Some(Instant::now());
+        encode_uplink(flow_id, dest, payload, &mut self.buf);
+        if self.buf.len() > max_payload {
+            if dest.port() == DNS_PORT {
+                if let Some(reply) = truncated_reply(payload) {
+                    encode_socks_udp(dest, &reply, &mut self.buf);
+                    let _ = socket.socket.try_send(&self.buf);
+                }
+            }
+            return;
+        }
+        let _ = unsafe {
+            slipstream_queue_datagram(cnx, self.buf.as_ptr(), self.buf.len(), MAX_QUEUED_DATAGRAMS)
+        };
+    }
+
+    /// Hands a datagram from the server to the socket of its flow.
+    pub(crate) fn deliver(&mut self, datagram: &[u8]) {
+        let Some((flow_id, payload)) = decode_downlink(datagram) else {
+            return;
+        };
+        let Some((socket, dest)) = self.by_id.get(&flow_id) else {
+            return;
+        };
+        let (socket, dest) = (socket.clone(), *dest);
+        if let Some(flow) = self.flows.get_mut(&(socket.id, dest)) {
+            flow.last_active = Instant::now();
+        }
+        self.last_activity = Some(Instant::now());
+        socket.touch();
+        encode_socks_udp(dest, payload, &mut self.buf);
+        if let Err(err) = socket.socket.try_send(&self.buf) {
+            // The engine closed the session; a full socket just drops this one.
+            if err.kind() != std::io::ErrorKind::WouldBlock {
+                self.close_socket(socket.id);
+            }
+        }
+    }
+
+    pub(crate) fn close_socket(&mut self, socket_id: u64) {
+        self.flows.retain(|(id, _), _| *id != socket_id);
+        self.by_id.retain(|_, (socket, _)| socket.id != socket_id);
+    }
+
+    /// The flow ID of `dest` on `socket`. Once all are taken, the one idle
+    /// longest is reassigned; the server starts over when it sees the ID
+    /// with a new destination.
+    fn flow_id(&mut self, socket: &LocalSocket, dest: SocketAddr) -> u16 {
+        let now = Instant::now();
+        if let Some(flow) = self.flows.get_mut(&(socket.id, dest)) {
+            flow.last_active = now;
+            return flow.id;
+        }
+        let id = if self.flows.len() < MAX_FLOWS {
+            (0..MAX_FLOWS as u16)
+                .find(|id| !self.by_id.contains_key(id))
+                .expect("a free flow ID")
+        } else {
+            let (&key, flow) = self
+                .flows
+                .iter()
+                .min_by_key(|(_, flow)| flow.last_active)
+                .expect("flows");
+            let id = flow.id;
+            self.flows.remove(&key);
+            id
+        };
+        self.flows.insert(
+            (socket.id, dest),
+            Flow {
+                id,
+                last_active: now,
+            },
+        );
+        self.by_id.insert(id, (socket.clone(), dest));
+        id
+    }
+
+    #[cfg(test)]
+    fn flow_count(&self) -> usize {
+        self.flows.len()
+    }
+}
+
+/// Reads the datagram sockets handed out by `crate::provider` and queues
+/// their messages as commands for the connection.
+pub(crate) fn spawn_local(
+    mut sockets: mpsc::UnboundedReceiver<StdUnixDatagram>,
+    command_tx: mpsc::UnboundedSender<Command>,
+) {
+    let epoch = Instant::now();
+    tokio::spawn(async move {
+        let mut next_id = 0u64;
+        while let Some(socket) = sockets.recv().await {
+            if socket.set_nonblocking(true).is_err() {
+                continue;
+            }
+            let Ok(socket) = UnixDatagram::from_std(socket) else {
+                continue;
+            };
+            next_id += 1;
+            let socket = LocalSocket {
+                id: next_id,
+                socket: Arc::new(socket),
+                epoch,
+                last_active_ms: Arc::new(AtomicU64::new(now_ms(epoch))),
+            };
+            tokio::spawn(read_socket(socket, command_tx.clone()));
+        }
+    });
+}
+
+/// A datagram socket pair gives no end-of-stream, so the socket closes once
+/// it has been idle both ways for `LOCAL_IDLE_TIMEOUT`.
+async fn read_socket(socket: LocalSocket, command_tx: mpsc::UnboundedSender<Command>) {
+    let mut buf = vec![0u8; MAX_MESSAGE_SIZE];
+    loop {
+        match timeout(LOCAL_IDLE_TIMEOUT, socket.socket.recv(&mut buf)).await {
+            Ok(Ok(len)) => {
+                socket.touch();
+                let command = Command::Datagram {
+                    socket: socket.clone(),
+                    message: buf[..len].to_vec(),
+                };
+                if command_tx.send(command).is_err() {
+                    return;
+                }
+            }
+            Ok(Err(_)) => break,
+            Err(_) => {
+                if socket.idle_for() >= LOCAL_IDLE_TIMEOUT {
+                    break;
+                }
+            }
+        }
+    }
+    let _ = command_tx.send(Command::DatagramSocketClosed {
+        socket_id: socket.id,
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use slipstream_core::datagram::encode_downlink;
+
+    fn local_socket(id: u64) -> (LocalSocket, StdUnixDatagram) {
+        let (local, remote) = StdUnixDatagram::pair().unwrap();
+        local.set_nonblocking(true).unwrap();
+        let socket = LocalSocket {
+            id,
+            socket: Arc::new(UnixDatagram::from_std(local).unwrap()),
+            epoch: Instant::now(),
+            last_active_ms: Arc::new(AtomicU64::new(0)),
+        };
+        (socket, remote)
+    }
+
+    #[tokio::test]
+    async fn replies_reach_the_socket_of_their_flow() {
+        let mut relay = DatagramRelay::new();
+        let (first, first_peer) = local_socket(1);
+        let (second, second_peer) = local_socket(2);
+        let dns: SocketAddr = "8.8.8.8:53".parse().unwrap();
+        let first_id = relay.flow_id(&first, dns);
+        let second_id = relay.flow_id(&second, dns);
+        assert_ne!(first_id, second_id);
+        assert_eq!(relay.flow_id(&first, dns), first_id);
+
+        let mut datagram = Vec::new();
+        encode_downlink(second_id, b"answer", &mut datagram);
+        relay.deliver(&datagram);
+        let mut buf = [0u8; 64];
+        let len = second_peer.recv(&mut buf).unwrap();
+        assert_eq!(decode_socks_udp(&buf[..len]), Some((dns, &b"answer"[..])));
+        first_peer.set_nonblocking(true).unwrap();
+        assert!(first_peer.recv(&mut buf).is_err());
+
+        // A closed session drops its flows.
+        drop(second_peer);
+        relay.deliver(&datagram);
+        assert_eq!(relay.flow_count(), 1);
+    }
+
+    #[tokio::test]
+    async fn full_table_reassigns_the_idlest_flow() {
+        let mut relay = DatagramRelay::new();
+        let (socket, _peer) = local_socket(1);
+        let mut ids = Vec::new();
+        for port in 0..MAX_FLOWS as u16 {
+            let dest = SocketAddr::from(([10, 0, 0, 1], 1000 + port));
+            ids.push(relay.flow_id(&socket, dest));
+        }
+        let now = Instant::now();
+        for flow in relay.flows.values_mut() {
+            let idle = if flow.id == ids[1] { 20 } else { 10 };
+            flow.last_active = now - Duration::from_secs(idle);
+        }
+        let id = relay.flow_id(&socket, SocketAddr::from(([10, 0, 0, 2], 53)));
+        assert_eq!(id, ids[1]);
+        assert_eq!(relay.flow_count(), MAX_FLOWS);
+    }
+}
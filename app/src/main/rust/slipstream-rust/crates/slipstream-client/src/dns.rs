@@ -1,13 +1,23 @@
+mod batch;
+mod compact;
 mod debug;
+mod encoding;
+mod hedge;
 mod path;
 mod poll;
 mod resolver;
 mod response;
+mod transport;
 
+pub(crate) use batch::fill_uplink_batch;
+pub(crate) use compact::compact_packet;
 pub(crate) use debug::maybe_report_debug;
+pub(crate) use encoding::{build_query_qname_into, ResponseEncoding};
+pub(crate) use hedge::{next_hedge_at, select_hedge_path};
 pub(crate) use path::{add_paths, refresh_resolver_path, resolver_mode_to_c};
-pub(crate) use poll::{expire_inflight_polls, send_poll_queries};
+pub(crate) use poll::{expire_inflight_polls, inflight_poll_deadline, send_poll_queries};
 pub(crate) use resolver::{
     reset_resolver_path, resolve_resolvers, sockaddr_storage_to_socket_addr, ResolverState,
 };
 pub(crate) use response::{handle_dns_response, DnsResponseContext};
+pub(crate) use transport::DnsTransport;
@@ -0,0 +1,72 @@
+use crate::error::ClientError;
+use slipstream_dns::{batch_push, BATCH_PACKET_OVERHEAD};
+use slipstream_ffi::picoquic::{picoquic_cnx_t, picoquic_current_time, picoquic_prepare_packet_ex};
+
+use super::compact::compact_packet;
+use super::path::refresh_resolver_path;
+use super::resolver::ResolverState;
+
+// Below this, a packet is mostly header and AEAD tag; stop filling the batch.
+const MIN_BATCHED_PACKET_BYTES: usize = 40;
+
+/// Tries to batch `first` with further packets for the resolver's path, each
+/// prepared into the room left under `limit` payload bytes and compacted when
+/// `compact` is set. On success `batch` holds the batch payload and the number
+/// of packets in it is returned; a result below 2 means `first` should go out
+/// on its own.
+pub(crate) fn fill_uplink_batch(
+    cnx: *mut picoquic_cnx_t,
+    resolver: &mut ResolverState,
+    first: &[u8],
+    limit: usize,
+    compact: bool,
+    batch: &mut Vec<u8>,
+    scratch: &mut [u8],
+) -> Result<usize, ClientError> {
+    batch.clear();
+    let min_len = 1 + first.len() + 2 * BATCH_PACKET_OVERHEAD + MIN_BATCHED_PACKET_BYTES;
+    if min_len > limit || !refresh_resolver_path(cnx, resolver) || !batch_push(batch, first) {
+        return Ok(0);
+    }
+
+    let mut count = 1usize;
+    loop {
+        let room = limit.saturating_sub(batch.len() + BATCH_PACKET_OVERHEAD);
+        if room < MIN_BATCHED_PACKET_BYTES {
+            break;
+        }
+        let current_time = unsafe { picoquic_current_time() };
+        let mut send_length: libc::size_t = 0;
+        let mut addr_to: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+        let mut addr_from: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+        let mut if_index: libc::c_int = 0;
+        let ret = unsafe {
+            picoquic_prepare_packet_ex(
+                cnx,
+                resolver.path_id,
+                current_time,
+                scratch.as_mut_ptr(),
+                room.min(scratch.len()),
+                &mut send_length,
+                &mut addr_to,
+                &mut addr_from,
+                &mut if_index,
+                std::ptr::null_mut(),
+            )
+        };
+        if ret < 0 {
+            return Err(ClientError::new("Failed preparing batched QUIC packet"));
+        }
+        if send_length == 0 || addr_to.ss_family == 0 {
+            break;
+        }
+        let packet_len = compact_packet(cnx, compact, &mut scratch[..send_length]);
+        if !batch_push(batch, &scratch[..packet_len]) {
+            return Err(ClientError::new("Batched QUIC packet exceeds its room"));
+        }
+        count += 1;
+        resolver.debug.send_packets = resolver.debug.send_packets.saturating_add(1);
+        resolver.debug.send_bytes = resolver.debug.send_bytes.saturating_add(send_length as u64);
+    }
+    Ok(count)
+}
@@ -0,0 +1,13 @@
+use slipstream_dns::compact_short_header;
+use slipstream_ffi::picoquic::{picoquic_cnx_t, picoquic_get_remote_cnxid};
+
+/// Replaces the server CID of the 1-RTT packet in `packet` with its slot when
+/// `enabled`, in place. Returns the length to send.
+pub(crate) fn compact_packet(cnx: *mut picoquic_cnx_t, enabled: bool, packet: &mut [u8]) -> usize {
+    if !enabled {
+        return packet.len();
+    }
+    // Every CID a server issues has the same length.
+    let cid_len = unsafe { picoquic_get_remote_cnxid(cnx) }.id_len as usize;
+    compact_short_header(packet, cid_len).unwrap_or(packet.len())
+}
@@ -0,0 +1,538 @@
+use slipstream_dns::{
+    build_multi_answer_qname_into, build_qname_into_with, max_payload_len_for_domain_with,
+    DnsError, QnameEncoding, MULTI_ANSWER_OVERHEAD, RR_NULL, RR_TXT,
+};
+use std::collections::HashSet;
+use std::fmt;
+
+// Queries sent in the trial encoding before it is judged.
+const TRIAL_QUERIES: u32 = 16;
+// Data answers that must come back intact for a trial to pass.
+const TRIAL_INTACT_MIN: u32 = 4;
+// A trial without a verdict this long after its last query is inconclusive.
+const TRIAL_TIMEOUT_US: u64 = 5_000_000;
+const TRIAL_RETRY_US: u64 = 30_000_000;
+// Inconclusive trials of one step before the resolver keeps what it has.
+const TRIAL_ATTEMPTS_MAX: u32 = 3;
+// Broken answers in a row that send a resolver back to single TXT answers and
+// base32 names.
+const BROKEN_STREAK_MAX: u32 = 3;
+
+/// How the server answers a query: the record type the query asks for, and
+/// whether it carries the multi-answer marker. The query name encoding rides
+/// along, since the same trials judge it.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) struct ResponseEncoding {
+    pub(crate) qtype: u16,
+    pub(crate) multi_answer: bool,
+    pub(crate) qname: QnameEncoding,
+}
+
+impl ResponseEncoding {
+    /// One TXT answer per response to a base32 name, which every server and
+    /// resolver carries.
+    pub(crate) const TXT: Self = Self {
+        qtype: RR_TXT,
+        multi_answer: false,
+        qname: QnameEncoding::Base32,
+    };
+}
+
+impl fmt::Display for ResponseEncoding {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let record = if self.qtype == RR_NULL { "NULL" } else { "TXT" };
+        write!(f, "{}", record)?;
+        if self.multi_answer {
+            write!(f, " multi-answer")?;
+        }
+        if self.qname == QnameEncoding::Base64 {
+            write!(f, " to base64 names")?;
+        }
+        Ok(())
+    }
+}
+
+/// Builds the query name for `payload` in the name encoding of `encoding`,
+/// with the multi-answer marker when `encoding` asks for it and the marked
+/// payload still fits the name.
+pub(crate) fn build_query_qname_into(
+    encoding: ResponseEncoding,
+    payload: &[u8],
+    domain: &str,
+    qname: &mut String,
+) -> Result<(), DnsError> {
+    if encoding.multi_answer
+        && payload.len() + MULTI_ANSWER_OVERHEAD
+            <= max_payload_len_for_domain_with(domain, encoding.qname)?
+    {
+        build_multi_answer_qname_into(payload, domain, encoding.qname, qname)
+    } else {
+        build_qname_into_with(payload, domain, encoding.qname, qname)
+    }
+}
+
+/// What a response to a tunnel query shows about its encoding.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) enum ResponseOutcome {
+    /// Answers that decoded into this many packets.
+    Data(usize),
+    /// NXDOMAIN, or NOERROR without answers: the server had nothing to send.
+    Empty,
+    /// SERVFAIL, which resolvers also return when the server is slow.
+    Failed,
+    /// Truncated, malformed, or refused.
+    Broken,
+}
+
+impl ResponseOutcome {
+    /// Classifies `packet`, given the number of packets `decode_response_packets`
+    /// found in it, if any.
+    pub(crate) fn classify(packet: &[u8], packets: Option<usize>) -> Self {
+        if let Some(count) = packets {
+            return ResponseOutcome::Data(count);
+        }
+        if packet.len() < 12 {
+            return ResponseOutcome::Broken;
+        }
+        let flags = u16::from_be_bytes([packet[2], packet[3]]);
+        let ancount = u16::from_be_bytes([packet[6], packet[7]]);
+        if flags & 0x0200 != 0 {
+            return ResponseOutcome::Broken;
+        }
+        match flags & 0x000f {
+            0 if ancount == 0 => ResponseOutcome::Empty,
+            3 => ResponseOutcome::Empty,
+            2 => ResponseOutcome::Failed,
+            _ => ResponseOutcome::Broken,
+        }
+    }
+}
+
+#[derive(Default)]
+struct Step {
+    attempts: u32,
+    settled: bool,
+}
+
+struct Trial {
+    encoding: ResponseEncoding,
+    ids: HashSet<u16>,
+    sent: u32,
+    intact: u32,
+    multi_seen: bool,
+    last_sent_at: u64,
+}
+
+/// Picks the densest downstream encoding a resolver delivers intact.
+///
+/// A resolver starts on single TXT answers to base32 names. The probe then
+/// tries NULL answers, which save a length byte per 255, then several answers
+/// per response, and last base64 names, which carry about a fifth more
+/// payload where the resolver keeps letter case; each step gets a trial of
+/// `TRIAL_QUERIES` queries. A step is kept once enough data answers come back
+/// whole, and multi-answer only once a response actually carried several
+/// packets. A truncated, malformed or refused answer rejects the step for
+/// good; the server refuses names whose case changed on the way. A trial
+/// without a verdict is retried a few times. Answers that later break in a
+/// row send the resolver back to TXT and base32.
+pub(crate) struct EncodingProbe {
+    current: ResponseEncoding,
+    trial: Option<Trial>,
+    null_step: Step,
+    multi_step: Step,
+    case_step: Step,
+    retry_at: u64,
+    broken_streak: u32,
+}
+
+impl EncodingProbe {
+    pub(crate) fn new() -> Self {
+        Self {
+            current: ResponseEncoding::TXT,
+            trial: None,
+            null_step: Step::default(),
+            multi_step: Step::default(),
+            case_step: Step::default(),
+            retry_at: 0,
+            broken_streak: 0,
+        }
+    }
+
+    /// The encoding for query `id`, sent at `now`.
+    pub(crate) fn on_query(&mut self, id: u16, now: u64) -> ResponseEncoding {
+        self.expire_trial(now);
+        if self.trial.is_none() && now >= self.retry_at {
+            self.trial = self.next_candidate().map(|encoding| Trial {
+                encoding,
+                ids: HashSet::new(),
+                sent: 0,
+                intact: 0,
+                multi_seen: false,
+                last_sent_at: now,
+            });
+        }
+        if let Some(trial) = self.trial.as_mut() {
+            if trial.sent < TRIAL_QUERIES {
+                trial.sent += 1;
+                trial.ids.insert(id);
+                trial.last_sent_at = now;
+                return trial.encoding;
+            }
+        }
+        self.current
+    }
+
+    /// Records the response to query `id`. Returns the new encoding when the
+    /// resolver moves to one.
+    pub(crate) fn on_response(
+        &mut self,
+        id: u16,
+        outcome: ResponseOutcome,
+        now: u64,
+    ) -> Option<ResponseEncoding> {
+        if let Some(trial) = self.trial.as_mut() {
+            if trial.ids.remove(&id) {
+                match outcome {
+                    ResponseOutcome::Broken => {
+                        let encoding = trial.encoding;
+                        self.step_for(encoding).settled = true;
+                        self.trial = None;
+                    }
+                    ResponseOutcome::Data(count) => {
+                        trial.intact += 1;
+                        trial.multi_seen |= count > 1;
+                        let multi_needed =
+                            trial.encoding.multi_answer && !self.current.multi_answer;
+                        if trial.intact >= TRIAL_INTACT_MIN && (!multi_needed || trial.multi_seen) {
+                            let encoding = trial.encoding;
+                            self.step_for(encoding).settled = true;
+                            self.trial = None;
+                            self.current = encoding;
+                            self.broken_streak = 0;
+                            return Some(encoding);
+                        }
+                    }
+                    ResponseOutcome::Empty | ResponseOutcome::Failed => {}
+                }
+                if self
+                    .trial
+                    .as_ref()
+                    .is_some_and(|trial| trial.sent >= TRIAL_QUERIES && trial.ids.is_empty())
+                {
+                    self.end_trial(now);
+                }
+                return None;
+            }
+        }
+        self.expire_trial(now);
+        if self.current == ResponseEncoding::TXT {
+            return None;
+        }
+        match outcome {
+            ResponseOutcome::Broken => {
+                self.broken_streak += 1;
+                if self.broken_streak >= BROKEN_STREAK_MAX {
+                    self.current = ResponseEncoding::TXT;
+                    self.null_step.settled = true;
+                    self.multi_step.settled = true;
+                    self.case_step.settled = true;
+                    self.trial = None;
+                    return Some(self.current);
+                }
+            }
+            ResponseOutcome::Data(_) => self.broken_streak = 0,
+            ResponseOutcome::Empty | ResponseOutcome::Failed => {}
+        }
+        None
+    }
+
+    fn next_candidate(&self) -> Option<ResponseEncoding> {
+        if !self.null_step.settled && self.current.qtype != RR_NULL {
+            Some(ResponseEncoding {
+                qtype: RR_NULL,
+                ..self.current
+            })
+        } else if !self.multi_step.settled && !self.current.multi_answer {
+            Some(ResponseEncoding {
+                multi_answer: true,
+                ..self.current
+            })
+        } else if !self.case_step.settled && self.current.qname != QnameEncoding::Base64 {
+            Some(ResponseEncoding {
+                qname: QnameEncoding::Base64,
+                ..self.current
+            })
+        } else {
+            None
+        }
+    }
+
+    fn step_for(&mut self, encoding: ResponseEncoding) -> &mut Step {
+        if encoding.qtype != self.current.qtype {
+            &mut self.null_step
+        } else if encoding.multi_answer != self.current.multi_answer {
+            &mut self.multi_step
+        } else {
+            &mut self.case_step
+        }
+    }
+
+    fn expire_trial(&mut self, now: u64) {
+        if self
+            .trial
+            .as_ref()
+            .is_some_and(|trial| now >= trial.last_sent_at.saturating_add(TRIAL_TIMEOUT_US))
+        {
+            self.end_trial(now);
+        }
+    }
+
+    /// Ends the trial without a verdict.
+    fn end_trial(&mut self, now: u64) {
+        let Some(trial) = self.trial.take() else {
+            return;
+        };
+        let encoding = trial.encoding;
+        let step = self.step_for(encoding);
+        step.attempts += 1;
+        step.settled = step.attempts >= TRIAL_ATTEMPTS_MAX;
+        self.retry_at = now.saturating_add(TRIAL_RETRY_US);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{
+        build_query_qname_into, EncodingProbe, ResponseEncoding, ResponseOutcome, TRIAL_QUERIES,
+        TRIAL_RETRY_US, TRIAL_TIMEOUT_US,
+    };
+    use slipstream_dns::{
+        build_qname_into, build_qname_into_with, max_payload_len_for_domain,
+        max_payload_len_for_domain_with, QnameEncoding, RR_NULL, RR_TXT,
+    };
+
+    const NULL: ResponseEncoding = ResponseEncoding {
+        qtype: RR_NULL,
+        multi_answer: false,
+        qname: QnameEncoding::Base32,
+    };
+    const NULL_MULTI: ResponseEncoding = ResponseEncoding {
+        qtype: RR_NULL,
+        multi_answer: true,
+        qname: QnameEncoding::Base32,
+    };
+    const NULL_MULTI_BASE64: ResponseEncoding = ResponseEncoding {
+        qname: QnameEncoding::Base64,
+        ..NULL_MULTI
+    };
+
+    /// Sends query `id` and answers it with `outcome`.
+    fn exchange(
+        probe: &mut EncodingProbe,
+        id: u16,
+        now: u64,
+        outcome: ResponseOutcome,
+    ) -> (ResponseEncoding, Option<ResponseEncoding>) {
+        let sent = probe.on_query(id, now);
+        (sent, probe.on_response(id, outcome, now))
+    }
+
+    #[test]
+    fn intact_answers_climb_to_null_multi_answer() {
+        let mut probe = EncodingProbe::new();
+        for id in 0..3 {
+            assert_eq!(
+                exchange(&mut probe, id, 0, ResponseOutcome::Data(1)),
+                (NULL, None)
+            );
+        }
+        assert_eq!(
+            exchange(&mut probe, 3, 0, ResponseOutcome::Data(1)),
+            (NULL, Some(NULL))
+        );
+
+        // Multi-answer needs a response that carried several packets; a
+        // trial without one ends undecided and is retried later.
+        for id in 4..4 + TRIAL_QUERIES as u16 {
+            assert_eq!(
+                exchange(&mut probe, id, 0, ResponseOutcome::Data(1)),
+                (NULL_MULTI, None)
+            );
+        }
+        assert_eq!(probe.on_query(100, 0), NULL);
+        let later = TRIAL_RETRY_US;
+        for id in 200..203 {
+            exchange(&mut probe, id, later, ResponseOutcome::Data(2));
+        }
+        assert_eq!(
+            exchange(&mut probe, 203, later, ResponseOutcome::Data(3)),
+            (NULL_MULTI, Some(NULL_MULTI))
+        );
+
+        for id in 300..303 {
+            exchange(&mut probe, id, later, ResponseOutcome::Empty);
+            exchange(&mut probe, id + 10, later, ResponseOutcome::Data(1));
+        }
+        assert_eq!(
+            exchange(&mut probe, 313, later, ResponseOutcome::Data(1)),
+            (NULL_MULTI_BASE64, Some(NULL_MULTI_BASE64))
+        );
+        assert_eq!(probe.on_query(400, later), NULL_MULTI_BASE64);
+    }
+
+    #[test]
+    fn refused_base64_names_keep_base32() {
+        let mut probe = EncodingProbe::new();
+        for id in 0..4 {
+            exchange(&mut probe, id, 0, ResponseOutcome::Data(1));
+        }
+        for id in 4..8 {
+            exchange(&mut probe, id, 0, ResponseOutcome::Data(2));
+        }
+        assert_eq!(probe.current, NULL_MULTI);
+        // The server refuses names whose letter case a resolver changed.
+        assert_eq!(
+            exchange(&mut probe, 8, 0, ResponseOutcome::Data(1)),
+            (NULL_MULTI_BASE64, None)
+        );
+        assert_eq!(
+            exchange(&mut probe, 9, 0, ResponseOutcome::Broken),
+            (NULL_MULTI_BASE64, None)
+        );
+        assert_eq!(probe.on_query(10, TRIAL_RETRY_US), NULL_MULTI);
+    }
+
+    #[test]
+    fn broken_answers_reject_a_step_for_good() {
+        let txt_multi = ResponseEncoding {
+            qtype: RR_TXT,
+            multi_answer: true,
+            qname: QnameEncoding::Base32,
+        };
+        let mut probe = EncodingProbe::new();
+        assert_eq!(
+            exchange(&mut probe, 0, 0, ResponseOutcome::Broken),
+            (NULL, None)
+        );
+        for id in 1..4 {
+            assert_eq!(
+                exchange(&mut probe, id, 0, ResponseOutcome::Data(2)),
+                (txt_multi, None)
+            );
+        }
+        assert_eq!(
+            exchange(&mut probe, 4, 0, ResponseOutcome::Data(2)),
+            (txt_multi, Some(txt_multi))
+        );
+        // NULL stays rejected; base64 names are tried next.
+        assert_eq!(
+            probe.on_query(5, 0),
+            ResponseEncoding {
+                qname: QnameEncoding::Base64,
+                ..txt_multi
+            }
+        );
+    }
+
+    #[test]
+    fn silent_trials_retry_then_stay_on_txt() {
+        let mut probe = EncodingProbe::new();
+        let mut now = 0;
+        for attempt in 0..3 {
+            for id in 0..TRIAL_QUERIES as u16 {
+                assert_eq!(probe.on_query(attempt * 100 + id, now), NULL);
+            }
+            now += TRIAL_TIMEOUT_US;
+            // Within the retry delay, queries go out in the current encoding.
+            assert_eq!(probe.on_query(1000, now), ResponseEncoding::TXT);
+            now += TRIAL_RETRY_US;
+        }
+        assert_ne!(probe.on_query(2000, now).qtype, RR_NULL);
+    }
+
+    #[test]
+    fn broken_streak_falls_back_to_txt() {
+        let mut probe = EncodingProbe::new();
+        for id in 0..4 {
+            exchange(&mut probe, id, 0, ResponseOutcome::Data(1));
+        }
+        assert_eq!(probe.current, NULL);
+        // The multi-answer trial is underway; answers outside it still count.
+        assert_eq!(probe.on_query(100, 0), NULL_MULTI);
+        assert_eq!(probe.on_response(500, ResponseOutcome::Broken, 0), None);
+        assert_eq!(probe.on_response(501, ResponseOutcome::Broken, 0), None);
+        assert_eq!(
+            probe.on_response(502, ResponseOutcome::Broken, 0),
+            Some(ResponseEncoding::TXT)
+        );
+        assert_eq!(probe.on_query(600, 0), ResponseEncoding::TXT);
+    }
+
+    #[test]
+    fn classify_reads_the_header() {
+        let mut header = [0u8; 12];
+        header[2] = 0x84;
+        assert_eq!(
+            ResponseOutcome::classify(&header, None),
+            ResponseOutcome::Empty
+        );
+        assert_eq!(
+            ResponseOutcome::classify(&header, Some(2)),
+            ResponseOutcome::Data(2)
+        );
+        header[3] = 2;
+        assert_eq!(
+            ResponseOutcome::classify(&header, None),
+            ResponseOutcome::Failed
+        );
+        header[3] = 3;
+        assert_eq!(
+            ResponseOutcome::classify(&header, None),
+            ResponseOutcome::Empty
+        );
+        header[3] = 5;
+        assert_eq!(
+            ResponseOutcome::classify(&header, None),
+            ResponseOutcome::Broken
+        );
+        header[2] = 0x86;
+        header[3] = 0;
+        assert_eq!(
+            ResponseOutcome::classify(&header, None),
+            ResponseOutcome::Broken
+        );
+    }
+
+    #[test]
+    fn marker_is_left_out_when_the_name_is_full() {
+        let domain = "test.com";
+        let max = max_payload_len_for_domain(domain).expect("max payload");
+        let mut qname = String::new();
+        let mut plain = String::new();
+        build_query_qname_into(NULL_MULTI, &vec![0x40; max], domain, &mut qname).expect("full");
+        build_qname_into(&vec![0x40; max], domain, &mut plain).expect("plain");
+        assert_eq!(qname, plain);
+        build_query_qname_into(NULL_MULTI, &[0x40; 8], domain, &mut qname).expect("marked");
+        build_qname_into(&[0x40; 8], domain, &mut plain).expect("plain");
+        assert_ne!(qname, plain);
+
+        let base64_max =
+            max_payload_len_for_domain_with(domain, QnameEncoding::Base64).expect("base64 max");
+        assert!(base64_max > max);
+        build_query_qname_into(
+            NULL_MULTI_BASE64,
+            &vec![0x40; base64_max],
+            domain,
+            &mut qname,
+        )
+        .expect("full base64");
+        build_qname_into_with(
+            &vec![0x40; base64_max],
+            domain,
+            QnameEncoding::Base64,
+            &mut plain,
+        )
+        .expect("plain base64");
+        assert_eq!(qname, plain);
+    }
+}
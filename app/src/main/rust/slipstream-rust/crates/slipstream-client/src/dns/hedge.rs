@@ -0,0 +1,276 @@
+use std::collections::{HashMap, VecDeque};
+
+use super::resolver::ResolverState;
+
+// Answered queries kept per resolver for the RTT percentile.
+const RTT_SAMPLES_MAX: usize = 64;
+// Too few samples say nothing about the tail.
+const RTT_SAMPLES_MIN: usize = 8;
+// Queries older than this are lost, not slow.
+const OUTSTANDING_TIMEOUT_US: u64 = 5_000_000;
+const OUTSTANDING_MAX: usize = 512;
+
+struct Outstanding {
+    sent_at: u64,
+    hedged: bool,
+}
+
+/// Round trips of the queries sent to one resolver, for hedging.
+///
+/// Every query counts, data-bearing or poll: whatever the server queued goes
+/// out in the answer to whichever query reaches it first.
+pub(crate) struct PollRtt {
+    outstanding: HashMap<u16, Outstanding>,
+    samples: VecDeque<u64>,
+    sorted: Vec<u64>,
+}
+
+impl PollRtt {
+    pub(crate) fn new() -> Self {
+        Self {
+            outstanding: HashMap::new(),
+            samples: VecDeque::with_capacity(RTT_SAMPLES_MAX),
+            sorted: Vec::with_capacity(RTT_SAMPLES_MAX),
+        }
+    }
+
+    pub(crate) fn on_sent(&mut self, id: u16, now: u64) {
+        if self.outstanding.len() >= OUTSTANDING_MAX {
+            self.expire(now);
+            if self.outstanding.len() >= OUTSTANDING_MAX {
+                return;
+            }
+        }
+        self.outstanding.insert(
+            id,
+            Outstanding {
+                sent_at: now,
+                hedged: false,
+            },
+        );
+    }
+
+    pub(crate) fn on_answer(&mut self, id: u16, now: u64) {
+        let Some(query) = self.outstanding.remove(&id) else {
+            return;
+        };
+        if self.samples.len() >= RTT_SAMPLES_MAX {
+            self.samples.pop_front();
+        }
+        self.samples.push_back(now.saturating_sub(query.sent_at));
+    }
+
+    /// The 90th percentile of the recent round trips, once there are enough.
+    pub(crate) fn p90(&mut self) -> Option<u64> {
+        if self.samples.len() < RTT_SAMPLES_MIN {
+            return None;
+        }
+        self.sorted.clear();
+        self.sorted.extend(self.samples.iter().copied());
+        let rank = (self.sorted.len() * 9).div_ceil(10) - 1;
+        let (_, p90, _) = self.sorted.select_nth_unstable(rank);
+        Some(*p90)
+    }
+
+    /// Marks the oldest query still waiting past `p90` as hedged and returns
+    /// true, so each slow query is hedged once.
+    fn take_overdue(&mut self, p90: u64, now: u64) -> bool {
+        self.expire(now);
+        let overdue = self
+            .outstanding
+            .values_mut()
+            .filter(|query| !query.hedged && now.saturating_sub(query.sent_at) > p90)
+            .min_by_key(|query| query.sent_at);
+        match overdue {
+            Some(query) => {
+                query.hedged = true;
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn expire(&mut self, now: u64) {
+        let expire_before = now.saturating_sub(OUTSTANDING_TIMEOUT_US);
+        self.outstanding
+            .retain(|_, query| query.sent_at > expire_before);
+    }
+
+    pub(crate) fn clear(&mut self) {
+        self.outstanding.clear();
+        self.samples.clear();
+    }
+}
+
+/// Picks the path to hedge a slow query on: the first resolver with a query
+/// outstanding past its p90 round trip, hedged on the other path with the
+/// lowest p90. Returns the index of that path, or None when nothing is
+/// overdue or no other path has answered enough queries yet.
+pub(crate) fn select_hedge_path(resolvers: &mut [ResolverState], now: u64) -> Option<usize> {
+    let p90s = path_p90s(resolvers);
+    for (slow, p90) in p90s.iter().enumerate() {
+        let Some(p90) = *p90 else {
+            continue;
+        };
+        let Some(fastest) = fastest_other_path(&p90s, slow) else {
+            continue;
+        };
+        let overdue = resolvers[slow]
+            .poll_rtt
+            .as_mut()
+            .is_some_and(|rtt| rtt.take_overdue(p90, now));
+        if overdue {
+            return Some(fastest);
+        }
+    }
+    None
+}
+
+/// When `select_hedge_path` next finds a query to hedge, and on which slow
+/// path, if any query could be hedged at all.
+pub(crate) fn next_hedge_at(resolvers: &mut [ResolverState]) -> Option<(u64, usize)> {
+    let p90s = path_p90s(resolvers);
+    let mut earliest: Option<(u64, usize)> = None;
+    for (slow, p90) in p90s.iter().enumerate() {
+        let Some(p90) = *p90 else {
+            continue;
+        };
+        if fastest_other_path(&p90s, slow).is_none() {
+            continue;
+        }
+        let oldest = resolvers[slow].poll_rtt.as_ref().and_then(|rtt| {
+            rtt.outstanding
+                .values()
+                .filter(|query| !query.hedged)
+                .map(|query| query.sent_at)
+                .min()
+        });
+        if let Some(sent_at) = oldest {
+            // Overdue means strictly past the p90, and a lost query is
+            // expired by then.
+            let hedge_at = sent_at
+                .saturating_add(p90.min(OUTSTANDING_TIMEOUT_US))
+                .saturating_add(1);
+            if earliest.is_none_or(|(at, _)| hedge_at < at) {
+                earliest = Some((hedge_at, slow));
+            }
+        }
+    }
+    earliest
+}
+
+fn path_p90s(resolvers: &mut [ResolverState]) -> Vec<Option<u64>> {
+    resolvers
+        .iter_mut()
+        .map(|resolver| match resolver.poll_rtt.as_mut() {
+            Some(rtt) if resolver.added => rtt.p90(),
+            _ => None,
+        })
+        .collect()
+}
+
+fn fastest_other_path(p90s: &[Option<u64>], slow: usize) -> Option<usize> {
+    p90s.iter()
+        .enumerate()
+        .filter(|(index, _)| *index != slow)
+        .filter_map(|(index, p90)| p90.map(|p90| (index, p90)))
+        .min_by_key(|(_, p90)| *p90)
+        .map(|(index, _)| index)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::dns::resolve_resolvers;
+    use slipstream_core::{AddressFamily, HostPort};
+    use slipstream_ffi::{ResolverMode, ResolverSpec, ResolverTransport};
+
+    fn answered(rtts: &[u64]) -> PollRtt {
+        let mut rtt = PollRtt::new();
+        for (id, sample) in rtts.iter().enumerate() {
+            rtt.on_sent(id as u16, 0);
+            rtt.on_answer(id as u16, *sample);
+        }
+        rtt
+    }
+
+    #[test]
+    fn p90_waits_for_enough_samples() {
+        let mut rtt = answered(&[100; RTT_SAMPLES_MIN - 1]);
+        assert_eq!(rtt.p90(), None);
+        rtt.on_sent(1000, 0);
+        rtt.on_answer(1000, 100);
+        assert_eq!(rtt.p90(), Some(100));
+    }
+
+    #[test]
+    fn p90_tracks_the_tail() {
+        let samples: Vec<u64> = (1..=20).map(|ms| ms * 1000).collect();
+        let mut rtt = answered(&samples);
+        assert_eq!(rtt.p90(), Some(18_000));
+        // Unknown and repeated answers are not samples.
+        rtt.on_answer(3, 1_000_000);
+        rtt.on_answer(4000, 1_000_000);
+        assert_eq!(rtt.p90(), Some(18_000));
+    }
+
+    #[test]
+    fn overdue_query_is_hedged_once() {
+        let mut rtt = answered(&[100; 10]);
+        rtt.on_sent(50, 1000);
+        assert!(!rtt.take_overdue(100, 1100));
+        assert!(rtt.take_overdue(100, 1101));
+        assert!(!rtt.take_overdue(100, 2000));
+        rtt.on_sent(51, 1500);
+        assert!(rtt.take_overdue(100, 2000));
+    }
+
+    #[test]
+    fn slow_path_is_hedged_on_the_fastest_other_path() {
+        let specs: Vec<ResolverSpec> = (0..3)
+            .map(|index| ResolverSpec {
+                resolver: HostPort {
+                    host: "127.0.0.1".to_string(),
+                    port: 8853 + index,
+                    family: AddressFamily::V4,
+                },
+                mode: ResolverMode::Recursive,
+                transport: ResolverTransport::Udp,
+            })
+            .collect();
+        let mut resolvers = resolve_resolvers(&specs, 900, false, true, false).expect("resolvers");
+        for (resolver, rtt) in resolvers.iter_mut().zip([5_000, 20_000, 10_000]) {
+            resolver.added = true;
+            resolver.poll_rtt = Some(answered(&[rtt; 10]));
+        }
+        assert_eq!(select_hedge_path(&mut resolvers, 0), None);
+
+        assert_eq!(next_hedge_at(&mut resolvers), None);
+
+        let rtt = resolvers[1].poll_rtt.as_mut().unwrap();
+        rtt.on_sent(100, 1_000_000);
+        assert_eq!(next_hedge_at(&mut resolvers), Some((1_020_001, 1)));
+        assert_eq!(select_hedge_path(&mut resolvers, 1_015_000), None);
+        assert_eq!(select_hedge_path(&mut resolvers, 1_020_001), Some(0));
+        assert_eq!(select_hedge_path(&mut resolvers, 1_030_000), None);
+        assert_eq!(next_hedge_at(&mut resolvers), None);
+
+        // A path that is not up yet is neither hedged nor a hedge.
+        resolvers[0].added = false;
+        resolvers[1]
+            .poll_rtt
+            .as_mut()
+            .unwrap()
+            .on_sent(101, 2_000_000);
+        assert_eq!(select_hedge_path(&mut resolvers, 2_020_001), Some(2));
+    }
+
+    #[test]
+    fn lost_queries_expire() {
+        let mut rtt = PollRtt::new();
+        rtt.on_sent(1, 0);
+        assert!(!rtt.take_overdue(100, OUTSTANDING_TIMEOUT_US));
+        rtt.on_answer(1, OUTSTANDING_TIMEOUT_US + 10);
+        assert!(rtt.samples.is_empty());
+    }
+}
@@ -1,15 +1,16 @@
 use crate::error::ClientError;
-use slipstream_core::net::is_transient_udp_error;
-use slipstream_dns::{build_qname, encode_query, QueryParams, CLASS_IN, RR_TXT};
+use slipstream_dns::{encode_query, QueryParams, CLASS_IN};
 use slipstream_ffi::picoquic::{
     picoquic_cnx_t, picoquic_current_time, picoquic_prepare_packet_ex, slipstream_request_poll,
 };
 use slipstream_ffi::{ClientConfig, ResolverMode};
 use std::collections::HashMap;
-use tokio::net::UdpSocket as TokioUdpSocket;
 
+use super::compact::compact_packet;
+use super::encoding::build_query_qname_into;
 use super::path::refresh_resolver_path;
 use super::resolver::{sockaddr_storage_to_socket_addr, ResolverState};
+use super::transport::DnsTransport;
 use slipstream_core::normalize_dual_stack_addr;
 
 const AUTHORITATIVE_POLL_TIMEOUT_US: u64 = 5_000_000;
@@ -30,16 +31,26 @@ pub(crate) fn expire_inflight_polls(inflight_poll_ids: &mut HashMap<u16, u64>, n
     }
 }
 
+/// When the oldest inflight poll expires, if any.
+pub(crate) fn inflight_poll_deadline(inflight_poll_ids: &HashMap<u16, u64>) -> Option<u64> {
+    inflight_poll_ids
+        .values()
+        .min()
+        .map(|sent_at| sent_at.saturating_add(AUTHORITATIVE_POLL_TIMEOUT_US))
+}
+
 #[allow(clippy::too_many_arguments)]
-pub(crate) async fn send_poll_queries(
+pub(crate) fn send_poll_queries(
     cnx: *mut picoquic_cnx_t,
-    udp: &TokioUdpSocket,
+    transport: &mut DnsTransport,
     config: &ClientConfig<'_>,
     local_addr_storage: &mut libc::sockaddr_storage,
     dns_id: &mut u16,
     resolver: &mut ResolverState,
     remaining: &mut usize,
+    compact: bool,
     send_buf: &mut [u8],
+    qname: &mut String,
 ) -> Result<(), ClientError> {
     if !refresh_resolver_path(cnx, resolver) {
         return Ok(());
@@ -87,12 +98,14 @@ pub(crate) async fn send_poll_queries(
         resolver.debug.polls_sent = resolver.debug.polls_sent.saturating_add(1);
 
         let poll_id = *dns_id;
-        let qname = build_qname(&send_buf[..send_length], config.domain)
+        let encoding = resolver.query_encoding(poll_id, current_time);
+        let send_length = compact_packet(cnx, compact, &mut send_buf[..send_length]);
+        build_query_qname_into(encoding, &send_buf[..send_length], config.domain, qname)
             .map_err(|err| ClientError::new(err.to_string()))?;
         let params = QueryParams {
             id: poll_id,
-            qname: &qname,
-            qtype: RR_TXT,
+            qname,
+            qtype: encoding.qtype,
             qclass: CLASS_IN,
             rd: true,
             cd: false,
@@ -104,17 +117,13 @@ pub(crate) async fn send_poll_queries(
 
         let dest = sockaddr_storage_to_socket_addr(&addr_to)?;
         let dest = normalize_dual_stack_addr(dest);
-        if let Err(err) = udp.send_to(&packet, dest).await {
-            if is_transient_udp_error(&err) {
-                remaining_count = remaining_count.saturating_add(1);
-                *remaining = remaining_count;
-                break;
-            }
-            return Err(ClientError::new(err.to_string()));
-        }
+        transport.queue(&packet, dest);
         if resolver.mode == ResolverMode::Authoritative {
             resolver.inflight_poll_ids.insert(poll_id, current_time);
         }
+        if let Some(rtt) = resolver.poll_rtt.as_mut() {
+            rtt.on_sent(poll_id, current_time);
+        }
     }
 
     Ok(())
@@ -7,6 +7,8 @@ use std::net::SocketAddr;
 use tracing::warn;
 
 use super::debug::DebugMetrics;
+use super::encoding::{EncodingProbe, ResponseEncoding};
+use super::hedge::PollRtt;
 
 pub(crate) struct ResolverState {
     pub(crate) addr: SocketAddr,
@@ -20,8 +22,12 @@ pub(crate) struct ResolverState {
     pub(crate) next_probe_at: u64,
     pub(crate) pending_polls: usize,
     pub(crate) inflight_poll_ids: HashMap<u16, u64>,
-    pub(crate) pacing_budget: Option<PacingPollBudget>,
+    pub(crate) pacing_budget: PacingPollBudget,
     pub(crate) last_pacing_snapshot: Option<PacingBudgetSnapshot>,
+    /// Query round trips, tracked only when polls are hedged.
+    pub(crate) poll_rtt: Option<PollRtt>,
+    /// Downstream encoding trials, run only when encodings are probed.
+    pub(crate) encoding: Option<EncodingProbe>,
     pub(crate) debug: DebugMetrics,
 }
 
@@ -32,12 +38,21 @@ impl ResolverState {
             self.path_id, self.unique_path_id, self.addr, self.mode
         )
     }
+
+    /// The encoding for query `id`, sent at `now`.
+    pub(crate) fn query_encoding(&mut self, id: u16, now: u64) -> ResponseEncoding {
+        self.encoding
+            .as_mut()
+            .map_or(ResponseEncoding::TXT, |probe| probe.on_query(id, now))
+    }
 }
 
 pub(crate) fn resolve_resolvers(
     resolvers: &[ResolverSpec],
     mtu: u32,
     debug_poll: bool,
+    hedge_polls: bool,
+    probe_encodings: bool,
 ) -> Result<Vec<ResolverState>, ClientError> {
     let mut resolved = Vec::with_capacity(resolvers.len());
     let mut seen = HashMap::new();
@@ -65,11 +80,10 @@ pub(crate) fn resolve_resolvers(
             next_probe_at: 0,
             pending_polls: 0,
             inflight_poll_ids: HashMap::new(),
-            pacing_budget: match resolver.mode {
-                ResolverMode::Authoritative => Some(PacingPollBudget::new(mtu)),
-                ResolverMode::Recursive => None,
-            },
+            pacing_budget: PacingPollBudget::new(mtu),
             last_pacing_snapshot: None,
+            poll_rtt: hedge_polls.then(PollRtt::new),
+            encoding: probe_encodings.then(EncodingProbe::new),
             debug: DebugMetrics::new(debug_poll),
         });
     }
@@ -88,6 +102,9 @@ pub(crate) fn reset_resolver_path(resolver: &mut ResolverState) {
     resolver.pending_polls = 0;
     resolver.inflight_poll_ids.clear();
     resolver.last_pacing_snapshot = None;
+    if let Some(rtt) = resolver.poll_rtt.as_mut() {
+        rtt.clear();
+    }
     resolver.probe_attempts = 0;
     resolver.next_probe_at = 0;
 }
@@ -102,7 +119,7 @@ pub(crate) fn sockaddr_storage_to_socket_addr(
 mod tests {
     use super::resolve_resolvers;
     use slipstream_core::{AddressFamily, HostPort};
-    use slipstream_ffi::{ResolverMode, ResolverSpec};
+    use slipstream_ffi::{ResolverMode, ResolverSpec, ResolverTransport};
 
     #[test]
     fn rejects_duplicate_resolver_addr() {
@@ -114,6 +131,7 @@ mod tests {
                     family: AddressFamily::V4,
                 },
                 mode: ResolverMode::Recursive,
+                transport: ResolverTransport::Udp,
             },
             ResolverSpec {
                 resolver: HostPort {
@@ -122,10 +140,11 @@ mod tests {
                     family: AddressFamily::V4,
                 },
                 mode: ResolverMode::Authoritative,
+                transport: ResolverTransport::Udp,
             },
         ];
 
-        match resolve_resolvers(&resolvers, 900, false) {
+        match resolve_resolvers(&resolvers, 900, false, false, false) {
             Ok(_) => panic!("expected duplicate resolver error"),
             Err(err) => assert!(err.to_string().contains("Duplicate resolver address")),
         }
@@ -1,21 +1,26 @@
 use crate::error::ClientError;
-use slipstream_dns::decode_response;
+use slipstream_dns::decode_response_packets;
 use slipstream_ffi::picoquic::{
     picoquic_cnx_t, picoquic_current_time, picoquic_incoming_packet_ex, picoquic_quic_t,
     PICOQUIC_PACKET_LOOP_RECV_MAX,
 };
 use slipstream_ffi::{socket_addr_to_storage, ResolverMode};
 use std::net::SocketAddr;
+use tracing::{info, warn};
 
+use super::encoding::ResponseOutcome;
 use super::resolver::ResolverState;
 use slipstream_core::normalize_dual_stack_addr;
 
 const MAX_POLL_BURST: usize = PICOQUIC_PACKET_LOOP_RECV_MAX;
+const RCODE_FORMAT_ERROR: u16 = 1;
 
 pub(crate) struct DnsResponseContext<'a> {
     pub(crate) quic: *mut picoquic_quic_t,
     pub(crate) local_addr_storage: &'a libc::sockaddr_storage,
     pub(crate) resolvers: &'a mut [ResolverState],
+    /// Whether queries may carry compact short headers.
+    pub(crate) compact_headers: &'a mut bool,
 }
 
 pub(crate) fn handle_dns_response(
@@ -25,7 +30,8 @@ pub(crate) fn handle_dns_response(
 ) -> Result<(), ClientError> {
     let peer = normalize_dual_stack_addr(peer);
     let response_id = dns_response_id(buf);
-    if let Some(payload) = decode_response(buf) {
+    if let Some(packets) = decode_response_packets(buf) {
+        let outcome = ResponseOutcome::classify(buf, Some(packets.len()));
         let resolver_index = ctx
             .resolvers
             .iter()
@@ -43,22 +49,25 @@ pub(crate) fn handle_dns_response(
         let mut first_cnx: *mut picoquic_cnx_t = std::ptr::null_mut();
         let mut first_path: libc::c_int = -1;
         let current_time = unsafe { picoquic_current_time() };
-        let ret = unsafe {
-            picoquic_incoming_packet_ex(
-                ctx.quic,
-                payload.as_ptr() as *mut u8,
-                payload.len(),
-                &mut peer_storage as *mut _ as *mut libc::sockaddr,
-                &mut local_storage as *mut _ as *mut libc::sockaddr,
-                0,
-                0,
-                &mut first_cnx,
-                &mut first_path,
-                current_time,
-            )
-        };
-        if ret < 0 {
-            return Err(ClientError::new("Failed processing inbound QUIC packet"));
+        // Servers filling answers send one QUIC packet per answer record.
+        for mut payload in packets {
+            let ret = unsafe {
+                picoquic_incoming_packet_ex(
+                    ctx.quic,
+                    payload.as_mut_ptr(),
+                    payload.len(),
+                    &mut peer_storage as *mut _ as *mut libc::sockaddr,
+                    &mut local_storage as *mut _ as *mut libc::sockaddr,
+                    0,
+                    0,
+                    &mut first_cnx,
+                    &mut first_path,
+                    current_time,
+                )
+            };
+            if ret < 0 {
+                return Err(ClientError::new("Failed processing inbound QUIC packet"));
+            }
         }
         let resolver = if let Some(resolver) = find_resolver_by_path_id(ctx.resolvers, first_path) {
             Some(resolver)
@@ -75,25 +84,54 @@ pub(crate) fn handle_dns_response(
                 if resolver.mode == ResolverMode::Authoritative {
                     resolver.inflight_poll_ids.remove(&response_id);
                 }
+                if let Some(rtt) = resolver.poll_rtt.as_mut() {
+                    rtt.on_answer(response_id, current_time);
+                }
+                note_encoding(resolver, response_id, outcome, current_time);
             }
             // Both modes: each response triggers a demand-driven poll.
             // For authoritative mode this provides a floor so that the poll
             // rate never drops below the actual response rate, even when BBR's
             // pacing estimate is conservative.
-            resolver.pending_polls =
-                resolver.pending_polls.saturating_add(1).min(MAX_POLL_BURST);
+            resolver.pending_polls = resolver.pending_polls.saturating_add(1).min(MAX_POLL_BURST);
         }
     } else if let Some(response_id) = response_id {
+        // Servers answer a compact header whose slot they cannot map with
+        // FORMERR; full headers let them reset a connection they lost.
+        if *ctx.compact_headers && dns_rcode(buf) == RCODE_FORMAT_ERROR {
+            *ctx.compact_headers = false;
+            warn!("Server could not map a connection ID slot; sending full headers");
+        }
         if let Some(resolver) = find_resolver_by_addr(ctx.resolvers, peer) {
             resolver.debug.dns_responses = resolver.debug.dns_responses.saturating_add(1);
             if resolver.mode == ResolverMode::Authoritative {
                 resolver.inflight_poll_ids.remove(&response_id);
             }
+            let current_time = unsafe { picoquic_current_time() };
+            if let Some(rtt) = resolver.poll_rtt.as_mut() {
+                rtt.on_answer(response_id, current_time);
+            }
+            let outcome = ResponseOutcome::classify(buf, None);
+            note_encoding(resolver, response_id, outcome, current_time);
         }
     }
     Ok(())
 }
 
+fn note_encoding(
+    resolver: &mut ResolverState,
+    response_id: u16,
+    outcome: ResponseOutcome,
+    current_time: u64,
+) {
+    let Some(probe) = resolver.encoding.as_mut() else {
+        return;
+    };
+    if let Some(encoding) = probe.on_response(response_id, outcome, current_time) {
+        info!("Resolver {} answers in {}", resolver.label(), encoding);
+    }
+}
+
 fn find_resolver_by_path_id(
     resolvers: &mut [ResolverState],
     path_id: libc::c_int,
@@ -114,6 +152,12 @@ fn find_resolver_by_addr(
     resolvers.iter_mut().find(|resolver| resolver.addr == peer)
 }
 
+fn dns_rcode(packet: &[u8]) -> u16 {
+    packet
+        .get(2..4)
+        .map_or(0, |flags| u16::from_be_bytes([flags[0], flags[1]]) & 0x000f)
+}
+
 fn dns_response_id(packet: &[u8]) -> Option<u16> {
     if packet.len() < 12 {
         return None;
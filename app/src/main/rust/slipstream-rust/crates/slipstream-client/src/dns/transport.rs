@@ -0,0 +1,629 @@
+//! How queries reach their resolvers.
+//!
+//! Plain resolvers get datagrams from the client's UDP socket. A resolver
+//! given as `tls://host` gets DNS over TLS (RFC 7858) and one given as
+//! `https://host/path` gets DNS over HTTPS (RFC 8484) on HTTP/2. Either way
+//! the client keeps one connection per resolver for as long as it runs and
+//! sends each query as soon as it is built, without waiting for earlier
+//! answers: pipelined over TLS, one request stream each over HTTP/2. Answers
+//! come back through the same receive path as datagrams, tagged with the
+//! resolver's address, so polling, pacing and path handling do not know which
+//! transport a resolver uses.
+//!
+//! A connection that fails drops the queries written to it, as a lossy path
+//! would, and QUIC retransmits what they carried. It is opened again on the
+//! next query after a delay that grows while connecting keeps failing.
+//!
+//! All UDP resolvers share the one unconnected socket and answers are told
+//! apart by their source address. Queries built in a round are queued and go
+//! out together with sendmmsg, and answers are taken with recvmmsg, so a busy
+//! round costs a few system calls rather than one per datagram.
+
+use crate::error::ClientError;
+use bytes::Bytes;
+use once_cell::sync::Lazy;
+use rustls::pki_types::ServerName;
+use slipstream_core::net::{is_transient_udp_error, recv_batch, send_batch, RecvBatch};
+use slipstream_ffi::{ResolverSpec, ResolverTransport};
+use std::collections::HashMap;
+use std::io;
+use std::net::SocketAddr;
+use std::sync::Arc;
+use std::time::Duration;
+use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt, BufReader, Interest};
+use tokio::net::{TcpSocket, TcpStream, UdpSocket as TokioUdpSocket};
+use tokio::sync::mpsc;
+use tokio::time::{sleep, timeout};
+use tokio_rustls::TlsConnector;
+use tracing::{debug, warn};
+
+/// Largest DNS message a stream transport carries.
+const DNS_MESSAGE_MAX: usize = u16::MAX as usize;
+/// Receive buffer per UDP answer.
+const UDP_RECV_BUF_LEN: usize = 4096;
+/// Answers taken per recvmmsg.
+const UDP_RECV_BATCH: usize = 32;
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(5);
+const RECONNECT_DELAY_MIN: Duration = Duration::from_millis(250);
+const RECONNECT_DELAY_MAX: Duration = Duration::from_secs(8);
+const DNS_MESSAGE_MEDIA_TYPE: &str = "application/dns-message";
+
+type Answer = (Vec<u8>, SocketAddr);
+
+static DOT_CONFIG: Lazy<Arc<rustls::ClientConfig>> = Lazy::new(|| tls_config(Vec::new()));
+static DOH_CONFIG: Lazy<Arc<rustls::ClientConfig>> = Lazy::new(|| tls_config(vec![b"h2".to_vec()]));
+
+/// Sends queries to resolvers and receives their answers, whatever the
+/// transport of each.
+pub(crate) struct DnsTransport {
+    udp: TokioUdpSocket,
+    /// Queries for the connection of each stream resolver, by the address
+    /// the resolver's path uses.
+    sessions: HashMap<SocketAddr, mpsc::UnboundedSender<Vec<u8>>>,
+    answers_tx: mpsc::UnboundedSender<Answer>,
+    answers_rx: mpsc::UnboundedReceiver<Answer>,
+    /// UDP queries queued since the last `flush`, back to back, with where
+    /// each ends and goes.
+    queued: Vec<u8>,
+    queued_ends: Vec<(usize, SocketAddr)>,
+    /// Answers of the last `recv` or `try_recv`: those of stream resolvers
+    /// first, then `udp_received` from the socket.
+    stream_answers: Vec<Answer>,
+    udp_answers: RecvBatch,
+    udp_received: usize,
+}
+
+impl DnsTransport {
+    pub(crate) fn new(udp: TokioUdpSocket) -> Self {
+        let (answers_tx, answers_rx) = mpsc::unbounded_channel();
+        Self {
+            udp,
+            sessions: HashMap::new(),
+            answers_tx,
+            answers_rx,
+            queued: Vec::new(),
+            queued_ends: Vec::new(),
+            stream_answers: Vec::new(),
+            udp_answers: RecvBatch::new(UDP_RECV_BATCH, UDP_RECV_BUF_LEN),
+            udp_received: 0,
+        }
+    }
+
+    pub(crate) fn local_addr(&self) -> io::Result<SocketAddr> {
+        self.udp.local_addr()
+    }
+
+    /// Moves to `udp` and drops the resolver connections, which `connect`
+    /// then opens again, e.g. after the network changed under them.
+    pub(crate) fn rebind(&mut self, udp: TokioUdpSocket) {
+        self.udp = udp;
+        self.sessions.clear();
+        self.queued.clear();
+        self.queued_ends.clear();
+    }
+
+    /// Starts the connection `resolver` needs at `addr`, the address its
+    /// path uses, unless it is on UDP or has one already.
+    pub(crate) fn connect(
+        &mut self,
+        resolver: &ResolverSpec,
+        addr: SocketAddr,
+    ) -> Result<(), ClientError> {
+        if resolver.transport == ResolverTransport::Udp || self.sessions.contains_key(&addr) {
+            return Ok(());
+        }
+        let server_name = ServerName::try_from(resolver.resolver.host.clone()).map_err(|_| {
+            ClientError::new(format!(
+                "Invalid TLS server name for resolver: {}",
+                resolver.resolver.host
+            ))
+        })?;
+        let session = StreamSession {
+            addr,
+            server_name,
+            transport: resolver.transport.clone(),
+            authority: authority(&resolver.resolver.host, resolver.resolver.port),
+        };
+        let (queries_tx, queries_rx) = mpsc::unbounded_channel();
+        tokio::spawn(session.run(queries_rx, self.answers_tx.clone()));
+        self.sessions.insert(addr, queries_tx);
+        Ok(())
+    }
+
+    /// Sends `packet` to `dest`: at once to a stream resolver, with the next
+    /// `flush` over UDP.
+    pub(crate) fn queue(&mut self, packet: &[u8], dest: SocketAddr) {
+        if let Some(queries) = self.sessions.get(&dest) {
+            // The session outlives its sender, so this cannot fail.
+            let _ = queries.send(packet.to_vec());
+            return;
+        }
+        self.queued.extend_from_slice(packet);
+        self.queued_ends.push((self.queued.len(), dest));
+    }
+
+    /// Sends the queued UDP queries, as few sendmmsg calls as the socket
+    /// buffer allows. A query whose resolver is unreachable is dropped, as
+    /// the network would.
+    pub(crate) async fn flush(&mut self) -> io::Result<()> {
+        let mut sent = 0;
+        let result = loop {
+            if sent == self.queued_ends.len() {
+                break Ok(());
+            }
+            let mut start = match sent {
+                0 => 0,
+                _ => self.queued_ends[sent - 1].0,
+            };
+            let datagrams: Vec<(&[u8], SocketAddr)> = self.queued_ends[sent..]
+                .iter()
+                .map(|&(end, dest)| {
+                    let packet = &self.queued[start..end];
+                    start = end;
+                    (packet, dest)
+                })
+                .collect();
+            match self
+                .udp
+                .try_io(Interest::WRITABLE, || send_batch(&self.udp, &datagrams))
+            {
+                Ok(count) => sent += count,
+                Err(err) if err.kind() == io::ErrorKind::WouldBlock => {
+                    if let Err(err) = self.udp.writable().await {
+                        break Err(err);
+                    }
+                }
+                Err(err) if err.kind() == io::ErrorKind::Interrupted => {}
+                Err(err) if is_transient_udp_error(&err) => sent += 1,
+                Err(err) => break Err(err),
+            }
+        };
+        self.queued.clear();
+        self.queued_ends.clear();
+        result
+    }
+
+    /// Waits for answers from any resolver and takes those already received;
+    /// see `answer`.
+    pub(crate) async fn recv(&mut self) -> io::Result<usize> {
+        loop {
+            match self.try_recv() {
+                Err(err) if err.kind() == io::ErrorKind::WouldBlock => {}
+                received => return received,
+            }
+            tokio::select! {
+                readable = self.udp.readable() => readable?,
+                Some(answer) = self.answers_rx.recv() => {
+                    self.stream_answers.push(answer);
+                    return Ok(1);
+                }
+            }
+        }
+    }
+
+    /// Takes the answers already received, or fails with `WouldBlock`; see
+    /// `answer`.
+    pub(crate) fn try_recv(&mut self) -> io::Result<usize> {
+        self.stream_answers.clear();
+        self.udp_received = 0;
+        while self.stream_answers.len() < UDP_RECV_BATCH {
+            let Ok(answer) = self.answers_rx.try_recv() else {
+                break;
+            };
+            self.stream_answers.push(answer);
+        }
+        match self.udp.try_io(Interest::READABLE, || {
+            recv_batch(&self.udp, &mut self.udp_answers)
+        }) {
+            Ok(received) => self.udp_received = received,
+            // Whatever went wrong shows again on the next call.
+            Err(_) if !self.stream_answers.is_empty() => {}
+            Err(err) => return Err(err),
+        }
+        Ok(self.stream_answers.len() + self.udp_received)
+    }
+
+    /// The `index`th answer the last `recv` or `try_recv` took, and the
+    /// resolver it came from. UDP answers longer than 4 KiB come out
+    /// truncated, which the decoder rejects.
+    pub(crate) fn answer(&self, index: usize) -> (&[u8], SocketAddr) {
+        match self.stream_answers.get(index) {
+            Some((answer, peer)) => (answer, *peer),
+            None => self.udp_answers.get(index - self.stream_answers.len()),
+        }
+    }
+}
+
+fn tls_config(alpn: Vec<Vec<u8>>) -> Arc<rustls::ClientConfig> {
+    let roots = rustls::RootCertStore {
+        roots: webpki_roots::TLS_SERVER_ROOTS.to_vec(),
+    };
+    let mut config = rustls::ClientConfig::builder_with_provider(Arc::new(
+        rustls::crypto::ring::default_provider(),
+    ))
+    .with_safe_default_protocol_versions()
+    .expect("ring supports the default protocol versions")
+    .with_root_certificates(roots)
+    .with_no_client_auth();
+    config.alpn_protocols = alpn;
+    Arc::new(config)
+}
+
+/// `host[:port]` as it goes in a URI, the port left out when it is 443.
+fn authority(host: &str, port: u16) -> String {
+    let host = if host.contains(':') {
+        format!("[{}]", host)
+    } else {
+        host.to_string()
+    };
+    if port == 443 {
+        host
+    } else {
+        format!("{}:{}", host, port)
+    }
+}
+
+struct StreamSession {
+    addr: SocketAddr,
+    server_name: ServerName<'static>,
+    transport: ResolverTransport,
+    authority: String,
+}
+
+impl StreamSession {
+    /// Serves queries until the transport goes away, connecting on the first
+    /// query and again on the first one after each failure.
+    async fn run(
+        self,
+        mut queries: mpsc::UnboundedReceiver<Vec<u8>>,
+        answers: mpsc::UnboundedSender<Answer>,
+    ) {
+        let mut reconnect_delay = RECONNECT_DELAY_MIN;
+        while let Some(first) = queries.recv().await {
+            let stream = match timeout(CONNECT_TIMEOUT, self.connect()).await {
+                Ok(Ok(stream)) => stream,
+                Ok(Err(err)) => {
+                    warn!("Resolver {}: connection failed: {}", self.addr, err);
+                    self.back_off(&mut queries, &mut reconnect_delay).await;
+                    continue;
+                }
+                Err(_) => {
+                    warn!("Resolver {}: connection timed out", self.addr);
+                    self.back_off(&mut queries, &mut reconnect_delay).await;
+                    continue;
+                }
+            };
+            reconnect_delay = RECONNECT_DELAY_MIN;
+            let result = match &self.transport {
+                ResolverTransport::Https { path } => {
+                    let uri = format!("https://{}{}", self.authority, path);
+                    serve_https(stream, &uri, first, &mut queries, &answers, self.addr).await
+                }
+                _ => serve_tls(stream, first, &mut queries, &answers, self.addr).await,
+            };
+            if let Err(err) = result {
+                debug!("Resolver {}: connection closed: {}", self.addr, err);
+            }
+        }
+    }
+
+    async fn connect(&self) -> io::Result<tokio_rustls::client::TlsStream<TcpStream>> {
+        // The path uses the IPv4-mapped form of IPv4 resolvers.
+        let addr = match self.addr {
+            SocketAddr::V6(v6) => match v6.ip().to_ipv4_mapped() {
+                Some(v4) => SocketAddr::new(v4.into(), v6.port()),
+                None => self.addr,
+            },
+            SocketAddr::V4(_) => self.addr,
+        };
+        let socket = match addr {
+            SocketAddr::V4(_) => TcpSocket::new_v4()?,
+            SocketAddr::V6(_) => TcpSocket::new_v6()?,
+        };
+        // Like the UDP socket, keep the connection out of the VPN.
+        #[cfg(target_os = "android")]
+        {
+            use std::os::fd::AsRawFd;
+            if !crate::android::protect_socket(socket.as_raw_fd()) {
+                return Err(io::Error::other("could not protect the socket"));
+            }
+        }
+        let stream = socket.connect(addr).await?;
+        stream.set_nodelay(true)?;
+        let config = match self.transport {
+            ResolverTransport::Https { .. } => DOH_CONFIG.clone(),
+            _ => DOT_CONFIG.clone(),
+        };
+        TlsConnector::from(config)
+            .connect(self.server_name.clone(), stream)
+            .await
+    }
+
+    /// Waits out the reconnect delay, dropping the queries meant for the
+    /// failed connection.
+    async fn back_off(
+        &self,
+        queries: &mut mpsc::UnboundedReceiver<Vec<u8>>,
+        reconnect_delay: &mut Duration,
+    ) {
+        sleep(*reconnect_delay).await;
+        while queries.try_recv().is_ok() {}
+        *reconnect_delay = (*reconnect_delay * 2).min(RECONNECT_DELAY_MAX);
+    }
+}
+
+/// DNS over TLS: length-prefixed messages both ways, any number of queries
+/// in flight, answers in whatever order the resolver sends them. Returns
+/// when the connection ends, or with `Ok` when the transport goes away.
+async fn serve_tls<S: AsyncRead + AsyncWrite>(
+    stream: S,
+    first: Vec<u8>,
+    queries: &mut mpsc::UnboundedReceiver<Vec<u8>>,
+    answers: &mpsc::UnboundedSender<Answer>,
+    addr: SocketAddr,
+) -> io::Result<()> {
+    let (reader, mut writer) = tokio::io::split(stream);
+    let mut reader = BufReader::new(reader);
+    let write = async {
+        let mut framed = Vec::new();
+        let mut next = Some(first);
+        loop {
+            let query = match next.take() {
+                Some(query) => query,
+                None => match queries.recv().await {
+                    Some(query) => query,
+                    None => return Ok(()),
+                },
+            };
+            framed.clear();
+            push_framed(&mut framed, &query);
+            // Queries built together go out in one record.
+            while let Ok(query) = queries.try_recv() {
+                push_framed(&mut framed, &query);
+            }
+            writer.write_all(&framed).await?;
+            writer.flush().await?;
+        }
+    };
+    let read = async {
+        loop {
+            match read_message(&mut reader).await {
+                Ok(answer) => {
+                    let _ = answers.send((answer, addr));
+                }
+                Err(err) => return Err(err),
+            }
+        }
+    };
+    tokio::select! {
+        result = write => result,
+        result = read => result,
+    }
+}
+
+async fn read_message<R: AsyncRead + Unpin>(reader: &mut R) -> io::Result<Vec<u8>> {
+    let mut len = [0u8; 2];
+    reader.read_exact(&mut len).await?;
+    let mut message = vec![0u8; u16::from_be_bytes(len) as usize];
+    reader.read_exact(&mut message).await?;
+    Ok(message)
+}
+
+fn push_framed(out: &mut Vec<u8>, message: &[u8]) {
+    if message.len() > DNS_MESSAGE_MAX {
+        return;
+    }
+    out.extend_from_slice(&(message.len() as u16).to_be_bytes());
+    out.extend_from_slice(message);
+}
+
+/// DNS over HTTPS on HTTP/2: each query is a POST on its own stream, as many
+/// at once as the server allows. Returns like `serve_tls`.
+async fn serve_https<S: AsyncRead + AsyncWrite + Unpin + Send + 'static>(
+    stream: S,
+    uri: &str,
+    first: Vec<u8>,
+    queries: &mut mpsc::UnboundedReceiver<Vec<u8>>,
+    answers: &mpsc::UnboundedSender<Answer>,
+    addr: SocketAddr,
+) -> io::Result<()> {
+    let (sender, connection) = h2::client::handshake(stream).await.map_err(h2_io)?;
+    tokio::pin!(connection);
+    let mut next = Some(first);
+    loop {
+        let query = match next.take() {
+            Some(query) => query,
+            None => tokio::select! {
+                query = queries.recv() => match query {
+                    Some(query) => query,
+                    None => return Ok(()),
+                },
+                result = &mut connection => return closed(result),
+            },
+        };
+        // Waits while the server's stream limit is reached.
+        let mut ready = tokio::select! {
+            ready = sender.clone().ready() => ready.map_err(h2_io)?,
+            result = &mut connection => return closed(result),
+        };
+        let request = http::Request::post(uri)
+            .header(http::header::CONTENT_TYPE, DNS_MESSAGE_MEDIA_TYPE)
+            .header(http::header::ACCEPT, DNS_MESSAGE_MEDIA_TYPE)
+            .body(())
+            .map_err(io::Error::other)?;
+        let (response, mut body) = ready.send_request(request, false).map_err(h2_io)?;
+        body.send_data(Bytes::from(query), true).map_err(h2_io)?;
+        tokio::spawn(read_https_answer(response, answers.clone(), addr));
+    }
+}
+
+async fn read_https_answer(
+    response: h2::client::ResponseFuture,
+    answers: mpsc::UnboundedSender<Answer>,
+    addr: SocketAddr,
+) {
+    let Ok(response) = response.await else {
+        return;
+    };
+    if response.status() != http::StatusCode::OK {
+        debug!("Resolver {}: HTTP status {}", addr, response.status());
+        return;
+    }
+    let mut body = response.into_body();
+    let mut answer = Vec::new();
+    while let Some(chunk) = body.data().await {
+        let Ok(chunk) = chunk else {
+            return;
+        };
+        let _ = body.flow_control().release_capacity(chunk.len());
+        answer.extend_from_slice(&chunk);
+        if answer.len() > DNS_MESSAGE_MAX {
+            return;
+        }
+    }
+    let _ = answers.send((answer, addr));
+}
+
+fn closed(result: Result<(), h2::Error>) -> io::Result<()> {
+    result.map_err(h2_io)?;
+    Err(io::ErrorKind::UnexpectedEof.into())
+}
+
+fn h2_io(err: h2::Error) -> io::Error {
+    if err.is_io() {
+        err.into_io().unwrap_or_else(|| io::Error::other("h2"))
+    } else {
+        io::Error::other(err)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn addr() -> SocketAddr {
+        "[::ffff:192.0.2.1]:853".parse().unwrap()
+    }
+
+    #[tokio::test]
+    async fn tls_queries_are_pipelined() {
+        let (client, mut server) = tokio::io::duplex(4096);
+        let (queries_tx, mut queries) = mpsc::unbounded_channel();
+        let (answers_tx, mut answers) = mpsc::unbounded_channel();
+        queries_tx.send(vec![2; 20]).unwrap();
+        let session = tokio::spawn(async move {
+            serve_tls(client, vec![1; 12], &mut queries, &answers_tx, addr()).await
+        });
+
+        // Both queries are written before either is answered.
+        let mut expected = Vec::new();
+        push_framed(&mut expected, &[1; 12]);
+        push_framed(&mut expected, &[2; 20]);
+        let mut written = vec![0u8; expected.len()];
+        server.read_exact(&mut written).await.unwrap();
+        assert_eq!(written, expected);
+
+        let mut framed = Vec::new();
+        push_framed(&mut framed, &[4; 300]);
+        push_framed(&mut framed, &[3; 12]);
+        server.write_all(&framed).await.unwrap();
+        assert_eq!(answers.recv().await.unwrap(), (vec![4; 300], addr()));
+        assert_eq!(answers.recv().await.unwrap(), (vec![3; 12], addr()));
+
+        drop(server);
+        assert!(session.await.unwrap().is_err());
+    }
+
+    #[tokio::test]
+    async fn https_queries_share_one_connection() {
+        let (client, server) = tokio::io::duplex(65536);
+        let (queries_tx, mut queries) = mpsc::unbounded_channel();
+        let (answers_tx, mut answers) = mpsc::unbounded_channel();
+        queries_tx.send(vec![2; 20]).unwrap();
+        let session = tokio::spawn(async move {
+            serve_https(
+                client,
+                "https://dns.example/dns-query",
+                vec![1; 12],
+                &mut queries,
+                &answers_tx,
+                addr(),
+            )
+            .await
+        });
+
+        let mut server = h2::server::handshake(server).await.unwrap();
+        let mut requests = Vec::new();
+        for _ in 0..2 {
+            requests.push(server.accept().await.unwrap().unwrap());
+        }
+        // Keep the connection going for the bodies and answers.
+        let server = tokio::spawn(async move { while server.accept().await.is_some() {} });
+        let mut pending = Vec::new();
+        for (request, respond) in requests {
+            assert_eq!(request.method(), http::Method::POST);
+            assert_eq!(request.uri().path(), "/dns-query");
+            assert_eq!(
+                request.headers()[http::header::CONTENT_TYPE],
+                DNS_MESSAGE_MEDIA_TYPE
+            );
+            let query = request.into_body().data().await.unwrap().unwrap();
+            pending.push((query, respond));
+        }
+        // Answer the second query first.
+        for (query, mut respond) in pending.into_iter().rev() {
+            let response = http::Response::builder().status(200).body(()).unwrap();
+            let mut stream = respond.send_response(response, false).unwrap();
+            let mut answer = query.to_vec();
+            answer.push(0xaa);
+            stream.send_data(Bytes::from(answer), true).unwrap();
+        }
+
+        let mut first = vec![2; 20];
+        first.push(0xaa);
+        let mut second = vec![1; 12];
+        second.push(0xaa);
+        assert_eq!(answers.recv().await.unwrap(), (first, addr()));
+        assert_eq!(answers.recv().await.unwrap(), (second, addr()));
+
+        drop(queries_tx);
+        assert!(session.await.unwrap().is_ok());
+        server.abort();
+    }
+
+    #[test]
+    fn authority_brackets_ipv6_and_drops_default_port() {
+        assert_eq!(authority("dns.example", 443), "dns.example");
+        assert_eq!(authority("dns.example", 8443), "dns.example:8443");
+        assert_eq!(authority("2001:db8::1", 443), "[2001:db8::1]");
+    }
+
+    #[tokio::test]
+    async fn udp_queries_flush_and_answers_come_back_together() {
+        let resolver = std::net::UdpSocket::bind("127.0.0.1:0").unwrap();
+        let udp = TokioUdpSocket::bind("127.0.0.1:0").await.unwrap();
+        let client = udp.local_addr().unwrap();
+        let mut transport = DnsTransport::new(udp);
+        for i in 0..3u8 {
+            transport.queue(&[i; 20], resolver.local_addr().unwrap());
+        }
+        transport.flush().await.unwrap();
+
+        let mut buf = [0u8; 64];
+        for i in 0..3u8 {
+            let (len, peer) = resolver.recv_from(&mut buf).unwrap();
+            assert_eq!((&buf[..len], peer), (&[i; 20][..], client));
+            resolver.send_to(&[i; 30], client).unwrap();
+        }
+        let mut answers = Vec::new();
+        while answers.len() < 3 {
+            let received = transport.recv().await.unwrap();
+            for index in 0..received {
+                let (answer, peer) = transport.answer(index);
+                assert_eq!(peer, resolver.local_addr().unwrap());
+                answers.push(answer.to_vec());
+            }
+        }
+        assert_eq!(answers, [[0u8; 30], [1; 30], [2; 30]]);
+    }
+}
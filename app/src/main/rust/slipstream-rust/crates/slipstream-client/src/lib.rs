@@ -3,12 +3,19 @@
 //! This module provides the core functionality for the slipstream DNS tunnel client,
 //! including Android JNI bindings for mobile deployment.
 
+pub mod datagrams;
 pub mod dns;
 pub mod error;
 pub mod pacing;
 pub mod pinning;
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub mod placement;
+pub mod provider;
 pub mod runtime;
+#[cfg(unix)]
+pub mod scan;
 pub mod streams;
+pub mod trace;
 
 #[cfg(target_os = "android")]
 pub mod android;
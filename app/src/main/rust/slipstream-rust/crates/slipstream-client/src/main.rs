@@ -1,15 +1,18 @@
+mod datagrams;
 mod dns;
 mod error;
 mod pacing;
 mod pinning;
+mod provider;
 mod runtime;
 mod streams;
+mod trace;
 
 use clap::{parser::ValueSource, ArgGroup, CommandFactory, FromArgMatches, Parser};
 use slipstream_core::{
     normalize_domain, parse_host_port, parse_host_port_parts, sip003, AddressKind, HostPort,
 };
-use slipstream_ffi::{ClientConfig, ResolverMode, ResolverSpec};
+use slipstream_ffi::{ClientConfig, ResolverMode, ResolverSpec, ResolverTransport};
 use tokio::runtime::Builder;
 use tracing_subscriber::EnvFilter;
 
@@ -31,15 +34,15 @@ struct Args {
     #[arg(long = "tcp-listen-port", short = 'l', default_value_t = 5201)]
     tcp_listen_port: u16,
     #[arg(long = "resolver", short = 'r', value_parser = parse_resolver)]
-    resolver: Vec<HostPort>,
+    resolver: Vec<ResolverTarget>,
     #[arg(
         long = "congestion-control",
         short = 'c',
-        value_parser = ["bbr", "dcubic"]
+        value_parser = ["bbr", "dcubic", "slipstream_bbr"]
     )]
     congestion_control: Option<String>,
     #[arg(long = "authoritative", value_parser = parse_resolver)]
-    authoritative: Vec<HostPort>,
+    authoritative: Vec<ResolverTarget>,
     #[arg(
         short = 'g',
         long = "gso",
@@ -52,6 +55,8 @@ struct Args {
     domain: Option<String>,
     #[arg(long = "cert", value_name = "PATH")]
     cert: Option<String>,
+    #[arg(long = "session-cache-dir", value_name = "DIR")]
+    session_cache_dir: Option<String>,
     #[arg(long = "keep-alive-interval", short = 't', default_value_t = 400)]
     keep_alive_interval: u16,
     #[arg(long = "debug-poll")]
@@ -60,6 +65,16 @@ struct Args {
     debug_streams: bool,
     #[arg(long = "idle-poll-interval", default_value_t = 2000)]
     idle_poll_interval: u64,
+    #[arg(long = "batch-uplink")]
+    batch_uplink: bool,
+    #[arg(long = "hedge-polls")]
+    hedge_polls: bool,
+    #[arg(long = "probe-encodings")]
+    probe_encodings: bool,
+    #[arg(long = "compact-headers")]
+    compact_headers: bool,
+    #[arg(long = "connections", default_value_t = 1, value_parser = parse_connections)]
+    connections: usize,
 }
 
 fn main() {
@@ -141,7 +156,11 @@ fn main() {
                             tracing::error!("SIP003 env error: {}", err);
                             std::process::exit(2);
                         });
-                vec![ResolverSpec { resolver, mode }]
+                vec![ResolverSpec {
+                    resolver,
+                    mode,
+                    transport: ResolverTransport::Udp,
+                }]
             } else {
                 tracing::error!("At least one resolver is required");
                 std::process::exit(2);
@@ -169,6 +188,12 @@ fn main() {
         );
     }
 
+    let session_cache_dir = if args.session_cache_dir.is_some() {
+        args.session_cache_dir.clone()
+    } else {
+        sip003::last_option_value(&sip003_env.plugin_options, "session-cache-dir")
+    };
+
     let keep_alive_interval = if cli_provided(&matches, "keep_alive_interval") {
         args.keep_alive_interval
     } else {
@@ -203,6 +228,12 @@ fn main() {
         debug_poll: args.debug_poll,
         debug_streams: args.debug_streams,
         idle_poll_interval_ms: idle_poll_interval,
+        session_cache_dir: session_cache_dir.as_deref(),
+        batch_uplink: args.batch_uplink,
+        hedge_polls: args.hedge_polls,
+        probe_encodings: args.probe_encodings,
+        compact_headers: args.compact_headers,
+        connections: args.connections,
     };
 
     let runtime = Builder::new_current_thread()
@@ -232,8 +263,45 @@ fn parse_domain(input: &str) -> Result<String, String> {
     normalize_domain(input).map_err(|err| err.to_string())
 }
 
-fn parse_resolver(input: &str) -> Result<HostPort, String> {
-    parse_host_port(input, 53, AddressKind::Resolver).map_err(|err| err.to_string())
+/// A resolver as given on the command line or in plugin options:
+/// `host[:port]` for UDP, `tls://host[:port]` for DNS over TLS or
+/// `https://host[:port][/path]` for DNS over HTTPS.
+#[derive(Debug, Clone)]
+struct ResolverTarget {
+    resolver: HostPort,
+    transport: ResolverTransport,
+}
+
+fn parse_resolver(input: &str) -> Result<ResolverTarget, String> {
+    let (address, default_port, transport) = if let Some(rest) = input.strip_prefix("tls://") {
+        (rest, 853, ResolverTransport::Tls)
+    } else if let Some(rest) = input.strip_prefix("https://") {
+        let (address, path) = match rest.find('/') {
+            Some(index) => rest.split_at(index),
+            None => (rest, "/dns-query"),
+        };
+        let path = path.to_string();
+        (address, 443, ResolverTransport::Https { path })
+    } else {
+        (input, 53, ResolverTransport::Udp)
+    };
+    let resolver = parse_host_port(address, default_port, AddressKind::Resolver)
+        .map_err(|err| err.to_string())?;
+    Ok(ResolverTarget {
+        resolver,
+        transport,
+    })
+}
+
+fn parse_connections(input: &str) -> Result<usize, String> {
+    let trimmed = input.trim();
+    let value = trimmed
+        .parse::<usize>()
+        .map_err(|_| format!("Invalid connections value: {}", trimmed))?;
+    if value == 0 || value > 16 {
+        return Err("connections must be between 1 and 16".to_string());
+    }
+    Ok(value)
 }
 
 fn build_resolvers(matches: &clap::ArgMatches, require: bool) -> Result<Vec<ResolverSpec>, String> {
@@ -259,8 +327,8 @@ fn collect_resolvers(
     ordered: &mut Vec<(usize, ResolverSpec)>,
 ) -> Result<(), String> {
     let indices: Vec<usize> = matches.indices_of(name).into_iter().flatten().collect();
-    let values: Vec<HostPort> = matches
-        .get_many::<HostPort>(name)
+    let values: Vec<ResolverTarget> = matches
+        .get_many::<ResolverTarget>(name)
         .into_iter()
         .flatten()
         .cloned()
@@ -268,8 +336,13 @@ fn collect_resolvers(
     if indices.len() != values.len() {
         return Err(format!("Mismatched {} arguments", name));
     }
-    for (idx, resolver) in indices.into_iter().zip(values) {
-        ordered.push((idx, ResolverSpec { resolver, mode }));
+    for (idx, target) in indices.into_iter().zip(values) {
+        let spec = ResolverSpec {
+            resolver: target.resolver,
+            mode,
+            transport: target.transport,
+        };
+        ordered.push((idx, spec));
     }
     Ok(())
 }
@@ -280,11 +353,11 @@ fn cli_provided(matches: &clap::ArgMatches, id: &str) -> bool {
 
 fn has_cli_resolvers(matches: &clap::ArgMatches) -> bool {
     matches
-        .get_many::<HostPort>("resolver")
+        .get_many::<ResolverTarget>("resolver")
         .map(|values| values.len() > 0)
         .unwrap_or(false)
         || matches
-            .get_many::<HostPort>("authoritative")
+            .get_many::<ResolverTarget>("authoritative")
             .map(|values| values.len() > 0)
             .unwrap_or(false)
 }
@@ -338,9 +411,12 @@ fn parse_resolvers_from_options(
         }
         let entries = sip003::split_list(&option.value).map_err(|err| err.to_string())?;
         for entry in entries {
-            let resolver = parse_host_port(&entry, 53, AddressKind::Resolver)
-                .map_err(|err| err.to_string())?;
-            ordered.push(ResolverSpec { resolver, mode });
+            let target = parse_resolver(&entry)?;
+            ordered.push(ResolverSpec {
+                resolver: target.resolver,
+                mode,
+                transport: target.transport,
+            });
         }
     }
     Ok(ResolverOptions {
@@ -354,7 +430,7 @@ fn parse_congestion_control(options: &[sip003::Sip003Option]) -> Result<Option<S
     for option in options {
         if option.key == "congestion-control" {
             let value = option.value.trim();
-            if value != "bbr" && value != "dcubic" {
+            if value != "bbr" && value != "dcubic" && value != "slipstream_bbr" {
                 return Err(format!("Invalid congestion-control value: {}", value));
             }
             last = Some(value.to_string());
@@ -470,6 +546,39 @@ mod tests {
         assert!(!parsed.authoritative_remote);
     }
 
+    #[test]
+    fn parses_stream_resolvers() {
+        let target = parse_resolver("tls://1.1.1.1").expect("DoT resolver should parse");
+        assert_eq!(target.resolver.host, "1.1.1.1");
+        assert_eq!(target.resolver.port, 853);
+        assert_eq!(target.transport, ResolverTransport::Tls);
+
+        let target = parse_resolver("https://dns.google").expect("DoH resolver should parse");
+        assert_eq!(target.resolver.host, "dns.google");
+        assert_eq!(target.resolver.port, 443);
+        assert_eq!(
+            target.transport,
+            ResolverTransport::Https {
+                path: "/dns-query".to_string()
+            }
+        );
+
+        let target =
+            parse_resolver("https://[2001:db8::1]:8443/resolve").expect("DoH path should parse");
+        assert_eq!(target.resolver.host, "2001:db8::1");
+        assert_eq!(target.resolver.port, 8443);
+        assert_eq!(
+            target.transport,
+            ResolverTransport::Https {
+                path: "/resolve".to_string()
+            }
+        );
+
+        let target = parse_resolver("9.9.9.9").expect("UDP resolver should parse");
+        assert_eq!(target.resolver.port, 53);
+        assert_eq!(target.transport, ResolverTransport::Udp);
+    }
+
     #[test]
     fn plugin_domain_single_entry() {
         let options = vec![sip003::Sip003Option {
@@ -15,7 +15,6 @@ pub(crate) struct PacingBudgetSnapshot {
 
 pub(crate) struct PacingPollBudget {
     payload_bytes: f64,
-    mtu: u32,
     last_pacing_rate: u64,
 }
 
@@ -24,39 +23,52 @@ impl PacingPollBudget {
         debug_assert!(mtu > 0, "PacingPollBudget::new expects MTU > 0");
         Self {
             payload_bytes: mtu.max(1) as f64,
-            mtu,
             last_pacing_rate: 0,
         }
     }
 
+    /// Derives the poll budget for one RTT from the rates the path's
+    /// congestion controller publishes. `query_rate_mqps` is the DNS
+    /// controller's query-rate target in milli-queries per second, or 0 when
+    /// the path runs a byte-oriented controller and only has a pacing rate.
     pub(crate) fn target_inflight(
         &mut self,
         quality: &picoquic_path_quality_t,
+        query_rate_mqps: u64,
         rtt_proxy_us: u64,
     ) -> PacingBudgetSnapshot {
         let pacing_rate = quality.pacing_rate;
         let rtt_seconds = (self.derive_rtt_us(quality.rtt, rtt_proxy_us) as f64) / 1_000_000.0;
+        if query_rate_mqps > 0 {
+            // The controller already probes; apply its target as is.
+            let qps = query_rate_mqps as f64 / 1000.0;
+            self.last_pacing_rate = pacing_rate;
+            return PacingBudgetSnapshot {
+                pacing_rate,
+                qps,
+                gain: PACING_GAIN_BASE,
+                target_inflight: polls_for_rate(qps, rtt_seconds),
+            };
+        }
         if pacing_rate == 0 {
-            let target_inflight = cwnd_target_polls(quality.cwin, self.mtu);
-            let qps = target_inflight as f64 / rtt_seconds;
+            // Nothing published yet; demand-driven polls carry the path.
             self.last_pacing_rate = 0;
             return PacingBudgetSnapshot {
                 pacing_rate,
-                qps,
+                qps: 0.0,
                 gain: PACING_GAIN_BASE,
-                target_inflight,
+                target_inflight: 0,
             };
         }
 
         let gain = self.next_gain(pacing_rate);
         let qps = (pacing_rate as f64 / self.payload_bytes) * gain;
-        let target_inflight = (qps * rtt_seconds).ceil().min(usize::MAX as f64) as usize;
 
         PacingBudgetSnapshot {
             pacing_rate,
             qps,
             gain,
-            target_inflight,
+            target_inflight: polls_for_rate(qps, rtt_seconds),
         }
     }
 
@@ -78,14 +90,8 @@ impl PacingPollBudget {
     }
 }
 
-pub(crate) fn cwnd_target_polls(cwin: u64, mtu: u32) -> usize {
-    debug_assert!(mtu > 0, "mtu must be > 0");
-    let mtu = mtu as u64;
-    if mtu == 0 {
-        return 0;
-    }
-    let target = cwin.saturating_add(mtu - 1) / mtu;
-    usize::try_from(target).unwrap_or(usize::MAX)
+fn polls_for_rate(qps: f64, rtt_seconds: f64) -> usize {
+    (qps * rtt_seconds).ceil().min(usize::MAX as f64) as usize
 }
 
 pub(crate) fn inflight_packet_estimate(bytes_in_transit: u64, mtu: u32) -> usize {
@@ -101,3 +107,43 @@ pub(crate) fn inflight_packet_estimate(bytes_in_transit: u64, mtu: u32) -> usize
         packets as usize
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn quality(pacing_rate: u64, rtt: u64) -> picoquic_path_quality_t {
+        picoquic_path_quality_t {
+            pacing_rate,
+            rtt,
+            ..Default::default()
+        }
+    }
+
+    #[test]
+    fn query_rate_target_overrides_pacing_rate() {
+        let mut budget = PacingPollBudget::new(100);
+        let snapshot = budget.target_inflight(&quality(1_000_000, 250_000), 40_000, 1);
+        assert_eq!(snapshot.qps, 40.0);
+        assert_eq!(snapshot.gain, PACING_GAIN_BASE);
+        assert_eq!(snapshot.target_inflight, 10);
+    }
+
+    #[test]
+    fn pacing_rate_is_scaled_by_payload() {
+        let mut budget = PacingPollBudget::new(100);
+        let first = budget.target_inflight(&quality(10_000, 250_000), 0, 1);
+        assert_eq!(first.gain, PACING_GAIN_PROBE);
+        assert_eq!(first.target_inflight, 32);
+        let steady = budget.target_inflight(&quality(10_000, 250_000), 0, 1);
+        assert_eq!(steady.gain, PACING_GAIN_BASE);
+        assert_eq!(steady.target_inflight, 25);
+    }
+
+    #[test]
+    fn no_published_rate_leaves_polling_to_demand() {
+        let mut budget = PacingPollBudget::new(100);
+        let snapshot = budget.target_inflight(&quality(0, 0), 0, 1_000);
+        assert_eq!(snapshot.target_inflight, 0);
+    }
+}
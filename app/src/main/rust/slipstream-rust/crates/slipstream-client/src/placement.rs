@@ -0,0 +1,229 @@
+//! CPU placement of the client thread on phones with big and little cores.
+//!
+//! The scheduler tends to leave a thread that sleeps between DNS answers on
+//! a little core at low frequency. `ThreadPlacement::apply` pins the calling
+//! thread to chosen cores, sets its nice level and gives the scheduler a
+//! minimum utilization hint, as hev-socks5-tunnel's misc `thread-*` options
+//! do for the tunnel threads.
+
+use std::fs;
+use tracing::{debug, info, warn};
+
+/// Highest utilization the kernel accepts in `sched_util_min`.
+pub const UTIL_MAX: u32 = 1024;
+
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub enum CpuSelection {
+    /// Keep the inherited affinity.
+    #[default]
+    Any,
+    /// Every core but those of the lowest capacity.
+    Performance,
+    /// These cores.
+    List(Vec<usize>),
+}
+
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct ThreadPlacement {
+    pub cpus: CpuSelection,
+    /// Nice level, 0 keeps the inherited one.
+    pub nice: i32,
+    /// Utilization the thread is run as if it used, up to `UTIL_MAX`; 0 is off.
+    pub util_min: u32,
+}
+
+impl CpuSelection {
+    /// Parses "" (any), "performance" or a list such as "4-7,9".
+    pub fn parse(input: &str) -> Result<Self, String> {
+        let input = input.trim();
+        if input.is_empty() {
+            return Ok(CpuSelection::Any);
+        }
+        if input == "performance" {
+            return Ok(CpuSelection::Performance);
+        }
+        let mut cpus = Vec::new();
+        for part in input.split(',').map(str::trim).filter(|p| !p.is_empty()) {
+            let (first, last) = match part.split_once('-') {
+                Some((first, last)) => (first.trim(), last.trim()),
+                None => (part, part),
+            };
+            let first: usize = first
+                .parse()
+                .map_err(|_| format!("Invalid CPU in {:?}", input))?;
+            let last: usize = last
+                .parse()
+                .map_err(|_| format!("Invalid CPU in {:?}", input))?;
+            if first > last || last >= libc::CPU_SETSIZE as usize {
+                return Err(format!("Invalid CPU range in {:?}", input));
+            }
+            cpus.extend(first..=last);
+        }
+        if cpus.is_empty() {
+            return Err(format!("No CPUs in {:?}", input));
+        }
+        cpus.sort_unstable();
+        cpus.dedup();
+        Ok(CpuSelection::List(cpus))
+    }
+}
+
+/// Cores whose capacity is above the lowest one, or none when they are all
+/// alike or one is unknown.
+fn faster_cpus(capacities: &[u64]) -> Vec<usize> {
+    let Some(&min) = capacities.iter().min() else {
+        return Vec::new();
+    };
+    if min == 0 || capacities.iter().all(|&cap| cap == min) {
+        return Vec::new();
+    }
+    capacities
+        .iter()
+        .enumerate()
+        .filter(|(_, &cap)| cap > min)
+        .map(|(cpu, _)| cpu)
+        .collect()
+}
+
+fn read_cpu_value(cpu: usize, name: &str) -> Option<u64> {
+    fs::read_to_string(format!("/sys/devices/system/cpu/cpu{}/{}", cpu, name))
+        .ok()?
+        .trim()
+        .parse()
+        .ok()
+}
+
+/// Capacity where the kernel knows it, else the top frequency.
+fn cpu_capacities() -> Vec<u64> {
+    // SAFETY: sysconf has no preconditions.
+    let count = unsafe { libc::sysconf(libc::_SC_NPROCESSORS_CONF) }.max(0) as usize;
+    (0..count.min(libc::CPU_SETSIZE as usize))
+        .map(|cpu| {
+            read_cpu_value(cpu, "cpu_capacity")
+                .filter(|&cap| cap > 0)
+                .or_else(|| read_cpu_value(cpu, "cpufreq/cpuinfo_max_freq"))
+                .unwrap_or(0)
+        })
+        .collect()
+}
+
+/// `struct sched_attr` of the kernel, which libc does not declare.
+#[repr(C)]
+#[derive(Default)]
+struct SchedAttr {
+    size: u32,
+    sched_policy: u32,
+    sched_flags: u64,
+    sched_nice: i32,
+    sched_priority: u32,
+    sched_runtime: u64,
+    sched_deadline: u64,
+    sched_period: u64,
+    sched_util_min: u32,
+    sched_util_max: u32,
+}
+
+const SCHED_FLAG_KEEP_POLICY: u64 = 0x08;
+const SCHED_FLAG_KEEP_PARAMS: u64 = 0x10;
+const SCHED_FLAG_UTIL_CLAMP_MIN: u64 = 0x20;
+
+impl ThreadPlacement {
+    /// Places the calling thread. Each step that fails is logged and skipped,
+    /// so the thread always runs.
+    pub fn apply(&self) {
+        let cpus = match &self.cpus {
+            CpuSelection::Any => Vec::new(),
+            CpuSelection::Performance => faster_cpus(&cpu_capacities()),
+            CpuSelection::List(cpus) => cpus.clone(),
+        };
+        if !cpus.is_empty() {
+            // SAFETY: cpu_set_t is plain data, and every index is below
+            // CPU_SETSIZE.
+            let res = unsafe {
+                let mut set: libc::cpu_set_t = std::mem::zeroed();
+                for &cpu in &cpus {
+                    libc::CPU_SET(cpu, &mut set);
+                }
+                libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set)
+            };
+            if res < 0 {
+                warn!(
+                    "Thread affinity {:?}: {}",
+                    cpus,
+                    std::io::Error::last_os_error()
+                );
+            } else {
+                debug!("Thread affinity {:?}", cpus);
+            }
+        } else if self.cpus != CpuSelection::Any {
+            info!("Thread affinity kept, no faster cores");
+        }
+
+        if self.nice != 0 {
+            // SAFETY: only the calling thread's priority changes.
+            let res = unsafe {
+                let tid = libc::syscall(libc::SYS_gettid) as libc::id_t;
+                libc::setpriority(libc::PRIO_PROCESS, tid, self.nice)
+            };
+            if res < 0 {
+                warn!(
+                    "Thread nice {}: {}",
+                    self.nice,
+                    std::io::Error::last_os_error()
+                );
+            }
+        }
+
+        if self.util_min > 0 {
+            let attr = SchedAttr {
+                size: std::mem::size_of::<SchedAttr>() as u32,
+                sched_flags: SCHED_FLAG_KEEP_POLICY
+                    | SCHED_FLAG_KEEP_PARAMS
+                    | SCHED_FLAG_UTIL_CLAMP_MIN,
+                sched_util_min: self.util_min.min(UTIL_MAX),
+                ..Default::default()
+            };
+            // SAFETY: attr outlives the call, which only reads it.
+            let res =
+                unsafe { libc::syscall(libc::SYS_sched_setattr, 0, &attr as *const SchedAttr, 0) };
+            if res < 0 {
+                warn!(
+                    "Thread util-min {}: {}",
+                    self.util_min,
+                    std::io::Error::last_os_error()
+                );
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_cpu_selections() {
+        assert_eq!(CpuSelection::parse(""), Ok(CpuSelection::Any));
+        assert_eq!(
+            CpuSelection::parse("performance"),
+            Ok(CpuSelection::Performance)
+        );
+        assert_eq!(
+            CpuSelection::parse("6, 4-5,5"),
+            Ok(CpuSelection::List(vec![4, 5, 6]))
+        );
+        assert!(CpuSelection::parse("5-4").is_err());
+        assert!(CpuSelection::parse("big").is_err());
+        assert!(CpuSelection::parse(",").is_err());
+    }
+
+    #[test]
+    fn faster_cpus_leave_out_the_little_cluster() {
+        // 4 little, 3 big and a prime core.
+        let caps = [325, 325, 325, 325, 828, 828, 828, 1024];
+        assert_eq!(faster_cpus(&caps), vec![4, 5, 6, 7]);
+        assert!(faster_cpus(&[1024; 8]).is_empty());
+        assert!(faster_cpus(&[0, 1024]).is_empty());
+        assert!(faster_cpus(&[]).is_empty());
+    }
+}
@@ -0,0 +1,167 @@
+//! In-process stream handoff for a tun2socks engine loaded next to the client.
+//!
+//! `slipstream_client_open_stream` returns one end of a Unix socket pair and
+//! hands the other end to the running client as if it had been accepted on the
+//! TCP listener. The caller then speaks the same byte stream as over the
+//! listener, minus the loopback connection and any bridge in front of it. The
+//! signature matches `HevSocks5TunnelProvider` of hev-socks5-tunnel.
+//! `slipstream_client_open_traced_stream` is its `HevSocks5TunnelTraceProvider`
+//! counterpart, for sessions whose milestones `crate::trace` records.
+//!
+//! `slipstream_client_open_datagrams` does the same for UDP sessions with a
+//! datagram socket pair, each message a SOCKS5 UDP request, carried in QUIC
+//! DATAGRAM frames by `crate::datagrams`. It returns -1 while the connection
+//! has not negotiated datagrams, so the engine falls back to its servers.
+
+use std::ffi::c_void;
+use std::os::fd::IntoRawFd;
+use std::os::unix::net::{UnixDatagram, UnixStream};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Mutex;
+use tokio::sync::mpsc;
+
+static STREAMS: Mutex<Option<mpsc::UnboundedSender<ProvidedStream>>> = Mutex::new(None);
+static DATAGRAMS: Mutex<Option<mpsc::UnboundedSender<UnixDatagram>>> = Mutex::new(None);
+static DATAGRAMS_AVAILABLE: AtomicBool = AtomicBool::new(false);
+
+/// A stream handed to the client, and the trace ID of the engine's session
+/// it belongs to, 0 when not traced.
+pub(crate) struct ProvidedStream {
+    pub(crate) stream: UnixStream,
+    pub(crate) trace: u64,
+}
+
+/// Keeps streams flowing to one run of the client, until dropped.
+pub(crate) struct ProviderGuard;
+
+impl Drop for ProviderGuard {
+    fn drop(&mut self) {
+        *STREAMS.lock().unwrap_or_else(|err| err.into_inner()) = None;
+        *DATAGRAMS.lock().unwrap_or_else(|err| err.into_inner()) = None;
+        DATAGRAMS_AVAILABLE.store(false, Ordering::Release);
+    }
+}
+
+pub(crate) fn install(
+    streams: mpsc::UnboundedSender<ProvidedStream>,
+    datagrams: mpsc::UnboundedSender<UnixDatagram>,
+) -> ProviderGuard {
+    *STREAMS.lock().unwrap_or_else(|err| err.into_inner()) = Some(streams);
+    *DATAGRAMS.lock().unwrap_or_else(|err| err.into_inner()) = Some(datagrams);
+    ProviderGuard
+}
+
+/// Whether the current connection carries datagrams.
+pub(crate) fn set_datagrams_available(available: bool) {
+    DATAGRAMS_AVAILABLE.store(available, Ordering::Release);
+}
+
+fn open_stream(trace: u64) -> libc::c_int {
+    let streams = STREAMS.lock().unwrap_or_else(|err| err.into_inner());
+    let Some(streams) = streams.as_ref() else {
+        return -1;
+    };
+    let Ok((local, remote)) = UnixStream::pair() else {
+        return -1;
+    };
+    let stream = ProvidedStream {
+        stream: remote,
+        trace,
+    };
+    if streams.send(stream).is_err() {
+        return -1;
+    }
+    local.into_raw_fd()
+}
+
+/// Open a stream to the server. Returns a connected stream socket owned by the
+/// caller, or -1 when no client is running.
+#[no_mangle]
+pub extern "C" fn slipstream_client_open_stream(_data: *mut c_void) -> libc::c_int {
+    open_stream(0)
+}
+
+/// Open a stream to the server for the engine session traced as `trace`.
+#[no_mangle]
+pub extern "C" fn slipstream_client_open_traced_stream(
+    _data: *mut c_void,
+    trace: u64,
+) -> libc::c_int {
+    open_stream(trace)
+}
+
+/// Open a datagram socket to the server. Returns a connected datagram socket
+/// owned by the caller, or -1 when no client is running or its connection
+/// does not carry datagrams.
+#[no_mangle]
+pub extern "C" fn slipstream_client_open_datagrams(_data: *mut c_void) -> libc::c_int {
+    if !DATAGRAMS_AVAILABLE.load(Ordering::Acquire) {
+        return -1;
+    }
+    let datagrams = DATAGRAMS.lock().unwrap_or_else(|err| err.into_inner());
+    let Some(datagrams) = datagrams.as_ref() else {
+        return -1;
+    };
+    let Ok((local, remote)) = UnixDatagram::pair() else {
+        return -1;
+    };
+    if datagrams.send(remote).is_err() {
+        return -1;
+    }
+    local.into_raw_fd()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::io::{Read, Write};
+    use std::os::fd::FromRawFd;
+
+    #[test]
+    fn open_stream_hands_the_peer_to_the_client() {
+        assert_eq!(slipstream_client_open_stream(std::ptr::null_mut()), -1);
+
+        let (tx, mut rx) = mpsc::unbounded_channel();
+        let (datagram_tx, _datagram_rx) = mpsc::unbounded_channel();
+        let guard = install(tx, datagram_tx);
+        let fd = slipstream_client_open_stream(std::ptr::null_mut());
+        assert!(fd >= 0);
+
+        let mut local = unsafe { UnixStream::from_raw_fd(fd) };
+        let provided = rx.try_recv().expect("peer should be queued");
+        assert_eq!(provided.trace, 0);
+        let mut remote = provided.stream;
+        local.write_all(b"ping").unwrap();
+        let mut buf = [0u8; 4];
+        remote.read_exact(&mut buf).unwrap();
+        assert_eq!(&buf, b"ping");
+
+        let fd = slipstream_client_open_traced_stream(std::ptr::null_mut(), 42);
+        assert!(fd >= 0);
+        drop(unsafe { UnixStream::from_raw_fd(fd) });
+        assert_eq!(rx.try_recv().expect("peer should be queued").trace, 42);
+
+        drop(guard);
+        assert_eq!(slipstream_client_open_stream(std::ptr::null_mut()), -1);
+    }
+
+    #[test]
+    fn open_datagrams_waits_for_a_connection_that_carries_them() {
+        let (tx, _rx) = mpsc::unbounded_channel();
+        let (datagram_tx, mut datagram_rx) = mpsc::unbounded_channel();
+        let guard = install(tx, datagram_tx);
+        assert_eq!(slipstream_client_open_datagrams(std::ptr::null_mut()), -1);
+
+        set_datagrams_available(true);
+        let fd = slipstream_client_open_datagrams(std::ptr::null_mut());
+        assert!(fd >= 0);
+        let local = unsafe { UnixDatagram::from_raw_fd(fd) };
+        let remote = datagram_rx.try_recv().expect("peer should be queued");
+        local.send(b"ping").unwrap();
+        let mut buf = [0u8; 8];
+        assert_eq!(remote.recv(&mut buf).unwrap(), 4);
+
+        drop(guard);
+        assert_eq!(slipstream_client_open_datagrams(std::ptr::null_mut()), -1);
+    }
+}
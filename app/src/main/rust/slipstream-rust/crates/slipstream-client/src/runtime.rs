@@ -1,10 +1,20 @@
+mod connections;
+pub(crate) mod network;
 mod path;
-mod setup;
+mod schedule;
+mod session;
+pub(crate) mod setup;
+#[cfg(any(target_os = "android", test))]
+pub(crate) mod socket_pool;
 
+use self::connections::{join_connections, spread_local_streams};
+use self::network::NetworkWatch;
 use self::path::{
-    apply_path_mode, drain_path_events, fetch_path_quality, find_resolver_by_addr_mut,
-    loop_burst_total, path_poll_burst_max,
+    apply_path_ack_frequency, apply_path_mode, drain_path_events, find_resolver_by_addr_mut,
+    loop_burst_total, path_poll_burst_max, CnxSnapshot,
 };
+use self::schedule::{owed_poll_deadline, PollSchedule};
+use self::session::{SessionSaveGuard, SessionStore};
 use self::setup::{bind_tcp_listener, bind_udp_socket, compute_mtu, map_io};
 
 // Android-specific imports for state signaling
@@ -31,29 +41,37 @@ fn record_connection_failure() {}
 fn exceeded_max_failures() -> bool {
     false
 }
+use crate::datagrams::{self, DATAGRAM_MAX_FRAME_SIZE};
 use crate::dns::{
-    add_paths, expire_inflight_polls, handle_dns_response, maybe_report_debug,
-    refresh_resolver_path, resolve_resolvers, resolver_mode_to_c, send_poll_queries,
-    sockaddr_storage_to_socket_addr, DnsResponseContext,
+    add_paths, build_query_qname_into, compact_packet, expire_inflight_polls, fill_uplink_batch,
+    handle_dns_response, inflight_poll_deadline, maybe_report_debug, next_hedge_at,
+    refresh_resolver_path, resolve_resolvers, resolver_mode_to_c, select_hedge_path,
+    send_poll_queries, sockaddr_storage_to_socket_addr, DnsResponseContext, DnsTransport,
+    ResponseEncoding,
 };
 use crate::error::ClientError;
-use crate::pacing::{cwnd_target_polls, inflight_packet_estimate};
+use crate::pacing::inflight_packet_estimate;
 use crate::pinning::configure_pinned_certificate;
+use crate::provider;
 use crate::streams::{
     acceptor::ClientAcceptor, client_callback, drain_commands, drain_stream_data, handle_command,
     ClientState, Command,
 };
 use slipstream_core::{net::is_transient_udp_error, normalize_dual_stack_addr};
-use slipstream_dns::{build_qname, encode_query, QueryParams, CLASS_IN, RR_TXT};
+use slipstream_dns::{
+    encode_query, max_payload_len_for_domain_with, QnameEncoding, QueryParams, CLASS_IN,
+};
 use slipstream_ffi::{
-    configure_quic_with_custom,
+    configure_cipher_suites, configure_quic_with_custom, cpu_has_aes,
     picoquic::{
         picoquic_close, picoquic_cnx_t, picoquic_connection_id_t, picoquic_create,
         picoquic_create_client_cnx, picoquic_current_time, picoquic_disable_keep_alive,
         picoquic_enable_keep_alive, picoquic_enable_path_callbacks,
         picoquic_enable_path_callbacks_default, picoquic_get_next_wake_delay,
-        picoquic_prepare_next_packet_ex, picoquic_set_callback, slipstream_has_ready_stream,
-        slipstream_is_flow_blocked, slipstream_mixed_cc_algorithm, slipstream_set_cc_override,
+        picoquic_is_0rtt_available, picoquic_prepare_next_packet_ex, picoquic_set_callback,
+        picoquic_set_credit_piggyback_policy, slipstream_datagram_max_payload,
+        slipstream_enable_datagrams, slipstream_is_flow_blocked, slipstream_mixed_cc_algorithm,
+        slipstream_restart_loss_recovery, slipstream_set_cc_override,
         slipstream_set_default_path_mode, PICOQUIC_CONNECTION_ID_MAX_SIZE,
         PICOQUIC_MAX_PACKET_SIZE, PICOQUIC_PACKET_LOOP_RECV_MAX, PICOQUIC_PACKET_LOOP_SEND_MAX,
     },
@@ -61,8 +79,10 @@ use slipstream_ffi::{
 };
 use std::ffi::CString;
 use std::net::Ipv6Addr;
+use std::os::unix::net::UnixDatagram as StdUnixDatagram;
 use std::sync::Arc;
 use std::time::Duration;
+use tokio::net::TcpListener as TokioTcpListener;
 use tokio::sync::{mpsc, Notify};
 use tokio::time::sleep;
 use tracing::{debug, error, info, warn};
@@ -71,12 +91,23 @@ use tracing::{debug, error, info, warn};
 const SLIPSTREAM_ALPN: &str = "picoquic_sample";
 const SLIPSTREAM_SNI: &str = "test.example.com";
 const DNS_WAKE_DELAY_MAX_US: i64 = 10_000_000;
-const DNS_POLL_SLICE_US: u64 = 50_000;
 const RECONNECT_SLEEP_MIN_MS: u64 = 250;
 const RECONNECT_SLEEP_MAX_MS: u64 = 5_000;
 const FLOW_BLOCKED_LOG_INTERVAL_US: u64 = 1_000_000;
 const IDLE_THRESHOLD_US: u64 = 2_000_000; // 2s without streams → idle
 
+// Session tickets arrive shortly after the handshake; save them once they have.
+const SESSION_SAVE_DELAY_US: u64 = 5_000_000;
+
+fn cipher_suite_name(id: u16) -> &'static str {
+    match id {
+        0x1301 => "TLS_AES_128_GCM_SHA256",
+        0x1302 => "TLS_AES_256_GCM_SHA384",
+        0x1303 => "TLS_CHACHA20_POLY1305_SHA256",
+        _ => "an unknown cipher suite",
+    }
+}
+
 fn is_ipv6_unspecified(host: &str) -> bool {
     host.parse::<Ipv6Addr>()
         .map(|addr| addr.is_unspecified())
@@ -94,19 +125,48 @@ fn drain_disconnected_commands(command_rx: &mut mpsc::UnboundedReceiver<Command>
     dropped
 }
 
+/// What every connection of one client run shares.
+struct Shared<'a> {
+    config: &'a ClientConfig<'a>,
+    mtu: u32,
+    batch_limit: usize,
+    base64_batch_limit: usize,
+    alpn: CString,
+    sni: CString,
+    cc_override: Option<CString>,
+    session_store: Option<SessionStore>,
+}
+
+/// One of the client's QUIC connections and the local streams it carries.
+struct Lane {
+    /// The first connection also carries datagrams and reports its state to
+    /// Android; the others only carry streams.
+    primary: bool,
+    listener: TokioTcpListener,
+    local_streams: mpsc::UnboundedReceiver<provider::ProvidedStream>,
+    datagrams: Option<mpsc::UnboundedReceiver<StdUnixDatagram>>,
+}
+
 pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
     let domain_len = config.domain.len();
     let mtu = compute_mtu(domain_len)?;
-    let udp = bind_udp_socket().await?;
+    // Batches fill the name a resolver's query encoding allows.
+    let (batch_limit, base64_batch_limit) = if config.batch_uplink {
+        let limit = |encoding| {
+            max_payload_len_for_domain_with(config.domain, encoding)
+                .map_err(|err| ClientError::new(err.to_string()))
+        };
+        (limit(QnameEncoding::Base32)?, limit(QnameEncoding::Base64)?)
+    } else {
+        (0, 0)
+    };
+    let connections = config.connections.max(1);
+    let reuse_port = connections > 1;
 
-    let (command_tx, mut command_rx) = mpsc::unbounded_channel();
-    let data_notify = Arc::new(Notify::new());
-    let acceptor = ClientAcceptor::new();
-    let debug_streams = config.debug_streams;
     let tcp_host = config.tcp_listen_host;
     let tcp_port = config.tcp_listen_port;
     let mut bound_host = tcp_host.to_string();
-    let listener = match bind_tcp_listener(tcp_host, tcp_port).await {
+    let listener = match bind_tcp_listener(tcp_host, tcp_port, reuse_port).await {
         Ok(listener) => listener,
         Err(err) => {
             if is_ipv6_unspecified(tcp_host) {
@@ -114,7 +174,7 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                     "Failed to bind TCP listener on {}:{} ({}); falling back to 0.0.0.0",
                     tcp_host, tcp_port, err
                 );
-                match bind_tcp_listener("0.0.0.0", tcp_port).await {
+                match bind_tcp_listener("0.0.0.0", tcp_port, reuse_port).await {
                     Ok(listener) => {
                         bound_host = "0.0.0.0".to_string();
                         listener
@@ -131,8 +191,19 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             }
         }
     };
-    acceptor.spawn(listener, command_tx.clone());
+    // The other connections join the port the first listener got.
+    let bound_port = listener.local_addr().map_err(map_io)?.port();
+    let mut listeners = vec![listener];
+    for _ in 1..connections {
+        listeners.push(bind_tcp_listener(&bound_host, bound_port, true).await?);
+    }
+    let (local_tx, local_rx) = mpsc::unbounded_channel();
+    let (datagram_tx, datagram_rx) = mpsc::unbounded_channel();
+    let _provider = provider::install(local_tx, datagram_tx);
     info!("Listening on TCP port {} (host {})", tcp_port, bound_host);
+    if connections > 1 {
+        info!("Spreading streams over {} QUIC connections", connections);
+    }
 
     // Signal to Android that the TCP listener is ready
     signal_listener_ready();
@@ -147,6 +218,65 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
         })?),
         None => None,
     };
+    let session_store = match config.session_cache_dir {
+        Some(dir) => Some(SessionStore::open(dir, config.domain)?),
+        None => None,
+    };
+    let shared = Shared {
+        config,
+        mtu,
+        batch_limit,
+        base64_batch_limit,
+        alpn,
+        sni,
+        cc_override,
+        session_store,
+    };
+
+    let mut datagram_rx = Some(datagram_rx);
+    let lanes = listeners
+        .into_iter()
+        .zip(spread_local_streams(local_rx, connections))
+        .enumerate()
+        .map(|(index, (listener, local_streams))| {
+            run_connection(
+                &shared,
+                Lane {
+                    primary: index == 0,
+                    listener,
+                    local_streams,
+                    datagrams: datagram_rx.take(),
+                },
+            )
+        })
+        .collect();
+    join_connections(lanes).await
+}
+
+async fn run_connection(shared: &Shared<'_>, lane: Lane) -> Result<i32, ClientError> {
+    let Shared {
+        config,
+        mtu,
+        batch_limit,
+        base64_batch_limit,
+        ..
+    } = *shared;
+    let (alpn, sni) = (&shared.alpn, &shared.sni);
+    let cc_override = &shared.cc_override;
+    let session_store = &shared.session_store;
+    let primary = lane.primary;
+    let mut transport = DnsTransport::new(bind_udp_socket().await?);
+    let mut network = NetworkWatch::new();
+
+    let (command_tx, mut command_rx) = mpsc::unbounded_channel();
+    let data_notify = Arc::new(Notify::new());
+    let acceptor = ClientAcceptor::new();
+    let debug_streams = config.debug_streams;
+    acceptor.spawn(lane.listener, command_tx.clone());
+    acceptor.spawn_local(lane.local_streams, command_tx.clone());
+    if let Some(datagram_rx) = lane.datagrams {
+        datagrams::spawn_local(datagram_rx, command_tx.clone());
+    }
 
     let mut state = Box::new(ClientState::new(
         command_tx,
@@ -157,6 +287,11 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
     let state_ptr: *mut ClientState = &mut *state;
     let _state = state;
 
+    let ticket_file = session_store
+        .as_ref()
+        .map(|store| store.ticket_file())
+        .unwrap_or(std::ptr::null());
+
     let mut reconnect_delay = Duration::from_millis(RECONNECT_SLEEP_MIN_MS);
 
     loop {
@@ -166,12 +301,25 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             return Ok(0);
         }
 
-        let mut resolvers = resolve_resolvers(config.resolvers, mtu, config.debug_poll)?;
+        if network.take_change() {
+            transport.rebind(bind_udp_socket().await?);
+        }
+        let mut resolvers = resolve_resolvers(
+            config.resolvers,
+            mtu,
+            config.debug_poll,
+            config.hedge_polls,
+            config.probe_encodings,
+        )?;
         if resolvers.is_empty() {
             return Err(ClientError::new("At least one resolver is required"));
         }
+        for (spec, resolver) in config.resolvers.iter().zip(&resolvers) {
+            transport.connect(spec, resolver.addr)?;
+        }
 
-        let mut local_addr_storage = socket_addr_to_storage(udp.local_addr().map_err(map_io)?);
+        let mut local_addr_storage =
+            socket_addr_to_storage(transport.local_addr().map_err(map_io)?);
 
         let current_time = unsafe { picoquic_current_time() };
         let quic = unsafe {
@@ -188,7 +336,7 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                 std::ptr::null(),
                 current_time,
                 std::ptr::null_mut(),
-                std::ptr::null(),
+                ticket_file,
                 std::ptr::null(),
                 0,
             )
@@ -204,6 +352,10 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             )));
         }
         let _quic_guard = QuicGuard::new(quic);
+        let _session_guard = SessionSaveGuard::new(session_store.as_ref(), quic);
+        if let Some(store) = session_store {
+            store.load_tokens(quic);
+        }
         let mixed_cc = unsafe { slipstream_mixed_cc_algorithm };
         if mixed_cc.is_null() {
             return Err(ClientError::new("Could not load mixed congestion control"));
@@ -211,12 +363,26 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
         unsafe {
             configure_quic_with_custom(quic, mixed_cc, mtu);
             picoquic_enable_path_callbacks_default(quic, 1);
+            // Every packet the client sends is a DNS query, so flow control
+            // credit rides on queries that go out anyway.
+            picoquic_set_credit_piggyback_policy(quic, 1);
+            if slipstream_enable_datagrams(quic, DATAGRAM_MAX_FRAME_SIZE) != 0 {
+                return Err(ClientError::new("Could not enable QUIC datagrams"));
+            }
             let override_ptr = cc_override
                 .as_ref()
                 .map(|value| value.as_ptr())
                 .unwrap_or(std::ptr::null());
             slipstream_set_cc_override(override_ptr);
         }
+        match unsafe { configure_cipher_suites(quic) } {
+            Some(id) => debug!(
+                "Offering {} first (AES instructions: {})",
+                cipher_suite_name(id),
+                cpu_has_aes()
+            ),
+            None => warn!("No TLS cipher suites available"),
+        }
         unsafe {
             slipstream_set_default_path_mode(resolver_mode_to_c(resolvers[0].mode));
         }
@@ -243,6 +409,15 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
 
         apply_path_mode(cnx, &mut resolvers[0])?;
 
+        // A resumed session can carry stream data in 0-RTT packets, within the
+        // stream limit remembered from the ticket, so accept local connections now.
+        if unsafe { picoquic_is_0rtt_available(cnx) } != 0 {
+            info!("Resuming session with 0-RTT");
+            unsafe {
+                (*state_ptr).update_acceptor_limit(cnx);
+            }
+        }
+
         unsafe {
             picoquic_set_callback(cnx, Some(client_callback), state_ptr as *mut _);
             picoquic_enable_path_callbacks(cnx, 1);
@@ -258,8 +433,12 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
         }
 
         let mut dns_id = 1u16;
-        let mut recv_buf = vec![0u8; 4096];
         let mut send_buf = vec![0u8; PICOQUIC_MAX_PACKET_SIZE];
+        let mut qname = String::with_capacity(256);
+        let mut batch_buf = Vec::with_capacity(256);
+        let mut batch_scratch = vec![0u8; 256];
+        // Cleared for the connection once the server fails to map a slot.
+        let mut compact_headers = config.compact_headers;
         let packet_loop_send_max = loop_burst_total(&resolvers, PICOQUIC_PACKET_LOOP_SEND_MAX);
         let packet_loop_recv_max = loop_burst_total(&resolvers, PICOQUIC_PACKET_LOOP_RECV_MAX);
         let mut zero_send_loops = 0u64;
@@ -269,6 +448,9 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
         let idle_poll_interval_us = config.idle_poll_interval_ms.saturating_mul(1000);
         let mut last_active_at: u64 = 0;
         let mut last_idle_poll_at: u64 = 0;
+        let mut ready_at: u64 = 0;
+        let mut session_saved = session_store.is_none();
+        let mut schedule = PollSchedule::new();
 
         loop {
             // Check for shutdown signal from Android
@@ -289,13 +471,30 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             if ready {
                 // Signal QUIC ready to Android (only once per connection)
                 if !quic_ready_signaled {
-                    signal_quic_ready();
                     quic_ready_signaled = true;
+                    if primary {
+                        signal_quic_ready();
+                        // Servers without the UDP relay do not offer datagrams;
+                        // the tun2socks engine then keeps UDP on its own path.
+                        provider::set_datagrams_available(unsafe {
+                            slipstream_datagram_max_payload(cnx) > 0
+                        });
+                    }
                 }
 
                 unsafe {
                     (*state_ptr).update_acceptor_limit(cnx);
                 }
+                if ready_at == 0 {
+                    ready_at = current_time;
+                } else if !session_saved
+                    && current_time.saturating_sub(ready_at) >= SESSION_SAVE_DELAY_US
+                {
+                    if let Some(store) = session_store {
+                        store.save(quic);
+                    }
+                    session_saved = true;
+                }
                 if reconnect_delay != Duration::from_millis(RECONNECT_SLEEP_MIN_MS) {
                     reconnect_delay = Duration::from_millis(RECONNECT_SLEEP_MIN_MS);
                 }
@@ -319,68 +518,105 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             let delay_us = if delay_us < 0 { 0 } else { delay_us as u64 };
             let streams_len_for_sleep = unsafe { (*state_ptr).streams_len() };
             let current_time_for_idle = unsafe { picoquic_current_time() };
-            if streams_len_for_sleep > 0 {
+            let datagrams_active = unsafe { (*state_ptr).last_datagram_activity() }
+                .is_some_and(|at| at.elapsed() < Duration::from_micros(IDLE_THRESHOLD_US));
+            if streams_len_for_sleep > 0 || datagrams_active {
                 last_active_at = current_time_for_idle;
             }
             let is_idle = idle_poll_interval_us > 0
                 && current_time_for_idle.saturating_sub(last_active_at) >= IDLE_THRESHOLD_US;
 
-            let mut has_work = streams_len_for_sleep > 0;
-            for resolver in resolvers.iter_mut() {
+            schedule.clear();
+            let snapshot = CnxSnapshot::fetch(cnx);
+            for (index, resolver) in resolvers.iter_mut().enumerate() {
+                if ready && !resolver.added && resolver.next_probe_at > current_time_for_idle {
+                    // Wake to probe the path again.
+                    schedule.schedule(index, resolver.next_probe_at);
+                }
                 if !refresh_resolver_path(cnx, resolver) {
                     continue;
                 }
+                let (quality, query_rate) = snapshot.path_quality(cnx, resolver);
                 let pending_for_sleep = match resolver.mode {
                     ResolverMode::Authoritative => {
-                        let quality = fetch_path_quality(cnx, resolver);
-                        let snapshot = resolver
-                            .pacing_budget
-                            .as_mut()
-                            .map(|budget| budget.target_inflight(&quality, delay_us.max(1)));
-                        resolver.last_pacing_snapshot = snapshot;
-                        let target = snapshot
-                            .map(|snapshot| snapshot.target_inflight)
-                            .unwrap_or_else(|| cwnd_target_polls(quality.cwin, mtu));
+                        let pacing_snapshot = resolver.pacing_budget.target_inflight(
+                            &quality,
+                            query_rate,
+                            delay_us.max(1),
+                        );
+                        resolver.last_pacing_snapshot = Some(pacing_snapshot);
                         let inflight_packets =
                             inflight_packet_estimate(quality.bytes_in_transit, mtu);
-                        let pacing = target.saturating_sub(inflight_packets);
+                        let pacing = pacing_snapshot
+                            .target_inflight
+                            .saturating_sub(inflight_packets);
                         // Include demand-driven pending_polls so we wake up to
                         // send response-triggered polls even when pacing is zero.
                         pacing.max(resolver.pending_polls)
                     }
-                    ResolverMode::Recursive => resolver.pending_polls,
+                    ResolverMode::Recursive => {
+                        apply_path_ack_frequency(cnx, resolver, query_rate);
+                        // Only the DNS controller publishes a query budget on
+                        // recursive paths; a byte-oriented override keeps them
+                        // purely demand-driven.
+                        resolver.last_pacing_snapshot = if query_rate > 0 {
+                            Some(resolver.pacing_budget.target_inflight(
+                                &quality,
+                                query_rate,
+                                delay_us.max(1),
+                            ))
+                        } else {
+                            None
+                        };
+                        resolver.pending_polls
+                    }
                 };
                 if pending_for_sleep > 0 {
                     if is_idle && resolver.mode == ResolverMode::Authoritative {
                         // When idle, only wake for the next idle poll interval
-                        if current_time_for_idle.saturating_sub(last_idle_poll_at)
-                            >= idle_poll_interval_us
-                        {
-                            has_work = true;
-                        }
+                        schedule.schedule(
+                            index,
+                            last_idle_poll_at.saturating_add(idle_poll_interval_us),
+                        );
                     } else {
-                        has_work = true;
+                        schedule.schedule(
+                            index,
+                            owed_poll_deadline(
+                                current_time_for_idle,
+                                resolver.last_pacing_snapshot,
+                            ),
+                        );
                     }
                 }
-                if resolver.mode == ResolverMode::Authoritative
-                    && !resolver.inflight_poll_ids.is_empty()
-                {
-                    // Don't let lingering inflight_poll_ids force the tight loop when idle
-                    if !is_idle {
-                        has_work = true;
+                if resolver.mode == ResolverMode::Authoritative && !is_idle {
+                    // Wake to expire polls the server never answered; lingering
+                    // inflight_poll_ids don't keep an idle client awake.
+                    if let Some(deadline) = inflight_poll_deadline(&resolver.inflight_poll_ids) {
+                        schedule.schedule(index, deadline);
                     }
                 }
             }
-            // Avoid a tight poll loop when idle, but keep the short slice during active transfers.
+            if config.hedge_polls && unsafe { (*state_ptr).has_latency_sensitive_stream() } {
+                if let Some((deadline, index)) = next_hedge_at(&mut resolvers) {
+                    schedule.schedule(index, deadline);
+                }
+            }
+            // Deadlines and picoquic's next wake (which covers keep-alive) set
+            // the sleep; DNS answers, commands and stream data cut it short.
             // Cap at 2 seconds so shutdown checks (should_shutdown()) happen within the
             // native stop timeout (3s). Without this cap, idle QUIC delays up to 10s
             // can cause the JNI stop to abandon the thread while it still holds the port.
             const MAX_SLEEP_US: u64 = 2_000_000;
-            let timeout_us = if has_work {
-                delay_us.clamp(1, DNS_POLL_SLICE_US)
-            } else {
-                delay_us.max(1).min(MAX_SLEEP_US)
-            };
+            let mut max_sleep_us = MAX_SLEEP_US;
+            if ready_at != 0 && !session_saved {
+                max_sleep_us = max_sleep_us.min(
+                    ready_at
+                        .saturating_add(SESSION_SAVE_DELAY_US)
+                        .saturating_sub(current_time_for_idle)
+                        .max(1),
+                );
+            }
+            let timeout_us = schedule.sleep_us(current_time_for_idle, delay_us, max_sleep_us);
             let timeout = Duration::from_micros(timeout_us);
 
             tokio::select! {
@@ -390,22 +626,32 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                     }
                 }
                 _ = data_notify.notified() => {}
-                recv = udp.recv_from(&mut recv_buf) => {
+                _ = network.changed() => {}
+                recv = transport.recv() => {
                     match recv {
-                        Ok((size, peer)) => {
+                        Ok(mut received) => {
                             let mut response_ctx = DnsResponseContext {
                                 quic,
                                 local_addr_storage: &local_addr_storage,
                                 resolvers: &mut resolvers,
+                                compact_headers: &mut compact_headers,
                             };
-                            handle_dns_response(&recv_buf[..size], peer, &mut response_ctx)?;
-                            for _ in 1..packet_loop_recv_max {
-                                match udp.try_recv_from(&mut recv_buf) {
-                                    Ok((size, peer)) => {
-                                        handle_dns_response(&recv_buf[..size], peer, &mut response_ctx)?;
-                                    }
+                            let mut handled = 0;
+                            loop {
+                                for index in 0..received {
+                                    let (answer, peer) = transport.answer(index);
+                                    handle_dns_response(answer, peer, &mut response_ctx)?;
+                                }
+                                handled += received;
+                                if handled >= packet_loop_recv_max {
+                                    break;
+                                }
+                                match transport.try_recv() {
+                                    Ok(more) => received = more,
                                     Err(err) if err.kind() == std::io::ErrorKind::WouldBlock => break,
-                                    Err(err) if err.kind() == std::io::ErrorKind::Interrupted => continue,
+                                    Err(err) if err.kind() == std::io::ErrorKind::Interrupted => {
+                                        received = 0;
+                                    }
                                     Err(err) => {
                                         if is_transient_udp_error(&err) {
                                             break;
@@ -429,6 +675,16 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             drain_stream_data(cnx, state_ptr);
             drain_path_events(cnx, &mut resolvers, state_ptr);
 
+            if network.take_change() {
+                // picoquic keeps the old local address; see runtime/network.rs.
+                transport.rebind(bind_udp_socket().await?);
+                for (spec, resolver) in config.resolvers.iter().zip(&resolvers) {
+                    transport.connect(spec, resolver.addr)?;
+                }
+                unsafe { slipstream_restart_loss_recovery(cnx, picoquic_current_time()) };
+                info!("Network changed; resuming the connection on new sockets");
+            }
+
             for _ in 0..packet_loop_send_max {
                 let current_time = unsafe { picoquic_current_time() };
                 let mut send_length: libc::size_t = 0;
@@ -479,22 +735,48 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                 if addr_to.ss_family == 0 {
                     break;
                 }
+                let send_length =
+                    compact_packet(cnx, compact_headers, &mut send_buf[..send_length]);
+                let mut payload = &send_buf[..send_length];
+                let query_id = dns_id;
+                let mut encoding = ResponseEncoding::TXT;
                 if let Ok(dest) = sockaddr_storage_to_socket_addr(&addr_to) {
                     let dest = normalize_dual_stack_addr(dest);
                     if let Some(resolver) = find_resolver_by_addr_mut(&mut resolvers, dest) {
+                        if let Some(rtt) = resolver.poll_rtt.as_mut() {
+                            rtt.on_sent(query_id, current_time);
+                        }
+                        encoding = resolver.query_encoding(query_id, current_time);
                         resolver.local_addr_storage = Some(unsafe { std::ptr::read(&addr_from) });
                         resolver.debug.send_packets = resolver.debug.send_packets.saturating_add(1);
                         resolver.debug.send_bytes =
                             resolver.debug.send_bytes.saturating_add(send_length as u64);
+                        let batch_limit = match encoding.qname {
+                            QnameEncoding::Base32 => batch_limit,
+                            QnameEncoding::Base64 => base64_batch_limit,
+                        };
+                        if batch_limit > 0
+                            && fill_uplink_batch(
+                                cnx,
+                                resolver,
+                                payload,
+                                batch_limit,
+                                compact_headers,
+                                &mut batch_buf,
+                                &mut batch_scratch,
+                            )? > 1
+                        {
+                            payload = &batch_buf;
+                        }
                     }
                 }
 
-                let qname = build_qname(&send_buf[..send_length], config.domain)
+                build_query_qname_into(encoding, payload, config.domain, &mut qname)
                     .map_err(|err| ClientError::new(err.to_string()))?;
                 let params = QueryParams {
-                    id: dns_id,
+                    id: query_id,
                     qname: &qname,
-                    qtype: RR_TXT,
+                    qtype: encoding.qtype,
                     qclass: CLASS_IN,
                     rd: true,
                     cd: false,
@@ -508,15 +790,12 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                 let dest = sockaddr_storage_to_socket_addr(&addr_to)?;
                 let dest = normalize_dual_stack_addr(dest);
                 local_addr_storage = addr_from;
-                if let Err(err) = udp.send_to(&packet, dest).await {
-                    if !is_transient_udp_error(&err) {
-                        return Err(map_io(err));
-                    }
-                }
+                transport.queue(&packet, dest);
             }
 
-            let has_ready_stream = unsafe { slipstream_has_ready_stream(cnx) != 0 };
-            let flow_blocked = unsafe { slipstream_is_flow_blocked(cnx) != 0 };
+            let snapshot = CnxSnapshot::fetch(cnx);
+            let has_ready_stream = snapshot.has_ready_stream();
+            let flow_blocked = snapshot.flow_blocked();
             let streams_len = unsafe { (*state_ptr).streams_len() };
             if streams_len > 0 && has_ready_stream && flow_blocked {
                 let now = unsafe { picoquic_current_time() };
@@ -556,11 +835,11 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                 }
                 match resolver.mode {
                     ResolverMode::Authoritative => {
-                        let quality = fetch_path_quality(cnx, resolver);
-                        let snapshot = resolver.last_pacing_snapshot;
-                        let pacing_target = snapshot
+                        let (quality, _) = snapshot.path_quality(cnx, resolver);
+                        let pacing_snapshot = resolver.last_pacing_snapshot;
+                        let pacing_target = pacing_snapshot
                             .map(|snapshot| snapshot.target_inflight)
-                            .unwrap_or_else(|| cwnd_target_polls(quality.cwin, mtu));
+                            .unwrap_or(0);
                         let inflight_packets =
                             inflight_packet_estimate(quality.bytes_in_transit, mtu);
                         let mut pacing_deficit = pacing_target.saturating_sub(inflight_packets);
@@ -601,64 +880,89 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                             let mut to_send = poll_deficit.min(burst_max);
                             send_poll_queries(
                                 cnx,
-                                &udp,
+                                &mut transport,
                                 config,
                                 &mut local_addr_storage,
                                 &mut dns_id,
                                 resolver,
                                 &mut to_send,
+                                compact_headers,
                                 &mut send_buf,
-                            )
-                            .await?;
+                                &mut qname,
+                            )?;
                             if is_idle {
                                 last_idle_poll_at = unsafe { picoquic_current_time() };
                             }
                         }
                     }
                     ResolverMode::Recursive => {
-                        resolver.last_pacing_snapshot = None;
                         if resolver.pending_polls > 0 {
-                            let burst_max = path_poll_burst_max(resolver);
-                            if resolver.pending_polls > burst_max {
-                                let mut to_send = burst_max;
-                                send_poll_queries(
-                                    cnx,
-                                    &udp,
-                                    config,
-                                    &mut local_addr_storage,
-                                    &mut dns_id,
-                                    resolver,
-                                    &mut to_send,
-                                    &mut send_buf,
-                                )
-                                .await?;
-                                resolver.pending_polls = resolver
-                                    .pending_polls
-                                    .saturating_sub(burst_max)
-                                    .saturating_add(to_send);
-                            } else {
-                                let mut pending = resolver.pending_polls;
-                                send_poll_queries(
-                                    cnx,
-                                    &udp,
-                                    config,
-                                    &mut local_addr_storage,
-                                    &mut dns_id,
-                                    resolver,
-                                    &mut pending,
-                                    &mut send_buf,
-                                )
-                                .await?;
-                                resolver.pending_polls = pending;
+                            // Demand-driven polls, capped by the DNS controller's
+                            // query budget so that response bursts cannot outrun
+                            // the resolver's rate limit. Always allow one poll so
+                            // the downstream never stalls on a stale estimate.
+                            let mut send_max = path_poll_burst_max(resolver);
+                            if let Some(pacing_snapshot) = resolver.last_pacing_snapshot {
+                                let (quality, _) = snapshot.path_quality(cnx, resolver);
+                                let inflight_packets =
+                                    inflight_packet_estimate(quality.bytes_in_transit, mtu);
+                                let query_budget = pacing_snapshot
+                                    .target_inflight
+                                    .saturating_sub(inflight_packets);
+                                send_max = send_max.min(query_budget.max(1));
                             }
+                            let mut to_send = resolver.pending_polls.min(send_max);
+                            let deferred = resolver.pending_polls - to_send;
+                            send_poll_queries(
+                                cnx,
+                                &mut transport,
+                                config,
+                                &mut local_addr_storage,
+                                &mut dns_id,
+                                resolver,
+                                &mut to_send,
+                                compact_headers,
+                                &mut send_buf,
+                                &mut qname,
+                            )?;
+                            resolver.pending_polls = deferred.saturating_add(to_send);
                         }
                     }
                 }
             }
 
+            // Hedge a query that is slower than its path usually is with a
+            // poll on the fastest other path, while a stream waits on it.
+            if config.hedge_polls && unsafe { (*state_ptr).has_latency_sensitive_stream() } {
+                let now = unsafe { picoquic_current_time() };
+                if let Some(index) = select_hedge_path(&mut resolvers, now) {
+                    let resolver = &mut resolvers[index];
+                    if resolver.debug.enabled {
+                        debug!("hedging a slow query on {}", resolver.label());
+                    }
+                    let mut to_send = 1;
+                    send_poll_queries(
+                        cnx,
+                        &mut transport,
+                        config,
+                        &mut local_addr_storage,
+                        &mut dns_id,
+                        resolver,
+                        &mut to_send,
+                        compact_headers,
+                        &mut send_buf,
+                        &mut qname,
+                    )?;
+                }
+            }
+
+            // The queries and polls of the round leave together.
+            transport.flush().await.map_err(map_io)?;
+
             let report_time = unsafe { picoquic_current_time() };
             let (enqueued_bytes, last_enqueue_at) = unsafe { (*state_ptr).debug_snapshot() };
             let streams_len = unsafe { (*state_ptr).streams_len() };
+            let snapshot = CnxSnapshot::fetch(cnx);
             for resolver in resolvers.iter_mut() {
                 resolver.debug.enqueued_bytes = enqueued_bytes;
                 resolver.debug.last_enqueue_at = last_enqueue_at;
@@ -670,7 +974,7 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
                 let inflight_polls = resolver.inflight_poll_ids.len();
                 let pending_for_debug = match resolver.mode {
                     ResolverMode::Authoritative => {
-                        let quality = fetch_path_quality(cnx, resolver);
+                        let (quality, _) = snapshot.path_quality(cnx, resolver);
                         let inflight_packets =
                             inflight_packet_estimate(quality.bytes_in_transit, mtu);
                         resolver
@@ -698,8 +1002,9 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
             picoquic_close(cnx, 0);
         }
 
-        // Track connection failures - if we never became ready, count as failure
-        if !quic_ready_signaled {
+        // Track connection failures - if we never became ready, count as failure.
+        // The other connections retry on their own without giving up.
+        if primary && !quic_ready_signaled {
             record_connection_failure();
             if exceeded_max_failures() {
                 error!("Exceeded max consecutive connection failures, giving up");
@@ -710,7 +1015,10 @@ pub async fn run_client(config: &ClientConfig<'_>) -> Result<i32, ClientError> {
         }
 
         // Reset QUIC ready state for reconnection
-        reset_quic_ready();
+        if primary {
+            reset_quic_ready();
+            provider::set_datagrams_available(false);
+        }
 
         unsafe {
             (*state_ptr).reset_for_reconnect();
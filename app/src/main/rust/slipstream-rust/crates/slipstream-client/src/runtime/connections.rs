@@ -0,0 +1,101 @@
+use crate::error::ClientError;
+use crate::provider::ProvidedStream;
+use std::future::{poll_fn, Future};
+use std::pin::Pin;
+use std::task::Poll;
+use tokio::sync::mpsc;
+
+/// Hands streams from `crate::provider` to the connections in turn. Streams
+/// from the TCP listeners need no help: each connection has its own listener
+/// on the shared port, and the kernel spreads accepts over them.
+pub(super) fn spread_local_streams(
+    mut streams: mpsc::UnboundedReceiver<ProvidedStream>,
+    connections: usize,
+) -> Vec<mpsc::UnboundedReceiver<ProvidedStream>> {
+    if connections <= 1 {
+        return vec![streams];
+    }
+    let (senders, receivers): (Vec<_>, Vec<_>) =
+        (0..connections).map(|_| mpsc::unbounded_channel()).unzip();
+    tokio::spawn(async move {
+        let mut next = 0;
+        while let Some(stream) = streams.recv().await {
+            if senders[next].send(stream).is_err() {
+                return;
+            }
+            next = (next + 1) % senders.len();
+        }
+    });
+    receivers
+}
+
+/// Drives every connection on the current task until all of them return,
+/// or one fails.
+pub(super) async fn join_connections<F>(connections: Vec<F>) -> Result<i32, ClientError>
+where
+    F: Future<Output = Result<i32, ClientError>>,
+{
+    let mut pending: Vec<Pin<Box<F>>> = connections.into_iter().map(Box::pin).collect();
+    let mut code = 0;
+    poll_fn(|cx| {
+        let mut index = 0;
+        while index < pending.len() {
+            match pending[index].as_mut().poll(cx) {
+                Poll::Ready(Ok(result)) => {
+                    code = result;
+                    drop(pending.swap_remove(index));
+                }
+                Poll::Ready(Err(err)) => return Poll::Ready(Err(err)),
+                Poll::Pending => index += 1,
+            }
+        }
+        if pending.is_empty() {
+            Poll::Ready(Ok(code))
+        } else {
+            Poll::Pending
+        }
+    })
+    .await
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{join_connections, spread_local_streams};
+    use crate::error::ClientError;
+    use crate::provider::ProvidedStream;
+    use std::os::unix::net::UnixStream as StdUnixStream;
+    use tokio::sync::mpsc;
+
+    #[tokio::test]
+    async fn local_streams_go_round_robin() {
+        let (tx, rx) = mpsc::unbounded_channel();
+        let mut receivers = spread_local_streams(rx, 3);
+        let mut peers = Vec::new();
+        for _ in 0..6 {
+            let (local, remote) = StdUnixStream::pair().unwrap();
+            tx.send(ProvidedStream {
+                stream: remote,
+                trace: 0,
+            })
+            .unwrap();
+            peers.push(local);
+        }
+        for receiver in receivers.iter_mut() {
+            for _ in 0..2 {
+                assert!(receiver.recv().await.is_some());
+            }
+            assert!(receiver.try_recv().is_err());
+        }
+    }
+
+    #[tokio::test]
+    async fn first_failure_ends_the_join() {
+        let connections: Vec<std::pin::Pin<Box<dyn std::future::Future<Output = _>>>> = vec![
+            Box::pin(std::future::pending::<Result<i32, ClientError>>()),
+            Box::pin(async { Err(ClientError::new("lost")) }),
+        ];
+        assert!(join_connections(connections).await.is_err());
+        let finished: Vec<_> = (0..2).map(|_| async { Ok(0) }).collect();
+        assert_eq!(join_connections(finished).await.unwrap(), 0);
+    }
+}
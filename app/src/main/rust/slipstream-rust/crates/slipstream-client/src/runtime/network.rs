@@ -0,0 +1,76 @@
+//! Moving a running client to a new network without reconnecting.
+//!
+//! The client's QUIC paths lead to resolvers, so the server sees the same
+//! peer addresses whichever network the client sends from; only the client's
+//! own sockets are tied to the old network. On a change each connection
+//! therefore swaps in fresh sockets and keeps reporting its old local
+//! address to picoquic. Connection, paths, streams and congestion state stay;
+//! the loss recovery backoff built up during the outage is cleared so what
+//! was lost goes out again right away.
+
+use once_cell::sync::Lazy;
+use tokio::sync::watch;
+
+static NETWORK: Lazy<watch::Sender<u64>> = Lazy::new(|| watch::channel(0).0);
+
+/// Asks every connection of the running client to move to the current
+/// network. Connections started later are not affected.
+#[cfg_attr(not(target_os = "android"), allow(dead_code))]
+pub fn network_changed() {
+    NETWORK.send_modify(|generation| *generation = generation.wrapping_add(1));
+}
+
+/// One connection's view of network changes.
+pub(crate) struct NetworkWatch {
+    changes: watch::Receiver<u64>,
+    /// A change `changed` saw and `take_change` has not.
+    seen: bool,
+}
+
+impl NetworkWatch {
+    pub(crate) fn new() -> Self {
+        Self {
+            changes: NETWORK.subscribe(),
+            seen: false,
+        }
+    }
+
+    /// Waits until the network changes, or returns at once if it changed
+    /// since the last `take_change`.
+    pub(crate) async fn changed(&mut self) {
+        if self.seen {
+            return;
+        }
+        // The sender lives in a static, so this never fails.
+        let _ = self.changes.changed().await;
+        self.seen = true;
+    }
+
+    /// Whether the network changed since the last call.
+    pub(crate) fn take_change(&mut self) -> bool {
+        let changed = self.seen || self.changes.has_changed().unwrap_or(false);
+        if changed {
+            self.changes.borrow_and_update();
+            self.seen = false;
+        }
+        changed
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[tokio::test]
+    async fn changes_reach_every_watch_once() {
+        let mut first = NetworkWatch::new();
+        let mut second = NetworkWatch::new();
+        assert!(!first.take_change());
+
+        network_changed();
+        first.changed().await;
+        assert!(first.take_change());
+        assert!(!first.take_change());
+        assert!(second.take_change());
+    }
+}
@@ -7,13 +7,21 @@ use crate::streams::{ClientState, PathEvent};
 use slipstream_core::normalize_dual_stack_addr;
 use slipstream_ffi::picoquic::{
     picoquic_cnx_t, picoquic_get_default_path_quality, picoquic_get_path_addr,
-    picoquic_get_path_quality, slipstream_get_path_id_from_unique, slipstream_set_path_ack_delay,
-    slipstream_set_path_mode, PICOQUIC_PACKET_LOOP_SEND_MAX,
+    picoquic_get_path_quality, picoquic_path_quality_t, slipstream_cnx_snapshot_t,
+    slipstream_get_cnx_snapshot, slipstream_get_path_id_from_unique,
+    slipstream_get_path_query_rate, slipstream_set_path_ack_delay,
+    slipstream_set_path_ack_frequency, slipstream_set_path_mode, PICOQUIC_PACKET_LOOP_SEND_MAX,
 };
 use slipstream_ffi::ResolverMode;
 use std::net::SocketAddr;
 
 const AUTHORITATIVE_LOOP_MULTIPLIER: usize = 2;
+/// Packets a recursive path may receive before it must ACK.
+const RECURSIVE_ACK_PACKET_THRESHOLD: u64 = 4;
+/// Bounds of a recursive path's ACK delay; picoquic further caps it at the
+/// max_ack_delay we advertised.
+const RECURSIVE_ACK_DELAY_MIN_US: u64 = 1_000;
+const RECURSIVE_ACK_DELAY_MAX_US: u64 = 25_000;
 
 pub(crate) fn apply_path_mode(
     cnx: *mut picoquic_cnx_t,
@@ -27,9 +35,51 @@ pub(crate) fn apply_path_mode(
         let disable_ack_delay = matches!(resolver.mode, ResolverMode::Authoritative) as libc::c_int;
         slipstream_set_path_ack_delay(cnx, resolver.path_id, disable_ack_delay);
     }
+    apply_path_ack_frequency(cnx, resolver, 0);
     Ok(())
 }
 
+/// Sets how often the path ACKs. Each ACK on a recursive path costs a query
+/// of its own unless it rides with data, so those paths wait for a few packets,
+/// or about one query interval, before sending one. Authoritative paths ACK
+/// as negotiated.
+pub(crate) fn apply_path_ack_frequency(
+    cnx: *mut picoquic_cnx_t,
+    resolver: &ResolverState,
+    query_rate: u64,
+) {
+    if resolver.path_id < 0 {
+        return;
+    }
+    let (packet_threshold, max_ack_delay_us) = path_ack_frequency(resolver.mode, query_rate);
+    unsafe {
+        slipstream_set_path_ack_frequency(
+            cnx,
+            resolver.path_id,
+            packet_threshold,
+            max_ack_delay_us,
+        );
+    }
+}
+
+/// Returns the packet threshold and ACK delay, in microseconds, for a path
+/// sending `query_rate` milli-queries per second; zeros keep the negotiated
+/// values.
+fn path_ack_frequency(mode: ResolverMode, query_rate: u64) -> (u64, u64) {
+    match mode {
+        ResolverMode::Authoritative => (0, 0),
+        ResolverMode::Recursive => {
+            let max_ack_delay_us = if query_rate == 0 {
+                RECURSIVE_ACK_DELAY_MAX_US
+            } else {
+                (1_000_000_000 / query_rate)
+                    .clamp(RECURSIVE_ACK_DELAY_MIN_US, RECURSIVE_ACK_DELAY_MAX_US)
+            };
+            (RECURSIVE_ACK_PACKET_THRESHOLD, max_ack_delay_us)
+        }
+    }
+}
+
 pub(crate) fn fetch_path_quality(
     cnx: *mut picoquic_cnx_t,
     resolver: &ResolverState,
@@ -47,6 +97,75 @@ pub(crate) fn fetch_path_quality(
     quality
 }
 
+/// Returns the DNS congestion controller's query-rate target for the path,
+/// in milli-queries per second, or 0 when the path runs another controller.
+pub(crate) fn fetch_path_query_rate(cnx: *mut picoquic_cnx_t, resolver: &ResolverState) -> u64 {
+    if resolver.path_id < 0 {
+        return 0;
+    }
+    unsafe { slipstream_get_path_query_rate(cnx, resolver.path_id) }
+}
+
+/// The connection's scheduling state, read in one FFI call per loop stage
+/// instead of one call per flag and per resolver path.
+pub(crate) struct CnxSnapshot {
+    inner: slipstream_cnx_snapshot_t,
+}
+
+impl CnxSnapshot {
+    pub(crate) fn fetch(cnx: *mut picoquic_cnx_t) -> Self {
+        let mut inner = slipstream_cnx_snapshot_t::default();
+        unsafe {
+            slipstream_get_cnx_snapshot(cnx, &mut inner as *mut _);
+        }
+        Self { inner }
+    }
+
+    pub(crate) fn flow_blocked(&self) -> bool {
+        self.inner.flow_blocked != 0 || self.inner.stream_blocked != 0
+    }
+
+    pub(crate) fn has_ready_stream(&self) -> bool {
+        self.inner.has_ready_stream != 0
+    }
+
+    /// Returns the path quality and DNS query rate for the resolver's path,
+    /// which must have been refreshed. Paths past the snapshot are looked up
+    /// separately.
+    pub(crate) fn path_quality(
+        &self,
+        cnx: *mut picoquic_cnx_t,
+        resolver: &ResolverState,
+    ) -> (picoquic_path_quality_t, u64) {
+        let path = usize::try_from(resolver.path_id)
+            .ok()
+            .filter(|&path_id| path_id < self.inner.nb_paths as usize)
+            .map(|path_id| &self.inner.paths[path_id])
+            .filter(|path| {
+                path.is_usable != 0
+                    && !matches!(resolver.unique_path_id,
+                        Some(unique_path_id) if unique_path_id != path.unique_path_id)
+            });
+        match path {
+            Some(path) => (
+                picoquic_path_quality_t {
+                    cwin: path.cwin,
+                    rtt: path.smoothed_rtt,
+                    rtt_min: path.rtt_min,
+                    pacing_rate: path.pacing_rate,
+                    bytes_in_transit: path.bytes_in_transit,
+                    ..Default::default()
+                },
+                path.query_rate,
+            ),
+            None => (
+                fetch_path_quality(cnx, resolver),
+                fetch_path_query_rate(cnx, resolver),
+            ),
+        }
+    }
+}
+
 pub(crate) fn drain_path_events(
     cnx: *mut picoquic_cnx_t,
     resolvers: &mut [ResolverState],
@@ -127,3 +246,33 @@ fn find_resolver_by_unique_id_mut(
         .iter_mut()
         .find(|resolver| resolver.unique_path_id == Some(unique_path_id))
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn recursive_paths_ack_about_once_per_query_interval() {
+        assert_eq!(
+            path_ack_frequency(ResolverMode::Authoritative, 100_000),
+            (0, 0)
+        );
+        assert_eq!(
+            path_ack_frequency(ResolverMode::Recursive, 0),
+            (RECURSIVE_ACK_PACKET_THRESHOLD, RECURSIVE_ACK_DELAY_MAX_US)
+        );
+        // 200 queries per second: one every 5 ms.
+        assert_eq!(
+            path_ack_frequency(ResolverMode::Recursive, 200_000),
+            (RECURSIVE_ACK_PACKET_THRESHOLD, 5_000)
+        );
+        assert_eq!(
+            path_ack_frequency(ResolverMode::Recursive, 10_000_000).1,
+            RECURSIVE_ACK_DELAY_MIN_US
+        );
+        assert_eq!(
+            path_ack_frequency(ResolverMode::Recursive, 1_000).1,
+            RECURSIVE_ACK_DELAY_MAX_US
+        );
+    }
+}
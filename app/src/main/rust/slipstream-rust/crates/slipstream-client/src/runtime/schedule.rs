@@ -0,0 +1,98 @@
+use crate::pacing::PacingBudgetSnapshot;
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+
+// Owed polls are due no sooner than this: each wake sends a burst of them, and
+// a path that cannot send yet is not spun on.
+const POLL_RETRY_US: u64 = 5_000;
+
+/// Next-poll deadline of each resolver path, earliest first.
+///
+/// The loop sleeps until the earliest deadline or picoquic's own next wake
+/// (which covers keep-alive and loss recovery), whichever comes first, and is
+/// woken earlier by DNS answers, new local streams and stream data.
+pub(crate) struct PollSchedule {
+    deadlines: BinaryHeap<Reverse<(u64, usize)>>,
+}
+
+impl PollSchedule {
+    pub(crate) fn new() -> Self {
+        Self {
+            deadlines: BinaryHeap::new(),
+        }
+    }
+
+    /// Clears the deadlines for the paths to be scheduled again.
+    pub(crate) fn clear(&mut self) {
+        self.deadlines.clear();
+    }
+
+    pub(crate) fn schedule(&mut self, path_index: usize, deadline: u64) {
+        self.deadlines.push(Reverse((deadline, path_index)));
+    }
+
+    /// The earliest deadline and the path it belongs to.
+    pub(crate) fn earliest(&self) -> Option<(u64, usize)> {
+        self.deadlines.peek().map(|Reverse(entry)| *entry)
+    }
+
+    /// How long to sleep at `now` when picoquic next wants to run in
+    /// `wake_delay_us`, bounded by `max_sleep_us`.
+    pub(crate) fn sleep_us(&self, now: u64, wake_delay_us: u64, max_sleep_us: u64) -> u64 {
+        let until_deadline = self
+            .earliest()
+            .map(|(deadline, _)| deadline.saturating_sub(now))
+            .unwrap_or(u64::MAX);
+        wake_delay_us.min(until_deadline).clamp(1, max_sleep_us)
+    }
+}
+
+/// When polls owed at `now` are due: one query interval of the path's
+/// congestion controller after `now`, or the retry delay when the path
+/// publishes no rate and polls are demand-driven.
+pub(crate) fn owed_poll_deadline(now: u64, pacing: Option<PacingBudgetSnapshot>) -> u64 {
+    let interval_us = pacing
+        .filter(|snapshot| snapshot.qps > 0.0)
+        .map(|snapshot| (1_000_000.0 / snapshot.qps) as u64)
+        .unwrap_or(0);
+    now.saturating_add(interval_us.max(POLL_RETRY_US))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn pacing(qps: f64) -> Option<PacingBudgetSnapshot> {
+        Some(PacingBudgetSnapshot {
+            qps,
+            ..Default::default()
+        })
+    }
+
+    #[test]
+    fn sleeps_until_the_earliest_deadline() {
+        let mut schedule = PollSchedule::new();
+        assert_eq!(schedule.sleep_us(1000, 5_000_000, 2_000_000), 2_000_000);
+        assert_eq!(schedule.sleep_us(1000, 300_000, 2_000_000), 300_000);
+        schedule.schedule(0, 90_000);
+        schedule.schedule(2, 41_000);
+        schedule.schedule(1, 600_000);
+        assert_eq!(schedule.earliest(), Some((41_000, 2)));
+        assert_eq!(schedule.sleep_us(1000, 300_000, 2_000_000), 40_000);
+        assert_eq!(schedule.sleep_us(1000, 7_000, 2_000_000), 7_000);
+        // Overdue deadlines and immediate wakes still yield the scheduler.
+        assert_eq!(schedule.sleep_us(50_000, 300_000, 2_000_000), 1);
+        assert_eq!(schedule.sleep_us(1000, 0, 2_000_000), 1);
+        schedule.clear();
+        assert_eq!(schedule.earliest(), None);
+    }
+
+    #[test]
+    fn owed_polls_follow_the_query_rate() {
+        assert_eq!(owed_poll_deadline(1000, pacing(50.0)), 21_000);
+        assert_eq!(owed_poll_deadline(1000, pacing(0.0)), 1000 + POLL_RETRY_US);
+        assert_eq!(owed_poll_deadline(1000, None), 1000 + POLL_RETRY_US);
+        // Fast paths are not polled in a spin.
+        assert_eq!(owed_poll_deadline(1000, pacing(1e9)), 1000 + POLL_RETRY_US);
+    }
+}
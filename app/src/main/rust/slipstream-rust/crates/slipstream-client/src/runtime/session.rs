@@ -0,0 +1,150 @@
+use crate::error::ClientError;
+use slipstream_ffi::picoquic::{
+    picoquic_load_retry_tokens, picoquic_quic_t, picoquic_save_retry_tokens,
+    picoquic_save_session_tickets,
+};
+use std::ffi::CString;
+use std::fs;
+use std::path::{Path, PathBuf};
+use tracing::{debug, warn};
+
+/// Session tickets and address tokens kept on disk across QUIC contexts.
+///
+/// The client builds a new context for every reconnect, and picoquic keeps
+/// tickets and tokens in the context, so without a store every reconnect is a
+/// full handshake. picoquic matches tickets on SNI and ALPN only, which are
+/// fixed in slipstream, so the files are named after the tunnel domain to keep
+/// one server's tickets from being offered to another.
+pub(crate) struct SessionStore {
+    tickets: StoreFile,
+    tokens: StoreFile,
+}
+
+struct StoreFile {
+    path: PathBuf,
+    temp_path: PathBuf,
+    c_path: CString,
+    c_temp_path: CString,
+}
+
+impl StoreFile {
+    fn new(dir: &Path, name: String) -> Result<Self, ClientError> {
+        let path = dir.join(&name);
+        let temp_path = dir.join(format!("{}.tmp", name));
+        let to_c = |path: &Path| {
+            CString::new(path.to_string_lossy().into_owned())
+                .map_err(|_| ClientError::new("Session cache path contains a null byte"))
+        };
+        Ok(Self {
+            c_path: to_c(&path)?,
+            c_temp_path: to_c(&temp_path)?,
+            path,
+            temp_path,
+        })
+    }
+
+    /// Writes through a temporary file, so a crash mid-save leaves the
+    /// previous file in place rather than a truncated one.
+    fn save(&self, save_fn: impl FnOnce(*const libc::c_char) -> libc::c_int) {
+        if save_fn(self.c_temp_path.as_ptr()) != 0 {
+            warn!("Failed to save session cache {}", self.path.display());
+            return;
+        }
+        if let Err(err) = fs::rename(&self.temp_path, &self.path) {
+            warn!(
+                "Failed to save session cache {}: {}",
+                self.path.display(),
+                err
+            );
+        }
+    }
+}
+
+impl SessionStore {
+    pub(crate) fn open(dir: &str, domain: &str) -> Result<Self, ClientError> {
+        let dir = Path::new(dir);
+        fs::create_dir_all(dir).map_err(|err| {
+            ClientError::new(format!(
+                "Failed to create session cache directory {}: {}",
+                dir.display(),
+                err
+            ))
+        })?;
+        let stem = session_file_stem(domain);
+        Ok(Self {
+            tickets: StoreFile::new(dir, format!("{}.tickets", stem))?,
+            tokens: StoreFile::new(dir, format!("{}.tokens", stem))?,
+        })
+    }
+
+    /// Ticket file for picoquic_create, which loads it. The context keeps the
+    /// pointer, so the store must outlive the context.
+    pub(crate) fn ticket_file(&self) -> *const libc::c_char {
+        self.tickets.c_path.as_ptr()
+    }
+
+    pub(crate) fn load_tokens(&self, quic: *mut picoquic_quic_t) {
+        if !self.tokens.path.exists() {
+            return;
+        }
+        if unsafe { picoquic_load_retry_tokens(quic, self.tokens.c_path.as_ptr()) } != 0 {
+            debug!(
+                "Ignoring unreadable address tokens {}",
+                self.tokens.path.display()
+            );
+        }
+    }
+
+    pub(crate) fn save(&self, quic: *mut picoquic_quic_t) {
+        self.tickets
+            .save(|path| unsafe { picoquic_save_session_tickets(quic, path) });
+        self.tokens
+            .save(|path| unsafe { picoquic_save_retry_tokens(quic, path) });
+    }
+}
+
+/// Saves the store when dropped. Declare it after the context's QuicGuard so
+/// that it runs first, while the context is still alive.
+pub(crate) struct SessionSaveGuard<'a> {
+    store: Option<&'a SessionStore>,
+    quic: *mut picoquic_quic_t,
+}
+
+impl<'a> SessionSaveGuard<'a> {
+    pub(crate) fn new(store: Option<&'a SessionStore>, quic: *mut picoquic_quic_t) -> Self {
+        Self { store, quic }
+    }
+}
+
+impl Drop for SessionSaveGuard<'_> {
+    fn drop(&mut self) {
+        if let Some(store) = self.store {
+            store.save(self.quic);
+        }
+    }
+}
+
+fn session_file_stem(domain: &str) -> String {
+    domain
+        .trim_end_matches('.')
+        .chars()
+        .map(|c| {
+            if c.is_ascii_alphanumeric() || c == '-' || c == '.' {
+                c.to_ascii_lowercase()
+            } else {
+                '_'
+            }
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::session_file_stem;
+
+    #[test]
+    fn session_file_stem_is_a_plain_file_name() {
+        assert_eq!(session_file_stem("T.Example.com."), "t.example.com");
+        assert_eq!(session_file_stem("../x/y"), ".._x_y");
+    }
+}
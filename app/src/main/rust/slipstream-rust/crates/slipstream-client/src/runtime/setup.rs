@@ -1,10 +1,9 @@
 use crate::error::ClientError;
 use socket2::{Domain, Protocol, SockAddr, Socket, Type};
 use std::net::{Ipv6Addr, SocketAddr, SocketAddrV6};
-#[cfg(target_os = "android")]
-use std::os::unix::io::AsRawFd;
+use std::os::fd::AsRawFd;
 use tokio::net::{lookup_host, TcpListener as TokioTcpListener, UdpSocket as TokioUdpSocket};
-use tracing::{info, warn};
+use tracing::warn;
 
 pub(crate) fn compute_mtu(domain_len: usize) -> Result<u32, ClientError> {
     if domain_len >= 240 {
@@ -22,13 +21,13 @@ pub(crate) fn compute_mtu(domain_len: usize) -> Result<u32, ClientError> {
 }
 
 pub(crate) async fn bind_udp_socket() -> Result<TokioUdpSocket, ClientError> {
-    let bind_addr = SocketAddr::V6(SocketAddrV6::new(Ipv6Addr::UNSPECIFIED, 0, 0, 0));
-    bind_udp_socket_addr(bind_addr)
+    bind_udp_socket_addr(UDP_BIND_ADDR)
 }
 
 pub(crate) async fn bind_tcp_listener(
     host: &str,
     port: u16,
+    reuse_port: bool,
 ) -> Result<TokioTcpListener, ClientError> {
     let addrs: Vec<SocketAddr> = lookup_host((host, port)).await.map_err(map_io)?.collect();
     if addrs.is_empty() {
@@ -39,7 +38,7 @@ pub(crate) async fn bind_tcp_listener(
     }
     let mut last_err = None;
     for addr in addrs {
-        match bind_tcp_listener_addr(addr) {
+        match bind_tcp_listener_addr(addr, reuse_port) {
             Ok(listener) => return Ok(listener),
             Err(err) => last_err = Some(err),
         }
@@ -49,7 +48,10 @@ pub(crate) async fn bind_tcp_listener(
     }))
 }
 
-fn bind_tcp_listener_addr(addr: SocketAddr) -> Result<TokioTcpListener, ClientError> {
+fn bind_tcp_listener_addr(
+    addr: SocketAddr,
+    reuse_port: bool,
+) -> Result<TokioTcpListener, ClientError> {
     let domain = match addr {
         SocketAddr::V4(_) => Domain::IPV4,
         SocketAddr::V6(_) => Domain::IPV6,
@@ -67,6 +69,9 @@ fn bind_tcp_listener_addr(addr: SocketAddr) -> Result<TokioTcpListener, ClientEr
             );
         }
     }
+    if reuse_port {
+        set_reuse_port(&socket).map_err(map_io)?;
+    }
     let sock_addr = SockAddr::from(addr);
     socket.bind(&sock_addr).map_err(map_io)?;
     socket.listen(1024).map_err(map_io)?;
@@ -75,7 +80,31 @@ fn bind_tcp_listener_addr(addr: SocketAddr) -> Result<TokioTcpListener, ClientEr
     TokioTcpListener::from_std(std_listener).map_err(map_io)
 }
 
-fn bind_udp_socket_addr(addr: SocketAddr) -> Result<TokioUdpSocket, ClientError> {
+/// Lets every connection of a striped client listen on the same port; the
+/// kernel spreads accepted connections over the listeners.
+fn set_reuse_port(socket: &Socket) -> std::io::Result<()> {
+    let enable: libc::c_int = 1;
+    let ret = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_REUSEPORT,
+            &enable as *const _ as *const libc::c_void,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret != 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+/// Address of the client's UDP socket: any port, both address families.
+pub(crate) const UDP_BIND_ADDR: SocketAddr =
+    SocketAddr::V6(SocketAddrV6::new(Ipv6Addr::UNSPECIFIED, 0, 0, 0));
+
+/// Creates a blocking UDP socket bound to `addr`, dual-stack where it is IPv6.
+pub(crate) fn new_udp_socket(addr: SocketAddr) -> Result<Socket, ClientError> {
     let domain = match addr {
         SocketAddr::V4(_) => Domain::IPV4,
         SocketAddr::V6(_) => Domain::IPV6,
@@ -91,21 +120,18 @@ fn bind_udp_socket_addr(addr: SocketAddr) -> Result<TokioUdpSocket, ClientError>
     }
     let sock_addr = SockAddr::from(addr);
     socket.bind(&sock_addr).map_err(map_io)?;
+    Ok(socket)
+}
 
-    // CRITICAL: On Android, protect the UDP socket BEFORE setting non-blocking
-    // and converting to tokio. This prevents the VPN from capturing DNS queries
-    // to the resolver, which would create a routing loop.
+fn bind_udp_socket_addr(addr: SocketAddr) -> Result<TokioUdpSocket, ClientError> {
+    // CRITICAL: On Android, the UDP socket is protected BEFORE setting
+    // non-blocking and converting to tokio. This prevents the VPN from
+    // capturing DNS queries to the resolver, which would create a routing
+    // loop. Sockets protected ahead of time are used first.
     #[cfg(target_os = "android")]
-    {
-        let fd = socket.as_raw_fd();
-        info!("Protecting UDP socket fd={} for DNS queries", fd);
-        if !crate::android::protect_socket(fd) {
-            return Err(ClientError::new(
-                "Failed to protect UDP socket - DNS queries will fail due to routing loop",
-            ));
-        }
-        info!("UDP socket fd={} protected successfully", fd);
-    }
+    let socket = crate::android::protected_udp_socket(addr)?;
+    #[cfg(not(target_os = "android"))]
+    let socket = new_udp_socket(addr)?;
 
     socket.set_nonblocking(true).map_err(map_io)?;
     let std_socket: std::net::UdpSocket = socket.into();
@@ -0,0 +1,131 @@
+use socket2::Socket;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Mutex;
+
+/// UDP sockets created and protected ahead of use, so binding the client's
+/// socket does not wait on a JNI round trip to VpnService.protect().
+///
+/// Refills run off the critical path, one at a time. Draining bumps the
+/// generation, so sockets from a refill started before the drain are closed
+/// instead of pooled.
+pub(crate) struct ProtectedSocketPool {
+    sockets: Mutex<Vec<Socket>>,
+    generation: AtomicU64,
+    refilling: AtomicBool,
+}
+
+impl ProtectedSocketPool {
+    pub(crate) const fn new() -> Self {
+        Self {
+            sockets: Mutex::new(Vec::new()),
+            generation: AtomicU64::new(0),
+            refilling: AtomicBool::new(false),
+        }
+    }
+
+    pub(crate) fn take(&self) -> Option<Socket> {
+        self.sockets.lock().unwrap().pop()
+    }
+
+    pub(crate) fn len(&self) -> usize {
+        self.sockets.lock().unwrap().len()
+    }
+
+    /// Claims the refill, unless one is running, and returns the generation
+    /// to fill for.
+    pub(crate) fn begin_refill(&self) -> Option<u64> {
+        if self.refilling.swap(true, Ordering::AcqRel) {
+            return None;
+        }
+        Some(self.generation.load(Ordering::Acquire))
+    }
+
+    /// Releases a refill claimed but not run.
+    pub(crate) fn end_refill(&self) {
+        self.refilling.store(false, Ordering::Release);
+    }
+
+    /// Tops the pool up to `size` sockets from `make`, stopping at the first
+    /// it cannot make, then releases the refill. Returns the sockets added.
+    pub(crate) fn refill(
+        &self,
+        generation: u64,
+        size: usize,
+        mut make: impl FnMut() -> Option<Socket>,
+    ) -> usize {
+        let mut added = 0;
+        while self.len() < size {
+            let Some(socket) = make() else {
+                break;
+            };
+            let mut sockets = self.sockets.lock().unwrap();
+            if self.generation.load(Ordering::Acquire) != generation || sockets.len() >= size {
+                break;
+            }
+            sockets.push(socket);
+            added += 1;
+        }
+        self.end_refill();
+        added
+    }
+
+    /// Closes the pooled sockets, and those of any refill in flight.
+    pub(crate) fn drain(&self) {
+        let mut sockets = self.sockets.lock().unwrap();
+        self.generation.fetch_add(1, Ordering::AcqRel);
+        sockets.clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use socket2::{Domain, Protocol, Type};
+
+    fn udp_socket() -> Option<Socket> {
+        Socket::new(Domain::IPV4, Type::DGRAM, Some(Protocol::UDP)).ok()
+    }
+
+    #[test]
+    fn refills_up_to_size_once_at_a_time() {
+        let pool = ProtectedSocketPool::new();
+        let generation = pool.begin_refill().expect("refill");
+        assert_eq!(pool.begin_refill(), None);
+        assert_eq!(pool.refill(generation, 2, udp_socket), 2);
+        assert_eq!(pool.len(), 2);
+
+        assert!(pool.take().is_some());
+        let generation = pool.begin_refill().expect("refill");
+        assert_eq!(pool.refill(generation, 2, udp_socket), 1);
+        assert_eq!(pool.len(), 2);
+    }
+
+    #[test]
+    fn failed_protect_stops_the_refill() {
+        let pool = ProtectedSocketPool::new();
+        let generation = pool.begin_refill().expect("refill");
+        let mut made = 0;
+        let added = pool.refill(generation, 4, || {
+            made += 1;
+            if made > 1 {
+                return None;
+            }
+            udp_socket()
+        });
+        assert_eq!(added, 1);
+        assert_eq!(made, 2);
+        assert!(pool.begin_refill().is_some());
+    }
+
+    #[test]
+    fn drain_discards_sockets_of_an_earlier_refill() {
+        let pool = ProtectedSocketPool::new();
+        let generation = pool.begin_refill().expect("refill");
+        assert_eq!(pool.refill(generation, 1, udp_socket), 1);
+        let generation = pool.begin_refill().expect("refill");
+        pool.drain();
+        assert_eq!(pool.len(), 0);
+        assert_eq!(pool.refill(generation, 2, udp_socket), 0);
+        assert!(pool.take().is_none());
+    }
+}
@@ -0,0 +1,637 @@
+//! Resolver scanner: probes many DNS resolvers at once from one thread.
+//!
+//! Every target gets a warm-up A query, then `samples` measured ones, and
+//! is reported with the median round trip, as the app's per-resolver scan
+//! does. Instead of a socket and a blocked thread per target, all probes
+//! share one UDP socket per address family, queries leave with sendmmsg and
+//! answers come back with recvmmsg, matched by resolver and query ID. All
+//! queries wait the same time, so a FIFO of deadlines is the timer.
+
+use slipstream_core::net::{recv_batch, send_batch, RecvBatch};
+use slipstream_dns::{encode_query, QueryParams, CLASS_IN, RR_A};
+use std::collections::{HashMap, VecDeque};
+use std::io::{Error, ErrorKind};
+use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr, UdpSocket};
+use std::os::unix::io::AsRawFd;
+use std::time::{Duration, Instant};
+
+/// Datagrams per sendmmsg or recvmmsg call.
+const SCAN_BATCH: usize = 64;
+/// Answers longer than this are cut; the first A record comes early.
+const SCAN_ANSWER_MAX: usize = 512;
+/// Socket buffers sized for a few thousand probes in flight.
+const SCAN_SOCKET_BUFFER: usize = 4 << 20;
+
+#[derive(Clone, Debug)]
+pub struct ScanConfig {
+    pub domain: String,
+    pub port: u16,
+    /// Budget per target, warm-up included.
+    pub timeout: Duration,
+    /// Wait for each query's answer.
+    pub query_timeout: Duration,
+    /// Measured queries after the warm-up; with none, the warm-up is timed.
+    pub samples: usize,
+    /// Targets probed at once.
+    pub max_in_flight: usize,
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum ScanStatus {
+    Working,
+    /// Answered with a private or null address, as hijacking resolvers do.
+    Censored,
+    /// Answered with an error code other than NXDOMAIN.
+    Error,
+    Timeout,
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ScanResult {
+    /// Position of the target in the scanned list.
+    pub index: usize,
+    pub status: ScanStatus,
+    /// Median round trip when working, else the time the probe took.
+    pub time: Duration,
+    pub rcode: u8,
+    pub answer: Option<Ipv4Addr>,
+}
+
+struct Probe {
+    started: Instant,
+    sent_at: Instant,
+    warmed: bool,
+    attempts: usize,
+    rtts: Vec<Duration>,
+}
+
+/// What an answer says, as the app's scan reads it.
+#[derive(Debug, PartialEq, Eq)]
+struct Answer {
+    rcode: u8,
+    address: Option<Ipv4Addr>,
+}
+
+impl Answer {
+    fn is_censored(&self) -> bool {
+        self.address
+            .is_some_and(|ip| ip.octets()[0] == 10 || ip.is_unspecified() || ip.is_loopback())
+    }
+
+    fn is_success(&self) -> bool {
+        self.address.is_some() || self.rcode == 0 || self.rcode == 3
+    }
+}
+
+struct Scanner<'a> {
+    targets: &'a [IpAddr],
+    config: &'a ScanConfig,
+    query: Vec<u8>,
+    v4: Option<UdpSocket>,
+    v6: Option<UdpSocket>,
+    probes: HashMap<usize, Probe>,
+    /// (resolver, query ID) to target index.
+    waiting: HashMap<(SocketAddr, u16), usize>,
+    deadlines: VecDeque<(Instant, usize, u16)>,
+    unsent: VecDeque<usize>,
+    next_id: u16,
+}
+
+/// Scans `targets` and hands each result to `on_result` as it is known,
+/// in no particular order. Stops early when `on_result` returns false.
+pub fn scan_resolvers<F>(
+    targets: &[IpAddr],
+    config: &ScanConfig,
+    mut on_result: F,
+) -> std::io::Result<()>
+where
+    F: FnMut(ScanResult) -> bool,
+{
+    let query = encode_query(&QueryParams {
+        id: 0,
+        qname: &config.domain,
+        qtype: RR_A,
+        qclass: CLASS_IN,
+        rd: true,
+        cd: false,
+        qdcount: 1,
+        is_query: true,
+    })
+    .map_err(|e| Error::new(ErrorKind::InvalidInput, format!("{:?}", e)))?;
+
+    let mut scanner = Scanner {
+        targets,
+        config,
+        query,
+        v4: None,
+        v6: None,
+        probes: HashMap::new(),
+        waiting: HashMap::new(),
+        deadlines: VecDeque::new(),
+        unsent: VecDeque::new(),
+        next_id: 0,
+    };
+    if targets.iter().any(IpAddr::is_ipv4) {
+        scanner.v4 = Some(scan_socket(IpAddr::V4(Ipv4Addr::UNSPECIFIED))?);
+    }
+    if targets.iter().any(IpAddr::is_ipv6) {
+        scanner.v6 = Some(scan_socket(IpAddr::V6(Ipv6Addr::UNSPECIFIED))?);
+    }
+    scanner.run(&mut on_result)
+}
+
+fn scan_socket(ip: IpAddr) -> std::io::Result<UdpSocket> {
+    let socket = socket2::Socket::new(
+        socket2::Domain::for_address(SocketAddr::new(ip, 0)),
+        socket2::Type::DGRAM,
+        Some(socket2::Protocol::UDP),
+    )?;
+    // Best effort: a smaller buffer only drops answers under load.
+    let _ = socket.set_recv_buffer_size(SCAN_SOCKET_BUFFER);
+    let _ = socket.set_send_buffer_size(SCAN_SOCKET_BUFFER);
+    socket.set_nonblocking(true)?;
+    socket.bind(&SocketAddr::new(ip, 0).into())?;
+    Ok(socket.into())
+}
+
+impl Scanner<'_> {
+    fn run<F>(&mut self, on_result: &mut F) -> std::io::Result<()>
+    where
+        F: FnMut(ScanResult) -> bool,
+    {
+        let max_in_flight = self.config.max_in_flight.max(1);
+        let mut next_target = 0;
+        let mut batch = RecvBatch::new(SCAN_BATCH, SCAN_ANSWER_MAX);
+        let mut results = Vec::new();
+
+        loop {
+            while self.probes.len() < max_in_flight && next_target < self.targets.len() {
+                let now = Instant::now();
+                self.probes.insert(
+                    next_target,
+                    Probe {
+                        started: now,
+                        sent_at: now,
+                        warmed: false,
+                        attempts: 0,
+                        rtts: Vec::with_capacity(self.config.samples),
+                    },
+                );
+                self.unsent.push_back(next_target);
+                next_target += 1;
+            }
+            if self.probes.is_empty() {
+                return Ok(());
+            }
+
+            let blocked = self.flush(&mut results)?;
+            self.wait(blocked)?;
+            self.receive(&mut batch, &mut results);
+            self.expire(Instant::now(), &mut results);
+
+            for result in results.drain(..) {
+                if !on_result(result) {
+                    return Ok(());
+                }
+            }
+        }
+    }
+
+    fn socket(&self, ip: &IpAddr) -> Option<&UdpSocket> {
+        match ip {
+            IpAddr::V4(_) => self.v4.as_ref(),
+            IpAddr::V6(_) => self.v6.as_ref(),
+        }
+    }
+
+    /// Sends queued queries, a batch per family at a time. Returns true when
+    /// a socket buffer filled up and queries are left over.
+    fn flush(&mut self, results: &mut Vec<ScanResult>) -> std::io::Result<bool> {
+        while !self.unsent.is_empty() {
+            let family_v4 = self.targets[self.unsent[0]].is_ipv4();
+            let indices: Vec<usize> = self
+                .unsent
+                .iter()
+                .take(SCAN_BATCH)
+                .take_while(|&&index| self.targets[index].is_ipv4() == family_v4)
+                .copied()
+                .collect();
+            let payloads: Vec<Vec<u8>> = indices
+                .iter()
+                .map(|&index| {
+                    let mut payload = self.query.clone();
+                    payload[..2].copy_from_slice(&self.take_id(index).to_be_bytes());
+                    payload
+                })
+                .collect();
+            let datagrams: Vec<(&[u8], SocketAddr)> = indices
+                .iter()
+                .zip(&payloads)
+                .map(|(&index, payload)| {
+                    (
+                        payload.as_slice(),
+                        SocketAddr::new(self.targets[index], self.config.port),
+                    )
+                })
+                .collect();
+            let socket = self
+                .socket(&self.targets[indices[0]])
+                .expect("socket for every family scanned");
+            let sent = match send_batch(socket, &datagrams) {
+                Ok(sent) => sent,
+                Err(err) if err.kind() == ErrorKind::WouldBlock => return Ok(true),
+                Err(err) if err.kind() == ErrorKind::Interrupted => continue,
+                Err(err) if is_target_error(&err) => {
+                    // This target cannot be reached at all; the rest can.
+                    let index = self.unsent.pop_front().expect("unsent target");
+                    let probe = self.probes.remove(&index).expect("probe per target");
+                    results.push(ScanResult {
+                        index,
+                        status: ScanStatus::Error,
+                        time: probe.started.elapsed(),
+                        rcode: 0,
+                        answer: None,
+                    });
+                    continue;
+                }
+                Err(err) => return Err(err),
+            };
+
+            let now = Instant::now();
+            for (&index, payload) in indices.iter().zip(&payloads).take(sent) {
+                self.unsent.pop_front();
+                let id = u16::from_be_bytes([payload[0], payload[1]]);
+                let probe = self.probes.get_mut(&index).expect("probe per target");
+                probe.sent_at = now;
+                probe.attempts += 1;
+                let resolver = SocketAddr::new(self.targets[index], self.config.port);
+                self.waiting.insert((resolver, id), index);
+                self.deadlines
+                    .push_back((now + self.config.query_timeout, index, id));
+            }
+            if sent < indices.len() {
+                return Ok(true);
+            }
+        }
+        Ok(false)
+    }
+
+    /// A query ID not in flight to this target's resolver.
+    fn take_id(&mut self, index: usize) -> u16 {
+        let resolver = SocketAddr::new(self.targets[index], self.config.port);
+        loop {
+            // Odd steps through all 2^16 IDs before one repeats.
+            self.next_id = self.next_id.wrapping_add(40503);
+            if !self.waiting.contains_key(&(resolver, self.next_id)) {
+                return self.next_id;
+            }
+        }
+    }
+
+    /// Sleeps until an answer arrives, the next deadline passes or, when
+    /// `blocked`, a socket can send again.
+    fn wait(&self, blocked: bool) -> std::io::Result<()> {
+        let timeout = self
+            .deadlines
+            .front()
+            .map_or(Duration::from_millis(100), |(deadline, _, _)| {
+                deadline.saturating_duration_since(Instant::now())
+            });
+        let timeout_ms = timeout.as_millis().min(i32::MAX as u128) as i32;
+        let events = if blocked {
+            libc::POLLIN | libc::POLLOUT
+        } else {
+            libc::POLLIN
+        };
+        let mut fds: Vec<libc::pollfd> = [&self.v4, &self.v6]
+            .iter()
+            .filter_map(|socket| socket.as_ref())
+            .map(|socket| libc::pollfd {
+                fd: socket.as_raw_fd(),
+                events,
+                revents: 0,
+            })
+            .collect();
+        // Round up so a deadline a fraction of a millisecond away is not
+        // polled for in a busy loop.
+        let timeout_ms = if timeout > Duration::from_millis(timeout_ms as u64) {
+            timeout_ms.saturating_add(1)
+        } else {
+            timeout_ms
+        };
+        // SAFETY: fds is a valid array of fds.len() pollfd entries.
+        let ret = unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, timeout_ms) };
+        if ret < 0 {
+            let err = Error::last_os_error();
+            if err.kind() != ErrorKind::Interrupted {
+                return Err(err);
+            }
+        }
+        Ok(())
+    }
+
+    fn receive(&mut self, batch: &mut RecvBatch, results: &mut Vec<ScanResult>) {
+        for family in 0..2 {
+            loop {
+                let socket = if family == 0 { &self.v4 } else { &self.v6 };
+                let Some(socket) = socket.as_ref() else {
+                    break;
+                };
+                match recv_batch(socket, batch) {
+                    Ok(0) | Err(_) => break,
+                    Ok(_) => {}
+                }
+                let now = Instant::now();
+                for i in 0..batch.len() {
+                    let (packet, peer) = batch.get(i);
+                    let Some(id) = response_id(packet) else {
+                        continue;
+                    };
+                    let Some(index) = self.waiting.remove(&(peer, id)) else {
+                        continue;
+                    };
+                    let answer = parse_answer(packet);
+                    self.on_answer(index, answer, now, results);
+                }
+                if batch.len() < batch.capacity() {
+                    break;
+                }
+            }
+        }
+    }
+
+    fn on_answer(
+        &mut self,
+        index: usize,
+        answer: Answer,
+        now: Instant,
+        results: &mut Vec<ScanResult>,
+    ) {
+        let probe = self.probes.get_mut(&index).expect("probe per target");
+        if !probe.warmed {
+            if answer.is_censored() || !answer.is_success() {
+                let status = if answer.is_censored() {
+                    ScanStatus::Censored
+                } else {
+                    ScanStatus::Error
+                };
+                let probe = self.probes.remove(&index).expect("probe per target");
+                results.push(ScanResult {
+                    index,
+                    status,
+                    time: now - probe.started,
+                    rcode: answer.rcode,
+                    answer: answer.address,
+                });
+                return;
+            }
+            probe.warmed = true;
+            if self.config.samples == 0 {
+                probe.rtts.push(now - probe.sent_at);
+            }
+        } else if answer.is_success() {
+            probe.rtts.push(now - probe.sent_at);
+        }
+        self.next_query(index, now, results);
+    }
+
+    /// Sends the next measured query, or reports the target when its
+    /// samples or its budget are spent.
+    fn next_query(&mut self, index: usize, now: Instant, results: &mut Vec<ScanResult>) {
+        let probe = &self.probes[&index];
+        // The warm-up is attempt 1.
+        if probe.attempts <= self.config.samples && now - probe.started < self.config.timeout {
+            self.unsent.push_back(index);
+            return;
+        }
+        let mut probe = self.probes.remove(&index).expect("probe per target");
+        let result = if probe.rtts.is_empty() {
+            ScanResult {
+                index,
+                status: ScanStatus::Timeout,
+                time: now - probe.started,
+                rcode: 0,
+                answer: None,
+            }
+        } else {
+            probe.rtts.sort_unstable();
+            ScanResult {
+                index,
+                status: ScanStatus::Working,
+                time: probe.rtts[probe.rtts.len() / 2],
+                rcode: 0,
+                answer: None,
+            }
+        };
+        results.push(result);
+    }
+
+    fn expire(&mut self, now: Instant, results: &mut Vec<ScanResult>) {
+        while let Some(&(deadline, index, id)) = self.deadlines.front() {
+            if deadline > now {
+                break;
+            }
+            self.deadlines.pop_front();
+            let resolver = SocketAddr::new(self.targets[index], self.config.port);
+            if self.waiting.get(&(resolver, id)) != Some(&index) {
+                // Answered already.
+                continue;
+            }
+            self.waiting.remove(&(resolver, id));
+            let probe = &self.probes[&index];
+            if !probe.warmed {
+                let probe = self.probes.remove(&index).expect("probe per target");
+                results.push(ScanResult {
+                    index,
+                    status: ScanStatus::Timeout,
+                    time: now - probe.started,
+                    rcode: 0,
+                    answer: None,
+                });
+            } else {
+                self.next_query(index, now, results);
+            }
+        }
+    }
+}
+
+/// Errors from sendmmsg that concern the first datagram's destination only.
+fn is_target_error(err: &Error) -> bool {
+    matches!(
+        err.raw_os_error(),
+        Some(code) if code == libc::ENETUNREACH
+            || code == libc::EHOSTUNREACH
+            || code == libc::EACCES
+            || code == libc::EPERM
+            || code == libc::EINVAL
+            || code == libc::EAFNOSUPPORT
+    )
+}
+
+fn response_id(packet: &[u8]) -> Option<u16> {
+    if packet.len() < 12 || packet[2] & 0x80 == 0 {
+        return None;
+    }
+    Some(u16::from_be_bytes([packet[0], packet[1]]))
+}
+
+/// Skips a possibly compressed name, returning the offset past it.
+fn skip_name(packet: &[u8], mut offset: usize) -> Option<usize> {
+    loop {
+        let len = *packet.get(offset)? as usize;
+        if len == 0 {
+            return Some(offset + 1);
+        }
+        if len & 0xC0 == 0xC0 {
+            return Some(offset + 2);
+        }
+        offset += len + 1;
+    }
+}
+
+/// Response code and the first A record of an answer.
+fn parse_answer(packet: &[u8]) -> Answer {
+    let rcode = packet[3] & 0x0F;
+    let address = (rcode == 0).then(|| first_a_record(packet)).flatten();
+    Answer { rcode, address }
+}
+
+fn first_a_record(packet: &[u8]) -> Option<Ipv4Addr> {
+    let qdcount = u16::from_be_bytes([packet[4], packet[5]]);
+    let ancount = u16::from_be_bytes([packet[6], packet[7]]);
+    let mut offset = 12;
+    for _ in 0..qdcount {
+        offset = skip_name(packet, offset)? + 4;
+    }
+    for _ in 0..ancount {
+        offset = skip_name(packet, offset)?;
+        let header = packet.get(offset..offset + 10)?;
+        let rtype = u16::from_be_bytes([header[0], header[1]]);
+        let rdlength = u16::from_be_bytes([header[8], header[9]]) as usize;
+        offset += 10;
+        let rdata = packet.get(offset..offset + rdlength)?;
+        if rtype == RR_A && rdlength == 4 {
+            return Some(Ipv4Addr::new(rdata[0], rdata[1], rdata[2], rdata[3]));
+        }
+        offset += rdlength;
+    }
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::net::UdpSocket;
+    use std::thread;
+
+    fn config(port: u16) -> ScanConfig {
+        ScanConfig {
+            domain: "example.com".to_string(),
+            port,
+            timeout: Duration::from_secs(2),
+            query_timeout: Duration::from_millis(300),
+            samples: 4,
+            max_in_flight: 1000,
+        }
+    }
+
+    /// Answers every query with `address` as its A record, `count` times.
+    fn spawn_resolver(address: [u8; 4], count: usize) -> u16 {
+        let socket = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let port = socket.local_addr().unwrap().port();
+        thread::spawn(move || {
+            let mut buf = [0u8; 512];
+            for _ in 0..count {
+                let (len, peer) = socket.recv_from(&mut buf).unwrap();
+                let mut reply = buf[..len].to_vec();
+                reply[2] |= 0x80;
+                reply[6..8].copy_from_slice(&1u16.to_be_bytes());
+                // Drop the OPT record the query carries.
+                reply[10..12].copy_from_slice(&0u16.to_be_bytes());
+                let question_end = skip_name(&reply, 12).unwrap() + 4;
+                reply.truncate(question_end);
+                reply.extend_from_slice(&[0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4]);
+                reply.extend_from_slice(&address);
+                socket.send_to(&reply, peer).unwrap();
+            }
+        });
+        port
+    }
+
+    #[test]
+    fn reports_working_and_censored_resolvers() {
+        let port = spawn_resolver([93, 184, 216, 34], 5);
+        let mut results = Vec::new();
+        scan_resolvers(&["127.0.0.1".parse().unwrap()], &config(port), |r| {
+            results.push(r);
+            true
+        })
+        .unwrap();
+        assert_eq!(results.len(), 1);
+        assert_eq!(results[0].status, ScanStatus::Working);
+
+        let port = spawn_resolver([10, 10, 34, 36], 1);
+        let mut results = Vec::new();
+        scan_resolvers(&["127.0.0.1".parse().unwrap()], &config(port), |r| {
+            results.push(r);
+            true
+        })
+        .unwrap();
+        assert_eq!(results[0].status, ScanStatus::Censored);
+        assert_eq!(results[0].answer, Some(Ipv4Addr::new(10, 10, 34, 36)));
+    }
+
+    #[test]
+    fn times_the_warm_up_without_samples() {
+        let port = spawn_resolver([93, 184, 216, 34], 1);
+        let mut results = Vec::new();
+        let config = ScanConfig {
+            samples: 0,
+            ..config(port)
+        };
+        scan_resolvers(&["127.0.0.1".parse().unwrap()], &config, |r| {
+            results.push(r);
+            true
+        })
+        .unwrap();
+        assert_eq!(results[0].status, ScanStatus::Working);
+    }
+
+    #[test]
+    fn silent_resolvers_time_out_together() {
+        // Bound but never read, so queries vanish.
+        let silent = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let port = silent.local_addr().unwrap().port();
+        let targets: Vec<IpAddr> = (0..200).map(|_| "127.0.0.1".parse().unwrap()).collect();
+        let started = Instant::now();
+        let mut results = Vec::new();
+        scan_resolvers(&targets, &config(port), |r| {
+            results.push(r);
+            true
+        })
+        .unwrap();
+        assert_eq!(results.len(), targets.len());
+        assert!(results.iter().all(|r| r.status == ScanStatus::Timeout));
+        // One query timeout for all of them, not one each.
+        assert!(started.elapsed() < Duration::from_secs(2));
+    }
+
+    #[test]
+    fn parses_the_first_a_record() {
+        let mut packet = vec![0x12, 0x34, 0x81, 0x80, 0, 1, 0, 2, 0, 0, 0, 0];
+        packet.extend_from_slice(&[3, b'f', b'o', b'o', 0, 0, 1, 0, 1]);
+        // A CNAME, then the A record.
+        packet.extend_from_slice(&[0xC0, 12, 0, 5, 0, 1, 0, 0, 0, 60, 0, 2, 0xC0, 12]);
+        packet.extend_from_slice(&[0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 1, 2, 3, 4]);
+        assert_eq!(response_id(&packet), Some(0x1234));
+        assert_eq!(
+            parse_answer(&packet),
+            Answer {
+                rcode: 0,
+                address: Some(Ipv4Addr::new(1, 2, 3, 4)),
+            }
+        );
+        packet.truncate(30);
+        assert_eq!(parse_answer(&packet).address, None);
+    }
+}
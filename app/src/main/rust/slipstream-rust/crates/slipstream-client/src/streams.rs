@@ -1,29 +1,77 @@
+use crate::datagrams::{DatagramRelay, LocalSocket};
 use slipstream_core::flow_control::{
     conn_reserve_bytes, consume_error_log_message, consume_stream_data, handle_stream_receive,
     overflow_log_message, promote_error_log_message, promote_streams, reserve_target_offset,
     FlowControlState, HasFlowControlState, PromoteEntry, StreamReceiveConfig, StreamReceiveOps,
 };
 use slipstream_core::invariants::InvariantReporter;
+use slipstream_core::priority::StreamClass;
 use slipstream_core::tcp::{stream_read_limit_chunks, tcp_send_buffer_bytes};
 use slipstream_ffi::picoquic::{
     picoquic_add_to_stream, picoquic_call_back_event_t, picoquic_cnx_t, picoquic_current_time,
     picoquic_get_close_reasons, picoquic_get_cnx_state, picoquic_get_next_local_stream_id,
     picoquic_mark_active_stream, picoquic_provide_stream_data_buffer, picoquic_reset_stream,
-    picoquic_stop_sending, picoquic_stream_data_consumed,
+    picoquic_set_stream_priority, picoquic_stop_sending, picoquic_stream_data_consumed,
 };
 use slipstream_ffi::{abort_stream_bidi, SLIPSTREAM_FILE_CANCEL_ERROR, SLIPSTREAM_INTERNAL_ERROR};
 use std::collections::HashMap;
+use std::os::fd::{AsRawFd, RawFd};
 use std::sync::Arc;
-use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
 use tokio::net::TcpStream as TokioTcpStream;
+use tokio::net::UnixStream as TokioUnixStream;
 use tokio::sync::{mpsc, oneshot, Notify};
 use tracing::{debug, error, info, warn};
 
 const STREAM_READ_CHUNK_BYTES: usize = 4096;
 const DEFAULT_TCP_RCVBUF_BYTES: usize = 256 * 1024;
 const CLIENT_WRITE_COALESCE_DEFAULT_BYTES: usize = 256 * 1024;
+// Streams that have received less than this are still latency-sensitive.
+const LATENCY_SENSITIVE_RX_BYTES: u64 = 16 * 1024;
 static INVARIANT_REPORTER: InvariantReporter = InvariantReporter::new(1_000_000);
 
+type StreamReadHalf = Box<dyn AsyncRead + Send + Unpin>;
+type StreamWriteHalf = Box<dyn AsyncWrite + Send + Unpin>;
+
+/// A local byte stream carried over one QUIC stream: a connection accepted
+/// on the TCP listener, or one half of a socket pair handed out in-process
+/// by `crate::provider`.
+pub(crate) enum LocalStream {
+    Tcp(TokioTcpStream),
+    Unix(TokioUnixStream),
+}
+
+impl LocalStream {
+    fn into_split(self) -> (StreamReadHalf, StreamWriteHalf) {
+        match self {
+            LocalStream::Tcp(stream) => {
+                let _ = stream.set_nodelay(true);
+                let (read_half, write_half) = stream.into_split();
+                (Box::new(read_half), Box::new(write_half))
+            }
+            LocalStream::Unix(stream) => {
+                let (read_half, write_half) = stream.into_split();
+                (Box::new(read_half), Box::new(write_half))
+            }
+        }
+    }
+}
+
+impl AsRawFd for LocalStream {
+    fn as_raw_fd(&self) -> RawFd {
+        match self {
+            LocalStream::Tcp(stream) => stream.as_raw_fd(),
+            LocalStream::Unix(stream) => stream.as_raw_fd(),
+        }
+    }
+}
+
+impl From<TokioTcpStream> for LocalStream {
+    fn from(stream: TokioTcpStream) -> Self {
+        LocalStream::Tcp(stream)
+    }
+}
+
 pub(crate) struct ClientState {
     ready: bool,
     closing: bool,
@@ -37,6 +85,7 @@ pub(crate) struct ClientState {
     debug_enqueued_bytes: u64,
     debug_last_enqueue_at: u64,
     acceptor_limit_logged: bool,
+    datagrams: DatagramRelay,
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -95,11 +144,13 @@ pub(crate) struct ClientBacklogSummary {
 }
 
 pub(crate) mod acceptor {
-    use super::Command;
+    use super::{Command, LocalStream};
+    use crate::provider::ProvidedStream;
     use slipstream_ffi::picoquic::{picoquic_cnx_t, slipstream_get_max_streams_bidir_remote};
     use std::sync::atomic::{AtomicUsize, Ordering};
     use std::sync::Arc;
     use tokio::net::TcpListener as TokioTcpListener;
+    use tokio::net::UnixStream as TokioUnixStream;
     use tokio::sync::{mpsc, Notify};
     use tokio::time::{sleep, Duration};
     use tracing::warn;
@@ -130,6 +181,21 @@ pub(crate) mod acceptor {
             TcpAcceptor::new(listener, command_tx, Arc::clone(&self.limiter)).spawn();
         }
 
+        /// Dispatch streams handed out by `crate::provider`, under the same
+        /// MAX_STREAMS credit as connections accepted on the listener.
+        pub(crate) fn spawn_local(
+            &self,
+            streams: mpsc::UnboundedReceiver<ProvidedStream>,
+            command_tx: mpsc::UnboundedSender<Command>,
+        ) {
+            let acceptor = LocalAcceptor {
+                streams,
+                command_tx,
+                limiter: Arc::clone(&self.limiter),
+            };
+            tokio::spawn(acceptor.run());
+        }
+
         pub(crate) fn update_limit(&self, cnx: *mut picoquic_cnx_t) -> usize {
             let max_streams = unsafe { slipstream_get_max_streams_bidir_remote(cnx) };
             let max_streams = usize::try_from(max_streams).unwrap_or(usize::MAX);
@@ -324,7 +390,8 @@ pub(crate) mod acceptor {
                     };
                     if command_tx
                         .send(Command::NewStream {
-                            stream,
+                            stream: stream.into(),
+                            trace: 0,
                             reservation,
                         })
                         .is_err()
@@ -387,6 +454,42 @@ pub(crate) mod acceptor {
         }
     }
 
+    struct LocalAcceptor {
+        streams: mpsc::UnboundedReceiver<ProvidedStream>,
+        command_tx: mpsc::UnboundedSender<Command>,
+        limiter: Arc<AcceptorLimiter>,
+    }
+
+    impl LocalAcceptor {
+        async fn run(mut self) {
+            while let Some(ProvidedStream { stream, trace }) = self.streams.recv().await {
+                let reservation = self.limiter.reserve().await;
+                if let Err(err) = stream.set_nonblocking(true) {
+                    warn!("acceptor: local stream nonblocking failed err={}", err);
+                    continue;
+                }
+                let stream = match TokioUnixStream::from_std(stream) {
+                    Ok(stream) => stream,
+                    Err(err) => {
+                        warn!("acceptor: local stream register failed err={}", err);
+                        continue;
+                    }
+                };
+                if self
+                    .command_tx
+                    .send(Command::NewStream {
+                        stream: LocalStream::Unix(stream),
+                        trace,
+                        reservation,
+                    })
+                    .is_err()
+                {
+                    break;
+                }
+            }
+        }
+    }
+
     #[cfg(test)]
     mod tests {
         use super::AcceptorLimiter;
@@ -448,6 +551,7 @@ impl ClientState {
             debug_enqueued_bytes: 0,
             debug_last_enqueue_at: 0,
             acceptor_limit_logged: false,
+            datagrams: DatagramRelay::new(),
         }
     }
 
@@ -463,6 +567,20 @@ impl ClientState {
         self.streams.len()
     }
 
+    /// When a datagram last went to or came from the server.
+    pub(crate) fn last_datagram_activity(&self) -> Option<std::time::Instant> {
+        self.datagrams.last_activity()
+    }
+
+    /// True while some stream has yet to receive more than its first bytes:
+    /// a request waiting on its response, or an interactive session, where a
+    /// slow poll shows up as latency rather than as lower throughput.
+    pub(crate) fn has_latency_sensitive_stream(&self) -> bool {
+        self.streams
+            .values()
+            .any(|stream| stream.flow.rx_bytes < LATENCY_SENSITIVE_RX_BYTES)
+    }
+
     pub(crate) fn update_acceptor_limit(&mut self, cnx: *mut picoquic_cnx_t) {
         let max_streams = self.acceptor.update_limit(cnx);
         if !self.acceptor_limit_logged && max_streams > 0 {
@@ -621,6 +739,8 @@ fn check_stream_invariants(state: &ClientState, stream_id: u64, context: &str) {
 }
 
 struct ClientStream {
+    /// Trace ID of the engine session behind the stream, 0 when not traced.
+    trace: u64,
     write_tx: mpsc::UnboundedSender<StreamWrite>,
     read_abort_tx: Option<oneshot::Sender<()>>,
     data_rx: Option<mpsc::Receiver<Vec<u8>>>,
@@ -628,6 +748,7 @@ struct ClientStream {
     recv_state: StreamRecvState,
     send_state: StreamSendState,
     flow: FlowControlState,
+    class: StreamClass,
 }
 
 impl HasFlowControlState for ClientStream {
@@ -647,7 +768,8 @@ enum StreamWrite {
 
 pub(crate) enum Command {
     NewStream {
-        stream: TokioTcpStream,
+        stream: LocalStream,
+        trace: u64,
         reservation: acceptor::AcceptorReservation,
     },
     StreamData {
@@ -667,6 +789,13 @@ pub(crate) enum Command {
         stream_id: u64,
         bytes: usize,
     },
+    Datagram {
+        socket: LocalSocket,
+        message: Vec<u8>,
+    },
+    DatagramSocketClosed {
+        socket_id: u64,
+    },
 }
 
 pub(crate) enum PathEvent {
@@ -778,6 +907,12 @@ pub(crate) unsafe extern "C" fn client_callback(
                 let _ = picoquic_provide_stream_data_buffer(bytes as *mut _, 0, 0, 0);
             }
         }
+        picoquic_call_back_event_t::picoquic_callback_datagram => {
+            if length > 0 && !bytes.is_null() {
+                let datagram = unsafe { std::slice::from_raw_parts(bytes as *const u8, length) };
+                state.datagrams.deliver(datagram);
+            }
+        }
         picoquic_call_back_event_t::picoquic_callback_path_available => {
             state.path_events.push(PathEvent::Available(stream_id));
         }
@@ -790,6 +925,18 @@ pub(crate) unsafe extern "C" fn client_callback(
     0
 }
 
+/// Re-pins a stream whose traffic class changed, see
+/// `slipstream_core::priority`.
+fn set_stream_priority(cnx: *mut picoquic_cnx_t, stream_id: u64, priority: u8, debug: bool) {
+    if cnx.is_null() {
+        return;
+    }
+    let ret = unsafe { picoquic_set_stream_priority(cnx, stream_id, priority) };
+    if debug {
+        debug!("stream {}: priority {} ret={}", stream_id, priority, ret);
+    }
+}
+
 fn handle_stream_data(
     cnx: *mut picoquic_cnx_t,
     state: &mut ClientState,
@@ -818,6 +965,13 @@ fn handle_stream_data(
             unsafe { abort_stream_bidi(cnx, stream_id, SLIPSTREAM_FILE_CANCEL_ERROR) };
             return;
         };
+        if stream.flow.rx_bytes == 0 && !data.is_empty() {
+            crate::trace::record(stream.trace, crate::trace::STREAM_FIRST_BYTE);
+        }
+        let now = unsafe { picoquic_current_time() };
+        if let Some(priority) = stream.class.observe_bytes(data.len(), now) {
+            set_stream_priority(cnx, stream_id, priority, debug_streams);
+        }
 
         if handle_stream_receive(
             stream,
@@ -946,6 +1100,7 @@ mod test_hooks {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::provider::ProvidedStream;
     use slipstream_core::test_support::ResetOnDrop;
     use std::sync::Arc;
     use tokio::net::TcpListener as TokioTcpListener;
@@ -966,6 +1121,7 @@ mod tests {
         state.streams.insert(
             stream_id,
             ClientStream {
+                trace: 0,
                 write_tx,
                 read_abort_tx: Some(read_abort_tx),
                 data_rx: None,
@@ -973,6 +1129,7 @@ mod tests {
                 recv_state: StreamRecvState::Open,
                 send_state: StreamSendState::Open,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(0),
             },
         );
 
@@ -1004,6 +1161,7 @@ mod tests {
         state.streams.insert(
             stream_id,
             ClientStream {
+                trace: 0,
                 write_tx,
                 read_abort_tx: Some(read_abort_tx),
                 data_rx: Some(data_rx),
@@ -1011,6 +1169,7 @@ mod tests {
                 recv_state: StreamRecvState::Open,
                 send_state: StreamSendState::Open,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(0),
             },
         );
 
@@ -1046,6 +1205,7 @@ mod tests {
         state.streams.insert(
             stream_id,
             ClientStream {
+                trace: 0,
                 write_tx,
                 read_abort_tx: Some(read_abort_tx),
                 data_rx: Some(data_rx),
@@ -1053,6 +1213,7 @@ mod tests {
                 recv_state: StreamRecvState::Open,
                 send_state: StreamSendState::Open,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(0),
             },
         );
 
@@ -1092,6 +1253,7 @@ mod tests {
         state.streams.insert(
             stream_id,
             ClientStream {
+                trace: 0,
                 write_tx,
                 read_abort_tx: Some(read_abort_tx),
                 data_rx: None,
@@ -1099,6 +1261,7 @@ mod tests {
                 recv_state: StreamRecvState::Open,
                 send_state: StreamSendState::FinQueued,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(0),
             },
         );
 
@@ -1150,7 +1313,8 @@ mod tests {
                 std::ptr::null_mut(),
                 &mut state as *mut _,
                 Command::NewStream {
-                    stream,
+                    stream: stream.into(),
+                    trace: 0,
                     reservation,
                 },
             );
@@ -1201,6 +1365,54 @@ mod tests {
             drop(clients);
         });
     }
+
+    #[test]
+    fn local_streams_share_acceptor_credit() {
+        let _guard = ResetOnDrop::new(|| acceptor::ClientAcceptor::set_test_limit(0));
+        acceptor::ClientAcceptor::set_test_limit(1);
+        let rt = tokio::runtime::Builder::new_current_thread()
+            .enable_io()
+            .enable_time()
+            .build()
+            .expect("build tokio runtime");
+        rt.block_on(async {
+            let (local_tx, local_rx) = mpsc::unbounded_channel();
+            let (command_tx, mut command_rx) = mpsc::unbounded_channel();
+            let acceptor = acceptor::ClientAcceptor::new();
+            acceptor.spawn_local(local_rx, command_tx);
+
+            let mut peers = Vec::new();
+            for _ in 0..2 {
+                let (local, remote) = std::os::unix::net::UnixStream::pair().expect("pair");
+                local_tx
+                    .send(ProvidedStream {
+                        stream: remote,
+                        trace: 0,
+                    })
+                    .expect("send local stream");
+                peers.push(local);
+            }
+
+            let first = timeout(Duration::from_secs(1), command_rx.recv())
+                .await
+                .expect("first local stream")
+                .expect("first command");
+            assert!(matches!(
+                first,
+                Command::NewStream {
+                    stream: LocalStream::Unix(_),
+                    ..
+                }
+            ));
+            let second = timeout(Duration::from_millis(200), command_rx.recv()).await;
+            assert!(
+                second.is_err(),
+                "expected local streams to wait for stream credit like accepts"
+            );
+
+            drop(peers);
+        });
+    }
 }
 
 pub(crate) fn drain_commands(
@@ -1244,13 +1456,13 @@ pub(crate) fn handle_command(
     match command {
         Command::NewStream {
             stream,
+            trace,
             reservation,
         } => {
             if !reservation.is_fresh() {
                 drop(stream);
                 return;
             }
-            let _ = stream.set_nodelay(true);
             #[cfg(test)]
             let forced_failure = test_hooks::take_mark_active_stream_failure();
             #[cfg(not(test))]
@@ -1313,6 +1525,7 @@ pub(crate) fn handle_command(
             state.streams.insert(
                 stream_id,
                 ClientStream {
+                    trace,
                     write_tx,
                     read_abort_tx: Some(read_abort_tx),
                     data_rx: Some(data_rx),
@@ -1320,6 +1533,7 @@ pub(crate) fn handle_command(
                     recv_state: StreamRecvState::Open,
                     send_state: StreamSendState::Open,
                     flow: FlowControlState::default(),
+                    class: StreamClass::new(unsafe { picoquic_current_time() }),
                 },
             );
             spawn_client_reader(
@@ -1360,6 +1574,7 @@ pub(crate) fn handle_command(
                     },
                 );
             }
+            crate::trace::record(trace, crate::trace::STREAM_OPEN);
             if state.debug_streams {
                 debug!("stream {}: accepted", stream_id);
             } else {
@@ -1380,8 +1595,14 @@ pub(crate) fn handle_command(
                 unsafe { abort_stream_bidi(cnx, stream_id, SLIPSTREAM_INTERNAL_ERROR) };
                 state.streams.remove(&stream_id);
             } else if let Some(stream) = state.streams.get_mut(&stream_id) {
+                if stream.tx_bytes == 0 {
+                    crate::trace::record(stream.trace, crate::trace::STREAM_REQUEST);
+                }
                 stream.tx_bytes = stream.tx_bytes.saturating_add(data.len() as u64);
                 let now = unsafe { picoquic_current_time() };
+                if let Some(priority) = stream.class.observe_uplink(&data, now) {
+                    set_stream_priority(cnx, stream_id, priority, state.debug_streams);
+                }
                 state.debug_enqueued_bytes =
                     state.debug_enqueued_bytes.saturating_add(data.len() as u64);
                 state.debug_last_enqueue_at = now;
@@ -1505,12 +1726,18 @@ pub(crate) fn handle_command(
             }
             check_stream_invariants(state, stream_id, "StreamWriteDrained");
         }
+        Command::Datagram { socket, message } => {
+            state.datagrams.send(cnx, socket, &message);
+        }
+        Command::DatagramSocketClosed { socket_id } => {
+            state.datagrams.close_socket(socket_id);
+        }
     }
 }
 
 fn spawn_client_reader(
     stream_id: u64,
-    mut read_half: tokio::net::tcp::OwnedReadHalf,
+    mut read_half: StreamReadHalf,
     mut read_abort_rx: oneshot::Receiver<()>,
     command_tx: mpsc::UnboundedSender<Command>,
     data_tx: mpsc::Sender<Vec<u8>>,
@@ -1553,7 +1780,7 @@ fn spawn_client_reader(
 
 fn spawn_client_writer(
     stream_id: u64,
-    mut write_half: tokio::net::tcp::OwnedWriteHalf,
+    mut write_half: StreamWriteHalf,
     mut write_rx: mpsc::UnboundedReceiver<StreamWrite>,
     command_tx: mpsc::UnboundedSender<Command>,
     coalesce_max_bytes: usize,
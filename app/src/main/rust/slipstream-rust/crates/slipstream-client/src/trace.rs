@@ -0,0 +1,158 @@
+//! Milestones of flows traced by the tun2socks engine.
+//!
+//! The engine samples some of its sessions and opens their streams with
+//! `slipstream_client_open_traced_stream`, which hands the session's trace ID
+//! along with the stream. The client then records when the QUIC stream opened,
+//! when the first request bytes were queued on it and when the first answer
+//! bytes arrived, on the engine's clock (CLOCK_MONOTONIC in microseconds), so
+//! both sets of events merge into one breakdown per flow. Events have the
+//! layout of `HevSocks5TunnelTraceEvent`, with milestones numbered after the
+//! engine's.
+//!
+//! Recording never blocks the connection: events go into a fixed ring with
+//! one sequence number per slot, and are dropped while the ring is full.
+
+use std::sync::atomic::{AtomicU32, AtomicU64, AtomicUsize, Ordering};
+use std::sync::Mutex;
+
+/// The QUIC stream of the flow was opened.
+pub const STREAM_OPEN: u32 = 16;
+/// The first bytes from the engine were queued on the stream.
+pub const STREAM_REQUEST: u32 = 17;
+/// The first bytes from the server arrived on the stream.
+pub const STREAM_FIRST_BYTE: u32 = 18;
+
+const TRACE_EVENTS: usize = 256;
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct TraceEvent {
+    pub trace: u64,
+    pub time: u64,
+    pub milestone: u32,
+    pub reserved: u32,
+}
+
+/// A slot of lap `n` is free for writers while its sequence is `2n` and
+/// holds an event for the reader while it is `2n + 1`.
+struct Slot {
+    seq: AtomicUsize,
+    trace: AtomicU64,
+    time: AtomicU64,
+    milestone: AtomicU32,
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_SLOT: Slot = Slot {
+    seq: AtomicUsize::new(0),
+    trace: AtomicU64::new(0),
+    time: AtomicU64::new(0),
+    milestone: AtomicU32::new(0),
+};
+
+static SLOTS: [Slot; TRACE_EVENTS] = [EMPTY_SLOT; TRACE_EVENTS];
+static HEAD: AtomicUsize = AtomicUsize::new(0);
+static TAIL: Mutex<usize> = Mutex::new(0);
+
+fn monotonic_micros() -> u64 {
+    let mut ts = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts) };
+    ts.tv_sec as u64 * 1_000_000 + ts.tv_nsec as u64 / 1_000
+}
+
+/// Record that the flow traced as `trace` reached `milestone`. Does nothing
+/// for trace 0, flows the engine did not sample.
+pub(crate) fn record(trace: u64, milestone: u32) {
+    if trace == 0 {
+        return;
+    }
+    let mut pos = HEAD.load(Ordering::Relaxed);
+    loop {
+        let slot = &SLOTS[pos % TRACE_EVENTS];
+        let lap = 2 * (pos / TRACE_EVENTS);
+        let seq = slot.seq.load(Ordering::Acquire);
+        if seq == lap {
+            match HEAD.compare_exchange_weak(pos, pos + 1, Ordering::Relaxed, Ordering::Relaxed) {
+                Ok(_) => {
+                    slot.trace.store(trace, Ordering::Relaxed);
+                    slot.time.store(monotonic_micros(), Ordering::Relaxed);
+                    slot.milestone.store(milestone, Ordering::Relaxed);
+                    slot.seq.store(lap + 1, Ordering::Release);
+                    return;
+                }
+                Err(current) => pos = current,
+            }
+        } else if seq < lap {
+            // Still holds the event of the previous lap: full.
+            return;
+        } else {
+            pos = HEAD.load(Ordering::Relaxed);
+        }
+    }
+}
+
+/// Take recorded events into `events`, oldest first. Returns how many.
+pub fn take(events: &mut [TraceEvent]) -> usize {
+    let mut tail = TAIL.lock().unwrap_or_else(|err| err.into_inner());
+    let mut taken = 0;
+    while taken < events.len() {
+        let slot = &SLOTS[*tail % TRACE_EVENTS];
+        let lap = 2 * (*tail / TRACE_EVENTS);
+        if slot.seq.load(Ordering::Acquire) != lap + 1 {
+            break;
+        }
+        events[taken] = TraceEvent {
+            trace: slot.trace.load(Ordering::Relaxed),
+            time: slot.time.load(Ordering::Relaxed),
+            milestone: slot.milestone.load(Ordering::Relaxed),
+            reserved: 0,
+        };
+        slot.seq.store(lap + 2, Ordering::Release);
+        *tail += 1;
+        taken += 1;
+    }
+    taken
+}
+
+/// Take recorded events, as `hev_socks5_tunnel_take_traces` does for the
+/// engine's. Returns how many were written to `events`.
+#[no_mangle]
+pub extern "C" fn slipstream_client_take_traces(events: *mut TraceEvent, count: usize) -> usize {
+    if events.is_null() || count == 0 {
+        return 0;
+    }
+    let events = unsafe { std::slice::from_raw_parts_mut(events, count) };
+    take(events)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn events_are_taken_in_order_and_dropped_while_full() {
+        let mut events = vec![TraceEvent::default(); TRACE_EVENTS + 1];
+        take(&mut events);
+
+        record(0, STREAM_OPEN);
+        for trace in 1..=(TRACE_EVENTS as u64 + 8) {
+            record(trace, STREAM_OPEN);
+        }
+        assert_eq!(take(&mut events), TRACE_EVENTS);
+        assert!(events[..TRACE_EVENTS]
+            .iter()
+            .enumerate()
+            .all(
+                |(index, event)| event.trace == index as u64 + 1 && event.milestone == STREAM_OPEN
+            ));
+        assert!(events[0].time <= events[TRACE_EVENTS - 1].time);
+
+        record(7, STREAM_FIRST_BYTE);
+        assert_eq!(take(&mut events[..1]), 1);
+        assert_eq!(events[0].trace, 7);
+        assert_eq!(take(&mut events), 0);
+    }
+}
@@ -0,0 +1,155 @@
+//! UDP datagrams carried in QUIC DATAGRAM frames.
+//!
+//! From client to server a datagram is a flow ID (2 bytes, big endian), the
+//! destination as a SOCKS5 address (IPv4 or IPv6, no names), then the
+//! payload. From server to client it is the flow ID, then the payload. Every
+//! uplink datagram carries its destination, so the server never depends on
+//! one that may have been lost.
+//!
+//! The in-process handoff between the tun2socks engine and the client puts
+//! the SOCKS5 UDP request header of RFC 1928 (RSV, FRAG, address) in front
+//! of each payload, as hev-socks5-tunnel sends over UDP ASSOCIATE.
+
+use std::net::{Ipv4Addr, Ipv6Addr, SocketAddr, SocketAddrV4, SocketAddrV6};
+
+pub const FLOW_ID_LEN: usize = 2;
+/// Longest uplink header, the one of an IPv6 destination.
+pub const UPLINK_HEADER_MAX: usize = FLOW_ID_LEN + 1 + 16 + 2;
+/// Longest SOCKS5 UDP request header of an IP address.
+pub const SOCKS_UDP_HEADER_MAX: usize = 3 + 1 + 16 + 2;
+
+const ATYP_IPV4: u8 = 1;
+const ATYP_IPV6: u8 = 4;
+
+pub fn encode_uplink(flow_id: u16, dest: SocketAddr, payload: &[u8], out: &mut Vec<u8>) {
+    out.clear();
+    out.extend_from_slice(&flow_id.to_be_bytes());
+    write_addr(dest, out);
+    out.extend_from_slice(payload);
+}
+
+pub fn decode_uplink(datagram: &[u8]) -> Option<(u16, SocketAddr, &[u8])> {
+    let flow_id = read_flow_id(datagram)?;
+    let (dest, len) = read_addr(&datagram[FLOW_ID_LEN..])?;
+    Some((flow_id, dest, &datagram[FLOW_ID_LEN + len..]))
+}
+
+pub fn encode_downlink(flow_id: u16, payload: &[u8], out: &mut Vec<u8>) {
+    out.clear();
+    out.extend_from_slice(&flow_id.to_be_bytes());
+    out.extend_from_slice(payload);
+}
+
+pub fn decode_downlink(datagram: &[u8]) -> Option<(u16, &[u8])> {
+    let flow_id = read_flow_id(datagram)?;
+    Some((flow_id, &datagram[FLOW_ID_LEN..]))
+}
+
+pub fn encode_socks_udp(addr: SocketAddr, payload: &[u8], out: &mut Vec<u8>) {
+    out.clear();
+    out.extend_from_slice(&[0, 0, 0]);
+    write_addr(addr, out);
+    out.extend_from_slice(payload);
+}
+
+/// Splits a SOCKS5 UDP request into its address and payload. Fragments and
+/// domain names are not supported.
+pub fn decode_socks_udp(message: &[u8]) -> Option<(SocketAddr, &[u8])> {
+    if message.len() < 3 || message[2] != 0 {
+        return None;
+    }
+    let (addr, len) = read_addr(&message[3..])?;
+    Some((addr, &message[3 + len..]))
+}
+
+fn read_flow_id(datagram: &[u8]) -> Option<u16> {
+    let bytes = datagram.get(..FLOW_ID_LEN)?;
+    Some(u16::from_be_bytes([bytes[0], bytes[1]]))
+}
+
+fn write_addr(addr: SocketAddr, out: &mut Vec<u8>) {
+    match addr {
+        SocketAddr::V4(addr) => {
+            out.push(ATYP_IPV4);
+            out.extend_from_slice(&addr.ip().octets());
+        }
+        SocketAddr::V6(addr) => match addr.ip().to_ipv4_mapped() {
+            Some(ip) => {
+                out.push(ATYP_IPV4);
+                out.extend_from_slice(&ip.octets());
+            }
+            None => {
+                out.push(ATYP_IPV6);
+                out.extend_from_slice(&addr.ip().octets());
+            }
+        },
+    }
+    out.extend_from_slice(&addr.port().to_be_bytes());
+}
+
+fn read_addr(bytes: &[u8]) -> Option<(SocketAddr, usize)> {
+    let (addr, len) = match *bytes.first()? {
+        ATYP_IPV4 => {
+            let octets: [u8; 4] = bytes.get(1..5)?.try_into().ok()?;
+            let port = u16::from_be_bytes(bytes.get(5..7)?.try_into().ok()?);
+            (
+                SocketAddr::V4(SocketAddrV4::new(Ipv4Addr::from(octets), port)),
+                7,
+            )
+        }
+        ATYP_IPV6 => {
+            let octets: [u8; 16] = bytes.get(1..17)?.try_into().ok()?;
+            let port = u16::from_be_bytes(bytes.get(17..19)?.try_into().ok()?);
+            (
+                SocketAddr::V6(SocketAddrV6::new(Ipv6Addr::from(octets), port, 0, 0)),
+                19,
+            )
+        }
+        _ => return None,
+    };
+    Some((addr, len))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn uplink_round_trips_both_families() {
+        let mut out = Vec::new();
+        for dest in ["8.8.8.8:53", "[2001:db8::1]:443"] {
+            let dest: SocketAddr = dest.parse().unwrap();
+            encode_uplink(7, dest, b"query", &mut out);
+            assert!(out.len() <= UPLINK_HEADER_MAX + 5);
+            assert_eq!(decode_uplink(&out), Some((7, dest, &b"query"[..])));
+        }
+
+        // Mapped addresses travel as IPv4.
+        let mapped: SocketAddr = "[::ffff:1.2.3.4]:53".parse().unwrap();
+        encode_uplink(1, mapped, b"", &mut out);
+        assert_eq!(
+            decode_uplink(&out),
+            Some((1, "1.2.3.4:53".parse().unwrap(), &b""[..]))
+        );
+
+        assert_eq!(decode_uplink(&out[..5]), None);
+        assert_eq!(decode_uplink(&[0, 1, 3, 4]), None);
+    }
+
+    #[test]
+    fn downlink_and_socks_headers_round_trip() {
+        let mut out = Vec::new();
+        encode_downlink(0xbeef, b"answer", &mut out);
+        assert_eq!(decode_downlink(&out), Some((0xbeef, &b"answer"[..])));
+        assert_eq!(decode_downlink(&[1]), None);
+
+        let addr: SocketAddr = "10.0.0.1:5353".parse().unwrap();
+        encode_socks_udp(addr, b"data", &mut out);
+        assert_eq!(&out[..4], &[0, 0, 0, ATYP_IPV4]);
+        assert_eq!(decode_socks_udp(&out), Some((addr, &b"data"[..])));
+
+        // Fragments are dropped.
+        out[2] = 1;
+        assert_eq!(decode_socks_udp(&out), None);
+    }
+}
@@ -1,3 +1,4 @@
+use std::sync::atomic::{AtomicUsize, Ordering};
 use std::sync::OnceLock;
 
 const DEFAULT_STREAM_QUEUE_MAX_BYTES: usize = 2 * 1024 * 1024;
@@ -77,6 +78,9 @@ pub struct StreamReceiveConfig {
     pub multi_stream: bool,
     pub reserve_bytes: usize,
     pub max_queue: usize,
+    /// Grant credit in multi-stream mode only as queued data drains, as in
+    /// single-stream mode, instead of on receive.
+    pub defer_credit: bool,
 }
 
 impl StreamReceiveConfig {
@@ -90,8 +94,78 @@ impl StreamReceiveConfig {
             multi_stream,
             reserve_bytes,
             max_queue,
+            defer_credit: false,
         }
     }
+
+    /// Shrinks the queue cap and defers credit as `pool` fills.
+    pub fn with_memory_pool(mut self, pool: &RecvMemoryPool) -> Self {
+        if self.multi_stream {
+            self.max_queue = pool.stream_queue_limit(self.max_queue);
+            self.defer_credit = pool.under_pressure();
+        }
+        self
+    }
+}
+
+/// Receive memory shared by every stream of every connection, as a byte
+/// budget over the data queued towards local sockets.
+///
+/// Up to half full the pool changes nothing. Past that, multi-stream queues
+/// are granted credit only as they drain, which holds back the connection's
+/// MAX_DATA, and the per-stream queue cap shrinks in proportion to the room
+/// left, down to the connection reserve, so a stream that keeps growing is
+/// stopped before the pool runs out.
+#[derive(Debug)]
+pub struct RecvMemoryPool {
+    used: AtomicUsize,
+    limit: usize,
+}
+
+impl RecvMemoryPool {
+    /// A pool of `limit` bytes; 0 leaves it unlimited.
+    pub fn new(limit: usize) -> Self {
+        Self {
+            used: AtomicUsize::new(0),
+            limit,
+        }
+    }
+
+    pub fn limit(&self) -> usize {
+        self.limit
+    }
+
+    pub fn used(&self) -> usize {
+        self.used.load(Ordering::Relaxed)
+    }
+
+    /// Moves a queue's share of the pool from `before` to `after` bytes.
+    pub fn account(&self, before: usize, after: usize) {
+        if after > before {
+            self.used.fetch_add(after - before, Ordering::Relaxed);
+        } else if before > after {
+            let _ = self
+                .used
+                .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |used| {
+                    Some(used.saturating_sub(before - after))
+                });
+        }
+    }
+
+    pub fn under_pressure(&self) -> bool {
+        self.limit > 0 && self.used() >= self.limit / 2
+    }
+
+    /// The per-stream queue cap in place of `max_queue`.
+    pub fn stream_queue_limit(&self, max_queue: usize) -> usize {
+        if !self.under_pressure() {
+            return max_queue;
+        }
+        let half = self.limit / 2;
+        let room = self.limit.saturating_sub(self.used());
+        let scaled = (max_queue as u128 * room as u128 / half.max(1) as u128) as usize;
+        scaled.clamp(conn_reserve_bytes().min(max_queue), max_queue)
+    }
 }
 
 pub struct StreamReceiveOps<Enqueue, Overflow, Consume, Stop, Log, Err> {
@@ -355,10 +429,15 @@ where
             queued_bytes = queued_bytes.saturating_add(incoming_len);
         }
 
+        let target = if config.defer_credit {
+            reserve_target_offset(rx_bytes, queued_bytes, fin_offset, conn_reserve_bytes())
+        } else {
+            rx_bytes
+        };
         if !discarding
             && !consume_stream_data(
                 &mut consumed_offset,
-                rx_bytes,
+                target,
                 &mut ops.consume,
                 &mut ops.on_consume_error,
             )
@@ -392,3 +471,100 @@ where
 
     reset_stream
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn pool_shrinks_queue_caps_past_half_full() {
+        let max_queue = 2 * 1024 * 1024;
+        let pool = RecvMemoryPool::new(16 * 1024 * 1024);
+        pool.account(0, 4 * 1024 * 1024);
+        assert!(!pool.under_pressure());
+        assert_eq!(pool.stream_queue_limit(max_queue), max_queue);
+
+        pool.account(4 * 1024 * 1024, 12 * 1024 * 1024);
+        assert!(pool.under_pressure());
+        assert_eq!(pool.stream_queue_limit(max_queue), max_queue / 2);
+
+        pool.account(0, 8 * 1024 * 1024);
+        assert_eq!(pool.used(), 20 * 1024 * 1024);
+        assert_eq!(
+            pool.stream_queue_limit(max_queue),
+            conn_reserve_bytes().min(max_queue)
+        );
+
+        pool.account(20 * 1024 * 1024, 0);
+        assert_eq!(pool.used(), 0);
+        pool.account(1, 0);
+        assert_eq!(pool.used(), 0);
+    }
+
+    #[test]
+    fn unlimited_pool_changes_nothing() {
+        let pool = RecvMemoryPool::new(0);
+        pool.account(0, usize::MAX / 2);
+        let config = StreamReceiveConfig::new(true, 0).with_memory_pool(&pool);
+        assert_eq!(config.max_queue, stream_queue_max_bytes());
+        assert!(!config.defer_credit);
+    }
+
+    #[derive(Default)]
+    struct Stream {
+        flow: FlowControlState,
+    }
+
+    impl HasFlowControlState for Stream {
+        fn flow_control(&self) -> &FlowControlState {
+            &self.flow
+        }
+
+        fn flow_control_mut(&mut self) -> &mut FlowControlState {
+            &mut self.flow
+        }
+    }
+
+    fn receive(stream: &mut Stream, len: usize, config: StreamReceiveConfig) -> u64 {
+        let mut consumed_to = 0;
+        handle_stream_receive(
+            stream,
+            len,
+            config,
+            StreamReceiveOps {
+                enqueue: |_: &mut Stream| Ok(()),
+                on_overflow: |_: &mut Stream| {},
+                consume: |offset| {
+                    consumed_to = offset;
+                    0
+                },
+                stop_sending: || {},
+                log_overflow: |_, _, _| {},
+                on_consume_error: |_, _, _| {},
+            },
+        );
+        consumed_to
+    }
+
+    #[test]
+    fn pressure_defers_multi_stream_credit() {
+        let len = conn_reserve_bytes() + 1000;
+        let mut stream = Stream::default();
+        assert_eq!(
+            receive(&mut stream, len, StreamReceiveConfig::new(true, 0)),
+            len as u64
+        );
+
+        let pool = RecvMemoryPool::new(1024 * 1024);
+        pool.account(0, 600 * 1024);
+        let mut stream = Stream::default();
+        let config = StreamReceiveConfig::new(true, 0).with_memory_pool(&pool);
+        assert!(config.defer_credit);
+        assert_eq!(
+            receive(&mut stream, len, config),
+            conn_reserve_bytes() as u64
+        );
+        assert_eq!(stream.flow.queued_bytes, len);
+        assert!(!stream.flow.discarding);
+    }
+}
@@ -1,9 +1,11 @@
 use std::fmt;
 
+pub mod datagram;
 pub mod flow_control;
 pub mod invariants;
 mod macros;
 pub mod net;
+pub mod priority;
 pub mod sip003;
 pub mod stream;
 pub mod tcp;
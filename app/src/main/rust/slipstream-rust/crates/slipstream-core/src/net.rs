@@ -1,4 +1,8 @@
 use std::io::{Error, ErrorKind};
+#[cfg(unix)]
+use std::net::{Ipv4Addr, Ipv6Addr, SocketAddr, SocketAddrV4, SocketAddrV6};
+#[cfg(unix)]
+use std::os::unix::io::AsRawFd;
 
 pub fn is_transient_udp_error(err: &Error) -> bool {
     match err.kind() {
@@ -13,3 +17,320 @@ pub fn is_transient_udp_error(err: &Error) -> bool {
         Some(code) if code == libc::ENETUNREACH || code == libc::EHOSTUNREACH
     )
 }
+
+/// Datagrams taken off a socket by one `recv_batch` call.
+///
+/// Buffers are allocated once, `capacity` slots of `slot_len` bytes, and
+/// reused by every call; datagrams longer than a slot are truncated.
+#[cfg(unix)]
+pub struct RecvBatch {
+    buf: Vec<u8>,
+    slot_len: usize,
+    slots: Vec<(usize, usize)>,
+    peers: Vec<SocketAddr>,
+}
+
+#[cfg(unix)]
+impl RecvBatch {
+    pub fn new(capacity: usize, slot_len: usize) -> Self {
+        let capacity = capacity.max(1);
+        Self {
+            buf: vec![0u8; capacity * slot_len],
+            slot_len,
+            slots: Vec::with_capacity(capacity),
+            peers: Vec::with_capacity(capacity),
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.slots.capacity()
+    }
+
+    pub fn len(&self) -> usize {
+        self.slots.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.slots.is_empty()
+    }
+
+    pub fn get(&self, index: usize) -> (&[u8], SocketAddr) {
+        let (start, len) = self.slots[index];
+        (&self.buf[start..start + len], self.peers[index])
+    }
+}
+
+/// Receives up to `batch.capacity()` datagrams without blocking, with a
+/// single recvmmsg on Linux and Android.
+///
+/// Fails with `WouldBlock` when nothing is queued, so it can run inside
+/// tokio's `try_io`. Returns the number of datagrams received.
+#[cfg(unix)]
+pub fn recv_batch<T: AsRawFd>(socket: &T, batch: &mut RecvBatch) -> std::io::Result<usize> {
+    batch.slots.clear();
+    batch.peers.clear();
+    let capacity = batch.capacity();
+    let fd = socket.as_raw_fd();
+
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    {
+        let mut addrs: Vec<libc::sockaddr_storage> = vec![unsafe { std::mem::zeroed() }; capacity];
+        let mut iovecs: Vec<libc::iovec> = batch
+            .buf
+            .chunks_mut(batch.slot_len)
+            .map(|chunk| libc::iovec {
+                iov_base: chunk.as_mut_ptr() as *mut libc::c_void,
+                iov_len: chunk.len(),
+            })
+            .collect();
+        let mut msgs: Vec<libc::mmsghdr> = (0..capacity)
+            .map(|i| {
+                let mut msg: libc::mmsghdr = unsafe { std::mem::zeroed() };
+                msg.msg_hdr.msg_name = &mut addrs[i] as *mut _ as *mut libc::c_void;
+                msg.msg_hdr.msg_namelen = std::mem::size_of::<libc::sockaddr_storage>() as _;
+                msg.msg_hdr.msg_iov = &mut iovecs[i];
+                msg.msg_hdr.msg_iovlen = 1;
+                msg
+            })
+            .collect();
+        let ret = unsafe {
+            libc::recvmmsg(
+                fd,
+                msgs.as_mut_ptr(),
+                capacity as _,
+                libc::MSG_DONTWAIT as _,
+                std::ptr::null_mut(),
+            )
+        };
+        if ret < 0 {
+            return Err(Error::last_os_error());
+        }
+        for (i, (msg, addr)) in msgs.iter().zip(addrs.iter()).take(ret as usize).enumerate() {
+            if let Some(peer) = storage_to_socket_addr(addr) {
+                let len = (msg.msg_len as usize).min(batch.slot_len);
+                batch.slots.push((i * batch.slot_len, len));
+                batch.peers.push(peer);
+            }
+        }
+    }
+
+    #[cfg(not(any(target_os = "linux", target_os = "android")))]
+    {
+        for i in 0..capacity {
+            let mut addr: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+            let mut addr_len = std::mem::size_of::<libc::sockaddr_storage>() as libc::socklen_t;
+            let slot = &mut batch.buf[i * batch.slot_len..(i + 1) * batch.slot_len];
+            let ret = unsafe {
+                libc::recvfrom(
+                    fd,
+                    slot.as_mut_ptr() as *mut libc::c_void,
+                    slot.len(),
+                    libc::MSG_DONTWAIT,
+                    &mut addr as *mut _ as *mut libc::sockaddr,
+                    &mut addr_len,
+                )
+            };
+            if ret < 0 {
+                let err = Error::last_os_error();
+                if i == 0 {
+                    return Err(err);
+                }
+                break;
+            }
+            if let Some(peer) = storage_to_socket_addr(&addr) {
+                let len = (ret as usize).min(batch.slot_len);
+                batch.slots.push((i * batch.slot_len, len));
+                batch.peers.push(peer);
+            }
+        }
+    }
+
+    Ok(batch.len())
+}
+
+/// Sends datagrams in order without blocking, with a single sendmmsg on
+/// Linux and Android.
+///
+/// Returns how many were sent, which may be fewer than given; an error is
+/// only returned if the first one could not be sent, `WouldBlock` when the
+/// socket buffer is full.
+#[cfg(unix)]
+pub fn send_batch<T: AsRawFd>(
+    socket: &T,
+    datagrams: &[(&[u8], SocketAddr)],
+) -> std::io::Result<usize> {
+    if datagrams.is_empty() {
+        return Ok(0);
+    }
+    let fd = socket.as_raw_fd();
+
+    #[cfg(any(target_os = "linux", target_os = "android"))]
+    {
+        let mut addrs: Vec<(libc::sockaddr_storage, libc::socklen_t)> = datagrams
+            .iter()
+            .map(|(_, peer)| socket_addr_to_storage(peer))
+            .collect();
+        let mut iovecs: Vec<libc::iovec> = datagrams
+            .iter()
+            .map(|(payload, _)| libc::iovec {
+                iov_base: payload.as_ptr() as *mut libc::c_void,
+                iov_len: payload.len(),
+            })
+            .collect();
+        let mut msgs: Vec<libc::mmsghdr> = (0..datagrams.len())
+            .map(|i| {
+                let mut msg: libc::mmsghdr = unsafe { std::mem::zeroed() };
+                msg.msg_hdr.msg_name = &mut addrs[i].0 as *mut _ as *mut libc::c_void;
+                msg.msg_hdr.msg_namelen = addrs[i].1;
+                msg.msg_hdr.msg_iov = &mut iovecs[i];
+                msg.msg_hdr.msg_iovlen = 1;
+                msg
+            })
+            .collect();
+        let ret = unsafe {
+            libc::sendmmsg(
+                fd,
+                msgs.as_mut_ptr(),
+                msgs.len() as _,
+                libc::MSG_DONTWAIT as _,
+            )
+        };
+        if ret < 0 {
+            return Err(Error::last_os_error());
+        }
+        Ok(ret as usize)
+    }
+
+    #[cfg(not(any(target_os = "linux", target_os = "android")))]
+    {
+        for (i, (payload, peer)) in datagrams.iter().enumerate() {
+            let (addr, addr_len) = socket_addr_to_storage(peer);
+            let ret = unsafe {
+                libc::sendto(
+                    fd,
+                    payload.as_ptr() as *const libc::c_void,
+                    payload.len(),
+                    libc::MSG_DONTWAIT,
+                    &addr as *const _ as *const libc::sockaddr,
+                    addr_len,
+                )
+            };
+            if ret < 0 {
+                let err = Error::last_os_error();
+                if i == 0 {
+                    return Err(err);
+                }
+                return Ok(i);
+            }
+        }
+        Ok(datagrams.len())
+    }
+}
+
+#[cfg(unix)]
+fn socket_addr_to_storage(addr: &SocketAddr) -> (libc::sockaddr_storage, libc::socklen_t) {
+    let mut storage: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+    let len = match addr {
+        SocketAddr::V4(addr) => {
+            let sin = unsafe { &mut *(&mut storage as *mut _ as *mut libc::sockaddr_in) };
+            sin.sin_family = libc::AF_INET as _;
+            sin.sin_port = addr.port().to_be();
+            sin.sin_addr = libc::in_addr {
+                s_addr: u32::from_ne_bytes(addr.ip().octets()),
+            };
+            std::mem::size_of::<libc::sockaddr_in>()
+        }
+        SocketAddr::V6(addr) => {
+            let sin6 = unsafe { &mut *(&mut storage as *mut _ as *mut libc::sockaddr_in6) };
+            sin6.sin6_family = libc::AF_INET6 as _;
+            sin6.sin6_port = addr.port().to_be();
+            sin6.sin6_flowinfo = addr.flowinfo();
+            sin6.sin6_addr = libc::in6_addr {
+                s6_addr: addr.ip().octets(),
+            };
+            sin6.sin6_scope_id = addr.scope_id();
+            std::mem::size_of::<libc::sockaddr_in6>()
+        }
+    };
+    (storage, len as libc::socklen_t)
+}
+
+#[cfg(unix)]
+fn storage_to_socket_addr(storage: &libc::sockaddr_storage) -> Option<SocketAddr> {
+    match storage.ss_family as libc::c_int {
+        libc::AF_INET => {
+            let sin = unsafe { &*(storage as *const _ as *const libc::sockaddr_in) };
+            Some(SocketAddr::V4(SocketAddrV4::new(
+                Ipv4Addr::from(sin.sin_addr.s_addr.to_ne_bytes()),
+                u16::from_be(sin.sin_port),
+            )))
+        }
+        libc::AF_INET6 => {
+            let sin6 = unsafe { &*(storage as *const _ as *const libc::sockaddr_in6) };
+            Some(SocketAddr::V6(SocketAddrV6::new(
+                Ipv6Addr::from(sin6.sin6_addr.s6_addr),
+                u16::from_be(sin6.sin6_port),
+                sin6.sin6_flowinfo,
+                sin6.sin6_scope_id,
+            )))
+        }
+        _ => None,
+    }
+}
+
+#[cfg(all(test, unix))]
+mod tests {
+    use super::{recv_batch, send_batch, RecvBatch};
+    use std::io::ErrorKind;
+    use std::net::UdpSocket;
+
+    #[test]
+    fn batch_round_trips_datagrams_in_order() {
+        let receiver = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let sender = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let to = receiver.local_addr().unwrap();
+        let payloads: Vec<Vec<u8>> = (0..40u8).map(|i| vec![i; 1 + i as usize]).collect();
+        let datagrams: Vec<(&[u8], _)> = payloads.iter().map(|p| (p.as_slice(), to)).collect();
+
+        assert_eq!(send_batch(&sender, &datagrams).unwrap(), datagrams.len());
+
+        let mut batch = RecvBatch::new(64, 512);
+        let mut received = Vec::new();
+        while received.len() < payloads.len() {
+            recv_batch(&receiver, &mut batch).unwrap();
+            for i in 0..batch.len() {
+                let (payload, peer) = batch.get(i);
+                assert_eq!(peer, sender.local_addr().unwrap());
+                received.push(payload.to_vec());
+            }
+        }
+        assert_eq!(received, payloads);
+    }
+
+    #[test]
+    fn recv_batch_would_block_when_empty() {
+        let receiver = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let mut batch = RecvBatch::new(8, 512);
+        let err = recv_batch(&receiver, &mut batch).unwrap_err();
+        assert_eq!(err.kind(), ErrorKind::WouldBlock);
+        assert!(batch.is_empty());
+    }
+
+    #[test]
+    fn recv_batch_truncates_to_slot() {
+        let receiver = UdpSocket::bind("127.0.0.1:0").unwrap();
+        let sender = UdpSocket::bind("127.0.0.1:0").unwrap();
+        sender
+            .send_to(&[7u8; 100], receiver.local_addr().unwrap())
+            .unwrap();
+        let mut batch = RecvBatch::new(4, 16);
+        loop {
+            match recv_batch(&receiver, &mut batch) {
+                Ok(_) => break,
+                Err(err) if err.kind() == ErrorKind::WouldBlock => continue,
+                Err(err) => panic!("{}", err),
+            }
+        }
+        assert_eq!(batch.get(0).0, &[7u8; 16][..]);
+    }
+}
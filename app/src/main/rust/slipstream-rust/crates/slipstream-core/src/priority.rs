@@ -0,0 +1,257 @@
+//! QUIC stream priorities by traffic class.
+//!
+//! Every poll carries only a few hundred bytes, so which stream fills it
+//! decides whether a keystroke waits behind a download. A stream starts at
+//! the priority of its destination port, read from the SOCKS5 CONNECT at the
+//! start of its uplink bytes, which both ends of the tunnel see. A stream
+//! that moves more than `BULK_RATE_BYTES_PER_SEC` within a second is
+//! demoted to bulk at once; below half of that for a second, it is back at
+//! its port's priority. This is the same rule as the session-bulk-rate of
+//! the tun2socks engine, applied to the bytes of the stream itself.
+//!
+//! picoquic sends the lowest priority value that has data first, round
+//! robin among streams of even values.
+
+pub const STREAM_PRIORITY_INTERACTIVE: u8 = 2;
+pub const STREAM_PRIORITY_DEFAULT: u8 = 4;
+pub const STREAM_PRIORITY_BULK: u8 = 6;
+
+pub const BULK_RATE_BYTES_PER_SEC: u64 = 32 * 1024;
+const RATE_WINDOW_US: u64 = 1_000_000;
+// Greeting, username/password auth and a CONNECT with the longest name.
+const SNIFF_MAX_BYTES: usize = 2 + 255 + 3 + 2 * 255 + 7 + 255;
+
+const SOCKS_VERSION: u8 = 5;
+const SOCKS_AUTH_VERSION: u8 = 1;
+const SOCKS_CMD_CONNECT: u8 = 1;
+
+/// Ports of protocols where a few bytes wait on each other: remote shells,
+/// DNS over TCP or TLS, remote desktop and push notification channels.
+fn is_interactive_port(port: u16) -> bool {
+    matches!(port, 22 | 23 | 53 | 853 | 3389 | 5222 | 5223 | 5228)
+}
+
+#[derive(Debug, PartialEq, Eq)]
+enum Sniff {
+    NeedMore,
+    Connect(u16),
+    Other,
+}
+
+/// Finds the destination port of the CONNECT request that follows the
+/// SOCKS5 greeting and, if the client offered it, username/password auth.
+fn sniff_connect(bytes: &[u8]) -> Sniff {
+    let Some(&version) = bytes.first() else {
+        return Sniff::NeedMore;
+    };
+    if version != SOCKS_VERSION {
+        return Sniff::Other;
+    }
+    let Some(&methods) = bytes.get(1) else {
+        return Sniff::NeedMore;
+    };
+    let mut offset = 2 + methods as usize;
+    match bytes.get(offset) {
+        None => return Sniff::NeedMore,
+        Some(&SOCKS_AUTH_VERSION) => {
+            let Some(&user_len) = bytes.get(offset + 1) else {
+                return Sniff::NeedMore;
+            };
+            offset += 2 + user_len as usize;
+            let Some(&pass_len) = bytes.get(offset) else {
+                return Sniff::NeedMore;
+            };
+            offset += 1 + pass_len as usize;
+        }
+        Some(_) => {}
+    }
+    let Some(request) = bytes.get(offset..offset + 4) else {
+        return Sniff::NeedMore;
+    };
+    if request[0] != SOCKS_VERSION || request[1] != SOCKS_CMD_CONNECT {
+        return Sniff::Other;
+    }
+    let addr_len = match request[3] {
+        1 => 4,
+        4 => 16,
+        3 => match bytes.get(offset + 4) {
+            Some(&len) => 1 + len as usize,
+            None => return Sniff::NeedMore,
+        },
+        _ => return Sniff::Other,
+    };
+    let port_at = offset + 4 + addr_len;
+    match bytes.get(port_at..port_at + 2) {
+        Some(port) => Sniff::Connect(u16::from_be_bytes([port[0], port[1]])),
+        None => Sniff::NeedMore,
+    }
+}
+
+/// The traffic class of one stream, fed with its bytes as they pass.
+#[derive(Debug)]
+pub struct StreamClass {
+    prefix: Vec<u8>,
+    sniffing: bool,
+    base: u8,
+    bulk: bool,
+    priority: u8,
+    window_start_us: u64,
+    window_bytes: u64,
+}
+
+impl StreamClass {
+    pub fn new(now_us: u64) -> Self {
+        Self {
+            prefix: Vec::new(),
+            sniffing: true,
+            base: STREAM_PRIORITY_DEFAULT,
+            bulk: false,
+            priority: STREAM_PRIORITY_DEFAULT,
+            window_start_us: now_us,
+            window_bytes: 0,
+        }
+    }
+
+    pub fn priority(&self) -> u8 {
+        self.priority
+    }
+
+    /// Feeds bytes sent by the client end toward the target. Returns the new
+    /// priority when it changed.
+    pub fn observe_uplink(&mut self, data: &[u8], now_us: u64) -> Option<u8> {
+        if self.sniffing {
+            let sniff = if self.prefix.is_empty() {
+                sniff_connect(data)
+            } else {
+                let take = data.len().min(SNIFF_MAX_BYTES - self.prefix.len());
+                self.prefix.extend_from_slice(&data[..take]);
+                sniff_connect(&self.prefix)
+            };
+            match sniff {
+                Sniff::NeedMore => {
+                    if self.prefix.is_empty() {
+                        let take = data.len().min(SNIFF_MAX_BYTES);
+                        self.prefix.extend_from_slice(&data[..take]);
+                    }
+                    if self.prefix.len() >= SNIFF_MAX_BYTES {
+                        self.stop_sniffing();
+                    }
+                }
+                Sniff::Connect(port) => {
+                    self.stop_sniffing();
+                    if is_interactive_port(port) {
+                        self.base = STREAM_PRIORITY_INTERACTIVE;
+                    }
+                }
+                _ => self.stop_sniffing(),
+            }
+        }
+        self.observe_bytes(data.len(), now_us)
+    }
+
+    /// Feeds the length of data that went either way. Returns the new
+    /// priority when it changed.
+    pub fn observe_bytes(&mut self, len: usize, now_us: u64) -> Option<u8> {
+        self.window_bytes = self.window_bytes.saturating_add(len as u64);
+        let elapsed = now_us.saturating_sub(self.window_start_us);
+        if elapsed < RATE_WINDOW_US {
+            // Demoted as soon as the window carried more, not at its end.
+            if !self.bulk && self.window_bytes > BULK_RATE_BYTES_PER_SEC {
+                self.bulk = true;
+            }
+        } else {
+            let rate = self.window_bytes.saturating_mul(RATE_WINDOW_US) / elapsed;
+            self.bulk =
+                rate > BULK_RATE_BYTES_PER_SEC || (self.bulk && rate > BULK_RATE_BYTES_PER_SEC / 2);
+            self.window_start_us = now_us;
+            self.window_bytes = 0;
+        }
+        let priority = if self.bulk {
+            STREAM_PRIORITY_BULK
+        } else {
+            self.base
+        };
+        if priority == self.priority {
+            return None;
+        }
+        self.priority = priority;
+        Some(priority)
+    }
+
+    fn stop_sniffing(&mut self) {
+        self.sniffing = false;
+        self.prefix = Vec::new();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn connect(port: u16) -> Vec<u8> {
+        let mut bytes = vec![5, 2, 0, 2, 1, 4, b'u', b's', b'e', b'r', 4];
+        bytes.extend_from_slice(b"pass");
+        bytes.extend_from_slice(&[5, 1, 0, 3, 11]);
+        bytes.extend_from_slice(b"example.com");
+        bytes.extend_from_slice(&port.to_be_bytes());
+        bytes
+    }
+
+    #[test]
+    fn sniffs_the_port_of_a_connect() {
+        assert_eq!(sniff_connect(&connect(22)), Sniff::Connect(22));
+        assert_eq!(
+            sniff_connect(&[5, 1, 0, 5, 1, 0, 1, 1, 2, 3, 4, 0x01, 0xbb]),
+            Sniff::Connect(443)
+        );
+        let bytes = connect(22);
+        for len in 0..bytes.len() {
+            assert_eq!(sniff_connect(&bytes[..len]), Sniff::NeedMore, "{len}");
+        }
+        assert_eq!(sniff_connect(b"GET / HTTP/1.1"), Sniff::Other);
+        assert_eq!(sniff_connect(&[5, 1, 0, 5, 3, 0, 1]), Sniff::Other);
+    }
+
+    #[test]
+    fn interactive_ports_start_high_across_split_writes() {
+        let bytes = connect(22);
+        let mut class = StreamClass::new(0);
+        assert_eq!(class.observe_uplink(&bytes[..3], 0), None);
+        assert_eq!(
+            class.observe_uplink(&bytes[3..], 0),
+            Some(STREAM_PRIORITY_INTERACTIVE)
+        );
+
+        let mut class = StreamClass::new(0);
+        assert_eq!(class.observe_uplink(&connect(443), 0), None);
+        assert_eq!(class.priority(), STREAM_PRIORITY_DEFAULT);
+    }
+
+    #[test]
+    fn fast_streams_are_demoted_and_recover() {
+        let mut class = StreamClass::new(0);
+        class.observe_uplink(&connect(22), 0);
+        let chunk = BULK_RATE_BYTES_PER_SEC as usize / 4;
+        let mut now = 0;
+        let mut changes = Vec::new();
+        for _ in 0..5 {
+            now += 100_000;
+            changes.extend(class.observe_bytes(chunk, now));
+        }
+        assert_eq!(changes, vec![STREAM_PRIORITY_BULK]);
+
+        // A window at just above half the rate keeps it bulk.
+        now = 1_000_000;
+        class.observe_bytes(0, now);
+        now += RATE_WINDOW_US;
+        assert_eq!(
+            class.observe_bytes(BULK_RATE_BYTES_PER_SEC as usize / 2 + 1, now),
+            None
+        );
+        now += RATE_WINDOW_US;
+        assert_eq!(
+            class.observe_bytes(1024, now),
+            Some(STREAM_PRIORITY_INTERACTIVE)
+        );
+    }
+}
@@ -1,6 +1,13 @@
+use crate::dots::insert_dots;
 use std::fmt;
 
 const ENCODE_TABLE: &[u8; 32] = b"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+// Markers above the 5-bit values in the decode table.
+const DOT: u8 = 0x40;
+const PAD: u8 = 0x41;
+const INVALID: u8 = 0xff;
+// Letters decode in either case.
+const DECODE_TABLE: [u8; 256] = build_decode_table();
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum Base32Error {
@@ -22,143 +29,271 @@ impl fmt::Display for Base32Error {
 
 impl std::error::Error for Base32Error {}
 
-pub fn encode(input: &[u8]) -> String {
-    if input.is_empty() {
-        return String::new();
+const fn build_decode_table() -> [u8; 256] {
+    let mut table = [INVALID; 256];
+    table[b'.' as usize] = DOT;
+    table[b'=' as usize] = PAD;
+    let mut i = 0;
+    while i < ENCODE_TABLE.len() {
+        let c = ENCODE_TABLE[i];
+        table[c as usize] = i as u8;
+        table[c.to_ascii_lowercase() as usize] = i as u8;
+        i += 1;
     }
+    table
+}
 
-    let mut out = String::with_capacity((input.len() * 8).div_ceil(5));
-    let mut buffer: u32 = 0;
-    let mut bits: u8 = 0;
+/// Number of base32 characters for `input_len` bytes, without padding.
+pub(crate) fn encoded_len(input_len: usize) -> usize {
+    (input_len * 8).div_ceil(5)
+}
 
-    for &byte in input {
-        buffer = (buffer << 8) | byte as u32;
-        bits += 8;
+pub fn encode(input: &[u8]) -> String {
+    let mut out = Vec::with_capacity(encoded_len(input.len()));
+    encode_into(input, &mut out);
+    String::from_utf8(out).unwrap_or_default()
+}
 
-        while bits >= 5 {
-            let shift = bits - 5;
-            let index = ((buffer >> shift) & 0x1f) as usize;
-            out.push(ENCODE_TABLE[index] as char);
-            bits -= 5;
-        }
+/// Appends the unpadded base32 encoding of `input` to `out`.
+///
+/// Works on 5-byte blocks: each block is loaded into one word and split into
+/// eight table lookups, with no per-bit loop.
+pub fn encode_into(input: &[u8], out: &mut Vec<u8>) {
+    out.reserve(encoded_len(input.len()));
+    let mut blocks = input.chunks_exact(5);
+    for block in &mut blocks {
+        out.extend_from_slice(&encode_block(block));
     }
-
-    if bits > 0 {
-        let index = ((buffer << (5 - bits)) & 0x1f) as usize;
-        out.push(ENCODE_TABLE[index] as char);
+    let rest = blocks.remainder();
+    if !rest.is_empty() {
+        let mut block = [0u8; 5];
+        block[..rest.len()].copy_from_slice(rest);
+        out.extend_from_slice(&encode_block(&block)[..encoded_len(rest.len())]);
     }
+}
 
-    out
+/// Appends the base32 encoding of `input` to `out` with label dots placed
+/// exactly as `dotify` places them, which the C implementation and the test
+/// vectors share.
+pub(crate) fn encode_dotted_into(input: &[u8], out: &mut Vec<u8>) {
+    let start = out.len();
+    encode_into(input, out);
+    insert_dots(out, start);
 }
 
-pub fn decode(input: &str) -> Result<Vec<u8>, Base32Error> {
-    if input.is_empty() {
-        return Ok(Vec::new());
+fn encode_block(block: &[u8]) -> [u8; 8] {
+    let word = (u64::from(block[0]) << 32)
+        | (u64::from(block[1]) << 24)
+        | (u64::from(block[2]) << 16)
+        | (u64::from(block[3]) << 8)
+        | u64::from(block[4]);
+    let mut chars = [0u8; 8];
+    for (i, c) in chars.iter_mut().enumerate() {
+        *c = ENCODE_TABLE[((word >> (35 - 5 * i)) & 0x1f) as usize];
     }
+    chars
+}
 
-    let mut cleaned = Vec::with_capacity(input.len());
-    let mut saw_pad = false;
-    for b in input.bytes() {
-        if b == b'.' {
-            continue;
-        }
-        if b == b'=' {
-            saw_pad = true;
-            cleaned.push(b);
-            continue;
-        }
-        if saw_pad {
-            return Err(Base32Error::InvalidPadding);
-        }
-        cleaned.push(b);
-    }
+pub fn decode(input: &str) -> Result<Vec<u8>, Base32Error> {
+    let mut out = Vec::with_capacity(input.len() * 5 / 8 + 4);
+    decode_into(input.as_bytes(), &mut out)?;
+    Ok(out)
+}
 
-    if cleaned.is_empty() {
-        return Ok(Vec::new());
+/// Appends the decoding of `input` to `out`. Dots are skipped and trailing
+/// padding is accepted, as in `decode`. On error, `out` may hold part of the
+/// output.
+pub fn decode_into(input: &[u8], out: &mut Vec<u8>) -> Result<(), Base32Error> {
+    out.reserve(input.len() * 5 / 8);
+    let mut decoder = Decoder::default();
+    match decoder.feed(input, out).and_then(|()| decoder.finish(out)) {
+        // Decoding stops at the first bad character, but padding and length
+        // errors anywhere in the input take precedence.
+        Err(Base32Error::InvalidChar) => {
+            Err(padding_or_length_error(input).unwrap_or(Base32Error::InvalidChar))
+        }
+        result => result,
     }
+}
 
-    let mut len = cleaned.len();
+fn padding_or_length_error(input: &[u8]) -> Option<Base32Error> {
+    let mut chars = 0usize;
     let mut pad = 0usize;
-    while len > 0 && cleaned[len - 1] == b'=' {
-        pad += 1;
-        len -= 1;
+    for &b in input {
+        match b {
+            b'.' => {}
+            b'=' => pad += 1,
+            _ if pad > 0 => return Some(Base32Error::InvalidPadding),
+            _ => chars += 1,
+        }
     }
+    check_lengths(chars, pad).err()
+}
 
+fn check_lengths(chars: usize, pad: usize) -> Result<(), Base32Error> {
     if pad > 0 {
-        if cleaned[..len].contains(&b'=') {
-            return Err(Base32Error::InvalidPadding);
-        }
-        if cleaned.len() < 8 || cleaned.len() % 8 != 0 || pad > 6 {
+        let total = chars + pad;
+        if total < 8 || !total.is_multiple_of(8) || pad > 6 {
             return Err(Base32Error::InvalidPadding);
         }
     }
-
-    let data = &cleaned[..len];
-    let rem = data.len() % 8;
-    if rem != 0 && rem != 2 && rem != 4 && rem != 5 && rem != 7 {
+    if !matches!(chars % 8, 0 | 2 | 4 | 5 | 7) {
         return Err(Base32Error::InvalidLength);
     }
+    Ok(())
+}
 
-    let mut out = Vec::with_capacity(data.len() * 5 / 8 + 4);
-    let mut index = 0usize;
+/// Streaming base32 decoder, fed one run of characters at a time so that
+/// label-split input needs no joined copy. Dots and trailing padding are
+/// accepted anywhere `decode` accepts them.
+#[derive(Default)]
+pub(crate) struct Decoder {
+    word: u64,
+    count: usize,
+    chars: usize,
+    pad: usize,
+}
 
-    while index + 8 <= data.len() {
-        let v1 = decode_value(data[index])?;
-        let v2 = decode_value(data[index + 1])?;
-        let v3 = decode_value(data[index + 2])?;
-        let v4 = decode_value(data[index + 3])?;
-        let v5 = decode_value(data[index + 4])?;
-        let v6 = decode_value(data[index + 5])?;
-        let v7 = decode_value(data[index + 6])?;
-        let v8 = decode_value(data[index + 7])?;
+impl Decoder {
+    pub(crate) fn feed(&mut self, mut input: &[u8], out: &mut Vec<u8>) -> Result<(), Base32Error> {
+        while self.count != 0 && !input.is_empty() {
+            self.push(input[0], out)?;
+            input = &input[1..];
+        }
+        let mut blocks = input.chunks_exact(8);
+        for block in &mut blocks {
+            let mut word = 0u64;
+            let mut special = 0u8;
+            for &c in block {
+                let value = DECODE_TABLE[c as usize];
+                special |= value;
+                word = (word << 5) | u64::from(value & 0x1f);
+            }
+            if special & !0x1f == 0 && self.pad == 0 && self.count == 0 {
+                out.extend_from_slice(&word.to_be_bytes()[3..]);
+                self.chars += 8;
+            } else {
+                // Dots, padding or a bad character: take the block one by one.
+                for &c in block {
+                    self.push(c, out)?;
+                }
+            }
+        }
+        for &c in blocks.remainder() {
+            self.push(c, out)?;
+        }
+        Ok(())
+    }
 
-        out.push((v1 << 3) | (v2 >> 2));
-        out.push((v2 << 6) | (v3 << 1) | (v4 >> 4));
-        out.push((v4 << 4) | (v5 >> 1));
-        out.push((v5 << 7) | (v6 << 2) | (v7 >> 3));
-        out.push((v7 << 5) | v8);
+    fn push(&mut self, c: u8, out: &mut Vec<u8>) -> Result<(), Base32Error> {
+        match DECODE_TABLE[c as usize] {
+            DOT => {}
+            PAD => self.pad += 1,
+            INVALID => return Err(Base32Error::InvalidChar),
+            _ if self.pad > 0 => return Err(Base32Error::InvalidPadding),
+            value => {
+                self.word = (self.word << 5) | u64::from(value);
+                self.count += 1;
+                self.chars += 1;
+                if self.count == 8 {
+                    out.extend_from_slice(&self.word.to_be_bytes()[3..]);
+                    self.word = 0;
+                    self.count = 0;
+                }
+            }
+        }
+        Ok(())
+    }
 
-        index += 8;
+    /// Checks the padding and length, then writes the bytes of a final
+    /// partial block; bits past the last whole byte are dropped.
+    pub(crate) fn finish(self, out: &mut Vec<u8>) -> Result<(), Base32Error> {
+        check_lengths(self.chars, self.pad)?;
+        let bytes = match self.count {
+            0 => return Ok(()),
+            2 => 1,
+            4 => 2,
+            5 => 3,
+            _ => 4,
+        };
+        let word = self.word >> (5 * self.count - 8 * bytes);
+        out.extend_from_slice(&word.to_be_bytes()[8 - bytes..]);
+        Ok(())
     }
+}
 
-    let remaining = data.len() - index;
-    if remaining > 0 {
-        let v1 = decode_value(data[index])?;
-        let v2 = decode_value(data[index + 1])?;
-        out.push((v1 << 3) | (v2 >> 2));
+#[cfg(test)]
+mod tests {
+    use super::{decode, decode_into, encode, encode_dotted_into, Base32Error, Decoder};
+    use crate::dots::dotify;
 
-        if remaining == 2 {
-            return Ok(out);
+    #[test]
+    fn round_trips_every_tail_length() {
+        let input: Vec<u8> = (0u8..=255).collect();
+        for len in 0..=40 {
+            let encoded = encode(&input[..len]);
+            assert_eq!(encoded.len(), (len * 8).div_ceil(5));
+            assert_eq!(decode(&encoded).expect("decode"), &input[..len]);
+            assert_eq!(
+                decode(&encoded.to_ascii_lowercase()).expect("decode lower"),
+                &input[..len]
+            );
         }
+        assert_eq!(encode(b"foobar"), "MZXW6YTBOI");
+    }
 
-        let v3 = decode_value(data[index + 2])?;
-        let v4 = decode_value(data[index + 3])?;
-        out.push((v2 << 6) | (v3 << 1) | (v4 >> 4));
-
-        if remaining == 4 {
-            return Ok(out);
-        }
+    #[test]
+    fn decode_skips_dots_inside_blocks() {
+        let input: Vec<u8> = (1u8..=30).collect();
+        let encoded = encode(&input);
+        let dotted = format!("{}.{}.{}", &encoded[..3], &encoded[3..20], &encoded[20..]);
+        assert_eq!(decode(&dotted).expect("decode"), input);
+    }
 
-        let v5 = decode_value(data[index + 4])?;
-        out.push((v4 << 4) | (v5 >> 1));
+    #[test]
+    fn decode_checks_padding_before_length_and_chars() {
+        assert_eq!(decode("MZXW6YQ="), Ok(b"fooba"[..4].to_vec()));
+        assert_eq!(decode("MZ======"), Ok(b"f".to_vec()));
+        assert_eq!(decode("MZ=A"), Err(Base32Error::InvalidPadding));
+        assert_eq!(decode("M!======"), Err(Base32Error::InvalidChar));
+        assert_eq!(decode("M======="), Err(Base32Error::InvalidPadding));
+        assert_eq!(decode("MZX"), Err(Base32Error::InvalidLength));
+        assert_eq!(decode("MZXW6Y!B"), Err(Base32Error::InvalidChar));
+    }
 
-        if remaining == 5 {
-            return Ok(out);
+    #[test]
+    fn decoder_joins_labels_split_inside_blocks() {
+        let input: Vec<u8> = (7u8..=60).collect();
+        let encoded = encode(&input);
+        let mut out = Vec::new();
+        let mut decoder = Decoder::default();
+        for label in [
+            &encoded[..3],
+            &encoded[3..19],
+            &encoded[19..20],
+            &encoded[20..],
+        ] {
+            decoder.feed(label.as_bytes(), &mut out).expect("feed");
         }
-
-        let v6 = decode_value(data[index + 5])?;
-        let v7 = decode_value(data[index + 6])?;
-        out.push((v5 << 7) | (v6 << 2) | (v7 >> 3));
+        decoder.finish(&mut out).expect("finish");
+        assert_eq!(out, input);
     }
 
-    Ok(out)
-}
+    #[test]
+    fn decode_into_appends() {
+        let mut out = vec![0xaa];
+        decode_into(b"MZXW6", &mut out).expect("decode");
+        assert_eq!(out, [0xaa, b'f', b'o', b'o']);
+    }
 
-fn decode_value(b: u8) -> Result<u8, Base32Error> {
-    match b {
-        b'A'..=b'Z' => Ok(b - b'A'),
-        b'a'..=b'z' => Ok(b - b'a'),
-        b'2'..=b'7' => Ok(b - b'2' + 26),
-        _ => Err(Base32Error::InvalidChar),
+    #[test]
+    fn encode_dotted_matches_dotify() {
+        let input: Vec<u8> = (0u8..=255).cycle().take(200).collect();
+        for len in [0, 1, 35, 36, 71, 72, 107, 108, 150, 200] {
+            let mut out = b"x".to_vec();
+            encode_dotted_into(&input[..len], &mut out);
+            let expected = format!("x{}", dotify(&encode(&input[..len])));
+            assert_eq!(String::from_utf8(out).unwrap(), expected, "len {}", len);
+        }
     }
 }
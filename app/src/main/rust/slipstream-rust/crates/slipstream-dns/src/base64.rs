@@ -0,0 +1,220 @@
+//! Case-preserving query names: base64url payloads for resolvers that keep
+//! letter case, four characters for every three bytes where base32 needs 4.8.
+//!
+//! The payload starts with `NAME_MARKER`, which base32 never produces, and a
+//! check digit: the number of upper-case letters after it, modulo 10. A
+//! resolver that folds case or randomizes it (0x20 encoding) changes the count
+//! in nine names out of ten, and the server refuses those instead of handing
+//! QUIC a corrupted packet.
+
+use crate::dots::insert_dots;
+
+const ENCODE_TABLE: &[u8; 64] = b"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+const INVALID: u8 = 0xff;
+const DECODE_TABLE: [u8; 256] = build_decode_table();
+
+pub(crate) const NAME_MARKER: u8 = b'0';
+/// Characters the marker and the check digit take.
+pub(crate) const NAME_HEADER_LEN: usize = 2;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum NameError {
+    InvalidChar,
+    InvalidLength,
+    /// The check digit does not match: a resolver changed letter case.
+    CaseChanged,
+}
+
+const fn build_decode_table() -> [u8; 256] {
+    let mut table = [INVALID; 256];
+    let mut i = 0;
+    while i < ENCODE_TABLE.len() {
+        table[ENCODE_TABLE[i] as usize] = i as u8;
+        i += 1;
+    }
+    table
+}
+
+/// Number of base64url characters for `input_len` bytes, without padding.
+pub(crate) fn encoded_len(input_len: usize) -> usize {
+    (input_len * 4).div_ceil(3)
+}
+
+/// The largest payload whose marked encoding fits in `chars` characters.
+pub(crate) fn max_payload_len(chars: usize) -> usize {
+    chars.saturating_sub(NAME_HEADER_LEN) * 3 / 4
+}
+
+pub(crate) fn is_marked(label: &[u8]) -> bool {
+    label.first() == Some(&NAME_MARKER)
+}
+
+/// Appends the unpadded base64url encoding of `input` to `out`.
+pub(crate) fn encode_into(input: &[u8], out: &mut Vec<u8>) {
+    out.reserve(encoded_len(input.len()));
+    let mut blocks = input.chunks_exact(3);
+    for block in &mut blocks {
+        out.extend_from_slice(&encode_block(block));
+    }
+    let rest = blocks.remainder();
+    if !rest.is_empty() {
+        let mut block = [0u8; 3];
+        block[..rest.len()].copy_from_slice(rest);
+        out.extend_from_slice(&encode_block(&block)[..encoded_len(rest.len())]);
+    }
+}
+
+fn encode_block(block: &[u8]) -> [u8; 4] {
+    let word = (u32::from(block[0]) << 16) | (u32::from(block[1]) << 8) | u32::from(block[2]);
+    let mut chars = [0u8; 4];
+    for (i, c) in chars.iter_mut().enumerate() {
+        *c = ENCODE_TABLE[((word >> (18 - 6 * i)) & 0x3f) as usize];
+    }
+    chars
+}
+
+/// Appends the marked encoding of `input` to `out`, with label dots placed as
+/// base32 names place them.
+pub(crate) fn encode_name_into(input: &[u8], out: &mut Vec<u8>) {
+    let start = out.len();
+    out.extend_from_slice(&[NAME_MARKER, b'0']);
+    encode_into(input, out);
+    let upper = out[start + NAME_HEADER_LEN..]
+        .iter()
+        .filter(|c| c.is_ascii_uppercase())
+        .count();
+    out[start + 1] = b'0' + (upper % 10) as u8;
+    insert_dots(out, start);
+}
+
+/// Streaming decoder for a marked name, fed one label at a time.
+#[derive(Default)]
+pub(crate) struct NameDecoder {
+    word: u32,
+    count: usize,
+    header: usize,
+    check: usize,
+    upper: usize,
+}
+
+impl NameDecoder {
+    pub(crate) fn feed(&mut self, label: &[u8], out: &mut Vec<u8>) -> Result<(), NameError> {
+        for &c in label {
+            if self.header < NAME_HEADER_LEN {
+                match (self.header, c) {
+                    (0, NAME_MARKER) => {}
+                    (1, b'0'..=b'9') => self.check = usize::from(c - b'0'),
+                    _ => return Err(NameError::InvalidChar),
+                }
+                self.header += 1;
+                continue;
+            }
+            let value = DECODE_TABLE[c as usize];
+            if value == INVALID {
+                return Err(NameError::InvalidChar);
+            }
+            self.upper += usize::from(c.is_ascii_uppercase());
+            self.word = (self.word << 6) | u32::from(value);
+            self.count += 1;
+            if self.count == 4 {
+                out.extend_from_slice(&self.word.to_be_bytes()[1..]);
+                self.word = 0;
+                self.count = 0;
+            }
+        }
+        Ok(())
+    }
+
+    /// Checks the case and length, then writes the bytes of a final partial
+    /// block; bits past the last whole byte are dropped.
+    pub(crate) fn finish(self, out: &mut Vec<u8>) -> Result<(), NameError> {
+        if self.header < NAME_HEADER_LEN {
+            return Err(NameError::InvalidLength);
+        }
+        if self.upper % 10 != self.check {
+            return Err(NameError::CaseChanged);
+        }
+        match self.count {
+            0 => {}
+            2 => out.push((self.word >> 4) as u8),
+            3 => out.extend_from_slice(&((self.word >> 2) as u16).to_be_bytes()),
+            _ => return Err(NameError::InvalidLength),
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{encode_into, encode_name_into, encoded_len, NameDecoder, NameError};
+    use crate::dots::dotify;
+
+    fn decode_name(name: &str) -> Result<Vec<u8>, NameError> {
+        let mut out = Vec::new();
+        let mut decoder = NameDecoder::default();
+        for label in name.split('.') {
+            decoder.feed(label.as_bytes(), &mut out)?;
+        }
+        decoder.finish(&mut out)?;
+        Ok(out)
+    }
+
+    #[test]
+    fn names_round_trip_every_tail_length() {
+        let input: Vec<u8> = (0u8..=255).rev().collect();
+        for len in 0..=200 {
+            let mut name = Vec::new();
+            encode_name_into(&input[..len], &mut name);
+            let name = String::from_utf8(name).unwrap();
+            let mut plain = Vec::new();
+            encode_into(&input[..len], &mut plain);
+            assert_eq!(plain.len(), encoded_len(len));
+            let expected = dotify(&format!(
+                "0{}{}",
+                &name[1..2],
+                String::from_utf8(plain).unwrap()
+            ));
+            assert_eq!(name, expected, "len {}", len);
+            assert_eq!(decode_name(&name).expect("decode"), &input[..len]);
+        }
+        let mut plain = Vec::new();
+        encode_into(b"\xfb\xff\xbf", &mut plain);
+        assert_eq!(plain, b"-_-_");
+    }
+
+    #[test]
+    fn case_changes_are_caught() {
+        let input: Vec<u8> = (1u8..=90).collect();
+        let mut name = Vec::new();
+        encode_name_into(&input, &mut name);
+        let name = String::from_utf8(name).unwrap();
+        assert!(name.bytes().any(|c| c.is_ascii_uppercase()));
+        // Folding every letter changes the count unless it was a multiple of
+        // ten, which this input avoids.
+        assert_ne!(
+            name[2..].bytes().filter(u8::is_ascii_uppercase).count() % 10,
+            0
+        );
+        assert_eq!(
+            decode_name(&name.to_ascii_lowercase()),
+            Err(NameError::CaseChanged)
+        );
+
+        // Swapping the case of a single letter always shows.
+        let at = name.find(|c: char| c.is_ascii_lowercase()).unwrap();
+        let mut flipped = name.into_bytes();
+        flipped[at] = flipped[at].to_ascii_uppercase();
+        let flipped = String::from_utf8(flipped).unwrap();
+        assert_eq!(decode_name(&flipped), Err(NameError::CaseChanged));
+    }
+
+    #[test]
+    fn malformed_names_are_rejected() {
+        assert_eq!(decode_name("0"), Err(NameError::InvalidLength));
+        assert_eq!(decode_name("1"), Err(NameError::InvalidChar));
+        assert_eq!(decode_name("0x"), Err(NameError::InvalidChar));
+        assert_eq!(decode_name("00ab+c"), Err(NameError::InvalidChar));
+        assert_eq!(decode_name("00abcde"), Err(NameError::InvalidLength));
+        assert_eq!(decode_name("00"), Ok(Vec::new()));
+    }
+}
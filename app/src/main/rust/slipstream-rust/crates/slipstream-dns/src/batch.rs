@@ -0,0 +1,104 @@
+//! Uplink batches: several QUIC packets carried in one query payload.
+//!
+//! A batch starts with `BATCH_MARKER` and holds each packet behind a one-byte
+//! length, in send order. The marker has the QUIC fixed bit clear, and
+//! slipstream clients never negotiate greasing that bit, so no plain packet
+//! payload starts with it. A query payload never exceeds 255 bytes.
+
+pub const BATCH_MARKER: u8 = 0x00;
+/// Bytes a packet costs in a batch on top of its own length.
+pub const BATCH_PACKET_OVERHEAD: usize = 1;
+
+pub fn is_batch(payload: &[u8]) -> bool {
+    payload.first() == Some(&BATCH_MARKER)
+}
+
+/// Appends `packet` to the batch in `out`, starting the batch if `out` is
+/// empty. Returns false, leaving `out` unchanged, if the packet is empty or
+/// too long for its length byte.
+pub fn batch_push(out: &mut Vec<u8>, packet: &[u8]) -> bool {
+    if packet.is_empty() || packet.len() > usize::from(u8::MAX) {
+        return false;
+    }
+    if out.is_empty() {
+        out.push(BATCH_MARKER);
+    }
+    out.push(packet.len() as u8);
+    out.extend_from_slice(packet);
+    true
+}
+
+/// Returns the packets of a batch payload, or `None` if `payload` is not a
+/// well-formed batch of at least one packet.
+pub fn split_batch(payload: &[u8]) -> Option<BatchPackets<'_>> {
+    if !is_batch(payload) {
+        return None;
+    }
+    let packets = BatchPackets {
+        rest: &payload[1..],
+    };
+    let mut count = 0usize;
+    let mut rest = packets.rest;
+    while let Some((&len, tail)) = rest.split_first() {
+        let len = usize::from(len);
+        if len == 0 || len > tail.len() {
+            return None;
+        }
+        rest = &tail[len..];
+        count += 1;
+    }
+    (count > 0).then_some(packets)
+}
+
+#[derive(Clone)]
+pub struct BatchPackets<'a> {
+    rest: &'a [u8],
+}
+
+impl<'a> Iterator for BatchPackets<'a> {
+    type Item = &'a [u8];
+
+    fn next(&mut self) -> Option<&'a [u8]> {
+        let (&len, tail) = self.rest.split_first()?;
+        let (packet, rest) = tail.split_at(usize::from(len));
+        self.rest = rest;
+        Some(packet)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{batch_push, is_batch, split_batch, BATCH_MARKER};
+
+    #[test]
+    fn batch_round_trips_packets_in_order() {
+        let packets: [&[u8]; 3] = [&[0x41, 1, 2], &[0x5f; 40], &[0x40]];
+        let mut batch = Vec::new();
+        for packet in packets {
+            assert!(batch_push(&mut batch, packet));
+        }
+        assert_eq!(batch.len(), 1 + 3 + 3 + 40 + 1);
+        assert!(is_batch(&batch));
+        let split: Vec<&[u8]> = split_batch(&batch).expect("batch").collect();
+        assert_eq!(split, packets);
+    }
+
+    #[test]
+    fn batch_push_rejects_empty_and_oversized_packets() {
+        let mut batch = Vec::new();
+        assert!(!batch_push(&mut batch, &[]));
+        assert!(!batch_push(&mut batch, &[0x40; 256]));
+        assert!(batch.is_empty());
+        assert!(batch_push(&mut batch, &[0x40; 255]));
+    }
+
+    #[test]
+    fn split_batch_rejects_plain_and_malformed_payloads() {
+        assert!(split_batch(&[0x40, 0, 0]).is_none());
+        assert!(split_batch(&[0xc0, 0, 0]).is_none());
+        assert!(split_batch(&[]).is_none());
+        assert!(split_batch(&[BATCH_MARKER]).is_none());
+        assert!(split_batch(&[BATCH_MARKER, 3, 0x40, 0x40]).is_none());
+        assert!(split_batch(&[BATCH_MARKER, 1, 0x40, 0]).is_none());
+    }
+}
@@ -0,0 +1,166 @@
+//! DNS codec microbenchmark; see docs/profiling.md.
+
+use slipstream_dns::{
+    base32_decode_into, base32_encode_into, build_qname, build_qname_into, build_qname_into_with,
+    decode_query, decode_response, encode_query, encode_response, encode_response_into,
+    max_payload_len_for_domain, QnameEncoding, QueryParams, Question, ResponseParams, CLASS_IN,
+    RR_TXT,
+};
+use std::hint::black_box;
+use std::time::Instant;
+
+const DOMAIN: &str = "test.com";
+
+struct Options {
+    iterations: u32,
+    payload_len: usize,
+}
+
+fn parse_options() -> Result<Options, String> {
+    let mut options = Options {
+        iterations: 20_000,
+        payload_len: 256,
+    };
+    for arg in std::env::args().skip(1) {
+        let (key, value) = arg
+            .split_once('=')
+            .ok_or_else(|| format!("expected --name=value, got {}", arg))?;
+        match key {
+            "--iterations" => {
+                options.iterations = value
+                    .parse()
+                    .map_err(|_| format!("invalid iterations: {}", value))?
+            }
+            "--payload-len" => {
+                options.payload_len = value
+                    .parse()
+                    .map_err(|_| format!("invalid payload-len: {}", value))?
+            }
+            _ => return Err(format!("unknown option {}", key)),
+        }
+    }
+    Ok(options)
+}
+
+fn run(name: &str, iterations: u32, bytes: usize, mut f: impl FnMut()) {
+    for _ in 0..iterations.min(1000) {
+        f();
+    }
+    let start = Instant::now();
+    for _ in 0..iterations {
+        f();
+    }
+    let elapsed = start.elapsed().as_secs_f64();
+    let per_iter_us = elapsed * 1e6 / f64::from(iterations);
+    let mib_per_s = (bytes as f64 * f64::from(iterations)) / elapsed / (1024.0 * 1024.0);
+    println!(
+        "{}: {:.3}us/iter, {:.0} MiB/s",
+        name, per_iter_us, mib_per_s
+    );
+}
+
+fn query_params(qname: &str) -> QueryParams<'_> {
+    QueryParams {
+        id: 0x1234,
+        qname,
+        qtype: RR_TXT,
+        qclass: CLASS_IN,
+        rd: true,
+        cd: false,
+        qdcount: 1,
+        is_query: true,
+    }
+}
+
+fn main() {
+    let options = parse_options().unwrap_or_else(|err| {
+        eprintln!("bench_dns: {}", err);
+        std::process::exit(2);
+    });
+    let iterations = options.iterations.max(1);
+    let max_payload = max_payload_len_for_domain(DOMAIN).expect("max payload");
+    let query_len = options.payload_len.min(max_payload);
+    if query_len < options.payload_len {
+        println!(
+            "Payload clamped to {} for {} (base32 + dots + suffix).",
+            query_len, DOMAIN
+        );
+    }
+    let payload: Vec<u8> = (0..options.payload_len)
+        .map(|i| (i * 31 + 7) as u8)
+        .collect();
+    let query_payload = &payload[..query_len];
+
+    let mut encoded = Vec::with_capacity(512);
+    run("base32_encode_into", iterations, query_len, || {
+        encoded.clear();
+        base32_encode_into(black_box(query_payload), &mut encoded);
+    });
+    let mut decoded = Vec::with_capacity(512);
+    run("base32_decode_into", iterations, encoded.len(), || {
+        decoded.clear();
+        base32_decode_into(black_box(&encoded), &mut decoded).expect("decode");
+    });
+
+    run("build_qname", iterations, query_len, || {
+        black_box(build_qname(black_box(query_payload), DOMAIN).expect("qname"));
+    });
+    let mut qname = String::with_capacity(256);
+    run("build_qname_into", iterations, query_len, || {
+        build_qname_into(black_box(query_payload), DOMAIN, &mut qname).expect("qname");
+    });
+
+    let mut base64_qname = String::with_capacity(256);
+    run("build_qname_into_base64", iterations, query_len, || {
+        build_qname_into_with(
+            black_box(query_payload),
+            DOMAIN,
+            QnameEncoding::Base64,
+            &mut base64_qname,
+        )
+        .expect("qname");
+    });
+    let base64_query = encode_query(&query_params(&base64_qname)).expect("query");
+    run(
+        "decode_query_base64",
+        iterations,
+        base64_query.len(),
+        || {
+            black_box(decode_query(black_box(&base64_query), DOMAIN).expect("decode query"));
+        },
+    );
+
+    let params = query_params(&qname);
+    run("encode_query", iterations, qname.len(), || {
+        black_box(encode_query(black_box(&params)).expect("query"));
+    });
+    let query = encode_query(&params).expect("query");
+    run("decode_query", iterations, query.len(), || {
+        black_box(decode_query(black_box(&query), DOMAIN).expect("decode query"));
+    });
+
+    let question = Question {
+        name: qname.clone(),
+        qtype: RR_TXT,
+        qclass: CLASS_IN,
+    };
+    let response_params = ResponseParams {
+        id: 0x1234,
+        rd: true,
+        cd: false,
+        question: &question,
+        payload: Some(&payload),
+        rcode: None,
+    };
+    run("encode_response", iterations, payload.len(), || {
+        black_box(encode_response(black_box(&response_params)).expect("response"));
+    });
+    let mut response_buf = Vec::with_capacity(1500);
+    run("encode_response_into", iterations, payload.len(), || {
+        encode_response_into(black_box(&response_params), &mut response_buf).expect("response");
+    });
+    let response = encode_response(&response_params).expect("response");
+    run("decode_response", iterations, response.len(), || {
+        black_box(decode_response(black_box(&response)).expect("decode response"));
+    });
+}
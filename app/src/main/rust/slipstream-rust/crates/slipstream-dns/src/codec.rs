@@ -1,15 +1,31 @@
-use crate::base32;
-use crate::dots;
+use crate::{base32, base64};
 
-use crate::name::{encode_name, extract_subdomain_multi, parse_name};
+use crate::domains::DomainSet;
+use crate::name::{encode_name, match_subdomain, read_name_labels, skip_name, NameLabels};
 use crate::types::{
-    DecodeQueryError, DecodedQuery, DnsError, QueryParams, Rcode, ResponseParams, EDNS_UDP_PAYLOAD,
-    RR_OPT, RR_TXT,
-};
-use crate::wire::{
-    parse_header, parse_question, parse_question_for_reply, read_u16, read_u32, write_u16,
-    write_u32,
+    DecodeQueryError, DecodedQuery, DnsError, QueryParams, Question, Rcode, ResponseParams,
+    EDNS_UDP_PAYLOAD, RR_NULL, RR_OPT, RR_TXT,
 };
+use crate::wire::{parse_header, parse_question_for_reply, read_u16, read_u32, write_u16};
+
+const HEADER_LEN: usize = 12;
+const OPT_RECORD_LEN: usize = 11;
+// Compressed name pointer, type, class, TTL and RDLENGTH.
+const ANSWER_OVERHEAD: usize = 12;
+// Root name, type, UDP payload size, extended RCODE and flags, RDLENGTH.
+const OPT_RECORD: [u8; OPT_RECORD_LEN] = [
+    0,
+    (RR_OPT >> 8) as u8,
+    RR_OPT as u8,
+    (EDNS_UDP_PAYLOAD >> 8) as u8,
+    EDNS_UDP_PAYLOAD as u8,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+];
 
 pub fn decode_query(packet: &[u8], domain: &str) -> Result<DecodedQuery, DecodeQueryError> {
     decode_query_with_domains(packet, &[domain])
@@ -19,6 +35,25 @@ pub fn decode_query_with_domains(
     packet: &[u8],
     domains: &[&str],
 ) -> Result<DecodedQuery, DecodeQueryError> {
+    decode_query_matching(packet, |labels| match_subdomain(packet, labels, domains))
+}
+
+/// Decodes a query for any of the domains in `domains`, matching the name
+/// against all of them in one pass.
+pub fn decode_query_with_domain_set(
+    packet: &[u8],
+    domains: &DomainSet,
+) -> Result<DecodedQuery, DecodeQueryError> {
+    decode_query_matching(packet, |labels| domains.match_labels(packet, labels))
+}
+
+fn decode_query_matching<F>(
+    packet: &[u8],
+    match_domain: F,
+) -> Result<DecodedQuery, DecodeQueryError>
+where
+    F: FnOnce(&NameLabels) -> Result<usize, Rcode>,
+{
     let header = match parse_header(packet) {
         Some(header) => header,
         None => return Err(DecodeQueryError::Drop),
@@ -49,12 +84,15 @@ pub fn decode_query_with_domains(
         });
     }
 
-    let question = match parse_question(packet, header.offset) {
-        Ok((question, _)) => question,
+    // Labels are matched and decoded where they sit in the packet; the only
+    // copies are the question name for the reply and the payload itself.
+    let mut labels = NameLabels::new();
+    let question = match read_question(packet, header.offset, &mut labels) {
+        Ok(question) => question,
         Err(_) => return Err(DecodeQueryError::Drop),
     };
 
-    if question.qtype != RR_TXT {
+    if question.qtype != RR_TXT && question.qtype != RR_NULL {
         return Err(DecodeQueryError::Reply {
             id: header.id,
             rd,
@@ -64,8 +102,8 @@ pub fn decode_query_with_domains(
         });
     }
 
-    let subdomain_raw = match extract_subdomain_multi(&question.name, domains) {
-        Ok(subdomain_raw) => subdomain_raw,
+    let payload_labels = match match_domain(&labels) {
+        Ok(payload_labels) => payload_labels,
         Err(rcode) => {
             return Err(DecodeQueryError::Reply {
                 id: header.id,
@@ -77,30 +115,35 @@ pub fn decode_query_with_domains(
         }
     };
 
-    let undotted = dots::undotify(&subdomain_raw);
-    if undotted.is_empty() {
+    let mut payload = Vec::with_capacity(question.name.len() * 3 / 4);
+    let decoded = if base64::is_marked(labels.label(packet, 0)) {
+        let mut decoder = base64::NameDecoder::default();
+        (0..payload_labels)
+            .try_for_each(|index| decoder.feed(labels.label(packet, index), &mut payload))
+            .and_then(|()| decoder.finish(&mut payload))
+            .map_err(|err| match err {
+                // Refused rather than failed, so the client stops using
+                // case-preserving names through this resolver.
+                base64::NameError::CaseChanged => Rcode::Refused,
+                _ => Rcode::ServerFailure,
+            })
+    } else {
+        let mut decoder = base32::Decoder::default();
+        (0..payload_labels)
+            .try_for_each(|index| decoder.feed(labels.label(packet, index), &mut payload))
+            .and_then(|()| decoder.finish(&mut payload))
+            .map_err(|_| Rcode::ServerFailure)
+    };
+    if let Err(rcode) = decoded {
         return Err(DecodeQueryError::Reply {
             id: header.id,
             rd,
             cd,
             question: Some(question),
-            rcode: Rcode::NameError,
+            rcode,
         });
     }
 
-    let payload = match base32::decode(&undotted) {
-        Ok(payload) => payload,
-        Err(_) => {
-            return Err(DecodeQueryError::Reply {
-                id: header.id,
-                rd,
-                cd,
-                question: Some(question),
-                rcode: Rcode::ServerFailure,
-            })
-        }
-    };
-
     Ok(DecodedQuery {
         id: header.id,
         rd,
@@ -110,6 +153,21 @@ pub fn decode_query_with_domains(
     })
 }
 
+fn read_question(
+    packet: &[u8],
+    offset: usize,
+    labels: &mut NameLabels,
+) -> Result<Question, DnsError> {
+    let offset = read_name_labels(packet, offset, labels)?;
+    let qtype = read_u16(packet, offset).ok_or_else(|| DnsError::new("truncated qtype"))?;
+    let qclass = read_u16(packet, offset + 2).ok_or_else(|| DnsError::new("truncated qclass"))?;
+    Ok(Question {
+        name: labels.to_name(packet)?,
+        qtype,
+        qclass,
+    })
+}
+
 pub fn encode_query(params: &QueryParams<'_>) -> Result<Vec<u8>, DnsError> {
     let mut out = Vec::with_capacity(256);
     let mut flags = 0u16;
@@ -136,28 +194,103 @@ pub fn encode_query(params: &QueryParams<'_>) -> Result<Vec<u8>, DnsError> {
         write_u16(&mut out, params.qclass);
     }
 
-    encode_opt_record(&mut out)?;
+    encode_opt_record(&mut out);
 
     Ok(out)
 }
 
 pub fn encode_response(params: &ResponseParams<'_>) -> Result<Vec<u8>, DnsError> {
-    let payload_len = params.payload.map(|payload| payload.len()).unwrap_or(0);
+    let mut out = Vec::new();
+    encode_response_into(params, &mut out)?;
+    Ok(out)
+}
+
+/// Like `encode_response`, but writes into `out`, replacing its contents, so
+/// that a reused buffer costs no allocation. On error `out` is unspecified.
+pub fn encode_response_into(
+    params: &ResponseParams<'_>,
+    out: &mut Vec<u8>,
+) -> Result<(), DnsError> {
+    let payload = params.payload.filter(|payload| !payload.is_empty());
+    encode_response_answers(params, payload.as_slice(), out)
+}
+
+/// Encodes a response that carries one answer per packet, in order, in place
+/// of `params.payload`. Only clients that decode with
+/// `decode_response_packets` read past the first answer.
+pub fn encode_response_packets(
+    params: &ResponseParams<'_>,
+    packets: &[&[u8]],
+) -> Result<Vec<u8>, DnsError> {
+    let mut out = Vec::new();
+    encode_response_packets_into(params, packets, &mut out)?;
+    Ok(out)
+}
+
+/// `encode_response_packets` into a reused buffer, as `encode_response_into`.
+pub fn encode_response_packets_into(
+    params: &ResponseParams<'_>,
+    packets: &[&[u8]],
+    out: &mut Vec<u8>,
+) -> Result<(), DnsError> {
+    if packets.iter().any(|packet| packet.is_empty()) {
+        return Err(DnsError::new("empty packet"));
+    }
+    encode_response_answers(params, packets, out)
+}
 
-    let mut rcode = params.rcode.unwrap_or(if payload_len > 0 {
+/// Wire size of a TXT answer carrying `payload_len` bytes.
+pub fn txt_answer_len(payload_len: usize) -> usize {
+    ANSWER_OVERHEAD + payload_len + payload_len.div_ceil(255)
+}
+
+/// Wire size of an answer of type `qtype` carrying `payload_len` bytes. NULL
+/// answers hold the payload as is; any other type is answered with TXT.
+pub fn answer_len(qtype: u16, payload_len: usize) -> usize {
+    if qtype == RR_NULL {
+        ANSWER_OVERHEAD + payload_len
+    } else {
+        txt_answer_len(payload_len)
+    }
+}
+
+/// Largest payload whose answer of type `qtype` fits in `room` bytes.
+pub fn answer_payload_max(qtype: u16, room: usize) -> usize {
+    let rdata_len = room.saturating_sub(ANSWER_OVERHEAD);
+    if qtype == RR_NULL {
+        rdata_len
+    } else {
+        // One length byte in front of every 255 bytes.
+        rdata_len - rdata_len.div_ceil(256)
+    }
+}
+
+/// Wire size of a response to `question` before any answers.
+pub fn response_base_len(question: &Question) -> usize {
+    let name = question.name.trim_end_matches('.');
+    let name_len = if name.is_empty() { 1 } else { name.len() + 2 };
+    HEADER_LEN + name_len + 4 + OPT_RECORD_LEN
+}
+
+fn encode_response_answers(
+    params: &ResponseParams<'_>,
+    answers: &[&[u8]],
+    out: &mut Vec<u8>,
+) -> Result<(), DnsError> {
+    let mut rcode = params.rcode.unwrap_or(if !answers.is_empty() {
         Rcode::Ok
     } else {
         Rcode::NameError
     });
 
     let mut ancount = 0u16;
-    if payload_len > 0 && rcode == Rcode::Ok {
-        ancount = 1;
+    if !answers.is_empty() && rcode == Rcode::Ok {
+        ancount = u16::try_from(answers.len()).map_err(|_| DnsError::new("too many answers"))?;
     } else if params.rcode.is_some() {
         rcode = params.rcode.unwrap_or(Rcode::Ok);
     }
+    let answers = if ancount > 0 { answers } else { &[] };
 
-    let mut out = Vec::with_capacity(256);
     let mut flags = 0x8000 | 0x0400;
     if params.rd {
         flags |= 0x0100;
@@ -167,47 +300,79 @@ pub fn encode_response(params: &ResponseParams<'_>) -> Result<Vec<u8>, DnsError>
     }
     flags |= rcode.to_u8() as u16;
 
-    write_u16(&mut out, params.id);
-    write_u16(&mut out, flags);
-    write_u16(&mut out, 1);
-    write_u16(&mut out, ancount);
-    write_u16(&mut out, 0);
-    write_u16(&mut out, 1);
-
-    encode_name(&params.question.name, &mut out)?;
-    write_u16(&mut out, params.question.qtype);
-    write_u16(&mut out, params.question.qclass);
-
-    if ancount == 1 {
-        out.extend_from_slice(&[0xC0, 0x0C]);
-        write_u16(&mut out, params.question.qtype);
-        write_u16(&mut out, params.question.qclass);
-        write_u32(&mut out, 60);
-        let chunk_count = payload_len.div_ceil(255);
-        let rdata_len = payload_len + chunk_count;
-        if rdata_len > u16::MAX as usize {
-            return Err(DnsError::new("payload too long"));
-        }
-        write_u16(&mut out, rdata_len as u16);
-        if let Some(payload) = params.payload {
-            let mut remaining = payload_len;
-            let mut cursor = 0;
-            while remaining > 0 {
-                let chunk_len = remaining.min(255);
-                out.push(chunk_len as u8);
-                out.extend_from_slice(&payload[cursor..cursor + chunk_len]);
-                cursor += chunk_len;
-                remaining -= chunk_len;
-            }
+    // Size the buffer once; header, question and OPT record are fixed
+    // layouts filled in from the query.
+    let answer_qtype = params.question.qtype;
+    let answers_len: usize = answers
+        .iter()
+        .map(|payload| answer_len(answer_qtype, payload.len()))
+        .sum();
+    out.clear();
+    out.reserve(response_base_len(params.question) + answers_len);
+    let id = params.id.to_be_bytes();
+    let flags = u16::to_be_bytes(flags);
+    let ancount = ancount.to_be_bytes();
+    out.extend_from_slice(&[
+        id[0], id[1], flags[0], flags[1], 0, 1, ancount[0], ancount[1], 0, 0, 0, 1,
+    ]);
+
+    encode_name(&params.question.name, out)?;
+    let qtype = params.question.qtype.to_be_bytes();
+    let qclass = params.question.qclass.to_be_bytes();
+    out.extend_from_slice(&[qtype[0], qtype[1], qclass[0], qclass[1]]);
+
+    if !answers.is_empty() {
+        // Name pointer to the question, type, class and a 60-second TTL.
+        let answer_prefix = [
+            0xC0, 0x0C, qtype[0], qtype[1], qclass[0], qclass[1], 0, 0, 0, 60,
+        ];
+        for payload in answers {
+            encode_answer(out, &answer_prefix, answer_qtype, payload)?;
         }
     }
 
-    encode_opt_record(&mut out)?;
+    encode_opt_record(out);
 
-    Ok(out)
+    Ok(())
+}
+
+fn encode_answer(
+    out: &mut Vec<u8>,
+    prefix: &[u8; 10],
+    qtype: u16,
+    payload: &[u8],
+) -> Result<(), DnsError> {
+    let rdata_len = answer_len(qtype, payload.len()) - ANSWER_OVERHEAD;
+    if rdata_len > u16::MAX as usize {
+        return Err(DnsError::new("payload too long"));
+    }
+    out.extend_from_slice(prefix);
+    write_u16(out, rdata_len as u16);
+    if qtype == RR_NULL {
+        out.extend_from_slice(payload);
+        return Ok(());
+    }
+    // TXT strings hold at most 255 bytes each.
+    for chunk in payload.chunks(255) {
+        out.push(chunk.len() as u8);
+        out.extend_from_slice(chunk);
+    }
+    Ok(())
 }
 
 pub fn decode_response(packet: &[u8]) -> Option<Vec<u8>> {
+    let mut answers = decode_answers(packet, false)?;
+    answers.pop()
+}
+
+/// Decodes every TXT or NULL answer of a data response, one packet per
+/// answer. A single-answer response yields the same packet as
+/// `decode_response`.
+pub fn decode_response_packets(packet: &[u8]) -> Option<Vec<Vec<u8>>> {
+    decode_answers(packet, true)
+}
+
+fn decode_answers(packet: &[u8], allow_multiple: bool) -> Option<Vec<Vec<u8>>> {
     let header = parse_header(packet)?;
     if !header.is_response {
         return None;
@@ -216,22 +381,30 @@ pub fn decode_response(packet: &[u8]) -> Option<Vec<u8>> {
     if rcode != Rcode::Ok {
         return None;
     }
-    if header.ancount != 1 {
+    if header.ancount == 0 || (header.ancount != 1 && !allow_multiple) {
         return None;
     }
 
     let mut offset = header.offset;
     for _ in 0..header.qdcount {
-        let (_, new_offset) = parse_name(packet, offset).ok()?;
-        offset = new_offset;
+        offset = skip_name(packet, offset).ok()?;
         if offset + 4 > packet.len() {
             return None;
         }
         offset += 4;
     }
 
-    let (_, new_offset) = parse_name(packet, offset).ok()?;
-    offset = new_offset;
+    let mut answers = Vec::with_capacity(header.ancount as usize);
+    for _ in 0..header.ancount {
+        let (answer, new_offset) = decode_answer(packet, offset)?;
+        answers.push(answer);
+        offset = new_offset;
+    }
+    Some(answers)
+}
+
+fn decode_answer(packet: &[u8], offset: usize) -> Option<(Vec<u8>, usize)> {
+    let mut offset = skip_name(packet, offset).ok()?;
     if offset + 10 > packet.len() {
         return None;
     }
@@ -246,6 +419,9 @@ pub fn decode_response(packet: &[u8]) -> Option<Vec<u8>> {
     if offset + rdlen > packet.len() || rdlen < 1 {
         return None;
     }
+    if qtype == RR_NULL {
+        return Some((packet[offset..offset + rdlen].to_vec(), offset + rdlen));
+    }
     if qtype != RR_TXT {
         return None;
     }
@@ -267,7 +443,7 @@ pub fn decode_response(packet: &[u8]) -> Option<Vec<u8>> {
     if out.is_empty() {
         return None;
     }
-    Some(out)
+    Some((out, offset + rdlen))
 }
 
 pub fn is_response(packet: &[u8]) -> bool {
@@ -276,19 +452,45 @@ pub fn is_response(packet: &[u8]) -> bool {
         .unwrap_or(false)
 }
 
-fn encode_opt_record(out: &mut Vec<u8>) -> Result<(), DnsError> {
-    out.push(0);
-    write_u16(out, RR_OPT);
-    write_u16(out, EDNS_UDP_PAYLOAD);
-    write_u32(out, 0);
-    write_u16(out, 0);
-    Ok(())
+/// Returns a reply to the DNS message, query or response, that keeps its
+/// header and question but sets the truncation bit and drops every record,
+/// so a stub resolver retries the question over TCP. Used where a message is
+/// too large for the transport at hand.
+pub fn truncated_reply(message: &[u8]) -> Option<Vec<u8>> {
+    let header = parse_header(message)?;
+    if header.qdcount > 1 {
+        return None;
+    }
+    let end = if header.qdcount == 1 {
+        let name_end = skip_name(message, HEADER_LEN).ok()?;
+        name_end
+            .checked_add(4)
+            .filter(|&end| end <= message.len())?
+    } else {
+        HEADER_LEN
+    };
+    let flags = read_u16(message, 2)? | 0x8000 | 0x0200;
+    let mut out = Vec::with_capacity(end);
+    out.extend_from_slice(&message[..2]);
+    write_u16(&mut out, flags);
+    write_u16(&mut out, header.qdcount);
+    out.extend_from_slice(&[0; 6]);
+    out.extend_from_slice(&message[HEADER_LEN..end]);
+    Some(out)
+}
+
+fn encode_opt_record(out: &mut Vec<u8>) {
+    out.extend_from_slice(&OPT_RECORD);
 }
 
 #[cfg(test)]
 mod tests {
-    use super::encode_response;
-    use crate::types::{Question, ResponseParams, CLASS_IN, RR_TXT};
+    use super::{
+        answer_len, answer_payload_max, decode_response, decode_response_packets, encode_response,
+        encode_response_into, encode_response_packets, encode_response_packets_into,
+        response_base_len, truncated_reply, txt_answer_len,
+    };
+    use crate::types::{QueryParams, Question, Rcode, ResponseParams, CLASS_IN, RR_NULL, RR_TXT};
 
     #[test]
     fn encode_response_rejects_large_payload() {
@@ -308,4 +510,156 @@ mod tests {
         };
         assert!(encode_response(&params).is_err());
     }
+
+    #[test]
+    fn response_packets_round_trip() {
+        let question = Question {
+            name: "a.test.com.".to_string(),
+            qtype: RR_TXT,
+            qclass: CLASS_IN,
+        };
+        let first = vec![1u8; 600];
+        let second = vec![2u8; 40];
+        let params = ResponseParams {
+            id: 0x1234,
+            rd: true,
+            cd: false,
+            question: &question,
+            payload: None,
+            rcode: None,
+        };
+        let encoded = encode_response_packets(&params, &[&first, &second]).expect("encode");
+        assert_eq!(
+            encoded.len(),
+            response_base_len(&question) + txt_answer_len(first.len()) + txt_answer_len(40)
+        );
+        let packets = decode_response_packets(&encoded).expect("decode");
+        assert_eq!(packets, vec![first.clone(), second]);
+        // Clients without multi-packet decode drop the whole answer.
+        assert!(decode_response(&encoded).is_none());
+
+        let single = encode_response_packets(&params, &[&first]).expect("encode single");
+        let legacy = encode_response(&ResponseParams {
+            payload: Some(&first),
+            ..params.clone()
+        })
+        .expect("encode legacy");
+        assert_eq!(single, legacy);
+        assert_eq!(decode_response(&single), Some(first));
+    }
+
+    #[test]
+    fn null_answers_carry_the_packets_as_is() {
+        let question = Question {
+            name: "a.test.com.".to_string(),
+            qtype: RR_NULL,
+            qclass: CLASS_IN,
+        };
+        let first = vec![1u8; 600];
+        let second = vec![2u8; 40];
+        let params = ResponseParams {
+            id: 0x1234,
+            rd: true,
+            cd: false,
+            question: &question,
+            payload: None,
+            rcode: None,
+        };
+        let encoded = encode_response_packets(&params, &[&first, &second]).expect("encode");
+        assert_eq!(
+            encoded.len(),
+            response_base_len(&question) + answer_len(RR_NULL, 600) + answer_len(RR_NULL, 40)
+        );
+        assert!(answer_len(RR_NULL, 600) < txt_answer_len(600));
+        let packets = decode_response_packets(&encoded).expect("decode");
+        assert_eq!(packets, vec![first.clone(), second]);
+
+        let single = encode_response(&ResponseParams {
+            payload: Some(&first),
+            ..params.clone()
+        })
+        .expect("encode single");
+        assert_eq!(decode_response(&single), Some(first));
+    }
+
+    #[test]
+    fn answer_payload_max_fills_the_room() {
+        for qtype in [RR_TXT, RR_NULL] {
+            for room in 0..2000 {
+                let max = answer_payload_max(qtype, room);
+                if max > 0 {
+                    assert!(answer_len(qtype, max) <= room);
+                }
+                assert!(answer_len(qtype, max + 1) > room);
+            }
+        }
+    }
+
+    #[test]
+    fn encode_into_replaces_the_buffer() {
+        let question = Question {
+            name: "a.test.com.".to_string(),
+            qtype: RR_TXT,
+            qclass: CLASS_IN,
+        };
+        let payload = vec![7u8; 300];
+        let params = ResponseParams {
+            id: 0x4321,
+            rd: true,
+            cd: true,
+            question: &question,
+            payload: Some(&payload),
+            rcode: None,
+        };
+        let mut out = Vec::new();
+        encode_response_packets_into(&params, &[&payload, &payload[..10]], &mut out)
+            .expect("encode packets");
+        let capacity = out.capacity();
+
+        encode_response_into(&params, &mut out).expect("encode");
+        assert_eq!(out, encode_response(&params).expect("encode"));
+        assert_eq!(out.capacity(), capacity);
+
+        let error = ResponseParams {
+            payload: None,
+            rcode: Some(Rcode::ServerFailure),
+            ..params.clone()
+        };
+        encode_response_into(&error, &mut out).expect("encode error");
+        assert_eq!(out, encode_response(&error).expect("encode error"));
+        assert_eq!(out.len(), response_base_len(&question));
+    }
+
+    #[test]
+    fn truncated_reply_keeps_the_question_only() {
+        let query = super::encode_query(&QueryParams {
+            id: 0x1234,
+            qname: "www.example.com.",
+            qtype: RR_TXT,
+            qclass: CLASS_IN,
+            rd: true,
+            cd: false,
+            qdcount: 1,
+            is_query: true,
+        })
+        .expect("encode query");
+        let reply = truncated_reply(&query).expect("truncate query");
+        assert_eq!(&reply[..2], &[0x12, 0x34]);
+        // QR, RD and TC set; one question and no records.
+        assert_eq!(&reply[2..4], &[0x83, 0x00]);
+        assert_eq!(&reply[4..12], &[0, 1, 0, 0, 0, 0, 0, 0]);
+        let question_end = 12 + "www.example.com.".len() + 1 + 4;
+        assert_eq!(&reply[12..], &query[12..question_end]);
+
+        let mut response = reply.clone();
+        response.extend_from_slice(&[0; 40]);
+        response[7] = 1;
+        assert_eq!(
+            truncated_reply(&response).expect("truncate response"),
+            reply
+        );
+
+        assert!(truncated_reply(&query[..question_end - 1]).is_none());
+        assert!(truncated_reply(&query[..8]).is_none());
+    }
 }
@@ -0,0 +1,131 @@
+//! Compact short headers: the server CID replaced by its two-byte slot.
+//!
+//! Servers write a slot into bytes `CID_SLOT_OFFSET..+2` of every CID they
+//! issue and can map it back to the CID. A client may then send a 1-RTT
+//! packet with the header form bit set and the fixed bit clear, followed by
+//! the slot and the rest of the packet after the CID. No QUIC packet slipstream
+//! sends has that first byte, and the protected low bits are kept as they are,
+//! so the server restores the exact packet before decrypting it. Slot 0 marks
+//! a CID without a slot, which is always sent in full.
+
+/// Byte of a server CID where its slot starts.
+pub const CID_SLOT_OFFSET: usize = 2;
+/// Bytes a compact packet spends on the slot.
+pub const COMPACT_SLOT_LEN: usize = 2;
+
+const FORM_BITS: u8 = 0xc0;
+const SHORT_HEADER: u8 = 0x40;
+const COMPACT_HEADER: u8 = 0x80;
+
+/// The slot a server CID carries, if any.
+pub fn cid_slot(cid: &[u8]) -> Option<u16> {
+    let bytes = cid.get(CID_SLOT_OFFSET..CID_SLOT_OFFSET + COMPACT_SLOT_LEN)?;
+    let slot = u16::from_be_bytes([bytes[0], bytes[1]]);
+    (slot != 0).then_some(slot)
+}
+
+pub fn is_compact(packet: &[u8]) -> bool {
+    packet
+        .first()
+        .is_some_and(|&first| first & FORM_BITS == COMPACT_HEADER)
+}
+
+/// The slot of a compact packet.
+pub fn compact_slot(packet: &[u8]) -> Option<u16> {
+    if !is_compact(packet) {
+        return None;
+    }
+    let bytes = packet.get(1..1 + COMPACT_SLOT_LEN)?;
+    Some(u16::from_be_bytes([bytes[0], bytes[1]]))
+}
+
+/// Compacts the short header packet in `packet` in place, given the length of
+/// its destination CID. Returns the compact length, or `None`, leaving the
+/// packet as it is, for long headers and CIDs without a slot.
+pub fn compact_short_header(packet: &mut [u8], cid_len: usize) -> Option<usize> {
+    let first = *packet.first()?;
+    if first & FORM_BITS != SHORT_HEADER || packet.len() <= 1 + cid_len {
+        return None;
+    }
+    let slot = cid_slot(&packet[1..1 + cid_len])?;
+    packet[0] = COMPACT_HEADER | (first & !FORM_BITS);
+    packet[1..1 + COMPACT_SLOT_LEN].copy_from_slice(&slot.to_be_bytes());
+    packet.copy_within(1 + cid_len.., 1 + COMPACT_SLOT_LEN);
+    Some(packet.len() - cid_len + COMPACT_SLOT_LEN)
+}
+
+/// Restores the compact packet in `packet` into `out` with the CID its slot
+/// maps to. Returns the packet length, or `None` if it does not fit `out`.
+pub fn expand_short_header(packet: &[u8], cid: &[u8], out: &mut [u8]) -> Option<usize> {
+    let rest = packet.get(1 + COMPACT_SLOT_LEN..)?;
+    if !is_compact(packet) || rest.is_empty() {
+        return None;
+    }
+    let len = 1 + cid.len() + rest.len();
+    let out = out.get_mut(..len)?;
+    out[0] = SHORT_HEADER | (packet[0] & !FORM_BITS);
+    out[1..1 + cid.len()].copy_from_slice(cid);
+    out[1 + cid.len()..].copy_from_slice(rest);
+    Some(len)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{compact_short_header, compact_slot, expand_short_header, is_compact};
+
+    const CID: [u8; 8] = [0x3f, 2, 0x01, 0x02, 0xaa, 0xbb, 0xcc, 0xdd];
+
+    fn short_packet(first: u8, cid: &[u8]) -> Vec<u8> {
+        let mut packet = vec![first];
+        packet.extend_from_slice(cid);
+        packet.extend_from_slice(&[9, 8, 7, 6, 5, 4, 3, 2, 1]);
+        packet
+    }
+
+    #[test]
+    fn compact_packets_expand_to_the_original() {
+        for first in [0x40u8, 0x5f, 0x7a] {
+            let packet = short_packet(first, &CID);
+            let mut compact = packet.clone();
+            let len = compact_short_header(&mut compact, CID.len()).expect("compact");
+            assert_eq!(len, packet.len() - 6);
+            let compact = &compact[..len];
+            assert!(is_compact(compact));
+            assert_eq!(compact_slot(compact), Some(0x0102));
+
+            let mut out = [0u8; 64];
+            let expanded = expand_short_header(compact, &CID, &mut out).expect("expand");
+            assert_eq!(&out[..expanded], &packet[..]);
+        }
+    }
+
+    #[test]
+    fn long_headers_and_unslotted_cids_stay_whole() {
+        let mut long = short_packet(0xc3, &CID);
+        assert_eq!(compact_short_header(&mut long, CID.len()), None);
+        assert_eq!(long, short_packet(0xc3, &CID));
+
+        let mut unslotted = CID;
+        unslotted[2] = 0;
+        unslotted[3] = 0;
+        let mut packet = short_packet(0x41, &unslotted);
+        assert_eq!(compact_short_header(&mut packet, CID.len()), None);
+        assert_eq!(packet, short_packet(0x41, &unslotted));
+
+        // Header alone: nothing would be left to send after the slot.
+        let mut header = short_packet(0x41, &CID);
+        header.truncate(1 + CID.len());
+        assert_eq!(compact_short_header(&mut header, CID.len()), None);
+    }
+
+    #[test]
+    fn plain_packets_are_not_compact() {
+        assert!(!is_compact(&short_packet(0x40, &CID)));
+        assert!(!is_compact(&short_packet(0xc0, &CID)));
+        assert!(!is_compact(&[]));
+        assert_eq!(compact_slot(&[0x80, 1]), None);
+        let mut out = [0u8; 8];
+        assert_eq!(expand_short_header(&[0x80, 0, 1], &CID, &mut out), None);
+        assert_eq!(expand_short_header(&[0x80, 0, 1, 5], &CID, &mut out), None);
+    }
+}
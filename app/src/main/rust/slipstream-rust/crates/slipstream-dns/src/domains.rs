@@ -0,0 +1,156 @@
+use std::cmp::Ordering;
+
+use crate::name::NameLabels;
+use crate::types::Rcode;
+
+const ROOT: usize = 0;
+
+struct DomainNode {
+    // Lowercased labels, sorted, with the node each leads to.
+    children: Vec<(Box<[u8]>, usize)>,
+    is_domain: bool,
+}
+
+impl DomainNode {
+    fn new() -> Self {
+        Self {
+            children: Vec::new(),
+            is_domain: false,
+        }
+    }
+
+    fn find(&self, label: &[u8]) -> Result<usize, usize> {
+        self.children
+            .binary_search_by(|(child, _)| compare_label(child, label))
+    }
+}
+
+/// The tunnel domains, compiled into a trie of their labels from the root
+/// down, so a query name is matched against all of them in one pass over its
+/// labels instead of once per domain.
+///
+/// Labels are compared ignoring ASCII case, as `match_subdomain` does, and the
+/// longest matching domain wins.
+pub struct DomainSet {
+    nodes: Vec<DomainNode>,
+}
+
+impl DomainSet {
+    pub fn new<S: AsRef<str>>(domains: &[S]) -> Self {
+        let mut nodes = vec![DomainNode::new()];
+        for domain in domains {
+            let domain = domain.as_ref().trim_end_matches('.');
+            if domain.is_empty() {
+                continue;
+            }
+            let mut node = ROOT;
+            for label in domain.rsplit('.') {
+                let label = label.to_ascii_lowercase().into_bytes();
+                node = match nodes[node].find(&label) {
+                    Ok(index) => nodes[node].children[index].1,
+                    Err(index) => {
+                        let child = nodes.len();
+                        nodes.push(DomainNode::new());
+                        nodes[node]
+                            .children
+                            .insert(index, (label.into_boxed_slice(), child));
+                        child
+                    }
+                };
+            }
+            nodes[node].is_domain = true;
+        }
+        Self { nodes }
+    }
+
+    /// Returns how many leading labels of the name carry the payload, under
+    /// the longest matching domain. A name equal to that domain carries no
+    /// payload and is rejected.
+    pub(crate) fn match_labels(&self, packet: &[u8], labels: &NameLabels) -> Result<usize, Rcode> {
+        let mut node = ROOT;
+        let mut domain_labels = None;
+        for depth in 0..labels.len() {
+            let label = labels.label(packet, labels.len() - 1 - depth);
+            let Ok(index) = self.nodes[node].find(label) else {
+                break;
+            };
+            node = self.nodes[node].children[index].1;
+            if self.nodes[node].is_domain {
+                domain_labels = Some(depth + 1);
+            }
+        }
+        match domain_labels {
+            Some(domain_labels) if domain_labels < labels.len() => Ok(labels.len() - domain_labels),
+            _ => Err(Rcode::NameError),
+        }
+    }
+}
+
+/// Orders a lowercased label against a label as sent.
+fn compare_label(lower: &[u8], label: &[u8]) -> Ordering {
+    lower
+        .iter()
+        .copied()
+        .cmp(label.iter().map(u8::to_ascii_lowercase))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::DomainSet;
+    use crate::name::{encode_name, match_subdomain, read_name_labels, NameLabels};
+    use crate::types::Rcode;
+
+    fn match_name(name: &str, domains: &[&str]) -> Result<usize, Rcode> {
+        let mut packet = Vec::new();
+        encode_name(name, &mut packet).expect("encode");
+        let mut labels = NameLabels::new();
+        read_name_labels(&packet, 0, &mut labels).expect("labels");
+        let matched = DomainSet::new(domains).match_labels(&packet, &labels);
+        assert_eq!(matched, match_subdomain(&packet, &labels, domains));
+        matched
+    }
+
+    #[test]
+    fn matches_like_the_domain_scan() {
+        let name = "AbC.dEf.Tunnel.Example.COM.";
+        assert_eq!(match_name(name, &["example.com"]), Ok(3));
+        assert_eq!(
+            match_name(name, &["example.com.", "tunnel.example.com"]),
+            Ok(2)
+        );
+        assert_eq!(
+            match_name(name, &["TUNNEL.example.com", "example.com"]),
+            Ok(2)
+        );
+        assert_eq!(
+            match_name(name, &["nnel.example.com", "xample.com"]),
+            Err(Rcode::NameError)
+        );
+        assert_eq!(
+            match_name(name, &["abc.def.tunnel.example.com", "example.com"]),
+            Err(Rcode::NameError)
+        );
+        assert_eq!(match_name(name, &[]), Err(Rcode::NameError));
+        assert_eq!(match_name(name, &["", "."]), Err(Rcode::NameError));
+    }
+
+    #[test]
+    fn matches_among_many_domains() {
+        let domains: Vec<String> = (0..50)
+            .map(|index| format!("t{index}.example.net"))
+            .chain(["example.org".to_string(), "a.example.org".to_string()])
+            .collect();
+        let domains: Vec<&str> = domains.iter().map(String::as_str).collect();
+        assert_eq!(match_name("pay.load.t17.example.net.", &domains), Ok(2));
+        assert_eq!(
+            match_name("pay.t170.example.net.", &domains),
+            Err(Rcode::NameError)
+        );
+        assert_eq!(
+            match_name("pay.example.net.", &domains),
+            Err(Rcode::NameError)
+        );
+        assert_eq!(match_name("pay.a.example.org.", &domains), Ok(1));
+        assert_eq!(match_name("pay.b.example.org.", &domains), Ok(2));
+    }
+}
@@ -38,6 +38,26 @@ pub fn dotify(input: &str) -> String {
     String::from_utf8(buf).unwrap_or_default()
 }
 
+/// Splits the characters from `start` to the end of `out` into labels as
+/// `dotify` does: with `d` dots, the first label takes `56 + d` characters,
+/// the middle ones 56, and the last whatever remains.
+pub(crate) fn insert_dots(out: &mut Vec<u8>, start: usize) {
+    let len = out.len() - start;
+    let dots = len.saturating_sub(1) / 57;
+    if dots == 0 {
+        return;
+    }
+
+    // Open the gaps back to front so that every character moves once.
+    out.resize(start + len + dots, 0);
+    for k in (1..=dots).rev() {
+        let from = start + 56 * k + dots;
+        let to = if k == dots { start + len } else { from + 56 };
+        out.copy_within(from..to, from + k);
+        out[from + k - 1] = b'.';
+    }
+}
+
 pub fn undotify(input: &str) -> String {
     let mut out = Vec::with_capacity(input.len());
     for &b in input.as_bytes() {
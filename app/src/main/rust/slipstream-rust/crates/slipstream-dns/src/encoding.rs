@@ -0,0 +1,101 @@
+//! Downstream encodings a client picks per query.
+//!
+//! The query type sets the answer record type: TXT, split into 255-byte
+//! strings, or NULL, which carries the packet bytes as they are. A query whose
+//! payload starts with `MULTI_ANSWER_MARKER` also lets the server answer with
+//! several records, one QUIC packet each, up to what the path is known to
+//! carry. Like `BATCH_MARKER`, the marker has the QUIC fixed bit clear, so no
+//! plain packet payload starts with it; a batch may follow it.
+
+use crate::build_qname_into_with;
+use crate::types::{DnsError, QnameEncoding};
+
+pub const MULTI_ANSWER_MARKER: u8 = 0x01;
+/// Bytes the marker costs in a query payload.
+pub const MULTI_ANSWER_OVERHEAD: usize = 1;
+
+// Longer than any payload a query name can hold.
+const MARKED_PAYLOAD_MAX: usize = 256;
+
+/// Removes the multi-answer marker from a decoded query payload. Returns
+/// whether it was there.
+pub fn take_multi_answer_marker(payload: &mut Vec<u8>) -> bool {
+    if payload.len() > MULTI_ANSWER_OVERHEAD && payload[0] == MULTI_ANSWER_MARKER {
+        payload.remove(0);
+        true
+    } else {
+        false
+    }
+}
+
+/// Like `build_qname_into_with`, with the multi-answer marker in front of
+/// `payload`.
+pub fn build_multi_answer_qname_into(
+    payload: &[u8],
+    domain: &str,
+    encoding: QnameEncoding,
+    qname: &mut String,
+) -> Result<(), DnsError> {
+    let mut marked = [0u8; MARKED_PAYLOAD_MAX];
+    let len = payload.len() + MULTI_ANSWER_OVERHEAD;
+    if len > marked.len() {
+        return Err(DnsError::new("payload too large for domain"));
+    }
+    marked[0] = MULTI_ANSWER_MARKER;
+    marked[MULTI_ANSWER_OVERHEAD..len].copy_from_slice(payload);
+    build_qname_into_with(&marked[..len], domain, encoding, qname)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{build_multi_answer_qname_into, take_multi_answer_marker, MULTI_ANSWER_MARKER};
+    use crate::{
+        build_qname, decode_query, encode_query, QnameEncoding, QueryParams, CLASS_IN, RR_NULL,
+    };
+
+    #[test]
+    fn marker_round_trips_through_a_query() {
+        let payload = [0x40u8, 1, 2, 3];
+        let mut qname = String::new();
+        build_multi_answer_qname_into(&payload, "test.com", QnameEncoding::Base32, &mut qname)
+            .expect("build qname");
+        let query = encode_query(&QueryParams {
+            id: 7,
+            qname: &qname,
+            qtype: RR_NULL,
+            qclass: CLASS_IN,
+            rd: true,
+            cd: false,
+            qdcount: 1,
+            is_query: true,
+        })
+        .expect("encode query");
+        let mut decoded = decode_query(&query, "test.com").expect("decode query");
+        assert_eq!(decoded.question.qtype, RR_NULL);
+        assert!(take_multi_answer_marker(&mut decoded.payload));
+        assert_eq!(decoded.payload, payload);
+
+        let plain = build_qname(&payload, "test.com").expect("build plain");
+        assert_ne!(plain, qname);
+        let mut unmarked = payload.to_vec();
+        assert!(!take_multi_answer_marker(&mut unmarked));
+        assert_eq!(unmarked, payload);
+        // A lone marker is not a marked payload.
+        let mut lone = vec![MULTI_ANSWER_MARKER];
+        assert!(!take_multi_answer_marker(&mut lone));
+    }
+
+    #[test]
+    fn marked_payload_respects_the_name_limit() {
+        let max = crate::max_payload_len_for_domain("test.com").expect("max payload");
+        let mut qname = String::new();
+        let base32 = QnameEncoding::Base32;
+        assert!(
+            build_multi_answer_qname_into(&vec![0u8; max - 1], "test.com", base32, &mut qname)
+                .is_ok()
+        );
+        assert!(
+            build_multi_answer_qname_into(&vec![0u8; max], "test.com", base32, &mut qname).is_err()
+        );
+    }
+}
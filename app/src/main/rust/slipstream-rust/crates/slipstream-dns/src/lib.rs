@@ -1,36 +1,101 @@
 mod base32;
+mod base64;
+mod batch;
 mod codec;
+mod compact;
+mod domains;
 mod dots;
+mod encoding;
 mod name;
 mod types;
 mod wire;
 
-pub use base32::{decode as base32_decode, encode as base32_encode, Base32Error};
+pub use base32::{
+    decode as base32_decode, decode_into as base32_decode_into, encode as base32_encode,
+    encode_into as base32_encode_into, Base32Error,
+};
+pub use batch::{
+    batch_push, is_batch, split_batch, BatchPackets, BATCH_MARKER, BATCH_PACKET_OVERHEAD,
+};
 pub use codec::{
-    decode_query, decode_query_with_domains, decode_response, encode_query, encode_response,
-    is_response,
+    answer_len, answer_payload_max, decode_query, decode_query_with_domain_set,
+    decode_query_with_domains, decode_response, decode_response_packets, encode_query,
+    encode_response, encode_response_into, encode_response_packets, encode_response_packets_into,
+    is_response, response_base_len, truncated_reply, txt_answer_len,
+};
+pub use compact::{
+    cid_slot, compact_short_header, compact_slot, expand_short_header, is_compact, CID_SLOT_OFFSET,
+    COMPACT_SLOT_LEN,
 };
+pub use domains::DomainSet;
 pub use dots::{dotify, undotify};
+pub use encoding::{
+    build_multi_answer_qname_into, take_multi_answer_marker, MULTI_ANSWER_MARKER,
+    MULTI_ANSWER_OVERHEAD,
+};
 pub use types::{
-    DecodeQueryError, DecodedQuery, DnsError, QueryParams, Question, Rcode, ResponseParams,
-    CLASS_IN, EDNS_UDP_PAYLOAD, RR_A, RR_OPT, RR_TXT,
+    DecodeQueryError, DecodedQuery, DnsError, QnameEncoding, QueryParams, Question, Rcode,
+    ResponseParams, CLASS_IN, EDNS_UDP_PAYLOAD, RR_A, RR_NULL, RR_OPT, RR_TXT,
 };
 
 pub fn build_qname(payload: &[u8], domain: &str) -> Result<String, DnsError> {
+    build_qname_with(payload, domain, QnameEncoding::Base32)
+}
+
+pub fn build_qname_with(
+    payload: &[u8],
+    domain: &str,
+    encoding: QnameEncoding,
+) -> Result<String, DnsError> {
+    let mut qname = String::new();
+    build_qname_into_with(payload, domain, encoding, &mut qname)?;
+    Ok(qname)
+}
+
+/// Writes the query name for `payload` into `qname`, replacing its contents.
+/// Base32 and label dots are produced in one pass into the string's own
+/// buffer, so a reused `qname` costs no allocation.
+pub fn build_qname_into(payload: &[u8], domain: &str, qname: &mut String) -> Result<(), DnsError> {
+    build_qname_into_with(payload, domain, QnameEncoding::Base32, qname)
+}
+
+/// Like `build_qname_into`, in the given name encoding.
+pub fn build_qname_into_with(
+    payload: &[u8],
+    domain: &str,
+    encoding: QnameEncoding,
+    qname: &mut String,
+) -> Result<(), DnsError> {
     let domain = domain.trim_end_matches('.');
     if domain.is_empty() {
         return Err(DnsError::new("domain must not be empty"));
     }
-    let max_payload = max_payload_len_for_domain(domain)?;
+    let max_payload = max_payload_len_for_domain_with(domain, encoding)?;
     if payload.len() > max_payload {
         return Err(DnsError::new("payload too large for domain"));
     }
-    let base32 = base32_encode(payload);
-    let dotted = dotify(&base32);
-    Ok(format!("{}.{}.", dotted, domain))
+    let mut bytes = std::mem::take(qname).into_bytes();
+    bytes.clear();
+    match encoding {
+        QnameEncoding::Base32 => base32::encode_dotted_into(payload, &mut bytes),
+        QnameEncoding::Base64 => base64::encode_name_into(payload, &mut bytes),
+    }
+    bytes.push(b'.');
+    bytes.extend_from_slice(domain.as_bytes());
+    bytes.push(b'.');
+    *qname = String::from_utf8(bytes).unwrap_or_default();
+    Ok(())
 }
 
 pub fn max_payload_len_for_domain(domain: &str) -> Result<usize, DnsError> {
+    max_payload_len_for_domain_with(domain, QnameEncoding::Base32)
+}
+
+/// The largest payload a query name under `domain` carries in `encoding`.
+pub fn max_payload_len_for_domain_with(
+    domain: &str,
+    encoding: QnameEncoding,
+) -> Result<usize, DnsError> {
     let domain = domain.trim_end_matches('.');
     if domain.is_empty() {
         return Err(DnsError::new("domain must not be empty"));
@@ -43,32 +108,30 @@ pub fn max_payload_len_for_domain(domain: &str) -> Result<usize, DnsError> {
     if max_dotted_len == 0 {
         return Ok(0);
     }
-    let mut max_base32_len = 0usize;
-    for len in 1..=max_dotted_len {
-        let dots = (len - 1) / 57;
-        if len + dots > max_dotted_len {
-            break;
-        }
-        max_base32_len = len;
+    // Each full 57-character label takes 58 bytes with its dot.
+    let max_chars = max_dotted_len - max_dotted_len / 58;
+    if encoding == QnameEncoding::Base64 {
+        return Ok(base64::max_payload_len(max_chars));
     }
 
-    let mut max_payload = (max_base32_len * 5) / 8;
-    while max_payload > 0 && base32_len(max_payload) > max_base32_len {
+    let mut max_payload = (max_chars * 5) / 8;
+    while max_payload > 0 && base32_len(max_payload) > max_chars {
         max_payload -= 1;
     }
     Ok(max_payload)
 }
 
 fn base32_len(payload_len: usize) -> usize {
-    if payload_len == 0 {
-        return 0;
-    }
-    (payload_len * 8).div_ceil(5)
+    base32::encoded_len(payload_len)
 }
 
 #[cfg(test)]
 mod tests {
-    use super::{build_qname, max_payload_len_for_domain};
+    use super::{
+        base32_encode, build_qname, build_qname_into, build_qname_with, decode_query, dotify,
+        encode_query, max_payload_len_for_domain, max_payload_len_for_domain_with,
+        DecodeQueryError, QnameEncoding, QueryParams, Rcode, CLASS_IN, RR_TXT,
+    };
 
     #[test]
     fn build_qname_rejects_payload_overflow() {
@@ -78,10 +141,88 @@ mod tests {
         assert!(build_qname(&payload, domain).is_err());
     }
 
+    #[test]
+    fn build_qname_into_reuses_the_buffer() {
+        let domain = "test.com";
+        let payload: Vec<u8> = (0u8..=255).take(150).collect();
+        let mut qname = String::with_capacity(256);
+        let capacity = qname.capacity();
+        for len in [0, 1, 36, 150] {
+            build_qname_into(&payload[..len], domain, &mut qname).expect("build qname");
+            let expected = format!("{}.{}.", dotify(&base32_encode(&payload[..len])), domain);
+            assert_eq!(qname, expected);
+            assert_eq!(
+                build_qname(&payload[..len], domain).expect("build"),
+                expected
+            );
+        }
+        assert_eq!(qname.capacity(), capacity);
+    }
+
+    #[test]
+    fn max_payload_fills_the_name() {
+        for domain_len in 1..=240 {
+            let domain = "a".repeat(domain_len);
+            let max_payload = max_payload_len_for_domain(&domain).expect("max payload");
+            let qname = build_qname(&vec![0u8; max_payload], &domain).expect("build qname");
+            assert!(qname.len() - 1 <= super::name::MAX_DNS_NAME_LEN);
+            if max_payload > 0 {
+                let longer = dotify(&base32_encode(&vec![0u8; max_payload + 1]));
+                assert!(longer.len() + domain_len + 1 > super::name::MAX_DNS_NAME_LEN);
+            }
+        }
+    }
+
     #[test]
     fn build_qname_rejects_long_domain() {
         let domain = format!("{}.com", "a".repeat(260));
         let payload = vec![0u8; 1];
         assert!(build_qname(&payload, &domain).is_err());
     }
+
+    fn query_for(qname: &str) -> Vec<u8> {
+        encode_query(&QueryParams {
+            id: 9,
+            qname,
+            qtype: RR_TXT,
+            qclass: CLASS_IN,
+            rd: true,
+            cd: false,
+            qdcount: 1,
+            is_query: true,
+        })
+        .expect("encode query")
+    }
+
+    #[test]
+    fn base64_names_carry_more_and_decode() {
+        for domain_len in 1..=240 {
+            let domain = "a".repeat(domain_len);
+            let base32_max = max_payload_len_for_domain(&domain).expect("base32 max");
+            let max = max_payload_len_for_domain_with(&domain, QnameEncoding::Base64)
+                .expect("base64 max");
+            assert!(max >= base32_max, "domain length {}", domain_len);
+            let qname = build_qname_with(&vec![0xa5; max], &domain, QnameEncoding::Base64)
+                .expect("build qname");
+            assert!(qname.len() - 1 <= super::name::MAX_DNS_NAME_LEN);
+            assert!(build_qname_with(&vec![0; max + 1], &domain, QnameEncoding::Base64).is_err());
+        }
+        let base32_max = max_payload_len_for_domain("test.com").expect("base32 max");
+        let max =
+            max_payload_len_for_domain_with("test.com", QnameEncoding::Base64).expect("base64 max");
+        assert_eq!((base32_max, max), (150, 178));
+
+        let payload: Vec<u8> = (0u8..=255).cycle().take(max).collect();
+        let qname =
+            build_qname_with(&payload, "test.com", QnameEncoding::Base64).expect("build qname");
+        let decoded = decode_query(&query_for(&qname), "test.com").expect("decode");
+        assert_eq!(decoded.payload, payload);
+
+        // A resolver that folds case gets a refusal, not a corrupted payload.
+        let folded = qname.to_ascii_lowercase();
+        match decode_query(&query_for(&folded), "test.com") {
+            Err(DecodeQueryError::Reply { rcode, .. }) => assert_eq!(rcode, Rcode::Refused),
+            _ => panic!("folded name accepted"),
+        }
+    }
 }
@@ -2,86 +2,63 @@ use crate::types::{DnsError, Rcode};
 
 pub(crate) const MAX_DNS_NAME_LEN: usize = 253;
 
-fn extract_subdomain(qname: &str, domain: &str) -> Result<String, Rcode> {
-    let domain = domain.trim_end_matches('.');
-    if domain.is_empty() {
-        return Err(Rcode::NameError);
-    }
+// A name of MAX_DNS_NAME_LEN bytes has at most this many labels.
+const MAX_LABELS: usize = MAX_DNS_NAME_LEN.div_ceil(2);
+const MAX_POINTER_DEPTH: usize = 16;
 
-    let suffix = format!(".{}.", domain);
-    if !qname
-        .to_ascii_lowercase()
-        .ends_with(&suffix.to_ascii_lowercase())
-    {
-        return Err(Rcode::NameError);
-    }
+/// Labels of a wire-format name, as ranges into the packet they came from.
+pub(crate) struct NameLabels {
+    ranges: [(usize, usize); MAX_LABELS],
+    len: usize,
+    name_len: usize,
+}
 
-    if qname.len() <= domain.len() + 2 {
-        return Err(Rcode::NameError);
+impl NameLabels {
+    pub(crate) fn new() -> Self {
+        Self {
+            ranges: [(0, 0); MAX_LABELS],
+            len: 0,
+            name_len: 0,
+        }
     }
 
-    let data_len = qname.len() - domain.len() - 2;
-    let subdomain = &qname[..data_len];
-    if subdomain.is_empty() {
-        return Err(Rcode::NameError);
+    pub(crate) fn len(&self) -> usize {
+        self.len
     }
-    Ok(subdomain.to_string())
-}
 
-pub(crate) fn extract_subdomain_multi(qname: &str, domains: &[&str]) -> Result<String, Rcode> {
-    let qname_trimmed = qname.trim_end_matches('.');
-    if qname_trimmed.is_empty() {
-        return Err(Rcode::NameError);
+    pub(crate) fn label<'a>(&self, packet: &'a [u8], index: usize) -> &'a [u8] {
+        let (start, end) = self.ranges[index];
+        &packet[start..end]
     }
-    let qname_lower = qname_trimmed.to_ascii_lowercase();
-
-    let mut best_domain: Option<&str> = None;
-    let mut best_len = 0usize;
-    let mut best_empty = false;
 
-    for domain in domains {
-        let domain_trimmed = domain.trim_end_matches('.');
-        if domain_trimmed.is_empty() {
-            continue;
+    /// The name in presentation form, with a trailing dot.
+    pub(crate) fn to_name(&self, packet: &[u8]) -> Result<String, DnsError> {
+        if self.len == 0 {
+            return Ok(".".to_string());
         }
-        let domain_lower = domain_trimmed.to_ascii_lowercase();
-
-        let is_exact = qname_lower == domain_lower;
-        let is_suffix = !is_exact
-            && qname_lower.len() > domain_lower.len()
-            && qname_lower.ends_with(&domain_lower)
-            && qname_lower.as_bytes()[qname_lower.len() - domain_lower.len() - 1] == b'.';
-
-        if !is_exact && !is_suffix {
-            continue;
-        }
-
-        let domain_len = domain_trimmed.len();
-        if domain_len > best_len {
-            best_len = domain_len;
-            best_domain = Some(domain_trimmed);
-            best_empty = is_exact;
+        let mut name = Vec::with_capacity(self.name_len + 1);
+        for index in 0..self.len {
+            name.extend_from_slice(self.label(packet, index));
+            name.push(b'.');
         }
+        String::from_utf8(name).map_err(|_| DnsError::new("label not utf-8"))
     }
-
-    let Some(best_domain) = best_domain else {
-        return Err(Rcode::NameError);
-    };
-    if best_empty {
-        return Err(Rcode::NameError);
-    }
-
-    extract_subdomain(qname, best_domain)
 }
 
-pub(crate) fn parse_name(packet: &[u8], start: usize) -> Result<(String, usize), DnsError> {
-    let mut labels = Vec::new();
+/// Walks the name at `start`, following compression pointers, and records its
+/// labels without copying them. Returns the offset just past the name.
+pub(crate) fn read_name_labels(
+    packet: &[u8],
+    start: usize,
+    labels: &mut NameLabels,
+) -> Result<usize, DnsError> {
     let mut offset = start;
     let mut jumped = false;
     let mut end_offset = start;
-    let mut seen = Vec::new();
+    let mut seen = [0usize; MAX_POINTER_DEPTH + 1];
     let mut depth = 0usize;
-    let mut name_len = 0usize;
+    labels.len = 0;
+    labels.name_len = 0;
 
     loop {
         if offset >= packet.len() {
@@ -96,17 +73,17 @@ pub(crate) fn parse_name(packet: &[u8], start: usize) -> Result<(String, usize),
             if ptr >= packet.len() {
                 return Err(DnsError::new("pointer out of range"));
             }
-            if seen.contains(&ptr) {
+            if seen[..depth].contains(&ptr) {
                 return Err(DnsError::new("pointer loop"));
             }
-            seen.push(ptr);
+            seen[depth] = ptr;
             if !jumped {
                 end_offset = offset + 2;
                 jumped = true;
             }
             offset = ptr;
             depth += 1;
-            if depth > 16 {
+            if depth > MAX_POINTER_DEPTH {
                 return Err(DnsError::new("pointer depth exceeded"));
             }
             continue;
@@ -126,31 +103,76 @@ pub(crate) fn parse_name(packet: &[u8], start: usize) -> Result<(String, usize),
         if end > packet.len() {
             return Err(DnsError::new("label out of range"));
         }
-        if !labels.is_empty() {
-            name_len += 1;
+        if labels.len > 0 {
+            labels.name_len += 1;
         }
-        name_len += len as usize;
-        if name_len > MAX_DNS_NAME_LEN {
+        labels.name_len += len as usize;
+        if labels.name_len > MAX_DNS_NAME_LEN {
             return Err(DnsError::new("name too long"));
         }
-        let label = std::str::from_utf8(&packet[offset..end])
-            .map_err(|_| DnsError::new("label not utf-8"))?;
-        labels.push(label.to_string());
+        std::str::from_utf8(&packet[offset..end]).map_err(|_| DnsError::new("label not utf-8"))?;
+        labels.ranges[labels.len] = (offset, end);
+        labels.len += 1;
         offset = end;
         if !jumped {
             end_offset = offset;
         }
     }
 
-    let name = if labels.is_empty() {
-        ".".to_string()
-    } else {
-        let mut name = labels.join(".");
-        name.push('.');
-        name
-    };
+    Ok(end_offset)
+}
 
-    Ok((name, end_offset))
+pub(crate) fn parse_name(packet: &[u8], start: usize) -> Result<(String, usize), DnsError> {
+    let mut labels = NameLabels::new();
+    let end_offset = read_name_labels(packet, start, &mut labels)?;
+    Ok((labels.to_name(packet)?, end_offset))
+}
+
+/// Returns the offset just past the name at `start`, checking it as
+/// `parse_name` does but without building it.
+pub(crate) fn skip_name(packet: &[u8], start: usize) -> Result<usize, DnsError> {
+    read_name_labels(packet, start, &mut NameLabels::new())
+}
+
+/// Matches the name against the tunnel domains, label by label and ignoring
+/// ASCII case, and returns how many leading labels carry the payload. The
+/// longest matching domain wins; a name equal to it carries no payload and is
+/// rejected.
+pub(crate) fn match_subdomain(
+    packet: &[u8],
+    labels: &NameLabels,
+    domains: &[&str],
+) -> Result<usize, Rcode> {
+    if labels.len() == 0 {
+        return Err(Rcode::NameError);
+    }
+
+    let mut best: Option<(usize, usize)> = None; // (domain length, domain labels)
+    for domain in domains {
+        let domain = domain.trim_end_matches('.');
+        if domain.is_empty() {
+            continue;
+        }
+        let domain_labels = domain.split('.').count();
+        if domain_labels > labels.len() {
+            continue;
+        }
+        let matches = domain.rsplit('.').enumerate().all(|(i, domain_label)| {
+            labels
+                .label(packet, labels.len() - 1 - i)
+                .eq_ignore_ascii_case(domain_label.as_bytes())
+        });
+        if matches && best.is_none_or(|(best_len, _)| domain.len() > best_len) {
+            best = Some((domain.len(), domain_labels));
+        }
+    }
+
+    match best {
+        Some((_, domain_labels)) if domain_labels < labels.len() => {
+            Ok(labels.len() - domain_labels)
+        }
+        _ => Err(Rcode::NameError),
+    }
 }
 
 pub(crate) fn encode_name(name: &str, out: &mut Vec<u8>) -> Result<(), DnsError> {
@@ -187,7 +209,10 @@ pub(crate) fn encode_name(name: &str, out: &mut Vec<u8>) -> Result<(), DnsError>
 #[cfg(test)]
 mod tests {
     use super::MAX_DNS_NAME_LEN;
-    use super::{encode_name, parse_name};
+    use super::{
+        encode_name, match_subdomain, parse_name, read_name_labels, skip_name, NameLabels,
+    };
+    use crate::types::Rcode;
 
     fn build_name(last_label_len: usize) -> String {
         format!(
@@ -231,4 +256,36 @@ mod tests {
         packet.push(0);
         assert!(parse_name(&packet, 0).is_err());
     }
+
+    #[test]
+    fn match_subdomain_compares_whole_labels() {
+        let mut packet = Vec::new();
+        encode_name("AbC.dEf.Tunnel.Example.COM.", &mut packet).expect("encode");
+        let mut labels = NameLabels::new();
+        let end = read_name_labels(&packet, 0, &mut labels).expect("labels");
+        assert_eq!(end, packet.len());
+        assert_eq!(skip_name(&packet, 0).expect("skip"), end);
+        assert_eq!(
+            labels.to_name(&packet).expect("name"),
+            "AbC.dEf.Tunnel.Example.COM."
+        );
+
+        assert_eq!(match_subdomain(&packet, &labels, &["example.com"]), Ok(3));
+        assert_eq!(
+            match_subdomain(&packet, &labels, &["example.com.", "tunnel.example.com"]),
+            Ok(2)
+        );
+        assert_eq!(
+            match_subdomain(&packet, &labels, &["nnel.example.com", "xample.com"]),
+            Err(Rcode::NameError)
+        );
+        assert_eq!(
+            match_subdomain(
+                &packet,
+                &labels,
+                &["abc.def.tunnel.example.com", "example.com"]
+            ),
+            Err(Rcode::NameError)
+        );
+    }
 }
@@ -1,6 +1,7 @@
 use std::fmt;
 
 pub const RR_A: u16 = 1;
+pub const RR_NULL: u16 = 10;
 pub const RR_TXT: u16 = 16;
 pub const RR_OPT: u16 = 41;
 pub const CLASS_IN: u16 = 1;
@@ -12,6 +13,7 @@ pub enum Rcode {
     FormatError,
     ServerFailure,
     NameError,
+    Refused,
 }
 
 impl Rcode {
@@ -21,6 +23,7 @@ impl Rcode {
             Rcode::FormatError => 1,
             Rcode::ServerFailure => 2,
             Rcode::NameError => 3,
+            Rcode::Refused => 5,
         }
     }
 
@@ -30,11 +33,22 @@ impl Rcode {
             1 => Some(Rcode::FormatError),
             2 => Some(Rcode::ServerFailure),
             3 => Some(Rcode::NameError),
+            5 => Some(Rcode::Refused),
             _ => None,
         }
     }
 }
 
+/// How a query name carries its payload.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub enum QnameEncoding {
+    /// Base32, which any resolver carries whatever it does to letter case.
+    #[default]
+    Base32,
+    /// Marked base64url, about a fifth denser, for resolvers that keep case.
+    Base64,
+}
+
 #[derive(Debug, Clone, PartialEq, Eq)]
 pub struct Question {
     pub name: String,
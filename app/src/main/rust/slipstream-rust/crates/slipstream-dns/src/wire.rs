@@ -112,7 +112,3 @@ pub(crate) fn read_u32(packet: &[u8], offset: usize) -> Option<u32> {
 pub(crate) fn write_u16(out: &mut Vec<u8>, value: u16) {
     out.extend_from_slice(&value.to_be_bytes());
 }
-
-pub(crate) fn write_u32(out: &mut Vec<u8>, value: u32) {
-    out.extend_from_slice(&value.to_be_bytes());
-}
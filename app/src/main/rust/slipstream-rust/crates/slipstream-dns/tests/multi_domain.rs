@@ -1,6 +1,6 @@
 use slipstream_dns::{
-    build_qname, decode_query_with_domains, encode_query, DecodeQueryError, QueryParams, Rcode,
-    CLASS_IN, RR_TXT,
+    build_qname, decode_query_with_domain_set, decode_query_with_domains, encode_query,
+    DecodeQueryError, DomainSet, QueryParams, Rcode, CLASS_IN, RR_TXT,
 };
 
 #[test]
@@ -89,3 +89,31 @@ fn decode_query_with_domains_rejects_empty_subdomain_on_overlap() {
         other => panic!("expected name error, got {:?}", other),
     }
 }
+
+#[test]
+fn decode_query_with_domain_set_prefers_longest_suffix() {
+    let payload = vec![4u8, 3, 2, 1];
+    let qname = build_qname(&payload, "Tunnel.Example.com").expect("build qname");
+    let query = encode_query(&QueryParams {
+        id: 7,
+        qname: &qname,
+        qtype: RR_TXT,
+        qclass: CLASS_IN,
+        rd: true,
+        cd: false,
+        qdcount: 1,
+        is_query: true,
+    })
+    .expect("encode query");
+
+    let domains = DomainSet::new(&["example.com", "other.net", "tunnel.example.com"]);
+    let decoded = decode_query_with_domain_set(&query, &domains).expect("decode query");
+    assert_eq!(decoded.payload, payload);
+
+    match decode_query_with_domain_set(&query, &DomainSet::new(&["other.net"])) {
+        Err(DecodeQueryError::Reply { rcode, .. }) => {
+            assert_eq!(rcode, Rcode::NameError);
+        }
+        other => panic!("expected name error, got {:?}", other),
+    }
+}
@@ -137,16 +137,32 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     let cc_dir = manifest_dir.join("cc");
     let cc_src = cc_dir.join("slipstream_server_cc.c");
     let mixed_cc_src = cc_dir.join("slipstream_mixed_cc.c");
+    let dns_cc_src = cc_dir.join("slipstream_dns_cc.c");
+    let bbr_cc_src = cc_dir.join("slipstream_bbr_cc.c");
+    let telemetry_src = cc_dir.join("slipstream_telemetry.c");
+    let perf_src = cc_dir.join("slipstream_perf.c");
+    let hibernate_src = cc_dir.join("slipstream_hibernate.c");
     let poll_src = cc_dir.join("slipstream_poll.c");
+    let datagram_src = cc_dir.join("slipstream_datagram.c");
     let stateless_packet_src = cc_dir.join("slipstream_stateless_packet.c");
     let test_helpers_src = cc_dir.join("slipstream_test_helpers.c");
     let picotls_layout_src = cc_dir.join("picotls_layout.c");
+    let crypto_src = cc_dir.join("slipstream_crypto.c");
+    let doh3_src = cc_dir.join("slipstream_doh3.c");
     println!("cargo:rerun-if-changed={}", cc_src.display());
     println!("cargo:rerun-if-changed={}", mixed_cc_src.display());
+    println!("cargo:rerun-if-changed={}", dns_cc_src.display());
+    println!("cargo:rerun-if-changed={}", bbr_cc_src.display());
+    println!("cargo:rerun-if-changed={}", telemetry_src.display());
+    println!("cargo:rerun-if-changed={}", perf_src.display());
+    println!("cargo:rerun-if-changed={}", hibernate_src.display());
     println!("cargo:rerun-if-changed={}", poll_src.display());
+    println!("cargo:rerun-if-changed={}", datagram_src.display());
     println!("cargo:rerun-if-changed={}", stateless_packet_src.display());
     println!("cargo:rerun-if-changed={}", test_helpers_src.display());
     println!("cargo:rerun-if-changed={}", picotls_layout_src.display());
+    println!("cargo:rerun-if-changed={}", crypto_src.display());
+    println!("cargo:rerun-if-changed={}", doh3_src.display());
     let picoquic_internal = picoquic_include_dir.join("picoquic_internal.h");
     if picoquic_internal.exists() {
         println!("cargo:rerun-if-changed={}", picoquic_internal.display());
@@ -159,10 +175,34 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     compile_cc(&cc, &mixed_cc_src, &mixed_cc_obj, &picoquic_include_dir)?;
     object_paths.push(mixed_cc_obj);
 
+    let dns_cc_obj = out_dir.join("slipstream_dns_cc.c.o");
+    compile_cc(&cc, &dns_cc_src, &dns_cc_obj, &picoquic_include_dir)?;
+    object_paths.push(dns_cc_obj);
+
+    let bbr_cc_obj = out_dir.join("slipstream_bbr_cc.c.o");
+    compile_cc(&cc, &bbr_cc_src, &bbr_cc_obj, &picoquic_include_dir)?;
+    object_paths.push(bbr_cc_obj);
+
+    let telemetry_obj = out_dir.join("slipstream_telemetry.c.o");
+    compile_cc(&cc, &telemetry_src, &telemetry_obj, &picoquic_include_dir)?;
+    object_paths.push(telemetry_obj);
+
+    let perf_obj = out_dir.join("slipstream_perf.c.o");
+    compile_cc(&cc, &perf_src, &perf_obj, &picoquic_include_dir)?;
+    object_paths.push(perf_obj);
+
+    let hibernate_obj = out_dir.join("slipstream_hibernate.c.o");
+    compile_cc(&cc, &hibernate_src, &hibernate_obj, &picoquic_include_dir)?;
+    object_paths.push(hibernate_obj);
+
     let poll_obj = out_dir.join("slipstream_poll.c.o");
     compile_cc(&cc, &poll_src, &poll_obj, &picoquic_include_dir)?;
     object_paths.push(poll_obj);
 
+    let datagram_obj = out_dir.join("slipstream_datagram.c.o");
+    compile_cc(&cc, &datagram_src, &datagram_obj, &picoquic_include_dir)?;
+    object_paths.push(datagram_obj);
+
     let stateless_packet_obj = out_dir.join("slipstream_stateless_packet.c.o");
     compile_cc(
         &cc,
@@ -190,6 +230,34 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     )?;
     object_paths.push(picotls_layout_obj);
 
+    let crypto_obj = out_dir.join("slipstream_crypto.c.o");
+    compile_cc_with_includes(
+        &cc,
+        &crypto_src,
+        &crypto_obj,
+        &[&picoquic_include_dir, &picotls_include_dir],
+    )?;
+    object_paths.push(crypto_obj);
+
+    // Installed headers share one directory; a source tree keeps picohttp
+    // beside picoquic.
+    let picohttp_include_dir = [
+        Some(picoquic_include_dir.clone()),
+        picoquic_include_dir.parent().map(|dir| dir.join("picohttp")),
+    ]
+    .into_iter()
+    .flatten()
+    .find(|dir| dir.join("h3zero.h").exists())
+    .ok_or("Missing picohttp headers; build picoquic with BUILD_HTTP=ON.")?;
+    let doh3_obj = out_dir.join("slipstream_doh3.c.o");
+    compile_cc_with_includes(
+        &cc,
+        &doh3_src,
+        &doh3_obj,
+        &[&picoquic_include_dir, &picohttp_include_dir],
+    )?;
+    object_paths.push(doh3_obj);
+
     let archive = out_dir.join("libslipstream_client_objs.a");
     create_archive(&ar, &archive, &object_paths)?;
     println!("cargo:rustc-link-search=native={}", out_dir.display());
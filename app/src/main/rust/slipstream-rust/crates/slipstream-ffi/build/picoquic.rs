@@ -251,6 +251,8 @@ fn resolve_picoquic_libs_single_dir(dir: &Path) -> Option<Vec<&'static str>> {
     if let Some(fusion) = find_lib_variant(dir, "picotls_fusion", "picotls-fusion") {
         libs.insert(3, fusion);
     }
+    // h3zero sits on top of picoquic, so it links first.
+    libs.insert(0, find_lib_variant(dir, "picohttp_core", "picohttp-core")?);
     Some(libs)
 }
 
@@ -263,7 +265,8 @@ fn resolve_picoquic_libs_split(
     let picotls_minicrypto =
         find_lib_variant(picotls_dir, "picotls_minicrypto", "picotls-minicrypto")?;
     let picotls_openssl = find_lib_variant(picotls_dir, "picotls_openssl", "picotls-openssl")?;
-    let mut libs = vec![picoquic_core, picotls_core, picotls_openssl];
+    let picohttp_core = find_lib_variant(picoquic_dir, "picohttp_core", "picohttp-core")?;
+    let mut libs = vec![picohttp_core, picoquic_core, picotls_core, picotls_openssl];
     if let Some(fusion) = find_lib_variant(picotls_dir, "picotls_fusion", "picotls-fusion") {
         libs.push(fusion);
     }
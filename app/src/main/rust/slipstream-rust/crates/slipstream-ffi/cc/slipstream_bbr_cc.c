@@ -0,0 +1,85 @@
+#include <stdint.h>
+
+#include <picoquic_internal.h>
+
+/* BBR for authoritative paths.
+ *
+ * Stock BBR enters ProbeRTT whenever its min RTT sample is 5 s old, caps the
+ * flight at half a BDP (at least 4 packets) and holds it there for 200 ms plus
+ * a round. On a tunnel each packet is one DNS query of a couple of hundred
+ * bytes, so that cap leaves a handful of queries outstanding and every probe
+ * shows up as a throughput dip. This variant keeps BBR's model and only swaps
+ * its tunables: ProbeRTT comes half as often, keeps one BDP in flight and ends
+ * after one round, which still lets queueing drain out of the min RTT filter
+ * because the flight stops growing. Send quanta are whole queries, a few at a
+ * time, instead of a byte budget sized for MTU-sized packets. Startup is gentler
+ * on query-sized paths, where a burst of 2.77 times the initial rate is what
+ * trips a resolver's rate limit. */
+
+#define SLIPSTREAM_BBR_CC_SMALL_MTU 512 /* below this, a packet is one query */
+#define SLIPSTREAM_BBR_CC_PROBE_RTT_INTERVAL 10000000 /* 10 s */
+#define SLIPSTREAM_BBR_CC_QUANTUM_PACKETS 4
+
+static const picoquic_bbr_profile_t slipstream_bbr_cc_profile_query = {
+    SLIPSTREAM_BBR_CC_PROBE_RTT_INTERVAL,
+    0,   /* one round */
+    1.0, /* one BDP */
+    2.0,
+    SLIPSTREAM_BBR_CC_QUANTUM_PACKETS
+};
+
+static const picoquic_bbr_profile_t slipstream_bbr_cc_profile_bulk = {
+    SLIPSTREAM_BBR_CC_PROBE_RTT_INTERVAL,
+    0,
+    1.0,
+    2.77,
+    SLIPSTREAM_BBR_CC_QUANTUM_PACKETS
+};
+
+static picoquic_bbr_profile_t const* slipstream_bbr_cc_profile(picoquic_path_t* path_x)
+{
+    if (path_x->send_mtu < SLIPSTREAM_BBR_CC_SMALL_MTU) {
+        return &slipstream_bbr_cc_profile_query;
+    }
+    return &slipstream_bbr_cc_profile_bulk;
+}
+
+static void slipstream_bbr_cc_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    picoquic_bbr_init_with_profile(cnx, path_x, current_time, slipstream_bbr_cc_profile(path_x));
+}
+
+/* The profile lives in the BBR state, which keeps it across resets, so
+ * everything after init is stock BBR. */
+static void slipstream_bbr_cc_notify(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_per_ack_state_t* ack_state,
+    uint64_t current_time)
+{
+    picoquic_bbr_algorithm->alg_notify(cnx, path_x, notification, ack_state, current_time);
+}
+
+static void slipstream_bbr_cc_delete(picoquic_path_t* path_x)
+{
+    picoquic_bbr_algorithm->alg_delete(path_x);
+}
+
+static void slipstream_bbr_cc_observe(picoquic_path_t* path_x, uint64_t* cc_state, uint64_t* cc_param)
+{
+    picoquic_bbr_algorithm->alg_observe(path_x, cc_state, cc_param);
+}
+
+#define picoquic_slipstream_bbr_cc_ID "slipstream_bbr"
+#define PICOQUIC_CC_ALGO_NUMBER_SLIPSTREAM_BBR 13
+
+picoquic_congestion_algorithm_t slipstream_bbr_cc_algorithm_struct = {
+    picoquic_slipstream_bbr_cc_ID, PICOQUIC_CC_ALGO_NUMBER_SLIPSTREAM_BBR,
+    slipstream_bbr_cc_init,
+    slipstream_bbr_cc_notify,
+    slipstream_bbr_cc_delete,
+    slipstream_bbr_cc_observe
+};
+
+picoquic_congestion_algorithm_t* slipstream_bbr_cc_algorithm = &slipstream_bbr_cc_algorithm_struct;
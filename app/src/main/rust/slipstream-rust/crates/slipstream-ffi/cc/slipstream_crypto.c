@@ -0,0 +1,101 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__linux__) && (defined(__aarch64__) || defined(__arm__))
+#include <sys/auxv.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "picotls.h"
+#include <picoquic_internal.h>
+
+/* Cipher suite order by CPU.
+ *
+ * picoquic offers its suites in registration order, AES-128-GCM first. That
+ * suits CPUs with AES and carry-less multiply instructions, but on phones
+ * without the ARMv8 crypto extensions AES-GCM runs in software at a fraction
+ * of ChaCha20-Poly1305's speed, and every DNS answer is decrypted on the
+ * client. The client therefore moves ChaCha20 to the front of its ClientHello
+ * when the CPU lacks either instruction. Nothing is needed on the server:
+ * picoquic leaves picotls's server_cipher_preference at 0, so the server takes
+ * the first suite of the client's list that it supports. */
+
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#ifndef AT_HWCAP2
+#define AT_HWCAP2 26
+#endif
+#ifndef HWCAP2_AES
+#define HWCAP2_AES (1 << 0)
+#endif
+#ifndef HWCAP2_PMULL
+#define HWCAP2_PMULL (1 << 1)
+#endif
+
+int slipstream_cpu_has_aes(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    /* AES-NI and PCLMULQDQ */
+    return (ecx & (1u << 25)) != 0 && (ecx & (1u << 1)) != 0;
+#elif defined(__linux__) && defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    return (hwcap & HWCAP_AES) != 0 && (hwcap & HWCAP_PMULL) != 0;
+#elif defined(__linux__) && defined(__arm__)
+    unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    return (hwcap2 & HWCAP2_AES) != 0 && (hwcap2 & HWCAP2_PMULL) != 0;
+#elif defined(__aarch64__) && defined(__APPLE__)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Moves the suite with the given ID to the front of the context's list,
+ * keeping the others in order. Returns -1 if the list does not have it. */
+static int slipstream_prefer_cipher_suite(picoquic_quic_t* quic, uint16_t id)
+{
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+    ptls_cipher_suite_t** suites;
+    size_t i;
+
+    if (ctx == NULL || ctx->cipher_suites == NULL) {
+        return -1;
+    }
+    suites = ctx->cipher_suites;
+    for (i = 0; suites[i] != NULL; i++) {
+        if (suites[i]->id == id) {
+            ptls_cipher_suite_t* preferred = suites[i];
+            for (; i > 0; i--) {
+                suites[i] = suites[i - 1];
+            }
+            suites[0] = preferred;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Orders the client's cipher suites for this CPU. Returns the ID of the
+ * suite now offered first, or 0 if the context has none. */
+int slipstream_configure_cipher_suites(picoquic_quic_t* quic)
+{
+    ptls_context_t* ctx = (ptls_context_t*)quic->tls_master_ctx;
+
+    if (!slipstream_cpu_has_aes()) {
+        (void)slipstream_prefer_cipher_suite(quic, PICOQUIC_CHACHA20_POLY1305_SHA256);
+    }
+    if (ctx == NULL || ctx->cipher_suites == NULL || ctx->cipher_suites[0] == NULL) {
+        return 0;
+    }
+    return ctx->cipher_suites[0]->id;
+}
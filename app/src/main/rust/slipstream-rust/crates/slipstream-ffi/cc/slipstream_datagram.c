@@ -0,0 +1,79 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <picoquic_internal.h>
+
+/* QUIC DATAGRAM frames for tunneled UDP.
+ *
+ * Datagrams go through picoquic's queue: each one is formatted into a frame
+ * when queued and sent whole in the next packet with room for it. The queue
+ * is sent in order, so a frame too big for every path would block the ones
+ * behind it for the life of the connection; queueing checks the length
+ * against the smallest usable path instead of leaving that to the sender. */
+
+/* Short header: flags byte, packet number, AEAD tag. */
+#define SLIPSTREAM_DATAGRAM_PACKET_OVERHEAD (1 + 4 + 16)
+/* DATAGRAM frame type and a two byte length. */
+#define SLIPSTREAM_DATAGRAM_FRAME_OVERHEAD (1 + 2)
+
+int slipstream_enable_datagrams(picoquic_quic_t *quic, uint32_t max_frame_size) {
+    if (quic == NULL) {
+        return -1;
+    }
+    picoquic_tp_t tp = *picoquic_get_default_tp(quic);
+    tp.max_datagram_frame_size = max_frame_size;
+    return picoquic_set_default_tp(quic, &tp);
+}
+
+size_t slipstream_datagram_max_payload(picoquic_cnx_t *cnx) {
+    if (cnx == NULL || cnx->remote_parameters.max_datagram_frame_size == 0) {
+        return 0;
+    }
+    size_t max_payload = PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH;
+    if (cnx->remote_parameters.max_datagram_frame_size < max_payload + SLIPSTREAM_DATAGRAM_FRAME_OVERHEAD) {
+        max_payload = cnx->remote_parameters.max_datagram_frame_size > SLIPSTREAM_DATAGRAM_FRAME_OVERHEAD
+            ? cnx->remote_parameters.max_datagram_frame_size - SLIPSTREAM_DATAGRAM_FRAME_OVERHEAD
+            : 0;
+    }
+    int usable_paths = 0;
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        picoquic_path_t *path_x = cnx->path[i];
+        if (path_x == NULL || path_x->path_is_demoted || path_x->path_abandon_sent ||
+            path_x->path_abandon_received || path_x->p_remote_cnxid == NULL) {
+            continue;
+        }
+        size_t overhead = SLIPSTREAM_DATAGRAM_PACKET_OVERHEAD + SLIPSTREAM_DATAGRAM_FRAME_OVERHEAD +
+            path_x->p_remote_cnxid->cnx_id.id_len;
+        size_t path_payload = path_x->send_mtu > overhead ? path_x->send_mtu - overhead : 0;
+        if (path_payload < max_payload) {
+            max_payload = path_payload;
+        }
+        usable_paths++;
+    }
+    return usable_paths > 0 ? max_payload : 0;
+}
+
+/* Queues one datagram. Returns 0 when queued, -1 when the connection cannot
+ * carry it now: not established, closing, too long, or `max_queued` frames
+ * already waiting. Dropping is the right answer for UDP in every case. */
+int slipstream_queue_datagram(picoquic_cnx_t *cnx, const uint8_t *bytes, size_t length, size_t max_queued) {
+    if (cnx == NULL || cnx->cnx_state < picoquic_state_server_false_start ||
+        cnx->cnx_state >= picoquic_state_disconnecting) {
+        return -1;
+    }
+    if (length > slipstream_datagram_max_payload(cnx)) {
+        return -1;
+    }
+    size_t queued = 0;
+    for (picoquic_misc_frame_header_t *frame = cnx->first_datagram; frame != NULL;
+         frame = frame->next_misc_frame) {
+        if (++queued >= max_queued) {
+            return -1;
+        }
+    }
+    if (picoquic_queue_datagram_frame(cnx, length, bytes) != 0) {
+        return -1;
+    }
+    picoquic_reinsert_by_wake_time(cnx->quic, cnx, picoquic_get_quic_time(cnx->quic));
+    return 0;
+}
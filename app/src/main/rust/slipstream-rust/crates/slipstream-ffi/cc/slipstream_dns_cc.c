@@ -0,0 +1,240 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <picoquic_internal.h>
+
+/* Query-rate controller for paths that go through a recursive resolver.
+ *
+ * Every QUIC packet on such a path is one DNS query, and what bounds the path
+ * is how many queries per second the resolver will answer, not how many bytes
+ * the network will carry. The controller keeps a query-rate target, measured
+ * in milli-queries per second, and adjusts it once per RTT epoch from the
+ * ratio of answered to timed-out queries and from RTT inflation, the usual
+ * signs that the resolver is queueing or rate limiting us. Pacing enforces
+ * the rate; the window only bounds the queries outstanding at once. */
+
+#define SLIPSTREAM_DNS_CC_RATE_INITIAL 20000 /* 20 qps */
+#define SLIPSTREAM_DNS_CC_RATE_MIN 2000 /* 2 qps */
+#define SLIPSTREAM_DNS_CC_RATE_MAX 1000000 /* 1000 qps */
+#define SLIPSTREAM_DNS_CC_RATE_STEP_MIN 1000 /* 1 qps */
+#define SLIPSTREAM_DNS_CC_EPOCH_MIN 20000 /* 20 ms */
+#define SLIPSTREAM_DNS_CC_MIN_SAMPLES 4
+#define SLIPSTREAM_DNS_CC_LOSS_PERCENT_MAX 10
+#define SLIPSTREAM_DNS_CC_RTT_INFLATION_MAX 2
+#define SLIPSTREAM_DNS_CC_BURST_QUERIES 4
+#define SLIPSTREAM_DNS_CC_WINDOW_HEADROOM 2
+#define SLIPSTREAM_DNS_CC_WINDOW_MIN_QUERIES 4
+
+typedef enum {
+    slipstream_dns_cc_alg_startup = 0,
+    slipstream_dns_cc_alg_steady = 1,
+    slipstream_dns_cc_alg_recovery = 2,
+} slipstream_dns_cc_alg_state_t;
+
+typedef struct st_slipstream_dns_cc_t {
+    slipstream_dns_cc_alg_state_t state;
+    uint64_t query_rate; /* milli-queries per second */
+    uint64_t epoch_start;
+    uint64_t answered;
+    uint64_t timed_out;
+    uint64_t recovery_end;
+} slipstream_dns_cc_t;
+
+static uint64_t slipstream_dns_cc_rtt(picoquic_path_t* path_x)
+{
+    return (path_x->smoothed_rtt > 0) ? path_x->smoothed_rtt : PICOQUIC_INITIAL_RTT;
+}
+
+static void slipstream_dns_cc_reset(slipstream_dns_cc_t* state, uint64_t current_time)
+{
+    memset(state, 0, sizeof(slipstream_dns_cc_t));
+    state->state = slipstream_dns_cc_alg_startup;
+    state->query_rate = SLIPSTREAM_DNS_CC_RATE_INITIAL;
+    state->epoch_start = current_time;
+}
+
+static void slipstream_dns_cc_start_epoch(slipstream_dns_cc_t* state, uint64_t current_time)
+{
+    state->epoch_start = current_time;
+    state->answered = 0;
+    state->timed_out = 0;
+}
+
+/* Publishes the rate as a pacing rate, and sizes the window so that about two
+ * RTTs worth of queries can be outstanding while the resolver answers. */
+static void slipstream_dns_cc_apply(picoquic_cnx_t* cnx, picoquic_path_t* path_x, slipstream_dns_cc_t* state)
+{
+    uint64_t send_mtu = (path_x->send_mtu > 0) ? path_x->send_mtu : PICOQUIC_INITIAL_MTU_IPV4;
+    double queries_per_second = (double)state->query_rate / 1000.0;
+    double window_queries = queries_per_second * (double)slipstream_dns_cc_rtt(path_x) / 1000000.0;
+    uint64_t cwin = (uint64_t)(window_queries * SLIPSTREAM_DNS_CC_WINDOW_HEADROOM * (double)send_mtu);
+
+    if (cwin < SLIPSTREAM_DNS_CC_WINDOW_MIN_QUERIES * send_mtu) {
+        cwin = SLIPSTREAM_DNS_CC_WINDOW_MIN_QUERIES * send_mtu;
+    }
+    path_x->cwin = cwin;
+    picoquic_update_pacing_rate(cnx, path_x, queries_per_second * (double)send_mtu,
+        SLIPSTREAM_DNS_CC_BURST_QUERIES * send_mtu);
+    path_x->is_cc_data_updated = 1;
+}
+
+static void slipstream_dns_cc_decrease(slipstream_dns_cc_t* state)
+{
+    state->query_rate -= state->query_rate / 4;
+    if (state->query_rate < SLIPSTREAM_DNS_CC_RATE_MIN) {
+        state->query_rate = SLIPSTREAM_DNS_CC_RATE_MIN;
+    }
+}
+
+static void slipstream_dns_cc_increase(slipstream_dns_cc_t* state)
+{
+    uint64_t step = state->query_rate;
+    if (state->state != slipstream_dns_cc_alg_startup) {
+        step = state->query_rate / 8;
+        if (step < SLIPSTREAM_DNS_CC_RATE_STEP_MIN) {
+            step = SLIPSTREAM_DNS_CC_RATE_STEP_MIN;
+        }
+    }
+    state->query_rate += step;
+    if (state->query_rate > SLIPSTREAM_DNS_CC_RATE_MAX) {
+        state->query_rate = SLIPSTREAM_DNS_CC_RATE_MAX;
+    }
+}
+
+/* Closes the current epoch once it spans an RTT and has enough samples. */
+static int slipstream_dns_cc_end_epoch(picoquic_path_t* path_x, slipstream_dns_cc_t* state, uint64_t current_time)
+{
+    uint64_t epoch_length = slipstream_dns_cc_rtt(path_x);
+    uint64_t elapsed = current_time - state->epoch_start;
+    uint64_t samples = state->answered + state->timed_out;
+
+    if (epoch_length < SLIPSTREAM_DNS_CC_EPOCH_MIN) {
+        epoch_length = SLIPSTREAM_DNS_CC_EPOCH_MIN;
+    }
+    if (current_time < state->epoch_start || elapsed < epoch_length || samples < SLIPSTREAM_DNS_CC_MIN_SAMPLES) {
+        return 0;
+    }
+
+    int rtt_inflated = path_x->rtt_min > 0 &&
+        path_x->smoothed_rtt > SLIPSTREAM_DNS_CC_RTT_INFLATION_MAX * path_x->rtt_min;
+    int lossy = state->timed_out * 100 > samples * SLIPSTREAM_DNS_CC_LOSS_PERCENT_MAX;
+
+    if (lossy || rtt_inflated) {
+        slipstream_dns_cc_decrease(state);
+        state->state = slipstream_dns_cc_alg_steady;
+    }
+    else {
+        /* Only probe upward if the epoch used at least half of its budget,
+         * so that an idle tunnel does not inflate the rate. */
+        double budget = (double)state->query_rate / 1000.0 * (double)elapsed / 1000000.0;
+        if ((double)samples * 2.0 >= budget) {
+            slipstream_dns_cc_increase(state);
+        }
+        if (state->state == slipstream_dns_cc_alg_recovery) {
+            state->state = slipstream_dns_cc_alg_steady;
+        }
+    }
+    slipstream_dns_cc_start_epoch(state, current_time);
+    return 1;
+}
+
+static void slipstream_dns_cc_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    slipstream_dns_cc_t* state = (slipstream_dns_cc_t*)malloc(sizeof(slipstream_dns_cc_t));
+    path_x->congestion_alg_state = (void*)state;
+    if (state != NULL) {
+        slipstream_dns_cc_reset(state, current_time);
+        slipstream_dns_cc_apply(cnx, path_x, state);
+    }
+}
+
+static void slipstream_dns_cc_notify(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    picoquic_per_ack_state_t* ack_state,
+    uint64_t current_time)
+{
+    slipstream_dns_cc_t* state = (slipstream_dns_cc_t*)path_x->congestion_alg_state;
+    if (state == NULL) {
+        return;
+    }
+
+    switch (notification) {
+    case picoquic_congestion_notification_acknowledgement:
+        if (ack_state != NULL && ack_state->nb_bytes_acknowledged > 0) {
+            uint64_t send_mtu = (path_x->send_mtu > 0) ? path_x->send_mtu : 1;
+            state->answered += (ack_state->nb_bytes_acknowledged + send_mtu - 1) / send_mtu;
+        }
+        if (slipstream_dns_cc_end_epoch(path_x, state, current_time)) {
+            slipstream_dns_cc_apply(cnx, path_x, state);
+        }
+        break;
+    case picoquic_congestion_notification_repeat:
+    case picoquic_congestion_notification_timeout:
+        state->timed_out++;
+        /* React to the first timeout right away, then at most once per RTT:
+         * the queries behind it were sent at the same rate. */
+        if (current_time >= state->recovery_end) {
+            slipstream_dns_cc_decrease(state);
+            state->state = slipstream_dns_cc_alg_recovery;
+            state->recovery_end = current_time + slipstream_dns_cc_rtt(path_x);
+            slipstream_dns_cc_start_epoch(state, current_time);
+            slipstream_dns_cc_apply(cnx, path_x, state);
+        }
+        break;
+    case picoquic_congestion_notification_spurious_repeat:
+        /* The resolver answered after all; the rate cut stands, the sample does not. */
+        if (state->timed_out > 0) {
+            state->timed_out--;
+        }
+        state->answered++;
+        break;
+    case picoquic_congestion_notification_rtt_measurement:
+        if (slipstream_dns_cc_end_epoch(path_x, state, current_time)) {
+            slipstream_dns_cc_apply(cnx, path_x, state);
+        }
+        break;
+    case picoquic_congestion_notification_reset:
+        slipstream_dns_cc_reset(state, current_time);
+        slipstream_dns_cc_apply(cnx, path_x, state);
+        break;
+    default:
+        /* ignore */
+        break;
+    }
+}
+
+static void slipstream_dns_cc_delete(picoquic_path_t* path_x)
+{
+    if (path_x->congestion_alg_state != NULL) {
+        free(path_x->congestion_alg_state);
+        path_x->congestion_alg_state = NULL;
+    }
+}
+
+static void slipstream_dns_cc_observe(picoquic_path_t* path_x, uint64_t* cc_state, uint64_t* cc_param)
+{
+    slipstream_dns_cc_t* state = (slipstream_dns_cc_t*)path_x->congestion_alg_state;
+    if (state == NULL) {
+        *cc_state = (uint64_t)slipstream_dns_cc_alg_startup;
+        *cc_param = 0;
+    } else {
+        *cc_state = (uint64_t)state->state;
+        *cc_param = state->query_rate;
+    }
+}
+
+#define picoquic_slipstream_dns_cc_ID "slipstream_dns"
+#define PICOQUIC_CC_ALGO_NUMBER_SLIPSTREAM_DNS 12
+
+picoquic_congestion_algorithm_t slipstream_dns_cc_algorithm_struct = {
+    picoquic_slipstream_dns_cc_ID, PICOQUIC_CC_ALGO_NUMBER_SLIPSTREAM_DNS,
+    slipstream_dns_cc_init,
+    slipstream_dns_cc_notify,
+    slipstream_dns_cc_delete,
+    slipstream_dns_cc_observe
+};
+
+picoquic_congestion_algorithm_t* slipstream_dns_cc_algorithm = &slipstream_dns_cc_algorithm_struct;
@@ -0,0 +1,514 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "picoquic.h"
+#include "picoquic_utils.h"
+#include "picoquic_packet_loop.h"
+#include "h3zero.h"
+#include "h3zero_common.h"
+
+/* DNS over HTTP/3 (RFC 8484 over RFC 9114).
+ *
+ * One QUIC connection to the DoH server is kept by a picoquic network thread
+ * and reopened on demand once it closes. Each query is a POST on its own
+ * request stream, so a burst of lookups shares the connection and none waits
+ * for another's answer. Callers block in slipstream_doh3_query(): the query
+ * is queued under the lock and the network thread is woken through its pipe,
+ * which opens the stream from the loop callback where picoquic may be used.
+ *
+ * A connection that closes before its handshake completes marks the server
+ * down for SLIPSTREAM_DOH3_RETRY_US, during which queries fail at once so
+ * the caller can fall back to DoH over HTTP/2 without waiting out a timeout. */
+
+#define SLIPSTREAM_DOH3_RETRY_US 30000000ull
+#define SLIPSTREAM_DOH3_IDLE_TIMEOUT_MS 30000
+#define SLIPSTREAM_DOH3_HANDSHAKE_TIMEOUT_US 3000000ull /* where UDP is blocked, give up soon */
+#define SLIPSTREAM_DOH3_HEADER_MAX 512
+#define SLIPSTREAM_DOH3_QUERY_MAX 65535
+
+typedef struct st_slipstream_doh3_query_t {
+    struct st_slipstream_doh3_query_t* next; /* queued, then in flight */
+    struct st_slipstream_doh3_query_t* previous; /* in flight only */
+    uint8_t* request;
+    size_t request_length;
+    uint8_t* answer;
+    size_t answer_max;
+    size_t answer_length;
+    h3zero_data_stream_state_t stream_state;
+    int result; /* 0 while pending, then the answer length or -1 */
+    int is_abandoned; /* the caller timed out, the network thread frees it */
+} slipstream_doh3_query_t;
+
+typedef struct st_slipstream_doh3_t {
+    picoquic_quic_t* quic;
+    picoquic_network_thread_ctx_t* thread_ctx;
+    picoquic_packet_loop_param_t param;
+    struct sockaddr_storage server;
+    char* authority;
+    char* path;
+    char* ticket_file;
+    /* Network thread only. */
+    picoquic_cnx_t* cnx;
+    slipstream_doh3_query_t* in_flight;
+    int is_cnx_ready;
+    /* Under lock. */
+    pthread_mutex_t lock;
+    pthread_cond_t answered;
+    slipstream_doh3_query_t* queued_first;
+    slipstream_doh3_query_t* queued_last;
+    uint64_t down_until;
+} slipstream_doh3_t;
+
+static void slipstream_doh3_query_free(slipstream_doh3_query_t* query)
+{
+    h3zero_delete_data_stream_state(&query->stream_state);
+    free(query->request);
+    free(query->answer);
+    free(query);
+}
+
+/* Hands the result to the waiting caller, or frees the query if it left. */
+static void slipstream_doh3_complete(slipstream_doh3_t* doh3, slipstream_doh3_query_t* query, int result)
+{
+    int is_abandoned;
+
+    pthread_mutex_lock(&doh3->lock);
+    query->result = result;
+    is_abandoned = query->is_abandoned;
+    pthread_cond_broadcast(&doh3->answered);
+    pthread_mutex_unlock(&doh3->lock);
+
+    if (is_abandoned) {
+        slipstream_doh3_query_free(query);
+    }
+}
+
+static void slipstream_doh3_unlink(slipstream_doh3_t* doh3, slipstream_doh3_query_t* query)
+{
+    if (query->previous != NULL) {
+        query->previous->next = query->next;
+    } else {
+        doh3->in_flight = query->next;
+    }
+    if (query->next != NULL) {
+        query->next->previous = query->previous;
+    }
+    query->next = NULL;
+    query->previous = NULL;
+}
+
+static void slipstream_doh3_finish_stream(slipstream_doh3_t* doh3, picoquic_cnx_t* cnx,
+    uint64_t stream_id, slipstream_doh3_query_t* query, int result)
+{
+    picoquic_unlink_app_stream_ctx(cnx, stream_id);
+    slipstream_doh3_unlink(doh3, query);
+    slipstream_doh3_complete(doh3, query, result);
+}
+
+/* Fails every query in flight on the connection, which is going away. */
+static void slipstream_doh3_fail_in_flight(slipstream_doh3_t* doh3)
+{
+    while (doh3->in_flight != NULL) {
+        slipstream_doh3_query_t* query = doh3->in_flight;
+        slipstream_doh3_unlink(doh3, query);
+        slipstream_doh3_complete(doh3, query, -1);
+    }
+}
+
+/* Feeds response bytes through the HTTP/3 frame parser and keeps the payload
+ * of DATA frames. Returns -1 on a protocol error or an oversized answer. */
+static int slipstream_doh3_receive(slipstream_doh3_query_t* query, uint8_t* bytes, size_t length)
+{
+    uint8_t* bytes_max = bytes + length;
+
+    while (bytes < bytes_max) {
+        uint64_t error_found = 0;
+        size_t available = 0;
+
+        bytes = h3zero_parse_data_stream(bytes, bytes_max, &query->stream_state, &available, &error_found);
+        if (bytes == NULL) {
+            return -1;
+        }
+        if (available > 0) {
+            if (query->answer_length + available > query->answer_max) {
+                return -1;
+            }
+            memcpy(query->answer + query->answer_length, bytes, available);
+            query->answer_length += available;
+            bytes += available;
+        }
+    }
+    return 0;
+}
+
+static int slipstream_doh3_callback(picoquic_cnx_t* cnx, uint64_t stream_id, uint8_t* bytes,
+    size_t length, picoquic_call_back_event_t fin_or_event, void* callback_ctx, void* v_stream_ctx)
+{
+    slipstream_doh3_t* doh3 = (slipstream_doh3_t*)callback_ctx;
+    slipstream_doh3_query_t* query = (slipstream_doh3_query_t*)v_stream_ctx;
+
+    switch (fin_or_event) {
+    case picoquic_callback_stream_data:
+    case picoquic_callback_stream_fin:
+        /* The server's control and QPACK streams carry nothing we act on. */
+        if (query == NULL) {
+            break;
+        }
+        if (length > 0 && slipstream_doh3_receive(query, bytes, length) != 0) {
+            picoquic_reset_stream(cnx, stream_id, H3ZERO_GENERAL_PROTOCOL_ERROR);
+            slipstream_doh3_finish_stream(doh3, cnx, stream_id, query, -1);
+        } else if (fin_or_event == picoquic_callback_stream_fin) {
+            int is_ok = query->stream_state.header_found &&
+                query->stream_state.header.status == 200 && query->answer_length > 0;
+            slipstream_doh3_finish_stream(doh3, cnx, stream_id, query,
+                is_ok ? (int)query->answer_length : -1);
+        }
+        break;
+    case picoquic_callback_stream_reset:
+    case picoquic_callback_stop_sending:
+        if (query != NULL) {
+            picoquic_reset_stream(cnx, stream_id, H3ZERO_REQUEST_CANCELLED);
+            slipstream_doh3_finish_stream(doh3, cnx, stream_id, query, -1);
+        }
+        break;
+    case picoquic_callback_ready:
+        doh3->is_cnx_ready = 1;
+        break;
+    case picoquic_callback_stateless_reset:
+    case picoquic_callback_close:
+    case picoquic_callback_application_close:
+        if (!doh3->is_cnx_ready) {
+            pthread_mutex_lock(&doh3->lock);
+            doh3->down_until = picoquic_current_time() + SLIPSTREAM_DOH3_RETRY_US;
+            pthread_mutex_unlock(&doh3->lock);
+        }
+        slipstream_doh3_fail_in_flight(doh3);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* Deletes a connection once picoquic is done with it; client connections
+ * are left to the application. */
+static void slipstream_doh3_reap(slipstream_doh3_t* doh3)
+{
+    if (doh3->cnx != NULL && picoquic_get_cnx_state(doh3->cnx) == picoquic_state_disconnected) {
+        slipstream_doh3_fail_in_flight(doh3);
+        picoquic_delete_cnx(doh3->cnx);
+        doh3->cnx = NULL;
+        doh3->is_cnx_ready = 0;
+    }
+}
+
+static int slipstream_doh3_connect(slipstream_doh3_t* doh3)
+{
+    picoquic_cnx_t* cnx = picoquic_create_cnx(doh3->quic, picoquic_null_connection_id,
+        picoquic_null_connection_id, (struct sockaddr*)&doh3->server, picoquic_current_time(),
+        0, doh3->authority, "h3", 1);
+
+    if (cnx == NULL) {
+        return -1;
+    }
+    picoquic_set_callback(cnx, slipstream_doh3_callback, doh3);
+    if (h3zero_protocol_init(cnx) != 0 || picoquic_start_client_cnx(cnx) != 0) {
+        picoquic_delete_cnx(cnx);
+        return -1;
+    }
+    doh3->cnx = cnx;
+    doh3->is_cnx_ready = 0;
+    return 0;
+}
+
+/* Opens a request stream for every queued query, connecting first if the
+ * last connection is gone. */
+static void slipstream_doh3_send_queued(slipstream_doh3_t* doh3)
+{
+    slipstream_doh3_query_t* query;
+
+    pthread_mutex_lock(&doh3->lock);
+    query = doh3->queued_first;
+    doh3->queued_first = NULL;
+    doh3->queued_last = NULL;
+    pthread_mutex_unlock(&doh3->lock);
+
+    if (query == NULL) {
+        return;
+    }
+
+    slipstream_doh3_reap(doh3);
+    if (doh3->cnx == NULL && slipstream_doh3_connect(doh3) != 0) {
+        while (query != NULL) {
+            slipstream_doh3_query_t* next = query->next;
+            query->next = NULL;
+            slipstream_doh3_complete(doh3, query, -1);
+            query = next;
+        }
+        return;
+    }
+
+    while (query != NULL) {
+        slipstream_doh3_query_t* next = query->next;
+        uint64_t stream_id = picoquic_get_next_local_stream_id(doh3->cnx, 0);
+
+        query->previous = NULL;
+        query->next = doh3->in_flight;
+        if (doh3->in_flight != NULL) {
+            doh3->in_flight->previous = query;
+        }
+        doh3->in_flight = query;
+
+        if (picoquic_add_to_stream_with_ctx(doh3->cnx, stream_id, query->request,
+                query->request_length, 1, query) != 0) {
+            slipstream_doh3_unlink(doh3, query);
+            slipstream_doh3_complete(doh3, query, -1);
+        }
+        query = next;
+    }
+}
+
+static int slipstream_doh3_loop_callback(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_argv)
+{
+    slipstream_doh3_t* doh3 = (slipstream_doh3_t*)callback_ctx;
+
+    (void)quic;
+    (void)callback_argv;
+
+    switch (cb_mode) {
+    case picoquic_packet_loop_wake_up:
+        slipstream_doh3_send_queued(doh3);
+        break;
+    case picoquic_packet_loop_after_receive:
+    case picoquic_packet_loop_after_send:
+        slipstream_doh3_reap(doh3);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* HEADERS frame for a POST of length bytes, then the DATA frame header. */
+static uint8_t* slipstream_doh3_request_head(slipstream_doh3_t* doh3, uint8_t* bytes,
+    uint8_t* bytes_max, size_t length)
+{
+    uint8_t block[SLIPSTREAM_DOH3_HEADER_MAX];
+    uint8_t* block_end = h3zero_create_post_header_frame_ex(block, block + sizeof(block),
+        (const uint8_t*)doh3->path, strlen(doh3->path), NULL, 0, doh3->authority,
+        h3zero_content_type_dns_message, NULL);
+
+    if (block_end == NULL) {
+        return NULL;
+    }
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, h3zero_frame_header)) == NULL ||
+        (bytes = picoquic_frames_varint_encode(bytes, bytes_max, block_end - block)) == NULL ||
+        bytes + (block_end - block) > bytes_max) {
+        return NULL;
+    }
+    memcpy(bytes, block, block_end - block);
+    bytes += block_end - block;
+
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, h3zero_frame_data)) == NULL) {
+        return NULL;
+    }
+    return picoquic_frames_varint_encode(bytes, bytes_max, length);
+}
+
+slipstream_doh3_t* slipstream_doh3_create(const struct sockaddr* server, const char* authority,
+    const char* path, const char* cert_root_file, const char* ticket_file)
+{
+    slipstream_doh3_t* doh3;
+    size_t server_length;
+    int ret = 0;
+
+    if (server == NULL || authority == NULL || path == NULL) {
+        return NULL;
+    }
+    if (server->sa_family == AF_INET) {
+        server_length = sizeof(struct sockaddr_in);
+    } else if (server->sa_family == AF_INET6) {
+        server_length = sizeof(struct sockaddr_in6);
+    } else {
+        return NULL;
+    }
+
+    doh3 = (slipstream_doh3_t*)calloc(1, sizeof(slipstream_doh3_t));
+    if (doh3 == NULL) {
+        return NULL;
+    }
+    memcpy(&doh3->server, server, server_length);
+    doh3->authority = strdup(authority);
+    doh3->path = strdup(path);
+    doh3->ticket_file = (ticket_file != NULL) ? strdup(ticket_file) : NULL;
+    pthread_mutex_init(&doh3->lock, NULL);
+    pthread_cond_init(&doh3->answered, NULL);
+
+    if (doh3->authority == NULL || doh3->path == NULL || (ticket_file != NULL && doh3->ticket_file == NULL)) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        doh3->quic = picoquic_create(1, NULL, NULL, cert_root_file, "h3", NULL, NULL, NULL, NULL, NULL,
+            picoquic_current_time(), NULL, doh3->ticket_file, NULL, 0);
+        if (doh3->quic == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        picoquic_set_default_idle_timeout(doh3->quic, SLIPSTREAM_DOH3_IDLE_TIMEOUT_MS);
+        picoquic_set_default_handshake_timeout(doh3->quic, SLIPSTREAM_DOH3_HANDSHAKE_TIMEOUT_US);
+        doh3->param.local_af = server->sa_family;
+        doh3->param.is_client = 1;
+        doh3->param.do_not_use_gso = 1;
+        doh3->thread_ctx = picoquic_start_network_thread(doh3->quic, &doh3->param,
+            slipstream_doh3_loop_callback, doh3, &ret);
+        if (doh3->thread_ctx == NULL && ret == 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret != 0) {
+        if (doh3->quic != NULL) {
+            picoquic_free(doh3->quic);
+        }
+        pthread_cond_destroy(&doh3->answered);
+        pthread_mutex_destroy(&doh3->lock);
+        free(doh3->ticket_file);
+        free(doh3->path);
+        free(doh3->authority);
+        free(doh3);
+        return NULL;
+    }
+    return doh3;
+}
+
+/* Resolves one DNS message. Returns the answer length, or -1 when the server
+ * is down, the request fails or no answer comes within timeout_us. */
+int slipstream_doh3_query(slipstream_doh3_t* doh3, const uint8_t* query_bytes, size_t query_length,
+    uint8_t* answer, size_t answer_max, uint64_t timeout_us)
+{
+    slipstream_doh3_query_t* query;
+    uint8_t head[SLIPSTREAM_DOH3_HEADER_MAX + 16];
+    uint8_t* head_end;
+    uint64_t deadline = picoquic_current_time() + timeout_us;
+    struct timespec until;
+    size_t head_length;
+    int result;
+
+    if (doh3 == NULL || query_length == 0 || query_length > SLIPSTREAM_DOH3_QUERY_MAX) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&doh3->lock);
+    result = doh3->down_until > picoquic_current_time();
+    pthread_mutex_unlock(&doh3->lock);
+    if (result) {
+        return -1;
+    }
+
+    head_end = slipstream_doh3_request_head(doh3, head, head + sizeof(head), query_length);
+    if (head_end == NULL) {
+        return -1;
+    }
+    head_length = head_end - head;
+
+    query = (slipstream_doh3_query_t*)calloc(1, sizeof(slipstream_doh3_query_t));
+    if (query == NULL) {
+        return -1;
+    }
+    query->request = (uint8_t*)malloc(head_length + query_length);
+    query->answer = (uint8_t*)malloc(answer_max);
+    if (query->request == NULL || query->answer == NULL) {
+        slipstream_doh3_query_free(query);
+        return -1;
+    }
+    memcpy(query->request, head, head_length);
+    memcpy(query->request + head_length, query_bytes, query_length);
+    query->request_length = head_length + query_length;
+    query->answer_max = answer_max;
+
+    pthread_mutex_lock(&doh3->lock);
+    if (doh3->queued_last != NULL) {
+        doh3->queued_last->next = query;
+    } else {
+        doh3->queued_first = query;
+    }
+    doh3->queued_last = query;
+    pthread_mutex_unlock(&doh3->lock);
+
+    if (picoquic_wake_up_network_thread(doh3->thread_ctx) != 0) {
+        /* The query stays queued and goes out with the next wake-up. */
+        DBG_PRINTF("%s", "DoH3 wake-up failed");
+    }
+
+    /* The deadline is in picoquic's wall clock, the wait in CLOCK_REALTIME. */
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += (time_t)(timeout_us / 1000000);
+    until.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&doh3->lock);
+    while (query->result == 0 && picoquic_current_time() < deadline) {
+        if (pthread_cond_timedwait(&doh3->answered, &doh3->lock, &until) != 0) {
+            break;
+        }
+    }
+    result = query->result;
+    if (result == 0) {
+        query->is_abandoned = 1;
+    }
+    pthread_mutex_unlock(&doh3->lock);
+
+    if (result == 0) {
+        return -1;
+    }
+    if (result > 0) {
+        memcpy(answer, query->answer, (size_t)result);
+    }
+    slipstream_doh3_query_free(query);
+    return result;
+}
+
+void slipstream_doh3_delete(slipstream_doh3_t* doh3)
+{
+    slipstream_doh3_query_t* query;
+
+    if (doh3 == NULL) {
+        return;
+    }
+
+    /* Stops the loop; nothing runs on the network thread past this point. */
+    picoquic_delete_network_thread(doh3->thread_ctx);
+
+    slipstream_doh3_fail_in_flight(doh3);
+    pthread_mutex_lock(&doh3->lock);
+    query = doh3->queued_first;
+    doh3->queued_first = NULL;
+    doh3->queued_last = NULL;
+    pthread_mutex_unlock(&doh3->lock);
+    while (query != NULL) {
+        slipstream_doh3_query_t* next = query->next;
+        slipstream_doh3_complete(doh3, query, -1);
+        query = next;
+    }
+
+    if (doh3->ticket_file != NULL) {
+        (void)picoquic_save_session_tickets(doh3->quic, doh3->ticket_file);
+    }
+    picoquic_free(doh3->quic);
+    pthread_cond_destroy(&doh3->answered);
+    pthread_mutex_destroy(&doh3->lock);
+    free(doh3->ticket_file);
+    free(doh3->path);
+    free(doh3->authority);
+    free(doh3);
+}
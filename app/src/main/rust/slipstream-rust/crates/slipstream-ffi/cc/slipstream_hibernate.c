@@ -0,0 +1,182 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <picoquic_internal.h>
+
+/* Idle connection trimming.
+ *
+ * picoquic only releases the packets it keeps for spurious loss detection when
+ * a later ACK moves the acknowledged time forward, so a connection that goes
+ * quiet after a loss holds those packets until it is deleted. The context's
+ * packet pool keeps every packet a burst ever allocated, up to
+ * PICOQUIC_MAX_PACKETS_IN_POOL per size class, and likewise for stream data
+ * nodes. On a server with many polling clients both add up to megabytes held
+ * for connections that send nothing.
+ *
+ * Trimming drops that memory without touching what the connection needs to
+ * resume: keys, connection IDs, stream offsets and data that is still
+ * unacknowledged or queued for repeat all stay in place. A late ACK for a
+ * dropped packet is no longer counted as spurious, which after seconds of
+ * silence is far past PICOQUIC_SPURIOUS_RETRANSMIT_DELAY_MAX anyway. */
+
+/* Idle tracking.
+ *
+ * The server finds the connections to trim or close from the context's idle
+ * lists instead of scanning every connection. Each connection it answers is
+ * moved to the end of the awake list with the time it was seen; trimming
+ * moves it to the asleep list, where it stays in the same order until it is
+ * seen again. Both lists are therefore oldest first, each pass only looks at
+ * the connections it acts on, and picoquic unlinks connections as it deletes
+ * them. Times must not go backwards. */
+
+#define SLIPSTREAM_IDLE_AWAKE 0
+#define SLIPSTREAM_IDLE_ASLEEP 1
+
+/* Notes that the connection was active at current_time. */
+void slipstream_idle_touch(picoquic_cnx_t* cnx, uint64_t current_time)
+{
+    if (cnx == NULL) {
+        return;
+    }
+    cnx->idle_last_seen = current_time;
+    if (cnx->idle_list != SLIPSTREAM_IDLE_AWAKE + 1 || cnx->idle_next != NULL) {
+        picoquic_idle_lists_remove(cnx);
+        picoquic_idle_lists_append(cnx, SLIPSTREAM_IDLE_AWAKE);
+    }
+}
+
+uint64_t slipstream_idle_last_seen(picoquic_cnx_t* cnx)
+{
+    return (cnx == NULL) ? 0 : cnx->idle_last_seen;
+}
+
+/* Moves the awake connection seen longest ago to the asleep list and returns
+ * it, if it was last seen at or before cutoff. */
+picoquic_cnx_t* slipstream_idle_next_to_trim(picoquic_quic_t* quic, uint64_t cutoff)
+{
+    picoquic_cnx_t* cnx = (quic == NULL) ? NULL : quic->idle_lists.first[SLIPSTREAM_IDLE_AWAKE];
+
+    if (cnx == NULL || cnx->idle_last_seen > cutoff) {
+        return NULL;
+    }
+    picoquic_idle_lists_remove(cnx);
+    picoquic_idle_lists_append(cnx, SLIPSTREAM_IDLE_ASLEEP);
+    return cnx;
+}
+
+/* Stops tracking the connection seen longest ago and returns it, if it was
+ * last seen at or before cutoff. */
+picoquic_cnx_t* slipstream_idle_next_to_close(picoquic_quic_t* quic, uint64_t cutoff)
+{
+    picoquic_cnx_t* awake;
+    picoquic_cnx_t* asleep;
+    picoquic_cnx_t* cnx;
+
+    if (quic == NULL) {
+        return NULL;
+    }
+    awake = quic->idle_lists.first[SLIPSTREAM_IDLE_AWAKE];
+    asleep = quic->idle_lists.first[SLIPSTREAM_IDLE_ASLEEP];
+    if (awake == NULL || (asleep != NULL && asleep->idle_last_seen < awake->idle_last_seen)) {
+        cnx = asleep;
+    }
+    else {
+        cnx = awake;
+    }
+    if (cnx == NULL || cnx->idle_last_seen > cutoff) {
+        return NULL;
+    }
+    picoquic_idle_lists_remove(cnx);
+    return cnx;
+}
+
+/* Number of tracked connections not trimmed since they were last seen. */
+size_t slipstream_idle_awake_count(picoquic_quic_t* quic)
+{
+    return (quic == NULL) ? 0 : quic->idle_lists.count[SLIPSTREAM_IDLE_AWAKE];
+}
+
+/* Number of tracked connections. */
+size_t slipstream_idle_count(picoquic_quic_t* quic)
+{
+    return (quic == NULL) ? 0 :
+        quic->idle_lists.count[SLIPSTREAM_IDLE_AWAKE] + quic->idle_lists.count[SLIPSTREAM_IDLE_ASLEEP];
+}
+
+static size_t slipstream_trim_retransmitted(picoquic_cnx_t* cnx, picoquic_packet_context_t* pkt_ctx)
+{
+    size_t nb_released = 0;
+
+    while (pkt_ctx->retransmitted_oldest != NULL) {
+        picoquic_dequeue_retransmitted_packet(cnx, pkt_ctx, pkt_ctx->retransmitted_oldest);
+        nb_released++;
+    }
+    return nb_released;
+}
+
+/* Releases the connection's spurious loss detection queues. Returns the
+ * number of packets released. */
+size_t slipstream_trim_idle_cnx(picoquic_cnx_t* cnx)
+{
+    size_t nb_released = 0;
+
+    if (cnx == NULL) {
+        return 0;
+    }
+    for (int pc = 0; pc < picoquic_nb_packet_context; pc++) {
+        nb_released += slipstream_trim_retransmitted(cnx, &cnx->pkt_ctx[pc]);
+    }
+    for (int path_id = 0; path_id < cnx->nb_paths; path_id++) {
+        if (cnx->path[path_id] != NULL) {
+            nb_released += slipstream_trim_retransmitted(cnx, &cnx->path[path_id]->pkt_ctx);
+        }
+    }
+    return nb_released;
+}
+
+static size_t slipstream_trim_pool_list(picoquic_quic_t* quic, picoquic_packet_t** first, int* nb_in_pool,
+    int nb_kept)
+{
+    size_t nb_freed = 0;
+
+    while (*nb_in_pool > nb_kept && *first != NULL) {
+        picoquic_packet_t* packet = *first;
+        *first = packet->packet_previous;
+        (*nb_in_pool)--;
+        quic->nb_packets_allocated--;
+        free(packet);
+        nb_freed++;
+    }
+    return nb_freed;
+}
+
+static size_t slipstream_trim_data_node_pool(picoquic_quic_t* quic, int nb_kept)
+{
+    size_t nb_freed = 0;
+
+    while (quic->nb_data_nodes_in_pool > nb_kept && quic->p_first_data_node != NULL) {
+        picoquic_stream_data_node_t* node = quic->p_first_data_node;
+        quic->p_first_data_node = node->next_stream_data;
+        quic->nb_data_nodes_in_pool--;
+        quic->nb_data_nodes_allocated--;
+        free(node);
+        nb_freed++;
+    }
+    return nb_freed;
+}
+
+/* Frees pooled packets and stream data nodes beyond nb_kept in each pool.
+ * Must run on the thread that owns the context. Returns the number of
+ * entries freed. */
+size_t slipstream_trim_packet_pool(picoquic_quic_t* quic, size_t nb_kept)
+{
+    int kept = (nb_kept > PICOQUIC_MAX_PACKETS_IN_POOL) ? PICOQUIC_MAX_PACKETS_IN_POOL : (int)nb_kept;
+
+    if (quic == NULL) {
+        return 0;
+    }
+    return slipstream_trim_pool_list(quic, &quic->p_first_packet, &quic->nb_packets_in_pool, kept) +
+        slipstream_trim_pool_list(quic, &quic->p_first_small_packet, &quic->nb_small_packets_in_pool, kept) +
+        slipstream_trim_data_node_pool(quic, kept);
+}
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <string.h>
 
 #include <picoquic_internal.h>
 
@@ -11,6 +12,11 @@ typedef enum {
 static slipstream_path_mode_t slipstream_default_path_mode = slipstream_path_mode_recursive;
 static picoquic_congestion_algorithm_t const* slipstream_cc_override = NULL;
 
+extern picoquic_congestion_algorithm_t* slipstream_dns_cc_algorithm;
+extern picoquic_congestion_algorithm_t* slipstream_bbr_cc_algorithm;
+void slipstream_telemetry_record(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification, uint64_t current_time);
+
 static slipstream_path_mode_t slipstream_normalize_mode(int mode)
 {
     if (mode == slipstream_path_mode_authoritative || mode == slipstream_path_mode_recursive) {
@@ -35,9 +41,9 @@ static picoquic_congestion_algorithm_t const* slipstream_select_cc(picoquic_path
     }
     slipstream_path_mode_t mode = slipstream_resolve_mode(path_x->slipstream_path_mode);
     if (mode == slipstream_path_mode_authoritative) {
-        return picoquic_bbr_algorithm;
+        return slipstream_bbr_cc_algorithm;
     }
-    return picoquic_dcubic_algorithm;
+    return slipstream_dns_cc_algorithm;
 }
 
 static void slipstream_mixed_cc_init(picoquic_cnx_t* cnx, picoquic_path_t* path_x, uint64_t current_time)
@@ -59,6 +65,7 @@ static void slipstream_mixed_cc_notify(
     if (alg != NULL && alg->alg_notify != NULL) {
         alg->alg_notify(cnx, path_x, notification, ack_state, current_time);
     }
+    slipstream_telemetry_record(cnx, path_x, notification, current_time);
 }
 
 static void slipstream_mixed_cc_delete(picoquic_path_t* path_x)
@@ -99,7 +106,12 @@ void slipstream_set_cc_override(const char* alg_name)
         slipstream_cc_override = NULL;
         return;
     }
-    picoquic_congestion_algorithm_t const* alg = picoquic_get_congestion_algorithm(alg_name);
+    picoquic_congestion_algorithm_t const* alg = NULL;
+    if (strcmp(alg_name, slipstream_bbr_cc_algorithm->congestion_algorithm_id) == 0) {
+        alg = slipstream_bbr_cc_algorithm;
+    } else {
+        alg = picoquic_get_congestion_algorithm(alg_name);
+    }
     slipstream_cc_override = alg;
 }
 
@@ -124,3 +136,34 @@ void slipstream_set_path_ack_delay(picoquic_cnx_t* cnx, int path_id, int disable
     }
     cnx->path[path_id]->slipstream_no_ack_delay = (disable != 0) ? 1 : 0;
 }
+
+void slipstream_set_path_ack_frequency(picoquic_cnx_t* cnx, int path_id, uint64_t packet_threshold,
+    uint64_t max_ack_delay_us)
+{
+    if (cnx == NULL || path_id < 0 || path_id >= cnx->nb_paths) {
+        return;
+    }
+    /* The peer sized its PTO for the delay we advertised; never wait longer. */
+    if (max_ack_delay_us > cnx->local_parameters.max_ack_delay) {
+        max_ack_delay_us = cnx->local_parameters.max_ack_delay;
+    }
+    picoquic_path_t* path_x = cnx->path[path_id];
+    path_x->slipstream_ack_gap = packet_threshold;
+    path_x->slipstream_ack_delay = max_ack_delay_us;
+}
+
+uint64_t slipstream_get_path_query_rate(picoquic_cnx_t* cnx, int path_id)
+{
+    if (cnx == NULL || path_id < 0 || path_id >= cnx->nb_paths) {
+        return 0;
+    }
+    picoquic_path_t* path_x = cnx->path[path_id];
+    if (cnx->congestion_alg != slipstream_mixed_cc_algorithm ||
+        slipstream_select_cc(path_x) != slipstream_dns_cc_algorithm) {
+        return 0;
+    }
+    uint64_t cc_state = 0;
+    uint64_t query_rate = 0;
+    slipstream_dns_cc_algorithm->alg_observe(path_x, &cc_state, &query_rate);
+    return query_rate;
+}
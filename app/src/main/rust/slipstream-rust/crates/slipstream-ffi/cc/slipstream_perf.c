@@ -0,0 +1,166 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <picoquic_internal.h>
+
+/* Aggregated performance counters.
+ *
+ * picoquic calls the context's perflog hook as each connection is deleted;
+ * picoquic's own performance_log.c keeps those records in memory until the
+ * context is idle and writes a CSV, which a server never is. Instead the hook
+ * folds the connection's counters into a per-context slot, and an update call
+ * from the owning thread publishes the slot's closed totals plus the counters
+ * of the live connections. Published totals only grow, so a reader on any
+ * thread can sum the slots and diff two sums for per-interval rates. RTTs go
+ * into a histogram on a log scale, four buckets per octave, rebuilt from the
+ * live connections at every update.
+ *
+ * Slots are process-wide: server workers each take the slot matching their
+ * worker ID, and the client uses slot 0. */
+
+#define SLIPSTREAM_PERF_SLOTS_MAX 256
+#define SLIPSTREAM_PERF_RTT_BUCKETS 64
+#define SLIPSTREAM_PERF_RTT_MIN_BITS 10 /* bucket 0 holds RTTs below 1024 us */
+#define SLIPSTREAM_PERF_RTT_SUB_BITS 2 /* layout mirrored by rtt_bucket_floor in src/runtime.rs */
+
+typedef struct st_slipstream_perf_totals_t {
+    uint64_t nb_connections; /* live at the last update */
+    uint64_t nb_closed;
+    uint64_t data_sent; /* stream bytes */
+    uint64_t data_received;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t retransmissions;
+    uint64_t spurious;
+    uint64_t answers_with_data;
+    uint64_t answers_empty;
+    uint64_t rtt_histogram[SLIPSTREAM_PERF_RTT_BUCKETS];
+} slipstream_perf_totals_t;
+
+#define SLIPSTREAM_PERF_FIELDS (sizeof(slipstream_perf_totals_t) / sizeof(uint64_t))
+
+typedef struct st_slipstream_perf_slot_t {
+    /* Written by the owning thread only. */
+    uint64_t base[SLIPSTREAM_PERF_FIELDS]; /* closed connections and answer counts */
+    /* Published copy, read from any thread. */
+    atomic_uint_fast64_t published[SLIPSTREAM_PERF_FIELDS];
+} slipstream_perf_slot_t;
+
+static slipstream_perf_slot_t slipstream_perf_slots[SLIPSTREAM_PERF_SLOTS_MAX];
+
+#define SLIPSTREAM_PERF_INDEX(field) (offsetof(slipstream_perf_totals_t, field) / sizeof(uint64_t))
+
+static void slipstream_perf_add_cnx(uint64_t* v, picoquic_cnx_t* cnx)
+{
+    v[SLIPSTREAM_PERF_INDEX(data_sent)] += cnx->data_sent;
+    v[SLIPSTREAM_PERF_INDEX(data_received)] += cnx->data_received;
+    v[SLIPSTREAM_PERF_INDEX(packets_sent)] += cnx->nb_packets_sent;
+    v[SLIPSTREAM_PERF_INDEX(packets_received)] += cnx->nb_packets_received;
+    v[SLIPSTREAM_PERF_INDEX(retransmissions)] += cnx->nb_retransmission_total;
+    v[SLIPSTREAM_PERF_INDEX(spurious)] += cnx->nb_spurious;
+}
+
+static size_t slipstream_perf_rtt_bucket(uint64_t rtt)
+{
+    int bits = 0;
+    size_t bucket;
+
+    if (rtt < (UINT64_C(1) << SLIPSTREAM_PERF_RTT_MIN_BITS)) {
+        return 0;
+    }
+    while ((rtt >> bits) > 1) {
+        bits++;
+    }
+    bucket = 1 + ((size_t)(bits - SLIPSTREAM_PERF_RTT_MIN_BITS) << SLIPSTREAM_PERF_RTT_SUB_BITS);
+    bucket += (size_t)((rtt >> (bits - SLIPSTREAM_PERF_RTT_SUB_BITS)) & ((1 << SLIPSTREAM_PERF_RTT_SUB_BITS) - 1));
+    return (bucket < SLIPSTREAM_PERF_RTT_BUCKETS) ? bucket : SLIPSTREAM_PERF_RTT_BUCKETS - 1;
+}
+
+static void slipstream_perf_publish(slipstream_perf_slot_t* slot, const uint64_t* v)
+{
+    for (size_t i = 0; i < SLIPSTREAM_PERF_FIELDS; i++) {
+        atomic_store_explicit(&slot->published[i], v[i], memory_order_relaxed);
+    }
+}
+
+static int slipstream_perf_record(picoquic_quic_t* quic, picoquic_cnx_t* cnx, int should_delete)
+{
+    slipstream_perf_slot_t* slot = (slipstream_perf_slot_t*)quic->v_perflog_ctx;
+
+    if (cnx != NULL && slot != NULL) {
+        slot->base[SLIPSTREAM_PERF_INDEX(nb_closed)]++;
+        slipstream_perf_add_cnx(slot->base, cnx);
+    }
+    if (should_delete) {
+        /* All connections are gone by now. The slot keeps its totals, with
+         * no live connections, and the context stops feeding it. */
+        if (slot != NULL) {
+            slipstream_perf_publish(slot, slot->base);
+        }
+        quic->perflog_fn = NULL;
+        quic->v_perflog_ctx = NULL;
+    }
+    return 0;
+}
+
+/* Attaches the collector to a context. Returns -1 if the slot is out of range
+ * or the context already has a performance log. */
+int slipstream_perf_enable(picoquic_quic_t* quic, size_t slot_index)
+{
+    if (quic == NULL || slot_index >= SLIPSTREAM_PERF_SLOTS_MAX || quic->perflog_fn != NULL) {
+        return -1;
+    }
+    quic->v_perflog_ctx = (void*)&slipstream_perf_slots[slot_index];
+    quic->perflog_fn = slipstream_perf_record;
+    return 0;
+}
+
+/* Counts DNS answers that carried a QUIC payload and answers that did not. */
+void slipstream_perf_count_answers(picoquic_quic_t* quic, uint64_t with_data, uint64_t empty)
+{
+    slipstream_perf_slot_t* slot = (quic == NULL) ? NULL : (slipstream_perf_slot_t*)quic->v_perflog_ctx;
+
+    if (slot != NULL && quic->perflog_fn == slipstream_perf_record) {
+        slot->base[SLIPSTREAM_PERF_INDEX(answers_with_data)] += with_data;
+        slot->base[SLIPSTREAM_PERF_INDEX(answers_empty)] += empty;
+    }
+}
+
+/* Publishes the context's totals. Must run on the thread that owns the context. */
+void slipstream_perf_update(picoquic_quic_t* quic)
+{
+    slipstream_perf_slot_t* slot = (quic == NULL) ? NULL : (slipstream_perf_slot_t*)quic->v_perflog_ctx;
+    uint64_t v[SLIPSTREAM_PERF_FIELDS];
+
+    if (slot == NULL || quic->perflog_fn != slipstream_perf_record) {
+        return;
+    }
+    memcpy(v, slot->base, sizeof(v));
+    for (picoquic_cnx_t* cnx = quic->cnx_list; cnx != NULL; cnx = cnx->next_in_table) {
+        v[SLIPSTREAM_PERF_INDEX(nb_connections)]++;
+        slipstream_perf_add_cnx(v, cnx);
+        if (cnx->path != NULL && cnx->path[0] != NULL && cnx->path[0]->smoothed_rtt > 0) {
+            v[SLIPSTREAM_PERF_INDEX(rtt_histogram) + slipstream_perf_rtt_bucket(cnx->path[0]->smoothed_rtt)]++;
+        }
+    }
+    slipstream_perf_publish(slot, v);
+}
+
+/* Sums the published totals of all slots. Fields may be torn across
+ * concurrent updates; each one is still a value some update published. */
+void slipstream_perf_read(slipstream_perf_totals_t* totals)
+{
+    uint64_t* v = (uint64_t*)totals;
+
+    if (totals == NULL) {
+        return;
+    }
+    memset(totals, 0, sizeof(slipstream_perf_totals_t));
+    for (size_t s = 0; s < SLIPSTREAM_PERF_SLOTS_MAX; s++) {
+        for (size_t i = 0; i < SLIPSTREAM_PERF_FIELDS; i++) {
+            v[i] += atomic_load_explicit(&slipstream_perf_slots[s].published[i], memory_order_relaxed);
+        }
+    }
+}
@@ -1,4 +1,36 @@
+#include <string.h>
 #include "picoquic_internal.h"
+#include "picoquic_lb.h"
+
+uint64_t slipstream_get_path_query_rate(picoquic_cnx_t* cnx, int path_id);
+picoquic_pmtu_discovery_status_enum picoquic_is_mtu_probe_needed(picoquic_cnx_t* cnx, picoquic_path_t* path_x);
+
+#define SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX 16
+
+/* Per-path congestion state, indexed by path ID in the snapshot. */
+typedef struct st_slipstream_path_snapshot_t {
+    uint64_t unique_path_id;
+    uint64_t cwin;
+    uint64_t bytes_in_transit;
+    uint64_t pacing_rate;
+    uint64_t smoothed_rtt;
+    uint64_t rtt_min;
+    uint64_t query_rate; /* milli-queries per second, 0 unless the DNS controller runs */
+    uint32_t is_usable; /* not demoted or abandoned */
+    uint32_t padding;
+} slipstream_path_snapshot_t;
+
+/* Everything the client poll loop reads from a connection, gathered in one
+ * FFI call per loop stage instead of one call per flag and per path. */
+typedef struct st_slipstream_cnx_snapshot_t {
+    uint64_t next_wake_time;
+    uint64_t max_streams_bidir_remote;
+    uint32_t flow_blocked;
+    uint32_t stream_blocked;
+    uint32_t has_ready_stream;
+    uint32_t nb_paths; /* entries filled in paths[], at most SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX */
+    slipstream_path_snapshot_t paths[SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX];
+} slipstream_cnx_snapshot_t;
 
 void slipstream_request_poll(picoquic_cnx_t *cnx) {
     if (cnx == NULL) {
@@ -21,6 +53,110 @@ int slipstream_has_ready_stream(picoquic_cnx_t *cnx) {
     return picoquic_find_ready_stream(cnx) != NULL ? 1 : 0;
 }
 
+static int slipstream_has_pending_path_work(picoquic_cnx_t* cnx, picoquic_path_t* path_x) {
+    if (path_x == NULL) {
+        return 0;
+    }
+    if (path_x->challenge_required || path_x->response_required || path_x->nat_challenge_required ||
+        path_x->is_multipath_probe_needed || path_x->is_pto_required || path_x->is_datagram_ready) {
+        return 1;
+    }
+    picoquic_packet_context_t* pkt_ctx = (cnx->is_multipath_enabled) ?
+        &path_x->pkt_ctx : &cnx->pkt_ctx[picoquic_packet_context_application];
+    return pkt_ctx->pending_first != NULL;
+}
+
+/* Whether picoquic_prepare_packet_ex on this path could produce a packet.
+ * Answers 0 only for a ready connection with nothing in flight, nothing to
+ * acknowledge and nothing queued: no stream or datagram data, control or
+ * repeated frames, flow control or CID updates, MTU probe, key rotation,
+ * keep-alive or timer due. Anything it does not know how to rule out
+ * answers 1, so the server can skip the full prepare for a poll only when
+ * it would find nothing to send. Every query the server answers has just delivered a
+ * packet on the connection, which keeps the idle timer from firing. */
+int slipstream_has_pending_send(picoquic_cnx_t *cnx, int path_id, uint64_t current_time) {
+    if (cnx == NULL || path_id < 0 || path_id >= cnx->nb_paths || cnx->path[path_id] == NULL) {
+        return 1;
+    }
+    picoquic_path_t* path_x = cnx->path[path_id];
+    if (cnx->cnx_state != picoquic_state_ready || !path_x->challenge_verified ||
+        cnx->recycle_sooner_needed || cnx->path_demotion_needed ||
+        (cnx->app_wake_time != 0 && cnx->app_wake_time <= current_time)) {
+        return 1;
+    }
+    if (cnx->first_misc_frame != NULL || cnx->first_datagram != NULL || cnx->is_datagram_ready ||
+        picoquic_first_data_repeat_packet(cnx) != NULL || picoquic_find_ready_stream(cnx) != NULL ||
+        picoquic_is_tls_stream_ready(cnx)) {
+        return 1;
+    }
+    if (cnx->flow_blocked || cnx->stream_blocked ||
+        cnx->is_ack_frequency_updated || cnx->is_preemptive_repeat_enabled ||
+        cnx->is_forced_probe_up_required || cnx->is_address_discovery_provider ||
+        (!cnx->client_mode && cnx->send_receive_bdp_frame)) {
+        return 1;
+    }
+
+    /* Same thresholds as the MAX_DATA, MAX_STREAM_DATA and MAX_STREAMS updates in the
+     * sender. Nothing else is queued here, so under the piggyback policy only
+     * urgent credit would be sent. */
+    int credit_urgent_only = cnx->quic->is_credit_piggyback_enabled;
+    if (picoquic_is_max_data_needed(cnx, credit_urgent_only) ||
+        (cnx->max_stream_data_needed && (!credit_urgent_only || picoquic_is_max_stream_data_urgent(cnx)))) {
+        return 1;
+    }
+    if (cnx->max_stream_id_bidir_local_computed + 2 * cnx->local_parameters.initial_max_stream_id_bidir >
+            cnx->max_stream_id_bidir_local ||
+        cnx->max_stream_id_unidir_local_computed + 2 * cnx->local_parameters.initial_max_stream_id_unidir >
+            cnx->max_stream_id_unidir_local) {
+        return 1;
+    }
+
+    if (cnx->keep_alive_interval != 0 && cnx->latest_progress_time + cnx->keep_alive_interval <= current_time) {
+        return 1;
+    }
+    if (cnx->nb_packets_sent - cnx->crypto_epoch_sequence > cnx->crypto_epoch_length_max &&
+        current_time > cnx->crypto_rotation_time_guard) {
+        return 1;
+    }
+    if (cnx->quic->local_cnxid_ttl != UINT64_MAX) {
+        return 1;
+    }
+    if (cnx->is_multipath_enabled &&
+        (cnx->max_path_id_local < cnx->next_path_id_in_lists + cnx->local_parameters.initial_max_path_id -
+            cnx->nb_local_cnxid_lists ||
+        (cnx->nb_local_cnxid_lists <= cnx->local_parameters.initial_max_path_id &&
+            cnx->next_path_id_in_lists <= cnx->max_path_id_remote))) {
+        return 1;
+    }
+    for (picoquic_local_cnxid_list_t* list = cnx->first_local_cnxid_list; list != NULL; list = list->next_list) {
+        if (list->nb_local_cnxid < (int)cnx->remote_parameters.active_connection_id_limit + list->nb_local_cnxid_expired &&
+            list->nb_local_cnxid <= PICOQUIC_NB_PATH_TARGET + list->nb_local_cnxid_expired) {
+            return 1;
+        }
+    }
+
+    if (picoquic_is_mtu_probe_needed(cnx, path_x) != picoquic_pmtu_discovery_not_needed) {
+        return 1;
+    }
+    for (int i = 0; i < cnx->nb_paths; i++) {
+        if (slipstream_has_pending_path_work(cnx, cnx->path[i])) {
+            return 1;
+        }
+    }
+    if (cnx->pkt_ctx[picoquic_packet_context_initial].pending_first != NULL ||
+        cnx->pkt_ctx[picoquic_packet_context_handshake].pending_first != NULL) {
+        return 1;
+    }
+
+    uint64_t next_wake_time = UINT64_MAX;
+    if (picoquic_is_ack_needed(cnx, current_time, &next_wake_time, picoquic_packet_context_application, 0) ||
+        picoquic_is_ack_needed(cnx, current_time, &next_wake_time, picoquic_packet_context_application, 1)) {
+        return 1;
+    }
+
+    return 0;
+}
+
 void slipstream_disable_ack_delay(picoquic_cnx_t *cnx) {
     if (cnx == NULL) {
         return;
@@ -28,23 +164,63 @@ void slipstream_disable_ack_delay(picoquic_cnx_t *cnx) {
     cnx->no_ack_delay = 1;
 }
 
+/* The client moved to another network: whatever was in flight on the old one
+ * is gone, and the retransmit timer of every path has backed off over the
+ * outage. Clearing the backoff makes the packets already overdue against the
+ * base timer go out again on the next prepare, so traffic resumes within a
+ * round trip instead of after the backed-off timeout. Congestion state, RTT
+ * estimates and the paths themselves stay as they are. */
+void slipstream_restart_loss_recovery(picoquic_cnx_t *cnx, uint64_t current_time) {
+    if (cnx == NULL) {
+        return;
+    }
+    for (int path_id = 0; path_id < cnx->nb_paths; path_id++) {
+        cnx->path[path_id]->nb_retransmit = 0;
+    }
+    picoquic_reinsert_by_wake_time(cnx->quic, cnx, current_time);
+}
+
+static int slipstream_path_matches_addr(picoquic_path_t* path_x, const struct sockaddr* addr_peer) {
+    if (path_x == NULL) {
+        return 0;
+    }
+    if (path_x->path_is_demoted || path_x->path_abandon_received || path_x->path_abandon_sent) {
+        return 0;
+    }
+    return picoquic_compare_addr((struct sockaddr*) &path_x->peer_addr, addr_peer) == 0;
+}
+
+/* Every DNS response is matched to its resolver path by peer address. The
+ * per-connection bins remember the last path found for an address hash. A
+ * hint is only trusted after checking that the path at that index is still
+ * the same path, still usable and still has that address, so path deletion,
+ * compaction, demotion and abandon invalidate it without any bookkeeping.
+ * A miss falls back to the scan, which also refills the bin. */
 int slipstream_find_path_id_by_addr(picoquic_cnx_t *cnx, const struct sockaddr* addr_peer) {
     if (cnx == NULL || addr_peer == NULL || addr_peer->sa_family == 0) {
         return -1;
     }
 
-    for (int path_id = 0; path_id < cnx->nb_paths; path_id++) {
-        picoquic_path_t* path_x = cnx->path[path_id];
-        if (path_x == NULL) {
-            continue;
+    int is_hashable = addr_peer->sa_family == AF_INET || addr_peer->sa_family == AF_INET6;
+    size_t bin = 0;
+    if (is_hashable) {
+        bin = (size_t)(picoquic_hash_addr(addr_peer) & (PICOQUIC_PATH_BY_ADDR_BINS - 1));
+        int path_id = cnx->slipstream_path_by_addr[bin].path_id;
+        if (path_id >= 0 && path_id < cnx->nb_paths &&
+            slipstream_path_matches_addr(cnx->path[path_id], addr_peer) &&
+            cnx->path[path_id]->unique_path_id == cnx->slipstream_path_by_addr[bin].unique_path_id) {
+            return path_id;
         }
-        if (path_x->path_is_demoted || path_x->path_abandon_received || path_x->path_abandon_sent) {
-            continue;
-        }
-        if (picoquic_compare_addr((struct sockaddr*) &path_x->peer_addr, addr_peer) != 0) {
-            continue;
+    }
+
+    for (int path_id = 0; path_id < cnx->nb_paths; path_id++) {
+        if (slipstream_path_matches_addr(cnx->path[path_id], addr_peer)) {
+            if (is_hashable) {
+                cnx->slipstream_path_by_addr[bin].path_id = path_id;
+                cnx->slipstream_path_by_addr[bin].unique_path_id = cnx->path[path_id]->unique_path_id;
+            }
+            return path_id;
         }
-        return path_id;
     }
 
     return -1;
@@ -68,10 +244,74 @@ int slipstream_get_path_id_from_unique(picoquic_cnx_t *cnx, uint64_t unique_path
     return path_id;
 }
 
+/* Largest packet the path is currently known to carry; 0 for an unknown path. */
+size_t slipstream_get_path_send_mtu(picoquic_cnx_t *cnx, int path_id) {
+    if (cnx == NULL || path_id < 0 || path_id >= cnx->nb_paths || cnx->path[path_id] == NULL) {
+        return 0;
+    }
+    return cnx->path[path_id]->send_mtu;
+}
+
 uint64_t slipstream_get_max_streams_bidir_remote(picoquic_cnx_t *cnx) {
-    if (cnx == NULL || cnx->remote_parameters_received == 0) {
+    /* While 0-RTT is available, the limit remembered from the session ticket applies. */
+    if (cnx == NULL || (cnx->remote_parameters_received == 0 && !picoquic_is_0rtt_available(cnx))) {
         return 0;
     }
     /* STREAM_RANK_FROM_ID is 1-based and returns stream count, not a zero-based index. */
     return STREAM_RANK_FROM_ID(cnx->max_stream_id_bidir_remote);
 }
+
+int slipstream_set_worker_cid(picoquic_quic_t *quic, uint8_t worker_id) {
+    picoquic_load_balancer_config_t lb_config;
+
+    if (quic == NULL) {
+        return -1;
+    }
+    /* Clear-text server ID in byte 1 of every local CID; see server shard routing. */
+    memset(&lb_config, 0, sizeof(lb_config));
+    lb_config.method = picoquic_load_balancer_cid_clear;
+    lb_config.server_id_length = 1;
+    lb_config.connection_id_length = quic->local_cnxid_length;
+    lb_config.server_id64 = worker_id;
+    return picoquic_lb_compat_cid_config(quic, &lb_config);
+}
+
+int slipstream_get_cnx_snapshot(picoquic_cnx_t *cnx, slipstream_cnx_snapshot_t* snapshot) {
+    if (snapshot == NULL) {
+        return -1;
+    }
+    memset(snapshot, 0, sizeof(slipstream_cnx_snapshot_t));
+    if (cnx == NULL) {
+        return -1;
+    }
+
+    snapshot->next_wake_time = cnx->next_wake_time;
+    snapshot->max_streams_bidir_remote = slipstream_get_max_streams_bidir_remote(cnx);
+    snapshot->flow_blocked = cnx->flow_blocked;
+    snapshot->stream_blocked = cnx->stream_blocked;
+    snapshot->has_ready_stream = picoquic_find_ready_stream(cnx) != NULL;
+
+    int nb_paths = cnx->nb_paths;
+    if (nb_paths > SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX) {
+        nb_paths = SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX;
+    }
+    for (int path_id = 0; path_id < nb_paths; path_id++) {
+        picoquic_path_t* path_x = cnx->path[path_id];
+        slipstream_path_snapshot_t* path_snapshot = &snapshot->paths[path_id];
+        if (path_x == NULL) {
+            continue;
+        }
+        path_snapshot->unique_path_id = path_x->unique_path_id;
+        path_snapshot->cwin = path_x->cwin;
+        path_snapshot->bytes_in_transit = path_x->bytes_in_transit;
+        path_snapshot->pacing_rate = path_x->pacing.rate;
+        path_snapshot->smoothed_rtt = path_x->smoothed_rtt;
+        path_snapshot->rtt_min = path_x->rtt_min;
+        path_snapshot->query_rate = slipstream_get_path_query_rate(cnx, path_id);
+        path_snapshot->is_usable =
+            !(path_x->path_is_demoted || path_x->path_abandon_received || path_x->path_abandon_sent);
+    }
+    snapshot->nb_paths = (uint32_t)nb_paths;
+
+    return 0;
+}
@@ -1,28 +1,78 @@
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 #include <picoquic_internal.h>
 
+void slipstream_telemetry_record(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification, uint64_t current_time);
+
+extern picoquic_congestion_algorithm_t* slipstream_server_cc_algorithm;
+
+/* Authoritative server congestion control.
+ *
+ * The server answers every query as soon as it arrives; when this controller
+ * holds a path back, the answer simply carries no QUIC payload. By default
+ * nothing is held back. Once an egress budget is set, the budget is split into
+ * weighted byte-rate shares among the paths that were active in the current or
+ * previous epoch, and each path is paced at its share, so one client polling
+ * hard cannot take the upstream bandwidth and CPU that the other answers queue
+ * behind. The budget is process-wide: worker threads add the weight of their
+ * active paths to a shared per-epoch counter, tagged with the epoch number so
+ * that the first writer of a new epoch restarts the count. */
+
+#define SLIPSTREAM_SERVER_CC_EPOCH_US 250000 /* 250 ms */
+#define SLIPSTREAM_SERVER_CC_WEIGHT_UNIT 256 /* weight of a single-path connection */
+#define SLIPSTREAM_SERVER_CC_WEIGHT_BITS 40
+#define SLIPSTREAM_SERVER_CC_WEIGHT_MASK ((UINT64_C(1) << SLIPSTREAM_SERVER_CC_WEIGHT_BITS) - 1)
+#define SLIPSTREAM_SERVER_CC_TAG_MASK ((UINT64_C(1) << (64 - SLIPSTREAM_SERVER_CC_WEIGHT_BITS)) - 1)
+#define SLIPSTREAM_SERVER_CC_RATE_MIN_PACKETS 4 /* per second, so handshakes and ACKs progress */
+#define SLIPSTREAM_SERVER_CC_QUANTUM_PACKETS 8
+
 typedef enum {
     slipstream_server_cc_alg_none = 0,
+    slipstream_server_cc_alg_shared = 1,
 } slipstream_server_cc_alg_state_t;
 
 typedef struct st_slipstream_server_cc_t {
     slipstream_server_cc_alg_state_t state;
+    uint64_t weight; /* connection weight, in SLIPSTREAM_SERVER_CC_WEIGHT_UNIT */
+    uint64_t active_epoch;
+    uint64_t share; /* bytes per second while shared */
 } slipstream_server_cc_t;
 
-static void slipstream_server_cc_init(picoquic_cnx_t * cnx, picoquic_path_t* path_x, uint64_t current_time)
+static atomic_uint_fast64_t slipstream_server_cc_budget; /* bytes per second, 0 = unlimited */
+static atomic_uint_fast64_t slipstream_server_cc_epoch_weight[2];
+
+static void slipstream_server_cc_add_weight(uint64_t epoch, uint64_t weight)
 {
-    (void)cnx;
-    (void)current_time;
-    slipstream_server_cc_t* state = (slipstream_server_cc_t*)malloc(sizeof(slipstream_server_cc_t));
-    if (state != NULL) {
-        state->state = slipstream_server_cc_alg_none;
+    atomic_uint_fast64_t* slot = &slipstream_server_cc_epoch_weight[epoch & 1];
+    uint64_t tag = epoch & SLIPSTREAM_SERVER_CC_TAG_MASK;
+    uint64_t old = atomic_load_explicit(slot, memory_order_relaxed);
+    uint64_t next;
+
+    do {
+        if ((old >> SLIPSTREAM_SERVER_CC_WEIGHT_BITS) == tag) {
+            next = old + weight;
+        } else {
+            next = (tag << SLIPSTREAM_SERVER_CC_WEIGHT_BITS) | weight;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(slot, &old, next,
+        memory_order_relaxed, memory_order_relaxed));
+}
+
+static uint64_t slipstream_server_cc_epoch_total(uint64_t epoch)
+{
+    uint64_t value = atomic_load_explicit(&slipstream_server_cc_epoch_weight[epoch & 1], memory_order_relaxed);
+    if ((value >> SLIPSTREAM_SERVER_CC_WEIGHT_BITS) != (epoch & SLIPSTREAM_SERVER_CC_TAG_MASK)) {
+        return 0;
     }
-    path_x->congestion_alg_state = (void*)state;
+    return value & SLIPSTREAM_SERVER_CC_WEIGHT_MASK;
+}
 
-    /* Disable congestion control/pacing limits for authoritative server mode. */
-    /* Keep packet_time_* non-zero to avoid zero-interval pacing paths. */
+/* Keep packet_time_* non-zero to avoid zero-interval pacing paths. */
+static void slipstream_server_cc_set_unlimited(picoquic_path_t* path_x)
+{
     path_x->cwin = UINT64_MAX;
     path_x->pacing.rate = UINT64_MAX;
     path_x->pacing.packet_time_nanosec = 1;
@@ -32,6 +82,81 @@ static void slipstream_server_cc_init(picoquic_cnx_t * cnx, picoquic_path_t* pat
     path_x->is_cc_data_updated = 1;
 }
 
+static void slipstream_server_cc_apply(picoquic_cnx_t* cnx, picoquic_path_t* path_x,
+    slipstream_server_cc_t* state, uint64_t current_time)
+{
+    uint64_t budget = atomic_load_explicit(&slipstream_server_cc_budget, memory_order_relaxed);
+
+    path_x->cwin = UINT64_MAX;
+    if (budget == 0) {
+        if (state->state != slipstream_server_cc_alg_none) {
+            state->state = slipstream_server_cc_alg_none;
+            state->share = 0;
+            slipstream_server_cc_set_unlimited(path_x);
+        }
+        return;
+    }
+
+    /* A connection's paths split its weight, so multipath does not buy extra shares. */
+    uint64_t epoch = current_time / SLIPSTREAM_SERVER_CC_EPOCH_US;
+    uint64_t nb_paths = (cnx->nb_paths > 0) ? (uint64_t)cnx->nb_paths : 1;
+    uint64_t path_weight = state->weight / nb_paths;
+    if (path_weight == 0) {
+        path_weight = 1;
+    }
+    if (state->active_epoch != epoch) {
+        slipstream_server_cc_add_weight(epoch, path_weight);
+        state->active_epoch = epoch;
+    }
+
+    /* The current epoch is still filling up; the previous one is complete. */
+    uint64_t total = slipstream_server_cc_epoch_total(epoch);
+    uint64_t previous = (epoch > 0) ? slipstream_server_cc_epoch_total(epoch - 1) : 0;
+    if (previous > total) {
+        total = previous;
+    }
+    if (total < path_weight) {
+        total = path_weight;
+    }
+
+    uint64_t send_mtu = (path_x->send_mtu > 0) ? path_x->send_mtu : PICOQUIC_INITIAL_MTU_IPV4;
+    uint64_t share = (uint64_t)((double)budget * (double)path_weight / (double)total);
+    if (share < SLIPSTREAM_SERVER_CC_RATE_MIN_PACKETS * send_mtu) {
+        share = SLIPSTREAM_SERVER_CC_RATE_MIN_PACKETS * send_mtu;
+    }
+
+    /* Shares move a little with every epoch; only repace on a real change. */
+    uint64_t delta = (share > state->share) ? share - state->share : state->share - share;
+    if (state->state != slipstream_server_cc_alg_shared || delta > state->share / 8) {
+        state->state = slipstream_server_cc_alg_shared;
+        state->share = share;
+        picoquic_update_pacing_rate(cnx, path_x, (double)share,
+            SLIPSTREAM_SERVER_CC_QUANTUM_PACKETS * send_mtu);
+        path_x->is_cc_data_updated = 1;
+    }
+}
+
+static void slipstream_server_cc_init(picoquic_cnx_t * cnx, picoquic_path_t* path_x, uint64_t current_time)
+{
+    slipstream_server_cc_t* state = (slipstream_server_cc_t*)malloc(sizeof(slipstream_server_cc_t));
+    path_x->congestion_alg_state = (void*)state;
+
+    /* Disable congestion control/pacing limits until a budget is shared out. */
+    slipstream_server_cc_set_unlimited(path_x);
+    if (state != NULL) {
+        state->state = slipstream_server_cc_alg_none;
+        state->weight = SLIPSTREAM_SERVER_CC_WEIGHT_UNIT;
+        state->active_epoch = UINT64_MAX;
+        state->share = 0;
+        /* New paths inherit the connection weight from the default path. */
+        if (cnx->path[0] != NULL && cnx->path[0] != path_x && cnx->path[0]->congestion_alg_state != NULL &&
+            cnx->congestion_alg == slipstream_server_cc_algorithm) {
+            state->weight = ((slipstream_server_cc_t*)cnx->path[0]->congestion_alg_state)->weight;
+        }
+        slipstream_server_cc_apply(cnx, path_x, state, current_time);
+    }
+}
+
 static void slipstream_server_cc_notify(
     picoquic_cnx_t* cnx,
     picoquic_path_t* path_x,
@@ -39,12 +164,15 @@ static void slipstream_server_cc_notify(
     picoquic_per_ack_state_t * ack_state,
     uint64_t current_time)
 {
-    (void)cnx;
-    (void)notification;
+    slipstream_server_cc_t* state = (slipstream_server_cc_t*)path_x->congestion_alg_state;
     (void)ack_state;
-    (void)current_time;
     path_x->is_cc_data_updated = 1;
-    path_x->cwin = UINT64_MAX;
+    if (state != NULL) {
+        slipstream_server_cc_apply(cnx, path_x, state, current_time);
+    } else {
+        path_x->cwin = UINT64_MAX;
+    }
+    slipstream_telemetry_record(cnx, path_x, notification, current_time);
 }
 
 static void slipstream_server_cc_delete(picoquic_path_t* path_x)
@@ -60,10 +188,11 @@ static void slipstream_server_cc_observe(picoquic_path_t* path_x, uint64_t* cc_s
     slipstream_server_cc_t* state = (slipstream_server_cc_t*)path_x->congestion_alg_state;
     if (state == NULL) {
         *cc_state = (uint64_t)slipstream_server_cc_alg_none;
+        *cc_param = UINT64_MAX;
     } else {
         *cc_state = (uint64_t)state->state;
+        *cc_param = (state->state == slipstream_server_cc_alg_shared) ? state->share : UINT64_MAX;
     }
-    *cc_param = UINT64_MAX;
 }
 
 #define picoquic_slipstream_server_cc_ID "slipstream_server"
@@ -78,3 +207,28 @@ picoquic_congestion_algorithm_t slipstream_server_cc_algorithm_struct = {
 };
 
 picoquic_congestion_algorithm_t* slipstream_server_cc_algorithm = &slipstream_server_cc_algorithm_struct;
+
+/* Sets the process-wide egress budget in bytes per second; 0 disables sharing.
+ * Paths pick up the change at their next congestion notification. */
+void slipstream_server_cc_set_egress_budget(uint64_t bytes_per_second)
+{
+    atomic_store_explicit(&slipstream_server_cc_budget, bytes_per_second, memory_order_relaxed);
+}
+
+/* Sets a connection's relative share of the egress budget; 1 is the default. */
+void slipstream_server_cc_set_weight(picoquic_cnx_t* cnx, uint32_t weight)
+{
+    if (cnx == NULL || cnx->congestion_alg != slipstream_server_cc_algorithm) {
+        return;
+    }
+    if (weight == 0) {
+        weight = 1;
+    }
+    for (int path_id = 0; path_id < cnx->nb_paths; path_id++) {
+        picoquic_path_t* path_x = cnx->path[path_id];
+        if (path_x != NULL && path_x->congestion_alg_state != NULL) {
+            ((slipstream_server_cc_t*)path_x->congestion_alg_state)->weight =
+                (uint64_t)weight * SLIPSTREAM_SERVER_CC_WEIGHT_UNIT;
+        }
+    }
+}
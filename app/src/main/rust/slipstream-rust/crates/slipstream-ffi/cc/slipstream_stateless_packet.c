@@ -2,17 +2,6 @@
 #include <picoquic_internal.h>
 #include <tls_api.h>
 
-static int slipstream_cid_equal(const picoquic_connection_id_t* a,
-                                const picoquic_connection_id_t* b) {
-    if (a->id_len != b->id_len) {
-        return 0;
-    }
-    if (a->id_len == 0) {
-        return 1;
-    }
-    return memcmp(a->id, b->id, a->id_len) == 0;
-}
-
 static int slipstream_parse_packet_header(picoquic_quic_t* quic,
                                           const uint8_t* packet,
                                           size_t packet_len,
@@ -24,22 +13,6 @@ static int slipstream_parse_packet_header(picoquic_quic_t* quic,
                quic, packet, packet_len, (struct sockaddr*)&dummy_addr, ph, &cnx, 1) == 0;
 }
 
-static int slipstream_stateless_reset_matches(picoquic_quic_t* quic,
-                                              picoquic_stateless_packet_t* sp,
-                                              const picoquic_connection_id_t* dest_cid) {
-    if (sp->length < PICOQUIC_RESET_SECRET_SIZE) {
-        return 0;
-    }
-    uint8_t reset_secret[PICOQUIC_RESET_SECRET_SIZE];
-    picoquic_connection_id_t cid = *dest_cid;
-    if (picoquic_create_cnxid_reset_secret(quic, &cid, reset_secret) != 0) {
-        return 0;
-    }
-    return memcmp(sp->bytes + sp->length - PICOQUIC_RESET_SECRET_SIZE,
-                  reset_secret,
-                  PICOQUIC_RESET_SECRET_SIZE) == 0;
-}
-
 int slipstream_take_stateless_packet_for_cid(picoquic_quic_t* quic,
                                              const uint8_t* packet,
                                              size_t packet_len,
@@ -62,53 +35,21 @@ int slipstream_take_stateless_packet_for_cid(picoquic_quic_t* quic,
         return 0;
     }
 
+    /* picoquic indexes queued packets by the peer CID they answer: the SCID of a long
+     * header query, the DCID of a short header one. Stateless resets are indexed by the
+     * CID their reset secret is derived from, so they match the same DCID. */
     int incoming_is_long = (packet[0] & 0x80) != 0;
-    picoquic_stateless_packet_t* prev = NULL;
-    picoquic_stateless_packet_t* sp = quic->pending_stateless_packet;
-    while (sp != NULL) {
-        int matches = 0;
-        if (sp->length > 0) {
-            int sp_is_long = (sp->bytes[0] & 0x80) != 0;
-            if (sp_is_long) {
-                if (incoming_is_long) {
-                    picoquic_packet_header sp_ph;
-                    if (slipstream_parse_packet_header(quic, sp->bytes, sp->length, &sp_ph) &&
-                        slipstream_cid_equal(&sp_ph.dest_cnx_id, &ph.srce_cnx_id)) {
-                        matches = 1;
-                    }
-                }
-            } else {
-                if (!incoming_is_long) {
-                    picoquic_packet_header sp_ph;
-                    if (slipstream_parse_packet_header(quic, sp->bytes, sp->length, &sp_ph) &&
-                        slipstream_cid_equal(&sp_ph.dest_cnx_id, &ph.dest_cnx_id)) {
-                        matches = 1;
-                    }
-                    if (!matches &&
-                        slipstream_stateless_reset_matches(quic, sp, &ph.dest_cnx_id)) {
-                        matches = 1;
-                    }
-                }
-            }
-        }
-
-        if (matches) {
-            if (sp->length > out_capacity) {
-                return -1;
-            }
-            memcpy(out_bytes, sp->bytes, sp->length);
-            *out_len = sp->length;
-            if (prev == NULL) {
-                quic->pending_stateless_packet = sp->next_packet;
-            } else {
-                prev->next_packet = sp->next_packet;
-            }
-            picoquic_delete_stateless_packet(sp);
-            return 1;
-        }
-        prev = sp;
-        sp = sp->next_packet;
+    picoquic_stateless_packet_t* sp = picoquic_find_stateless_packet_by_cid(
+        quic, incoming_is_long ? &ph.srce_cnx_id : &ph.dest_cnx_id, incoming_is_long);
+    if (sp == NULL) {
+        return 0;
     }
-
-    return 0;
+    if (sp->length > out_capacity) {
+        return -1;
+    }
+    memcpy(out_bytes, sp->bytes, sp->length);
+    *out_len = sp->length;
+    picoquic_remove_stateless_packet(quic, sp);
+    picoquic_delete_stateless_packet(sp);
+    return 1;
 }
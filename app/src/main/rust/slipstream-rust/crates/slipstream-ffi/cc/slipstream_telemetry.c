@@ -0,0 +1,148 @@
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <picoquic_internal.h>
+
+/* Per-path congestion telemetry.
+ *
+ * The mixed and server congestion controllers record a sample from
+ * alg_notify at most once per sampling interval per path. Samples go into a
+ * fixed-size bounded queue (Vyukov's MPMC ring): server workers may record
+ * concurrently and the drain side runs on another thread, so each cell
+ * carries a sequence number instead of the ring taking a lock. When the ring
+ * is full new samples are dropped and counted, so a consumer that stops
+ * draining costs nothing but the counter. Sampling is off until an interval
+ * is set; the disabled path is a single relaxed load. */
+
+#define SLIPSTREAM_TELEMETRY_RING_SIZE 2048 /* must be a power of 2 */
+
+typedef struct st_slipstream_telemetry_sample_t {
+    uint64_t time_us;
+    uint64_t unique_path_id;
+    uint64_t cwin;
+    uint64_t pacing_rate;
+    uint64_t rtt_min;
+    uint64_t smoothed_rtt;
+    uint64_t bytes_in_transit;
+    uint64_t nb_losses;
+    uint64_t nb_timer_losses;
+    uint64_t nb_spurious;
+    uint64_t packets_sent; /* one DNS query per packet: the poll cadence */
+    uint32_t notification;
+    uint32_t path_mode;
+} slipstream_telemetry_sample_t;
+
+/* The cell sequence is stored relative to the cell index, so the zeroed
+ * ring is already in its initial state: cell i expects position i. */
+typedef struct st_slipstream_telemetry_cell_t {
+    atomic_size_t sequence;
+    slipstream_telemetry_sample_t sample;
+} slipstream_telemetry_cell_t;
+
+static slipstream_telemetry_cell_t slipstream_telemetry_ring[SLIPSTREAM_TELEMETRY_RING_SIZE];
+static atomic_size_t slipstream_telemetry_head;
+static atomic_size_t slipstream_telemetry_tail;
+static atomic_uint_fast64_t slipstream_telemetry_interval;
+static atomic_uint_fast64_t slipstream_telemetry_nb_dropped;
+
+static int slipstream_telemetry_push(const slipstream_telemetry_sample_t* sample)
+{
+    size_t pos = atomic_load_explicit(&slipstream_telemetry_head, memory_order_relaxed);
+    for (;;) {
+        size_t index = pos & (SLIPSTREAM_TELEMETRY_RING_SIZE - 1);
+        slipstream_telemetry_cell_t* cell = &slipstream_telemetry_ring[index];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire) + index;
+        intptr_t diff = (intptr_t)(sequence - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&slipstream_telemetry_head, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed)) {
+                cell->sample = *sample;
+                atomic_store_explicit(&cell->sequence, pos + 1 - index, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&slipstream_telemetry_head, memory_order_relaxed);
+        }
+    }
+}
+
+static int slipstream_telemetry_pop(slipstream_telemetry_sample_t* sample)
+{
+    size_t pos = atomic_load_explicit(&slipstream_telemetry_tail, memory_order_relaxed);
+    for (;;) {
+        size_t index = pos & (SLIPSTREAM_TELEMETRY_RING_SIZE - 1);
+        slipstream_telemetry_cell_t* cell = &slipstream_telemetry_ring[index];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire) + index;
+        intptr_t diff = (intptr_t)(sequence - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&slipstream_telemetry_tail, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed)) {
+                *sample = cell->sample;
+                atomic_store_explicit(&cell->sequence,
+                    pos + SLIPSTREAM_TELEMETRY_RING_SIZE - index, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&slipstream_telemetry_tail, memory_order_relaxed);
+        }
+    }
+}
+
+void slipstream_telemetry_record(
+    picoquic_cnx_t* cnx,
+    picoquic_path_t* path_x,
+    picoquic_congestion_notification_t notification,
+    uint64_t current_time)
+{
+    uint64_t interval = atomic_load_explicit(&slipstream_telemetry_interval, memory_order_relaxed);
+    if (interval == 0 || current_time < path_x->slipstream_telemetry_next_time) {
+        return;
+    }
+    path_x->slipstream_telemetry_next_time = current_time + interval;
+
+    slipstream_telemetry_sample_t sample;
+    sample.time_us = current_time;
+    sample.unique_path_id = path_x->unique_path_id;
+    sample.cwin = path_x->cwin;
+    sample.pacing_rate = path_x->pacing.rate;
+    sample.rtt_min = path_x->rtt_min;
+    sample.smoothed_rtt = path_x->smoothed_rtt;
+    sample.bytes_in_transit = path_x->bytes_in_transit;
+    sample.nb_losses = path_x->nb_losses_found;
+    sample.nb_timer_losses = path_x->nb_timer_losses;
+    sample.nb_spurious = path_x->nb_spurious;
+    sample.packets_sent = picoquic_get_sequence_number(cnx, path_x, picoquic_packet_context_application);
+    sample.notification = (uint32_t)notification;
+    sample.path_mode = path_x->slipstream_path_mode;
+
+    if (slipstream_telemetry_push(&sample) != 0) {
+        atomic_fetch_add_explicit(&slipstream_telemetry_nb_dropped, 1, memory_order_relaxed);
+    }
+}
+
+void slipstream_telemetry_set_interval(uint64_t interval_us)
+{
+    atomic_store_explicit(&slipstream_telemetry_interval, interval_us, memory_order_relaxed);
+}
+
+size_t slipstream_telemetry_drain(slipstream_telemetry_sample_t* samples, size_t max_samples)
+{
+    size_t nb_samples = 0;
+    if (samples == NULL) {
+        return 0;
+    }
+    while (nb_samples < max_samples && slipstream_telemetry_pop(&samples[nb_samples]) == 0) {
+        nb_samples++;
+    }
+    return nb_samples;
+}
+
+uint64_t slipstream_telemetry_dropped(void)
+{
+    return atomic_load_explicit(&slipstream_telemetry_nb_dropped, memory_order_relaxed);
+}
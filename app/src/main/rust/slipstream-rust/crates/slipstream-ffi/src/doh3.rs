@@ -0,0 +1,98 @@
+//! DNS over HTTP/3 upstream, backed by `cc/slipstream_doh3.c`.
+//!
+//! One QUIC connection to the DoH server carries every query on its own
+//! request stream, so lookups do not queue behind each other as they do on a
+//! single HTTP/2 connection that loses a packet.
+
+use crate::picoquic::{
+    slipstream_doh3_create, slipstream_doh3_delete, slipstream_doh3_query, slipstream_doh3_t,
+};
+use crate::runtime::socket_addr_to_storage;
+use std::ffi::CString;
+use std::net::SocketAddr;
+use std::path::Path;
+use std::time::Duration;
+
+/// Largest DNS message over HTTP.
+const DNS_MESSAGE_MAX: usize = 65535;
+
+pub struct Doh3Client {
+    doh3: *mut slipstream_doh3_t,
+}
+
+// SAFETY: the C side serializes callers with its own lock and only touches
+// the connection on its network thread.
+unsafe impl Send for Doh3Client {}
+unsafe impl Sync for Doh3Client {}
+
+impl Doh3Client {
+    /// Starts the network thread for `server`, verified as `authority`
+    /// against the PEM roots in `cert_roots`. Session tickets for 0-RTT are
+    /// kept in `ticket_file` when one is given.
+    pub fn new(
+        server: SocketAddr,
+        authority: &str,
+        path: &str,
+        cert_roots: Option<&Path>,
+        ticket_file: Option<&Path>,
+    ) -> Result<Self, String> {
+        let to_cstring = |value: &str| {
+            CString::new(value).map_err(|_| format!("Invalid DoH3 setting {:?}", value))
+        };
+        let authority = to_cstring(authority)?;
+        let path = to_cstring(path)?;
+        let cert_roots = cert_roots
+            .map(|p| to_cstring(&p.to_string_lossy()))
+            .transpose()?;
+        let ticket_file = ticket_file
+            .map(|p| to_cstring(&p.to_string_lossy()))
+            .transpose()?;
+        let storage = socket_addr_to_storage(server);
+        // SAFETY: every pointer is valid for the call, which copies what it keeps.
+        let doh3 = unsafe {
+            slipstream_doh3_create(
+                &storage as *const _ as *const libc::sockaddr,
+                authority.as_ptr(),
+                path.as_ptr(),
+                cert_roots.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+                ticket_file
+                    .as_ref()
+                    .map_or(std::ptr::null(), |s| s.as_ptr()),
+            )
+        };
+        if doh3.is_null() {
+            return Err(format!("Could not start DoH3 client for {}", server));
+        }
+        Ok(Self { doh3 })
+    }
+
+    /// Resolves one DNS message. None when the server is unreachable, the
+    /// request fails or no answer comes in time; the caller falls back.
+    pub fn query(&self, query: &[u8], timeout: Duration) -> Option<Vec<u8>> {
+        let mut answer = vec![0u8; DNS_MESSAGE_MAX];
+        // SAFETY: both buffers outlive the call, which blocks until it is done
+        // with them.
+        let len = unsafe {
+            slipstream_doh3_query(
+                self.doh3,
+                query.as_ptr(),
+                query.len(),
+                answer.as_mut_ptr(),
+                answer.len(),
+                timeout.as_micros().min(u64::MAX as u128) as u64,
+            )
+        };
+        if len <= 0 {
+            return None;
+        }
+        answer.truncate(len as usize);
+        Some(answer)
+    }
+}
+
+impl Drop for Doh3Client {
+    fn drop(&mut self) {
+        // SAFETY: the pointer came from slipstream_doh3_create and is freed once.
+        unsafe { slipstream_doh3_delete(self.doh3) };
+    }
+}
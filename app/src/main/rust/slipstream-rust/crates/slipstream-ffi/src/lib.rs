@@ -3,9 +3,11 @@
 use openssl_sys as _;
 use slipstream_core::HostPort;
 
+pub mod doh3;
 pub mod picoquic;
 pub mod runtime;
 
+pub use doh3::Doh3Client;
 pub use picoquic::get_pacing_rate;
 pub use picoquic::get_rtt;
 
@@ -16,10 +18,24 @@ pub enum ResolverMode {
     Authoritative = 2,
 }
 
+/// How queries reach a resolver.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub enum ResolverTransport {
+    /// Plain DNS over UDP.
+    #[default]
+    Udp,
+    /// DNS over TLS (RFC 7858) on one persistent, pipelined connection.
+    Tls,
+    /// DNS over HTTPS (RFC 8484) on one persistent HTTP/2 connection,
+    /// posting to `path`.
+    Https { path: String },
+}
+
 #[derive(Debug, Clone)]
 pub struct ResolverSpec {
     pub resolver: HostPort,
     pub mode: ResolverMode,
+    pub transport: ResolverTransport,
 }
 
 #[derive(Debug)]
@@ -35,10 +51,19 @@ pub struct ClientConfig<'a> {
     pub debug_poll: bool,
     pub debug_streams: bool,
     pub idle_poll_interval_ms: u64,
+    pub session_cache_dir: Option<&'a str>,
+    pub batch_uplink: bool,
+    pub hedge_polls: bool,
+    pub probe_encodings: bool,
+    pub compact_headers: bool,
+    pub connections: usize,
 }
 
 pub use runtime::{
-    abort_stream_bidi, configure_quic, configure_quic_with_custom, sockaddr_storage_to_socket_addr,
-    socket_addr_to_storage, take_crypto_errors, take_stateless_packet_for_cid,
-    write_stream_or_reset, QuicGuard, SLIPSTREAM_FILE_CANCEL_ERROR, SLIPSTREAM_INTERNAL_ERROR,
+    abort_stream_bidi, configure_cipher_suites, configure_mtu_search, configure_quic,
+    configure_quic_with_custom, count_perf_answers, cpu_has_aes, drain_telemetry,
+    enable_perf_stats, provide_stream_data_segments, read_perf_totals, set_telemetry_interval,
+    sockaddr_storage_to_socket_addr, socket_addr_to_storage, take_crypto_errors,
+    take_stateless_packet_for_cid, telemetry_dropped, update_perf_stats, write_stream_or_reset,
+    PerfSummary, QuicGuard, SLIPSTREAM_FILE_CANCEL_ERROR, SLIPSTREAM_INTERNAL_ERROR,
 };
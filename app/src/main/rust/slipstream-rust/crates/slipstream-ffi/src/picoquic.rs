@@ -7,6 +7,7 @@ pub const PICOQUIC_MAX_PACKET_SIZE: usize = 1536;
 pub const PICOQUIC_RESET_SECRET_SIZE: usize = 16;
 pub const PICOQUIC_PACKET_LOOP_RECV_MAX: usize = 10;
 pub const PICOQUIC_PACKET_LOOP_SEND_MAX: usize = 10;
+pub const PICOQUIC_PMTUD_REQUIRED: c_int = 1;
 
 #[repr(C)]
 #[derive(Clone, Copy)]
@@ -15,6 +16,18 @@ pub struct picoquic_connection_id_t {
     pub id_len: u8,
 }
 
+/// One datagram of a `picoquic_incoming_packets` batch; `first_cnx` and
+/// `first_path_id` are filled in.
+#[repr(C)]
+pub struct picoquic_incoming_datagram_t {
+    pub bytes: *mut u8,
+    pub length: size_t,
+    pub addr_from: *mut sockaddr,
+    pub addr_to: *mut sockaddr,
+    pub first_cnx: *mut picoquic_cnx_t,
+    pub first_path_id: c_int,
+}
+
 #[repr(C)]
 pub struct picoquic_quic_t {
     _private: [u8; 0],
@@ -25,6 +38,11 @@ pub struct picoquic_cnx_t {
     _private: [u8; 0],
 }
 
+#[repr(C)]
+pub struct slipstream_doh3_t {
+    _private: [u8; 0],
+}
+
 #[repr(C)]
 pub struct ptls_t {
     _private: [u8; 0],
@@ -56,6 +74,106 @@ pub struct picoquic_path_quality_t {
     pub bytes_in_transit: u64,
 }
 
+/// One per-path congestion sample, recorded from `alg_notify` by the mixed and
+/// server congestion controllers (see `cc/slipstream_telemetry.c`).
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct slipstream_telemetry_sample_t {
+    pub time_us: u64,
+    pub unique_path_id: u64,
+    pub cwin: u64,
+    pub pacing_rate: u64,
+    pub rtt_min: u64,
+    pub smoothed_rtt: u64,
+    pub bytes_in_transit: u64,
+    pub nb_losses: u64,
+    pub nb_timer_losses: u64,
+    pub nb_spurious: u64,
+    pub packets_sent: u64,
+    pub notification: u32,
+    pub path_mode: u32,
+}
+
+pub const SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX: usize = 16;
+
+/// Per-path congestion state in a connection snapshot, indexed by path ID.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct slipstream_path_snapshot_t {
+    pub unique_path_id: u64,
+    pub cwin: u64,
+    pub bytes_in_transit: u64,
+    pub pacing_rate: u64,
+    pub smoothed_rtt: u64,
+    pub rtt_min: u64,
+    pub query_rate: u64,
+    pub is_usable: u32,
+    pub padding: u32,
+}
+
+/// Connection scheduling state filled by `slipstream_get_cnx_snapshot`
+/// (see `cc/slipstream_poll.c`).
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct slipstream_cnx_snapshot_t {
+    pub next_wake_time: u64,
+    pub max_streams_bidir_remote: u64,
+    pub flow_blocked: u32,
+    pub stream_blocked: u32,
+    pub has_ready_stream: u32,
+    pub nb_paths: u32,
+    pub paths: [slipstream_path_snapshot_t; SLIPSTREAM_CNX_SNAPSHOT_PATHS_MAX],
+}
+
+pub const SLIPSTREAM_PERF_RTT_BUCKETS: usize = 64;
+
+/// Summed counters of every context attached to the performance collector
+/// (see `cc/slipstream_perf.c`). Everything but `nb_connections` and the RTT
+/// histogram only grows.
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct slipstream_perf_totals_t {
+    pub nb_connections: u64,
+    pub nb_closed: u64,
+    pub data_sent: u64,
+    pub data_received: u64,
+    pub packets_sent: u64,
+    pub packets_received: u64,
+    pub retransmissions: u64,
+    pub spurious: u64,
+    pub answers_with_data: u64,
+    pub answers_empty: u64,
+    pub rtt_histogram: [u64; SLIPSTREAM_PERF_RTT_BUCKETS],
+}
+
+impl Default for slipstream_perf_totals_t {
+    fn default() -> Self {
+        Self {
+            nb_connections: 0,
+            nb_closed: 0,
+            data_sent: 0,
+            data_received: 0,
+            packets_sent: 0,
+            packets_received: 0,
+            retransmissions: 0,
+            spurious: 0,
+            answers_with_data: 0,
+            answers_empty: 0,
+            rtt_histogram: [0; SLIPSTREAM_PERF_RTT_BUCKETS],
+        }
+    }
+}
+
+pub const PICOQUIC_STREAM_DATA_SEGMENTS_MAX: usize = 16;
+
+/// One source buffer for `picoquic_provide_stream_data_segments`.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct picoquic_stream_data_segment_t {
+    pub bytes: *const u8,
+    pub length: size_t,
+}
+
 #[repr(C)]
 #[derive(Clone, Copy)]
 pub struct ptls_iovec_t {
@@ -203,6 +321,11 @@ extern "C" {
 
     pub fn picoquic_set_cookie_mode(quic: *mut picoquic_quic_t, cookie_mode: c_int);
     pub fn picoquic_set_default_priority(quic: *mut picoquic_quic_t, default_stream_priority: u8);
+    pub fn picoquic_set_stream_priority(
+        cnx: *mut picoquic_cnx_t,
+        stream_id: u64,
+        stream_priority: u8,
+    ) -> c_int;
     pub fn picoquic_set_default_direct_receive_callback(
         quic: *mut picoquic_quic_t,
         direct_receive_fn: picoquic_stream_direct_receive_fn,
@@ -212,6 +335,11 @@ extern "C" {
         quic: *mut picoquic_quic_t,
         defer_stream_data_consumption: c_int,
     );
+    pub fn picoquic_set_wake_wheel(quic: *mut picoquic_quic_t, use_wake_wheel: c_int);
+    pub fn picoquic_set_rate_weighted_paths(
+        quic: *mut picoquic_quic_t,
+        use_rate_weighted_paths: c_int,
+    );
     pub fn picoquic_set_default_congestion_algorithm_by_name(
         quic: *mut picoquic_quic_t,
         alg_name: *const c_char,
@@ -225,6 +353,22 @@ extern "C" {
         multipath_option: c_int,
     );
     pub fn picoquic_set_preemptive_repeat_policy(quic: *mut picoquic_quic_t, do_repeat: c_int);
+    pub fn picoquic_set_preemptive_repeat_loss_threshold(
+        quic: *mut picoquic_quic_t,
+        loss_permille: u32,
+    );
+    pub fn picoquic_set_credit_piggyback_policy(quic: *mut picoquic_quic_t, do_piggyback: c_int);
+    pub fn picoquic_set_cid_slots(
+        quic: *mut picoquic_quic_t,
+        offset: u8,
+        first: u16,
+        stride: u16,
+    ) -> c_int;
+    pub fn picoquic_get_cid_by_slot(
+        quic: *mut picoquic_quic_t,
+        slot: u16,
+        cnx_id: *mut picoquic_connection_id_t,
+    ) -> c_int;
     pub fn picoquic_disable_port_blocking(
         quic: *mut picoquic_quic_t,
         is_port_blocking_disabled: c_int,
@@ -236,8 +380,29 @@ extern "C" {
         initial_mtu_ipv4: u32,
         initial_mtu_ipv6: u32,
     );
+    pub fn picoquic_set_mtu_probe_step(quic: *mut picoquic_quic_t, step: u32);
+    pub fn picoquic_set_default_pmtud_policy(quic: *mut picoquic_quic_t, pmtud_policy: c_int);
     pub fn picoquic_set_key_log_file_from_env(quic: *mut picoquic_quic_t);
+    pub fn picoquic_set_binlog(quic: *mut picoquic_quic_t, binlog_dir: *const c_char) -> c_int;
+    pub fn picoquic_set_binlog_async(
+        quic: *mut picoquic_quic_t,
+        ring_size: size_t,
+        sample_one_in: u32,
+    ) -> c_int;
+    pub fn picoquic_get_binlog_async_dropped(quic: *mut picoquic_quic_t) -> u64;
     pub fn picoquic_enable_path_callbacks_default(quic: *mut picoquic_quic_t, are_enabled: c_int);
+    pub fn picoquic_load_retry_tokens(
+        quic: *mut picoquic_quic_t,
+        token_store_filename: *const c_char,
+    ) -> c_int;
+    pub fn picoquic_save_session_tickets(
+        quic: *mut picoquic_quic_t,
+        ticket_store_filename: *const c_char,
+    ) -> c_int;
+    pub fn picoquic_save_retry_tokens(
+        quic: *mut picoquic_quic_t,
+        token_store_filename: *const c_char,
+    ) -> c_int;
 
     pub fn picoquic_explain_crypto_error(
         err_file: *mut *const c_char,
@@ -265,6 +430,8 @@ extern "C" {
 
     pub static mut slipstream_server_cc_algorithm: *mut picoquic_congestion_algorithm_t;
     pub static mut slipstream_mixed_cc_algorithm: *mut picoquic_congestion_algorithm_t;
+    pub fn slipstream_server_cc_set_egress_budget(bytes_per_second: u64);
+    pub fn slipstream_server_cc_set_weight(cnx: *mut picoquic_cnx_t, weight: u32);
 
     pub fn picoquic_create_client_cnx(
         quic: *mut picoquic_quic_t,
@@ -283,6 +450,7 @@ extern "C" {
         callback_ctx: *mut c_void,
     );
     pub fn picoquic_enable_path_callbacks(cnx: *mut picoquic_cnx_t, are_enabled: c_int);
+    pub fn picoquic_is_0rtt_available(cnx: *mut picoquic_cnx_t) -> c_int;
     pub fn picoquic_close(cnx: *mut picoquic_cnx_t, application_reason_code: u64) -> c_int;
     pub fn picoquic_close_immediate(cnx: *mut picoquic_cnx_t);
     pub fn picoquic_delete_cnx(cnx: *mut picoquic_cnx_t);
@@ -295,6 +463,7 @@ extern "C" {
         current_time: u64,
         delay_max: i64,
     ) -> i64;
+    pub fn picoquic_get_remote_cnxid(cnx: *mut picoquic_cnx_t) -> picoquic_connection_id_t;
     pub fn picoquic_get_rtt(cnx: *mut picoquic_cnx_t) -> u64;
     pub fn picoquic_get_cwin(cnx: *mut picoquic_cnx_t) -> u64;
     pub fn picoquic_get_pacing_rate(cnx: *mut picoquic_cnx_t) -> u64;
@@ -311,7 +480,13 @@ extern "C" {
     pub fn slipstream_request_poll(cnx: *mut picoquic_cnx_t);
     pub fn slipstream_is_flow_blocked(cnx: *mut picoquic_cnx_t) -> c_int;
     pub fn slipstream_has_ready_stream(cnx: *mut picoquic_cnx_t) -> c_int;
+    pub fn slipstream_has_pending_send(
+        cnx: *mut picoquic_cnx_t,
+        path_id: c_int,
+        current_time: u64,
+    ) -> c_int;
     pub fn slipstream_disable_ack_delay(cnx: *mut picoquic_cnx_t);
+    pub fn slipstream_restart_loss_recovery(cnx: *mut picoquic_cnx_t, current_time: u64);
     pub fn slipstream_find_path_id_by_addr(
         cnx: *mut picoquic_cnx_t,
         addr_peer: *const sockaddr,
@@ -320,11 +495,75 @@ extern "C" {
         cnx: *mut picoquic_cnx_t,
         unique_path_id: u64,
     ) -> c_int;
+    pub fn slipstream_get_path_send_mtu(cnx: *mut picoquic_cnx_t, path_id: c_int) -> size_t;
     pub fn slipstream_get_max_streams_bidir_remote(cnx: *mut picoquic_cnx_t) -> u64;
+    pub fn slipstream_get_cnx_snapshot(
+        cnx: *mut picoquic_cnx_t,
+        snapshot: *mut slipstream_cnx_snapshot_t,
+    ) -> c_int;
+    pub fn slipstream_set_worker_cid(quic: *mut picoquic_quic_t, worker_id: u8) -> c_int;
+    pub fn picoquic_lb_compat_cid_config_free(quic: *mut picoquic_quic_t);
     pub fn slipstream_set_cc_override(alg_name: *const c_char);
     pub fn slipstream_set_default_path_mode(mode: c_int);
     pub fn slipstream_set_path_mode(cnx: *mut picoquic_cnx_t, path_id: c_int, mode: c_int);
     pub fn slipstream_set_path_ack_delay(cnx: *mut picoquic_cnx_t, path_id: c_int, disable: c_int);
+    pub fn slipstream_set_path_ack_frequency(
+        cnx: *mut picoquic_cnx_t,
+        path_id: c_int,
+        packet_threshold: u64,
+        max_ack_delay_us: u64,
+    );
+    pub fn slipstream_get_path_query_rate(cnx: *mut picoquic_cnx_t, path_id: c_int) -> u64;
+    pub fn slipstream_telemetry_set_interval(interval_us: u64);
+    pub fn slipstream_telemetry_drain(
+        samples: *mut slipstream_telemetry_sample_t,
+        max_samples: size_t,
+    ) -> size_t;
+    pub fn slipstream_telemetry_dropped() -> u64;
+    pub fn slipstream_doh3_create(
+        server: *const sockaddr,
+        authority: *const c_char,
+        path: *const c_char,
+        cert_root_file: *const c_char,
+        ticket_file: *const c_char,
+    ) -> *mut slipstream_doh3_t;
+    pub fn slipstream_doh3_query(
+        doh3: *mut slipstream_doh3_t,
+        query: *const u8,
+        query_length: size_t,
+        answer: *mut u8,
+        answer_max: size_t,
+        timeout_us: u64,
+    ) -> c_int;
+    pub fn slipstream_doh3_delete(doh3: *mut slipstream_doh3_t);
+    pub fn slipstream_perf_enable(quic: *mut picoquic_quic_t, slot_index: size_t) -> c_int;
+    pub fn slipstream_perf_count_answers(quic: *mut picoquic_quic_t, with_data: u64, empty: u64);
+    pub fn slipstream_perf_update(quic: *mut picoquic_quic_t);
+    pub fn slipstream_perf_read(totals: *mut slipstream_perf_totals_t);
+    pub fn slipstream_trim_idle_cnx(cnx: *mut picoquic_cnx_t) -> size_t;
+    pub fn slipstream_trim_packet_pool(quic: *mut picoquic_quic_t, nb_kept: size_t) -> size_t;
+    pub fn slipstream_idle_touch(cnx: *mut picoquic_cnx_t, current_time: u64);
+    pub fn slipstream_idle_last_seen(cnx: *mut picoquic_cnx_t) -> u64;
+    pub fn slipstream_idle_next_to_trim(
+        quic: *mut picoquic_quic_t,
+        cutoff: u64,
+    ) -> *mut picoquic_cnx_t;
+    pub fn slipstream_idle_next_to_close(
+        quic: *mut picoquic_quic_t,
+        cutoff: u64,
+    ) -> *mut picoquic_cnx_t;
+    pub fn slipstream_idle_awake_count(quic: *mut picoquic_quic_t) -> size_t;
+    pub fn slipstream_idle_count(quic: *mut picoquic_quic_t) -> size_t;
+    pub fn slipstream_enable_datagrams(quic: *mut picoquic_quic_t, max_frame_size: u32) -> c_int;
+    pub fn slipstream_datagram_max_payload(cnx: *mut picoquic_cnx_t) -> size_t;
+    pub fn slipstream_queue_datagram(
+        cnx: *mut picoquic_cnx_t,
+        bytes: *const u8,
+        length: size_t,
+        max_queued: size_t,
+    ) -> c_int;
+    pub fn slipstream_cpu_has_aes() -> c_int;
+    pub fn slipstream_configure_cipher_suites(quic: *mut picoquic_quic_t) -> c_int;
 
     pub fn picoquic_get_first_cnx(quic: *mut picoquic_quic_t) -> *mut picoquic_cnx_t;
     pub fn picoquic_get_next_cnx(cnx: *mut picoquic_cnx_t) -> *mut picoquic_cnx_t;
@@ -379,6 +618,13 @@ extern "C" {
         current_time: u64,
     ) -> c_int;
 
+    pub fn picoquic_incoming_packets(
+        quic: *mut picoquic_quic_t,
+        datagrams: *mut picoquic_incoming_datagram_t,
+        nb_datagrams: size_t,
+        current_time: u64,
+    ) -> c_int;
+
     pub fn picoquic_provide_stream_data_buffer(
         context: *mut c_void,
         nb_bytes: size_t,
@@ -386,6 +632,14 @@ extern "C" {
         is_still_active: c_int,
     ) -> *mut u8;
 
+    pub fn picoquic_provide_stream_data_segments(
+        context: *mut c_void,
+        segments: *const picoquic_stream_data_segment_t,
+        nb_segments: size_t,
+        is_fin: c_int,
+        is_still_active: c_int,
+    ) -> i64;
+
     pub fn picoquic_add_to_stream(
         cnx: *mut picoquic_cnx_t,
         stream_id: u64,
@@ -1,21 +1,36 @@
 use crate::picoquic::{
     picoquic_clear_crypto_errors, picoquic_cnx_t, picoquic_congestion_algorithm_t,
-    picoquic_disable_port_blocking, picoquic_explain_crypto_error, picoquic_free, picoquic_quic_t,
+    picoquic_disable_port_blocking, picoquic_explain_crypto_error, picoquic_free,
+    picoquic_lb_compat_cid_config_free, picoquic_provide_stream_data_segments, picoquic_quic_t,
     picoquic_reset_stream, picoquic_set_cookie_mode, picoquic_set_default_congestion_algorithm,
     picoquic_set_default_congestion_algorithm_by_name, picoquic_set_default_multipath_option,
-    picoquic_set_default_priority, picoquic_set_initial_send_mtu,
-    picoquic_set_key_log_file_from_env, picoquic_set_max_data_control, picoquic_set_mtu_max,
-    picoquic_set_preemptive_repeat_policy, picoquic_set_stream_data_consumption_mode,
-    picoquic_stop_sending, slipstream_take_stateless_packet_for_cid, PICOQUIC_MAX_PACKET_SIZE,
+    picoquic_set_default_pmtud_policy, picoquic_set_default_priority,
+    picoquic_set_initial_send_mtu, picoquic_set_key_log_file_from_env,
+    picoquic_set_max_data_control, picoquic_set_mtu_max, picoquic_set_mtu_probe_step,
+    picoquic_set_preemptive_repeat_loss_threshold, picoquic_set_preemptive_repeat_policy,
+    picoquic_set_rate_weighted_paths, picoquic_set_stream_data_consumption_mode,
+    picoquic_stop_sending, picoquic_stream_data_segment_t, slipstream_configure_cipher_suites,
+    slipstream_cpu_has_aes, slipstream_perf_count_answers, slipstream_perf_enable,
+    slipstream_perf_read, slipstream_perf_totals_t, slipstream_perf_update,
+    slipstream_take_stateless_packet_for_cid, slipstream_telemetry_drain,
+    slipstream_telemetry_dropped, slipstream_telemetry_sample_t, slipstream_telemetry_set_interval,
+    PICOQUIC_MAX_PACKET_SIZE, PICOQUIC_PMTUD_REQUIRED, PICOQUIC_STREAM_DATA_SEGMENTS_MAX,
+    SLIPSTREAM_PERF_RTT_BUCKETS,
 };
-use libc::{c_char, c_int, c_ulong, size_t, sockaddr_storage};
+use libc::{c_char, c_int, c_ulong, c_void, size_t, sockaddr_storage};
+use slipstream_core::priority::STREAM_PRIORITY_DEFAULT;
 use slipstream_core::tcp::stream_write_buffer_bytes;
 use std::ffi::CStr;
+use std::fmt;
 use std::io::Write;
 use std::net::{Ipv4Addr, Ipv6Addr, Shutdown, SocketAddr, SocketAddrV4, SocketAddrV6, TcpStream};
+use std::time::Duration;
 
 pub const SLIPSTREAM_INTERNAL_ERROR: u64 = 0x101;
 pub const SLIPSTREAM_FILE_CANCEL_ERROR: u64 = 0x105;
+// Paths losing at least this share of their bytes, in per mille, have the
+// tails of their bursts repeated on a path that loses less.
+const PREEMPTIVE_REPEAT_LOSS_PERMILLE: u32 = 30;
 
 extern "C" {
     fn ERR_error_string_n(e: c_ulong, buf: *mut c_char, len: size_t);
@@ -35,7 +50,12 @@ impl Drop for QuicGuard {
     fn drop(&mut self) {
         if !self.quic.is_null() {
             // SAFETY: QuicGuard owns the quic pointer returned by picoquic_create.
-            unsafe { picoquic_free(self.quic) };
+            // picoquic_free does not release a worker CID context; the free call
+            // is a no-op when none was configured.
+            unsafe {
+                picoquic_lb_compat_cid_config_free(self.quic);
+                picoquic_free(self.quic);
+            }
         }
     }
 }
@@ -69,9 +89,12 @@ pub unsafe fn configure_quic_with_custom(
 /// `quic` must be a valid picoquic context and `mtu` must be non-zero.
 unsafe fn configure_quic_common(quic: *mut picoquic_quic_t, mtu: u32) {
     picoquic_set_cookie_mode(quic, 0);
-    picoquic_set_default_priority(quic, 2);
+    picoquic_set_default_priority(quic, STREAM_PRIORITY_DEFAULT);
     picoquic_set_default_multipath_option(quic, 1);
+    // Each resolver is a path; share data by how fast each one answers.
+    picoquic_set_rate_weighted_paths(quic, 1);
     picoquic_set_preemptive_repeat_policy(quic, 1);
+    picoquic_set_preemptive_repeat_loss_threshold(quic, PREEMPTIVE_REPEAT_LOSS_PERMILLE);
     picoquic_disable_port_blocking(quic, 1);
     picoquic_set_stream_data_consumption_mode(quic, 1);
     picoquic_set_max_data_control(quic, stream_write_buffer_bytes() as u64);
@@ -80,6 +103,19 @@ unsafe fn configure_quic_common(quic: *mut picoquic_quic_t, mtu: u32) {
     picoquic_set_key_log_file_from_env(quic);
 }
 
+/// Starts every path at `initial_mtu` and searches each one, by bisection with
+/// probes, for the largest packet up to the context's MTU that it carries,
+/// stopping within `step` bytes. Meant for DNS answers, where the limit is set
+/// by each resolver rather than by the IP path.
+///
+/// # Safety
+/// `quic` must be a valid picoquic context configured by `configure_quic*`.
+pub unsafe fn configure_mtu_search(quic: *mut picoquic_quic_t, initial_mtu: u32, step: u32) {
+    picoquic_set_initial_send_mtu(quic, initial_mtu, initial_mtu);
+    picoquic_set_mtu_probe_step(quic, step);
+    picoquic_set_default_pmtud_policy(quic, PICOQUIC_PMTUD_REQUIRED);
+}
+
 pub fn take_crypto_errors() -> Vec<String> {
     let mut errors = Vec::new();
     loop {
@@ -124,6 +160,193 @@ pub fn take_crypto_errors() -> Vec<String> {
     errors
 }
 
+/// Samples drained per call; the C ring holds 2048.
+const TELEMETRY_DRAIN_MAX: usize = 256;
+
+/// Sets the per-path telemetry sampling interval; 0 turns sampling off.
+pub fn set_telemetry_interval(interval_us: u64) {
+    unsafe {
+        slipstream_telemetry_set_interval(interval_us);
+    }
+}
+
+/// Drains queued per-path telemetry samples, oldest first.
+pub fn drain_telemetry() -> Vec<slipstream_telemetry_sample_t> {
+    let mut samples = Vec::new();
+    loop {
+        let len = samples.len();
+        samples.resize(
+            len + TELEMETRY_DRAIN_MAX,
+            slipstream_telemetry_sample_t::default(),
+        );
+        // SAFETY: the buffer has room for TELEMETRY_DRAIN_MAX samples past len.
+        let drained = unsafe {
+            slipstream_telemetry_drain(samples.as_mut_ptr().add(len), TELEMETRY_DRAIN_MAX)
+        };
+        samples.truncate(len + drained);
+        if drained < TELEMETRY_DRAIN_MAX {
+            return samples;
+        }
+    }
+}
+
+/// Number of samples dropped because the ring was full.
+pub fn telemetry_dropped() -> u64 {
+    unsafe { slipstream_telemetry_dropped() }
+}
+
+/// Bucket layout of `slipstream_perf_totals_t::rtt_histogram`: bucket 0 holds
+/// RTTs below 2^PERF_RTT_MIN_BITS us, then 2^PERF_RTT_SUB_BITS buckets per octave.
+const PERF_RTT_MIN_BITS: u32 = 10;
+/// Whether the CPU has AES and carry-less multiply instructions, which make
+/// AES-GCM faster than ChaCha20-Poly1305.
+pub fn cpu_has_aes() -> bool {
+    unsafe { slipstream_cpu_has_aes() != 0 }
+}
+
+/// Orders the suites a client offers for this CPU: ChaCha20-Poly1305 first
+/// without AES instructions, AES-GCM first otherwise. The server follows the
+/// client's order. Returns the ID of the suite offered first, if any.
+///
+/// # Safety
+/// `quic` must be a valid picoquic context with no connections yet.
+pub unsafe fn configure_cipher_suites(quic: *mut picoquic_quic_t) -> Option<u16> {
+    match slipstream_configure_cipher_suites(quic) {
+        0 => None,
+        id => Some(id as u16),
+    }
+}
+
+const PERF_RTT_SUB_BITS: u32 = 2;
+
+/// Attaches the performance collector to `quic`, feeding the given slot
+/// (a server worker ID, or 0). Returns false if the slot is out of range.
+///
+/// # Safety
+/// `quic` must be a valid picoquic context.
+pub unsafe fn enable_perf_stats(quic: *mut picoquic_quic_t, slot: usize) -> bool {
+    slipstream_perf_enable(quic, slot) == 0
+}
+
+/// Counts DNS answers with and without a QUIC payload.
+///
+/// # Safety
+/// `quic` must be a valid picoquic context owned by the calling thread.
+pub unsafe fn count_perf_answers(quic: *mut picoquic_quic_t, with_data: u64, empty: u64) {
+    if with_data != 0 || empty != 0 {
+        slipstream_perf_count_answers(quic, with_data, empty);
+    }
+}
+
+/// Publishes the totals of `quic` and its live connections.
+///
+/// # Safety
+/// `quic` must be a valid picoquic context owned by the calling thread.
+pub unsafe fn update_perf_stats(quic: *mut picoquic_quic_t) {
+    slipstream_perf_update(quic);
+}
+
+/// Reads the totals last published by every attached context, summed.
+pub fn read_perf_totals() -> slipstream_perf_totals_t {
+    let mut totals = slipstream_perf_totals_t::default();
+    unsafe { slipstream_perf_read(&mut totals) };
+    totals
+}
+
+/// One interval of aggregated performance, from two reads of the collector.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct PerfSummary {
+    pub connections: u64,
+    pub closed: u64,
+    pub send_bps: u64,
+    pub recv_bps: u64,
+    pub rtt_p50_us: u64,
+    pub rtt_p90_us: u64,
+    pub rtt_p99_us: u64,
+    /// Retransmitted packets per packet sent.
+    pub retransmit_ratio: f64,
+    pub answers_with_data: u64,
+    pub answers_empty: u64,
+}
+
+impl PerfSummary {
+    pub fn between(
+        previous: &slipstream_perf_totals_t,
+        current: &slipstream_perf_totals_t,
+        elapsed: Duration,
+    ) -> Self {
+        // A slot published mid-read can trail its last value; count that as idle.
+        let delta = |current: u64, previous: u64| current.saturating_sub(previous);
+        let micros = elapsed.as_micros().max(1) as u64;
+        let rate = |bytes: u64| bytes.saturating_mul(8_000_000) / micros;
+        let packets_sent = delta(current.packets_sent, previous.packets_sent);
+        let retransmissions = delta(current.retransmissions, previous.retransmissions);
+        Self {
+            connections: current.nb_connections,
+            closed: delta(current.nb_closed, previous.nb_closed),
+            send_bps: rate(delta(current.data_sent, previous.data_sent)),
+            recv_bps: rate(delta(current.data_received, previous.data_received)),
+            rtt_p50_us: rtt_percentile(&current.rtt_histogram, 50),
+            rtt_p90_us: rtt_percentile(&current.rtt_histogram, 90),
+            rtt_p99_us: rtt_percentile(&current.rtt_histogram, 99),
+            retransmit_ratio: if packets_sent == 0 {
+                0.0
+            } else {
+                retransmissions as f64 / packets_sent as f64
+            },
+            answers_with_data: delta(current.answers_with_data, previous.answers_with_data),
+            answers_empty: delta(current.answers_empty, previous.answers_empty),
+        }
+    }
+}
+
+impl fmt::Display for PerfSummary {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(
+            f,
+            "connections={} closed={} send_kbps={} recv_kbps={} rtt_p50_ms={} rtt_p90_ms={} rtt_p99_ms={} retransmit_pct={:.1} answers_data={} answers_empty={}",
+            self.connections,
+            self.closed,
+            self.send_bps / 1000,
+            self.recv_bps / 1000,
+            self.rtt_p50_us / 1000,
+            self.rtt_p90_us / 1000,
+            self.rtt_p99_us / 1000,
+            self.retransmit_ratio * 100.0,
+            self.answers_with_data,
+            self.answers_empty
+        )
+    }
+}
+
+/// Lower bound of a histogram bucket, in microseconds.
+fn rtt_bucket_floor(bucket: usize) -> u64 {
+    if bucket == 0 {
+        return 0;
+    }
+    let octave = ((bucket - 1) >> PERF_RTT_SUB_BITS) as u32;
+    let sub = ((bucket - 1) & ((1 << PERF_RTT_SUB_BITS) - 1)) as u64;
+    ((1u64 << PERF_RTT_SUB_BITS) + sub) << (octave + PERF_RTT_MIN_BITS - PERF_RTT_SUB_BITS)
+}
+
+/// Returns the floor of the bucket holding the given percentile, or 0 if the
+/// histogram is empty.
+fn rtt_percentile(histogram: &[u64; SLIPSTREAM_PERF_RTT_BUCKETS], percent: u64) -> u64 {
+    let total: u64 = histogram.iter().sum();
+    if total == 0 {
+        return 0;
+    }
+    let rank = (total * percent).div_ceil(100).max(1);
+    let mut seen = 0;
+    for (bucket, count) in histogram.iter().enumerate() {
+        seen += count;
+        if seen >= rank {
+            return rtt_bucket_floor(bucket);
+        }
+    }
+    rtt_bucket_floor(SLIPSTREAM_PERF_RTT_BUCKETS - 1)
+}
+
 pub fn socket_addr_to_storage(addr: SocketAddr) -> sockaddr_storage {
     match addr {
         SocketAddr::V4(addr) => {
@@ -256,6 +479,46 @@ pub unsafe fn write_stream_or_reset(
     false
 }
 
+/// Answers a `prepare_to_send` callback with data held in several buffers,
+/// written back to back into one stream frame. Returns the number of bytes
+/// written, or `None` if there are more than
+/// `PICOQUIC_STREAM_DATA_SEGMENTS_MAX` segments or they do not fit in the
+/// frame; nothing is committed in that case.
+///
+/// # Safety
+/// `context` must be the `bytes` argument of the `prepare_to_send`
+/// callback being answered, and that callback must not have returned yet.
+pub unsafe fn provide_stream_data_segments(
+    context: *mut c_void,
+    segments: &[&[u8]],
+    is_fin: bool,
+    is_still_active: bool,
+) -> Option<usize> {
+    if segments.len() > PICOQUIC_STREAM_DATA_SEGMENTS_MAX {
+        return None;
+    }
+    let mut iovec = [picoquic_stream_data_segment_t {
+        bytes: std::ptr::null(),
+        length: 0,
+    }; PICOQUIC_STREAM_DATA_SEGMENTS_MAX];
+    for (entry, segment) in iovec.iter_mut().zip(segments) {
+        entry.bytes = segment.as_ptr();
+        entry.length = segment.len();
+    }
+    // SAFETY: the segments borrow live slices and context is the callback's
+    // stream frame context, as guaranteed by the caller.
+    let written = unsafe {
+        picoquic_provide_stream_data_segments(
+            context,
+            iovec.as_ptr(),
+            segments.len(),
+            is_fin as c_int,
+            is_still_active as c_int,
+        )
+    };
+    usize::try_from(written).ok()
+}
+
 /// # Safety
 /// Caller must ensure `cnx` points to a valid picoquic connection.
 pub unsafe fn abort_stream_bidi(cnx: *mut picoquic_cnx_t, stream_id: u64, app_error: u64) {
@@ -1,5 +1,17 @@
-use slipstream_ffi::picoquic::picoquic_clear_crypto_errors;
-use slipstream_ffi::take_crypto_errors;
+use slipstream_ffi::picoquic::{
+    picoquic_clear_crypto_errors, picoquic_create, picoquic_create_client_cnx,
+    picoquic_current_time, picoquic_delete_cnx, slipstream_cnx_snapshot_t,
+    slipstream_get_cnx_snapshot, slipstream_idle_awake_count, slipstream_idle_count,
+    slipstream_idle_next_to_close, slipstream_idle_next_to_trim, slipstream_idle_touch,
+    slipstream_perf_totals_t,
+};
+use slipstream_ffi::{
+    configure_cipher_suites, cpu_has_aes, drain_telemetry, set_telemetry_interval,
+    socket_addr_to_storage, take_crypto_errors, PerfSummary, QuicGuard,
+};
+use std::ffi::CString;
+use std::ptr;
+use std::time::Duration;
 
 #[test]
 fn take_crypto_errors_returns_empty_when_clear() {
@@ -20,3 +32,178 @@ fn take_crypto_errors_returns_empty_when_clear() {
         second
     );
 }
+
+#[test]
+fn drain_telemetry_is_empty_without_samples() {
+    set_telemetry_interval(0);
+    assert!(drain_telemetry().is_empty());
+    set_telemetry_interval(10_000);
+    assert!(drain_telemetry().is_empty());
+    set_telemetry_interval(0);
+}
+
+#[test]
+fn cnx_snapshot_without_connection_is_cleared() {
+    let mut snapshot = slipstream_cnx_snapshot_t {
+        next_wake_time: 1,
+        flow_blocked: 1,
+        nb_paths: 3,
+        ..Default::default()
+    };
+    // SAFETY: a null connection is rejected before it is dereferenced.
+    let ret = unsafe { slipstream_get_cnx_snapshot(std::ptr::null_mut(), &mut snapshot) };
+    assert_eq!(ret, -1);
+    assert_eq!(snapshot.next_wake_time, 0);
+    assert_eq!(snapshot.flow_blocked, 0);
+    assert_eq!(snapshot.nb_paths, 0);
+}
+
+#[test]
+fn perf_summary_reports_interval_rates_and_rtt_percentiles() {
+    let previous = slipstream_perf_totals_t {
+        nb_closed: 3,
+        data_sent: 1_000,
+        packets_sent: 100,
+        retransmissions: 5,
+        answers_with_data: 10,
+        answers_empty: 40,
+        ..Default::default()
+    };
+    let mut current = slipstream_perf_totals_t {
+        nb_connections: 4,
+        nb_closed: 4,
+        data_sent: 251_000,
+        data_received: 125_000,
+        packets_sent: 300,
+        retransmissions: 15,
+        answers_with_data: 60,
+        answers_empty: 50,
+        ..Default::default()
+    };
+    // One connection at 1024..1280 us, two at 4096..5120 us, one at 65536..81920 us.
+    current.rtt_histogram[1] = 1;
+    current.rtt_histogram[9] = 2;
+    current.rtt_histogram[25] = 1;
+
+    let summary = PerfSummary::between(&previous, &current, Duration::from_secs(2));
+    assert_eq!(summary.connections, 4);
+    assert_eq!(summary.closed, 1);
+    assert_eq!(summary.send_bps, 1_000_000);
+    assert_eq!(summary.recv_bps, 500_000);
+    assert_eq!(summary.retransmit_ratio, 0.05);
+    assert_eq!(summary.answers_with_data, 50);
+    assert_eq!(summary.answers_empty, 10);
+    assert_eq!(summary.rtt_p50_us, 4096);
+    assert_eq!(summary.rtt_p90_us, 65536);
+    assert_eq!(summary.rtt_p99_us, 65536);
+}
+
+#[test]
+fn perf_summary_of_idle_collector_is_zero() {
+    let totals = slipstream_perf_totals_t::default();
+    let summary = PerfSummary::between(&totals, &totals, Duration::ZERO);
+    assert_eq!(summary, PerfSummary::default());
+}
+
+#[test]
+fn cipher_suites_follow_cpu_aes_support() {
+    let alpn = CString::new("picoquic_sample").unwrap();
+    let now = unsafe { picoquic_current_time() };
+    // SAFETY: picoquic_create accepts null for optional pointers and uses a valid ALPN C string.
+    let quic = unsafe {
+        picoquic_create(
+            1,
+            ptr::null(),
+            ptr::null(),
+            ptr::null(),
+            alpn.as_ptr(),
+            None,
+            ptr::null_mut(),
+            None,
+            ptr::null_mut(),
+            ptr::null(),
+            now,
+            ptr::null_mut(),
+            ptr::null(),
+            ptr::null(),
+            0,
+        )
+    };
+    assert!(!quic.is_null(), "picoquic_create returned null");
+    let _guard = QuicGuard::new(quic);
+
+    // SAFETY: quic is a fresh context without connections.
+    let first = unsafe { configure_cipher_suites(quic) };
+    if cpu_has_aes() {
+        assert_eq!(first, Some(0x1301));
+    } else {
+        assert_eq!(first, Some(0x1303));
+    }
+}
+
+#[test]
+fn idle_lists_return_connections_oldest_first_and_drop_deleted_ones() {
+    let alpn = CString::new("picoquic_sample").unwrap();
+    let now = unsafe { picoquic_current_time() };
+    // SAFETY: picoquic_create accepts null for optional pointers and uses a valid ALPN C string.
+    let quic = unsafe {
+        picoquic_create(
+            4,
+            ptr::null(),
+            ptr::null(),
+            ptr::null(),
+            alpn.as_ptr(),
+            None,
+            ptr::null_mut(),
+            None,
+            ptr::null_mut(),
+            ptr::null(),
+            now,
+            ptr::null_mut(),
+            ptr::null(),
+            ptr::null(),
+            0,
+        )
+    };
+    assert!(!quic.is_null(), "picoquic_create returned null");
+    let _guard = QuicGuard::new(quic);
+    let mut server = socket_addr_to_storage("127.0.0.1:4433".parse().unwrap());
+    let cnx: Vec<_> = (0..3)
+        .map(|_| {
+            // SAFETY: quic is live and server is a valid IPv4 sockaddr.
+            let cnx = unsafe {
+                picoquic_create_client_cnx(
+                    quic,
+                    &mut server as *mut _ as *mut libc::sockaddr,
+                    now,
+                    0,
+                    ptr::null(),
+                    alpn.as_ptr(),
+                    None,
+                    ptr::null_mut(),
+                )
+            };
+            assert!(!cnx.is_null(), "picoquic_create_client_cnx returned null");
+            cnx
+        })
+        .collect();
+
+    // SAFETY: every connection belongs to quic, which outlives the calls.
+    unsafe {
+        slipstream_idle_touch(cnx[0], 10);
+        slipstream_idle_touch(cnx[1], 20);
+        slipstream_idle_touch(cnx[2], 30);
+        slipstream_idle_touch(cnx[0], 40);
+        assert_eq!(slipstream_idle_count(quic), 3);
+
+        assert_eq!(slipstream_idle_next_to_trim(quic, 25), cnx[1]);
+        assert!(slipstream_idle_next_to_trim(quic, 25).is_null());
+        assert_eq!(slipstream_idle_awake_count(quic), 2);
+
+        picoquic_delete_cnx(cnx[1]);
+        assert_eq!(slipstream_idle_count(quic), 2);
+        assert_eq!(slipstream_idle_next_to_close(quic, 100), cnx[2]);
+        assert_eq!(slipstream_idle_next_to_close(quic, 100), cnx[0]);
+        assert!(slipstream_idle_next_to_close(quic, 100).is_null());
+    }
+}
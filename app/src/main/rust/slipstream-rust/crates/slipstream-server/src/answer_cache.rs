@@ -0,0 +1,254 @@
+use std::collections::hash_map::RandomState;
+use std::collections::{HashMap, VecDeque};
+use std::hash::BuildHasher;
+use std::net::SocketAddr;
+
+const DNS_HEADER_LEN: usize = 12;
+// Type and class after the name.
+const DNS_QUESTION_TAIL_LEN: usize = 4;
+// Evicted buffers kept for the next answers.
+const SPARE_MAX: usize = 64;
+
+/// Identifies a query across resolver retransmits: the sender, the DNS ID
+/// and a hash of the flags and the question exactly as sent.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub(crate) struct AnswerKey {
+    peer: SocketAddr,
+    id: u16,
+    question_hash: u64,
+}
+
+struct CachedAnswer {
+    response: Vec<u8>,
+    expires_at: u64,
+}
+
+/// Recent answers, replayed byte for byte when a resolver retransmits the
+/// query because ours was slow or lost.
+///
+/// A replay skips the DNS decode, picoquic's packet processing and the
+/// prepare of a new answer, and the resolver sees the same answer both times.
+/// Answers a retransmit missed are lost packets, which QUIC recovers as
+/// usual. Entries live for a fixed time, so they expire in insertion order.
+pub(crate) struct AnswerCache {
+    entries: HashMap<AnswerKey, CachedAnswer>,
+    order: VecDeque<(AnswerKey, u64)>,
+    spare: Vec<Vec<u8>>,
+    hasher: RandomState,
+    ttl_us: u64,
+    max_entries: usize,
+}
+
+impl AnswerCache {
+    pub(crate) fn new(ttl_us: u64, max_entries: usize) -> Self {
+        Self {
+            entries: HashMap::new(),
+            order: VecDeque::new(),
+            spare: Vec::new(),
+            hasher: RandomState::new(),
+            ttl_us,
+            max_entries: max_entries.max(1),
+        }
+    }
+
+    /// Keys a raw datagram that looks like a single-question query, without
+    /// decoding it.
+    pub(crate) fn key(&self, packet: &[u8], peer: SocketAddr) -> Option<AnswerKey> {
+        if packet.len() < DNS_HEADER_LEN
+            || packet[2] & 0xf8 != 0
+            || u16::from_be_bytes([packet[4], packet[5]]) != 1
+        {
+            return None;
+        }
+        let mut offset = DNS_HEADER_LEN;
+        loop {
+            let len = *packet.get(offset)? as usize;
+            offset += 1;
+            if len == 0 {
+                break;
+            }
+            if len & 0xc0 != 0 {
+                return None;
+            }
+            offset += len;
+        }
+        let end = offset + DNS_QUESTION_TAIL_LEN;
+        if end > packet.len() {
+            return None;
+        }
+        Some(AnswerKey {
+            peer,
+            id: u16::from_be_bytes([packet[0], packet[1]]),
+            question_hash: self
+                .hasher
+                .hash_one((&packet[2..4], &packet[DNS_HEADER_LEN..end])),
+        })
+    }
+
+    /// Returns the answer sent for `key`, if it has not expired.
+    pub(crate) fn lookup(&mut self, key: &AnswerKey, now: u64) -> Option<&[u8]> {
+        self.expire(now);
+        self.entries.get(key).map(|entry| entry.response.as_slice())
+    }
+
+    pub(crate) fn insert(&mut self, key: AnswerKey, response: &[u8], now: u64) {
+        self.expire(now);
+        while self.entries.len() >= self.max_entries {
+            let Some((oldest, expires_at)) = self.order.pop_front() else {
+                break;
+            };
+            self.remove(&oldest, expires_at);
+        }
+        let mut buf = self.spare.pop().unwrap_or_default();
+        buf.clear();
+        buf.extend_from_slice(response);
+        let expires_at = now.saturating_add(self.ttl_us);
+        if let Some(old) = self.entries.insert(
+            key,
+            CachedAnswer {
+                response: buf,
+                expires_at,
+            },
+        ) {
+            self.recycle(old.response);
+        }
+        self.order.push_back((key, expires_at));
+    }
+
+    fn expire(&mut self, now: u64) {
+        while let Some(&(key, expires_at)) = self.order.front() {
+            if expires_at > now {
+                break;
+            }
+            self.order.pop_front();
+            self.remove(&key, expires_at);
+        }
+    }
+
+    /// Removes `key` unless a later insert replaced the entry `expires_at`
+    /// was queued for.
+    fn remove(&mut self, key: &AnswerKey, expires_at: u64) {
+        if self
+            .entries
+            .get(key)
+            .is_some_and(|entry| entry.expires_at == expires_at)
+        {
+            if let Some(entry) = self.entries.remove(key) {
+                self.recycle(entry.response);
+            }
+        }
+    }
+
+    fn recycle(&mut self, buf: Vec<u8>) {
+        if self.spare.len() < SPARE_MAX {
+            self.spare.push(buf);
+        }
+    }
+
+    #[cfg(test)]
+    fn len(&self) -> usize {
+        self.entries.len()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn build_query(id: u16, name: &str) -> Vec<u8> {
+        let mut packet = Vec::new();
+        packet.extend_from_slice(&id.to_be_bytes());
+        packet.extend_from_slice(&[0x01, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0]);
+        for label in name.split('.') {
+            packet.push(label.len() as u8);
+            packet.extend_from_slice(label.as_bytes());
+        }
+        packet.push(0);
+        packet.extend_from_slice(&[0x00, 0x10, 0x00, 0x01]);
+        packet
+    }
+
+    fn peer(port: u16) -> SocketAddr {
+        SocketAddr::from(([192, 0, 2, 1], port))
+    }
+
+    #[test]
+    fn retransmit_replays_the_answer_until_it_expires() {
+        let mut cache = AnswerCache::new(1000, 16);
+        let query = build_query(7, "abc.example.com");
+        let key = cache.key(&query, peer(53)).expect("key");
+        assert!(cache.lookup(&key, 0).is_none());
+        cache.insert(key, b"answer", 0);
+
+        let retransmit = cache.key(&query.clone(), peer(53)).expect("key");
+        assert_eq!(cache.lookup(&retransmit, 999), Some(&b"answer"[..]));
+        assert!(cache.lookup(&retransmit, 1000).is_none());
+        assert_eq!(cache.len(), 0);
+    }
+
+    #[test]
+    fn key_tells_apart_peer_id_and_question() {
+        let cache = AnswerCache::new(1000, 16);
+        let query = build_query(7, "abc.example.com");
+        let key = cache.key(&query, peer(53)).unwrap();
+        assert_ne!(cache.key(&query, peer(54)), Some(key));
+        assert_ne!(
+            cache.key(&build_query(8, "abc.example.com"), peer(53)),
+            Some(key)
+        );
+        assert_ne!(
+            cache.key(&build_query(7, "abd.example.com"), peer(53)),
+            Some(key)
+        );
+        // Case is kept: the answer echoes the question as sent.
+        assert_ne!(
+            cache.key(&build_query(7, "ABC.example.com"), peer(53)),
+            Some(key)
+        );
+    }
+
+    #[test]
+    fn key_rejects_responses_and_malformed_questions() {
+        let cache = AnswerCache::new(1000, 16);
+        let mut response = build_query(7, "abc.example.com");
+        response[2] |= 0x80;
+        assert!(cache.key(&response, peer(53)).is_none());
+        let query = build_query(7, "abc.example.com");
+        assert!(cache.key(&query[..query.len() - 1], peer(53)).is_none());
+        let mut compressed = build_query(7, "abc.example.com");
+        compressed[DNS_HEADER_LEN] = 0xc0;
+        assert!(cache.key(&compressed, peer(53)).is_none());
+        assert!(cache.key(&query[..8], peer(53)).is_none());
+    }
+
+    #[test]
+    fn full_cache_evicts_the_oldest_answer() {
+        let mut cache = AnswerCache::new(1000, 2);
+        let keys: Vec<AnswerKey> = (0..3)
+            .map(|id| {
+                cache
+                    .key(&build_query(id, "a.example.com"), peer(53))
+                    .unwrap()
+            })
+            .collect();
+        for (time, key) in keys.iter().enumerate() {
+            cache.insert(*key, b"answer", time as u64);
+        }
+        assert_eq!(cache.len(), 2);
+        assert!(cache.lookup(&keys[0], 3).is_none());
+        assert!(cache.lookup(&keys[1], 3).is_some());
+        assert!(cache.lookup(&keys[2], 3).is_some());
+    }
+
+    #[test]
+    fn reinsert_outlives_the_first_expiry() {
+        let mut cache = AnswerCache::new(1000, 16);
+        let key = cache
+            .key(&build_query(1, "a.example.com"), peer(53))
+            .unwrap();
+        cache.insert(key, b"first", 0);
+        cache.insert(key, b"second", 500);
+        assert_eq!(cache.lookup(&key, 1200), Some(&b"second"[..]));
+        assert!(cache.lookup(&key, 1500).is_none());
+    }
+}
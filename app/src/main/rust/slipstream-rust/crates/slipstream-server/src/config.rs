@@ -5,6 +5,7 @@ use openssl::hash::MessageDigest;
 use openssl::nid::Nid;
 use openssl::pkey::PKey;
 use openssl::rand::rand_bytes;
+use openssl::sha::Sha256;
 use openssl::x509::{X509NameBuilder, X509};
 use std::fmt::Write as FmtWrite;
 use std::fs::{self, File, OpenOptions};
@@ -72,6 +73,28 @@ pub(crate) fn load_or_create_reset_seed(path: &Path) -> Result<ResetSeed, String
     }
 }
 
+pub(crate) const TICKET_KEY_SIZE: usize = 32;
+
+/// Key for the session tickets the server issues. Every worker must use the
+/// same key, since a resuming client may land on any of them. With a reset seed
+/// the key is derived from it, so tickets also survive restarts; otherwise it
+/// is random per process.
+pub(crate) fn session_ticket_key(
+    reset_seed: Option<&ResetSeed>,
+) -> Result<[u8; TICKET_KEY_SIZE], String> {
+    let mut key = [0u8; TICKET_KEY_SIZE];
+    match reset_seed {
+        Some(seed) => {
+            let mut hasher = Sha256::new();
+            hasher.update(b"slipstream session ticket key");
+            hasher.update(&seed.bytes);
+            key = hasher.finish();
+        }
+        None => rand_bytes(&mut key).map_err(|err| err.to_string())?,
+    }
+    Ok(key)
+}
+
 pub(crate) fn ensure_cert_key(cert_path: &Path, key_path: &Path) -> Result<bool, String> {
     let cert_exists = cert_path.exists();
     let key_exists = key_path.exists();
@@ -309,6 +332,19 @@ mod tests {
         let _ = fs::remove_file(&path);
     }
 
+    #[test]
+    fn session_ticket_key_follows_reset_seed() {
+        let seed = ResetSeed {
+            bytes: [7u8; PICOQUIC_RESET_SECRET_SIZE],
+            created: false,
+        };
+        let key = session_ticket_key(Some(&seed)).expect("derive key");
+        assert_eq!(key, session_ticket_key(Some(&seed)).expect("derive key"));
+        assert_ne!(&key[..PICOQUIC_RESET_SECRET_SIZE], &seed.bytes[..]);
+        let random = session_ticket_key(None).expect("random key");
+        assert_ne!(random, session_ticket_key(None).expect("random key"));
+    }
+
     #[test]
     fn reset_seed_rejects_bad_length() {
         let path = temp_path("reset-seed-bad");
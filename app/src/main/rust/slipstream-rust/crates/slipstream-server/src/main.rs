@@ -1,15 +1,19 @@
+mod answer_cache;
 mod config;
+mod pipeline;
 mod server;
+mod shard;
 mod streams;
 mod target;
+mod tcp_ingress;
 mod udp_fallback;
+mod udp_relay;
 
 use clap::{parser::ValueSource, CommandFactory, FromArgMatches, Parser};
 use server::{run_server, ServerConfig};
 use slipstream_core::{
     normalize_domain, parse_host_port, parse_host_port_parts, sip003, AddressKind, HostPort,
 };
-use tokio::runtime::Builder;
 use tracing_subscriber::EnvFilter;
 
 #[derive(Parser, Debug)]
@@ -41,8 +45,38 @@ struct Args {
     domains: Vec<String>,
     #[arg(long = "max-connections", default_value_t = 256, value_parser = parse_max_connections)]
     max_connections: u32,
+    #[arg(long = "workers", default_value_t = 1, value_parser = parse_workers)]
+    workers: usize,
+    #[arg(long = "codec-threads", default_value_t = 0, value_parser = parse_codec_threads)]
+    codec_threads: usize,
+    #[arg(long = "egress-budget-kbps", default_value_t = 0, value_parser = parse_egress_budget)]
+    egress_budget_kbps: u64,
+    #[arg(long = "binlog-dir", value_name = "DIR")]
+    binlog_dir: Option<String>,
+    #[arg(long = "binlog-sample", default_value_t = 1, value_parser = parse_binlog_sample)]
+    binlog_sample: u32,
+    #[arg(long = "stats-interval-seconds", default_value_t = 0)]
+    stats_interval_seconds: u64,
+    #[arg(long = "fill-answers")]
+    fill_answers: bool,
+    #[arg(long = "udp-relay")]
+    udp_relay: bool,
+    #[arg(long = "dns-tcp")]
+    dns_tcp: bool,
+    #[arg(long = "dns-tcp-upgrade-kb", default_value_t = 0)]
+    dns_tcp_upgrade_kb: u64,
     #[arg(long = "idle-timeout-seconds", default_value_t = 1200)]
     idle_timeout_seconds: u64,
+    #[arg(long = "hibernate-seconds", default_value_t = 30)]
+    hibernate_seconds: u64,
+    #[arg(long = "target-pool", default_value_t = 2)]
+    target_pool: usize,
+    #[arg(long = "target-pool-idle-seconds", default_value_t = 30)]
+    target_pool_idle_seconds: u64,
+    #[arg(long = "answer-cache-ms", default_value_t = 2000)]
+    answer_cache_ms: u64,
+    #[arg(long = "recv-memory-mb", default_value_t = 1024)]
+    recv_memory_mb: u64,
     #[arg(long = "debug-streams")]
     debug_streams: bool,
     #[arg(long = "debug-commands")]
@@ -161,6 +195,30 @@ fn main() {
         args.max_connections
     };
 
+    let workers = if cli_provided(&matches, "workers") {
+        args.workers
+    } else if let Some(value) = sip003::last_option_value(&sip003_env.plugin_options, "workers") {
+        parse_workers(&value).unwrap_or_else(|err| {
+            tracing::error!("SIP003 env error: {}", err);
+            std::process::exit(2);
+        })
+    } else {
+        args.workers
+    };
+
+    let egress_budget_kbps = if cli_provided(&matches, "egress_budget_kbps") {
+        args.egress_budget_kbps
+    } else if let Some(value) =
+        sip003::last_option_value(&sip003_env.plugin_options, "egress-budget-kbps")
+    {
+        parse_egress_budget(&value).unwrap_or_else(|err| {
+            tracing::error!("SIP003 env error: {}", err);
+            std::process::exit(2);
+        })
+    } else {
+        args.egress_budget_kbps
+    };
+
     let config = ServerConfig {
         dns_listen_host,
         dns_listen_port,
@@ -172,16 +230,26 @@ fn main() {
         domains,
         max_connections,
         idle_timeout_seconds: args.idle_timeout_seconds,
+        hibernate_seconds: args.hibernate_seconds,
+        target_pool: args.target_pool,
+        target_pool_idle_seconds: args.target_pool_idle_seconds,
+        answer_cache_ms: args.answer_cache_ms,
+        recv_memory_mb: args.recv_memory_mb,
         debug_streams: args.debug_streams,
         debug_commands: args.debug_commands,
+        workers,
+        codec_threads: args.codec_threads,
+        egress_budget_kbps,
+        binlog_dir: args.binlog_dir.clone(),
+        binlog_sample: args.binlog_sample,
+        stats_interval_seconds: args.stats_interval_seconds,
+        fill_answers: args.fill_answers,
+        udp_relay: args.udp_relay,
+        dns_tcp: args.dns_tcp,
+        dns_tcp_upgrade_kb: args.dns_tcp_upgrade_kb,
     };
 
-    let runtime = Builder::new_current_thread()
-        .enable_io()
-        .enable_time()
-        .build()
-        .expect("Failed to build Tokio runtime");
-    match runtime.block_on(run_server(&config)) {
+    match run_server(&config) {
         Ok(code) => std::process::exit(code),
         Err(err) => {
             tracing::error!("Server error: {}", err);
@@ -226,6 +294,47 @@ fn parse_max_connections(input: &str) -> Result<u32, String> {
     Ok(value)
 }
 
+fn parse_workers(input: &str) -> Result<usize, String> {
+    let trimmed = input.trim();
+    let value = trimmed
+        .parse::<usize>()
+        .map_err(|_| format!("Invalid workers value: {}", trimmed))?;
+    // Worker IDs are carried in one connection ID byte.
+    if value == 0 || value > 256 {
+        return Err("workers must be between 1 and 256".to_string());
+    }
+    Ok(value)
+}
+
+fn parse_codec_threads(input: &str) -> Result<usize, String> {
+    let trimmed = input.trim();
+    let value = trimmed
+        .parse::<usize>()
+        .map_err(|_| format!("Invalid codec-threads value: {}", trimmed))?;
+    if value > 64 {
+        return Err("codec-threads must be at most 64".to_string());
+    }
+    Ok(value)
+}
+
+fn parse_egress_budget(input: &str) -> Result<u64, String> {
+    let trimmed = input.trim();
+    trimmed
+        .parse::<u64>()
+        .map_err(|_| format!("Invalid egress-budget-kbps value: {}", trimmed))
+}
+
+fn parse_binlog_sample(input: &str) -> Result<u32, String> {
+    let trimmed = input.trim();
+    let value = trimmed
+        .parse::<u32>()
+        .map_err(|_| format!("Invalid binlog-sample value: {}", trimmed))?;
+    if value == 0 {
+        return Err("binlog-sample must be at least 1".to_string());
+    }
+    Ok(value)
+}
+
 fn cli_provided(matches: &clap::ArgMatches, id: &str) -> bool {
     matches.value_source(id) == Some(ValueSource::CommandLine)
 }
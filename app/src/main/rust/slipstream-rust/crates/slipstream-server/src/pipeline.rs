@@ -0,0 +1,387 @@
+//! DNS decode and encode on a pool of threads around a worker's QUIC core.
+//!
+//! picoquic stays on the worker thread. With `--codec-threads`, the worker
+//! copies the queries it receives into decode jobs, runs the decoded queries
+//! a codec thread hands back through QUIC, and leaves encoding and sending the
+//! answers to the pool. Jobs go round-robin over bounded queues, one per
+//! thread; when every queue is full the worker does the job itself, so a slow
+//! pool costs parallelism, never answers.
+
+use crate::answer_cache::AnswerKey;
+use crate::server::{map_io, ServerError};
+use slipstream_core::net::{is_transient_udp_error, send_batch};
+use slipstream_dns::{
+    decode_query_with_domain_set, encode_response_into, encode_response_packets_into,
+    DecodeQueryError, DecodedQuery, DnsError, DomainSet, Question, Rcode, ResponseParams,
+};
+use std::net::SocketAddr;
+use std::os::unix::io::AsRawFd;
+use std::sync::mpsc::{sync_channel, Receiver, SyncSender, TrySendError};
+use std::sync::Arc;
+use std::thread::JoinHandle;
+use tokio::net::UdpSocket as TokioUdpSocket;
+use tokio::sync::mpsc;
+
+// Jobs queued per codec thread before the worker does them itself.
+const JOB_QUEUE_MAX: usize = 4;
+// Results the worker has yet to take before codec threads wait on it.
+const RESULT_QUEUE_MAX: usize = 64;
+// How long a codec thread waits for socket buffer room before retrying.
+const SEND_POLL_MS: libc::c_int = 10;
+
+/// A received query, copied for a codec thread.
+pub(crate) struct RawQuery {
+    pub(crate) packet: Vec<u8>,
+    pub(crate) peer: SocketAddr,
+    pub(crate) answer_key: Option<AnswerKey>,
+}
+
+pub(crate) struct DecodedPacket {
+    pub(crate) raw: RawQuery,
+    pub(crate) query: Result<DecodedQuery, DecodeQueryError>,
+}
+
+/// An answer ready to encode, owned so that it can cross threads.
+pub(crate) struct Answer {
+    peer: SocketAddr,
+    id: u16,
+    rd: bool,
+    cd: bool,
+    question: Question,
+    rcode: Option<Rcode>,
+    payload: Option<Vec<u8>>,
+    packet_ends: Vec<usize>,
+    answer_key: Option<AnswerKey>,
+}
+
+impl Answer {
+    pub(crate) fn new(
+        params: &ResponseParams<'_>,
+        packet_ends: &[usize],
+        peer: SocketAddr,
+        answer_key: Option<AnswerKey>,
+    ) -> Self {
+        Self {
+            peer,
+            id: params.id,
+            rd: params.rd,
+            cd: params.cd,
+            question: params.question.clone(),
+            rcode: params.rcode,
+            payload: params.payload.map(<[u8]>::to_vec),
+            packet_ends: packet_ends.to_vec(),
+            answer_key,
+        }
+    }
+
+    pub(crate) fn peer(&self) -> SocketAddr {
+        self.peer
+    }
+
+    pub(crate) fn answer_key(&self) -> Option<AnswerKey> {
+        self.answer_key
+    }
+
+    pub(crate) fn encode_into(&self, out: &mut Vec<u8>) -> Result<(), DnsError> {
+        let params = ResponseParams {
+            id: self.id,
+            rd: self.rd,
+            cd: self.cd,
+            question: &self.question,
+            payload: self.payload.as_deref(),
+            rcode: self.rcode,
+        };
+        encode_answer_into(&params, &self.packet_ends, out)
+    }
+}
+
+/// Encodes the answer to `params`, one record per QUIC packet when
+/// `packet_ends` splits its payload into several.
+pub(crate) fn encode_answer_into(
+    params: &ResponseParams<'_>,
+    packet_ends: &[usize],
+    out: &mut Vec<u8>,
+) -> Result<(), DnsError> {
+    match params.payload {
+        Some(payload) if packet_ends.len() > 1 => {
+            let mut start = 0;
+            let packets: Vec<&[u8]> = packet_ends
+                .iter()
+                .map(|&end| {
+                    let packet = &payload[start..end];
+                    start = end;
+                    packet
+                })
+                .collect();
+            encode_response_packets_into(params, &packets, out)
+        }
+        _ => encode_response_into(params, out),
+    }
+}
+
+pub(crate) fn decode_batch(domains: &DomainSet, batch: Vec<RawQuery>) -> Vec<DecodedPacket> {
+    batch
+        .into_iter()
+        .map(|raw| {
+            let query = decode_query_with_domain_set(&raw.packet, domains);
+            DecodedPacket { raw, query }
+        })
+        .collect()
+}
+
+enum Job {
+    Decode(Vec<RawQuery>),
+    Encode(Vec<Answer>),
+}
+
+pub(crate) enum CodecResult {
+    Decoded(Vec<DecodedPacket>),
+    /// Sent answers the answer cache keeps.
+    Sent(Vec<(AnswerKey, Vec<u8>)>),
+    Failed(ServerError),
+}
+
+pub(crate) struct CodecPool {
+    jobs: Vec<SyncSender<Job>>,
+    next: usize,
+    results: mpsc::Receiver<CodecResult>,
+    threads: Vec<JoinHandle<()>>,
+}
+
+impl CodecPool {
+    pub(crate) fn spawn(
+        threads: usize,
+        worker_id: usize,
+        domains: &[String],
+        udp: Arc<TokioUdpSocket>,
+    ) -> Result<Self, ServerError> {
+        let (result_tx, results) = mpsc::channel(RESULT_QUEUE_MAX);
+        let mut pool = Self {
+            jobs: Vec::with_capacity(threads),
+            next: 0,
+            results,
+            threads: Vec::with_capacity(threads),
+        };
+        for index in 0..threads {
+            let (job_tx, job_rx) = sync_channel(JOB_QUEUE_MAX);
+            let result_tx = result_tx.clone();
+            let domains = DomainSet::new(domains);
+            let udp = udp.clone();
+            let handle = std::thread::Builder::new()
+                .name(format!("slipstream-codec-{}-{}", worker_id, index))
+                .spawn(move || run_codec_thread(job_rx, result_tx, domains, udp))
+                .map_err(map_io)?;
+            pool.jobs.push(job_tx);
+            pool.threads.push(handle);
+        }
+        Ok(pool)
+    }
+
+    /// Queues `batch` for decoding, or hands it back if every queue is full.
+    pub(crate) fn decode(&mut self, batch: Vec<RawQuery>) -> Result<(), Vec<RawQuery>> {
+        match self.submit(Job::Decode(batch)) {
+            Ok(()) => Ok(()),
+            Err(Job::Decode(batch)) => Err(batch),
+            Err(Job::Encode(_)) => unreachable!("decode job came back as encode"),
+        }
+    }
+
+    /// Queues `answers` to be encoded and sent, or hands them back if every
+    /// queue is full.
+    pub(crate) fn encode(&mut self, answers: Vec<Answer>) -> Result<(), Vec<Answer>> {
+        match self.submit(Job::Encode(answers)) {
+            Ok(()) => Ok(()),
+            Err(Job::Encode(answers)) => Err(answers),
+            Err(Job::Decode(_)) => unreachable!("encode job came back as decode"),
+        }
+    }
+
+    fn submit(&mut self, mut job: Job) -> Result<(), Job> {
+        for _ in 0..self.jobs.len() {
+            let index = self.next;
+            self.next = (self.next + 1) % self.jobs.len();
+            match self.jobs[index].try_send(job) {
+                Ok(()) => return Ok(()),
+                Err(TrySendError::Full(unsent) | TrySendError::Disconnected(unsent)) => {
+                    job = unsent
+                }
+            }
+        }
+        Err(job)
+    }
+
+    pub(crate) async fn recv(&mut self) -> Option<CodecResult> {
+        self.results.recv().await
+    }
+}
+
+impl Drop for CodecPool {
+    fn drop(&mut self) {
+        // Closed results let threads blocked on a full queue go.
+        self.results.close();
+        self.jobs.clear();
+        for handle in self.threads.drain(..) {
+            let _ = handle.join();
+        }
+    }
+}
+
+fn run_codec_thread(
+    jobs: Receiver<Job>,
+    results: mpsc::Sender<CodecResult>,
+    domains: DomainSet,
+    udp: Arc<TokioUdpSocket>,
+) {
+    let mut responses: Vec<(Vec<u8>, SocketAddr)> = Vec::new();
+    let mut keys: Vec<Option<AnswerKey>> = Vec::new();
+    let mut spare: Vec<Vec<u8>> = Vec::new();
+    while let Ok(job) = jobs.recv() {
+        let result = match job {
+            Job::Decode(batch) => Some(CodecResult::Decoded(decode_batch(&domains, batch))),
+            Job::Encode(answers) => {
+                encode_and_send(&udp, &answers, &mut responses, &mut keys, &mut spare)
+            }
+        };
+        if let Some(result) = result {
+            if results.blocking_send(result).is_err() {
+                break;
+            }
+        }
+    }
+}
+
+fn encode_and_send(
+    udp: &TokioUdpSocket,
+    answers: &[Answer],
+    responses: &mut Vec<(Vec<u8>, SocketAddr)>,
+    keys: &mut Vec<Option<AnswerKey>>,
+    spare: &mut Vec<Vec<u8>>,
+) -> Option<CodecResult> {
+    for answer in answers {
+        let mut response = spare.pop().unwrap_or_default();
+        if let Err(err) = answer.encode_into(&mut response) {
+            return Some(CodecResult::Failed(ServerError::new(err.to_string())));
+        }
+        responses.push((response, answer.peer));
+        keys.push(answer.answer_key);
+    }
+    if let Err(err) = send_blocking(udp, responses) {
+        return Some(CodecResult::Failed(map_io(err)));
+    }
+    let mut cached = Vec::new();
+    for ((response, _), key) in responses.drain(..).zip(keys.drain(..)) {
+        match key {
+            Some(key) => cached.push((key, response)),
+            None => spare.push(response),
+        }
+    }
+    (!cached.is_empty()).then_some(CodecResult::Sent(cached))
+}
+
+/// Sends `responses` as the worker's `send_responses` does, waiting for
+/// socket buffer room with poll(2) instead of the runtime.
+fn send_blocking(udp: &TokioUdpSocket, responses: &[(Vec<u8>, SocketAddr)]) -> std::io::Result<()> {
+    let mut sent = 0usize;
+    while sent < responses.len() {
+        let batch: Vec<(&[u8], SocketAddr)> = responses[sent..]
+            .iter()
+            .map(|(response, peer)| (response.as_slice(), *peer))
+            .collect();
+        match send_batch(udp, &batch) {
+            Ok(count) => sent += count,
+            Err(err) if err.kind() == std::io::ErrorKind::WouldBlock => {
+                let mut pollfd = libc::pollfd {
+                    fd: udp.as_raw_fd(),
+                    events: libc::POLLOUT,
+                    revents: 0,
+                };
+                unsafe {
+                    libc::poll(&mut pollfd, 1, SEND_POLL_MS);
+                }
+            }
+            Err(err) => {
+                if !is_transient_udp_error(&err) {
+                    return Err(err);
+                }
+                sent += 1;
+            }
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{decode_batch, Answer, CodecPool, CodecResult, RawQuery};
+    use slipstream_dns::{
+        build_qname, decode_response, encode_query, DomainSet, QueryParams, CLASS_IN, RR_TXT,
+    };
+    use std::sync::Arc;
+    use std::time::Duration;
+    use tokio::net::UdpSocket as TokioUdpSocket;
+
+    fn query(payload: &[u8]) -> Vec<u8> {
+        let qname = build_qname(payload, "test.com").expect("qname");
+        encode_query(&QueryParams {
+            id: 7,
+            qname: &qname,
+            qtype: RR_TXT,
+            qclass: CLASS_IN,
+            rd: true,
+            cd: false,
+            qdcount: 1,
+            is_query: true,
+        })
+        .expect("query")
+    }
+
+    #[tokio::test]
+    async fn pool_decodes_and_answers_like_the_worker() {
+        let server = Arc::new(TokioUdpSocket::bind("127.0.0.1:0").await.expect("bind"));
+        let client = TokioUdpSocket::bind("127.0.0.1:0").await.expect("bind");
+        let client_addr = client.local_addr().expect("addr");
+        let domains = vec!["test.com".to_string()];
+        let mut pool = CodecPool::spawn(2, 0, &domains, server.clone()).expect("spawn");
+
+        let raw = |payload: &[u8]| RawQuery {
+            packet: query(payload),
+            peer: client_addr,
+            answer_key: None,
+        };
+        assert!(pool
+            .decode(vec![raw(&[0x40, 1, 2]), raw(&[0x40, 3])])
+            .is_ok());
+        let decoded = match tokio::time::timeout(Duration::from_secs(5), pool.recv()).await {
+            Ok(Some(CodecResult::Decoded(decoded))) => decoded,
+            _ => panic!("no decoded batch"),
+        };
+        let inline = decode_batch(&DomainSet::new(&domains), vec![raw(&[0x40, 1, 2])]);
+        let query = decoded[0].query.as_ref().ok().expect("decoded");
+        assert_eq!(query.payload, [0x40, 1, 2]);
+        assert_eq!(
+            inline[0].query.as_ref().ok().expect("inline").payload,
+            query.payload
+        );
+
+        let payload = [0x41u8, 9, 9, 9];
+        let params = slipstream_dns::ResponseParams {
+            id: query.id,
+            rd: query.rd,
+            cd: query.cd,
+            question: &query.question,
+            payload: Some(&payload),
+            rcode: None,
+        };
+        assert!(pool
+            .encode(vec![Answer::new(&params, &[], client_addr, None)])
+            .is_ok());
+        let mut buf = [0u8; 1500];
+        let (len, from) = tokio::time::timeout(Duration::from_secs(5), client.recv_from(&mut buf))
+            .await
+            .expect("answer")
+            .expect("recv");
+        assert_eq!(from, server.local_addr().expect("addr"));
+        assert_eq!(decode_response(&buf[..len]), Some(payload.to_vec()));
+        drop(pool);
+    }
+}
@@ -1,47 +1,100 @@
-use crate::config::{ensure_cert_key, load_or_create_reset_seed, ResetSeed};
-use crate::udp_fallback::{handle_packet, FallbackManager, PacketContext, MAX_UDP_PACKET_SIZE};
+use crate::answer_cache::{AnswerCache, AnswerKey};
+use crate::config::{
+    ensure_cert_key, load_or_create_reset_seed, session_ticket_key, ResetSeed, TICKET_KEY_SIZE,
+};
+use crate::pipeline::{
+    decode_batch, encode_answer_into, Answer, CodecPool, CodecResult, DecodedPacket, RawQuery,
+};
+use crate::shard::{ForwardedPacket, WorkerShard, FORWARD_QUEUE_MAX};
+use crate::target::TargetPool;
+use crate::tcp_ingress::{
+    bind_tcp_listener, spawn_tcp_ingress, TcpQuery, TcpReply, TCP_MESSAGE_MAX,
+};
+use crate::udp_fallback::{
+    defer_handshakes, handle_decoded, handle_packet, ingest_slots, FallbackManager, PacketContext,
+    MAX_UDP_PACKET_SIZE,
+};
+use crate::udp_relay::DATAGRAM_MAX_FRAME_SIZE;
 use slipstream_core::{
-    net::is_transient_udp_error, normalize_dual_stack_addr, resolve_host_port, HostPort,
+    flow_control::RecvMemoryPool,
+    net::{is_transient_udp_error, recv_batch, send_batch, RecvBatch},
+    normalize_dual_stack_addr, resolve_host_port, HostPort,
+};
+use slipstream_dns::{
+    answer_len, answer_payload_max, response_base_len, truncated_reply, DomainSet, Question, Rcode,
+    ResponseParams, CID_SLOT_OFFSET, EDNS_UDP_PAYLOAD,
 };
-use slipstream_dns::{encode_response, Question, Rcode, ResponseParams};
 use slipstream_ffi::picoquic::{
     picoquic_cnx_t, picoquic_create, picoquic_current_time, picoquic_delete_cnx,
-    picoquic_get_first_cnx, picoquic_get_next_cnx, picoquic_prepare_packet_ex, picoquic_quic_t,
-    slipstream_has_ready_stream, slipstream_is_flow_blocked, slipstream_server_cc_algorithm,
-    PICOQUIC_MAX_PACKET_SIZE, PICOQUIC_PACKET_LOOP_RECV_MAX,
+    picoquic_get_binlog_async_dropped, picoquic_prepare_packet_ex, picoquic_quic_t,
+    picoquic_set_binlog, picoquic_set_binlog_async, picoquic_set_cid_slots,
+    picoquic_set_wake_wheel, slipstream_enable_datagrams, slipstream_get_path_send_mtu,
+    slipstream_has_pending_send, slipstream_has_ready_stream, slipstream_idle_awake_count,
+    slipstream_idle_last_seen, slipstream_idle_next_to_close, slipstream_idle_next_to_trim,
+    slipstream_idle_touch, slipstream_is_flow_blocked, slipstream_perf_totals_t,
+    slipstream_server_cc_algorithm, slipstream_server_cc_set_egress_budget,
+    slipstream_set_worker_cid, slipstream_trim_idle_cnx, slipstream_trim_packet_pool,
+    PICOQUIC_MAX_PACKET_SIZE,
 };
 use slipstream_ffi::{
-    configure_quic_with_custom, socket_addr_to_storage, take_crypto_errors, QuicGuard,
+    configure_mtu_search, configure_quic_with_custom, count_perf_answers, enable_perf_stats,
+    read_perf_totals, socket_addr_to_storage, take_crypto_errors, update_perf_stats, PerfSummary,
+    QuicGuard,
 };
 use socket2::{Domain, Protocol, SockAddr, Socket, Type};
-use std::collections::HashMap;
+use std::collections::{HashMap, VecDeque};
 use std::ffi::CString;
 use std::fmt;
 use std::net::SocketAddr;
+use std::os::unix::io::AsRawFd;
 use std::path::Path;
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Arc;
 use std::time::{Duration, Instant};
+use tokio::io::Interest;
 use tokio::net::{lookup_host, UdpSocket as TokioUdpSocket};
+use tokio::runtime::{Builder, Runtime};
 use tokio::sync::mpsc;
 use tokio::time::sleep;
 
 use crate::streams::{
     drain_commands, handle_command, handle_shutdown, maybe_report_command_stats,
-    remove_connection_streams, server_callback, ServerState,
+    remove_connection_streams, server_callback, trim_connection_streams, ServerState,
 };
 
 // Protocol defaults; see docs/config.md for details.
 const SLIPSTREAM_ALPN: &str = "picoquic_sample";
 const DNS_MAX_QUERY_SIZE: usize = 512;
 const IDLE_SLEEP_MS: u64 = 10;
+// Datagrams taken per recvmmsg; fallback slots are 64 KiB each.
+const RECV_BATCH_MAX: usize = 64;
+const RECV_BATCH_MAX_FALLBACK: usize = 16;
 const IDLE_GC_INTERVAL: Duration = Duration::from_secs(1);
-// Default QUIC MTU for server packets; see docs/config.md for details.
+// Pooled packets kept per connection that is still awake after a trim.
+const HIBERNATE_POOL_PER_AWAKE: usize = 32;
+// Largest QUIC packet the server sends; see docs/config.md for details.
 const QUIC_MTU: u32 = 900;
+// Paths start here, which fits a 512-byte response to the longest question,
+// then probe up towards QUIC_MTU until within QUIC_MTU_PROBE_STEP of their limit.
+const QUIC_MIN_MTU: u32 = 217;
+const QUIC_MTU_PROBE_STEP: u32 = 32;
 pub(crate) const STREAM_READ_CHUNK_BYTES: usize = 4096;
 pub(crate) const DEFAULT_TCP_RCVBUF_BYTES: usize = 256 * 1024;
 pub(crate) const TARGET_WRITE_COALESCE_DEFAULT_BYTES: usize = 256 * 1024;
 const FLOW_BLOCKED_LOG_INTERVAL_US: u64 = 1_000_000;
+// Fill-answers mode stops packing once less than this much room is left.
+const FILL_MIN_PACKET_SIZE: usize = 128;
+// Answers each worker holds for retransmitted queries.
+const ANSWER_CACHE_MAX_ENTRIES: usize = 4096;
+// A connection gets at most one truncated answer per interval, so a path
+// whose resolver cannot reach us over TCP still moves data over UDP.
+const TCP_UPGRADE_INTERVAL_US: u64 = 1_000_000;
+// Queries opening a connection fed to picoquic per round. Each signs with the
+// server key on this thread, so in a reconnect storm the rest wait for later
+// rounds instead of holding up every established connection's answers.
+const HANDSHAKES_PER_ROUND: usize = 16;
+// Past this many waiting, the oldest are dropped; their clients retransmit.
+const HANDSHAKE_BACKLOG_MAX: usize = 4096;
 
 static SHOULD_SHUTDOWN: AtomicBool = AtomicBool::new(false);
 
@@ -81,8 +134,56 @@ pub struct ServerConfig {
     pub domains: Vec<String>,
     pub max_connections: u32,
     pub idle_timeout_seconds: u64,
+    /// Trim the memory of connections idle this long; 0 disables it.
+    pub hibernate_seconds: u64,
+    /// Target connections each worker keeps open ahead of new streams; 0
+    /// connects for every stream.
+    pub target_pool: usize,
+    /// Age at which an unused pooled target connection is replaced.
+    pub target_pool_idle_seconds: u64,
+    /// How long an answer is replayed to retransmits of its query; 0
+    /// disables the cache.
+    pub answer_cache_ms: u64,
     pub debug_streams: bool,
     pub debug_commands: bool,
+    pub workers: usize,
+    /// Threads each worker decodes queries and encodes answers on; 0 keeps
+    /// both on the worker thread.
+    pub codec_threads: usize,
+    /// Egress budget shared out across connections, in kilobits per second;
+    /// 0 leaves every path unlimited.
+    pub egress_budget_kbps: u64,
+    /// Directory for picoquic binary logs, written off the packet path.
+    pub binlog_dir: Option<String>,
+    /// Log one connection in this many.
+    pub binlog_sample: u32,
+    /// Interval of the aggregated performance summary; 0 disables it.
+    pub stats_interval_seconds: u64,
+    /// Pack several QUIC packets into each answer, one TXT record per packet.
+    pub fill_answers: bool,
+    /// Offer QUIC datagrams and relay the UDP they carry to its destination.
+    pub udp_relay: bool,
+    /// Also answer DNS over TCP on the listen port.
+    pub dns_tcp: bool,
+    /// Truncate a UDP answer, so the resolver retries over TCP, when this
+    /// many KiB wait for the connection; 0 never does. Needs `dns_tcp`.
+    pub dns_tcp_upgrade_kb: u64,
+    /// Receive memory shared by all connections, in MiB; 0 leaves it
+    /// unlimited.
+    pub recv_memory_mb: u64,
+}
+
+/// Process-wide state resolved once before any worker starts.
+struct ServerSetup {
+    target_addr: SocketAddr,
+    fallback_addr: Option<SocketAddr>,
+    reset_seed: Option<ResetSeed>,
+    ticket_key: [u8; TICKET_KEY_SIZE],
+    alpn: CString,
+    cert: CString,
+    key: CString,
+    binlog_dir: Option<CString>,
+    recv_pool: Arc<RecvMemoryPool>,
 }
 
 #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
@@ -130,6 +231,11 @@ pub(crate) enum Command {
         stream_id: u64,
         bytes: usize,
     },
+    DatagramReply {
+        cnx_id: usize,
+        flow_id: u16,
+        payload: Vec<u8>,
+    },
 }
 
 pub(crate) struct Slot {
@@ -142,9 +248,16 @@ pub(crate) struct Slot {
     pub(crate) cnx: *mut picoquic_cnx_t,
     pub(crate) path_id: libc::c_int,
     pub(crate) payload_override: Option<Vec<u8>>,
+    pub(crate) answer_key: Option<AnswerKey>,
+    /// The query carried the multi-answer marker.
+    pub(crate) multi_answer: bool,
+    /// The query came over DNS/TCP; the answer goes here.
+    pub(crate) tcp_reply: Option<TcpReply>,
+    /// QUIC packets of the query not yet fed to picoquic, see `ingest_slots`.
+    pub(crate) ingress: Vec<Vec<u8>>,
 }
 
-pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
+fn prepare_server(config: &ServerConfig) -> Result<ServerSetup, ServerError> {
     let cert_path = Path::new(&config.cert);
     let key_path = Path::new(&config.key);
     let generated = ensure_cert_key(cert_path, key_path).map_err(ServerError::new)?;
@@ -160,7 +273,7 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
         let seed = load_or_create_reset_seed(Path::new(path)).map_err(ServerError::new)?;
         if seed.created {
             tracing::warn!(
-                "Reset seed created at {}; stateless resets will now survive restarts",
+                "Reset seed created at {}; stateless resets and session tickets will now survive restarts",
                 path
             );
         } else {
@@ -169,11 +282,13 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
         Some(seed)
     } else {
         tracing::warn!(
-            "Reset seed not configured; stateless resets will not survive server restarts"
+            "Reset seed not configured; stateless resets and session tickets will not survive server restarts"
         );
         None
     };
 
+    let ticket_key = session_ticket_key(reset_seed.as_ref()).map_err(ServerError::new)?;
+
     let target_addr = resolve_host_port(&config.target_address)
         .map_err(|err| ServerError::new(err.to_string()))?;
     let fallback_addr = match &config.fallback_address {
@@ -189,31 +304,151 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
         .map_err(|_| ServerError::new("Cert path contains an unexpected null byte"))?;
     let key = CString::new(config.key.clone())
         .map_err(|_| ServerError::new("Key path contains an unexpected null byte"))?;
+    let binlog_dir = match &config.binlog_dir {
+        Some(dir) => Some(
+            CString::new(dir.clone())
+                .map_err(|_| ServerError::new("Binlog path contains an unexpected null byte"))?,
+        ),
+        None => None,
+    };
+    warn_overlapping_domains(&config.domains);
+    if config.domains.is_empty() {
+        return Err(ServerError::new("At least one domain must be configured"));
+    }
+
+    Ok(ServerSetup {
+        target_addr,
+        fallback_addr,
+        reset_seed,
+        ticket_key,
+        alpn,
+        cert,
+        key,
+        binlog_dir,
+        recv_pool: Arc::new(RecvMemoryPool::new(
+            config.recv_memory_mb.saturating_mul(1024 * 1024) as usize,
+        )),
+    })
+}
+
+/// Runs the server on the calling thread, or on `config.workers` threads that
+/// share one SO_REUSEPORT address, each with its own picoquic context.
+pub fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
+    let setup = prepare_server(config)?;
+
+    unsafe {
+        let handler = handle_sigterm as *const () as libc::sighandler_t;
+        libc::signal(libc::SIGTERM, handler);
+        // Process-wide, so the workers split one budget between them.
+        slipstream_server_cc_set_egress_budget(config.egress_budget_kbps.saturating_mul(1000) / 8);
+    }
+
+    if config.workers <= 1 {
+        return build_runtime()?.block_on(run_worker(config, &setup, None));
+    }
+    run_workers(config, &setup)
+}
+
+fn run_workers(config: &ServerConfig, setup: &ServerSetup) -> Result<i32, ServerError> {
+    let (senders, receivers): (Vec<_>, Vec<_>) = (0..config.workers)
+        .map(|_| mpsc::channel(FORWARD_QUEUE_MAX))
+        .unzip();
+    std::thread::scope(|scope| {
+        let mut handles = Vec::with_capacity(config.workers);
+        for (id, forwarded_rx) in receivers.into_iter().enumerate() {
+            let shard = WorkerShard::new(id, senders.clone(), forwarded_rx);
+            let spawned = std::thread::Builder::new()
+                .name(format!("slipstream-worker-{}", id))
+                .spawn_scoped(scope, move || {
+                    let result = build_runtime().and_then(|runtime| {
+                        runtime.block_on(run_worker(config, setup, Some(shard)))
+                    });
+                    if result.is_err() {
+                        // Take the other workers down with this one, as a single
+                        // server would have exited.
+                        SHOULD_SHUTDOWN.store(true, Ordering::Relaxed);
+                    }
+                    result
+                });
+            match spawned {
+                Ok(handle) => handles.push(handle),
+                Err(err) => {
+                    SHOULD_SHUTDOWN.store(true, Ordering::Relaxed);
+                    return Err(map_io(err));
+                }
+            }
+        }
+        drop(senders);
+
+        let mut exit = Ok(0);
+        for handle in handles {
+            let result = handle
+                .join()
+                .unwrap_or_else(|_| Err(ServerError::new("Server worker panicked")));
+            if let (Ok(_), Err(err)) = (&exit, result) {
+                exit = Err(err);
+            }
+        }
+        exit
+    })
+}
+
+fn build_runtime() -> Result<Runtime, ServerError> {
+    Builder::new_current_thread()
+        .enable_io()
+        .enable_time()
+        .build()
+        .map_err(map_io)
+}
+
+async fn run_worker(
+    config: &ServerConfig,
+    setup: &ServerSetup,
+    mut shard: Option<WorkerShard>,
+) -> Result<i32, ServerError> {
     let (command_tx, mut command_rx) = mpsc::unbounded_channel();
     let debug_streams = config.debug_streams;
     let debug_commands = config.debug_commands;
     let idle_timeout = Duration::from_secs(config.idle_timeout_seconds);
+    let hibernate_after = Duration::from_secs(config.hibernate_seconds);
     let mut state = Box::new(ServerState::new(
-        target_addr,
+        setup.target_addr,
         command_tx,
         debug_streams,
         debug_commands,
     ));
+    if config.target_pool > 0 {
+        state.set_target_pool(Some(TargetPool::spawn(
+            setup.target_addr,
+            config.target_pool,
+            Duration::from_secs(config.target_pool_idle_seconds.max(1)),
+        )));
+    }
+    state.set_recv_pool(setup.recv_pool.clone());
+    if config.udp_relay {
+        state.enable_udp_relay();
+    }
     let state_ptr: *mut ServerState = &mut *state;
     let _state = state;
 
     let current_time = unsafe { picoquic_current_time() };
-    let reset_seed_ptr = reset_seed
+    let reset_seed_ptr = setup
+        .reset_seed
         .as_ref()
         .map(|seed| seed.bytes.as_ptr())
         .unwrap_or(std::ptr::null());
+    // Each worker's context gets its share of the connection table.
+    let max_connections = match &shard {
+        Some(shard) => config.max_connections.div_ceil(shard.workers() as u32),
+        None => config.max_connections,
+    };
     let quic = unsafe {
         picoquic_create(
-            config.max_connections,
-            cert.as_ptr(),
-            key.as_ptr(),
+            max_connections,
+            setup.cert.as_ptr(),
+            setup.key.as_ptr(),
             std::ptr::null(),
-            alpn.as_ptr(),
+            setup.alpn.as_ptr(),
             Some(server_callback),
             state_ptr as *mut _,
             None,
@@ -222,8 +457,8 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
             current_time,
             std::ptr::null_mut(),
             std::ptr::null(),
-            std::ptr::null(),
-            0,
+            setup.ticket_key.as_ptr(),
+            setup.ticket_key.len(),
         )
     };
     if quic.is_null() {
@@ -237,6 +472,7 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
         )));
     }
     let _quic_guard = QuicGuard::new(quic);
+    let worker_id = shard.as_ref().map_or(0, |shard| shard.id());
     unsafe {
         if slipstream_server_cc_algorithm.is_null() {
             return Err(ServerError::new(
@@ -244,13 +480,56 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
             ));
         }
         configure_quic_with_custom(quic, slipstream_server_cc_algorithm, QUIC_MTU);
+        // Resolvers truncate or fail answers at different sizes; find each path's own.
+        configure_mtu_search(quic, QUIC_MIN_MTU, QUIC_MTU_PROBE_STEP);
+        // Every poll reschedules its connection; keep that O(1) with many idle clients.
+        picoquic_set_wake_wheel(quic, 1);
+        if let Some(shard) = &shard {
+            if slipstream_set_worker_cid(quic, shard.id() as u8) != 0 {
+                return Err(ServerError::new(
+                    "Could not configure worker connection IDs",
+                ));
+            }
+        }
+        // Slots let clients send compact short headers; each worker takes
+        // the slots that leave its ID as remainder, so they route like CIDs.
+        let (slot_first, slot_stride) = shard
+            .as_ref()
+            .map_or((0, 1), |shard| (shard.id() as u16, shard.workers() as u16));
+        if picoquic_set_cid_slots(quic, CID_SLOT_OFFSET as u8, slot_first, slot_stride) != 0 {
+            return Err(ServerError::new("Could not configure connection ID slots"));
+        }
+        if config.udp_relay && slipstream_enable_datagrams(quic, DATAGRAM_MAX_FRAME_SIZE) != 0 {
+            return Err(ServerError::new("Could not enable QUIC datagrams"));
+        }
+        if config.stats_interval_seconds > 0 {
+            if !enable_perf_stats(quic, worker_id) {
+                return Err(ServerError::new("Could not enable performance stats"));
+            }
+        }
+        if let Some(dir) = &setup.binlog_dir {
+            // Events are queued to a writer thread and dropped, not waited on,
+            // if it falls behind.
+            if picoquic_set_binlog(quic, dir.as_ptr()) != 0
+                || picoquic_set_binlog_async(quic, 0, config.binlog_sample) != 0
+            {
+                return Err(ServerError::new("Could not enable binary logging"));
+            }
+        }
     }
 
-    let udp = Arc::new(bind_udp_socket(&config.dns_listen_host, config.dns_listen_port).await?);
+    let udp = Arc::new(
+        bind_udp_socket(
+            &config.dns_listen_host,
+            config.dns_listen_port,
+            shard.is_some(),
+        )
+        .await?,
+    );
     let udp_local_addr = udp.local_addr().map_err(map_io)?;
     let map_ipv4_peers = matches!(udp_local_addr, SocketAddr::V6(_));
     let local_addr_storage = socket_addr_to_storage(udp_local_addr);
-    if let Some(addr) = fallback_addr {
+    if let Some(addr) = setup.fallback_addr {
         if addr == udp_local_addr {
             tracing::warn!(
                 "Fallback address matches DNS listen address ({}); non-DNS packets will loop. \
@@ -259,29 +538,73 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
             );
         }
     }
-    let mut fallback_mgr =
-        fallback_addr.map(|addr| FallbackManager::new(udp.clone(), addr, map_ipv4_peers));
-    warn_overlapping_domains(&config.domains);
-    let domains: Vec<&str> = config.domains.iter().map(String::as_str).collect();
-    if domains.is_empty() {
-        return Err(ServerError::new("At least one domain must be configured"));
-    }
-
-    unsafe {
-        let handler = handle_sigterm as *const () as libc::sighandler_t;
-        libc::signal(libc::SIGTERM, handler);
-    }
+    let mut fallback_mgr = setup
+        .fallback_addr
+        .map(|addr| FallbackManager::new(udp.clone(), addr, map_ipv4_peers));
+    let domains = DomainSet::new(&config.domains);
+    let mut codec_pool = if config.codec_threads > 0 {
+        Some(CodecPool::spawn(
+            config.codec_threads,
+            worker_id,
+            &config.domains,
+            udp.clone(),
+        )?)
+    } else {
+        None
+    };
+    let mut tcp_queries = if config.dns_tcp {
+        let listener = bind_tcp_listener(udp_local_addr, shard.is_some())?;
+        Some(spawn_tcp_ingress(listener))
+    } else {
+        None
+    };
+    let tcp_upgrade_bytes = if config.dns_tcp {
+        config.dns_tcp_upgrade_kb.saturating_mul(1024)
+    } else {
+        0
+    };
+    // When each connection last had an answer truncated.
+    let mut tcp_upgrades: HashMap<usize, u64> = HashMap::new();
+    // Queries opening a connection, waiting for their round.
+    let mut handshakes: VecDeque<Slot> = VecDeque::new();
 
     let recv_buf_len = if fallback_mgr.is_some() {
         MAX_UDP_PACKET_SIZE
     } else {
         DNS_MAX_QUERY_SIZE
     };
-    let mut recv_buf = vec![0u8; recv_buf_len];
-    let mut send_buf = vec![0u8; PICOQUIC_MAX_PACKET_SIZE];
-    let mut last_seen = HashMap::new();
+    // Fallback datagrams may be full-size, so keep the batch smaller there.
+    let recv_batch_len = if fallback_mgr.is_some() {
+        RECV_BATCH_MAX_FALLBACK
+    } else {
+        RECV_BATCH_MAX
+    };
+    let mut recv_batch_buf = RecvBatch::new(recv_batch_len, recv_buf_len);
+    let mut responses: Vec<(Vec<u8>, SocketAddr)> = Vec::new();
+    // Sent response buffers, reused for the next round's answers.
+    let mut response_bufs: Vec<Vec<u8>> = Vec::new();
+    // DNS/TCP answers hold many packets; UDP ones fit in one full-size packet.
+    let send_buf_len = if config.dns_tcp {
+        TCP_MESSAGE_MAX
+    } else {
+        PICOQUIC_MAX_PACKET_SIZE
+    };
+    let mut send_buf = vec![0u8; send_buf_len];
+    let mut packet_ends: Vec<usize> = Vec::new();
     let mut last_idle_gc = Instant::now();
+    let mut last_hibernate = Instant::now();
+    let mut perf_reporter = PerfReporter::new(
+        Duration::from_secs(config.stats_interval_seconds),
+        worker_id == 0,
+        setup.recv_pool.clone(),
+    );
     let mut last_flow_block_log_at: u64 = 0;
+    let mut answer_cache = (config.answer_cache_ms > 0).then(|| {
+        AnswerCache::new(
+            config.answer_cache_ms.saturating_mul(1000),
+            ANSWER_CACHE_MAX_ENTRIES,
+        )
+    });
 
     loop {
         drain_commands(state_ptr, &mut command_rx);
@@ -297,6 +620,7 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
         if let Some(manager) = fallback_mgr.as_mut() {
             manager.cleanup();
         }
+        unsafe { &mut *state_ptr }.cleanup_udp_relay();
 
         tokio::select! {
             command = command_rx.recv() => {
@@ -304,44 +628,57 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
                     handle_command(state_ptr, command);
                 }
             }
-            recv = udp.recv_from(&mut recv_buf) => {
-                match recv {
-                    Ok((size, peer)) => {
+            readable = udp.readable() => {
+                readable.map_err(map_io)?;
+                match udp.try_io(Interest::READABLE, || recv_batch(&*udp, &mut recv_batch_buf)) {
+                    Ok(_) => {
                         let loop_time = unsafe { picoquic_current_time() };
                         let context = PacketContext {
                             domains: &domains,
                             quic,
-                            current_time: loop_time,
-                            local_addr_storage: &local_addr_storage,
+                            shard: shard.as_ref(),
+                            tcp_reply: None,
                         };
-                        handle_packet(
-                            &mut slots,
-                            &recv_buf[..size],
-                            peer,
-                            &context,
-                            &mut fallback_mgr,
-                        )
-                        .await?;
-                        for _ in 1..PICOQUIC_PACKET_LOOP_RECV_MAX {
-                            match udp.try_recv_from(&mut recv_buf) {
-                                Ok((size, peer)) => {
-                                    handle_packet(
-                                        &mut slots,
-                                        &recv_buf[..size],
-                                        peer,
-                                        &context,
-                                        &mut fallback_mgr,
-                                    )
-                                    .await?;
-                                }
-                                Err(err) if err.kind() == std::io::ErrorKind::WouldBlock => break,
-                                Err(err) if err.kind() == std::io::ErrorKind::Interrupted => continue,
-                                Err(err) => {
-                                    if is_transient_udp_error(&err) {
-                                        break;
-                                    }
-                                    return Err(map_io(err));
-                                }
+                        let mut raw = Vec::new();
+                        for index in 0..recv_batch_buf.len() {
+                            let (packet, peer) = recv_batch_buf.get(index);
+                            let answer_key = match replay_answer(
+                                &mut answer_cache,
+                                packet,
+                                peer,
+                                loop_time,
+                                map_ipv4_peers,
+                                &mut responses,
+                                &mut response_bufs,
+                            ) {
+                                ReplayOutcome::Replayed => continue,
+                                ReplayOutcome::Miss(answer_key) => answer_key,
+                            };
+                            if codec_pool.is_some() {
+                                raw.push(RawQuery {
+                                    packet: packet.to_vec(),
+                                    peer,
+                                    answer_key,
+                                });
+                                continue;
+                            }
+                            let queued = slots.len();
+                            handle_packet(&mut slots, packet, peer, &context, &mut fallback_mgr)
+                                .await?;
+                            if let Some(slot) = slots.get_mut(queued) {
+                                slot.answer_key = answer_key;
+                            }
+                        }
+                        if let Some(pool) = codec_pool.as_mut().filter(|_| !raw.is_empty()) {
+                            if let Err(raw) = pool.decode(raw) {
+                                let decoded = decode_batch(&domains, raw);
+                                handle_decoded_batch(
+                                    &mut slots,
+                                    decoded,
+                                    &context,
+                                    &mut fallback_mgr,
+                                )
+                                .await?;
                             }
                         }
                     }
@@ -352,54 +689,255 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
                     }
                 }
             }
+            forwarded = recv_forwarded(&mut shard) => {
+                if let Some(first) = forwarded {
+                    let mut forwarded_batch: Vec<ForwardedPacket> = vec![first];
+                    if let Some(shard) = shard.as_mut() {
+                        while forwarded_batch.len() < recv_batch_len {
+                            let Some(next) = shard.try_recv() else {
+                                break;
+                            };
+                            forwarded_batch.push(next);
+                        }
+                    }
+                    let loop_time = unsafe { picoquic_current_time() };
+                    let context = PacketContext {
+                        domains: &domains,
+                        quic,
+                        shard: shard.as_ref(),
+                        tcp_reply: None,
+                    };
+                    let mut raw = Vec::new();
+                    for (packet, peer, tcp_reply) in forwarded_batch {
+                        if let Some(reply) = tcp_reply {
+                            handle_tcp_query(&mut slots, &packet, peer, reply, &context).await?;
+                            continue;
+                        }
+                        let answer_key = match replay_answer(
+                            &mut answer_cache,
+                            &packet,
+                            peer,
+                            loop_time,
+                            map_ipv4_peers,
+                            &mut responses,
+                            &mut response_bufs,
+                        ) {
+                            ReplayOutcome::Replayed => continue,
+                            ReplayOutcome::Miss(answer_key) => answer_key,
+                        };
+                        if codec_pool.is_some() {
+                            raw.push(RawQuery {
+                                packet,
+                                peer,
+                                answer_key,
+                            });
+                            continue;
+                        }
+                        let queued = slots.len();
+                        handle_packet(&mut slots, &packet, peer, &context, &mut fallback_mgr)
+                            .await?;
+                        if let Some(slot) = slots.get_mut(queued) {
+                            slot.answer_key = answer_key;
+                        }
+                    }
+                    if let Some(pool) = codec_pool.as_mut().filter(|_| !raw.is_empty()) {
+                        if let Err(raw) = pool.decode(raw) {
+                            let decoded = decode_batch(&domains, raw);
+                            handle_decoded_batch(&mut slots, decoded, &context, &mut fallback_mgr)
+                                .await?;
+                        }
+                    }
+                }
+            }
+            query = recv_tcp(&mut tcp_queries) => {
+                if let Some(first) = query {
+                    let mut batch = vec![first];
+                    if let Some(queries) = tcp_queries.as_mut() {
+                        while batch.len() < recv_batch_len {
+                            let Ok(next) = queries.try_recv() else {
+                                break;
+                            };
+                            batch.push(next);
+                        }
+                    }
+                    let context = PacketContext {
+                        domains: &domains,
+                        quic,
+                        shard: shard.as_ref(),
+                        tcp_reply: None,
+                    };
+                    for TcpQuery { packet, peer, reply } in batch {
+                        handle_tcp_query(&mut slots, &packet, peer, reply, &context).await?;
+                    }
+                } else {
+                    tcp_queries = None;
+                }
+            }
+            result = recv_codec(&mut codec_pool) => {
+                match result {
+                    Some(CodecResult::Decoded(decoded)) => {
+                        let context = PacketContext {
+                            domains: &domains,
+                            quic,
+                            shard: shard.as_ref(),
+                            tcp_reply: None,
+                        };
+                        handle_decoded_batch(&mut slots, decoded, &context, &mut fallback_mgr)
+                            .await?;
+                    }
+                    Some(CodecResult::Sent(sent)) => {
+                        if let Some(cache) = answer_cache.as_mut() {
+                            let now = unsafe { picoquic_current_time() };
+                            for (key, response) in sent {
+                                cache.insert(key, &response, now);
+                            }
+                        }
+                    }
+                    Some(CodecResult::Failed(err)) => return Err(err),
+                    None => return Err(ServerError::new("Codec threads exited")),
+                }
+            }
+            _ = std::future::ready(()), if !handshakes.is_empty() => {}
             _ = sleep(Duration::from_millis(IDLE_SLEEP_MS)) => {}
         }
 
-        let now = Instant::now();
-        if idle_timeout != Duration::ZERO {
-            note_active_connections(&mut last_seen, &slots, now);
-            maybe_gc_idle_connections(
-                quic,
-                state_ptr,
-                &mut last_seen,
-                idle_timeout,
-                &mut last_idle_gc,
-                now,
+        let dropped = defer_handshakes(&mut slots, &mut handshakes, HANDSHAKE_BACKLOG_MAX);
+        if dropped > 0 {
+            tracing::debug!(
+                "Dropped {} queries opening a connection: backlog full",
+                dropped
             );
         }
+        if !slots.is_empty() || !handshakes.is_empty() {
+            let ingest_time = unsafe { picoquic_current_time() };
+            ingest_slots(quic, &mut slots, &local_addr_storage, ingest_time)?;
+            let round = handshakes.len().min(HANDSHAKES_PER_ROUND);
+            let mut admitted: Vec<Slot> = handshakes.drain(..round).collect();
+            ingest_slots(quic, &mut admitted, &local_addr_storage, ingest_time)?;
+            slots.append(&mut admitted);
+        }
+
+        let now = Instant::now();
+        if idle_timeout != Duration::ZERO || hibernate_after != Duration::ZERO {
+            let idle_time = unsafe { picoquic_current_time() };
+            note_active_connections(&slots, idle_time);
+            if idle_timeout != Duration::ZERO {
+                maybe_gc_idle_connections(
+                    quic,
+                    state_ptr,
+                    idle_timeout,
+                    &mut last_idle_gc,
+                    now,
+                    idle_time,
+                );
+            }
+            if hibernate_after != Duration::ZERO {
+                maybe_hibernate_idle_connections(
+                    quic,
+                    state_ptr,
+                    hibernate_after,
+                    &mut last_hibernate,
+                    now,
+                    idle_time,
+                );
+            }
+        }
 
         drain_commands(state_ptr, &mut command_rx);
         maybe_report_command_stats(state_ptr);
+        perf_reporter.maybe_report(quic, now);
 
         if slots.is_empty() {
+            if !responses.is_empty() {
+                send_responses(&udp, &mut responses, &mut response_bufs).await?;
+            }
             continue;
         }
 
         let loop_time = unsafe { picoquic_current_time() };
+        let mut answers_with_data = 0u64;
+        let mut answers_empty = 0u64;
+        let mut answers = Vec::new();
+        let mut send_backlogs = None;
+        if !tcp_upgrades.is_empty() {
+            tcp_upgrades.retain(|_, at| loop_time.saturating_sub(*at) < TCP_UPGRADE_INTERVAL_US);
+        }
 
         for slot in slots.iter_mut() {
             let mut send_length = 0usize;
+            packet_ends.clear();
             let mut addr_to: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
             let mut addr_from: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
             let mut if_index: libc::c_int = 0;
+            let peer = if map_ipv4_peers {
+                normalize_dual_stack_addr(slot.peer)
+            } else {
+                slot.peer
+            };
+
+            if tcp_upgrade_bytes > 0
+                && slot.tcp_reply.is_none()
+                && slot.payload_override.is_none()
+                && slot.rcode.is_none()
+                && !slot.cnx.is_null()
+            {
+                // With bulk data waiting, a truncated answer has the resolver
+                // retry over TCP, where the answer can carry up to 64 KiB.
+                // The QUIC packet in the query is fed again there, as a
+                // duplicate, which still names the connection.
+                let cnx_id = slot.cnx as usize;
+                let backlogs =
+                    send_backlogs.get_or_insert_with(|| unsafe { (&*state_ptr).send_backlogs() });
+                if !tcp_upgrades.contains_key(&cnx_id)
+                    && backlogs
+                        .get(&cnx_id)
+                        .is_some_and(|&bytes| bytes as u64 >= tcp_upgrade_bytes)
+                {
+                    let params = ResponseParams {
+                        id: slot.id,
+                        rd: slot.rd,
+                        cd: slot.cd,
+                        question: &slot.question,
+                        payload: None,
+                        rcode: Some(Rcode::Ok),
+                    };
+                    let mut response = response_bufs.pop().unwrap_or_default();
+                    encode_answer_into(&params, &[], &mut response)
+                        .map_err(|err| ServerError::new(err.to_string()))?;
+                    if let Some(truncated) = truncated_reply(&response) {
+                        tcp_upgrades.insert(cnx_id, loop_time);
+                        answers_empty += 1;
+                        responses.push((truncated, peer));
+                        response_bufs.push(response);
+                        continue;
+                    }
+                    response_bufs.push(response);
+                }
+            }
 
             if slot.payload_override.is_none() && slot.rcode.is_none() && !slot.cnx.is_null() {
-                let ret = unsafe {
-                    picoquic_prepare_packet_ex(
-                        slot.cnx,
-                        slot.path_id,
-                        loop_time,
-                        send_buf.as_mut_ptr(),
-                        send_buf.len(),
-                        &mut send_length,
-                        &mut addr_to,
-                        &mut addr_from,
-                        &mut if_index,
-                        std::ptr::null_mut(),
-                    )
-                };
-                if ret < 0 {
-                    return Err(ServerError::new("Failed to prepare QUIC packet"));
+                // Most polls on an idle tunnel find nothing to send; answer
+                // those empty without running the full prepare.
+                let has_pending =
+                    unsafe { slipstream_has_pending_send(slot.cnx, slot.path_id, loop_time) != 0 };
+                if has_pending {
+                    let ret = unsafe {
+                        picoquic_prepare_packet_ex(
+                            slot.cnx,
+                            slot.path_id,
+                            loop_time,
+                            send_buf.as_mut_ptr(),
+                            PICOQUIC_MAX_PACKET_SIZE,
+                            &mut send_length,
+                            &mut addr_to,
+                            &mut addr_from,
+                            &mut if_index,
+                            std::ptr::null_mut(),
+                        )
+                    };
+                    if ret < 0 {
+                        return Err(ServerError::new("Failed to prepare QUIC packet"));
+                    }
                 }
 
                 if send_length == 0 {
@@ -440,9 +978,24 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
                         );
                         last_flow_block_log_at = loop_time;
                     }
+                } else if config.fill_answers || slot.multi_answer || slot.tcp_reply.is_some() {
+                    send_length = fill_answer(
+                        slot,
+                        loop_time,
+                        &mut send_buf,
+                        send_length,
+                        &mut packet_ends,
+                    )?;
                 }
             }
 
+            if !slot.cnx.is_null() {
+                if send_length > 0 {
+                    answers_with_data += 1;
+                } else {
+                    answers_empty += 1;
+                }
+            }
             let payload_override = slot.payload_override.as_deref();
             let (payload, rcode) = if let Some(payload) = payload_override {
                 (Some(payload), slot.rcode)
@@ -454,32 +1007,304 @@ pub async fn run_server(config: &ServerConfig) -> Result<i32, ServerError> {
             } else {
                 (None, slot.rcode)
             };
-            let response = encode_response(&ResponseParams {
+            let params = ResponseParams {
                 id: slot.id,
                 rd: slot.rd,
                 cd: slot.cd,
                 question: &slot.question,
                 payload,
                 rcode,
-            })
-            .map_err(|err| ServerError::new(err.to_string()))?;
-            let peer = if map_ipv4_peers {
-                normalize_dual_stack_addr(slot.peer)
+            };
+            let packet_ends: &[usize] = if payload_override.is_none() {
+                packet_ends.as_slice()
             } else {
-                slot.peer
+                &[]
             };
-            if let Err(err) = udp.send_to(&response, peer).await {
+            if let Some(reply) = slot.tcp_reply.as_ref() {
+                let mut response = Vec::new();
+                encode_answer_into(&params, packet_ends, &mut response)
+                    .map_err(|err| ServerError::new(err.to_string()))?;
+                // A closed connection has nobody left to answer.
+                let _ = reply.send(response);
+                continue;
+            }
+            if codec_pool.is_some() {
+                answers.push(Answer::new(&params, packet_ends, peer, slot.answer_key));
+                continue;
+            }
+            let mut response = response_bufs.pop().unwrap_or_default();
+            encode_answer_into(&params, packet_ends, &mut response)
+                .map_err(|err| ServerError::new(err.to_string()))?;
+            if let (Some(cache), Some(key)) = (answer_cache.as_mut(), slot.answer_key) {
+                cache.insert(key, &response, loop_time);
+            }
+            responses.push((response, peer));
+        }
+        unsafe { count_perf_answers(quic, answers_with_data, answers_empty) };
+        if let Some(pool) = codec_pool.as_mut().filter(|_| !answers.is_empty()) {
+            if let Err(answers) = pool.encode(answers) {
+                // Every codec queue is full: answer from here.
+                for answer in answers {
+                    let mut response = response_bufs.pop().unwrap_or_default();
+                    answer
+                        .encode_into(&mut response)
+                        .map_err(|err| ServerError::new(err.to_string()))?;
+                    if let (Some(cache), Some(key)) = (answer_cache.as_mut(), answer.answer_key()) {
+                        cache.insert(key, &response, loop_time);
+                    }
+                    responses.push((response, answer.peer()));
+                }
+            }
+        }
+        send_responses(&udp, &mut responses, &mut response_bufs).await?;
+    }
+
+    if setup.binlog_dir.is_some() {
+        let dropped = unsafe { picoquic_get_binlog_async_dropped(quic) };
+        if dropped > 0 {
+            tracing::warn!("Binary log dropped {} events under load", dropped);
+        }
+    }
+    Ok(0)
+}
+
+enum ReplayOutcome {
+    Replayed,
+    Miss(Option<AnswerKey>),
+}
+
+/// Queues the cached answer to a retransmitted query, or returns the key its
+/// fresh answer should be cached under.
+fn replay_answer(
+    cache: &mut Option<AnswerCache>,
+    packet: &[u8],
+    peer: SocketAddr,
+    now: u64,
+    map_ipv4_peers: bool,
+    responses: &mut Vec<(Vec<u8>, SocketAddr)>,
+    spare: &mut Vec<Vec<u8>>,
+) -> ReplayOutcome {
+    let Some(cache) = cache.as_mut() else {
+        return ReplayOutcome::Miss(None);
+    };
+    let Some(key) = cache.key(packet, peer) else {
+        return ReplayOutcome::Miss(None);
+    };
+    let Some(answer) = cache.lookup(&key, now) else {
+        return ReplayOutcome::Miss(Some(key));
+    };
+    let mut response = spare.pop().unwrap_or_default();
+    response.clear();
+    response.extend_from_slice(answer);
+    let peer = if map_ipv4_peers {
+        normalize_dual_stack_addr(peer)
+    } else {
+        peer
+    };
+    responses.push((response, peer));
+    ReplayOutcome::Replayed
+}
+
+/// Publishes this worker's performance counters every interval. The reporting
+/// worker also logs the summary of all workers since its last report.
+struct PerfReporter {
+    interval: Duration,
+    reporting: bool,
+    last_at: Instant,
+    previous: slipstream_perf_totals_t,
+    recv_pool: Arc<RecvMemoryPool>,
+}
+
+impl PerfReporter {
+    fn new(interval: Duration, reporting: bool, recv_pool: Arc<RecvMemoryPool>) -> Self {
+        Self {
+            interval,
+            reporting,
+            recv_pool,
+            last_at: Instant::now(),
+            previous: read_perf_totals(),
+        }
+    }
+
+    fn maybe_report(&mut self, quic: *mut picoquic_quic_t, now: Instant) {
+        if self.interval.is_zero() || now.duration_since(self.last_at) < self.interval {
+            return;
+        }
+        unsafe { update_perf_stats(quic) };
+        if self.reporting {
+            let current = read_perf_totals();
+            let summary =
+                PerfSummary::between(&self.previous, &current, now.duration_since(self.last_at));
+            tracing::info!(
+                "stats: {} recv_pool_kb={}/{}",
+                summary,
+                self.recv_pool.used() / 1024,
+                self.recv_pool.limit() / 1024
+            );
+            self.previous = current;
+        }
+        self.last_at = now;
+    }
+}
+
+/// Prepares further packets for the slot's path behind the first one, while
+/// their answers, of the query's type, fit the response size the path is
+/// known to carry: that of one full-size packet, at most EDNS_UDP_PAYLOAD.
+/// Answers over DNS/TCP fill up to the largest message TCP can frame.
+/// Records where each packet ends in `send_buf` and returns the total length.
+fn fill_answer(
+    slot: &Slot,
+    loop_time: u64,
+    send_buf: &mut [u8],
+    first_length: usize,
+    packet_ends: &mut Vec<usize>,
+) -> Result<usize, ServerError> {
+    let mut offset = first_length;
+    let qtype = slot.question.qtype;
+    let base_len = response_base_len(&slot.question);
+    let send_mtu = unsafe { slipstream_get_path_send_mtu(slot.cnx, slot.path_id) };
+    let response_max = if slot.tcp_reply.is_some() {
+        TCP_MESSAGE_MAX
+    } else {
+        (base_len + answer_len(qtype, send_mtu)).min(EDNS_UDP_PAYLOAD as usize)
+    };
+    let mut response_len = base_len + answer_len(qtype, first_length);
+    packet_ends.push(offset);
+    loop {
+        // Largest packet whose answer fits the room left.
+        let room = response_max.saturating_sub(response_len);
+        let max_length = answer_payload_max(qtype, room)
+            .min(send_buf.len() - offset)
+            .min(PICOQUIC_MAX_PACKET_SIZE);
+        if max_length < FILL_MIN_PACKET_SIZE {
+            break;
+        }
+        let mut send_length = 0usize;
+        let mut addr_to: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+        let mut addr_from: libc::sockaddr_storage = unsafe { std::mem::zeroed() };
+        let mut if_index: libc::c_int = 0;
+        let ret = unsafe {
+            picoquic_prepare_packet_ex(
+                slot.cnx,
+                slot.path_id,
+                loop_time,
+                send_buf[offset..].as_mut_ptr(),
+                max_length,
+                &mut send_length,
+                &mut addr_to,
+                &mut addr_from,
+                &mut if_index,
+                std::ptr::null_mut(),
+            )
+        };
+        if ret < 0 {
+            return Err(ServerError::new("Failed to prepare QUIC packet"));
+        }
+        if send_length == 0 {
+            break;
+        }
+        offset += send_length;
+        response_len += answer_len(qtype, send_length);
+        packet_ends.push(offset);
+    }
+    Ok(offset)
+}
+
+/// Flushes the round's DNS responses with as few sendmmsg calls as the
+/// socket buffer allows. Transient errors drop the datagram at the head,
+/// the same as a failed send_to did. The buffers go back to `spare`.
+async fn send_responses(
+    udp: &TokioUdpSocket,
+    responses: &mut Vec<(Vec<u8>, SocketAddr)>,
+    spare: &mut Vec<Vec<u8>>,
+) -> Result<(), ServerError> {
+    let mut sent = 0usize;
+    while sent < responses.len() {
+        let batch: Vec<(&[u8], SocketAddr)> = responses[sent..]
+            .iter()
+            .map(|(response, peer)| (response.as_slice(), *peer))
+            .collect();
+        match udp.try_io(Interest::WRITABLE, || send_batch(udp, &batch)) {
+            Ok(count) => sent += count,
+            Err(err) if err.kind() == std::io::ErrorKind::WouldBlock => {
+                udp.writable().await.map_err(map_io)?;
+            }
+            Err(err) => {
                 if !is_transient_udp_error(&err) {
                     return Err(map_io(err));
                 }
+                sent += 1;
             }
         }
     }
+    spare.extend(responses.drain(..).map(|(response, _)| response));
+    Ok(())
+}
 
-    Ok(0)
+async fn recv_codec(pool: &mut Option<CodecPool>) -> Option<CodecResult> {
+    match pool {
+        Some(pool) => pool.recv().await,
+        None => std::future::pending().await,
+    }
+}
+
+/// Runs queries a codec thread decoded through QUIC, as `handle_packet` does.
+async fn handle_decoded_batch(
+    slots: &mut Vec<Slot>,
+    decoded: Vec<DecodedPacket>,
+    context: &PacketContext<'_>,
+    fallback_mgr: &mut Option<FallbackManager>,
+) -> Result<(), ServerError> {
+    for DecodedPacket { raw, query } in decoded {
+        let queued = slots.len();
+        handle_decoded(slots, &raw.packet, raw.peer, query, context, fallback_mgr).await?;
+        if let Some(slot) = slots.get_mut(queued) {
+            slot.answer_key = raw.answer_key;
+        }
+    }
+    Ok(())
 }
 
-async fn bind_udp_socket(host: &str, port: u16) -> Result<TokioUdpSocket, ServerError> {
+/// Runs a DNS/TCP query through QUIC, as `handle_packet` does, and has its
+/// answer go back on the connection. Fallback only applies to UDP peers.
+async fn handle_tcp_query(
+    slots: &mut Vec<Slot>,
+    packet: &[u8],
+    peer: SocketAddr,
+    reply: TcpReply,
+    context: &PacketContext<'_>,
+) -> Result<(), ServerError> {
+    let context = PacketContext {
+        tcp_reply: Some(&reply),
+        ..*context
+    };
+    let queued = slots.len();
+    handle_packet(slots, packet, peer, &context, &mut None).await?;
+    if let Some(slot) = slots.get_mut(queued) {
+        slot.tcp_reply = Some(reply);
+    }
+    Ok(())
+}
+
+async fn recv_tcp(queries: &mut Option<mpsc::Receiver<TcpQuery>>) -> Option<TcpQuery> {
+    match queries {
+        Some(queries) => queries.recv().await,
+        None => std::future::pending().await,
+    }
+}
+
+async fn recv_forwarded(shard: &mut Option<WorkerShard>) -> Option<ForwardedPacket> {
+    match shard {
+        Some(shard) => shard.recv().await,
+        None => std::future::pending().await,
+    }
+}
+
+async fn bind_udp_socket(
+    host: &str,
+    port: u16,
+    reuse_port: bool,
+) -> Result<TokioUdpSocket, ServerError> {
     let addrs: Vec<SocketAddr> = lookup_host((host, port)).await.map_err(map_io)?.collect();
     if addrs.is_empty() {
         return Err(ServerError::new(format!(
@@ -489,7 +1314,7 @@ async fn bind_udp_socket(host: &str, port: u16) -> Result<TokioUdpSocket, Server
     }
     let mut last_err = None;
     for addr in addrs {
-        match bind_udp_socket_addr(addr) {
+        match bind_udp_socket_addr(addr, reuse_port) {
             Ok(socket) => return Ok(socket),
             Err(err) => last_err = Some(err),
         }
@@ -499,7 +1324,7 @@ async fn bind_udp_socket(host: &str, port: u16) -> Result<TokioUdpSocket, Server
     }))
 }
 
-fn bind_udp_socket_addr(addr: SocketAddr) -> Result<TokioUdpSocket, ServerError> {
+fn bind_udp_socket_addr(addr: SocketAddr, reuse_port: bool) -> Result<TokioUdpSocket, ServerError> {
     let domain = match addr {
         SocketAddr::V4(_) => Domain::IPV4,
         SocketAddr::V6(_) => Domain::IPV6,
@@ -514,6 +1339,9 @@ fn bind_udp_socket_addr(addr: SocketAddr) -> Result<TokioUdpSocket, ServerError>
             );
         }
     }
+    if reuse_port {
+        set_reuse_port(&socket).map_err(map_io)?;
+    }
     let sock_addr = SockAddr::from(addr);
     socket.bind(&sock_addr).map_err(map_io)?;
     socket.set_nonblocking(true).map_err(map_io)?;
@@ -521,96 +1349,118 @@ fn bind_udp_socket_addr(addr: SocketAddr) -> Result<TokioUdpSocket, ServerError>
     TokioUdpSocket::from_std(std_socket).map_err(map_io)
 }
 
+pub(crate) fn set_reuse_port(socket: &Socket) -> std::io::Result<()> {
+    let enable: libc::c_int = 1;
+    let ret = unsafe {
+        libc::setsockopt(
+            socket.as_raw_fd(),
+            libc::SOL_SOCKET,
+            libc::SO_REUSEPORT,
+            &enable as *const _ as *const libc::c_void,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret != 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
 pub(crate) fn map_io(err: std::io::Error) -> ServerError {
     ServerError::new(err.to_string())
 }
 
-fn note_active_connections(last_seen: &mut HashMap<usize, Instant>, slots: &[Slot], now: Instant) {
+fn note_active_connections(slots: &[Slot], current_time: u64) {
     for slot in slots {
         if !slot.cnx.is_null() {
-            last_seen.insert(slot.cnx as usize, now);
+            unsafe { slipstream_idle_touch(slot.cnx, current_time) };
         }
     }
 }
 
-fn collect_active_connections(quic: *mut picoquic_quic_t) -> HashMap<usize, *mut picoquic_cnx_t> {
-    let mut active = HashMap::new();
-    let mut cnx = unsafe { picoquic_get_first_cnx(quic) };
-    while !cnx.is_null() {
-        active.insert(cnx as usize, cnx);
-        cnx = unsafe { picoquic_get_next_cnx(cnx) };
-    }
-    active
-}
-
-fn prune_and_collect_idle<T>(
-    last_seen: &mut HashMap<usize, Instant>,
-    active: &HashMap<usize, T>,
-    idle_timeout: Duration,
-    now: Instant,
-) -> Vec<usize> {
-    last_seen.retain(|cnx_id, _| active.contains_key(cnx_id));
-    let mut idle = Vec::new();
-    for (cnx_id, last) in last_seen.iter() {
-        if now.duration_since(*last) >= idle_timeout {
-            idle.push(*cnx_id);
-        }
-    }
-    idle
-}
-
+/// Closes the connections last seen `idle_timeout` ago or earlier. They come
+/// oldest first off the context's idle lists, so a pass costs nothing for
+/// the connections that stay.
 fn maybe_gc_idle_connections(
     quic: *mut picoquic_quic_t,
     state_ptr: *mut ServerState,
-    last_seen: &mut HashMap<usize, Instant>,
     idle_timeout: Duration,
     last_gc: &mut Instant,
     now: Instant,
+    current_time: u64,
 ) {
-    if last_seen.is_empty() {
-        return;
-    }
     if now.duration_since(*last_gc) < IDLE_GC_INTERVAL {
         return;
     }
-
-    let active = collect_active_connections(quic);
-    if active.is_empty() {
-        last_seen.clear();
-        *last_gc = now;
+    *last_gc = now;
+    let Some(cutoff) = current_time.checked_sub(idle_timeout.as_micros() as u64) else {
         return;
-    }
+    };
 
-    if last_seen.is_empty() {
-        *last_gc = now;
-        return;
+    let state = unsafe { &mut *state_ptr };
+    loop {
+        let cnx = unsafe { slipstream_idle_next_to_close(quic, cutoff) };
+        if cnx.is_null() {
+            break;
+        }
+        let cnx_id = cnx as usize;
+        remove_connection_streams(state, cnx_id);
+        tracing::debug!(
+            "idle gc: closing connection cnx_id={} idle_for_ms={}",
+            cnx_id,
+            current_time.saturating_sub(unsafe { slipstream_idle_last_seen(cnx) }) / 1000
+        );
+        unsafe {
+            picoquic_delete_cnx(cnx);
+        }
     }
+}
 
-    let idle = prune_and_collect_idle(last_seen, &active, idle_timeout, now);
-
-    if idle.is_empty() {
-        *last_gc = now;
+/// Releases what idle connections hold beyond the state needed to resume:
+/// spurious-loss packets, spare stream buffer capacity, and the part of the
+/// packet pool that the connections still awake do not need. A connection
+/// is trimmed once per idle period: it leaves the awake list until it is
+/// seen again.
+fn maybe_hibernate_idle_connections(
+    quic: *mut picoquic_quic_t,
+    state_ptr: *mut ServerState,
+    hibernate_after: Duration,
+    last_run: &mut Instant,
+    now: Instant,
+    current_time: u64,
+) {
+    if now.duration_since(*last_run) < IDLE_GC_INTERVAL {
         return;
     }
+    *last_run = now;
+    let Some(cutoff) = current_time.checked_sub(hibernate_after.as_micros() as u64) else {
+        return;
+    };
 
     let state = unsafe { &mut *state_ptr };
-    for cnx_id in idle {
-        if let Some(&cnx) = active.get(&cnx_id) {
-            remove_connection_streams(state, cnx_id);
-            if let Some(last) = last_seen.get(&cnx_id) {
-                tracing::debug!(
-                    "idle gc: closing connection cnx_id={} idle_for_ms={}",
-                    cnx_id,
-                    now.duration_since(*last).as_millis()
-                );
-            }
-            unsafe {
-                picoquic_delete_cnx(cnx);
-            }
-            last_seen.remove(&cnx_id);
+    let mut trimmed = 0usize;
+    let mut packets_released = 0usize;
+    loop {
+        let cnx = unsafe { slipstream_idle_next_to_trim(quic, cutoff) };
+        if cnx.is_null() {
+            break;
         }
+        trim_connection_streams(state, cnx as usize);
+        packets_released += unsafe { slipstream_trim_idle_cnx(cnx) };
+        trimmed += 1;
     }
-    *last_gc = now;
+    if trimmed == 0 {
+        return;
+    }
+    let awake = unsafe { slipstream_idle_awake_count(quic) };
+    let pool_freed = unsafe { slipstream_trim_packet_pool(quic, awake * HIBERNATE_POOL_PER_AWAKE) };
+    tracing::debug!(
+        "hibernate: trimmed connections={} packets_released={} pool_freed={} awake={}",
+        trimmed,
+        packets_released,
+        pool_freed,
+        awake
+    );
 }
 
 fn warn_overlapping_domains(domains: &[String]) {
@@ -661,26 +1511,18 @@ fn is_label_suffix(domain: &str, suffix: &str) -> bool {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use slipstream_dns::txt_answer_len;
 
     #[test]
-    fn prune_and_collect_idle_prunes_and_collects() {
-        let now = Instant::now();
-        let idle_timeout = Duration::from_secs(10);
-        let mut last_seen = HashMap::new();
-        last_seen.insert(1, now - Duration::from_secs(11));
-        last_seen.insert(2, now - Duration::from_secs(5));
-        last_seen.insert(3, now - Duration::from_secs(12));
-
-        let mut active = HashMap::new();
-        active.insert(1, ());
-        active.insert(2, ());
-
-        let mut idle = prune_and_collect_idle(&mut last_seen, &active, idle_timeout, now);
-        idle.sort_unstable();
-
-        assert_eq!(idle, vec![1]);
-        assert!(last_seen.contains_key(&1));
-        assert!(last_seen.contains_key(&2));
-        assert!(!last_seen.contains_key(&3));
+    fn min_mtu_fits_a_512_byte_response_to_the_longest_question() {
+        let label = "a".repeat(63);
+        let question = Question {
+            name: format!("{0}.{0}.{0}.{1}.", label, "a".repeat(61)),
+            qtype: slipstream_dns::RR_TXT,
+            qclass: slipstream_dns::CLASS_IN,
+        };
+        let base_len = response_base_len(&question);
+        assert_eq!(base_len + txt_answer_len(QUIC_MIN_MTU as usize), 512);
+        assert!(base_len + txt_answer_len(QUIC_MIN_MTU as usize + 1) > 512);
     }
 }
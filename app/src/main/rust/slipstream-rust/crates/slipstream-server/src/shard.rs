@@ -0,0 +1,149 @@
+use crate::tcp_ingress::TcpReply;
+use slipstream_dns::compact_slot;
+use std::net::SocketAddr;
+use tokio::sync::mpsc;
+
+/// Byte of every server-issued CID that carries the owning worker's ID
+/// (clear-text picoquic LB encoding, set by `slipstream_set_worker_cid`).
+const WORKER_CID_OFFSET: usize = 1;
+const LONG_HEADER_DCID_OFFSET: usize = 6;
+
+pub(crate) const FORWARD_QUEUE_MAX: usize = 1024;
+
+/// A raw query, its peer and, for DNS/TCP queries, where the answer goes.
+pub(crate) type ForwardedPacket = (Vec<u8>, SocketAddr, Option<TcpReply>);
+
+/// One worker's view of the SO_REUSEPORT group.
+///
+/// The kernel spreads resolver queries across sockets by 4-tuple, which says
+/// nothing about the QUIC connection inside. Each datagram is routed by its
+/// destination CID instead: server CIDs carry the worker ID, and a client's
+/// initial random CID picks a worker from the same byte, so every packet of a
+/// connection, before and after the handshake, lands on one worker. Packets
+/// for another worker are handed over a bounded queue; the owner answers from
+/// its own socket, which is bound to the same address.
+pub(crate) struct WorkerShard {
+    id: usize,
+    peers: Vec<mpsc::Sender<ForwardedPacket>>,
+    forwarded_rx: mpsc::Receiver<ForwardedPacket>,
+}
+
+impl WorkerShard {
+    pub(crate) fn new(
+        id: usize,
+        peers: Vec<mpsc::Sender<ForwardedPacket>>,
+        forwarded_rx: mpsc::Receiver<ForwardedPacket>,
+    ) -> Self {
+        Self {
+            id,
+            peers,
+            forwarded_rx,
+        }
+    }
+
+    pub(crate) fn id(&self) -> usize {
+        self.id
+    }
+
+    pub(crate) fn workers(&self) -> usize {
+        self.peers.len()
+    }
+
+    /// Returns the worker owning `payload` if it is not this one.
+    pub(crate) fn foreign_owner(&self, payload: &[u8]) -> Option<usize> {
+        quic_owner(payload, self.workers()).filter(|&owner| owner != self.id)
+    }
+
+    /// Hands a raw DNS query to its owner. A full queue drops the query; the
+    /// resolver retries it like any lost datagram.
+    pub(crate) fn forward(
+        &self,
+        owner: usize,
+        packet: &[u8],
+        peer: SocketAddr,
+        tcp_reply: Option<TcpReply>,
+    ) {
+        if let Err(err) = self.peers[owner].try_send((packet.to_vec(), peer, tcp_reply)) {
+            tracing::debug!(
+                "worker {}: dropping query for worker {}: {}",
+                self.id,
+                owner,
+                err
+            );
+        }
+    }
+
+    pub(crate) async fn recv(&mut self) -> Option<ForwardedPacket> {
+        self.forwarded_rx.recv().await
+    }
+
+    pub(crate) fn try_recv(&mut self) -> Option<ForwardedPacket> {
+        self.forwarded_rx.try_recv().ok()
+    }
+}
+
+/// Picks the worker for a QUIC packet from its destination CID.
+fn quic_owner(payload: &[u8], workers: usize) -> Option<usize> {
+    if workers <= 1 {
+        return None;
+    }
+    if let Some(slot) = compact_slot(payload) {
+        return Some(slot as usize % workers);
+    }
+    let first = *payload.first()?;
+    let dcid = if first & 0x80 != 0 {
+        let dcid_len = *payload.get(LONG_HEADER_DCID_OFFSET - 1)? as usize;
+        payload.get(LONG_HEADER_DCID_OFFSET..LONG_HEADER_DCID_OFFSET + dcid_len)?
+    } else {
+        // Short headers do not carry the CID length; only the routing byte is needed.
+        payload.get(1..)?
+    };
+    dcid.get(WORKER_CID_OFFSET)
+        .map(|&byte| byte as usize % workers)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::quic_owner;
+
+    fn long_header(dcid: &[u8]) -> Vec<u8> {
+        let mut packet = vec![0xc0, 0, 0, 0, 1, dcid.len() as u8];
+        packet.extend_from_slice(dcid);
+        packet.extend_from_slice(&[8, 1, 2, 3, 4, 5, 6, 7, 8]);
+        packet
+    }
+
+    #[test]
+    fn long_and_short_headers_route_by_cid_byte() {
+        let dcid = [0x3f, 2, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff];
+        assert_eq!(quic_owner(&long_header(&dcid), 4), Some(2));
+
+        let mut short = vec![0x40];
+        short.extend_from_slice(&dcid);
+        short.extend_from_slice(&[0u8; 20]);
+        assert_eq!(quic_owner(&short, 4), Some(2));
+    }
+
+    #[test]
+    fn compact_headers_route_by_slot() {
+        // Worker 1 of 3 issues slots 1, 4, 7...
+        assert_eq!(quic_owner(&[0x81, 0x00, 0x07, 0xaa], 3), Some(1));
+        assert_eq!(quic_owner(&[0xbf, 0x01, 0x00, 0xaa], 3), Some(1));
+        assert_eq!(quic_owner(&[0x80, 0x00, 0x06, 0xaa], 3), Some(0));
+        assert_eq!(quic_owner(&[0x80, 0x00], 3), None);
+    }
+
+    #[test]
+    fn client_initial_cid_is_spread_by_modulo() {
+        let dcid = [0x11, 7, 0, 0, 0, 0, 0, 0];
+        assert_eq!(quic_owner(&long_header(&dcid), 3), Some(1));
+    }
+
+    #[test]
+    fn truncated_or_single_worker_stays_local() {
+        assert_eq!(quic_owner(&[], 4), None);
+        assert_eq!(quic_owner(&[0xc0, 0, 0, 0, 1, 8, 1], 4), None);
+        assert_eq!(quic_owner(&[0x40, 1], 4), None);
+        assert_eq!(quic_owner(&long_header(&[0, 3, 0, 0]), 1), None);
+    }
+}
@@ -1,20 +1,27 @@
-use crate::server::{Command, StreamKey, StreamWrite};
-use crate::target::spawn_target_connector;
+use crate::server::{Command, StreamKey, StreamWrite, STREAM_READ_CHUNK_BYTES};
+use crate::target::{spawn_target_connector, TargetPool};
+use crate::udp_relay::UdpRelay;
 use slipstream_core::flow_control::{
     conn_reserve_bytes, consume_error_log_message, consume_stream_data, handle_stream_receive,
     overflow_log_message, promote_error_log_message, promote_streams, reserve_target_offset,
-    FlowControlState, HasFlowControlState, PromoteEntry, StreamReceiveConfig, StreamReceiveOps,
+    FlowControlState, HasFlowControlState, PromoteEntry, RecvMemoryPool, StreamReceiveConfig,
+    StreamReceiveOps,
 };
 use slipstream_core::invariants::InvariantReporter;
+use slipstream_core::priority::StreamClass;
 #[cfg(test)]
 use slipstream_core::test_support::FailureCounter;
 use slipstream_ffi::picoquic::{
     picoquic_call_back_event_t, picoquic_close, picoquic_close_immediate, picoquic_cnx_t,
     picoquic_current_time, picoquic_get_first_cnx, picoquic_get_next_cnx,
     picoquic_mark_active_stream, picoquic_provide_stream_data_buffer, picoquic_quic_t,
-    picoquic_reset_stream, picoquic_stop_sending, picoquic_stream_data_consumed,
+    picoquic_reset_stream, picoquic_set_stream_priority, picoquic_stop_sending,
+    picoquic_stream_data_consumed, PICOQUIC_STREAM_DATA_SEGMENTS_MAX,
+};
+use slipstream_ffi::{
+    abort_stream_bidi, provide_stream_data_segments, SLIPSTREAM_FILE_CANCEL_ERROR,
+    SLIPSTREAM_INTERNAL_ERROR,
 };
-use slipstream_ffi::{abort_stream_bidi, SLIPSTREAM_FILE_CANCEL_ERROR, SLIPSTREAM_INTERNAL_ERROR};
 use std::collections::{HashMap, HashSet, VecDeque};
 use std::net::SocketAddr;
 use std::sync::atomic::{AtomicBool, Ordering};
@@ -27,8 +34,14 @@ static INVARIANT_REPORTER: InvariantReporter = InvariantReporter::new(1_000_000)
 
 pub(crate) struct ServerState {
     target_addr: SocketAddr,
+    target_pool: Option<TargetPool>,
+    recv_pool: Arc<RecvMemoryPool>,
     streams: HashMap<StreamKey, ServerStream>,
     multi_streams: HashSet<usize>,
+    udp_relay: Option<UdpRelay>,
+    // Streams whose class changed while picoquic was preparing a packet,
+    // re-pinned once it is done.
+    repin: Vec<(StreamKey, u8)>,
     command_tx: mpsc::UnboundedSender<Command>,
     debug_streams: bool,
     debug_commands: bool,
@@ -90,8 +103,12 @@ impl ServerState {
     ) -> Self {
         Self {
             target_addr,
+            target_pool: None,
+            recv_pool: Arc::new(RecvMemoryPool::new(0)),
             streams: HashMap::new(),
             multi_streams: HashSet::new(),
+            udp_relay: None,
+            repin: Vec::new(),
             command_tx,
             debug_streams,
             debug_commands,
@@ -103,6 +120,45 @@ impl ServerState {
         }
     }
 
+    /// New streams take their target connection from `pool` when it has one.
+    pub(crate) fn set_target_pool(&mut self, pool: Option<TargetPool>) {
+        self.target_pool = pool;
+    }
+
+    /// Queued receive data is charged to `pool`, shared with other workers.
+    pub(crate) fn set_recv_pool(&mut self, pool: Arc<RecvMemoryPool>) {
+        self.recv_pool = pool;
+    }
+
+    /// Relays the UDP that connections send in QUIC datagrams.
+    pub(crate) fn enable_udp_relay(&mut self) {
+        self.udp_relay = Some(UdpRelay::new(self.command_tx.clone()));
+    }
+
+    /// Closes the relay flows idle past their timeout.
+    pub(crate) fn cleanup_udp_relay(&mut self) {
+        if let Some(relay) = self.udp_relay.as_mut() {
+            relay.cleanup();
+        }
+    }
+
+    /// Bytes from the targets waiting to go down each connection: what its
+    /// streams have stashed, plus the reads still queued, counted as full.
+    pub(crate) fn send_backlogs(&self) -> HashMap<usize, usize> {
+        let mut backlogs = HashMap::new();
+        for (key, stream) in self.streams.iter() {
+            let stashed = stream.send_stash.as_ref().map_or(0, Vec::len);
+            let queued = stream
+                .data_rx
+                .as_ref()
+                .map_or(0, |data_rx| data_rx.len() * STREAM_READ_CHUNK_BYTES);
+            if stashed + queued > 0 {
+                *backlogs.entry(key.cnx).or_insert(0) += stashed + queued;
+            }
+        }
+        backlogs
+    }
+
     pub(crate) fn stream_debug_metrics(&self, cnx_id: usize) -> ServerStreamMetrics {
         let mut metrics = ServerStreamMetrics {
             multi_stream: self.multi_streams.contains(&cnx_id),
@@ -289,6 +345,7 @@ struct CommandCounts {
     stream_read_error: u64,
     stream_write_error: u64,
     stream_write_drained: u64,
+    datagram_reply: u64,
 }
 
 impl CommandCounts {
@@ -301,6 +358,7 @@ impl CommandCounts {
             Command::StreamReadError { .. } => self.stream_read_error += 1,
             Command::StreamWriteError { .. } => self.stream_write_error += 1,
             Command::StreamWriteDrained { .. } => self.stream_write_drained += 1,
+            Command::DatagramReply { .. } => self.datagram_reply += 1,
         }
     }
 
@@ -312,6 +370,7 @@ impl CommandCounts {
             + self.stream_read_error
             + self.stream_write_error
             + self.stream_write_drained
+            + self.datagram_reply
     }
 
     fn reset(&mut self) {
@@ -332,6 +391,7 @@ struct ServerStream {
     pending_fin: bool,
     fin_enqueued: bool,
     flow: FlowControlState,
+    class: StreamClass,
 }
 
 impl HasFlowControlState for ServerStream {
@@ -420,6 +480,15 @@ pub(crate) unsafe extern "C" fn server_callback(
             }
             let _ = picoquic_reset_stream(cnx, stream_id, SLIPSTREAM_FILE_CANCEL_ERROR);
         }
+        picoquic_call_back_event_t::picoquic_callback_datagram => {
+            if let Some(relay) = state.udp_relay.as_mut() {
+                if length > 0 && !bytes.is_null() {
+                    let datagram =
+                        unsafe { std::slice::from_raw_parts(bytes as *const u8, length) };
+                    relay.send(cnx as usize, datagram);
+                }
+            }
+        }
         picoquic_call_back_event_t::picoquic_callback_close
         | picoquic_call_back_event_t::picoquic_callback_application_close
         | picoquic_call_back_event_t::picoquic_callback_stateless_reset => {
@@ -501,58 +570,40 @@ pub(crate) unsafe extern "C" fn server_callback(
                     return 0;
                 }
 
-                let mut send_data: Option<Vec<u8>> = None;
-                if let Some(mut stash) = stream.send_stash.take() {
-                    if stash.len() > length {
-                        let remainder = stash.split_off(length);
-                        stream.send_stash = Some(remainder);
-                    }
-                    send_data = Some(stash);
-                } else if let Some(rx) = stream.data_rx.as_mut() {
-                    match rx.try_recv() {
-                        Ok(mut data) => {
-                            if data.len() > length {
-                                let remainder = data.split_off(length);
-                                stream.send_stash = Some(remainder);
-                            }
-                            send_data = Some(data);
-                        }
-                        Err(mpsc::error::TryRecvError::Empty) => {}
-                        Err(mpsc::error::TryRecvError::Disconnected) => {
-                            stream.data_rx = None;
-                            stream.target_fin_pending = true;
-                            stream.close_after_flush = true;
-                        }
-                    }
-                }
-
-                if let Some(data) = send_data {
-                    let send_len = data.len();
-                    let buffer =
-                        picoquic_provide_stream_data_buffer(bytes as *mut _, send_len, 0, 1);
-                    if buffer.is_null() {
+                let send_data = take_send_segments(stream, length);
+                if !send_data.is_empty() {
+                    let segments: Vec<&[u8]> = send_data.iter().map(Vec::as_slice).collect();
+                    let send_len: usize = segments.iter().map(|segment| segment.len()).sum();
+                    let written = unsafe {
+                        provide_stream_data_segments(bytes as *mut _, &segments, false, true)
+                    };
+                    if written.is_none() {
                         if let Some(stream) = shutdown_stream(state, key) {
                             error!(
-                                "stream {:?}: provide_stream_data_buffer returned null send_len={} queued={} pending_chunks={} tx_bytes={}",
+                                "stream {:?}: provide_stream_data_segments failed send_len={} segments={} queued={} pending_chunks={} tx_bytes={}",
                                 key.stream_id,
                                 send_len,
+                                segments.len(),
                                 stream.flow.queued_bytes,
                                 stream.pending_data.len(),
                                 stream.tx_bytes
                             );
                         } else {
                             error!(
-                                "stream {:?}: provide_stream_data_buffer returned null send_len={}",
-                                key.stream_id, send_len
+                                "stream {:?}: provide_stream_data_segments failed send_len={} segments={}",
+                                key.stream_id,
+                                send_len,
+                                segments.len()
                             );
                         }
                         unsafe { abort_stream_bidi(cnx, stream_id, SLIPSTREAM_INTERNAL_ERROR) };
                         return 0;
                     }
-                    unsafe {
-                        std::ptr::copy_nonoverlapping(data.as_ptr(), buffer, data.len());
+                    stream.tx_bytes = stream.tx_bytes.saturating_add(send_len as u64);
+                    let now = unsafe { picoquic_current_time() };
+                    if let Some(priority) = stream.class.observe_bytes(send_len, now) {
+                        state.repin.push((key, priority));
                     }
-                    stream.tx_bytes = stream.tx_bytes.saturating_add(data.len() as u64);
                 } else if stream.target_fin_pending {
                     stream.target_fin_pending = false;
                     if stream.close_after_flush {
@@ -582,6 +633,46 @@ pub(crate) unsafe extern "C" fn server_callback(
     0
 }
 
+/// Collects up to `length` bytes for one stream frame: the stash first, then
+/// as many queued target reads as fit in one scatter-gather call. Whatever
+/// does not fit goes back into the stash.
+fn take_send_segments(stream: &mut ServerStream, length: usize) -> Vec<Vec<u8>> {
+    let mut segments = Vec::new();
+    let mut send_len = 0usize;
+    if let Some(mut stash) = stream.send_stash.take() {
+        if stash.len() > length {
+            stream.send_stash = Some(stash.split_off(length));
+        }
+        send_len = stash.len();
+        segments.push(stash);
+    }
+    while send_len < length
+        && stream.send_stash.is_none()
+        && segments.len() < PICOQUIC_STREAM_DATA_SEGMENTS_MAX
+    {
+        let Some(rx) = stream.data_rx.as_mut() else {
+            break;
+        };
+        match rx.try_recv() {
+            Ok(mut data) => {
+                let room = length - send_len;
+                if data.len() > room {
+                    stream.send_stash = Some(data.split_off(room));
+                }
+                send_len += data.len();
+                segments.push(data);
+            }
+            Err(mpsc::error::TryRecvError::Empty) => break,
+            Err(mpsc::error::TryRecvError::Disconnected) => {
+                stream.data_rx = None;
+                stream.target_fin_pending = true;
+                stream.close_after_flush = true;
+            }
+        }
+    }
+    segments
+}
+
 fn handle_stream_data(
     cnx: *mut picoquic_cnx_t,
     state: &mut ServerState,
@@ -605,6 +696,7 @@ fn handle_stream_data(
         spawn_target_connector(
             key,
             state.target_addr,
+            state.target_pool.as_ref(),
             state.command_tx.clone(),
             debug_streams,
             shutdown_rx,
@@ -624,6 +716,7 @@ fn handle_stream_data(
                 pending_fin: false,
                 fin_enqueued: false,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(unsafe { picoquic_current_time() }),
             },
         );
     }
@@ -663,11 +756,17 @@ fn handle_stream_data(
             Some(stream) => stream,
             None => return,
         };
+        let queued_before = stream.flow.queued_bytes;
+        let now = unsafe { picoquic_current_time() };
+        if let Some(priority) = stream.class.observe_uplink(data, now) {
+            state.repin.push((key, priority));
+        }
 
         if handle_stream_receive(
             stream,
             data.len(),
-            StreamReceiveConfig::new(multi_stream, reserve_bytes),
+            StreamReceiveConfig::new(multi_stream, reserve_bytes)
+                .with_memory_pool(&state.recv_pool),
             StreamReceiveOps {
                 enqueue: |stream: &mut ServerStream| {
                     if let Some(write_tx) = stream.write_tx.as_ref() {
@@ -711,6 +810,9 @@ fn handle_stream_data(
         ) {
             reset_stream = true;
         }
+        state
+            .recv_pool
+            .account(queued_before, stream.flow.queued_bytes);
 
         if fin {
             if stream.flow.discarding {
@@ -773,10 +875,29 @@ pub(crate) fn remove_connection_streams(state: &mut ServerState, cnx: usize) {
         shutdown_stream(state, key);
     }
     state.multi_streams.remove(&cnx);
+    state.repin.retain(|(key, _)| key.cnx != cnx);
+    if let Some(relay) = state.udp_relay.as_mut() {
+        relay.remove_connection(cnx);
+    }
+}
+
+/// Drops the spare capacity that a burst left in an idle connection's stream
+/// buffers. Buffered data stays, so the streams resume where they stopped.
+pub(crate) fn trim_connection_streams(state: &mut ServerState, cnx: usize) {
+    for (key, stream) in state.streams.iter_mut() {
+        if key.cnx != cnx {
+            continue;
+        }
+        stream.pending_data.shrink_to_fit();
+        if let Some(stash) = stream.send_stash.as_mut() {
+            stash.shrink_to_fit();
+        }
+    }
 }
 
 fn shutdown_stream(state: &mut ServerState, key: StreamKey) -> Option<ServerStream> {
     if let Some(stream) = state.streams.remove(&key) {
+        state.recv_pool.account(stream.flow.queued_bytes, 0);
         let _ = stream.shutdown_tx.send(true);
         return Some(stream);
     }
@@ -787,11 +908,34 @@ pub(crate) fn drain_commands(
     state_ptr: *mut ServerState,
     command_rx: &mut mpsc::UnboundedReceiver<Command>,
 ) {
+    apply_stream_priorities(unsafe { &mut *state_ptr });
     while let Ok(command) = command_rx.try_recv() {
         handle_command(state_ptr, command);
     }
 }
 
+/// Re-pins streams whose traffic class changed, see
+/// `slipstream_core::priority`. Called outside of packet preparation, which
+/// walks the stream order that a new priority changes.
+fn apply_stream_priorities(state: &mut ServerState) {
+    for (key, priority) in std::mem::take(&mut state.repin) {
+        if state.streams.contains_key(&key) {
+            set_stream_priority(key, priority, state.debug_streams);
+        }
+    }
+}
+
+fn set_stream_priority(key: StreamKey, priority: u8, debug: bool) {
+    let cnx = key.cnx as *mut picoquic_cnx_t;
+    let ret = unsafe { picoquic_set_stream_priority(cnx, key.stream_id, priority) };
+    if debug {
+        debug!(
+            "stream {:?}: priority {} ret={}",
+            key.stream_id, priority, ret
+        );
+    }
+}
+
 pub(crate) fn handle_command(state_ptr: *mut ServerState, command: Command) {
     let state = unsafe { &mut *state_ptr };
     if state.debug_commands {
@@ -1061,33 +1205,42 @@ pub(crate) fn handle_command(state_ptr: *mut ServerState, command: Command) {
                 if stream.flow.discarding {
                     return;
                 }
-                stream.flow.queued_bytes = stream.flow.queued_bytes.saturating_sub(bytes);
-                if !state.multi_streams.contains(&cnx_id) {
-                    let new_offset = reserve_target_offset(
+                let queued_before = stream.flow.queued_bytes;
+                stream.flow.queued_bytes = queued_before.saturating_sub(bytes);
+                state
+                    .recv_pool
+                    .account(queued_before, stream.flow.queued_bytes);
+                let multi_stream = state.multi_streams.contains(&cnx_id);
+                // Multi-stream credit deferred while the pool was under
+                // pressure is granted once it no longer is.
+                let new_offset = if multi_stream && !state.recv_pool.under_pressure() {
+                    stream.flow.rx_bytes
+                } else {
+                    reserve_target_offset(
                         stream.flow.rx_bytes,
                         stream.flow.queued_bytes,
                         stream.flow.fin_offset,
                         conn_reserve_bytes(),
-                    );
-                    if !consume_stream_data(
-                        &mut stream.flow.consumed_offset,
-                        new_offset,
-                        |new_offset| unsafe {
-                            picoquic_stream_data_consumed(
-                                cnx_id as *mut picoquic_cnx_t,
-                                stream_id,
-                                new_offset,
-                            )
-                        },
-                        |ret, current, target| {
-                            warn!(
-                                "{}",
-                                consume_error_log_message(stream_id, "", ret, current, target)
-                            );
-                        },
-                    ) {
-                        reset_stream = true;
-                    }
+                    )
+                };
+                if !consume_stream_data(
+                    &mut stream.flow.consumed_offset,
+                    new_offset,
+                    |new_offset| unsafe {
+                        picoquic_stream_data_consumed(
+                            cnx_id as *mut picoquic_cnx_t,
+                            stream_id,
+                            new_offset,
+                        )
+                    },
+                    |ret, current, target| {
+                        warn!(
+                            "{}",
+                            consume_error_log_message(stream_id, "", ret, current, target)
+                        );
+                    },
+                ) {
+                    reset_stream = true;
                 }
             }
             if reset_stream {
@@ -1102,6 +1255,15 @@ pub(crate) fn handle_command(state_ptr: *mut ServerState, command: Command) {
             }
             check_stream_invariants(state, key, "StreamWriteDrained");
         }
+        Command::DatagramReply {
+            cnx_id,
+            flow_id,
+            payload,
+        } => {
+            if let Some(relay) = state.udp_relay.as_mut() {
+                relay.queue_reply(cnx_id, flow_id, &payload);
+            }
+        }
     }
 }
 
@@ -1117,7 +1279,7 @@ pub(crate) fn maybe_report_command_stats(state_ptr: *mut ServerState) {
     let total = state.command_counts.total();
     if total > 0 {
         debug!(
-            "debug: commands total={} connected={} connect_err={} closed={} readable={} read_err={} write_err={} write_drained={}",
+            "debug: commands total={} connected={} connect_err={} closed={} readable={} read_err={} write_err={} write_drained={} datagram_reply={}",
             total,
             state.command_counts.stream_connected,
             state.command_counts.stream_connect_error,
@@ -1125,7 +1287,8 @@ pub(crate) fn maybe_report_command_stats(state_ptr: *mut ServerState) {
             state.command_counts.stream_readable,
             state.command_counts.stream_read_error,
             state.command_counts.stream_write_error,
-            state.command_counts.stream_write_drained
+            state.command_counts.stream_write_drained,
+            state.command_counts.datagram_reply
         );
     }
     state.command_counts.reset();
@@ -1142,6 +1305,9 @@ pub(crate) fn handle_shutdown(quic: *mut picoquic_quic_t, state: &mut ServerStat
     }
     state.streams.clear();
     state.multi_streams.clear();
+    if let Some(relay) = state.udp_relay.as_mut() {
+        relay.clear();
+    }
     true
 }
 
@@ -1185,6 +1351,7 @@ mod tests {
                 pending_fin: false,
                 fin_enqueued: false,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(0),
             },
         );
 
@@ -1232,6 +1399,7 @@ mod tests {
                 pending_fin: false,
                 fin_enqueued: false,
                 flow: FlowControlState::default(),
+                class: StreamClass::new(0),
             },
         );
 
@@ -1255,4 +1423,66 @@ mod tests {
             "send_pending should be dropped when the stream is removed"
         );
     }
+
+    fn send_test_stream(data_rx: mpsc::Receiver<Vec<u8>>) -> ServerStream {
+        let (shutdown_tx, _shutdown_rx) = watch::channel(false);
+        ServerStream {
+            write_tx: None,
+            data_rx: Some(data_rx),
+            send_pending: None,
+            send_stash: None,
+            shutdown_tx,
+            tx_bytes: 0,
+            target_fin_pending: false,
+            close_after_flush: false,
+            pending_data: VecDeque::new(),
+            pending_fin: false,
+            fin_enqueued: false,
+            flow: FlowControlState::default(),
+            class: StreamClass::new(0),
+        }
+    }
+
+    #[test]
+    fn send_segments_gather_stash_and_queued_reads() {
+        let (data_tx, data_rx) = mpsc::channel(8);
+        let mut stream = send_test_stream(data_rx);
+        stream.send_stash = Some(vec![1; 10]);
+        data_tx.try_send(vec![2; 20]).unwrap();
+        data_tx.try_send(vec![3; 30]).unwrap();
+        data_tx.try_send(vec![4; 40]).unwrap();
+
+        let segments = take_send_segments(&mut stream, 45);
+        let lengths: Vec<usize> = segments.iter().map(Vec::len).collect();
+        assert_eq!(lengths, vec![10, 20, 15]);
+        assert_eq!(stream.send_stash, Some(vec![3; 15]));
+
+        // The stash goes out first; the read behind it stays queued.
+        let segments = take_send_segments(&mut stream, 10);
+        assert_eq!(segments, vec![vec![3; 10]]);
+        let segments = take_send_segments(&mut stream, 100);
+        assert_eq!(segments, vec![vec![3; 5], vec![4; 40]]);
+        assert!(stream.send_stash.is_none());
+        assert!(!stream.target_fin_pending);
+    }
+
+    #[test]
+    fn send_segments_stop_at_segment_limit_and_note_closed_target() {
+        let (data_tx, data_rx) = mpsc::channel(PICOQUIC_STREAM_DATA_SEGMENTS_MAX + 1);
+        let mut stream = send_test_stream(data_rx);
+        for _ in 0..=PICOQUIC_STREAM_DATA_SEGMENTS_MAX {
+            data_tx.try_send(vec![7; 3]).unwrap();
+        }
+        drop(data_tx);
+
+        let segments = take_send_segments(&mut stream, 1000);
+        assert_eq!(segments.len(), PICOQUIC_STREAM_DATA_SEGMENTS_MAX);
+        assert!(!stream.target_fin_pending);
+
+        let segments = take_send_segments(&mut stream, 1000);
+        assert_eq!(segments, vec![vec![7; 3]]);
+        assert!(stream.target_fin_pending);
+        assert!(stream.close_after_flush);
+        assert!(stream.data_rx.is_none());
+    }
 }
@@ -3,21 +3,162 @@ use crate::server::{
     TARGET_WRITE_COALESCE_DEFAULT_BYTES,
 };
 use slipstream_core::tcp::{stream_read_limit_chunks, tcp_send_buffer_bytes};
+use socket2::SockRef;
+use std::collections::VecDeque;
+use std::mem::MaybeUninit;
 use std::net::SocketAddr;
 use std::sync::atomic::{AtomicBool, Ordering};
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
 use tokio::io::{AsyncReadExt, AsyncWriteExt};
 use tokio::net::TcpStream as TokioTcpStream;
-use tokio::sync::{mpsc, watch};
+use tokio::sync::{mpsc, watch, Notify};
+use tokio::task::JoinHandle;
 use tracing::{debug, warn};
 
+/// How often idle pooled connections are checked for a close by the target.
+const TARGET_POOL_CHECK_INTERVAL: Duration = Duration::from_secs(5);
+const TARGET_POOL_RETRY_MIN: Duration = Duration::from_millis(500);
+const TARGET_POOL_RETRY_MAX: Duration = Duration::from_secs(30);
+
+/// Connections to the target opened ahead of the streams that will use them,
+/// so a new stream starts forwarding without waiting on a connect.
+///
+/// A background task keeps `size` of them open, one connect at a time and
+/// backing off while the target refuses. Connections are retired after
+/// `max_idle`, before targets such as sshd drop unauthenticated ones, and the
+/// ones the target closed meanwhile are never handed out.
+pub(crate) struct TargetPool {
+    shared: Arc<TargetPoolShared>,
+    refill: JoinHandle<()>,
+}
+
+struct TargetPoolShared {
+    idle: Mutex<VecDeque<PooledStream>>,
+    wake: Notify,
+    size: usize,
+    max_idle: Duration,
+}
+
+struct PooledStream {
+    stream: TokioTcpStream,
+    connected_at: Instant,
+}
+
+impl PooledStream {
+    fn usable(&self, now: Instant, max_idle: Duration) -> bool {
+        now.saturating_duration_since(self.connected_at) < max_idle && stream_open(&self.stream)
+    }
+}
+
+/// Whether the target still has the connection open. Data it sent already,
+/// an SSH banner say, stays queued for the stream.
+fn stream_open(stream: &TokioTcpStream) -> bool {
+    let mut buf = [MaybeUninit::<u8>::uninit(); 1];
+    match SockRef::from(stream).peek(&mut buf) {
+        Ok(0) => false,
+        Ok(_) => true,
+        Err(err) => err.kind() == std::io::ErrorKind::WouldBlock,
+    }
+}
+
+impl TargetPool {
+    /// Starts filling the pool on the current runtime.
+    pub(crate) fn spawn(target_addr: SocketAddr, size: usize, max_idle: Duration) -> Self {
+        let shared = Arc::new(TargetPoolShared {
+            idle: Mutex::new(VecDeque::with_capacity(size)),
+            wake: Notify::new(),
+            size,
+            max_idle,
+        });
+        let refill = tokio::spawn(refill_target_pool(shared.clone(), target_addr));
+        Self { shared, refill }
+    }
+
+    /// Takes the oldest usable connection, if any, and has it replaced.
+    pub(crate) fn take(&self) -> Option<TokioTcpStream> {
+        let now = Instant::now();
+        let taken = {
+            let mut idle = self.shared.idle.lock().unwrap();
+            std::iter::from_fn(|| idle.pop_front())
+                .find(|entry| entry.usable(now, self.shared.max_idle))
+        };
+        self.shared.wake.notify_one();
+        taken.map(|entry| entry.stream)
+    }
+
+    #[cfg(test)]
+    fn idle_len(&self) -> usize {
+        self.shared.idle.lock().unwrap().len()
+    }
+}
+
+impl Drop for TargetPool {
+    fn drop(&mut self) {
+        self.refill.abort();
+    }
+}
+
+async fn refill_target_pool(shared: Arc<TargetPoolShared>, target_addr: SocketAddr) {
+    let mut retry = TARGET_POOL_RETRY_MIN;
+    loop {
+        let now = Instant::now();
+        let (missing, next_expiry) = {
+            let mut idle = shared.idle.lock().unwrap();
+            idle.retain(|entry| entry.usable(now, shared.max_idle));
+            (
+                shared.size.saturating_sub(idle.len()),
+                idle.front()
+                    .map(|entry| entry.connected_at + shared.max_idle),
+            )
+        };
+        if missing > 0 {
+            match TokioTcpStream::connect(target_addr).await {
+                Ok(stream) => {
+                    let _ = stream.set_nodelay(true);
+                    shared.idle.lock().unwrap().push_back(PooledStream {
+                        stream,
+                        connected_at: Instant::now(),
+                    });
+                    retry = TARGET_POOL_RETRY_MIN;
+                    continue;
+                }
+                Err(err) => {
+                    debug!(
+                        "target pool: connect failed err={} retry_ms={}",
+                        err,
+                        retry.as_millis()
+                    );
+                    tokio::time::sleep(retry).await;
+                    retry = (retry * 2).min(TARGET_POOL_RETRY_MAX);
+                    continue;
+                }
+            }
+        }
+        let check = now + TARGET_POOL_CHECK_INTERVAL;
+        let deadline = next_expiry.map_or(check, |expiry| expiry.min(check));
+        tokio::select! {
+            _ = shared.wake.notified() => {}
+            _ = tokio::time::sleep_until(deadline.into()) => {}
+        }
+    }
+}
+
 pub(crate) fn spawn_target_connector(
     key: StreamKey,
     target_addr: SocketAddr,
+    pool: Option<&TargetPool>,
     command_tx: mpsc::UnboundedSender<Command>,
     debug_streams: bool,
     mut shutdown_rx: watch::Receiver<bool>,
 ) {
+    if let Some(stream) = pool.and_then(TargetPool::take) {
+        if debug_streams {
+            debug!("stream {:?}: pooled target connection", key.stream_id);
+        }
+        start_target_stream(key, stream, command_tx, debug_streams, shutdown_rx);
+        return;
+    }
     tokio::spawn(async move {
         if *shutdown_rx.borrow() {
             return;
@@ -35,42 +176,7 @@ pub(crate) fn spawn_target_connector(
         match stream {
             Ok(stream) => {
                 let _ = stream.set_nodelay(true);
-                let read_limit = stream_read_limit_chunks(
-                    &stream,
-                    DEFAULT_TCP_RCVBUF_BYTES,
-                    STREAM_READ_CHUNK_BYTES,
-                );
-                let (data_tx, data_rx) = mpsc::channel(read_limit);
-                let send_buffer_bytes = tcp_send_buffer_bytes(&stream)
-                    .filter(|bytes| *bytes > 0)
-                    .unwrap_or(TARGET_WRITE_COALESCE_DEFAULT_BYTES);
-                let (read_half, write_half) = stream.into_split();
-                let (write_tx, write_rx) = mpsc::unbounded_channel();
-                let send_pending = Arc::new(AtomicBool::new(false));
-                spawn_target_reader(
-                    key,
-                    read_half,
-                    data_tx,
-                    command_tx.clone(),
-                    send_pending.clone(),
-                    debug_streams,
-                    shutdown_rx.clone(),
-                );
-                spawn_target_writer(
-                    key,
-                    write_half,
-                    write_rx,
-                    command_tx.clone(),
-                    shutdown_rx,
-                    send_buffer_bytes,
-                );
-                let _ = command_tx.send(Command::StreamConnected {
-                    cnx_id: key.cnx,
-                    stream_id: key.stream_id,
-                    write_tx,
-                    data_rx,
-                    send_pending,
-                });
+                start_target_stream(key, stream, command_tx, debug_streams, shutdown_rx);
             }
             Err(err) => {
                 warn!(
@@ -88,6 +194,48 @@ pub(crate) fn spawn_target_connector(
     });
 }
 
+fn start_target_stream(
+    key: StreamKey,
+    stream: TokioTcpStream,
+    command_tx: mpsc::UnboundedSender<Command>,
+    debug_streams: bool,
+    shutdown_rx: watch::Receiver<bool>,
+) {
+    let read_limit =
+        stream_read_limit_chunks(&stream, DEFAULT_TCP_RCVBUF_BYTES, STREAM_READ_CHUNK_BYTES);
+    let (data_tx, data_rx) = mpsc::channel(read_limit);
+    let send_buffer_bytes = tcp_send_buffer_bytes(&stream)
+        .filter(|bytes| *bytes > 0)
+        .unwrap_or(TARGET_WRITE_COALESCE_DEFAULT_BYTES);
+    let (read_half, write_half) = stream.into_split();
+    let (write_tx, write_rx) = mpsc::unbounded_channel();
+    let send_pending = Arc::new(AtomicBool::new(false));
+    spawn_target_reader(
+        key,
+        read_half,
+        data_tx,
+        command_tx.clone(),
+        send_pending.clone(),
+        debug_streams,
+        shutdown_rx.clone(),
+    );
+    spawn_target_writer(
+        key,
+        write_half,
+        write_rx,
+        command_tx.clone(),
+        shutdown_rx,
+        send_buffer_bytes,
+    );
+    let _ = command_tx.send(Command::StreamConnected {
+        cnx_id: key.cnx,
+        stream_id: key.stream_id,
+        write_tx,
+        data_rx,
+        send_pending,
+    });
+}
+
 pub(crate) fn spawn_target_reader(
     key: StreamKey,
     mut read_half: tokio::net::tcp::OwnedReadHalf,
@@ -235,3 +383,57 @@ pub(crate) fn spawn_target_writer(
         let _ = write_half.shutdown().await;
     });
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tokio::net::TcpListener;
+    use tokio::time::timeout;
+
+    async fn wait_idle(pool: &TargetPool, len: usize) {
+        timeout(Duration::from_secs(2), async {
+            while pool.idle_len() != len {
+                tokio::time::sleep(Duration::from_millis(5)).await;
+            }
+        })
+        .await
+        .expect("pool did not settle");
+    }
+
+    #[tokio::test]
+    async fn pool_refills_after_take() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let pool = TargetPool::spawn(listener.local_addr().unwrap(), 2, Duration::from_secs(30));
+        let mut accepted = Vec::new();
+        for _ in 0..2 {
+            accepted.push(listener.accept().await.unwrap().0);
+        }
+        wait_idle(&pool, 2).await;
+
+        let stream = pool.take().expect("pooled stream");
+        assert!(stream.peer_addr().is_ok());
+        accepted.push(listener.accept().await.unwrap().0);
+        wait_idle(&pool, 2).await;
+    }
+
+    #[tokio::test]
+    async fn pool_skips_connections_closed_by_target() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let pool = TargetPool::spawn(listener.local_addr().unwrap(), 1, Duration::from_secs(30));
+        let (first, _) = listener.accept().await.unwrap();
+        wait_idle(&pool, 1).await;
+        drop(first);
+        tokio::time::sleep(Duration::from_millis(50)).await;
+
+        assert!(pool.take().is_none());
+        let (mut second, _) = listener.accept().await.unwrap();
+        wait_idle(&pool, 1).await;
+        second.write_all(b"SSH-2.0-test\r\n").await.unwrap();
+        tokio::time::sleep(Duration::from_millis(50)).await;
+
+        let mut stream = pool.take().expect("pooled stream");
+        let mut banner = [0u8; 14];
+        stream.read_exact(&mut banner).await.unwrap();
+        assert_eq!(&banner, b"SSH-2.0-test\r\n");
+    }
+}
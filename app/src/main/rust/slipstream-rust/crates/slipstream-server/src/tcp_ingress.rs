@@ -0,0 +1,212 @@
+//! DNS over TCP (RFC 7766).
+//!
+//! Resolvers retry a query over TCP when its UDP answer comes back truncated,
+//! and some keep the connection for later queries, several in flight at once.
+//! With `--dns-tcp` each worker also listens on the DNS port over TCP. Queries
+//! read from a connection are handed to the worker like datagrams and run
+//! through the same decode, QUIC and encode steps, but their answers go back
+//! on the connection, may fill up to 64 KiB and are written in whatever order
+//! they are ready, as RFC 7766 allows for pipelined queries.
+
+use crate::server::{map_io, set_reuse_port, ServerError};
+use socket2::{Domain, Protocol, SockAddr, Socket, Type};
+use std::net::SocketAddr;
+use std::sync::Arc;
+use std::time::Duration;
+use tokio::io::{AsyncRead, AsyncReadExt, AsyncWriteExt, BufReader};
+use tokio::net::{TcpListener, TcpStream};
+use tokio::sync::{mpsc, Semaphore};
+use tokio::time::{sleep, timeout};
+
+/// Largest DNS message the two-byte length prefix can frame.
+pub(crate) const TCP_MESSAGE_MAX: usize = u16::MAX as usize;
+// Queries read but not yet taken by the worker, across all connections.
+const TCP_QUERY_QUEUE_MAX: usize = 1024;
+// Connections each worker serves at once; later ones are closed on accept.
+const TCP_CONNECTIONS_MAX: usize = 256;
+// Connections that send no query for this long are closed.
+const TCP_IDLE_TIMEOUT: Duration = Duration::from_secs(10);
+const TCP_ACCEPT_RETRY: Duration = Duration::from_millis(100);
+const TCP_LISTEN_BACKLOG: i32 = 128;
+const DNS_HEADER_LEN: usize = 12;
+
+/// Takes the answers to one connection's queries, in any order.
+pub(crate) type TcpReply = mpsc::UnboundedSender<Vec<u8>>;
+
+pub(crate) struct TcpQuery {
+    pub(crate) packet: Vec<u8>,
+    pub(crate) peer: SocketAddr,
+    pub(crate) reply: TcpReply,
+}
+
+/// Accepts connections on `listener` for the rest of the worker's life and
+/// returns the queries read from them.
+pub(crate) fn spawn_tcp_ingress(listener: TcpListener) -> mpsc::Receiver<TcpQuery> {
+    let (query_tx, query_rx) = mpsc::channel(TCP_QUERY_QUEUE_MAX);
+    let permits = Arc::new(Semaphore::new(TCP_CONNECTIONS_MAX));
+    tokio::spawn(async move {
+        while !query_tx.is_closed() {
+            let (stream, peer) = match listener.accept().await {
+                Ok(accepted) => accepted,
+                Err(err) => {
+                    // Out of descriptors, most likely; give closing ones a moment.
+                    tracing::debug!("DNS/TCP accept failed: {}", err);
+                    sleep(TCP_ACCEPT_RETRY).await;
+                    continue;
+                }
+            };
+            let Ok(permit) = permits.clone().try_acquire_owned() else {
+                tracing::debug!("DNS/TCP connection from {} refused: at capacity", peer);
+                continue;
+            };
+            let query_tx = query_tx.clone();
+            tokio::spawn(async move {
+                serve_connection(stream, peer, query_tx).await;
+                drop(permit);
+            });
+        }
+    });
+    query_rx
+}
+
+/// Reads queries until the peer closes, goes idle or sends something that is
+/// not DNS, then closes once every query read has been answered or dropped.
+async fn serve_connection(stream: TcpStream, peer: SocketAddr, queries: mpsc::Sender<TcpQuery>) {
+    let _ = stream.set_nodelay(true);
+    let (reader, mut writer) = stream.into_split();
+    let mut reader = BufReader::new(reader);
+    let (reply, mut answers) = mpsc::unbounded_channel::<Vec<u8>>();
+    let writer_task = tokio::spawn(async move {
+        let mut framed = Vec::new();
+        while let Some(answer) = answers.recv().await {
+            framed.clear();
+            push_framed(&mut framed, &answer);
+            // Answers ready together go out in one write.
+            while let Ok(answer) = answers.try_recv() {
+                push_framed(&mut framed, &answer);
+            }
+            if writer.write_all(&framed).await.is_err() {
+                return;
+            }
+        }
+        let _ = writer.shutdown().await;
+    });
+    while let Ok(Ok(Some(packet))) = timeout(TCP_IDLE_TIMEOUT, read_message(&mut reader)).await {
+        let query = TcpQuery {
+            packet,
+            peer,
+            reply: reply.clone(),
+        };
+        if queries.send(query).await.is_err() {
+            break;
+        }
+    }
+    drop(reply);
+    let _ = writer_task.await;
+}
+
+/// Reads one length-prefixed message. `None` means the stream ended cleanly
+/// or framed something too short to be DNS.
+async fn read_message<R: AsyncRead + Unpin>(reader: &mut R) -> std::io::Result<Option<Vec<u8>>> {
+    let mut len = [0u8; 2];
+    match reader.read_exact(&mut len).await {
+        Ok(_) => {}
+        Err(err) if err.kind() == std::io::ErrorKind::UnexpectedEof => return Ok(None),
+        Err(err) => return Err(err),
+    }
+    let len = u16::from_be_bytes(len) as usize;
+    if len < DNS_HEADER_LEN {
+        return Ok(None);
+    }
+    let mut packet = vec![0u8; len];
+    reader.read_exact(&mut packet).await?;
+    Ok(Some(packet))
+}
+
+fn push_framed(out: &mut Vec<u8>, message: &[u8]) {
+    if message.len() > TCP_MESSAGE_MAX {
+        return;
+    }
+    out.extend_from_slice(&(message.len() as u16).to_be_bytes());
+    out.extend_from_slice(message);
+}
+
+/// Binds the TCP side of the DNS listener at the UDP socket's address.
+pub(crate) fn bind_tcp_listener(
+    addr: SocketAddr,
+    reuse_port: bool,
+) -> Result<TcpListener, ServerError> {
+    let domain = match addr {
+        SocketAddr::V4(_) => Domain::IPV4,
+        SocketAddr::V6(_) => Domain::IPV6,
+    };
+    let socket = Socket::new(domain, Type::STREAM, Some(Protocol::TCP)).map_err(map_io)?;
+    if let SocketAddr::V6(_) = addr {
+        if let Err(err) = socket.set_only_v6(false) {
+            tracing::warn!(
+                "Failed to enable dual-stack TCP listener on {}: {}",
+                addr,
+                err
+            );
+        }
+    }
+    socket.set_reuse_address(true).map_err(map_io)?;
+    if reuse_port {
+        set_reuse_port(&socket).map_err(map_io)?;
+    }
+    socket.bind(&SockAddr::from(addr)).map_err(map_io)?;
+    socket.listen(TCP_LISTEN_BACKLOG).map_err(map_io)?;
+    socket.set_nonblocking(true).map_err(map_io)?;
+    let std_listener: std::net::TcpListener = socket.into();
+    TcpListener::from_std(std_listener).map_err(map_io)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn query(id: u8) -> Vec<u8> {
+        let mut packet = vec![0u8; DNS_HEADER_LEN];
+        packet[1] = id;
+        packet
+    }
+
+    #[tokio::test]
+    async fn pipelined_queries_are_answered_in_any_order() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let addr = listener.local_addr().unwrap();
+        let mut queries = spawn_tcp_ingress(listener);
+
+        let mut client = TcpStream::connect(addr).await.unwrap();
+        let mut framed = Vec::new();
+        push_framed(&mut framed, &query(1));
+        push_framed(&mut framed, &query(2));
+        client.write_all(&framed).await.unwrap();
+
+        let first = queries.recv().await.unwrap();
+        let second = queries.recv().await.unwrap();
+        assert_eq!(first.packet, query(1));
+        assert_eq!(second.packet, query(2));
+        second.reply.send(vec![2; 300]).unwrap();
+        first.reply.send(vec![1; 3]).unwrap();
+        drop((first, second));
+        client.shutdown().await.unwrap();
+
+        let mut answers = Vec::new();
+        client.read_to_end(&mut answers).await.unwrap();
+        let mut expected = Vec::new();
+        push_framed(&mut expected, &[2; 300]);
+        push_framed(&mut expected, &[1; 3]);
+        assert_eq!(answers, expected);
+    }
+
+    #[tokio::test]
+    async fn runt_messages_end_the_connection() {
+        let mut reader: &[u8] = &[0, 2, 0xab, 0xcd];
+        assert!(read_message(&mut reader).await.unwrap().is_none());
+        let mut reader: &[u8] = &[0, 12];
+        assert!(read_message(&mut reader).await.is_err());
+        let mut reader: &[u8] = &[];
+        assert!(read_message(&mut reader).await.unwrap().is_none());
+    }
+}
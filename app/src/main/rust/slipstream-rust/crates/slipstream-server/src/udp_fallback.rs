@@ -1,35 +1,83 @@
-use slipstream_core::{net::is_transient_udp_error, normalize_dual_stack_addr};
-use slipstream_dns::{decode_query_with_domains, DecodeQueryError};
+use slipstream_core::{
+    net::{is_transient_udp_error, recv_batch, send_batch, RecvBatch},
+    normalize_dual_stack_addr,
+};
+use slipstream_dns::{
+    compact_slot, decode_query_with_domain_set, expand_short_header, split_batch,
+    take_multi_answer_marker, DecodeQueryError, DecodedQuery, DomainSet, Rcode,
+};
 use slipstream_ffi::picoquic::{
-    picoquic_cnx_t, picoquic_incoming_packet_ex, picoquic_quic_t, slipstream_disable_ack_delay,
+    picoquic_connection_id_t, picoquic_get_cid_by_slot, picoquic_incoming_datagram_t,
+    picoquic_incoming_packets, picoquic_quic_t, slipstream_disable_ack_delay,
+    PICOQUIC_CONNECTION_ID_MAX_SIZE,
 };
 use slipstream_ffi::{socket_addr_to_storage, take_stateless_packet_for_cid};
-use std::collections::HashMap;
+use std::collections::hash_map::RandomState;
+use std::collections::{HashMap, VecDeque};
+use std::future::poll_fn;
+use std::hash::BuildHasher;
 use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr};
-use std::sync::{Arc, Mutex};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::task::Poll;
 use std::time::{Duration, Instant};
+use tokio::io::Interest;
 use tokio::net::UdpSocket as TokioUdpSocket;
-use tokio::sync::watch;
-use tokio::task::JoinHandle;
+use tokio::sync::mpsc;
 
 use crate::server::{map_io, ServerError, Slot};
+use crate::shard::WorkerShard;
+use crate::tcp_ingress::TcpReply;
 
 pub(crate) const MAX_UDP_PACKET_SIZE: usize = 65535;
 const FALLBACK_IDLE_TIMEOUT: Duration = Duration::from_secs(180);
 const FALLBACK_CLEANUP_INTERVAL: Duration = Duration::from_secs(30);
 const NON_DNS_STREAK_THRESHOLD: usize = 16;
+// Peers are spread over this many shards, each with one reply pump and swept
+// in turn, so a full sweep still takes FALLBACK_CLEANUP_INTERVAL.
+const FALLBACK_SHARDS: usize = 8;
+// Replies taken off one session socket per recvmmsg.
+const REPLY_BATCH_MAX: usize = 8;
+// Above any packet a query payload restores to: payloads stay under 256
+// bytes, and a CID adds at most 18 bytes over its slot.
+const EXPANDED_PACKET_MAX: usize = 512;
 
 enum DecodeSlotOutcome {
     Slot(Slot),
-    DnsOnly,
     Drop,
+    Forward(usize),
+}
+
+/// Shared between the manager and the shard's reply pump. Stamps are
+/// milliseconds since the manager's epoch.
+struct SessionState {
+    last_seen_ms: AtomicU64,
+    closed: AtomicBool,
+}
+
+impl SessionState {
+    fn touch(&self, epoch: Instant) {
+        self.last_seen_ms
+            .store(millis_since(epoch), Ordering::Relaxed);
+    }
+
+    fn is_idle(&self, now_ms: u64) -> bool {
+        let last_seen_ms = self.last_seen_ms.load(Ordering::Relaxed);
+        now_ms.saturating_sub(last_seen_ms) > FALLBACK_IDLE_TIMEOUT.as_millis() as u64
+    }
+
+    fn close(&self) {
+        self.closed.store(true, Ordering::Relaxed);
+    }
+
+    fn is_closed(&self) -> bool {
+        self.closed.load(Ordering::Relaxed)
+    }
 }
 
 struct FallbackSession {
     socket: Arc<TokioUdpSocket>,
-    last_seen: Arc<Mutex<Instant>>,
-    shutdown_tx: watch::Sender<bool>,
-    reply_task: JoinHandle<()>,
+    state: Arc<SessionState>,
 }
 
 struct DnsPeerState {
@@ -37,11 +85,68 @@ struct DnsPeerState {
     non_dns_streak: usize,
 }
 
+/// A session as the reply pump sees it.
+struct PumpSession {
+    peer: SocketAddr,
+    send_addr: SocketAddr,
+    socket: Arc<TokioUdpSocket>,
+    state: Arc<SessionState>,
+}
+
+enum PumpCommand {
+    Add(PumpSession),
+    /// Drop the sessions the manager has closed.
+    Sweep,
+}
+
+#[derive(Default)]
+struct FallbackShard {
+    dns_peers: HashMap<SocketAddr, DnsPeerState>,
+    sessions: HashMap<SocketAddr, FallbackSession>,
+    // Started with the shard's first session; it stops when this is dropped.
+    pump: Option<mpsc::UnboundedSender<PumpCommand>>,
+}
+
+impl FallbackShard {
+    /// Drops idle and dead sessions and DNS-only peers in one pass.
+    fn sweep(&mut self, now: Instant, now_ms: u64) {
+        self.dns_peers
+            .retain(|_, state| now.duration_since(state.last_seen) <= FALLBACK_IDLE_TIMEOUT);
+
+        let before = self.sessions.len();
+        self.sessions.retain(|peer, session| {
+            if session.state.is_closed() || session.state.is_idle(now_ms) {
+                tracing::debug!("ending fallback session for {}", peer);
+                session.state.close();
+                return false;
+            }
+            true
+        });
+        if self.sessions.len() != before {
+            if let Some(pump) = self.pump.as_ref() {
+                let _ = pump.send(PumpCommand::Sweep);
+            }
+        }
+    }
+
+    fn end_session(&mut self, peer: SocketAddr) {
+        if let Some(session) = self.sessions.remove(&peer) {
+            session.state.close();
+            if let Some(pump) = self.pump.as_ref() {
+                let _ = pump.send(PumpCommand::Sweep);
+            }
+            tracing::debug!("ending fallback session for {}", peer);
+        }
+    }
+}
+
 pub(crate) struct PacketContext<'a> {
-    pub(crate) domains: &'a [&'a str],
+    pub(crate) domains: &'a DomainSet,
     pub(crate) quic: *mut picoquic_quic_t,
-    pub(crate) current_time: u64,
-    pub(crate) local_addr_storage: &'a libc::sockaddr_storage,
+    pub(crate) shard: Option<&'a WorkerShard>,
+    /// Set for a query read from DNS/TCP, so a forwarded query is answered
+    /// on the same connection.
+    pub(crate) tcp_reply: Option<&'a TcpReply>,
 }
 
 /// Tracks per-peer routing for UDP fallback based on DNS decoding outcomes.
@@ -53,12 +158,18 @@ pub(crate) struct PacketContext<'a> {
 /// For DNS-only peers, a streak of non-DNS packets can switch the peer to fallback once it
 /// reaches the non-DNS streak threshold. Classification is per source address and expires after
 /// idle timeout.
+///
+/// Each fallback session keeps its own connected socket, so the fallback endpoint still sees one
+/// source address per peer, but peers are split over a few shards: replies for a whole shard are
+/// forwarded by one pump task, and cleanup sweeps one shard at a time.
 pub(crate) struct FallbackManager {
     fallback_addr: SocketAddr,
     main_socket: Arc<TokioUdpSocket>,
     map_ipv4_peers: bool,
-    dns_peers: HashMap<SocketAddr, DnsPeerState>,
-    sessions: HashMap<SocketAddr, FallbackSession>,
+    hasher: RandomState,
+    shards: Vec<FallbackShard>,
+    epoch: Instant,
+    next_sweep: usize,
     last_cleanup: Instant,
 }
 
@@ -69,59 +180,44 @@ impl FallbackManager {
         map_ipv4_peers: bool,
     ) -> Self {
         tracing::info!("non-DNS packets will be forwarded to {}", fallback_addr);
+        let now = Instant::now();
         Self {
             fallback_addr,
             main_socket,
             map_ipv4_peers,
-            dns_peers: HashMap::new(),
-            sessions: HashMap::new(),
-            last_cleanup: Instant::now(),
+            hasher: RandomState::new(),
+            shards: (0..FALLBACK_SHARDS)
+                .map(|_| FallbackShard::default())
+                .collect(),
+            epoch: now,
+            next_sweep: 0,
+            last_cleanup: now,
         }
     }
 
     pub(crate) fn cleanup(&mut self) {
         let now = Instant::now();
-        if now.duration_since(self.last_cleanup) < FALLBACK_CLEANUP_INTERVAL {
+        if now.duration_since(self.last_cleanup)
+            < FALLBACK_CLEANUP_INTERVAL / FALLBACK_SHARDS as u32
+        {
             return;
         }
         self.last_cleanup = now;
 
-        self.dns_peers
-            .retain(|_, state| now.duration_since(state.last_seen) <= FALLBACK_IDLE_TIMEOUT);
-
-        let mut expired = Vec::new();
-        for (peer, session) in &self.sessions {
-            let last_seen = match session.last_seen.lock() {
-                Ok(last_seen) => *last_seen,
-                Err(_) => {
-                    tracing::warn!(
-                        "fallback session for {} has poisoned mutex, marking for cleanup",
-                        peer
-                    );
-                    expired.push(*peer);
-                    continue;
-                }
-            };
-            if now.duration_since(last_seen) > FALLBACK_IDLE_TIMEOUT {
-                expired.push(*peer);
-            }
-        }
-
-        for peer in expired {
-            self.end_session(peer);
-        }
+        let now_ms = millis_since(self.epoch);
+        self.shards[self.next_sweep].sweep(now, now_ms);
+        self.next_sweep = (self.next_sweep + 1) % self.shards.len();
     }
 
-    fn end_session(&mut self, peer: SocketAddr) {
-        if let Some(session) = self.sessions.remove(&peer) {
-            let _ = session.shutdown_tx.send(true);
-            tracing::debug!("ending fallback session for {}", peer);
-        }
+    fn shard_index(&self, peer: SocketAddr) -> usize {
+        (self.hasher.hash_one(peer) % self.shards.len() as u64) as usize
     }
 
     fn mark_dns(&mut self, peer: SocketAddr) {
         let now = Instant::now();
-        self.dns_peers
+        let index = self.shard_index(peer);
+        self.shards[index]
+            .dns_peers
             .entry(peer)
             .and_modify(|state| {
                 state.last_seen = now;
@@ -134,33 +230,16 @@ impl FallbackManager {
     }
 
     fn is_active_fallback_peer(&mut self, peer: SocketAddr) -> bool {
-        let mut should_end = false;
-        let last_seen = match self.sessions.get(&peer) {
-            Some(session) => match session.last_seen.lock() {
-                Ok(last_seen) => *last_seen,
-                Err(_) => {
-                    tracing::warn!(
-                        "fallback session for {} has poisoned mutex, marking for cleanup",
-                        peer
-                    );
-                    should_end = true;
-                    Instant::now()
-                }
-            },
+        let index = self.shard_index(peer);
+        let shard = &mut self.shards[index];
+        let idle = match shard.sessions.get(&peer) {
+            Some(session) => session.state.is_idle(millis_since(self.epoch)),
             None => return false,
         };
-
-        if should_end {
-            self.end_session(peer);
-            return false;
-        }
-
-        let now = Instant::now();
-        if now.duration_since(last_seen) > FALLBACK_IDLE_TIMEOUT {
-            self.end_session(peer);
+        if idle {
+            shard.end_session(peer);
             return false;
         }
-
         true
     }
 
@@ -169,21 +248,14 @@ impl FallbackManager {
     }
 
     async fn handle_non_dns(&mut self, packet: &[u8], peer: SocketAddr) {
-        let mut should_forward = true;
-        let mut should_remove = false;
-        if let Some(state) = self.dns_peers.get_mut(&peer) {
+        let index = self.shard_index(peer);
+        let dns_peers = &mut self.shards[index].dns_peers;
+        if let Some(state) = dns_peers.get_mut(&peer) {
             state.non_dns_streak = state.non_dns_streak.saturating_add(1);
             if state.non_dns_streak < NON_DNS_STREAK_THRESHOLD {
-                should_forward = false;
-            } else {
-                should_remove = true;
+                return;
             }
-        }
-        if should_remove {
-            self.dns_peers.remove(&peer);
-        }
-        if !should_forward {
-            return;
+            dns_peers.remove(&peer);
         }
         self.forward_packet(packet, peer).await;
     }
@@ -206,65 +278,68 @@ impl FallbackManager {
     }
 
     async fn ensure_session(&mut self, peer: SocketAddr) -> Option<Arc<TokioUdpSocket>> {
-        let reset_session = self
+        let index = self.shard_index(peer);
+        let reset_session = self.shards[index]
             .sessions
             .get(&peer)
-            .map(|session| session.reply_task.is_finished())
+            .map(|session| session.state.is_closed())
             .unwrap_or(false);
         if reset_session {
-            self.sessions.remove(&peer);
+            self.shards[index].sessions.remove(&peer);
             tracing::debug!("fallback reply loop ended for {}; recreating session", peer);
         }
-        if !self.sessions.contains_key(&peer) {
-            if let Err(err) = self.create_session(peer).await {
+        if !self.shards[index].sessions.contains_key(&peer) {
+            if let Err(err) = self.create_session(index, peer).await {
                 tracing::warn!("failed to create fallback session for {}: {}", peer, err);
                 return None;
             }
         }
 
-        let socket = if let Some(session) = self.sessions.get_mut(&peer) {
-            if let Ok(mut last_seen) = session.last_seen.lock() {
-                *last_seen = Instant::now();
-            }
-            session.socket.clone()
-        } else {
-            return None;
-        };
-
-        Some(socket)
+        let session = self.shards[index].sessions.get(&peer)?;
+        session.state.touch(self.epoch);
+        Some(session.socket.clone())
     }
 
-    async fn create_session(&mut self, peer: SocketAddr) -> Result<(), ServerError> {
+    async fn create_session(&mut self, index: usize, peer: SocketAddr) -> Result<(), ServerError> {
         let bind_addr = fallback_bind_addr(self.fallback_addr);
         let socket = TokioUdpSocket::bind(bind_addr).await.map_err(map_io)?;
         socket.connect(self.fallback_addr).await.map_err(map_io)?;
         let socket = Arc::new(socket);
-        let last_seen = Arc::new(Mutex::new(Instant::now()));
-        let (shutdown_tx, shutdown_rx) = watch::channel(false);
-        let proxy_socket = socket.clone();
-        let main_socket = self.main_socket.clone();
-        let last_seen_update = last_seen.clone();
-        let map_ipv4_peers = self.map_ipv4_peers;
-        let reply_task = tokio::spawn(async move {
-            forward_fallback_replies(
-                proxy_socket,
-                main_socket,
-                peer,
-                map_ipv4_peers,
-                last_seen_update,
-                shutdown_rx,
-            )
-            .await;
+        let state = Arc::new(SessionState {
+            last_seen_ms: AtomicU64::new(millis_since(self.epoch)),
+            closed: AtomicBool::new(false),
         });
-        self.sessions.insert(
+        let send_addr = if self.map_ipv4_peers {
+            normalize_dual_stack_addr(peer)
+        } else {
+            peer
+        };
+        let mut command = PumpCommand::Add(PumpSession {
             peer,
-            FallbackSession {
-                socket,
-                last_seen,
-                shutdown_tx,
-                reply_task,
-            },
-        );
+            send_addr,
+            socket: socket.clone(),
+            state: state.clone(),
+        });
+        let shard = &mut self.shards[index];
+        if let Some(pump) = shard.pump.as_ref() {
+            match pump.send(command) {
+                Ok(()) => command = PumpCommand::Sweep,
+                Err(mpsc::error::SendError(unsent)) => command = unsent,
+            }
+        }
+        if let PumpCommand::Add(_) = command {
+            let (pump_tx, pump_rx) = mpsc::unbounded_channel();
+            let _ = pump_tx.send(command);
+            tokio::spawn(pump_fallback_replies(
+                self.main_socket.clone(),
+                self.epoch,
+                pump_rx,
+            ));
+            shard.pump = Some(pump_tx);
+        }
+        shard
+            .sessions
+            .insert(peer, FallbackSession { socket, state });
         tracing::debug!("created fallback session for {}", peer);
         Ok(())
     }
@@ -277,35 +352,68 @@ pub(crate) async fn handle_packet(
     context: &PacketContext<'_>,
     fallback_mgr: &mut Option<FallbackManager>,
 ) -> Result<(), ServerError> {
+    if forward_fallback_peer(packet, peer, fallback_mgr).await {
+        return Ok(());
+    }
+    let query = decode_query_with_domain_set(packet, context.domains);
+    handle_query(slots, packet, peer, query, context, fallback_mgr).await
+}
+
+/// Like `handle_packet`, for a query a codec thread already decoded.
+pub(crate) async fn handle_decoded(
+    slots: &mut Vec<Slot>,
+    packet: &[u8],
+    peer: SocketAddr,
+    query: Result<DecodedQuery, DecodeQueryError>,
+    context: &PacketContext<'_>,
+    fallback_mgr: &mut Option<FallbackManager>,
+) -> Result<(), ServerError> {
+    if forward_fallback_peer(packet, peer, fallback_mgr).await {
+        return Ok(());
+    }
+    handle_query(slots, packet, peer, query, context, fallback_mgr).await
+}
+
+async fn forward_fallback_peer(
+    packet: &[u8],
+    peer: SocketAddr,
+    fallback_mgr: &mut Option<FallbackManager>,
+) -> bool {
     if let Some(manager) = fallback_mgr.as_mut() {
         if manager.is_active_fallback_peer(peer) {
             manager.forward_existing(packet, peer).await;
-            return Ok(());
+            return true;
         }
     }
+    false
+}
 
-    match decode_slot(
-        packet,
-        peer,
-        context.domains,
-        context.quic,
-        context.current_time,
-        context.local_addr_storage,
-    )? {
+async fn handle_query(
+    slots: &mut Vec<Slot>,
+    packet: &[u8],
+    peer: SocketAddr,
+    query: Result<DecodedQuery, DecodeQueryError>,
+    context: &PacketContext<'_>,
+    fallback_mgr: &mut Option<FallbackManager>,
+) -> Result<(), ServerError> {
+    match decode_slot(query, peer, context.quic, context.shard) {
         DecodeSlotOutcome::Slot(slot) => {
             if let Some(manager) = fallback_mgr.as_mut() {
                 manager.mark_dns(peer);
             }
             slots.push(slot);
         }
-        DecodeSlotOutcome::DnsOnly => {
+        DecodeSlotOutcome::Drop => {
             if let Some(manager) = fallback_mgr.as_mut() {
-                manager.mark_dns(peer);
+                manager.handle_non_dns(packet, peer).await;
             }
         }
-        DecodeSlotOutcome::Drop => {
+        DecodeSlotOutcome::Forward(owner) => {
             if let Some(manager) = fallback_mgr.as_mut() {
-                manager.handle_non_dns(packet, peer).await;
+                manager.mark_dns(peer);
+            }
+            if let Some(shard) = context.shard {
+                shard.forward(owner, packet, peer, context.tcp_reply.cloned());
             }
         }
     }
@@ -313,73 +421,75 @@ pub(crate) async fn handle_packet(
     Ok(())
 }
 
+/// Turns a query into a slot. Its QUIC packets are only restored here;
+/// `ingest_slots` feeds them to picoquic with the rest of the batch.
 fn decode_slot(
-    packet: &[u8],
+    query: Result<DecodedQuery, DecodeQueryError>,
     peer: SocketAddr,
-    domains: &[&str],
     quic: *mut picoquic_quic_t,
-    current_time: u64,
-    local_addr_storage: &libc::sockaddr_storage,
-) -> Result<DecodeSlotOutcome, ServerError> {
-    match decode_query_with_domains(packet, domains) {
-        Ok(query) => {
-            let mut peer_storage = dummy_sockaddr_storage();
-            let mut local_storage = unsafe { std::ptr::read(local_addr_storage) };
-            let mut first_cnx: *mut picoquic_cnx_t = std::ptr::null_mut();
-            let mut first_path: libc::c_int = -1;
-            let ret = unsafe {
-                picoquic_incoming_packet_ex(
-                    quic,
-                    query.payload.as_ptr() as *mut u8,
-                    query.payload.len(),
-                    &mut peer_storage as *mut _ as *mut libc::sockaddr,
-                    &mut local_storage as *mut _ as *mut libc::sockaddr,
-                    0,
-                    0,
-                    &mut first_cnx,
-                    &mut first_path,
-                    current_time,
-                )
-            };
-            if ret < 0 {
-                return Err(ServerError::new("Failed to process QUIC packet"));
+    shard: Option<&WorkerShard>,
+) -> DecodeSlotOutcome {
+    match query {
+        Ok(mut query) => {
+            let multi_answer = take_multi_answer_marker(&mut query.payload);
+            // Batched queries are routed and answered by their first packet.
+            let batch = split_batch(&query.payload);
+            let lead = batch
+                .clone()
+                .and_then(|mut packets| packets.next())
+                .unwrap_or(&query.payload);
+            if let Some(owner) = shard.and_then(|shard| shard.foreign_owner(lead)) {
+                return DecodeSlotOutcome::Forward(owner);
             }
-            if first_cnx.is_null() {
-                if let Some(payload) =
-                    unsafe { take_stateless_packet_for_cid(quic, &query.payload) }
-                {
-                    if !payload.is_empty() {
-                        return Ok(DecodeSlotOutcome::Slot(Slot {
-                            peer,
-                            id: query.id,
-                            rd: query.rd,
-                            cd: query.cd,
-                            question: query.question,
-                            rcode: None,
-                            cnx: std::ptr::null_mut(),
-                            path_id: -1,
-                            payload_override: Some(payload),
-                        }));
-                    }
-                }
-                return Ok(DecodeSlotOutcome::DnsOnly);
-            }
-            unsafe {
-                slipstream_disable_ack_delay(first_cnx);
-            }
-            Ok(DecodeSlotOutcome::Slot(Slot {
+            let mut lead_buf = [0u8; EXPANDED_PACKET_MAX];
+            let Some(lead) = expand_packet(quic, lead, &mut lead_buf) else {
+                // The slot names no CID, as after a restart. FORMERR has the
+                // client resend with the full CID, which a stateless reset
+                // can then answer.
+                return DecodeSlotOutcome::Slot(Slot {
+                    peer,
+                    id: query.id,
+                    rd: query.rd,
+                    cd: query.cd,
+                    question: query.question,
+                    rcode: Some(Rcode::FormatError),
+                    cnx: std::ptr::null_mut(),
+                    path_id: -1,
+                    payload_override: None,
+                    answer_key: None,
+                    multi_answer: false,
+                    tcp_reply: None,
+                    ingress: Vec::new(),
+                });
+            };
+            let ingress = match batch {
+                Some(packets) => packets
+                    .filter_map(|packet| {
+                        let mut packet_buf = [0u8; EXPANDED_PACKET_MAX];
+                        expand_packet(quic, packet, &mut packet_buf).map(<[u8]>::to_vec)
+                    })
+                    .collect(),
+                // A full header is fed as it came.
+                None if lead.len() == query.payload.len() => vec![query.payload],
+                None => vec![lead.to_vec()],
+            };
+            DecodeSlotOutcome::Slot(Slot {
                 peer,
                 id: query.id,
                 rd: query.rd,
                 cd: query.cd,
                 question: query.question,
                 rcode: None,
-                cnx: first_cnx,
-                path_id: first_path,
+                cnx: std::ptr::null_mut(),
+                path_id: -1,
                 payload_override: None,
-            }))
+                answer_key: None,
+                multi_answer,
+                tcp_reply: None,
+                ingress,
+            })
         }
-        Err(DecodeQueryError::Drop) => Ok(DecodeSlotOutcome::Drop),
+        Err(DecodeQueryError::Drop) => DecodeSlotOutcome::Drop,
         Err(DecodeQueryError::Reply {
             id,
             rd,
@@ -389,9 +499,9 @@ fn decode_slot(
         }) => {
             let Some(question) = question else {
                 // Treat empty-question queries (QDCOUNT=0) as non-DNS for fallback.
-                return Ok(DecodeSlotOutcome::Drop);
+                return DecodeSlotOutcome::Drop;
             };
-            Ok(DecodeSlotOutcome::Slot(Slot {
+            DecodeSlotOutcome::Slot(Slot {
                 peer,
                 id,
                 rd,
@@ -401,9 +511,134 @@ fn decode_slot(
                 cnx: std::ptr::null_mut(),
                 path_id: -1,
                 payload_override: None,
-            }))
+                answer_key: None,
+                multi_answer: false,
+                tcp_reply: None,
+                ingress: Vec::new(),
+            })
+        }
+    }
+}
+
+/// Restores a compact short header with the CID its slot names; other
+/// packets are returned as they are. `None` means the slot names no CID.
+fn expand_packet<'a>(
+    quic: *mut picoquic_quic_t,
+    packet: &'a [u8],
+    buf: &'a mut [u8; EXPANDED_PACKET_MAX],
+) -> Option<&'a [u8]> {
+    let Some(slot) = compact_slot(packet) else {
+        return Some(packet);
+    };
+    let mut cid = picoquic_connection_id_t {
+        id: [0; PICOQUIC_CONNECTION_ID_MAX_SIZE],
+        id_len: 0,
+    };
+    if unsafe { picoquic_get_cid_by_slot(quic, slot, &mut cid) } != 0 {
+        return None;
+    }
+    let len = expand_short_header(packet, &cid.id[..cid.id_len as usize], buf)?;
+    Some(&buf[..len])
+}
+
+/// Feeds the QUIC packets of every slot to picoquic in one batch, grouped
+/// by connection, and points each slot at the connection and path its first
+/// landed packet reached. A slot that reached none answers with the
+/// stateless packet picoquic queued for its lead packet, or is dropped.
+pub(crate) fn ingest_slots(
+    quic: *mut picoquic_quic_t,
+    slots: &mut Vec<Slot>,
+    local_addr_storage: &libc::sockaddr_storage,
+    current_time: u64,
+) -> Result<(), ServerError> {
+    let mut peer_storage = dummy_sockaddr_storage();
+    let mut local_storage = unsafe { std::ptr::read(local_addr_storage) };
+    let mut datagrams = Vec::new();
+    let mut owners = Vec::new();
+    for (index, slot) in slots.iter_mut().enumerate() {
+        for packet in slot.ingress.iter_mut() {
+            datagrams.push(picoquic_incoming_datagram_t {
+                bytes: packet.as_mut_ptr(),
+                length: packet.len(),
+                addr_from: &mut peer_storage as *mut _ as *mut libc::sockaddr,
+                addr_to: &mut local_storage as *mut _ as *mut libc::sockaddr,
+                first_cnx: std::ptr::null_mut(),
+                first_path_id: -1,
+            });
+            owners.push(index);
+        }
+    }
+    if datagrams.is_empty() {
+        return Ok(());
+    }
+    let ret = unsafe {
+        picoquic_incoming_packets(quic, datagrams.as_mut_ptr(), datagrams.len(), current_time)
+    };
+    if ret < 0 {
+        return Err(ServerError::new("Failed to process QUIC packet"));
+    }
+    for (datagram, &index) in datagrams.iter().zip(&owners) {
+        let slot = &mut slots[index];
+        if slot.cnx.is_null() && !datagram.first_cnx.is_null() {
+            slot.cnx = datagram.first_cnx;
+            slot.path_id = datagram.first_path_id;
+        }
+    }
+    slots.retain_mut(|slot| {
+        if slot.ingress.is_empty() {
+            return true;
+        }
+        let ingress = std::mem::take(&mut slot.ingress);
+        if !slot.cnx.is_null() {
+            unsafe {
+                slipstream_disable_ack_delay(slot.cnx);
+            }
+            return true;
+        }
+        match unsafe { take_stateless_packet_for_cid(quic, &ingress[0]) } {
+            Some(payload) if !payload.is_empty() => {
+                slot.payload_override = Some(payload);
+                slot.multi_answer = false;
+                true
+            }
+            _ => false,
+        }
+    });
+    Ok(())
+}
+
+/// Moves the slots whose lead packet is a client Initial to the back of
+/// `backlog`, keeping the order of both, and drops the oldest waiting past
+/// `max`. Returns how many were dropped.
+pub(crate) fn defer_handshakes(
+    slots: &mut Vec<Slot>,
+    backlog: &mut VecDeque<Slot>,
+    max: usize,
+) -> usize {
+    let opens_connection = |slot: &Slot| {
+        slot.ingress
+            .first()
+            .is_some_and(|packet| is_client_initial(packet))
+    };
+    if slots.iter().any(opens_connection) {
+        let mut kept = Vec::with_capacity(slots.len());
+        for slot in slots.drain(..) {
+            if opens_connection(&slot) {
+                backlog.push_back(slot);
+            } else {
+                kept.push(slot);
+            }
         }
+        *slots = kept;
     }
+    let dropped = backlog.len().saturating_sub(max);
+    backlog.drain(..dropped);
+    dropped
+}
+
+/// A QUIC v1 Initial: long header, fixed bit, packet type 0.
+fn is_client_initial(packet: &[u8]) -> bool {
+    packet.first().is_some_and(|&byte| byte & 0xf0 == 0xc0)
 }
 
 fn fallback_bind_addr(fallback_addr: SocketAddr) -> SocketAddr {
@@ -413,57 +648,105 @@ fn fallback_bind_addr(fallback_addr: SocketAddr) -> SocketAddr {
     }
 }
 
-async fn forward_fallback_replies(
-    proxy_socket: Arc<TokioUdpSocket>,
+fn millis_since(epoch: Instant) -> u64 {
+    epoch.elapsed().as_millis() as u64
+}
+
+/// Forwards fallback replies for one shard's sessions back through the main
+/// socket. Each wakeup drains every readable session socket with recvmmsg and
+/// sends its replies with one sendmmsg.
+async fn pump_fallback_replies(
     main_socket: Arc<TokioUdpSocket>,
-    client_addr: SocketAddr,
-    map_ipv4_peers: bool,
-    last_seen: Arc<Mutex<Instant>>,
-    mut shutdown_rx: watch::Receiver<bool>,
+    epoch: Instant,
+    mut commands: mpsc::UnboundedReceiver<PumpCommand>,
 ) {
-    let client_send_addr = if map_ipv4_peers {
-        normalize_dual_stack_addr(client_addr)
-    } else {
-        client_addr
-    };
-    let mut buf = vec![0u8; MAX_UDP_PACKET_SIZE];
+    let mut sessions: Vec<PumpSession> = Vec::new();
+    let mut ready: Vec<usize> = Vec::new();
+    let mut batch = RecvBatch::new(REPLY_BATCH_MAX, MAX_UDP_PACKET_SIZE);
     loop {
         tokio::select! {
-            recv = proxy_socket.recv(&mut buf) => {
-                match recv {
-                    Ok(size) => {
-                        if let Ok(mut last_seen) = last_seen.lock() {
-                            *last_seen = Instant::now();
-                        }
-                        if let Err(err) = main_socket.send_to(&buf[..size], client_send_addr).await {
-                            if !is_transient_udp_error(&err) {
-                                tracing::warn!(
-                                    "fallback write to client {} failed: {}",
-                                    client_addr,
-                                    err
-                                );
-                            }
-                        }
+            command = commands.recv() => {
+                match command {
+                    Some(PumpCommand::Add(session)) => sessions.push(session),
+                    Some(PumpCommand::Sweep) => {}
+                    None => break,
+                }
+                sessions.retain(|session| !session.state.is_closed());
+            }
+            _ = poll_fn(|cx| {
+                ready.clear();
+                for (index, session) in sessions.iter().enumerate() {
+                    if session.socket.poll_recv_ready(cx).is_ready() {
+                        ready.push(index);
                     }
-                    Err(err) => {
-                        if is_transient_udp_error(&err) {
-                            continue;
-                        }
-                        tracing::warn!(
-                            "fallback read for client {} failed: {}",
-                            client_addr,
-                            err
-                        );
-                        break;
+                }
+                if ready.is_empty() {
+                    Poll::Pending
+                } else {
+                    Poll::Ready(())
+                }
+            }) => {
+                for &index in &ready {
+                    let session = &sessions[index];
+                    if !forward_session_replies(&main_socket, session, &mut batch, epoch).await {
+                        session.state.close();
                     }
                 }
+                sessions.retain(|session| !session.state.is_closed());
+            }
+        }
+    }
+}
+
+/// Drains the replies queued on one session socket. Returns false once the
+/// socket has failed, so the session is recreated on the peer's next packet.
+async fn forward_session_replies(
+    main_socket: &TokioUdpSocket,
+    session: &PumpSession,
+    batch: &mut RecvBatch,
+    epoch: Instant,
+) -> bool {
+    loop {
+        match session
+            .socket
+            .try_io(Interest::READABLE, || recv_batch(&*session.socket, batch))
+        {
+            Ok(_) => {}
+            Err(err) if err.kind() == std::io::ErrorKind::WouldBlock => return true,
+            Err(err) => {
+                if is_transient_udp_error(&err) {
+                    continue;
+                }
+                tracing::warn!("fallback read for client {} failed: {}", session.peer, err);
+                return false;
             }
-            changed = shutdown_rx.changed() => {
-                if changed.is_err() || *shutdown_rx.borrow() {
-                    break;
+        }
+        session.state.touch(epoch);
+        let replies: Vec<(&[u8], SocketAddr)> = (0..batch.len())
+            .map(|index| (batch.get(index).0, session.send_addr))
+            .collect();
+        let mut sent = 0usize;
+        while sent < replies.len() {
+            match main_socket.try_io(Interest::WRITABLE, || {
+                send_batch(main_socket, &replies[sent..])
+            }) {
+                Ok(count) => sent += count,
+                Err(err) if err.kind() == std::io::ErrorKind::WouldBlock => {
+                    if main_socket.writable().await.is_err() {
+                        return true;
+                    }
+                }
+                Err(err) => {
+                    if !is_transient_udp_error(&err) {
+                        tracing::warn!("fallback write to client {} failed: {}", session.peer, err);
+                    }
+                    sent += 1;
                 }
             }
         }
+        if batch.len() < batch.capacity() {
+            return true;
+        }
     }
 }
 
@@ -543,13 +826,12 @@ mod tests {
             fallback_addr,
             false,
         ));
-        let domains = vec!["example.com"];
-        let local_addr_storage = dummy_sockaddr_storage();
+        let domains = DomainSet::new(&["example.com"]);
         let context = PacketContext {
             domains: &domains,
             quic: std::ptr::null_mut(),
-            current_time: 0,
-            local_addr_storage: &local_addr_storage,
+            shard: None,
+            tcp_reply: None,
         };
 
         let non_dns = b"nope";
@@ -597,12 +879,67 @@ mod tests {
             .expect("fallback receive timeout")
             .expect("fallback receive");
         assert_eq!(echoed, dns_packet);
+    }
 
-        if let Some(manager) = fallback_mgr.as_mut() {
-            for session in manager.sessions.values() {
-                let _ = session.shutdown_tx.send(true);
+    #[tokio::test]
+    async fn fallback_pumps_replies_for_many_peers() {
+        let main_socket = Arc::new(TokioUdpSocket::bind("127.0.0.1:0").await.unwrap());
+        let main_addr = main_socket.local_addr().unwrap();
+        let fallback_socket = Arc::new(TokioUdpSocket::bind("127.0.0.1:0").await.unwrap());
+        let fallback_addr = fallback_socket.local_addr().unwrap();
+        let (notify_tx, _notify_rx) = mpsc::unbounded_channel();
+        spawn_fallback_echo(fallback_socket, notify_tx);
+
+        let mut fallback_mgr = Some(FallbackManager::new(
+            main_socket.clone(),
+            fallback_addr,
+            false,
+        ));
+        let domains = DomainSet::new(&["example.com"]);
+        let context = PacketContext {
+            domains: &domains,
+            quic: std::ptr::null_mut(),
+            shard: None,
+            tcp_reply: None,
+        };
+
+        let mut clients = Vec::new();
+        for _ in 0..(FALLBACK_SHARDS * 2) {
+            clients.push(TokioUdpSocket::bind("127.0.0.1:0").await.unwrap());
+        }
+        let mut recv_buf = [0u8; 64];
+        for round in 0..2u8 {
+            for (index, client) in clients.iter().enumerate() {
+                client
+                    .send_to(&[round, index as u8], main_addr)
+                    .await
+                    .unwrap();
+                let (size, peer) = recv_with_timeout(&main_socket, &mut recv_buf).await;
+                let mut slots = Vec::new();
+                handle_packet(
+                    &mut slots,
+                    &recv_buf[..size],
+                    peer,
+                    &context,
+                    &mut fallback_mgr,
+                )
+                .await
+                .unwrap();
+            }
+            for (index, client) in clients.iter().enumerate() {
+                let mut client_buf = [0u8; 64];
+                let (size, _) = recv_with_timeout(client, &mut client_buf).await;
+                assert_eq!(&client_buf[..size], &[round, index as u8]);
             }
         }
+
+        let manager = fallback_mgr.as_ref().unwrap();
+        let sessions: usize = manager
+            .shards
+            .iter()
+            .map(|shard| shard.sessions.len())
+            .sum();
+        assert_eq!(sessions, clients.len());
     }
 
     #[tokio::test]
@@ -620,13 +957,12 @@ mod tests {
             fallback_addr,
             false,
         ));
-        let domains = vec!["example.com"];
-        let local_addr_storage = dummy_sockaddr_storage();
+        let domains = DomainSet::new(&["example.com"]);
         let context = PacketContext {
             domains: &domains,
             quic: std::ptr::null_mut(),
-            current_time: 0,
-            local_addr_storage: &local_addr_storage,
+            shard: None,
+            tcp_reply: None,
         };
 
         let qdcount_zero = build_empty_question_query();
@@ -655,12 +991,6 @@ mod tests {
             .expect("fallback receive timeout")
             .expect("fallback receive");
         assert_eq!(echoed, qdcount_zero);
-
-        if let Some(manager) = fallback_mgr.as_mut() {
-            for session in manager.sessions.values() {
-                let _ = session.shutdown_tx.send(true);
-            }
-        }
     }
 
     #[tokio::test]
@@ -678,13 +1008,12 @@ mod tests {
             fallback_addr,
             false,
         ));
-        let domains = vec!["example.com"];
-        let local_addr_storage = dummy_sockaddr_storage();
+        let domains = DomainSet::new(&["example.com"]);
         let context = PacketContext {
             domains: &domains,
             quic: std::ptr::null_mut(),
-            current_time: 0,
-            local_addr_storage: &local_addr_storage,
+            shard: None,
+            tcp_reply: None,
         };
 
         let dns_packet = build_dns_query("example.com");
@@ -703,7 +1032,8 @@ mod tests {
         .unwrap();
 
         if let Some(manager) = fallback_mgr.as_ref() {
-            assert!(manager.dns_peers.contains_key(&peer));
+            let shard = &manager.shards[manager.shard_index(peer)];
+            assert!(shard.dns_peers.contains_key(&peer));
         }
 
         let non_dns = b"nope";
@@ -742,12 +1072,6 @@ mod tests {
             .expect("fallback receive timeout")
             .expect("fallback receive");
         assert_eq!(echoed, non_dns);
-
-        if let Some(manager) = fallback_mgr.as_mut() {
-            for session in manager.sessions.values() {
-                let _ = session.shutdown_tx.send(true);
-            }
-        }
     }
 
     #[tokio::test]
@@ -760,18 +1084,18 @@ mod tests {
         let (notify_tx, mut notify_rx) = mpsc::unbounded_channel();
         spawn_fallback_echo(fallback_socket, notify_tx);
 
-        let mut fallback_mgr = Some(FallbackManager::new(
-            main_socket.clone(),
-            fallback_addr,
-            false,
-        ));
-        let domains = vec!["example.com"];
-        let local_addr_storage = dummy_sockaddr_storage();
+        let mut manager = FallbackManager::new(main_socket.clone(), fallback_addr, false);
+        // Stamps count from the epoch; start it early enough that 0 is idle.
+        manager.epoch = Instant::now()
+            .checked_sub(FALLBACK_IDLE_TIMEOUT * 2)
+            .expect("epoch");
+        let mut fallback_mgr = Some(manager);
+        let domains = DomainSet::new(&["example.com"]);
         let context = PacketContext {
             domains: &domains,
             quic: std::ptr::null_mut(),
-            current_time: 0,
-            local_addr_storage: &local_addr_storage,
+            shard: None,
+            tcp_reply: None,
         };
 
         let non_dns = b"nope";
@@ -796,11 +1120,9 @@ mod tests {
         assert_eq!(echoed, non_dns);
 
         if let Some(manager) = fallback_mgr.as_mut() {
-            if let Some(session) = manager.sessions.get(&peer) {
-                if let Ok(mut last_seen) = session.last_seen.lock() {
-                    *last_seen = Instant::now() - FALLBACK_IDLE_TIMEOUT - Duration::from_secs(1);
-                }
-            }
+            let shard = &manager.shards[manager.shard_index(peer)];
+            let session = shard.sessions.get(&peer).expect("fallback session");
+            session.state.last_seen_ms.store(0, Ordering::Relaxed);
         }
 
         let dns_packet = build_dns_query("example.com");
@@ -823,11 +1145,47 @@ mod tests {
                 .is_err(),
             "fallback endpoint should not see DNS query after idle"
         );
+    }
 
-        if let Some(manager) = fallback_mgr.as_mut() {
-            for session in manager.sessions.values() {
-                let _ = session.shutdown_tx.send(true);
-            }
+    fn slot_with(id: u16, lead: &[u8]) -> Slot {
+        Slot {
+            peer: SocketAddr::from(([127, 0, 0, 1], 53)),
+            id,
+            rd: false,
+            cd: false,
+            question: slipstream_dns::Question {
+                name: "example.com.".to_string(),
+                qtype: slipstream_dns::RR_TXT,
+                qclass: CLASS_IN,
+            },
+            rcode: None,
+            cnx: std::ptr::null_mut(),
+            path_id: -1,
+            payload_override: None,
+            answer_key: None,
+            multi_answer: false,
+            tcp_reply: None,
+            ingress: vec![lead.to_vec()],
         }
     }
+
+    #[test]
+    fn handshakes_wait_in_order_and_the_oldest_drop() {
+        let initial = [0xc3, 0, 0, 0, 1];
+        let short = [0x43, 1, 2, 3];
+        let mut backlog = VecDeque::new();
+        let mut slots = vec![slot_with(1, &initial), slot_with(2, &short)];
+        slots.push(slot_with(3, &initial));
+        slots.push(slot_with(4, &short));
+        assert_eq!(defer_handshakes(&mut slots, &mut backlog, 3), 0);
+        assert_eq!(slots.iter().map(|slot| slot.id).collect::<Vec<_>>(), [2, 4]);
+
+        let mut slots = vec![slot_with(5, &initial), slot_with(6, &initial)];
+        assert_eq!(defer_handshakes(&mut slots, &mut backlog, 3), 1);
+        assert!(slots.is_empty());
+        assert_eq!(
+            backlog.iter().map(|slot| slot.id).collect::<Vec<_>>(),
+            [3, 5, 6]
+        );
+    }
 }
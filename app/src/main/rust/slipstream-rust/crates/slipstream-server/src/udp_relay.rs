@@ -0,0 +1,306 @@
+use slipstream_core::datagram::{decode_uplink, encode_downlink, FLOW_ID_LEN};
+use slipstream_dns::truncated_reply;
+use slipstream_ffi::picoquic::{
+    picoquic_cnx_t, slipstream_datagram_max_payload, slipstream_queue_datagram,
+};
+use std::collections::HashMap;
+use std::net::{IpAddr, Ipv4Addr, Ipv6Addr, SocketAddr, UdpSocket};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use tokio::net::UdpSocket as TokioUdpSocket;
+use tokio::sync::mpsc;
+use tokio::task::JoinHandle;
+use tracing::debug;
+
+use crate::server::Command;
+
+/// Largest frame the server accepts; client payloads are far smaller, the
+/// limit only bounds the receive buffer picoquic hands over.
+pub(crate) const DATAGRAM_MAX_FRAME_SIZE: u32 = 1200;
+const MAX_FLOWS_PER_CONNECTION: usize = 256;
+const FLOW_IDLE_TIMEOUT: Duration = Duration::from_secs(60);
+const FLOW_CLEANUP_INTERVAL: Duration = Duration::from_secs(10);
+// Replies waiting in picoquic's datagram queue past this are dropped; they
+// would be stale by the time a poll carried them.
+const MAX_QUEUED_DATAGRAMS: usize = 64;
+const MAX_REPLY_SIZE: usize = 65535;
+const DNS_PORT: u16 = 53;
+
+struct RelayFlow {
+    socket: Arc<TokioUdpSocket>,
+    dest: SocketAddr,
+    last_active: Instant,
+    reply_task: JoinHandle<()>,
+}
+
+impl Drop for RelayFlow {
+    fn drop(&mut self) {
+        self.reply_task.abort();
+    }
+}
+
+/// UDP flows of connections that carry datagrams, each a socket connected to
+/// the flow's destination. Replies come back through the worker's command
+/// channel, so they are queued on the connection from the packet loop.
+pub(crate) struct UdpRelay {
+    flows: HashMap<(usize, u16), RelayFlow>,
+    flows_per_cnx: HashMap<usize, usize>,
+    command_tx: mpsc::UnboundedSender<Command>,
+    last_cleanup: Instant,
+    datagram_buf: Vec<u8>,
+}
+
+impl UdpRelay {
+    pub(crate) fn new(command_tx: mpsc::UnboundedSender<Command>) -> Self {
+        Self {
+            flows: HashMap::new(),
+            flows_per_cnx: HashMap::new(),
+            command_tx,
+            last_cleanup: Instant::now(),
+            datagram_buf: Vec::new(),
+        }
+    }
+
+    /// Sends one uplink datagram of `cnx` to its destination. Datagrams that
+    /// do not parse, go to a refused destination, or find the socket full
+    /// are dropped.
+    pub(crate) fn send(&mut self, cnx: usize, datagram: &[u8]) {
+        let Some((flow_id, dest, payload)) = decode_uplink(datagram) else {
+            return;
+        };
+        if !is_allowed_destination(dest.ip()) {
+            debug!("udp relay: refused destination {}", dest);
+            return;
+        }
+        self.forward(cnx, flow_id, dest, payload);
+    }
+
+    fn forward(&mut self, cnx: usize, flow_id: u16, dest: SocketAddr, payload: &[u8]) {
+        let key = (cnx, flow_id);
+        // A flow ID the client reused for another destination starts over.
+        if self.flows.get(&key).is_some_and(|flow| flow.dest != dest) {
+            self.remove_flow(key);
+        }
+        if !self.flows.contains_key(&key) {
+            if self.flows_per_cnx.get(&cnx).copied().unwrap_or(0) >= MAX_FLOWS_PER_CONNECTION {
+                return;
+            }
+            let socket = match connect_flow_socket(dest) {
+                Ok(socket) => Arc::new(socket),
+                Err(err) => {
+                    debug!("udp relay: cannot open flow to {}: {}", dest, err);
+                    return;
+                }
+            };
+            let reply_task = tokio::spawn(pump_replies(
+                socket.clone(),
+                cnx,
+                flow_id,
+                self.command_tx.clone(),
+            ));
+            self.flows.insert(
+                key,
+                RelayFlow {
+                    socket,
+                    dest,
+                    last_active: Instant::now(),
+                    reply_task,
+                },
+            );
+            *self.flows_per_cnx.entry(cnx).or_insert(0) += 1;
+        }
+        let flow = self.flows.get_mut(&key).expect("flow inserted");
+        flow.last_active = Instant::now();
+        // A full socket buffer drops the datagram, as the network would.
+        let _ = flow.socket.try_send(payload);
+    }
+
+    /// Queues a reply on its connection, unless the flow is gone, which
+    /// means the connection is too.
+    pub(crate) fn queue_reply(&mut self, cnx_id: usize, flow_id: u16, payload: &[u8]) {
+        let Some(flow) = self.flows.get_mut(&(cnx_id, flow_id)) else {
+            return;
+        };
+        flow.last_active = Instant::now();
+        let cnx = cnx_id as *mut picoquic_cnx_t;
+        let max_payload =
+            unsafe { slipstream_datagram_max_payload(cnx) }.saturating_sub(FLOW_ID_LEN);
+        let truncated;
+        let payload = if payload.len() <= max_payload {
+            payload
+        } else if flow.dest.port() == DNS_PORT {
+            // An answer too long for a datagram goes back truncated, so the
+            // resolver retries over TCP instead of timing out.
+            match truncated_reply(payload) {
+                Some(reply) if reply.len() <= max_payload => {
+                    truncated = reply;
+                    &truncated
+                }
+                _ => return,
+            }
+        } else {
+            return;
+        };
+        encode_downlink(flow_id, payload, &mut self.datagram_buf);
+        let _ = unsafe {
+            slipstream_queue_datagram(
+                cnx,
+                self.datagram_buf.as_ptr(),
+                self.datagram_buf.len(),
+                MAX_QUEUED_DATAGRAMS,
+            )
+        };
+    }
+
+    pub(crate) fn remove_connection(&mut self, cnx: usize) {
+        if self.flows_per_cnx.remove(&cnx).is_some() {
+            self.flows.retain(|key, _| key.0 != cnx);
+        }
+    }
+
+    pub(crate) fn cleanup(&mut self) {
+        let now = Instant::now();
+        if now.duration_since(self.last_cleanup) < FLOW_CLEANUP_INTERVAL {
+            return;
+        }
+        self.last_cleanup = now;
+        let idle: Vec<(usize, u16)> = self
+            .flows
+            .iter()
+            .filter(|(_, flow)| now.duration_since(flow.last_active) > FLOW_IDLE_TIMEOUT)
+            .map(|(key, _)| *key)
+            .collect();
+        for key in idle {
+            self.remove_flow(key);
+        }
+    }
+
+    pub(crate) fn clear(&mut self) {
+        self.flows.clear();
+        self.flows_per_cnx.clear();
+    }
+
+    fn remove_flow(&mut self, key: (usize, u16)) {
+        if self.flows.remove(&key).is_none() {
+            return;
+        }
+        if let Some(count) = self.flows_per_cnx.get_mut(&key.0) {
+            *count -= 1;
+            if *count == 0 {
+                self.flows_per_cnx.remove(&key.0);
+            }
+        }
+    }
+
+    #[cfg(test)]
+    fn flow_count(&self) -> usize {
+        self.flows.len()
+    }
+}
+
+/// The relay reaches the Internet for clients; it never reaches the server
+/// itself or sends to group addresses.
+fn is_allowed_destination(ip: IpAddr) -> bool {
+    let ip = match ip {
+        IpAddr::V6(v6) => match v6.to_ipv4_mapped() {
+            Some(v4) => IpAddr::V4(v4),
+            None => IpAddr::V6(v6),
+        },
+        ip => ip,
+    };
+    match ip {
+        IpAddr::V4(v4) => {
+            !(v4.is_loopback() || v4.is_unspecified() || v4.is_multicast() || v4.is_broadcast())
+        }
+        IpAddr::V6(v6) => !(v6.is_loopback() || v6.is_unspecified() || v6.is_multicast()),
+    }
+}
+
+fn connect_flow_socket(dest: SocketAddr) -> std::io::Result<TokioUdpSocket> {
+    let bind_addr = match dest {
+        SocketAddr::V4(_) => SocketAddr::new(IpAddr::V4(Ipv4Addr::UNSPECIFIED), 0),
+        SocketAddr::V6(_) => SocketAddr::new(IpAddr::V6(Ipv6Addr::UNSPECIFIED), 0),
+    };
+    let socket = UdpSocket::bind(bind_addr)?;
+    socket.connect(dest)?;
+    socket.set_nonblocking(true)?;
+    TokioUdpSocket::from_std(socket)
+}
+
+async fn pump_replies(
+    socket: Arc<TokioUdpSocket>,
+    cnx_id: usize,
+    flow_id: u16,
+    command_tx: mpsc::UnboundedSender<Command>,
+) {
+    let mut buf = vec![0u8; MAX_REPLY_SIZE];
+    loop {
+        let len = match socket.recv(&mut buf).await {
+            Ok(len) => len,
+            // ICMP errors surface here on connected sockets; the flow stays
+            // until it idles out.
+            Err(_) => continue,
+        };
+        let command = Command::DatagramReply {
+            cnx_id,
+            flow_id,
+            payload: buf[..len].to_vec(),
+        };
+        if command_tx.send(command).is_err() {
+            return;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn refuses_local_and_group_destinations() {
+        for ip in [
+            "127.0.0.1",
+            "0.0.0.0",
+            "224.0.0.1",
+            "255.255.255.255",
+            "::1",
+            "::ffff:127.0.0.1",
+            "ff02::1",
+        ] {
+            assert!(!is_allowed_destination(ip.parse().unwrap()), "{ip}");
+        }
+        for ip in ["8.8.8.8", "10.0.0.1", "2001:4860:4860::8888"] {
+            assert!(is_allowed_destination(ip.parse().unwrap()), "{ip}");
+        }
+    }
+
+    #[tokio::test]
+    async fn relays_to_the_destination_and_back() {
+        let echo = TokioUdpSocket::bind("127.0.0.1:0").await.unwrap();
+        let addr = echo.local_addr().unwrap();
+        let (command_tx, mut command_rx) = mpsc::unbounded_channel();
+        let mut relay = UdpRelay::new(command_tx);
+
+        // Loopback is refused by send(), so hand the datagram on past it.
+        relay.forward(1, 9, addr, b"ping");
+        let mut buf = [0u8; 16];
+        let (len, from) = echo.recv_from(&mut buf).await.unwrap();
+        assert_eq!(&buf[..len], b"ping");
+
+        echo.send_to(b"pong", from).await.unwrap();
+        match command_rx.recv().await {
+            Some(Command::DatagramReply {
+                cnx_id,
+                flow_id,
+                payload,
+            }) => {
+                assert_eq!((cnx_id, flow_id), (1, 9));
+                assert_eq!(payload, b"pong");
+            }
+            _ => panic!("expected a datagram reply"),
+        }
+
+        relay.remove_connection(1);
+        assert_eq!(relay.flow_count(), 0);
+    }
+}
@@ -0,0 +1,84 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)"
+CERT_DIR="${CERT_DIR:-"${ROOT_DIR}/fixtures/certs"}"
+
+DNS_LISTEN_PORT="${DNS_LISTEN_PORT:-8853}"
+DOMAIN="${DOMAIN:-test.com}"
+CONNECTIONS="${CONNECTIONS:-1000 5000 10000 50000}"
+RAMP_PER_SEC="${RAMP_PER_SEC:-2000}"
+POLL_INTERVAL_MS="${POLL_INTERVAL_MS:-1000}"
+CONNECT_TIMEOUT_SECS="${CONNECT_TIMEOUT_SECS:-120}"
+WARMUP_SECS="${WARMUP_SECS:-2}"
+DURATION_SECS="${DURATION_SECS:-10}"
+WORKERS="${WORKERS:-1}"
+SERVER_ARGS="${SERVER_ARGS:-}"
+LABEL="${LABEL:-$(git -C "${ROOT_DIR}" rev-parse --short HEAD 2>/dev/null || echo unknown)}"
+
+RUN_DIR="${RUN_DIR:-"${ROOT_DIR}/.interop/bench-conn-scaling-$(date +%Y%m%d_%H%M%S)"}"
+CSV="${CSV:-${RUN_DIR}/conn_scaling.csv}"
+
+server_extra_args=()
+if [[ -n "${SERVER_ARGS}" ]]; then
+  read -r -a server_extra_args <<< "${SERVER_ARGS}"
+fi
+
+if [[ ! -f "${CERT_DIR}/cert.pem" || ! -f "${CERT_DIR}/key.pem" ]]; then
+  echo "Missing test certs in ${CERT_DIR}. Set CERT_DIR to override." >&2
+  exit 1
+fi
+
+mkdir -p "${RUN_DIR}" "$(dirname "${CSV}")"
+
+cleanup() {
+  if [[ -n "${SERVER_PID:-}" ]] && kill -0 "${SERVER_PID}" 2>/dev/null; then
+    kill "${SERVER_PID}" 2>/dev/null || true
+    wait "${SERVER_PID}" 2>/dev/null || true
+  fi
+  SERVER_PID=""
+}
+trap cleanup EXIT INT TERM HUP
+
+cargo build -p slipstream-server -p slipstream-client --release \
+  --bin slipstream-server --bin bench_connections
+
+for count in ${CONNECTIONS}; do
+  echo "Running ${count} connections..."
+  # A fresh server per step, so its RSS starts from the same baseline and no
+  # connections are left over from the previous step.
+  "${ROOT_DIR}/target/release/slipstream-server" \
+    --dns-listen-port "${DNS_LISTEN_PORT}" \
+    --domain "${DOMAIN}" \
+    --cert "${CERT_DIR}/cert.pem" \
+    --key "${CERT_DIR}/key.pem" \
+    --max-connections "$((count + count / 10 + 16))" \
+    --workers "${WORKERS}" \
+    --target-pool 0 \
+    "${server_extra_args[@]}" \
+    >"${RUN_DIR}/server-${count}.log" 2>&1 &
+  SERVER_PID=$!
+  sleep 1
+  if ! kill -0 "${SERVER_PID}" 2>/dev/null; then
+    echo "Server exited early; see ${RUN_DIR}/server-${count}.log" >&2
+    exit 1
+  fi
+
+  "${ROOT_DIR}/target/release/bench_connections" \
+    --server="127.0.0.1:${DNS_LISTEN_PORT}" \
+    --domain="${DOMAIN}" \
+    --connections="${count}" \
+    --ramp-per-sec="${RAMP_PER_SEC}" \
+    --poll-interval-ms="${POLL_INTERVAL_MS}" \
+    --connect-timeout-secs="${CONNECT_TIMEOUT_SECS}" \
+    --warmup-secs="${WARMUP_SECS}" \
+    --duration-secs="${DURATION_SECS}" \
+    --server-pid="${SERVER_PID}" \
+    --csv="${CSV}" \
+    --label="${LABEL}" \
+    2>"${RUN_DIR}/bench-${count}.log"
+  cleanup
+  tail -n 1 "${CSV}"
+done
+
+echo "conn scaling csv: ${CSV}"
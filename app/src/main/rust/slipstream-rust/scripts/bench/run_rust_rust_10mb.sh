@@ -16,6 +16,7 @@ DOMAIN="${DOMAIN:-test.com}"
 SOCKET_TIMEOUT="${SOCKET_TIMEOUT:-}"
 TRANSFER_BYTES="${TRANSFER_BYTES:-10485760}"
 CHUNK_SIZE="${CHUNK_SIZE:-16384}"
+STREAMS="${STREAMS:-1}"
 PREFACE_BYTES="${PREFACE_BYTES:-1}"
 RUNS="${RUNS:-1}"
 RUN_EXFIL="${RUN_EXFIL:-1}"
@@ -390,6 +391,7 @@ start_target() {
     --bytes "${TRANSFER_BYTES}"
     --chunk-size "${CHUNK_SIZE}"
     --timeout "${SOCKET_TIMEOUT}"
+    --streams "${STREAMS}"
     --log "${target_json}"
   )
   if [[ "${preface_bytes}" -gt 0 ]]; then
@@ -424,6 +426,7 @@ run_bench_client() {
     --bytes "${TRANSFER_BYTES}"
     --chunk-size "${CHUNK_SIZE}"
     --timeout "${SOCKET_TIMEOUT}"
+    --streams "${STREAMS}"
     --log "${bench_json}"
   )
   if [[ "${preface_bytes}" -gt 0 ]]; then
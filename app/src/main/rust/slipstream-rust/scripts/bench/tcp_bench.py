@@ -3,6 +3,7 @@ import argparse
 import json
 import socket
 import sys
+import threading
 import time
 
 
@@ -40,6 +41,81 @@ def summarize(label: str, total: int, elapsed: float) -> None:
     print(f"{label}: bytes={total} secs={elapsed:.3f} MiB/s={mib_s:.2f}")
 
 
+def split_bytes(total: int, streams: int):
+    share, extra = divmod(total, streams)
+    return [share + (1 if index < extra else 0) for index in range(streams)]
+
+
+def run_streams(worker, items):
+    """Runs worker over items on one thread each; returns results in order."""
+    results = [None] * len(items)
+    errors = []
+
+    def run(index, item):
+        try:
+            results[index] = worker(item)
+        except Exception as err:  # noqa: BLE001 - reported below
+            errors.append(err)
+
+    threads = [threading.Thread(target=run, args=(index, item)) for index, item in enumerate(items)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    if errors:
+        raise errors[0]
+    return results
+
+
+def merge_results(results):
+    """Totals per-stream (bytes, start, first_ts, last_ts) over all streams."""
+    total = sum(result[0] for result in results)
+    starts = [result[1] for result in results if result[1] is not None]
+    firsts = [result[2] for result in results if result[2] is not None]
+    lasts = [result[3] for result in results if result[3] is not None]
+    start = min(starts) if starts else None
+    elapsed = time.perf_counter() - start if start is not None else 0.0
+    return total, elapsed, min(firsts) if firsts else None, max(lasts) if lasts else None
+
+
+def serve_stream(conn, args: argparse.Namespace, nbytes: int):
+    total = 0
+    start = None
+    first_payload_ts = None
+    last_payload_ts = None
+    if args.mode == "sink":
+        while True:
+            data = conn.recv(args.chunk_size)
+            if not data:
+                break
+            if first_payload_ts is None:
+                first_payload_ts = time.time()
+                start = time.perf_counter()
+            total += len(data)
+            last_payload_ts = time.time()
+            if nbytes and total >= nbytes:
+                break
+    else:
+        remaining_preface = args.preface_bytes
+        while remaining_preface > 0:
+            data = conn.recv(min(args.chunk_size, remaining_preface))
+            if not data:
+                break
+            remaining_preface -= len(data)
+        remaining = nbytes
+        chunk = b"a" * args.chunk_size
+        while remaining > 0:
+            send_len = args.chunk_size if remaining > args.chunk_size else remaining
+            if first_payload_ts is None:
+                first_payload_ts = time.time()
+                start = time.perf_counter()
+            conn.sendall(chunk[:send_len])
+            last_payload_ts = time.time()
+            remaining -= send_len
+        total = nbytes
+    return total, start, first_payload_ts, last_payload_ts
+
+
 def run_server(args: argparse.Namespace) -> int:
     host, port = parse_hostport(args.listen)
     log_fp = open_log(args.log)
@@ -50,46 +126,19 @@ def run_server(args: argparse.Namespace) -> int:
     with socket.create_server((host, port)) as server:
         server.settimeout(args.timeout)
         log_event(log_fp, {"ts": time.time(), "event": "listening", "listen": args.listen, "mode": mode})
-        conn, addr = server.accept()
-        with conn:
+        conns = []
+        for _ in range(args.streams):
+            conn, addr = server.accept()
             conn.settimeout(args.timeout)
             peer = f"{addr[0]}:{addr[1]}"
             log_event(log_fp, {"ts": time.time(), "event": "accept", "peer": peer, "mode": mode})
-            total = 0
-            start = None
-            first_payload_ts = None
-            last_payload_ts = None
-            if mode == "sink":
-                while True:
-                    data = conn.recv(args.chunk_size)
-                    if not data:
-                        break
-                    if first_payload_ts is None:
-                        first_payload_ts = time.time()
-                        start = time.perf_counter()
-                    total += len(data)
-                    last_payload_ts = time.time()
-                    if args.bytes and total >= args.bytes:
-                        break
-            else:
-                remaining_preface = args.preface_bytes
-                while remaining_preface > 0:
-                    data = conn.recv(min(args.chunk_size, remaining_preface))
-                    if not data:
-                        break
-                    remaining_preface -= len(data)
-                remaining = args.bytes
-                chunk = b"a" * args.chunk_size
-                while remaining > 0:
-                    send_len = args.chunk_size if remaining > args.chunk_size else remaining
-                    if first_payload_ts is None:
-                        first_payload_ts = time.time()
-                        start = time.perf_counter()
-                    conn.sendall(chunk[:send_len])
-                    last_payload_ts = time.time()
-                    remaining -= send_len
-                total = args.bytes
-            elapsed = time.perf_counter() - start if start is not None else 0.0
+            conns.append(conn)
+        try:
+            results = run_streams(
+                lambda item: serve_stream(item[0], args, item[1]),
+                list(zip(conns, split_bytes(args.bytes, args.streams))),
+            )
+            total, elapsed, first_payload_ts, last_payload_ts = merge_results(results)
             log_event(
                 log_fp,
                 {
@@ -105,6 +154,9 @@ def run_server(args: argparse.Namespace) -> int:
             summarize(f"server {mode}", total, elapsed)
             if mode == "source" and args.linger_secs > 0:
                 time.sleep(args.linger_secs)
+        finally:
+            for conn in conns:
+                conn.close()
 
     if log_fp is not sys.stdout:
         log_fp.close()
@@ -114,22 +166,16 @@ def run_server(args: argparse.Namespace) -> int:
     return 0
 
 
-def run_client(args: argparse.Namespace) -> int:
+def client_stream(args: argparse.Namespace, nbytes: int):
     host, port = parse_hostport(args.connect)
-    log_fp = open_log(args.log)
-    mode = args.mode
-    if mode not in ("send", "recv"):
-        raise ValueError("mode must be send or recv")
-
     with socket.create_connection((host, port), timeout=args.timeout) as sock:
         sock.settimeout(args.timeout)
-        log_event(log_fp, {"ts": time.time(), "event": "connect", "peer": args.connect, "mode": mode})
         total = 0
         start = None
         first_payload_ts = None
         last_payload_ts = None
-        if mode == "send":
-            remaining = args.bytes
+        if args.mode == "send":
+            remaining = nbytes
             chunk = b"b" * args.chunk_size
             while remaining > 0:
                 send_len = args.chunk_size if remaining > args.chunk_size else remaining
@@ -139,7 +185,10 @@ def run_client(args: argparse.Namespace) -> int:
                 sock.sendall(chunk[:send_len])
                 last_payload_ts = time.time()
                 remaining -= send_len
-            total = args.bytes
+            total = nbytes
+            if args.linger_secs > 0:
+                time.sleep(args.linger_secs)
+            sock.shutdown(socket.SHUT_WR)
         else:
             if args.preface_bytes:
                 remaining = args.preface_bytes
@@ -157,26 +206,36 @@ def run_client(args: argparse.Namespace) -> int:
                     start = time.perf_counter()
                 total += len(data)
                 last_payload_ts = time.time()
-                if args.bytes and total >= args.bytes:
+                if nbytes and total >= nbytes:
                     break
-        elapsed = time.perf_counter() - start if start is not None else 0.0
-        log_event(
-            log_fp,
-            {
-                "ts": time.time(),
-                "event": "done",
-                "mode": mode,
-                "bytes": total,
-                "secs": elapsed,
-                "first_payload_ts": first_payload_ts,
-                "last_payload_ts": last_payload_ts,
-            },
-        )
-        summarize(f"client {mode}", total, elapsed)
-        if mode == "send":
-            if args.linger_secs > 0:
-                time.sleep(args.linger_secs)
-            sock.shutdown(socket.SHUT_WR)
+    return total, start, first_payload_ts, last_payload_ts
+
+
+def run_client(args: argparse.Namespace) -> int:
+    log_fp = open_log(args.log)
+    mode = args.mode
+    if mode not in ("send", "recv"):
+        raise ValueError("mode must be send or recv")
+
+    log_event(log_fp, {"ts": time.time(), "event": "connect", "peer": args.connect, "mode": mode})
+    results = run_streams(
+        lambda nbytes: client_stream(args, nbytes),
+        split_bytes(args.bytes, args.streams),
+    )
+    total, elapsed, first_payload_ts, last_payload_ts = merge_results(results)
+    log_event(
+        log_fp,
+        {
+            "ts": time.time(),
+            "event": "done",
+            "mode": mode,
+            "bytes": total,
+            "secs": elapsed,
+            "first_payload_ts": first_payload_ts,
+            "last_payload_ts": last_payload_ts,
+        },
+    )
+    summarize(f"client {mode}", total, elapsed)
 
     if log_fp is not sys.stdout:
         log_fp.close()
@@ -198,6 +257,7 @@ def main() -> int:
     server_parser.add_argument("--timeout", type=float, default=30)
     server_parser.add_argument("--preface-bytes", type=int, default=0)
     server_parser.add_argument("--linger-secs", type=float, default=0)
+    server_parser.add_argument("--streams", type=int, default=1, help="connections to accept; --bytes is split over them")
     server_parser.add_argument("--log", default="-", help="log file path (default: stdout)")
 
     client_parser = subparsers.add_parser("client", help="run send/recv client")
@@ -208,6 +268,7 @@ def main() -> int:
     client_parser.add_argument("--timeout", type=float, default=30)
     client_parser.add_argument("--preface-bytes", type=int, default=0)
     client_parser.add_argument("--linger-secs", type=float, default=0)
+    client_parser.add_argument("--streams", type=int, default=1, help="parallel connections; --bytes is split over them")
     client_parser.add_argument("--log", default="-", help="log file path (default: stdout)")
 
     args = parser.parse_args()
@@ -25,12 +25,12 @@ if [[ -n "${CARGO_FEATURE_PICOQUIC_MINIMAL_BUILD:-}" ]]; then
     1|true|yes|on)
       CMAKE_ARGS+=(
         "-DBUILD_DEMO=OFF"
-        "-DBUILD_HTTP=OFF"
         "-DBUILD_LOGLIB=OFF"
         "-DBUILD_LOGREADER=OFF"
         "-Dpicoquic_BUILD_TESTS=OFF"
       )
-      BUILD_TARGET=(--target picoquic-core)
+      # picohttp-core carries h3zero for the DNS over HTTP/3 resolver.
+      BUILD_TARGET=(--target picoquic-core --target picohttp-core)
       ;;
   esac
 fi